@@ -131,6 +131,8 @@ slowCallPattern :: [ArgRep] -> (FastString, RepArity)
 --
 -- In 99% of cases this function will match *all* the arguments in one batch
 
+slowCallPattern (P: P: P: P: P: P: P: P: _) = (fsLit "stg_ap_pppppppp", 8)
+slowCallPattern (P: P: P: P: P: P: P: _) = (fsLit "stg_ap_ppppppp", 7)
 slowCallPattern (P: P: P: P: P: P: _) = (fsLit "stg_ap_pppppp", 6)
 slowCallPattern (P: P: P: P: P: _)    = (fsLit "stg_ap_ppppp", 5)
 slowCallPattern (P: P: P: P: _)       = (fsLit "stg_ap_pppp", 4)
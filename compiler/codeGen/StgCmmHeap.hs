@@ -208,11 +208,12 @@ mkStaticClosureFields dflags info_tbl ccs caf_refs payload
         | otherwise  = []
 
         -- For a static constructor which has NoCafRefs, we set the
-        -- static link field to a non-zero value so the garbage
-        -- collector will ignore it.
+        -- static link field to 3 (STATIC_FLAG_LIST) so the garbage
+        -- collector will ignore it; see Note [STATIC_LINK fields] in
+        -- rts/sm/Storage.h.
     static_link_value
         | mayHaveCafRefs caf_refs  = mkIntCLit dflags 0
-        | otherwise                = mkIntCLit dflags 1  -- No CAF refs
+        | otherwise                = mkIntCLit dflags 3  -- No CAF refs
 
 
 mkStaticClosure :: DynFlags -> CLabel -> CostCentreStack -> [CmmLit]
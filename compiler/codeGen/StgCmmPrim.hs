@@ -757,23 +757,42 @@ emitPrimOp _ [] PrefetchValueOp0            args = doPrefetchValueOp 0 args
 
 -- Atomic read-modify-write
 emitPrimOp dflags [res] FetchAddByteArrayOp_Int [mba, ix, n] =
-    doAtomicRMW res AMO_Add mba ix (bWord dflags) n
+    doAtomicRMW (arrWordsHdrSize dflags) res AMO_Add mba ix (bWord dflags) n
 emitPrimOp dflags [res] FetchSubByteArrayOp_Int [mba, ix, n] =
-    doAtomicRMW res AMO_Sub mba ix (bWord dflags) n
+    doAtomicRMW (arrWordsHdrSize dflags) res AMO_Sub mba ix (bWord dflags) n
 emitPrimOp dflags [res] FetchAndByteArrayOp_Int [mba, ix, n] =
-    doAtomicRMW res AMO_And mba ix (bWord dflags) n
+    doAtomicRMW (arrWordsHdrSize dflags) res AMO_And mba ix (bWord dflags) n
 emitPrimOp dflags [res] FetchNandByteArrayOp_Int [mba, ix, n] =
-    doAtomicRMW res AMO_Nand mba ix (bWord dflags) n
+    doAtomicRMW (arrWordsHdrSize dflags) res AMO_Nand mba ix (bWord dflags) n
 emitPrimOp dflags [res] FetchOrByteArrayOp_Int [mba, ix, n] =
-    doAtomicRMW res AMO_Or mba ix (bWord dflags) n
+    doAtomicRMW (arrWordsHdrSize dflags) res AMO_Or mba ix (bWord dflags) n
 emitPrimOp dflags [res] FetchXorByteArrayOp_Int [mba, ix, n] =
-    doAtomicRMW res AMO_Xor mba ix (bWord dflags) n
+    doAtomicRMW (arrWordsHdrSize dflags) res AMO_Xor mba ix (bWord dflags) n
 emitPrimOp dflags [res] AtomicReadByteArrayOp_Int [mba, ix] =
-    doAtomicReadByteArray res mba ix (bWord dflags)
+    doAtomicRead (arrWordsHdrSize dflags) res mba ix (bWord dflags)
 emitPrimOp dflags [] AtomicWriteByteArrayOp_Int [mba, ix, val] =
-    doAtomicWriteByteArray mba ix (bWord dflags) val
+    doAtomicWrite (arrWordsHdrSize dflags) mba ix (bWord dflags) val
 emitPrimOp dflags [res] CasByteArrayOp_Int [mba, ix, old, new] =
-    doCasByteArray res mba ix (bWord dflags) old new
+    doCas (arrWordsHdrSize dflags) res mba ix (bWord dflags) old new
+
+emitPrimOp dflags [res] FetchAddOffAddrOp_Int [addr, ix, n] =
+    doAtomicRMW 0 res AMO_Add addr ix (bWord dflags) n
+emitPrimOp dflags [res] FetchSubOffAddrOp_Int [addr, ix, n] =
+    doAtomicRMW 0 res AMO_Sub addr ix (bWord dflags) n
+emitPrimOp dflags [res] FetchAndOffAddrOp_Int [addr, ix, n] =
+    doAtomicRMW 0 res AMO_And addr ix (bWord dflags) n
+emitPrimOp dflags [res] FetchNandOffAddrOp_Int [addr, ix, n] =
+    doAtomicRMW 0 res AMO_Nand addr ix (bWord dflags) n
+emitPrimOp dflags [res] FetchOrOffAddrOp_Int [addr, ix, n] =
+    doAtomicRMW 0 res AMO_Or addr ix (bWord dflags) n
+emitPrimOp dflags [res] FetchXorOffAddrOp_Int [addr, ix, n] =
+    doAtomicRMW 0 res AMO_Xor addr ix (bWord dflags) n
+emitPrimOp dflags [res] AtomicReadOffAddrOp_Int [addr, ix] =
+    doAtomicRead 0 res addr ix (bWord dflags)
+emitPrimOp dflags [] AtomicWriteOffAddrOp_Int [addr, ix, val] =
+    doAtomicWrite 0 addr ix (bWord dflags) val
+emitPrimOp dflags [res] CasOffAddrOp_Int [addr, ix, old, new] =
+    doCas 0 res addr ix (bWord dflags) old new
 
 -- The rest just translate straightforwardly
 emitPrimOp dflags [res] op [arg]
@@ -2025,73 +2044,74 @@ doWriteSmallPtrArrayOp addr idx val = do
 ------------------------------------------------------------------------------
 -- Atomic read-modify-write
 
--- | Emit an atomic modification to a byte array element. The result
--- reg contains that previous value of the element. Implies a full
--- memory barrier.
-doAtomicRMW :: LocalReg      -- ^ Result reg
+-- | Emit an atomic modification to a byte array element, or to an
+-- 'Addr#' element when the initial offset is 0. The result reg
+-- contains that previous value of the element. Implies a full memory
+-- barrier.
+doAtomicRMW :: ByteOff       -- ^ Initial offset in bytes
+            -> LocalReg      -- ^ Result reg
             -> AtomicMachOp  -- ^ Atomic op (e.g. add)
-            -> CmmExpr       -- ^ MutableByteArray#
+            -> CmmExpr       -- ^ MutableByteArray# or Addr#
             -> CmmExpr       -- ^ Index
             -> CmmType       -- ^ Type of element by which we are indexing
             -> CmmExpr       -- ^ Op argument (e.g. amount to add)
             -> FCode ()
-doAtomicRMW res amop mba idx idx_ty n = do
+doAtomicRMW off res amop base idx idx_ty n = do
     dflags <- getDynFlags
     let width = typeWidth idx_ty
-        addr  = cmmIndexOffExpr dflags (arrWordsHdrSize dflags)
-                width mba idx
+        addr  = cmmIndexOffExpr dflags off width base idx
     emitPrimCall
         [ res ]
         (MO_AtomicRMW width amop)
         [ addr, n ]
 
--- | Emit an atomic read to a byte array that acts as a memory barrier.
-doAtomicReadByteArray
-    :: LocalReg  -- ^ Result reg
-    -> CmmExpr   -- ^ MutableByteArray#
+-- | Emit an atomic read that acts as a memory barrier.
+doAtomicRead
+    :: ByteOff   -- ^ Initial offset in bytes
+    -> LocalReg  -- ^ Result reg
+    -> CmmExpr   -- ^ MutableByteArray# or Addr#
     -> CmmExpr   -- ^ Index
     -> CmmType   -- ^ Type of element by which we are indexing
     -> FCode ()
-doAtomicReadByteArray res mba idx idx_ty = do
+doAtomicRead off res base idx idx_ty = do
     dflags <- getDynFlags
     let width = typeWidth idx_ty
-        addr  = cmmIndexOffExpr dflags (arrWordsHdrSize dflags)
-                width mba idx
+        addr  = cmmIndexOffExpr dflags off width base idx
     emitPrimCall
         [ res ]
         (MO_AtomicRead width)
         [ addr ]
 
--- | Emit an atomic write to a byte array that acts as a memory barrier.
-doAtomicWriteByteArray
-    :: CmmExpr   -- ^ MutableByteArray#
+-- | Emit an atomic write that acts as a memory barrier.
+doAtomicWrite
+    :: ByteOff   -- ^ Initial offset in bytes
+    -> CmmExpr   -- ^ MutableByteArray# or Addr#
     -> CmmExpr   -- ^ Index
     -> CmmType   -- ^ Type of element by which we are indexing
     -> CmmExpr   -- ^ Value to write
     -> FCode ()
-doAtomicWriteByteArray mba idx idx_ty val = do
+doAtomicWrite off base idx idx_ty val = do
     dflags <- getDynFlags
     let width = typeWidth idx_ty
-        addr  = cmmIndexOffExpr dflags (arrWordsHdrSize dflags)
-                width mba idx
+        addr  = cmmIndexOffExpr dflags off width base idx
     emitPrimCall
         [ {- no results -} ]
         (MO_AtomicWrite width)
         [ addr, val ]
 
-doCasByteArray
-    :: LocalReg  -- ^ Result reg
-    -> CmmExpr   -- ^ MutableByteArray#
+doCas
+    :: ByteOff   -- ^ Initial offset in bytes
+    -> LocalReg  -- ^ Result reg
+    -> CmmExpr   -- ^ MutableByteArray# or Addr#
     -> CmmExpr   -- ^ Index
     -> CmmType   -- ^ Type of element by which we are indexing
     -> CmmExpr   -- ^ Old value
     -> CmmExpr   -- ^ New value
     -> FCode ()
-doCasByteArray res mba idx idx_ty old new = do
+doCas off res base idx idx_ty old new = do
     dflags <- getDynFlags
     let width = (typeWidth idx_ty)
-        addr = cmmIndexOffExpr dflags (arrWordsHdrSize dflags)
-               width mba idx
+        addr = cmmIndexOffExpr dflags off width base idx
     emitPrimCall
         [ res ]
         (MO_Cmpxchg width)
@@ -199,6 +199,9 @@ mkProtoBCO dflags nm instrs_ordlist origin arity bitmap_size bitmap is_ret mallo
            = PUSH_LLL off1 (off2-1) (off3-2) : peep rest
         peep (PUSH_L off1 : PUSH_L off2 : rest)
            = PUSH_LL off1 (off2-1) : peep rest
+        -- the end of every tail call and constructor return
+        peep (SLIDE n by : ENTER : rest)
+           = SLIDE_ENTER n by : peep rest
         peep (i:rest)
            = i : peep rest
         peep []
@@ -138,6 +138,7 @@ data BCInstr
 
    -- To Infinity And Beyond
    | ENTER
+   | SLIDE_ENTER Word16 Word16 -- SLIDE, then ENTER
    | RETURN             -- return a lifted value
    | RETURN_UBX ArgRep -- return an unlifted value, here's its rep
 
@@ -256,6 +257,7 @@ instance Outputable BCInstr where
    ppr (SWIZZLE stkoff n)    = text "SWIZZLE " <+> text "stkoff" <+> ppr stkoff
                                                <+> text "by" <+> ppr n
    ppr ENTER                 = text "ENTER"
+   ppr (SLIDE_ENTER n d)     = text "SLIDE_ENTER" <+> ppr n <+> ppr d
    ppr RETURN                = text "RETURN"
    ppr (RETURN_UBX pk)       = text "RETURN_UBX  " <+> ppr pk
    ppr (BRK_FUN _breakArray index info) = text "BRK_FUN" <+> text "<array>" <+> ppr index <+> ppr info
@@ -313,6 +315,7 @@ bciStackUse TESTEQ_P{}            = 0
 bciStackUse CASEFAIL{}            = 0
 bciStackUse JMP{}                 = 0
 bciStackUse ENTER{}               = 0
+bciStackUse SLIDE_ENTER{}         = 0
 bciStackUse RETURN{}              = 0
 bciStackUse RETURN_UBX{}          = 1
 bciStackUse CCALL{}               = 0
@@ -966,11 +966,23 @@ lineCommentToken span buf len = do
 {-
   nested comments require traversing by hand, they can't be parsed
   using regular expressions.
+
+  Unless we are keeping the comments as tokens, we don't need the text
+  of the comment, and skipNestedComment skips it much faster than going
+  through it a character at a time.
 -}
 nested_comment :: P (RealLocated Token) -> Action
 nested_comment cont span buf len = do
-  input <- getInput
-  go (reverse $ drop 2 $ lexemeToString buf len) (1::Int) input
+  input@(AI loc s) <- getInput
+  b <- extension rawTokenStreamEnabled
+  if b
+    then go (reverse $ drop 2 $ lexemeToString buf len) (1::Int) input
+    else case skipNestedComment 1 s (srcLocLine loc) (srcLocCol loc) of
+      (closed, s', line, col) -> do
+        let input' = AI (mkRealSrcLoc (srcLocFile loc) line col) s'
+        if closed
+          then setInput input' >> cont
+          else errBrace input' span
   where
     go commentAcc 0 input = do
       setInput input
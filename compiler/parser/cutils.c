@@ -30,6 +30,143 @@ ghc_memcmp( HsPtr a1, HsPtr a2, HsInt len )
     return (memcmp((char *)a1, a2, len));
 }
 
+/*
+Scanning UTF-8 source text for the lexer, see Encoding.countUTF8Chars and
+StringBuffer.skipNestedComment.  These must agree with Encoding.utf8DecodeChar#
+about where each character ends, invalid sequences included, so
+utf8_char_len() follows it exactly: a bad sequence ends just before the first
+byte that isn't a continuation byte.  Unlike utf8DecodeChar# it doesn't look
+past the end of the text.
+*/
+
+static HsInt
+utf8_char_len( const unsigned char *p, const unsigned char *end )
+{
+    unsigned char c = p[0];
+    HsInt n, i;
+
+    if (c <= 0x7F) {
+        return 1;
+    } else if (c >= 0xC0 && c <= 0xDF) {
+        n = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+    } else if (c >= 0xF0 && c <= 0xF8) {
+        n = 4;
+    } else {
+        return 1;
+    }
+    for (i = 1; i < n; i++) {
+        if (p + i >= end || p[i] < 0x80 || p[i] >= 0xC0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+#define LOW_BITS  (~(StgWord)0 / 0xFF)
+#define HIGH_BITS (LOW_BITS * 0x80)
+
+/* Whether any byte of w, all of whose bytes are ASCII, is c */
+#define HAS_BYTE(w,c) ((((w) ^ (LOW_BITS * (c))) - LOW_BITS) & HIGH_BITS)
+
+/* The number of characters in len bytes of UTF-8, taking all-ASCII words
+   of the text in one go. */
+HsInt
+ghc_utf8_count_chars( HsPtr a, HsInt len )
+{
+    const unsigned char *p = a;
+    const unsigned char *end = p + len;
+    HsInt n = 0;
+    StgWord w;
+
+    while (p < end) {
+        if ((StgWord)(end - p) >= sizeof(StgWord)) {
+            memcpy(&w, p, sizeof(StgWord));
+            if ((w & HIGH_BITS) == 0) {
+                p += sizeof(StgWord);
+                n += sizeof(StgWord);
+                continue;
+            }
+        }
+        p += utf8_char_len(p, end);
+        n++;
+    }
+    return n;
+}
+
+/* Skip the rest of a {- -} comment, nested depth deep, starting just after
+   the {- that opened it.  Returns the number of bytes up to and including
+   the -} that closes it, or -1 if the text ends first.  loc[0] and loc[1]
+   are the line and column, which are advanced over the characters skipped
+   as SrcLoc.advanceSrcLoc would. */
+HsInt
+ghc_skip_nested_comment( HsPtr a, HsInt len, HsInt depth, HsInt *loc )
+{
+    const unsigned char *start = a;
+    const unsigned char *p = start;
+    const unsigned char *end = start + len;
+    HsInt line = loc[0], col = loc[1];
+    StgWord w;
+
+    while (p < end) {
+        // Plain ASCII without any of '\t', '\n', '-' or '{' can't end,
+        // open or affect the position of anything but the column.
+        if ((StgWord)(end - p) >= sizeof(StgWord)) {
+            memcpy(&w, p, sizeof(StgWord));
+            if ((w & HIGH_BITS) == 0 &&
+                !HAS_BYTE(w, '\t') && !HAS_BYTE(w, '\n') &&
+                !HAS_BYTE(w, '-') && !HAS_BYTE(w, '{')) {
+                p += sizeof(StgWord);
+                col += sizeof(StgWord);
+                continue;
+            }
+        }
+        switch (*p) {
+        case '\n':
+            line++;
+            col = 1;
+            p++;
+            break;
+        case '\t':
+            col = ((((col - 1) >> 3) + 1) << 3) + 1;
+            p++;
+            break;
+        case '-':
+            if (p + 1 < end && p[1] == '}') {
+                p += 2;
+                col += 2;
+                if (--depth == 0) {
+                    loc[0] = line;
+                    loc[1] = col;
+                    return p - start;
+                }
+            } else {
+                p++;
+                col++;
+            }
+            break;
+        case '{':
+            if (p + 1 < end && p[1] == '-') {
+                p += 2;
+                col += 2;
+                depth++;
+            } else {
+                p++;
+                col++;
+            }
+            break;
+        default:
+            p += utf8_char_len(p, end);
+            col++;
+            break;
+        }
+    }
+    loc[0] = line;
+    loc[1] = col;
+    return -1;
+}
+
 void
 enableTimingStats( void )       /* called from the driver */
 {
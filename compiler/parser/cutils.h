@@ -10,6 +10,10 @@
 HsInt ghc_strlen( HsAddr a );
 HsInt ghc_memcmp( HsAddr a1, HsAddr a2, HsInt len );
 
+// Scanning UTF-8 for the lexer, see Encoding.hs and StringBuffer.hs
+HsInt ghc_utf8_count_chars( HsAddr a, HsInt len );
+HsInt ghc_skip_nested_comment( HsAddr a, HsInt len, HsInt depth, HsInt *loc );
+
 
 void enableTimingStats( void );
 void setHeapSize( HsInt size );
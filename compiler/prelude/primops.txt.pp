@@ -1072,6 +1072,31 @@ primop  NewAlignedPinnedByteArrayOp_Char "newAlignedPinnedByteArray#" GenPrimOp
    with out_of_line = True
         has_side_effects = True
 
+primop  MapFileByteArrayOp "mapFileByteArray#" GenPrimOp
+   Int# -> State# RealWorld -> (# State# RealWorld, Int#, ByteArray# #)
+   {Map the regular file open on the given file descriptor into the heap,
+    read-only, as a pinned byte array holding its contents.  The file is
+    not copied, and it is unmapped when the array is garbage collected;
+    it must not be truncated while the array is alive.  The descriptor
+    may be closed as soon as this returns.  Returns {\tt 0} and the array,
+    or {\tt -1}, with {\tt errno} set, and an empty array.}
+   with out_of_line = True
+        has_side_effects = True
+
+primop  ReceiveShmChannelOp "receiveShmChannel#" GenPrimOp
+   Addr# -> State# RealWorld -> (# State# RealWorld, Int#, ByteArray# #)
+   {Take the next message from the shared-memory channel opened by
+    {\tt rts\_openShmChannel}, as a pinned byte array whose payload is
+    the buffer the sender wrote it into, mapped into the heap without
+    copying.  The buffer goes back to the channel when the array is
+    garbage collected.  Returns {\tt 0} and the array, or {\tt -1},
+    with {\tt errno} set, and an empty array; {\tt errno} is
+    {\tt EAGAIN} if there is no message, and the channel's file
+    descriptor ({\tt rts\_shmChannelFd}) becomes readable when one
+    arrives.}
+   with out_of_line = True
+        has_side_effects = True
+
 primop  ByteArrayContents_Char "byteArrayContents#" GenPrimOp
    ByteArray# -> Addr#
    {Intended for use with pinned arrays; otherwise very unsafe!}
@@ -1446,6 +1471,18 @@ primop CasByteArrayOp_Int "casIntArray#" GenPrimOp
    with has_side_effects = True
         can_fail = True
 
+primop CasDoubleWordArrayOp "casDoubleWordArray#" GenPrimOp
+   MutableByteArray# s -> Int# -> Word# -> Word# -> Word# -> Word# -> State# s -> (# State# s, Int#, Word#, Word# #)
+   {Given an array, an offset in units of two words, the expected old
+    values of the two words there, and their new values, perform an
+    atomic compare and swap of both words at once.  Returns 1\# if the
+    swap happened, and the two words before the operation.  The element
+    must be aligned to twice the word size, so the array should come from
+    {\tt newAlignedPinnedByteArray\#}.  Implies a full memory barrier.}
+   with out_of_line = True
+        has_side_effects = True
+        can_fail = True
+
 primop FetchAddByteArrayOp_Int "fetchAddIntArray#" GenPrimOp
    MutableByteArray# s -> Int# -> Int# -> State# s -> (# State# s, Int# #)
    {Given an array, and offset in Int units, and a value to add,
@@ -1864,6 +1901,92 @@ primop  WriteOffAddrOp_Word64 "writeWord64OffAddr#" GenPrimOp
    with has_side_effects = True
         can_fail         = True
 
+-- Atomic operations
+
+primop  AtomicReadOffAddrOp_Int "atomicReadIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> State# s -> (# State# s, Int# #)
+   {Given an address and an offset in Int units, read an element.
+    Implies a full memory barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
+primop  AtomicWriteOffAddrOp_Int "atomicWriteIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> Int# -> State# s -> State# s
+   {Given an address and an offset in Int units, write an element.
+    Implies a full memory barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
+primop  CasOffAddrOp_Int "casIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> Int# -> Int# -> State# s -> (# State# s, Int# #)
+   {Given an address, an offset in Int units, the expected old value, and
+    the new value, perform an atomic compare and swap i.e. write the new
+    value if the current value matches the provided old value. Returns
+    the value of the element before the operation. Implies a full memory
+    barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
+primop  CasDoubleWordOffAddrOp "casDoubleWordOffAddr#" GenPrimOp
+   Addr# -> Int# -> Word# -> Word# -> Word# -> Word# -> State# s -> (# State# s, Int#, Word#, Word# #)
+   {Given an address, an offset in units of two words, the expected old
+    values of the two words there, and their new values, perform an
+    atomic compare and swap of both words at once.  Returns 1\# if the
+    swap happened, and the two words before the operation.  The address
+    of the element must be a multiple of twice the word size.  Implies a
+    full memory barrier.}
+   with out_of_line      = True
+        has_side_effects = True
+        can_fail         = True
+
+primop  FetchAddOffAddrOp_Int "fetchAddIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> Int# -> State# s -> (# State# s, Int# #)
+   {Given an address, an offset in Int units, and a value to add,
+    atomically add the value to the element. Returns the value of the
+    element before the operation. Implies a full memory barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
+primop  FetchSubOffAddrOp_Int "fetchSubIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> Int# -> State# s -> (# State# s, Int# #)
+   {Given an address, an offset in Int units, and a value to subtract,
+    atomically subtract the value from the element. Returns the value of the
+    element before the operation. Implies a full memory barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
+primop  FetchAndOffAddrOp_Int "fetchAndIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> Int# -> State# s -> (# State# s, Int# #)
+   {Given an address, an offset in Int units, and a value to AND,
+    atomically AND the value to the element. Returns the value of the
+    element before the operation. Implies a full memory barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
+primop  FetchNandOffAddrOp_Int "fetchNandIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> Int# -> State# s -> (# State# s, Int# #)
+   {Given an address, an offset in Int units, and a value to NAND,
+    atomically NAND the value to the element. Returns the value of the
+    element before the operation. Implies a full memory barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
+primop  FetchOrOffAddrOp_Int "fetchOrIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> Int# -> State# s -> (# State# s, Int# #)
+   {Given an address, an offset in Int units, and a value to OR,
+    atomically OR the value to the element. Returns the value of the
+    element before the operation. Implies a full memory barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
+primop  FetchXorOffAddrOp_Int "fetchXorIntOffAddr#" GenPrimOp
+   Addr# -> Int# -> Int# -> State# s -> (# State# s, Int# #)
+   {Given an address, an offset in Int units, and a value to XOR,
+    atomically XOR the value to the element. Returns the value of the
+    element before the operation. Implies a full memory barrier.}
+   with has_side_effects = True
+        can_fail         = True
+
 ------------------------------------------------------------------------
 section "Mutable variables"
         {Operations on MutVar\#s.}
@@ -1915,6 +2038,15 @@ primop  CasMutVarOp "casMutVar#" GenPrimOp
    out_of_line = True
    has_side_effects = True
 
+primop  AtomicSwapMutVarOp "atomicSwapMutVar#" GenPrimOp
+   MutVar# s a -> a -> State# s -> (# State# s, a #)
+   {Atomically write a new value into a {\tt MutVar\#}, returning the
+    old one. Unlike {\tt atomicModifyMutVar\#}, this doesn't allocate.
+    Implies a full memory barrier.}
+   with
+   out_of_line = True
+   has_side_effects = True
+
 ------------------------------------------------------------------------
 section "Exceptions"
 ------------------------------------------------------------------------
@@ -2083,6 +2215,17 @@ primop  WriteTVarOp "writeTVar#" GenPrimOp
 primop  SameTVarOp "sameTVar#" GenPrimOp
    TVar# s a -> TVar# s a -> Int#
 
+primop  SetTVarWakeupLimitOp "setTVarWakeupLimit#" GenPrimOp
+       TVar# s a
+    -> Int#
+    -> State# s -> State# s
+   {Set how many of the threads blocked in {\tt retry} on a {\tt TVar\#}
+    are woken when a transaction updates it: the ones that have waited
+    longest, or all of them if the limit is 0 (the default).}
+   with
+   out_of_line      = True
+   has_side_effects = True
+
 
 ------------------------------------------------------------------------
 section "Synchronized Mutable Variables"
@@ -2185,7 +2328,7 @@ primop  WaitWriteOp "waitWrite#" GenPrimOp
    has_side_effects = True
    out_of_line      = True
 
-#ifdef mingw32_TARGET_OS
+#if defined(mingw32_TARGET_OS) || defined(linux_TARGET_OS)
 primop  AsyncReadOp "asyncRead#" GenPrimOp
    Int# -> Int# -> Int# -> Addr# -> State# RealWorld-> (# State# RealWorld, Int#, Int# #)
    {Asynchronously read bytes from specified file descriptor.}
@@ -2200,6 +2343,9 @@ primop  AsyncWriteOp "asyncWrite#" GenPrimOp
    has_side_effects = True
    out_of_line      = True
 
+#endif
+
+#ifdef mingw32_TARGET_OS
 primop  AsyncDoProcOp "asyncDoProc#" GenPrimOp
    Addr# -> Addr# -> State# RealWorld-> (# State# RealWorld, Int#, Int# #)
    {Asynchronously perform procedure (first arg), passing it 2nd arg.}
@@ -2309,9 +2455,12 @@ primop  AddCFinalizerToWeakOp "addCFinalizerToWeak#" GenPrimOp
           -> State# RealWorld -> (# State# RealWorld, Int# #)
    { {\tt addCFinalizerToWeak# fptr ptr flag eptr w} attaches a C
      function pointer {\tt fptr} to a weak pointer {\tt w} as a finalizer. If
-     {\tt flag} is zero, {\tt fptr} will be called with one argument,
+     bit 0 of {\tt flag} is clear, {\tt fptr} will be called with one argument,
      {\tt ptr}. Otherwise, it will be called with two arguments,
-     {\tt eptr} and {\tt ptr}. {\tt addCFinalizerToWeak#} returns
+     {\tt eptr} and {\tt ptr}. If bit 1 of {\tt flag} is set, the finalizer
+     is run during the garbage collection that finds {\tt w} dead, rather
+     than later by the threaded RTS's finalizer thread.
+     {\tt addCFinalizerToWeak#} returns
      1 on success, or 0 if {\tt w} is already dead. }
    with
    has_side_effects = True
@@ -2617,6 +2766,20 @@ primop  TraceEventOp "traceEvent#" GenPrimOp
    has_side_effects = True
    out_of_line      = True
 
+primop  TraceBinaryEventOp "traceBinaryEvent#" GenPrimOp
+   Word# -> ByteArray# -> Int# -> Int# -> State# s -> State# s
+   { Emits a binary event via the RTS tracing framework.  The first
+     argument says what kind of event it is (see
+     {\tt Debug.Trace.registerBinaryEventType}), and the contents are the
+     bytes of the array starting at the given offset, of the given
+     length, copied as they are.  The array need not be pinned.  The
+     event is emitted only to the .eventlog file.  The kind must fit
+     in 32 bits; events of a larger kind are dropped, and contents of
+     more than 65531 bytes are cut short. }
+   with
+   has_side_effects = True
+   out_of_line      = True
+
 primop  TraceMarkerOp "traceMarker#" GenPrimOp
    Addr# -> State# s -> State# s
    { Emits a marker event via the RTS tracing framework.  The contents
@@ -124,16 +124,11 @@ utf8DecodeString ptr len
                 chs <- unpack (p `plusPtr#` nBytes#)
                 return (C# c# : chs)
 
-countUTF8Chars :: Ptr Word8 -> Int -> IO Int
-countUTF8Chars ptr len = go ptr 0
-  where
-        !end = ptr `plusPtr` len
-
-        go p !n
-           | p >= end = return n
-           | otherwise  = do
-                case utf8DecodeChar# (unPtr p) of
-                  (# _, nBytes# #) -> go (p `plusPtr#` nBytes#) (n+1)
+-- | The number of characters in some UTF-8, as 'utf8DecodeString' would
+-- decode them.  This is done in C (see compiler/parser/cutils.c), which
+-- can skip over ASCII a word at a time.
+foreign import ccall unsafe "ghc_utf8_count_chars"
+  countUTF8Chars :: Ptr Word8 -> Int -> IO Int
 
 unPtr :: Ptr a -> Addr#
 unPtr (Ptr a) = a
@@ -32,6 +32,7 @@ module StringBuffer
         stepOn,
         offsetBytes,
         byteDiff,
+        skipNestedComment,
 
         -- * Conversion
         lexemeToString,
@@ -210,6 +211,32 @@ offsetBytes i s = s { cur = cur s + i }
 byteDiff :: StringBuffer -> StringBuffer -> Int
 byteDiff s1 s2 = cur s2 - cur s1
 
+-- | Skip the rest of a @{- -}@ comment that is nested the given number
+-- of levels deep, starting just after the @{-@ that opened it.  Also
+-- moves the given line and column past the characters skipped.  Returns
+-- 'False' and the end of the buffer if the comment isn't closed.
+--
+-- This is the lexer's @nested_comment@ without the comment's text,
+-- done in C (see compiler/parser/cutils.c) so that it can skip plain
+-- text a word at a time.
+skipNestedComment :: Int -> StringBuffer -> Int -> Int
+                  -> (Bool, StringBuffer, Int, Int)
+skipNestedComment depth (StringBuffer buf len cur) line col =
+  inlinePerformIO $
+    withForeignPtr buf $ \ptr ->
+      allocaArray 2 $ \loc -> do
+        pokeElemOff loc 0 line
+        pokeElemOff loc 1 col
+        n <- skip_nested_comment (ptr `plusPtr` cur) (len - cur) depth loc
+        line' <- peekElemOff loc 0
+        col'  <- peekElemOff loc 1
+        return $ if n < 0
+                    then (False, StringBuffer buf len len, line', col')
+                    else (True, StringBuffer buf len (cur + n), line', col')
+
+foreign import ccall unsafe "ghc_skip_nested_comment"
+  skip_nested_comment :: Ptr Word8 -> Int -> Int -> Ptr Int -> IO Int
+
 atEnd :: StringBuffer -> Bool
 atEnd (StringBuffer _ l c) = l == c
 
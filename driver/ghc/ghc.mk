@@ -12,6 +12,29 @@
 
 ifeq "$(Windows_Host)" "YES"
 
+ifeq "$(WINDOWS_DYN_DRIVERS)" "YES"
+
+# Note [Windows driver launchers]
+#
+# A dynamically linked ghc.exe is only a small launcher, built from
+# driver/utils/dynwrapper.c, that loads the compiler from a DLL.  So
+# rather than a program that starts ghc.exe as a child process and
+# waits for it, ghc-<version>.exe and ghci.exe are copies of that
+# launcher (ghci.exe with --interactive added to its arguments), and
+# run the compiler in their own process.
+
+driver/ghc_LAUNCHER = driver/ghc/dist/build/tmp/ghc-$(ProjectVersion)$(exeext1)
+
+$(driver/ghc_LAUNCHER) : ghc/stage2/build/tmp/ghc-stage2-wrapper.c | $$(dir $$@)/.
+	"$(GHC_STAGE1)" -no-hs-main -no-auto-link-packages -optc-g -optc-O0 -Iincludes $< -o $@
+
+$(eval $(call all-target,driver/ghc,$(driver/ghc_LAUNCHER)))
+INSTALL_BINS += $(driver/ghc_LAUNCHER)
+
+$(eval $(call clean-target,driver/ghc,launcher,driver/ghc/dist))
+
+else
+
 driver/ghc_dist_C_SRCS   = ghc.c ../utils/cwrapper.c ../utils/getLocation.c
 driver/ghc_dist_CC_OPTS += -I driver/utils
 driver/ghc_dist_PROGNAME = ghc-$(ProjectVersion)
@@ -22,3 +45,5 @@ $(eval $(call build-prog,driver/ghc,dist,0))
 
 endif
 
+endif
+
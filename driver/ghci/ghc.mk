@@ -29,6 +29,35 @@ install_driver_ghci:
 
 else # Windows_Host...
 
+ifeq "$(WINDOWS_DYN_DRIVERS)" "YES"
+
+# See Note [Windows driver launchers] in driver/ghc/ghc.mk
+
+driver/ghci_LAUNCHER         = driver/ghci/dist/build/tmp/ghci$(exeext1)
+driver/ghci_LAUNCHER_INPLACE = driver/ghci/dist/build/tmp/inplace-ghci$(exeext1)
+driver/ghci_LAUNCHER_OPTS    = -no-hs-main -no-auto-link-packages -optc-g -optc-O0 -Iincludes '-optc-DWRAPPER_ARGS="--interactive"'
+
+$(driver/ghci_LAUNCHER) : ghc/stage2/build/tmp/ghc-stage2-wrapper.c driver/ghci/ghci.res | $$(dir $$@)/.
+	"$(GHC_STAGE1)" $(driver/ghci_LAUNCHER_OPTS) $< driver/ghci/ghci.res -o $@
+
+$(driver/ghci_LAUNCHER_INPLACE) : ghc/stage2/build/tmp/ghc-stage2-inplace-wrapper.c driver/ghci/ghci.res | $$(dir $$@)/.
+	"$(GHC_STAGE1)" $(driver/ghci_LAUNCHER_OPTS) $< driver/ghci/ghci.res -o $@
+
+$(INPLACE_BIN)/ghci$(exeext1) : $(driver/ghci_LAUNCHER_INPLACE) | $$(dir $$@)/.
+	$(INSTALL) -m 755 $< $@
+
+driver/ghci_dist_PROG_VER = ghci-$(ProjectVersion)$(exeext1)
+
+$(eval $(call all-target,driver/ghci,driver/ghci/dist/build/tmp/$(driver/ghci_dist_PROG_VER) $(INPLACE_BIN)/ghci$(exeext1)))
+$(eval $(call clean-target,driver/ghci,launcher,driver/ghci/dist $(INPLACE_BIN)/ghci$(exeext1)))
+
+INSTALL_BINS += $(driver/ghci_LAUNCHER)
+
+driver/ghci/dist/build/tmp/$(driver/ghci_dist_PROG_VER) : $(driver/ghci_LAUNCHER)
+	"$(CP)" $< $@
+
+else
+
 driver/ghci_dist_C_SRCS  = ghci.c ../utils/cwrapper.c ../utils/getLocation.c
 driver/ghci_dist_CC_OPTS += -I driver/utils
 driver/ghci_dist_PROGNAME = ghci
@@ -40,14 +69,16 @@ $(eval $(call build-prog,driver/ghci,dist,1))
 
 driver/ghci_dist_PROG_VER = ghci-$(ProjectVersion)$(exeext1)
 
+driver/ghci/dist/build/tmp/$(driver/ghci_dist_PROG_VER) : driver/ghci/dist/build/tmp/$(driver/ghci_dist_PROG)
+	"$(CP)" $< $@
+
+endif
+
 INSTALL_BINS += driver/ghci/dist/build/tmp/$(driver/ghci_dist_PROG_VER)
 
 driver/ghci/ghci.res : driver/ghci/ghci.rc driver/ghci/ghci.ico
 	"$(WINDRES)" --preprocessor="$(CPP) -xc -DRC_INVOKED" -o driver/ghci/ghci.res -i driver/ghci/ghci.rc -O coff
 
-driver/ghci/dist/build/tmp/$(driver/ghci_dist_PROG_VER) : driver/ghci/dist/build/tmp/$(driver/ghci_dist_PROG)
-	"$(CP)" $< $@
-
 install : install_driver_ghcii
 
 .PHONY: install_driver_ghcii
@@ -5,6 +5,11 @@ LPTSTR path_dirs[];
 LPTSTR progDll;
 LPTSTR rtsDll;
 int rtsOpts;
+
+If WRAPPER_ARGS is defined, as a comma-separated list of C strings, the
+program gets those arguments ahead of its own.  The Windows drivers
+(driver/ghc, driver/ghci) use this to run a dynamically linked GHC in
+their own process, rather than starting ghc.exe as a child process.
 */
 
 #include <stdarg.h>
@@ -154,6 +159,31 @@ HINSTANCE GetNonNullModuleHandle(LPTSTR dll) {
 
 typedef int (*hs_main_t)(int , char **, StgClosure *, RtsConfig);
 
+#ifdef WRAPPER_ARGS
+static char *wrapperArgs[] = { WRAPPER_ARGS };
+
+char **addWrapperArgs(int *argc, char *argv[]) {
+    int n = sizeof(wrapperArgs) / sizeof(wrapperArgs[0]);
+    int i;
+    char **newArgv;
+
+    newArgv = malloc((*argc + n + 1) * sizeof(char *));
+    if (newArgv == NULL) {
+        die("Mallocing %d arguments failed", *argc + n + 1);
+    }
+    newArgv[0] = argv[0];
+    for (i = 0; i < n; i++) {
+        newArgv[i + 1] = wrapperArgs[i];
+    }
+    for (i = 1; i <= *argc; i++) {
+        // copies the NULL at argv[argc] too
+        newArgv[i + n] = argv[i];
+    }
+    *argc += n;
+    return newArgv;
+}
+#endif
+
 int main(int argc, char *argv[]) {
     void *p;
     HINSTANCE hRtsDll, hProgDll;
@@ -192,6 +222,10 @@ int main(int argc, char *argv[]) {
     rts_config.rts_opts_enabled = rtsOpts;
     rts_config.rts_opts = NULL;
 
+#ifdef WRAPPER_ARGS
+    argv = addWrapperArgs(&argc, argv);
+#endif
+
     return hs_main_p(argc, argv, main_p, rts_config);
 }
 
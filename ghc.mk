@@ -238,6 +238,14 @@ WINDOWS_DYN_PROG_RTS := $(WINDOWS_DYN_PROG_RTS)_debug
 endif
 WINDOWS_DYN_PROG_RTS := $(WINDOWS_DYN_PROG_RTS)_dyn_LIB_NAME
 
+# The Windows drivers run a dynamically linked stage 2 compiler in their
+# own process; see Note [Windows driver launchers] in driver/ghc/ghc.mk
+ifeq "$(Windows_Host) $(DYNAMIC_GHC_PROGRAMS) $(INSTALL_GHC_STAGE)" "YES YES 2"
+WINDOWS_DYN_DRIVERS = YES
+else
+WINDOWS_DYN_DRIVERS = NO
+endif
+
 # -----------------------------------------------------------------------------
 # Compilation Flags
 
@@ -179,7 +179,9 @@ install_ghc_link:
 	$(LN_S) $(CrossCompilePrefix)ghc-$(ProjectVersion) "$(DESTDIR)$(bindir)/$(CrossCompilePrefix)ghc"
 else
 # On Windows we install the main binary as $(bindir)/ghc.exe
-# To get ghc-<version>.exe we have a little C program in driver/ghc
+# To get ghc-<version>.exe we have a little C program in driver/ghc, or
+# a copy of the launcher in a dynamically linked ghc.exe (see
+# Note [Windows driver launchers] in driver/ghc/ghc.mk)
 install: install_ghc_post
 .PHONY: install_ghc_post
 install_ghc_post: install_bins
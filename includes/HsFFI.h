@@ -153,6 +153,8 @@ extern void hs_add_root (void (*init_root)(void));
 extern void hs_thread_done (void);
 
 extern void hs_perform_gc (void);
+extern void hs_dump_eventlog (void);
+extern void hs_heap_snapshot (void);
 
 extern void hs_lock_stable_tables (void);
 extern void hs_unlock_stable_tables (void);
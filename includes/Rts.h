@@ -233,7 +233,11 @@ INLINE_HEADER Time fsecondsToTime (double t)
 #include "rts/Linker.h"
 #include "rts/Ticky.h"
 #include "rts/Timer.h"
+#include "rts/EventLogSubscriber.h"
+#include "rts/EventLogControl.h"
+#include "rts/UserEvents.h"
 #include "rts/Stable.h"
+#include "rts/ShmChannel.h"
 #include "rts/TTY.h"
 #include "rts/Utils.h"
 #include "rts/PrimFloat.h"
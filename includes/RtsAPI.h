@@ -154,6 +154,11 @@ HaskellObj   rts_mkDouble     ( Capability *, HsDouble f );
 HaskellObj   rts_mkStablePtr  ( Capability *, HsStablePtr s );
 HaskellObj   rts_mkBool       ( Capability *, HsBool   b );
 HaskellObj   rts_mkString     ( Capability *, char    *s );
+HaskellObj   rts_mkList       ( Capability *, HaskellObj *elems, StgWord n );
+HaskellObj   rts_mkIntList    ( Capability *, HsInt *elems, StgWord n );
+HaskellObj   rts_mkByteArray  ( Capability *, void *buf, StgWord bytes );
+HaskellObj   rts_mkPinnedByteArray ( Capability *, StgWord bytes,
+                                     void **contents );
 
 HaskellObj   rts_apply        ( Capability *, HaskellObj, HaskellObj );
 
@@ -177,6 +182,24 @@ HsFloat      rts_getFloat     ( HaskellObj );
 HsDouble     rts_getDouble    ( HaskellObj );
 HsStablePtr  rts_getStablePtr ( HaskellObj );
 HsBool       rts_getBool      ( HaskellObj );
+HsInt        rts_getList      ( HaskellObj, HaskellObj *elems, StgWord max );
+HsInt        rts_getIntList   ( HaskellObj, HsInt *elems, StgWord max );
+void *       rts_getByteArray ( HaskellObj, StgWord *bytes );
+
+/* ----------------------------------------------------------------------------
+   Fire-and-forget calls into Haskell
+
+   These queue the call on the given Capability (modulo the number of
+   Capabilities) and return at once, without rts_lock(): the call runs
+   on a new unbound Haskell thread, soon.  They may be called from any
+   OS thread.  The StablePtr is not freed.
+   ------------------------------------------------------------------------- */
+
+// action :: StablePtr (IO ())
+void rts_evalAsync    ( int capability, HsStablePtr action );
+
+// fn :: StablePtr (Ptr a -> IO ())
+void rts_evalAsyncPtr ( int capability, HsStablePtr fn, HsPtr arg );
 
 /* ----------------------------------------------------------------------------
    Evaluating Haskell expressions
@@ -236,6 +259,15 @@ SchedulerStatus rts_getSchedStatus (Capability *cap);
  */
 void rts_done (void);
 
+/*
+ * The number of Haskell finalizers that the GC has started threads for
+ * since the program started, and the number of those that have run to
+ * completion: the difference is the backlog of finalizers waiting to
+ * run.  rts_finalizerDone() is called by GHC.Weak after each one.
+ */
+void rts_getFinalizerCounts (HsWord64 *queued, HsWord64 *completed);
+void rts_finalizerDone      (void);
+
 /* --------------------------------------------------------------------------
    Wrapper closures
 
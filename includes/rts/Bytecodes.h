@@ -79,6 +79,7 @@
 #define bci_BRK_FUN			54
 #define bci_TESTLT_W   			55
 #define bci_TESTEQ_W  			56
+#define bci_SLIDE_ENTER			57
 /* If you need to go past 255 then you will run into the flags */
 
 /* If you need to go below 0x0100 then you will run into the instructions */
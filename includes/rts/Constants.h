@@ -70,8 +70,20 @@
  * (1<<MUT_ARR_PTRS_CARD_BITS) elements in the array.  To find a good
  * value for this, I used the benchmarks nofib/gc/hash,
  * nofib/gc/graph, and nofib/gc/gc_bench.
+ *
+ * Programs that keep many large, mostly-clean arrays in the old
+ * generation may do better with smaller cards; configure
+ * --with-mut-arr-card-bits=<n> overrides the default.  The code
+ * generator gets the value from here too (via deriveConstants), so it
+ * can't be changed at runtime.
  */
+#ifndef MUT_ARR_PTRS_CARD_BITS
 #define MUT_ARR_PTRS_CARD_BITS 7
+#endif
+
+#if MUT_ARR_PTRS_CARD_BITS < 1 || MUT_ARR_PTRS_CARD_BITS > 16
+#error MUT_ARR_PTRS_CARD_BITS must be between 1 and 16
+#endif
 
 /* -----------------------------------------------------------------------------
    STG Registers.
@@ -282,6 +294,26 @@
  */
 #define TSO_ALLOC_LIMIT 256
 
+/*
+ * Linux, non-threaded RTS: the thread is on the blocked queue waiting
+ * for an asyncRead#/asyncWrite# request, and its block_info is an
+ * async_result rather than a file descriptor.  See posix/AsyncIO.c.
+ */
+#define TSO_ASYNC_IO 512
+
+/*
+ * The highest tso->priority.  The run queue keeps the threads with a
+ * higher priority ahead of the others; 0 is the default.
+ */
+#define MAX_THREAD_PRIORITY 3
+
+/*
+ * Threads are in accounting groups 0 (the default, no group) to
+ * MAX_ACCOUNTING_GROUPS-1 (see Note [Accounting groups] in
+ * rts/sm/Accounting.c).
+ */
+#define MAX_ACCOUNTING_GROUPS 64
+
 /*
  * The number of times we spin in a spin lock before yielding (see
  * #3758).  To tune this value, use the benchmark in #3758: run the
@@ -300,4 +332,10 @@
 
 #define MAX_SPARE_WORKERS 6
 
+/*
+ * The maximum number of NUMA nodes we support.  This is a fixed limit so that
+ * we can have static arrays of this size in the RTS for speed.
+ */
+#define MAX_NUMA_NODES 16
+
 #endif /* RTS_CONSTANTS_H */
@@ -0,0 +1,37 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Changing what goes in the eventlog as the program runs
+ *
+ * Do not #include this file directly: #include "Rts.h" instead.
+ *
+ * To understand the structure of the RTS headers, see the wiki:
+ *   http://ghc.haskell.org/trac/ghc/wiki/Commentary/SourceTree/Includes
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef RTS_EVENTLOGCONTROL_H
+#define RTS_EVENTLOGCONTROL_H
+
+/*
+ * Turn classes of events on or off.  classes is in the syntax of
+ * +RTS -l ("s" turns on the scheduler events, "-g" turns off the GC
+ * events, "-as" leaves only the scheduler events), except that the
+ * classes it doesn't mention are left as they are.  Returns rtsFalse,
+ * changing nothing, if events are not being logged to the eventlog
+ * (+RTS -l) or classes has an unknown class.
+ */
+rtsBool rts_setEventLogClasses (const char *classes);
+
+/*
+ * Log only 1 in n of each kind of event of the class cls on each
+ * capability, as with +RTS --eventlog-sample: cls is 's' for the
+ * scheduler events (a thread's stop event is logged if its run event
+ * was) or 'f' for the full-detail spark events.  1 logs them all.
+ * Returns rtsFalse if events are not being logged or cls can't be
+ * sampled.
+ */
+rtsBool rts_setEventLogSampling (char cls, HsInt n);
+
+#endif /* RTS_EVENTLOGCONTROL_H */
@@ -57,6 +57,32 @@
  *       [Word16]       -- length of the rest (for variable-sized events only)
  *       ... extra event-specific info ...
  *
+ * The compact format (+RTS --eventlog-compact)
+ * --------------------------------------------
+ *
+ * The header is the same, but it ends with EVENT_DATA_BEGIN_COMPACT
+ * rather than EVENT_DATA_BEGIN, so that a tool that doesn't know the
+ * compact format rejects the log instead of misreading it.  The events
+ * have a shorter header:
+ *
+ * Event :
+ *       Word8          -- event_type; 0xff is followed by a second byte
+ *                      -- (0xff 0xff is EVENT_DATA_END)
+ *       Varint         -- time, as the signed difference from the
+ *                      -- previous event in the same block
+ *       [Word16]       -- length of the rest (for variable-sized events only)
+ *       ... extra event-specific info, as in the normal format ...
+ *
+ * except for EVENT_BLOCK_MARKER, whose time is a Word64: this is the
+ * base for the times of the events in its block.  A Varint is 7 bits
+ * per byte, least significant first, with the top bit set on all but
+ * the last byte, and a signed value v is stored as 2v for v >= 0 and
+ * -2v-1 otherwise.
+ *
+ * In a block of a capability, EVENT_STOP_CUR_THREAD stands for an
+ * EVENT_STOP_THREAD of the thread of the last EVENT_RUN_THREAD in the
+ * same block.
+ *
  *
  * To add a new event
  * ------------------
@@ -83,6 +109,7 @@
 #define EVENT_HEADER_END      0x68647265 /* 'h' 'd' 'r' 'e' */
 
 #define EVENT_DATA_BEGIN      0x64617462 /* 'd' 'a' 't' 'b' */
+#define EVENT_DATA_BEGIN_COMPACT 0x64617463 /* 'd' 'a' 't' 'c' */
 #define EVENT_DATA_END        0xffff
 
 /*
@@ -174,12 +201,34 @@
 
 /* Range 140 - 159 is reserved for Perf events. */
 
+#define EVENT_STM_ABORT          160 /* (thread, tvar, aborts) */
+#define EVENT_USER_BINARY_MSG    161 /* (user_event_id, bytes ...) */
+#define EVENT_USER_BINARY_TYPE   162 /* (user_event_id, name_string) */
+#define EVENT_GC_PHASES          163 /* (roots, scav, weak, sweep,
+                                         nursery, return_mem), in ns */
+#define EVENT_HW_COUNTERS        164 /* (cap, kind, cycles, instructions,
+                                         llc_misses, dtlb_misses) */
+#define EVENT_STACK_SAMPLE       165 /* (thread, frame info pointers ...) */
+#define EVENT_THREAD_USAGE       166 /* (thread, cpu_time, allocated) */
+#define EVENT_ALLOC_SAMPLE       167 /* (thread, bytes, closure info,
+                                         frame info) */
+#define EVENT_BLACKHOLE_WAIT     168 /* (thread, wait time in ns) */
+#define EVENT_CLOCK_SOURCE       169 /* (clock, counter_hz, resolution_ns) */
+#define EVENT_HEAP_PROF_BEGIN    170 /* (breakdown, interval_ns) */
+#define EVENT_HEAP_PROF_BAND     171 /* (band, name) */
+#define EVENT_HEAP_PROF_SAMPLE_BEGIN 172 /* (sample, mut_time_ns) */
+#define EVENT_HEAP_PROF_SAMPLE   173 /* (band, bytes) */
+#define EVENT_HEAP_PROF_SAMPLE_END 174 /* (sample) */
+#define EVENT_STOP_CUR_THREAD    175 /* (status, blocked_on), compact only */
+#define EVENT_EXCEPTION_RAISE    176 /* (thread, frames, update frames) */
+#define EVENT_GC_SYNC            177 /* (sync_ns, last_cap, last_thread) */
+
 /*
  * The highest event code +1 that ghc itself emits. Note that some event
  * ranges higher than this are reserved but not currently emitted by ghc.
  * This must match the size of the EventDesc[] array in EventLog.c
  */
-#define NUM_GHC_EVENT_TAGS        60
+#define NUM_GHC_EVENT_TAGS        178
 
 #if 0  /* DEPRECATED EVENTS: */
 /* we don't actually need to record the thread, it's implicit */
@@ -226,6 +275,16 @@
 #define CAPSET_TYPE_OSPROCESS   2  /* caps belong to the same OS process */
 #define CAPSET_TYPE_CLOCKDOMAIN 3  /* caps share a local clock/time      */
 
+/*
+ * Kind values for EVENT_HW_COUNTERS: the running totals for the mutator
+ * or the GC on the capability, or those of a GC phase (in the order of
+ * EVENT_GC_PHASES) on the thread leading the GC.  A counter that isn't
+ * available is 0.
+ */
+#define HW_COUNTERS_MUTATOR     0
+#define HW_COUNTERS_GC          1
+#define HW_COUNTERS_GC_PHASE    2  /* + the phase */
+
 #ifndef EVENTLOG_CONSTANTS_ONLY
 
 typedef StgWord16 EventTypeNum;
@@ -0,0 +1,45 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Receiving the eventlog in-process, as the program runs
+ *
+ * Do not #include this file directly: #include "Rts.h" instead.
+ *
+ * To understand the structure of the RTS headers, see the wiki:
+ *   http://ghc.haskell.org/trac/ghc/wiki/Commentary/SourceTree/Includes
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef RTS_EVENTLOGSUBSCRIBER_H
+#define RTS_EVENTLOGSUBSCRIBER_H
+
+/*
+ * A subscriber is handed the binary eventlog (in the format of
+ * EventLogFormat.h) in pieces: first the header, then each block of
+ * events as a capability's buffer is written out, and finally the
+ * end-of-data marker when the RTS shuts down.  The buffer is only
+ * valid for the duration of the call.
+ *
+ * The calls are never concurrent, but they come from whichever OS
+ * thread filled the buffer, possibly while it holds a Capability or in
+ * the middle of a GC: the function must not call back into the RTS and
+ * should return quickly (copy the data and hand it to another thread).
+ */
+typedef void (*EventLogSubscriber) (void *user, const StgWord8 *buf,
+                                    StgWord size);
+
+/*
+ * Start sending the eventlog to fn.  Returns rtsFalse if events are not
+ * being logged (the program was not run with +RTS -l, or the RTS was
+ * not built with tracing) or there is a subscriber already.
+ */
+rtsBool rts_subscribeEventLog (EventLogSubscriber fn, void *user);
+
+/*
+ * Stop sending the eventlog; when this returns fn will not be called
+ * again.
+ */
+void rts_unsubscribeEventLog (void);
+
+#endif /* RTS_EVENTLOGSUBSCRIBER_H */
@@ -38,6 +38,8 @@ typedef struct _GC_FLAGS {
     nat     initialStkSize;     /* in *words* */
     nat     stkChunkSize;       /* in *words* */
     nat     stkChunkBufferSize; /* in *words* */
+    nat     stkPauseSplitSize;  /* in *words*, 0 == never */
+    nat     stkGcSplitSize;     /* in *words*, 0 == never */
 
     nat	    maxHeapSize;        /* in *blocks* */
     nat     minAllocAreaSize;   /* in *blocks* */
@@ -62,8 +64,14 @@ typedef struct _GC_FLAGS {
 
     Time    idleGCDelayTime;    /* units: TIME_RESOLUTION */
     rtsBool doIdleGC;
+    Time    idleGCBudget;       /* 0 => the idle GC is a major GC */
 
     StgWord heapBase;           /* address to ask the OS for memory */
+    StgWord addressSpaceSize;   /* in bytes, address space to reserve
+                                 * for the heap (USE_LARGE_ADDRESS_SPACE) */
+
+    rtsBool hugePages;          /* back the heap with huge pages (-xH) */
+    StgWord hugePageSize;       /* in bytes, 0 <=> the OS default */
 
     StgWord allocLimitGrace;    /* units: *blocks*
                                  * After an AllocationLimitExceeded
@@ -72,6 +80,34 @@ typedef struct _GC_FLAGS {
                                  * to handle the exception before we
                                  * raise it again.
                                  */
+
+    rtsBool numa;               /* Use NUMA */
+    StgWord numaMask;           /* bit n set <=> use OS NUMA node n */
+
+    rtsBool autoNursery;        /* size the nursery automatically */
+    Time    autoNurseryPause;   /* target minor GC pause for autoNursery,
+                                 * units: TIME_RESOLUTION */
+
+    double  gcOverhead;         /* tune oldGenFactor to spend this fraction
+                                 * of the CPU time in GC; 0 <=> don't */
+
+    Time    decommitAge;        /* give the memory of free mblocks back to
+                                 * the OS once they have been free this
+                                 * long; 0 <=> unmap them after major GC */
+    StgWord decommitRate;       /* at most this many bytes per second */
+
+    nat     tenureAge;          /* number of GCs an object survives before
+                                 * it is promoted out of the aging
+                                 * generations (Note [Aging] in GC.c) */
+    rtsBool adaptiveTenure;     /* vary the tenure age (up to tenureAge)
+                                 * with the amount that gets promoted */
+
+    rtsBool cFinalizersInGC;    /* run C finalizers in the GC, not in
+                                 * a thread of their own */
+    nat     softHeapLimit;      /* in *blocks*; 0 <=> none.  Past this,
+                                 * major GCs come sooner and the memory
+                                 * pressure handlers run (see
+                                 * resize_generations() in GC.c) */
 } GC_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -92,6 +128,9 @@ typedef struct _DEBUG_FLAGS {
     rtsBool squeeze;        /* 'z'  stack squeezing & lazy blackholing */
     rtsBool hpc; 	    /* 'c' coverage */
     rtsBool sparks; 	    /* 'r' */
+    nat     sanity_sample;  /* with -DS, check one heap block in this many */
+    StgWord64 trace_buffer; /* --debug-trace-buffer: bytes of stderr trace
+                               kept per OS thread, 0 to write it at once */
 } DEBUG_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
@@ -123,11 +162,16 @@ typedef struct _PROFILING_FLAGS {
     Time                heapProfileInterval; /* time between samples */
     nat                 heapProfileIntervalTicks; /* ticks between samples (derived) */
     rtsBool             includeTSOs;
-
+    rtsBool             binaryHeapProfile; /* see rts/prof/HeapProfileFormat.h */
+    rtsBool             eventlogHeapProfile; /* samples go in the eventlog */
 
     rtsBool		showCCSOnException;
 
     nat                 maxRetainerSetSize;
+    nat                 retainerSampleRoots; /* traverse from 1 in this
+                                                many roots, 0 for all */
+    nat                 ldvSampleEras;  /* -hb follows the closures of 1 in
+                                           this many eras */
 
     nat                 ccsLength;
 
@@ -154,14 +198,34 @@ typedef struct _TRACE_FLAGS {
     rtsBool sparks_sampled; /* trace spark events by a sampled method */
     rtsBool sparks_full;    /* trace spark events 100% accurately */
     rtsBool user;           /* trace user events (emitted from Haskell code) */
+    rtsBool async_writer;   /* write the eventlog from a background thread */
+    char   *sink;           /* where to send the eventlog, NULL for default */
+    StgWord64 ring_size;    /* --eventlog-ring: bytes kept per capability,
+                               0 to write everything */
+    rtsBool compact;        /* --eventlog-compact: see EventLogFormat.h */
+    nat stack_sample_ticks; /* --sample-stacks: sample the stacks every
+                               this many ticks, 0 for never */
+    StgWord64 alloc_sample_bytes; /* --alloc-sample: sample the allocating
+                               code every this many bytes, 0 for never */
+    nat sched_sample;       /* --eventlog-sample: log 1 in this many of
+                               each scheduler event on each capability */
+    nat spark_sample;       /* the same for the full-detail spark events */
+    char *toggle_classes;   /* --eventlog-toggle: the classes that SIGUSR2
+                               turns on, or NULL */
+    Time toggle_time;       /* for how long, 0 until the next SIGUSR2 */
 } TRACE_FLAGS;
 
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _CONCURRENT_FLAGS {
     Time ctxtSwitchTime;         /* units: TIME_RESOLUTION */
     int ctxtSwitchTicks;         /* derived */
+    nat stmContention;           /* what to do after a failed commit */
 } CONCURRENT_FLAGS;
 
+/* Contention managers for STM (--stm-contention) */
+#define STM_CONTENTION_NONE    0  /* re-run the transaction at once */
+#define STM_CONTENTION_BACKOFF 1  /* randomised exponential backoff */
+
 /*
  * The tickInterval is the time interval between "ticks", ie.
  * timer signals (see Timer.{c,h}).  It is the frequency at
@@ -171,6 +235,11 @@ typedef struct _CONCURRENT_FLAGS {
  */
 #define DEFAULT_TICK_INTERVAL USToTime(10000)
 
+/* Clocks for timestamps (--clock) */
+#define CLOCK_SOURCE_MONOTONIC 0  /* clock_gettime(CLOCK_MONOTONIC) */
+#define CLOCK_SOURCE_TSC       1  /* the CPU's cycle counter */
+#define CLOCK_SOURCE_COARSE    2  /* CLOCK_MONOTONIC_COARSE (Linux) */
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _MISC_FLAGS {
     Time    tickInterval;        /* units: TIME_RESOLUTION */
@@ -178,9 +247,35 @@ typedef struct _MISC_FLAGS {
     rtsBool machineReadable;
     StgWord linkerMemBase;       /* address to ask the OS for memory
                                   * for the linker, NULL ==> off */
+    nat     linkerThreads;       /* threads relocating objects in the
+                                  * linker, 0 ==> one per processor */
+    char   *linkerCache;         /* directory of relocated objects for
+                                  * the linker, NULL ==> off */
+    rtsBool perfCounters;        /* hardware counters (Linux only) */
+    rtsBool threadCPUTime;       /* count the CPU time of each thread */
+    char   *metricsShm;          /* shared memory object for live stats,
+                                  * NULL ==> off (not on Windows) */
+    rtsBool heapSnapshotSignal;  /* SIGUSR1 writes a heap snapshot */
+    char   *heapImage;           /* file of evaluated CAFs to start
+                                  * with, NULL ==> off (Linux only) */
+    rtsBool fastExit;            /* exit the program without a final GC,
+                                  * finalizers or freeing memory */
+    nat     clockSource;         /* clock for eventlog and trace
+                                  * timestamps, a CLOCK_SOURCE_* */
 } MISC_FLAGS;
 
 #ifdef THREADED_RTS
+/* A pool of Capabilities (+RTS --cap-pool), see Note [Capability pools] */
+#define MAX_CAP_POOLS 8
+
+typedef struct _CAP_POOL_FLAGS {
+  char          *name;
+  nat            nCaps;
+  int            cpu;            /* first CPU to bind to, or -1 */
+  Time           ctxtSwitchTime; /* -1: the same as -C */
+  int            ctxtSwitchTicks;
+} CAP_POOL_FLAGS;
+
 /* See Note [Synchronization of flags and base APIs] */
 typedef struct _PAR_FLAGS {
   nat            nNodes;         /* number of threads to run simultaneously */
@@ -202,9 +297,35 @@ typedef struct _PAR_FLAGS {
                                   * it up when doing a
                                   * non-load-balancing parallel GC.
                                   * (zero disables) */
+  nat            parGcThreads;   /* use at most this many GC threads
+                                  * (zero: all of them) */
+  rtsBool        parGcAuto;      /* choose the number of GC threads
+                                  * for each GC */
 
   rtsBool        setAffinity;    /* force thread affinity with CPUs */
+  nat            affinityPolicy; /* how to pick the CPUs (AFFINITY_*) */
+  rtsBool        stealThreads;   /* idle Capabilities ask for threads */
+  nat            maxSpareWorkers; /* idle workers kept per Capability */
+  Time           workerIdleTimeout;
+                                 /* idle workers beyond the first exit
+                                  * after this long (zero: never) */
+  rtsBool        elastic;        /* adjust the number of enabled
+                                  * Capabilities automatically */
+  Time           elasticInterval;
+  rtsBool        sparkThrottle;  /* drop sparks early when most of
+                                  * them fizzle */
+  nat            handoffSpin;    /* times a Task that passed its
+                                  * Capability to a bound thread looks
+                                  * for it again before sleeping */
+  nat            nCapPools;      /* number of --cap-pool flags */
+  CAP_POOL_FLAGS capPools[MAX_CAP_POOLS];
 } PAR_FLAGS;
+
+/* Values for affinityPolicy */
+#define AFFINITY_MODULO   0  /* -qa: Capability n on CPUs n, n+N, n+2N.. */
+#define AFFINITY_COMPACT  1  /* fill the SMT threads of each core in turn */
+#define AFFINITY_SCATTER  2  /* one per core, across sockets, then SMT */
+#define AFFINITY_PHYSICAL 3  /* one SMT thread of each core only */
 #endif /* THREADED_RTS */
 
 /* See Note [Synchronization of flags and base APIs] */
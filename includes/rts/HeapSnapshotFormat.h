@@ -0,0 +1,69 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * The format of the heap snapshots written by hs_heap_snapshot() and
+ * +RTS --heap-snapshot-signal, for tools that analyse them offline.
+ *
+ * This file only contains #defines, so that such tools can include it
+ * without the rest of the RTS headers.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef RTS_HEAPSNAPSHOTFORMAT_H
+#define RTS_HEAPSNAPSHOTFORMAT_H
+
+/*
+ * A snapshot is taken at the end of a major GC, and shows every closure
+ * in the dynamic heap with the pointers it holds.  Static closures are
+ * not part of it, but pointers to them are.
+ *
+ * The file starts with the 8 bytes of HS_SNAP_MAGIC.  Then come records,
+ * each a tag byte followed by its fields:
+ *
+ *   HS_SNAP_HEADER                 -- first, and only once
+ *       uint word size             -- in bytes
+ *       uint generations
+ *       uint time                  -- elapsed, in milliseconds
+ *
+ *   HS_SNAP_CLOSURES
+ *       uint generation
+ *       uint length                -- in bytes, of the closures
+ *       closures, each:
+ *           int  address           -- in words, relative to the end of the
+ *                                  -- previous closure of the record (to 0
+ *                                  -- for the first)
+ *           uint info pointer      -- 0 for a block of pinned objects
+ *           uint closure type      -- as in rts/storage/ClosureTypes.h
+ *           uint size              -- in words
+ *           uint n
+ *           n times: int pointer   -- in words, relative to the closure's
+ *                                  -- address, without the pointer tag
+ *
+ *   HS_SNAP_ROOTS
+ *       uint length                -- in bytes, of the roots
+ *       roots, each: uint address  -- of a closure the program holds on to
+ *                                  -- from outside the heap
+ *
+ *   HS_SNAP_END                    -- last: the snapshot is complete
+ *
+ * The closures of one generation may be spread over many records, in
+ * any order.  The roots are the threads on the run queues, the other
+ * closures the scheduler keeps alive, the weak pointers and the stable
+ * pointers; the static closures the program refers to (the CAFs) are
+ * roots too, but are only known from the pointers to them.
+ *
+ * A uint is a little-endian base-128 varint: 7 bits per byte, least
+ * significant first, with the top bit set on all but the last byte.  An
+ * int is a uint holding (n << 1) for n >= 0 and ~(n << 1) for n < 0.
+ */
+
+#define HS_SNAP_MAGIC           "\211HSN\r\n\032\n"
+#define HS_SNAP_MAGIC_LEN       8
+
+#define HS_SNAP_HEADER          1
+#define HS_SNAP_CLOSURES        2
+#define HS_SNAP_ROOTS           3
+#define HS_SNAP_END             4
+
+#endif /* RTS_HEAPSNAPSHOTFORMAT_H */
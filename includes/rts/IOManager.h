@@ -27,9 +27,17 @@ void     sendIOManagerEvent (HsWord32 event);
 #else
 
 void     setIOManagerControlFd   (nat cap_no, int fd);
-void     setTimerManagerControlFd(int fd);
+void     setTimerManagerControlFd(nat cap_no, int fd);
 void     setIOManagerWakeupFd   (int fd);
 
+// Take up to max queued signals into buf, an array of siginfo_t.
+// Called by the TimerManager; see posix/Signals.c
+HsInt    takePendingSignals     (void *buf, HsInt max);
+
+// Does asyncRead#/asyncWrite# do the I/O in the background?  See
+// posix/AsyncIO.c
+HsBool   rtsSupportsAsyncIO     (void);
+
 #endif
 
 //
@@ -0,0 +1,110 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Layout of the shared memory segment written by +RTS --metrics-shm
+ *
+ * Unlike the other RTS headers this one is meant to be #included by the
+ * programs that read the segment (monitoring agents and the like), so it
+ * only depends on HsFFI.h.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef RTS_METRICS_H
+#define RTS_METRICS_H
+
+#include "HsFFI.h"
+
+/*
+ * The RTS creates the POSIX shared memory object named by
+ * --metrics-shm=<name> (a '/' is prepended if necessary), writes an
+ * RtsMetrics header followed by max_caps RtsMetricsCap entries into it,
+ * and unlinks it when the program exits.  magic is written last, so a
+ * reader should wait until it reads RTS_METRICS_MAGIC, and must check
+ * version before looking at anything else.  Fields are only ever
+ * added at the end of the structures, in which case size grows but the
+ * version stays the same.
+ *
+ * The global statistics are updated at the end of every GC, and each
+ * capability's entry whenever its scheduler starts or stops running a
+ * Haskell thread.  Each is protected by a sequence lock: the writer
+ * increments seq before and after an update, so a consistent snapshot
+ * is one where seq is even and unchanged across the copy:
+ *
+ *     do {
+ *         s = m->seq;  read barrier;
+ *         copy the fields;
+ *         read barrier;
+ *     } while ((s & 1) || s != m->seq);
+ *
+ * All times are in nanoseconds and all sizes in bytes.
+ */
+
+#define RTS_METRICS_MAGIC    0x535243544d434847ULL  /* "GHCMTRCS", little-endian */
+#define RTS_METRICS_VERSION  1
+#define RTS_METRICS_MAX_GENS 8
+
+/* RtsMetricsCap.state */
+#define RTS_METRICS_CAP_SCHEDULER 0   /* in the scheduler, or idle */
+#define RTS_METRICS_CAP_RUNNING   1   /* running a Haskell thread */
+#define RTS_METRICS_CAP_GC        2   /* stopped for a GC */
+#define RTS_METRICS_CAP_DISABLED  3   /* disabled by setNumCapabilities */
+
+typedef struct {
+    volatile HsWord64 seq;
+    HsWord32 state;
+    HsWord32 run_queue_len;     /* threads waiting to run */
+    HsWord64 allocated_bytes;   /* as of the last GC */
+
+    /* sparks (zero in the non-threaded RTS), as of the last GC */
+    HsWord64 sparks_created;
+    HsWord64 sparks_dud;
+    HsWord64 sparks_overflowed;
+    HsWord64 sparks_converted;
+    HsWord64 sparks_gcd;
+    HsWord64 sparks_fizzled;
+} RtsMetricsCap;
+
+typedef struct {
+    /* Fixed when the segment is created */
+    volatile HsWord64 magic;
+    HsWord32 version;
+    HsWord32 size;              /* of the whole segment */
+    HsWord32 max_caps;          /* entries following the header */
+    HsWord32 n_gens;            /* entries of gen_collections in use */
+    HsWord64 pid;
+
+    /* Written without the lock */
+    volatile HsWord32 n_caps;   /* capabilities in use, <= max_caps */
+    volatile HsWord32 in_gc;    /* non-zero while a GC is running */
+
+    /* Protected by seq, updated at the end of each GC */
+    volatile HsWord64 seq;
+    HsWord64 elapsed_ns;        /* time since startup of the update */
+    HsWord64 heap_size_bytes;
+    HsWord64 live_bytes;        /* after the last major GC */
+    HsWord64 max_live_bytes;
+    HsWord64 allocated_bytes;
+    HsWord64 copied_bytes;
+    HsWord64 gcs;
+    HsWord64 major_gcs;
+    HsWord64 gc_cpu_ns;
+    HsWord64 gc_elapsed_ns;
+    HsWord64 last_pause_ns;
+    HsWord64 max_pause_ns;
+    HsWord64 gen_collections[RTS_METRICS_MAX_GENS];
+
+    /* Protected by seq, updated when a GC has stopped the other
+     * capabilities (in the threaded RTS) */
+    HsWord64 last_sync_ns;      /* from the request to the last arrival */
+    HsWord64 max_sync_ns;
+    HsWord64 last_sync_thread;  /* the thread the last capability was
+                                   running, 0 if none */
+    HsWord32 last_sync_cap;     /* the last capability to stop */
+    HsWord32 _pad;
+} RtsMetrics;
+
+#define RTS_METRICS_CAP(m,i) \
+    (&((RtsMetricsCap *)((char *)(m) + sizeof(RtsMetrics)))[i])
+
+#endif /* RTS_METRICS_H */
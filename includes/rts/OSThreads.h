@@ -30,14 +30,27 @@
 #include <pthread.h>
 #include <errno.h>
 
+#if defined(linux_HOST_OS)
+// On Linux condition variables are futexes: see rts/posix/OSThreads.c
+#define USE_FUTEX_CONDITION 1
+typedef struct {
+    volatile StgWord32 seq;     // bumped by every signal and broadcast
+    volatile StgWord32 waiters; // threads in waitCondition()
+} Condition;
+#else
 typedef pthread_cond_t  Condition;
+#endif
 typedef pthread_mutex_t Mutex;
 typedef pthread_t       OSThreadId;
 typedef pthread_key_t   ThreadLocalKey;
 
 #define OSThreadProcAttr /* nothing */
 
+#if defined(USE_FUTEX_CONDITION)
+#define INIT_COND_VAR       {0, 0}
+#else
 #define INIT_COND_VAR       PTHREAD_COND_INITIALIZER
+#endif
 
 #ifdef LOCK_DEBUG
 #define LOCK_DEBUG_BELCH(what, mutex) \
@@ -184,6 +197,13 @@ extern void closeCondition        ( Condition* pCond );
 extern rtsBool broadcastCondition ( Condition* pCond );
 extern rtsBool signalCondition    ( Condition* pCond );
 extern rtsBool waitCondition      ( Condition* pCond, Mutex* pMut );
+// returns rtsFalse if the timeout expired first
+extern rtsBool timedWaitCondition ( Condition* pCond, Mutex* pMut,
+                                    Time timeout );
+// Signal pCond and release pMut, which the caller holds.  The waiter is
+// woken only once pMut is free, so that it doesn't immediately block on
+// it again, and pCond may be freed as soon as pMut has been released.
+extern void unlockAndSignalCondition ( Condition* pCond, Mutex* pMut );
 
 //
 // Mutexes
@@ -191,6 +211,15 @@ extern rtsBool waitCondition      ( Condition* pCond, Mutex* pMut );
 extern void initMutex             ( Mutex* pMut );
 extern void closeMutex            ( Mutex* pMut );
 
+//
+// Sleeping on a word (used by spin locks).  waitOnWord() sleeps while
+// *p == expected, but may also return spuriously; it returns rtsFalse
+// straight away if the OS has no way to do this.  Only values that fit
+// in 32 bits can be waited for.
+//
+extern rtsBool waitOnWord         ( StgVolatilePtr p, StgWord expected );
+extern void    wakeOnWord         ( StgVolatilePtr p );
+
 //
 // Thread-local storage
 //
@@ -200,7 +229,9 @@ void  setThreadLocalVar (ThreadLocalKey *key, void *value);
 void  freeThreadLocalKey (ThreadLocalKey *key);
 
 // Processors and affinity
+void initCpuTopology       (nat policy);
 void setThreadAffinity     (nat n, nat m);
+void setThreadNode         (nat node);
 #endif // !CMINUSMINUS
 
 #else
@@ -0,0 +1,52 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Shared-memory message channels between processes
+ *
+ * Do not #include this file directly: #include "Rts.h" instead.
+ *
+ * To understand the structure of the RTS headers, see the wiki:
+ *   http://ghc.haskell.org/trac/ghc/wiki/Commentary/SourceTree/Includes
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef RTS_SHMCHANNEL_H
+#define RTS_SHMCHANNEL_H
+
+/*
+ * Open the channel in the file path, which should be on a memory file
+ * system such as /dev/shm.  With slots > 0 the channel is created (or
+ * recreated) with that many message buffers of slot_size bytes each;
+ * with slots == 0 an existing channel is opened.  Returns NULL, with
+ * errno set, on failure.  See Note [Shared memory channels] in
+ * rts/ShmChannel.c.
+ */
+void *rts_openShmChannel (const char *path, HsWord slots, HsWord slot_size);
+
+/*
+ * Close a channel.  The messages received from it stay valid; the
+ * channel's mapping goes once they have all been garbage collected.
+ */
+void rts_closeShmChannel (void *chan);
+
+/*
+ * A file descriptor that becomes readable when a message arrives after
+ * receiveShmChannel# found the channel empty, to be waited on with
+ * threadWaitRead.
+ */
+int rts_shmChannelFd (void *chan);
+
+/*
+ * Copy len bytes from buf into a free buffer of the channel and queue
+ * it.  Returns 0, or -1 with errno set: EAGAIN if every buffer is in
+ * use, EMSGSIZE if len is bigger than the channel's buffers.
+ */
+int rts_sendShmChannel (void *chan, const void *buf, HsWord len);
+
+/*
+ * The size of the channel's message buffers.
+ */
+HsWord rts_shmChannelSlotSize (void *chan);
+
+#endif /* RTS_SHMCHANNEL_H */
@@ -4,13 +4,10 @@
  *
  * Spin locks
  *
- * These are simple spin-only locks as opposed to Mutexes which
- * probably spin for a while before blocking in the kernel.  We use
- * these when we are sure that all our threads are actively running on
- * a CPU, eg. in the GC.
- *
- * TODO: measure whether we really need these, or whether Mutexes
- * would do (and be a bit safer if a CPU becomes loaded).
+ * These are locks that spin for a short while before blocking in the
+ * kernel.  We use these when we expect all our threads to be actively
+ * running on a CPU, eg. in the GC, and the lock to be held only
+ * briefly.
  *
  * Do not #include this file directly: #include "Rts.h" instead.
  *
@@ -24,84 +21,76 @@
  
 #if defined(THREADED_RTS)
 
+/*
+ * A spin lock is one of
+ *
+ *   SPIN_LOCK_FREE     not held
+ *   SPIN_LOCK_HELD     held
+ *   SPIN_LOCK_PARKED   held, and other threads may be asleep waiting
+ *                      for it; whoever releases it has to wake one
+ *
+ * The uncontended paths are inline.  A contended ACQUIRE_SPIN_LOCK()
+ * spins for a while (spin_lock_spins iterations, calibrated at startup
+ * to a few microseconds) and then sleeps in the kernel (a futex on
+ * Linux, WaitOnAddress() on Windows), so that a thread waiting for a
+ * lock whose holder has been descheduled doesn't burn its own time
+ * slice too.  Where there is no way to sleep on an address it falls
+ * back to yieldThread().
+ *
+ * Spin locks are used as binary semaphores too (gc_spin and mut_spin),
+ * so a lock may be released by a thread other than the one that took it.
+ */
+#define SPIN_LOCK_HELD   0
+#define SPIN_LOCK_FREE   1
+#define SPIN_LOCK_PARKED 2
+
 #if defined(PROF_SPIN)
 typedef struct SpinLock_
 {
     StgWord   lock;
-    StgWord64 spin; // DEBUG version counts how much it spins
+    StgWord64 spin;      // how much it spins
+    StgWord64 contended; // acquisitions that had to wait
+    StgWord64 parked;    // times a waiter went to sleep
 } SpinLock;
+#define SPIN_LOCK_WORD(p) (&(p)->lock)
 #else
 typedef StgWord SpinLock;
+#define SPIN_LOCK_WORD(p) (p)
 #endif
 
-#if defined(PROF_SPIN)
-
-// PROF_SPIN enables counting the number of times we spin on a lock
+void acquireSpinLockSlow (SpinLock *p);
+void wakeSpinLockWaiter  (SpinLock *p);
 
 // acquire spin lock
 INLINE_HEADER void ACQUIRE_SPIN_LOCK(SpinLock * p)
 {
-    StgWord32 r = 0;
-    nat i;
-    do {
-        for (i = 0; i < SPIN_COUNT; i++) {
-            r = cas((StgVolatilePtr)&(p->lock), 1, 0);
-            if (r != 0) return;
-            p->spin++;
-            busy_wait_nop();
-        }
-        yieldThread();
-    } while (1);
+    if (cas((StgVolatilePtr)SPIN_LOCK_WORD(p),
+            SPIN_LOCK_FREE, SPIN_LOCK_HELD) != SPIN_LOCK_FREE) {
+        acquireSpinLockSlow(p);
+    }
 }
 
 // release spin lock
 INLINE_HEADER void RELEASE_SPIN_LOCK(SpinLock * p)
 {
     write_barrier();
-    p->lock = 1;
+    if (xchg((StgPtr)SPIN_LOCK_WORD(p), SPIN_LOCK_FREE) == SPIN_LOCK_PARKED) {
+        wakeSpinLockWaiter(p);
+    }
 }
 
 // initialise spin lock
 INLINE_HEADER void initSpinLock(SpinLock * p)
 {
     write_barrier();
-    p->lock = 1;
+    *SPIN_LOCK_WORD(p) = SPIN_LOCK_FREE;
+#if defined(PROF_SPIN)
     p->spin = 0;
+    p->contended = 0;
+    p->parked = 0;
+#endif
 }
 
-#else
-
-// acquire spin lock
-INLINE_HEADER void ACQUIRE_SPIN_LOCK(SpinLock * p)
-{
-    StgWord32 r = 0;
-    nat i;
-    do {
-        for (i = 0; i < SPIN_COUNT; i++) {
-            r = cas((StgVolatilePtr)p, 1, 0);
-            if (r != 0) return;
-            busy_wait_nop();
-        }
-        yieldThread();
-    } while (1);
-}
-
-// release spin lock
-INLINE_HEADER void RELEASE_SPIN_LOCK(SpinLock * p)
-{
-    write_barrier();
-    (*p) = 1;
-}
-
-// init spin lock
-INLINE_HEADER void initSpinLock(SpinLock * p)
-{
-    write_barrier();
-    (*p) = 1;
-}
-
-#endif /* PROF_SPIN */
-
 #else /* !THREADED_RTS */
 
 // Using macros here means we don't have to ensure the argument is in scope
@@ -28,7 +28,8 @@ typedef struct {
 } snEntry;
 
 typedef struct {
-    StgPtr addr;
+    StgPtr  addr;                       /* Haskell object, or NULL if free */
+    StgWord link;                       /* next free entry, if free */
 } spEntry;
 
 extern DLL_IMPORT_RTS snEntry *stable_name_table;
@@ -48,6 +48,33 @@ HsInt64 rts_getThreadAllocationCounter   (StgPtr tso);
 void    rts_setThreadAllocationCounter   (StgPtr tso, HsInt64 i);
 void    rts_enableThreadAllocationLimit  (StgPtr tso);
 void    rts_disableThreadAllocationLimit (StgPtr tso);
+HsWord64 rts_getThreadCPUTime            (StgPtr tso);
+HsWord64 rts_getThreadAllocated          (StgPtr tso);
+HsInt   rts_getThreadPretenuring         (StgPtr tso);
+void    rts_setThreadPretenuring         (StgPtr tso, HsInt gen);
+HsInt   rts_getThreadPriority            (StgPtr tso);
+void    rts_setThreadPriority            (StgPtr tso, HsInt priority);
+HsInt   rts_getThreadAccountingGroup     (StgPtr tso);
+void    rts_setThreadAccountingGroup     (StgPtr tso, HsInt group);
+
+// The pool of a Capability (+RTS --cap-pool), from Capability.c
+HsInt   rts_getCapabilityPool            (HsInt cap);
+
+//
+// Accounting groups, from sm/Accounting.c
+//
+HsWord64 rts_getAccountingGroupResidency (HsInt group);
+HsWord64 rts_getAccountingGroupQuota     (HsInt group);
+void     rts_setAccountingGroupQuota     (HsInt group, HsWord64 bytes);
+
+#if !defined(mingw32_HOST_OS)
+// Raise the exception in tso after us microseconds, unless the
+// deadline has been cleared (used by System.Timeout in the
+// non-threaded RTS), see rts/posix/Select.c
+void *  rts_setThreadDeadline            (StgPtr tso, HsInt us,
+                                          HsStablePtr exception);
+void    rts_clearThreadDeadline          (void *deadline);
+#endif
 
 #if !defined(mingw32_HOST_OS)
 pid_t  forkProcess     (HsStablePtr *entry);
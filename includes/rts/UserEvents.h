@@ -0,0 +1,24 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Binary user events (the traceBinaryEvent# primop)
+ *
+ * Do not #include this file directly: #include "Rts.h" instead.
+ *
+ * To understand the structure of the RTS headers, see the wiki:
+ *   http://ghc.haskell.org/trac/ghc/wiki/Commentary/SourceTree/Includes
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef RTS_USEREVENTS_H
+#define RTS_USEREVENTS_H
+
+/*
+ * Give a name to the binary user events with this id, by posting an
+ * EVENT_USER_BINARY_TYPE event.  Does nothing unless user events are
+ * being logged.  Used by Debug.Trace.registerBinaryEventType.
+ */
+void traceUserEventType (StgWord32 id, char *name);
+
+#endif /* RTS_USEREVENTS_H */
@@ -0,0 +1,62 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * The binary heap profile format, written by +RTS -h --binary-heap-profile
+ * and read by hp2ps.
+ *
+ * This file is included by hp2ps as well as the RTS, so it must only
+ * contain #defines.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef RTS_PROF_HEAPPROFILEFORMAT_H
+#define RTS_PROF_HEAPPROFILEFORMAT_H
+
+/*
+ * The .hp file holds the same information as the text format, but each
+ * identifier (cost-centre stack, closure type, ...) is written out only
+ * once, and each sample only lists the identifiers whose value changed
+ * since the previous sample.
+ *
+ * The file starts with the 8 bytes of HP_BIN_MAGIC, which can't start a
+ * text .hp file.  Then come records, each a tag byte followed by its
+ * fields, until the end of the file:
+ *
+ *   HP_BIN_JOB, HP_BIN_DATE, HP_BIN_SAMPLE_UNIT, HP_BIN_VALUE_UNIT
+ *       string                 -- as in the text format
+ *
+ *   HP_BIN_IDENT
+ *       uint id, string name   -- ids are given out in order from 0, and
+ *                              -- each is defined before it is used
+ *   HP_BIN_MARK
+ *       uint time
+ *
+ *   HP_BIN_SAMPLE
+ *       int time-delta         -- since the previous sample (or 0)
+ *       uint n
+ *       n times: uint id, int value-delta
+ *
+ * The value of every identifier starts at 0, and stays the same from one
+ * sample to the next unless the sample has a delta for it; identifiers
+ * whose value is 0 are not part of the sample.
+ *
+ * A uint is a little-endian base-128 varint: 7 bits per byte, least
+ * significant first, with the top bit set on all but the last byte.  An
+ * int is a uint holding (n << 1) for n >= 0 and ~(n << 1) for n < 0.  A
+ * string is a uint length followed by that many bytes.  Times are in
+ * microseconds of the sample unit.
+ */
+
+#define HP_BIN_MAGIC            "\211HPB\r\n\032\n"
+#define HP_BIN_MAGIC_LEN        8
+
+#define HP_BIN_JOB              1
+#define HP_BIN_DATE             2
+#define HP_BIN_SAMPLE_UNIT      3
+#define HP_BIN_VALUE_UNIT       4
+#define HP_BIN_IDENT            5
+#define HP_BIN_MARK             6
+#define HP_BIN_SAMPLE           7
+
+#endif /* RTS_PROF_HEAPPROFILEFORMAT_H */
@@ -78,6 +78,23 @@
 
 /* The block descriptor is 64 bytes on a 64-bit machine, and 32-bytes
  * on a 32-bit machine.
+ *
+ * The size has to be a power of two for Bdescr(), and it is the
+ * smallest one that the fields fit in.  The descriptors of the blocks
+ * of a megablock are consecutive, in its first block, so a GC that
+ * works through the blocks in address order streams them through the
+ * hardware prefetcher.  Bdescr() on an arbitrary object is the
+ * expensive case: evacuate() reads the flags, gen_no and dest_no of
+ * its object's descriptor, and each descriptor is a cache line of its
+ * own on a 64-bit machine, all of whose fields are within that line.
+ * With GcPrefetch=YES the GC prefetches the descriptor together with
+ * the object (prefetch_closure() in rts/sm/GCUtils.h).
+ *
+ * Splitting the hot fields (start, free, link, u, gen_no, flags) from
+ * the cold ones wouldn't help: a lookup already touches exactly one
+ * line.  Sharing a line between two descriptors would need a 32-byte
+ * descriptor on a 64-bit machine, which the fields don't fit in
+ * without recomputing start and gen from the descriptor's address.
  */
 
 // Note: fields marked with [READ ONLY] must not be modified by the
@@ -104,13 +121,15 @@ typedef struct bdescr_ {
         struct bdescr_ *back;  // used (occasionally) for doubly-linked lists
         StgWord *bitmap;       // bitmap for marking GC
         StgPtr  scan;          // scan pointer for copying GC
+        StgWord freed;         // when a free mgroup was freed, in ms
+                               // (see decommitFreeMBlocks())
     } u;
 
     struct generation_ *gen;   // generation
 
     StgWord16 gen_no;          // gen->no, cached
     StgWord16 dest_no;         // number of destination generation
-    StgWord16 _pad1;
+    StgWord16 node;            // which NUMA node the memory lives on
 
     StgWord16 flags;           // block flags, see below
 
@@ -153,6 +172,19 @@ typedef struct bdescr_ {
 #define BF_KNOWN     128
 /* Block was swept in the last generation */
 #define BF_SWEPT     256
+/* Free mgroup whose memory has been given back to the OS */
+#define BF_DECOMMITTED 512
+/* Block belongs to a compact region (all the block descriptors of the
+ * group have this flag, not just the first) */
+#define BF_COMPACT   1024
+/* Block of small pinned objects, with a mark bitmap at the start (see
+ * allocatePinned()) */
+#define BF_PINNED_SMALL 2048
+/* Block is in the frozen heap (see rts/sm/Freeze.c) */
+#define BF_FROZEN    4096
+/* Large object whose payload is an mmap()ed file (see Note [Mapped
+ * byte arrays] in rts/sm/Storage.c) */
+#define BF_MAPPED    8192
 
 /* Finding the block descriptor for a given block -------------------------- */
 
@@ -285,6 +317,12 @@ bdescr *allocBlock(void);
 bdescr *allocGroup_lock(W_ n);
 bdescr *allocBlock_lock(void);
 
+// versions that allocate memory on a particular NUMA node:
+bdescr *allocGroupOnNode(nat node, W_ n);
+bdescr *allocBlockOnNode(nat node);
+bdescr *allocGroupOnNode_lock(nat node, W_ n);
+bdescr *allocBlockOnNode_lock(nat node);
+
 /* De-Allocation ----------------------------------------------------------- */
 
 void freeGroup(bdescr *p);
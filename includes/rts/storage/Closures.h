@@ -167,6 +167,25 @@ typedef struct {
     StgClosure *var;
 } StgMutVar;
 
+/* Compact regions (see rts/sm/CNF.c).  Every block group of a region
+ * starts with an StgCompactNFDataBlock; the first one is followed by
+ * the StgCompactNFData, which is the object the program holds on to.
+ */
+typedef struct StgCompactNFDataBlock_ {
+    struct StgCompactNFDataBlock_ *self;  // where this block is (or was,
+                                          // in a serialised region)
+    struct StgCompactNFData_ *owner;
+    struct StgCompactNFDataBlock_ *next;
+} StgCompactNFDataBlock;
+
+typedef struct StgCompactNFData_ {
+    StgHeader header;                     // stg_COMPACT_NFDATA_info
+    StgWord totalW;                       // words in all the blocks
+    StgWord autoBlockW;                   // size of a new block, in words
+    StgCompactNFDataBlock *nursery;       // where we allocate
+    StgCompactNFDataBlock *last;          // last block of the region
+} StgCompactNFData;
+
 typedef struct _StgUpdateFrame {
     StgHeader  header;
     StgClosure *updatee;
@@ -217,9 +236,13 @@ typedef struct _StgCFinalizerList {
   void (*fptr)(void);
   void *ptr;
   void *eptr;
-  StgWord flag; /* has environment (0 or 1) */
+  StgWord flag; /* CFINALIZER_HAS_ENV and CFINALIZER_IN_GC */
 } StgCFinalizerList;
 
+/* The flag of an StgCFinalizerList */
+#define CFINALIZER_HAS_ENV 1    /* called with eptr as well as ptr */
+#define CFINALIZER_IN_GC   2    /* run by the GC, not the finalizer thread */
+
 /* Byte code objects.  These are fixed size objects with pointers to
  * four arrays, designed so that a BCO can be easily "re-linked" to
  * other BCOs, to facilitate GHC's intelligent recompilation.  The
@@ -323,7 +346,9 @@ typedef struct {
   StgHeader                  header;
   StgClosure                *volatile current_value;
   StgTVarWatchQueue         *volatile first_watch_queue_entry;
-  StgInt                     volatile num_updates;
+  StgWord                    volatile version; /* stm_clock at last update */
+  StgWord                    wakeup_limit; /* threads woken by an update,
+                                              0 for all of them */
 } StgTVar;
 
 typedef struct {
@@ -340,7 +365,7 @@ typedef struct {
   StgClosure                *expected_value;
   StgClosure                *new_value;
 #if defined(THREADED_RTS)
-  StgInt                     num_updates;
+  StgWord                    version;
 #endif
 } TRecEntry;
 
@@ -374,6 +399,9 @@ struct StgTRecHeader_ {
   StgTRecChunk              *current_chunk;
   StgInvariantCheckQueue    *invariants_to_check;
   TRecState                  state;
+  StgWord                    read_version;  /* stm_clock at the start */
+  StgWord                    has_updates;
+  struct TRecIndex_         *index;         /* malloc'd, see STM.c */
 };
 
 typedef struct {
@@ -411,6 +439,13 @@ typedef struct MessageWakeup_ {
     StgTSO   *tso;
 } MessageWakeup;
 
+typedef struct MessageSetPriority_ {
+    StgHeader header;
+    Message  *link;
+    StgTSO   *tso;
+    StgWord   priority;
+} MessageSetPriority;
+
 typedef struct MessageThrowTo_ {
     StgHeader   header;
     struct MessageThrowTo_ *link;
@@ -100,6 +100,14 @@ typedef struct generation_ {
     memcount       n_new_large_words;   // words of new large objects
                                         // (for doYouWantToGC())
 
+    bdescr *       compact_objects;     // compact regions (doubly linked
+                                        // through their first block)
+    memcount       n_compact_blocks;    // no. of blocks in compact regions
+
+    memcount       n_pinned_blocks;     // blocks of small pinned objects
+    memcount       n_pinned_live_words; // words in them found live by the
+                                        // GC that last collected them
+
     memcount       max_blocks;          // max blocks
 
     StgTSO *       threads;             // threads in this gen
@@ -136,10 +144,12 @@ typedef struct generation_ {
     bdescr *     scavenged_large_objects;  // live large objs after GC (d-link)
     memcount     n_scavenged_large_blocks; // size (not count) of above
 
+    bdescr *     live_compact_objects;  // live compact regions after GC
+    memcount     n_live_compact_blocks; // size (not count) of above
+
     bdescr *     bitmap;                // bitmap for compacting collection
 
     StgTSO *     old_threads;
-    StgWeak *    old_weak_ptr_list;
 } generation;
 
 extern generation * generations;
@@ -170,10 +180,16 @@ extern generation * oldest_gen;
                                 allocatePinned, for the
                                 benefit of the ticky-ticky profiler.
 
+   StgPtr allocateMappedFile(Capability *cap, StgInt fd)
+                                Returns a ByteArray# whose payload is
+                                the file fd, mapped read-only, or NULL
+                                with errno set.
+
    -------------------------------------------------------------------------- */
 
 StgPtr  allocate        ( Capability *cap, W_ n );
 StgPtr  allocatePinned  ( Capability *cap, W_ n );
+StgPtr  allocateMappedFile ( Capability *cap, StgInt fd );
 
 /* memory allocator for executable memory */
 typedef void* AdjustorWritable;
@@ -196,6 +212,21 @@ extern W_ large_alloc_lim;
 void performGC(void);
 void performMajorGC(void);
 
+// Register a StablePtr to an IO () action, to be run in a new thread
+// after each major GC that leaves the heap above the soft limit (+RTS
+// --soft-heap-limit).
+void addMemoryPressureHandler (StgStablePtr action);
+
+// Do a major GC, and then freeze the heap that is left: it is never
+// collected again, and the GC no longer writes to it, so that forked
+// processes can share it with their parent.  See rts/sm/Freeze.c.
+void freezeHeap (void);
+
+// Do a major GC, and write the values of the evaluated CAFs to the
+// heap image file given by +RTS --heap-image, for the next run of the
+// same program to start with.  See rts/sm/HeapImage.c.
+void saveHeapImage (void);
+
 /* -----------------------------------------------------------------------------
    The CAF table - used to let us revert CAFs in GHCi
    -------------------------------------------------------------------------- */
@@ -211,6 +242,10 @@ void setKeepCAFs (void);
    Stats
    -------------------------------------------------------------------------- */
 
+// A megablock in use has at most BLOCKS_PER_MBLOCK-1 (< 2^8) free
+// blocks
+#define MBLOCK_FREE_HISTOGRAM_SIZE 8
+
 typedef struct _GCStats {
   StgWord64 bytes_allocated;
   StgWord64 num_gcs;
@@ -230,10 +265,56 @@ typedef struct _GCStats {
   StgDouble gc_wall_seconds;
   StgDouble cpu_seconds;
   StgDouble wall_seconds;
+  // blocks of small pinned objects (see allocatePinned()), and how
+  // much of them is live
+  StgWord64 pinned_bytes;
+  StgWord64 pinned_live_bytes;
+  // elapsed time in each phase of the GC (see GcPhase in rts/Stats.h)
+  StgDouble gc_roots_wall_seconds;
+  StgDouble gc_scav_wall_seconds;
+  StgDouble gc_weak_wall_seconds;
+  StgDouble gc_sweep_wall_seconds;
+  StgDouble gc_nursery_wall_seconds;
+  StgDouble gc_return_mem_wall_seconds;
+  // free memory held by the block allocator: in free groups smaller
+  // than a megablock, and in wholly free megablocks
+  StgWord64 free_block_bytes;
+  StgWord64 free_mblock_bytes;
+  // entry i counts the megablocks in use that have between 2^i and
+  // 2^(i+1)-1 free blocks
+  StgWord64 mblock_free_histogram[MBLOCK_FREE_HISTOGRAM_SIZE];
 } GCStats;
 void getGCStats (GCStats *s);
 rtsBool getGCStatsEnabled (void);
 
+// The distribution of GC pause times (elapsed), from a histogram, so
+// the percentiles are within about 3%
+typedef struct _GCPauseStats {
+  StgWord64 pauses;
+  StgDouble p50_seconds;
+  StgDouble p90_seconds;
+  StgDouble p99_seconds;
+  StgDouble p999_seconds;
+  StgDouble max_seconds;
+} GCPauseStats;
+
+// Minimum mutator utilisation is given for windows of 1ms, 10ms, 100ms
+// and 1s
+#define GC_MMU_WINDOWS 4
+
+typedef struct _GCStatsExt {
+  GCPauseStats all;                 // all GCs
+  GCPauseStats major;               // collections of the oldest generation
+  StgDouble mmu_window_seconds[GC_MMU_WINDOWS];
+  // the smallest fraction of any window of that size spent outside the
+  // GC, or -1 if the program has not run for that long
+  StgDouble mmu[GC_MMU_WINDOWS];
+} GCStatsExt;
+
+// These need GC stats to be enabled, like getGCStats()
+void getGCStatsExt   (GCStatsExt *s);
+void getGCPauseStats (nat gen, GCPauseStats *s);
+
 // These don't change over execution, so do them elsewhere
 //  StgDouble init_cpu_seconds;
 //  StgDouble init_wall_seconds;
@@ -34,7 +34,7 @@ typedef StgWord32 StgThreadID;
  */
 typedef unsigned int StgThreadReturnCode;
 
-#if defined(mingw32_HOST_OS)
+#if defined(mingw32_HOST_OS) || defined(linux_HOST_OS)
 /* results from an async I/O request + its request ID. */
 typedef struct {
   unsigned int reqID;
@@ -51,15 +51,14 @@ typedef union {
   struct MessageThrowTo_ *throwto;
   struct MessageWakeup_  *wakeup;
   StgInt fd;    /* StgInt instead of int, so that it's the same size as the ptrs */
-#if defined(mingw32_HOST_OS)
+#if defined(mingw32_HOST_OS) || defined(linux_HOST_OS)
   StgAsyncIOResult *async_result;
 #endif
 #if !defined(THREADED_RTS)
-  StgWord target;
-    // Only for the non-threaded RTS: the target time for a thread
-    // blocked in threadDelay, in units of 1ms.  This is a
-    // compromise: we don't want to take up much space in the TSO.  If
-    // you want better resolution for threadDelay, use -threaded.
+  StgWord sleep_index;
+    // Only for the non-threaded RTS: the position of a thread blocked
+    // in threadDelay in the sleeping queue, which holds its target
+    // time (see rts/posix/Select.c).
 #endif
 } StgTSOBlockInfo;
 
@@ -174,6 +173,50 @@ typedef struct StgTSO_ {
      */
     StgWord32  tot_stack_size;
 
+    /*
+     * The number of times in a row that this thread has failed to
+     * commit a transaction, for the STM contention manager.
+     */
+    StgWord32  stm_aborts;
+
+    /*
+     * The generation that the GC copies the objects this thread
+     * allocates into, or 0 for the usual path through g0 (see Note
+     * [Pretenuring] in rts/sm/Storage.c).
+     */
+    StgWord32  pretenure_gen;
+
+    /*
+     * From 0 to MAX_THREAD_PRIORITY: the run queue of a Capability
+     * keeps its threads in order of priority, and in the order they
+     * were queued within each (see Note [Thread priorities] in
+     * rts/Schedule.c).
+     */
+    StgWord32  priority;
+
+    /*
+     * The accounting group that the thread's residency goes to, or 0
+     * (see Note [Accounting groups] in rts/sm/Accounting.c).  Inherited
+     * by the threads it forks.
+     */
+    StgWord32  acct_group;
+
+    /*
+     * The CPU time this thread has run for (in ns; only with +RTS
+     * --thread-cpu-time) and the bytes it has allocated, added up by
+     * the scheduler each time the thread stops.  They don't include
+     * the thread's current run.  Use only PK_Word64/ASSIGN_Word64.
+     */
+    StgWord64  cpu_time;
+    StgWord64  allocated;
+
+    /*
+     * When the thread last blocked on a black hole (getMonotonicNSec()),
+     * for EVENT_BLACKHOLE_WAIT.  Only kept while scheduler events are
+     * being traced, 0 otherwise.
+     */
+    StgWord64  blackhole_since;
+
 #ifdef TICKY_TICKY
     /* TICKY-specific stuff would go here. */
 #endif
@@ -119,11 +119,13 @@ RTS_ENTRY(stg_SMALL_MUT_ARR_PTRS_FROZEN0);
 RTS_ENTRY(stg_MUT_VAR_CLEAN);
 RTS_ENTRY(stg_MUT_VAR_DIRTY);
 RTS_ENTRY(stg_END_TSO_QUEUE);
+RTS_ENTRY(stg_COMPACT_NFDATA);
 RTS_ENTRY(stg_GCD_CAF);
 RTS_ENTRY(stg_STM_AWOKEN);
 RTS_ENTRY(stg_MSG_TRY_WAKEUP);
 RTS_ENTRY(stg_MSG_THROWTO);
 RTS_ENTRY(stg_MSG_BLACKHOLE);
+RTS_ENTRY(stg_MSG_SET_PRIORITY);
 RTS_ENTRY(stg_MSG_NULL);
 RTS_ENTRY(stg_MVAR_TSO_QUEUE);
 RTS_ENTRY(stg_catch);
@@ -242,6 +244,8 @@ RTS_RET(stg_ap_pppv);
 RTS_RET(stg_ap_pppp);
 RTS_RET(stg_ap_ppppp);
 RTS_RET(stg_ap_pppppp);
+RTS_RET(stg_ap_ppppppp);
+RTS_RET(stg_ap_pppppppp);
 
 RTS_FUN_DECL(stg_ap_0_fast);
 RTS_FUN_DECL(stg_ap_v_fast);
@@ -261,6 +265,8 @@ RTS_FUN_DECL(stg_ap_pppv_fast);
 RTS_FUN_DECL(stg_ap_pppp_fast);
 RTS_FUN_DECL(stg_ap_ppppp_fast);
 RTS_FUN_DECL(stg_ap_pppppp_fast);
+RTS_FUN_DECL(stg_ap_ppppppp_fast);
+RTS_FUN_DECL(stg_ap_pppppppp_fast);
 RTS_FUN_DECL(stg_PAP_apply);
 
 /* standard GC & stack check entry points, all defined in HeapStackCheck.hc */
@@ -310,7 +316,7 @@ RTS_RET(stg_block_takemvar);
 RTS_RET(stg_block_readmvar);
 RTS_FUN_DECL(stg_block_putmvar);
 RTS_RET(stg_block_putmvar);
-#ifdef mingw32_HOST_OS
+#if defined(mingw32_HOST_OS) || defined(linux_HOST_OS)
 RTS_FUN_DECL(stg_block_async);
 RTS_RET(stg_block_async);
 RTS_FUN_DECL(stg_block_async_void);
@@ -348,6 +354,8 @@ RTS_FUN_DECL(stg_casArrayzh);
 RTS_FUN_DECL(stg_newByteArrayzh);
 RTS_FUN_DECL(stg_newPinnedByteArrayzh);
 RTS_FUN_DECL(stg_newAlignedPinnedByteArrayzh);
+RTS_FUN_DECL(stg_mapFileByteArrayzh);
+RTS_FUN_DECL(stg_receiveShmChannelzh);
 RTS_FUN_DECL(stg_shrinkMutableByteArrayzh);
 RTS_FUN_DECL(stg_resizzeMutableByteArrayzh);
 RTS_FUN_DECL(stg_casIntArrayzh);
@@ -372,9 +380,27 @@ RTS_FUN_DECL(stg_copySmallArrayzh);
 RTS_FUN_DECL(stg_copySmallMutableArrayzh);
 RTS_FUN_DECL(stg_casSmallArrayzh);
 
+RTS_FUN_DECL(stg_compactNewzh);
+RTS_FUN_DECL(stg_compactAddzh);
+RTS_FUN_DECL(stg_compactContainszh);
+RTS_FUN_DECL(stg_compactSizzezh);
+RTS_FUN_DECL(stg_compactGetFirstBlockzh);
+RTS_FUN_DECL(stg_compactGetNextBlockzh);
+RTS_FUN_DECL(stg_compactAllocateBlockzh);
+RTS_FUN_DECL(stg_compactFixupPointerszh);
+
+RTS_FUN_DECL(stg_newRingBufferzh);
+RTS_FUN_DECL(stg_ringPutzh);
+RTS_FUN_DECL(stg_ringTakezh);
+RTS_FUN_DECL(stg_ringTakeManyzh);
+RTS_FUN_DECL(stg_ringClearWaitingzh);
+
 RTS_FUN_DECL(stg_newMutVarzh);
 RTS_FUN_DECL(stg_atomicModifyMutVarzh);
 RTS_FUN_DECL(stg_casMutVarzh);
+RTS_FUN_DECL(stg_casDoubleWordArrayzh);
+RTS_FUN_DECL(stg_casDoubleWordOffAddrzh);
+RTS_FUN_DECL(stg_atomicSwapMutVarzh);
 
 RTS_FUN_DECL(stg_isEmptyMVarzh);
 RTS_FUN_DECL(stg_newMVarzh);
@@ -388,9 +414,11 @@ RTS_FUN_DECL(stg_tryReadMVarzh);
 RTS_FUN_DECL(stg_waitReadzh);
 RTS_FUN_DECL(stg_waitWritezh);
 RTS_FUN_DECL(stg_delayzh);
-#ifdef mingw32_HOST_OS
+#if defined(mingw32_HOST_OS) || defined(linux_HOST_OS)
 RTS_FUN_DECL(stg_asyncReadzh);
 RTS_FUN_DECL(stg_asyncWritezh);
+#endif
+#ifdef mingw32_HOST_OS
 RTS_FUN_DECL(stg_asyncDoProczh);
 #endif
 
@@ -434,6 +462,7 @@ RTS_FUN_DECL(stg_newTVarzh);
 RTS_FUN_DECL(stg_readTVarzh);
 RTS_FUN_DECL(stg_readTVarIOzh);
 RTS_FUN_DECL(stg_writeTVarzh);
+RTS_FUN_DECL(stg_setTVarWakeupLimitzh);
 RTS_FUN_DECL(stg_checkzh);
 
 RTS_FUN_DECL(stg_unpackClosurezh);
@@ -446,6 +475,7 @@ RTS_FUN_DECL(stg_noDuplicatezh);
 RTS_FUN_DECL(stg_traceCcszh);
 RTS_FUN_DECL(stg_traceEventzh);
 RTS_FUN_DECL(stg_traceMarkerzh);
+RTS_FUN_DECL(stg_traceBinaryEventzh);
 
 /* Other misc stuff */
 // See wiki:Commentary/Compiler/Backends/PprC#Prototypes
@@ -459,7 +489,6 @@ extern StgWord rts_breakpoint_io_action[];
 
 // Schedule.c
 extern StgWord RTS_VAR(blocked_queue_hd), RTS_VAR(blocked_queue_tl);
-extern StgWord RTS_VAR(sleeping_queue);
 extern StgWord RTS_VAR(blackhole_queue);
 extern StgWord RTS_VAR(sched_mutex);
 
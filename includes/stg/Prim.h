@@ -43,6 +43,8 @@ StgWord hs_cmpxchg8(volatile StgWord8 *x, StgWord old, StgWord new);
 StgWord hs_cmpxchg16(volatile StgWord16 *x, StgWord old, StgWord new);
 StgWord hs_cmpxchg32(volatile StgWord32 *x, StgWord old, StgWord new);
 StgWord hs_cmpxchg64(volatile StgWord64 *x, StgWord64 old, StgWord64 new);
+StgWord hs_cmpxchg128(volatile StgWord64 *x, StgWord64 old0, StgWord64 old1,
+                      StgWord64 new0, StgWord64 new1, StgWord64 *cur);
 StgWord hs_atomicread8(volatile StgWord8 *x);
 StgWord hs_atomicread16(volatile StgWord16 *x);
 StgWord hs_atomicread32(volatile StgWord32 *x);
@@ -56,6 +58,9 @@ void hs_atomicwrite64(volatile StgWord64 *x, StgWord64 val);
 StgWord16 hs_bswap16(StgWord16 x);
 StgWord32 hs_bswap32(StgWord32 x);
 StgWord64 hs_bswap64(StgWord64 x);
+void hs_bswap16_array(StgWord16 *dst, const StgWord16 *src, StgWord n);
+void hs_bswap32_array(StgWord32 *dst, const StgWord32 *src, StgWord n);
+void hs_bswap64_array(StgWord64 *dst, const StgWord64 *src, StgWord n);
 
 /* TODO: longlong.c */
 
@@ -65,6 +70,7 @@ StgWord hs_popcnt16(StgWord x);
 StgWord hs_popcnt32(StgWord x);
 StgWord hs_popcnt64(StgWord64 x);
 StgWord hs_popcnt(StgWord x);
+StgWord hs_popcnt_bytes(const StgWord8 *p, StgWord n);
 
 /* libraries/ghc-prim/cbits/word2float.c */
 StgFloat hs_word2float32(StgWord x);
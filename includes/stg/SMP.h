@@ -460,4 +460,85 @@ atomic_dec(StgVolatilePtr p)
 
 #endif /* !THREADED_RTS */
 
+#if !IN_STG_CODE || IN_STGCRUN
+/*
+ * Double-word compare-and-swap, for tagged pointers and the like.
+ * Atomically does this:
+ *
+ * cas2w(p,o1,o2,n1,n2,cur) {
+ *    cur[0] = p[0]; cur[1] = p[1];
+ *    if (cur[0] == o1 && cur[1] == o2) { p[0] = n1; p[1] = n2; }
+ *    return (cur[0] == o1 && cur[1] == o2);
+ * }
+ *
+ * p must be aligned to two words.  Unlike cas(), this is atomic in the
+ * non-threaded RTS too: casDoubleWord*# and ghc-prim's hs_cmpxchg128
+ * are for Haskell code, which may share the memory with other OS
+ * threads.  Implies a full memory barrier.
+ */
+EXTERN_INLINE StgWord cas2w(StgVolatilePtr p, StgWord o1, StgWord o2,
+                            StgWord n1, StgWord n2, StgWord *cur);
+EXTERN_INLINE StgWord
+cas2w(StgVolatilePtr p, StgWord o1, StgWord o2,
+      StgWord n1, StgWord n2, StgWord *cur)
+{
+#if defined(x86_64_HOST_ARCH)
+    StgWord8 ok;
+    __asm__ __volatile__ (
+        "lock\ncmpxchg16b %1\n\tsetz %0"
+        : "=q" (ok), "+m" (*p), "+a" (o1), "+d" (o2)
+        : "b" (n1), "c" (n2)
+        : "memory", "cc");
+    cur[0] = o1;
+    cur[1] = o2;
+    return ok;
+#elif defined(aarch64_HOST_ARCH)
+    StgWord r1, r2;
+    unsigned int fail;
+    do {
+        __asm__ __volatile__ (
+            "ldaxp %0, %1, %2"
+            : "=&r" (r1), "=&r" (r2)
+            : "Q" (*p)
+            : "memory");
+        // store what we found if it isn't what we want: only a
+        // successful store-exclusive makes the load of the pair atomic
+        if (r1 != o1 || r2 != o2) {
+            n1 = r1;
+            n2 = r2;
+        }
+        __asm__ __volatile__ (
+            "stlxp %w0, %2, %3, %1"
+            : "=&r" (fail), "=Q" (*p)
+            : "r" (n1), "r" (n2)
+            : "memory");
+    } while (fail);
+    cur[0] = r1;
+    cur[1] = r2;
+    return (r1 == o1 && r2 == o2);
+#elif WORD_SIZE_IN_BITS == 32
+    // a double word is 64 bits, which GCC can do on its own
+    union { StgWord w[2]; StgWord64 d; } o, n, r;
+    o.w[0] = o1; o.w[1] = o2;
+    n.w[0] = n1; n.w[1] = n2;
+    r.d = __sync_val_compare_and_swap((volatile StgWord64 *)p, o.d, n.d);
+    cur[0] = r.w[0];
+    cur[1] = r.w[1];
+    return (r.d == o.d);
+#else
+    // other 64-bit platforms: GCC may need libatomic for this
+    union { StgWord w[2]; unsigned __int128 d; } o, n;
+    StgWord ok;
+    o.w[0] = o1; o.w[1] = o2;
+    n.w[0] = n1; n.w[1] = n2;
+    ok = __atomic_compare_exchange_n(
+        (volatile unsigned __int128 *)p, &o.d, n.d, 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    cur[0] = o.w[0];
+    cur[1] = o.w[1];
+    return ok;
+#endif
+}
+#endif
+
 #endif /* SMP_H */
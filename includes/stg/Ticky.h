@@ -39,7 +39,14 @@ extern W_ top_ct[];
    TICKY_C is defined only in rts/Ticky.c */
 #ifdef TICKY_C
 #define INIT(ializer) = ializer
+/* Every Capability bumps the same counters, so in the threaded RTS each
+   one gets a cache line to itself: that way they only contend with the
+   same counter on other Capabilities, not with their neighbours too */
+#if defined(THREADED_RTS) && !defined(mingw32_HOST_OS) && defined(__GNUC__)
+#define EXTERN __attribute__((aligned(64)))
+#else
 #define EXTERN
+#endif
 #else
 #define INIT(ializer)
 #define EXTERN extern
@@ -80,6 +87,8 @@ EXTERN StgInt SLOW_CALL_fast_pppv_ctr INIT(0);
 EXTERN StgInt SLOW_CALL_fast_pppp_ctr INIT(0);
 EXTERN StgInt SLOW_CALL_fast_ppppp_ctr INIT(0);
 EXTERN StgInt SLOW_CALL_fast_pppppp_ctr INIT(0);
+EXTERN StgInt SLOW_CALL_fast_ppppppp_ctr INIT(0);
+EXTERN StgInt SLOW_CALL_fast_pppppppp_ctr INIT(0);
 EXTERN StgInt VERY_SLOW_CALL_ctr INIT(0);
 
 EXTERN StgInt ticky_slow_call_unevald;
@@ -0,0 +1,218 @@
+{-# LANGUAGE Trustworthy #-}
+{-# LANGUAGE MagicHash, UnboxedTuples, GHCForeignImportPrim,
+             UnliftedFFITypes #-}
+
+-----------------------------------------------------------------------------
+-- |
+-- Module      :  Control.Concurrent.BoundedChan
+-- Copyright   :  (c) The University of Glasgow 2016
+-- License     :  BSD-style (see the file libraries/base/LICENSE)
+--
+-- Maintainer  :  libraries@haskell.org
+-- Stability   :  experimental
+-- Portability :  non-portable (concurrency)
+--
+-- Bounded FIFO channels, for producer/consumer pipelines.
+--
+-----------------------------------------------------------------------------
+
+module Control.Concurrent.BoundedChan
+        ( -- * Bounded channels
+          BoundedChan,          -- abstract
+          newBoundedChan,       -- :: Int -> IO (BoundedChan a)
+          writeBoundedChan,     -- :: BoundedChan a -> a -> IO ()
+          readBoundedChan,      -- :: BoundedChan a -> IO a
+          readBoundedChanMany   -- :: BoundedChan a -> Int -> IO [a]
+        ) where
+
+import Control.Concurrent.MVar ( MVar, newEmptyMVar, takeMVar, tryTakeMVar
+                               , putMVar, newMVar, tryPutMVar )
+import Control.Exception
+import Data.Maybe
+import GHC.Base
+import GHC.List ( null, reverse )
+
+-- | A 'BoundedChan' is a FIFO channel that holds at most a fixed number
+-- of elements: 'writeBoundedChan' blocks while it is full, and
+-- 'readBoundedChan' blocks while it is empty.
+--
+-- The elements are kept in a ring buffer in the RTS (see \"Ring
+-- buffers\" in @rts/PrimOps.cmm@), which is locked once per operation.
+-- Threads only block, and only have to be woken up, when the channel is
+-- full or empty, so a producer and a consumer on different capabilities
+-- that keep up with each other don't exchange a wakeup for every element,
+-- as they would with a 'Control.Concurrent.Chan.Chan'.
+-- 'readBoundedChanMany' takes all the elements that are there at once.
+--
+-- Blocked threads are woken up in FIFO order, but a thread that didn't
+-- have to block may overtake them.
+--
+data BoundedChan a = BoundedChan (MutableArray# RealWorld Any)
+                                 !(MVar Waiters)
+
+instance Eq (BoundedChan a) where
+  BoundedChan r1 _ == BoundedChan r2 _ = isTrue# (sameMutableArray# r1 r2)
+
+-- The threads that found the ring empty (readers) or full (writers).
+-- Each queue is (xs, ys), standing for xs ++ reverse ys, of empty
+-- (MVar ())s, as in Control.Concurrent.QSem: to wake a thread up we
+-- put () into its MVar, and a thread takes itself off the queue by
+-- doing the same if it gets an exception while blocked.  A thread that
+-- has been woken up tries again, and it queues up again if somebody has
+-- beaten it to the element or the slot.
+--
+-- The queues are only changed with the MVar taken.  The ring has a flag
+-- for each queue, which a slow-path ring operation sets when it fails,
+-- and which we clear when the queue becomes empty.  While a flag is set
+-- the fast paths fail, so that the threads that could wake up a waiter
+-- come here.
+data Waiters = Waiters [MVar ()] [MVar ()]      -- readers
+                       [MVar ()] [MVar ()]      -- writers
+
+foreign import prim "stg_newRingBufferzh"
+  newRingBuffer# :: Int# -> State# RealWorld
+                 -> (# State# RealWorld, MutableArray# RealWorld Any #)
+foreign import prim "stg_ringPutzh"
+  ringPut# :: MutableArray# RealWorld Any -> Any -> Int# -> State# RealWorld
+           -> (# State# RealWorld, Int# #)
+foreign import prim "stg_ringTakezh"
+  ringTake# :: MutableArray# RealWorld Any -> Int# -> State# RealWorld
+            -> (# State# RealWorld, Int#, Any #)
+foreign import prim "stg_ringTakeManyzh"
+  ringTakeMany# :: MutableArray# RealWorld Any -> MutableArray# RealWorld Any
+                -> State# RealWorld -> (# State# RealWorld, Int# #)
+foreign import prim "stg_ringClearWaitingzh"
+  ringClearWaiting# :: MutableArray# RealWorld Any -> Int# -> State# RealWorld
+                    -> State# RealWorld
+
+-- The flags, as in rts/PrimOps.cmm
+readersWaiting, writersWaiting :: Int#
+readersWaiting = 1#
+writersWaiting = 2#
+
+-- |Build a new 'BoundedChan' that holds at most the given number of
+-- elements, which must be at least 1.
+newBoundedChan :: Int -> IO (BoundedChan a)
+newBoundedChan (I# n)
+  | isTrue# (n <# 1#) = fail "newBoundedChan: size must be at least 1"
+  | otherwise         = do
+      m <- newMVar (Waiters [] [] [] [])
+      IO $ \s -> case newRingBuffer# n s of
+                   (# s', r #) -> (# s', BoundedChan r m #)
+
+-- |Write a value to a 'BoundedChan', blocking while it is full.
+writeBoundedChan :: BoundedChan a -> a -> IO ()
+writeBoundedChan (BoundedChan r m) x = do
+  ok <- ringPut r x 0#
+  if ok then return () else mask_ slow
+  where
+    slow = do
+      Waiters rs1 rs2 ws1 ws2 <- takeMVar m
+      ok <- ringPut r x 1#
+      if ok
+         then do
+           (rs1', rs2') <- wake r readersWaiting rs1 rs2
+           putMVar m (Waiters rs1' rs2' ws1 ws2)
+         else do
+           b <- newEmptyMVar
+           putMVar m (Waiters rs1 rs2 ws1 (b:ws2))
+           wait r m True b
+           slow
+
+-- |Read the next value from a 'BoundedChan', blocking while it is empty.
+readBoundedChan :: BoundedChan a -> IO a
+readBoundedChan (BoundedChan r m) = do
+  mx <- ringTake r 0#
+  case mx of
+    Just x  -> return x
+    Nothing -> mask_ slow
+  where
+    slow = do
+      Waiters rs1 rs2 ws1 ws2 <- takeMVar m
+      mx <- ringTake r 1#
+      case mx of
+        Just x -> do
+          (ws1', ws2') <- wake r writersWaiting ws1 ws2
+          putMVar m (Waiters rs1 rs2 ws1' ws2')
+          return x
+        Nothing -> do
+          b <- newEmptyMVar
+          putMVar m (Waiters rs1 (b:rs2) ws1 ws2)
+          wait r m False b
+          slow
+
+-- |Read at most the given number of values from a 'BoundedChan', and at
+-- least one: if it is empty, this blocks like 'readBoundedChan'.  The
+-- values come out in the order they were written.
+readBoundedChanMany :: BoundedChan a -> Int -> IO [a]
+readBoundedChanMany c@(BoundedChan r _) (I# n)
+  | isTrue# (n <# 1#) = return []
+  | otherwise         = do
+      xs <- IO $ \s ->
+              case newArray# n (unsafeCoerce# ()) s of
+                (# s1, dst #) -> case ringTakeMany# r dst s1 of
+                  (# s2, k #) -> arrayElems dst k s2
+      case xs of
+        -- empty, or a writer is waiting and has to be woken up
+        [] -> do x <- readBoundedChan c; return [x]
+        _  -> return xs
+
+-- Block until we are woken up.  If we get an exception first, take
+-- ourselves off the queue, or if the wakeup has arrived in the meantime,
+-- pass it on to the next thread so that it doesn't get lost.
+wait :: MutableArray# RealWorld Any -> MVar Waiters -> Bool -> MVar ()
+     -> IO ()
+wait r m writer b =
+  takeMVar b `onException`
+    (uninterruptibleMask_ $ do -- Note [signal uninterruptible] in QSem
+       w@(Waiters rs1 rs2 ws1 ws2) <- takeMVar m
+       woken <- tryTakeMVar b
+       w' <- if isNothing woken
+                then do putMVar b (); return w
+                else if writer
+                  then do (ws1', ws2') <- wake r writersWaiting ws1 ws2
+                          return (Waiters rs1 rs2 ws1' ws2')
+                  else do (rs1', rs2') <- wake r readersWaiting rs1 rs2
+                          return (Waiters rs1' rs2' ws1 ws2)
+       putMVar m w')
+
+-- Wake up the first thread on a queue, skipping the ones that have gone
+-- away, and clear the ring's flag for the queue if it is then empty.
+wake :: MutableArray# RealWorld Any -> Int# -> [MVar ()] -> [MVar ()]
+     -> IO ([MVar ()], [MVar ()])
+wake r flag = loop
+  where
+    loop [] [] = do clearWaiting r flag; return ([], [])
+    loop [] ys = loop (reverse ys) []
+    loop (b:bs) ys = do
+      ok <- tryPutMVar b ()
+      if not ok
+         then loop bs ys
+         else do
+           when (null bs && null ys) $ clearWaiting r flag
+           return (bs, ys)
+
+ringPut :: MutableArray# RealWorld Any -> a -> Int# -> IO Bool
+ringPut r x force = IO $ \s ->
+  case ringPut# r (unsafeCoerce# x) force s of
+    (# s', ok #) -> (# s', isTrue# ok #)
+
+ringTake :: MutableArray# RealWorld Any -> Int# -> IO (Maybe a)
+ringTake r force = IO $ \s ->
+  case ringTake# r force s of
+    (# s', 0#, _ #) -> (# s', Nothing #)
+    (# s', _,  x #) -> (# s', Just (unsafeCoerce# x) #)
+
+clearWaiting :: MutableArray# RealWorld Any -> Int# -> IO ()
+clearWaiting r flag = IO $ \s ->
+  case ringClearWaiting# r flag s of s' -> (# s', () #)
+
+-- The first k elements of an array, as a list
+arrayElems :: MutableArray# RealWorld Any -> Int# -> State# RealWorld
+           -> (# State# RealWorld, [a] #)
+arrayElems arr k = go (k -# 1#) []
+  where
+    go i acc s
+      | isTrue# (i <# 0#) = (# s, acc #)
+      | otherwise = case readArray# arr i s of
+          (# s', x #) -> go (i -# 1#) (unsafeCoerce# x : acc) s'
@@ -27,6 +27,7 @@ module Data.IORef
         atomicModifyIORef,
         atomicModifyIORef',
         atomicWriteIORef,
+        atomicSwapIORef,
 
 #if !defined(__PARALLEL_HASKELL__)
         mkWeakIORef,
@@ -100,25 +101,14 @@ modifyIORef' ref f = do
 atomicModifyIORef :: IORef a -> (a -> (a,b)) -> IO b
 atomicModifyIORef = GHC.IORef.atomicModifyIORef
 
--- | Strict version of 'atomicModifyIORef'.  This forces both the value stored
--- in the 'IORef' as well as the value returned.
---
--- @since 4.6.0.0
-atomicModifyIORef' :: IORef a -> (a -> (a,b)) -> IO b
-atomicModifyIORef' ref f = do
-    b <- atomicModifyIORef ref $ \a ->
-            case f a of
-                v@(a',_) -> a' `seq` v
-    b `seq` return b
-
 -- | Variant of 'writeIORef' with the \"barrier to reordering\" property that
 -- 'atomicModifyIORef' has.
 --
 -- @since 4.6.0.0
 atomicWriteIORef :: IORef a -> a -> IO ()
 atomicWriteIORef ref a = do
-    x <- atomicModifyIORef ref (\_ -> (a, ()))
-    x `seq` return ()
+    _ <- atomicSwapIORef ref a
+    return ()
 
 {- $memmodel
 
@@ -42,6 +42,10 @@ module Debug.Trace (
         -- $markers
         traceMarker,
         traceMarkerIO,
+
+        -- * Binary events
+        -- $binary_events
+        registerBinaryEventType,
   ) where
 
 import System.IO.Unsafe
@@ -53,6 +57,7 @@ import GHC.IO.Encoding
 import GHC.Ptr
 import GHC.Show
 import GHC.Stack
+import GHC.Word
 import Data.List
 
 -- $tracing
@@ -287,3 +292,23 @@ traceMarkerIO :: String -> IO ()
 traceMarkerIO msg =
   GHC.Foreign.withCString utf8 msg $ \(Ptr p) -> IO $ \s ->
     case traceMarker# p s of s' -> (# s', () #)
+
+-- $binary_events
+--
+-- Formatting a message for 'traceEventIO' is too slow for code that
+-- emits many events a second.  The @traceBinaryEvent#@ primop (from
+-- "GHC.Exts") instead copies bytes straight from a @ByteArray#@ into
+-- the eventlog, along with a number saying what kind of event it is.
+-- 'registerBinaryEventType' puts a name for such a number in the
+-- eventlog, for tools to show.
+
+-- | Name the binary events with the given number, if eventlog profiling
+-- is available and enabled at runtime.
+--
+-- @since 4.8.1.0
+registerBinaryEventType :: Word32 -> String -> IO ()
+registerBinaryEventType n name =
+  GHC.Foreign.withCString utf8 name $ \p -> c_traceUserEventType n p
+
+foreign import ccall unsafe "traceUserEventType"
+  c_traceUserEventType :: Word32 -> CString -> IO ()
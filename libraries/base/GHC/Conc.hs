@@ -34,6 +34,7 @@ module GHC.Conc
         , getNumCapabilities
         , setNumCapabilities
         , getNumProcessors
+        , capabilityPool
         , numSparks
         , childHandler
         , myThreadId
@@ -65,6 +66,26 @@ module GHC.Conc
         , enableAllocationLimit
         , disableAllocationLimit
 
+        -- * Per-thread CPU time and allocation
+        , threadCPUTime
+        , threadAllocated
+
+        -- * Thread priorities
+        , setThreadPriority
+        , threadPriority
+
+        -- * Accounting groups
+        , setAccountingGroup
+        , accountingGroup
+        , setAccountingGroupQuota
+        , accountingGroupQuota
+        , accountingGroupResidency
+
+        -- * Pretenuring
+        , setPretenureGeneration
+        , getPretenureGeneration
+        , withPretenuring
+
         -- * TVars
         , STM(..)
         , atomically
@@ -80,6 +101,7 @@ module GHC.Conc
         , readTVar
         , readTVarIO
         , writeTVar
+        , setTVarWakeupLimit
         , unsafeIOToSTM
 
         -- * Miscellaneous
@@ -50,6 +50,9 @@ module GHC.Conc.IO
         , ConsoleEvent(..)
         , win32ConsoleHandler
         , toWin32ConsoleEvent
+#elif defined(linux_HOST_OS)
+        , asyncRead
+        , asyncWrite
 #endif
         ) where
 
@@ -67,6 +70,26 @@ import GHC.Conc.Windows (asyncRead, asyncWrite, asyncDoProc, asyncReadBA,
 #else
 import qualified GHC.Event.Thread as Event
 #endif
+#if defined(linux_HOST_OS)
+import GHC.Ptr (Ptr(..))
+#endif
+
+#if defined(linux_HOST_OS)
+-- | Read into a buffer in the background (non-threaded RTS only):
+-- the other Haskell threads keep running until the read is done.
+-- The buffer must be pinned, and kept alive until this returns.
+-- Returns the number of bytes read, or -1 and the errno.
+asyncRead :: Int -> Int -> Int -> Ptr a -> IO (Int, Int)
+asyncRead  (I# fd) (I# isSock) (I# len) (Ptr buf) =
+  IO $ \s -> case asyncRead# fd isSock len buf s of
+               (# s', len#, err# #) -> (# s', (I# len#, I# err#) #)
+
+-- | Like 'asyncRead', for writing from the buffer.
+asyncWrite :: Int -> Int -> Int -> Ptr a -> IO (Int, Int)
+asyncWrite  (I# fd) (I# isSock) (I# len) (Ptr buf) =
+  IO $ \s -> case asyncWrite# fd isSock len buf s of
+               (# s', len#, err# #) -> (# s', (I# len#, I# err#) #)
+#endif
 
 ensureIOManagerIsRunning :: IO ()
 #ifndef mingw32_HOST_OS
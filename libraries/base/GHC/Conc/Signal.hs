@@ -1,5 +1,5 @@
 {-# LANGUAGE Trustworthy #-}
-{-# LANGUAGE NoImplicitPrelude #-}
+{-# LANGUAGE CPP, NoImplicitPrelude #-}
 
 module GHC.Conc.Signal
         ( Signal
@@ -7,11 +7,15 @@ module GHC.Conc.Signal
         , setHandler
         , runHandlers
         , runHandlersPtr
+        , runHandlersBatchPtr
+#if !defined(mingw32_HOST_OS)
+        , runPendingHandlers
+#endif
         ) where
 
 import Control.Concurrent.MVar (MVar, newMVar, withMVar)
 import Data.Dynamic (Dynamic)
-import Foreign.C.Types (CInt)
+import Foreign.C.Types (CInt(..))
 import Foreign.ForeignPtr (ForeignPtr, newForeignPtr)
 import Foreign.StablePtr (castPtrToStablePtr, castStablePtrToPtr,
                           deRefStablePtr, freeStablePtr, newStablePtr)
@@ -25,6 +29,16 @@ import GHC.IOArray (IOArray, boundsIOArray, newIOArray,
                     unsafeReadIOArray, unsafeWriteIOArray)
 import GHC.Real (fromIntegral)
 import GHC.Word (Word8)
+#if !defined(mingw32_HOST_OS)
+import Foreign.C.Types (CSize(..))
+import Foreign.ForeignPtr (mallocForeignPtrBytes, withForeignPtr)
+import Foreign.Marshal.Alloc (free, mallocBytes)
+import Foreign.Marshal.Utils (copyBytes)
+import Foreign.Ptr (plusPtr)
+import GHC.Conc.Sync (childHandler)
+import GHC.IO (catchException)
+import GHC.Num ((*), (+))
+#endif
 
 ------------------------------------------------------------------------
 -- Signal handling
@@ -60,17 +74,21 @@ setHandler sig handler = do
               unsafeWriteIOArray arr int handler
               return old
 
-runHandlers :: ForeignPtr Word8 -> Signal -> IO ()
-runHandlers p_info sig = do
+lookupHandler :: Signal -> IO (Maybe (HandlerFun, Dynamic))
+lookupHandler sig = do
   let int = fromIntegral sig
   withMVar signal_handlers $ \arr ->
     if not (inRange (boundsIOArray arr) int)
-      then return ()
-      else do handler <- unsafeReadIOArray arr int
-              case handler of
-                Nothing -> return ()
-                Just (f,_)  -> do _ <- forkIO (f p_info)
-                                  return ()
+      then return Nothing
+      else unsafeReadIOArray arr int
+
+runHandlers :: ForeignPtr Word8 -> Signal -> IO ()
+runHandlers p_info sig = do
+  handler <- lookupHandler sig
+  case handler of
+    Nothing -> return ()
+    Just (f,_)  -> do _ <- forkIO (f p_info)
+                      return ()
 
 -- It is our responsibility to free the memory buffer, so we create a
 -- foreignPtr.
@@ -79,6 +97,59 @@ runHandlersPtr p s = do
   fp <- newForeignPtr finalizerFree p
   runHandlers fp s
 
+-- | Run the handlers for a batch of signals, whose @siginfo_t@s the RTS
+-- has laid out one after another in a buffer that we must free.  The
+-- handlers run one after another in the calling thread, rather than in
+-- a thread each; an exception from one of them is reported as if it
+-- had been thrown in a thread of its own, and the rest still run.
+runHandlersBatchPtr :: Ptr Word8 -> Int -> IO ()
+#if !defined(mingw32_HOST_OS)
+runHandlersBatchPtr p n = go 0
+  where
+    sz = fromIntegral sizeof_siginfo_t
+
+    go i | i == n    = free p
+         | otherwise = do
+             let p_info = p `plusPtr` (i * sz)
+             sig <- siginfo_signo p_info
+             handler <- lookupHandler sig
+             case handler of
+               Nothing    -> return ()
+               Just (f,_) -> do
+                 fp <- mallocForeignPtrBytes sz
+                 withForeignPtr fp $ \q -> copyBytes q p_info sz
+                 f fp `catchException` childHandler
+             go (i + 1)
+
+-- | Start the handlers for the signals that the RTS has queued, in one
+-- thread per batch.  The TimerManager calls this when the RTS tells it
+-- that there are signals pending.
+runPendingHandlers :: IO ()
+runPendingHandlers = do
+  p <- mallocBytes (pendingSignalsBatch * fromIntegral sizeof_siginfo_t)
+  n <- c_takePendingSignals p pendingSignalsBatch
+  if n == 0
+    then free p
+    else do _ <- forkIO (runHandlersBatchPtr p n)
+            when (n == pendingSignalsBatch) runPendingHandlers
+
+-- The size of the RTS's queue of pending signals (see rts/posix/Signals.c)
+pendingSignalsBatch :: Int
+pendingSignalsBatch = 64
+
+foreign import ccall unsafe "__hscore_sizeof_siginfo_t"
+  sizeof_siginfo_t :: CSize
+
+foreign import ccall unsafe "__hscore_siginfo_signo"
+  siginfo_signo :: Ptr Word8 -> IO CInt
+
+foreign import ccall unsafe "takePendingSignals"
+  c_takePendingSignals :: Ptr Word8 -> Int -> IO Int
+#else
+-- there are no POSIX signals on Windows
+runHandlersBatchPtr _ _ = return ()
+#endif
+
 -- Machinery needed to ensure that we only have one copy of certain
 -- CAFs in this module even when the base package is present twice, as
 -- it is when base is dynamically loaded into GHCi.  The RTS keeps
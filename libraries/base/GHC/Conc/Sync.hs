@@ -43,6 +43,7 @@ module GHC.Conc.Sync
         , getNumCapabilities
         , setNumCapabilities
         , getNumProcessors
+        , capabilityPool
         , numSparks
         , childHandler
         , myThreadId
@@ -65,6 +66,26 @@ module GHC.Conc.Sync
         , enableAllocationLimit
         , disableAllocationLimit
 
+        -- * Per-thread CPU time and allocation
+        , threadCPUTime
+        , threadAllocated
+
+        -- * Thread priorities
+        , setThreadPriority
+        , threadPriority
+
+        -- * Accounting groups
+        , setAccountingGroup
+        , accountingGroup
+        , setAccountingGroupQuota
+        , accountingGroupQuota
+        , accountingGroupResidency
+
+        -- * Pretenuring
+        , setPretenureGeneration
+        , getPretenureGeneration
+        , withPretenuring
+
         -- * TVars
         , STM(..)
         , atomically
@@ -80,6 +101,7 @@ module GHC.Conc.Sync
         , readTVar
         , readTVarIO
         , writeTVar
+        , setTVarWakeupLimit
         , unsafeIOToSTM
 
         -- * Miscellaneous
@@ -105,6 +127,7 @@ import Data.Typeable
 import Data.Maybe
 
 import GHC.Base
+import GHC.Enum         ( maxBound )
 import {-# SOURCE #-} GHC.IO.Handle ( hFlush )
 import {-# SOURCE #-} GHC.IO.Handle.FD ( stdout )
 import GHC.IO
@@ -238,6 +261,190 @@ disableAllocationLimit = do
   ThreadId t <- myThreadId
   rts_disableThreadAllocationLimit t
 
+-- | The CPU time, in nanoseconds, that the thread has spent running
+-- Haskell code (and in safe foreign calls), up to the last time it
+-- returned to the scheduler.  This is only counted when the program
+-- is run with @+RTS --thread-cpu-time@; otherwise it is 0.
+--
+-- On a 32-bit platform the value read for another thread that is
+-- running may be inconsistent.
+--
+-- @since 4.8.1.0
+threadCPUTime :: ThreadId -> IO Word64
+threadCPUTime (ThreadId t) = rts_getThreadCPUTime t
+
+-- | The number of bytes that the thread has allocated, up to the last
+-- time it returned to the scheduler.  Unlike the allocation counter
+-- this is never reset.  The same caveat as for 'threadCPUTime'
+-- applies on 32-bit platforms.
+--
+-- @since 4.8.1.0
+threadAllocated :: ThreadId -> IO Word64
+threadAllocated (ThreadId t) = rts_getThreadAllocated t
+
+-- | Set the priority of a thread, from @0@ (the default) to @3@; values
+-- outside that range are taken as the nearest.  Each capability runs
+-- the runnable threads of the highest priority that it has, in turn,
+-- and a thread of a higher priority that becomes runnable takes over
+-- from one of a lower priority at the next context switch.  So a
+-- thread that answers requests can be given a higher priority than
+-- those doing batch work, which only run when it is blocked.  Threads
+-- of a low priority can starve, so a thread with a high priority
+-- should block most of the time.
+--
+-- The new priority takes effect at once: a runnable thread moves
+-- behind the other runnable threads of its new priority.  A thread on
+-- another capability is changed by that capability, when it next
+-- handles its messages, so until then 'threadPriority' may still
+-- return the old priority.
+--
+-- @since 4.8.1.0
+setThreadPriority :: ThreadId -> Int -> IO ()
+setThreadPriority (ThreadId t) n = rts_setThreadPriority t n
+
+-- | The priority of a thread (see 'setThreadPriority').
+--
+-- @since 4.8.1.0
+threadPriority :: ThreadId -> IO Int
+threadPriority (ThreadId t) = rts_getThreadPriority t
+
+foreign import ccall unsafe "rts_getThreadPriority"
+  rts_getThreadPriority :: ThreadId# -> IO Int
+
+foreign import ccall unsafe "rts_setThreadPriority"
+  rts_setThreadPriority :: ThreadId# -> Int -> IO ()
+
+-- | Put a thread in an accounting group, from @1@ to @63@, or in none
+-- with @0@.  The threads that it forks from now on start in the same
+-- group.  Each major GC works out how much of the heap the threads of
+-- each group keep alive, their residency, and throws
+-- 'ResidencyQuotaExceeded' to the threads of a group whose residency
+-- is over its quota (see 'setAccountingGroupQuota').
+--
+-- What is reachable from the threads of several groups counts for
+-- the one with the lowest number only, and what is reachable only in
+-- other ways (from a top-level value or a 'StablePtr', say) for none.
+--
+-- @since 4.8.1.0
+setAccountingGroup :: ThreadId -> Int -> IO ()
+setAccountingGroup (ThreadId t) n
+  | n < 0 || n > maxAccountingGroup = badAccountingGroup "setAccountingGroup"
+  | otherwise = rts_setThreadAccountingGroup t n
+
+-- | The accounting group of a thread, or @0@ if it isn't in one (see
+-- 'setAccountingGroup').
+--
+-- @since 4.8.1.0
+accountingGroup :: ThreadId -> IO Int
+accountingGroup (ThreadId t) = rts_getThreadAccountingGroup t
+
+-- | Set the quota of an accounting group, in bytes, or take it away
+-- with @0@.  The threads of the group get 'ResidencyQuotaExceeded'
+-- after a major GC finds that they keep more than that alive, except
+-- for those that are masking asynchronous exceptions or are in a
+-- foreign call; they don't get it again until the group has been
+-- under its quota at a major GC.
+--
+-- @since 4.8.1.0
+setAccountingGroupQuota :: Int -> Word64 -> IO ()
+setAccountingGroupQuota n bytes
+  | n < 1 || n > maxAccountingGroup =
+      badAccountingGroup "setAccountingGroupQuota"
+  | otherwise = rts_setAccountingGroupQuota n bytes
+
+-- | The quota of an accounting group, in bytes, or @0@ if it has none
+-- (see 'setAccountingGroupQuota').
+--
+-- @since 4.8.1.0
+accountingGroupQuota :: Int -> IO Word64
+accountingGroupQuota n
+  | n < 1 || n > maxAccountingGroup = badAccountingGroup "accountingGroupQuota"
+  | otherwise = rts_getAccountingGroupQuota n
+
+-- | How much of the heap, in bytes, the threads of an accounting group
+-- kept alive at the last major GC (see 'setAccountingGroup').
+--
+-- @since 4.8.1.0
+accountingGroupResidency :: Int -> IO Word64
+accountingGroupResidency n
+  | n < 1 || n > maxAccountingGroup =
+      badAccountingGroup "accountingGroupResidency"
+  | otherwise = rts_getAccountingGroupResidency n
+
+-- MAX_ACCOUNTING_GROUPS - 1
+maxAccountingGroup :: Int
+maxAccountingGroup = 63
+
+badAccountingGroup :: String -> IO a
+badAccountingGroup fn =
+  ioError (IOError Nothing InvalidArgument fn "no such accounting group"
+                   Nothing Nothing)
+
+foreign import ccall unsafe "rts_getThreadAccountingGroup"
+  rts_getThreadAccountingGroup :: ThreadId# -> IO Int
+
+foreign import ccall unsafe "rts_setThreadAccountingGroup"
+  rts_setThreadAccountingGroup :: ThreadId# -> Int -> IO ()
+
+foreign import ccall unsafe "rts_getAccountingGroupQuota"
+  rts_getAccountingGroupQuota :: Int -> IO Word64
+
+foreign import ccall unsafe "rts_setAccountingGroupQuota"
+  rts_setAccountingGroupQuota :: Int -> Word64 -> IO ()
+
+foreign import ccall unsafe "rts_getAccountingGroupResidency"
+  rts_getAccountingGroupResidency :: Int -> IO Word64
+
+-- | Have the garbage collector copy the heap objects that the
+-- current thread allocates from now on straight into generation @n@
+-- (as numbered by @+RTS -G@) when they survive a GC, rather than
+-- through each younger generation in turn.  This saves copying data
+-- that is built to be kept, such as a cache, several times over.
+-- @0@ turns it off again, and a generation beyond the oldest means
+-- the oldest.
+--
+-- The objects of a thread that allocates while pretenuring are kept
+-- until the next collection of generation @n@ even if they die
+-- sooner, so pretenure only what will live for a long time.
+-- Pretenuring is accurate only to about 4Kbytes.
+--
+-- @since 4.8.1.0
+setPretenureGeneration :: Int -> IO ()
+setPretenureGeneration n = do
+  ThreadId t <- myThreadId
+  rts_setThreadPretenuring t n
+
+-- | The generation that the current thread's objects are pretenured
+-- into, or @0@ if it isn't pretenuring (see 'setPretenureGeneration').
+--
+-- @since 4.8.1.0
+getPretenureGeneration :: IO Int
+getPretenureGeneration = do
+  ThreadId t <- myThreadId
+  rts_getThreadPretenuring t
+
+-- | Run an action, pretenuring the objects it allocates into the oldest
+-- generation (see 'setPretenureGeneration').
+--
+-- @since 4.8.1.0
+withPretenuring :: IO a -> IO a
+withPretenuring io = do
+  old <- getPretenureGeneration
+  (setPretenureGeneration maxBound >> io)
+    `finally` setPretenureGeneration old
+
+foreign import ccall unsafe "rts_getThreadPretenuring"
+  rts_getThreadPretenuring :: ThreadId# -> IO Int
+
+foreign import ccall unsafe "rts_setThreadPretenuring"
+  rts_setThreadPretenuring :: ThreadId# -> Int -> IO ()
+
+foreign import ccall unsafe "rts_getThreadCPUTime"
+  rts_getThreadCPUTime :: ThreadId# -> IO Word64
+
+foreign import ccall unsafe "rts_getThreadAllocated"
+  rts_getThreadAllocated :: ThreadId# -> IO Word64
+
 -- We cannot do these operations safely on another thread, because on
 -- a 32-bit machine we cannot do atomic operations on a 64-bit value.
 -- Therefore, we only expose APIs that allow getting and setting the
@@ -385,6 +592,20 @@ getNumProcessors = fmap fromIntegral c_getNumberOfProcessors
 foreign import ccall unsafe "getNumberOfProcessors"
   c_getNumberOfProcessors :: IO CUInt
 
+-- | The pool that a capability is in: @0@ for the default pool, and
+-- from @1@ the pools set up with @+RTS --cap-pool@, in the order of
+-- the flags, or @-1@ if there is no such capability.  The threads that
+-- a thread forks with 'forkIO', and the sparks that it creates, stay
+-- within the pool of its capability, so a thread started with
+-- 'forkOn' on a capability of a pool starts work in that pool.
+--
+-- @since 4.8.1.0
+capabilityPool :: Int -> IO Int
+capabilityPool = rts_getCapabilityPool
+
+foreign import ccall unsafe "rts_getCapabilityPool"
+  rts_getCapabilityPool :: Int -> IO Int
+
 -- | Returns the number of sparks currently in the local spark pool
 numSparks :: IO Int
 numSparks = IO $ \s -> case numSparks# s of (# s', n #) -> (# s', I# n #)
@@ -807,6 +1028,26 @@ writeTVar (TVar tvar#) val = STM $ \s1# ->
     case writeTVar# tvar# val s1# of
          s2# -> (# s2#, () #)
 
+-- |Set how many of the threads blocked in 'retry' on a 'TVar' are woken
+-- when a transaction updates it.  Normally they all are (a limit of 0),
+-- so that each can see whether the change lets it continue.  For a
+-- 'TVar' holding a queue of work, of which any waiting thread can take
+-- any item, waking them all for each new item is wasted effort: most of
+-- them find the queue empty again and go back to sleep.  With a limit
+-- of @n@, only the @n@ threads that have waited longest are woken, and
+-- a thread that takes an item wakes the next ones when it updates the
+-- 'TVar' in turn.
+--
+-- Only use this when every thread waiting on the 'TVar' would do for
+-- every update: a wakeup given to a thread that then blocks again, or
+-- that is killed before it runs, is not passed on.
+--
+-- @since 4.8.1.0
+setTVarWakeupLimit :: TVar a -> Int -> IO ()
+setTVarWakeupLimit (TVar tvar#) (I# n#) = IO $ \s1# ->
+    case setTVarWakeupLimit# tvar# n# s1# of
+         s2# -> (# s2#, () #)
+
 -----------------------------------------------------------------------------
 -- MVar utilities
 -----------------------------------------------------------------------------
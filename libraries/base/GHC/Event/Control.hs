@@ -28,18 +28,15 @@ module GHC.Event.Control
 
 #include "EventConfig.h"
 
-import Foreign.ForeignPtr (ForeignPtr)
 import GHC.Base
 import GHC.Conc.Signal (Signal)
 import GHC.Real (fromIntegral)
 import GHC.Show (Show)
 import GHC.Word (Word8)
 import Foreign.C.Error (throwErrnoIfMinus1_)
-import Foreign.C.Types (CInt(..), CSize(..))
-import Foreign.ForeignPtr (mallocForeignPtrBytes, withForeignPtr)
+import Foreign.C.Types (CInt(..))
 import Foreign.Marshal (alloca, allocaBytes)
 import Foreign.Marshal.Array (allocaArray)
-import Foreign.Ptr (castPtr)
 import Foreign.Storable (peek, peekElemOff, poke)
 import System.Posix.Internals (c_close, c_pipe, c_read, c_write,
                                setCloseOnExec, setNonBlockingFD)
@@ -52,10 +49,11 @@ import Foreign.C.Types (CULLong(..))
 import Foreign.C.Error (eAGAIN, eWOULDBLOCK, getErrno, throwErrno)
 #endif
 
+-- | 'CMsgSignals' means that the RTS has queued signals, however many,
+-- which 'GHC.Conc.Signal.runPendingHandlers' takes.
 data ControlMessage = CMsgWakeup
                     | CMsgDie
-                    | CMsgSignal {-# UNPACK #-} !(ForeignPtr Word8)
-                                 {-# UNPACK #-} !Signal
+                    | CMsgSignals
     deriving (Eq, Show)
 
 -- | The structure used to tell the IO manager thread what to do.
@@ -130,12 +128,10 @@ closeControl w = do
 #endif
   return ()
 
-io_MANAGER_WAKEUP, io_MANAGER_DIE :: Word8
-io_MANAGER_WAKEUP = 0xff
-io_MANAGER_DIE    = 0xfe
-
-foreign import ccall "__hscore_sizeof_siginfo_t"
-    sizeof_siginfo_t :: CSize
+io_MANAGER_WAKEUP, io_MANAGER_DIE, io_MANAGER_SIGNALS :: Word8
+io_MANAGER_WAKEUP  = 0xff
+io_MANAGER_DIE     = 0xfe
+io_MANAGER_SIGNALS = 0xfc
 
 readControlMessage :: Control -> Fd -> IO ControlMessage
 readControlMessage ctrl fd
@@ -153,15 +149,8 @@ readControlMessage ctrl fd
                 -- file descriptor but we handle them anyway.
                 _ | s == io_MANAGER_WAKEUP -> return CMsgWakeup
                 _ | s == io_MANAGER_DIE    -> return CMsgDie
-                _ -> do  -- Signal
-                    fp <- mallocForeignPtrBytes (fromIntegral sizeof_siginfo_t)
-                    withForeignPtr fp $ \p_siginfo -> do
-                        r <- c_read (fromIntegral fd) (castPtr p_siginfo)
-                             sizeof_siginfo_t
-                        when (r /= fromIntegral sizeof_siginfo_t) $
-                            error "failed to read siginfo_t"
-                        let !s' = fromIntegral s
-                        return $ CMsgSignal fp s'
+                _ | s == io_MANAGER_SIGNALS -> return CMsgSignals
+                _ -> error "readControlMessage: unknown message"
 
   where wakeupBufferSize =
 #if defined(HAVE_EVENTFD)
@@ -195,7 +184,7 @@ sendMessage fd msg = alloca $ \p -> do
   case msg of
     CMsgWakeup        -> poke p io_MANAGER_WAKEUP
     CMsgDie           -> poke p io_MANAGER_DIE
-    CMsgSignal _fp _s -> error "Signals can only be sent from within the RTS"
+    CMsgSignals       -> error "Signals can only be sent from within the RTS"
   fromIntegral `fmap` c_write (fromIntegral fd) p 1
 
 #if defined(HAVE_EVENTFD)
@@ -25,8 +25,8 @@ import Foreign.C.Types (CInt(..), CUInt(..))
 import Foreign.Ptr (Ptr)
 import GHC.Base
 import GHC.List (zipWith, zipWith3)
-import GHC.Conc.Sync (TVar, ThreadId, ThreadStatus(..), atomically, forkIO,
-                      labelThread, modifyMVar_, withMVar, newTVar, sharedCAF,
+import GHC.Conc.Sync (TVar, ThreadId, ThreadStatus(..), atomically,
+                      labelThread, withMVar, newTVar, sharedCAF,
                       getNumCapabilities, threadCapability, myThreadId, forkOn,
                       threadStatus, writeTVar, newTVarIO, readTVar, retry,throwSTM,STM)
 import GHC.IO (mask_, onException)
@@ -41,7 +41,7 @@ import GHC.Event.Manager (Event, EventManager, evtRead, evtWrite, loop,
 import qualified GHC.Event.Manager as M
 import qualified GHC.Event.TimerManager as TM
 import GHC.Num ((-), (+))
-import GHC.Real (fromIntegral)
+import GHC.Real (fromIntegral, rem)
 import GHC.Show (showSignedInt)
 import System.IO.Unsafe (unsafePerformIO)
 import System.Posix.Types (Fd)
@@ -211,27 +211,43 @@ ioManagerLock = unsafePerformIO $ do
    m <- newMVar ()
    sharedCAF m getOrSetSystemEventThreadIOManagerThreadStore
 
+-- | Retrieve the system timer manager for the capability on which the
+-- calling thread is running.
+--
+-- Each capability has its own timer manager, so that the threads that
+-- register timeouts on different capabilities don't contend for one
+-- queue of timeouts and one wakeup pipe.  A timeout must be
+-- unregistered or updated with the timer manager it was registered
+-- with, even if the thread has moved to another capability since.
 getSystemTimerManager :: IO TM.TimerManager
 getSystemTimerManager = do
-  Just mgr <- readIORef timerManager
+  t <- myThreadId
+  (cap, _) <- threadCapability t
+  timerManagerArray <- readIORef timerManager
+  let (_, high) = boundsIOArray timerManagerArray
+  Just (_,mgr) <- readIOArray timerManagerArray (cap `rem` (high+1))
   return mgr
 
 foreign import ccall unsafe "getOrSetSystemTimerThreadEventManagerStore"
     getOrSetSystemTimerThreadEventManagerStore :: Ptr a -> IO (Ptr a)
 
-timerManager :: IORef (Maybe TM.TimerManager)
+timerManager :: IORef (IOArray Int (Maybe (ThreadId, TM.TimerManager)))
 timerManager = unsafePerformIO $ do
-    em <- newIORef Nothing
+    numCaps <- getNumCapabilities
+    timerManagerArray <- newIOArray (0, numCaps - 1) Nothing
+    em <- newIORef timerManagerArray
     sharedCAF em getOrSetSystemTimerThreadEventManagerStore
 {-# NOINLINE timerManager #-}
 
 foreign import ccall unsafe "getOrSetSystemTimerThreadIOManagerThreadStore"
     getOrSetSystemTimerThreadIOManagerThreadStore :: Ptr a -> IO (Ptr a)
 
-{-# NOINLINE timerManagerThreadVar #-}
-timerManagerThreadVar :: MVar (Maybe ThreadId)
-timerManagerThreadVar = unsafePerformIO $ do
-   m <- newMVar Nothing
+-- | The timerManagerLock protects the 'timerManager' value, as
+-- 'ioManagerLock' does the 'eventManager' value.
+{-# NOINLINE timerManagerLock #-}
+timerManagerLock :: MVar ()
+timerManagerLock = unsafePerformIO $ do
+   m <- newMVar ()
    sharedCAF m getOrSetSystemTimerThreadIOManagerThreadStore
 
 ensureIOManagerIsRunning :: IO ()
@@ -239,7 +255,7 @@ ensureIOManagerIsRunning
   | not threaded = return ()
   | otherwise = do
       startIOManagerThreads
-      startTimerManagerThread
+      startTimerManagerThreads
 
 startIOManagerThreads :: IO ()
 startIOManagerThreads =
@@ -290,19 +306,29 @@ startIOManagerThread eventManagerArray i = do
           create
         _other         -> return ()
 
-startTimerManagerThread :: IO ()
-startTimerManagerThread = modifyMVar_ timerManagerThreadVar $ \old -> do
+startTimerManagerThreads :: IO ()
+startTimerManagerThreads =
+  withMVar timerManagerLock $ \_ -> do
+    timerManagerArray <- readIORef timerManager
+    let (_, high) = boundsIOArray timerManagerArray
+    mapM_ (startTimerManagerThread timerManagerArray) [0..high]
+
+startTimerManagerThread :: IOArray Int (Maybe (ThreadId, TM.TimerManager))
+                        -> Int
+                        -> IO ()
+startTimerManagerThread timerManagerArray i = do
   let create = do
         !mgr <- TM.new
         c_setTimerManagerControlFd
+          (fromIntegral i)
           (fromIntegral $ controlWriteFd $ TM.emControl mgr)
-        writeIORef timerManager $ Just mgr
-        !t <- forkIO $ TM.loop mgr
-        labelThread t "TimerManager"
-        return $ Just t
+        !t <- forkOn i $ TM.loop mgr
+        labelThread t ("TimerManager on cap " ++ show_int i)
+        writeIOArray timerManagerArray i (Just (t,mgr))
+  old <- readIOArray timerManagerArray i
   case old of
-    Nothing            -> create
-    st@(Just t) -> do
+    Nothing     -> create
+    Just (t,em) -> do
       s <- threadStatus t
       case s of
         ThreadFinished -> create
@@ -312,13 +338,10 @@ startTimerManagerThread = modifyMVar_ timerManagerThreadVar $ \old -> do
           -- the fork, for example. In this case we should clean up
           -- open pipes and everything else related to the event manager.
           -- See #4449
-          mem <- readIORef timerManager
-          _ <- case mem of
-                 Nothing -> return ()
-                 Just em -> do c_setTimerManagerControlFd (-1)
-                               TM.cleanup em
+          c_setTimerManagerControlFd (fromIntegral i) (-1)
+          TM.cleanup em
           create
-        _other         -> return st
+        _other         -> return ()
 
 foreign import ccall unsafe "rtsSupportsBoundThreads" threaded :: Bool
 
@@ -354,9 +377,25 @@ ioManagerCapabilitiesChanged = do
               tid <- restartPollLoop mgr i
               writeIOArray eventManagerArray i (Just (tid,mgr))
 
+  -- The timer managers of disabled capabilities keep running (their
+  -- threads are migrated elsewhere), so only new capabilities need
+  -- new ones.
+  withMVar timerManagerLock $ \_ -> do
+    new_n_caps <- getNumCapabilities
+    timerManagerArray <- readIORef timerManager
+    let (_, high) = boundsIOArray timerManagerArray
+    when (new_n_caps > high + 1) $ do
+      new_timerManagerArray <- newIOArray (0, new_n_caps - 1) Nothing
+      forM_ [0..high] $ \i ->
+        readIOArray timerManagerArray i >>=
+          writeIOArray new_timerManagerArray i
+      forM_ [high+1..new_n_caps-1] $
+        startTimerManagerThread new_timerManagerArray
+      writeIORef timerManager new_timerManagerArray
+
 -- Used to tell the RTS how it can send messages to the I/O manager.
 foreign import ccall unsafe "setIOManagerControlFd"
    c_setIOManagerControlFd :: CUInt -> CInt -> IO ()
 
 foreign import ccall unsafe "setTimerManagerControlFd"
-   c_setTimerManagerControlFd :: CInt -> IO ()
+   c_setTimerManagerControlFd :: CUInt -> CInt -> IO ()
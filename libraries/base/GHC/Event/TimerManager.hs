@@ -43,7 +43,7 @@ import Data.Foldable (sequence_)
 import Data.IORef (IORef, atomicModifyIORef', mkWeakIORef, newIORef, readIORef,
                    writeIORef)
 import GHC.Base
-import GHC.Conc.Signal (runHandlers)
+import GHC.Conc.Signal (runPendingHandlers)
 import GHC.Num (Num(..))
 import GHC.Real ((/), fromIntegral )
 import GHC.Show (Show(..))
@@ -102,7 +102,7 @@ handleControlEvent mgr fd _evt = do
   case msg of
     CMsgWakeup      -> return ()
     CMsgDie         -> writeIORef (emState mgr) Finished
-    CMsgSignal fp s -> runHandlers fp s
+    CMsgSignals     -> runPendingHandlers
 
 newDefaultBackend :: IO Backend
 #if defined(HAVE_POLL)
@@ -16,9 +16,17 @@
 module GHC.Fingerprint (
         Fingerprint(..), fingerprint0,
         fingerprintData,
+        fingerprintDataMany,
         fingerprintString,
         fingerprintFingerprints,
-        getFileHash
+        getFileHash,
+
+        -- * Fast fingerprints
+        FastFingerprintContext,
+        newFastFingerprintContext,
+        updateFastFingerprint,
+        finishFastFingerprint,
+        fastFingerprintData
    ) where
 
 import GHC.IO
@@ -33,7 +41,7 @@ import System.IO
 
 import GHC.Fingerprint.Type
 
--- for SIZEOF_STRUCT_MD5CONTEXT:
+-- for SIZEOF_STRUCT_MD5CONTEXT and SIZEOF_STRUCT_MURMUR3CONTEXT:
 #include "HsBaseConfig.h"
 
 -- XXX instance Storable Fingerprint
@@ -56,6 +64,19 @@ fingerprintData buf len = do
       c_MD5Final pdigest pctxt
       peek (castPtr pdigest :: Ptr Fingerprint)
 
+-- | The fingerprints of many blocks of memory, the same as
+-- 'fingerprintData' of each.  Several are hashed together, so this is
+-- quicker when there are many blocks to fingerprint.
+--
+-- @since 4.8.1.0
+fingerprintDataMany :: [(Ptr Word8, Int)] -> IO [Fingerprint]
+fingerprintDataMany bufs =
+  withArrayLen (map fst bufs) $ \n pbufs ->
+  withArray (map (fromIntegral . snd) bufs :: [CInt]) $ \plens ->
+  allocaBytes (n * 16) $ \pdigests -> do
+    c_MD5Many (fromIntegral n) pbufs plens pdigests
+    peekArray n (castPtr pdigests :: Ptr Fingerprint)
+
 -- This is duplicated in compiler/utils/Fingerprint.hsc
 fingerprintString :: String -> Fingerprint
 fingerprintString str = unsafeDupablePerformIO $
@@ -104,6 +125,55 @@ getFileHash path = withBinaryFile path ReadMode $ \h -> do
 
       in loop
 
+-- -----------------------------------------------------------------------------
+-- Fast fingerprints
+
+-- | A fingerprint being computed a piece at a time, with a hash that is
+-- much faster than MD5 (MurmurHash3) but not cryptographic: fine for
+-- telling apart inputs no-one chose to collide, such as for caching or
+-- recompilation checks, but not for anything an adversary controls.
+-- Fast fingerprints are not comparable with those of 'fingerprintData'.
+--
+-- @since 4.8.1.0
+newtype FastFingerprintContext = FastFingerprintContext (ForeignPtr Murmur3Context)
+
+-- | @since 4.8.1.0
+newFastFingerprintContext :: IO FastFingerprintContext
+newFastFingerprintContext = do
+  fp <- mallocForeignPtrBytes SIZEOF_STRUCT_MURMUR3CONTEXT
+  withForeignPtr fp c_Murmur3Init
+  return (FastFingerprintContext fp)
+
+-- | Add a block of memory to the fingerprint.
+--
+-- @since 4.8.1.0
+updateFastFingerprint :: FastFingerprintContext -> Ptr Word8 -> Int -> IO ()
+updateFastFingerprint (FastFingerprintContext fp) buf len =
+  withForeignPtr fp $ \pctxt -> c_Murmur3Update pctxt buf (fromIntegral len)
+
+-- | The fingerprint of everything added so far.  The context then
+-- starts again from nothing.
+--
+-- @since 4.8.1.0
+finishFastFingerprint :: FastFingerprintContext -> IO Fingerprint
+finishFastFingerprint (FastFingerprintContext fp) =
+  withForeignPtr fp $ \pctxt ->
+    allocaBytes 16 $ \pdigest -> do
+      c_Murmur3Final pdigest pctxt
+      peek (castPtr pdigest :: Ptr Fingerprint)
+
+-- | The fast fingerprint of a block of memory.
+--
+-- @since 4.8.1.0
+fastFingerprintData :: Ptr Word8 -> Int -> IO Fingerprint
+fastFingerprintData buf len = do
+  allocaBytes SIZEOF_STRUCT_MURMUR3CONTEXT $ \pctxt -> do
+    c_Murmur3Init pctxt
+    c_Murmur3Update pctxt buf (fromIntegral len)
+    allocaBytes 16 $ \pdigest -> do
+      c_Murmur3Final pdigest pctxt
+      peek (castPtr pdigest :: Ptr Fingerprint)
+
 data MD5Context
 
 foreign import ccall unsafe "__hsbase_MD5Init"
@@ -112,3 +182,14 @@ foreign import ccall unsafe "__hsbase_MD5Update"
    c_MD5Update :: Ptr MD5Context -> Ptr Word8 -> CInt -> IO ()
 foreign import ccall unsafe "__hsbase_MD5Final"
    c_MD5Final  :: Ptr Word8 -> Ptr MD5Context -> IO ()
+foreign import ccall unsafe "__hsbase_MD5Many"
+   c_MD5Many   :: CInt -> Ptr (Ptr Word8) -> Ptr CInt -> Ptr Word8 -> IO ()
+
+data Murmur3Context
+
+foreign import ccall unsafe "__hsbase_Murmur3Init"
+   c_Murmur3Init   :: Ptr Murmur3Context -> IO ()
+foreign import ccall unsafe "__hsbase_Murmur3Update"
+   c_Murmur3Update :: Ptr Murmur3Context -> Ptr Word8 -> CInt -> IO ()
+foreign import ccall unsafe "__hsbase_Murmur3Final"
+   c_Murmur3Final  :: Ptr Word8 -> Ptr Murmur3Context -> IO ()
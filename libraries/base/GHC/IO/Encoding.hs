@@ -185,6 +185,8 @@ char8 = Latin1.latin1
 --
 --  * @UTF-32@, @UTF-32BE@, @UTF-32LE@
 --
+--  * @ISO-8859-1@
+--
 -- There is additional notation (borrowed from GNU iconv) for specifying
 -- how illegal characters are handled:
 --
@@ -243,6 +245,8 @@ mkTextEncoding' cfm enc = case [toUpper c | c <- enc, c /= '-'] of
     "UTF32"   -> return $ UTF32.mkUTF32 cfm
     "UTF32LE" -> return $ UTF32.mkUTF32le cfm
     "UTF32BE" -> return $ UTF32.mkUTF32be cfm
+    "ISO88591" -> return $ Latin1.mkLatin1_checked cfm
+    "LATIN1"  -> return $ Latin1.mkLatin1_checked cfm
 #if defined(mingw32_HOST_OS)
     'C':'P':n | [(cp,"")] <- reads n -> return $ CodePage.mkCodePageEncoding cfm cp
     _ -> unknownEncodingErr (enc ++ codingFailureModeSuffix cfm)
@@ -0,0 +1,89 @@
+{-# LANGUAGE Trustworthy #-}
+{-# LANGUAGE CPP
+           , NoImplicitPrelude
+           , MagicHash
+           , UnboxedTuples
+           , UnliftedFFITypes
+  #-}
+{-# OPTIONS_HADDOCK hide #-}
+
+-----------------------------------------------------------------------------
+-- |
+-- Module      :  GHC.IO.Encoding.Native
+-- Copyright   :  (c) The University of Glasgow, 2016
+-- License     :  see libraries/base/LICENSE
+--
+-- Maintainer  :  libraries@haskell.org
+-- Stability   :  internal
+-- Portability :  non-portable
+--
+-- The inner loops of the UTF-8 and UTF-16 codecs, in C (cbits/utf.c)
+--
+-----------------------------------------------------------------------------
+
+module GHC.IO.Encoding.Native (
+  utf8_decode, utf8_encode,
+  utf16be_decode, utf16be_encode,
+  utf16le_decode, utf16le_encode
+  ) where
+
+#include "MachDeps.h"
+
+import GHC.Base
+import GHC.Ptr
+import GHC.Word
+import GHC.IO.Buffer
+import GHC.IO.Encoding.Types
+
+utf8_decode :: DecodeBuffer
+utf8_decode = runCodec c_utf8_decode
+
+utf8_encode :: EncodeBuffer
+utf8_encode = runCodec c_utf8_encode
+
+utf16be_decode, utf16le_decode :: DecodeBuffer
+utf16be_decode = runCodec (c_utf16_decode 1)
+utf16le_decode = runCodec (c_utf16_decode 0)
+
+utf16be_encode, utf16le_encode :: EncodeBuffer
+utf16be_encode = runCodec (c_utf16_encode 1)
+utf16le_encode = runCodec (c_utf16_encode 0)
+
+type Codec from to = Ptr from -> Int -> Int -> Ptr to -> Int -> Int
+                   -> MutableByteArray# RealWorld -> IO Int
+
+-- The C code leaves the indices it got to in a two-element array, and
+-- returns which CodingProgress it stopped with.
+runCodec :: Codec from to -> CodeBuffer from to
+runCodec codec
+  input@Buffer{  bufRaw=iraw, bufL=ir0, bufR=iw,  bufSize=_  }
+  output@Buffer{ bufRaw=oraw, bufL=_,   bufR=ow0, bufSize=os }
+ = withRawBuffer iraw $ \piraw ->
+   withRawBuffer oraw $ \poraw ->
+   IO $ \s0 ->
+   case newByteArray# (2# *# SIZEOF_HSINT#) s0 of { (# s1, idx #) ->
+   case unIO (codec piraw ir0 iw poraw ow0 os idx) s1 of { (# s2, why #) ->
+   case readIntArray# idx 0# s2 of { (# s3, ir# #) ->
+   case readIntArray# idx 1# s3 of { (# s4, ow# #) ->
+   let ir = I# ir# in
+   (# s4, (progress why,
+           if ir == iw then input{ bufL=0, bufR=0 }
+                       else input{ bufL=ir },
+           output{ bufR=I# ow# }) #) }}}}
+
+progress :: Int -> CodingProgress
+progress 0 = InputUnderflow
+progress 1 = OutputUnderflow
+progress _ = InvalidSequence
+
+foreign import ccall unsafe "hs_utf8_decode"
+   c_utf8_decode :: Codec Word8 Char
+
+foreign import ccall unsafe "hs_utf8_encode"
+   c_utf8_encode :: Codec Char Word8
+
+foreign import ccall unsafe "hs_utf16_decode"
+   c_utf16_decode :: Int -> Codec Word8 Char
+
+foreign import ccall unsafe "hs_utf16_encode"
+   c_utf16_encode :: Int -> Codec Char Word8
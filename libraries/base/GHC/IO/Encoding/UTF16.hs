@@ -1,8 +1,6 @@
 {-# LANGUAGE Trustworthy #-}
 {-# LANGUAGE NoImplicitPrelude
-           , BangPatterns
            , NondecreasingIndentation
-           , MagicHash
   #-}
 {-# OPTIONS_GHC  -funbox-strict-fields #-}
 
@@ -39,14 +37,13 @@ module GHC.IO.Encoding.UTF16 (
   ) where
 
 import GHC.Base
-import GHC.Real
 import GHC.Num
 -- import GHC.IO
 import GHC.IO.Buffer
 import GHC.IO.Encoding.Failure
+import GHC.IO.Encoding.Native
 import GHC.IO.Encoding.Types
 import GHC.Word
-import Data.Bits
 import GHC.IORef
 
 -- -----------------------------------------------------------------------------
@@ -195,165 +192,3 @@ utf16le_EF cfm =
              getState = return (),
              setState = const $ return ()
           })
-
-
-utf16be_decode :: DecodeBuffer
-utf16be_decode
-  input@Buffer{  bufRaw=iraw, bufL=ir0, bufR=iw,  bufSize=_  }
-  output@Buffer{ bufRaw=oraw, bufL=_,   bufR=ow0, bufSize=os }
- = let
-       loop !ir !ow
-         | ow >= os     = done OutputUnderflow ir ow
-         | ir >= iw     = done InputUnderflow ir ow
-         | ir + 1 == iw = done InputUnderflow ir ow
-         | otherwise = do
-              c0 <- readWord8Buf iraw ir
-              c1 <- readWord8Buf iraw (ir+1)
-              let x1 = fromIntegral c0 `shiftL` 8 + fromIntegral c1
-              if validate1 x1
-                 then do ow' <- writeCharBuf oraw ow (unsafeChr (fromIntegral x1))
-                         loop (ir+2) ow'
-                 else if iw - ir < 4 then done InputUnderflow ir ow else do
-                      c2 <- readWord8Buf iraw (ir+2)
-                      c3 <- readWord8Buf iraw (ir+3)
-                      let x2 = fromIntegral c2 `shiftL` 8 + fromIntegral c3
-                      if not (validate2 x1 x2) then invalid else do
-                      ow' <- writeCharBuf oraw ow (chr2 x1 x2)
-                      loop (ir+4) ow'
-         where
-           invalid = done InvalidSequence ir ow
-
-       -- lambda-lifted, to avoid thunks being built in the inner-loop:
-       done why !ir !ow = return (why,
-                                  if ir == iw then input{ bufL=0, bufR=0 }
-                                              else input{ bufL=ir },
-                                  output{ bufR=ow })
-    in
-    loop ir0 ow0
-
-utf16le_decode :: DecodeBuffer
-utf16le_decode
-  input@Buffer{  bufRaw=iraw, bufL=ir0, bufR=iw,  bufSize=_  }
-  output@Buffer{ bufRaw=oraw, bufL=_,   bufR=ow0, bufSize=os }
- = let
-       loop !ir !ow
-         | ow >= os     = done OutputUnderflow ir ow
-         | ir >= iw     = done InputUnderflow ir ow
-         | ir + 1 == iw = done InputUnderflow ir ow
-         | otherwise = do
-              c0 <- readWord8Buf iraw ir
-              c1 <- readWord8Buf iraw (ir+1)
-              let x1 = fromIntegral c1 `shiftL` 8 + fromIntegral c0
-              if validate1 x1
-                 then do ow' <- writeCharBuf oraw ow (unsafeChr (fromIntegral x1))
-                         loop (ir+2) ow'
-                 else if iw - ir < 4 then done InputUnderflow ir ow else do
-                      c2 <- readWord8Buf iraw (ir+2)
-                      c3 <- readWord8Buf iraw (ir+3)
-                      let x2 = fromIntegral c3 `shiftL` 8 + fromIntegral c2
-                      if not (validate2 x1 x2) then invalid else do
-                      ow' <- writeCharBuf oraw ow (chr2 x1 x2)
-                      loop (ir+4) ow'
-         where
-           invalid = done InvalidSequence ir ow
-
-       -- lambda-lifted, to avoid thunks being built in the inner-loop:
-       done why !ir !ow = return (why,
-                                  if ir == iw then input{ bufL=0, bufR=0 }
-                                              else input{ bufL=ir },
-                                  output{ bufR=ow })
-    in
-    loop ir0 ow0
-
-utf16be_encode :: EncodeBuffer
-utf16be_encode
-  input@Buffer{  bufRaw=iraw, bufL=ir0, bufR=iw,  bufSize=_  }
-  output@Buffer{ bufRaw=oraw, bufL=_,   bufR=ow0, bufSize=os }
- = let
-      done why !ir !ow = return (why,
-                                 if ir == iw then input{ bufL=0, bufR=0 }
-                                             else input{ bufL=ir },
-                                 output{ bufR=ow })
-      loop !ir !ow
-        | ir >= iw     =  done InputUnderflow ir ow
-        | os - ow < 2  =  done OutputUnderflow ir ow
-        | otherwise = do
-           (c,ir') <- readCharBuf iraw ir
-           case ord c of
-             x | x < 0x10000 -> if isSurrogate c then done InvalidSequence ir ow else do
-                    writeWord8Buf oraw ow     (fromIntegral (x `shiftR` 8))
-                    writeWord8Buf oraw (ow+1) (fromIntegral x)
-                    loop ir' (ow+2)
-               | otherwise -> do
-                    if os - ow < 4 then done OutputUnderflow ir ow else do
-                    let
-                         n1 = x - 0x10000
-                         c1 = fromIntegral (n1 `shiftR` 18 + 0xD8)
-                         c2 = fromIntegral (n1 `shiftR` 10)
-                         n2 = n1 .&. 0x3FF
-                         c3 = fromIntegral (n2 `shiftR` 8 + 0xDC)
-                         c4 = fromIntegral n2
-                    --
-                    writeWord8Buf oraw ow     c1
-                    writeWord8Buf oraw (ow+1) c2
-                    writeWord8Buf oraw (ow+2) c3
-                    writeWord8Buf oraw (ow+3) c4
-                    loop ir' (ow+4)
-    in
-    loop ir0 ow0
-
-utf16le_encode :: EncodeBuffer
-utf16le_encode
-  input@Buffer{  bufRaw=iraw, bufL=ir0, bufR=iw,  bufSize=_  }
-  output@Buffer{ bufRaw=oraw, bufL=_,   bufR=ow0, bufSize=os }
- = let
-      done why !ir !ow = return (why,
-                                 if ir == iw then input{ bufL=0, bufR=0 }
-                                             else input{ bufL=ir },
-                                 output{ bufR=ow })
-      loop !ir !ow
-        | ir >= iw     =  done InputUnderflow ir ow
-        | os - ow < 2  =  done OutputUnderflow ir ow
-        | otherwise = do
-           (c,ir') <- readCharBuf iraw ir
-           case ord c of
-             x | x < 0x10000 -> if isSurrogate c then done InvalidSequence ir ow else do
-                    writeWord8Buf oraw ow     (fromIntegral x)
-                    writeWord8Buf oraw (ow+1) (fromIntegral (x `shiftR` 8))
-                    loop ir' (ow+2)
-               | otherwise ->
-                    if os - ow < 4 then done OutputUnderflow ir ow else do
-                    let
-                         n1 = x - 0x10000
-                         c1 = fromIntegral (n1 `shiftR` 18 + 0xD8)
-                         c2 = fromIntegral (n1 `shiftR` 10)
-                         n2 = n1 .&. 0x3FF
-                         c3 = fromIntegral (n2 `shiftR` 8 + 0xDC)
-                         c4 = fromIntegral n2
-                    --
-                    writeWord8Buf oraw ow     c2
-                    writeWord8Buf oraw (ow+1) c1
-                    writeWord8Buf oraw (ow+2) c4
-                    writeWord8Buf oraw (ow+3) c3
-                    loop ir' (ow+4)
-    in
-    loop ir0 ow0
-
-chr2 :: Word16 -> Word16 -> Char
-chr2 (W16# a#) (W16# b#) = C# (chr# (upper# +# lower# +# 0x10000#))
-    where
-      !x# = word2Int# a#
-      !y# = word2Int# b#
-      !upper# = uncheckedIShiftL# (x# -# 0xD800#) 10#
-      !lower# = y# -# 0xDC00#
-{-# INLINE chr2 #-}
-
-validate1    :: Word16 -> Bool
-validate1 x1 = (x1 >= 0 && x1 < 0xD800) || x1 > 0xDFFF
-{-# INLINE validate1 #-}
-
-validate2       ::  Word16 -> Word16 -> Bool
-validate2 x1 x2 = x1 >= 0xD800 && x1 <= 0xDBFF &&
-                  x2 >= 0xDC00 && x2 <= 0xDFFF
-{-# INLINE validate2 #-}
-
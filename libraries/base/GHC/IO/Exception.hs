@@ -23,6 +23,7 @@ module GHC.IO.Exception (
   BlockedIndefinitelyOnSTM(..), blockedIndefinitelyOnSTM,
   Deadlock(..),
   AllocationLimitExceeded(..), allocationLimitExceeded,
+  ResidencyQuotaExceeded(..), residencyQuotaExceeded,
   AssertionFailed(..),
 
   SomeAsyncException(..),
@@ -116,6 +117,26 @@ allocationLimitExceeded = toException AllocationLimitExceeded
 
 -----
 
+-- |The accounting group of this thread keeps more of the heap alive
+-- than its quota.  See 'GHC.Conc.setAccountingGroup' and
+-- 'GHC.Conc.setAccountingGroupQuota'.
+--
+-- @since 4.8.1.0
+data ResidencyQuotaExceeded = ResidencyQuotaExceeded
+
+instance Exception ResidencyQuotaExceeded where
+  toException = asyncExceptionToException
+  fromException = asyncExceptionFromException
+
+instance Show ResidencyQuotaExceeded where
+    showsPrec _ ResidencyQuotaExceeded =
+      showString "residency quota exceeded"
+
+residencyQuotaExceeded :: SomeException -- for the RTS
+residencyQuotaExceeded = toException ResidencyQuotaExceeded
+
+-----
+
 -- |'assert' was applied to 'False'.
 data AssertionFailed = AssertionFailed String
 
@@ -26,10 +26,12 @@ module GHC.IO.FD (
         openFile, mkFD, release,
         setNonBlockingMode,
         readRawBufferPtr, readRawBufferPtrNoBlock, writeRawBufferPtr,
+        fdWriteVectored, fdSendFile,
         stdin, stdout, stderr
     ) where
 
 import GHC.Base
+import GHC.List (take, length)
 import GHC.Num
 import GHC.Real
 import GHC.Show
@@ -456,6 +458,83 @@ fdWriteNonBlocking fd ptr bytes = do
             (fromIntegral bytes)
   return (fromIntegral res)
 
+-- | Write all of the given buffers, each an address and a length, in
+-- order.  Where there is @writev()@ this takes one system call for up
+-- to 64 buffers, rather than one per buffer, and the buffers are never
+-- copied.
+fdWriteVectored :: FD -> [(Ptr Word8, Int)] -> IO ()
+fdWriteVectored fd bufs0 = go [ b | b@(_, n) <- bufs0, n > 0 ]
+  where
+    go [] = return ()
+    go bufs = do
+      let batch = take iovMax bufs
+          n     = length batch
+      r <- allocaArray n $ \ptrs -> allocaArray n $ \lens -> do
+             pokeArray ptrs (map fst batch)
+             pokeArray lens (map snd batch)
+             writevRawBufferPtr "GHC.IO.FD.fdWriteVectored" fd ptrs lens n
+      case r of
+        Nothing      -> writeEach bufs
+        Just written -> go (dropBytes written bufs)
+
+    writeEach [] = return ()
+    writeEach ((ptr, bytes) : rest) = do fdWrite fd ptr bytes
+                                         writeEach rest
+
+    -- a partial write may stop in the middle of a buffer
+    dropBytes _ [] = []
+    dropBytes k ((ptr, bytes) : rest)
+      | k >= bytes = dropBytes (k - bytes) rest
+      | otherwise  = (ptr `plusPtr` k, bytes - k) : rest
+
+-- Must be no more than HS_IOV_MAX in cbits/writev.c
+iovMax :: Int
+iovMax = 64
+
+-- | @fdSendFile out file off count@ writes @count@ bytes of the file
+-- open on @file@, starting at offset @off@, to @out@, and returns how
+-- many it wrote: fewer than @count@ only if the file ended first.
+--
+-- On Linux the kernel copies the data with @sendfile()@, without it
+-- going through user space, and the file position of @file@ doesn't
+-- change.  Elsewhere, or when @sendfile()@ can't handle the pair of
+-- descriptors, we seek @file@ to @off@ and copy through a buffer, which
+-- leaves the file position after the bytes that were copied.
+fdSendFile :: FD -> FD -> Int64 -> Int -> IO Int
+fdSendFile out file off0 count0 = go off0 count0 0
+  where
+    go !off !count !done
+      | count <= 0 = return done
+      | otherwise  = do
+          r <- sendfileRawFD "GHC.IO.FD.fdSendFile" out file off
+                  (min count sendfileMax)
+          case r of
+            Nothing -> do n <- copyFD out file off count
+                          return (done + n)
+            Just 0  -> return done
+            Just n  -> go (off + fromIntegral n) (count - n) (done + n)
+
+-- Linux's sendfile() never does more than about 2GB at a time anyway
+sendfileMax :: Int
+sendfileMax = 0x40000000
+
+copyFD :: FD -> FD -> Int64 -> Int -> IO Int
+copyFD out file off count0 = do
+  seek file AbsoluteSeek (fromIntegral off)
+  allocaBytes copyBufferSize $ \buf ->
+    let loop !count !done
+          | count <= 0 = return done
+          | otherwise  = do
+              n <- fdRead file buf (min count copyBufferSize)
+              if n == 0
+                 then return done
+                 else do fdWrite out buf n
+                         loop (count - n) (done + n)
+    in loop count0 0
+
+copyBufferSize :: Int
+copyBufferSize = 65536
+
 -- -----------------------------------------------------------------------------
 -- FD operations
 
@@ -498,6 +577,9 @@ indicates that there's no data, we call threadWaitRead.
 readRawBufferPtr :: String -> FD -> Ptr Word8 -> Int -> CSize -> IO Int
 readRawBufferPtr loc !fd buf off len
   | isNonBlocking fd = unsafe_read -- unsafe is ok, it can't block
+#if defined(linux_HOST_OS)
+  | useAsyncIO   = asyncReadRawBufferPtr loc fd buf off len
+#endif
   | otherwise    = do r <- throwErrnoIfMinus1 loc
                                 (unsafe_fdReady (fdFD fd) 0 0 0)
                       if r /= 0
@@ -531,6 +613,9 @@ readRawBufferPtrNoBlock loc !fd buf off len
 writeRawBufferPtr :: String -> FD -> Ptr Word8 -> Int -> CSize -> IO CInt
 writeRawBufferPtr loc !fd buf off len
   | isNonBlocking fd = unsafe_write -- unsafe is ok, it can't block
+#if defined(linux_HOST_OS)
+  | useAsyncIO  = fromIntegral `fmap` asyncWriteRawBufferPtr loc fd buf off len
+#endif
   | otherwise   = do r <- unsafe_fdReady (fdFD fd) 1 0 0
                      if r /= 0
                         then write
@@ -558,9 +643,106 @@ writeRawBufferPtrNoBlock loc !fd buf off len
     unsafe_write  = do_write (c_write (fdFD fd) (buf `plusPtr` off) len)
     safe_write    = do_write (c_safe_write (fdFD fd) (buf `plusPtr` off) len)
 
+-- Gather writes and sendfile, which block as writeRawBufferPtr does.
+-- They return Nothing when the system call can't do the job at all
+-- (there is no writev() or sendfile(), or sendfile() doesn't support
+-- this pair of descriptors), and the caller falls back to plain writes.
+-- So does writevRawBufferPtr for a blocking FD when asyncWrite# is in
+-- use, since that has no gather form.
+
+writevRawBufferPtr :: String -> FD -> Ptr (Ptr Word8) -> Ptr Int -> Int
+                   -> IO (Maybe Int)
+writevRawBufferPtr loc !fd bufs lens n
+#if defined(linux_HOST_OS)
+  | not (isNonBlocking fd) && useAsyncIO = return Nothing
+#endif
+  | otherwise
+  = writeRetryMayBlock loc fd (== eNOSYS)
+      (c_writev (fdFD fd) bufs lens n)
+      (c_safe_writev (fdFD fd) bufs lens n)
+
+sendfileRawFD :: String -> FD -> FD -> Int64 -> Int -> IO (Maybe Int)
+sendfileRawFD loc !out !file off count
+  = writeRetryMayBlock loc out unsupported
+      (c_sendfile (fdFD out) (fdFD file) off count)
+      (c_safe_sendfile (fdFD out) (fdFD file) off count)
+  where
+    unsupported e = e == eNOSYS || e == eINVAL
+      -- EINVAL: the output is of a kind (or the file is on a file
+      -- system) that this kernel's sendfile() doesn't support
+
+writeRetryMayBlock :: String -> FD -> (Errno -> Bool) -> IO Int -> IO Int
+                   -> IO (Maybe Int)
+writeRetryMayBlock loc !fd unsupported unsafe_call safe_call
+  | isNonBlocking fd = retry unsafe_call
+  | otherwise = do r <- unsafe_fdReady (fdFD fd) 1 0 0
+                   when (r == 0) $ threadWaitWrite (fromIntegral (fdFD fd))
+                   retry (if threaded then safe_call else unsafe_call)
+  where
+    retry call = do
+      r <- call
+      if r /= -1
+         then return (Just r)
+         else do
+           err <- getErrno
+           if err == eINTR
+              then retry call
+              else if err == eAGAIN || err == eWOULDBLOCK
+                      then do threadWaitWrite (fromIntegral (fdFD fd))
+                              retry call
+                      else if unsupported err
+                              then return Nothing
+                              else throwErrno loc
+
+foreign import ccall unsafe "hs_writev"
+  c_writev :: CInt -> Ptr (Ptr Word8) -> Ptr Int -> Int -> IO Int
+
+foreign import ccall safe "hs_writev"
+  c_safe_writev :: CInt -> Ptr (Ptr Word8) -> Ptr Int -> Int -> IO Int
+
+foreign import ccall unsafe "hs_sendfile"
+  c_sendfile :: CInt -> CInt -> Int64 -> Int -> IO Int
+
+foreign import ccall safe "hs_sendfile"
+  c_safe_sendfile :: CInt -> CInt -> Int64 -> Int -> IO Int
+
 isNonBlocking :: FD -> Bool
 isNonBlocking fd = fdIsNonBlocking fd /= 0
 
+#if defined(linux_HOST_OS)
+-- In the non-threaded RTS a read or write on a blocking FD (a regular
+-- file, say) stops every Haskell thread until it returns.  Where the
+-- RTS can do asyncRead#/asyncWrite# in the background (with io_uring,
+-- see rts/posix/AsyncIO.c), we use them instead; this also closes the
+-- race described in note [nonblock].
+useAsyncIO :: Bool
+useAsyncIO = not threaded && asyncIOSupported
+
+foreign import ccall unsafe "rtsSupportsAsyncIO" asyncIOSupported :: Bool
+
+asyncReadRawBufferPtr :: String -> FD -> Ptr Word8 -> Int -> CSize -> IO Int
+asyncReadRawBufferPtr loc !fd buf off len = do
+    (l, rc) <- asyncRead (fromIntegral (fdFD fd)) 0
+                         (fromIntegral len) (buf `plusPtr` off)
+    if l == (-1)
+      then if Errno (fromIntegral rc) == eINTR
+             then asyncReadRawBufferPtr loc fd buf off len
+             else ioError (errnoToIOError loc (Errno (fromIntegral rc))
+                                          Nothing Nothing)
+      else return l
+
+asyncWriteRawBufferPtr :: String -> FD -> Ptr Word8 -> Int -> CSize -> IO Int
+asyncWriteRawBufferPtr loc !fd buf off len = do
+    (l, rc) <- asyncWrite (fromIntegral (fdFD fd)) 0
+                          (fromIntegral len) (buf `plusPtr` off)
+    if l == (-1)
+      then if Errno (fromIntegral rc) == eINTR
+             then asyncWriteRawBufferPtr loc fd buf off len
+             else ioError (errnoToIOError loc (Errno (fromIntegral rc))
+                                          Nothing Nothing)
+      else return l
+#endif
+
 foreign import ccall unsafe "fdReady"
   unsafe_fdReady :: CInt -> CInt -> CInt -> CInt -> IO CInt
 
@@ -582,6 +764,15 @@ readRawBufferPtrNoBlock = readRawBufferPtr
 writeRawBufferPtrNoBlock :: String -> FD -> Ptr Word8 -> Int -> CSize -> IO CInt
 writeRawBufferPtrNoBlock = writeRawBufferPtr
 
+-- No writev() or sendfile(): the callers fall back to plain writes
+
+writevRawBufferPtr :: String -> FD -> Ptr (Ptr Word8) -> Ptr Int -> Int
+                   -> IO (Maybe Int)
+writevRawBufferPtr _ _ _ _ _ = return Nothing
+
+sendfileRawFD :: String -> FD -> FD -> Int64 -> Int -> IO (Maybe Int)
+sendfileRawFD _ _ _ _ _ = return Nothing
+
 -- Async versions of the read/write primitives, for the non-threaded RTS
 
 asyncReadRawBufferPtr :: String -> FD -> Ptr Word8 -> Int -> CSize -> IO CInt
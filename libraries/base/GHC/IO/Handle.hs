@@ -45,7 +45,8 @@ module GHC.IO.Handle (
 
    hWaitForInput, hGetChar, hGetLine, hGetContents, hPutChar, hPutStr,
 
-   hGetBuf, hGetBufNonBlocking, hPutBuf, hPutBufNonBlocking
+   hGetBuf, hGetBufNonBlocking, hPutBuf, hPutBufNonBlocking,
+   hPutBufs, hSendFile
  ) where
 
 import GHC.IO
@@ -28,6 +28,7 @@ module GHC.IO.Handle.Text (
         hWaitForInput, hGetChar, hGetLine, hGetContents, hPutChar, hPutStr,
         commitBuffer',       -- hack, see below
         hGetBuf, hGetBufSome, hGetBufNonBlocking, hPutBuf, hPutBufNonBlocking,
+        hPutBufs, hSendFile,
         memcpy, hPutStrLn,
     ) where
 
@@ -758,6 +759,74 @@ bufWrite h_@Handle__{..} ptr count can_block =
                                    return count
                            else writeChunkNonBlocking h_ (castPtr ptr) count
 
+-- ---------------------------------------------------------------------------
+-- hPutBufs
+
+-- | 'hPutBufs' @hdl bufs@ writes each of @bufs@, given as an address and
+-- a number of bytes, to @hdl@ in turn, as 'hPutBuf' would.
+--
+-- If they don't all fit in the 'Handle''s buffer and the 'Handle' is
+-- over a file descriptor, they are written straight from where they
+-- are, together with what is in the buffer already, with gather writes
+-- (@writev()@), rather than being copied into the buffer first.
+hPutBufs :: Handle -> [(Ptr a, Int)] -> IO ()
+hPutBufs handle bufs
+  | (_, count) : _ <- filter ((< 0) . snd) bufs
+  = illegalBufferSize handle "hPutBufs" count
+  | otherwise =
+    wantWritableHandle "hPutBufs" handle $
+      \ h_@Handle__{..} -> do
+          buf@Buffer{ bufRaw=raw, bufL=r, bufR=w, bufSize=size }
+             <- readIORef haByteBuffer
+          let total = sum (map snd bufs)
+          case cast haDevice of
+            Just fd | total >= size - w -> do
+              debugIO ("hPutBufs: writev, total=" ++ show total)
+              withRawBuffer raw $ \p ->
+                fdWriteVectored (fd::FD) $
+                  (p `plusPtr` r, w - r) : [ (castPtr ptr, n) | (ptr, n) <- bufs ]
+              writeIORef haByteBuffer buf{ bufL=0, bufR=0 }
+            _ -> do
+              let copy [] = return ()
+                  copy ((ptr, n) : rest) = do _ <- bufWrite h_ (castPtr ptr) n True
+                                              copy rest
+              copy bufs
+              -- flush as hPutBuf does
+              case haBufferMode of
+                 BlockBuffering _      -> do return ()
+                 _line_or_no_buffering -> do flushWriteBuffer h_
+
+-- ---------------------------------------------------------------------------
+-- hSendFile
+
+-- | 'hSendFile' @hdl file off count@ writes @count@ bytes of @file@,
+-- starting at byte offset @off@, to @hdl@, and returns the number of
+-- bytes written: fewer than @count@ only if @file@ ended first.  Both
+-- handles must be over file descriptors, and @file@ must be seekable.
+--
+-- The bytes don't go through either 'Handle''s buffer: on Linux the
+-- kernel copies them with @sendfile()@, which is the fast way to send a
+-- file to a socket.  Otherwise (see 'GHC.IO.FD.fdSendFile') they are
+-- read and written through a temporary buffer, and the position of
+-- @file@ is left after the bytes that were copied.  Like 'hPutBuf',
+-- 'hSendFile' ignores the encoding and newline mode of both handles.
+hSendFile :: Handle -> Handle -> Integer -> Int -> IO Int
+hSendFile handle file off count
+  | count < 0 = illegalBufferSize handle "hSendFile" count
+  | handle == file || off < 0 =
+      ioException (IOError (Just handle) InvalidArgument "hSendFile"
+                           "illegal arguments" Nothing Nothing)
+  | otherwise =
+    wantReadableHandle_ "hSendFile" file $ \ file_ ->
+    wantWritableHandle "hSendFile" handle $ \ h_ -> do
+      flushBuffer file_
+      flushWriteBuffer h_
+      case (haFD h_, haFD file_) of
+        (Just out, Just fd) -> fdSendFile out fd (fromIntegral off) count
+        _ -> ioException (IOError (Just handle) UnsupportedOperation
+                                  "hSendFile" "not a file descriptor"
+                                  Nothing Nothing)
+
 writeChunk :: Handle__ -> Ptr Word8 -> Int -> IO ()
 writeChunk h_@Handle__{..} ptr bytes
   | Just fd <- cast haDevice  =  RawIO.write (fd::FD) ptr bytes
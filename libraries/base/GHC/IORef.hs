@@ -1,5 +1,5 @@
 {-# LANGUAGE Unsafe #-}
-{-# LANGUAGE NoImplicitPrelude, MagicHash #-}
+{-# LANGUAGE NoImplicitPrelude, MagicHash, UnboxedTuples, BangPatterns #-}
 {-# OPTIONS_GHC -funbox-strict-fields #-}
 {-# OPTIONS_HADDOCK hide #-}
 
@@ -19,7 +19,8 @@
 
 module GHC.IORef (
         IORef(..),
-        newIORef, readIORef, writeIORef, atomicModifyIORef
+        newIORef, readIORef, writeIORef, atomicModifyIORef,
+        atomicModifyIORef', atomicSwapIORef
     ) where
 
 import GHC.Base
@@ -51,3 +52,30 @@ writeIORef (IORef var) v = stToIO (writeSTRef var v)
 atomicModifyIORef :: IORef a -> (a -> (a,b)) -> IO b
 atomicModifyIORef (IORef (STRef r#)) f = IO $ \s -> atomicModifyMutVar# r# f s
 
+-- | Strict version of 'atomicModifyIORef'.  This forces both the value stored
+-- in the 'IORef' as well as the value returned.
+--
+-- It doesn't leave a thunk in the 'IORef': it applies the function to
+-- the current contents, forces the new value, and compare-and-swaps it
+-- in, trying again if another thread has changed the 'IORef' in the
+-- meantime.  So the function may be applied more than once, but nothing
+-- is allocated besides what the function allocates.
+--
+-- @since 4.6.0.0
+atomicModifyIORef' :: IORef a -> (a -> (a,b)) -> IO b
+atomicModifyIORef' (IORef (STRef r#)) f = do
+    b <- IO loop
+    b `seq` return b
+  where
+    loop s1 = case readMutVar# r# s1 of
+      (# s2, old #) -> case f old of
+        (!new, b) -> case casMutVar# r# old new s2 of
+          (# s3, 0#, _ #) -> (# s3, b #)
+          (# s3, _,  _ #) -> loop s3
+
+-- | Atomically write a new value into an 'IORef' and return the old one.
+-- This doesn't allocate.
+--
+-- @since 4.8.1.0
+atomicSwapIORef :: IORef a -> a -> IO a
+atomicSwapIORef (IORef (STRef r#)) new = IO $ \s -> atomicSwapMutVar# r# new s
@@ -1,5 +1,6 @@
 {-# LANGUAGE Unsafe #-}
 {-# LANGUAGE NoImplicitPrelude
+           , ForeignFunctionInterface
            , BangPatterns
            , MagicHash
            , UnboxedTuples
@@ -149,7 +150,11 @@ runFinalizerBatch (I# n) arr =
                   _  -> let !m' = m -# 1# in
                         case indexArray# arr m' of { (# io #) ->
                         case unIO io s of          { (# s', _ #) ->
-                        unIO (go m') s'
-                        }}
+                        case unIO finalizerDone s' of { (# s'', _ #) ->
+                        unIO (go m') s''
+                        }}}
    in
         go n
+
+-- Counts the finalizers that have run, for rts_getFinalizerCounts()
+foreign import ccall unsafe "rts_finalizerDone" finalizerDone :: IO ()
@@ -18,8 +18,14 @@ module System.Mem
        ( performGC
        , performMajorGC
        , performMinorGC
+       , addMemoryPressureHandler
+       , freezeHeap
+       , saveHeapImage
        ) where
 
+import Control.Exception.Base (SomeException, catch)
+import Foreign.StablePtr (StablePtr, newStablePtr)
+
 -- | Triggers an immediate garbage collection.
 performGC :: IO ()
 performGC = performMajorGC
@@ -33,3 +39,59 @@ foreign import ccall "performMajorGC" performMajorGC :: IO ()
 --
 -- @since 4.7.0.0
 foreign import ccall "performGC" performMinorGC :: IO ()
+
+-- | Registers an action for the runtime system to run, in a thread of
+-- its own, after each major garbage collection that leaves the heap
+-- bigger than the soft limit set with @+RTS --soft-heap-limit@.  A
+-- program can use it to drop caches before it runs into the hard limit
+-- (@-M@), or into the limits of the machine.  Exceptions thrown by the
+-- action are ignored.
+--
+-- Handlers cannot be removed, and they are never run without a soft
+-- limit.
+--
+-- @since 4.8.1.0
+addMemoryPressureHandler :: IO () -> IO ()
+addMemoryPressureHandler act =
+    newStablePtr (act `catch` ignore) >>= c_addMemoryPressureHandler
+  where
+    ignore :: SomeException -> IO ()
+    ignore _ = return ()
+
+foreign import ccall unsafe "addMemoryPressureHandler"
+    c_addMemoryPressureHandler :: StablePtr (IO ()) -> IO ()
+
+-- | Performs a major garbage collection, and then freezes all the data
+-- that is left in the heap: it is never collected again, and the
+-- garbage collector doesn't copy it or write to it.  A server that
+-- builds a big heap before forking worker processes (for example with
+-- @System.Posix.Process.forkProcess@) can call this just before the
+-- first fork, so that the workers keep sharing that heap with the
+-- parent copy-on-write, rather than each getting a private copy of it
+-- at its first major collection.
+--
+-- Data in the frozen heap that becomes garbage is never reclaimed, in
+-- the parent or in the children.  Writing to frozen mutable objects
+-- (including evaluating frozen thunks) still makes private copies of
+-- the pages they are on.  With @+RTS -G1@ the heap can't be frozen,
+-- and this only reports an error.
+--
+-- @since 4.8.1.0
+foreign import ccall "freezeHeap" freezeHeap :: IO ()
+
+-- | Performs a major garbage collection, and then writes the values of
+-- the evaluated CAFs (top-level constants) that are still live to the
+-- file given by @+RTS --heap-image=\<file\>@.  A later run of the same
+-- executable with the same flag reads the file as it starts, and those
+-- CAFs start out evaluated, so that a program that spends a long time
+-- building tables at startup need only build them once.
+--
+-- Only a CAF whose value is immutable (constructors, functions, thunks,
+-- immutable arrays and unpinned byte arrays) is saved; the others are
+-- evaluated again, as usual.  The image is ignored by any other build
+-- of the program.  Heap images are only supported on Linux, for
+-- statically linked programs, and not when profiling; elsewhere this
+-- only reports an error.
+--
+-- @since 4.8.1.0
+foreign import ccall "saveHeapImage" saveHeapImage :: IO ()
@@ -1,5 +1,6 @@
-{-# LANGUAGE Safe #-}
+{-# LANGUAGE Trustworthy #-}
 {-# LANGUAGE CPP #-}
+{-# LANGUAGE MagicHash, UnliftedFFITypes #-}
 {-# LANGUAGE StandaloneDeriving #-}
 
 -------------------------------------------------------------------------------
@@ -22,6 +23,11 @@ module System.Timeout ( timeout ) where
 import Control.Monad
 import GHC.Event           (getSystemTimerManager,
                             registerTimeout, unregisterTimeout)
+import GHC.Base            (ThreadId#)
+import GHC.Conc.Sync       (ThreadId(..))
+import Foreign.Ptr         (Ptr)
+import Foreign.StablePtr   (StablePtr, newStablePtr)
+import Control.Exception   (SomeException)
 #endif
 
 import Control.Concurrent
@@ -108,7 +114,21 @@ timeout n f
                    (bracket (registerTimeout tm n handleTimeout)
                             cleanupTimeout
                             (\_ -> fmap Just f))
-#endif
+    | otherwise = do
+        -- In the non-threaded RTS, the scheduler raises the exception
+        -- itself when the thread's deadline passes.  So no thread is
+        -- forked, and none has to be killed when f finishes in time.
+        -- The RTS does not raise it while the thread masks exceptions,
+        -- so it can't arrive once the deadline has been cleared.
+        ThreadId pid <- myThreadId
+        ex <- fmap Timeout newUnique
+        handleJust (\e -> if e == ex then Just () else Nothing)
+                   (\_ -> return Nothing)
+                   (bracket (newStablePtr (toException ex) >>=
+                                 setThreadDeadline pid n)
+                            clearThreadDeadline
+                            (\_ -> fmap Just f))
+#else
     | otherwise = do
         pid <- myThreadId
         ex  <- fmap Timeout newUnique
@@ -119,3 +139,13 @@ timeout n f
                             (uninterruptibleMask_ . killThread)
                             (\_ -> fmap Just f))
         -- #7719 explains why we need uninterruptibleMask_ above.
+#endif
+
+#ifndef mingw32_HOST_OS
+foreign import ccall unsafe "rts_setThreadDeadline"
+  setThreadDeadline :: ThreadId# -> Int -> StablePtr SomeException
+                    -> IO (Ptr ())
+
+foreign import ccall unsafe "rts_clearThreadDeadline"
+  clearThreadDeadline :: Ptr () -> IO ()
+#endif
@@ -7,6 +7,39 @@
 /* select and supporting types is not Posix */
 /* #include "PosixSource.h" */
 #include "HsBase.h"
+#if defined(HAVE_POLL) && HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(_WIN32) \
+    && defined(HAVE_POLL) && HAVE_POLL_H
+#define USE_POLL 1
+#endif
+
+#if defined(USE_POLL)
+/*
+ * poll() a set of descriptors, retrying on EINTR.  A negative 'msecs'
+ * waits indefinitely.  Unlike select() this has no FD_SETSIZE limit
+ * and its cost depends on the number of descriptors, not their value.
+ */
+static int
+pollRetry(struct pollfd *fds, nfds_t nfds, int msecs)
+{
+    int ready;
+
+    while ((ready = poll(fds, nfds, msecs < 0 ? -1 : msecs)) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return ready;
+}
+
+/* POLLHUP/POLLERR make a subsequent read()/write() return without
+ * blocking, which is what select() reports as ready, too */
+#define POLL_READY(revents) \
+    ((revents) & (POLLIN | POLLOUT | POLLHUP | POLLERR))
+#endif
 
 /*
  * inputReady(fd) checks to see whether input is available on the file
@@ -16,6 +49,27 @@
 int
 fdReady(int fd, int write, int msecs, int isSock)
 {
+#if defined(USE_POLL)
+    struct pollfd pfd;
+    int ready;
+
+    (void)isSock;
+    pfd.fd = fd;
+    pfd.events = write ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+
+    ready = pollRetry(&pfd, 1, msecs);
+    if (ready <= 0) {
+        return ready;
+    }
+    if (pfd.revents & POLLNVAL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* 1 => Input ready, 0 => not ready, -1 => error */
+    return POLL_READY(pfd.revents) ? 1 : 0;
+#else
     if 
 #if defined(_MSC_VER) || defined(__MINGW32__) || defined(_WIN32)
     ( isSock ) {
@@ -45,7 +99,7 @@ fdReady(int fd, int write, int msecs, int isSock)
 	tv.tv_sec  = msecs / 1000;
 	tv.tv_usec = (msecs % 1000) * 1000;
 	
-	while ((ready = select(maxfd, &rfd, &wfd, NULL, &tv)) < 0 ) {
+	while ((ready = select(maxfd, &rfd, &wfd, NULL, msecs < 0 ? NULL : &tv)) < 0 ) {
 	    if (errno != EINTR ) {
 		return -1;
 	    }
@@ -169,4 +223,80 @@ fdReady(int fd, int write, int msecs, int isSock)
         }
     }
 #endif
-}    
+#endif /* USE_POLL */
+}
+
+/*
+ * fdsReady(nfds, fds, write, ready, msecs) is the batched form of
+ * fdReady(): it waits up to 'msecs' milliseconds (indefinitely if
+ * negative) until at least one of the 'nfds' descriptors in 'fds' is
+ * ready for reading (write[i] == 0) or writing (write[i] != 0), and
+ * sets ready[i] to 1 or 0 for every descriptor.
+ *
+ * Returns the number of ready descriptors, or -1 on error.  With
+ * poll() all descriptors are checked in a single system call;
+ * otherwise they are checked in turn and only the first one waits.
+ */
+int
+fdsReady(int nfds, const int *fds, const int *write, int *ready, int msecs)
+{
+#if defined(USE_POLL)
+    struct pollfd stack_pfds[16];
+    struct pollfd *pfds = stack_pfds;
+    int i, n;
+
+    if (nfds < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (nfds > (int)(sizeof(stack_pfds) / sizeof(stack_pfds[0]))) {
+        pfds = malloc(nfds * sizeof(struct pollfd));
+        if (pfds == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    for (i = 0; i < nfds; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = write[i] ? POLLOUT : POLLIN;
+        pfds[i].revents = 0;
+    }
+
+    n = pollRetry(pfds, (nfds_t)nfds, msecs);
+    if (n > 0) {
+        n = 0;
+        for (i = 0; i < nfds; i++) {
+            if (pfds[i].revents & POLLNVAL) {
+                errno = EBADF;
+                n = -1;
+                break;
+            }
+            ready[i] = POLL_READY(pfds[i].revents) ? 1 : 0;
+            n += ready[i];
+        }
+    } else if (n == 0) {
+        for (i = 0; i < nfds; i++) {
+            ready[i] = 0;
+        }
+    }
+
+    if (pfds != stack_pfds) {
+        free(pfds);
+    }
+    return n;
+#else
+    int i, r, n = 0;
+
+    for (i = 0; i < nfds; i++) {
+        /* only the first descriptor gets to block */
+        r = fdReady(fds[i], write[i], n == 0 && i == 0 ? msecs : 0, 0);
+        if (r < 0) {
+            return -1;
+        }
+        ready[i] = r;
+        n += r;
+    }
+    return n;
+#endif
+}
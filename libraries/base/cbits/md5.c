@@ -23,6 +23,8 @@ void __hsbase_MD5Init(struct MD5Context *context);
 void __hsbase_MD5Update(struct MD5Context *context, byte const *buf, int len);
 void __hsbase_MD5Final(byte digest[16], struct MD5Context *context);
 void __hsbase_MD5Transform(word32 buf[4], word32 const in[16]);
+void __hsbase_MD5Many(int n, byte const *const *bufs, int const *lens,
+		      byte *digests);
 
 
 /*
@@ -146,12 +148,87 @@ __hsbase_MD5Final(byte digest[16], struct MD5Context *ctx)
 #define MD5STEP(f,w,x,y,z,in,s) \
 	 (w += f(x,y,z) + in, w = (w<<s | w>>(32-s)) + x)
 
+/*
+ * The 64 steps of the transform, for both the one-message and the
+ * multi-message versions below.
+ */
+#define MD5ROUNDS(STEP) \
+	STEP(F1, a, b, c, d, 0, 0xd76aa478, 7); \
+	STEP(F1, d, a, b, c, 1, 0xe8c7b756, 12); \
+	STEP(F1, c, d, a, b, 2, 0x242070db, 17); \
+	STEP(F1, b, c, d, a, 3, 0xc1bdceee, 22); \
+	STEP(F1, a, b, c, d, 4, 0xf57c0faf, 7); \
+	STEP(F1, d, a, b, c, 5, 0x4787c62a, 12); \
+	STEP(F1, c, d, a, b, 6, 0xa8304613, 17); \
+	STEP(F1, b, c, d, a, 7, 0xfd469501, 22); \
+	STEP(F1, a, b, c, d, 8, 0x698098d8, 7); \
+	STEP(F1, d, a, b, c, 9, 0x8b44f7af, 12); \
+	STEP(F1, c, d, a, b, 10, 0xffff5bb1, 17); \
+	STEP(F1, b, c, d, a, 11, 0x895cd7be, 22); \
+	STEP(F1, a, b, c, d, 12, 0x6b901122, 7); \
+	STEP(F1, d, a, b, c, 13, 0xfd987193, 12); \
+	STEP(F1, c, d, a, b, 14, 0xa679438e, 17); \
+	STEP(F1, b, c, d, a, 15, 0x49b40821, 22); \
+	\
+	STEP(F2, a, b, c, d, 1, 0xf61e2562, 5); \
+	STEP(F2, d, a, b, c, 6, 0xc040b340, 9); \
+	STEP(F2, c, d, a, b, 11, 0x265e5a51, 14); \
+	STEP(F2, b, c, d, a, 0, 0xe9b6c7aa, 20); \
+	STEP(F2, a, b, c, d, 5, 0xd62f105d, 5); \
+	STEP(F2, d, a, b, c, 10, 0x02441453, 9); \
+	STEP(F2, c, d, a, b, 15, 0xd8a1e681, 14); \
+	STEP(F2, b, c, d, a, 4, 0xe7d3fbc8, 20); \
+	STEP(F2, a, b, c, d, 9, 0x21e1cde6, 5); \
+	STEP(F2, d, a, b, c, 14, 0xc33707d6, 9); \
+	STEP(F2, c, d, a, b, 3, 0xf4d50d87, 14); \
+	STEP(F2, b, c, d, a, 8, 0x455a14ed, 20); \
+	STEP(F2, a, b, c, d, 13, 0xa9e3e905, 5); \
+	STEP(F2, d, a, b, c, 2, 0xfcefa3f8, 9); \
+	STEP(F2, c, d, a, b, 7, 0x676f02d9, 14); \
+	STEP(F2, b, c, d, a, 12, 0x8d2a4c8a, 20); \
+	\
+	STEP(F3, a, b, c, d, 5, 0xfffa3942, 4); \
+	STEP(F3, d, a, b, c, 8, 0x8771f681, 11); \
+	STEP(F3, c, d, a, b, 11, 0x6d9d6122, 16); \
+	STEP(F3, b, c, d, a, 14, 0xfde5380c, 23); \
+	STEP(F3, a, b, c, d, 1, 0xa4beea44, 4); \
+	STEP(F3, d, a, b, c, 4, 0x4bdecfa9, 11); \
+	STEP(F3, c, d, a, b, 7, 0xf6bb4b60, 16); \
+	STEP(F3, b, c, d, a, 10, 0xbebfbc70, 23); \
+	STEP(F3, a, b, c, d, 13, 0x289b7ec6, 4); \
+	STEP(F3, d, a, b, c, 0, 0xeaa127fa, 11); \
+	STEP(F3, c, d, a, b, 3, 0xd4ef3085, 16); \
+	STEP(F3, b, c, d, a, 6, 0x04881d05, 23); \
+	STEP(F3, a, b, c, d, 9, 0xd9d4d039, 4); \
+	STEP(F3, d, a, b, c, 12, 0xe6db99e5, 11); \
+	STEP(F3, c, d, a, b, 15, 0x1fa27cf8, 16); \
+	STEP(F3, b, c, d, a, 2, 0xc4ac5665, 23); \
+	\
+	STEP(F4, a, b, c, d, 0, 0xf4292244, 6); \
+	STEP(F4, d, a, b, c, 7, 0x432aff97, 10); \
+	STEP(F4, c, d, a, b, 14, 0xab9423a7, 15); \
+	STEP(F4, b, c, d, a, 5, 0xfc93a039, 21); \
+	STEP(F4, a, b, c, d, 12, 0x655b59c3, 6); \
+	STEP(F4, d, a, b, c, 3, 0x8f0ccc92, 10); \
+	STEP(F4, c, d, a, b, 10, 0xffeff47d, 15); \
+	STEP(F4, b, c, d, a, 1, 0x85845dd1, 21); \
+	STEP(F4, a, b, c, d, 8, 0x6fa87e4f, 6); \
+	STEP(F4, d, a, b, c, 15, 0xfe2ce6e0, 10); \
+	STEP(F4, c, d, a, b, 6, 0xa3014314, 15); \
+	STEP(F4, b, c, d, a, 13, 0x4e0811a1, 21); \
+	STEP(F4, a, b, c, d, 4, 0xf7537e82, 6); \
+	STEP(F4, d, a, b, c, 11, 0xbd3af235, 10); \
+	STEP(F4, c, d, a, b, 2, 0x2ad7d2bb, 15); \
+	STEP(F4, b, c, d, a, 9, 0xeb86d391, 21);
+
 /*
  * The core of the MD5 algorithm, this alters an existing MD5 hash to
  * reflect the addition of 16 longwords of new data.  MD5Update blocks
  * the data and converts bytes into longwords for this routine.
  */
 
+#define STEP1(f,w,x,y,z,i,k,s) MD5STEP(f,w,x,y,z,in[i] + k,s)
+
 void
 __hsbase_MD5Transform(word32 buf[4], word32 const in[16])
 {
@@ -162,73 +239,7 @@ __hsbase_MD5Transform(word32 buf[4], word32 const in[16])
 	c = buf[2];
 	d = buf[3];
 
-	MD5STEP(F1, a, b, c, d, in[0] + 0xd76aa478, 7);
-	MD5STEP(F1, d, a, b, c, in[1] + 0xe8c7b756, 12);
-	MD5STEP(F1, c, d, a, b, in[2] + 0x242070db, 17);
-	MD5STEP(F1, b, c, d, a, in[3] + 0xc1bdceee, 22);
-	MD5STEP(F1, a, b, c, d, in[4] + 0xf57c0faf, 7);
-	MD5STEP(F1, d, a, b, c, in[5] + 0x4787c62a, 12);
-	MD5STEP(F1, c, d, a, b, in[6] + 0xa8304613, 17);
-	MD5STEP(F1, b, c, d, a, in[7] + 0xfd469501, 22);
-	MD5STEP(F1, a, b, c, d, in[8] + 0x698098d8, 7);
-	MD5STEP(F1, d, a, b, c, in[9] + 0x8b44f7af, 12);
-	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
-	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22);
-	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122, 7);
-	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12);
-	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17);
-	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22);
-
-	MD5STEP(F2, a, b, c, d, in[1] + 0xf61e2562, 5);
-	MD5STEP(F2, d, a, b, c, in[6] + 0xc040b340, 9);
-	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14);
-	MD5STEP(F2, b, c, d, a, in[0] + 0xe9b6c7aa, 20);
-	MD5STEP(F2, a, b, c, d, in[5] + 0xd62f105d, 5);
-	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453, 9);
-	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
-	MD5STEP(F2, b, c, d, a, in[4] + 0xe7d3fbc8, 20);
-	MD5STEP(F2, a, b, c, d, in[9] + 0x21e1cde6, 5);
-	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6, 9);
-	MD5STEP(F2, c, d, a, b, in[3] + 0xf4d50d87, 14);
-	MD5STEP(F2, b, c, d, a, in[8] + 0x455a14ed, 20);
-	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905, 5);
-	MD5STEP(F2, d, a, b, c, in[2] + 0xfcefa3f8, 9);
-	MD5STEP(F2, c, d, a, b, in[7] + 0x676f02d9, 14);
-	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
-
-	MD5STEP(F3, a, b, c, d, in[5] + 0xfffa3942, 4);
-	MD5STEP(F3, d, a, b, c, in[8] + 0x8771f681, 11);
-	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
-	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23);
-	MD5STEP(F3, a, b, c, d, in[1] + 0xa4beea44, 4);
-	MD5STEP(F3, d, a, b, c, in[4] + 0x4bdecfa9, 11);
-	MD5STEP(F3, c, d, a, b, in[7] + 0xf6bb4b60, 16);
-	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
-	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6, 4);
-	MD5STEP(F3, d, a, b, c, in[0] + 0xeaa127fa, 11);
-	MD5STEP(F3, c, d, a, b, in[3] + 0xd4ef3085, 16);
-	MD5STEP(F3, b, c, d, a, in[6] + 0x04881d05, 23);
-	MD5STEP(F3, a, b, c, d, in[9] + 0xd9d4d039, 4);
-	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
-	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
-	MD5STEP(F3, b, c, d, a, in[2] + 0xc4ac5665, 23);
-
-	MD5STEP(F4, a, b, c, d, in[0] + 0xf4292244, 6);
-	MD5STEP(F4, d, a, b, c, in[7] + 0x432aff97, 10);
-	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15);
-	MD5STEP(F4, b, c, d, a, in[5] + 0xfc93a039, 21);
-	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3, 6);
-	MD5STEP(F4, d, a, b, c, in[3] + 0x8f0ccc92, 10);
-	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15);
-	MD5STEP(F4, b, c, d, a, in[1] + 0x85845dd1, 21);
-	MD5STEP(F4, a, b, c, d, in[8] + 0x6fa87e4f, 6);
-	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
-	MD5STEP(F4, c, d, a, b, in[6] + 0xa3014314, 15);
-	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
-	MD5STEP(F4, a, b, c, d, in[4] + 0xf7537e82, 6);
-	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10);
-	MD5STEP(F4, c, d, a, b, in[2] + 0x2ad7d2bb, 15);
-	MD5STEP(F4, b, c, d, a, in[9] + 0xeb86d391, 21);
+	MD5ROUNDS(STEP1)
 
 	buf[0] += a;
 	buf[1] += b;
@@ -236,3 +247,87 @@ __hsbase_MD5Transform(word32 buf[4], word32 const in[16])
 	buf[3] += d;
 }
 
+/*
+ * The same for MD5_LANES independent messages at once: in[i][l] is word
+ * i of the block of message l.  Each step is the same operation on all
+ * the lanes, which the C compiler can turn into vector instructions.
+ */
+
+#define STEP4(f,w,x,y,z,i,k,s) \
+	for (l = 0; l < MD5_LANES; l++) MD5STEP(f,w[l],x[l],y[l],z[l],in[i][l] + k,s)
+
+static void
+MD5TransformLanes(word32 buf[4][MD5_LANES], word32 const in[16][MD5_LANES])
+{
+	word32 a[MD5_LANES], b[MD5_LANES], c[MD5_LANES], d[MD5_LANES];
+	int l;
+
+	for (l = 0; l < MD5_LANES; l++) {
+		a[l] = buf[0][l];
+		b[l] = buf[1][l];
+		c[l] = buf[2][l];
+		d[l] = buf[3][l];
+	}
+
+	MD5ROUNDS(STEP4)
+
+	for (l = 0; l < MD5_LANES; l++) {
+		buf[0][l] += a[l];
+		buf[1][l] += b[l];
+		buf[2][l] += c[l];
+		buf[3][l] += d[l];
+	}
+}
+
+/*
+ * Compute the digests of n independent messages, bufs[i] of lens[i]
+ * bytes, into digests[16*i..16*i+15].  The messages are taken
+ * MD5_LANES at a time, and their blocks transformed together for as
+ * long as all of them have one; each then finishes on its own.
+ */
+void
+__hsbase_MD5Many(int n, byte const *const *bufs, int const *lens,
+		 byte *digests)
+{
+	static const word32 init[4] =
+		{ 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+	word32 buf[4][MD5_LANES];
+	word32 in[16][MD5_LANES];
+	struct MD5Context ctx;
+	int i, j, l, w, lanes, blocks;
+	byte const *p;
+
+	for (i = 0; i < n; i += MD5_LANES) {
+		lanes = n - i < MD5_LANES ? n - i : MD5_LANES;
+
+		blocks = lens[i] / 64;
+		for (l = 1; l < lanes; l++) {
+			if (lens[i+l] / 64 < blocks) blocks = lens[i+l] / 64;
+		}
+
+		for (w = 0; w < 4; w++) {
+			for (l = 0; l < MD5_LANES; l++) buf[w][l] = init[w];
+		}
+		memset(in, 0, sizeof(in));
+
+		for (j = 0; j < blocks; j++) {
+			for (l = 0; l < lanes; l++) {
+				p = bufs[i+l] + 64*j;
+				for (w = 0; w < 16; w++, p += 4) {
+					in[w][l] = (word32)((unsigned)p[3] << 8 | p[2]) << 16 |
+						((unsigned)p[1] << 8 | p[0]);
+				}
+			}
+			MD5TransformLanes(buf, (word32 const (*)[MD5_LANES])in);
+		}
+
+		for (l = 0; l < lanes; l++) {
+			for (w = 0; w < 4; w++) ctx.buf[w] = buf[w][l];
+			ctx.bytes[0] = 64 * (word32)blocks;
+			ctx.bytes[1] = 0;
+			__hsbase_MD5Update(&ctx, bufs[i+l] + 64*blocks,
+					   lens[i+l] - 64*blocks);
+			__hsbase_MD5Final(digests + 16*(i+l), &ctx);
+		}
+	}
+}
@@ -0,0 +1,137 @@
+/*
+ * MurmurHash3_x64_128, by Austin Appleby, who placed it in the public
+ * domain, rearranged so that the message can be given a piece at a time.
+ * The digest is the same as that of the original with a seed of 0: h1
+ * then h2, each most significant byte first, as read by the Storable
+ * instance of Fingerprint.
+ *
+ * This is not a cryptographic hash.  It is several times faster than
+ * MD5, for fingerprints that only need to tell apart inputs that are
+ * not chosen to collide.
+ */
+
+#include "HsFFI.h"
+#include "murmur3.h"
+#include <string.h>
+
+#define ROTL64(x,r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+#define C1 0x87c37b91114253d5ULL
+#define C2 0x4cf5ad432745937fULL
+
+static HsWord64
+getblock(HsWord8 const *p)
+{
+	return  (HsWord64)p[0]       | (HsWord64)p[1] << 8  |
+		(HsWord64)p[2] << 16 | (HsWord64)p[3] << 24 |
+		(HsWord64)p[4] << 32 | (HsWord64)p[5] << 40 |
+		(HsWord64)p[6] << 48 | (HsWord64)p[7] << 56;
+}
+
+static HsWord64
+fmix64(HsWord64 k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static void
+block(struct Murmur3Context *ctx, HsWord8 const *p)
+{
+	HsWord64 k1 = getblock(p);
+	HsWord64 k2 = getblock(p + 8);
+
+	k1 *= C1; k1 = ROTL64(k1, 31); k1 *= C2; ctx->h1 ^= k1;
+	ctx->h1 = ROTL64(ctx->h1, 27); ctx->h1 += ctx->h2;
+	ctx->h1 = ctx->h1 * 5 + 0x52dce729;
+
+	k2 *= C2; k2 = ROTL64(k2, 33); k2 *= C1; ctx->h2 ^= k2;
+	ctx->h2 = ROTL64(ctx->h2, 31); ctx->h2 += ctx->h1;
+	ctx->h2 = ctx->h2 * 5 + 0x38495ab5;
+}
+
+void
+__hsbase_Murmur3Init(struct Murmur3Context *ctx)
+{
+	ctx->h1 = 0;
+	ctx->h2 = 0;
+	ctx->bytes = 0;
+}
+
+void
+__hsbase_Murmur3Update(struct Murmur3Context *ctx, HsWord8 const *buf, int len)
+{
+	int t = (int)(ctx->bytes & 15);	/* bytes in ctx->tail */
+
+	ctx->bytes += len;
+
+	if (t > 0) {
+		if (t + len < 16) {
+			memcpy(ctx->tail + t, buf, len);
+			return;
+		}
+		memcpy(ctx->tail + t, buf, 16 - t);
+		block(ctx, ctx->tail);
+		buf += 16 - t;
+		len -= 16 - t;
+	}
+
+	while (len >= 16) {
+		block(ctx, buf);
+		buf += 16;
+		len -= 16;
+	}
+
+	memcpy(ctx->tail, buf, len);
+}
+
+void
+__hsbase_Murmur3Final(HsWord8 digest[16], struct Murmur3Context *ctx)
+{
+	HsWord8 const *tail = ctx->tail;
+	HsWord64 h1 = ctx->h1, h2 = ctx->h2;
+	HsWord64 k1 = 0, k2 = 0;
+	int i;
+
+	switch (ctx->bytes & 15) {
+	case 15: k2 ^= (HsWord64)tail[14] << 48;
+	case 14: k2 ^= (HsWord64)tail[13] << 40;
+	case 13: k2 ^= (HsWord64)tail[12] << 32;
+	case 12: k2 ^= (HsWord64)tail[11] << 24;
+	case 11: k2 ^= (HsWord64)tail[10] << 16;
+	case 10: k2 ^= (HsWord64)tail[ 9] << 8;
+	case  9: k2 ^= (HsWord64)tail[ 8];
+		k2 *= C2; k2 = ROTL64(k2, 33); k2 *= C1; h2 ^= k2;
+	case  8: k1 ^= (HsWord64)tail[ 7] << 56;
+	case  7: k1 ^= (HsWord64)tail[ 6] << 48;
+	case  6: k1 ^= (HsWord64)tail[ 5] << 40;
+	case  5: k1 ^= (HsWord64)tail[ 4] << 32;
+	case  4: k1 ^= (HsWord64)tail[ 3] << 24;
+	case  3: k1 ^= (HsWord64)tail[ 2] << 16;
+	case  2: k1 ^= (HsWord64)tail[ 1] << 8;
+	case  1: k1 ^= (HsWord64)tail[ 0];
+		k1 *= C1; k1 = ROTL64(k1, 31); k1 *= C2; h1 ^= k1;
+	}
+
+	h1 ^= ctx->bytes;
+	h2 ^= ctx->bytes;
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	for (i = 0; i < 8; i++) {
+		digest[i]     = (HsWord8)(h1 >> (56 - 8*i));
+		digest[8 + i] = (HsWord8)(h2 >> (56 - 8*i));
+	}
+	memset(ctx, 0, sizeof(*ctx));
+}
@@ -10,6 +10,8 @@
 #include "HsFFI.h"
 #include "Rts.h" // XXX wrong (for IEEE_FLOATING_POINT and WORDS_BIGENDIAN)
 
+#include <string.h>
+
 #define IEEE_FLOATING_POINT 1
 
 union stg_ieee754_flt
@@ -442,6 +444,145 @@ rintDouble(HsDouble d)
     }
 }
 
+/*
+ * Array versions of the predicates above, for validating whole
+ * buffers (e.g. a ByteArray# passed to an unsafe foreign call) without
+ * one FFI call per element.  Each takes a base pointer, an element
+ * offset and an element count.  They test the raw bit patterns with
+ * masks rather than bit-fields, so that the loops have no branches the
+ * C compiler can't turn into vector code.
+ */
+
+#define DBL_EXP_MASK  0x7ff0000000000000ULL
+#define DBL_MANT_MASK 0x000fffffffffffffULL
+#define DBL_SIGN_MASK 0x8000000000000000ULL
+#define FLT_EXP_MASK  0x7f800000U
+#define FLT_MANT_MASK 0x007fffffU
+#define FLT_SIGN_MASK 0x80000000U
+
+/* bits set by classifyDoubles()/classifyFloats(), one per predicate */
+#define FP_CLASS_NAN           1
+#define FP_CLASS_INFINITE      2
+#define FP_CLASS_DENORMALIZED  4
+#define FP_CLASS_NEGATIVE_ZERO 8
+
+static inline StgWord64
+doubleBits(HsDouble d)
+{
+    StgWord64 w;
+    memcpy(&w, &d, sizeof(w));
+#if FLOAT_WORDS_BIGENDIAN && !WORDS_BIGENDIAN
+    w = (w << 32) | (w >> 32);
+#endif
+    return w;
+}
+
+static inline StgWord32
+floatBits(HsFloat f)
+{
+    StgWord32 w;
+    memcpy(&w, &f, sizeof(w));
+    return w;
+}
+
+HsInt
+countDoubleNaN(const HsDouble *xs, HsInt off, HsInt n)
+{
+    HsInt i, c = 0;
+    xs += off;
+    for (i = 0; i < n; i++) {
+        /* NaN iff the bits without sign exceed those of +Inf */
+        c += (doubleBits(xs[i]) & ~DBL_SIGN_MASK) > DBL_EXP_MASK;
+    }
+    return c;
+}
+
+HsInt
+countFloatNaN(const HsFloat *xs, HsInt off, HsInt n)
+{
+    HsInt i, c = 0;
+    xs += off;
+    for (i = 0; i < n; i++) {
+        c += (floatBits(xs[i]) & ~FLT_SIGN_MASK) > FLT_EXP_MASK;
+    }
+    return c;
+}
+
+/* Index (relative to 'off') of the first NaN or infinite element, or -1
+ * if all 'n' elements are finite.  Checks a block at a time so that the
+ * common all-finite case runs without an early exit in the inner loop. */
+HsInt
+findDoubleNonFinite(const HsDouble *xs, HsInt off, HsInt n)
+{
+    HsInt i, j;
+    xs += off;
+    for (i = 0; i < n; i += 64) {
+        HsInt m = n - i < 64 ? n - i : 64;
+        StgWord64 any = 0;
+        for (j = 0; j < m; j++) {
+            any |= (~doubleBits(xs[i+j]) & DBL_EXP_MASK) == 0;
+        }
+        if (any) {
+            for (j = 0; j < m; j++) {
+                if ((~doubleBits(xs[i+j]) & DBL_EXP_MASK) == 0) return i + j;
+            }
+        }
+    }
+    return -1;
+}
+
+HsInt
+findFloatNonFinite(const HsFloat *xs, HsInt off, HsInt n)
+{
+    HsInt i, j;
+    xs += off;
+    for (i = 0; i < n; i += 64) {
+        HsInt m = n - i < 64 ? n - i : 64;
+        StgWord32 any = 0;
+        for (j = 0; j < m; j++) {
+            any |= (~floatBits(xs[i+j]) & FLT_EXP_MASK) == 0;
+        }
+        if (any) {
+            for (j = 0; j < m; j++) {
+                if ((~floatBits(xs[i+j]) & FLT_EXP_MASK) == 0) return i + j;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Store a combination of the FP_CLASS_* bits for each element; 0 means
+ * the element is a normal number or a positive zero. */
+void
+classifyDoubles(const HsDouble *xs, HsInt off, HsWord8 *classes, HsInt n)
+{
+    HsInt i;
+    xs += off;
+    for (i = 0; i < n; i++) {
+        StgWord64 w = doubleBits(xs[i]);
+        StgWord64 e = w & DBL_EXP_MASK, m = w & DBL_MANT_MASK;
+        classes[i] = (e == DBL_EXP_MASK && m != 0) * FP_CLASS_NAN
+                   | (e == DBL_EXP_MASK && m == 0) * FP_CLASS_INFINITE
+                   | (e == 0 && m != 0)            * FP_CLASS_DENORMALIZED
+                   | (w == DBL_SIGN_MASK)          * FP_CLASS_NEGATIVE_ZERO;
+    }
+}
+
+void
+classifyFloats(const HsFloat *xs, HsInt off, HsWord8 *classes, HsInt n)
+{
+    HsInt i;
+    xs += off;
+    for (i = 0; i < n; i++) {
+        StgWord32 w = floatBits(xs[i]);
+        StgWord32 e = w & FLT_EXP_MASK, m = w & FLT_MANT_MASK;
+        classes[i] = (e == FLT_EXP_MASK && m != 0) * FP_CLASS_NAN
+                   | (e == FLT_EXP_MASK && m == 0) * FP_CLASS_INFINITE
+                   | (e == 0 && m != 0)            * FP_CLASS_DENORMALIZED
+                   | (w == FLT_SIGN_MASK)          * FP_CLASS_NEGATIVE_ZERO;
+    }
+}
+
 #else /* ! IEEE_FLOATING_POINT */
 
 /* Dummy definitions of predicates - they all return "normal" values */
@@ -455,6 +596,14 @@ HsInt isFloatNaN(HsFloat f) { return 0; }
 HsInt isFloatInfinite(HsFloat f) { return 0; }
 HsInt isFloatDenormalized(HsFloat f) { return 0; }
 HsInt isFloatNegativeZero(HsFloat f) { return 0; }
+HsInt countDoubleNaN(const HsDouble *xs, HsInt off, HsInt n) { return 0; }
+HsInt countFloatNaN(const HsFloat *xs, HsInt off, HsInt n) { return 0; }
+HsInt findDoubleNonFinite(const HsDouble *xs, HsInt off, HsInt n) { return -1; }
+HsInt findFloatNonFinite(const HsFloat *xs, HsInt off, HsInt n) { return -1; }
+void classifyDoubles(const HsDouble *xs, HsInt off, HsWord8 *classes, HsInt n)
+{ HsInt i; for (i = 0; i < n; i++) classes[i] = 0; }
+void classifyFloats(const HsFloat *xs, HsInt off, HsWord8 *classes, HsInt n)
+{ HsInt i; for (i = 0; i < n; i++) classes[i] = 0; }
 
 
 /* For exotic floating point formats, we can't do much */
@@ -0,0 +1,240 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The University of Glasgow, 2016
+ *
+ * The inner loops of the UTF-8 and UTF-16 codecs of GHC.IO.Encoding.
+ *
+ * Each function converts from in[ir..iw) to out[ow..os) for as long as it
+ * can, leaves the indices it stopped at in idx[0] (input) and idx[1]
+ * (output), and returns why it stopped: CODEC_INPUT_UNDERFLOW,
+ * CODEC_OUTPUT_UNDERFLOW or CODEC_INVALID_SEQUENCE, as in the
+ * CodingProgress type.  They behave exactly like the Haskell loops they
+ * replace, down to which of those they return when more than one applies.
+ *
+ * Characters are the 32-bit elements of a CharBuffer.  Runs of ASCII,
+ * which are most of the text in practice, are dealt with a machine word
+ * at a time.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "HsFFI.h"
+#include <string.h>
+
+#define CODEC_INPUT_UNDERFLOW  0
+#define CODEC_OUTPUT_UNDERFLOW 1
+#define CODEC_INVALID_SEQUENCE 2
+
+#define ASCII_HIGHS ((~(HsWord)0/0xFF)*0x80)
+
+#define between(x,lo,hi) ((x) >= (lo) && (x) <= (hi))
+
+static HsInt done (HsInt why, HsInt ir, HsInt ow, HsInt *idx)
+{
+    idx[0] = ir;
+    idx[1] = ow;
+    return why;
+}
+
+static int validate3 (HsWord8 x1, HsWord8 x2, HsWord8 x3)
+{
+    if (!between(x3, 0x80, 0xBF)) return 0;
+    if (x1 == 0xE0)                return between(x2, 0xA0, 0xBF);
+    if (between(x1, 0xE1, 0xEC))   return between(x2, 0x80, 0xBF);
+    if (x1 == 0xED)                return between(x2, 0x80, 0x9F);
+    if (between(x1, 0xEE, 0xEF))   return between(x2, 0x80, 0xBF);
+    return 0;
+}
+
+static int validate4 (HsWord8 x1, HsWord8 x2, HsWord8 x3, HsWord8 x4)
+{
+    if (!between(x3, 0x80, 0xBF) || !between(x4, 0x80, 0xBF)) return 0;
+    if (x1 == 0xF0)                return between(x2, 0x90, 0xBF);
+    if (between(x1, 0xF1, 0xF3))   return between(x2, 0x80, 0xBF);
+    if (x1 == 0xF4)                return between(x2, 0x80, 0x8F);
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+   UTF-8
+   -------------------------------------------------------------------------- */
+
+HsInt hs_utf8_decode (const HsWord8 *in, HsInt ir, HsInt iw,
+                      HsWord32 *out, HsInt ow, HsInt os, HsInt *idx)
+{
+    HsWord8 c0, c1, c2, c3;
+    HsWord w;
+    HsInt i;
+
+    for (;;) {
+        // a word of ASCII at a time
+        while (iw - ir >= (HsInt)sizeof(HsWord) &&
+               os - ow >= (HsInt)sizeof(HsWord)) {
+            memcpy(&w, in + ir, sizeof(HsWord));
+            if (w & ASCII_HIGHS) break;
+            for (i = 0; i < (HsInt)sizeof(HsWord); i++) {
+                out[ow + i] = in[ir + i];
+            }
+            ir += sizeof(HsWord);
+            ow += sizeof(HsWord);
+        }
+
+        if (ow >= os) return done(CODEC_OUTPUT_UNDERFLOW, ir, ow, idx);
+        if (ir >= iw) return done(CODEC_INPUT_UNDERFLOW, ir, ow, idx);
+
+        c0 = in[ir];
+        if (c0 <= 0x7F) {
+            out[ow++] = c0;
+            ir++;
+        } else if (between(c0, 0xC2, 0xDF)) {
+            if (iw - ir < 2) return done(CODEC_INPUT_UNDERFLOW, ir, ow, idx);
+            c1 = in[ir+1];
+            if (!between(c1, 0x80, 0xBF)) break;
+            out[ow++] = ((c0 - 0xC0) << 6) + (c1 - 0x80);
+            ir += 2;
+        } else if (between(c0, 0xE0, 0xEF)) {
+            if (iw - ir < 3) {
+                // check for an error even when we don't have the full
+                // sequence yet (#3341)
+                if (iw - ir == 2 && !validate3(c0, in[ir+1], 0x80)) break;
+                return done(CODEC_INPUT_UNDERFLOW, ir, ow, idx);
+            }
+            c1 = in[ir+1];
+            c2 = in[ir+2];
+            if (!validate3(c0, c1, c2)) break;
+            out[ow++] = ((c0 - 0xE0) << 12) + ((c1 - 0x80) << 6) + (c2 - 0x80);
+            ir += 3;
+        } else if (c0 >= 0xF0) {
+            if (iw - ir < 4) {
+                if (iw - ir == 2 && !validate4(c0, in[ir+1], 0x80, 0x80)) break;
+                if (iw - ir == 3 && !validate4(c0, in[ir+1], in[ir+2], 0x80)) break;
+                return done(CODEC_INPUT_UNDERFLOW, ir, ow, idx);
+            }
+            c1 = in[ir+1];
+            c2 = in[ir+2];
+            c3 = in[ir+3];
+            if (!validate4(c0, c1, c2, c3)) break;
+            out[ow++] = ((c0 - 0xF0) << 18) + ((c1 - 0x80) << 12)
+                      + ((c2 - 0x80) << 6) + (c3 - 0x80);
+            ir += 4;
+        } else {
+            // a continuation byte, or an overlong 0xC0/0xC1
+            break;
+        }
+    }
+    return done(CODEC_INVALID_SEQUENCE, ir, ow, idx);
+}
+
+HsInt hs_utf8_encode (const HsWord32 *in, HsInt ir, HsInt iw,
+                      HsWord8 *out, HsInt ow, HsInt os, HsInt *idx)
+{
+    HsWord32 x;
+
+    for (;;) {
+        // four ASCII characters at a time
+        while (iw - ir >= 4 && os - ow >= 4 &&
+               (in[ir] | in[ir+1] | in[ir+2] | in[ir+3]) <= 0x7F) {
+            out[ow]   = in[ir];
+            out[ow+1] = in[ir+1];
+            out[ow+2] = in[ir+2];
+            out[ow+3] = in[ir+3];
+            ir += 4;
+            ow += 4;
+        }
+
+        if (ow >= os) return done(CODEC_OUTPUT_UNDERFLOW, ir, ow, idx);
+        if (ir >= iw) return done(CODEC_INPUT_UNDERFLOW, ir, ow, idx);
+
+        x = in[ir];
+        if (x <= 0x7F) {
+            out[ow++] = x;
+        } else if (x <= 0x7FF) {
+            if (os - ow < 2) return done(CODEC_OUTPUT_UNDERFLOW, ir, ow, idx);
+            out[ow++] = (x >> 6) + 0xC0;
+            out[ow++] = (x & 0x3F) + 0x80;
+        } else if (x <= 0xFFFF) {
+            if (between(x, 0xD800, 0xDFFF)) {
+                return done(CODEC_INVALID_SEQUENCE, ir, ow, idx);
+            }
+            if (os - ow < 3) return done(CODEC_OUTPUT_UNDERFLOW, ir, ow, idx);
+            out[ow++] = (x >> 12) + 0xE0;
+            out[ow++] = ((x >> 6) & 0x3F) + 0x80;
+            out[ow++] = (x & 0x3F) + 0x80;
+        } else {
+            if (os - ow < 4) return done(CODEC_OUTPUT_UNDERFLOW, ir, ow, idx);
+            out[ow++] = (x >> 18) + 0xF0;
+            out[ow++] = ((x >> 12) & 0x3F) + 0x80;
+            out[ow++] = ((x >> 6) & 0x3F) + 0x80;
+            out[ow++] = (x & 0x3F) + 0x80;
+        }
+        ir++;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   UTF-16, big-endian if be is non-zero and little-endian otherwise
+   -------------------------------------------------------------------------- */
+
+#define unit16(p,be) ((be) ? ((p)[0] << 8) + (p)[1] : ((p)[1] << 8) + (p)[0])
+
+HsInt hs_utf16_decode (HsInt be, const HsWord8 *in, HsInt ir, HsInt iw,
+                       HsWord32 *out, HsInt ow, HsInt os, HsInt *idx)
+{
+    HsWord32 x1, x2;
+
+    for (;;) {
+        if (ow >= os)     return done(CODEC_OUTPUT_UNDERFLOW, ir, ow, idx);
+        if (iw - ir < 2)  return done(CODEC_INPUT_UNDERFLOW, ir, ow, idx);
+
+        x1 = unit16(in + ir, be);
+        if (!between(x1, 0xD800, 0xDFFF)) {
+            out[ow++] = x1;
+            ir += 2;
+        } else {
+            if (iw - ir < 4) return done(CODEC_INPUT_UNDERFLOW, ir, ow, idx);
+            x2 = unit16(in + ir + 2, be);
+            if (!between(x1, 0xD800, 0xDBFF) || !between(x2, 0xDC00, 0xDFFF)) {
+                return done(CODEC_INVALID_SEQUENCE, ir, ow, idx);
+            }
+            out[ow++] = ((x1 - 0xD800) << 10) + (x2 - 0xDC00) + 0x10000;
+            ir += 4;
+        }
+    }
+}
+
+static void put16 (HsWord8 *p, HsWord32 x, HsInt be)
+{
+    if (be) {
+        p[0] = x >> 8;
+        p[1] = x;
+    } else {
+        p[0] = x;
+        p[1] = x >> 8;
+    }
+}
+
+HsInt hs_utf16_encode (HsInt be, const HsWord32 *in, HsInt ir, HsInt iw,
+                       HsWord8 *out, HsInt ow, HsInt os, HsInt *idx)
+{
+    HsWord32 x;
+
+    for (;;) {
+        if (ir >= iw)     return done(CODEC_INPUT_UNDERFLOW, ir, ow, idx);
+        if (os - ow < 2)  return done(CODEC_OUTPUT_UNDERFLOW, ir, ow, idx);
+
+        x = in[ir];
+        if (x < 0x10000) {
+            if (between(x, 0xD800, 0xDFFF)) {
+                return done(CODEC_INVALID_SEQUENCE, ir, ow, idx);
+            }
+            put16(out + ow, x, be);
+            ow += 2;
+        } else {
+            if (os - ow < 4) return done(CODEC_OUTPUT_UNDERFLOW, ir, ow, idx);
+            x -= 0x10000;
+            put16(out + ow,     0xD800 + (x >> 10),   be);
+            put16(out + ow + 2, 0xDC00 + (x & 0x3FF), be);
+            ow += 4;
+        }
+        ir++;
+    }
+}
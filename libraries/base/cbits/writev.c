@@ -0,0 +1,62 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The University of Glasgow, 2016
+ *
+ * Gather writes and file-to-descriptor copies for GHC.IO.FD.
+ *
+ * hs_writev() writes a list of buffers with one writev() call, and
+ * hs_sendfile() copies part of a file to a descriptor inside the kernel.
+ * They return what the system call does, so that GHC.IO.FD can retry
+ * and block exactly as it does for write(); where the system call is
+ * missing they fail with ENOSYS, and GHC.IO.FD falls back to copying.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "HsBase.h"
+
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+#if HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+/* At most this many buffers per call: POSIX only promises IOV_MAX >= 16,
+   and the caller loops anyway, because writev() may write less. */
+#define HS_IOV_MAX 64
+
+HsInt
+hs_writev (int fd, HsPtr *bufs, HsInt *lens, HsInt n)
+{
+#if defined(HAVE_WRITEV) && HAVE_SYS_UIO_H
+    struct iovec iov[HS_IOV_MAX];
+    HsInt i;
+
+    if (n > HS_IOV_MAX) n = HS_IOV_MAX;
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len  = (size_t)lens[i];
+    }
+    return writev(fd, iov, (int)n);
+#else
+    (void)fd; (void)bufs; (void)lens; (void)n;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+HsInt
+hs_sendfile (int out_fd, int in_fd, HsInt64 offset, HsInt count)
+{
+#if defined(HAVE_SENDFILE) && HAVE_SYS_SENDFILE_H
+    off_t off = (off_t)offset;
+
+    // Linux: doesn't move in_fd's file position.  Other systems have a
+    // sendfile() too, but with a different signature.
+    return sendfile(out_fd, in_fd, &off, (size_t)count);
+#else
+    (void)out_fd; (void)in_fd; (void)offset; (void)count;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
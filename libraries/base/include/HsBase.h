@@ -154,6 +154,12 @@ extern HsWord64 getMonotonicUSec(void);
 
 /* in inputReady.c */
 extern int fdReady(int fd, int write, int msecs, int isSock);
+extern int fdsReady(int nfds, const int *fds, const int *write, int *ready,
+                    int msecs);
+
+/* in writev.c */
+extern HsInt hs_writev(int fd, HsPtr *bufs, HsInt *lens, HsInt n);
+extern HsInt hs_sendfile(int out_fd, int in_fd, HsInt64 offset, HsInt count);
 
 /* -----------------------------------------------------------------------------
    INLINE functions.
@@ -473,6 +479,11 @@ INLINE size_t __hscore_sizeof_siginfo_t (void)
 {
     return sizeof(siginfo_t);
 }
+
+INLINE int __hscore_siginfo_signo (siginfo_t *info)
+{
+    return info->si_signo;
+}
 #endif
 
 INLINE int
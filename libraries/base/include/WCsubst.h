@@ -21,5 +21,15 @@ HsInt u_towtitle(HsInt wc);
 
 HsInt u_gencat(HsInt wc);
 
+HsInt u_ascii_prefix(const HsWord8 *s, HsInt n);
+
+void  u_gencat_utf32(const HsWord32 *src, HsInt n, HsWord8 *cats);
+HsInt u_gencat_utf8(const HsWord8 *src, HsInt n, HsWord8 *cats);
+
+void  u_towupper_utf32(const HsWord32 *src, HsInt n, HsWord32 *dst);
+void  u_towlower_utf32(const HsWord32 *src, HsInt n, HsWord32 *dst);
+HsInt u_towupper_utf8(const HsWord8 *src, HsInt n, HsWord8 *dst, HsInt dstlen);
+HsInt u_towlower_utf8(const HsWord8 *src, HsInt n, HsWord8 *dst, HsInt dstlen);
+
 #endif
 
@@ -18,6 +18,12 @@ void __hsbase_MD5Update(struct MD5Context *context, byte const *buf, int len);
 void __hsbase_MD5Final(byte digest[16], struct MD5Context *context);
 void __hsbase_MD5Transform(word32 buf[4], word32 const in[16]);
 
+/* The number of messages __hsbase_MD5Many() hashes together */
+#define MD5_LANES 4
+
+void __hsbase_MD5Many(int n, byte const *const *bufs, int const *lens,
+		      byte *digests);
+
 #endif /* _MD5_H */
 
 
@@ -0,0 +1,18 @@
+/* MurmurHash3 (x64, 128-bit), a fast non-cryptographic hash */
+#ifndef _MURMUR3_H
+#define _MURMUR3_H
+
+#include "HsFFI.h"
+
+struct Murmur3Context {
+	HsWord64 h1, h2;
+	HsWord64 bytes;		/* processed so far */
+	HsWord8  tail[16];	/* the last (bytes % 16) of them */
+};
+
+void __hsbase_Murmur3Init(struct Murmur3Context *context);
+void __hsbase_Murmur3Update(struct Murmur3Context *context,
+			    HsWord8 const *buf, int len);
+void __hsbase_Murmur3Final(HsWord8 digest[16], struct Murmur3Context *context);
+
+#endif /* _MURMUR3_H */
@@ -0,0 +1,34 @@
+-- hPutBufs and hSendFile, in each buffering mode
+
+import Control.Monad
+import Foreign
+import GHC.IO.Handle (hPutBufs, hSendFile)
+import System.IO
+
+chunks :: [String]
+chunks = [ show i ++ replicate (i * 37 `mod` 5000) 'x' ++ "\n" | i <- [1..200] ]
+
+main :: IO ()
+main = forM_ [NoBuffering, LineBuffering, BlockBuffering Nothing] $ \mode -> do
+  bufs <- forM chunks $ \s -> do
+            p <- newArray (map (fromIntegral . fromEnum) s) :: IO (Ptr Word8)
+            return (p, length s)
+  h <- openBinaryFile "hPutBufs001.out" WriteMode
+  hSetBuffering h mode
+  hPutStr h "start\n"
+  hPutBufs h (take 3 bufs)       -- small: goes through the buffer
+  hPutBufs h bufs                -- large: writev
+  hClose h
+  mapM_ (free . fst) bufs
+  s <- readFile "hPutBufs001.out"
+  print (s == "start\n" ++ concat (take 3 chunks) ++ concat chunks)
+
+  file <- openBinaryFile "hPutBufs001.out" ReadMode
+  h' <- openBinaryFile "hPutBufs001.copy" WriteMode
+  hSetBuffering h' mode
+  hPutStr h' "copy\n"
+  n <- hSendFile h' file 6 (length s)   -- runs off the end
+  hClose h'
+  hClose file
+  s' <- readFile "hPutBufs001.copy"
+  print (n == length s - 6, s' == "copy\n" ++ drop 6 s)
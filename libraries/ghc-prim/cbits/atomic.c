@@ -259,6 +259,22 @@ hs_cmpxchg64(volatile StgWord64 *x, StgWord64 old, StgWord64 new)
 }
 #endif
 
+// CasDoubleWord: x[0] and x[1] become new0 and new1 if they were old0
+// and old1.  Returns 1 if they did, and what they were in cur[0] and
+// cur[1].  x must be 16-byte aligned.
+
+#if WORD_SIZE_IN_BITS == 64
+extern StgWord hs_cmpxchg128(volatile StgWord64 *x,
+                             StgWord64 old0, StgWord64 old1,
+                             StgWord64 new0, StgWord64 new1, StgWord64 *cur);
+StgWord
+hs_cmpxchg128(volatile StgWord64 *x, StgWord64 old0, StgWord64 old1,
+              StgWord64 new0, StgWord64 new1, StgWord64 *cur)
+{
+  return cas2w((StgVolatilePtr)x, old0, old1, new0, new1, (StgWord *)cur);
+}
+#endif
+
 // AtomicReadByteArrayOp_Int
 
 extern StgWord hs_atomicread8(volatile StgWord8 *x);
@@ -25,3 +25,37 @@ hs_bswap64(StgWord64 x)
          | ((x >> 8)  & 0xff000000) | ((x & 0xff000000) << 8)
          );
 }
+
+// Byte-swap each of the n elements of src into dst, which may be src.
+// The C compiler turns the loops into bswap instructions, or vector
+// shuffles where it can.
+
+extern void hs_bswap16_array(StgWord16 *dst, const StgWord16 *src, StgWord n);
+void
+hs_bswap16_array(StgWord16 *dst, const StgWord16 *src, StgWord n)
+{
+  StgWord i;
+  for (i = 0; i < n; i++) {
+      dst[i] = hs_bswap16(src[i]);
+  }
+}
+
+extern void hs_bswap32_array(StgWord32 *dst, const StgWord32 *src, StgWord n);
+void
+hs_bswap32_array(StgWord32 *dst, const StgWord32 *src, StgWord n)
+{
+  StgWord i;
+  for (i = 0; i < n; i++) {
+      dst[i] = hs_bswap32(src[i]);
+  }
+}
+
+extern void hs_bswap64_array(StgWord64 *dst, const StgWord64 *src, StgWord n);
+void
+hs_bswap64_array(StgWord64 *dst, const StgWord64 *src, StgWord n)
+{
+  StgWord i;
+  for (i = 0; i < n; i++) {
+      dst[i] = hs_bswap64(src[i]);
+  }
+}
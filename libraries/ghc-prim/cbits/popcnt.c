@@ -1,5 +1,60 @@
 #include "Rts.h"
 #include "MachDeps.h"
+#include <string.h>
+
+// Without -msse4.2 the code generator calls these instead of using the
+// popcnt instruction, and so do we, through a table.  Distributed
+// binaries have to target the baseline x86-64, which doesn't have the
+// instruction, but most machines they run on do: so on x86 we check
+// once whether the CPU has it, and use it if so.
+
+#if (defined(x86_64_HOST_ARCH) || defined(i386_HOST_ARCH)) && \
+    !defined(__POPCNT__) && !defined(__clang__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define POPCNT_DISPATCH
+#include <cpuid.h>
+#endif
+
+#if defined(POPCNT_DISPATCH)
+
+// -1 until we have looked.  Threads racing to look all find the same.
+static int have_popcnt = -1;
+
+static int
+cpuHasPopcnt (void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      return 0;
+  }
+  return (ecx & bit_POPCNT) != 0;
+}
+
+#define usePopcnt() \
+    (have_popcnt >= 0 ? have_popcnt : (have_popcnt = cpuHasPopcnt()))
+
+__attribute__((target("popcnt")))
+static StgWord
+popcnt32_hw (StgWord32 x)
+{
+  return __builtin_popcount(x);
+}
+
+__attribute__((target("popcnt")))
+static StgWord
+popcnt64_hw (StgWord64 x)
+{
+  return __builtin_popcountll(x);
+}
+
+#define POPCNT_HW(width,x) if (usePopcnt()) return popcnt##width##_hw(x)
+
+#else
+
+#define POPCNT_HW(width,x) /* nothing */
+
+#endif
 
 static const unsigned char popcount_tab[] =
 {
@@ -24,6 +79,7 @@ extern StgWord hs_popcnt16(StgWord x);
 StgWord
 hs_popcnt16(StgWord x)
 {
+  POPCNT_HW(32, (StgWord16)x);
   return popcount_tab[(unsigned char)x] +
       popcount_tab[(unsigned char)(x >> 8)];
 }
@@ -32,6 +88,7 @@ extern StgWord hs_popcnt32(StgWord x);
 StgWord
 hs_popcnt32(StgWord x)
 {
+  POPCNT_HW(32, (StgWord32)x);
   return popcount_tab[(unsigned char)x] +
       popcount_tab[(unsigned char)(x >> 8)] +
       popcount_tab[(unsigned char)(x >> 16)] +
@@ -42,6 +99,7 @@ extern StgWord hs_popcnt64(StgWord64 x);
 StgWord
 hs_popcnt64(StgWord64 x)
 {
+  POPCNT_HW(64, x);
   return popcount_tab[(unsigned char)x] +
       popcount_tab[(unsigned char)(x >> 8)] +
       popcount_tab[(unsigned char)(x >> 16)] +
@@ -58,6 +116,7 @@ extern StgWord hs_popcnt(StgWord x);
 StgWord
 hs_popcnt(StgWord x)
 {
+  POPCNT_HW(32, x);
   return popcount_tab[(unsigned char)x] +
       popcount_tab[(unsigned char)(x >> 8)] +
       popcount_tab[(unsigned char)(x >> 16)] +
@@ -70,6 +129,7 @@ extern StgWord hs_popcnt(StgWord x);
 StgWord
 hs_popcnt(StgWord x)
 {
+  POPCNT_HW(64, x);
   return popcount_tab[(unsigned char)x] +
       popcount_tab[(unsigned char)(x >> 8)] +
       popcount_tab[(unsigned char)(x >> 16)] +
@@ -85,3 +145,48 @@ hs_popcnt(StgWord x)
 #error Unknown machine word size
 
 #endif
+
+// The number of bits set in the n bytes at p, for bitmaps: a word at a
+// time, and with the popcnt instruction if there is one.
+
+#if defined(POPCNT_DISPATCH)
+__attribute__((target("popcnt")))
+static StgWord
+popcnt_bytes_hw (const StgWord8 *p, StgWord n)
+{
+  StgWord64 w;
+  StgWord r = 0;
+
+  for (; n >= 8; p += 8, n -= 8) {
+      memcpy(&w, p, 8);
+      r += __builtin_popcountll(w);
+  }
+  for (; n > 0; p++, n--) {
+      r += __builtin_popcount(*p);
+  }
+  return r;
+}
+#endif
+
+extern StgWord hs_popcnt_bytes(const StgWord8 *p, StgWord n);
+StgWord
+hs_popcnt_bytes(const StgWord8 *p, StgWord n)
+{
+  StgWord64 w;
+  StgWord r = 0;
+
+#if defined(POPCNT_DISPATCH)
+  if (usePopcnt()) return popcnt_bytes_hw(p, n);
+#endif
+  for (; n >= 8; p += 8, n -= 8) {
+      memcpy(&w, p, 8);
+      w = w - ((w >> 1) & 0x5555555555555555ULL);
+      w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+      w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+      r += (w * 0x0101010101010101ULL) >> 56;
+  }
+  for (; n > 0; p++, n--) {
+      r += popcount_tab[*p];
+  }
+  return r;
+}
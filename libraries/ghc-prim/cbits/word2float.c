@@ -13,3 +13,30 @@ hs_word2float64(StgWord x)
 {
   return x;
 }
+
+/* Convert 'n' words starting at element 'off' of 'src' into 'dst', for
+   converting whole ByteArray#s in one unsafe foreign call.  Plain loops
+   so that the C compiler can vectorise them. */
+extern void hs_word2float32_array(StgFloat *dst, const StgWord *src,
+                                  StgWord off, StgWord n);
+void
+hs_word2float32_array(StgFloat *dst, const StgWord *src, StgWord off, StgWord n)
+{
+  StgWord i;
+  src += off;
+  for (i = 0; i < n; i++) {
+    dst[i] = src[i];
+  }
+}
+
+extern void hs_word2float64_array(StgDouble *dst, const StgWord *src,
+                                  StgWord off, StgWord n);
+void
+hs_word2float64_array(StgDouble *dst, const StgWord *src, StgWord off, StgWord n)
+{
+  StgWord i;
+  src += off;
+  for (i = 0; i < n; i++) {
+    dst[i] = src[i];
+  }
+}
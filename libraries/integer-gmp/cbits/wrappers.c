@@ -75,6 +75,83 @@ mp_size_minabs(const mp_size_t x, const mp_size_t y)
   return mp_size_min(mp_size_abs(x), mp_size_abs(y));
 }
 
+// Number of significant bits in limb x
+static inline unsigned
+limb_bitlen(const mp_limb_t x)
+{
+#if defined(__GNUC__)
+# if GMP_LIMB_BITS == 64
+  return x ? 64 - __builtin_clzll(x) : 0;
+# else
+  return x ? 32 - __builtin_clz(x) : 0;
+# endif
+#else
+  unsigned n = 0;
+  for (mp_limb_t y = x; y; y >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+static inline mp_limb_t
+limb_bswap(mp_limb_t x)
+{
+#if defined(__GNUC__) && GMP_LIMB_BITS == 64
+  return __builtin_bswap64(x);
+#elif defined(__GNUC__) && GMP_LIMB_BITS == 32
+  return __builtin_bswap32(x);
+#else
+  mp_limb_t r = 0;
+  for (unsigned i = 0; i < SIZEOF_HSWORD; i++, x >>= 8)
+    r = (r << 8) | (x & 0xff);
+  return r;
+#endif
+}
+
+// Unaligned big- and little-endian limb loads and stores; these are a
+// single (byte-swapping) move on the platforms we care about
+static inline mp_limb_t
+load_limb_be(const uint8_t *p)
+{
+  mp_limb_t x;
+  memcpy(&x, p, sizeof(x));
+#if defined(WORDS_BIGENDIAN)
+  return x;
+#else
+  return limb_bswap(x);
+#endif
+}
+
+static inline mp_limb_t
+load_limb_le(const uint8_t *p)
+{
+  mp_limb_t x;
+  memcpy(&x, p, sizeof(x));
+#if defined(WORDS_BIGENDIAN)
+  return limb_bswap(x);
+#else
+  return x;
+#endif
+}
+
+static inline void
+store_limb_be(uint8_t *p, mp_limb_t x)
+{
+#if !defined(WORDS_BIGENDIAN)
+  x = limb_bswap(x);
+#endif
+  memcpy(p, &x, sizeof(x));
+}
+
+static inline void
+store_limb_le(uint8_t *p, mp_limb_t x)
+{
+#if defined(WORDS_BIGENDIAN)
+  x = limb_bswap(x);
+#endif
+  memcpy(p, &x, sizeof(x));
+}
+
 /* Perform arithmetic right shift on MPNs (multi-precision naturals)
  *
  * pre-conditions:
@@ -218,10 +295,32 @@ integer_gmp_mpn_gcd_1(const mp_limb_t x[], const mp_size_t xn,
 }
 
 
+/* Shift {sp,sn} right by count bits into {rp,rn}, returning the
+ * normalized rn; pre-condition: {sp,sn} has more than count bits
+ */
+static mp_size_t
+mpn_rshift_norm(mp_limb_t rp[], const mp_limb_t sp[], const mp_size_t sn,
+                const mp_bitcnt_t count)
+{
+  mp_size_t rn = sn - count / GMP_NUMB_BITS;
+
+  integer_gmp_mpn_rshift(rp, sp, sn, count);
+  while (rn > 1 && !rp[rn-1])
+    rn--;
+
+  return rn;
+}
+
+/* GCD of {x0,xn} and {y0,yn} into {r,rn}
+ *
+ * r must have space for yn limbs, and tp for xn+yn+2 limbs (only used
+ * if yn > 1)
+ */
 mp_size_t
 integer_gmp_mpn_gcd(mp_limb_t r[],
                     const mp_limb_t x0[], const mp_size_t xn,
-                    const mp_limb_t y0[], const mp_size_t yn)
+                    const mp_limb_t y0[], const mp_size_t yn,
+                    mp_limb_t tp[])
 {
   assert (xn >= yn);
   assert (yn > 0);
@@ -238,82 +337,168 @@ integer_gmp_mpn_gcd(mp_limb_t r[],
       return xn;
     }
   } else {
-    // mpn_gcd() seems to require non-trivial normalization of its
-    // input arguments (which does not seem to be documented anywhere,
-    // see source of mpz_gcd() for more details), so we resort to just
-    // use mpz_gcd() which does the tiresome normalization for us at
-    // the cost of a few additional temporary buffer allocations in
-    // C-land.
-
-    const mpz_t op1 = CONST_MPZ_INIT(x0, xn);
-    const mpz_t op2 = CONST_MPZ_INIT(y0, yn);
-
-    mpz_t rop;
-    mpz_init (rop);
-
-    mpz_gcd(rop, op1, op2);
+    // mpn_gcd() destroys its inputs, and requires at least one of them
+    // to be odd (and, in older GMP versions, {xp,xn} >= {yp,yn}). So,
+    // like mpz_gcd(), we work on copies with all powers of 2 shifted
+    // out, and shift the common ones back into the result.
+    mp_limb_t *xp = tp;
+    mp_limb_t *yp = &tp[xn+1];
+
+    const mp_bitcnt_t xz = mpn_scan1(x0, 0);
+    const mp_bitcnt_t yz = mpn_scan1(y0, 0);
+    const mp_bitcnt_t gz = xz < yz ? xz : yz;
+
+    mp_size_t xn1 = mpn_rshift_norm(xp, x0, xn, xz);
+    mp_size_t yn1 = mpn_rshift_norm(yp, y0, yn, yz);
+
+    if (xn1 < yn1 || (xn1 == yn1 && mpn_cmp(xp, yp, xn1) < 0)) {
+      mp_limb_t *const t = xp; xp = yp; yp = t;
+      const mp_size_t tn = xn1; xn1 = yn1; yn1 = tn;
+    }
 
-    const mp_size_t rn = rop[0]._mp_size;
-    assert(rn > 0);
-    assert(rn <= xn);
+    mp_size_t rn;
+    if (yn1 == 1) {
+      r[0] = mpn_gcd_1(xp, xn1, yp[0]);
+      rn = 1;
+    } else {
+      rn = mpn_gcd(r, xp, xn1, yp, yn1);
+    }
 
-    /* the allocation/memcpy of the result can be neglectable since
-       mpz_gcd() already has to allocate other temporary buffers
-       anyway */
-    memcpy(r, rop[0]._mp_d, rn*sizeof(mp_limb_t));
+    // shift the common powers of 2 back in, in place
+    const mp_size_t    limb_shift = gz / GMP_NUMB_BITS;
+    const unsigned int bit_shift  = gz % GMP_NUMB_BITS;
 
-    mpz_clear(rop);
+    if (bit_shift) {
+      const mp_limb_t msl = mpn_lshift(&r[limb_shift], r, rn, bit_shift);
+      if (msl)
+        r[limb_shift + rn++] = msl;
+    } else if (limb_shift) {
+      memmove(&r[limb_shift], r, rn*sizeof(mp_limb_t));
+    }
+    memset(r, 0, limb_shift*sizeof(mp_limb_t));
+    rn += limb_shift;
 
+    assert(rn <= yn);
     return rn;
   }
 }
 
-/* wraps mpz_gcdext()
+/* mpz_gcdext() on mpn's
  *
  * Set g to the greatest common divisor of x and y, and in addition
- * set s and t to coefficients satisfying x*s + y*t = g.
+ * set s and t to coefficients satisfying x*s + y*t = g. The
+ * coefficient s is the same one mpz_gcdext() returns.
  *
  * The {gp,gn} array is zero-padded (as otherwise 'gn' can't be
  * reconstructed).
  *
  * g must have space for exactly gn=min(xn,yn) limbs.
- * s must have space for at least xn limbs.
+ * s must have space for at least max(xn,yn) limbs.
+ * tp must have space for 3*(xn+yn)+6 limbs (with xn,yn taken absolute)
  *
  * return value: signed 'sn' of {sp,sn}
  */
 mp_size_t
 integer_gmp_gcdext(mp_limb_t s0[], mp_limb_t g0[],
                    const mp_limb_t x0[], const mp_size_t xn,
-                   const mp_limb_t y0[], const mp_size_t yn)
+                   const mp_limb_t y0[], const mp_size_t yn,
+                   mp_limb_t tp[])
 {
   const mp_size_t gn0 = mp_size_minabs(xn, yn);
-  const mpz_t x = CONST_MPZ_INIT(x0, mp_limb_zero_p(x0,xn) ? 0 : xn);
-  const mpz_t y = CONST_MPZ_INIT(y0, mp_limb_zero_p(y0,yn) ? 0 : yn);
 
-  mpz_t g, s;
-  mpz_init (g);
-  mpz_init (s);
+  // mpn_gcdext() needs the first operand to have at least as many
+  // limbs as the second one, and only computes the cofactor of the
+  // former; so as mpz_gcdext() does, if x is the shorter one, we get
+  // s from y's cofactor s' as (g - s'*y) / x.
+  const mp_size_t xn1 = mp_limb_zero_p(x0,xn) ? 0 : mp_size_abs(xn);
+  const mp_size_t yn1 = mp_limb_zero_p(y0,yn) ? 0 : mp_size_abs(yn);
+  const bool swapped = xn1 < yn1;
+  const mp_limb_t *const ap = swapped ? y0 : x0;
+  const mp_limb_t *const bp = swapped ? x0 : y0;
+  const mp_size_t asn = swapped ? yn : xn;
+  const mp_size_t bsn = swapped ? xn : yn;
+  const mp_size_t an = swapped ? yn1 : xn1;
+  const mp_size_t bn = swapped ? xn1 : yn1;
 
-  mpz_gcdext (g, s, NULL, x, y);
-
-  const mp_size_t gn = g[0]._mp_size;
-  assert(0 <= gn && gn <= gn0);
   memset(g0, 0, gn0*sizeof(mp_limb_t));
-  memcpy(g0, g[0]._mp_d, gn*sizeof(mp_limb_t));
-  mpz_clear (g);
 
-  const mp_size_t ssn = s[0]._mp_size;
-  const mp_size_t sn  = mp_size_abs(ssn);
-  assert(sn <= xn);
-  memcpy(s0, s[0]._mp_d, sn*sizeof(mp_limb_t));
-  mpz_clear (s);
+  if (!bn) {
+    /* g = |a|, s' = sgn(a) */
+    assert(an <= gn0);
+    memcpy(g0, ap, an*sizeof(mp_limb_t));
+
+    s0[0] = (!swapped && an) ? 1 : 0;
+    return s0[0] && asn < 0 ? -1 : 1;
+  }
+
+  mp_limb_t *const tap = tp;            // an+1 limbs
+  mp_limb_t *const tbp = &tap[an+1];    // bn+1 limbs
+  mp_limb_t *const tsp = &tbp[bn+1];    // bn+1 limbs
+  memcpy(tap, ap, an*sizeof(mp_limb_t));
+  memcpy(tbp, bp, bn*sizeof(mp_limb_t));
+
+  mp_size_t ssn;
+  const mp_size_t gn = mpn_gcdext(g0, tsp, &ssn, tap, an, tbp, bn);
+  assert(0 < gn && gn <= gn0);
+
+  mp_size_t sn = mp_size_abs(ssn);
+
+  if (!swapped) {
+    assert(sn <= an);
+    memcpy(s0, tsp, sn*sizeof(mp_limb_t));
+    if (!sn) {
+      s0[0] = 0;
+      return 1;
+    }
+    return asn >= 0 ? ssn : -ssn;
+  }
+
+  // |s'*a| - g or |s'*a| + g, divided by |b|, into s0; the
+  // destroyed copies of a and b make room for the product
+  mp_limb_t *const np = tap;            // an+bn+2 limbs
+  mp_limb_t *const rp = &tsp[bn+1];     // bn limbs
+  mp_limb_t *const qp = &rp[bn];        // an+3 limbs
+  mp_size_t nn;
 
   if (!sn) {
+    memcpy(np, g0, gn*sizeof(mp_limb_t));
+    nn = gn;
+  } else {
+    if (an >= sn)
+      mpn_mul(np, ap, an, tsp, sn);
+    else
+      mpn_mul(np, tsp, sn, ap, an);
+    nn = an + sn;
+    if (ssn > 0) {
+      mpn_sub(np, np, nn, g0, gn);
+    } else if (mpn_add(np, np, nn, g0, gn)) {
+      np[nn++] = 1;
+    }
+  }
+
+  while (nn > 0 && !np[nn-1])
+    nn--;
+
+  if (!nn) {
     s0[0] = 0;
     return 1;
   }
 
-  return ssn;
+  assert(nn >= bn);
+  mpn_tdiv_qr(qp, rp, 0, np, nn, bp, bn);
+#if !defined(NDEBUG)
+  for (mp_size_t i = 0; i < bn; i++)
+    assert(!rp[i]); // the division is exact
+#endif
+
+  sn = nn - bn + 1;
+  while (sn > 1 && !qp[sn-1])
+    sn--;
+  assert(sn <= an);
+  memcpy(s0, qp, sn*sizeof(mp_limb_t));
+
+  // g - s'*|a| is negative iff s' is positive
+  return (ssn > 0) != (bsn < 0) ? -sn : sn;
 }
 
 /* Truncating (i.e. rounded towards zero) integer division-quotient of MPN */
@@ -371,6 +556,16 @@ integer_gmp_mpn_sizeinbase(const mp_limb_t s[], const mp_size_t sn,
 
   if (mp_limb_zero_p(s,sn)) return 1;
 
+  // for powers of 2 the digit count follows from the bit length (this
+  // is also what mpz_sizeinbase() does, but without the overhead)
+  if (!(base & (base-1))) {
+    const mp_size_t n = mp_size_abs(sn);
+    const unsigned lg = limb_bitlen(base-1);
+    const HsWord bits = (n-1)*GMP_LIMB_BITS + limb_bitlen(s[n-1]);
+
+    return (bits + lg - 1) / lg;
+  }
+
   const mpz_t zs = CONST_MPZ_INIT(s, sn);
 
   return mpz_sizeinbase(zs, base);
@@ -383,26 +578,44 @@ integer_gmp_mpn_sizeinbase1(const mp_limb_t s, const HsInt base)
   return s ? integer_gmp_mpn_sizeinbase(&s, 1, base) : 1;
 }
 
-/* Wrapper around GMP's 'mpz_export()' function */
+/* Export {s,sn} to memory location in base-256 representation
+ *
+ * Returns the number of bytes written, i.e. 0 for zero and
+ * 'integer_gmp_mpn_sizeinbase(s,sn,256)' otherwise
+ */
 HsWord
 integer_gmp_mpn_export(const mp_limb_t s[], const mp_size_t sn,
                        void *destptr, HsInt destofs, HsInt msbf)
 {
-  /* TODO: implement w/o GMP, c.f. 'integer_gmp_mpn_import()' */
   assert (msbf == 0 || msbf == 1);
 
   if (mp_limb_zero_p(s,sn)) return 0;
 
-  const mpz_t zs = CONST_MPZ_INIT(s, sn);
+  const mp_size_t n = mp_size_abs(sn);
+  const mp_limb_t msl = s[n-1];
+  const unsigned msl_bytes = (limb_bitlen(msl) + 7) / 8;
+
+  uint8_t *dst = ((uint8_t *)destptr) + destofs;
 
-  size_t written = 0;
+  if (msbf) {
+    for (unsigned i = msl_bytes; i > 0; --i)
+      *dst++ = msl >> ((i-1)*8);
 
-  // mpz_export (void *rop, size_t *countp, int order, size_t size, int endian,
-  //             size_t nails, const mpz_t op)
-  (void) mpz_export(((char *)destptr)+destofs, &written, !msbf ? -1 : 1,
-                    /* size */ 1, /* endian */ 0, /* nails */ 0, zs);
+    for (mp_size_t i = n-1; i > 0; --i) {
+      store_limb_be(dst, s[i-1]);
+      dst += SIZEOF_HSWORD;
+    }
+  } else { // lsbf
+    for (mp_size_t i = 0; i < n-1; ++i) {
+      store_limb_le(dst, s[i]);
+      dst += SIZEOF_HSWORD;
+    }
 
-  return written;
+    for (unsigned i = 0; i < msl_bytes; ++i)
+      *dst++ = msl >> (i*8);
+  }
+
+  return (n-1)*SIZEOF_HSWORD + msl_bytes;
 }
 
 /* Single-limb version of 'integer_gmp_mpn_export()' */
@@ -410,7 +623,6 @@ HsWord
 integer_gmp_mpn_export1(const mp_limb_t s,
                         void *destptr, const HsInt destofs, const HsInt msbf)
 {
-  /* TODO: implement w/o GMP */
   return integer_gmp_mpn_export(&s, 1, destptr, destofs, msbf);
 }
 
@@ -427,6 +639,9 @@ integer_gmp_mpn_import1(const uint8_t *srcptr, const HsWord srcofs,
 
   srcptr += srcofs;
 
+  if (srclen == SIZEOF_HSWORD)
+    return msbf ? load_limb_be(srcptr) : load_limb_le(srcptr);
+
   HsWord result = 0;
 
   if (msbf)
@@ -458,13 +673,13 @@ integer_gmp_mpn_import(mp_limb_t * restrict r, const uint8_t * restrict srcptr,
       srcptr += limb_cnt_rem;
     }
 
-    for (unsigned ri = 0; ri < limb_cnt; ++ri) {
-      r[limb_cnt-ri-1] = integer_gmp_mpn_import1(srcptr, 0, SIZEOF_HSWORD, 1);
+    for (mp_size_t ri = 0; ri < limb_cnt; ++ri) {
+      r[limb_cnt-ri-1] = load_limb_be(srcptr);
       srcptr += SIZEOF_HSWORD;
     }
   } else { // lsbf
-    for (unsigned ri = 0; ri < limb_cnt; ++ri) {
-      r[ri] = integer_gmp_mpn_import1(srcptr, 0, SIZEOF_HSWORD, 0);
+    for (mp_size_t ri = 0; ri < limb_cnt; ++ri) {
+      r[ri] = load_limb_le(srcptr);
       srcptr += SIZEOF_HSWORD;
     }
 
@@ -483,14 +698,20 @@ HsWord
 integer_gmp_scan_nzbyte(const uint8_t *srcptr,
                         const HsWord srcofs, const HsWord srclen)
 {
-  // TODO: consider implementing this function in Haskell-land
-  srcptr += srcofs;
+  const uint8_t *p = srcptr + srcofs;
+  const uint8_t *const end = p + srclen;
+
+  // runs of zeros are skipped a word at a time
+  while (p < end && ((uintptr_t)p % SIZEOF_HSWORD) && !*p)
+    p++;
 
-  for (unsigned i = 0; i < srclen; ++i)
-    if (srcptr[i])
-      return srcofs+i;
+  while (end - p >= SIZEOF_HSWORD && !load_limb_le(p))
+    p += SIZEOF_HSWORD;
 
-  return srcofs+srclen;
+  while (p < end && !*p)
+    p++;
+
+  return p - srcptr;
 }
 
 /* Reverse scan for non-zero byte
@@ -503,14 +724,47 @@ HsWord
 integer_gmp_rscan_nzbyte(const uint8_t *srcptr,
                          const HsWord srcofs, const HsWord srclen)
 {
-  // TODO: consider implementing this function in Haskell-land
-  srcptr += srcofs;
+  const uint8_t *const start = srcptr + srcofs;
+  const uint8_t *p = start + srclen;
+
+  while (p > start && ((uintptr_t)p % SIZEOF_HSWORD) && !p[-1])
+    p--;
+
+  while (p - start >= SIZEOF_HSWORD && !load_limb_le(p - SIZEOF_HSWORD))
+    p -= SIZEOF_HSWORD;
 
-  for (unsigned i = srclen; i > 0; --i)
-    if (srcptr[i-1])
-      return i;
+  while (p > start && !p[-1])
+    p--;
 
-  return 0;
+  return p - start;
+}
+
+/* Like 'integer_gmp_mpn_import()', but skip the most significant zero
+ * bytes first (i.e. the leading ones if msbf, or the trailing ones
+ * otherwise), so that the limbs written to r are normalized
+ *
+ * r must have space for ceiling(srclen / SIZEOF_HSWORD) limbs.
+ *
+ * return value: number of limbs written, or 0 if all bytes were zero
+ */
+HsWord
+integer_gmp_mpn_import_nz(mp_limb_t * restrict r,
+                          const uint8_t * restrict srcptr,
+                          HsWord srcofs, HsWord srclen, const HsInt msbf)
+{
+  if (msbf) {
+    const HsWord ofs = integer_gmp_scan_nzbyte(srcptr, srcofs, srclen);
+    srclen -= ofs - srcofs;
+    srcofs = ofs;
+  } else {
+    srclen = integer_gmp_rscan_nzbyte(srcptr, srcofs, srclen);
+  }
+
+  if (!srclen) return 0;
+
+  integer_gmp_mpn_import(r, srcptr, srcofs, srclen, msbf);
+
+  return (srclen + SIZEOF_HSWORD - 1) / SIZEOF_HSWORD;
 }
 
 /* wrapper around mpz_probab_prime_p */
@@ -679,20 +933,324 @@ integer_gmp_powm_word(const mp_limb_t b0, // base
   return integer_gmp_powm1(&b0, !!b0, &e0, !!e0, m0);
 }
 
+/* Montgomery contexts for repeated modular exponentiation
+ *
+ * 'integer_gmp_powm()' pays for setting up 'mpz_t' temporaries and for
+ * GMP's modulus-dependent precomputation on every call. When the same
+ * (odd) modulus is used over and over, that work can be done once by
+ * 'integer_gmp_powm_ctx_init()', and 'integer_gmp_powm_ctx()' then does
+ * the exponentiation on mpn's only, using caller-supplied buffers.
+ *
+ * A context for an mn-limb modulus M occupies
+ * 'integer_gmp_powm_ctx_size(mn)' limbs, laid out as
+ *
+ *   ctx[0]                 mn
+ *   ctx[1]                 -1/M mod B, or 0 if M is even
+ *   ctx[2      .. 2+mn)    M
+ *   ctx[2+mn   .. 2+2*mn)  B^(2*mn) mod M
+ *
+ * where B = 2^GMP_LIMB_BITS. Even moduli (and negative exponents) are
+ * passed on to 'integer_gmp_powm()', so that the result is always the
+ * same as the one of the latter.
+ */
 
-/* wrapper around mpz_invert()
+mp_size_t
+integer_gmp_powm_ctx_size(const mp_size_t mn)
+{
+  return 2 + 2*mn;
+}
+
+/* Sliding window size for an exponent of 'ebits' bits (the same
+ * thresholds as GMP's mpz_powm uses)
+ */
+static int
+powm_ctx_window_bits(const mp_bitcnt_t ebits)
+{
+  static const mp_bitcnt_t thresholds[] = { 7, 25, 81, 241, 673 };
+  int k = 1;
+
+  while (k <= 5 && ebits > thresholds[k-1])
+    k++;
+
+  return k;
+}
+
+/* Number of scratch limbs 'integer_gmp_powm_ctx()' needs for a bn-limb
+ * base, an en-limb exponent and an mn-limb modulus
+ */
+mp_size_t
+integer_gmp_powm_ctx_scratch_size(const mp_size_t bn, const mp_size_t en,
+                                  const mp_size_t mn)
+{
+  const mp_size_t abn = mp_size_abs(bn);
+  const mp_size_t qn = abn >= mn ? abn-mn+1 : 0;
+  const int k = powm_ctx_window_bits(mp_size_abs(en)*GMP_LIMB_BITS);
+
+  return ((mp_size_t)1 << (k-1))*mn + 4*mn + qn;
+}
+
+void
+integer_gmp_powm_ctx_init(mp_limb_t ctx[],
+                          const mp_limb_t mp[], const mp_size_t mn)
+{
+  assert(mn > 0 && mp[mn-1]);
+
+  ctx[0] = mn;
+  memcpy(&ctx[2], mp, mn*sizeof(mp_limb_t));
+
+  if (!(mp[0] & 1)) {
+    ctx[1] = 0;
+    return;
+  }
+
+  // Newton iteration for 1/M mod B; 'inv' is correct to 3 bits to start
+  // with and the number of correct bits doubles in each step
+  mp_limb_t inv = mp[0];
+  for (int bits = 3; bits < GMP_LIMB_BITS; bits *= 2)
+    inv *= 2 - mp[0]*inv;
+  assert(inv * mp[0] == 1);
+  ctx[1] = -inv;
+
+  const mpz_t m = CONST_MPZ_INIT(mp, mn);
+
+  mpz_t r;
+  mpz_init_set_ui (r, 1);
+  mpz_mul_2exp(r, r, 2*mn*GMP_LIMB_BITS);
+  mpz_tdiv_r(r, r, m);
+
+  const mp_size_t rn = r[0]._mp_size;
+  assert(0 <= rn && rn <= mn);
+
+  memset(&ctx[2+mn], 0, mn*sizeof(mp_limb_t));
+  memcpy(&ctx[2+mn], r[0]._mp_d, rn*sizeof(mp_limb_t));
+
+  mpz_clear (r);
+}
+
+/* Montgomery reduction: {rp,n} := {tp,2n} / B^n mod M, and
+ * Montgomery multiplication: {rp,n} := {ap,n} * {bp,n} / B^n mod M
+ *
+ * The result is only reduced to below B^n, not below M (which is enough
+ * to use it as an input again). {tp,2n} is scratch space and must not
+ * overlap the inputs; rp may be the same as ap or bp.
+ */
+static void
+mont_redc(mp_limb_t rp[], mp_limb_t tp[], const mp_limb_t mp[],
+          const mp_size_t n, const mp_limb_t minv)
+{
+  // keep the carry out of each step in the limb it cleared
+  for (mp_size_t i = 0; i < n; i++)
+    tp[i] = mpn_addmul_1(&tp[i], mp, n, tp[i]*minv);
+
+  if (mpn_add_n(rp, &tp[n], tp, n))
+    mpn_sub_n(rp, rp, mp, n);
+}
+
+static void
+mont_mul(mp_limb_t rp[], const mp_limb_t ap[], const mp_limb_t bp[],
+         mp_limb_t tp[], const mp_limb_t mp[], const mp_size_t n,
+         const mp_limb_t minv)
+{
+  mpn_mul_n(tp, ap, bp, n);
+  mont_redc(rp, tp, mp, n, minv);
+}
+
+static void
+mont_sqr(mp_limb_t rp[], const mp_limb_t ap[],
+         mp_limb_t tp[], const mp_limb_t mp[], const mp_size_t n,
+         const mp_limb_t minv)
+{
+#if __GNU_MP_VERSION < 5
+  mpn_mul_n(tp, ap, ap, n);
+#else
+  mpn_sqr(tp, ap, n);
+#endif
+  mont_redc(rp, tp, mp, n, minv);
+}
+
+static inline int
+mp_limb_bit(const mp_limb_t sp[], const mp_bitcnt_t i)
+{
+  return (sp[i / GMP_LIMB_BITS] >> (i % GMP_LIMB_BITS)) & 1;
+}
+
+#if defined(__SIZEOF_INT128__) && GMP_LIMB_BITS == 64
+/* single-limb version of the exponentiation loop below, for which the
+ * mpn calls would cost more than the arithmetic they do
+ */
+typedef unsigned __int128 mp_dlimb_t;
+
+static inline mp_limb_t
+mont_mul1(const mp_limb_t a, const mp_limb_t b,
+          const mp_limb_t m, const mp_limb_t minv)
+{
+  const mp_dlimb_t t = (mp_dlimb_t)a * b;
+  const mp_limb_t q = (mp_limb_t)t * minv;
+  const mp_dlimb_t u = (mp_dlimb_t)q * m;
+  // the low limbs of t and u add up to 0 mod B, this is the carry out
+  const mp_limb_t c = (mp_limb_t)t != 0;
+  const mp_limb_t th = t >> GMP_LIMB_BITS, uh = u >> GMP_LIMB_BITS;
+  const mp_limb_t r = th + uh + c;
+
+  // th + uh + c < 2m, but may have wrapped around B
+  return (r < th || r >= m) ? r - m : r;
+}
+
+static mp_limb_t
+powm_ctx1(const mp_limb_t b0, const mp_limb_t ep[], const mp_bitcnt_t ebits,
+          const mp_limb_t m, const mp_limb_t minv, const mp_limb_t r2)
+{
+  const mp_limb_t bm = mont_mul1(b0, r2, m, minv);
+  mp_limb_t acc = bm;
+
+  for (mp_bitcnt_t i = ebits-1; i > 0; i--) {
+    acc = mont_mul1(acc, acc, m, minv);
+    if (mp_limb_bit(ep, i-1))
+      acc = mont_mul1(acc, bm, m, minv);
+  }
+
+  return mont_mul1(acc, 1, m, minv);
+}
+#endif
+
+/* Store '(B^E) mod M' in {rp,rn}, with M given by an
+ * 'integer_gmp_powm_ctx_init()'ed context
+ *
+ * rp must have allocated mn limbs, and tp
+ * 'integer_gmp_powm_ctx_scratch_size(bn,en,mn)' limbs. Like
+ * 'integer_gmp_powm()', returns the actual number rn (0 < rn <= mn) of
+ * limbs written to the rp limb-array.
+ *
+ * bn and en are allowed to be negative to denote negative numbers
+ */
+mp_size_t
+integer_gmp_powm_ctx(mp_limb_t rp[], // result
+                     const mp_limb_t bp[], const mp_size_t bn, // base
+                     const mp_limb_t ep[], const mp_size_t en, // exponent
+                     const mp_limb_t ctx[], mp_limb_t tp[])
+{
+  const mp_size_t mn = ctx[0];
+  const mp_limb_t minv = ctx[1];
+  const mp_limb_t *const mp = &ctx[2];
+  const mp_limb_t *const r2 = &ctx[2+mn];
+
+  if (!minv || en < 0)
+    return integer_gmp_powm(rp, bp, bn, ep, en, mp, mn);
+
+  if (mn == 1 && mp[0] == 1) {
+    rp[0] = 0;
+    return 1;
+  }
+
+  if (mp_limb_zero_p(ep,en)) {
+    rp[0] = 1;
+    return 1;
+  }
+
+  mp_bitcnt_t ebits = en*GMP_LIMB_BITS;
+  while (!mp_limb_bit(ep, ebits-1))
+    ebits--;
+
+#if defined(__SIZEOF_INT128__) && GMP_LIMB_BITS == 64
+  if (mn == 1) {
+    const mp_size_t abn = mp_size_abs(bn);
+    mp_limb_t b0 = mpn_mod_1(bp, abn, mp[0]);
+    if (bn < 0 && b0)
+      b0 = mp[0] - b0;
+    rp[0] = powm_ctx1(b0, ep, ebits, mp[0], minv, r2[0]);
+    return 1;
+  }
+#endif
+
+  const int k = powm_ctx_window_bits(ebits);
+
+  // odd powers B^1, B^3, .., B^(2^k-1), in Montgomery form
+  mp_limb_t *const table = tp;
+  mp_limb_t *const acc = &table[((mp_size_t)1 << (k-1))*mn];
+  mp_limb_t *const bmod = &acc[mn];
+  mp_limb_t *const prod = &bmod[mn];
+  mp_limb_t *const qp = &prod[2*mn];
+
+  // bmod := B mod M
+  const mp_size_t abn = mp_size_abs(bn);
+  memset(bmod, 0, mn*sizeof(mp_limb_t));
+  if (abn >= mn)
+    mpn_tdiv_qr(qp, bmod, 0, bp, abn, mp, mn);
+  else
+    memcpy(bmod, bp, abn*sizeof(mp_limb_t));
+
+  if (bn < 0 && !mp_limb_zero_p(bmod, mn))
+    mpn_sub_n(bmod, mp, bmod, mn);
+
+  mont_mul(&table[0], bmod, r2, prod, mp, mn, minv);
+  if (k > 1) {
+    mont_sqr(acc, &table[0], prod, mp, mn, minv);
+    for (mp_size_t j = 1; j < ((mp_size_t)1 << (k-1)); j++)
+      mont_mul(&table[j*mn], &table[(j-1)*mn], acc, prod, mp, mn, minv);
+  }
+
+  // left-to-right sliding window exponentiation; 'acc' is set up by the
+  // first window, which starts at the exponent's top bit
+  bool started = false;
+  mp_bitcnt_t i = ebits;
+  while (i > 0) {
+    if (!mp_limb_bit(ep, i-1)) {
+      mont_sqr(acc, acc, prod, mp, mn, minv);
+      i--;
+      continue;
+    }
+
+    // the window is bits [lo,i) of E, with bit lo set
+    mp_bitcnt_t lo = i > (mp_bitcnt_t)k ? i-k : 0;
+    while (!mp_limb_bit(ep, lo))
+      lo++;
+
+    mp_limb_t w = 0;
+    for (mp_bitcnt_t j = i; j > lo; j--)
+      w = (w << 1) | mp_limb_bit(ep, j-1);
+
+    if (started) {
+      for (mp_bitcnt_t j = lo; j < i; j++)
+        mont_sqr(acc, acc, prod, mp, mn, minv);
+      mont_mul(acc, acc, &table[(w >> 1)*mn], prod, mp, mn, minv);
+    } else {
+      memcpy(acc, &table[(w >> 1)*mn], mn*sizeof(mp_limb_t));
+      started = true;
+    }
+
+    i = lo;
+  }
+
+  // leave Montgomery form, and reduce fully below M
+  memset(bmod, 0, mn*sizeof(mp_limb_t));
+  bmod[0] = 1;
+  mont_mul(rp, acc, bmod, prod, mp, mn, minv);
+  if (mpn_cmp(rp, mp, mn) >= 0)
+    mpn_sub_n(rp, rp, mp, mn);
+
+  mp_size_t rn = mn;
+  while (rn > 1 && !rp[rn-1])
+    rn--;
+
+  return rn;
+}
+
+
+/* mpz_invert() on mpn's
  *
  * Store '(1/X) mod abs(M)' in {rp,rn}
  *
  * rp must have allocated mn limbs; This function's return value is
  * the actual number rn (0 < rn <= mn) of limbs written to the rp limb-array.
+ * tp must have space for 5*mn+xn+6 limbs (with xn,mn taken absolute).
  *
  * Returns 0 if inverse does not exist.
  */
 mp_size_t
 integer_gmp_invert(mp_limb_t rp[], // result
                    const mp_limb_t xp[], const mp_size_t xn, // base
-                   const mp_limb_t mp[], const mp_size_t mn) // mod
+                   const mp_limb_t mp[], const mp_size_t mn, // mod
+                   mp_limb_t tp[])
 {
   if (mp_limb_zero_p(xp,xn)
       || mp_limb_zero_p(mp,mn)
@@ -701,28 +1259,71 @@ integer_gmp_invert(mp_limb_t rp[], // result
     return 1;
   }
 
-  const mpz_t x = CONST_MPZ_INIT(xp, xn);
-  const mpz_t m = CONST_MPZ_INIT(mp, mn);
-
-  mpz_t r;
-  mpz_init (r);
-
-  const int inv_exists = mpz_invert(r, x, m);
-
-  const mp_size_t rn = inv_exists ? r[0]._mp_size : 0;
+  const mp_size_t axn = mp_size_abs(xn);
+  const mp_size_t amn = mp_size_abs(mn);
+
+  mp_limb_t *const up = tp;             // amn+2 limbs
+  mp_limb_t *const vp = &up[amn+2];     // amn+1 limbs
+  mp_limb_t *const gp = &vp[amn+1];     // amn limbs
+  mp_limb_t *const sp = &gp[amn];       // amn+1 limbs
+  mp_limb_t *const xr = &sp[amn+1];     // amn limbs
+  mp_limb_t *const qp = &xr[amn];       // axn+2 limbs
+
+  // {xr,xrn} := abs(X) mod M
+  mp_size_t xrn;
+  if (axn >= amn) {
+    mpn_tdiv_qr(qp, xr, 0, xp, axn, mp, amn);
+    xrn = amn;
+  } else {
+    memcpy(xr, xp, axn*sizeof(mp_limb_t));
+    xrn = axn;
+  }
+  while (xrn > 0 && !xr[xrn-1])
+    xrn--;
 
-  if (rn) {
-    assert(0 < rn && rn <= mn);
-    memcpy(rp, r[0]._mp_d, rn*sizeof(mp_limb_t));
+  if (!xrn) {
+    rp[0] = 0;
+    return 1;
   }
 
-  mpz_clear (r);
+  // mpn_gcdext() gives us the cofactor of its first operand, which
+  // must not be shorter than the second one; so we ask for the one of
+  // abs(X) mod M + M, which is congruent to abs(X)
+  mp_size_t un = amn;
+  if (mpn_add(up, mp, amn, xr, xrn))
+    up[un++] = 1;
+  memcpy(vp, mp, amn*sizeof(mp_limb_t));
 
-  if (!rn) {
+  mp_size_t ssn;
+  const mp_size_t gn = mpn_gcdext(gp, sp, &ssn, up, un, vp, amn);
+
+  if (gn != 1 || gp[0] != 1) {
     rp[0] = 0;
     return 1;
   }
 
+  mp_size_t sn = mp_size_abs(ssn);
+  if (sn > amn || (sn == amn && mpn_cmp(sp, mp, amn) >= 0)) {
+    mpn_tdiv_qr(qp, xr, 0, sp, sn, mp, amn);
+    memcpy(sp, xr, amn*sizeof(mp_limb_t));
+    sn = amn;
+  }
+  while (sn > 0 && !sp[sn-1])
+    sn--;
+  assert(sn > 0);
+
+  // the inverse of abs(X) is s or M-s, and then the one of X is
+  // either that or M minus that
+  mp_size_t rn = amn;
+  if ((ssn < 0) != (xn < 0)) {
+    mpn_sub(rp, mp, amn, sp, sn);
+  } else {
+    memset(rp, 0, amn*sizeof(mp_limb_t));
+    memcpy(rp, sp, sn*sizeof(mp_limb_t));
+  }
+  while (rn > 1 && !rp[rn-1])
+    rn--;
+
   return rn;
 }
 
@@ -734,21 +1335,24 @@ integer_gmp_invert_word(const mp_limb_t x0, const mp_limb_t m0)
   if (!x0 || m0<=1) return 0;
   if (x0 == 1) return 1;
 
-  const mpz_t x = CONST_MPZ_INIT(&x0, 1);
-  const mpz_t m = CONST_MPZ_INIT(&m0, 1);
-
-  mpz_t r;
-  mpz_init (r);
+  // extended Euclid, with the cofactors kept as magnitudes (which are
+  // bounded by m0) of alternating sign
+  mp_limb_t u1 = 1, u3 = x0 % m0, v1 = 0, v3 = m0;
+  bool neg = false;
 
-  const int inv_exists = mpz_invert(r, x, m);
-  const mp_size_t rn = inv_exists ? r[0]._mp_size : 0;
+  while (v3) {
+    const mp_limb_t q = u3 / v3;
+    const mp_limb_t t3 = u3 % v3;
+    const mp_limb_t t1 = u1 + q*v1;
 
-  assert (rn == 0 || rn == 1);
-  const mp_limb_t r0 = rn ? r[0]._mp_d[0] : 0;
+    u1 = v1; v1 = t1;
+    u3 = v3; v3 = t3;
+    neg = !neg;
+  }
 
-  mpz_clear (r);
+  if (u3 != 1) return 0;
 
-  return r0;
+  return neg ? m0 - u1 : u1;
 }
 
 
@@ -761,45 +1365,32 @@ integer_gmp_invert_word(const mp_limb_t x0, const mp_limb_t m0)
  *  mpn_copyd, mpn_zero
  *
  * We use some of those, but for GMP 4.x compatibility we need to
- * emulate those (while incurring some overhead).
+ * emulate those. The logic operations are simple enough to be done
+ * limb by limb right here, rather than by a round-trip through
+ * (heap-allocated) mpz_t's.
  */
 #if __GNU_MP_VERSION < 5
 
-#define MPN_LOGIC_OP_WRAPPER(MPN_WRAPPER, MPZ_OP) \
+#define MPN_LOGIC_OP_WRAPPER(MPN_WRAPPER, OP)                      \
 void                                                               \
 MPN_WRAPPER(mp_limb_t *rp, const mp_limb_t *s1p,                   \
             const mp_limb_t *s2p, mp_size_t n)                     \
 {                                                                  \
   assert(n > 0);                                                   \
                                                                    \
-  const mpz_t s1 = CONST_MPZ_INIT(s1p, n);                         \
-  const mpz_t s2 = CONST_MPZ_INIT(s2p, n);                         \
-                                                                   \
-  mpz_t r;                                                         \
-  mpz_init (r);                                                    \
-  MPZ_OP (r, s1, s2);                                              \
-                                                                   \
-  const mp_size_t rn = r[0]._mp_size;                              \
-  memset (rp, 0, n*sizeof(mp_limb_t));                             \
-  memcpy (rp, r[0]._mp_d, mp_size_minabs(rn,n)*sizeof(mp_limb_t)); \
-                                                                   \
-  mpz_clear (r);                                                   \
+  for (mp_size_t i = 0; i < n; i++)                                \
+    rp[i] = OP(s1p[i], s2p[i]);                                    \
 }
 
-static void
-__mpz_andn(mpz_t r, const mpz_t s1, const mpz_t s2)
-{
-  mpz_t s2c;
-  mpz_init (s2c);
-  mpz_com (s2c, s2);
-  mpz_and (r, s1, s2c);
-  mpz_clear (s2c);
-}
+#define LIMB_AND(x,y)  ((x) & (y))
+#define LIMB_ANDN(x,y) ((x) & ~(y))
+#define LIMB_IOR(x,y)  ((x) | (y))
+#define LIMB_XOR(x,y)  ((x) ^ (y))
 
-MPN_LOGIC_OP_WRAPPER(integer_gmp_mpn_and_n,  mpz_and)
-MPN_LOGIC_OP_WRAPPER(integer_gmp_mpn_andn_n, __mpz_andn)
-MPN_LOGIC_OP_WRAPPER(integer_gmp_mpn_ior_n,  mpz_ior)
-MPN_LOGIC_OP_WRAPPER(integer_gmp_mpn_xor_n,  mpz_xor)
+MPN_LOGIC_OP_WRAPPER(integer_gmp_mpn_and_n,  LIMB_AND)
+MPN_LOGIC_OP_WRAPPER(integer_gmp_mpn_andn_n, LIMB_ANDN)
+MPN_LOGIC_OP_WRAPPER(integer_gmp_mpn_ior_n,  LIMB_IOR)
+MPN_LOGIC_OP_WRAPPER(integer_gmp_mpn_xor_n,  LIMB_XOR)
 
 #else /* __GNU_MP_VERSION >= 5 */
 void
@@ -830,3 +1421,83 @@ integer_gmp_mpn_xor_n(mp_limb_t *rp, const mp_limb_t *s1p,
   mpn_xor_n(rp, s1p, s2p, n);
 }
 #endif
+
+
+/* Bitwise logic operation on two's complement numbers
+ *
+ * Store 'X op Y' in {rp,rn}, where X and Y are given in
+ * sign-magnitude form (i.e. xn and yn are negative to denote negative
+ * numbers) and 'op' is one of INTEGER_GMP_LOGIC_{AND,IOR,XOR}. The
+ * two's complement of negative operands, and of a negative result, is
+ * formed limb by limb on the fly, so no temporaries are needed.
+ *
+ * rp must have space for max(|xn|,|yn|)+1 limbs.
+ *
+ * return value: signed 'rn' of {rp,rn}, with rn=1 and rp[0]=0 for 0
+ */
+#define INTEGER_GMP_LOGIC_AND 0
+#define INTEGER_GMP_LOGIC_IOR 1
+#define INTEGER_GMP_LOGIC_XOR 2
+
+mp_size_t
+integer_gmp_mpn_logic_2c(mp_limb_t rp[], const HsInt op,
+                         const mp_limb_t xp[], const mp_size_t xn,
+                         const mp_limb_t yp[], const mp_size_t yn)
+{
+  const mp_size_t axn = mp_size_abs(xn), ayn = mp_size_abs(yn);
+  const mp_size_t n = axn > ayn ? axn : ayn;
+  const bool xneg = xn < 0, yneg = yn < 0;
+
+  bool rneg;
+  switch (op) {
+  case INTEGER_GMP_LOGIC_AND: rneg = xneg && yneg; break;
+  case INTEGER_GMP_LOGIC_IOR: rneg = xneg || yneg; break;
+  default:                    rneg = xneg != yneg; break;
+  }
+
+  // -X = ~(X-1); 'xb' and 'yb' are the borrows of the X-1 and Y-1,
+  // and 'rc' the carry of the ~R+1 for a negative result
+  mp_limb_t xb = xneg, yb = yneg, rc = rneg;
+
+  for (mp_size_t i = 0; i < n; i++) {
+    mp_limb_t x = i < axn ? xp[i] : 0;
+    mp_limb_t y = i < ayn ? yp[i] : 0;
+
+    if (xneg) {
+      const mp_limb_t t = x - xb;
+      xb = x < xb;
+      x = ~t;
+    }
+
+    if (yneg) {
+      const mp_limb_t t = y - yb;
+      yb = y < yb;
+      y = ~t;
+    }
+
+    mp_limb_t r;
+    switch (op) {
+    case INTEGER_GMP_LOGIC_AND: r = x & y; break;
+    case INTEGER_GMP_LOGIC_IOR: r = x | y; break;
+    default:                    r = x ^ y; break;
+    }
+
+    if (rneg) {
+      r = ~r + rc;
+      rc = rc && !r;
+    }
+
+    rp[i] = r;
+  }
+
+  // beyond n limbs, a negative result is all ones (and so its
+  // magnitude all zeros, except for the final carry)
+  mp_size_t rn = n;
+  if (rc)
+    rp[rn++] = 1;
+
+  while (rn > 1 && !rp[rn-1])
+    rn--;
+
+  return rneg ? -rn : rn;
+}
@@ -48,6 +48,9 @@ module GHC.Integer.GMP.Internals
     , lcmInteger
     , sqrInteger
     , powModInteger
+    , PowModContext
+    , powModContextInteger
+    , powModIntegerCtx
     , recipModInteger
 
       -- ** Additional conversion operations to 'Integer'
@@ -99,6 +102,8 @@ module GHC.Integer.GMP.Internals
 
     , powModBigNat
     , powModBigNatWord
+    , powModContextBigNat
+    , powModBigNatCtx
 
     , recipModBigNat
 
@@ -577,14 +577,9 @@ orInteger  _           (S# -1#)  = S# -1#
 -- base-cases
 orInteger  (S# x#)     (S# y#)   = S# (orI# x# y#)
 orInteger  (Jp# x)     (Jp# y)   = Jp# (orBigNat x y)
-orInteger  (Jn# x)     (Jn# y)
-    = bigNatToNegInteger (plusBigNatWord (andBigNat
-                                          (minusBigNatWord x 1##)
-                                          (minusBigNatWord y 1##)) 1##)
+orInteger  (Jn# x)     (Jn# y)   = logic2cSBigNat 1# (NegBN x) (NegBN y)
 orInteger  x@(Jn# _)   y@(Jp# _)  = orInteger y x -- retry with swapped args
-orInteger  (Jp# x)     (Jn# y)
-    = bigNatToNegInteger (plusBigNatWord (andnBigNat (minusBigNatWord y 1##) x)
-                                         1##)
+orInteger  (Jp# x)     (Jn# y)   = logic2cSBigNat 1# (PosBN x) (NegBN y)
 -- TODO/FIXpromotion-hack
 orInteger  x@(S# _)   y          = orInteger (unsafePromote x) y
 orInteger  x           y {- S# -}= orInteger x (unsafePromote y)
@@ -599,13 +594,9 @@ xorInteger x           (S# 0#)    = x
 -- base-cases
 xorInteger (S# x#)     (S# y#)    = S# (xorI# x# y#)
 xorInteger (Jp# x)     (Jp# y)    = bigNatToInteger (xorBigNat x y)
-xorInteger (Jn# x)     (Jn# y)
-    = bigNatToInteger (xorBigNat (minusBigNatWord x 1##)
-                                 (minusBigNatWord y 1##))
+xorInteger (Jn# x)     (Jn# y)    = logic2cSBigNat 2# (NegBN x) (NegBN y)
 xorInteger x@(Jn# _)   y@(Jp# _)  = xorInteger y x -- retry with swapped args
-xorInteger (Jp# x)     (Jn# y)
-    = bigNatToNegInteger (plusBigNatWord (xorBigNat x (minusBigNatWord y 1##))
-                                         1##)
+xorInteger (Jp# x)     (Jn# y)    = logic2cSBigNat 2# (PosBN x) (NegBN y)
 -- TODO/FIXME promotion-hack
 xorInteger x@(S# _)    y          = xorInteger (unsafePromote x) y
 xorInteger x           y {- S# -} = xorInteger x (unsafePromote y)
@@ -621,17 +612,31 @@ andInteger x           (S# -1#)  = x
 -- base-cases
 andInteger (S# x#)     (S# y#)   = S# (andI# x# y#)
 andInteger (Jp# x)     (Jp# y)   = bigNatToInteger (andBigNat x y)
-andInteger (Jn# x)     (Jn# y)
-    = bigNatToNegInteger (plusBigNatWord (orBigNat (minusBigNatWord x 1##)
-                                                   (minusBigNatWord y 1##)) 1##)
+andInteger (Jn# x)     (Jn# y)   = logic2cSBigNat 0# (NegBN x) (NegBN y)
 andInteger x@(Jn# _)   y@(Jp# _)  = andInteger y x
-andInteger (Jp# x)     (Jn# y)
-    = bigNatToInteger (andnBigNat x (minusBigNatWord y 1##))
+andInteger (Jp# x)     (Jn# y)   = logic2cSBigNat 0# (PosBN x) (NegBN y)
 -- TODO/FIXME promotion-hack
 andInteger x@(S# _)   y          = andInteger (unsafePromote x) y
 andInteger x           y {- S# -}= andInteger x (unsafePromote y)
 {-# CONSTANT_FOLDED andInteger #-}
 
+-- internal helper: bitwise AND (0#), OR (1#) or XOR (2#) of the two's
+-- complement of 'SBigNat's, at least one of which is negative
+logic2cSBigNat :: Int# -> SBigNat -> SBigNat -> Integer
+logic2cSBigNat op# x y = runS $ do
+    r@(MBN# r#) <- newBigNat# (maxI# (absI# xn#) (absI# yn#) +# 1#)
+    I# rn_# <- liftIO (c_mpn_logic_2c# r# op# x# xn# y# yn#)
+    let rn# = narrowGmpSize# rn_#
+    r' <- unsafeShrinkFreezeBigNat# r (absI# rn#)
+    case rn# >=# 0# of
+        0# -> return (bigNatToNegInteger r')
+        _  -> return (bigNatToInteger r')
+  where
+    !(BN# x#) = absSBigNat x
+    !(BN# y#) = absSBigNat y
+    xn# = ssizeofSBigNat# x
+    yn# = ssizeofSBigNat# y
+
 -- HACK warning! breaks invariant on purpose
 unsafePromote :: Integer -> Integer
 unsafePromote (S# x#)
@@ -1247,7 +1252,8 @@ gcdBigNat x@(BN# x#) y@(BN# y#)
   where
     gcd' a# na# b# nb# = do -- na >= nb
         mbn@(MBN# mba#) <- newBigNat# nb#
-        I# rn'# <- liftIO (c_mpn_gcd# mba# a# na# b# nb#)
+        MBN# t# <- newBigNat# (case nb# of 1# -> 0#; _ -> na# +# nb# +# 2#)
+        I# rn'# <- liftIO (c_mpn_gcd# mba# a# na# b# nb# t#)
         let rn# = narrowGmpSize# rn'#
         case rn# ==# nb# of
             0# -> unsafeShrinkFreezeBigNat# mbn rn#
@@ -1278,8 +1284,9 @@ gcdExtSBigNat x y = case runS go of (g,s) -> (# g, s #)
   where
     go = do
         g@(MBN# g#) <- newBigNat# gn0#
-        s@(MBN# s#) <- newBigNat# (absI# xn#)
-        I# ssn_# <- liftIO (integer_gmp_gcdext# s# g# x# xn# y# yn#)
+        s@(MBN# s#) <- newBigNat# (maxI# (absI# xn#) (absI# yn#))
+        MBN# t# <- newBigNat# (3# *# (absI# xn# +# absI# yn#) +# 6#)
+        I# ssn_# <- liftIO (integer_gmp_gcdext# s# g# x# xn# y# yn# t#)
         let ssn# = narrowGmpSize# ssn_#
             sn#  = absI# ssn#
         s' <- unsafeShrinkFreezeBigNat# s sn#
@@ -1379,6 +1386,89 @@ foreign import ccall unsafe "integer_gmp_powm1"
   integer_gmp_powm1# :: ByteArray# -> GmpSize# -> ByteArray# -> GmpSize#
                         -> GmpLimb# -> GmpLimb#
 
+-- | A modulus for 'powModIntegerCtx' and 'powModBigNatCtx', together
+-- with the values they need which only depend on the modulus.
+--
+-- @since 1.0.1.0
+data PowModContext = PMC# ByteArray#
+
+-- | \"@'powModContextInteger' /m/@\" sets up a 'PowModContext' for
+-- modulus @abs(/m/)@, which must be non-zero.
+--
+-- Repeated exponentiations modulo the same odd number are cheaper with
+-- 'powModIntegerCtx' than with 'powModInteger'; for even moduli the two
+-- do the same.
+--
+-- @since 1.0.1.0
+powModContextInteger :: Integer -> PowModContext
+powModContextInteger (S# m#) = powModContextBigNat (wordToBigNat (int2Word# (absI# m#)))
+powModContextInteger (Jp# m) = powModContextBigNat m
+powModContextInteger (Jn# m) = powModContextBigNat m
+
+-- | Version of 'powModContextInteger' operating on 'BigNat's
+--
+-- @since 1.0.1.0
+powModContextBigNat :: BigNat -> PowModContext
+powModContextBigNat (BN# m#) = runS $ do
+    mctx@(MBN# mctx#) <- newBigNat# (integer_gmp_powm_ctx_size# mn#)
+    _ <- liftIO (integer_gmp_powm_ctx_init# mctx# m# mn#)
+    BN# ctx# <- unsafeFreezeBigNat# mctx
+    return (PMC# ctx#)
+  where
+    mn# = sizeofBigNat# (BN# m#)
+
+-- | \"@'powModIntegerCtx' /b/ /e/ /ctx/@\" computes the same as
+-- \"@'powModInteger' /b/ /e/ /m/@\", for the modulus @/m/@ @/ctx/@ was
+-- set up for with 'powModContextInteger'.
+--
+-- @since 1.0.1.0
+{-# NOINLINE powModIntegerCtx #-}
+powModIntegerCtx :: Integer -> Integer -> PowModContext -> Integer
+powModIntegerCtx b e ctx
+  = bigNatToInteger (powModSBigNatCtx (integerToSBigNat b)
+                                      (integerToSBigNat e) ctx)
+
+-- | Version of 'powModIntegerCtx' operating on 'BigNat's
+--
+-- @since 1.0.1.0
+powModBigNatCtx :: BigNat -> BigNat -> PowModContext -> BigNat
+powModBigNatCtx b e ctx = inline powModSBigNatCtx (PosBN b) (PosBN e) ctx
+
+-- internal non-exported helper
+powModSBigNatCtx :: SBigNat -> SBigNat -> PowModContext -> BigNat
+powModSBigNatCtx b e (PMC# ctx#) = runS $ do
+    r@(MBN# r#) <- newBigNat# mn#
+    MBN# t# <- newBigNat# tn#
+    I# rn_# <- liftIO (integer_gmp_powm_ctx# r# b# bn# e# en# ctx# t#)
+    let rn# = narrowGmpSize# rn_#
+    case rn# ==# mn# of
+        0# -> unsafeShrinkFreezeBigNat# r rn#
+        _  -> unsafeFreezeBigNat# r
+  where
+    !(BN# b#) = absSBigNat b
+    !(BN# e#) = absSBigNat e
+    bn# = ssizeofSBigNat# b
+    en# = ssizeofSBigNat# e
+    mn# = word2Int# (indexWordArray# ctx# 0#)
+    tn# = integer_gmp_powm_ctx_scratch_size# bn# en# mn#
+
+foreign import ccall unsafe "integer_gmp_powm_ctx_size"
+  integer_gmp_powm_ctx_size# :: GmpSize# -> GmpSize#
+
+foreign import ccall unsafe "integer_gmp_powm_ctx_scratch_size"
+  integer_gmp_powm_ctx_scratch_size# :: GmpSize# -> GmpSize# -> GmpSize#
+                                        -> GmpSize#
+
+foreign import ccall unsafe "integer_gmp_powm_ctx_init"
+  integer_gmp_powm_ctx_init# :: MutableByteArray# RealWorld
+                                -> ByteArray# -> GmpSize# -> IO ()
+
+foreign import ccall unsafe "integer_gmp_powm_ctx"
+  integer_gmp_powm_ctx# :: MutableByteArray# RealWorld
+                           -> ByteArray# -> GmpSize# -> ByteArray# -> GmpSize#
+                           -> ByteArray# -> MutableByteArray# RealWorld
+                           -> IO GmpSize
+
 
 -- | \"@'recipModInteger' /x/ /m/@\" computes the inverse of @/x/@ modulo @/m/@. If
 -- the inverse exists, the return value @/y/@ will satisfy @0 < /y/ <
@@ -1411,7 +1501,8 @@ foreign import ccall unsafe "integer_gmp_invert_word"
 recipModSBigNat :: SBigNat -> BigNat -> BigNat
 recipModSBigNat x m@(BN# m#) = runS $ do
     r@(MBN# r#) <- newBigNat# mn#
-    I# rn_# <- liftIO (integer_gmp_invert# r# x# xn# m# mn#)
+    MBN# t# <- newBigNat# (5# *# mn# +# absI# xn# +# 6#)
+    I# rn_# <- liftIO (integer_gmp_invert# r# x# xn# m# mn# t#)
     let rn# = narrowGmpSize# rn_#
     case rn# ==# mn# of
         0# -> unsafeShrinkFreezeBigNat# r rn#
@@ -1424,7 +1515,8 @@ recipModSBigNat x m@(BN# m#) = runS $ do
 foreign import ccall unsafe "integer_gmp_invert"
   integer_gmp_invert# :: MutableByteArray# RealWorld
                          -> ByteArray# -> GmpSize#
-                         -> ByteArray# -> GmpSize# -> IO GmpSize
+                         -> ByteArray# -> GmpSize#
+                         -> MutableByteArray# RealWorld -> IO GmpSize
 
 ----------------------------------------------------------------------------
 -- Conversions to/from floating point
@@ -1483,12 +1575,18 @@ foreign import ccall unsafe "integer_gmp_mpn_gcd_1"
 
 foreign import ccall unsafe "integer_gmp_mpn_gcd"
   c_mpn_gcd# :: MutableByteArray# s -> ByteArray# -> GmpSize#
-                -> ByteArray# -> GmpSize# -> IO GmpSize
+                -> ByteArray# -> GmpSize# -> MutableByteArray# s -> IO GmpSize
 
 foreign import ccall unsafe "integer_gmp_gcdext"
   integer_gmp_gcdext# :: MutableByteArray# s -> MutableByteArray# s
                          -> ByteArray# -> GmpSize#
-                         -> ByteArray# -> GmpSize# -> IO GmpSize
+                         -> ByteArray# -> GmpSize#
+                         -> MutableByteArray# s -> IO GmpSize
+
+foreign import ccall unsafe "integer_gmp_mpn_logic_2c"
+  c_mpn_logic_2c# :: MutableByteArray# s -> Int#
+                     -> ByteArray# -> GmpSize# -> ByteArray# -> GmpSize#
+                     -> IO GmpSize
 
 -- mp_limb_t mpn_add_1 (mp_limb_t *rp, const mp_limb_t *s1p, mp_size_t n,
 --                      mp_limb_t s2limb)
@@ -1757,35 +1855,20 @@ importIntegerFromAddr addr len msbf = IO $ do
 -- | Version of 'importIntegerFromAddr' constructing a 'BigNat'
 importBigNatFromAddr :: Addr# -> Word# -> Int# -> IO BigNat
 importBigNatFromAddr _ 0## _ = IO (\s -> (# s, zeroBigNat #))
-importBigNatFromAddr addr len0 1# = IO $ do -- MSBF
-    W# ofs <- liftIO (c_scan_nzbyte_addr addr 0## len0)
-    let len = len0 `minusWord#` ofs
-        addr' = addr `plusAddr#` (word2Int# ofs)
-    importBigNatFromAddr# addr' len 1#
-importBigNatFromAddr addr len0 _ = IO $ do -- LSBF
-    W# len <- liftIO (c_rscan_nzbyte_addr addr 0## len0)
-    importBigNatFromAddr# addr len 0#
-
-foreign import ccall unsafe "integer_gmp_scan_nzbyte"
-    c_scan_nzbyte_addr :: Addr# -> Word# -> Word# -> IO Word
-
-foreign import ccall unsafe "integer_gmp_rscan_nzbyte"
-    c_rscan_nzbyte_addr :: Addr# -> Word# -> Word# -> IO Word
-
--- | Helper for 'importBigNatFromAddr'
-importBigNatFromAddr# :: Addr# -> Word# -> Int# -> S RealWorld BigNat
-importBigNatFromAddr# _ 0## _ = return zeroBigNat
-importBigNatFromAddr# addr len msbf = do
+importBigNatFromAddr addr len msbf = IO $ do
     mbn@(MBN# mba#) <- newBigNat# n#
-    () <- liftIO (c_mpn_import_addr mba# addr 0## len msbf)
-    unsafeFreezeBigNat# mbn
+    W# rn <- liftIO (c_mpn_import_nz_addr mba# addr 0## len msbf)
+    case rn of
+        0## -> return zeroBigNat
+        _   -> unsafeShrinkFreezeBigNat# mbn (word2Int# rn)
   where
-    -- n = ceiling(len / SIZEOF_HSWORD), i.e. number of limbs required
+    -- n = ceiling(len / SIZEOF_HSWORD), i.e. upper bound on limbs required
     n# = (word2Int# len +# (SIZEOF_HSWORD# -# 1#)) `quotInt#` SIZEOF_HSWORD#
 
-foreign import ccall unsafe "integer_gmp_mpn_import"
-    c_mpn_import_addr :: MutableByteArray# RealWorld -> Addr# -> Word# -> Word#
-                      -> Int# -> IO ()
+-- Skips zero bytes and imports in one pass; returns normalized limb count
+foreign import ccall unsafe "integer_gmp_mpn_import_nz"
+    c_mpn_import_nz_addr :: MutableByteArray# RealWorld -> Addr# -> Word#
+                         -> Word# -> Int# -> IO Word
 
 -- | Read 'Integer' (without sign) from byte-array in base-256 representation.
 --
@@ -1809,36 +1892,20 @@ importIntegerFromByteArray ba ofs len msbf
 
 -- | Version of 'importIntegerFromByteArray' constructing a 'BigNat'
 importBigNatFromByteArray :: ByteArray# -> Word# -> Word# -> Int# -> BigNat
-importBigNatFromByteArray _  _    0##  _  = zeroBigNat
-importBigNatFromByteArray ba ofs0 len0 1# = runS $ do -- MSBF
-    W# ofs <- liftIO (c_scan_nzbyte_bytearray ba ofs0 len0)
-    let len = (len0 `plusWord#` ofs0) `minusWord#` ofs
-    importBigNatFromByteArray# ba ofs len 1#
-importBigNatFromByteArray ba ofs  len0 _  = runS $ do -- LSBF
-    W# len <- liftIO (c_rscan_nzbyte_bytearray ba ofs len0)
-    importBigNatFromByteArray# ba ofs len 0#
-
-foreign import ccall unsafe "integer_gmp_scan_nzbyte"
-    c_scan_nzbyte_bytearray :: ByteArray# -> Word# -> Word# -> IO Word
-
-foreign import ccall unsafe "integer_gmp_rscan_nzbyte"
-    c_rscan_nzbyte_bytearray :: ByteArray# -> Word# -> Word# -> IO Word
-
--- | Helper for 'importBigNatFromByteArray'
-importBigNatFromByteArray# :: ByteArray# -> Word# -> Word# -> Int#
-                           -> S RealWorld BigNat
-importBigNatFromByteArray# _ _ 0## _ = return zeroBigNat
-importBigNatFromByteArray# ba ofs len msbf = do
+importBigNatFromByteArray _  _   0##  _    = zeroBigNat
+importBigNatFromByteArray ba ofs len  msbf = runS $ do
     mbn@(MBN# mba#) <- newBigNat# n#
-    () <- liftIO (c_mpn_import_bytearray mba# ba ofs len msbf)
-    unsafeFreezeBigNat# mbn
+    W# rn <- liftIO (c_mpn_import_nz_bytearray mba# ba ofs len msbf)
+    case rn of
+        0## -> return zeroBigNat
+        _   -> unsafeShrinkFreezeBigNat# mbn (word2Int# rn)
   where
-    -- n = ceiling(len / SIZEOF_HSWORD), i.e. number of limbs required
+    -- n = ceiling(len / SIZEOF_HSWORD), i.e. upper bound on limbs required
     n# = (word2Int# len +# (SIZEOF_HSWORD# -# 1#)) `quotInt#` SIZEOF_HSWORD#
 
-foreign import ccall unsafe "integer_gmp_mpn_import"
-    c_mpn_import_bytearray :: MutableByteArray# RealWorld -> ByteArray# -> Word#
-                           -> Word# -> Int# -> IO ()
+foreign import ccall unsafe "integer_gmp_mpn_import_nz"
+    c_mpn_import_nz_bytearray :: MutableByteArray# RealWorld -> ByteArray#
+                              -> Word# -> Word# -> Int# -> IO Word
 
 -- | Test whether all internal invariants are satisfied by 'BigNat' value
 --
@@ -2000,3 +2067,7 @@ cmpI# x# y# = (x# ># y#) -# (x# <# y#)
 minI# :: Int# -> Int# -> Int#
 minI# x# y# | isTrue# (x# <=# y#) = x#
             | True                = y#
+
+maxI# :: Int# -> Int# -> Int#
+maxI# x# y# | isTrue# (x# >=# y#) = x#
+            | True                = y#
@@ -228,6 +228,127 @@ static void GNUC3_ATTRIBUTE(used) obscure_ccall_wrapper(void)
   );
 }
 extern void obscure_ccall_ret_code(void);
+
+/*
+  Adjustor pools
+
+  Programs that turn many Haskell closures into FunPtrs (callbacks for
+  a GUI toolkit, say) create and free adjustors all the time, and going
+  to allocateExec() and freeExec() for each of them takes the storage
+  manager lock (and, on Linux, a trip through libffi's allocator).  So
+  the adjustors are kept in a pool for each of the two kinds we make,
+  carved out of slabs that come from one allocateExec() each, and
+  freeHaskellFunctionPtr() puts an adjustor back on the free list of its
+  pool instead of freeing it.  The slabs are never given back.
+
+  Each stub starts with a word holding its own writable address, as in
+  allocateExec() on Linux, followed by the code; the executable address
+  of the code is the one we hand out.  A free stub holds the next stub
+  on the free list in its first code word.
+
+  The free lists are lock-free: a stub is pushed with a cas, and taken
+  by grabbing the whole list with an xchg and putting back what is left
+  (which only needs a walk down it if some other stub was pushed in the
+  meantime).  Unlike popping a single stub with a cas, this can't be
+  fooled by a stub that was taken and put back between the read of the
+  head and the cas.
+*/
+
+#if defined(mingw32_HOST_OS)
+#define ADJUSTOR_SMALL_SIZE 0x38
+#define ADJUSTOR_LARGE_SIZE 0x58
+#else
+#define ADJUSTOR_SMALL_SIZE 0x30
+#define ADJUSTOR_LARGE_SIZE 0x40
+#endif
+
+// The most that allocateExec() can give us on every platform
+#define ADJUSTOR_SLAB_SIZE (BLOCK_SIZE - 4 * sizeof(W_))
+
+typedef struct {
+    W_ size;                         // of a stub, with its header word
+    AdjustorExecutable volatile free;
+} AdjustorPool;
+
+static AdjustorPool small_adjustors = { ADJUSTOR_SMALL_SIZE + sizeof(W_), NULL };
+static AdjustorPool large_adjustors = { ADJUSTOR_LARGE_SIZE + sizeof(W_), NULL };
+
+// The header of a stub: w[0] is its writable address, w[1] the link
+STATIC_INLINE void **
+stubHeader (AdjustorExecutable exec)
+{
+    return ((void **)exec)[-1];
+}
+
+// Push the stubs first..last, which are linked together already
+static void
+pushStubs (AdjustorPool *pool, AdjustorExecutable first,
+           AdjustorExecutable last)
+{
+    AdjustorExecutable old;
+
+    do {
+        old = pool->free;
+        stubHeader(last)[1] = old;
+    } while (cas((StgVolatilePtr)&pool->free, (StgWord)old, (StgWord)first)
+             != (StgWord)old);
+}
+
+static AdjustorExecutable
+newAdjustorSlab (AdjustorPool *pool)
+{
+    StgWord8 *slab, *exec;
+    void **w;
+    W_ i, n;
+
+    slab = allocateExec(ADJUSTOR_SLAB_SIZE, (AdjustorExecutable *)&exec);
+    if (slab == NULL) {
+        barf("createAdjustor: failed to allocate memory");
+    }
+
+    n = ADJUSTOR_SLAB_SIZE / pool->size;
+    for (i = 0; i < n; i++) {
+        w = (void **)(slab + i * pool->size);
+        w[0] = w;
+        w[1] = i + 1 < n ? exec + (i + 1) * pool->size + sizeof(W_) : NULL;
+    }
+
+    if (n > 1) {
+        pushStubs(pool, exec + pool->size + sizeof(W_),
+                  exec + (n - 1) * pool->size + sizeof(W_));
+    }
+    return exec + sizeof(W_);
+}
+
+static AdjustorWritable
+allocateAdjustor (AdjustorPool *pool, AdjustorExecutable *exec_ret)
+{
+    AdjustorExecutable exec, rest, last;
+
+    exec = (AdjustorExecutable)xchg((StgPtr)&pool->free, 0);
+    if (exec == NULL) {
+        exec = newAdjustorSlab(pool);
+    } else {
+        rest = stubHeader(exec)[1];
+        if (rest != NULL &&
+            cas((StgVolatilePtr)&pool->free, 0, (StgWord)rest) != 0) {
+            for (last = rest; stubHeader(last)[1] != NULL;
+                 last = stubHeader(last)[1]) {
+                // nothing
+            }
+            pushStubs(pool, rest, last);
+        }
+    }
+
+    *exec_ret = exec;
+    return stubHeader(exec) + 1;
+}
+
+static void
+freeAdjustor (AdjustorPool *pool, AdjustorExecutable exec)
+{
+    pushStubs(pool, exec, exec);
+}
 #endif
 
 #if defined(alpha_HOST_ARCH)
@@ -541,7 +662,7 @@ createAdjustor(int cconv, StgStablePtr hptr,
             (typeString[2] == '\0') ||
             (typeString[3] == '\0')) {
 
-            adjustor = allocateExec(0x38,&code);
+            adjustor = allocateAdjustor(&small_adjustors,&code);
             adj_code = (StgWord8*)adjustor;
 
             *(StgInt32 *)adj_code        = 0x49c1894d;
@@ -562,7 +683,7 @@ createAdjustor(int cconv, StgStablePtr hptr,
             int fourthFloating;
 
             fourthFloating = (typeString[3] == 'f' || typeString[3] == 'd');
-            adjustor = allocateExec(0x58,&code);
+            adjustor = allocateAdjustor(&large_adjustors,&code);
             adj_code = (StgWord8*)adjustor;
             *(StgInt32 *)adj_code        = 0x08ec8348;
             *(StgInt32 *)(adj_code+0x4)  = fourthFloating ? 0x5c110ff2
@@ -658,7 +779,7 @@ createAdjustor(int cconv, StgStablePtr hptr,
         }
 
         if (i < 6) {
-            adjustor = allocateExec(0x30,&code);
+            adjustor = allocateAdjustor(&small_adjustors,&code);
             adj_code = (StgWord8*)adjustor;
 
             *(StgInt32 *)adj_code        = 0x49c1894d;
@@ -673,7 +794,7 @@ createAdjustor(int cconv, StgStablePtr hptr,
         }
         else
         {
-            adjustor = allocateExec(0x40,&code);
+            adjustor = allocateAdjustor(&large_adjustors,&code);
             adj_code = (StgWord8*)adjustor;
 
             *(StgInt32 *)adj_code        = 0x35ff5141;
@@ -1252,6 +1373,8 @@ freeHaskellFunctionPtr(void* ptr)
     freeStablePtr(*((StgStablePtr*)((unsigned char*)ptr + 0x02)));
  }
 #elif defined(x86_64_HOST_ARCH)
+ AdjustorPool *pool;
+
  if ( *(StgWord16 *)ptr == 0x894d ) {
      freeStablePtr(*(StgStablePtr*)((StgWord8*)ptr+
 #if defined(mingw32_HOST_OS)
@@ -1260,18 +1383,24 @@ freeHaskellFunctionPtr(void* ptr)
                                                    0x20
 #endif
                                                        ));
+     pool = &small_adjustors;
 #if !defined(mingw32_HOST_OS)
  } else if ( *(StgWord16 *)ptr == 0x5141 ) {
      freeStablePtr(*(StgStablePtr*)((StgWord8*)ptr+0x30));
+     pool = &large_adjustors;
 #endif
 #if defined(mingw32_HOST_OS)
  } else if ( *(StgWord16 *)ptr == 0x8348 ) {
      freeStablePtr(*(StgStablePtr*)((StgWord8*)ptr+0x48));
+     pool = &large_adjustors;
 #endif
  } else {
    errorBelch("freeHaskellFunctionPtr: not for me, guv! %p\n", ptr);
    return;
  }
+ // back to its pool, see "Adjustor pools" above
+ freeAdjustor(pool, ptr);
+ return;
 #elif defined(sparc_HOST_ARCH)
  if ( *(unsigned long*)ptr != 0x9C23A008UL ) {
    errorBelch("freeHaskellFunctionPtr: not for me, guv! %p\n", ptr);
@@ -19,6 +19,18 @@
  */
 RTS_PRIVATE void awaitEvent(rtsBool wait);  /* In posix/Select.c or
                                              * win32/AwaitEvent.c */
+
+#if !defined(mingw32_HOST_OS)
+/* resetAwaitEvent()
+ *
+ * Discards any kernel-side state kept by awaitEvent(); called in the
+ * child after forkProcess().
+ *
+ * Called from STG :  NO
+ * Locks assumed   :  none
+ */
+RTS_PRIVATE void resetAwaitEvent(void);
+#endif
 #endif
 
 #endif /* AWAITEVENT_H */
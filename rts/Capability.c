@@ -25,7 +25,10 @@
 #include "Trace.h"
 #include "sm/GC.h" // for gcWorkerThread()
 #include "STM.h"
+#include "Stable.h"
 #include "RtsUtils.h"
+#include "sm/OSMem.h"
+#include "GetTime.h"
 
 #if !defined(mingw32_HOST_OS)
 #include "rts/IOManager.h" // for setIOManagerControlFd()
@@ -53,6 +56,13 @@ Capability **capabilities = NULL;
 // locking, so we don't do that.
 Capability *last_free_capability = NULL;
 
+// The number of idle Capabilities waiting for work (+RTS -qs)
+volatile StgWord n_hungry_capabilities = 0;
+
+// The NUMA nodes in use, see Capability.h
+nat n_numa_nodes = 1;
+nat numa_map[MAX_NUMA_NODES];
+
 /*
  * Indicates that the RTS wants to synchronise all the Capabilities
  * for some reason.  All Capabilities should stop and return to the
@@ -85,13 +95,77 @@ globalWorkToDo (void)
 #endif
 
 #if defined(THREADED_RTS)
+// The most sparks findSpark() takes from another Capability at once
+#define SPARK_STEAL_BATCH 32
+
+STATIC_INLINE nat
+randomCapability (Capability *cap)
+{
+    StgWord32 x = cap->spark_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cap->spark_seed = x;
+    return x % n_capabilities;
+}
+
+/* ----------------------------------------------------------------------------
+ * stealSparksFrom
+ *
+ * Steal up to half of robbed's sparks (at most SPARK_STEAL_BATCH) with
+ * a single cas on its pool.  We run the first one that hasn't fizzled,
+ * and push the rest onto our own pool, where we find them next time
+ * without having to touch robbed again.  We never take more than our
+ * own pool has room for, so none of them are lost.
+ *
+ * Returns NULL if robbed had no sparks for us; *conflict is set if that
+ * may have been because we raced with another thief.
+ * ------------------------------------------------------------------------- */
+
+static StgClosure *
+stealSparksFrom (Capability *cap, Capability *robbed, rtsBool *conflict)
+{
+    StgClosure *stolen[SPARK_STEAL_BATCH];
+    StgClosure *spark;
+    long space;
+    nat n, i;
+
+    for (;;) {
+        space = dequeSpace(cap->sparks) + 1; // +1 for the one we run
+        n = tryStealSparks(robbed->sparks, stolen,
+                           stg_min(space, SPARK_STEAL_BATCH));
+        if (n == 0) {
+            if (!emptySparkPoolCap(robbed)) {
+                *conflict = rtsTrue;
+            }
+            return NULL;
+        }
+
+        spark = NULL;
+        for (i = 0; i < n; i++) {
+            if (fizzledSpark(stolen[i])) {
+                cap->spark_stats.fizzled++;
+                traceEventSparkFizzle(cap);
+            } else if (spark == NULL) {
+                spark = stolen[i];
+            } else {
+                pushWSDeque(cap->sparks, stolen[i]);
+            }
+        }
+        if (spark != NULL) {
+            return spark;
+        }
+        // they had all fizzled: try again
+    }
+}
+
 StgClosure *
 findSpark (Capability *cap)
 {
   Capability *robbed;
   StgClosurePtr spark;
   rtsBool retry;
-  nat i = 0;
+  nat i = 0, start;
 
   if (!emptyRunQueue(cap) || cap->returning_tasks_hd != NULL) {
       // If there are other threads, don't try to run any new
@@ -108,7 +182,8 @@ findSpark (Capability *cap)
       // needing any atomic instructions:
       //   spark = reclaimSpark(cap->sparks);
       // However, measurements show that this makes at least one benchmark
-      // slower (prsa) and doesn't affect the others.
+      // slower (prsa) and doesn't affect the others.  It would also
+      // race with other Capabilities calling tryStealSparks() on us.
       spark = tryStealSpark(cap->sparks);
       while (spark != NULL && fizzledSpark(spark)) {
           cap->spark_stats.fizzled++;
@@ -133,30 +208,32 @@ findSpark (Capability *cap)
                  "cap %d: Trying to steal work from other capabilities",
                  cap->no);
 
-      /* visit cap.s 0..n-1 in sequence until a theft succeeds. We could
-      start at a random place instead of 0 as well.  */
+      /* Start with the Capability we last stole from, if it still has
+         sparks: it is likely to have more.  Otherwise start somewhere
+         random, so that idle Capabilities don't all converge on
+         capabilities[0]. */
+      start = cap->spark_victim;
+      if (start >= n_capabilities || start == cap->no
+          || emptySparkPoolCap(capabilities[start])) {
+          start = randomCapability(cap);
+      }
+
       for ( i=0 ; i < n_capabilities ; i++ ) {
-          robbed = capabilities[i];
+          robbed = capabilities[(start + i) % n_capabilities];
           if (cap == robbed)  // ourselves...
               continue;
 
+          if (robbed->pool != cap->pool) // see Note [Capability pools]
+              continue;
+
           if (emptySparkPoolCap(robbed)) // nothing to steal here
               continue;
 
-          spark = tryStealSpark(robbed->sparks);
-          while (spark != NULL && fizzledSpark(spark)) {
-              cap->spark_stats.fizzled++;
-              traceEventSparkFizzle(cap);
-              spark = tryStealSpark(robbed->sparks);
-          }
-          if (spark == NULL && !emptySparkPoolCap(robbed)) {
-              // we conflicted with another thread while trying to steal;
-              // try again later.
-              retry = rtsTrue;
-          }
+          spark = stealSparksFrom(cap, robbed, &retry);
 
           if (spark != NULL) {
               cap->spark_stats.converted++;
+              cap->spark_victim = robbed->no;
               traceEventSparkSteal(cap, robbed->no);
 
               return spark;
@@ -169,17 +246,19 @@ findSpark (Capability *cap)
   return NULL;
 }
 
-// Returns True if any spark pool is non-empty at this moment in time
+// Returns True if any spark pool of a Capability in the same pool as
+// cap is non-empty at this moment in time.
 // The result is only valid for an instant, of course, so in a sense
 // is immediately invalid, and should not be relied upon for
 // correctness.
 rtsBool
-anySparks (void)
+anySparks (Capability *cap)
 {
     nat i;
 
     for (i=0; i < n_capabilities; i++) {
-        if (!emptySparkPoolCap(capabilities[i])) {
+        if (capabilities[i]->pool == cap->pool &&
+            !emptySparkPoolCap(capabilities[i])) {
             return rtsTrue;
         }
     }
@@ -224,6 +303,145 @@ popReturningTask (Capability *cap)
 }
 #endif
 
+/* Note [Capability pools]
+
+   A program that runs several services, or the mutator of a service
+   and its background jobs, wants to keep them from slowing each other
+   down: a burst of work in one shouldn't take the CPUs of another.  So
+   +RTS --cap-pool=<name>:<n> sets aside <n> of the -N Capabilities as
+   a pool; the pools take the last Capabilities, in the order of the
+   flags, and the ones left over form the default pool, numbered 0,
+   which has the main thread.  Then:
+
+     - schedulePushWork() and requestWork() only move threads between
+       Capabilities in the same pool, so the threads that a thread
+       forks with forkIO stay in its pool.  A thread gets into a pool
+       with forkOn (see GHC.Conc.capabilityPool).
+
+     - findSpark() only steals sparks from the same pool, and an idle
+       Capability only starts a spark thread for the sparks of its
+       pool (anySparks()).
+
+     - a pool can have its own context switch interval (C=<secs>) and
+       be bound to a range of CPUs (cpu=<n>), for which see
+       contextSwitchCapPools() and capPoolCpu().
+
+   A pool is not isolated from the others in the GC, which still stops
+   every Capability, nor by forkOn, threads woken up by another pool,
+   or setNumCapabilities(): Capabilities added later are in the
+   default pool, and the threads of a disabled Capability move to a
+   Capability that may be in another pool.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+// The first Capability of each pool (0 for the default pool)
+static nat cap_pool_first[MAX_CAP_POOLS + 1];
+
+// Ticks left before the next context switch in each pool
+static int pool_ticks_to_ctxt_switch[MAX_CAP_POOLS + 1];
+
+static void
+initCapPools (nat n)
+{
+    nat p, named = 0;
+
+    if (RtsFlags.ParFlags.elastic) {
+        // it would disable the Capabilities of the pools first
+        errorBelch("--cap-pool can't be used with --elastic-capabilities");
+        stg_exit(EXIT_FAILURE);
+    }
+
+    for (p = 0; p < RtsFlags.ParFlags.nCapPools; p++) {
+        named += RtsFlags.ParFlags.capPools[p].nCaps;
+    }
+    if (named >= n) {
+        errorBelch("--cap-pool: the pools need %d capabilities and the "
+                   "default pool at least one more, but there are only %d",
+                   named, n);
+        stg_exit(EXIT_FAILURE);
+    }
+
+    cap_pool_first[0] = 0;
+    cap_pool_first[1] = n - named;
+    for (p = 1; p < RtsFlags.ParFlags.nCapPools; p++) {
+        cap_pool_first[p + 1] =
+            cap_pool_first[p] + RtsFlags.ParFlags.capPools[p - 1].nCaps;
+    }
+    for (p = 1; p <= RtsFlags.ParFlags.nCapPools; p++) {
+        debugTrace(DEBUG_sched, "capability pool %d (%s): capabilities %d-%d",
+                   p, RtsFlags.ParFlags.capPools[p - 1].name, cap_pool_first[p],
+                   cap_pool_first[p] + RtsFlags.ParFlags.capPools[p - 1].nCaps - 1);
+    }
+}
+
+static nat
+capPoolOf (nat i)
+{
+    nat p;
+
+    for (p = 1; p <= RtsFlags.ParFlags.nCapPools; p++) {
+        if (i >= cap_pool_first[p] &&
+            i < cap_pool_first[p] + RtsFlags.ParFlags.capPools[p - 1].nCaps) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+// The CPU that the worker threads of cap should run on, or -1 if its
+// pool isn't bound to any (cpu=<n>)
+int
+capPoolCpu (Capability *cap)
+{
+    CAP_POOL_FLAGS *pool;
+
+    if (cap->pool == 0) return -1;
+    pool = &RtsFlags.ParFlags.capPools[cap->pool - 1];
+    if (pool->cpu < 0) return -1;
+    return (pool->cpu + cap->no - cap_pool_first[cap->pool])
+        % getNumberOfProcessors();
+}
+
+// Called on each tick of the timer instead of
+// contextSwitchAllCapabilities() when there are pools, each of which
+// may have its own context switch interval.
+void
+contextSwitchCapPools (void)
+{
+    rtsBool due[MAX_CAP_POOLS + 1];
+    nat p, i;
+    int ticks;
+
+    for (p = 0; p <= RtsFlags.ParFlags.nCapPools; p++) {
+        due[p] = rtsFalse;
+        ticks = p == 0 ? RtsFlags.ConcFlags.ctxtSwitchTicks
+                       : RtsFlags.ParFlags.capPools[p - 1].ctxtSwitchTicks;
+        if (ticks > 0 && --pool_ticks_to_ctxt_switch[p] <= 0) {
+            pool_ticks_to_ctxt_switch[p] = ticks;
+            due[p] = rtsTrue;
+        }
+    }
+    for (i = 0; i < n_capabilities; i++) {
+        if (due[capabilities[i]->pool]) {
+            contextSwitchCapability(capabilities[i]);
+        }
+    }
+}
+
+HsInt
+rts_getCapabilityPool (HsInt cap)
+{
+    if (cap < 0 || cap >= (HsInt)n_capabilities) return -1;
+    return capabilities[cap]->pool;
+}
+#else
+HsInt
+rts_getCapabilityPool (HsInt cap)
+{
+    return cap == 0 ? 0 : -1;
+}
+#endif
+
 /* ----------------------------------------------------------------------------
  * Initialisation
  *
@@ -233,15 +451,28 @@ popReturningTask (Capability *cap)
 static void
 initCapability( Capability *cap, nat i )
 {
-    nat g;
+    nat g, k;
 
     cap->no = i;
+    cap->node = capNoToNumaNode(i);
     cap->in_haskell        = rtsFalse;
     cap->idle              = 0;
     cap->disabled          = rtsFalse;
+    cap->hungry            = rtsFalse;
+#ifdef TRACING
+    memset(cap->trace_sample_count, 0, sizeof(cap->trace_sample_count));
+    cap->trace_run_sampled = rtsTrue;
+#endif
+#if defined(THREADED_RTS)
+    cap->pool              = capPoolOf(i);
+#else
+    cap->pool              = 0;
+#endif
 
     cap->run_queue_hd      = END_TSO_QUEUE;
     cap->run_queue_tl      = END_TSO_QUEUE;
+    cap->n_run_queue       = 0;
+    cap->async_calls       = NULL;
 
 #if defined(THREADED_RTS)
     initMutex(&cap->lock);
@@ -253,14 +484,23 @@ initCapability( Capability *cap, nat i )
     cap->returning_tasks_tl = NULL;
     cap->inbox              = (Message*)END_TSO_QUEUE;
     cap->sparks             = allocSparkPool();
+    cap->spark_victim       = i;
+    cap->spark_seed         = 2463534242U + i; // any non-zero value
     cap->spark_stats.created    = 0;
     cap->spark_stats.dud        = 0;
     cap->spark_stats.overflowed = 0;
     cap->spark_stats.converted  = 0;
     cap->spark_stats.gcd        = 0;
     cap->spark_stats.fizzled    = 0;
+    cap->spark_stats.throttled  = 0;
+    cap->resumes                = 0;
+    cap->fast_resumes           = 0;
+    cap->bound_handoffs         = 0;
+    cap->spun_handoffs          = 0;
+    cap->handoff_latency        = 0;
 #if !defined(mingw32_HOST_OS)
     cap->io_manager_control_wr_fd = -1;
+    cap->timer_manager_control_wr_fd = -1;
 #endif
 #endif
     cap->total_allocated        = 0;
@@ -278,6 +518,7 @@ initCapability( Capability *cap, nat i )
 
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         cap->mut_lists[g] = NULL;
+        cap->saved_mut_lists[g] = NULL;
     }
 
     cap->weak_ptr_list_hd = NULL;
@@ -285,11 +526,46 @@ initCapability( Capability *cap, nat i )
     cap->free_tvar_watch_queues = END_STM_WATCH_QUEUE;
     cap->free_invariant_check_queues = END_INVARIANT_CHECK_QUEUE;
     cap->free_trec_chunks = END_STM_CHUNK_LIST;
+    cap->n_free_trec_chunks = 0;
     cap->free_trec_headers = NO_TREC;
     cap->transaction_tokens = 0;
+    cap->stm_commits = 0;
+    cap->stm_aborts = 0;
+    cap->bh_blocked = 0;
+    cap->bh_forwarded = 0;
+    cap->bh_remote_wakeups = 0;
+    cap->bh_wakeup_batches = 0;
     cap->context_switch = 0;
-    cap->pinned_object_block = NULL;
+    cap->sample_stack = 0;
+    if (RtsFlags.TraceFlags.alloc_sample_bytes > 0) {
+        cap->alloc_sample_next =
+            RtsFlags.TraceFlags.alloc_sample_bytes / sizeof(W_);
+    } else {
+        cap->alloc_sample_next = (W_)-1;
+    }
+    cap->pretenure_gen = 0;
+    cap->block_cache = NULL;
+    cap->n_cached_blocks = 0;
+    cap->spt_free = SPT_END;
+    cap->n_spt_free = 0;
+    for (k = 0; k < N_PINNED_CLASSES; k++) {
+        cap->pinned_object_block[k] = NULL;
+    }
     cap->pinned_object_blocks = NULL;
+    cap->n_free_stacks = 0;
+    cap->stack_chunks = 0;
+    cap->stack_chunk_hits = 0;
+    cap->pauses = 0;
+    cap->pause_frames = 0;
+    cap->pause_words_squeezed = 0;
+    cap->pause_splits = 0;
+    cap->stack_gc_splits = 0;
+    cap->n_free_thread_stacks = 0;
+    cap->finished_stack = NULL;
+    cap->threads_created = 0;
+    cap->thread_stack_hits = 0;
+    cap->new_threads_hd = END_TSO_QUEUE;
+    cap->new_threads_tl = END_TSO_QUEUE;
 
 #ifdef PROFILING
     cap->r.rCCCS = CCS_SYSTEM;
@@ -325,8 +601,36 @@ initCapabilities( void )
     traceCapsetCreate(CAPSET_OSPROCESS_DEFAULT, CapsetTypeOsProcess);
     traceCapsetCreate(CAPSET_CLOCKDOMAIN_DEFAULT, CapsetTypeClockdomain);
 
+    // Initialise NUMA
+    if (!RtsFlags.GcFlags.numa) {
+        n_numa_nodes = 1;
+        numa_map[0] = 0;
+    } else {
+        nat nNodes = osNumaNodes();
+        nat logical = 0, physical;
+        StgWord mask;
+        if (nNodes > MAX_NUMA_NODES) {
+            barf("Too many NUMA nodes (max %d)", MAX_NUMA_NODES);
+        }
+        mask = RtsFlags.GcFlags.numaMask & osNumaMask();
+        for (physical = 0; physical < nNodes; physical++) {
+            if (mask & ((StgWord)1 << physical)) {
+                numa_map[logical++] = physical;
+            }
+        }
+        if (logical == 0) {
+            barf("available NUMA node set is empty");
+        }
+        n_numa_nodes = logical;
+        debugTrace(DEBUG_sched, "using %d NUMA nodes", n_numa_nodes);
+    }
+
 #if defined(THREADED_RTS)
 
+    if (RtsFlags.ParFlags.setAffinity) {
+        initCpuTopology(RtsFlags.ParFlags.affinityPolicy);
+    }
+
 #ifndef REG_Base
     // We can't support multiple CPUs if BaseReg is not a register
     if (RtsFlags.ParFlags.nNodes > 1) {
@@ -335,6 +639,10 @@ initCapabilities( void )
     }
 #endif
 
+    if (RtsFlags.ParFlags.nCapPools > 0) {
+        initCapPools(RtsFlags.ParFlags.nNodes);
+    }
+
     n_capabilities = 0;
     moreCapabilities(0, RtsFlags.ParFlags.nNodes);
     n_capabilities = RtsFlags.ParFlags.nNodes;
@@ -378,8 +686,8 @@ moreCapabilities (nat from USED_IF_THREADS, nat to USED_IF_THREADS)
             if (i < from) {
                 capabilities[i] = old_capabilities[i];
             } else {
-                capabilities[i] = stgMallocBytes(sizeof(Capability),
-                                                 "moreCapabilities");
+                capabilities[i] = stgMallocAlignedBytes(sizeof(Capability),
+                                                        64, "moreCapabilities");
                 initCapability(capabilities[i], i);
             }
         }
@@ -414,6 +722,15 @@ void interruptAllCapabilities(void)
     }
 }
 
+void sampleAllCapabilities(void)
+{
+    nat i;
+    for (i=0; i < n_capabilities; i++) {
+        capabilities[i]->sample_stack = 1;
+        interruptCapability(capabilities[i]);
+    }
+}
+
 /* ----------------------------------------------------------------------------
  * Give a Capability to a Task.  The task must currently be sleeping
  * on its condition variable.
@@ -428,6 +745,31 @@ void interruptAllCapabilities(void)
  *
  * ------------------------------------------------------------------------- */
 
+/* Note [bound thread handoff]
+
+   A bound thread can only run in its own Task, so when it is at the
+   head of the run queue the Task that has the Capability must give it
+   to the bound Task (releaseCapability_()) and go to sleep.  A program
+   in which a bound thread and an unbound one take turns, for instance
+   through an MVar, does this twice for every turn, and if both OS
+   threads sleep each time, every turn costs two wakeups by the OS.
+
+   So a Task that gives up its Capability from yieldCapability(), and
+   is likely to be given it back soon, checks task->wakeup up to
+   RtsFlags.ParFlags.handoffSpin times (+RTS --handoff-spin) before it
+   sleeps on task->cond.  That is a bound Task, or a worker that has
+   just passed the Capability to a bound Task.  signalCondition()
+   doesn't need to call into the OS when nobody waits on the
+   condition, so when that Task is caught spinning, the handoff is
+   just the exchange of task->lock.  Only the Task that the Capability
+   is given to is woken; the spare workers stay asleep, as before.
+
+   Each handoff to a bound Task records the time in task->handoff_time,
+   and the bound Task adds the time it took to take the Capability to
+   cap->handoff_latency, which +RTS -s reports along with the number of
+   handoffs and how many of them were caught spinning.
+*/
+
 #if defined(THREADED_RTS)
 STATIC_INLINE void
 giveCapabilityToTask (Capability *cap USED_IF_DEBUG, Task *task)
@@ -440,12 +782,19 @@ giveCapabilityToTask (Capability *cap USED_IF_DEBUG, Task *task)
     ACQUIRE_LOCK(&task->lock);
     if (task->wakeup == rtsFalse) {
         task->wakeup = rtsTrue;
+        if (task->incall->tso != NULL) {
+            task->handoff_time = getProcessElapsedTime();
+        }
         // the wakeup flag is needed because signalCondition() doesn't
         // flag the condition if the thread is already runniing, but we want
         // it to be sticky.
-        signalCondition(&task->cond);
+        //
+        // The Task is woken only once task->lock is free, because the
+        // first thing it does is take it.
+        unlockAndSignalCondition(&task->cond, &task->lock);
+    } else {
+        RELEASE_LOCK(&task->lock);
     }
-    RELEASE_LOCK(&task->lock);
 }
 #endif
 
@@ -468,11 +817,15 @@ releaseCapability_ (Capability* cap,
 
     ASSERT_PARTIAL_CAPABILITY_INVARIANTS(cap,task);
 
-    cap->running_task = NULL;
+    // NB. we only set running_task to NULL once we have decided not to
+    // hand the Capability directly to a new worker, because
+    // resumeThread() may claim it without taking cap->lock as soon as
+    // it is NULL.  See Note [fast resume] in Schedule.c.
 
     // Check to see whether a worker thread can be given
     // the go-ahead to return the result of an external call..
     if (cap->returning_tasks_hd != NULL) {
+        setCapabilityFree(cap);
         giveCapabilityToTask(cap,cap->returning_tasks_hd);
         // The Task pops itself from the queue (see waitForReturnCapability())
         return;
@@ -482,6 +835,7 @@ releaseCapability_ (Capability* cap,
     // Capability free.  The thread trying to sync will be about to
     // call waitForReturnCapability().
     if (pending_sync != 0 && pending_sync != SYNC_GC_PAR) {
+      setCapabilityFree(cap);
       last_free_capability = cap; // needed?
       debugTrace(DEBUG_sched, "sync pending, set capability %d free", cap->no);
       return;
@@ -496,6 +850,7 @@ releaseCapability_ (Capability* cap,
         // ThreadBlocked, but the thread may be back on the run queue
         // by now.
         task = peekRunQueue(cap)->bound->task;
+        setCapabilityFree(cap);
         giveCapabilityToTask(cap, task);
         return;
     }
@@ -508,7 +863,7 @@ releaseCapability_ (Capability* cap,
         if (sched_state < SCHED_SHUTTING_DOWN || !emptyRunQueue(cap)) {
             debugTrace(DEBUG_sched,
                        "starting new worker on capability %d", cap->no);
-            startWorkerTask(cap);
+            startWorkerTask(cap); // takes over cap->running_task
             return;
         }
     }
@@ -517,8 +872,10 @@ releaseCapability_ (Capability* cap,
     // anything else to do, give the Capability to a worker thread.
     if (always_wakeup ||
         !emptyRunQueue(cap) || !emptyInbox(cap) ||
+        cap->async_calls != NULL ||
         (!cap->disabled && !emptySparkPoolCap(cap)) || globalWorkToDo()) {
         if (cap->spare_workers) {
+            setCapabilityFree(cap);
             giveCapabilityToTask(cap, cap->spare_workers);
             // The worker Task pops itself from the queue;
             return;
@@ -528,6 +885,7 @@ releaseCapability_ (Capability* cap,
 #ifdef PROFILING
     cap->r.rCCCS = CCS_IDLE;
 #endif
+    setCapabilityFree(cap);
     last_free_capability = cap;
     debugTrace(DEBUG_sched, "freeing capability %d", cap->no);
 }
@@ -568,7 +926,7 @@ releaseCapabilityAndQueueWorker (Capability* cap USED_IF_THREADS)
     // Schedule.c:workerStart()).
     if (!isBoundTask(task))
     {
-        if (cap->n_spare_workers < MAX_SPARE_WORKERS)
+        if (cap->n_spare_workers < RtsFlags.ParFlags.maxSpareWorkers)
         {
             task->next = cap->spare_workers;
             cap->spare_workers = task;
@@ -645,9 +1003,8 @@ waitForReturnCapability (Capability **pCap, Task *task)
 
     debugTrace(DEBUG_sched, "returning; I want capability %d", cap->no);
 
-    if (!cap->running_task) {
-        // It's free; just grab it
-        cap->running_task = task;
+    if (claimCapability(cap, task)) {
+        // It was free; we have grabbed it
         RELEASE_LOCK(&cap->lock);
     } else {
         newReturningTask(cap,task);
@@ -669,7 +1026,12 @@ waitForReturnCapability (Capability **pCap, Task *task)
                     RELEASE_LOCK(&cap->lock);
                     continue;
                 }
-                cap->running_task = task;
+                if (!claimCapability(cap, task)) {
+                    // resumeThread() got in first; we stay at the
+                    // front of the queue
+                    RELEASE_LOCK(&cap->lock);
+                    continue;
+                }
                 popReturningTask(cap);
                 RELEASE_LOCK(&cap->lock);
                 break;
@@ -692,6 +1054,122 @@ waitForReturnCapability (Capability **pCap, Task *task)
 }
 
 #if defined(THREADED_RTS)
+/* ----------------------------------------------------------------------------
+ * requestWork
+ *
+ * With +RTS -qs, a Capability that runs out of threads asks for more
+ * rather than waiting for a busy Capability to notice that it is free.
+ * Threads are still only moved by the Capability that owns them, in
+ * schedulePushWork(), because only the owner may touch its run queue;
+ * what the idle Capability does is to get the owner there promptly:
+ *
+ *   - it is marked hungry (by yieldCapability()), so that a
+ *     Capability that creates a thread goes back to the scheduler to
+ *     share it (see scheduleThread()).
+ *
+ *   - it interrupts the next Capability that has threads to spare,
+ *     which will find us free when it calls schedulePushWork().
+ *
+ * Bound threads and threads created by forkOn stay where they are, as
+ * schedulePushWork() never moves them.
+ *
+ * Called after cap has been released, so that the busy Capability can
+ * grab it.
+ * ------------------------------------------------------------------------- */
+
+static void
+requestWork (Capability *cap)
+{
+    nat i;
+    Capability *victim;
+
+    if (!RtsFlags.ParFlags.migrate) return;
+
+    for (i = 1; i < n_capabilities; i++) {
+        victim = capabilities[(cap->no + i) % n_capabilities];
+        if (victim->pool != cap->pool) continue;
+        // This peeks at another Capability's run queue without any
+        // locking, but it's only a hint.
+        if (!victim->disabled
+            && victim->run_queue_hd != END_TSO_QUEUE
+            && victim->run_queue_hd->_link != END_TSO_QUEUE) {
+            debugTrace(DEBUG_sched, "cap %d: asking cap %d for work",
+                       cap->no, victim->no);
+            contextSwitchCapability(victim);
+            return;
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * retireSpareWorker
+ *
+ * Called by a spare worker that has been idle for
+ * RtsFlags.ParFlags.workerIdleTimeout.  Unless it is the last spare
+ * worker on its Capability, or it has been woken up in the meantime, it
+ * takes itself off the spare_workers list and exits, which shows up as a
+ * TaskDelete event in the eventlog.  So after a burst of safe foreign
+ * calls, up to maxSpareWorkers threads are kept for the next burst, but
+ * not for ever.
+ * ------------------------------------------------------------------------- */
+
+static void
+retireSpareWorker (Task *task)
+{
+    Capability *cap = task->cap;
+    Task *t, **prev;
+
+    ACQUIRE_LOCK(&cap->lock);
+
+    // giveCapabilityToTask() sets task->wakeup with cap->lock held, so
+    // this can't change under our feet.
+    if (task->wakeup || cap->n_spare_workers <= 1) {
+        RELEASE_LOCK(&cap->lock);
+        return;
+    }
+
+    for (prev = &cap->spare_workers, t = cap->spare_workers; t != NULL;
+         prev = &t->next, t = t->next) {
+        if (t == task) {
+            *prev = task->next;
+            task->next = NULL;
+            cap->n_spare_workers--;
+
+            debugTrace(DEBUG_sched,
+                       "worker idle for too long on capability %d, exiting "
+                       "(%d spare workers left)", cap->no, cap->n_spare_workers);
+            // hold the lock until after workerTaskStop; c.f. scheduleWorker()
+            workerTaskStop(task);
+            RELEASE_LOCK(&cap->lock);
+            shutdownThread();
+        }
+    }
+
+    RELEASE_LOCK(&cap->lock);
+}
+
+/* ----------------------------------------------------------------------------
+ * spinForWakeup
+ *
+ * Look for task->wakeup for a while before sleeping on task->cond; see
+ * Note [bound thread handoff].  Reads the flag without task->lock, so
+ * the caller must still take the lock and check it again.
+ * ------------------------------------------------------------------------- */
+
+static rtsBool
+spinForWakeup (Task *task)
+{
+    nat i;
+
+    for (i = 0; i < RtsFlags.ParFlags.handoffSpin; i++) {
+        if (*(volatile rtsBool *)&task->wakeup) {
+            return rtsTrue;
+        }
+        busy_wait_nop();
+    }
+    return rtsFalse;
+}
+
 /* ----------------------------------------------------------------------------
  * yieldCapability
  * ------------------------------------------------------------------------- */
@@ -702,6 +1180,7 @@ rtsBool /* Did we GC? */
 yieldCapability (Capability** pCap, Task *task, rtsBool gcAllowed)
 {
     Capability *cap = *pCap;
+    rtsBool hungry, spin, spun = rtsFalse;
 
     if ((pending_sync == SYNC_GC_PAR) && gcAllowed) {
         traceEventGcStart(cap);
@@ -719,12 +1198,41 @@ yieldCapability (Capability** pCap, Task *task, rtsBool gcAllowed)
         // We must now release the capability and wait to be woken up
         // again.
         task->wakeup = rtsFalse;
+        task->handoff_time = 0;
+        hungry = RtsFlags.ParFlags.stealThreads && emptyRunQueue(cap);
+        if (hungry && !cap->hungry) {
+            cap->hungry = rtsTrue;
+            atomic_inc(&n_hungry_capabilities, 1);
+        }
+        // We still own cap, so we can look at its run queue.
+        spin = isBoundTask(task) ||
+               (!emptyRunQueue(cap) && peekRunQueue(cap)->bound);
         releaseCapabilityAndQueueWorker(cap);
+        if (hungry) {
+            requestWork(cap);
+        }
+
+        if (spin) {
+            spun = spinForWakeup(task);
+        }
 
         for (;;) {
             ACQUIRE_LOCK(&task->lock);
             // task->lock held, cap->lock not held
-            if (!task->wakeup) waitCondition(&task->cond, &task->lock);
+            if (!task->wakeup) {
+                if (task->incall->tso == NULL
+                    && RtsFlags.ParFlags.workerIdleTimeout > 0) {
+                    if (!timedWaitCondition(&task->cond, &task->lock,
+                                    RtsFlags.ParFlags.workerIdleTimeout)
+                        && !task->wakeup) {
+                        RELEASE_LOCK(&task->lock);
+                        retireSpareWorker(task); // returns if we're needed
+                        continue;
+                    }
+                } else {
+                    waitCondition(&task->cond, &task->lock);
+                }
+            }
             cap = task->cap;
             task->wakeup = rtsFalse;
             RELEASE_LOCK(&task->lock);
@@ -756,12 +1264,30 @@ yieldCapability (Capability** pCap, Task *task, rtsBool gcAllowed)
                     RELEASE_LOCK(&cap->lock);
                     continue;
                 }
+                if (!claimCapability(cap, task)) {
+                    // resumeThread() got in first
+                    RELEASE_LOCK(&cap->lock);
+                    continue;
+                }
                 cap->spare_workers = task->next;
                 task->next = NULL;
                 cap->n_spare_workers--;
+            } else if (!claimCapability(cap, task)) {
+                RELEASE_LOCK(&cap->lock);
+                continue;
+            } else if (task->handoff_time != 0) {
+                // we own cap now, so we can update its counters
+                Time latency = getProcessElapsedTime() - task->handoff_time;
+                task->handoff_time = 0;
+                cap->bound_handoffs++;
+                if (spun) cap->spun_handoffs++;
+                cap->handoff_latency += latency;
+                debugTrace(DEBUG_sched, "bound task took capability %d "
+                           "after %" FMT_Word64 "ns%s", cap->no,
+                           (StgWord64)TimeToNS(latency),
+                           spun ? " (spinning)" : "");
             }
 
-            cap->running_task = task;
             RELEASE_LOCK(&cap->lock);
             break;
         }
@@ -819,13 +1345,38 @@ void
 prodCapability (Capability *cap, Task *task)
 {
     ACQUIRE_LOCK(&cap->lock);
-    if (!cap->running_task) {
-        cap->running_task = task;
+    if (claimCapability(cap, task)) {
         releaseCapability_(cap,rtsTrue);
     }
     RELEASE_LOCK(&cap->lock);
 }
 
+/* ----------------------------------------------------------------------------
+ * wakeupCapability
+ *
+ * Like prodCapability(), but callable from an OS thread that isn't
+ * running Haskell code and may not have a Task yet: it gets one just to
+ * claim the Capability with (see getMyTask()).  If the Capability is
+ * busy, we stop its current thread instead, so that the scheduler
+ * looks for new work soon.
+ * ------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+void
+wakeupCapability (Capability *cap)
+{
+    Task *task = getMyTask();
+
+    ACQUIRE_LOCK(&cap->lock);
+    if (claimCapability(cap, task)) {
+        releaseCapability_(cap,rtsFalse);
+    } else {
+        interruptCapability(cap);
+    }
+    RELEASE_LOCK(&cap->lock);
+}
+#endif
+
 /* ----------------------------------------------------------------------------
  * tryGrabCapability
  *
@@ -838,12 +1389,11 @@ tryGrabCapability (Capability *cap, Task *task)
 {
     if (cap->running_task != NULL) return rtsFalse;
     ACQUIRE_LOCK(&cap->lock);
-    if (cap->running_task != NULL) {
+    if (!claimCapability(cap, task)) {
         RELEASE_LOCK(&cap->lock);
         return rtsFalse;
     }
     task->cap = cap;
-    cap->running_task = task;
     RELEASE_LOCK(&cap->lock);
     return rtsTrue;
 }
@@ -888,13 +1438,12 @@ shutdownCapability (Capability *cap USED_IF_THREADS,
         debugTrace(DEBUG_sched,
                    "shutting down capability %d, attempt %d", cap->no, i);
         ACQUIRE_LOCK(&cap->lock);
-        if (cap->running_task) {
+        if (!claimCapability(cap, task)) {
             RELEASE_LOCK(&cap->lock);
             debugTrace(DEBUG_sched, "not owner, yielding");
             yieldThread();
             continue;
         }
-        cap->running_task = task;
 
         if (cap->spare_workers) {
             // Look for workers that have died without removing
@@ -982,6 +1531,13 @@ shutdownCapabilities(Task *task, rtsBool safe)
 static void
 freeCapability (Capability *cap)
 {
+    AsyncCall *a, *next;
+
+    // calls that came in too late to be run
+    for (a = cap->async_calls; a != NULL; a = next) {
+        next = a->link;
+        stgFree(a);
+    }
     stgFree(cap->mut_lists);
     stgFree(cap->saved_mut_lists);
 #if defined(THREADED_RTS)
@@ -1000,7 +1556,7 @@ freeCapabilities (void)
     for (i=0; i < n_capabilities; i++) {
         freeCapability(capabilities[i]);
         if (capabilities[i] != &MainCapability)
-            stgFree(capabilities[i]);
+            stgFreeAligned(capabilities[i]);
     }
 #else
     freeCapability(&MainCapability);
@@ -1043,8 +1599,17 @@ markCapability (evac_fn evac, void *user, Capability *cap,
     }
 #endif
 
-    // Free STM structures for this Capability
+    // Free STM structures for this Capability, except the TRecs and
+    // their chunks (see Note [Keeping the free TRecs] in STM.c)
     stmPreGCHook(cap);
+    evac(user, (StgClosure **)(void *)&cap->free_trec_chunks);
+    evac(user, (StgClosure **)(void *)&cap->free_trec_headers);
+
+    // and the free stacks, which nothing else refers to.  The finished
+    // threads keep finished_stack alive themselves if they need it.
+    cap->n_free_stacks = 0;
+    cap->n_free_thread_stacks = 0;
+    cap->finished_stack = NULL;
 }
 
 void
@@ -1059,7 +1624,7 @@ markCapabilities (evac_fn evac, void *user)
 #if defined(THREADED_RTS)
 rtsBool checkSparkCountInvariant (void)
 {
-    SparkCounters sparks = { 0, 0, 0, 0, 0, 0 };
+    SparkCounters sparks = { 0, 0, 0, 0, 0, 0, 0 };
     StgWord64 remaining = 0;
     nat i;
 
@@ -24,9 +24,37 @@
 #include "sm/GC.h" // for evac_fn
 #include "Task.h"
 #include "Sparks.h"
+#include "rts/EventLogFormat.h"
 
 #include "BeginPrivate.h"
 
+// Number of size classes of small pinned objects (see allocatePinned())
+#define N_PINNED_CLASSES 3
+
+// Number of free stack chunks a Capability keeps (see "Free stack
+// chunks" in Threads.c)
+#define N_FREE_STACKS 4
+
+// Number of stacks of finished threads a Capability keeps (see
+// "Recycling thread stacks" in Threads.c)
+#define N_FREE_THREAD_STACKS 16
+
+// A call queued with rts_evalAsync() or rts_evalAsyncPtr(), waiting
+// for its Capability to start a thread for it.
+typedef struct AsyncCall_ {
+    StgStablePtr       fn;     // IO (), or Ptr a -> IO () if has_arg
+    void              *arg;
+    rtsBool            has_arg;
+    struct AsyncCall_ *link;
+} AsyncCall;
+
+// Starts a new cache line within a Capability, see below
+#ifndef mingw32_HOST_OS
+#define CAP_CACHE_LINE ATTRIBUTE_ALIGNED(64)
+#else
+#define CAP_CACHE_LINE /*nothing*/
+#endif
+
 struct Capability_ {
     // State required by the STG virtual machine when running Haskell
     // code.  During STG execution, the BaseReg register always points
@@ -34,22 +62,42 @@ struct Capability_ {
     StgFunTable f;
     StgRegTable r;
 
-    nat no;  // capability number.
+    // Read by other Capabilities, and seldom written: a cache line of
+    // their own keeps them away from the end of r, which is written
+    // all the time.
+    nat no CAP_CACHE_LINE;  // capability number.
 
-    // The Task currently holding this Capability.  This task has
-    // exclusive access to the contents of this Capability (apart from
-    // returning_tasks_hd/returning_tasks_tl).
-    // Locks required: cap->lock.
-    Task *running_task;
+    // The NUMA node on which this capability resides.  This is used to
+    // allocate node-local memory in allocate().
+    //
+    // Note: this is always equal to cap->no % n_numa_nodes.
+    // The reason we slice it this way is that if we add or remove
+    // capabilities via setNumCapabilities(), then we keep the number of
+    // capabilities on each NUMA node balanced.
+    nat node;
+
+    rtsBool disabled;
+
+    // The pool this Capability is in (+RTS --cap-pool), numbered from 1
+    // in the order of the flags, or 0 for the default pool.  See Note
+    // [Capability pools] in Capability.c.
+    nat pool;
+
+#if defined(THREADED_RTS)
+    // Stolen from by other Capabilities, see findSpark()
+    SparkPool *sparks;
+#endif
 
     // true if this Capability is running Haskell code, used for
     // catching unsafe call-ins.
-    rtsBool in_haskell;
+    rtsBool in_haskell CAP_CACHE_LINE;
 
     // Has there been any activity on this Capability since the last GC?
     nat idle;
 
-    rtsBool disabled;
+    // This Capability has run out of threads and is waiting for another
+    // one to give it some (+RTS -qs).  See requestWork().
+    rtsBool hungry;
 
     // The run queue.  The Task owning this Capability has exclusive
     // access to its run queue, so can wake up threads without
@@ -57,6 +105,7 @@ struct Capability_ {
     // also lock-free.
     StgTSO *run_queue_hd;
     StgTSO *run_queue_tl;
+    nat n_run_queue;
 
     // Tasks currently making safe foreign calls.  Doubly-linked.
     // When returning, a task first acquires the Capability before
@@ -74,19 +123,153 @@ struct Capability_ {
     bdescr **mut_lists;
     bdescr **saved_mut_lists; // tmp use during GC
 
-    // block for allocating pinned objects into
-    bdescr *pinned_object_block;
+    // Free single blocks owned by this Capability, so that allocate(),
+    // allocatePinned() and the GC can get a block without taking
+    // sm_mutex.  See "Per-Capability block cache" in BlockAlloc.c.
+    bdescr *block_cache;
+    nat n_cached_blocks;
+
+    // Free stable pointer table entries owned by this Capability, so
+    // that getStablePtr() and freeStablePtr() don't need stable_mutex.
+    // See "Per-Capability free lists" in Stable.c.
+    StgWord spt_free;
+    nat n_spt_free;
+
+    // blocks for allocating pinned objects into, one per size class
+    // (see allocatePinned())
+    bdescr *pinned_object_block[N_PINNED_CLASSES];
     // full pinned object blocks allocated since the last GC
     bdescr *pinned_object_blocks;
 
+    // free stack chunks of the default size (+RTS -kc), reused by
+    // threadStackOverflow().  See "Free stack chunks" in Threads.c.
+    StgStack *free_stacks[N_FREE_STACKS];
+    nat n_free_stacks;
+    // stack chunks allocated by threadStackOverflow(), in total and
+    // from free_stacks
+    StgWord stack_chunks;
+    StgWord stack_chunk_hits;
+
+    // threadPaused(): the number of calls, the stack frames they
+    // scanned, the words squeezed out of the stack, and the times the
+    // stack was split to bound the next scan (+RTS -ks)
+    StgWord pauses;
+    StgWord pause_frames;
+    StgWord pause_words_squeezed;
+    StgWord pause_splits;
+    // stacks split by threadStackSplitClean() before the thread ran,
+    // because the last GC found them clean (+RTS -kg)
+    StgWord stack_gc_splits;
+
+    // stacks of finished threads, reused by createThread(), and the
+    // empty stack that those threads are left with.  See "Recycling
+    // thread stacks" in Threads.c.
+    StgStack *free_thread_stacks[N_FREE_THREAD_STACKS];
+    nat n_free_thread_stacks;
+    StgStack *finished_stack;
+    // threads created by createThread(), and how many got a stack from
+    // free_thread_stacks
+    StgWord threads_created;
+    StgWord thread_stack_hits;
+
+    // threads created on this Capability since the last GC, which
+    // moves them to g0->threads (see collectFreshThreads())
+    StgTSO *new_threads_hd;
+    StgTSO *new_threads_tl;
+
     // per-capability weak pointer list associated with nursery (older
     // lists stored in generation object)
     StgWeak *weak_ptr_list_hd;
     StgWeak *weak_ptr_list_tl;
 
+    // Total words allocated by this cap since rts start
+    // See [Note allocation accounting] in Storage.c
+    W_ total_allocated;
+
+    // When total_allocated reaches this, the next heap check that
+    // takes a new nursery block logs an allocation sample (see
+    // traceAllocSample()).  All ones when --alloc-sample is off.
+    W_ alloc_sample_next;
+
+    // The destination generation of the nursery blocks we hand out:
+    // the pretenure_gen of the thread we're running (see Note
+    // [Pretenuring] in sm/Storage.c)
+    StgWord16 pretenure_gen;
+
+#if defined(THREADED_RTS)
+    // The Capability we last stole sparks from, which findSpark() tries
+    // first, and the state of the xorshift generator it uses to pick
+    // where to start otherwise.
+    nat spark_victim;
+    StgWord32 spark_seed;
+
+    // Stats on spark creation/conversion
+    SparkCounters spark_stats;
+
+    // Returns from safe foreign calls, in total and by the fast path
+    // (see Note [fast resume] in Schedule.c)
+    StgWord resumes;
+    StgWord fast_resumes;
+
+    // Bound threads whose Task was given this Capability to run them,
+    // how many of those Tasks caught it before going to sleep, and the
+    // total time from the handoff to the Task taking the Capability
+    // (see Note [bound thread handoff] in Capability.c)
+    StgWord bound_handoffs;
+    StgWord spun_handoffs;
+    Time    handoff_latency;
+#if !defined(mingw32_HOST_OS)
+    // IO and timer managers for this cap
+    int io_manager_control_wr_fd;
+    int timer_manager_control_wr_fd;
+#endif
+#endif
+
+    // Per-capability STM-related data
+    StgTVarWatchQueue *free_tvar_watch_queues;
+    StgInvariantCheckQueue *free_invariant_check_queues;
+    StgTRecChunk *free_trec_chunks;
+    nat n_free_trec_chunks;
+    StgTRecHeader *free_trec_headers;
+    nat transaction_tokens;
+
+    // STM statistics, for +RTS -s
+    W_ stm_commits;
+    W_ stm_aborts;
+
+    // black hole statistics, for +RTS -s: threads blocked on a black
+    // hole owned by a thread on this Capability, MSG_BLACKHOLEs
+    // forwarded to the owner's Capability, and threads on other
+    // Capabilities woken by wakeBlockingQueue(), with the number of
+    // sendMessages() that took them.
+    W_ bh_blocked;
+    W_ bh_forwarded;
+    W_ bh_remote_wakeups;
+    W_ bh_wakeup_batches;
+
+#ifdef TRACING
+    // The events of each kind to skip before logging the next one
+    // (+RTS --eventlog-sample), and whether the run event of the thread
+    // we're running was logged, so that its stop event goes with it.
+    StgWord32 trace_sample_count[NUM_GHC_EVENT_TAGS];
+    rtsBool trace_run_sampled;
+#endif
+
+    // ---------------------------------------------------------------
+    // The fields from here on are written by other Capabilities, or by
+    // the timer.  Each group has a cache line of its own, so that those
+    // writes don't take the lines of the fields above, which the owner
+    // writes all the time, away from its CPU (false sharing).  This
+    // doesn't include r: stopCapability() sets r.rHpLim, but only along
+    // with context_switch or interrupt, which the owner will read next
+    // anyway.
+
+    // Read by the owner at every heap check failure (see
+    // HeapStackCheck.cmm).
+    //
     // Context switch flag.  When non-zero, this means: stop running
     // Haskell code, and switch threads.
-    int context_switch;
+    int context_switch CAP_CACHE_LINE;
 
     // Interrupt flag.  Like the context_switch flag, this also
     // indicates that we should stop running Haskell code, but we do
@@ -98,9 +281,21 @@ struct Capability_ {
     // reset after we have executed the context switch.
     int interrupt;
 
-    // Total words allocated by this cap since rts start
-    // See [Note allocation accounting] in Storage.c
-    W_ total_allocated;
+    // Set by the timer to ask for a sample of the stack of the thread
+    // we're running when it next returns to the scheduler (see
+    // traceStackSample()).  Reset along with interrupt.
+    int sample_stack;
+
+    // Written by the Tasks that return to this Capability or come to
+    // it with an in-call, and by the Task that hands it over.
+    //
+    // The Task currently holding this Capability.  This task has
+    // exclusive access to the contents of this Capability (apart from
+    // returning_tasks_hd/returning_tasks_tl).
+    // Locks required: cap->lock, except that a free Capability (NULL
+    // here) is always claimed with claimCapability(), which
+    // resumeThread() may call without the lock.
+    Task * volatile running_task CAP_CACHE_LINE;
 
 #if defined(THREADED_RTS)
     // Worker Tasks waiting in the wings.  Singly-linked.
@@ -111,7 +306,6 @@ struct Capability_ {
     //    running_task
     //    returning_tasks_{hd,tl}
     //    wakeup_queue
-    //    inbox
     Mutex lock;
 
     // Tasks waiting to return from a foreign call, or waiting to make
@@ -121,27 +315,23 @@ struct Capability_ {
     // check whether it is NULL without taking the lock, however.
     Task *returning_tasks_hd; // Singly-linked, with head/tail
     Task *returning_tasks_tl;
+#endif
 
-    // Messages, or END_TSO_QUEUE.
-    // Locks required: cap->lock
-    Message *inbox;
-
-    SparkPool *sparks;
+    // Pushed to by any Capability or OS thread.
+    //
+    // Calls from outside the RTS that haven't been started yet, most
+    // recent first, or NULL.  Like the inbox, any thread may push with
+    // cas(), and the owner takes the whole list with xchg().  See
+    // rts_evalAsync() in RtsAPI.c.
+    AsyncCall * volatile async_calls CAP_CACHE_LINE;
 
-    // Stats on spark creation/conversion
-    SparkCounters spark_stats;
-#if !defined(mingw32_HOST_OS)
-    // IO manager for this cap
-    int io_manager_control_wr_fd;
-#endif
+#if defined(THREADED_RTS)
+    // Messages, or END_TSO_QUEUE.
+    // Lock-free: any Capability may push a message with cas(), and
+    // only the owner of this Capability takes the whole list with
+    // xchg().  See sendMessage() in Messages.c.
+    Message * volatile inbox;
 #endif
-
-    // Per-capability STM-related data
-    StgTVarWatchQueue *free_tvar_watch_queues;
-    StgInvariantCheckQueue *free_invariant_check_queues;
-    StgTRecChunk *free_trec_chunks;
-    StgTRecHeader *free_trec_headers;
-    nat transaction_tokens;
 } // typedef Capability is defined in RtsAPI.h
   // We never want a Capability to overlap a cache line with anything
   // else, so round it up to a cache line size:
@@ -205,6 +395,14 @@ void releaseCapability           (Capability* cap);
 void releaseAndWakeupCapability  (Capability* cap);
 void releaseCapability_ (Capability* cap, rtsBool always_wakeup);
 // assumes cap->lock is held
+
+// Take a free Capability; returns rtsFalse if it is not free.
+INLINE_HEADER rtsBool claimCapability (Capability *cap, Task *task);
+
+// Mark the Capability free.  The current Task must either hold
+// cap->lock, or be handing it over to a Task that will claim it with
+// claimCapability().
+INLINE_HEADER void setCapabilityFree (Capability *cap);
 #else
 // releaseCapability() is empty in non-threaded RTS
 INLINE_HEADER void releaseCapability  (Capability* cap STG_UNUSED) {};
@@ -229,6 +427,21 @@ extern Capability **capabilities;
 //
 extern Capability *last_free_capability;
 
+// The number of Capabilities with cap->hungry set
+//
+extern volatile StgWord n_hungry_capabilities;
+
+//
+// The number of NUMA nodes we are using (1 unless +RTS --numa), and the
+// mapping from our node numbers to the OS node numbers.  Our node
+// numbers are dense in [0 .. n_numa_nodes-1]; the OS node numbers in
+// numa_map[] need not be, because --numa=<mask> may select a subset.
+//
+extern nat n_numa_nodes;
+extern nat numa_map[MAX_NUMA_NODES];
+
+#define capNoToNumaNode(n) ((n) % n_numa_nodes)
+
 //
 // Indicates that the RTS wants to synchronise all the Capabilities
 // for some reason.  All Capabilities should stop and return to the
@@ -293,9 +506,18 @@ rtsBool tryGrabCapability (Capability *cap, Task *task);
 //
 StgClosure *findSpark (Capability *cap);
 
-// True if any capabilities have sparks
+// True if any capabilities in the same pool as cap have sparks
 //
-rtsBool anySparks (void);
+rtsBool anySparks (Capability *cap);
+
+// Context switch the Capabilities of each pool at the pool's own
+// interval, called by the timer when there are pools (+RTS --cap-pool)
+//
+void contextSwitchCapPools (void);
+
+// The CPU to bind the workers of cap to, or -1 for the usual -qa
+//
+int capPoolCpu (Capability *cap);
 
 INLINE_HEADER rtsBool emptySparkPoolCap (Capability *cap);
 INLINE_HEADER nat     sparkPoolSizeCap  (Capability *cap);
@@ -326,6 +548,9 @@ INLINE_HEADER void contextSwitchCapability(Capability *cap);
 // cause all capabilities to stop running Haskell code and return to
 // the scheduler as soon as possible.
 void interruptAllCapabilities(void);
+
+// interrupt all capabilities and have them log a stack sample
+void sampleAllCapabilities(void);
 INLINE_HEADER void interruptCapability(Capability *cap);
 
 // Free all capabilities
@@ -347,6 +572,11 @@ void traverseSparkQueues (evac_fn evac, void *user);
 
 INLINE_HEADER rtsBool emptyInbox(Capability *cap);
 
+#if defined(THREADED_RTS)
+// Get an idle Capability looking for work, from any OS thread
+void wakeupCapability (Capability *cap);
+#endif
+
 #endif // THREADED_RTS
 
 /* -----------------------------------------------------------------------------
@@ -362,6 +592,9 @@ recordMutableCap (StgClosure *p, Capability *cap, nat gen)
     //    ASSERT(cap->running_task == myTask());
     // NO: assertion is violated by performPendingThrowTos()
     bd = cap->mut_lists[gen];
+    // Don't record the same object twice in a row, as happens when
+    // several threads block on a BLOCKING_QUEUE in turn.
+    if (bd->free > bd->start && bd->free[-1] == (StgWord)p) return;
     if (bd->free >= bd->start + BLOCK_SIZE_W) {
         bdescr *new_bd;
         new_bd = allocBlock_lock();
@@ -420,6 +653,18 @@ contextSwitchCapability (Capability *cap)
     cap->context_switch = 1;
 }
 
+// The context switch interval of cap's pool, in ticks (0 for -C0)
+INLINE_HEADER int
+capCtxtSwitchTicks (Capability *cap USED_IF_THREADS)
+{
+#if defined(THREADED_RTS)
+    if (cap->pool != 0) {
+        return RtsFlags.ParFlags.capPools[cap->pool - 1].ctxtSwitchTicks;
+    }
+#endif
+    return RtsFlags.ConcFlags.ctxtSwitchTicks;
+}
+
 #ifdef THREADED_RTS
 
 INLINE_HEADER rtsBool emptyInbox(Capability *cap)
@@ -427,6 +672,22 @@ INLINE_HEADER rtsBool emptyInbox(Capability *cap)
     return (cap->inbox == (Message*)END_TSO_QUEUE);
 }
 
+INLINE_HEADER rtsBool
+claimCapability (Capability *cap, Task *task)
+{
+    return cas((StgVolatilePtr)&cap->running_task,
+               (StgWord)NULL, (StgWord)task) == (StgWord)NULL;
+}
+
+INLINE_HEADER void
+setCapabilityFree (Capability *cap)
+{
+    // whoever claims the Capability next must see everything we did
+    // with it
+    write_barrier();
+    cap->running_task = NULL;
+}
+
 #endif
 
 #include "EndPrivate.h"
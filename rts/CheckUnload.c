@@ -12,16 +12,20 @@
 #include "Rts.h"
 
 #include "RtsUtils.h"
-#include "Hash.h"
 #include "LinkerInternals.h"
 #include "CheckUnload.h"
 #include "sm/Storage.h"
 #include "sm/GCThread.h"
+#include "sm/GC.h"
+#include "sm/CNF.h"
+#include "sm/Freeze.h"
 
 //
 // Code that we unload may be referenced from:
 //   - info pointers in heap objects and stack frames
 //   - pointers to static objects from the heap
+//   - pointers to static objects from compact regions, which the GC
+//     doesn't follow (see Note [Compact regions] in sm/CNF.c)
 //   - StablePtrs to static objects
 //
 // We can find live static objects after a major GC, so we don't have
@@ -30,31 +34,71 @@
 // traversal: we look at the header of every object, but not its
 // contents.
 //
-// On the assumption that there aren't many different info pointers in
-// a typical heap, we insert addresses into a hash table.  The
-// first time we see an address, we check it against the pending
-// unloadable objects and if it lies within any of them, we mark that
-// object as referenced so that it won't get unloaded in this round.
+// The images of the pending unloadable objects are put in ranges[],
+// sorted by address, so we can find the one an address lies in (if
+// any) by binary search; most addresses are in none of them, and
+// don't get past the comparison with the lowest and highest.  If an
+// address lies within one, we mark that object as referenced so that
+// it won't get unloaded in this round.
+//
+// The heap is searched by all the GC threads (see runOnGcThreads()),
+// which claim CHECK_CHUNK blocks of it at a time, and stop as soon
+// as every object has been found to be referenced.
 //
 
-static void checkAddress (HashTable *addrs, void *addr)
-{
+typedef struct {
+    W_ start, end;              // of the image
     ObjectCode *oc;
+    volatile StgWord referenced;
+} UnloadRange;
 
-    if (!lookupHashTable(addrs, (W_)addr)) {
-        insertHashTable(addrs, (W_)addr, addr);
+static UnloadRange *ranges = NULL;
+static nat n_ranges;
+static W_ ranges_start, ranges_end;
+static volatile StgWord n_unreferenced;
 
-        for (oc = unloaded_objects; oc; oc = oc->next) {
-            if ((W_)addr >= (W_)oc->image &&
-                (W_)addr <  (W_)oc->image + oc->fileSize) {
-                oc->referenced = 1;
-                break;
+#define CHECK_CHUNK 64
+
+static bdescr **check_chains = NULL;
+static nat n_check_chains, check_chain;
+static bdescr *check_next;
+#if defined(THREADED_RTS)
+static SpinLock check_lock;
+#endif
+
+static void checkAddress (void *addr)
+{
+    nat lo, hi, mid;
+    UnloadRange *r;
+
+    if ((W_)addr < ranges_start || (W_)addr >= ranges_end) return;
+
+    lo = 0;
+    hi = n_ranges;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        r = &ranges[mid];
+        if ((W_)addr < r->start) {
+            hi = mid;
+        } else if ((W_)addr >= r->end) {
+            lo = mid + 1;
+        } else {
+            if (r->referenced == 0 && cas(&r->referenced, 0, 1) == 0) {
+                atomic_dec(&n_unreferenced);
             }
+            return;
         }
     }
 }
 
-static void searchStackChunk (HashTable *addrs, StgPtr sp, StgPtr stack_end)
+static int cmpRanges (const void *a, const void *b)
+{
+    W_ x = ((const UnloadRange *)a)->start;
+    W_ y = ((const UnloadRange *)b)->start;
+    return x < y ? -1 : x > y;
+}
+
+static void searchStackChunk (StgPtr sp, StgPtr stack_end)
 {
     StgPtr p;
     const StgRetInfoTable *info;
@@ -66,7 +110,7 @@ static void searchStackChunk (HashTable *addrs, StgPtr sp, StgPtr stack_end)
         switch (info->i.type) {
         case RET_SMALL:
         case RET_BIG:
-            checkAddress(addrs, (void*)info);
+            checkAddress((void*)info);
             break;
 
         default:
@@ -78,14 +122,15 @@ static void searchStackChunk (HashTable *addrs, StgPtr sp, StgPtr stack_end)
 }
 
 
-static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
+// Search the blocks from bd up to (not including) end
+static void searchHeapBlocks (bdescr *bd, bdescr *end)
 {
     StgPtr p;
     StgInfoTable *info;
     nat size;
     rtsBool prim;
 
-    for (; bd != NULL; bd = bd->link) {
+    for (; bd != end; bd = bd->link) {
 
         if (bd->flags & BF_PINNED) {
             // Assume that objects in PINNED blocks cannot refer to
@@ -181,7 +226,7 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
                 StgAP_STACK *ap = (StgAP_STACK *)p;
                 prim = rtsTrue;
                 size = ap_stack_sizeW(ap);
-                searchStackChunk(addrs, (StgPtr)ap->payload,
+                searchStackChunk((StgPtr)ap->payload,
                                  (StgPtr)ap->payload + ap->size);
                 break;
             }
@@ -215,7 +260,7 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
             case STACK: {
                 StgStack *stack = (StgStack*)p;
                 prim = rtsTrue;
-                searchStackChunk(addrs, stack->sp,
+                searchStackChunk(stack->sp,
                                  stack->stack + stack->stack_size);
                 size = stack_sizeW(stack);
                 break;
@@ -231,7 +276,7 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
             }
 
             if (!prim) {
-                checkAddress(addrs,info);
+                checkAddress(info);
             }
 
             p += size;
@@ -239,6 +284,37 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
     }
 }
 
+// Returns the first of up to CHECK_CHUNK blocks, and in *end the block
+// after the last, or NULL if the search is done
+static bdescr *claimCheckChunk (bdescr **end)
+{
+    bdescr *bd, *first;
+    nat n;
+
+    ACQUIRE_SPIN_LOCK(&check_lock);
+    while (check_next == NULL && check_chain < n_check_chains) {
+        check_next = check_chains[check_chain++];
+    }
+    first = check_next;
+    for (bd = first, n = 0; bd != NULL && n < CHECK_CHUNK; n++) {
+        bd = bd->link;
+    }
+    check_next = bd;
+    RELEASE_SPIN_LOCK(&check_lock);
+
+    *end = bd;
+    return first;
+}
+
+static void checkUnloadWorker (nat me STG_UNUSED)
+{
+    bdescr *bd, *end;
+
+    while (n_unreferenced > 0 && (bd = claimCheckChunk(&end)) != NULL) {
+        searchHeapBlocks(bd, end);
+    }
+}
+
 //
 // Check whether we can unload any object code.  This is called at the
 // appropriate point during a GC, where all the heap data is nice and
@@ -250,50 +326,98 @@ static void searchHeapBlocks (HashTable *addrs, bdescr *bd)
 //
 void checkUnload (StgClosure *static_objects)
 {
-  nat g, n;
-  HashTable *addrs;
+  nat g, n, i;
   StgClosure* p;
   const StgInfoTable *info;
   ObjectCode *oc, *prev, *next;
   gen_workspace *ws;
   StgClosure* link;
+  bdescr *bd;
 
   if (unloaded_objects == NULL) return;
 
   ACQUIRE_LOCK(&linker_unloaded_mutex);
 
   // Mark every unloadable object as unreferenced initially
+  n = 0;
   for (oc = unloaded_objects; oc; oc = oc->next) {
       IF_DEBUG(linker, debugBelch("Checking whether to unload %" PATH_FMT "\n",
                                   oc->fileName));
       oc->referenced = rtsFalse;
+      n++;
   }
 
-  addrs = allocHashTable();
+  ranges = stgReallocBytes(ranges, n * sizeof(UnloadRange), "checkUnload");
+  n_ranges = 0;
+  for (oc = unloaded_objects; oc; oc = oc->next) {
+      if (oc->fileSize == 0) continue;
+      ranges[n_ranges].start = (W_)oc->image;
+      ranges[n_ranges].end   = (W_)oc->image + oc->fileSize;
+      ranges[n_ranges].oc    = oc;
+      ranges[n_ranges].referenced = 0;
+      n_ranges++;
+  }
+  qsort(ranges, n_ranges, sizeof(UnloadRange), cmpRanges);
+  ranges_start = n_ranges > 0 ? ranges[0].start : 0;
+  ranges_end = 0;
+  for (i = 0; i < n_ranges; i++) {
+      if (ranges[i].end > ranges_end) ranges_end = ranges[i].end;
+  }
+  n_unreferenced = n_ranges;
 
-  for (p = static_objects; p != END_OF_STATIC_LIST; p = link) {
-      checkAddress(addrs, p);
+  for (p = static_objects; p != END_OF_STATIC_OBJECT_LIST; p = link) {
+      p = UNTAG_STATIC_LIST_PTR(p);
+      checkAddress(p);
       info = get_itbl(p);
       link = *STATIC_LINK(info, p);
   }
 
   // CAFs on revertible_caf_list are not on static_objects
   for (p = (StgClosure*)revertible_caf_list;
-       p != END_OF_STATIC_LIST;
+       p != END_OF_CAF_LIST;
        p = ((StgIndStatic *)p)->static_link) {
-      checkAddress(addrs, p);
+      p = UNTAG_STATIC_LIST_PTR(p);
+      checkAddress(p);
   }
 
-  for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
-      searchHeapBlocks (addrs, generations[g].blocks);
-      searchHeapBlocks (addrs, generations[g].large_objects);
+  for (g = 0; g < RtsFlags.GcFlags.generations && n_unreferenced > 0; g++) {
+      for (bd = generations[g].compact_objects; bd != NULL; bd = bd->link) {
+          compactSearchPointers(bd, checkAddress);
+      }
+  }
 
-      for (n = 0; n < n_capabilities; n++) {
-          ws = &gc_threads[n]->gens[g];
-          searchHeapBlocks(addrs, ws->todo_bd);
-          searchHeapBlocks(addrs, ws->part_list);
-          searchHeapBlocks(addrs, ws->scavd_list);
+  if (n_unreferenced > 0) {
+      check_chains = stgReallocBytes(check_chains,
+                                     (RtsFlags.GcFlags.generations *
+                                      (2 + 3 * n_capabilities) + 2) *
+                                     sizeof(bdescr *),
+                                     "checkUnload");
+      i = 0;
+      for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+          check_chains[i++] = generations[g].blocks;
+          check_chains[i++] = generations[g].large_objects;
+
+          for (n = 0; n < n_capabilities; n++) {
+              ws = &gc_threads[n]->gens[g];
+              check_chains[i++] = ws->todo_bd;
+              check_chains[i++] = ws->part_list;
+              check_chains[i++] = ws->scavd_list;
+          }
       }
+      check_chains[i++] = frozen_blocks;
+      check_chains[i++] = frozen_large_objects;
+      n_check_chains = i;
+      check_chain = 0;
+      check_next = NULL;
+#if defined(THREADED_RTS)
+      initSpinLock(&check_lock);
+#endif
+
+      runOnGcThreads(checkUnloadWorker);
+  }
+
+  for (i = 0; i < n_ranges; i++) {
+      ranges[i].oc->referenced = ranges[i].referenced;
   }
 
   // Look through the unloadable objects, and any object that is still
@@ -318,7 +442,5 @@ void checkUnload (StgClosure *static_objects)
       }
   }
 
-  freeHashTable(addrs, NULL);
-
   RELEASE_LOCK(&linker_unloaded_mutex);
 }
@@ -244,6 +244,10 @@ disInstr ( StgBCO *bco, int pc )
          debugBelch("ENTER\n");
          break;
 
+      case bci_SLIDE_ENTER:
+         debugBelch("SLIDE_ENTER %d down by %d\n", instrs[pc], instrs[pc+1] );
+         pc += 2; break;
+
       case bci_RETURN:
          debugBelch("RETURN\n" );
          break;
@@ -0,0 +1,291 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Elastic Capabilities: +RTS --elastic-capabilities
+ *
+ * -N<n> allocates n Capabilities, but a program running in a container
+ * may only be allowed to use a fraction of the machine's CPUs (a cgroup
+ * CPU quota).  If it runs more threads than that it is throttled, which
+ * is bad for latency.  With --elastic-capabilities, a background OS
+ * thread looks at the Capabilities periodically and enables or
+ * disables some of them with setNumCapabilities(), which does not free
+ * anything, so Capabilities can come back cheaply when the load goes up
+ * again.
+ *
+ * Each interval (the argument to --elastic-capabilities) is split into
+ * ELASTIC_SAMPLES samples.  In each sample we count the enabled
+ * Capabilities that are idle (no Task holds them) and the ones that
+ * have work waiting (more than one runnable thread, or sparks).  At the
+ * end of the interval:
+ *
+ *   - if the cgroup has throttled us since last time, we drop one
+ *     Capability;
+ *   - otherwise, if there was work waiting and no Capability was idle
+ *     on average, we add as many Capabilities as had work waiting, so
+ *     that we follow bursts quickly;
+ *   - otherwise, if at least one Capability was idle on average, we
+ *     drop one.
+ *
+ * The result is always between 1 and the number of Capabilities from
+ * -N (or setNumCapabilities()), and never more than the cgroup quota,
+ * rounded up.  The quota is re-read every interval.
+ *
+ * Only Linux cgroups (v1 and v2) are understood; elsewhere only the
+ * load is taken into account.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Elastic.h"
+#include "Capability.h"
+#include "Schedule.h"
+#include "Task.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+
+#if defined(THREADED_RTS)
+
+#if !defined(mingw32_HOST_OS)
+#include <unistd.h>
+#endif
+#include <string.h>
+
+#define ELASTIC_SAMPLES 8
+
+static Mutex     elastic_mutex;
+static Condition elastic_wakeup;
+static Condition elastic_done;
+static rtsBool   elastic_running = rtsFalse;
+static rtsBool   elastic_stop = rtsFalse;
+#if !defined(mingw32_HOST_OS)
+static pid_t     elastic_pid;
+#endif
+
+/* -----------------------------------------------------------------------------
+ * cgroup CPU quota
+ * -------------------------------------------------------------------------- */
+
+#if defined(linux_HOST_OS)
+
+static rtsBool
+readWord (const char *path, StgInt64 *val)
+{
+    FILE *f;
+    long long v;
+    int r;
+
+    f = fopen(path, "r");
+    if (f == NULL) return rtsFalse;
+    r = fscanf(f, "%lld", &v);
+    fclose(f);
+    if (r != 1) return rtsFalse;
+    *val = v;
+    return rtsTrue;
+}
+
+// The number of CPUs the cgroup quota allows us, rounded up, or 0 if
+// there is no quota.
+nat
+cgroupCpuLimit (void)
+{
+    FILE *f;
+    char quota[32];
+    StgInt64 q, period;
+    int r;
+
+    // cgroup v2: "<quota> <period>" or "max <period>"
+    f = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (f != NULL) {
+        r = fscanf(f, "%31s %lld", quota, (long long *)&period);
+        fclose(f);
+        if (r != 2 || !strcmp(quota, "max") || period <= 0) return 0;
+        q = strtoll(quota, NULL, 10);
+        return q > 0 ? (nat)((q + period - 1) / period) : 0;
+    }
+
+    // cgroup v1: a quota of -1 means none
+    if (readWord("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", &q) && q > 0 &&
+        readWord("/sys/fs/cgroup/cpu/cpu.cfs_period_us", &period) &&
+        period > 0) {
+        return (nat)((q + period - 1) / period);
+    }
+
+    return 0;
+}
+
+// The number of periods in which the cgroup has been throttled
+static StgWord64
+cgroupThrottleCount (void)
+{
+    FILE *f;
+    char key[64];
+    unsigned long long val;
+
+    f = fopen("/sys/fs/cgroup/cpu.stat", "r");
+    if (f == NULL) {
+        f = fopen("/sys/fs/cgroup/cpu/cpu.stat", "r");
+    }
+    if (f == NULL) return 0;
+
+    while (fscanf(f, "%63s %llu", key, &val) == 2) {
+        if (!strcmp(key, "nr_throttled")) {
+            fclose(f);
+            return val;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+#else
+
+nat              cgroupCpuLimit      (void) { return 0; }
+static StgWord64 cgroupThrottleCount (void) { return 0; }
+
+#endif
+
+/* -----------------------------------------------------------------------------
+ * Sampling
+ *
+ * We read the Capabilities without holding anything, so the numbers are
+ * only approximate, which is all we need.
+ * -------------------------------------------------------------------------- */
+
+static void
+sampleCapabilities (nat *idle, nat *queued)
+{
+    nat i;
+    Capability *cap;
+
+    for (i = 0; i < enabled_capabilities; i++) {
+        cap = capabilities[i];
+        if (cap->running_task == NULL) {
+            (*idle)++;
+        }
+        if ((!emptyRunQueue(cap) && cap->run_queue_hd->_link != END_TSO_QUEUE)
+            || !emptySparkPoolCap(cap)) {
+            (*queued)++;
+        }
+    }
+}
+
+static nat
+elasticTarget (nat idle, nat queued, rtsBool throttled)
+{
+    nat enabled = enabled_capabilities;
+    nat max = n_capabilities;
+    nat limit, target;
+
+    limit = cgroupCpuLimit();
+    if (limit != 0 && limit < max) {
+        max = limit;
+    }
+
+    idle   /= ELASTIC_SAMPLES;
+    queued /= ELASTIC_SAMPLES;
+
+    if (throttled) {
+        target = enabled - 1;
+    } else if (queued > 0 && idle == 0) {
+        target = enabled + queued;
+    } else if (idle > 0) {
+        target = enabled - 1;
+    } else {
+        target = enabled;
+    }
+
+    if (target < 1)   target = 1;
+    if (target > max) target = max;
+    return target;
+}
+
+static void OSThreadProcAttr
+elasticThread (void *arg STG_UNUSED)
+{
+    Time interval = RtsFlags.ParFlags.elasticInterval / ELASTIC_SAMPLES;
+    StgWord64 throttle_count, last_throttle_count;
+    nat samples = 0, idle = 0, queued = 0, target;
+
+    last_throttle_count = cgroupThrottleCount();
+
+    ACQUIRE_LOCK(&elastic_mutex);
+    while (!elastic_stop) {
+        timedWaitCondition(&elastic_wakeup, &elastic_mutex, interval);
+        if (elastic_stop) break;
+        RELEASE_LOCK(&elastic_mutex);
+
+        sampleCapabilities(&idle, &queued);
+
+        if (++samples == ELASTIC_SAMPLES) {
+            throttle_count = cgroupThrottleCount();
+            target = elasticTarget(idle, queued,
+                                   throttle_count > last_throttle_count);
+            last_throttle_count = throttle_count;
+            samples = idle = queued = 0;
+
+            if (target != enabled_capabilities
+                && sched_state == SCHED_RUNNING) {
+                debugTrace(DEBUG_sched,
+                           "elastic: %d -> %d capabilities",
+                           enabled_capabilities, target);
+                setNumCapabilities(target);
+            }
+        }
+
+        ACQUIRE_LOCK(&elastic_mutex);
+    }
+    elastic_running = rtsFalse;
+    broadcastCondition(&elastic_done);
+    RELEASE_LOCK(&elastic_mutex);
+
+    freeMyTask();
+}
+
+void
+startElasticCapabilities (void)
+{
+    OSThreadId tid;
+
+    if (!RtsFlags.ParFlags.elastic) return;
+
+    initMutex(&elastic_mutex);
+    initCondition(&elastic_wakeup);
+    initCondition(&elastic_done);
+    elastic_stop = rtsFalse;
+    elastic_running = rtsTrue;
+#if !defined(mingw32_HOST_OS)
+    elastic_pid = getpid();
+#endif
+
+    if (createOSThread(&tid, "ghc_elastic", elasticThread, NULL) != 0) {
+        sysErrorBelch("startElasticCapabilities: failed to create thread");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+void
+stopElasticCapabilities (void)
+{
+    if (!RtsFlags.ParFlags.elastic) return;
+#if !defined(mingw32_HOST_OS)
+    // The thread doesn't survive forkProcess()
+    if (getpid() != elastic_pid) return;
+#endif
+
+    ACQUIRE_LOCK(&elastic_mutex);
+    elastic_stop = rtsTrue;
+    signalCondition(&elastic_wakeup);
+    while (elastic_running) {
+        waitCondition(&elastic_done, &elastic_mutex);
+    }
+    RELEASE_LOCK(&elastic_mutex);
+
+    closeCondition(&elastic_done);
+    closeCondition(&elastic_wakeup);
+    closeMutex(&elastic_mutex);
+}
+
+#endif /* THREADED_RTS */
@@ -0,0 +1,25 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Adjusting the number of enabled Capabilities to the load and to the
+ * CPU quota of the process (+RTS --elastic-capabilities)
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef ELASTIC_H
+#define ELASTIC_H
+
+#include "BeginPrivate.h"
+
+#if defined(THREADED_RTS)
+void startElasticCapabilities (void);
+void stopElasticCapabilities  (void);
+
+// CPUs allowed by the cgroup CPU quota, rounded up; 0 if there is none
+nat  cgroupCpuLimit           (void);
+#endif
+
+#include "EndPrivate.h"
+
+#endif /* ELASTIC_H */
@@ -21,17 +21,45 @@ typedef struct {
     StgWord64 device;
     StgWord64 inode;
     int   readers; // >0 : readers,  <0 : writers
+    nat   shard;
 } Lock;
 
-// Two hash tables.  The first maps objects (device/inode pairs) to
-// Lock objects containing the number of active readers or writers.  The
-// second maps file descriptors to lock objects, so that we can unlock
-// by FD without needing to fstat() again.
-static HashTable *obj_hash;
-static HashTable *fd_hash;
+// The locks are spread over FILE_LOCK_SHARDS shards by device/inode.
+// Each shard has its own mutex and a hash table mapping objects
+// (device/inode pairs) to Lock objects containing the number of
+// active readers or writers, so opens of different files don't
+// contend.  Most programs never lock a file, so a shard's table is
+// only made by the first lockFile() that needs it.
+#define FILE_LOCK_SHARDS 16
+
+typedef struct {
+#ifdef THREADED_RTS
+    Mutex      mutex;
+#endif
+    HashTable *obj_hash;
+} __attribute__((aligned(64))) LockShard;
+
+static LockShard shards[FILE_LOCK_SHARDS];
+
+// To unlock by FD without needing to fstat() again, we also map file
+// descriptors to Lock objects.  FDs below FD_DIRECT_MAX are looked up
+// in a two-level array whose chunks are allocated on demand; the rest
+// go in a hash table.
+//
+// An FD's entry is only set by lockFile() and cleared by unlockFile(),
+// and the program doesn't reuse an FD before it has closed it, or
+// close it before unlockFile(), so only the chunk allocation needs
+// synchronising.
+#define FD_CHUNK_BITS  10
+#define FD_CHUNK_SIZE  (1 << FD_CHUNK_BITS)
+#define FD_CHUNKS      1024
+#define FD_DIRECT_MAX  (FD_CHUNKS * FD_CHUNK_SIZE)
+
+static Lock **fd_chunks[FD_CHUNKS];
+static HashTable *fd_hash = NULL;   // FDs >= FD_DIRECT_MAX
 
 #ifdef THREADED_RTS
-static Mutex file_lock_mutex;
+static Mutex fd_hash_mutex;
 #endif
 
 static int cmpLocks(StgWord w1, StgWord w2)
@@ -49,13 +77,23 @@ static int hashLock(HashTable *table, StgWord w)
     return hashWord(table, key);
 }
 
+static nat
+lockShard (StgWord64 dev, StgWord64 ino)
+{
+    // Fibonacci hashing; the top bits are the best mixed
+    StgWord64 h = (ino ^ (dev << 32 | dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+    return (nat)(h >> 32) % FILE_LOCK_SHARDS;
+}
+
 void
 initFileLocking(void)
 {
-    obj_hash = allocHashTable_(hashLock, cmpLocks);
-    fd_hash  = allocHashTable(); /* ordinary word-based table */
 #ifdef THREADED_RTS
-    initMutex(&file_lock_mutex);
+    nat i;
+    for (i = 0; i < FILE_LOCK_SHARDS; i++) {
+        initMutex(&shards[i].mutex);
+    }
+    initMutex(&fd_hash_mutex);
 #endif
 }
 
@@ -68,24 +106,118 @@ freeLock(void *lock)
 void
 freeFileLocking(void)
 {
-    freeHashTable(obj_hash, freeLock);
-    freeHashTable(fd_hash,  NULL);
+    nat i;
+
+    for (i = 0; i < FILE_LOCK_SHARDS; i++) {
+        if (shards[i].obj_hash != NULL) {
+            freeHashTable(shards[i].obj_hash, freeLock);
+            shards[i].obj_hash = NULL;
+        }
 #ifdef THREADED_RTS
-    closeMutex(&file_lock_mutex);
+        closeMutex(&shards[i].mutex);
+#endif
+    }
+    for (i = 0; i < FD_CHUNKS; i++) {
+        if (fd_chunks[i] != NULL) {
+            stgFree(fd_chunks[i]);
+            fd_chunks[i] = NULL;
+        }
+    }
+    if (fd_hash != NULL) {
+        freeHashTable(fd_hash, NULL);
+        fd_hash = NULL;
+    }
+#ifdef THREADED_RTS
+    closeMutex(&fd_hash_mutex);
 #endif
 }
 
+// The FD's entry in the direct map, or NULL if it doesn't have one; if
+// alloc, the chunk holding it is made if necessary.
+static Lock **
+fdSlot (int fd, rtsBool alloc)
+{
+    Lock **chunk;
+    nat i;
+
+    if (fd < 0 || fd >= FD_DIRECT_MAX) {
+        return NULL;
+    }
+    i = (nat)fd >> FD_CHUNK_BITS;
+    chunk = fd_chunks[i];
+    if (chunk == NULL) {
+        if (!alloc) return NULL;
+        chunk = stgCallocBytes(FD_CHUNK_SIZE, sizeof(Lock *), "fdSlot");
+#ifdef THREADED_RTS
+        // someone else may have got there first
+        if (cas((StgVolatilePtr)&fd_chunks[i], 0, (StgWord)chunk) != 0) {
+            stgFree(chunk);
+            chunk = fd_chunks[i];
+        }
+#else
+        fd_chunks[i] = chunk;
+#endif
+    }
+    return &chunk[fd & (FD_CHUNK_SIZE - 1)];
+}
+
+static void
+setFdLock (int fd, Lock *lock)
+{
+    Lock **slot = fdSlot(fd, rtsTrue);
+
+    if (slot != NULL) {
+        *slot = lock;
+    } else {
+        ACQUIRE_LOCK(&fd_hash_mutex);
+        if (fd_hash == NULL) {
+            fd_hash = allocHashTable(); /* ordinary word-based table */
+        }
+        insertHashTable(fd_hash, fd, lock);
+        RELEASE_LOCK(&fd_hash_mutex);
+    }
+}
+
+// Remove the FD's entry, returning the Lock it was mapped to
+static Lock *
+takeFdLock (int fd)
+{
+    Lock *lock;
+
+    if (fd >= 0 && fd < FD_DIRECT_MAX) {
+        Lock **slot = fdSlot(fd, rtsFalse);
+        if (slot == NULL) return NULL;
+        lock = *slot;
+        *slot = NULL;
+        return lock;
+    }
+
+    ACQUIRE_LOCK(&fd_hash_mutex);
+    lock = fd_hash != NULL ? removeHashTable(fd_hash, fd, NULL) : NULL;
+    RELEASE_LOCK(&fd_hash_mutex);
+    return lock;
+}
+
 int
 lockFile(int fd, StgWord64 dev, StgWord64 ino, int for_writing)
 {
     Lock key, *lock;
+    LockShard *shard;
+    nat s;
+
+    s = lockShard(dev, ino);
+    shard = &shards[s];
 
-    ACQUIRE_LOCK(&file_lock_mutex);
+    ACQUIRE_LOCK(&shard->mutex);
+
+    if (shard->obj_hash == NULL) {
+        shard->obj_hash = allocHashTable_(hashLock, cmpLocks);
+    }
 
     key.device = dev;
     key.inode  = ino;
 
-    lock = lookupHashTable(obj_hash, (StgWord)&key);
+    lock = lookupHashTable(shard->obj_hash, (StgWord)&key);
 
     if (lock == NULL)
     {
@@ -93,21 +225,22 @@ lockFile(int fd, StgWord64 dev, StgWord64 ino, int for_writing)
         lock->device = dev;
         lock->inode  = ino;
         lock->readers = for_writing ? -1 : 1;
-        insertHashTable(obj_hash, (StgWord)lock, (void *)lock);
-        insertHashTable(fd_hash, fd, lock);
-        RELEASE_LOCK(&file_lock_mutex);
+        lock->shard = s;
+        insertHashTable(shard->obj_hash, (StgWord)lock, (void *)lock);
+        setFdLock(fd, lock);
+        RELEASE_LOCK(&shard->mutex);
         return 0;
     }
     else
     {
         // single-writer/multi-reader locking:
         if (for_writing || lock->readers < 0) {
-            RELEASE_LOCK(&file_lock_mutex);
+            RELEASE_LOCK(&shard->mutex);
             return -1;
         }
-        insertHashTable(fd_hash, fd, lock);
+        setFdLock(fd, lock);
         lock->readers++;
-        RELEASE_LOCK(&file_lock_mutex);
+        RELEASE_LOCK(&shard->mutex);
         return 0;
     }
 }
@@ -116,18 +249,21 @@ int
 unlockFile(int fd)
 {
     Lock *lock;
+    LockShard *shard;
 
-    ACQUIRE_LOCK(&file_lock_mutex);
-
-    lock = lookupHashTable(fd_hash, fd);
+    lock = takeFdLock(fd);
     if (lock == NULL) {
         // errorBelch("unlockFile: fd %d not found", fd);
         // This is normal: we didn't know when calling unlockFile
         // whether this FD referred to a locked file or not.
-        RELEASE_LOCK(&file_lock_mutex);
         return 1;
     }
 
+    // lock can't go away under us: this FD is one of its readers or
+    // its writer
+    shard = &shards[lock->shard];
+    ACQUIRE_LOCK(&shard->mutex);
+
     if (lock->readers < 0) {
         lock->readers++;
     } else {
@@ -135,11 +271,10 @@ unlockFile(int fd)
     }
 
     if (lock->readers == 0) {
-        removeHashTable(obj_hash, (StgWord)lock, NULL);
+        removeHashTable(shard->obj_hash, (StgWord)lock, NULL);
         stgFree(lock);
     }
-    removeHashTable(fd_hash, fd, NULL);
 
-    RELEASE_LOCK(&file_lock_mutex);
+    RELEASE_LOCK(&shard->mutex);
     return 0;
 }
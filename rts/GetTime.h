@@ -18,6 +18,18 @@ Time getThreadCPUTime      (void);
 Time getProcessElapsedTime (void);
 void getProcessTimes       (Time *user, Time *elapsed);
 
+/* The clock for eventlog and trace timestamps, chosen by --clock.
+   getTimestampNSec() is on the same time base as getMonotonicNSec(),
+   but may be cheaper to read and less precise.  initTimestampClock()
+   must be called after the RTS flags have been read.
+ */
+void      initTimestampClock (void);
+StgWord64 getTimestampNSec   (void);
+// The clock in use (a CLOCK_SOURCE_*), the frequency of the counter it
+// reads (0 if it isn't a counter) and its resolution in nanoseconds
+void      getTimestampClock  (nat *source, StgWord64 *hz,
+                              StgWord64 *resolution);
+
 /* Get the current date and time.
    Uses seconds since the Unix epoch, plus nanoseconds
  */
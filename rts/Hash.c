@@ -3,9 +3,22 @@
  * (c) The AQUA Project, Glasgow University, 1995-1998
  * (c) The GHC Team, 1999
  *
- * Dynamically expanding linear hash tables, as described in
- * Per-\AAke Larson, ``Dynamic Hash Tables,'' CACM 31(4), April 1988,
- * pp. 446 -- 457.
+ * Open-addressing hash tables with Robin Hood linear probing, as
+ * described in Pedro Celis, ``Robin Hood Hashing,'' PhD thesis,
+ * University of Waterloo, 1986.
+ *
+ * Each slot holds the key, the data and the hash of the key, so a lookup
+ * is a linear scan over a contiguous array rather than a walk down a
+ * chain, and keys whose hash differs are rejected without calling the
+ * comparison function (which matters for string keys).  Robin Hood
+ * insertion keeps the entries along each probe sequence ordered by
+ * their distance from home, so a failed lookup can stop as soon as it
+ * meets an entry that is closer to home than the key would be.
+ * Deletion shifts the following entries back, so there are no
+ * tombstones.
+ *
+ * As before, the table may contain several entries with the same key;
+ * lookupHashTable() returns the one inserted most recently.
  * -------------------------------------------------------------------------- */
 
 #include "PosixSource.h"
@@ -16,87 +29,64 @@
 
 #include <string.h>
 
-#define HSEGSIZE    1024    /* Size of a single hash table segment */
-                            /* Also the minimum size of a hash table */
-#define HDIRSIZE    1024    /* Size of the segment directory */
-                            /* Maximum hash table size is HSEGSIZE * HDIRSIZE */
-#define HLOAD       5       /* Maximum average load of a single hash bucket */
-
-#define HCHUNK      (1024 * sizeof(W_) / sizeof(HashList))
-                            /* Number of HashList cells to allocate in one go */
+#define HMINSIZE    64      /* Initial (and minimum) number of slots */
+                            /* must be a power of 2 */
+#define HLOAD_NUM   3       /* Maximum load factor of the table is */
+#define HLOAD_DEN   4       /* HLOAD_NUM / HLOAD_DEN */
 
+#define EMPTY_HASH  ((StgWord)-1)   /* the hash of an empty slot */
 
-/* Linked list of (key, data) pairs for separate chaining */
-typedef struct hashlist {
+typedef struct hashentry {
     StgWord key;
     void *data;
-    struct hashlist *next;  /* Next cell in bucket chain (same hash value) */
-} HashList;
-
-typedef struct chunklist {
-  HashList *chunk;
-  struct chunklist *next;
-} HashListChunk;
+    StgWord hash;           /* result of table->hash, or EMPTY_HASH */
+} HashEntry;
 
 struct hashtable {
-    int split;              /* Next bucket to split when expanding */
-    int max;                /* Max bucket of smaller table */
-    int mask1;              /* Mask for doing the mod of h_1 (smaller table) */
-    int mask2;              /* Mask for doing the mod of h_2 (larger table) */
-    int kcount;             /* Number of keys */
-    int bcount;             /* Number of buckets */
-    HashList **dir[HDIRSIZE];   /* Directory of segments */
-    HashList *freeList;         /* free list of HashLists */
-    HashListChunk *chunks;
+    HashEntry *slots;
+    StgWord mask;               /* number of slots - 1 */
+    int kcount;                 /* Number of keys */
     HashFunction *hash;         /* hash function */
     CompareFunction *compare;   /* key comparison function */
 };
 
 /* -----------------------------------------------------------------------------
- * Hash first using the smaller table.  If the bucket is less than the
- * next bucket to be split, re-hash using the larger table.
+ * Hash functions.  These return a hash in the range [0, 2^31), which
+ * the table reduces to a slot index itself; a hash function for
+ * arbitrary keys (see allocHashTable_) may be built on hashWord.
  * -------------------------------------------------------------------------- */
 
 int
-hashWord(HashTable *table, StgWord key)
+hashWord(HashTable *table STG_UNUSED, StgWord key)
 {
-    int bucket;
-
     /* Strip the boring zero bits */
     key /= sizeof(StgWord);
 
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = key & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = key & table->mask2;
-    }
-    return bucket;
+    /* Fibonacci hashing, folding the well-mixed high bits down */
+#if SIZEOF_VOID_P == 8
+    key *= 0x9E3779B97F4A7C15;
+    key ^= key >> 32;
+#else
+    key *= 0x9E3779B9;
+    key ^= key >> 16;
+#endif
+    return (int)(key & 0x7fffffff);
 }
 
 int
-hashStr(HashTable *table, char *key)
+hashStr(HashTable *table STG_UNUSED, char *key)
 {
-    int h, bucket;
-    char *s;
-
-    s = key;
-    for (h=0; *s; s++) {
-        h *= 128;
-        h += *s;
-        h = h % 1048583;        /* some random large prime */
+    StgWord32 h;
+    unsigned char *s;
+
+    /* FNV-1a */
+    h = 2166136261U;
+    for (s = (unsigned char *)key; *s; s++) {
+        h ^= *s;
+        h *= 16777619U;
     }
 
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = h & table->mask1;
-
-    if (bucket < table->split) {
-        /* Mod the size of the expanded hash table (also a power of 2) */
-        bucket = h & table->mask2;
-    }
-
-    return bucket;
+    return (int)(h & 0x7fffffff);
 }
 
 static int
@@ -111,99 +101,132 @@ compareStr(StgWord key1, StgWord key2)
     return (strcmp((char *)key1, (char *)key2) == 0);
 }
 
+/* -----------------------------------------------------------------------------
+ * Slots and probing.
+ * -------------------------------------------------------------------------- */
+
+/* How far the entry with hash h in slot i is from its home slot */
+#define PROBE_DIST(table, h, i) (((i) - (h)) & (table)->mask)
+
+static StgWord
+hashKey(HashTable *table, StgWord key)
+{
+    return (StgWord)table->hash(table, key) & 0x7fffffff;
+}
+
+static HashEntry *
+allocSlots(StgWord n)
+{
+    HashEntry *slots;
+    StgWord i;
+
+    slots = stgMallocBytes(n * sizeof(HashEntry), "allocSlots");
+    for (i = 0; i < n; i++) {
+        slots[i].hash = EMPTY_HASH;
+    }
+    return slots;
+}
 
 /* -----------------------------------------------------------------------------
- * Allocate a new segment of the dynamically growing hash table.
+ * Put an entry in the table, which must have room for it.  With
+ * newest = rtsTrue the entry goes in front of any existing entries with
+ * the same key, otherwise behind them.
  * -------------------------------------------------------------------------- */
 
 static void
-allocSegment(HashTable *table, int segment)
+placeEntry(HashTable *table, HashEntry cur, rtsBool newest)
 {
-    table->dir[segment] = stgMallocBytes(HSEGSIZE * sizeof(HashList *),
-                                         "allocSegment");
-}
+    StgWord i, d, ed;
+    HashEntry *e, tmp;
 
+    i = cur.hash & table->mask;
+    d = 0;
+
+    for (;;) {
+        e = &table->slots[i];
+        if (e->hash == EMPTY_HASH) {
+            *e = cur;
+            return;
+        }
+        ed = PROBE_DIST(table, e->hash, i);
+        // Take the slot from an entry that is closer to home than we
+        // are.  An entry that is displaced carries on looking, and any
+        // later duplicates of it are further along, so we can swap with
+        // equal keys too and keep the duplicates in order.
+        if (ed < d || (newest && ed == d && e->hash == cur.hash
+                       && table->compare(e->key, cur.key))) {
+            tmp = *e;
+            *e = cur;
+            cur = tmp;
+            d = ed;
+        }
+        i = (i + 1) & table->mask;
+        d++;
+    }
+}
 
 /* -----------------------------------------------------------------------------
- * Expand the larger hash table by one bucket, and split one bucket
- * from the smaller table into two parts.  Only the bucket referenced
- * by @table->split@ is affected by the expansion.
+ * Double the size of the table.  Entries are moved in probe order,
+ * starting just after an empty slot, so that duplicate keys stay in
+ * the same order relative to each other.
  * -------------------------------------------------------------------------- */
 
 static void
 expand(HashTable *table)
 {
-    int oldsegment;
-    int oldindex;
-    int newbucket;
-    int newsegment;
-    int newindex;
-    HashList *hl;
-    HashList *next;
-    HashList *old, *new;
-
-    if (table->split + table->max >= HDIRSIZE * HSEGSIZE)
-        /* Wow!  That's big.  Too big, so don't expand. */
-        return;
-
-    /* Calculate indices of bucket to split */
-    oldsegment = table->split / HSEGSIZE;
-    oldindex = table->split % HSEGSIZE;
-
-    newbucket = table->max + table->split;
-
-    /* And the indices of the new bucket */
-    newsegment = newbucket / HSEGSIZE;
-    newindex = newbucket % HSEGSIZE;
-
-    if (newindex == 0)
-        allocSegment(table, newsegment);
-
-    if (++table->split == table->max) {
-        table->split = 0;
-        table->max *= 2;
-        table->mask1 = table->mask2;
-        table->mask2 = table->mask2 << 1 | 1;
+    HashEntry *old;
+    StgWord oldsize, start, i, n;
+
+    old = table->slots;
+    oldsize = table->mask + 1;
+
+    for (start = 0; old[start].hash != EMPTY_HASH; start++) {
+        /* there is always an empty slot */
     }
-    table->bcount++;
-
-    /* Split the bucket, paying no attention to the original order */
-
-    old = new = NULL;
-    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
-        next = hl->next;
-        if (table->hash(table, hl->key) == newbucket) {
-            hl->next = new;
-            new = hl;
-        } else {
-            hl->next = old;
-            old = hl;
+
+    table->slots = allocSlots(oldsize * 2);
+    table->mask = oldsize * 2 - 1;
+
+    for (n = 0; n < oldsize; n++) {
+        i = (start + n) & (oldsize - 1);
+        if (old[i].hash != EMPTY_HASH) {
+            placeEntry(table, old[i], rtsFalse);
         }
     }
-    table->dir[oldsegment][oldindex] = old;
-    table->dir[newsegment][newindex] = new;
 
-    return;
+    stgFree(old);
 }
 
-void *
-lookupHashTable(HashTable *table, StgWord key)
+static HashEntry *
+findEntry(HashTable *table, StgWord key, void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
+    StgWord h, i, d;
+    HashEntry *e;
+
+    h = hashKey(table, key);
+    i = h & table->mask;
 
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
+    for (d = 0; ; d++) {
+        e = &table->slots[i];
+        if (e->hash == EMPTY_HASH || PROBE_DIST(table, e->hash, i) < d) {
+            /* It's not there */
+            return NULL;
+        }
+        if (e->hash == h && table->compare(e->key, key)
+            && (data == NULL || e->data == data)) {
+            return e;
+        }
+        i = (i + 1) & table->mask;
+    }
+}
 
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next)
-        if (table->compare(hl->key, key))
-            return hl->data;
+void *
+lookupHashTable(HashTable *table, StgWord key)
+{
+    HashEntry *e;
 
-    /* It's not there */
-    return NULL;
+    e = findEntry(table, key, NULL);
+    return e == NULL ? NULL : e->data;
 }
 
 // Puts up to szKeys keys of the hash table into the given array. Returns the
@@ -212,125 +235,68 @@ lookupHashTable(HashTable *table, StgWord key)
 // If the table is modified concurrently, the function behavior is undefined.
 //
 int keysHashTable(HashTable *table, StgWord keys[], int szKeys) {
-    int segment, index;
+    StgWord i;
     int k = 0;
-    HashList *hl;
-
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
 
-    while (segment >= 0 && k < szKeys) {
-        while (index >= 0 && k < szKeys) {
-            hl = table->dir[segment][index];
-            while (hl && k < szKeys) {
-                keys[k] = hl->key;
-                k += 1;
-                hl = hl->next;
-            }
-            index--;
+    for (i = 0; i <= table->mask && k < szKeys; i++) {
+        if (table->slots[i].hash != EMPTY_HASH) {
+            keys[k] = table->slots[i].key;
+            k += 1;
         }
-        segment--;
-        index = HSEGSIZE - 1;
     }
     return k;
 }
 
-/* -----------------------------------------------------------------------------
- * We allocate the hashlist cells in large chunks to cut down on malloc
- * overhead.  Although we keep a free list of hashlist cells, we make
- * no effort to actually return the space to the malloc arena.
- * -------------------------------------------------------------------------- */
-
-static HashList *
-allocHashList (HashTable *table)
-{
-    HashList *hl, *p;
-    HashListChunk *cl;
-
-    if ((hl = table->freeList) != NULL) {
-        table->freeList = hl->next;
-    } else {
-        hl = stgMallocBytes(HCHUNK * sizeof(HashList), "allocHashList");
-        cl = stgMallocBytes(sizeof (*cl), "allocHashList: chunkList");
-        cl->chunk = hl;
-        cl->next = table->chunks;
-        table->chunks = cl;
-
-        table->freeList = hl + 1;
-        for (p = table->freeList; p < hl + HCHUNK - 1; p++)
-            p->next = p + 1;
-        p->next = NULL;
-    }
-    return hl;
-}
-
-static void
-freeHashList (HashTable *table, HashList *hl)
-{
-    hl->next = table->freeList;
-    table->freeList = hl;
-}
-
 void
 insertHashTable(HashTable *table, StgWord key, void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
+    HashEntry e;
 
     // Disable this assert; sometimes it's useful to be able to
     // overwrite entries in the hash table.
     // ASSERT(lookupHashTable(table, key) == NULL);
 
-    /* When the average load gets too high, we expand the table */
-    if (++table->kcount >= HLOAD * table->bcount)
+    /* When the load gets too high, we expand the table */
+    if ((StgWord)(table->kcount + 1) * HLOAD_DEN
+            > (table->mask + 1) * HLOAD_NUM) {
         expand(table);
+    }
 
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    hl = allocHashList(table);
-
-    hl->key = key;
-    hl->data = data;
-    hl->next = table->dir[segment][index];
-    table->dir[segment][index] = hl;
-
+    e.key = key;
+    e.data = data;
+    e.hash = hashKey(table, key);
+    placeEntry(table, e, rtsTrue);
+    table->kcount++;
 }
 
 void *
 removeHashTable(HashTable *table, StgWord key, void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-    HashList *prev = NULL;
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-        if (table->compare(hl->key,key) && (data == NULL || hl->data == data)) {
-            if (prev == NULL)
-                table->dir[segment][index] = hl->next;
-            else
-                prev->next = hl->next;
-            freeHashList(table,hl);
-            table->kcount--;
-            return hl->data;
-        }
-        prev = hl;
+    HashEntry *e;
+    StgWord i, j;
+    void *result;
+
+    e = findEntry(table, key, data);
+    if (e == NULL) {
+        /* It's not there */
+        ASSERT(data == NULL);
+        return NULL;
     }
+    result = e->data;
+
+    /* Shift the rest of the probe sequence back by one */
+    i = e - table->slots;
+    j = (i + 1) & table->mask;
+    while (table->slots[j].hash != EMPTY_HASH
+           && PROBE_DIST(table, table->slots[j].hash, j) > 0) {
+        table->slots[i] = table->slots[j];
+        i = j;
+        j = (j + 1) & table->mask;
+    }
+    table->slots[i].hash = EMPTY_HASH;
 
-    /* It's not there */
-    ASSERT(data == NULL);
-    return NULL;
+    table->kcount--;
+    return result;
 }
 
 /* -----------------------------------------------------------------------------
@@ -342,63 +308,29 @@ removeHashTable(HashTable *table, StgWord key, void *data)
 void
 freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 {
-    long segment;
-    long index;
-    HashList *hl;
-    HashList *next;
-    HashListChunk *cl, *cl_next;
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-        while (index >= 0) {
-            for (hl = table->dir[segment][index]; hl != NULL; hl = next) {
-                next = hl->next;
-                if (freeDataFun != NULL)
-                    (*freeDataFun)(hl->data);
+    StgWord i;
+
+    if (freeDataFun != NULL) {
+        for (i = 0; i <= table->mask; i++) {
+            if (table->slots[i].hash != EMPTY_HASH) {
+                (*freeDataFun)(table->slots[i].data);
             }
-            index--;
         }
-        stgFree(table->dir[segment]);
-        segment--;
-        index = HSEGSIZE - 1;
-    }
-    for (cl = table->chunks; cl != NULL; cl = cl_next) {
-        cl_next = cl->next;
-        stgFree(cl->chunk);
-        stgFree(cl);
     }
+    stgFree(table->slots);
     stgFree(table);
 }
 
-/* -----------------------------------------------------------------------------
- * When we initialize a hash table, we set up the first segment as well,
- * initializing all of the first segment's hash buckets to NULL.
- * -------------------------------------------------------------------------- */
-
 HashTable *
 allocHashTable_(HashFunction *hash, CompareFunction *compare)
 {
     HashTable *table;
-    HashList **hb;
 
     table = stgMallocBytes(sizeof(HashTable),"allocHashTable");
 
-    allocSegment(table, 0);
-
-    for (hb = table->dir[0]; hb < table->dir[0] + HSEGSIZE; hb++)
-        *hb = NULL;
-
-    table->split = 0;
-    table->max = HSEGSIZE;
-    table->mask1 = HSEGSIZE - 1;
-    table->mask2 = 2 * HSEGSIZE - 1;
+    table->slots = allocSlots(HMINSIZE);
+    table->mask = HMINSIZE - 1;
     table->kcount = 0;
-    table->bcount = HSEGSIZE;
-    table->freeList = NULL;
-    table->chunks = NULL;
     table->hash = hash;
     table->compare = compare;
 
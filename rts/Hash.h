@@ -43,7 +43,10 @@ HashTable * allocStrHashTable ( void );
 #define removeStrHashTable(table, key, data) \
    (removeHashTable(table, (StgWord)key, data))
 
-/* Hash tables for arbitrary keys */
+/* Hash tables for arbitrary keys.  A HashFunction returns a hash in
+ * the range [0, 2^31) that does not depend on the size of the table;
+ * hashWord and hashStr can be used to mix arbitrary words and strings.
+ */
 typedef int HashFunction(HashTable *table, StgWord key);
 typedef int CompareFunction(StgWord key1, StgWord key2);
 HashTable * allocHashTable_(HashFunction *hash, CompareFunction *compare);
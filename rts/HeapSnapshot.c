@@ -0,0 +1,673 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Heap snapshots: write every closure of the heap, with its pointers, to
+ * a file for offline analysis (finding what retains a leak, say), in
+ * any build of the RTS.  The format is in
+ * includes/rts/HeapSnapshotFormat.h.
+ *
+ * A snapshot is asked for by hs_heap_snapshot(), or with +RTS
+ * --heap-snapshot-signal by a SIGUSR1, which set performHeapSnapshot.
+ * The scheduler then does a major GC, and the GC calls heapSnapshot()
+ * when it has finished, at the same point as it would do a heap census
+ * and for the same reason: the heap is tidy and nothing runs.
+ *
+ * The closures are found as in heapCensus(), and the work is shared out
+ * among the GC threads in the same way.  Each thread encodes the
+ * closures it finds into a buffer of its own, and only takes the lock
+ * on the file to write out a full buffer.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "RtsUtils.h"
+#include "Trace.h"
+#include "Capability.h"
+#include "Stable.h"
+#include "GetTime.h"
+#include "Apply.h"
+#include "HeapSnapshot.h"
+#include "sm/GCThread.h"
+#include "sm/GC.h"
+#include "rts/HeapSnapshotFormat.h"
+
+#include <string.h>
+
+volatile rtsBool performHeapSnapshot = rtsFalse;
+
+static nat snapshot_count = 0;          // snapshots written so far
+static FILE *snapshot_file = NULL;
+#if defined(THREADED_RTS)
+static Mutex snapshot_mutex;            // protects snapshot_file
+#endif
+
+#define SNAPSHOT_BUF_SIZE (64 * 1024)
+#define SNAPSHOT_CHUNK    64            // blocks claimed at a time
+
+typedef struct {
+    StgWord8    *buf;
+    nat          size;                  // of buf
+    nat          len;                   // bytes written to buf
+    nat          gen;                   // of the closures in buf
+    StgPtr       last;                  // end of the last closure in buf
+    StgClosure **edges;                 // pointers of the current closure
+    nat          n_edges;
+    nat          max_edges;
+} SnapshotBuffer;
+
+static SnapshotBuffer *snapshot_bufs;
+
+static bdescr **snapshot_chains;
+static nat n_snapshot_chains;
+static nat snapshot_chain;              // the next chain to claim from
+static bdescr *snapshot_next;           // the next block to claim
+#if defined(THREADED_RTS)
+static SpinLock snapshot_lock;
+#endif
+
+/* -----------------------------------------------------------------------------
+ * Encoding
+ * -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+putVarint( SnapshotBuffer *b, StgWord w )
+{
+    while (w >= 0x80) {
+        b->buf[b->len++] = (StgWord8)(w | 0x80);
+        w >>= 7;
+    }
+    b->buf[b->len++] = (StgWord8)w;
+}
+
+STATIC_INLINE void
+putSVarint( SnapshotBuffer *b, StgInt i )
+{
+    putVarint(b, i >= 0 ? (StgWord)i << 1 : ~((StgWord)i << 1));
+}
+
+static void
+writeVarint( FILE *f, StgWord w )
+{
+    while (w >= 0x80) {
+        fputc((int)((w | 0x80) & 0xff), f);
+        w >>= 7;
+    }
+    fputc((int)w, f);
+}
+
+// Write out the contents of b as a record with the given tag
+static void
+flushSnapshotBuffer( SnapshotBuffer *b, StgWord8 tag )
+{
+    if (b->len == 0) return;
+
+    ACQUIRE_LOCK(&snapshot_mutex);
+    fputc(tag, snapshot_file);
+    if (tag == HS_SNAP_CLOSURES) {
+        writeVarint(snapshot_file, b->gen);
+    }
+    writeVarint(snapshot_file, b->len);
+    fwrite(b->buf, 1, b->len, snapshot_file);
+    RELEASE_LOCK(&snapshot_mutex);
+
+    b->len = 0;
+    b->last = NULL;
+}
+
+// Make room for n more bytes in b
+static void
+reserveSnapshotBuffer( SnapshotBuffer *b, nat n, StgWord8 tag )
+{
+    if (b->len + n > b->size) {
+        flushSnapshotBuffer(b, tag);
+        if (n > b->size) {
+            b->size = n;
+            b->buf = stgReallocBytes(b->buf, b->size, "reserveSnapshotBuffer");
+        }
+    }
+}
+
+STATIC_INLINE void
+addEdge( SnapshotBuffer *b, StgClosure *p )
+{
+    if (p == NULL) return;
+    if (b->n_edges == b->max_edges) {
+        b->max_edges *= 2;
+        b->edges = stgReallocBytes(b->edges,
+                                   b->max_edges * sizeof(StgClosure *),
+                                   "addEdge");
+    }
+    b->edges[b->n_edges++] = UNTAG_CLOSURE(p);
+}
+
+// Encode a closure, with the pointers collected in b->edges
+static void
+putClosure( SnapshotBuffer *b, StgPtr p, const StgInfoTable *info,
+            nat type, nat size )
+{
+    nat i;
+
+    // five varints and a varint per edge, of at most 10 bytes each
+    reserveSnapshotBuffer(b, (5 + b->n_edges) * 10, HS_SNAP_CLOSURES);
+
+    putSVarint(b, b->last == NULL ? (StgInt)((StgWord)p / sizeof(W_))
+                                  : (StgInt)(p - b->last));
+    putVarint(b, (StgWord)info);
+    putVarint(b, type);
+    putVarint(b, size);
+    putVarint(b, b->n_edges);
+    for (i = 0; i < b->n_edges; i++) {
+        putSVarint(b, ((StgInt)(StgWord)b->edges[i] - (StgInt)(StgWord)p)
+                      / (StgInt)sizeof(W_));
+    }
+    b->last = p + size;
+    b->n_edges = 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * Finding the pointers of a closure
+ *
+ * These follow the scavenging code in sm/Scav.c, without the SRTs: they
+ * only point to static closures, which the tool can not see anyway.
+ * -------------------------------------------------------------------------- */
+
+static void
+addPtrs( SnapshotBuffer *b, StgPtr p, StgPtr end )
+{
+    for (; p < end; p++) {
+        addEdge(b, (StgClosure *)*p);
+    }
+}
+
+static void
+addSmallBitmap( SnapshotBuffer *b, StgPtr p, StgWord size, StgWord bitmap )
+{
+    for (; size > 0; size--, p++, bitmap >>= 1) {
+        if ((bitmap & 1) == 0) {
+            addEdge(b, (StgClosure *)*p);
+        }
+    }
+}
+
+static void
+addLargeBitmap( SnapshotBuffer *b, StgPtr p, StgLargeBitmap *large_bitmap,
+                StgWord size )
+{
+    nat i, j, n;
+    StgWord bitmap;
+
+    for (i = 0, n = 0; i < size; n++) {
+        bitmap = large_bitmap->bitmap[n];
+        j = stg_min(size-i, BITS_IN(W_));
+        i += j;
+        for (; j > 0; j--, p++, bitmap >>= 1) {
+            if ((bitmap & 1) == 0) {
+                addEdge(b, (StgClosure *)*p);
+            }
+        }
+    }
+}
+
+static StgPtr
+addArgBlock( SnapshotBuffer *b, StgFunInfoTable *fun_info, StgClosure **args )
+{
+    StgPtr p;
+    StgWord size;
+
+    p = (StgPtr)args;
+    switch (fun_info->f.fun_type) {
+    case ARG_GEN:
+        size = BITMAP_SIZE(fun_info->f.b.bitmap);
+        addSmallBitmap(b, p, size, BITMAP_BITS(fun_info->f.b.bitmap));
+        break;
+    case ARG_GEN_BIG:
+        size = GET_FUN_LARGE_BITMAP(fun_info)->size;
+        addLargeBitmap(b, p, GET_FUN_LARGE_BITMAP(fun_info), size);
+        break;
+    default:
+        size = BITMAP_SIZE(stg_arg_bitmaps[fun_info->f.fun_type]);
+        addSmallBitmap(b, p, size,
+                       BITMAP_BITS(stg_arg_bitmaps[fun_info->f.fun_type]));
+        break;
+    }
+    return p + size;
+}
+
+static void
+addPAPPayload( SnapshotBuffer *b, StgClosure *fun, StgClosure **payload,
+               StgWord size )
+{
+    StgFunInfoTable *fun_info;
+
+    addEdge(b, fun);
+    fun_info = get_fun_itbl(UNTAG_CLOSURE(fun));
+
+    switch (fun_info->f.fun_type) {
+    case ARG_GEN:
+        addSmallBitmap(b, (StgPtr)payload, size,
+                       BITMAP_BITS(fun_info->f.b.bitmap));
+        break;
+    case ARG_GEN_BIG:
+        addLargeBitmap(b, (StgPtr)payload, GET_FUN_LARGE_BITMAP(fun_info), size);
+        break;
+    case ARG_BCO:
+        addLargeBitmap(b, (StgPtr)payload, BCO_BITMAP(fun), size);
+        break;
+    default:
+        addSmallBitmap(b, (StgPtr)payload, size,
+                       BITMAP_BITS(stg_arg_bitmaps[fun_info->f.fun_type]));
+        break;
+    }
+}
+
+static void
+addStack( SnapshotBuffer *b, StgPtr p, StgPtr stack_end )
+{
+    const StgRetInfoTable *info;
+    StgWord size;
+
+    while (p < stack_end) {
+        info = get_ret_itbl((StgClosure *)p);
+
+        switch (info->i.type) {
+
+        case UPDATE_FRAME:
+            addEdge(b, ((StgUpdateFrame *)p)->updatee);
+            p += sizeofW(StgUpdateFrame);
+            continue;
+
+        case CATCH_STM_FRAME:
+        case CATCH_RETRY_FRAME:
+        case ATOMICALLY_FRAME:
+        case UNDERFLOW_FRAME:
+        case STOP_FRAME:
+        case CATCH_FRAME:
+        case RET_SMALL:
+            size = BITMAP_SIZE(info->i.layout.bitmap);
+            p++;
+            addSmallBitmap(b, p, size, BITMAP_BITS(info->i.layout.bitmap));
+            p += size;
+            continue;
+
+        case RET_BCO: {
+            StgBCO *bco;
+
+            p++;
+            addEdge(b, (StgClosure *)*p);
+            bco = (StgBCO *)*p;
+            p++;
+            size = BCO_BITMAP_SIZE(bco);
+            addLargeBitmap(b, p, BCO_BITMAP(bco), size);
+            p += size;
+            continue;
+        }
+
+        case RET_BIG:
+            size = GET_LARGE_BITMAP(&info->i)->size;
+            p++;
+            addLargeBitmap(b, p, GET_LARGE_BITMAP(&info->i), size);
+            p += size;
+            continue;
+
+        case RET_FUN: {
+            StgRetFun *ret_fun = (StgRetFun *)p;
+
+            addEdge(b, ret_fun->fun);
+            p = addArgBlock(b, get_fun_itbl(UNTAG_CLOSURE(ret_fun->fun)),
+                            ret_fun->payload);
+            continue;
+        }
+
+        default:
+            barf("heapSnapshot: weird activation record found on stack: %d",
+                 (int)(info->i.type));
+        }
+    }
+}
+
+// Encode the closure at p, and return its size
+static nat
+snapshotClosure( SnapshotBuffer *b, StgPtr p )
+{
+    const StgInfoTable *info;
+    nat size;
+
+    info = get_itbl((StgClosure *)p);
+    size = closure_sizeW_((StgClosure *)p, (StgInfoTable *)info);
+
+    switch (info->type) {
+
+    case THUNK:
+    case THUNK_1_0:
+    case THUNK_0_1:
+    case THUNK_2_0:
+    case THUNK_1_1:
+    case THUNK_0_2:
+        addPtrs(b, (StgPtr)((StgThunk *)p)->payload,
+                (StgPtr)((StgThunk *)p)->payload + info->layout.payload.ptrs);
+        break;
+
+    case THUNK_SELECTOR:
+        addEdge(b, ((StgSelector *)p)->selectee);
+        break;
+
+    case FUN:
+    case FUN_1_0:
+    case FUN_0_1:
+    case FUN_2_0:
+    case FUN_1_1:
+    case FUN_0_2:
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_0_1:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case CONSTR_0_2:
+    case WEAK:
+    case PRIM:
+    case MUT_PRIM:
+        addPtrs(b, (StgPtr)((StgClosure *)p)->payload,
+                (StgPtr)((StgClosure *)p)->payload + info->layout.payload.ptrs);
+        break;
+
+    case IND:
+    case IND_PERM:
+    case BLACKHOLE:
+        addEdge(b, ((StgInd *)p)->indirectee);
+        break;
+
+    case BLOCKING_QUEUE: {
+        StgBlockingQueue *bq = (StgBlockingQueue *)p;
+        addEdge(b, bq->bh);
+        addEdge(b, (StgClosure *)bq->owner);
+        addEdge(b, (StgClosure *)bq->queue);
+        addEdge(b, (StgClosure *)bq->link);
+        break;
+    }
+
+    case MVAR_CLEAN:
+    case MVAR_DIRTY: {
+        StgMVar *mvar = (StgMVar *)p;
+        addEdge(b, (StgClosure *)mvar->head);
+        addEdge(b, (StgClosure *)mvar->tail);
+        addEdge(b, mvar->value);
+        break;
+    }
+
+    case TVAR: {
+        StgTVar *tvar = (StgTVar *)p;
+        addEdge(b, tvar->current_value);
+        addEdge(b, (StgClosure *)tvar->first_watch_queue_entry);
+        break;
+    }
+
+    case MUT_VAR_CLEAN:
+    case MUT_VAR_DIRTY:
+        addEdge(b, ((StgMutVar *)p)->var);
+        break;
+
+    case AP:
+        addPAPPayload(b, ((StgAP *)p)->fun, ((StgAP *)p)->payload,
+                      ((StgAP *)p)->n_args);
+        break;
+
+    case PAP:
+        addPAPPayload(b, ((StgPAP *)p)->fun, ((StgPAP *)p)->payload,
+                      ((StgPAP *)p)->n_args);
+        break;
+
+    case AP_STACK: {
+        StgAP_STACK *ap = (StgAP_STACK *)p;
+        addEdge(b, ap->fun);
+        addStack(b, (StgPtr)ap->payload, (StgPtr)ap->payload + ap->size);
+        break;
+    }
+
+    case BCO: {
+        StgBCO *bco = (StgBCO *)p;
+        addEdge(b, (StgClosure *)bco->instrs);
+        addEdge(b, (StgClosure *)bco->literals);
+        addEdge(b, (StgClosure *)bco->ptrs);
+        break;
+    }
+
+    case ARR_WORDS:
+        break;
+
+    case MUT_ARR_PTRS_CLEAN:
+    case MUT_ARR_PTRS_DIRTY:
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0: {
+        StgMutArrPtrs *a = (StgMutArrPtrs *)p;
+        addPtrs(b, (StgPtr)a->payload, (StgPtr)a->payload + a->ptrs);
+        break;
+    }
+
+    case SMALL_MUT_ARR_PTRS_CLEAN:
+    case SMALL_MUT_ARR_PTRS_DIRTY:
+    case SMALL_MUT_ARR_PTRS_FROZEN:
+    case SMALL_MUT_ARR_PTRS_FROZEN0: {
+        StgSmallMutArrPtrs *a = (StgSmallMutArrPtrs *)p;
+        addPtrs(b, (StgPtr)a->payload, (StgPtr)a->payload + a->ptrs);
+        break;
+    }
+
+    case TSO: {
+        StgTSO *tso = (StgTSO *)p;
+        addEdge(b, (StgClosure *)tso->stackobj);
+        addEdge(b, (StgClosure *)tso->_link);
+        addEdge(b, (StgClosure *)tso->blocked_exceptions);
+        addEdge(b, (StgClosure *)tso->bq);
+        addEdge(b, (StgClosure *)tso->trec);
+        if (   tso->why_blocked == BlockedOnMVar
+            || tso->why_blocked == BlockedOnMVarRead
+            || tso->why_blocked == BlockedOnBlackHole
+            || tso->why_blocked == BlockedOnMsgThrowTo
+            || tso->why_blocked == NotBlocked) {
+            addEdge(b, tso->block_info.closure);
+        }
+        break;
+    }
+
+    case STACK: {
+        StgStack *stack = (StgStack *)p;
+        addStack(b, stack->sp, stack->stack + stack->stack_size);
+        break;
+    }
+
+    case TREC_CHUNK: {
+        StgTRecChunk *tc = (StgTRecChunk *)p;
+        TRecEntry *e = &tc->entries[0];
+        StgWord i;
+        addEdge(b, (StgClosure *)tc->prev_chunk);
+        for (i = 0; i < tc->next_entry_idx; i++, e++) {
+            addEdge(b, (StgClosure *)e->tvar);
+            addEdge(b, e->expected_value);
+            addEdge(b, e->new_value);
+        }
+        break;
+    }
+
+    default:
+        barf("heapSnapshot: unknown object: %d", info->type);
+    }
+
+    putClosure(b, p, info, info->type, size);
+    return size;
+}
+
+static void
+snapshotBlock( SnapshotBuffer *b, bdescr *bd )
+{
+    StgPtr p;
+
+    if (bd->gen_no != b->gen) {
+        flushSnapshotBuffer(b, HS_SNAP_CLOSURES);
+        b->gen = bd->gen_no;
+    }
+
+    // As in heapCensusBlock(): the objects of a pinned block can't be
+    // told apart, so it goes in as one, without an info pointer
+    if (bd->flags & BF_PINNED) {
+        putClosure(b, bd->start, NULL, ARR_WORDS, bd->blocks * BLOCK_SIZE_W);
+        return;
+    }
+
+    p = bd->start;
+    while (p < bd->free) {
+        p += snapshotClosure(b, p);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Sharing out the work, as in heapCensus()
+ * -------------------------------------------------------------------------- */
+
+static bdescr *
+claimSnapshotChunk( void )
+{
+    bdescr *bd, *first;
+    nat n;
+
+    ACQUIRE_SPIN_LOCK(&snapshot_lock);
+    while (snapshot_next == NULL && snapshot_chain < n_snapshot_chains) {
+        snapshot_next = snapshot_chains[snapshot_chain++];
+    }
+    first = snapshot_next;
+    for (bd = first, n = 0; bd != NULL && n < SNAPSHOT_CHUNK; n++) {
+        bd = bd->link;
+    }
+    snapshot_next = bd;
+    RELEASE_SPIN_LOCK(&snapshot_lock);
+
+    return first;
+}
+
+static void
+heapSnapshotWorker( nat me )
+{
+    SnapshotBuffer *b = &snapshot_bufs[me];
+    bdescr *bd;
+    nat n;
+
+    while ((bd = claimSnapshotChunk()) != NULL) {
+        for (n = 0; bd != NULL && n < SNAPSHOT_CHUNK; bd = bd->link, n++) {
+            snapshotBlock(b, bd);
+        }
+    }
+    flushSnapshotBuffer(b, HS_SNAP_CLOSURES);
+}
+
+static void
+snapshotRoot( void *user, StgClosure **root )
+{
+    SnapshotBuffer *b = (SnapshotBuffer *)user;
+
+    reserveSnapshotBuffer(b, 10, HS_SNAP_ROOTS);
+    putVarint(b, (StgWord)UNTAG_CLOSURE(*root));
+}
+
+/* -----------------------------------------------------------------------------
+ * Taking a snapshot
+ * -------------------------------------------------------------------------- */
+
+void
+heapSnapshot( void )
+{
+    char *filename;
+    nat g, n, i;
+    gen_workspace *ws;
+    StgWeak *weak;
+    SnapshotBuffer *b;
+
+    filename = stgMallocBytes(strlen(prog_name) + 10 /* .%d */
+                              + 10 /* .snapshot */, "heapSnapshot");
+    sprintf(filename, "%s.%d.snapshot", prog_name, ++snapshot_count);
+    snapshot_file = fopen(filename, "wb");
+    if (snapshot_file == NULL) {
+        sysErrorBelch("heapSnapshot: can't open %s", filename);
+        stgFree(filename);
+        return;
+    }
+    debugTrace(DEBUG_gc, "writing heap snapshot to %s", filename);
+    stgFree(filename);
+
+    fwrite(HS_SNAP_MAGIC, 1, HS_SNAP_MAGIC_LEN, snapshot_file);
+    fputc(HS_SNAP_HEADER, snapshot_file);
+    writeVarint(snapshot_file, sizeof(W_));
+    writeVarint(snapshot_file, RtsFlags.GcFlags.generations);
+    writeVarint(snapshot_file,
+                (StgWord)(TimeToNS(getProcessElapsedTime()) / 1000000));
+
+    snapshot_chains = stgMallocBytes(RtsFlags.GcFlags.generations *
+                                     (2 + 3 * n_capabilities) *
+                                     sizeof(bdescr *),
+                                     "heapSnapshot");
+    i = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        snapshot_chains[i++] = generations[g].blocks;
+        snapshot_chains[i++] = generations[g].large_objects;
+        for (n = 0; n < n_capabilities; n++) {
+            ws = &gc_threads[n]->gens[g];
+            snapshot_chains[i++] = ws->todo_bd;
+            snapshot_chains[i++] = ws->part_list;
+            snapshot_chains[i++] = ws->scavd_list;
+        }
+    }
+    n_snapshot_chains = i;
+    snapshot_chain = 0;
+    snapshot_next = NULL;
+#if defined(THREADED_RTS)
+    initSpinLock(&snapshot_lock);
+    initMutex(&snapshot_mutex);
+#endif
+
+    snapshot_bufs = stgMallocBytes(n_capabilities * sizeof(SnapshotBuffer),
+                                   "heapSnapshot");
+    for (n = 0; n < n_capabilities; n++) {
+        b = &snapshot_bufs[n];
+        b->size = SNAPSHOT_BUF_SIZE;
+        b->buf = stgMallocBytes(b->size, "heapSnapshot");
+        b->len = 0;
+        b->gen = 0;
+        b->last = NULL;
+        b->max_edges = 64;
+        b->edges = stgMallocBytes(b->max_edges * sizeof(StgClosure *),
+                                  "heapSnapshot");
+        b->n_edges = 0;
+    }
+
+    runOnGcThreads(heapSnapshotWorker);
+
+    // The roots, as found by the retainer profiler (see
+    // computeRetainerSet())
+    b = &snapshot_bufs[0];
+    markCapabilities(snapshotRoot, b);
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        for (weak = generations[g].weak_ptr_list; weak != NULL;
+             weak = weak->link) {
+            snapshotRoot(b, (StgClosure **)&weak);
+        }
+    }
+    markStableTables(snapshotRoot, b);
+    flushSnapshotBuffer(b, HS_SNAP_ROOTS);
+
+    fputc(HS_SNAP_END, snapshot_file);
+    fclose(snapshot_file);
+    snapshot_file = NULL;
+
+    for (n = 0; n < n_capabilities; n++) {
+        stgFree(snapshot_bufs[n].buf);
+        stgFree(snapshot_bufs[n].edges);
+    }
+    stgFree(snapshot_bufs);
+    snapshot_bufs = NULL;
+    stgFree(snapshot_chains);
+    snapshot_chains = NULL;
+#if defined(THREADED_RTS)
+    closeMutex(&snapshot_mutex);
+#endif
+}
@@ -0,0 +1,25 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Heap snapshots for offline analysis.  The format is in
+ * includes/rts/HeapSnapshotFormat.h.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef HEAPSNAPSHOT_H
+#define HEAPSNAPSHOT_H
+
+#include "BeginPrivate.h"
+
+// Set by hs_heap_snapshot() and the SIGUSR1 handler: the next GC is a
+// major one and writes a snapshot
+extern volatile rtsBool performHeapSnapshot;
+
+// Write <prog>.<n>.snapshot; called by the GC when it has finished, with
+// the other GC threads waiting to continue
+void heapSnapshot (void);
+
+#include "EndPrivate.h"
+
+#endif /* HEAPSNAPSHOT_H */
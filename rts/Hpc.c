@@ -30,12 +30,33 @@
 /* This is the runtime support for the Haskell Program Coverage (hpc) toolkit,
  * inside GHC.
  *
+ * The .tix file is normally the text that the hpc tool reads, but if
+ * HPCTIXBINARY is set in the environment, or the existing .tix file is
+ * already binary, it is written in a binary format instead, which is
+ * much quicker to read and write for a large program.  All of it is in
+ * host byte order, and every field is aligned to its size, so that
+ * another program can mmap() the file and use the tick arrays in place:
+ *
+ *   TIX_BINARY_MAGIC (8 bytes)
+ *   StgWord64 1                  -- to check the byte order
+ *   StgWord64 number of modules
+ *   for each module:
+ *     StgWord32 length of the name, StgWord32 hash number,
+ *     StgWord32 number of ticks, StgWord32 0
+ *     the name, padded with zeroes to a multiple of 8 bytes
+ *     StgWord64 ticks[number of ticks]
  */
 
+#define TIX_BINARY_MAGIC     "\211TIX\r\n\032\n"
+#define TIX_BINARY_MAGIC_LEN 8
+
 static int hpc_inited = 0;              // Have you started this component?
 static pid_t hpc_pid = 0;               // pid of this process at hpc-boot time.
                                         // Only this pid will read or write .tix file(s).
-static FILE *tixFile;                   // file being read/written
+static rtsBool tix_binary = rtsFalse;   // write the binary format
+static char *tix_buf;                   // contents of the .tix file being read
+static size_t tix_size;
+static size_t tix_pos;                  // position of the next char
 static int tix_ch;                      // current char
 
 static HashTable * moduleHash = NULL;   // module name -> HpcModuleInfo
@@ -56,12 +77,29 @@ failure(char *msg) {
   stg_exit(1);
 }
 
+STATIC_INLINE int nextChar(void) {
+  return tix_pos < tix_size ? (unsigned char)tix_buf[tix_pos++] : EOF;
+}
+
+// Read the whole of the .tix file into tix_buf
 static int init_open(FILE *file) {
-  tixFile = file;
- if (tixFile == 0) {
+  long size;
+
+  if (file == 0) {
     return 0;
   }
-  tix_ch = getc(tixFile);
+  if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET) != 0) {
+    failure("cannot find the size of the .tix file");
+  }
+  tix_size = size;
+  tix_buf = stgMallocBytes(tix_size + 1, "Hpc.init_open");
+  if (fread(tix_buf, 1, tix_size, file) != tix_size) {
+    failure("cannot read the .tix file");
+  }
+  fclose(file);
+  tix_pos = 0;
+  tix_ch = nextChar();
   return 1;
 }
 
@@ -70,27 +108,31 @@ static void expect(char c) {
     fprintf(stderr,"('%c' '%c')\n",tix_ch,c);
     failure("parse error when reading .tix file");
   }
-  tix_ch = getc(tixFile);
+  tix_ch = nextChar();
 }
 
 static void ws(void) {
   while (tix_ch == ' ') {
-    tix_ch = getc(tixFile);
+    tix_ch = nextChar();
   }
 }
 
 static char *expectString(void) {
-  char tmp[256], *res; // XXX
-  int tmp_ix = 0;
+  char *res;
+  size_t start, len;
   expect('"');
+  start = tix_pos - 1;          // of tix_ch
   while (tix_ch != '"') {
-    tmp[tmp_ix++] = tix_ch;
-    tix_ch = getc(tixFile);
+    if (tix_ch == EOF) {
+      failure("parse error when reading .tix file");
+    }
+    tix_ch = nextChar();
   }
-  tmp[tmp_ix++] = 0;
+  len = tix_pos - 1 - start;
   expect('"');
-  res = stgMallocBytes(tmp_ix,"Hpc.expectString");
-  strcpy(res,tmp);
+  res = stgMallocBytes(len + 1,"Hpc.expectString");
+  memcpy(res, tix_buf + start, len);
+  res[len] = 0;
   return res;
 }
 
@@ -98,15 +140,49 @@ static StgWord64 expectWord64(void) {
   StgWord64 tmp = 0;
   while (isdigit(tix_ch)) {
     tmp = tmp * 10 + (tix_ch -'0');
-    tix_ch = getc(tixFile);
+    tix_ch = nextChar();
   }
   return tmp;
 }
 
+// Add a module read from the .tix file: either it is new, or its ticks
+// go into the tix array of an existing one
+static void
+addTixModule(HpcModuleInfo *tmpModule) {
+  unsigned int i;
+  HpcModuleInfo *lookup;
+
+  lookup = lookupHashTable(moduleHash, (StgWord)tmpModule->modName);
+  if (lookup == NULL) {
+      debugTrace(DEBUG_hpc,"readTix: new HpcModuleInfo for %s",
+                 tmpModule->modName);
+      insertHashTable(moduleHash, (StgWord)tmpModule->modName, tmpModule);
+  } else {
+      ASSERT(lookup->tixArr != 0);
+      ASSERT(!strcmp(tmpModule->modName, lookup->modName));
+      debugTrace(DEBUG_hpc,"readTix: existing HpcModuleInfo for %s",
+                 tmpModule->modName);
+      if (tmpModule->hashNo != lookup->hashNo) {
+          fprintf(stderr,"in module '%s'\n",tmpModule->modName);
+          failure("module mismatch with .tix/.mix file hash number");
+          if (tixFilename != NULL) {
+              fprintf(stderr,"(perhaps remove %s ?)\n",tixFilename);
+          }
+          stg_exit(EXIT_FAILURE);
+      }
+      for (i=0; i < tmpModule->tickCount; i++) {
+          lookup->tixArr[i] = tmpModule->tixArr[i];
+      }
+      stgFree(tmpModule->tixArr);
+      stgFree(tmpModule->modName);
+      stgFree(tmpModule);
+  }
+}
+
 static void
 readTix(void) {
   unsigned int i;
-  HpcModuleInfo *tmpModule, *lookup;
+  HpcModuleInfo *tmpModule;
 
   ws();
   expect('T');
@@ -150,31 +226,7 @@ readTix(void) {
     expect(']');
     ws();
 
-    lookup = lookupHashTable(moduleHash, (StgWord)tmpModule->modName);
-    if (lookup == NULL) {
-        debugTrace(DEBUG_hpc,"readTix: new HpcModuleInfo for %s",
-                   tmpModule->modName);
-        insertHashTable(moduleHash, (StgWord)tmpModule->modName, tmpModule);
-    } else {
-        ASSERT(lookup->tixArr != 0);
-        ASSERT(!strcmp(tmpModule->modName, lookup->modName));
-        debugTrace(DEBUG_hpc,"readTix: existing HpcModuleInfo for %s",
-                   tmpModule->modName);
-        if (tmpModule->hashNo != lookup->hashNo) {
-            fprintf(stderr,"in module '%s'\n",tmpModule->modName);
-            failure("module mismatch with .tix/.mix file hash number");
-            if (tixFilename != NULL) {
-                fprintf(stderr,"(perhaps remove %s ?)\n",tixFilename);
-            }
-            stg_exit(EXIT_FAILURE);
-        }
-        for (i=0; i < tmpModule->tickCount; i++) {
-            lookup->tixArr[i] = tmpModule->tixArr[i];
-        }
-        stgFree(tmpModule->tixArr);
-        stgFree(tmpModule->modName);
-        stgFree(tmpModule);
-    }
+    addTixModule(tmpModule);
 
     if (tix_ch == ',') {
       expect(',');
@@ -182,7 +234,63 @@ readTix(void) {
     }
   }
   expect(']');
-  fclose(tixFile);
+}
+
+// Returns the next n bytes of the binary .tix file in tix_buf
+static char *
+takeBytes(size_t n) {
+  char *p;
+  if (tix_size - tix_pos < n) {
+    failure("unexpected end of binary .tix file");
+  }
+  p = tix_buf + tix_pos;
+  tix_pos += n;
+  return p;
+}
+
+static StgWord32
+takeWord32(void) {
+  StgWord32 w;
+  memcpy(&w, takeBytes(sizeof(w)), sizeof(w));
+  return w;
+}
+
+static StgWord64
+takeWord64(void) {
+  StgWord64 w;
+  memcpy(&w, takeBytes(sizeof(w)), sizeof(w));
+  return w;
+}
+
+static void
+readBinaryTix(void) {
+  StgWord64 n;
+  StgWord32 len;
+  HpcModuleInfo *tmpModule;
+
+  tix_pos = TIX_BINARY_MAGIC_LEN;
+  if (takeWord64() != 1) {
+    failure("binary .tix file has the wrong byte order");
+  }
+  for (n = takeWord64(); n > 0; n--) {
+    tmpModule = (HpcModuleInfo *)stgMallocBytes(sizeof(HpcModuleInfo),
+                                                "Hpc.readBinaryTix");
+    tmpModule->from_file = rtsTrue;
+    len = takeWord32();
+    tmpModule->hashNo = takeWord32();
+    tmpModule->tickCount = takeWord32();
+    (void)takeWord32();
+    tmpModule->modName = stgMallocBytes(len + 1, "Hpc.readBinaryTix");
+    memcpy(tmpModule->modName, takeBytes(len), len);
+    tmpModule->modName[len] = 0;
+    (void)takeBytes((8 - len % 8) % 8);
+    tmpModule->tixArr = (StgWord64 *)calloc(tmpModule->tickCount,sizeof(StgWord64));
+    memcpy(tmpModule->tixArr,
+           takeBytes(tmpModule->tickCount * sizeof(StgWord64)),
+           tmpModule->tickCount * sizeof(StgWord64));
+
+    addTixModule(tmpModule);
+  }
 }
 
 void
@@ -232,8 +340,18 @@ startupHpc(void)
     sprintf(tixFilename, "%s.tix", prog_name);
   }
 
-  if (init_open(fopen(tixFilename,"r"))) {
-    readTix();
+  tix_binary = getenv("HPCTIXBINARY") != NULL;
+
+  if (init_open(fopen(tixFilename,"rb"))) {
+    if (tix_size >= TIX_BINARY_MAGIC_LEN &&
+        !memcmp(tix_buf, TIX_BINARY_MAGIC, TIX_BINARY_MAGIC_LEN)) {
+      tix_binary = rtsTrue;
+      readBinaryTix();
+    } else {
+      readTix();
+    }
+    stgFree(tix_buf);
+    tix_buf = NULL;
   }
 }
 
@@ -360,6 +478,53 @@ writeTix(FILE *f) {
   fclose(f);
 }
 
+static void
+writeBinaryTix(FILE *f) {
+  HpcModuleInfo *tmpModule;
+  StgWord64 n, one;
+  StgWord32 hdr[4];
+  static const char pad[8] = { 0 };
+  unsigned int i;
+
+  if (f == 0) {
+    return;
+  }
+
+  n = 0;
+  for (tmpModule = modules; tmpModule != 0; tmpModule = tmpModule->next) {
+    n++;
+  }
+
+  fwrite(TIX_BINARY_MAGIC, 1, TIX_BINARY_MAGIC_LEN, f);
+  one = 1;
+  fwrite(&one, sizeof(one), 1, f);
+  fwrite(&n, sizeof(n), 1, f);
+
+  for (tmpModule = modules; tmpModule != 0; tmpModule = tmpModule->next) {
+    hdr[0] = strlen(tmpModule->modName);
+    hdr[1] = tmpModule->hashNo;
+    hdr[2] = tmpModule->tickCount;
+    hdr[3] = 0;
+    fwrite(hdr, sizeof(StgWord32), 4, f);
+    fwrite(tmpModule->modName, 1, hdr[0], f);
+    fwrite(pad, 1, (8 - hdr[0] % 8) % 8, f);
+    debugTrace(DEBUG_hpc,"%s: %u (hash=%u)\n",
+               tmpModule->modName,
+               (nat)tmpModule->tickCount,
+               (nat)tmpModule->hashNo);
+
+    if (tmpModule->tixArr) {
+      fwrite(tmpModule->tixArr, sizeof(StgWord64), tmpModule->tickCount, f);
+    } else {
+      for (i = 0; i < tmpModule->tickCount; i++) {
+        fwrite(pad, 1, sizeof(StgWord64), f);
+      }
+    }
+  }
+
+  fclose(f);
+}
+
 static void
 freeHpcModuleInfo (HpcModuleInfo *mod)
 {
@@ -386,8 +551,11 @@ exitHpc(void) {
   // not clober the .tix file.
 
   if (hpc_pid == getpid()) {
-    FILE *f = fopen(tixFilename,"w");
-    writeTix(f);
+    if (tix_binary) {
+      writeBinaryTix(fopen(tixFilename,"wb"));
+    } else {
+      writeTix(fopen(tixFilename,"w"));
+    }
   }
 
   freeHashTable(moduleHash, (void (*)(void *))freeHpcModuleInfo);
@@ -12,6 +12,11 @@
 
 #include "Stable.h"
 #include "Task.h"
+#include "HeapSnapshot.h"
+
+#ifdef TRACING
+#include "eventlog/EventLog.h"
+#endif
 
 // hs_init and hs_exit are defined in RtsStartup.c
 
@@ -28,6 +33,29 @@ hs_perform_gc(void)
     performMajorGC();
 }
 
+void
+hs_dump_eventlog(void)
+{
+#ifdef TRACING
+    if (RtsFlags.TraceFlags.ring_size != 0) {
+        /* --eventlog-ring: the dump is done while the GC has all the
+           capabilities stopped */
+        performEventLogDump = rtsTrue;
+        performGC();
+    } else {
+        flushEventLog();
+    }
+#endif
+}
+
+void
+hs_heap_snapshot(void)
+{
+    /* the snapshot is written at the end of the major GC */
+    performHeapSnapshot = rtsTrue;
+    performMajorGC();
+}
+
 void hs_lock_stable_tables (void)
 {
     stableLock();
@@ -195,6 +195,40 @@ void interp_shutdown ( void )
 
 #endif
 
+/* -----------------------------------------------------------------------------
+   Note [Threaded dispatch]
+
+   When the C compiler has labels as values (gcc and clang do), each
+   instruction jumps straight to the code of the next one through the
+   table dispatch_table, instead of back to the one switch at nextInsn.
+   That saves the bounds check of the switch, and gives each instruction
+   its own indirect jump, which the CPU predicts much better than one
+   jump shared by them all.
+
+   The DEBUG RTS keeps going through nextInsn, so that every instruction
+   can be traced, and so does INTERP_STATS, which counts them there.
+
+   Each INSTR(op) gives the instruction both its case label and the
+   label lbl_op in the table, and NEXT_INSN goes on to the next one.
+   -------------------------------------------------------------------------- */
+
+#if defined(__GNUC__) && !defined(DEBUG) && !defined(INTERP_STATS)
+#define THREADED_DISPATCH
+#endif
+
+#ifdef THREADED_DISPATCH
+#define INSTR(op) case bci_##op: lbl_##op
+#define NEXT_INSN                                                       \
+    do {                                                                \
+        bci = BCO_NEXT;                                                 \
+        if ((bci & 0xFF) > bci_SLIDE_ENTER) goto unknown_insn;          \
+        goto *dispatch_table[bci & 0xFF];                               \
+    } while (0)
+#else
+#define INSTR(op) case bci_##op
+#define NEXT_INSN goto nextInsn
+#endif
+
 static StgWord app_ptrs_itbl[] = {
     (W_)&stg_ap_p_info,
     (W_)&stg_ap_pp_info,
@@ -202,8 +236,96 @@ static StgWord app_ptrs_itbl[] = {
     (W_)&stg_ap_pppp_info,
     (W_)&stg_ap_ppppp_info,
     (W_)&stg_ap_pppppp_info,
+    (W_)&stg_ap_ppppppp_info,
 };
 
+/* -----------------------------------------------------------------------------
+   Note [Calling foreign functions directly]
+
+   The bytecode generator prepares an ffi_cif for each foreign call once,
+   when it links the BCO, so CCALL only has to copy the arguments out of
+   the stack and hand them to ffi_call().  But ffi_call() is slow for
+   what most calls need: it works out from the cif where each argument
+   goes every time it is called.
+
+   When every argument and the result are a word (a pointer or an
+   integer of the native size), a double, or nothing, and there are not
+   many arguments, the call is the same as a call of a C function with
+   that prototype, so we make it ourselves.  Smaller integers, floats
+   and every other calling convention still go through ffi_call(), as
+   the C compiler would pass them differently.
+   -------------------------------------------------------------------------- */
+
+#define MAX_DIRECT_ARGS 4
+
+static rtsBool
+isWordFFIType (ffi_type *t)
+{
+    switch (t->type) {
+    case FFI_TYPE_POINTER:
+        return rtsTrue;
+#if WORD_SIZE_IN_BITS == 64
+    case FFI_TYPE_SINT64:
+    case FFI_TYPE_UINT64:
+#else
+    case FFI_TYPE_SINT32:
+    case FFI_TYPE_UINT32:
+#endif
+        return t->size == sizeof(W_);
+    default:
+        return rtsFalse;
+    }
+}
+
+static rtsBool
+canCallDirectly (ffi_cif *cif)
+{
+    nat i;
+
+    if (cif->abi != FFI_DEFAULT_ABI || cif->nargs > MAX_DIRECT_ARGS) {
+        return rtsFalse;
+    }
+    for (i = 0; i < cif->nargs; i++) {
+        if (!isWordFFIType(cif->arg_types[i])) return rtsFalse;
+    }
+    return cif->rtype->type == FFI_TYPE_VOID   ||
+           cif->rtype->type == FFI_TYPE_DOUBLE ||
+           isWordFFIType(cif->rtype);
+}
+
+#define DIRECT_CALL(res, ty)                                            \
+    switch (nargs) {                                                    \
+    case 0: res ((ty (*)(void))fn)(); break;                            \
+    case 1: res ((ty (*)(W_))fn)(args[0]); break;                       \
+    case 2: res ((ty (*)(W_,W_))fn)(args[0], args[1]); break;           \
+    case 3: res ((ty (*)(W_,W_,W_))fn)(args[0], args[1], args[2]);      \
+            break;                                                      \
+    case 4: res ((ty (*)(W_,W_,W_,W_))fn)(args[0], args[1], args[2],    \
+                                          args[3]);                     \
+            break;                                                      \
+    default: barf("callDirectly: %d arguments", nargs);                 \
+    }
+
+// Call fn as ffi_call(cif, fn, ret, ...) would, for a cif that
+// canCallDirectly(); args are the argument words, in order.
+static void
+callDirectly (ffi_cif *cif, void (*fn)(void), W_ *ret, W_ *args)
+{
+    nat nargs = cif->nargs;
+
+    switch (cif->rtype->type) {
+    case FFI_TYPE_VOID:
+        DIRECT_CALL((void), void);
+        break;
+    case FFI_TYPE_DOUBLE:
+        DIRECT_CALL(*(double *)ret =, double);
+        break;
+    default:
+        DIRECT_CALL(*ret =, W_);
+        break;
+    }
+}
+
 HsStablePtr rts_breakpoint_io_action; // points to the IO action which is executed on a breakpoint
                                 // it is set in main/GHC.hs:runStmt
 
@@ -443,6 +565,12 @@ do_return:
         if (info == (StgInfoTable *)&stg_ap_pppppp_info) {
             n = 6; m = 6; goto do_apply;
         }
+        if (info == (StgInfoTable *)&stg_ap_ppppppp_info) {
+            n = 7; m = 7; goto do_apply;
+        }
+        if (info == (StgInfoTable *)&stg_ap_pppppppp_info) {
+            n = 8; m = 8; goto do_apply;
+        }
         goto do_return_unrecognised;
     }
 
@@ -792,6 +920,70 @@ run_BCO:
         register StgWord16* instrs    = (StgWord16*)(bco->instrs->payload);
         register StgWord*  literals   = (StgWord*)(&bco->literals->payload[0]);
         register StgPtr*   ptrs       = (StgPtr*)(&bco->ptrs->payload[0]);
+#ifdef THREADED_DISPATCH
+        // See Note [Threaded dispatch]; every opcode up to
+        // bci_SLIDE_ENTER must have an entry
+        static const void *const dispatch_table[bci_SLIDE_ENTER + 1] = {
+            [0]                     = &&unknown_insn,
+            [bci_STKCHECK          ] = &&lbl_STKCHECK,
+            [bci_PUSH_L            ] = &&lbl_PUSH_L,
+            [bci_PUSH_LL           ] = &&lbl_PUSH_LL,
+            [bci_PUSH_LLL          ] = &&lbl_PUSH_LLL,
+            [bci_PUSH_G            ] = &&lbl_PUSH_G,
+            [bci_PUSH_ALTS         ] = &&lbl_PUSH_ALTS,
+            [bci_PUSH_ALTS_P       ] = &&lbl_PUSH_ALTS_P,
+            [bci_PUSH_ALTS_N       ] = &&lbl_PUSH_ALTS_N,
+            [bci_PUSH_ALTS_F       ] = &&lbl_PUSH_ALTS_F,
+            [bci_PUSH_ALTS_D       ] = &&lbl_PUSH_ALTS_D,
+            [bci_PUSH_ALTS_L       ] = &&lbl_PUSH_ALTS_L,
+            [bci_PUSH_ALTS_V       ] = &&lbl_PUSH_ALTS_V,
+            [bci_PUSH_UBX          ] = &&lbl_PUSH_UBX,
+            [bci_PUSH_APPLY_N      ] = &&lbl_PUSH_APPLY_N,
+            [bci_PUSH_APPLY_F      ] = &&lbl_PUSH_APPLY_F,
+            [bci_PUSH_APPLY_D      ] = &&lbl_PUSH_APPLY_D,
+            [bci_PUSH_APPLY_L      ] = &&lbl_PUSH_APPLY_L,
+            [bci_PUSH_APPLY_V      ] = &&lbl_PUSH_APPLY_V,
+            [bci_PUSH_APPLY_P      ] = &&lbl_PUSH_APPLY_P,
+            [bci_PUSH_APPLY_PP     ] = &&lbl_PUSH_APPLY_PP,
+            [bci_PUSH_APPLY_PPP    ] = &&lbl_PUSH_APPLY_PPP,
+            [bci_PUSH_APPLY_PPPP   ] = &&lbl_PUSH_APPLY_PPPP,
+            [bci_PUSH_APPLY_PPPPP  ] = &&lbl_PUSH_APPLY_PPPPP,
+            [bci_PUSH_APPLY_PPPPPP ] = &&lbl_PUSH_APPLY_PPPPPP,
+            [25                    ] = &&unknown_insn,
+            [bci_SLIDE             ] = &&lbl_SLIDE,
+            [bci_ALLOC_AP          ] = &&lbl_ALLOC_AP,
+            [bci_ALLOC_AP_NOUPD    ] = &&lbl_ALLOC_AP_NOUPD,
+            [bci_ALLOC_PAP         ] = &&lbl_ALLOC_PAP,
+            [bci_MKAP              ] = &&lbl_MKAP,
+            [bci_MKPAP             ] = &&lbl_MKPAP,
+            [bci_UNPACK            ] = &&lbl_UNPACK,
+            [bci_PACK              ] = &&lbl_PACK,
+            [bci_TESTLT_I          ] = &&lbl_TESTLT_I,
+            [bci_TESTEQ_I          ] = &&lbl_TESTEQ_I,
+            [bci_TESTLT_F          ] = &&lbl_TESTLT_F,
+            [bci_TESTEQ_F          ] = &&lbl_TESTEQ_F,
+            [bci_TESTLT_D          ] = &&lbl_TESTLT_D,
+            [bci_TESTEQ_D          ] = &&lbl_TESTEQ_D,
+            [bci_TESTLT_P          ] = &&lbl_TESTLT_P,
+            [bci_TESTEQ_P          ] = &&lbl_TESTEQ_P,
+            [bci_CASEFAIL          ] = &&lbl_CASEFAIL,
+            [bci_JMP               ] = &&lbl_JMP,
+            [bci_CCALL             ] = &&lbl_CCALL,
+            [bci_SWIZZLE           ] = &&lbl_SWIZZLE,
+            [bci_ENTER             ] = &&lbl_ENTER,
+            [bci_RETURN            ] = &&lbl_RETURN,
+            [bci_RETURN_P          ] = &&lbl_RETURN_P,
+            [bci_RETURN_N          ] = &&lbl_RETURN_N,
+            [bci_RETURN_F          ] = &&lbl_RETURN_F,
+            [bci_RETURN_D          ] = &&lbl_RETURN_D,
+            [bci_RETURN_L          ] = &&lbl_RETURN_L,
+            [bci_RETURN_V          ] = &&lbl_RETURN_V,
+            [bci_BRK_FUN           ] = &&lbl_BRK_FUN,
+            [bci_TESTLT_W          ] = &&lbl_TESTLT_W,
+            [bci_TESTEQ_W          ] = &&lbl_TESTEQ_W,
+            [bci_SLIDE_ENTER       ] = &&lbl_SLIDE_ENTER
+        };
+#endif
 #ifdef DEBUG
         int bcoSize;
         bcoSize = bco->instrs->bytes / sizeof(StgWord16);
@@ -802,7 +994,9 @@ run_BCO:
         it_lastopc = 0; /* no opcode */
 #endif
 
+#ifndef THREADED_DISPATCH
     nextInsn:
+#endif
         ASSERT(bciPtr < bcoSize);
         IF_DEBUG(interpreter,
                  //if (do_print_stack) {
@@ -840,7 +1034,7 @@ run_BCO:
     switch (bci & 0xFF) {
 
         /* check for a breakpoint on the beginning of a let binding */
-        case bci_BRK_FUN:
+        INSTR(BRK_FUN):
         {
             int arg1_brk_array, arg2_array_index, arg3_freeVars;
             StgArrWords *breakPoints;
@@ -927,10 +1121,10 @@ run_BCO:
             cap->r.rCurrentTSO->flags &= ~TSO_STOPPED_ON_BREAKPOINT;
 
             // continue normal execution of the byte code instructions
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_STKCHECK: {
+        INSTR(STKCHECK): {
             // Explicit stack check at the beginning of a function
             // *only* (stack checks in case alternatives are
             // propagated to the enclosing function).
@@ -941,27 +1135,27 @@ run_BCO:
                 Sp[0] = (W_)&stg_apply_interp_info;
                 RETURN_TO_SCHEDULER(ThreadInterpret, StackOverflow);
             } else {
-                goto nextInsn;
+                NEXT_INSN;
             }
         }
 
-        case bci_PUSH_L: {
+        INSTR(PUSH_L): {
             int o1 = BCO_NEXT;
             Sp[-1] = Sp[o1];
             Sp--;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_LL: {
+        INSTR(PUSH_LL): {
             int o1 = BCO_NEXT;
             int o2 = BCO_NEXT;
             Sp[-1] = Sp[o1];
             Sp[-2] = Sp[o2];
             Sp -= 2;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_LLL: {
+        INSTR(PUSH_LLL): {
             int o1 = BCO_NEXT;
             int o2 = BCO_NEXT;
             int o3 = BCO_NEXT;
@@ -969,107 +1163,107 @@ run_BCO:
             Sp[-2] = Sp[o2];
             Sp[-3] = Sp[o3];
             Sp -= 3;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_G: {
+        INSTR(PUSH_G): {
             int o1 = BCO_GET_LARGE_ARG;
             Sp[-1] = BCO_PTR(o1);
             Sp -= 1;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS: {
+        INSTR(PUSH_ALTS): {
             int o_bco  = BCO_GET_LARGE_ARG;
             Sp[-2] = (W_)&stg_ctoi_R1p_info;
             Sp[-1] = BCO_PTR(o_bco);
             Sp -= 2;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_P: {
+        INSTR(PUSH_ALTS_P): {
             int o_bco  = BCO_GET_LARGE_ARG;
             Sp[-2] = (W_)&stg_ctoi_R1unpt_info;
             Sp[-1] = BCO_PTR(o_bco);
             Sp -= 2;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_N: {
+        INSTR(PUSH_ALTS_N): {
             int o_bco  = BCO_GET_LARGE_ARG;
             Sp[-2] = (W_)&stg_ctoi_R1n_info;
             Sp[-1] = BCO_PTR(o_bco);
             Sp -= 2;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_F: {
+        INSTR(PUSH_ALTS_F): {
             int o_bco  = BCO_GET_LARGE_ARG;
             Sp[-2] = (W_)&stg_ctoi_F1_info;
             Sp[-1] = BCO_PTR(o_bco);
             Sp -= 2;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_D: {
+        INSTR(PUSH_ALTS_D): {
             int o_bco  = BCO_GET_LARGE_ARG;
             Sp[-2] = (W_)&stg_ctoi_D1_info;
             Sp[-1] = BCO_PTR(o_bco);
             Sp -= 2;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_L: {
+        INSTR(PUSH_ALTS_L): {
             int o_bco  = BCO_GET_LARGE_ARG;
             Sp[-2] = (W_)&stg_ctoi_L1_info;
             Sp[-1] = BCO_PTR(o_bco);
             Sp -= 2;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_ALTS_V: {
+        INSTR(PUSH_ALTS_V): {
             int o_bco  = BCO_GET_LARGE_ARG;
             Sp[-2] = (W_)&stg_ctoi_V_info;
             Sp[-1] = BCO_PTR(o_bco);
             Sp -= 2;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PUSH_APPLY_N:
+        INSTR(PUSH_APPLY_N):
             Sp--; Sp[0] = (W_)&stg_ap_n_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_V:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_V):
             Sp--; Sp[0] = (W_)&stg_ap_v_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_F:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_F):
             Sp--; Sp[0] = (W_)&stg_ap_f_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_D:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_D):
             Sp--; Sp[0] = (W_)&stg_ap_d_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_L:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_L):
             Sp--; Sp[0] = (W_)&stg_ap_l_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_P:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_P):
             Sp--; Sp[0] = (W_)&stg_ap_p_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PP:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_PP):
             Sp--; Sp[0] = (W_)&stg_ap_pp_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PPP:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_PPP):
             Sp--; Sp[0] = (W_)&stg_ap_ppp_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PPPP:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_PPPP):
             Sp--; Sp[0] = (W_)&stg_ap_pppp_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PPPPP:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_PPPPP):
             Sp--; Sp[0] = (W_)&stg_ap_ppppp_info;
-            goto nextInsn;
-        case bci_PUSH_APPLY_PPPPPP:
+            NEXT_INSN;
+        INSTR(PUSH_APPLY_PPPPPP):
             Sp--; Sp[0] = (W_)&stg_ap_pppppp_info;
-            goto nextInsn;
+            NEXT_INSN;
 
-        case bci_PUSH_UBX: {
+        INSTR(PUSH_UBX): {
             int i;
             int o_lits = BCO_GET_LARGE_ARG;
             int n_words = BCO_NEXT;
@@ -1077,10 +1271,10 @@ run_BCO:
             for (i = 0; i < n_words; i++) {
                 Sp[i] = (W_)BCO_LIT(o_lits+i);
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_SLIDE: {
+        INSTR(SLIDE): {
             int n  = BCO_NEXT;
             int by = BCO_NEXT;
             /* a_1, .. a_n, b_1, .. b_by, s => a_1, .. a_n, s */
@@ -1089,10 +1283,10 @@ run_BCO:
             }
             Sp += by;
             INTERP_TICK(it_slides);
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_ALLOC_AP: {
+        INSTR(ALLOC_AP): {
             StgAP* ap;
             int n_payload = BCO_NEXT;
             ap = (StgAP*)allocate(cap, AP_sizeW(n_payload));
@@ -1100,10 +1294,10 @@ run_BCO:
             ap->n_args = n_payload;
             SET_HDR(ap, &stg_AP_info, CCS_SYSTEM/*ToDo*/)
             Sp --;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_ALLOC_AP_NOUPD: {
+        INSTR(ALLOC_AP_NOUPD): {
             StgAP* ap;
             int n_payload = BCO_NEXT;
             ap = (StgAP*)allocate(cap, AP_sizeW(n_payload));
@@ -1111,10 +1305,10 @@ run_BCO:
             ap->n_args = n_payload;
             SET_HDR(ap, &stg_AP_NOUPD_info, CCS_SYSTEM/*ToDo*/)
             Sp --;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_ALLOC_PAP: {
+        INSTR(ALLOC_PAP): {
             StgPAP* pap;
             int arity = BCO_NEXT;
             int n_payload = BCO_NEXT;
@@ -1124,10 +1318,10 @@ run_BCO:
             pap->arity = arity;
             SET_HDR(pap, &stg_PAP_info, CCS_SYSTEM/*ToDo*/)
             Sp --;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_MKAP: {
+        INSTR(MKAP): {
             int i;
             int stkoff = BCO_NEXT;
             int n_payload = BCO_NEXT;
@@ -1147,10 +1341,10 @@ run_BCO:
                      debugBelch("\tBuilt ");
                      printObj((StgClosure*)ap);
                 );
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_MKPAP: {
+        INSTR(MKPAP): {
             int i;
             int stkoff = BCO_NEXT;
             int n_payload = BCO_NEXT;
@@ -1168,10 +1362,10 @@ run_BCO:
                      debugBelch("\tBuilt ");
                      printObj((StgClosure*)pap);
                 );
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_UNPACK: {
+        INSTR(UNPACK): {
             /* Unpack N ptr words from t.o.s constructor */
             int i;
             int n_words = BCO_NEXT;
@@ -1180,10 +1374,10 @@ run_BCO:
             for (i = 0; i < n_words; i++) {
                 Sp[i] = (W_)con->payload[i];
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_PACK: {
+        INSTR(PACK): {
             int i;
             int o_itbl         = BCO_GET_LARGE_ARG;
             int n_words        = BCO_NEXT;
@@ -1203,40 +1397,40 @@ run_BCO:
                      debugBelch("\tBuilt ");
                      printObj((StgClosure*)con);
                 );
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_P: {
+        INSTR(TESTLT_P): {
             unsigned int discr  = BCO_NEXT;
             int failto = BCO_GET_LARGE_ARG;
             StgClosure* con = (StgClosure*)Sp[0];
             if (GET_TAG(con) >= discr) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_P: {
+        INSTR(TESTEQ_P): {
             unsigned int discr  = BCO_NEXT;
             int failto = BCO_GET_LARGE_ARG;
             StgClosure* con = (StgClosure*)Sp[0];
             if (GET_TAG(con) != discr) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_I: {
+        INSTR(TESTLT_I): {
             // There should be an Int at Sp[1], and an info table at Sp[0].
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
             I_ stackInt = (I_)Sp[1];
             if (stackInt >= (I_)BCO_LIT(discr))
                 bciPtr = failto;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_I: {
+        INSTR(TESTEQ_I): {
             // There should be an Int at Sp[1], and an info table at Sp[0].
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1244,20 +1438,20 @@ run_BCO:
             if (stackInt != (I_)BCO_LIT(discr)) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_W: {
+        INSTR(TESTLT_W): {
             // There should be an Int at Sp[1], and an info table at Sp[0].
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
             W_ stackWord = (W_)Sp[1];
             if (stackWord >= (W_)BCO_LIT(discr))
                 bciPtr = failto;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_W: {
+        INSTR(TESTEQ_W): {
             // There should be an Int at Sp[1], and an info table at Sp[0].
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1265,10 +1459,10 @@ run_BCO:
             if (stackWord != (W_)BCO_LIT(discr)) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_D: {
+        INSTR(TESTLT_D): {
             // There should be a Double at Sp[1], and an info table at Sp[0].
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1278,10 +1472,10 @@ run_BCO:
             if (stackDbl >= discrDbl) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_D: {
+        INSTR(TESTEQ_D): {
             // There should be a Double at Sp[1], and an info table at Sp[0].
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1291,10 +1485,10 @@ run_BCO:
             if (stackDbl != discrDbl) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTLT_F: {
+        INSTR(TESTLT_F): {
             // There should be a Float at Sp[1], and an info table at Sp[0].
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1304,10 +1498,10 @@ run_BCO:
             if (stackFlt >= discrFlt) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_TESTEQ_F: {
+        INSTR(TESTEQ_F): {
             // There should be a Float at Sp[1], and an info table at Sp[0].
             int discr   = BCO_GET_LARGE_ARG;
             int failto  = BCO_GET_LARGE_ARG;
@@ -1317,11 +1511,21 @@ run_BCO:
             if (stackFlt != discrFlt) {
                 bciPtr = failto;
             }
-            goto nextInsn;
+            NEXT_INSN;
         }
 
         // Control-flow ish things
-        case bci_ENTER:
+        INSTR(SLIDE_ENTER): {
+            int n  = BCO_NEXT;
+            int by = BCO_NEXT;
+            while(--n >= 0) {
+                Sp[n+by] = Sp[n];
+            }
+            Sp += by;
+            INTERP_TICK(it_slides);
+        }
+        /* fall through */
+        INSTR(ENTER):
             // Context-switch check.  We put it here to ensure that
             // the interpreter has done at least *some* work before
             // context switching: sometimes the scheduler can invoke
@@ -1333,44 +1537,44 @@ run_BCO:
             }
             goto eval;
 
-        case bci_RETURN:
+        INSTR(RETURN):
             tagged_obj = (StgClosure *)Sp[0];
             Sp++;
             goto do_return;
 
-        case bci_RETURN_P:
+        INSTR(RETURN_P):
             Sp--;
             Sp[0] = (W_)&stg_ret_p_info;
             goto do_return_unboxed;
-        case bci_RETURN_N:
+        INSTR(RETURN_N):
             Sp--;
             Sp[0] = (W_)&stg_ret_n_info;
             goto do_return_unboxed;
-        case bci_RETURN_F:
+        INSTR(RETURN_F):
             Sp--;
             Sp[0] = (W_)&stg_ret_f_info;
             goto do_return_unboxed;
-        case bci_RETURN_D:
+        INSTR(RETURN_D):
             Sp--;
             Sp[0] = (W_)&stg_ret_d_info;
             goto do_return_unboxed;
-        case bci_RETURN_L:
+        INSTR(RETURN_L):
             Sp--;
             Sp[0] = (W_)&stg_ret_l_info;
             goto do_return_unboxed;
-        case bci_RETURN_V:
+        INSTR(RETURN_V):
             Sp--;
             Sp[0] = (W_)&stg_ret_v_info;
             goto do_return_unboxed;
 
-        case bci_SWIZZLE: {
+        INSTR(SWIZZLE): {
             int stkoff = BCO_NEXT;
             signed short n = (signed short)(BCO_NEXT);
             Sp[stkoff] += (W_)n;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_CCALL: {
+        INSTR(CCALL): {
             void *tok;
             int stk_offset            = BCO_NEXT;
             int o_itbl                = BCO_GET_LARGE_ARG;
@@ -1412,6 +1616,7 @@ run_BCO:
             W_ *arguments[stk_offset];  // max needed
             void *argptrs[nargs];
             void (*fn)(void);
+            rtsBool direct = canCallDirectly(cif);
 
             if (cif->rtype->type == FFI_TYPE_VOID) {
                 // necessary because cif->rtype->size == 1 for void,
@@ -1466,7 +1671,12 @@ run_BCO:
             tok = suspendThread(&cap->r, interruptible ? rtsTrue : rtsFalse);
 
             // We already made a copy of the arguments above.
-            ffi_call(cif, fn, ret, argptrs);
+            // See Note [Calling foreign functions directly]
+            if (direct) {
+                callDirectly(cif, fn, ret, (W_ *)arguments);
+            } else {
+                ffi_call(cif, fn, ret, argptrs);
+            }
 
             // And restart the thread again, popping the stg_ret_p frame.
             cap = (Capability *)((void *)((unsigned char*)resumeThread(tok) - STG_FIELD_OFFSET(Capability,r)));
@@ -1498,21 +1708,24 @@ run_BCO:
             // most 2 words large, and resides at arguments[0].
             memcpy(Sp, ret, sizeof(W_) * stg_min(stk_offset,ret_size));
 
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_JMP: {
+        INSTR(JMP): {
             /* BCO_NEXT modifies bciPtr, so be conservative. */
             int nextpc = BCO_GET_LARGE_ARG;
             bciPtr     = nextpc;
-            goto nextInsn;
+            NEXT_INSN;
         }
 
-        case bci_CASEFAIL:
+        INSTR(CASEFAIL):
             barf("interpretBCO: hit a CASEFAIL");
 
             // Errors
         default:
+#ifdef THREADED_DISPATCH
+        unknown_insn:
+#endif
             barf("interpretBCO: unknown or unimplemented opcode %d",
                  (int)(bci & 0xFF));
 
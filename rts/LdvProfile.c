@@ -17,6 +17,13 @@
 #include "Stats.h"
 #include "RtsUtils.h"
 #include "Schedule.h"
+#include "Capability.h"
+#include "sm/GC.h"
+
+// The dead closures found by each GC thread, unless the census is
+// restricted by biography: see LDV_countDead()
+static LdvDeaths *ldv_deaths = NULL;
+static nat n_ldv_deaths = 0;
 
 /* --------------------------------------------------------------------------
  * This function is called eventually on every object destroyed during
@@ -28,7 +35,7 @@
  * header portion, so that the caller can find the next closure.
  * ----------------------------------------------------------------------- */
 STATIC_INLINE nat
-processHeapClosureForDead( StgClosure *c )
+processHeapClosureForDead( LdvDeaths *d, StgClosure *c )
 {
     nat size;
     const StgInfoTable *info;
@@ -121,7 +128,11 @@ processHeapClosureForDead( StgClosure *c )
         // rate.
     case IND:
         // Found a dead closure: record its size
-        LDV_recordDead(c, size);
+        if (d != NULL) {
+            LDV_countDead(d, c, size);
+        } else {
+            LDV_recordDead(c, size);
+        }
         return size;
 
         /*
@@ -150,58 +161,93 @@ processHeapClosureForDead( StgClosure *c )
 }
 
 /* --------------------------------------------------------------------------
- * Calls processHeapClosureForDead() on every *dead* closures in the
- * heap blocks starting at bd.
+ * Calls processHeapClosureForDead() on every *dead* closure in the
+ * block bd, which is a block of small objects in the nursery or the
+ * from-space of a generation, or holds a large object.
  * ----------------------------------------------------------------------- */
 static void
-processHeapForDead( bdescr *bd )
+processBlockForDead( LdvDeaths *d, bdescr *bd )
 {
     StgPtr p;
 
-    while (bd != NULL) {
-        p = bd->start;
-        while (p < bd->free) {
-            p += processHeapClosureForDead((StgClosure *)p);
-            while (p < bd->free && !*p)   // skip slop
-                p++;
+    if (bd->flags & BF_LARGE) {
+        // Any object still in the chain is dead!
+        if (!(bd->flags & BF_PINNED)) {
+            processHeapClosureForDead(d, (StgClosure *)bd->start);
         }
-        ASSERT(p == bd->free);
-        bd = bd->link;
+        return;
+    }
+
+    p = bd->start;
+    while (p < bd->free) {
+        while (p < bd->free && !*p) p++; // skip slop
+        if (p >= bd->free) break;
+        p += processHeapClosureForDead(d, (StgClosure *)p);
     }
+    ASSERT(p == bd->free);
 }
 
 /* --------------------------------------------------------------------------
- * Calls processHeapClosureForDead() on every *dead* closures in the nursery.
+ * Sharing out the census for dead closures
+ *
+ * As for the heap census (see heapCensus()), the block chains to look
+ * at are put in ldv_chains[], and each GC thread repeatedly claims the
+ * next LDV_CHUNK blocks of them.  Each thread adds up the deaths in its
+ * own LdvDeaths, and they are all passed on to the censuses at the end.
+ * A census restricted by biography has to look up the counters of the
+ * dead closures in the hash tables of the censuses, so it is done by
+ * the thread leading the GC alone, with LDV_recordDead().
  * ----------------------------------------------------------------------- */
-static void
-processNurseryForDead( void )
+
+#define LDV_CHUNK 64
+
+static bdescr **ldv_chains = NULL;
+static nat n_ldv_chains;
+static nat ldv_chain;           // the next chain to claim from
+static bdescr *ldv_next;        // the next block to claim
+#if defined(THREADED_RTS)
+static SpinLock ldv_lock;
+#endif
+
+// Returns the first of up to LDV_CHUNK blocks, or NULL if the census is
+// done
+static bdescr *
+claimLdvChunk( void )
 {
-    StgPtr p;
-    bdescr *bd;
+    bdescr *bd, *first;
+    nat n;
 
-    for (bd = MainCapability.r.rNursery->blocks; bd != NULL; bd = bd->link) {
-        p = bd->start;
-        while (p < bd->free) {
-            while (p < bd->free && !*p) p++; // skip slop
-            if (p >= bd->free) break;
-            p += processHeapClosureForDead((StgClosure *)p);
-        }
+    ACQUIRE_SPIN_LOCK(&ldv_lock);
+    while (ldv_next == NULL && ldv_chain < n_ldv_chains) {
+        ldv_next = ldv_chains[ldv_chain++];
+    }
+    first = ldv_next;
+    for (bd = first, n = 0; bd != NULL && n < LDV_CHUNK; n++) {
+        bd = bd->link;
     }
+    ldv_next = bd;
+    RELEASE_SPIN_LOCK(&ldv_lock);
+
+    return first;
 }
 
-/* --------------------------------------------------------------------------
- * Calls processHeapClosureForDead() on every *dead* closures in the closure
- * chain.
- * ----------------------------------------------------------------------- */
 static void
-processChainForDead( bdescr *bd )
+ldvCensusWorker( nat me )
 {
-    // Any object still in the chain is dead!
-    while (bd != NULL) {
-        if (!(bd->flags & BF_PINNED)) {
-            processHeapClosureForDead((StgClosure *)bd->start);
+    LdvDeaths *d;
+    bdescr *bd;
+    nat n;
+
+    if (RtsFlags.ProfFlags.bioSelector == NULL) {
+        d = &ldv_deaths[me];
+    } else {
+        d = NULL;
+    }
+
+    while ((bd = claimLdvChunk()) != NULL) {
+        for (n = 0; bd != NULL && n < LDV_CHUNK; bd = bd->link, n++) {
+            processBlockForDead(d, bd);
         }
-        bd = bd->link;
     }
 }
 
@@ -211,12 +257,13 @@ processChainForDead( bdescr *bd )
  * current garbage collection.  This function is called from a garbage
  * collector right before tidying up, when all dead closures are still
  * stored in the heap and easy to identify.  Generations 0 through N
- * have just been garbage collected.
+ * have just been garbage collected.  If parallel, the other GC threads
+ * are waiting to continue and can share the work.
  * ----------------------------------------------------------------------- */
-void
-LdvCensusForDead( nat N )
+static void
+ldvCensusForDead( nat N, rtsBool parallel )
 {
-    nat g;
+    nat g, n, i;
 
     // ldvTime == 0 means that LDV profiling is currently turned off.
     if (era == 0)
@@ -227,15 +274,64 @@ LdvCensusForDead( nat N )
         // Todo: support LDV for two-space garbage collection.
         //
         barf("Lag/Drag/Void profiling not supported with -G1");
-    } else {
-        processNurseryForDead();
-        for (g = 0; g <= N; g++) {
-            processHeapForDead(generations[g].old_blocks);
-            processChainForDead(generations[g].large_objects);
+    }
+
+    ldv_chains = stgReallocBytes(ldv_chains,
+                                 (n_capabilities + 2 * (N + 1))
+                                 * sizeof(bdescr *),
+                                 "LdvCensusForDead");
+    i = 0;
+    for (n = 0; n < n_capabilities; n++) {
+        ldv_chains[i++] = capabilities[n]->r.rNursery->blocks;
+    }
+    for (g = 0; g <= N; g++) {
+        ldv_chains[i++] = generations[g].old_blocks;
+        ldv_chains[i++] = generations[g].large_objects;
+    }
+    n_ldv_chains = i;
+    ldv_chain = 0;
+    ldv_next = NULL;
+#if defined(THREADED_RTS)
+    initSpinLock(&ldv_lock);
+#endif
+
+    if (RtsFlags.ProfFlags.bioSelector != NULL) {
+        ldvCensusWorker(0);
+        return;
+    }
+
+    if (n_ldv_deaths < n_capabilities) {
+        ldv_deaths = stgReallocBytes(ldv_deaths,
+                                     n_capabilities * sizeof(LdvDeaths),
+                                     "LdvCensusForDead");
+        for (n = n_ldv_deaths; n < n_capabilities; n++) {
+            ldv_deaths[n].void_new = NULL;
+            ldv_deaths[n].drag_new = NULL;
+            ldv_deaths[n].size = 0;
         }
+        n_ldv_deaths = n_capabilities;
+    }
+    for (n = 0; n < n_capabilities; n++) {
+        LDV_initDeaths(&ldv_deaths[n]);
+    }
+
+    if (parallel) {
+        runOnGcThreads(ldvCensusWorker);
+    } else {
+        ldvCensusWorker(0);
+    }
+
+    for (n = 0; n < n_capabilities; n++) {
+        LDV_addDeaths(&ldv_deaths[n]);
     }
 }
 
+void
+LdvCensusForDead( nat N )
+{
+    ldvCensusForDead(N, rtsTrue);
+}
+
 /* --------------------------------------------------------------------------
  * Regard any closure in the current heap as dead or moribund and update
  * LDV statistics accordingly.
@@ -245,7 +341,19 @@ LdvCensusForDead( nat N )
 void
 LdvCensusKillAll( void )
 {
-    LdvCensusForDead(RtsFlags.GcFlags.generations - 1);
+    nat n;
+
+    // not during a GC, so there are no GC threads to help
+    ldvCensusForDead(RtsFlags.GcFlags.generations - 1, rtsFalse);
+
+    for (n = 0; n < n_ldv_deaths; n++) {
+        LDV_freeDeaths(&ldv_deaths[n]);
+    }
+    stgFree(ldv_deaths);
+    ldv_deaths = NULL;
+    n_ldv_deaths = 0;
+    stgFree(ldv_chains);
+    ldv_chains = NULL;
 }
 
 #endif /* PROFILING */
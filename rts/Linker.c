@@ -135,6 +135,35 @@
 #define ALWAYS_PIC
 #endif
 
+/* Index the symbols of the shared objects we dlopen() ourselves; see
+ * Note [Indexing the symbols of shared objects]
+ */
+#if defined(OBJFORMAT_ELF) && defined(linux_HOST_OS) && defined(HAVE_DLFCN_H)
+#include <link.h>
+#define USE_DLSYM_INDEX
+#endif
+
+/* Load the members of archives only when one of their symbols is
+ * needed; see Note [Lazy archive members]
+ */
+#if defined(USE_MMAP) && defined(OBJFORMAT_ELF)
+#define USE_LAZY_ARCHIVES
+#endif
+
+/* Keep the relocated images of objects in +RTS --linker-cache; see
+ * Note [Linker cache]
+ */
+#if defined(USE_MMAP) && defined(OBJFORMAT_ELF)
+#define USE_LINKER_CACHE
+#endif
+
+/* Share the symbol extras of objects that jump to the same place; see
+ * Note [Shared symbol extras]
+ */
+#if defined(USE_MMAP) && defined(OBJFORMAT_ELF) && defined(x86_64_HOST_ARCH)
+#define USE_SHARED_SYMBOL_EXTRAS
+#endif
+
 #if defined(dragonfly_HOST_OS)
 #include <sys/tls.h>
 #endif
@@ -156,7 +185,8 @@ ObjectCode *objects = NULL;     /* initially empty */
 ObjectCode *unloaded_objects = NULL; /* initially empty */
 
 #ifdef THREADED_RTS
-/* This protects all the Linker's global state except unloaded_objects */
+/* This protects all the Linker's global state except unloaded_objects
+   and the memory allocators (see Note [Concurrent loading]) */
 Mutex linker_mutex;
 /*
  * This protects unloaded_objects.  We have a separate mutex for this, because
@@ -165,6 +195,57 @@ Mutex linker_mutex;
  * operations proceed concurrently with the GC. 
  */
 Mutex linker_unloaded_mutex;
+#ifdef USE_MMAP
+/* This protects mmapForLinker()'s placement of the mappings and the m32
+   allocator, which loadObj() uses without linker_mutex */
+static Mutex linker_alloc_mutex;
+#endif
+#endif
+
+#if defined(USE_LAZY_ARCHIVES)
+/* An object file in an archive, that we load when one of the symbols
+   listed for it in the archive's index is looked up */
+typedef struct _LazyMember {
+    struct _LazyArchive *archive;
+    long         offset;        /* of its contents in the archive */
+    int          size;
+    char        *memberName;    /* like "libarchive.a(object.o)" */
+    ObjectCode  *oc;            /* once it is loaded */
+    int          failed;        /* if loading it failed */
+} LazyMember;
+
+typedef struct _LazyArchive {
+    pathchar    *path;
+    LazyMember  *members;
+    nat          n_members;
+    char        *index;         /* the contents of the index */
+    char       **syms;          /* the symbols of the index, into index */
+    nat          n_syms;
+    struct _LazyArchive *next;
+} LazyArchive;
+
+/* The archives whose members are loaded lazily */
+static LazyArchive *lazy_archives = NULL;
+
+/* Hash table mapping symbol names to the LazyMember that defines
+   them, for the symbols that are not in symhash yet */
+static /*Str*/HashTable *lazy_symhash = NULL;
+
+static void *lookupLazySymbol( char *lbl );
+static HsInt removeLazyArchive( pathchar *path );
+#endif
+
+#if defined(USE_DLSYM_INDEX)
+static void freeSOIndex( void );
+#endif
+
+#if defined(USE_SHARED_SYMBOL_EXTRAS)
+static void freeSharedSymbolExtras( void );
+#ifdef THREADED_RTS
+/* protects the shared symbol extras, which objects relocated in
+   parallel take from at once */
+static Mutex shared_extras_mutex;
+#endif
 #endif
 
 /* Type of the initializer */
@@ -172,6 +253,9 @@ typedef void (*init_t) (int argc, char **argv, char **env);
 
 static HsInt isAlreadyLoaded( pathchar *path );
 static HsInt loadOc( ObjectCode* oc );
+static HsInt prepareOc( ObjectCode* oc );
+static HsInt loadOcNames( ObjectCode* oc );
+static HsInt resolveOc( ObjectCode* oc );
 static ObjectCode* mkOc( pathchar *path, char *image, int imageSize,
                          char *archiveMemberName
 #ifndef USE_MMAP
@@ -181,6 +265,12 @@ static ObjectCode* mkOc( pathchar *path, char *image, int imageSize,
 #endif
                        );
 
+#if defined(USE_MMAP)
+static void *m32_alloc ( size_t size, nat alignment );
+static void m32_free ( void *addr, size_t size );
+static void m32_flush ( void );
+#endif
+
 // Use wchar_t for pathnames on Windows (#5697)
 #if defined(mingw32_HOST_OS)
 #define pathcmp wcscmp
@@ -221,12 +311,22 @@ static int ocRunInit_ELF        ( ObjectCode* oc );
 #if defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH) || defined(arm_HOST_ARCH)
 static int ocAllocateSymbolExtras_ELF ( ObjectCode* oc );
 #endif
+#if defined(USE_MMAP)
+static StgWord imageAlignment_ELF ( char* image, int size );
+#endif
+#if defined(USE_LAZY_ARCHIVES) && defined(THREADED_RTS)
+static void ocLoadLazyMembers_ELF ( ObjectCode* oc );
+#endif
+#if defined(USE_LINKER_CACHE)
+static StgWord64 hashImage ( char* image, int size );
+#endif
 #elif defined(OBJFORMAT_PEi386)
 static int ocVerifyImage_PEi386 ( ObjectCode* oc );
 static int ocGetNames_PEi386    ( ObjectCode* oc );
 static int ocResolve_PEi386     ( ObjectCode* oc );
 static int ocRunInit_PEi386     ( ObjectCode* oc );
 static void *lookupSymbolInDLLs ( unsigned char *lbl );
+static void freeDLLIndex ( void );
 static void zapTrailingAtSign   ( unsigned char *sym );
 static char *allocateImageAndTrampolines (
    pathchar* arch_name, char* member_name,
@@ -356,8 +456,20 @@ typedef struct _RtsSymbolVal {
                                 SymI_HasProto(stg_makeStableNamezh)             \
                                 SymI_HasProto(stg_finalizzeWeakzh)
 
+#if defined(linux_HOST_OS)
+#define RTS_LINUX_ONLY_SYMBOLS                  \
+      SymI_HasProto(stg_asyncReadzh)            \
+      SymI_HasProto(stg_asyncWritezh)
+#else
+#define RTS_LINUX_ONLY_SYMBOLS /**/
+#endif
+
 #if !defined (mingw32_HOST_OS)
 #define RTS_POSIX_ONLY_SYMBOLS                  \
+      RTS_LINUX_ONLY_SYMBOLS                    \
+      SymI_HasProto(rtsSupportsAsyncIO)         \
+      SymI_HasProto(rts_clearThreadDeadline)    \
+      SymI_HasProto(rts_setThreadDeadline)      \
       SymI_HasProto(__hscore_get_saved_termios) \
       SymI_HasProto(__hscore_set_saved_termios) \
       SymI_HasProto(shutdownHaskellAndSignal)   \
@@ -875,6 +987,7 @@ typedef struct _RtsSymbolVal {
    SymI_HasProto(setIOManagerControlFd) \
    SymI_HasProto(setTimerManagerControlFd) \
    SymI_HasProto(setIOManagerWakeupFd)  \
+   SymI_HasProto(takePendingSignals)    \
    SymI_HasProto(ioManagerWakeup)       \
    SymI_HasProto(blockUserSignals)      \
    SymI_HasProto(unblockUserSignals)
@@ -925,7 +1038,9 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(stg_ap_pppv_ret)                    \
       SymI_HasProto(stg_ap_pppp_ret)                    \
       SymI_HasProto(stg_ap_ppppp_ret)                   \
-      SymI_HasProto(stg_ap_pppppp_ret)
+      SymI_HasProto(stg_ap_pppppp_ret)                  \
+      SymI_HasProto(stg_ap_ppppppp_ret)                 \
+      SymI_HasProto(stg_ap_pppppppp_ret)
 #endif
 
 /* Modules compiled with -ticky may mention ticky counters */
@@ -967,6 +1082,8 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(SLOW_CALL_fast_pppp_ctr)                 \
       SymI_HasProto(SLOW_CALL_fast_ppppp_ctr)                \
       SymI_HasProto(SLOW_CALL_fast_pppppp_ctr)               \
+      SymI_HasProto(SLOW_CALL_fast_ppppppp_ctr)              \
+      SymI_HasProto(SLOW_CALL_fast_pppppppp_ctr)             \
       SymI_HasProto(VERY_SLOW_CALL_ctr)                \
       SymI_HasProto(ticky_slow_call_unevald)            \
       SymI_HasProto(SLOW_CALL_ctr)                      \
@@ -1145,6 +1262,8 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(getOrSetLibHSghcFastStringTable)                    \
       SymI_HasProto(getGCStats)                                         \
       SymI_HasProto(getGCStatsEnabled)                                  \
+      SymI_HasProto(getGCStatsExt)                                      \
+      SymI_HasProto(getGCPauseStats)                                    \
       SymI_HasProto(genericRaise)                                       \
       SymI_HasProto(getProgArgv)                                        \
       SymI_HasProto(getFullProgArgv)                                    \
@@ -1155,6 +1274,8 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(hs_set_argv)                                        \
       SymI_HasProto(hs_add_root)                                        \
       SymI_HasProto(hs_perform_gc)                                      \
+      SymI_HasProto(hs_dump_eventlog)                                   \
+      SymI_HasProto(hs_heap_snapshot)                                   \
       SymI_HasProto(hs_lock_stable_tables)                              \
       SymI_HasProto(hs_unlock_stable_tables)                            \
       SymI_HasProto(hs_free_stable_ptr)                                 \
@@ -1204,17 +1325,38 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(stg_casIntArrayzh)                                  \
       SymI_HasProto(stg_newMVarzh)                                      \
       SymI_HasProto(stg_newMutVarzh)                                    \
+      SymI_HasProto(stg_compactNewzh)                                   \
+      SymI_HasProto(stg_compactAddzh)                                   \
+      SymI_HasProto(stg_compactContainszh)                              \
+      SymI_HasProto(stg_compactSizzezh)                                 \
+      SymI_HasProto(stg_compactGetFirstBlockzh)                         \
+      SymI_HasProto(stg_compactGetNextBlockzh)                          \
+      SymI_HasProto(stg_compactAllocateBlockzh)                         \
+      SymI_HasProto(stg_compactFixupPointerszh)                         \
+      SymI_HasProto(stg_newRingBufferzh)                                \
+      SymI_HasProto(stg_ringPutzh)                                      \
+      SymI_HasProto(stg_ringTakezh)                                     \
+      SymI_HasProto(stg_ringTakeManyzh)                                 \
+      SymI_HasProto(stg_ringClearWaitingzh)                             \
       SymI_HasProto(stg_newTVarzh)                                      \
       SymI_HasProto(stg_noDuplicatezh)                                  \
       SymI_HasProto(stg_atomicModifyMutVarzh)                           \
       SymI_HasProto(stg_casMutVarzh)                                    \
+      SymI_HasProto(stg_casDoubleWordArrayzh)                           \
+      SymI_HasProto(stg_casDoubleWordOffAddrzh)                         \
+      SymI_HasProto(stg_atomicSwapMutVarzh)                             \
       SymI_HasProto(stg_newPinnedByteArrayzh)                           \
       SymI_HasProto(stg_newAlignedPinnedByteArrayzh)                    \
+      SymI_HasProto(stg_mapFileByteArrayzh)                             \
+      SymI_HasProto(stg_receiveShmChannelzh)                            \
       SymI_HasProto(stg_shrinkMutableByteArrayzh)                       \
       SymI_HasProto(stg_resizzeMutableByteArrayzh)                      \
       SymI_HasProto(newSpark)                                           \
       SymI_HasProto(performGC)                                          \
       SymI_HasProto(performMajorGC)                                     \
+      SymI_HasProto(addMemoryPressureHandler)                           \
+      SymI_HasProto(freezeHeap)                                         \
+      SymI_HasProto(saveHeapImage)                                      \
       SymI_HasProto(prog_argc)                                          \
       SymI_HasProto(prog_argv)                                          \
       SymI_HasProto(stg_putMVarzh)                                      \
@@ -1233,8 +1375,11 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(rts_evalIO)                                         \
       SymI_HasProto(rts_evalLazyIO)                                     \
       SymI_HasProto(rts_evalStableIO)                                   \
+      SymI_HasProto(rts_evalAsync)                                      \
+      SymI_HasProto(rts_evalAsyncPtr)                                   \
       SymI_HasProto(rts_eval_)                                          \
       SymI_HasProto(rts_getBool)                                        \
+      SymI_HasProto(rts_getByteArray)                                   \
       SymI_HasProto(rts_getChar)                                        \
       SymI_HasProto(rts_getDouble)                                      \
       SymI_HasProto(rts_getFloat)                                       \
@@ -1243,6 +1388,8 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(rts_getInt16)                                       \
       SymI_HasProto(rts_getInt32)                                       \
       SymI_HasProto(rts_getInt64)                                       \
+      SymI_HasProto(rts_getIntList)                                     \
+      SymI_HasProto(rts_getList)                                        \
       SymI_HasProto(rts_getPtr)                                         \
       SymI_HasProto(rts_getFunPtr)                                      \
       SymI_HasProto(rts_getStablePtr)                                   \
@@ -1254,6 +1401,7 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(rts_getWord64)                                      \
       SymI_HasProto(rts_lock)                                           \
       SymI_HasProto(rts_mkBool)                                         \
+      SymI_HasProto(rts_mkByteArray)                                    \
       SymI_HasProto(rts_mkChar)                                         \
       SymI_HasProto(rts_mkDouble)                                       \
       SymI_HasProto(rts_mkFloat)                                        \
@@ -1262,6 +1410,9 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(rts_mkInt16)                                        \
       SymI_HasProto(rts_mkInt32)                                        \
       SymI_HasProto(rts_mkInt64)                                        \
+      SymI_HasProto(rts_mkIntList)                                      \
+      SymI_HasProto(rts_mkList)                                         \
+      SymI_HasProto(rts_mkPinnedByteArray)                              \
       SymI_HasProto(rts_mkPtr)                                          \
       SymI_HasProto(rts_mkFunPtr)                                       \
       SymI_HasProto(rts_mkStablePtr)                                    \
@@ -1271,12 +1422,35 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(rts_mkWord16)                                       \
       SymI_HasProto(rts_mkWord32)                                       \
       SymI_HasProto(rts_mkWord64)                                       \
+      SymI_HasProto(rts_subscribeEventLog)                              \
+      SymI_HasProto(rts_setEventLogClasses)                             \
+      SymI_HasProto(rts_setEventLogSampling)                            \
       SymI_HasProto(rts_unlock)                                         \
+      SymI_HasProto(rts_unsubscribeEventLog)                            \
       SymI_HasProto(rts_unsafeGetMyCapability)                          \
       SymI_HasProto(rtsSupportsBoundThreads)                            \
       SymI_HasProto(rts_isProfiled)                                     \
       SymI_HasProto(rts_isDynamic)                                      \
       SymI_HasProto(rts_getThreadAllocationCounter)                     \
+      SymI_HasProto(rts_getThreadCPUTime)                               \
+      SymI_HasProto(rts_getFinalizerCounts)                             \
+      SymI_HasProto(rts_finalizerDone)                                  \
+      SymI_HasProto(rts_getThreadAllocated)                             \
+      SymI_HasProto(rts_getThreadPretenuring)                           \
+      SymI_HasProto(rts_setThreadPretenuring)                           \
+      SymI_HasProto(rts_getThreadPriority)                              \
+      SymI_HasProto(rts_setThreadPriority)                              \
+      SymI_HasProto(rts_getCapabilityPool)                              \
+      SymI_HasProto(rts_openShmChannel)                                 \
+      SymI_HasProto(rts_closeShmChannel)                                \
+      SymI_HasProto(rts_shmChannelFd)                                   \
+      SymI_HasProto(rts_shmChannelSlotSize)                             \
+      SymI_HasProto(rts_sendShmChannel)                                 \
+      SymI_HasProto(rts_getThreadAccountingGroup)                       \
+      SymI_HasProto(rts_setThreadAccountingGroup)                       \
+      SymI_HasProto(rts_getAccountingGroupResidency)                    \
+      SymI_HasProto(rts_getAccountingGroupQuota)                        \
+      SymI_HasProto(rts_setAccountingGroupQuota)                        \
       SymI_HasProto(rts_setThreadAllocationCounter)                     \
       SymI_HasProto(rts_enableThreadAllocationLimit)                    \
       SymI_HasProto(rts_disableThreadAllocationLimit)                   \
@@ -1325,6 +1499,8 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(stg_ap_pppp_info)                                   \
       SymI_HasProto(stg_ap_ppppp_info)                                  \
       SymI_HasProto(stg_ap_pppppp_info)                                 \
+      SymI_HasProto(stg_ap_ppppppp_info)                                \
+      SymI_HasProto(stg_ap_pppppppp_info)                               \
       SymI_HasProto(stg_ap_0_fast)                                      \
       SymI_HasProto(stg_ap_v_fast)                                      \
       SymI_HasProto(stg_ap_f_fast)                                      \
@@ -1343,6 +1519,8 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(stg_ap_pppp_fast)                                   \
       SymI_HasProto(stg_ap_ppppp_fast)                                  \
       SymI_HasProto(stg_ap_pppppp_fast)                                 \
+      SymI_HasProto(stg_ap_ppppppp_fast)                                \
+      SymI_HasProto(stg_ap_pppppppp_fast)                               \
       SymI_HasProto(stg_ap_1_upd_info)                                  \
       SymI_HasProto(stg_ap_2_upd_info)                                  \
       SymI_HasProto(stg_ap_3_upd_info)                                  \
@@ -1398,6 +1576,7 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(stg_waitReadzh)                                     \
       SymI_HasProto(stg_waitWritezh)                                    \
       SymI_HasProto(stg_writeTVarzh)                                    \
+      SymI_HasProto(stg_setTVarWakeupLimitzh)                           \
       SymI_HasProto(stg_yieldzh)                                        \
       SymI_NeedsProto(stg_interp_constr_entry)                          \
       SymI_HasProto(stg_arg_bitmaps)                                    \
@@ -1419,6 +1598,8 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(stg_traceCcszh)                                     \
       SymI_HasProto(stg_traceEventzh)                                   \
       SymI_HasProto(stg_traceMarkerzh)                                  \
+      SymI_HasProto(stg_traceBinaryEventzh)                             \
+      SymI_HasProto(traceUserEventType)                                 \
       SymI_HasProto(getMonotonicNSec)                                   \
       SymI_HasProto(lockFile)                                           \
       SymI_HasProto(unlockFile)                                         \
@@ -1657,11 +1838,20 @@ initLinker_ (int retain_cafs)
 #if defined(THREADED_RTS)
     initMutex(&linker_mutex);
     initMutex(&linker_unloaded_mutex);
+#if defined(USE_MMAP)
+    initMutex(&linker_alloc_mutex);
+#endif
 #if defined(OBJFORMAT_ELF) || defined(OBJFORMAT_MACHO)
     initMutex(&dl_mutex);
 #endif
+#if defined(USE_SHARED_SYMBOL_EXTRAS)
+    initMutex(&shared_extras_mutex);
+#endif
 #endif
     symhash = allocStrHashTable();
+#if defined(USE_LAZY_ARCHIVES)
+    lazy_symhash = allocStrHashTable();
+#endif
 
     /* populate the symbol table with stuff from the RTS */
     for (sym = rtsSyms; sym->lbl != NULL; sym++) {
@@ -1748,9 +1938,33 @@ exitLinker( void ) {
 #endif
    if (linker_init_done == 1) {
        freeHashTable(symhash, free);
+#if defined(USE_LAZY_ARCHIVES)
+       while (lazy_archives != NULL) {
+           removeLazyArchive(lazy_archives->path);
+       }
+       freeHashTable(lazy_symhash, NULL);
+#endif
+#if defined(USE_DLSYM_INDEX)
+       freeSOIndex();
+#endif
+#if defined(OBJFORMAT_PEi386)
+       freeDLLIndex();
+#endif
+#if defined(USE_SHARED_SYMBOL_EXTRAS)
+       freeSharedSymbolExtras();
+#endif
+#if defined(USE_MMAP)
+       m32_flush();
+#endif
    }
 #ifdef THREADED_RTS
    closeMutex(&linker_mutex);
+#if defined(USE_MMAP)
+   closeMutex(&linker_alloc_mutex);
+#endif
+#if defined(USE_SHARED_SYMBOL_EXTRAS)
+   closeMutex(&shared_extras_mutex);
+#endif
 #endif
 }
 
@@ -1896,10 +2110,325 @@ internal_dlopen(const char *dll_name)
   libraries don't populate the global symbol table.
 */
 
+#if defined(USE_DLSYM_INDEX)
+/*
+  Note [Indexing the symbols of shared objects]
+
+  Looking for a symbol in each of the shared objects we have opened in
+  turn, with dlsym(), takes a long time when there are hundreds of
+  them.  So instead we read the dynamic symbol table of each of them
+  once, when we first look up a symbol after it was opened, and keep
+  all of their symbols in so_symbols.
+
+  dlsym(handle) looks in the object and then in its dependencies,
+  breadth first (its "scope"), so we do the same: the definition of a
+  symbol we keep is the one in the first object of the scope of the
+  most recently opened handle that has one.  Each object in
+  so_libs records the newest handle whose scope it is in (rank) and
+  where it is in that scope (pos), and a definition replaces another
+  if its object comes before the other's in that order.
+
+  Thread-local symbols and GNU indirect functions need dlsym() to find
+  their address, so for those we still go through the handles.  If we
+  can't make sense of an object (it has no symbol table we can read,
+  or we can't find one of its dependencies) we stop using the index
+  altogether.  Everything here is protected by dl_mutex.
+*/
+
+typedef struct _IndexedLib {
+    struct link_map *map;
+    nat rank;                   /* of the newest handle whose scope has it */
+    nat pos;                    /* its position in that scope */
+} IndexedLib;
+
+typedef struct _IndexedSym {
+    IndexedLib *lib;
+    void *addr;                 /* NULL ==> ask dlsym() */
+} IndexedSym;
+
+typedef struct _DynInfo {
+    ElfW(Sym)  *symtab;
+    char       *strtab;
+    ElfW(Half) *versym;
+    nat         n_syms;
+    char       *soname;
+} DynInfo;
+
+/* str -> IndexedSym */
+static HashTable *so_symbols = NULL;
+/* link_map -> IndexedLib */
+static HashTable *so_libs = NULL;
+/* the first of openedSOs whose symbols are in so_symbols */
+static OpenedSO *so_indexed = NULL;
+static nat so_rank = 0;
+static rtsBool so_index_ok = rtsTrue;
+
+/* glibc relocates the addresses in the dynamic section, but not on
+   every platform */
+static void *
+dynPtr (struct link_map *map, ElfW(Addr) p)
+{
+    return (void *)(p < map->l_addr ? p + map->l_addr : p);
+}
+
+/* The number of symbols in the table that a DT_GNU_HASH section is for */
+static nat
+gnuHashSymbols (Elf32_Word *h)
+{
+    Elf32_Word nbuckets = h[0], symoffset = h[1], bloom_size = h[2];
+    Elf32_Word *buckets = (Elf32_Word *)((ElfW(Addr) *)(h + 4) + bloom_size);
+    Elf32_Word *chain = buckets + nbuckets;
+    Elf32_Word i, last = 0;
+
+    for (i = 0; i < nbuckets; i++) {
+        if (buckets[i] > last) last = buckets[i];
+    }
+    if (last < symoffset) {
+        return symoffset;
+    }
+    while (!(chain[last - symoffset] & 1)) {
+        last++;
+    }
+    return last + 1;
+}
+
+static rtsBool
+readDynamic (struct link_map *map, DynInfo *info)
+{
+    ElfW(Dyn) *dyn;
+    Elf32_Word *hash = NULL, *gnu_hash = NULL;
+    ElfW(Addr) soname = 0;
+    rtsBool have_soname = rtsFalse;
+
+    info->symtab = NULL;
+    info->strtab = NULL;
+    info->versym = NULL;
+    if (map->l_ld == NULL) {
+        return rtsFalse;
+    }
+    for (dyn = map->l_ld; dyn->d_tag != DT_NULL; dyn++) {
+        switch (dyn->d_tag) {
+        case DT_SYMTAB:   info->symtab = dynPtr(map, dyn->d_un.d_ptr); break;
+        case DT_STRTAB:   info->strtab = dynPtr(map, dyn->d_un.d_ptr); break;
+        case DT_VERSYM:   info->versym = dynPtr(map, dyn->d_un.d_ptr); break;
+        case DT_HASH:     hash         = dynPtr(map, dyn->d_un.d_ptr); break;
+        case DT_GNU_HASH: gnu_hash     = dynPtr(map, dyn->d_un.d_ptr); break;
+        case DT_SONAME:
+            soname = dyn->d_un.d_val;
+            have_soname = rtsTrue;
+            break;
+        }
+    }
+    if (info->symtab == NULL || info->strtab == NULL) {
+        return rtsFalse;
+    }
+    if (hash != NULL) {
+        info->n_syms = hash[1];
+    } else if (gnu_hash != NULL) {
+        info->n_syms = gnuHashSymbols(gnu_hash);
+    } else {
+        return rtsFalse;
+    }
+    info->soname = have_soname ? info->strtab + soname : NULL;
+    return rtsTrue;
+}
+
+/* Put the symbols of lib, which is at pos in the scope of the handle
+   of the given rank, in so_symbols */
+static rtsBool
+indexLib (struct link_map *map, nat rank, nat pos)
+{
+    IndexedLib *lib;
+    IndexedSym *e;
+    DynInfo info;
+    ElfW(Sym) *sym;
+    unsigned char bind, type;
+    nat i;
+
+    if (!readDynamic(map, &info)) {
+        IF_DEBUG(linker, debugBelch("indexLib: can't read the symbols of %s\n", map->l_name));
+        return rtsFalse;
+    }
+
+    lib = lookupHashTable(so_libs, (StgWord)map);
+    if (lib == NULL) {
+        lib = stgMallocBytes(sizeof(IndexedLib), "indexLib");
+        lib->map = map;
+        insertHashTable(so_libs, (StgWord)map, lib);
+    }
+    lib->rank = rank;
+    lib->pos = pos;
+
+    for (i = 1; i < info.n_syms; i++) {
+        sym = &info.symtab[i];
+        bind = ELF32_ST_BIND(sym->st_info);
+        type = ELF32_ST_TYPE(sym->st_info);
+        // the symbols dlsym() would find: see do_lookup_x() in glibc
+        if (sym->st_shndx == SHN_UNDEF || sym->st_name == 0
+            || (sym->st_value == 0 && type != STT_TLS)
+            || (bind != STB_GLOBAL && bind != STB_WEAK
+                && bind != STB_GNU_UNIQUE)
+            || (type != STT_NOTYPE && type != STT_OBJECT
+                && type != STT_FUNC && type != STT_COMMON
+                && type != STT_TLS && type != STT_GNU_IFUNC)) {
+            continue;
+        }
+        // not the default version of the symbol
+        if (info.versym != NULL
+            && (info.versym[i] & 0x8000 || info.versym[i] == 0)) {
+            continue;
+        }
+
+        e = lookupStrHashTable(so_symbols, info.strtab + sym->st_name);
+        if (e == NULL) {
+            e = stgMallocBytes(sizeof(IndexedSym), "indexLib");
+            insertStrHashTable(so_symbols, info.strtab + sym->st_name, e);
+        } else if (e->lib->rank > rank
+                   || (e->lib->rank == rank && e->lib->pos <= pos)) {
+            continue;
+        }
+        e->lib = lib;
+        if (type == STT_TLS || type == STT_GNU_IFUNC) {
+            e->addr = NULL;
+        } else {
+            e->addr = (void *)(map->l_addr + sym->st_value);
+        }
+    }
+    return rtsTrue;
+}
+
+/* Index the scope of a handle: the object and its dependencies,
+   breadth first */
+static rtsBool
+indexHandle (void *handle, nat rank, HashTable *by_name)
+{
+    struct link_map *map, **scope;
+    ElfW(Dyn) *dyn;
+    HashTable *seen;
+    DynInfo info;
+    nat n, size, pos;
+    rtsBool ok = rtsTrue;
+
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || map == NULL) {
+        return rtsFalse;
+    }
+
+    size = 16;
+    scope = stgMallocBytes(size * sizeof(struct link_map *), "indexHandle");
+    seen = allocHashTable();
+    scope[0] = map;
+    n = 1;
+    insertHashTable(seen, (StgWord)map, map);
+
+    for (pos = 0; ok && pos < n; pos++) {
+        map = scope[pos];
+        if (!indexLib(map, rank, pos) || !readDynamic(map, &info)) {
+            ok = rtsFalse;
+            break;
+        }
+        for (dyn = map->l_ld; dyn->d_tag != DT_NULL; dyn++) {
+            struct link_map *dep;
+            if (dyn->d_tag != DT_NEEDED) continue;
+            dep = lookupStrHashTable(by_name, info.strtab + dyn->d_un.d_val);
+            if (dep == NULL) {
+                IF_DEBUG(linker, debugBelch("indexHandle: can't find %s, needed by %s\n", info.strtab + dyn->d_un.d_val, map->l_name));
+                ok = rtsFalse;
+                break;
+            }
+            if (lookupHashTable(seen, (StgWord)dep) != NULL) continue;
+            insertHashTable(seen, (StgWord)dep, dep);
+            if (n == size) {
+                size *= 2;
+                scope = stgReallocBytes(scope, size * sizeof(struct link_map *),
+                                        "indexHandle");
+            }
+            scope[n++] = dep;
+        }
+    }
+
+    freeHashTable(seen, NULL);
+    stgFree(scope);
+    return ok;
+}
+
+/* Index the shared objects opened since last time.  Returns rtsFalse if
+   we can't use the index. */
+static rtsBool
+updateSOIndex (void)
+{
+    OpenedSO *o_so, **new_sos;
+    struct link_map *map;
+    HashTable *by_name;
+    DynInfo info;
+    nat n, i;
+    char *base;
+
+    if (!so_index_ok || openedSOs == so_indexed) {
+        return so_index_ok;
+    }
+
+    if (so_symbols == NULL) {
+        so_symbols = allocStrHashTable();
+        so_libs = allocHashTable();
+    }
+
+    /* the objects that are loaded, by the names they are needed by */
+    by_name = allocStrHashTable();
+    if (dlinfo(openedSOs->handle, RTLD_DI_LINKMAP, &map) != 0) {
+        map = NULL;
+    }
+    while (map != NULL && map->l_prev != NULL) {
+        map = map->l_prev;
+    }
+    for (; map != NULL; map = map->l_next) {
+        if (map->l_name != NULL && map->l_name[0] != '\0') {
+            base = strrchr(map->l_name, '/');
+            base = base ? base + 1 : map->l_name;
+            insertStrHashTable(by_name, base, map);
+        }
+        if (readDynamic(map, &info) && info.soname != NULL) {
+            insertStrHashTable(by_name, info.soname, map);
+        }
+    }
+
+    /* oldest first, so that the newest get the highest rank */
+    n = 0;
+    for (o_so = openedSOs; o_so != so_indexed; o_so = o_so->next) n++;
+    new_sos = stgMallocBytes(n * sizeof(OpenedSO *), "updateSOIndex");
+    i = n;
+    for (o_so = openedSOs; o_so != so_indexed; o_so = o_so->next) {
+        new_sos[--i] = o_so;
+    }
+    for (i = 0; i < n && so_index_ok; i++) {
+        so_index_ok = indexHandle(new_sos[i]->handle, ++so_rank, by_name);
+    }
+    stgFree(new_sos);
+    freeHashTable(by_name, NULL);
+
+    so_indexed = openedSOs;
+    IF_DEBUG(linker, debugBelch("updateSOIndex: %s\n", so_index_ok ? "done" : "giving up"));
+    return so_index_ok;
+}
+
+static void
+freeSOIndex (void)
+{
+    if (so_symbols != NULL) {
+        freeHashTable(so_symbols, stgFree);
+        freeHashTable(so_libs, stgFree);
+        so_symbols = NULL;
+        so_libs = NULL;
+    }
+}
+#endif /* USE_DLSYM_INDEX */
+
 static void *
 internal_dlsym(const char *symbol) {
     OpenedSO* o_so;
     void *v;
+#if defined(USE_DLSYM_INDEX)
+    IndexedSym *e;
+#endif
 
     // We acquire dl_mutex as concurrent dl* calls may alter dlerror
     ACQUIRE_LOCK(&dl_mutex);
@@ -1911,6 +2440,17 @@ internal_dlsym(const char *symbol) {
         return v;
     }
 
+#if defined(USE_DLSYM_INDEX)
+    // See Note [Indexing the symbols of shared objects]
+    if (updateSOIndex()) {
+        e = lookupStrHashTable(so_symbols, symbol);
+        if (e == NULL || e->addr != NULL) {
+            RELEASE_LOCK(&dl_mutex);
+            return e == NULL ? NULL : e->addr;
+        }
+    }
+#endif
+
     for (o_so = openedSOs; o_so != NULL; o_so = o_so->next) {
         v = dlsym(o_so->handle, symbol);
         if (dlerror() == NULL) {
@@ -2076,6 +2616,12 @@ static void* lookupSymbol_ (char *lbl)
 
     if (!ghciLookupSymbolTable(symhash, lbl, &val)) {
         IF_DEBUG(linker, debugBelch("lookupSymbol: symbol not found\n"));
+#       if defined(USE_LAZY_ARCHIVES)
+        val = lookupLazySymbol(lbl);
+        if (val != NULL) {
+            return val;
+        }
+#       endif
 #       if defined(OBJFORMAT_ELF)
         return internal_dlsym(lbl);
 #       elif defined(OBJFORMAT_MACHO)
@@ -2201,9 +2747,10 @@ void ghci_enquire ( char* addr )
 #define ROUND_UP(x,size) ((x + size - 1) & ~(size - 1))
 
 //
-// Returns NULL on failure.
+// Returns NULL on failure.  offset (into fd) must be a multiple of the
+// page size.  Requires: linker_alloc_mutex.
 //
-static void * mmapForLinker (size_t bytes, nat flags, int fd)
+static void * mmapForLinker_ (size_t bytes, nat flags, int fd, off_t offset)
 {
    void *map_addr = NULL;
    void *result;
@@ -2232,7 +2779,7 @@ mmap_again:
 
    result = mmap(map_addr, size,
                  PROT_EXEC|PROT_READ|PROT_WRITE,
-                 MAP_PRIVATE|TRY_MAP_32BIT|fixed|flags, fd, 0);
+                 MAP_PRIVATE|TRY_MAP_32BIT|fixed|flags, fd, offset);
 
    if (result == MAP_FAILED) {
        sysErrorBelch("mmap %" FMT_Word " bytes at %p",(W_)size,map_addr);
@@ -2294,6 +2841,255 @@ mmap_again:
 
    return result;
 }
+
+static void * mmapForLinker (size_t bytes, nat flags, int fd, off_t offset)
+{
+   void *result;
+
+   ACQUIRE_LOCK(&linker_alloc_mutex);
+   result = mmapForLinker_(bytes, flags, fd, offset);
+   RELEASE_LOCK(&linker_alloc_mutex);
+   return result;
+}
+
+/*
+ * Note [M32 Allocator]
+ *
+ * Each object we load used to get a mapping of its own, rounded up to
+ * whole pages, and often another for its symbol extras.  A GHCi
+ * session with thousands of small objects wastes most of the memory
+ * it maps that way, and can run into the kernel's limit on the number
+ * of mappings a process may have (vm.max_map_count on Linux).
+ *
+ * So small allocations come from the m32 allocator instead, which
+ * packs them into pages that it maps with mmapForLinker(), and hence
+ * in reach of each other and of the code loaded before (below 2Gb on
+ * x86_64, when that is asked for).  It keeps up to M32_MAX_PAGES pages
+ * open, and takes each allocation from the first one with room, or
+ * maps a new page in place of the fullest one.  The first word of each
+ * page counts the allocations in it, plus one while the allocator
+ * keeps the page open; m32_free() decrements it, and whoever takes it
+ * to zero unmaps the page.  An open page whose count drops back to one
+ * is empty, and is reused from the start.
+ *
+ * Allocations too big for a page are mapped on their own, as before;
+ * m32_free() tells them apart by their size, so it must be given the
+ * size that was allocated.  m32_alloc() is called with the
+ * linker_alloc_mutex held, but m32_free() may be called by the GC, when
+ * it frees an unloaded object, so the counts are updated atomically.
+ */
+
+#define M32_MAX_PAGES 32
+#define M32_REFCOUNT_BYTES 8    // the count
+#define M32_MAX_ALIGN 64        // the most a small allocation can ask for
+
+typedef struct {
+    char *base_addr;            // NULL if this slot has no page
+    nat   current_size;         // bytes used, counting the count
+} m32_page_t;
+
+static m32_page_t m32_pages[M32_MAX_PAGES];
+
+STATIC_INLINE rtsBool m32_is_large (size_t size)
+{
+    return size > (size_t)getpagesize() - M32_MAX_ALIGN;
+}
+
+// Drop one reference to the page that starts at addr
+static void m32_free_page (char *addr)
+{
+    if (atomic_dec((StgVolatilePtr)addr) == 0) {
+        if (munmap(addr, getpagesize()) == -1) {
+            sysErrorBelch("munmap");
+        }
+    }
+}
+
+//
+// Returns size bytes aligned to alignment (a power of 2, at most
+// M32_MAX_ALIGN), or NULL on failure.  Requires: linker_alloc_mutex.
+//
+static void *m32_alloc_ (size_t size, nat alignment)
+{
+    int pagesize = getpagesize();
+    nat i, empty, most_filled;
+    W_ aligned;
+    char *page;
+
+    ASSERT(alignment <= M32_MAX_ALIGN);
+    if (m32_is_large(size)) {
+        return mmapForLinker_(size, MAP_ANONYMOUS, -1, 0);
+    }
+
+    empty = M32_MAX_PAGES;
+    most_filled = 0;
+    for (i = 0; i < M32_MAX_PAGES; i++) {
+        if (m32_pages[i].base_addr == NULL) {
+            if (empty == M32_MAX_PAGES) empty = i;
+            continue;
+        }
+        // everything in this page has been freed: start it afresh
+        if (*(StgWord *)m32_pages[i].base_addr == 1) {
+            m32_pages[i].current_size = M32_REFCOUNT_BYTES;
+        }
+        aligned = ROUND_UP(m32_pages[i].current_size, alignment);
+        if (aligned + size <= (W_)pagesize) {
+            atomic_inc((StgVolatilePtr)m32_pages[i].base_addr, 1);
+            m32_pages[i].current_size = aligned + size;
+            return m32_pages[i].base_addr + aligned;
+        }
+        if (m32_pages[i].current_size >
+            m32_pages[most_filled].current_size) {
+            most_filled = i;
+        }
+    }
+
+    // no room: close the fullest page, if we need its slot
+    if (empty == M32_MAX_PAGES) {
+        m32_free_page(m32_pages[most_filled].base_addr);
+        m32_pages[most_filled].base_addr = NULL;
+        empty = most_filled;
+    }
+
+    page = mmapForLinker_(pagesize, MAP_ANONYMOUS, -1, 0);
+    if (page == NULL) {
+        return NULL;
+    }
+    *(StgWord *)page = 2;       // the allocator's and this allocation's
+    aligned = ROUND_UP(M32_REFCOUNT_BYTES, alignment);
+    m32_pages[empty].base_addr = page;
+    m32_pages[empty].current_size = aligned + size;
+    return page + aligned;
+}
+
+static void *m32_alloc (size_t size, nat alignment)
+{
+    void *result;
+
+    ACQUIRE_LOCK(&linker_alloc_mutex);
+    result = m32_alloc_(size, alignment);
+    RELEASE_LOCK(&linker_alloc_mutex);
+    return result;
+}
+
+static void m32_free (void *addr, size_t size)
+{
+    if (m32_is_large(size)) {
+        if (munmap(addr, ROUND_UP(size, getpagesize())) == -1) {
+            sysErrorBelch("munmap");
+        }
+    } else {
+        m32_free_page((char *)((W_)addr & ~(W_)(getpagesize() - 1)));
+    }
+}
+
+// Close the open pages, so that each is unmapped once the objects in
+// it are freed
+static void m32_flush (void)
+{
+    nat i;
+
+    ACQUIRE_LOCK(&linker_alloc_mutex);
+    for (i = 0; i < M32_MAX_PAGES; i++) {
+        if (m32_pages[i].base_addr != NULL) {
+            m32_free_page(m32_pages[i].base_addr);
+            m32_pages[i].base_addr = NULL;
+        }
+    }
+    RELEASE_LOCK(&linker_alloc_mutex);
+}
+
+/*
+ * Note [Mapping archive members]
+ *
+ * Rather than copying each object file of an archive into memory of
+ * its own, we map it straight from the archive, privately, so that
+ * only the pages we write to (with relocations, mostly) are copied,
+ * and loading the packages of a large program costs little more than
+ * the page faults on what it touches.  oc->imageOffset records where
+ * in its first page the image starts.
+ *
+ * A mapping starts on a page boundary of the file, though, whereas the
+ * members of an archive are only 2-byte aligned, and the sections of an
+ * object file are only as aligned in memory as its image is.  So we can
+ * only do this for members that start at an offset that is a multiple
+ * of the alignment their sections need; the others are copied as
+ * before.
+ *
+ * Returns the image, or NULL if the member must be read in instead.
+ */
+#if defined(OBJFORMAT_ELF)
+static char * mmapArchiveMember (FILE *f, int size, int *imageOffset)
+{
+    long pos;
+    int pagesize, offset;
+    char *map, *image;
+    StgWord align;
+
+    pos = ftell(f);
+    if (pos < 0) {
+        return NULL;
+    }
+
+    pagesize = getpagesize();
+    offset = pos % pagesize;
+    if (offset % sizeof(StgWord) != 0) {
+        return NULL; // not even the ELF header would be aligned
+    }
+
+    map = mmapForLinker(size + offset, 0, fileno(f), pos - offset);
+    if (map == NULL) {
+        return NULL;
+    }
+    image = map + offset;
+
+    align = imageAlignment_ELF(image, size);
+    if (align == 0 || (W_)image % align != 0) {
+        munmap(map, ROUND_UP(size + offset, pagesize));
+        return NULL;
+    }
+
+    IF_DEBUG(linker,
+             debugBelch("mmapArchiveMember: mapped %d bytes at %p\n",
+                        size, image));
+    *imageOffset = offset;
+    return image;
+}
+
+/*
+ * Read a small object of size bytes, at offset in fd, into memory from
+ * m32_alloc() (see Note [M32 Allocator]), rather than giving it pages
+ * of its own.
+ *
+ * Returns the image, or NULL if the object is too big, or its sections
+ * need more alignment than m32_alloc() gives, or it can't be read.
+ */
+static char * m32ReadImage (int fd, off_t offset, int size)
+{
+    char *image;
+    StgWord align;
+
+    if (USE_CONTIGUOUS_MMAP || m32_is_large(size)) {
+        return NULL; // the jump islands must follow the image
+    }
+
+    image = m32_alloc(size, M32_MAX_ALIGN);
+    if (image == NULL) {
+        return NULL;
+    }
+    if (pread(fd, image, size, offset) == size) {
+        align = imageAlignment_ELF(image, size);
+        if (align != 0 && (W_)image % align == 0) {
+            IF_DEBUG(linker,
+                     debugBelch("m32ReadImage: read %d bytes to %p\n",
+                                size, image));
+            return image;
+        }
+    }
+    m32_free(image, size);
+    return NULL;
+}
+#endif
 #endif // USE_MMAP
 
 /*
@@ -2352,6 +3148,11 @@ void freeObjectCode (ObjectCode *oc)
 
         for (s = oc->sections; s != NULL; s = nexts) {
             nexts = s->next;
+#ifdef USE_MMAP
+            if (s->m32_size != 0) {
+                m32_free(s->start, s->m32_size);
+            }
+#endif
             stgFree(s);
         }
     }
@@ -2361,20 +3162,24 @@ void freeObjectCode (ObjectCode *oc)
 #ifdef USE_MMAP
     int pagesize, size, r;
 
-    pagesize = getpagesize();
-    size = ROUND_UP(oc->fileSize, pagesize);
+    if (oc->imageM32) {
+        m32_free(oc->image, oc->fileSize);
+    } else {
+        pagesize = getpagesize();
+        size = ROUND_UP(oc->fileSize + oc->imageOffset, pagesize);
 
-    r = munmap(oc->image, size);
-    if (r == -1) {
-        sysErrorBelch("munmap");
+        r = munmap(oc->image - oc->imageOffset, size);
+        if (r == -1) {
+            sysErrorBelch("munmap");
+        }
     }
 
 #if defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH) || defined(arm_HOST_ARCH)
 #if !defined(x86_64_HOST_ARCH) || !defined(mingw32_HOST_OS)
-    if (!USE_CONTIGUOUS_MMAP && oc->symbol_extras != NULL)
+    if (oc->symbol_extras_apart)
     {
-        munmap(oc->symbol_extras,
-               ROUND_UP(sizeof(SymbolExtra) * oc->n_symbol_extras, pagesize));
+        m32_free(oc->symbol_extras,
+                 sizeof(SymbolExtra) * oc->n_symbol_extras);
     }
 #endif
 #endif
@@ -2447,12 +3252,16 @@ mkOc( pathchar *path, char *image, int imageSize,
    }
 
    oc->fileSize          = imageSize;
+   oc->imageOffset       = 0;
+   oc->imageM32          = 0;
+   oc->imageHash         = 0;
    oc->symbols           = NULL;
    oc->sections          = NULL;
    oc->proddables        = NULL;
    oc->stable_ptrs       = NULL;
 #if powerpc_HOST_ARCH || x86_64_HOST_ARCH || arm_HOST_ARCH
    oc->symbol_extras     = NULL;
+   oc->symbol_extras_apart = 0;
 #endif
 
 #ifndef USE_MMAP
@@ -2477,28 +3286,331 @@ static HsInt
 isAlreadyLoaded( pathchar *path )
 {
     ObjectCode *o;
+#if defined(USE_LAZY_ARCHIVES)
+    LazyArchive *la;
+#endif
     for (o = objects; o; o = o->next) {
        if (0 == pathcmp(o->fileName, path)) {
            return 1; /* already loaded */
        }
     }
+#if defined(USE_LAZY_ARCHIVES)
+    for (la = lazy_archives; la; la = la->next) {
+       if (0 == pathcmp(la->path, path)) {
+           return 1; /* its members are loaded on demand */
+       }
+    }
+#endif
     return 0; /* not loaded yet */
 }
 
-static HsInt loadArchive_ (pathchar *path)
+#if defined(USE_LAZY_ARCHIVES)
+/* -----------------------------------------------------------------------------
+ * Note [Lazy archive members]
+ *
+ * A program that loads a big package archive usually needs only a
+ * few of its object files.  So when an archive has a symbol index
+ * (the member called "/", which ar writes for ELF archives), we don't
+ * load its object files when we load the archive: we only make a
+ * LazyMember for each object file that the index lists, and put the
+ * symbols of the index into lazy_symhash.  When lookupSymbol_ doesn't
+ * find a symbol in symhash, it looks in lazy_symhash, and loads and
+ * resolves the object file that defines it (which may pull in more
+ * object files, from the symbols it needs).  This is what the system
+ * linker does with archives too.
+ *
+ * The object files that the index doesn't list (those that define no
+ * global symbols) are loaded straight away, as are the members of
+ * thin archives and of archives without an index.
+ *
+ * The GNU index is: the number of symbols n, as a 32-bit big-endian
+ * number, then n such numbers, the offsets of the headers of the
+ * members that define them, and then the n names, each terminated by
+ * a NUL.
+ */
+
+static StgWord32
+getWord32BE (unsigned char *p)
 {
-    ObjectCode* oc;
-    char *image;
-    int memberSize;
-    FILE *f;
-    int n;
-    size_t thisFileNameSize;
+    return ((StgWord32)p[0] << 24) | ((StgWord32)p[1] << 16)
+         | ((StgWord32)p[2] << 8)  |  (StgWord32)p[3];
+}
+
+/* Returns NULL if the index isn't one we understand.  *offsets maps
+   the header offsets of the members listed in it to la, until
+   addLazyMember() sees them. */
+static LazyArchive *
+readArchiveIndex (pathchar *path, char *index, int size, HashTable **offsets)
+{
+    LazyArchive *la;
+    HashTable *offs;
+    nat n, i, n_members;
+    char *p, *end, *nul;
+    StgWord off;
+
+    if (size < 4) {
+        return NULL;
+    }
+    n = getWord32BE((unsigned char *)index);
+    if (n == 0 || (size - 4) / 4 < (int)n) {
+        return NULL;
+    }
+
+    la = stgMallocBytes(sizeof(LazyArchive), "readArchiveIndex");
+    la->path = pathdup(path);
+    la->members = NULL;
+    la->n_members = 0;
+    la->index = index;
+    la->n_syms = n;
+    la->syms = stgMallocBytes(n * sizeof(char *), "readArchiveIndex");
+    la->next = NULL;
+
+    p = index + 4 + 4 * n;
+    end = index + size;
+    for (i = 0; i < n; i++) {
+        nul = p < end ? memchr(p, '\0', end - p) : NULL;
+        if (nul == NULL) {
+            IF_DEBUG(linker, debugBelch("readArchiveIndex: truncated index in `%" PATH_FMT "'\n", path));
+            stgFree(la->syms);
+            stgFree(la->path);
+            stgFree(la);
+            return NULL;
+        }
+        la->syms[i] = p;
+        p = nul + 1;
+    }
+
+    offs = allocHashTable();
+    n_members = 0;
+    for (i = 0; i < n; i++) {
+        off = getWord32BE((unsigned char *)index + 4 + 4 * i);
+        if (lookupHashTable(offs, off) == NULL) {
+            insertHashTable(offs, off, la);
+            n_members++;
+        }
+    }
+    la->members = stgMallocBytes(n_members * sizeof(LazyMember),
+                                 "readArchiveIndex");
+
+    *offsets = offs;
+    return la;
+}
+
+/* The header offset of the member that defines symbol i of the index */
+static long
+lazySymbolOffset (LazyArchive *la, nat i)
+{
+    return getWord32BE((unsigned char *)la->index + 4 + 4 * i);
+}
+
+/* A member of an archive with an index, whose header is at hdrOffset
+   and whose contents are the next size bytes of f: returns 1 if it
+   can be loaded later, because the index lists it. */
+static int
+addLazyMember (LazyArchive *la, HashTable *offsets, long hdrOffset,
+               FILE *f, int size, char *memberName)
+{
+    LazyMember *m;
+    long pos;
+
+    if (lookupHashTable(offsets, (StgWord)hdrOffset) != la) {
+        return 0;
+    }
+    pos = ftell(f);
+    if (pos < 0) {
+        return 0;
+    }
+
+    m = &la->members[la->n_members++];
+    m->archive = la;
+    m->offset = pos;
+    m->size = size;
+    m->memberName = memberName;
+    m->oc = NULL;
+    m->failed = 0;
+    insertHashTable(offsets, (StgWord)hdrOffset, m);
+    return 1;
+}
+
+/* Once all the members have been seen: put the symbols of the ones we
+   didn't load into lazy_symhash.  The first archive that has a symbol
+   is the one we load it from, as with the system linker. */
+static void
+addLazyArchive (LazyArchive *la, HashTable *offsets)
+{
+    LazyMember *m;
+    nat i;
+
+    for (i = 0; i < la->n_syms; i++) {
+        m = lookupHashTable(offsets, (StgWord)lazySymbolOffset(la, i));
+        if (m == (LazyMember *)la) {
+            la->syms[i] = NULL;     // not an object file we know of
+        } else if (lookupStrHashTable(lazy_symhash, la->syms[i]) == NULL) {
+            insertStrHashTable(lazy_symhash, la->syms[i], m);
+        } else {
+            la->syms[i] = NULL;     // another archive has it
+        }
+    }
+
+    la->next = lazy_archives;
+    lazy_archives = la;
+}
+
+static void
+freeLazyArchive (LazyArchive *la)
+{
+    nat i;
+
+    for (i = 0; i < la->n_members; i++) {
+        stgFree(la->members[i].memberName);
+    }
+    stgFree(la->members);
+    stgFree(la->syms);
+    stgFree(la->index);
+    stgFree(la->path);
+    stgFree(la);
+}
+
+/* Forget the index of an archive (when it is unloaded).  Returns 1 if
+   we had one. */
+static HsInt
+removeLazyArchive (pathchar *path)
+{
+    LazyArchive *la, **prev;
+    nat i;
+
+    for (prev = &lazy_archives; *prev; prev = &(*prev)->next) {
+        la = *prev;
+        if (0 == pathcmp(la->path, path)) {
+            for (i = 0; i < la->n_syms; i++) {
+                if (la->syms[i] != NULL) {
+                    removeStrHashTable(lazy_symhash, la->syms[i], NULL);
+                }
+            }
+            *prev = la->next;
+            freeLazyArchive(la);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static HsInt
+loadLazyMember (LazyMember *m)
+{
+    ObjectCode *oc;
+    FILE *f;
+    char *image;
+    int imageOffset, imageM32, n;
+
+    IF_DEBUG(linker, debugBelch("loadLazyMember: loading %s\n", m->memberName));
+
+    f = pathopen(m->archive->path, WSTR("rb"));
+    if (!f) {
+        errorBelch("loadArchive: can't read `%" PATH_FMT "'", m->archive->path);
+        return 0;
+    }
+    if (fseek(f, m->offset, SEEK_SET) != 0) {
+        errorBelch("loadArchive: error whilst seeking to %s", m->memberName);
+        fclose(f);
+        return 0;
+    }
+
+    imageOffset = 0;
+    imageM32 = 0;
+    image = m32ReadImage(fileno(f), m->offset, m->size);
+    if (image != NULL) {
+        imageM32 = 1;
+    } else {
+        image = mmapArchiveMember(f, m->size, &imageOffset);
+    }
+    if (image == NULL) {
+        imageOffset = 0;
+        image = mmapForLinker(m->size, MAP_ANONYMOUS, -1, 0);
+        if (image == NULL) {
+            fclose(f);
+            return 0;
+        }
+        n = fread(image, 1, m->size, f);
+        if (n != m->size) {
+            errorBelch("loadArchive: error whilst reading %s", m->memberName);
+            munmap(image, ROUND_UP(m->size, getpagesize()));
+            fclose(f);
+            return 0;
+        }
+    }
+    fclose(f);
+
+    oc = mkOc(m->archive->path, image, m->size, m->memberName);
+    oc->imageOffset = imageOffset;
+    oc->imageM32 = imageM32;
+
+    if (!loadOc(oc)) {
+        removeOcSymbols(oc);
+        freeObjectCode(oc);
+        return 0;
+    }
+    oc->next = objects;
+    objects = oc;
+
+    // Set first: resolving it may look up its own symbols again
+    m->oc = oc;
+
+    // If this fails, resolveObjs() will try again and report it
+    return resolveOc(oc);
+}
+
+/* lookupSymbol_ for the symbols of the archive members we haven't
+   loaded yet: returns NULL if it isn't one of them. */
+static void *
+lookupLazySymbol (char *lbl)
+{
+    LazyMember *m;
+    void *val;
+
+    m = lookupStrHashTable(lazy_symhash, lbl);
+    if (m == NULL || m->oc != NULL || m->failed) {
+        return NULL;
+    }
+
+    if (!loadLazyMember(m)) {
+        m->failed = 1;
+        return NULL;
+    }
+
+    if (!ghciLookupSymbolTable(symhash, lbl, &val)) {
+        return NULL;
+    }
+    IF_DEBUG(linker, debugBelch("lookupSymbol: value of %s is %p, from %s\n", lbl, val, m->memberName));
+    return val;
+}
+#endif /* USE_LAZY_ARCHIVES */
+
+static HsInt loadArchive_ (pathchar *path)
+{
+    ObjectCode* oc;
+    char *image;
+    int memberSize;
+    FILE *f;
+    int n;
+    size_t thisFileNameSize;
     char *fileName;
     size_t fileNameSize;
-    int isObject, isGnuIndex, isThin;
+    int isObject, isGnuIndex, isThin, isMapped, isM32;
     char tmp[20];
+    char hdr[60];
     char *gnuFileIndex;
     int gnuFileIndexSize;
+#if defined(USE_MMAP) && defined(OBJFORMAT_ELF)
+    int imageOffset;
+#endif
+#if defined(USE_LAZY_ARCHIVES)
+    LazyArchive *lazy;
+    HashTable *lazyOffsets;
+    long hdrOffset;
+    int isSymIndex;
+    char *symIndex;
+#endif
 #if defined(darwin_HOST_OS)
     int i;
     uint32_t nfat_arch, nfat_offset, cputype, cpusubtype;
@@ -2539,6 +3651,10 @@ static HsInt loadArchive_ (pathchar *path)
 
     gnuFileIndex = NULL;
     gnuFileIndexSize = 0;
+#if defined(USE_LAZY_ARCHIVES)
+    lazy = NULL;
+    lazyOffsets = NULL;
+#endif
 
     fileNameSize = 32;
     fileName = stgMallocBytes(fileNameSize, "loadArchive(fileName)");
@@ -2627,8 +3743,14 @@ static HsInt loadArchive_ (pathchar *path)
     IF_DEBUG(linker, debugBelch("loadArchive: loading archive contents\n"));
 
     while(1) {
-        n = fread ( fileName, 1, 16, f );
-        if (n != 16) {
+#if defined(USE_LAZY_ARCHIVES)
+        hdrOffset = ftell(f);
+        isSymIndex = 0;
+#endif
+        /* The header of a member: its name (16 bytes), mod time (12),
+           owner (6), group (6), mode (8), size (10) and magic (2) */
+        n = fread ( hdr, 1, 60, f );
+        if (n < 16) {
             if (feof(f)) {
                 IF_DEBUG(linker, debugBelch("loadArchive: EOF while reading from '%" PATH_FMT "'\n", path));
                 break;
@@ -2637,6 +3759,7 @@ static HsInt loadArchive_ (pathchar *path)
                 barf("loadArchive: Failed reading file name from `%s'", path);
             }
         }
+        memcpy(fileName, hdr, 16);
 
 #if defined(darwin_HOST_OS)
         if (strncmp(fileName, "!<arch>\n", 8) == 0) {
@@ -2645,33 +3768,18 @@ static HsInt loadArchive_ (pathchar *path)
         }
 #endif
 
-        n = fread ( tmp, 1, 12, f );
-        if (n != 12)
-            barf("loadArchive: Failed reading mod time from `%s'", path);
-        n = fread ( tmp, 1, 6, f );
-        if (n != 6)
-            barf("loadArchive: Failed reading owner from `%s'", path);
-        n = fread ( tmp, 1, 6, f );
-        if (n != 6)
-            barf("loadArchive: Failed reading group from `%s'", path);
-        n = fread ( tmp, 1, 8, f );
-        if (n != 8)
-            barf("loadArchive: Failed reading mode from `%s'", path);
-        n = fread ( tmp, 1, 10, f );
-        if (n != 10)
-            barf("loadArchive: Failed reading size from `%s'", path);
+        if (n != 60)
+            barf("loadArchive: Failed reading member header from `%s'", path);
+        memcpy(tmp, hdr + 48, 10);
         tmp[10] = '\0';
         for (n = 0; isdigit(tmp[n]); n++);
         tmp[n] = '\0';
         memberSize = atoi(tmp);
 
         IF_DEBUG(linker, debugBelch("loadArchive: size of this archive member is %d\n", memberSize));
-        n = fread ( tmp, 1, 2, f );
-        if (n != 2)
-            barf("loadArchive: Failed reading magic from `%s'", path);
-        if (strncmp(tmp, "\x60\x0A", 2) != 0)
+        if (strncmp(hdr + 58, "\x60\x0A", 2) != 0)
             barf("loadArchive: Failed reading magic from `%s' at %ld. Got %c%c",
-                 path, ftell(f), tmp[0], tmp[1]);
+                 path, ftell(f), hdr[58], hdr[59]);
 
         isGnuIndex = 0;
         /* Check for BSD-variant large filenames */
@@ -2742,6 +3850,10 @@ static HsInt loadArchive_ (pathchar *path)
             else if (fileName[1] == ' ') {
                 fileName[0] = '\0';
                 thisFileNameSize = 0;
+#if defined(USE_LAZY_ARCHIVES)
+                /* the symbol index, see Note [Lazy archive members] */
+                isSymIndex = !isThin && hdrOffset == 8;
+#endif
             }
             else {
                 barf("loadArchive: GNU-variant filename offset not found while reading filename from `%s'", path);
@@ -2792,15 +3904,50 @@ static HsInt loadArchive_ (pathchar *path)
 
             IF_DEBUG(linker, debugBelch("loadArchive: Member is an object file...loading...\n"));
 
-            /* We can't mmap from the archive directly, as object
-               files need to be 8-byte aligned but files in .ar
-               archives are 2-byte aligned. When possible we use mmap
+            archiveMemberName = stgMallocBytes(pathlen(path) + thisFileNameSize + 3,
+                                               "loadArchive(file)");
+            sprintf(archiveMemberName, "%" PATH_FMT "(%.*s)",
+                    path, (int)thisFileNameSize, fileName);
+
+#if defined(USE_LAZY_ARCHIVES)
+            /* See Note [Lazy archive members] */
+            if (lazy != NULL && !isThin &&
+                addLazyMember(lazy, lazyOffsets, hdrOffset, f, memberSize,
+                              archiveMemberName)) {
+                IF_DEBUG(linker, debugBelch("loadArchive: \tleaving it until it is needed\n"));
+                n = fseek(f, memberSize, SEEK_CUR);
+                if (n != 0)
+                    barf("loadArchive: error whilst seeking by %d in `%s'",
+                         memberSize, path);
+                goto next_member;
+            }
+#endif
+
+            /* A small member is read into pages it shares with other
+               small objects (see Note [M32 Allocator]).  We can only
+               mmap a bigger one from the archive directly when the
+               member is aligned well enough in it (see Note [Mapping
+               archive members]), as files in .ar archives are only
+               2-byte aligned.  Otherwise, when possible we use mmap
                to get some anonymous memory, as on 64-bit platforms if
-               we use malloc then we can be given memory above 2^32.
-               In the mmap case we're probably wasting lots of space;
-               we could do better. */
+               we use malloc then we can be given memory above 2^32. */
+            isMapped = 0;
+            isM32 = 0;
 #if defined(USE_MMAP)
-            image = mmapForLinker(memberSize, MAP_ANONYMOUS, -1);
+            image = NULL;
+#if defined(OBJFORMAT_ELF)
+            if (!isThin) {
+                image = m32ReadImage(fileno(f), ftell(f), memberSize);
+                isM32 = image != NULL;
+            }
+            if (!isThin && image == NULL) {
+                image = mmapArchiveMember(f, memberSize, &imageOffset);
+                isMapped = image != NULL;
+            }
+#endif
+            if (image == NULL) {
+                image = mmapForLinker(memberSize, MAP_ANONYMOUS, -1, 0);
+            }
 #elif defined(mingw32_HOST_OS)
         // TODO: We would like to use allocateExec here, but allocateExec
         //       cannot currently allocate blocks large enough.
@@ -2859,6 +4006,13 @@ static HsInt loadArchive_ (pathchar *path)
             }
             else
 #endif
+            if (isMapped || isM32) {
+                n = fseek(f, memberSize, SEEK_CUR);
+                if (n != 0)
+                    barf("loadArchive: error whilst seeking by %d in `%s'",
+                         memberSize, path);
+            }
+            else
             {
                 n = fread ( image, 1, memberSize, f );
                 if (n != memberSize) {
@@ -2866,11 +4020,6 @@ static HsInt loadArchive_ (pathchar *path)
                 }
             }
 
-            archiveMemberName = stgMallocBytes(pathlen(path) + thisFileNameSize + 3,
-                                               "loadArchive(file)");
-            sprintf(archiveMemberName, "%" PATH_FMT "(%.*s)",
-                    path, (int)thisFileNameSize, fileName);
-
             oc = mkOc(path, image, memberSize, archiveMemberName
 #ifndef USE_MMAP
 #ifdef darwin_HOST_OS
@@ -2880,6 +4029,12 @@ static HsInt loadArchive_ (pathchar *path)
                      );
 
             stgFree(archiveMemberName);
+#if defined(USE_MMAP) && defined(OBJFORMAT_ELF)
+            if (isMapped) {
+                oc->imageOffset = imageOffset;
+            }
+            oc->imageM32 = isM32;
+#endif
 
             if (0 == loadOc(oc)) {
                 stgFree(fileName);
@@ -2896,7 +4051,7 @@ static HsInt loadArchive_ (pathchar *path)
             }
             IF_DEBUG(linker, debugBelch("loadArchive: Found GNU-variant file index\n"));
 #ifdef USE_MMAP
-            gnuFileIndex = mmapForLinker(memberSize + 1, MAP_ANONYMOUS, -1);
+            gnuFileIndex = mmapForLinker(memberSize + 1, MAP_ANONYMOUS, -1, 0);
 #else
             gnuFileIndex = stgMallocBytes(memberSize + 1, "loadArchive(image)");
 #endif
@@ -2907,6 +4062,20 @@ static HsInt loadArchive_ (pathchar *path)
             gnuFileIndex[memberSize] = '/';
             gnuFileIndexSize = memberSize;
         }
+#if defined(USE_LAZY_ARCHIVES)
+        else if (isSymIndex) {
+            IF_DEBUG(linker, debugBelch("loadArchive: Found GNU-variant symbol index\n"));
+            symIndex = stgMallocBytes(memberSize, "loadArchive(symIndex)");
+            n = fread ( symIndex, 1, memberSize, f );
+            if (n != memberSize) {
+                barf("loadArchive: error whilst reading `%s'", path);
+            }
+            lazy = readArchiveIndex(path, symIndex, memberSize, &lazyOffsets);
+            if (lazy == NULL) {
+                stgFree(symIndex);
+            }
+        }
+#endif
         else {
             IF_DEBUG(linker, debugBelch("loadArchive: '%s' does not appear to be an object file\n", fileName));
             if (!isThin || thisFileNameSize == 0) {
@@ -2917,6 +4086,9 @@ static HsInt loadArchive_ (pathchar *path)
             }
         }
 
+#if defined(USE_LAZY_ARCHIVES)
+    next_member:
+#endif
         /* .ar files are 2-byte aligned */
         if (!(isThin && thisFileNameSize > 0) && memberSize % 2) {
             IF_DEBUG(linker, debugBelch("loadArchive: trying to read one pad byte\n"));
@@ -2937,6 +4109,17 @@ static HsInt loadArchive_ (pathchar *path)
 
     fclose(f);
 
+#if defined(USE_LAZY_ARCHIVES)
+    if (lazy != NULL) {
+        if (lazy->n_members > 0) {
+            addLazyArchive(lazy, lazyOffsets);
+        } else {
+            freeLazyArchive(lazy);
+        }
+        freeHashTable(lazyOffsets, NULL);
+    }
+#endif
+
     stgFree(fileName);
     if (gnuFileIndex != NULL) {
 #ifdef USE_MMAP
@@ -2959,11 +4142,11 @@ HsInt loadArchive (pathchar *path)
 }
 
 /* -----------------------------------------------------------------------------
- * Load an obj (populate the global symbol table, but don't resolve yet)
+ * Read an object file into memory
  *
- * Returns: 1 if ok, 0 on error.
+ * Returns: the new ObjectCode, or NULL on error.
  */
-static HsInt loadObj_ (pathchar *path)
+static ObjectCode *readObj (pathchar *path)
 {
    ObjectCode* oc;
    char *image;
@@ -2971,30 +4154,17 @@ static HsInt loadObj_ (pathchar *path)
    struct_stat st;
    int r;
 #ifdef USE_MMAP
-   int fd;
+   int fd, imageM32;
 #else
    FILE *f;
 #  if defined(darwin_HOST_OS)
    int misalignment;
 #  endif
 #endif
-   IF_DEBUG(linker, debugBelch("loadObj %" PATH_FMT "\n", path));
-
-   /* debugBelch("loadObj %s\n", path ); */
-
-   /* Check that we haven't already loaded this object.
-      Ignore requests to load multiple times */
-
-   if (isAlreadyLoaded(path)) {
-       IF_DEBUG(linker,
-                debugBelch("ignoring repeated load of %" PATH_FMT "\n", path));
-       return 1; /* success */
-   }
-
    r = pathstat(path, &st);
    if (r == -1) {
        IF_DEBUG(linker, debugBelch("File doesn't exist\n"));
-       return 0;
+       return NULL;
    }
 
    fileSize = st.st_size;
@@ -3011,13 +4181,19 @@ static HsInt loadObj_ (pathchar *path)
 #endif
    if (fd == -1) {
       errorBelch("loadObj: can't open `%s'", path);
-      return 0;
+      return NULL;
    }
 
-   image = mmapForLinker(fileSize, 0, fd);
+   imageM32 = 0;
+#if defined(OBJFORMAT_ELF)
+   image = m32ReadImage(fd, 0, fileSize);
+   imageM32 = image != NULL;
+   if (image == NULL)
+#endif
+   image = mmapForLinker(fileSize, 0, fd, 0);
    close(fd);
    if (image == NULL) {
-       return 0;
+       return NULL;
    }
 
 #else /* !USE_MMAP */
@@ -3026,7 +4202,7 @@ static HsInt loadObj_ (pathchar *path)
    f = pathopen(path, WSTR("rb"));
    if (!f) {
        errorBelch("loadObj: can't read `%" PATH_FMT "'", path);
-       return 0;
+       return NULL;
    }
 
 #   if defined(mingw32_HOST_OS)
@@ -3039,7 +4215,7 @@ static HsInt loadObj_ (pathchar *path)
        fileSize);
     if (image == NULL) {
         fclose(f);
-        return 0;
+        return NULL;
     }
 #   elif defined(darwin_HOST_OS)
     // In a Mach-O .o file, all sections can and will be misaligned
@@ -3065,7 +4241,7 @@ static HsInt loadObj_ (pathchar *path)
        if (n != fileSize) {
            errorBelch("loadObj: error whilst reading `%" PATH_FMT "'", path);
            stgFree(image);
-           return 0;
+           return NULL;
        }
    }
 #endif /* USE_MMAP */
@@ -3077,8 +4253,21 @@ static HsInt loadObj_ (pathchar *path)
 #endif
 #endif
             );
+#ifdef USE_MMAP
+   oc->imageM32 = imageM32;
+#endif
+   return oc;
+}
 
-   if (! loadOc(oc)) {
+/* -----------------------------------------------------------------------------
+ * Add a prepared object to the global symbol table and the objects.
+ * Requires: linker_mutex.
+ *
+ * Returns: 1 if ok, 0 on error, when the object has been freed.
+ */
+static HsInt addObj (ObjectCode *oc)
+{
+   if (! loadOcNames(oc)) {
        // failed; free everything we've allocated
        removeOcSymbols(oc);
        // no need to freeOcStablePtrs, they aren't created until resolveObjs()
@@ -3091,19 +4280,99 @@ static HsInt loadObj_ (pathchar *path)
    return 1;
 }
 
+/*
+ * Note [Concurrent loading]
+ *
+ * A program that loads objects from several threads at once (a plugin
+ * host, or GHC building modules that use Template Haskell with -j)
+ * used to do every step of every load with linker_mutex held.  But
+ * reading an object in and checking it (the ocVerifyImage_* and
+ * ocAllocateSymbolExtras_* functions) only use the object's own
+ * ObjectCode, and the memory that mmapForLinker() and the m32 allocator
+ * hand out.  So loadObj() does those steps without linker_mutex, with
+ * just linker_alloc_mutex around each allocation, and only takes
+ * linker_mutex to look for the object among those loaded and to add
+ * it and its symbols (loadOcNames()).  Two threads loading the same
+ * object may both read it in; the second to take linker_mutex finds it
+ * loaded and frees its copy.
+ *
+ * Archives, resolveObjs(), lookupSymbol() and unloadObj() still hold
+ * linker_mutex throughout.  This is only done for ELF, the format whose
+ * checking has been seen not to touch the linker's global state.
+ */
+
+/* -----------------------------------------------------------------------------
+ * Load an obj (populate the global symbol table, but don't resolve yet)
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
 HsInt loadObj (pathchar *path)
 {
+   ObjectCode* oc;
+   HsInt r;
+
+   IF_DEBUG(linker, debugBelch("loadObj %" PATH_FMT "\n", path));
+
+   /* Check that we haven't already loaded this object.
+      Ignore requests to load multiple times */
+
    ACQUIRE_LOCK(&linker_mutex);
-   HsInt r = loadObj_(path);
+   if (isAlreadyLoaded(path)) {
+       RELEASE_LOCK(&linker_mutex);
+       IF_DEBUG(linker,
+                debugBelch("ignoring repeated load of %" PATH_FMT "\n", path));
+       return 1; /* success */
+   }
+#if defined(OBJFORMAT_ELF)
+   // See Note [Concurrent loading]
+   RELEASE_LOCK(&linker_mutex);
+#endif
+
+   oc = readObj(path);
+   if (oc != NULL && ! prepareOc(oc)) {
+       freeObjectCode(oc);
+       oc = NULL;
+   }
+
+#if defined(OBJFORMAT_ELF)
+   ACQUIRE_LOCK(&linker_mutex);
+#endif
+   if (oc == NULL) {
+       r = 0;
+   } else if (isAlreadyLoaded(path)) {
+       // another thread got there first
+       freeObjectCode(oc);
+       r = 1;
+   } else {
+       r = addObj(oc);
+   }
    RELEASE_LOCK(&linker_mutex);
    return r;
 }
 
 static HsInt
 loadOc( ObjectCode* oc ) {
+   return prepareOc(oc) && loadOcNames(oc);
+}
+
+/* -----------------------------------------------------------------------------
+ * Check an object in memory, and allocate its symbol extras.  This
+ * needs no lock (see Note [Concurrent loading]).
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
+static HsInt
+prepareOc( ObjectCode* oc ) {
    int r;
 
-   IF_DEBUG(linker, debugBelch("loadOc: start\n"));
+   IF_DEBUG(linker, debugBelch("prepareOc: start\n"));
+
+#  if defined(USE_LINKER_CACHE)
+   /* before anything changes it: see Note [Linker cache] */
+   if (RtsFlags.MiscFlags.linkerCache != NULL) {
+       oc->imageHash = hashImage(oc->image, oc->fileSize);
+   }
+#  endif
 
    /* verify the in-memory image */
 #  if defined(OBJFORMAT_ELF)
@@ -3116,26 +4385,39 @@ loadOc( ObjectCode* oc ) {
    barf("loadObj: no verify method");
 #  endif
    if (!r) {
-       IF_DEBUG(linker, debugBelch("loadOc: ocVerifyImage_* failed\n"));
+       IF_DEBUG(linker, debugBelch("prepareOc: ocVerifyImage_* failed\n"));
        return r;
    }
 
 #  if defined(OBJFORMAT_MACHO) && (defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH))
    r = ocAllocateSymbolExtras_MachO ( oc );
    if (!r) {
-       IF_DEBUG(linker, debugBelch("loadOc: ocAllocateSymbolExtras_MachO failed\n"));
+       IF_DEBUG(linker, debugBelch("prepareOc: ocAllocateSymbolExtras_MachO failed\n"));
        return r;
    }
 #  elif defined(OBJFORMAT_ELF) && (defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH) || defined(arm_HOST_ARCH))
    r = ocAllocateSymbolExtras_ELF ( oc );
    if (!r) {
-       IF_DEBUG(linker, debugBelch("loadOc: ocAllocateSymbolExtras_ELF failed\n"));
+       IF_DEBUG(linker, debugBelch("prepareOc: ocAllocateSymbolExtras_ELF failed\n"));
        return r;
    }
 #  elif defined(OBJFORMAT_PEi386) && defined(x86_64_HOST_ARCH)
    ocAllocateSymbolExtras_PEi386 ( oc );
 #endif
 
+   return 1;
+}
+
+/* -----------------------------------------------------------------------------
+ * Add the symbols of a prepared object to the global symbol table.
+ * Requires: linker_mutex.
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
+static HsInt
+loadOcNames( ObjectCode* oc ) {
+   int r;
+
    /* build the symbol list for this image */
 #  if defined(OBJFORMAT_ELF)
    r = ocGetNames_ELF ( oc );
@@ -3158,6 +4440,182 @@ loadOc( ObjectCode* oc ) {
    return 1;
 }
 
+/* -----------------------------------------------------------------------------
+ * relocate an unlinked object in memory
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
+static int ocResolve (ObjectCode *oc)
+{
+#   if defined(OBJFORMAT_ELF)
+    return ocResolve_ELF ( oc );
+#   elif defined(OBJFORMAT_PEi386)
+    return ocResolve_PEi386 ( oc );
+#   elif defined(OBJFORMAT_MACHO)
+    return ocResolve_MachO ( oc );
+#   else
+    barf("resolveObjs: not implemented on this platform");
+#   endif
+}
+
+/* -----------------------------------------------------------------------------
+ * run the initialisers (init/init_array/ctors/mod_init_func) of a
+ * relocated object
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
+static int ocRunInit (ObjectCode *oc)
+{
+    int r;
+
+    loading_obj = oc; // tells foreignExportStablePtr what to do
+#if defined(OBJFORMAT_ELF)
+    r = ocRunInit_ELF ( oc );
+#elif defined(OBJFORMAT_PEi386)
+    r = ocRunInit_PEi386 ( oc );
+#elif defined(OBJFORMAT_MACHO)
+    r = ocRunInit_MachO ( oc );
+#else
+    barf("resolveObjs: initializers not implemented on this platform");
+#endif
+    loading_obj = NULL;
+
+    return r;
+}
+
+/* -----------------------------------------------------------------------------
+ * resolve an unlinked object in memory, and run its initialisers
+ *
+ * Returns: 1 if ok, 0 on error.
+ */
+static HsInt resolveOc (ObjectCode *oc)
+{
+    int r;
+
+    r = ocResolve(oc);
+    if (!r) { return r; }
+
+    r = ocRunInit(oc);
+    if (!r) { return r; }
+
+    oc->status = OBJECT_RESOLVED;
+    return 1;
+}
+
+#if defined(THREADED_RTS) && defined(OBJFORMAT_ELF)
+/* -----------------------------------------------------------------------------
+ * Note [Parallel relocation]
+ *
+ * Once the objects are loaded, all their symbols are in symhash, and
+ * relocating an object only writes to its own image and symbol
+ * extras.  So resolveObjs() relocates the objects on several threads
+ * at once (+RTS --linker-threads), and then runs their initialisers in
+ * order on this thread, as they may call into any of the objects.
+ *
+ * The lookups done while relocating must not change symhash, and the
+ * only ones that would are those that load an archive member (Note
+ * [Lazy archive members]).  So before starting the workers we look up
+ * the undefined symbols of each object that may come from such a
+ * member, on this thread, which loads them all.
+ *
+ * The workers are plain OS threads, started by each resolveObjs() that
+ * has enough objects to relocate.  They take the objects in turn, and
+ * stop early once one of them fails.
+ */
+
+/* With fewer objects than this, it isn't worth starting the workers */
+#define MIN_PARALLEL_RESOLVE 4
+
+typedef struct _ResolveJob {
+    ObjectCode     **ocs;
+    StgWord          n_ocs;
+    volatile StgWord next;      /* the next of ocs to relocate */
+    volatile int     failed;
+    nat              running;   /* workers not finished, under lock */
+    Mutex            lock;
+    Condition        finished;
+} ResolveJob;
+
+static void
+resolveJobObjects (ResolveJob *job)
+{
+    StgWord i;
+
+    while (!job->failed) {
+        i = atomic_inc(&job->next, 1) - 1;
+        if (i >= job->n_ocs) break;
+        if (!ocResolve(job->ocs[i])) {
+            job->failed = 1;
+        }
+    }
+}
+
+static void OSThreadProcAttr
+resolveWorker (void *arg)
+{
+    ResolveJob *job = arg;
+
+    resolveJobObjects(job);
+
+    ACQUIRE_LOCK(&job->lock);
+    job->running--;
+    if (job->running == 0) {
+        signalCondition(&job->finished);
+    }
+    RELEASE_LOCK(&job->lock);
+}
+
+/* Relocate the n objects ocs in parallel.  Returns: 1 if ok, 0 on error. */
+static HsInt
+resolveParallel (ObjectCode **ocs, StgWord n)
+{
+    ResolveJob job;
+    OSThreadId tid;
+    nat n_threads, i;
+
+    n_threads = RtsFlags.MiscFlags.linkerThreads;
+    if (n_threads == 0) {
+        n_threads = getNumberOfProcessors();
+    }
+    if (n_threads > n) {
+        n_threads = n;
+    }
+
+    job.ocs = ocs;
+    job.n_ocs = n;
+    job.next = 0;
+    job.failed = 0;
+    job.running = 1;            // this thread
+    initMutex(&job.lock);
+    initCondition(&job.finished);
+
+    IF_DEBUG(linker, debugBelch("resolveObjs: relocating %" FMT_Word " objects on %d threads\n", n, n_threads));
+
+    ACQUIRE_LOCK(&job.lock);
+    for (i = 1; i < n_threads; i++) {
+        if (createOSThread(&tid, "ghc_linker", resolveWorker, &job) != 0) {
+            // carry on with the ones we have
+            break;
+        }
+        job.running++;
+    }
+    RELEASE_LOCK(&job.lock);
+
+    resolveWorker(&job);
+
+    ACQUIRE_LOCK(&job.lock);
+    while (job.running > 0) {
+        waitCondition(&job.finished, &job.lock);
+    }
+    RELEASE_LOCK(&job.lock);
+
+    closeCondition(&job.finished);
+    closeMutex(&job.lock);
+
+    return !job.failed;
+}
+#endif
+
 /* -----------------------------------------------------------------------------
  * resolve all the currently unlinked objects in memory
  *
@@ -3167,39 +4625,57 @@ static HsInt resolveObjs_ (void)
 {
     ObjectCode *oc;
     int r;
+#if defined(THREADED_RTS) && defined(OBJFORMAT_ELF)
+    ObjectCode **ocs;
+    StgWord n, i;
+#endif
 
     IF_DEBUG(linker, debugBelch("resolveObjs: start\n"));
 
+#if defined(THREADED_RTS) && defined(OBJFORMAT_ELF)
+    /* See Note [Parallel relocation] */
+#if defined(USE_LAZY_ARCHIVES)
+    if (lazy_archives != NULL) {
+        for (oc = objects; oc; oc = oc->next) {
+            if (oc->status != OBJECT_RESOLVED) {
+                ocLoadLazyMembers_ELF(oc);
+            }
+        }
+    }
+#endif
+
+    n = 0;
     for (oc = objects; oc; oc = oc->next) {
-        if (oc->status != OBJECT_RESOLVED) {
-#           if defined(OBJFORMAT_ELF)
-            r = ocResolve_ELF ( oc );
-#           elif defined(OBJFORMAT_PEi386)
-            r = ocResolve_PEi386 ( oc );
-#           elif defined(OBJFORMAT_MACHO)
-            r = ocResolve_MachO ( oc );
-#           else
-            barf("resolveObjs: not implemented on this platform");
-#           endif
-            if (!r) { return r; }
+        if (oc->status != OBJECT_RESOLVED) n++;
+    }
 
-            // run init/init_array/ctors/mod_init_func
+    if (n >= MIN_PARALLEL_RESOLVE && RtsFlags.MiscFlags.linkerThreads != 1) {
+        ocs = stgMallocBytes(n * sizeof(ObjectCode*), "resolveObjs");
+        i = 0;
+        for (oc = objects; oc; oc = oc->next) {
+            if (oc->status != OBJECT_RESOLVED) ocs[i++] = oc;
+        }
 
-            loading_obj = oc; // tells foreignExportStablePtr what to do
-#if defined(OBJFORMAT_ELF)
-            r = ocRunInit_ELF ( oc );
-#elif defined(OBJFORMAT_PEi386)
-            r = ocRunInit_PEi386 ( oc );
-#elif defined(OBJFORMAT_MACHO)
-            r = ocRunInit_MachO ( oc );
-#else
-            barf("resolveObjs: initializers not implemented on this platform");
+        r = resolveParallel(ocs, n);
+
+        for (i = 0; r && i < n; i++) {
+            r = ocRunInit(ocs[i]);
+            if (r) {
+                ocs[i]->status = OBJECT_RESOLVED;
+            }
+        }
+        stgFree(ocs);
+        if (!r) { return r; }
+
+        IF_DEBUG(linker, debugBelch("resolveObjs: done\n"));
+        return 1;
+    }
 #endif
-            loading_obj = NULL;
 
+    for (oc = objects; oc; oc = oc->next) {
+        if (oc->status != OBJECT_RESOLVED) {
+            r = resolveOc(oc);
             if (!r) { return r; }
-
-            oc->status = OBJECT_RESOLVED;
         }
     }
     IF_DEBUG(linker, debugBelch("resolveObjs: done\n"));
@@ -3223,10 +4699,16 @@ static HsInt unloadObj_ (pathchar *path, rtsBool just_purge)
     HsBool unloadedAnyObj = HS_BOOL_FALSE;
 
     ASSERT(symhash != NULL);
-    ASSERT(objects != NULL);
 
     IF_DEBUG(linker, debugBelch("unloadObj: %" PATH_FMT "\n", path));
 
+#if defined(USE_LAZY_ARCHIVES)
+    // the members of an archive we haven't loaded yet
+    if (removeLazyArchive(path)) {
+        unloadedAnyObj = HS_BOOL_TRUE;
+    }
+#endif
+
     prev = NULL;
     for (oc = objects; oc; oc = next) {
         next = oc->next; // oc might be freed
@@ -3343,6 +4825,7 @@ addSection ( ObjectCode* oc, SectionKind kind,
    s->start     = start;
    s->end       = end;
    s->kind      = kind;
+   s->m32_size  = 0;
    s->next      = oc->sections;
    oc->sections = s;
 
@@ -3401,25 +4884,29 @@ static int ocAllocateSymbolExtras( ObjectCode* oc, int count, int first )
 
 #ifdef USE_MMAP
     pagesize = getpagesize();
-    n = ROUND_UP( oc->fileSize, pagesize );
-    m = ROUND_UP( aligned + sizeof (SymbolExtra) * count, pagesize );
+    n = ROUND_UP( oc->imageOffset + oc->fileSize, pagesize );
+    m = ROUND_UP( oc->imageOffset + aligned + sizeof (SymbolExtra) * count,
+                  pagesize );
 
     /* we try to use spare space at the end of the last page of the
      * image for the jump islands, but if there isn't enough space
-     * then we have to map some (anonymously, remembering MAP_32BIT).
+     * (or the rest of the page isn't the image's, see Note [M32
+     * Allocator]) then we have to map some (anonymously, remembering
+     * MAP_32BIT).
      */
-    if( m > n ) // we need to allocate more pages
+    if( m > n || oc->imageM32 ) // we need to allocate more pages
     {
         if (USE_CONTIGUOUS_MMAP)
         {
             /* Keep image and symbol_extras contiguous */
             void *new = mmapForLinker(n + (sizeof(SymbolExtra) * count),
-                                  MAP_ANONYMOUS, -1);
+                                  MAP_ANONYMOUS, -1, 0);
             if (new)
             {
                 memcpy(new, oc->image, oc->fileSize);
-                munmap(oc->image, n);
+                munmap(oc->image - oc->imageOffset, n);
                 oc->image = new;
+                oc->imageOffset = 0;
                 oc->fileSize = n + (sizeof(SymbolExtra) * count);
                 oc->symbol_extras = (SymbolExtra *) (oc->image + n);
             }
@@ -3430,9 +4917,10 @@ static int ocAllocateSymbolExtras( ObjectCode* oc, int count, int first )
         }
         else
         {
-            oc->symbol_extras = mmapForLinker(sizeof(SymbolExtra) * count,
-                                          MAP_ANONYMOUS, -1);
+            oc->symbol_extras = m32_alloc(sizeof(SymbolExtra) * count,
+                                          sizeof(StgWord));
             if (oc->symbol_extras == NULL) return 0;
+            oc->symbol_extras_apart = 1;
         }
     }
     else
@@ -3455,30 +4943,163 @@ static int ocAllocateSymbolExtras( ObjectCode* oc, int count, int first )
   else
     oc->symbol_extras = NULL;
 
-  oc->first_symbol_extra = first;
-  oc->n_symbol_extras = count;
+  oc->first_symbol_extra = first;
+  oc->n_symbol_extras = count;
+
+  return 1;
+}
+
+#endif
+#endif // defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH) || defined(arm_HOST_ARCH)
+
+#if defined(arm_HOST_ARCH)
+
+static void
+ocFlushInstructionCache( ObjectCode *oc )
+{
+    // Object code
+    __clear_cache(oc->image, oc->image + oc->fileSize);
+    // Jump islands
+    __clear_cache(oc->symbol_extras, &oc->symbol_extras[oc->n_symbol_extras]);
+}
+
+#endif
+
+#if defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH)
+#if !defined(x86_64_HOST_ARCH) || !defined(mingw32_HOST_OS)
+
+#if defined(USE_SHARED_SYMBOL_EXTRAS)
+/*
+  Note [Shared symbol extras]
+
+  The symbol extras of an object are the same for every object that
+  jumps to (or takes from a GOT entry) the same target: the target,
+  and a jump to it.  With hundreds of objects all calling into base,
+  keeping them per object wastes memory and instruction cache.  So
+  makeSymbolExtra hands out extras from a pool that all objects share,
+  with one extra per target, as long as the extra can be reached from
+  all of the object's image with a 32-bit displacement (and, if the
+  image is in the low 2Gb, is too, for R_X86_64_32).  If it can't, the
+  object gets a new one from the pool if that can be reached, or
+  otherwise uses its own, which ocAllocateSymbolExtras_ELF still
+  reserves, though those pages are never touched when the pool is used.
+
+  The extras of the pool are never freed: what one holds only depends
+  on its target, so it stays right for any object that jumps there,
+  even after the object it was made for has been unloaded.
+
+  The linker cache (Note [Linker cache]) only knows about the extras of
+  the object itself, so with +RTS --linker-cache we don't use the pool.
+*/
+
+#define SHARED_EXTRAS_CHUNK 4096        /* SymbolExtras */
+
+/* the margin we leave for the addends of relocations */
+#define SHARED_EXTRAS_MARGIN 0x10000L
+
+typedef struct _SharedExtrasChunk {
+    SymbolExtra *extras;
+    struct _SharedExtrasChunk *next;
+} SharedExtrasChunk;
+
+/* target -> SymbolExtra */
+static HashTable *shared_extras = NULL;
+/* the chunks of the pool, most recent (the one we use) first */
+static SharedExtrasChunk *shared_extras_chunks = NULL;
+static nat shared_extras_used = SHARED_EXTRAS_CHUNK;
+
+static rtsBool
+reachableExtra (ObjectCode *oc, SymbolExtra *extra)
+{
+    StgInt64 lo = (StgInt64)oc->image;
+    StgInt64 hi = lo + oc->fileSize;
+    StgInt64 start = (StgInt64)extra;
+    StgInt64 end = start + sizeof(SymbolExtra);
+
+    if (lo < 0x80000000L && end >= 0x80000000L - SHARED_EXTRAS_MARGIN) {
+        return rtsFalse;
+    }
+    return end - lo < 0x80000000L - SHARED_EXTRAS_MARGIN
+        && start - hi > -0x80000000L + SHARED_EXTRAS_MARGIN;
+}
+
+/* Returns NULL if oc must use an extra of its own */
+static SymbolExtra *
+sharedSymbolExtra (ObjectCode *oc, unsigned long target)
+{
+    SymbolExtra *extra;
+    SharedExtrasChunk *chunk;
+    // jmp *-14(%rip)
+    static uint8_t jmp[] = { 0xFF, 0x25, 0xF2, 0xFF, 0xFF, 0xFF };
+
+    if (RtsFlags.MiscFlags.linkerCache != NULL) {
+        return NULL;
+    }
+
+    ACQUIRE_LOCK(&shared_extras_mutex);
+    if (shared_extras == NULL) {
+        shared_extras = allocHashTable();
+    }
+
+    extra = lookupHashTable(shared_extras, target);
+    if (extra != NULL && reachableExtra(oc, extra)) {
+        RELEASE_LOCK(&shared_extras_mutex);
+        return extra;
+    }
+
+    if (shared_extras_used == SHARED_EXTRAS_CHUNK) {
+        chunk = stgMallocBytes(sizeof(SharedExtrasChunk), "sharedSymbolExtra");
+        chunk->extras = mmapForLinker(SHARED_EXTRAS_CHUNK * sizeof(SymbolExtra),
+                                      MAP_ANONYMOUS, -1, 0);
+        if (chunk->extras == NULL) {
+            stgFree(chunk);
+            RELEASE_LOCK(&shared_extras_mutex);
+            return NULL;
+        }
+        chunk->next = shared_extras_chunks;
+        shared_extras_chunks = chunk;
+        shared_extras_used = 0;
+    }
+
+    extra = &shared_extras_chunks->extras[shared_extras_used];
+    if (!reachableExtra(oc, extra)) {
+        RELEASE_LOCK(&shared_extras_mutex);
+        return NULL;
+    }
+    shared_extras_used++;
 
-  return 1;
-}
+    extra->addr = target;
+    memcpy(extra->jumpIsland, jmp, 6);
 
-#endif
-#endif // defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH) || defined(arm_HOST_ARCH)
+    if (lookupHashTable(shared_extras, target) != NULL) {
+        removeHashTable(shared_extras, target, NULL);
+    }
+    insertHashTable(shared_extras, target, extra);
 
-#if defined(arm_HOST_ARCH)
+    RELEASE_LOCK(&shared_extras_mutex);
+    return extra;
+}
 
 static void
-ocFlushInstructionCache( ObjectCode *oc )
+freeSharedSymbolExtras (void)
 {
-    // Object code
-    __clear_cache(oc->image, oc->image + oc->fileSize);
-    // Jump islands
-    __clear_cache(oc->symbol_extras, &oc->symbol_extras[oc->n_symbol_extras]);
+    SharedExtrasChunk *chunk, *next;
+
+    for (chunk = shared_extras_chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        munmap(chunk->extras,
+               ROUND_UP(SHARED_EXTRAS_CHUNK * sizeof(SymbolExtra),
+                        getpagesize()));
+        stgFree(chunk);
+    }
+    shared_extras_chunks = NULL;
+    shared_extras_used = SHARED_EXTRAS_CHUNK;
+    if (shared_extras != NULL) {
+        freeHashTable(shared_extras, NULL);
+        shared_extras = NULL;
+    }
 }
-
-#endif
-
-#if defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH)
-#if !defined(x86_64_HOST_ARCH) || !defined(mingw32_HOST_OS)
+#endif /* USE_SHARED_SYMBOL_EXTRAS */
 
 static SymbolExtra* makeSymbolExtra( ObjectCode* oc,
                                      unsigned long symbolNumber,
@@ -3486,6 +5107,14 @@ static SymbolExtra* makeSymbolExtra( ObjectCode* oc,
 {
   SymbolExtra *extra;
 
+#if defined(USE_SHARED_SYMBOL_EXTRAS)
+  /* See Note [Shared symbol extras] */
+  extra = sharedSymbolExtra(oc, target);
+  if (extra != NULL) {
+      return extra;
+  }
+#endif
+
   ASSERT( symbolNumber >= oc->first_symbol_extra
         && symbolNumber - oc->first_symbol_extra < oc->n_symbol_extras);
 
@@ -4001,11 +5630,197 @@ zapTrailingAtSign ( UChar* sym )
 #  undef my_isdigit
 }
 
+/*
+  Note [Indexing the exports of DLLs]
+
+  Looking for a symbol with GetProcAddress() in each of the DLLs we
+  have opened in turn takes a long time when an object has thousands
+  of imports.  So instead we read the export directory of each DLL
+  once, when we first look up a symbol after it was opened, and keep
+  all the names it exports in dll_exports, with the newest DLL that
+  exports each one, since that is the one our search would find first.
+
+  A forwarded export names an export of another DLL, which only
+  GetProcAddress() can find, so for those we ask GetProcAddress()
+  with the DLL we have recorded.  If we can't make sense of the headers
+  of a DLL, we stop using the index altogether.  Everything here is
+  protected by linker_mutex, as the objects are relocated one at a
+  time on Windows.
+*/
+
+typedef struct _IndexedExport {
+    OpenedDLL *dll;             /* the newest that exports the name */
+    nat rank;                   /* of dll: the newer, the higher */
+    void *addr;                 /* NULL ==> ask GetProcAddress() */
+} IndexedExport;
+
+/* str -> IndexedExport; the strings are in the DLLs' export tables */
+static HashTable *dll_exports = NULL;
+/* the first of opened_dlls whose exports are in dll_exports */
+static OpenedDLL *dll_indexed = NULL;
+static nat dll_rank = 0;
+static rtsBool dll_index_ok = rtsTrue;
+
+/* Put the names that o_dll exports in dll_exports */
+static rtsBool
+indexDLL (OpenedDLL *o_dll, nat rank)
+{
+    BYTE *base = (BYTE *)o_dll->instance;
+    IMAGE_DOS_HEADER *dos = (IMAGE_DOS_HEADER *)base;
+    IMAGE_NT_HEADERS *nt;
+    IMAGE_DATA_DIRECTORY *dir;
+    IMAGE_EXPORT_DIRECTORY *exports;
+    DWORD *names, *functions, i, rva;
+    WORD *ordinals;
+    IndexedExport *e;
+    char *name;
+
+    if (base == NULL || dos->e_magic != IMAGE_DOS_SIGNATURE) {
+        return rtsFalse;
+    }
+    nt = (IMAGE_NT_HEADERS *)(base + dos->e_lfanew);
+    if (nt->Signature != IMAGE_NT_SIGNATURE ||
+        nt->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR_MAGIC) {
+        return rtsFalse;
+    }
+    if (nt->OptionalHeader.NumberOfRvaAndSizes <=
+        IMAGE_DIRECTORY_ENTRY_EXPORT) {
+        return rtsTrue;
+    }
+    dir = &nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+    if (dir->VirtualAddress == 0 || dir->Size == 0) {
+        return rtsTrue;         /* it exports nothing */
+    }
+
+    exports   = (IMAGE_EXPORT_DIRECTORY *)(base + dir->VirtualAddress);
+    names     = (DWORD *)(base + exports->AddressOfNames);
+    ordinals  = (WORD *)(base + exports->AddressOfNameOrdinals);
+    functions = (DWORD *)(base + exports->AddressOfFunctions);
+
+    for (i = 0; i < exports->NumberOfNames; i++) {
+        if (ordinals[i] >= exports->NumberOfFunctions) {
+            IF_DEBUG(linker, debugBelch("indexDLL: bad export table in %" PATH_FMT "\n", o_dll->name));
+            return rtsFalse;
+        }
+        name = (char *)(base + names[i]);
+        rva = functions[ordinals[i]];
+
+        e = lookupStrHashTable(dll_exports, name);
+        if (e == NULL) {
+            e = stgMallocBytes(sizeof(IndexedExport), "indexDLL");
+            insertStrHashTable(dll_exports, name, e);
+        }
+        e->dll = o_dll;
+        e->rank = rank;
+        if (rva >= dir->VirtualAddress &&
+            rva < dir->VirtualAddress + dir->Size) {
+            e->addr = NULL;     /* forwarded */
+        } else {
+            e->addr = base + rva;
+        }
+    }
+    return rtsTrue;
+}
+
+/* Index the DLLs opened since last time.  Returns rtsFalse if we can't
+   use the index. */
+static rtsBool
+updateDLLIndex (void)
+{
+    OpenedDLL *o_dll, **new_dlls;
+    nat n, i;
+
+    if (!dll_index_ok || opened_dlls == dll_indexed) {
+        return dll_index_ok;
+    }
+
+    if (dll_exports == NULL) {
+        dll_exports = allocStrHashTable();
+    }
+
+    /* oldest first, so that the newest get the highest rank */
+    n = 0;
+    for (o_dll = opened_dlls; o_dll != dll_indexed; o_dll = o_dll->next) n++;
+    new_dlls = stgMallocBytes(n * sizeof(OpenedDLL *), "updateDLLIndex");
+    i = n;
+    for (o_dll = opened_dlls; o_dll != dll_indexed; o_dll = o_dll->next) {
+        new_dlls[--i] = o_dll;
+    }
+    for (i = 0; i < n && dll_index_ok; i++) {
+        dll_index_ok = indexDLL(new_dlls[i], ++dll_rank);
+    }
+    stgFree(new_dlls);
+
+    dll_indexed = opened_dlls;
+    IF_DEBUG(linker, debugBelch("updateDLLIndex: %s\n", dll_index_ok ? "done" : "giving up"));
+    return dll_index_ok;
+}
+
+static void
+freeDLLIndex (void)
+{
+    if (dll_exports != NULL) {
+        freeHashTable(dll_exports, stgFree);
+        dll_exports = NULL;
+    }
+    dll_indexed = NULL;
+    dll_rank = 0;
+    dll_index_ok = rtsTrue;
+}
+
+/* The address of the export name of e */
+static void *
+indexedExportAddr (IndexedExport *e, UChar *name)
+{
+    return e->addr != NULL ? e->addr
+                           : GetProcAddress(e->dll->instance, (char*)name);
+}
+
 static void *
 lookupSymbolInDLLs ( UChar *lbl )
 {
     OpenedDLL* o_dll;
-    void *sym;
+    void *sym = NULL;
+
+    // See Note [Indexing the exports of DLLs]
+    if (updateDLLIndex()) {
+        /* the names the search below tries in each DLL in turn: the
+           one found in the newest DLL wins, and then the first */
+        IndexedExport *e, *best = NULL;
+        UChar *name = NULL;
+
+        if (lbl[0] == '_') {
+            e = lookupStrHashTable(dll_exports, (char*)(lbl+1));
+            if (e != NULL) { best = e; name = lbl+1; }
+        }
+        if (strncmp ((const char*)lbl, "__imp_", 6) == 0) {
+            e = lookupStrHashTable(dll_exports, (char*)(lbl+6));
+            if (e != NULL && (best == NULL || e->rank > best->rank)) {
+                best = e; name = lbl+6;
+            }
+        }
+        e = lookupStrHashTable(dll_exports, (char*)lbl);
+        if (e != NULL && (best == NULL || e->rank > best->rank)) {
+            best = e; name = lbl;
+        }
+
+        if (best == NULL) {
+            return NULL;
+        }
+        sym = indexedExportAddr(best, name);
+        if (sym != NULL && name == lbl+6) {
+            /* see Ticket #2283 below */
+            IndirectAddr* ret;
+            ret = stgMallocBytes( sizeof(IndirectAddr), "lookupSymbolInDLLs" );
+            ret->addr = sym;
+            ret->next = indirects;
+            indirects = ret;
+            errorBelch("warning: %s from %S is linked instead of %s",
+                          (char*)(lbl+6), best->dll->name, (char*)lbl);
+            return (void*) & ret->addr;
+        }
+        return sym;
+    }
 
     for (o_dll = opened_dlls; o_dll != NULL; o_dll = o_dll->next) {
         /* debugBelch("look in %ls for %s\n", o_dll->name, lbl); */
@@ -5049,6 +6864,45 @@ PLTSize(void)
  * Generic ELF functions
  */
 
+#if defined(USE_MMAP)
+/*
+ * The alignment that the image of an ELF object needs in memory, so
+ * that its sections are aligned: the largest of their sh_addralign.
+ * Returns 0 if the image doesn't look like an ELF object; the caller
+ * has made sure that the header is aligned (see mmapArchiveMember()).
+ */
+static StgWord
+imageAlignment_ELF ( char* image, int size )
+{
+   Elf_Ehdr* ehdr = (Elf_Ehdr*)image;
+   Elf_Shdr* shdr;
+   StgWord align;
+   int i;
+
+   if (size < (int)sizeof(Elf_Ehdr) ||
+       ehdr->e_ident[EI_MAG0] != ELFMAG0 ||
+       ehdr->e_ident[EI_MAG1] != ELFMAG1 ||
+       ehdr->e_ident[EI_MAG2] != ELFMAG2 ||
+       ehdr->e_ident[EI_MAG3] != ELFMAG3 ||
+       ehdr->e_ident[EI_CLASS] != ELFCLASS ||
+       ehdr->e_shentsize != sizeof(Elf_Shdr) ||
+       ehdr->e_shoff % sizeof(StgWord) != 0 ||
+       ehdr->e_shoff + (StgWord)ehdr->e_shnum * sizeof(Elf_Shdr)
+           > (StgWord)size) {
+      return 0;
+   }
+
+   shdr = (Elf_Shdr*)(image + ehdr->e_shoff);
+   align = sizeof(StgWord);
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      if (shdr[i].sh_addralign > align) {
+         align = shdr[i].sh_addralign;
+      }
+   }
+   return align;
+}
+#endif
+
 static int
 ocVerifyImage_ELF ( ObjectCode* oc )
 {
@@ -5332,13 +7186,30 @@ ocGetNames_ELF ( ObjectCode* oc )
          ("Portable Formats Specification, Version 1.1"). */
       int         is_bss = FALSE;
       SectionKind kind   = getSectionKind_ELF(&shdr[i], &is_bss);
+      StgWord     bss_m32 = 0;
 
       if (is_bss && shdr[i].sh_size > 0) {
          /* This is a non-empty .bss section.  Allocate zeroed space for
             it, and set its .sh_offset field such that
-            ehdrC + .sh_offset == addr_of_zeroed_space.  */
-         char* zspace = stgCallocBytes(1, shdr[i].sh_size,
-                                       "ocGetNames_ELF(BSS)");
+            ehdrC + .sh_offset == addr_of_zeroed_space.  We put it
+            near the code when we can (see Note [M32 Allocator]), as
+            the code may refer to it PC-relatively. */
+         char* zspace = NULL;
+#if defined(USE_MMAP)
+         if (kind != SECTIONKIND_OTHER &&
+             shdr[i].sh_addralign <= M32_MAX_ALIGN) {
+            zspace = m32_alloc(shdr[i].sh_size,
+                               stg_max(shdr[i].sh_addralign, 1));
+            if (zspace != NULL) {
+               memset(zspace, 0, shdr[i].sh_size);
+               bss_m32 = shdr[i].sh_size;
+            }
+         }
+#endif
+         if (zspace == NULL) {
+            zspace = stgCallocBytes(1, shdr[i].sh_size,
+                                    "ocGetNames_ELF(BSS)");
+         }
          shdr[i].sh_offset = ((char*)zspace) - ((char*)ehdrC);
          /*
          debugBelch("BSS section at 0x%x, size %d\n",
@@ -5351,6 +7222,7 @@ ocGetNames_ELF ( ObjectCode* oc )
          addProddableBlock(oc, ehdrC + shdr[i].sh_offset, shdr[i].sh_size);
          addSection(oc, kind, ehdrC + shdr[i].sh_offset,
                         ehdrC + shdr[i].sh_offset + shdr[i].sh_size - 1);
+         oc->sections->m32_size = bss_m32;
       }
 
       if (shdr[i].sh_type != SHT_SYMTAB) continue;
@@ -6093,6 +7965,361 @@ do_Elf_Rela_relocations ( ObjectCode* oc, char* ehdrC,
    return 1;
 }
 
+#if defined(USE_LINKER_CACHE)
+/* -----------------------------------------------------------------------------
+ * Note [Linker cache]
+ *
+ * With +RTS --linker-cache=<dir>, ocResolve_ELF keeps the result of
+ * relocating each object in <dir>, so that the next session that
+ * loads the same object doesn't have to relocate it again.
+ *
+ * What relocating an object writes depends on the bytes of the object
+ * file, on where its image, its sections (those we allocate, like
+ * .bss, too) and its symbol extras are in memory, and on the value of
+ * every global symbol its relocations refer to.  So an entry of the
+ * cache is named after a hash of the image, as loadOc read it, and
+ * the image's address, and holds:
+ *
+ *   LINKER_CACHE_MAGIC, then words:
+ *     version, hash, image, file size, symbol extras, count of extras
+ *     e_shnum, then the sh_offset of each section
+ *     n, then n times: symbol table, symbol, value  -- the bindings
+ *     n, then n times: section, size, contents      -- padded to a word
+ *     the symbol extras
+ *
+ * An entry is only used if all of these are the same as they are
+ * now, which we check by looking up each of the bindings once, rather
+ * than once for each relocation that refers to it.  Then we copy the
+ * relocated sections and the symbol extras over those of the image,
+ * instead of relocating it.  Otherwise we relocate the image as
+ * usual, and write a new entry.
+ *
+ * The image is only at the same address as before when the objects
+ * are loaded in the same order, into memory laid out the same way:
+ * with +RTS -xm, or where MAP_32BIT gives deterministic addresses.
+ * The entries are in the native byte order and word size, so a cache
+ * directory shouldn't be shared between machines.  Nothing removes
+ * stale entries.
+ */
+
+#define LINKER_CACHE_MAGIC      "\211GHCLC\r\n"
+#define LINKER_CACHE_MAGIC_LEN  8
+#define LINKER_CACHE_VERSION    1
+
+static StgWord64
+hashImage (char *image, int size)
+{
+    StgWord64 h = 0xcbf29ce484222325ULL ^ (StgWord64)size;
+    StgWord64 w;
+    int i;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&w, image + i, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++) {
+        h = (h ^ (unsigned char)image[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static char *
+linkerCachePath (ObjectCode *oc)
+{
+    char *dir = RtsFlags.MiscFlags.linkerCache;
+    char *path;
+    size_t len;
+
+    len = strlen(dir) + 64;
+    path = stgMallocBytes(len, "linkerCachePath");
+    snprintf(path, len, "%s/%016" FMT_HexWord64 "-%" FMT_HexWord ".lc",
+             dir, oc->imageHash, (W_)oc->image);
+    return path;
+}
+
+typedef struct {
+    char *p, *end;
+} CacheReader;
+
+static int
+readCacheWord (CacheReader *r, StgWord *w)
+{
+    if ((size_t)(r->end - r->p) < sizeof(StgWord)) return 0;
+    memcpy(w, r->p, sizeof(StgWord));
+    r->p += sizeof(StgWord);
+    return 1;
+}
+
+static int
+expectCacheWord (CacheReader *r, StgWord expected)
+{
+    StgWord w;
+    return readCacheWord(r, &w) && w == expected;
+}
+
+static StgWord
+cachePadding (StgWord size)
+{
+    return (sizeof(StgWord) - size % sizeof(StgWord)) % sizeof(StgWord);
+}
+
+static char *
+symbolExtras (ObjectCode *oc, StgWord *size)
+{
+#if defined(powerpc_HOST_ARCH) || defined(x86_64_HOST_ARCH) || defined(arm_HOST_ARCH)
+    *size = oc->n_symbol_extras * sizeof(SymbolExtra);
+    return (char *)oc->symbol_extras;
+#else
+    *size = 0;
+    return NULL;
+#endif
+}
+
+/* Returns 1 if oc has been relocated from the cache */
+static int
+readLinkerCache_ELF (ObjectCode *oc)
+{
+   char*     ehdrC = (char*)(oc->image);
+   Elf_Ehdr* ehdr  = (Elf_Ehdr*) ehdrC;
+   Elf_Shdr* shdr  = (Elf_Shdr*) (ehdrC + ehdr->e_shoff);
+   Elf_Sym*  stab;
+   char      *path, *buf, *extras, *sections;
+   FILE      *f;
+   long      size;
+   CacheReader r;
+   StgWord   n, i, shndx, sym, value, len, extrasSize;
+   int       ok = 0;
+
+   path = linkerCachePath(oc);
+   f = fopen(path, "rb");
+   if (f == NULL) {
+      stgFree(path);
+      return 0;
+   }
+   buf = NULL;
+   if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0
+       || fseek(f, 0, SEEK_SET) != 0) {
+      goto out;
+   }
+   buf = stgMallocBytes(size + 1, "readLinkerCache_ELF");
+   if (fread(buf, 1, size, f) != (size_t)size) goto out;
+   r.p = buf;
+   r.end = buf + size;
+
+   extras = symbolExtras(oc, &extrasSize);
+
+   if (size < LINKER_CACHE_MAGIC_LEN
+       || memcmp(buf, LINKER_CACHE_MAGIC, LINKER_CACHE_MAGIC_LEN) != 0) {
+      goto out;
+   }
+   r.p += LINKER_CACHE_MAGIC_LEN;
+   if (!expectCacheWord(&r, LINKER_CACHE_VERSION)
+       || !expectCacheWord(&r, (StgWord)oc->imageHash)
+       || !expectCacheWord(&r, (StgWord)oc->image)
+       || !expectCacheWord(&r, (StgWord)oc->fileSize)
+       || !expectCacheWord(&r, (StgWord)extras)
+       || !expectCacheWord(&r, extrasSize)
+       || !expectCacheWord(&r, ehdr->e_shnum)) {
+      goto out;
+   }
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      if (!expectCacheWord(&r, shdr[i].sh_offset)) goto out;
+   }
+
+   if (!readCacheWord(&r, &n)) goto out;
+   for (i = 0; i < n; i++) {
+      if (!readCacheWord(&r, &shndx) || !readCacheWord(&r, &sym)
+          || !readCacheWord(&r, &value)
+          || shndx >= ehdr->e_shnum || shdr[shndx].sh_type != SHT_SYMTAB
+          || sym >= shdr[shndx].sh_size / sizeof(Elf_Sym)) {
+         goto out;
+      }
+      stab = (Elf_Sym*) (ehdrC + shdr[shndx].sh_offset);
+      if ((StgWord)lookupSymbol_(ehdrC + shdr[shdr[shndx].sh_link].sh_offset
+                                       + stab[sym].st_name) != value) {
+         IF_DEBUG(linker, debugBelch("readLinkerCache: %s has moved\n",
+                                     ehdrC + shdr[shdr[shndx].sh_link].sh_offset
+                                           + stab[sym].st_name));
+         goto out;
+      }
+   }
+
+   /* check all of the sections before we change any of them */
+   if (!readCacheWord(&r, &n)) goto out;
+   sections = r.p;
+   for (i = 0; i < n; i++) {
+      if (!readCacheWord(&r, &shndx) || !readCacheWord(&r, &len)
+          || shndx >= ehdr->e_shnum || len != shdr[shndx].sh_size
+          || (StgWord)(r.end - r.p) < len + cachePadding(len)) {
+         goto out;
+      }
+      r.p += len + cachePadding(len);
+   }
+   if ((StgWord)(r.end - r.p) != extrasSize) goto out;
+
+   r.p = sections;
+   for (i = 0; i < n; i++) {
+      // checked above, so this only fails if the buffer changed
+      if (!readCacheWord(&r, &shndx) || !readCacheWord(&r, &len)
+          || shndx >= ehdr->e_shnum || len != shdr[shndx].sh_size) {
+         goto out;
+      }
+      memcpy(ehdrC + shdr[shndx].sh_offset, r.p, len);
+      r.p += len + cachePadding(len);
+   }
+   if (extrasSize > 0) {
+      memcpy(extras, r.p, extrasSize);
+   }
+   ok = 1;
+
+out:
+   fclose(f);
+   if (buf != NULL) stgFree(buf);
+   stgFree(path);
+   return ok;
+}
+
+static void
+writeCacheWord (FILE *f, StgWord w)
+{
+    fwrite(&w, sizeof(StgWord), 1, f);
+}
+
+/* After oc has been relocated: write its entry of the cache */
+static void
+writeLinkerCache_ELF (ObjectCode *oc)
+{
+   char*     ehdrC = (char*)(oc->image);
+   Elf_Ehdr* ehdr  = (Elf_Ehdr*) ehdrC;
+   Elf_Shdr* shdr  = (Elf_Shdr*) (ehdrC + ehdr->e_shoff);
+   Elf_Sym*  stab;
+   char      **seen, *targets, *path, *tmp, *extras, *strtab;
+   int       shnum, i, fd, is_bss;
+   StgWord   j, nent, n, extrasSize, info;
+   FILE      *f;
+   static const char zeroes[sizeof(StgWord)] = { 0 };
+
+   /* the global symbols each symbol table has relocations against,
+      and the sections they relocate */
+   seen = stgCallocBytes(ehdr->e_shnum, sizeof(char *), "writeLinkerCache_ELF");
+   targets = stgCallocBytes(ehdr->e_shnum, 1, "writeLinkerCache_ELF");
+   for (shnum = 0; shnum < ehdr->e_shnum; shnum++) {
+      if (shdr[shnum].sh_type != SHT_REL && shdr[shnum].sh_type != SHT_RELA) {
+         continue;
+      }
+      if (getSectionKind_ELF(&shdr[shdr[shnum].sh_info], &is_bss)
+          == SECTIONKIND_OTHER) {
+         continue;
+      }
+      targets[shdr[shnum].sh_info] = 1;
+
+      i = shdr[shnum].sh_link;
+      stab = (Elf_Sym*) (ehdrC + shdr[i].sh_offset);
+      if (seen[i] == NULL) {
+         seen[i] = stgCallocBytes(shdr[i].sh_size / sizeof(Elf_Sym), 1,
+                                  "writeLinkerCache_ELF");
+      }
+      if (shdr[shnum].sh_type == SHT_REL) {
+         nent = shdr[shnum].sh_size / sizeof(Elf_Rel);
+      } else {
+         nent = shdr[shnum].sh_size / sizeof(Elf_Rela);
+      }
+      for (j = 0; j < nent; j++) {
+         if (shdr[shnum].sh_type == SHT_REL) {
+            info = ((Elf_Rel*) (ehdrC + shdr[shnum].sh_offset))[j].r_info;
+         } else {
+            info = ((Elf_Rela*) (ehdrC + shdr[shnum].sh_offset))[j].r_info;
+         }
+         if (ELF_R_SYM(info) != 0
+             && ELF_ST_BIND(stab[ELF_R_SYM(info)].st_info) != STB_LOCAL) {
+            seen[i][ELF_R_SYM(info)] = 1;
+         }
+      }
+   }
+
+   path = linkerCachePath(oc);
+   tmp = stgMallocBytes(strlen(path) + 8, "writeLinkerCache_ELF");
+   sprintf(tmp, "%s.XXXXXX", path);
+   fd = mkstemp(tmp);
+   f = fd < 0 ? NULL : fdopen(fd, "wb");
+   if (f == NULL) {
+      IF_DEBUG(linker, debugBelch("writeLinkerCache: can't create %s\n", tmp));
+      if (fd >= 0) {
+         close(fd);
+         unlink(tmp);
+      }
+      goto out;
+   }
+
+   extras = symbolExtras(oc, &extrasSize);
+
+   fwrite(LINKER_CACHE_MAGIC, 1, LINKER_CACHE_MAGIC_LEN, f);
+   writeCacheWord(f, LINKER_CACHE_VERSION);
+   writeCacheWord(f, (StgWord)oc->imageHash);
+   writeCacheWord(f, (StgWord)oc->image);
+   writeCacheWord(f, (StgWord)oc->fileSize);
+   writeCacheWord(f, (StgWord)extras);
+   writeCacheWord(f, extrasSize);
+   writeCacheWord(f, ehdr->e_shnum);
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      writeCacheWord(f, shdr[i].sh_offset);
+   }
+
+   n = 0;
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      if (seen[i] == NULL) continue;
+      for (j = 0; j < shdr[i].sh_size / sizeof(Elf_Sym); j++) {
+         n += seen[i][j];
+      }
+   }
+   writeCacheWord(f, n);
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      if (seen[i] == NULL) continue;
+      stab = (Elf_Sym*) (ehdrC + shdr[i].sh_offset);
+      strtab = ehdrC + shdr[shdr[i].sh_link].sh_offset;
+      for (j = 0; j < shdr[i].sh_size / sizeof(Elf_Sym); j++) {
+         if (!seen[i][j]) continue;
+         writeCacheWord(f, i);
+         writeCacheWord(f, j);
+         writeCacheWord(f, (StgWord)lookupSymbol_(strtab + stab[j].st_name));
+      }
+   }
+
+   n = 0;
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      n += targets[i];
+   }
+   writeCacheWord(f, n);
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      if (!targets[i]) continue;
+      writeCacheWord(f, i);
+      writeCacheWord(f, shdr[i].sh_size);
+      fwrite(ehdrC + shdr[i].sh_offset, 1, shdr[i].sh_size, f);
+      fwrite(zeroes, 1, cachePadding(shdr[i].sh_size), f);
+   }
+
+   if (extrasSize > 0) {
+      fwrite(extras, 1, extrasSize, f);
+   }
+
+   i = ferror(f);
+   if (fclose(f) != 0 || i || rename(tmp, path) != 0) {
+      IF_DEBUG(linker, debugBelch("writeLinkerCache: can't write %s\n", path));
+      unlink(tmp);
+   }
+
+out:
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      if (seen[i] != NULL) stgFree(seen[i]);
+   }
+   stgFree(seen);
+   stgFree(targets);
+   stgFree(tmp);
+   stgFree(path);
+}
+#endif /* USE_LINKER_CACHE */
+
 static int
 ocResolve_ELF ( ObjectCode* oc )
 {
@@ -6101,6 +8328,17 @@ ocResolve_ELF ( ObjectCode* oc )
    Elf_Ehdr* ehdr  = (Elf_Ehdr*) ehdrC;
    Elf_Shdr* shdr  = (Elf_Shdr*) (ehdrC + ehdr->e_shoff);
 
+#if defined(USE_LINKER_CACHE)
+   if (RtsFlags.MiscFlags.linkerCache != NULL && readLinkerCache_ELF(oc)) {
+      IF_DEBUG(linker, debugBelch("ocResolve_ELF: %s relocated from the cache\n",
+                                  OC_INFORMATIVE_FILENAME(oc)));
+#if defined(powerpc_HOST_ARCH) || defined(arm_HOST_ARCH)
+      ocFlushInstructionCache( oc );
+#endif
+      return 1;
+   }
+#endif
+
    /* Process the relocation sections. */
    for (shnum = 0; shnum < ehdr->e_shnum; shnum++) {
       if (shdr[shnum].sh_type == SHT_REL) {
@@ -6114,6 +8352,12 @@ ocResolve_ELF ( ObjectCode* oc )
       }
    }
 
+#if defined(USE_LINKER_CACHE)
+   if (RtsFlags.MiscFlags.linkerCache != NULL) {
+      writeLinkerCache_ELF(oc);
+   }
+#endif
+
 #if defined(powerpc_HOST_ARCH) || defined(arm_HOST_ARCH)
    ocFlushInstructionCache( oc );
 #endif
@@ -6121,6 +8365,41 @@ ocResolve_ELF ( ObjectCode* oc )
    return 1;
 }
 
+#if defined(USE_LAZY_ARCHIVES) && defined(THREADED_RTS)
+/* Look up the undefined symbols of oc that come from archive members
+   we haven't loaded yet, which loads them: see Note [Parallel
+   relocation].  Those we can't load are reported by ocResolve_ELF. */
+static void
+ocLoadLazyMembers_ELF ( ObjectCode* oc )
+{
+   char*     ehdrC = (char*)(oc->image);
+   Elf_Ehdr* ehdr  = (Elf_Ehdr*) ehdrC;
+   Elf_Shdr* shdr  = (Elf_Shdr*) (ehdrC + ehdr->e_shoff);
+   Elf_Sym*  stab;
+   char*     strtab;
+   char*     nm;
+   int       i, j, nent;
+
+   for (i = 0; i < ehdr->e_shnum; i++) {
+      if (shdr[i].sh_type != SHT_SYMTAB) continue;
+
+      stab = (Elf_Sym*) (ehdrC + shdr[i].sh_offset);
+      strtab = ehdrC + shdr[shdr[i].sh_link].sh_offset;
+      nent = shdr[i].sh_size / sizeof(Elf_Sym);
+
+      for (j = 1; j < nent; j++) {
+         if (stab[j].st_shndx != SHN_UNDEF
+             || ELF_ST_BIND(stab[j].st_info) == STB_LOCAL
+             || stab[j].st_name == 0) continue;
+         nm = strtab + stab[j].st_name;
+         if (lookupStrHashTable(symhash, nm) == NULL) {
+            lookupLazySymbol(nm);
+         }
+      }
+   }
+}
+#endif
+
 static int ocRunInit_ELF( ObjectCode *oc )
 {
    int   i;
@@ -7069,7 +9348,7 @@ ocGetNames_MachO(ObjectCode* oc)
         if((sections[i].flags & SECTION_TYPE) == S_ZEROFILL)
         {
 #ifdef USE_MMAP
-            char * zeroFillArea = mmapForLinker(sections[i].size, MAP_ANONYMOUS, -1);
+            char * zeroFillArea = mmapForLinker(sections[i].size, MAP_ANONYMOUS, -1, 0);
             if (zeroFillArea == NULL) return 0;
             memset(zeroFillArea, 0, sections[i].size);
 #else
@@ -32,6 +32,8 @@ typedef
       void* start; 
       void* end; 
       SectionKind kind;
+      StgWord m32_size;   /* if it was allocated by m32_alloc(), its
+                             size, for m32_free(); otherwise 0 */
       struct _Section* next;
    } 
    Section;
@@ -98,6 +100,19 @@ typedef struct _ObjectCode {
     /* ptr to malloc'd lump of memory holding the obj file */
     char*      image;
 
+    /* how far into its first page the image starts, when it is mapped
+       straight from an archive (see Note [Mapping archive members] in
+       Linker.c) */
+    int        imageOffset;
+
+    /* the image was read into memory from m32_alloc(), and is freed
+       with m32_free() (see Note [M32 Allocator] in Linker.c) */
+    int        imageM32;
+
+    /* hash of the image as it was read, for the linker cache (see
+       Note [Linker cache] in Linker.c) */
+    StgWord64  imageHash;
+
     /* flag used when deciding whether to unload an object file */
     int        referenced;
 
@@ -129,6 +144,8 @@ typedef struct _ObjectCode {
     SymbolExtra    *symbol_extras;
     unsigned long   first_symbol_extra;
     unsigned long   n_symbol_extras;
+    /* symbol_extras were allocated apart from the image */
+    int             symbol_extras_apart;
 #endif
 
     ForeignExportStablePtr *stable_ptrs;
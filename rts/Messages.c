@@ -21,30 +21,64 @@
 
 #ifdef THREADED_RTS
 
+/* The inbox is a lock-free multiple-producer, single-consumer stack:
+ * senders push with cas(), and the owner of the Capability takes the
+ * whole list at once with xchg() (see scheduleProcessInbox()).
+ *
+ * Only the sender that makes the inbox non-empty needs to wake up the
+ * receiving Capability.  Any later sender finds a message that has not
+ * been taken yet, so the receiver is already going to look at the
+ * inbox and will take our message along with the earlier one.  The
+ * wakeup still needs to_cap->lock, because it must not race with the
+ * Capability being released: releaseCapability_() checks the inbox
+ * with the lock held, so either it sees our message, or we see
+ * running_task == NULL and hand the Capability to a worker ourselves.
+ *
+ * sendMessages() pushes a whole chain of messages, linked from first
+ * to last through their link fields, with a single cas() and at most
+ * one wakeup.
+ */
 void sendMessage(Capability *from_cap, Capability *to_cap, Message *msg)
 {
-    ACQUIRE_LOCK(&to_cap->lock);
+    sendMessages(from_cap, to_cap, msg, msg);
+}
 
+void sendMessages(Capability *from_cap, Capability *to_cap,
+                  Message *first, Message *last)
+{
+    Message *msg, *old;
+
+    for (msg = first; ; msg = msg->link) {
 #ifdef DEBUG
-    {
         const StgInfoTable *i = msg->header.info;
         if (i != &stg_MSG_THROWTO_info &&
             i != &stg_MSG_BLACKHOLE_info &&
             i != &stg_MSG_TRY_WAKEUP_info &&
+            i != &stg_MSG_SET_PRIORITY_info &&
             i != &stg_IND_info && // can happen if a MSG_BLACKHOLE is revoked
             i != &stg_WHITEHOLE_info) {
             barf("sendMessage: %p", i);
         }
-    }
 #endif
+        recordClosureMutated(from_cap,(StgClosure*)msg);
+        if (msg == last) break;
+    }
 
-    msg->link = to_cap->inbox;
-    to_cap->inbox = msg;
+    do {
+        old = to_cap->inbox;
+        last->link = old;
+    } while (cas((StgVolatilePtr)&to_cap->inbox,
+                 (StgWord)old, (StgWord)first) != (StgWord)old);
 
-    recordClosureMutated(from_cap,(StgClosure*)msg);
+    if (old != (Message*)END_TSO_QUEUE) {
+        // someone else is responsible for waking up to_cap
+        return;
+    }
 
-    if (to_cap->running_task == NULL) {
-        to_cap->running_task = myTask();
+    ACQUIRE_LOCK(&to_cap->lock);
+
+    // we own from_cap, so this is myTask() without a TLS lookup
+    if (claimCapability(to_cap, from_cap->running_task)) {
             // precond for releaseCapability_()
         releaseCapability_(to_cap,rtsFalse);
     } else {
@@ -77,6 +111,13 @@ loop:
                       (W_)tso->id);
         tryWakeupThread(cap, tso);
     }
+    else if (i == &stg_MSG_SET_PRIORITY_info)
+    {
+        MessageSetPriority *p = (MessageSetPriority *)m;
+        debugTraceCap(DEBUG_sched, cap, "message: set priority of thread %ld",
+                      (W_)p->tso->id);
+        setThreadPriority(cap, p->tso, p->priority);
+    }
     else if (i == &stg_MSG_THROWTO_info)
     {
         MessageThrowTo *t = (MessageThrowTo *)m;
@@ -210,6 +251,7 @@ loop:
 #ifdef THREADED_RTS
         if (owner->cap != cap) {
             sendMessage(cap, owner->cap, (Message*)msg);
+            cap->bh_forwarded++;
             debugTraceCap(DEBUG_sched, cap, "forwarding message to cap %d",
                           owner->cap->no);
             return 1;
@@ -255,6 +297,7 @@ loop:
         ((StgInd*)bh)->indirectee = (StgClosure *)bq;
         recordClosureMutated(cap,bh); // bh was mutated
 
+        cap->bh_blocked++;
         debugTraceCap(DEBUG_sched, cap, "thread %d blocked on thread %d",
                       (W_)msg->tso->id, (W_)owner->id);
 
@@ -274,6 +317,7 @@ loop:
 #ifdef THREADED_RTS
         if (owner->cap != cap) {
             sendMessage(cap, owner->cap, (Message*)msg);
+            cap->bh_forwarded++;
             debugTraceCap(DEBUG_sched, cap, "forwarding message to cap %d",
                           owner->cap->no);
             return 1;
@@ -289,6 +333,7 @@ loop:
             recordClosureMutated(cap,(StgClosure*)bq);
         }
 
+        cap->bh_blocked++;
         debugTraceCap(DEBUG_sched, cap, "thread %d blocked on thread %d",
                       (W_)msg->tso->id, (W_)owner->id);
 
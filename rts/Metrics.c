@@ -0,0 +1,259 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Live statistics in a POSIX shared memory segment, for
+ * +RTS --metrics-shm=<name>
+ *
+ * A monitoring agent can map the segment and read the heap size, GC
+ * counts and pause times, and the state, run queue length and spark
+ * counters of each Capability, without the program's cooperation and
+ * without the cost of the eventlog.  The layout and the reading protocol
+ * are in includes/rts/Metrics.h.
+ *
+ * There is only ever one writer of each part of the segment: the global
+ * statistics are written by the thread leading a GC, at the end of the
+ * GC, and the entry of a Capability by the Task that holds it (during a
+ * GC, all of them are held by the leader).  So the writers need no
+ * locks, only the sequence numbers that let readers spot a torn copy.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "RtsUtils.h"
+#include "Capability.h"
+#include "Metrics.h"
+
+#if !defined(mingw32_HOST_OS)
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+RtsMetrics *rts_metrics = NULL;
+
+static char  *metrics_name = NULL;
+static size_t metrics_size = 0;
+
+// The reader is another process, so even the non-threaded RTS needs
+// real barriers here, not the write_barrier() of SMP.h.
+#define metricsBarrier() __sync_synchronize()
+
+static void
+beginWrite (volatile StgWord64 *seq)
+{
+    *seq = *seq + 1;
+    metricsBarrier();
+}
+
+static void
+endWrite (volatile StgWord64 *seq)
+{
+    metricsBarrier();
+    *seq = *seq + 1;
+}
+
+void
+initMetrics (void)
+{
+    char *name = RtsFlags.MiscFlags.metricsShm;
+    nat max_caps;
+    int fd;
+    void *p;
+
+    if (name == NULL) return;
+
+#if defined(THREADED_RTS)
+    max_caps = getNumberOfProcessors();
+    if (max_caps < RtsFlags.ParFlags.nNodes) {
+        max_caps = RtsFlags.ParFlags.nNodes;
+    }
+#else
+    max_caps = 1;
+#endif
+    metrics_size = sizeof(RtsMetrics) + max_caps * sizeof(RtsMetricsCap);
+
+    metrics_name = stgMallocBytes(strlen(name) + 2, "initMetrics");
+    if (name[0] == '/') {
+        strcpy(metrics_name, name);
+    } else {
+        metrics_name[0] = '/';
+        strcpy(metrics_name + 1, name);
+    }
+
+    fd = shm_open(metrics_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        sysErrorBelch("--metrics-shm: cannot create %s", metrics_name);
+        goto fail;
+    }
+    if (ftruncate(fd, metrics_size) != 0) {
+        sysErrorBelch("--metrics-shm: ftruncate");
+        close(fd);
+        shm_unlink(metrics_name);
+        goto fail;
+    }
+    p = mmap(NULL, metrics_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        sysErrorBelch("--metrics-shm: mmap");
+        shm_unlink(metrics_name);
+        goto fail;
+    }
+
+    // The statistics come from the same place as those of +RTS -s
+    if (RtsFlags.GcFlags.giveStats == NO_GC_STATS) {
+        RtsFlags.GcFlags.giveStats = COLLECT_GC_STATS;
+    }
+
+    // ftruncate() filled the segment with zeroes
+    rts_metrics = p;
+    rts_metrics->version  = RTS_METRICS_VERSION;
+    rts_metrics->size     = metrics_size;
+    rts_metrics->max_caps = max_caps;
+    rts_metrics->n_gens   = stg_min(RtsFlags.GcFlags.generations,
+                                    RTS_METRICS_MAX_GENS);
+    rts_metrics->pid      = getpid();
+    rts_metrics->n_caps   = stg_min(n_capabilities, max_caps);
+    metricsBarrier();
+    rts_metrics->magic    = RTS_METRICS_MAGIC;
+    return;
+
+fail:
+    // carry on without: the statistics are not worth failing for
+    stgFree(metrics_name);
+    metrics_name = NULL;
+}
+
+void
+exitMetrics (void)
+{
+    if (rts_metrics == NULL) return;
+
+    munmap(rts_metrics, metrics_size);
+    rts_metrics = NULL;
+    shm_unlink(metrics_name);
+    stgFree(metrics_name);
+    metrics_name = NULL;
+}
+
+void
+resetMetrics (void)
+{
+    if (rts_metrics == NULL) return;
+
+    // The segment belongs to the parent, which will remove it
+    munmap(rts_metrics, metrics_size);
+    rts_metrics = NULL;
+    stgFree(metrics_name);
+    metrics_name = NULL;
+}
+
+void
+metricsStartGC_ (void)
+{
+    nat i, n;
+    RtsMetricsCap *m;
+
+    rts_metrics->in_gc = 1;
+
+    n = stg_min(n_capabilities, rts_metrics->max_caps);
+    for (i = 0; i < n; i++) {
+        m = RTS_METRICS_CAP(rts_metrics, i);
+        beginWrite(&m->seq);
+        m->state = RTS_METRICS_CAP_GC;
+        endWrite(&m->seq);
+    }
+}
+
+void
+metricsSync_ (Time sync, nat last_cap, StgWord64 last_thread)
+{
+    StgWord64 ns = TimeToNS(sync);
+
+    beginWrite(&rts_metrics->seq);
+    rts_metrics->last_sync_ns = ns;
+    if (rts_metrics->max_sync_ns < ns) {
+        rts_metrics->max_sync_ns = ns;
+    }
+    rts_metrics->last_sync_thread = last_thread;
+    rts_metrics->last_sync_cap = last_cap;
+    endWrite(&rts_metrics->seq);
+}
+
+void
+metricsEndGC_ (nat gen, Time elapsed, Time gc_cpu, Time gc_elapsed,
+               W_ copied, W_ live, W_ max_live, W_ tot_alloc)
+{
+    nat i, g, n;
+    Capability *cap;
+    RtsMetricsCap *m;
+    StgWord64 pause;
+
+    beginWrite(&rts_metrics->seq);
+
+    pause = TimeToNS(gc_elapsed);
+    rts_metrics->elapsed_ns      = TimeToNS(elapsed);
+    rts_metrics->heap_size_bytes = (StgWord64)mblocks_allocated * MBLOCK_SIZE;
+    rts_metrics->live_bytes      = (StgWord64)live * sizeof(W_);
+    rts_metrics->max_live_bytes  = (StgWord64)max_live * sizeof(W_);
+    rts_metrics->allocated_bytes = (StgWord64)tot_alloc * sizeof(W_);
+    rts_metrics->copied_bytes   += (StgWord64)copied * sizeof(W_);
+    rts_metrics->gcs++;
+    if (gen == RtsFlags.GcFlags.generations - 1) {
+        rts_metrics->major_gcs++;
+    }
+    rts_metrics->gc_cpu_ns      += TimeToNS(gc_cpu);
+    rts_metrics->gc_elapsed_ns  += pause;
+    rts_metrics->last_pause_ns   = pause;
+    if (rts_metrics->max_pause_ns < pause) {
+        rts_metrics->max_pause_ns = pause;
+    }
+    for (g = 0; g < rts_metrics->n_gens; g++) {
+        rts_metrics->gen_collections[g] = generations[g].collections;
+    }
+
+    endWrite(&rts_metrics->seq);
+
+    n = stg_min(n_capabilities, rts_metrics->max_caps);
+    for (i = 0; i < n; i++) {
+        cap = capabilities[i];
+        m = RTS_METRICS_CAP(rts_metrics, i);
+        beginWrite(&m->seq);
+        m->state = cap->disabled ? RTS_METRICS_CAP_DISABLED
+                                 : RTS_METRICS_CAP_SCHEDULER;
+        m->run_queue_len = cap->n_run_queue;
+        m->allocated_bytes = (StgWord64)cap->total_allocated * sizeof(W_);
+#if defined(THREADED_RTS)
+        m->sparks_created    = cap->spark_stats.created;
+        m->sparks_dud        = cap->spark_stats.dud;
+        m->sparks_overflowed = cap->spark_stats.overflowed;
+        m->sparks_converted  = cap->spark_stats.converted;
+        m->sparks_gcd        = cap->spark_stats.gcd;
+        m->sparks_fizzled    = cap->spark_stats.fizzled;
+#endif
+        endWrite(&m->seq);
+    }
+    rts_metrics->n_caps = n;
+    rts_metrics->in_gc = 0;
+}
+
+void
+metricsCapState_ (Capability *cap, StgWord32 state)
+{
+    RtsMetricsCap *m;
+
+    if (cap->no >= rts_metrics->max_caps) return;
+
+    m = RTS_METRICS_CAP(rts_metrics, cap->no);
+    beginWrite(&m->seq);
+    m->state = state;
+    m->run_queue_len = cap->n_run_queue;
+    endWrite(&m->seq);
+}
+
+#endif /* !mingw32_HOST_OS */
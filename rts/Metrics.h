@@ -0,0 +1,83 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Live statistics in shared memory, for +RTS --metrics-shm.  The layout
+ * of the segment is in includes/rts/Metrics.h.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "rts/Metrics.h"
+#include "Capability.h"
+
+#include "BeginPrivate.h"
+
+#if !defined(mingw32_HOST_OS)
+
+// NULL unless --metrics-shm was given and the segment was created
+extern RtsMetrics *rts_metrics;
+
+// Create the segment; after initStorage()
+void initMetrics (void);
+// Remove the segment
+void exitMetrics (void);
+// In the child of a fork(): stop writing to the parent's segment
+void resetMetrics (void);
+
+void metricsStartGC_ (void);
+void metricsEndGC_   (nat gen, Time elapsed, Time gc_cpu, Time gc_elapsed,
+                      W_ copied, W_ live, W_ max_live, W_ tot_alloc);
+void metricsCapState_ (Capability *cap, StgWord32 state);
+void metricsSync_    (Time sync, nat last_cap, StgWord64 last_thread);
+
+INLINE_HEADER void metricsStartGC (void)
+{
+    if (RTS_UNLIKELY(rts_metrics != NULL)) {
+        metricsStartGC_();
+    }
+}
+
+INLINE_HEADER void metricsEndGC (nat gen, Time elapsed,
+                                 Time gc_cpu, Time gc_elapsed, W_ copied,
+                                 W_ live, W_ max_live, W_ tot_alloc)
+{
+    if (RTS_UNLIKELY(rts_metrics != NULL)) {
+        metricsEndGC_(gen, elapsed, gc_cpu, gc_elapsed,
+                      copied, live, max_live, tot_alloc);
+    }
+}
+
+INLINE_HEADER void metricsCapState (Capability *cap, StgWord32 state)
+{
+    if (RTS_UNLIKELY(rts_metrics != NULL)) {
+        metricsCapState_(cap, state);
+    }
+}
+
+INLINE_HEADER void metricsSync (Time sync, nat last_cap,
+                                StgWord64 last_thread)
+{
+    if (RTS_UNLIKELY(rts_metrics != NULL)) {
+        metricsSync_(sync, last_cap, last_thread);
+    }
+}
+
+#else
+
+#define initMetrics()                             /* nothing */
+#define exitMetrics()                             /* nothing */
+#define resetMetrics()                            /* nothing */
+#define metricsStartGC()                          /* nothing */
+#define metricsEndGC(gen, elapsed, gc_cpu, gc_elapsed, \
+                     copied, live, max_live, tot_alloc) /* nothing */
+#define metricsCapState(cap, state)               /* nothing */
+#define metricsSync(sync, last_cap, last_thread)  /* nothing */
+
+#endif
+
+#include "EndPrivate.h"
+
+#endif /* METRICS_H */
@@ -0,0 +1,324 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Hardware performance counters, for +RTS --perf-counters (Linux only).
+ *
+ * Unlike Papi.c this needs no library: each OS thread that runs a Task
+ * opens a group of counters for itself with perf_event_open(), counting
+ * CPU cycles, instructions retired, last-level cache misses and data TLB
+ * misses in user space.  At the start and end of each GC, and around
+ * each phase of the GC (see stat_startGCPhase()), the thread reads its
+ * counters and charges what they have counted since its last reading to
+ * the Capability it holds, either to the mutator or to the GC.  The
+ * thread leading the GC also charges them to the phase, so the phase
+ * figures are for that thread only, while the GC figures of each
+ * Capability include the parallel GC threads.  What a thread counts
+ * while it holds no Capability (in a safe foreign call, say) goes to
+ * the mutator of the next Capability it holds.
+ *
+ * The totals are printed by +RTS -s, and at the end of each GC they are
+ * posted to the eventlog (EVENT_HW_COUNTERS) when GC events are on.
+ *
+ * A counter that the CPU doesn't have, or that perf_event_paranoid
+ * forbids, is left out and reported as "-".
+ *
+ * ---------------------------------------------------------------------------*/
+
+#if defined(__linux__)
+/* for syscall() */
+#define _GNU_SOURCE
+#endif
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "RtsUtils.h"
+#include "Capability.h"
+#include "Task.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+
+#if defined(linux_HOST_OS)
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef PERF_FLAG_FD_CLOEXEC
+#define PERF_FLAG_FD_CLOEXEC 0
+#endif
+
+static const struct {
+    StgWord32 type;
+    StgWord64 config;
+} perf_events[PERF_N_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+                          | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+static rtsBool perf_enabled = rtsFalse;
+static rtsBool perf_have[PERF_N_COUNTERS];
+
+typedef struct {
+    StgWord64 mut[PERF_N_COUNTERS];
+    StgWord64 gc[PERF_N_COUNTERS];
+} CapPerfCounts;
+
+static CapPerfCounts *cap_counts = NULL;     // indexed by cap->no
+static nat n_cap_counts = 0;
+static StgWord64 phase_counts[N_GC_PHASES][PERF_N_COUNTERS];
+
+static int
+openCounter (nat i, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = perf_events[i].type;
+    attr.config         = perf_events[i].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_GROUP;
+
+    return syscall(__NR_perf_event_open, &attr, 0 /* this thread */,
+                   -1 /* any CPU */, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Read the counters of the calling thread, which runs task; the ones we
+// don't have are 0.
+static rtsBool
+readCounters (Task *task, StgWord64 *counts)
+{
+    StgWord64 buf[1 + PERF_N_COUNTERS];   // the number of counters first
+    nat i, n;
+
+    if (task->perf_fds[0] < 0 ||
+        read(task->perf_fds[0], buf, sizeof(buf)) < (ssize_t)sizeof(buf[0])) {
+        return rtsFalse;
+    }
+    n = 1;
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+        if (perf_have[i] && n <= buf[0]) {
+            counts[i] = buf[n++];
+        } else {
+            counts[i] = 0;
+        }
+    }
+    return rtsTrue;
+}
+
+void
+initPerfCounters (void)
+{
+    nat i;
+    int fd, err = 0;
+
+    if (!RtsFlags.MiscFlags.perfCounters) return;
+
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+        fd = openCounter(i, -1);
+        if (fd >= 0) {
+            close(fd);
+            perf_have[i] = rtsTrue;
+            perf_enabled = rtsTrue;
+        } else {
+            perf_have[i] = rtsFalse;
+            err = errno;
+        }
+    }
+
+    if (!perf_enabled) {
+        errorBelch("--perf-counters: perf_event_open: %s "
+                   "(see /proc/sys/kernel/perf_event_paranoid)",
+                   strerror(err));
+        return;
+    }
+
+    memset(phase_counts, 0, sizeof(phase_counts));
+#if defined(THREADED_RTS)
+    perfCountersAddCapabilities(RtsFlags.ParFlags.nNodes);
+#else
+    perfCountersAddCapabilities(1);
+#endif
+}
+
+void
+exitPerfCounters (void)
+{
+    if (cap_counts != NULL) {
+        stgFree(cap_counts);
+        cap_counts = NULL;
+        n_cap_counts = 0;
+    }
+    perf_enabled = rtsFalse;
+}
+
+void
+perfCountersAddCapabilities (nat n)
+{
+    if (!perf_enabled || n <= n_cap_counts) return;
+
+    cap_counts = stgReallocBytes(cap_counts, n * sizeof(CapPerfCounts),
+                                 "perfCountersAddCapabilities");
+    memset(&cap_counts[n_cap_counts], 0,
+           (n - n_cap_counts) * sizeof(CapPerfCounts));
+    n_cap_counts = n;
+}
+
+void
+perfCountersStartTask (Task *task)
+{
+    nat i, n;
+    int fd;
+
+    perfCountersFreeTask(task);
+    if (!perf_enabled) return;
+
+    n = 0;
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+        if (!perf_have[i]) continue;
+        fd = openCounter(i, n == 0 ? -1 : task->perf_fds[0]);
+        if (fd < 0) {
+            // e.g. the thread can't have the whole group at once; count
+            // nothing rather than count some of them some of the time
+            perfCountersFreeTask(task);
+            return;
+        }
+        task->perf_fds[n++] = fd;
+    }
+
+    if (!readCounters(task, task->perf_last)) {
+        perfCountersFreeTask(task);
+    }
+}
+
+void
+perfCountersFreeTask (Task *task)
+{
+    nat i;
+
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+        if (task->perf_fds[i] >= 0) {
+            close(task->perf_fds[i]);
+            task->perf_fds[i] = -1;
+        }
+    }
+}
+
+void
+perfCountersCharge (rtsBool gc, int phase)
+{
+    Task *task;
+    CapPerfCounts *c;
+    StgWord64 now[PERF_N_COUNTERS], d;
+    nat i;
+
+    if (!perf_enabled) return;
+
+    task = myTask();
+    if (task == NULL || task->cap == NULL ||
+        task->cap->no >= n_cap_counts || !readCounters(task, now)) {
+        return;
+    }
+
+    c = &cap_counts[task->cap->no];
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+        d = now[i] - task->perf_last[i];
+        task->perf_last[i] = now[i];
+        if (gc) {
+            c->gc[i] += d;
+        } else {
+            c->mut[i] += d;
+        }
+        if (phase >= 0) {
+            phase_counts[phase][i] += d;
+        }
+    }
+}
+
+void
+perfCountersTrace (Capability *cap)
+{
+    nat i, p;
+
+    if (!perf_enabled) return;
+
+    for (i = 0; i < n_capabilities && i < n_cap_counts; i++) {
+        traceEventHwCounters(cap, i, HW_COUNTERS_MUTATOR, cap_counts[i].mut);
+        traceEventHwCounters(cap, i, HW_COUNTERS_GC, cap_counts[i].gc);
+    }
+    for (p = 0; p < N_GC_PHASES; p++) {
+        traceEventHwCounters(cap, cap->no, HW_COUNTERS_GC_PHASE + p,
+                             phase_counts[p]);
+    }
+}
+
+static void
+printCounts (const char *what, StgWord64 *counts)
+{
+    nat i;
+
+    statsPrintf("  %-14s", what);
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+        if (perf_have[i]) {
+            statsPrintf(" %15" FMT_Word64, counts[i]);
+        } else {
+            statsPrintf(" %15s", "-");
+        }
+        if (i == 1) {
+            // instructions per cycle
+            if (perf_have[0] && perf_have[1] && counts[0] > 0) {
+                statsPrintf(" %5.2f", (double)counts[1] / (double)counts[0]);
+            } else {
+                statsPrintf(" %5s", "-");
+            }
+        }
+    }
+    statsPrintf("\n");
+}
+
+void
+perfCountersReport (const char **phase_names)
+{
+    StgWord64 mut[PERF_N_COUNTERS], gc[PERF_N_COUNTERS];
+    char what[32];
+    nat i, n, p;
+
+    if (!perf_enabled) return;
+
+    statsPrintf("\n  %-14s %15s %15s %5s %15s %15s\n", "HW counters",
+                "Cycles", "Instructions", "IPC", "LLC misses", "dTLB misses");
+
+    memset(mut, 0, sizeof(mut));
+    memset(gc, 0, sizeof(gc));
+    n = stg_min(n_capabilities, n_cap_counts);
+    for (i = 0; i < n; i++) {
+        for (p = 0; p < PERF_N_COUNTERS; p++) {
+            mut[p] += cap_counts[i].mut[p];
+            gc[p]  += cap_counts[i].gc[p];
+        }
+        if (n > 1) {
+            sprintf(what, "Cap %u MUT", i);
+            printCounts(what, cap_counts[i].mut);
+            sprintf(what, "Cap %u GC", i);
+            printCounts(what, cap_counts[i].gc);
+        }
+    }
+    printCounts("MUT", mut);
+    printCounts("GC", gc);
+    for (p = 0; p < N_GC_PHASES; p++) {
+        sprintf(what, "  %s", phase_names[p]);
+        printCounts(what, phase_counts[p]);
+    }
+}
+
+#endif /* linux_HOST_OS */
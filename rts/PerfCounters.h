@@ -0,0 +1,58 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Hardware performance counters on Linux, using perf_event_open(), for
+ * +RTS --perf-counters
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include "BeginPrivate.h"
+
+// CPU cycles, instructions, last-level cache misses, data TLB misses;
+// in this order in the report and in EVENT_HW_COUNTERS
+#define PERF_N_COUNTERS 4
+
+#if defined(linux_HOST_OS)
+
+struct Task_;
+
+void initPerfCounters (void);
+void exitPerfCounters (void);
+
+// Make room for the counts of capabilities up to n
+void perfCountersAddCapabilities (nat n);
+
+// Open counters for the calling OS thread, which runs task (and close
+// any it had before, after a fork())
+void perfCountersStartTask (struct Task_ *task);
+void perfCountersFreeTask  (struct Task_ *task);
+
+// Charge what the calling OS thread has counted since it last called
+// this to the mutator or the GC of the Capability it holds, and to GC
+// phase phase unless it is -1.
+void perfCountersCharge (rtsBool gc, int phase);
+
+// For +RTS -s, and the eventlog at the end of each GC
+void perfCountersReport (const char **phase_names);
+void perfCountersTrace  (Capability *cap);
+
+#else
+
+#define initPerfCounters()                 /* nothing */
+#define exitPerfCounters()                 /* nothing */
+#define perfCountersAddCapabilities(n)     /* nothing */
+#define perfCountersStartTask(task)        /* nothing */
+#define perfCountersFreeTask(task)         /* nothing */
+#define perfCountersCharge(gc, phase)      /* nothing */
+#define perfCountersReport(phase_names)    /* nothing */
+#define perfCountersTrace(cap)             /* nothing */
+
+#endif
+
+#include "EndPrivate.h"
+
+#endif /* PERFCOUNTERS_H */
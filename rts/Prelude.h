@@ -26,6 +26,7 @@
 
 PRELUDE_CLOSURE(ghczmprim_GHCziTypes_True_closure);
 PRELUDE_CLOSURE(ghczmprim_GHCziTypes_False_closure);
+PRELUDE_CLOSURE(ghczmprim_GHCziTypes_ZMZN_closure);
 PRELUDE_CLOSURE(base_GHCziPack_unpackCString_closure);
 PRELUDE_CLOSURE(base_GHCziWeak_runFinalizzerBatch_closure);
 
@@ -38,6 +39,7 @@ extern StgClosure ZCMain_main_closure;
 PRELUDE_CLOSURE(base_GHCziIOziException_stackOverflow_closure);
 PRELUDE_CLOSURE(base_GHCziIOziException_heapOverflow_closure);
 PRELUDE_CLOSURE(base_GHCziIOziException_allocationLimitExceeded_closure);
+PRELUDE_CLOSURE(base_GHCziIOziException_residencyQuotaExceeded_closure);
 PRELUDE_CLOSURE(base_GHCziIOziException_blockedIndefinitelyOnThrowTo_closure);
 PRELUDE_CLOSURE(base_GHCziIOziException_blockedIndefinitelyOnMVar_closure);
 PRELUDE_CLOSURE(base_GHCziIOziException_blockedIndefinitelyOnSTM_closure);
@@ -48,7 +50,7 @@ PRELUDE_CLOSURE(base_GHCziEventziThread_blockedOnBadFD_closure);
 PRELUDE_CLOSURE(base_GHCziConcziSync_runSparks_closure);
 PRELUDE_CLOSURE(base_GHCziConcziIO_ensureIOManagerIsRunning_closure);
 PRELUDE_CLOSURE(base_GHCziConcziIO_ioManagerCapabilitiesChanged_closure);
-PRELUDE_CLOSURE(base_GHCziConcziSignal_runHandlersPtr_closure);
+PRELUDE_CLOSURE(base_GHCziConcziSignal_runHandlersBatchPtr_closure);
 
 PRELUDE_CLOSURE(base_GHCziTopHandler_flushStdHandles_closure);
 
@@ -76,6 +78,7 @@ PRELUDE_INFO(base_GHCziPtr_Ptr_con_info);
 PRELUDE_INFO(base_GHCziPtr_FunPtr_con_info);
 PRELUDE_INFO(base_Addr_Azh_con_info);
 PRELUDE_INFO(ghczmprim_GHCziTypes_Wzh_con_info);
+PRELUDE_INFO(ghczmprim_GHCziTypes_ZC_con_info);
 PRELUDE_INFO(base_GHCziInt_I8zh_con_info);
 PRELUDE_INFO(base_GHCziInt_I16zh_con_info);
 PRELUDE_INFO(base_GHCziInt_I32zh_con_info);
@@ -89,6 +92,7 @@ PRELUDE_INFO(base_GHCziStable_StablePtr_con_info);
 
 #define True_closure              DLL_IMPORT_DATA_REF(ghczmprim_GHCziTypes_True_closure)
 #define False_closure             DLL_IMPORT_DATA_REF(ghczmprim_GHCziTypes_False_closure)
+#define Nil_closure               DLL_IMPORT_DATA_REF(ghczmprim_GHCziTypes_ZMZN_closure)
 #define unpackCString_closure     DLL_IMPORT_DATA_REF(base_GHCziPack_unpackCString_closure)
 #define runFinalizerBatch_closure DLL_IMPORT_DATA_REF(base_GHCziWeak_runFinalizzerBatch_closure)
 #define mainIO_closure            (&ZCMain_main_closure)
@@ -96,13 +100,14 @@ PRELUDE_INFO(base_GHCziStable_StablePtr_con_info);
 #define runSparks_closure         DLL_IMPORT_DATA_REF(base_GHCziConcziSync_runSparks_closure)
 #define ensureIOManagerIsRunning_closure DLL_IMPORT_DATA_REF(base_GHCziConcziIO_ensureIOManagerIsRunning_closure)
 #define ioManagerCapabilitiesChanged_closure DLL_IMPORT_DATA_REF(base_GHCziConcziIO_ioManagerCapabilitiesChanged_closure)
-#define runHandlersPtr_closure       DLL_IMPORT_DATA_REF(base_GHCziConcziSignal_runHandlersPtr_closure)
+#define runHandlersBatchPtr_closure  DLL_IMPORT_DATA_REF(base_GHCziConcziSignal_runHandlersBatchPtr_closure)
 
 #define flushStdHandles_closure   DLL_IMPORT_DATA_REF(base_GHCziTopHandler_flushStdHandles_closure)
 
 #define stackOverflow_closure     DLL_IMPORT_DATA_REF(base_GHCziIOziException_stackOverflow_closure)
 #define heapOverflow_closure      DLL_IMPORT_DATA_REF(base_GHCziIOziException_heapOverflow_closure)
 #define allocationLimitExceeded_closure DLL_IMPORT_DATA_REF(base_GHCziIOziException_allocationLimitExceeded_closure)
+#define residencyQuotaExceeded_closure DLL_IMPORT_DATA_REF(base_GHCziIOziException_residencyQuotaExceeded_closure)
 #define blockedIndefinitelyOnMVar_closure DLL_IMPORT_DATA_REF(base_GHCziIOziException_blockedIndefinitelyOnMVar_closure)
 #define blockedIndefinitelyOnSTM_closure DLL_IMPORT_DATA_REF(base_GHCziIOziException_blockedIndefinitelyOnSTM_closure)
 #define nonTermination_closure    DLL_IMPORT_DATA_REF(base_ControlziExceptionziBase_nonTermination_closure)
@@ -131,6 +136,7 @@ PRELUDE_INFO(base_GHCziStable_StablePtr_con_info);
 #define Dzh_con_info              DLL_IMPORT_DATA_REF(ghczmprim_GHCziTypes_Dzh_con_info)
 #define Azh_con_info              DLL_IMPORT_DATA_REF(base_Addr_Azh_con_info)
 #define Wzh_con_info              DLL_IMPORT_DATA_REF(ghczmprim_GHCziTypes_Wzh_con_info)
+#define ZC_con_info               DLL_IMPORT_DATA_REF(ghczmprim_GHCziTypes_ZC_con_info)
 #define W8zh_con_info             DLL_IMPORT_DATA_REF(base_GHCziWord_W8zh_con_info)
 #define W16zh_con_info            DLL_IMPORT_DATA_REF(base_GHCziWord_W16zh_con_info)
 #define W32zh_con_info            DLL_IMPORT_DATA_REF(base_GHCziWord_W32zh_con_info)
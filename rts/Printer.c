@@ -348,7 +348,7 @@ printClosure( StgClosure *obj )
     case TVAR:
         {
           StgTVar* tv = (StgTVar*)obj;
-          debugBelch("TVAR(value=%p, wq=%p, num_updates=%" FMT_Word ")\n", tv->current_value, tv->first_watch_queue_entry, tv->num_updates);
+          debugBelch("TVAR(value=%p, wq=%p, version=%" FMT_Word ", wakeup_limit=%" FMT_Word ")\n", tv->current_value, tv->first_watch_queue_entry, tv->version, tv->wakeup_limit);
           break;
         }
 
@@ -19,6 +19,11 @@
 #include "Arena.h"
 #include "Printer.h"
 #include "sm/GCThread.h"
+#include "sm/GC.h"
+#include "Capability.h"
+#include "Task.h"
+#include "Trace.h"
+#include "rts/prof/HeapProfileFormat.h"
 
 #include <string.h>
 
@@ -88,6 +93,16 @@ typedef struct {
 static Census *censuses = NULL;
 static nat n_censuses = 0;
 
+// For sharing out a census among the GC threads, see heapCensus()
+static bdescr **census_chains = NULL;
+static nat n_census_chains, census_chain;
+static bdescr *census_next;
+static nat census_leader;
+static Census *thread_censuses = NULL;  // indexed by GC thread
+#if defined(THREADED_RTS)
+static SpinLock census_lock;
+#endif
+
 #ifdef PROFILING
 static void aggregateCensusInfo( void );
 #endif
@@ -178,6 +193,15 @@ doingRetainerProfiling( void )
 // when a thunk is replaced by an indirection object.
 
 #ifdef PROFILING
+// With --ldv-sample-eras=<n>, -hb only follows the closures created in
+// one in n eras, and dumpCensus() scales up what it finds.
+STATIC_INLINE rtsBool
+ldvSampled( StgClosure *c )
+{
+    return ((((LDVW(c) & LDV_CREATE_MASK) >> LDV_SHIFT) - 1)
+            % RtsFlags.ProfFlags.ldvSampleEras) == 0;
+}
+
 void
 LDV_recordDead( StgClosure *c, nat size )
 {
@@ -185,7 +209,7 @@ LDV_recordDead( StgClosure *c, nat size )
     nat t;
     counter *ctr;
 
-    if (era > 0 && closureSatisfiesConstraints(c)) {
+    if (era > 0 && ldvSampled(c) && closureSatisfiesConstraints(c)) {
         size -= sizeofW(StgProfHeader);
         ASSERT(LDVW(c) != 0);
         if ((LDVW((c)) & LDV_STATE_MASK) == LDV_STATE_CREATE) {
@@ -239,6 +263,82 @@ LDV_recordDead( StgClosure *c, nat size )
         }
     }
 }
+
+/* --------------------------------------------------------------------------
+ * Recording deaths in bulk
+ *
+ * Unless a census is restricted by biography, a death only moves size
+ * words of void or drag from censuses[era] back to the census of the
+ * era in which the closure was created or last used.  So rather than
+ * updating two counters spread across censuses[] for each dead closure
+ * as LDV_recordDead() does, LdvCensusForDead() adds the deaths up per
+ * era in an LdvDeaths with LDV_countDead(), which is private to the GC
+ * thread doing it, and LDV_addDeaths() passes the totals on to
+ * censuses[] at the end.
+ * ----------------------------------------------------------------------- */
+
+void
+LDV_initDeaths( LdvDeaths *d )
+{
+    if (d->size <= era) {
+        d->size = era + 1;
+        d->void_new = stgReallocBytes(d->void_new, d->size * sizeof(long),
+                                      "LDV_initDeaths");
+        d->drag_new = stgReallocBytes(d->drag_new, d->size * sizeof(long),
+                                      "LDV_initDeaths");
+    }
+    memset(d->void_new, 0, (era + 1) * sizeof(long));
+    memset(d->drag_new, 0, (era + 1) * sizeof(long));
+}
+
+void
+LDV_countDead( LdvDeaths *d, StgClosure *c, nat size )
+{
+    nat t;
+
+    ASSERT(RtsFlags.ProfFlags.bioSelector == NULL);
+
+    if (ldvSampled(c) && closureSatisfiesConstraints(c)) {
+        size -= sizeofW(StgProfHeader);
+        ASSERT(LDVW(c) != 0);
+        if ((LDVW((c)) & LDV_STATE_MASK) == LDV_STATE_CREATE) {
+            t = (LDVW((c)) & LDV_CREATE_MASK) >> LDV_SHIFT;
+            if (t < era) {
+                d->void_new[t] += (long)size;
+            }
+        } else {
+            t = LDVW((c)) & LDV_LAST_MASK;
+            if (t + 1 < era) {
+                d->drag_new[t+1] += (long)size;
+            }
+        }
+    }
+}
+
+void
+LDV_addDeaths( LdvDeaths *d )
+{
+    nat t;
+
+    for (t = 1; t < era; t++) {
+        censuses[t].void_total   += d->void_new[t];
+        censuses[era].void_total -= d->void_new[t];
+        censuses[t].drag_total   += d->drag_new[t];
+        censuses[era].drag_total -= d->drag_new[t];
+        ASSERT(d->void_new[t] == 0
+               || censuses[t].void_total < censuses[t].not_used);
+    }
+}
+
+void
+LDV_freeDeaths( LdvDeaths *d )
+{
+    stgFree(d->void_new);
+    stgFree(d->drag_new);
+    d->void_new = NULL;
+    d->drag_new = NULL;
+    d->size = 0;
+}
 #endif
 
 /* --------------------------------------------------------------------------
@@ -327,13 +427,15 @@ void initProfiling2 (void)
     }
 #endif
 
-  if (RtsFlags.ProfFlags.doHeapProfile) {
+  if (RtsFlags.ProfFlags.doHeapProfile &&
+      !RtsFlags.ProfFlags.eventlogHeapProfile) {
     /* Initialise the log file name */
     hp_filename = stgMallocBytes(strlen(prog) + 6, "hpFileName");
     sprintf(hp_filename, "%s.hp", prog);
 
     /* open the log file */
-    if ((hp_file = fopen(hp_filename, "w")) == NULL) {
+    if ((hp_file = fopen(hp_filename,
+                         RtsFlags.ProfFlags.binaryHeapProfile ? "wb" : "w")) == NULL) {
       debugBelch("Can't open profiling report file %s\n",
               hp_filename);
       RtsFlags.ProfFlags.doHeapProfile = 0;
@@ -353,17 +455,223 @@ void endProfiling( void )
 }
 #endif /* !PROFILING */
 
+/* -----------------------------------------------------------------------------
+ * Writing the .hp file
+ *
+ * With --binary-heap-profile the file is in the format described in
+ * includes/rts/prof/HeapProfileFormat.h.  Each band is given an id the
+ * first time it appears, found by its name in hp_ids, and each sample
+ * only has the bands whose value is not the same as in the previous one.
+ *
+ * With --eventlog-heap-profile there is no .hp file: the bands are
+ * numbered in the same way, but go in the eventlog (see
+ * traceHeapProfBegin() and friends), and each sample has the value of
+ * every band that is not empty.
+ * -------------------------------------------------------------------------- */
+
+static HashTable *hp_ids   = NULL;  // band name -> id + 1
+static Arena     *hp_names = NULL;  // the names in hp_ids
+static nat        hp_n_ids, hp_max_ids;
+static W_        *hp_last;          // hp_last[id]: value in the last sample
+static W_        *hp_now;           // hp_now[id]: value in this sample
+static StgWord64  hp_time;          // of the last sample, in microseconds
+static nat        hp_n_samples;     // --eventlog-heap-profile only
+
+#define HP_BANDS_BY_ID (RtsFlags.ProfFlags.binaryHeapProfile || \
+                        RtsFlags.ProfFlags.eventlogHeapProfile)
+
+#if defined(TRACING)
+// The Capability whose event buffer the heap profile goes in: the one
+// leading the GC during a census, and our own at startup and exit
+static Capability *
+hpEventCap (void)
+{
+    Task *task = myTask();
+
+    if (task != NULL && task->cap != NULL) {
+        return task->cap;
+    }
+    return capabilities[0];
+}
+#endif
+
+static void
+hpPutVarint (StgWord64 n)
+{
+    while (n >= 0x80) {
+        fputc((int)(n & 0x7f) | 0x80, hp_file);
+        n >>= 7;
+    }
+    fputc((int)n, hp_file);
+}
+
+static void
+hpPutSVarint (StgInt64 n)
+{
+    hpPutVarint(n >= 0 ? (StgWord64)n << 1 : ~((StgWord64)n << 1));
+}
+
+static void
+hpPutString (const char *s)
+{
+    size_t len = strlen(s);
+
+    hpPutVarint(len);
+    fwrite(s, 1, len, hp_file);
+}
+
+static nat
+hpBandId (const char *name)
+{
+    StgWord id;
+    char *copy;
+
+    id = (StgWord)lookupStrHashTable(hp_ids, name);
+    if (id != 0) {
+        return id - 1;
+    }
+
+    if (hp_n_ids == hp_max_ids) {
+        hp_max_ids = hp_max_ids == 0 ? 64 : hp_max_ids * 2;
+        hp_last = stgReallocBytes(hp_last, hp_max_ids * sizeof(W_),
+                                  "hpBandId");
+        hp_now  = stgReallocBytes(hp_now,  hp_max_ids * sizeof(W_),
+                                  "hpBandId");
+    }
+    id = hp_n_ids++;
+    hp_last[id] = 0;
+    hp_now[id]  = 0;
+
+    copy = arenaAlloc(hp_names, strlen(name) + 1);
+    strcpy(copy, name);
+    insertStrHashTable(hp_ids, copy, (void *)(id + 1));
+
+    if (RtsFlags.ProfFlags.eventlogHeapProfile) {
+        traceHeapProfBand(hpEventCap(), (StgWord32)id, copy);
+        return id;
+    }
+
+    fputc(HP_BIN_IDENT, hp_file);
+    hpPutVarint(id);
+    hpPutString(copy);
+    return id;
+}
+
+static void
+printHeader(int tag, const char *keyword, const char *value)
+{
+    if (RtsFlags.ProfFlags.eventlogHeapProfile) {
+        return;
+    } else if (RtsFlags.ProfFlags.binaryHeapProfile) {
+        fputc(tag, hp_file);
+        hpPutString(value);
+    } else {
+        fprintf(hp_file, "%s \"%s\"\n", keyword, value);
+    }
+}
+
 static void
 printSample(rtsBool beginSample, StgDouble sampleValue)
 {
-    fprintf(hp_file, "%s %f\n",
-            (beginSample ? "BEGIN_SAMPLE" : "END_SAMPLE"),
-            sampleValue);
-    if (!beginSample) {
-        fflush(hp_file);
+    StgWord64 time;
+    nat id, n;
+
+    if (RtsFlags.ProfFlags.eventlogHeapProfile) {
+        if (beginSample) {
+            traceHeapProfSampleBegin(hpEventCap(), hp_n_samples,
+                                     (StgWord64)(sampleValue * 1e9));
+            return;
+        }
+        for (id = 0; id < hp_n_ids; id++) {
+            if (hp_now[id] != 0) {
+                traceHeapProfSample(hpEventCap(), id, hp_now[id]);
+                hp_now[id] = 0;
+            }
+        }
+        traceHeapProfSampleEnd(hpEventCap(), hp_n_samples);
+        hp_n_samples++;
+        return;
+    }
+
+    if (!RtsFlags.ProfFlags.binaryHeapProfile) {
+        fprintf(hp_file, "%s %f\n",
+                (beginSample ? "BEGIN_SAMPLE" : "END_SAMPLE"),
+                sampleValue);
+        if (!beginSample) {
+            fflush(hp_file);
+        }
+        return;
+    }
+
+    // The values are collected in hp_now[] and written at the end
+    if (beginSample) return;
+
+    n = 0;
+    for (id = 0; id < hp_n_ids; id++) {
+        if (hp_now[id] != hp_last[id]) n++;
+    }
+
+    time = (StgWord64)(sampleValue * 1e6);
+    fputc(HP_BIN_SAMPLE, hp_file);
+    hpPutSVarint((StgInt64)(time - hp_time));
+    hpPutVarint(n);
+    for (id = 0; id < hp_n_ids; id++) {
+        if (hp_now[id] != hp_last[id]) {
+            hpPutVarint(id);
+            hpPutSVarint((StgInt64)(hp_now[id] - hp_last[id]));
+            hp_last[id] = hp_now[id];
+        }
+        hp_now[id] = 0;
+    }
+    hp_time = time;
+    fflush(hp_file);
+}
+
+// The value of one band of the current sample, in bytes
+static void
+printSampleValue(const char *name, W_ bytes)
+{
+    if (HP_BANDS_BY_ID) {
+        hp_now[hpBandId(name)] += bytes;
+    } else {
+        fprintf(hp_file, "%s\t%" FMT_Word "\n", name, bytes);
     }
 }
 
+static char *
+jobString(void)
+{
+    char *job;
+    size_t len;
+#ifdef PROFILING
+    int count;
+#endif
+
+    len = strlen(prog_name) + 1;
+#ifdef PROFILING
+    for (count = 1; count < prog_argc; count++)
+        len += strlen(prog_argv[count]) + 1;
+    len += 5;
+    for (count = 0; count < rts_argc; count++)
+        len += strlen(rts_argv[count]) + 1;
+#endif
+
+    job = stgMallocBytes(len, "jobString");
+    strcpy(job, prog_name);
+#ifdef PROFILING
+    for (count = 1; count < prog_argc; count++) {
+        strcat(job, " ");
+        strcat(job, prog_argv[count]);
+    }
+    strcat(job, " +RTS");
+    for (count = 0; count < rts_argc; count++) {
+        strcat(job, " ");
+        strcat(job, rts_argv[count]);
+    }
+#endif /* PROFILING */
+    return job;
+}
+
 /* --------------------------------------------------------------------------
  * Initialize the heap profilier
  * ----------------------------------------------------------------------- */
@@ -379,6 +687,12 @@ initHeapProfiling(void)
         errorBelch("cannot mix -hb and -hr");
         stg_exit(EXIT_FAILURE);
     }
+    if (RtsFlags.ProfFlags.ldvSampleEras > 1
+        && (RtsFlags.ProfFlags.doHeapProfile != HEAP_BY_LDV
+            || RtsFlags.ProfFlags.bioSelector != NULL)) {
+        errorBelch("--ldv-sample-eras only works with -hb, and not with -hb<bio>");
+        stg_exit(EXIT_FAILURE);
+    }
 #endif
 
     // we only count eras if we're doing LDV profiling.  Otherwise era
@@ -401,25 +715,32 @@ initHeapProfiling(void)
     initEra( &censuses[era] );
 
     /* initProfilingLogFile(); */
-    fprintf(hp_file, "JOB \"%s", prog_name);
+    if (RtsFlags.ProfFlags.eventlogHeapProfile) {
+        traceHeapProfBegin(hpEventCap(),
+                           RtsFlags.ProfFlags.doHeapProfile,
+                           TimeToNS(RtsFlags.ProfFlags.heapProfileInterval));
+        hp_n_samples = 0;
+    } else if (RtsFlags.ProfFlags.binaryHeapProfile) {
+        fwrite(HP_BIN_MAGIC, 1, HP_BIN_MAGIC_LEN, hp_file);
+    }
+    if (HP_BANDS_BY_ID) {
+        hp_ids     = allocStrHashTable();
+        hp_names   = newArena();
+        hp_n_ids   = 0;
+        hp_max_ids = 0;
+        hp_last    = NULL;
+        hp_now     = NULL;
+        hp_time    = 0;
+    }
 
-#ifdef PROFILING
     {
-        int count;
-        for(count = 1; count < prog_argc; count++)
-            fprintf(hp_file, " %s", prog_argv[count]);
-        fprintf(hp_file, " +RTS");
-        for(count = 0; count < rts_argc; count++)
-            fprintf(hp_file, " %s", rts_argv[count]);
+        char *job = jobString();
+        printHeader(HP_BIN_JOB, "JOB", job);
+        stgFree(job);
     }
-#endif /* PROFILING */
-
-    fprintf(hp_file, "\"\n" );
-
-    fprintf(hp_file, "DATE \"%s\"\n", time_str());
-
-    fprintf(hp_file, "SAMPLE_UNIT \"seconds\"\n");
-    fprintf(hp_file, "VALUE_UNIT \"bytes\"\n");
+    printHeader(HP_BIN_DATE, "DATE", time_str());
+    printHeader(HP_BIN_SAMPLE_UNIT, "SAMPLE_UNIT", "seconds");
+    printHeader(HP_BIN_VALUE_UNIT, "VALUE_UNIT", "bytes");
 
     printSample(rtsTrue, 0);
     printSample(rtsFalse, 0);
@@ -477,11 +798,24 @@ endHeapProfiling(void)
 #endif
 
     stgFree(censuses);
+    stgFree(census_chains);
+    census_chains = NULL;
+    stgFree(thread_censuses);
+    thread_censuses = NULL;
 
     seconds = mut_user_time();
     printSample(rtsTrue, seconds);
     printSample(rtsFalse, seconds);
-    fclose(hp_file);
+    if (HP_BANDS_BY_ID) {
+        freeHashTable(hp_ids, NULL);
+        hp_ids = NULL;
+        arenaFree(hp_names);
+        stgFree(hp_last);
+        stgFree(hp_now);
+    }
+    if (!RtsFlags.ProfFlags.eventlogHeapProfile) {
+        fclose(hp_file);
+    }
 }
 
 
@@ -499,20 +833,25 @@ buf_append(char *p, const char *q, char *end)
     return m;
 }
 
+// The name of a CCS in a heap profile, into out, which must have room
+// for CCS_NAME_EXTRA + max_length chars.
+#define CCS_NAME_EXTRA 32
+
 static void
-fprint_ccs(FILE *fp, CostCentreStack *ccs, nat max_length)
+sprint_ccs(char *out, CostCentreStack *ccs, nat max_length)
 {
-    char buf[max_length+1], *p, *buf_end;
+    char *buf, *p, *buf_end;
 
     // MAIN on its own gets printed as "MAIN", otherwise we ignore MAIN.
     if (ccs == CCS_MAIN) {
-        fprintf(fp, "MAIN");
+        strcpy(out, "MAIN");
         return;
     }
 
-    fprintf(fp, "(%ld)", ccs->ccsID);
+    buf = out + sprintf(out, "(%ld)", ccs->ccsID);
 
     p = buf;
+    *p = '\0';
     buf_end = buf + max_length + 1;
 
     // keep printing components of the stack until we run out of space
@@ -536,7 +875,6 @@ fprint_ccs(FILE *fp, CostCentreStack *ccs, nat max_length)
             break;
         }
     }
-    fprintf(fp, "%s", buf);
 }
 
 rtsBool
@@ -735,20 +1073,24 @@ dumpCensus( Census *census )
 {
     counter *ctr;
     long count;
+    const char *name;
+#ifdef PROFILING
+    char buf[RtsFlags.ProfFlags.ccsLength + CCS_NAME_EXTRA];
+#endif
 
     printSample(rtsTrue, census->time);
 
 #ifdef PROFILING
     if (RtsFlags.ProfFlags.doHeapProfile == HEAP_BY_LDV) {
-      fprintf(hp_file, "VOID\t%lu\n", (unsigned long)(census->void_total) * sizeof(W_));
-        fprintf(hp_file, "LAG\t%lu\n",
-                (unsigned long)(census->not_used - census->void_total) * sizeof(W_));
-        fprintf(hp_file, "USE\t%lu\n",
-                (unsigned long)(census->used - census->drag_total) * sizeof(W_));
-        fprintf(hp_file, "INHERENT_USE\t%lu\n",
-                (unsigned long)(census->prim) * sizeof(W_));
-        fprintf(hp_file, "DRAG\t%lu\n",
-                (unsigned long)(census->drag_total) * sizeof(W_));
+        // the closures of the eras left out by --ldv-sample-eras
+        W_ scale = RtsFlags.ProfFlags.ldvSampleEras * sizeof(W_);
+        printSampleValue("VOID", (W_)census->void_total * scale);
+        printSampleValue("LAG",
+                (W_)(census->not_used - census->void_total) * scale);
+        printSampleValue("USE",
+                (W_)(census->used - census->drag_total) * scale);
+        printSampleValue("INHERENT_USE", (W_)census->prim * sizeof(W_));
+        printSampleValue("DRAG", (W_)census->drag_total * scale);
         printSample(rtsFalse, census->time);
         return;
     }
@@ -780,20 +1122,23 @@ dumpCensus( Census *census )
 #if !defined(PROFILING)
         switch (RtsFlags.ProfFlags.doHeapProfile) {
         case HEAP_BY_CLOSURE_TYPE:
-            fprintf(hp_file, "%s", (char *)ctr->identity);
+            name = (char *)ctr->identity;
             break;
+        default:
+            barf("dumpCensus; doHeapProfile");
         }
 #endif
 
 #ifdef PROFILING
         switch (RtsFlags.ProfFlags.doHeapProfile) {
         case HEAP_BY_CCS:
-            fprint_ccs(hp_file, (CostCentreStack *)ctr->identity, RtsFlags.ProfFlags.ccsLength);
+            sprint_ccs(buf, (CostCentreStack *)ctr->identity, RtsFlags.ProfFlags.ccsLength);
+            name = buf;
             break;
         case HEAP_BY_MOD:
         case HEAP_BY_DESCR:
         case HEAP_BY_TYPE:
-            fprintf(hp_file, "%s", (char *)ctr->identity);
+            name = (char *)ctr->identity;
             break;
         case HEAP_BY_RETAINER:
         {
@@ -801,7 +1146,7 @@ dumpCensus( Census *census )
 
             // it might be the distinguished retainer set rs_MANY:
             if (rs == &rs_MANY) {
-                fprintf(hp_file, "MANY");
+                name = "MANY";
                 break;
             }
 
@@ -814,8 +1159,8 @@ dumpCensus( Census *census )
             if (rs->id > 0)
                 rs->id = -(rs->id);
 
-            // report in the unit of bytes: * sizeof(StgWord)
-            printRetainerSetShort(hp_file, rs, RtsFlags.ProfFlags.ccsLength);
+            showRetainerSetShort(buf, rs, RtsFlags.ProfFlags.ccsLength);
+            name = buf;
             break;
         }
         default:
@@ -823,7 +1168,8 @@ dumpCensus( Census *census )
         }
 #endif
 
-        fprintf(hp_file, "\t%" FMT_SizeT "\n", (W_)count * sizeof(W_));
+        // report in the unit of bytes: * sizeof(StgWord)
+        printSampleValue(name, (W_)count * sizeof(W_));
     }
 
     printSample(rtsFalse, census->time);
@@ -855,6 +1201,8 @@ static void heapProfObject(Census *census, StgClosure *p, nat size,
                 if (RtsFlags.ProfFlags.doHeapProfile == HEAP_BY_LDV) {
                     if (prim)
                         census->prim += real_size;
+                    else if (!ldvSampled((StgClosure *)p))
+                        ; // left out by --ldv-sample-eras
                     else if ((LDVW(p) & LDV_STATE_MASK) == LDV_STATE_CREATE)
                         census->not_used += real_size;
                     else
@@ -910,180 +1258,283 @@ static void heapProfObject(Census *census, StgClosure *p, nat size,
 /* -----------------------------------------------------------------------------
  * Code to perform a heap census.
  * -------------------------------------------------------------------------- */
+#ifdef PROFILING
+// Once p has been counted, see resetRetainerSetForNextProfile()
+STATIC_INLINE void
+resetRetainerSampling( StgClosure *p )
+{
+    if (doingRetainerProfiling() && doingRetainerSampling()) {
+        resetRetainerSetForNextProfile(p);
+    }
+}
+#endif
+
 static void
-heapCensusChain( Census *census, bdescr *bd )
+heapCensusBlock( Census *census, bdescr *bd )
 {
     StgPtr p;
     StgInfoTable *info;
     nat size;
     rtsBool prim;
 
-    for (; bd != NULL; bd = bd->link) {
-
-        // HACK: pretend a pinned block is just one big ARR_WORDS
-        // owned by CCS_PINNED.  These blocks can be full of holes due
-        // to alignment constraints so we can't traverse the memory
-        // and do a proper census.
-        if (bd->flags & BF_PINNED) {
-            StgClosure arr;
-            SET_HDR(&arr, &stg_ARR_WORDS_info, CCS_PINNED);
-            heapProfObject(census, &arr, bd->blocks * BLOCK_SIZE_W, rtsTrue);
-            continue;
-        }
+    // HACK: pretend a pinned block is just one big ARR_WORDS
+    // owned by CCS_PINNED.  These blocks can be full of holes due
+    // to alignment constraints so we can't traverse the memory
+    // and do a proper census.
+    if (bd->flags & BF_PINNED) {
+        StgClosure arr;
+        SET_HDR(&arr, &stg_ARR_WORDS_info, CCS_PINNED);
+        heapProfObject(census, &arr, bd->blocks * BLOCK_SIZE_W, rtsTrue);
+        return;
+    }
 
-        p = bd->start;
-        while (p < bd->free) {
-            info = get_itbl((StgClosure *)p);
-            prim = rtsFalse;
+    p = bd->start;
+    while (p < bd->free) {
+        info = get_itbl((StgClosure *)p);
+        prim = rtsFalse;
 
-            switch (info->type) {
+        switch (info->type) {
 
-            case THUNK:
-                size = thunk_sizeW_fromITBL(info);
-                break;
+        case THUNK:
+            size = thunk_sizeW_fromITBL(info);
+            break;
 
-            case THUNK_1_1:
-            case THUNK_0_2:
-            case THUNK_2_0:
-                size = sizeofW(StgThunkHeader) + 2;
-                break;
+        case THUNK_1_1:
+        case THUNK_0_2:
+        case THUNK_2_0:
+            size = sizeofW(StgThunkHeader) + 2;
+            break;
 
-            case THUNK_1_0:
-            case THUNK_0_1:
-            case THUNK_SELECTOR:
-                size = sizeofW(StgThunkHeader) + 1;
-                break;
+        case THUNK_1_0:
+        case THUNK_0_1:
+        case THUNK_SELECTOR:
+            size = sizeofW(StgThunkHeader) + 1;
+            break;
 
-            case CONSTR:
-            case FUN:
-            case IND_PERM:
-            case BLACKHOLE:
-            case BLOCKING_QUEUE:
-            case FUN_1_0:
-            case FUN_0_1:
-            case FUN_1_1:
-            case FUN_0_2:
-            case FUN_2_0:
-            case CONSTR_1_0:
-            case CONSTR_0_1:
-            case CONSTR_1_1:
-            case CONSTR_0_2:
-            case CONSTR_2_0:
-                size = sizeW_fromITBL(info);
-                break;
+        case CONSTR:
+        case FUN:
+        case IND_PERM:
+        case BLACKHOLE:
+        case BLOCKING_QUEUE:
+        case FUN_1_0:
+        case FUN_0_1:
+        case FUN_1_1:
+        case FUN_0_2:
+        case FUN_2_0:
+        case CONSTR_1_0:
+        case CONSTR_0_1:
+        case CONSTR_1_1:
+        case CONSTR_0_2:
+        case CONSTR_2_0:
+            size = sizeW_fromITBL(info);
+            break;
 
-            case IND:
-                // Special case/Delicate Hack: INDs don't normally
-                // appear, since we're doing this heap census right
-                // after GC.  However, GarbageCollect() also does
-                // resurrectThreads(), which can update some
-                // blackholes when it calls raiseAsync() on the
-                // resurrected threads.  So we know that any IND will
-                // be the size of a BLACKHOLE.
-                size = BLACKHOLE_sizeW();
-                break;
+        case IND:
+            // Special case/Delicate Hack: INDs don't normally
+            // appear, since we're doing this heap census right
+            // after GC.  However, GarbageCollect() also does
+            // resurrectThreads(), which can update some
+            // blackholes when it calls raiseAsync() on the
+            // resurrected threads.  So we know that any IND will
+            // be the size of a BLACKHOLE.
+            size = BLACKHOLE_sizeW();
+            break;
 
-            case BCO:
-                prim = rtsTrue;
-                size = bco_sizeW((StgBCO *)p);
-                break;
+        case BCO:
+            prim = rtsTrue;
+            size = bco_sizeW((StgBCO *)p);
+            break;
 
-            case MVAR_CLEAN:
-            case MVAR_DIRTY:
-            case TVAR:
-            case WEAK:
-            case PRIM:
-            case MUT_PRIM:
-            case MUT_VAR_CLEAN:
-            case MUT_VAR_DIRTY:
-                prim = rtsTrue;
-                size = sizeW_fromITBL(info);
-                break;
+        case MVAR_CLEAN:
+        case MVAR_DIRTY:
+        case TVAR:
+        case WEAK:
+        case PRIM:
+        case MUT_PRIM:
+        case MUT_VAR_CLEAN:
+        case MUT_VAR_DIRTY:
+            prim = rtsTrue;
+            size = sizeW_fromITBL(info);
+            break;
 
-            case AP:
-                size = ap_sizeW((StgAP *)p);
-                break;
+        case AP:
+            size = ap_sizeW((StgAP *)p);
+            break;
 
-            case PAP:
-                size = pap_sizeW((StgPAP *)p);
-                break;
+        case PAP:
+            size = pap_sizeW((StgPAP *)p);
+            break;
 
-            case AP_STACK:
-                size = ap_stack_sizeW((StgAP_STACK *)p);
-                break;
+        case AP_STACK:
+            size = ap_stack_sizeW((StgAP_STACK *)p);
+            break;
 
-            case ARR_WORDS:
-                prim = rtsTrue;
-                size = arr_words_sizeW((StgArrWords*)p);
-                break;
+        case ARR_WORDS:
+            prim = rtsTrue;
+            size = arr_words_sizeW((StgArrWords*)p);
+            break;
 
-            case MUT_ARR_PTRS_CLEAN:
-            case MUT_ARR_PTRS_DIRTY:
-            case MUT_ARR_PTRS_FROZEN:
-            case MUT_ARR_PTRS_FROZEN0:
-                prim = rtsTrue;
-                size = mut_arr_ptrs_sizeW((StgMutArrPtrs *)p);
-                break;
+        case MUT_ARR_PTRS_CLEAN:
+        case MUT_ARR_PTRS_DIRTY:
+        case MUT_ARR_PTRS_FROZEN:
+        case MUT_ARR_PTRS_FROZEN0:
+            prim = rtsTrue;
+            size = mut_arr_ptrs_sizeW((StgMutArrPtrs *)p);
+            break;
 
-            case SMALL_MUT_ARR_PTRS_CLEAN:
-            case SMALL_MUT_ARR_PTRS_DIRTY:
-            case SMALL_MUT_ARR_PTRS_FROZEN:
-            case SMALL_MUT_ARR_PTRS_FROZEN0:
-                prim = rtsTrue;
-                size = small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs *)p);
-                break;
+        case SMALL_MUT_ARR_PTRS_CLEAN:
+        case SMALL_MUT_ARR_PTRS_DIRTY:
+        case SMALL_MUT_ARR_PTRS_FROZEN:
+        case SMALL_MUT_ARR_PTRS_FROZEN0:
+            prim = rtsTrue;
+            size = small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs *)p);
+            break;
 
-            case TSO:
-                prim = rtsTrue;
+        case TSO:
+            prim = rtsTrue;
 #ifdef PROFILING
-                if (RtsFlags.ProfFlags.includeTSOs) {
-                    size = sizeofW(StgTSO);
-                    break;
-                } else {
-                    // Skip this TSO and move on to the next object
-                    p += sizeofW(StgTSO);
-                    continue;
-                }
-#else
+            if (RtsFlags.ProfFlags.includeTSOs) {
                 size = sizeofW(StgTSO);
                 break;
+            } else {
+                // Skip this TSO and move on to the next object
+                resetRetainerSampling((StgClosure *)p);
+                p += sizeofW(StgTSO);
+                continue;
+            }
+#else
+            size = sizeofW(StgTSO);
+            break;
 #endif
 
-            case STACK:
-                prim = rtsTrue;
+        case STACK:
+            prim = rtsTrue;
 #ifdef PROFILING
-                if (RtsFlags.ProfFlags.includeTSOs) {
-                    size = stack_sizeW((StgStack*)p);
-                    break;
-                } else {
-                    // Skip this TSO and move on to the next object
-                    p += stack_sizeW((StgStack*)p);
-                    continue;
-                }
-#else
+            if (RtsFlags.ProfFlags.includeTSOs) {
                 size = stack_sizeW((StgStack*)p);
                 break;
+            } else {
+                // Skip this TSO and move on to the next object
+                resetRetainerSampling((StgClosure *)p);
+                p += stack_sizeW((StgStack*)p);
+                continue;
+            }
+#else
+            size = stack_sizeW((StgStack*)p);
+            break;
 #endif
 
-            case TREC_CHUNK:
-                prim = rtsTrue;
-                size = sizeofW(StgTRecChunk);
-                break;
+        case TREC_CHUNK:
+            prim = rtsTrue;
+            size = sizeofW(StgTRecChunk);
+            break;
 
-            default:
-                barf("heapCensus, unknown object: %d", info->type);
-            }
+        default:
+            barf("heapCensus, unknown object: %d", info->type);
+        }
+
+        heapProfObject(census,(StgClosure*)p,size,prim);
+#ifdef PROFILING
+        resetRetainerSampling((StgClosure *)p);
+#endif
+
+        p += size;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Sharing out the census
+ *
+ * The census is done by all the GC threads (see runOnGcThreads()).  The
+ * block chains of the heap are put in census_chains[], and each thread
+ * repeatedly claims the next CENSUS_CHUNK blocks of them and counts
+ * their closures in a Census of its own.  The thread leading the GC uses
+ * censuses[era] itself; the others' are added to it at the end by
+ * mergeCensus().
+ * -------------------------------------------------------------------------- */
+
+#define CENSUS_CHUNK 64
 
-            heapProfObject(census,(StgClosure*)p,size,prim);
 
-            p += size;
+// Returns the first of up to CENSUS_CHUNK blocks, or NULL if the census
+// is done
+static bdescr *
+claimCensusChunk( void )
+{
+    bdescr *bd, *first;
+    nat n;
+
+    ACQUIRE_SPIN_LOCK(&census_lock);
+    while (census_next == NULL && census_chain < n_census_chains) {
+        census_next = census_chains[census_chain++];
+    }
+    first = census_next;
+    for (bd = first, n = 0; bd != NULL && n < CENSUS_CHUNK; n++) {
+        bd = bd->link;
+    }
+    census_next = bd;
+    RELEASE_SPIN_LOCK(&census_lock);
+
+    return first;
+}
+
+static void
+heapCensusWorker( nat me )
+{
+    Census *census;
+    bdescr *bd;
+    nat n;
+
+    if (me == census_leader) {
+        census = &censuses[era];
+    } else {
+        census = &thread_censuses[me];
+        initEra(census);
+    }
+
+    while ((bd = claimCensusChunk()) != NULL) {
+        for (n = 0; bd != NULL && n < CENSUS_CHUNK; bd = bd->link, n++) {
+            heapCensusBlock(census, bd);
+        }
+    }
+}
+
+// Add the counts of from to census
+static void
+mergeCensus( Census *census, Census *from )
+{
+    counter *c, *d;
+
+    census->prim     += from->prim;
+    census->not_used += from->not_used;
+    census->used     += from->used;
+
+    for (c = from->ctrs; c != NULL; c = c->next) {
+        d = lookupHashTable(census->hash, (StgWord)c->identity);
+        if (d == NULL) {
+            d = arenaAlloc(census->arena, sizeof(counter));
+            *d = *c;
+            insertHashTable(census->hash, (StgWord)d->identity, d);
+            d->next = census->ctrs;
+            census->ctrs = d;
+        } else {
+#ifdef PROFILING
+            if (RtsFlags.ProfFlags.bioSelector != NULL) {
+                d->c.ldv.prim     += c->c.ldv.prim;
+                d->c.ldv.not_used += c->c.ldv.not_used;
+                d->c.ldv.used     += c->c.ldv.used;
+            } else
+#endif
+            {
+                d->c.resid += c->c.resid;
+            }
         }
     }
 }
 
 void heapCensus (Time t)
 {
-  nat g, n;
+  nat g, n, i;
   Census *census;
   gen_workspace *ws;
 
@@ -1102,17 +1553,46 @@ void heapCensus (Time t)
 #endif
 
   // Traverse the heap, collecting the census info
+  census_chains = stgReallocBytes(census_chains,
+                                  RtsFlags.GcFlags.generations *
+                                  (2 + 3 * n_capabilities) * sizeof(bdescr *),
+                                  "heapCensus");
+  i = 0;
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
-      heapCensusChain( census, generations[g].blocks );
+      census_chains[i++] = generations[g].blocks;
       // Are we interested in large objects?  might be
       // confusing to include the stack in a heap profile.
-      heapCensusChain( census, generations[g].large_objects );
+      census_chains[i++] = generations[g].large_objects;
 
       for (n = 0; n < n_capabilities; n++) {
           ws = &gc_threads[n]->gens[g];
-          heapCensusChain(census, ws->todo_bd);
-          heapCensusChain(census, ws->part_list);
-          heapCensusChain(census, ws->scavd_list);
+          census_chains[i++] = ws->todo_bd;
+          census_chains[i++] = ws->part_list;
+          census_chains[i++] = ws->scavd_list;
+      }
+  }
+  n_census_chains = i;
+  census_chain = 0;
+  census_next = NULL;
+#if defined(THREADED_RTS)
+  initSpinLock(&census_lock);
+#endif
+
+  thread_censuses = stgReallocBytes(thread_censuses,
+                                    n_capabilities * sizeof(Census),
+                                    "heapCensus");
+  for (n = 0; n < n_capabilities; n++) {
+      thread_censuses[n].hash = NULL;
+  }
+  // the GC thread leading the GC is the one for our Capability
+  census_leader = myTask()->cap->no;
+
+  runOnGcThreads(heapCensusWorker);
+
+  for (n = 0; n < n_capabilities; n++) {
+      if (thread_censuses[n].hash != NULL) {
+          mergeCensus(census, &thread_censuses[n]);
+          freeEra(&thread_censuses[n]);
       }
   }
 
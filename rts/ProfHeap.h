@@ -16,6 +16,20 @@ nat     initHeapProfiling  (void);
 void    endHeapProfiling   (void);
 rtsBool strMatchesSelector (char* str, char* sel);
 
+#ifdef PROFILING
+// Deaths found by LdvCensusForDead(), added up by era
+typedef struct {
+    long *void_new;     // indexed by the era of creation
+    long *drag_new;     // indexed by the era after the last use
+    nat   size;         // of void_new and drag_new
+} LdvDeaths;
+
+void    LDV_initDeaths     (LdvDeaths *d);
+void    LDV_countDead      (LdvDeaths *d, StgClosure *c, nat size);
+void    LDV_addDeaths      (LdvDeaths *d);
+void    LDV_freeDeaths     (LdvDeaths *d);
+#endif
+
 #include "EndPrivate.h"
 
 #endif /* PROFHEAP_H */
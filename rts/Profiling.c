@@ -31,6 +31,19 @@
  */
 Arena *prof_arena;
 
+/*
+ * The counters of a CostCentreStack are bumped by every Capability
+ * running code in it, so in the threaded RTS each CCS created at run
+ * time gets a whole number of cache lines from an arena of its own, to
+ * keep the counters of different stacks off each other's lines.
+ */
+#if defined(THREADED_RTS)
+static Arena *ccs_arena;
+#define CCS_ALIGN 64
+#define sizeofCCS() \
+    ((sizeof(CostCentreStack) + CCS_ALIGN - 1) & ~(CCS_ALIGN - 1))
+#endif
+
 /*
  * Global variables used to assign unique IDs to cc's, ccs's, and
  * closure_cats
@@ -144,6 +157,9 @@ initProfiling1 (void)
 {
     // initialise our arena
     prof_arena = newArena();
+#if defined(THREADED_RTS)
+    ccs_arena = newArena();
+#endif
 
     /* for the benefit of allocate()... */
     {
@@ -162,6 +178,9 @@ void
 freeProfiling (void)
 {
     arenaFree(prof_arena);
+#if defined(THREADED_RTS)
+    arenaFree(ccs_arena);
+#endif
 }
 
 void
@@ -265,13 +284,16 @@ initProfilingLogFile(void)
         }
     }
 
-    if (RtsFlags.ProfFlags.doHeapProfile) {
+    if (RtsFlags.ProfFlags.doHeapProfile &&
+        !RtsFlags.ProfFlags.eventlogHeapProfile) {
         /* Initialise the log file name */
         hp_filename = arenaAlloc(prof_arena, strlen(prog) + 6);
         sprintf(hp_filename, "%s.hp", prog);
 
         /* open the log file */
-        if ((hp_file = fopen(hp_filename, "w")) == NULL) {
+        if ((hp_file = fopen(hp_filename,
+                             RtsFlags.ProfFlags.binaryHeapProfile ? "wb" : "w"))
+            == NULL) {
             debugBelch("Can't open profiling report file %s\n",
                     hp_filename);
             RtsFlags.ProfFlags.doHeapProfile = 0;
@@ -500,10 +522,27 @@ appendCCS ( CostCentreStack *ccs1, CostCentreStack *ccs2 )
 // #define RECURSION_DROPS
 #define RECURSION_TRUNCATES
 
+/*
+ * Finding the result of a push in the IndexTable of ccs is a walk along
+ * a list of all its children, which is long for the CCSs of functions
+ * that call many others.  So the children are also cached in
+ * push_cache[], indexed by a hash of (ccs, cc).  A slot holds just the
+ * child, which has ccs as its prevStack and cc as its cc: that way a
+ * slot is read and written in one go, and needs no lock.  Back edges
+ * (see RECURSION_TRUNCATES) aren't children, so they aren't cached.
+ */
+#define PUSH_CACHE_SIZE 4096  // must be a power of 2
+
+static CostCentreStack *push_cache[PUSH_CACHE_SIZE];
+
+#define pushCacheSlot(ccs,cc) \
+    (&push_cache[(((StgWord)(ccs) >> 3) * 31 + ((StgWord)(cc) >> 3)) \
+                 & (PUSH_CACHE_SIZE - 1)])
+
 CostCentreStack *
 pushCostCentre (CostCentreStack *ccs, CostCentre *cc)
 {
-    CostCentreStack *temp_ccs, *ret;
+    CostCentreStack *temp_ccs, *ret, **slot;
     IndexTable *ixtable;
 
     if (ccs == EMPTY_STACK) {
@@ -515,11 +554,21 @@ pushCostCentre (CostCentreStack *ccs, CostCentre *cc)
         if (ccs->cc == cc) {
             return ccs;
         } else {
+            slot = pushCacheSlot(ccs,cc);
+            temp_ccs = *slot;
+            if (temp_ccs != NULL && temp_ccs->prevStack == ccs
+                && temp_ccs->cc == cc) {
+                return temp_ccs;
+            }
+
             // check if we've already memoized this stack
             ixtable = ccs->indexTable;
             temp_ccs = isInIndexTable(ixtable,cc);
 
             if (temp_ccs != EMPTY_STACK) {
+                if (temp_ccs->prevStack == ccs) {
+                    *slot = temp_ccs;
+                }
                 return temp_ccs;
             } else {
 
@@ -560,6 +609,10 @@ pushCostCentre (CostCentreStack *ccs, CostCentre *cc)
                     ret = new_ccs;
                 } else {
                     ret = actualPush (ccs,cc);
+                    // the new CCS must be complete before another
+                    // thread can find it in the cache
+                    write_barrier();
+                    *slot = ret;
                 }
             }
         }
@@ -585,8 +638,15 @@ actualPush (CostCentreStack *ccs, CostCentre *cc)
 {
     CostCentreStack *new_ccs;
 
-    // allocate space for a new CostCentreStack
+    // allocate space for a new CostCentreStack.  Arena blocks are
+    // block-aligned, so if every allocation in ccs_arena is a multiple
+    // of CCS_ALIGN, they are all aligned to it.
+#if defined(THREADED_RTS)
+    new_ccs = (CostCentreStack *) arenaAlloc(ccs_arena, sizeofCCS());
+    ASSERT(((StgWord)new_ccs & (CCS_ALIGN - 1)) == 0);
+#else
     new_ccs = (CostCentreStack *) arenaAlloc(prof_arena, sizeof(CostCentreStack));
+#endif
 
     return actualPush_(ccs, cc, new_ccs);
 }
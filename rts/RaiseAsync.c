@@ -21,6 +21,8 @@
 #include "Messages.h"
 #if defined(mingw32_HOST_OS)
 #include "win32/IOManager.h"
+#elif defined(linux_HOST_OS) && !defined(THREADED_RTS)
+#include "posix/AsyncIO.h"
 #endif
 
 static StgTSO* raiseAsync (Capability *cap,
@@ -722,12 +724,19 @@ removeFromQueues(Capability *cap, StgTSO *tso)
        * the request.
        */
       abandonWorkRequest(tso->block_info.async_result->reqID);
+#elif defined(linux_HOST_OS)
+      if (tso->flags & TSO_ASYNC_IO) {
+          abandonIORequest(tso->block_info.async_result);
+          tso->flags &= ~TSO_ASYNC_IO;
+      }
 #endif
       goto done;
 
+#if !defined(mingw32_HOST_OS)
   case BlockedOnDelay:
-        removeThreadFromQueue(cap, &sleeping_queue, tso);
+        removeSleepingThread(tso);
         goto done;
+#endif
 #endif
 
   default:
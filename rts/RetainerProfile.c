@@ -31,7 +31,7 @@
 #include "ProfHeap.h"
 #include "Apply.h"
 #include "Stable.h" /* markStableTables */
-#include "sm/Storage.h" // for END_OF_STATIC_LIST
+#include "sm/Storage.h" // for END_OF_STATIC_OBJECT_LIST
 
 /*
   Note: what to change in order to plug-in a new retainer profiling scheme?
@@ -51,6 +51,12 @@ static nat retainerGeneration;  // generation
 static nat numObjectVisited;    // total number of objects visited
 static nat timesAnyObjectVisited; // number of times any objects are visited
 
+// With --retainer-sample-roots=n, a retainer profile only traverses from
+// the roots whose number (in the order retainRoot() sees them) is
+// retainerGeneration modulo n, so that each root is used once in n
+// profiles, and a profile costs about 1/n of a full one.
+static nat rootNumber;
+
 /*
   The rs field in the profile header of any object points to its retainer
   set in an indirect way: if flip is 0, it points to the retainer set;
@@ -1743,6 +1749,13 @@ retainRoot(void *user STG_UNUSED, StgClosure **tl)
     // We no longer assume that only TSOs and WEAKs are roots; any closure can
     // be a root.
 
+    if (doingRetainerSampling()) {
+        if ((rootNumber++ + retainerGeneration)
+            % RtsFlags.ProfFlags.retainerSampleRoots != 0) {
+            return;
+        }
+    }
+
     ASSERT(isEmptyRetainerStack());
     currentStackBoundary = stackTop;
 
@@ -1774,6 +1787,7 @@ computeRetainerSet( void )
     RetainerSet tmpRetainerSet;
 #endif
 
+    rootNumber = 0;
     markCapabilities(retainRoot, NULL); // for scheduler roots
 
     // This function is called after a major GC, when key, value, and finalizer
@@ -1869,6 +1883,18 @@ computeRetainerSet( void )
  * to have fixed the assertion failure in retainerSetOf() I was
  * encountering.
  * -------------------------------------------------------------------------- */
+STATIC_INLINE void
+resetStaticRetainerSet( StgClosure *c )
+{
+    // The census doesn't see static closures, so this is where they are
+    // reset when sampling; see resetRetainerSetForNextProfile()
+    if (doingRetainerSampling()) {
+        resetRetainerSetForNextProfile(c);
+    } else {
+        maybeInitRetainerSet(c);
+    }
+}
+
 void
 resetStaticObjectForRetainerProfiling( StgClosure *static_objects )
 {
@@ -1881,7 +1907,8 @@ resetStaticObjectForRetainerProfiling( StgClosure *static_objects )
     count = 0;
 #endif
     p = static_objects;
-    while (p != END_OF_STATIC_LIST) {
+    while (p != END_OF_STATIC_OBJECT_LIST) {
+        p = UNTAG_STATIC_LIST_PTR(p);
 #ifdef DEBUG_RETAINER
         count++;
 #endif
@@ -1893,15 +1920,15 @@ resetStaticObjectForRetainerProfiling( StgClosure *static_objects )
             p = (StgClosure*)*IND_STATIC_LINK(p);
             break;
         case THUNK_STATIC:
-            maybeInitRetainerSet(p);
+            resetStaticRetainerSet(p);
             p = (StgClosure*)*THUNK_STATIC_LINK(p);
             break;
         case FUN_STATIC:
-            maybeInitRetainerSet(p);
+            resetStaticRetainerSet(p);
             p = (StgClosure*)*FUN_STATIC_LINK(p);
             break;
         case CONSTR_STATIC:
-            maybeInitRetainerSet(p);
+            resetStaticRetainerSet(p);
             p = (StgClosure*)*STATIC_LINK(get_itbl(p), p);
             break;
         default:
@@ -32,6 +32,17 @@ extern StgWord flip;
 #define isRetainerSetFieldValid(c) \
   ((((StgWord)(c)->header.prof.hp.rs & 1) ^ flip) == 0)
 
+// With --retainer-sample-roots a retainer profile only reaches part of
+// the heap, so the closures it doesn't reach would keep the retainer set
+// of two profiles ago, which the flip bit can't tell from a new one.
+// Instead the census resets every closure it has counted to look
+// unvisited by the next retainer profile.
+#define resetRetainerSetForNextProfile(c) \
+  ((c)->header.prof.hp.rs = (RetainerSet *)(flip ^ 1))
+
+#define doingRetainerSampling() \
+  (RtsFlags.ProfFlags.retainerSampleRoots > 1)
+
 static inline RetainerSet *
 retainerSetOf( StgClosure *c )
 {
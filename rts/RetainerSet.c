@@ -20,9 +20,14 @@
 
 #include <string.h>
 
-#define HASH_TABLE_SIZE 255
-#define hash(hk)  (hk % HASH_TABLE_SIZE)
-static RetainerSet *hashTable[HASH_TABLE_SIZE];
+// The hash table starts with INIT_HASH_TABLE_SIZE buckets, and is
+// rehashed into 2n+1 buckets whenever it holds more than 2n sets, so
+// that the chains stay short however many retainer sets there are.
+#define INIT_HASH_TABLE_SIZE 255
+#define hash(hk)  (hk % hashTableSize)
+static RetainerSet **hashTable = NULL;
+static nat hashTableSize;
+static nat numRetainerSets;     // in hashTable
 
 static Arena *arena;            // arena in which we store retainer sets
 
@@ -56,6 +61,65 @@ sizeofRetainerSet( int elems )
     return (sizeof(RetainerSet) + elems * sizeof(retainer));
 }
 
+/* -----------------------------------------------------------------------------
+ * (Re)allocates an empty hashTable[] of INIT_HASH_TABLE_SIZE buckets.
+ * -------------------------------------------------------------------------- */
+static void
+initHashTable(void)
+{
+    nat i;
+
+    hashTableSize = INIT_HASH_TABLE_SIZE;
+    hashTable = stgReallocBytes(hashTable,
+                                hashTableSize * sizeof(RetainerSet *),
+                                "initHashTable");
+    for (i = 0; i < hashTableSize; i++)
+        hashTable[i] = NULL;
+    numRetainerSets = 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * Moves all the retainer sets into a hashTable[] of 2n+1 buckets.
+ * -------------------------------------------------------------------------- */
+static void
+growHashTable(void)
+{
+    RetainerSet **old, *rs, *next;
+    nat i, oldSize;
+
+    old = hashTable;
+    oldSize = hashTableSize;
+
+    hashTableSize = oldSize * 2 + 1;
+    hashTable = stgMallocBytes(hashTableSize * sizeof(RetainerSet *),
+                               "growHashTable");
+    for (i = 0; i < hashTableSize; i++)
+        hashTable[i] = NULL;
+
+    for (i = 0; i < oldSize; i++) {
+        for (rs = old[i]; rs != NULL; rs = next) {
+            next = rs->link;
+            rs->link = hashTable[hash(rs->hashKey)];
+            hashTable[hash(rs->hashKey)] = rs;
+        }
+    }
+    stgFree(old);
+}
+
+/* -----------------------------------------------------------------------------
+ * Puts a new retainer set at the head of its bucket.
+ * -------------------------------------------------------------------------- */
+STATIC_INLINE void
+insertRetainerSet(RetainerSet *rs)
+{
+    if (numRetainerSets >= 2 * hashTableSize) {
+        growHashTable();
+    }
+    rs->link = hashTable[hash(rs->hashKey)];
+    hashTable[hash(rs->hashKey)] = rs;
+    numRetainerSets++;
+}
+
 /* -----------------------------------------------------------------------------
  * Creates the first pool and initializes hashTable[].
  * Frees all pools if any.
@@ -63,12 +127,9 @@ sizeofRetainerSet( int elems )
 void
 initializeAllRetainerSet(void)
 {
-    int i;
-
     arena = newArena();
 
-    for (i = 0; i < HASH_TABLE_SIZE; i++)
-        hashTable[i] = NULL;
+    initHashTable();
     nextId = 2;   // Initial value must be positive, 2 is MANY.
 }
 
@@ -79,14 +140,11 @@ void
 refreshAllRetainerSet(void)
 {
 #ifdef FIRST_APPROACH
-    int i;
-
     // first approach: completely refresh
     arenaFree(arena);
     arena = newArena();
 
-    for (i = 0; i < HASH_TABLE_SIZE; i++)
-        hashTable[i] = NULL;
+    initHashTable();
     nextId = 2;
 #endif /* FIRST_APPROACH */
 }
@@ -98,6 +156,8 @@ void
 closeAllRetainerSet(void)
 {
     arenaFree(arena);
+    stgFree(hashTable);
+    hashTable = NULL;
 }
 
 /* -----------------------------------------------------------------------------
@@ -117,12 +177,11 @@ singleton(retainer r)
     rs = arenaAlloc( arena, sizeofRetainerSet(1) );
     rs->num = 1;
     rs->hashKey = hk;
-    rs->link = hashTable[hash(hk)];
     rs->id = nextId++;
     rs->element[0] = r;
 
     // The new retainer set is placed at the head of the linked list.
-    hashTable[hash(hk)] = rs;
+    insertRetainerSet(rs);
 
     return rs;
 }
@@ -196,7 +255,6 @@ addElement(retainer r, RetainerSet *rs)
     nrs = arenaAlloc( arena, sizeofRetainerSet(rs->num + 1) );
     nrs->num = rs->num + 1;
     nrs->hashKey = hk;
-    nrs->link = hashTable[hash(hk)];
     nrs->id = nextId++;
     for (i = 0; i < nl; i++) {              // copy the first nl retainers
         nrs->element[i] = rs->element[i];
@@ -206,7 +264,7 @@ addElement(retainer r, RetainerSet *rs)
         nrs->element[i + 1] = rs->element[i];
     }
 
-    hashTable[hash(hk)] = nrs;
+    insertRetainerSet(nrs);
 
 #ifdef DEBUG_RETAINER
     // debugBelch("%p\n", nrs);
@@ -220,11 +278,11 @@ addElement(retainer r, RetainerSet *rs)
 void
 traverseAllRetainerSet(void (*f)(RetainerSet *))
 {
-    int i;
+    nat i;
     RetainerSet *rs;
 
     (*f)(&rs_MANY);
-    for (i = 0; i < HASH_TABLE_SIZE; i++)
+    for (i = 0; i < hashTableSize; i++)
         for (rs = hashTable[i]; rs != NULL; rs = rs->link)
             (*f)(rs);
 }
@@ -311,9 +369,8 @@ printRetainerSetShort(FILE *f, RetainerSet *rs, nat max_length)
 #elif defined(RETAINER_SCHEME_CCS)
 // Retainer scheme 2: retainer = cost centre stack
 void
-printRetainerSetShort(FILE *f, RetainerSet *rs, nat max_length)
+showRetainerSetShort(char *tmp, RetainerSet *rs, nat max_length)
 {
-    char tmp[max_length + 1];
     nat size;
     nat j;
 
@@ -342,6 +399,14 @@ printRetainerSetShort(FILE *f, RetainerSet *rs, nat max_length)
             // size = strlen(tmp);
         }
     }
+}
+
+void
+printRetainerSetShort(FILE *f, RetainerSet *rs, nat max_length)
+{
+    char tmp[max_length + 1];
+
+    showRetainerSetShort(tmp, rs, max_length);
     fputs(tmp, f);
 }
 #elif defined(RETAINER_SCHEME_CC)
@@ -438,7 +503,7 @@ outputAllRetainerSet(FILE *prof_file)
     // find out the number of retainer sets which have had a non-zero cost at
     // least once during retainer profiling
     numSet = 0;
-    for (i = 0; i < HASH_TABLE_SIZE; i++)
+    for (i = 0; i < hashTableSize; i++)
         for (rs = hashTable[i]; rs != NULL; rs = rs->link) {
             if (rs->id < 0)
                 numSet++;
@@ -453,7 +518,7 @@ outputAllRetainerSet(FILE *prof_file)
 
     // prepare for sorting
     j = 0;
-    for (i = 0; i < HASH_TABLE_SIZE; i++)
+    for (i = 0; i < hashTableSize; i++)
         for (rs = hashTable[i]; rs != NULL; rs = rs->link) {
             if (rs->id < 0) {
                 rsArray[j] = rs;
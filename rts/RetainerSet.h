@@ -166,6 +166,10 @@ void traverseAllRetainerSet(void (*f)(RetainerSet *));
 #ifdef SECOND_APPROACH
 // Prints a single retainer set.
 void printRetainerSetShort(FILE *, RetainerSet *, nat);
+#ifdef RETAINER_SCHEME_CCS
+// The same, into a buffer of max_length + 1 chars.
+void showRetainerSetShort(char *, RetainerSet *, nat);
+#endif
 #endif
 
 // Print the statistics on all the retainer sets.
@@ -18,6 +18,8 @@
 #include "Stable.h"
 #include "Weak.h"
 
+#include <string.h>
+
 /* ----------------------------------------------------------------------------
    Building Haskell objects from C datatypes.
 
@@ -192,6 +194,111 @@ rts_mkString (Capability *cap, char *s)
   return rts_apply(cap, (StgClosure *)unpackCString_closure, rts_mkPtr(cap,s));
 }
 
+/* ----------------------------------------------------------------------------
+   Building lists and arrays in bulk
+
+   Marshalling a C array with rts_mkInt and rts_apply costs an allocate()
+   call per element, and rts_mkString goes through an unpackCString#
+   thunk.  These build the whole structure with as few allocate() calls
+   as possible: one for a byte array, and one per (nearly full) block for
+   a list.  The cells of a list can't go in a single large object,
+   because the GC assumes that a large object holds only one closure.
+   ------------------------------------------------------------------------- */
+
+// How many words of a list to allocate at once: just under the size at
+// which allocate() would make a large object.
+#define LIST_CHUNK_WORDS (LARGE_OBJECT_THRESHOLD/sizeof(W_) - 1)
+
+/* Build the list [elem(0), ..., elem(n-1)], consing the cells on from
+ * the end.  Each cell takes cell_words words of the chunk it is in:
+ * the (:) itself, followed by cell_words - CONSTR_sizeW(2,0) words for
+ * the element, which fill() builds (or not) and returns.
+ */
+static HaskellObj
+mkList (Capability *cap, StgWord n, StgWord cell_words,
+        HaskellObj (*fill)(void *env, StgWord i, StgClosure *p), void *env)
+{
+    StgClosure *list, *cell;
+    StgWord k, i, chunk;
+    StgPtr p;
+
+    list = (StgClosure *)Nil_closure;
+    chunk = LIST_CHUNK_WORDS / cell_words;
+
+    while (n > 0) {
+        k = stg_min(n, chunk);
+        n -= k;
+        p = allocate(cap, k * cell_words);
+        for (i = k; i > 0; i--) {
+            cell = (StgClosure *)(p + (i-1) * cell_words);
+            SET_HDR(cell, ZC_con_info, CCS_SYSTEM);
+            cell->payload[0] = fill(env, n + i - 1,
+                                    (StgClosure *)((StgPtr)cell
+                                                   + CONSTR_sizeW(2,0)));
+            cell->payload[1] = list;
+            list = cell;
+        }
+    }
+    return list;
+}
+
+static HaskellObj
+fillObj (void *env, StgWord i, StgClosure *p STG_UNUSED)
+{
+    return ((HaskellObj *)env)[i];
+}
+
+static HaskellObj
+fillInt (void *env, StgWord i, StgClosure *p)
+{
+    SET_HDR(p, Izh_con_info, CCS_SYSTEM);
+    p->payload[0] = (StgClosure *)((HsInt *)env)[i];
+    return p;
+}
+
+HaskellObj
+rts_mkList (Capability *cap, HaskellObj *elems, StgWord n)
+{
+    return mkList(cap, n, CONSTR_sizeW(2,0), fillObj, elems);
+}
+
+HaskellObj
+rts_mkIntList (Capability *cap, HsInt *elems, StgWord n)
+{
+    return mkList(cap, n, CONSTR_sizeW(2,0) + CONSTR_sizeW(0,1),
+                  fillInt, elems);
+}
+
+// A ByteArray# holding a copy of the bytes at buf (if buf is not NULL).
+HaskellObj
+rts_mkByteArray (Capability *cap, void *buf, StgWord bytes)
+{
+    StgArrWords *arr;
+
+    arr = (StgArrWords *)allocate(cap, sizeofW(StgArrWords)
+                                       + ROUNDUP_BYTES_TO_WDS(bytes));
+    SET_ARR_HDR(arr, &stg_ARR_WORDS_info, CCS_SYSTEM, bytes);
+    if (buf != NULL) {
+        memcpy(arr->payload, buf, bytes);
+    }
+    return (StgClosure *)arr;
+}
+
+// A pinned ByteArray#, which stays where it is for as long as it is
+// alive.  The C caller can fill it in place through *contents, or hold
+// on to it instead of copying the bytes into a buffer of its own.
+HaskellObj
+rts_mkPinnedByteArray (Capability *cap, StgWord bytes, void **contents)
+{
+    StgArrWords *arr;
+
+    arr = (StgArrWords *)allocatePinned(cap, sizeofW(StgArrWords)
+                                             + ROUNDUP_BYTES_TO_WDS(bytes));
+    SET_ARR_HDR(arr, &stg_ARR_WORDS_info, CCS_SYSTEM, bytes);
+    *contents = arr->payload;
+    return (StgClosure *)arr;
+}
+
 HaskellObj
 rts_apply (Capability *cap, HaskellObj f, HaskellObj arg)
 {
@@ -373,6 +480,96 @@ rts_getBool (HaskellObj p)
     }
 }
 
+/* ----------------------------------------------------------------------------
+   Taking lists and arrays apart in bulk
+
+   rts_getList and rts_getIntList walk a list whose spine (and, for
+   rts_getIntList, whose elements) the caller has already evaluated,
+   e.g. with rts_eval of (length xs `seq` xs).  They store at most max
+   elements, and return the length of the list, or -1 if they found a
+   part of it that was not evaluated.
+   ------------------------------------------------------------------------- */
+
+// The constructor that p is, or evaluated to; NULL if it is unevaluated.
+static StgClosure *
+evaluatedCon (StgClosure *p)
+{
+    for (;;) {
+        p = UNTAG_CLOSURE(p);
+        switch (get_itbl(p)->type) {
+        case IND:
+        case IND_STATIC:
+            p = ((StgInd *)p)->indirectee;
+            continue;
+        case BLACKHOLE:
+            // evaluated if the indirectee is a value, not an owning TSO
+            p = ((StgInd *)p)->indirectee;
+            continue;
+        case CONSTR:
+        case CONSTR_1_0:
+        case CONSTR_0_1:
+        case CONSTR_2_0:
+        case CONSTR_1_1:
+        case CONSTR_0_2:
+        case CONSTR_STATIC:
+        case CONSTR_NOCAF_STATIC:
+            return p;
+        default:
+            return NULL;
+        }
+    }
+}
+
+static HsInt
+getList (HaskellObj list, HaskellObj *objs, HsInt *ints, StgWord max)
+{
+    StgClosure *p, *elem;
+    StgWord n;
+
+    n = 0;
+    for (;;) {
+        p = evaluatedCon(list);
+        if (p == NULL) return -1;
+        if (get_itbl(p)->srt_bitmap == 0) { // [] (the constructor tag)
+            return n;
+        }
+        if (n < max) {
+            if (objs != NULL) {
+                objs[n] = p->payload[0];
+            } else {
+                elem = evaluatedCon(p->payload[0]);
+                if (elem == NULL) return -1;
+                ints[n] = (HsInt)elem->payload[0];
+            }
+        }
+        n++;
+        list = p->payload[1];
+    }
+}
+
+HsInt
+rts_getList (HaskellObj list, HaskellObj *elems, StgWord max)
+{
+    return getList(list, elems, NULL, max);
+}
+
+HsInt
+rts_getIntList (HaskellObj list, HsInt *elems, StgWord max)
+{
+    return getList(list, NULL, elems, max);
+}
+
+// The contents of a ByteArray#.  Unless the array is pinned, they move
+// at the next GC, so copy them out before running Haskell code again.
+void *
+rts_getByteArray (HaskellObj p, StgWord *bytes)
+{
+    StgArrWords *arr = (StgArrWords *)UNTAG_CLOSURE(p);
+
+    *bytes = arr->bytes;
+    return arr->payload;
+}
+
 /* -----------------------------------------------------------------------------
    Creating threads
    -------------------------------------------------------------------------- */
@@ -420,6 +617,69 @@ createStrictIOThread(Capability *cap, W_ stack_size,  StgClosure *closure)
   return t;
 }
 
+/* ----------------------------------------------------------------------------
+   Fire-and-forget calls into Haskell
+
+   A call from C with rts_lock() and rts_evalIO() makes a bound thread,
+   and waits for a Capability and then for the result.  rts_evalAsync()
+   only queues the call on a Capability and returns: the Capability
+   starts an ordinary (unbound) thread for it at its next scheduling
+   point.  So it may be called from any OS thread, at any time, and
+   costs a malloc() and a cas(); the caller can't see the result, and
+   the action should catch its own exceptions.
+
+   Only the caller that makes the queue non-empty wakes up the
+   Capability, so a burst of calls costs one wakeup; the argument is
+   the same as for the inbox (see sendMessage() in Messages.c).
+
+   In the non-threaded RTS there is nobody to wake up: the calls must
+   come from the thread running the RTS (e.g. from a foreign call),
+   and start when it gets back to the scheduler.
+
+   The StablePtrs are not freed, so that a callback can be queued many
+   times without making a new one each time.
+   ------------------------------------------------------------------------- */
+
+static void
+queueAsyncCall (int capability, HsStablePtr fn, void *arg, rtsBool has_arg)
+{
+    Capability *cap;
+    AsyncCall *a, *old;
+
+    cap = capabilities[(nat)capability % enabled_capabilities];
+
+    a = stgMallocBytes(sizeof(AsyncCall), "queueAsyncCall");
+    a->fn      = (StgStablePtr)fn;
+    a->arg     = arg;
+    a->has_arg = has_arg;
+
+    do {
+        old = cap->async_calls;
+        a->link = old;
+    } while (cas((StgVolatilePtr)&cap->async_calls,
+                 (StgWord)old, (StgWord)a) != (StgWord)old);
+
+#if defined(THREADED_RTS)
+    if (old == NULL) {
+        wakeupCapability(cap);
+    }
+#endif
+}
+
+// Run the IO () action, on a fresh thread
+void
+rts_evalAsync (int capability, HsStablePtr action)
+{
+    queueAsyncCall(capability, action, NULL, rtsFalse);
+}
+
+// Run (fn arg), where fn :: Ptr a -> IO (), on a fresh thread
+void
+rts_evalAsyncPtr (int capability, HsStablePtr fn, HsPtr arg)
+{
+    queueAsyncCall(capability, fn, arg, rtsTrue);
+}
+
 /* ----------------------------------------------------------------------------
    Evaluating Haskell expressions
    ------------------------------------------------------------------------- */
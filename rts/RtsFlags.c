@@ -58,6 +58,8 @@ wchar_t **win32_prog_argv = NULL;
 #define RTS 1
 #define PGM 0
 
+#define MAX_TENURE_AGE 16
+
 /* -----------------------------------------------------------------------------
    Static function decls
    -------------------------------------------------------------------------- */
@@ -78,6 +80,11 @@ static void bad_option       (const char *s);
 
 #ifdef TRACING
 static void read_trace_flags(char *arg);
+static rtsBool read_trace_sampling(const char *arg);
+#endif
+
+#if defined(THREADED_RTS)
+static rtsBool parseCapPool (const char *arg);
 #endif
 
 static void errorUsage      (void) GNU_ATTRIBUTE(__noreturn__);
@@ -106,6 +113,8 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.initialStkSize     = 1024 / sizeof(W_);
     RtsFlags.GcFlags.stkChunkSize       = (32 * 1024) / sizeof(W_);
     RtsFlags.GcFlags.stkChunkBufferSize = (1 * 1024) / sizeof(W_);
+    RtsFlags.GcFlags.stkPauseSplitSize  = (8 * 1024) / sizeof(W_);
+    RtsFlags.GcFlags.stkGcSplitSize     = (8 * 1024) / sizeof(W_);
 
     RtsFlags.GcFlags.minAllocAreaSize   = (512 * 1024)        / BLOCK_SIZE;
     RtsFlags.GcFlags.nurseryChunkSize   = 0;
@@ -121,6 +130,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.GcFlags.compactThreshold   = 30.0;
     RtsFlags.GcFlags.sweep              = rtsFalse;
     RtsFlags.GcFlags.idleGCDelayTime    = USToTime(300000); // 300ms
+    RtsFlags.GcFlags.idleGCBudget       = 0;
 #ifdef THREADED_RTS
     RtsFlags.GcFlags.doIdleGC           = rtsTrue;
 #else
@@ -138,7 +148,25 @@ void initRtsFlagsDefaults(void)
 #else
     RtsFlags.GcFlags.heapBase           = 0;   /* means don't care */
 #endif
+#if SIZEOF_VOID_P == 8
+    RtsFlags.GcFlags.addressSpaceSize   = (StgWord)1 << 40; // 1TB
+#else
+    RtsFlags.GcFlags.addressSpaceSize   = 0;
+#endif
+    RtsFlags.GcFlags.hugePages          = rtsFalse;
+    RtsFlags.GcFlags.hugePageSize       = 0;
     RtsFlags.GcFlags.allocLimitGrace    = (100*1024) / BLOCK_SIZE;
+    RtsFlags.GcFlags.numa               = rtsFalse;
+    RtsFlags.GcFlags.numaMask           = 1;
+    RtsFlags.GcFlags.autoNursery        = rtsFalse;
+    RtsFlags.GcFlags.autoNurseryPause   = USToTime(10000); // 10ms
+    RtsFlags.GcFlags.gcOverhead         = 0;
+    RtsFlags.GcFlags.decommitAge        = 0;
+    RtsFlags.GcFlags.decommitRate       = 64 * 1024 * 1024; // 64MB/s
+    RtsFlags.GcFlags.tenureAge          = 0;    /* see normaliseRtsOpts */
+    RtsFlags.GcFlags.adaptiveTenure     = rtsFalse;
+    RtsFlags.GcFlags.softHeapLimit      = 0;    /* off by default */
+    RtsFlags.GcFlags.cFinalizersInGC    = rtsFalse;
 
 #ifdef DEBUG
     RtsFlags.DebugFlags.scheduler       = rtsFalse;
@@ -156,6 +184,8 @@ void initRtsFlagsDefaults(void)
     RtsFlags.DebugFlags.squeeze         = rtsFalse;
     RtsFlags.DebugFlags.hpc             = rtsFalse;
     RtsFlags.DebugFlags.sparks          = rtsFalse;
+    RtsFlags.DebugFlags.sanity_sample   = 1;
+    RtsFlags.DebugFlags.trace_buffer    = 0;
 #endif
 
 #if defined(PROFILING)
@@ -164,11 +194,15 @@ void initRtsFlagsDefaults(void)
 
     RtsFlags.ProfFlags.doHeapProfile      = rtsFalse;
     RtsFlags.ProfFlags. heapProfileInterval = USToTime(100000); // 100ms
+    RtsFlags.ProfFlags.binaryHeapProfile  = rtsFalse;
+    RtsFlags.ProfFlags.eventlogHeapProfile = rtsFalse;
 
 #ifdef PROFILING
     RtsFlags.ProfFlags.includeTSOs        = rtsFalse;
     RtsFlags.ProfFlags.showCCSOnException = rtsFalse;
     RtsFlags.ProfFlags.maxRetainerSetSize = 8;
+    RtsFlags.ProfFlags.retainerSampleRoots = 0;
+    RtsFlags.ProfFlags.ldvSampleEras      = 1;
     RtsFlags.ProfFlags.ccsLength          = 25;
     RtsFlags.ProfFlags.modSelector        = NULL;
     RtsFlags.ProfFlags.descrSelector      = NULL;
@@ -187,6 +221,16 @@ void initRtsFlagsDefaults(void)
     RtsFlags.TraceFlags.sparks_sampled= rtsFalse;
     RtsFlags.TraceFlags.sparks_full   = rtsFalse;
     RtsFlags.TraceFlags.user          = rtsFalse;
+    RtsFlags.TraceFlags.async_writer  = rtsFalse;
+    RtsFlags.TraceFlags.sink          = NULL;
+    RtsFlags.TraceFlags.ring_size     = 0;
+    RtsFlags.TraceFlags.compact       = rtsFalse;
+    RtsFlags.TraceFlags.stack_sample_ticks = 0;
+    RtsFlags.TraceFlags.alloc_sample_bytes = 0;
+    RtsFlags.TraceFlags.sched_sample  = 1;
+    RtsFlags.TraceFlags.spark_sample  = 1;
+    RtsFlags.TraceFlags.toggle_classes = NULL;
+    RtsFlags.TraceFlags.toggle_time   = 0;
 #endif
 
 #ifdef PROFILING
@@ -196,10 +240,20 @@ void initRtsFlagsDefaults(void)
     RtsFlags.MiscFlags.tickInterval     = DEFAULT_TICK_INTERVAL;
 #endif
     RtsFlags.ConcFlags.ctxtSwitchTime   = USToTime(20000); // 20ms
+    RtsFlags.ConcFlags.stmContention    = STM_CONTENTION_NONE;
 
     RtsFlags.MiscFlags.install_signal_handlers = rtsTrue;
     RtsFlags.MiscFlags.machineReadable = rtsFalse;
     RtsFlags.MiscFlags.linkerMemBase    = 0;
+    RtsFlags.MiscFlags.linkerThreads    = 0;
+    RtsFlags.MiscFlags.linkerCache      = NULL;
+    RtsFlags.MiscFlags.perfCounters     = rtsFalse;
+    RtsFlags.MiscFlags.threadCPUTime    = rtsFalse;
+    RtsFlags.MiscFlags.metricsShm       = NULL;
+    RtsFlags.MiscFlags.heapSnapshotSignal = rtsFalse;
+    RtsFlags.MiscFlags.heapImage        = NULL;
+    RtsFlags.MiscFlags.fastExit         = rtsFalse;
+    RtsFlags.MiscFlags.clockSource      = CLOCK_SOURCE_MONOTONIC;
 
 #ifdef THREADED_RTS
     RtsFlags.ParFlags.nNodes            = 1;
@@ -209,7 +263,18 @@ void initRtsFlagsDefaults(void)
     RtsFlags.ParFlags.parGcLoadBalancingEnabled = rtsTrue;
     RtsFlags.ParFlags.parGcLoadBalancingGen = 1;
     RtsFlags.ParFlags.parGcNoSyncWithIdle   = 0;
+    RtsFlags.ParFlags.parGcThreads      = 0;
+    RtsFlags.ParFlags.parGcAuto         = rtsFalse;
     RtsFlags.ParFlags.setAffinity       = 0;
+    RtsFlags.ParFlags.affinityPolicy    = AFFINITY_MODULO;
+    RtsFlags.ParFlags.stealThreads      = rtsFalse;
+    RtsFlags.ParFlags.maxSpareWorkers   = MAX_SPARE_WORKERS;
+    RtsFlags.ParFlags.workerIdleTimeout = 0;
+    RtsFlags.ParFlags.elastic           = rtsFalse;
+    RtsFlags.ParFlags.elasticInterval   = USToTime(1000000); // 1s
+    RtsFlags.ParFlags.sparkThrottle     = rtsFalse;
+    RtsFlags.ParFlags.handoffSpin       = 1000;
+    RtsFlags.ParFlags.nCapPools         = 0;
 #endif
 
 #if defined(THREADED_RTS)
@@ -248,12 +313,43 @@ usage_text[] = {
 "  -ki<size> Sets the initial thread stack size (default 1k)  Egs: -ki4k -ki2m",
 "  -kc<size> Sets the stack chunk size (default 32k)",
 "  -kb<size> Sets the stack chunk buffer size (default 1k)",
+"  -ks<size> Split the stack when a thread stops with more than <size>",
+"            of it not yet scanned for lazy blackholing (default 8k, 0: never)",
+"  -kg<size> Split the stack before a thread runs when the last GC found",
+"            more than <size> of it clean (default 8k, 0: never)",
 "",
 "  -A<size> Sets the minimum allocation area size (default 512k) Egs: -A1m -A10k",
+"  --auto-nursery[=<secs>]",
+"           Size the allocation area automatically, starting from the",
+"           CPU cache size and growing it as long as minor GC pauses stay",
+"           under <secs> (default: 0.01).  -A gives the minimum size.",
 "  -M<size> Sets the maximum heap size (default unlimited)  Egs: -M256k -M1G",
+"  --soft-heap-limit=<size>",
+"           Do major GCs more often, compact the oldest generation and run",
+"           the memory pressure handlers (System.Mem) as the heap grows",
+"           past <size>",
+"  --decommit-age=<secs>",
+"           Give free memory back to the OS in the background once it has",
+"           been free for <secs>, rather than after each major GC",
+"  --decommit-rate=<size>",
+"           Give back at most <size> per second (default: 64m)",
+#if defined(THREADED_RTS)
+"  --c-finalizers-in-gc",
+"           Run the C finalizers of dead weak pointers (ForeignPtrs) during",
+"           the GC, rather than in a thread of their own",
+#endif
 "  -H<size> Sets the minimum heap size (default 0M)   Egs: -H24m  -H1G",
+"  --gc-overhead=<percent>",
+"           Adjust -F after each major GC to keep the share of CPU time",
+"           spent in GC near <percent>",
 "  -m<n>    Minimum % of heap which must be available (default 3%)",
 "  -G<n>    Number of generations (default: 2)",
+"  --tenure-age=<n>",
+"           Promote objects out of generation 0 after they survive <n>",
+"           GCs (default: 2); <n>-2 extra generations hold them meanwhile",
+"  --adaptive-tenure",
+"           Vary the tenure age between 2 and the --tenure-age",
+"           (default: 4) with the amount of data that gets promoted",
 "  -c<n>    Use in-place compaction instead of copying in the oldest generation",
 "           when live data is at least <n>% of the maximum heap size set with",
 "           -M (default: 30%)",
@@ -262,6 +358,10 @@ usage_text[] = {
 "  -w       Use mark-region for the oldest generation (experimental)",
 #if defined(THREADED_RTS)
 "  -I<sec>  Perform full GC after <sec> idle time (default: 0.3, 0 == off)",
+"  -Ibudget=<ms>",
+"           Collect each generation in turn when idle, only while the last",
+"           collection of the next took at most <ms>, and stop when there",
+"           is work to do",
 #endif
 "",
 "  -T         Collect GC statistics (useful for in-program statistics access)",
@@ -295,8 +395,14 @@ usage_text[] = {
 "    -hy<typ>...  closures with specified type descriptions",
 "    -hr<cc>...   closures with specified retainers",
 "    -hb<bio>...  closures with specified biographies (lag,drag,void,use)",
+"  --ldv-sample-eras=<n>",
+"                 Only follow the closures created in one in <n> eras",
+"                 (censuses) in a -hb profile, and scale up the results",
 "",
 "  -R<size>       Set the maximum retainer set size (default: 8)",
+"  --retainer-sample-roots=<n>",
+"                 Only traverse from one in <n> roots in each retainer",
+"                 profile, a different one each time",
 "",
 "  -L<chars>      Maximum length of a cost-centre stack in a heap profile",
 "                 (default: 25)",
@@ -325,6 +431,39 @@ usage_text[] = {
 #  endif
 "               -x    disable an event class, for any flag above",
 "             the initial enabled event classes are 'sgpu'",
+"  --eventlog-sink=<sink>",
+"             Send the -l eventlog to <sink> instead of <program>.eventlog:",
+"                file:<path>  the file <path>",
+"                fd:<n>       the already-open file descriptor <n>",
+#  if !defined(mingw32_HOST_OS)
+"                unix:<path>  the Unix domain socket <path>",
+#  endif
+"                none         nowhere (for rts_subscribeEventLog())",
+#  if defined(THREADED_RTS)
+"  --eventlog-async",
+"             Write the eventlog from a background thread",
+#  endif
+"  --eventlog-ring=<size>",
+"             Keep only the last <size> bytes of events per capability in",
+"             memory, and write them out at exit, on SIGUSR2, or when",
+"             hs_dump_eventlog() is called",
+"  --eventlog-sample=<class><n>[,<class><n>...]",
+"             Log only 1 in <n> of each kind of event of the class 's' or",
+"             'f' on each capability",
+#  if !defined(mingw32_HOST_OS)
+"  --eventlog-toggle=<classes>[,<secs>]",
+"             On SIGUSR2, turn on the -l<classes> for <secs> (default:",
+"             until the next SIGUSR2); not with --eventlog-ring",
+#  endif
+"  --eventlog-compact",
+"             Write the eventlog in the compact format, which most tools",
+"             that read eventlogs don't understand yet",
+"  --sample-stacks[=<n>]",
+"             Every <n> ticks (default: 1, see -V), log the return frames",
+"             on the stack of the thread running on each capability",
+"  --alloc-sample=<size>",
+"             Every <size> bytes allocated by each capability, log the",
+"             code that is allocating",
 #endif
 
 #if !defined(PROFILING)
@@ -332,6 +471,12 @@ usage_text[] = {
 "  -h       Heap residency profile (output file <program>.hp)",
 #endif
 "  -i<sec>  Time between heap profile samples (seconds, default: 0.1)",
+"  --binary-heap-profile",
+"           Write the heap profile in the compact binary format (hp2ps",
+"           reads both)",
+"  --eventlog-heap-profile",
+"           Write the heap profile samples to the eventlog (implies -l)",
+"           instead of the .hp file",
 "",
 #if defined(TICKY_TICKY)
 "  -r<file>  Produce ticky-ticky statistics (with -rstderr for stderr)",
@@ -340,6 +485,10 @@ usage_text[] = {
 "  -C<secs>  Context-switch interval in seconds.",
 "            0 or no argument means switch as often as possible.",
 "            Default: 0.02 sec.",
+"  --stm-contention=<policy>",
+"           What a transaction does when its commit fails: none (re-run it",
+"           at once, the default) or backoff (wait a randomised time that",
+"           doubles with each consecutive failure)",
 "  -V<secs>  Master tick interval in seconds (0 == disable timer).",
 "            This sets the resolution for -C and the heap profile timer -i,",
 "            and is the frequence of time profile samples.",
@@ -365,6 +514,11 @@ usage_text[] = {
 "  -Dz  DEBUG: stack squeezing",
 "  -Dc  DEBUG: program coverage",
 "  -Dr  DEBUG: sparks",
+"  --sanity-sample=<n>  With -DS, check only about one heap block in <n>",
+"            at each GC (default: 1, check them all)",
+"  --debug-trace-buffer=<size>  Keep up to <size> bytes of the -D and -v",
+"            output of each OS thread in memory, and write it out in time",
+"            order when a buffer fills up and at exit",
 "",
 "     NOTE: DEBUG events are sent to stderr by default; add -l to create a",
 "     binary event log file instead.",
@@ -377,21 +531,89 @@ usage_text[] = {
 "            (default: 0, -qg alone turns off parallel GC)",
 "  -qb[<n>]  Use load-balancing in the parallel GC only for generations >= <n>",
 "            (default: 1, -qb alone turns off load-balancing)",
+"  -qn[<n>]  Use at most <n> threads in the parallel GC (default: all),",
+"            -qn alone chooses the number for each GC by its size",
 "  -qa       Use the OS to set thread affinity (experimental)",
+"  -qa=<policy>  Pin threads using the CPU topology, where <policy> is",
+"            compact, scatter or physical (see the User's Guide)",
 "  -qm       Don't automatically migrate threads between CPUs",
+"  -qs       Idle CPUs ask busy ones for threads to run (work stealing)",
+"  -qt       Drop sparks early while most of them fizzle (spark throttling)",
 "  -qi<n>    If a processor has been idle for the last <n> GCs, do not",
 "            wake it up for a non-load-balancing parallel GC.",
 "            (0 disables,  default: 0)",
 #endif
 "  --install-signal-handlers=<yes|no>",
 "            Install signal handlers (default: yes)",
+#if defined(linux_HOST_OS)
+"  --perf-counters",
+"            Count CPU cycles, instructions, cache and TLB misses for the",
+"            mutator and each phase of the GC (reported by -s and -lg)",
+#endif
+"  --thread-cpu-time",
+"            Count the CPU time used by each Haskell thread",
+"  --fast-exit",
+"            When the program exits, skip the final GC, the finalizers",
+"            and freeing memory; only flush the handles and write the",
+"            statistics, profiles and eventlog",
+"  --clock=<monotonic|tsc|coarse>",
+"            Timestamp eventlog events and trace output with the OS's",
+"            monotonic clock (the default), the CPU's cycle counter, or",
+"            the OS's coarse monotonic clock (Linux only)",
+#if !defined(mingw32_HOST_OS)
+"  --metrics-shm=<name>",
+"            Keep live GC and scheduler statistics in the POSIX shared",
+"            memory object <name>, for monitoring tools to read",
+"  --heap-snapshot-signal",
+"            Write a snapshot of the heap to <program>.<n>.snapshot on",
+"            SIGUSR1 (see also hs_heap_snapshot())",
+#endif
+#if defined(linux_HOST_OS) && !defined(PROFILING)
+"  --heap-image=<file>",
+"            Start with the values of the CAFs saved in <file> by an",
+"            earlier run of the program (see System.Mem.saveHeapImage)",
+#endif
 #if defined(THREADED_RTS)
+"  --numa[=<node_mask>]",
+"            Use NUMA-aware memory allocation, optionally restricted to",
+"            the nodes in <node_mask> (default: all available nodes)",
+"  --spare-workers=<n>",
+"            Keep up to <n> idle OS threads per CPU for making safe",
+"            foreign calls (default: 6)",
+"  --handoff-spin=<n>",
+"            Check <n> times for the CPU to come back before sleeping, in",
+"            an OS thread that has passed it to a bound thread (default: 1000)",
+"  --worker-idle-timeout=<secs>",
+"            An idle OS thread exits after <secs>, keeping one per CPU",
+"            (default: 0, never)",
+"  --elastic-capabilities[=<secs>]",
+"            Every <secs> (default: 1), enable or disable some of the -N",
+"            capabilities to suit the load and the cgroup CPU quota",
+"  --cap-pool=<name>:<n>[,cpu=<cpu>][,C=<secs>]",
+"            Keep the threads and sparks of <n> capabilities to themselves,",
+"            optionally bound to the CPUs from <cpu> and with their own",
+"            context switch interval (may be given up to 8 times)",
 "  -e<n>     Maximum number of outstanding local sparks (default: 4096)",
 #endif
+"  -xH[<size>]  Back the heap with huge pages of the given size",
+"            (default: the OS default, usually 2m)",
+#if defined(USE_LARGE_ADDRESS_SPACE)
+"  -xr<size> Address space to reserve for the heap (default: 1T)",
+#endif
 #if defined(x86_64_HOST_ARCH)
 "  -xm       Base address to mmap memory in the GHCi linker",
 "            (hex; must be <80000000)",
 #endif
+#if defined(THREADED_RTS)
+"  --linker-threads=<n>",
+"            Relocate the objects loaded by the GHCi linker on <n> threads",
+"            (default: one per processor)",
+#endif
+#if !defined(mingw32_HOST_OS)
+"  --linker-cache=<dir>",
+"            Keep the objects relocated by the GHCi linker in <dir>, and",
+"            reuse them when they are loaded at the same address again",
+#endif
 #if defined(USE_PAPI)
 "  -aX       CPU performance counter measurements using PAPI",
 "            (use with the -s<file> option).  X is one of:",
@@ -728,6 +950,420 @@ error = rtsTrue;
                       printRtsInfo();
                       stg_exit(0);
                   }
+                  else if (strequal("thread-cpu-time",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.MiscFlags.threadCPUTime = rtsTrue;
+                  }
+                  else if (strequal("perf-counters",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+#if defined(linux_HOST_OS)
+                      RtsFlags.MiscFlags.perfCounters = rtsTrue;
+#else
+                      errorBelch("%s: only supported on Linux",
+                                 rts_argv[arg]);
+                      error = rtsTrue;
+#endif
+                  }
+                  else if (!strncmp("retainer-sample-roots=",
+                                    &rts_argv[arg][2], 22)) {
+                      OPTION_SAFE;
+                      PROFILING_BUILD_ONLY(
+                          RtsFlags.ProfFlags.retainerSampleRoots =
+                              strtol(rts_argv[arg]+24, (char **)NULL, 10);
+                          );
+                  }
+                  else if (!strncmp("ldv-sample-eras=",
+                                    &rts_argv[arg][2], 16)) {
+                      OPTION_SAFE;
+                      PROFILING_BUILD_ONLY(
+                          RtsFlags.ProfFlags.ldvSampleEras =
+                              strtol(rts_argv[arg]+18, (char **)NULL, 10);
+                          if (RtsFlags.ProfFlags.ldvSampleEras == 0) {
+                              bad_option(rts_argv[arg]);
+                          }
+                          );
+                  }
+                  else if (strequal("binary-heap-profile",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.ProfFlags.binaryHeapProfile = rtsTrue;
+                  }
+                  else if (strequal("eventlog-heap-profile",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.ProfFlags.eventlogHeapProfile = rtsTrue;
+                          RtsFlags.TraceFlags.tracing = TRACE_EVENTLOG;
+                          );
+                  }
+                  else if (!strncmp("linker-threads=",
+                                    &rts_argv[arg][2], 15)) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          if (!isdigit(rts_argv[arg][17])) {
+                              bad_option(rts_argv[arg]);
+                          }
+                          RtsFlags.MiscFlags.linkerThreads =
+                              strtol(rts_argv[arg]+17, (char **)NULL, 10);
+                          );
+                  }
+                  else if (!strncmp("linker-cache=", &rts_argv[arg][2], 13)) {
+                      OPTION_UNSAFE;
+#if !defined(mingw32_HOST_OS)
+                      if (rts_argv[arg][15] == '\0') {
+                          errorBelch("%s: missing directory", rts_argv[arg]);
+                          error = rtsTrue;
+                      } else {
+                          RtsFlags.MiscFlags.linkerCache = &rts_argv[arg][15];
+                      }
+#else
+                      errorBelch("%s: not supported on Windows",
+                                 rts_argv[arg]);
+                      error = rtsTrue;
+#endif
+                  }
+                  else if (!strncmp("metrics-shm=", &rts_argv[arg][2], 12)) {
+                      OPTION_UNSAFE;
+#if !defined(mingw32_HOST_OS)
+                      if (rts_argv[arg][14] == '\0') {
+                          errorBelch("%s: missing name", rts_argv[arg]);
+                          error = rtsTrue;
+                      } else {
+                          RtsFlags.MiscFlags.metricsShm = &rts_argv[arg][14];
+                      }
+#else
+                      errorBelch("%s: not supported on Windows",
+                                 rts_argv[arg]);
+                      error = rtsTrue;
+#endif
+                  }
+                  else if (strequal("heap-snapshot-signal",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+#if !defined(mingw32_HOST_OS)
+                      RtsFlags.MiscFlags.heapSnapshotSignal = rtsTrue;
+#else
+                      errorBelch("%s: not supported on Windows",
+                                 rts_argv[arg]);
+                      error = rtsTrue;
+#endif
+                  }
+                  else if (!strncmp("heap-image=", &rts_argv[arg][2], 11)) {
+                      OPTION_UNSAFE;
+#if defined(linux_HOST_OS) && !defined(PROFILING)
+                      if (rts_argv[arg][13] == '\0') {
+                          errorBelch("%s: missing file", rts_argv[arg]);
+                          error = rtsTrue;
+                      } else {
+                          RtsFlags.MiscFlags.heapImage = &rts_argv[arg][13];
+                      }
+#else
+                      errorBelch("%s: only supported on Linux, without "
+                                 "profiling", rts_argv[arg]);
+                      error = rtsTrue;
+#endif
+                  }
+                  else if (strequal("fast-exit",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.MiscFlags.fastExit = rtsTrue;
+                  }
+                  else if (!strncmp("clock=", &rts_argv[arg][2], 6)) {
+                      OPTION_SAFE;
+                      if (strequal("monotonic", &rts_argv[arg][8])) {
+                          RtsFlags.MiscFlags.clockSource =
+                              CLOCK_SOURCE_MONOTONIC;
+                      } else if (strequal("tsc", &rts_argv[arg][8])) {
+                          RtsFlags.MiscFlags.clockSource = CLOCK_SOURCE_TSC;
+                      } else if (strequal("coarse", &rts_argv[arg][8])) {
+                          RtsFlags.MiscFlags.clockSource =
+                              CLOCK_SOURCE_COARSE;
+                      } else {
+                          errorBelch("%s: unknown clock", rts_argv[arg]);
+                          error = rtsTrue;
+                      }
+                  }
+                  else if (!strncmp("sanity-sample=",
+                                    &rts_argv[arg][2], 14)) {
+                      OPTION_SAFE;
+                      DEBUG_BUILD_ONLY(
+                          RtsFlags.DebugFlags.sanity_sample =
+                              strtol(rts_argv[arg]+16, (char **) NULL, 10);
+                          if (RtsFlags.DebugFlags.sanity_sample == 0) {
+                              errorBelch("%s: must be at least 1",
+                                         rts_argv[arg]);
+                              error = rtsTrue;
+                          }
+                          );
+                  }
+                  else if (!strncmp("debug-trace-buffer=",
+                                    &rts_argv[arg][2], 19)) {
+                      OPTION_SAFE;
+                      DEBUG_BUILD_ONLY(
+                          RtsFlags.DebugFlags.trace_buffer =
+                              decodeSize(rts_argv[arg], 21, 64*1024,
+                                         HS_WORD_MAX);
+                          );
+                  }
+#if defined(THREADED_RTS)
+                  else if (!strncmp("numa", &rts_argv[arg][2], 4)) {
+                      OPTION_SAFE;
+                      StgWord mask;
+                      if (rts_argv[arg][6] == '=') {
+                          mask = (StgWord)strtol(rts_argv[arg]+7,
+                                                 (char **)NULL, 10);
+                      } else if (rts_argv[arg][6] == '\0') {
+                          mask = (StgWord)~0;
+                      } else {
+                          errorBelch("%s: unknown numa option",
+                                     rts_argv[arg]);
+                          error = rtsTrue;
+                          break;
+                      }
+                      if (!osNumaAvailable()) {
+                          errorBelch("%s: OS reports NUMA is not available",
+                                     rts_argv[arg]);
+                          error = rtsTrue;
+                          break;
+                      }
+
+                      RtsFlags.GcFlags.numa = rtsTrue;
+                      RtsFlags.GcFlags.numaMask = mask;
+                  }
+#endif
+                  else if (!strncmp("spare-workers=", &rts_argv[arg][2], 14)) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.ParFlags.maxSpareWorkers
+                              = strtol(rts_argv[arg]+16, (char **) NULL, 10);
+                          );
+                  }
+                  else if (!strncmp("handoff-spin=", &rts_argv[arg][2], 13)) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.ParFlags.handoffSpin
+                              = strtol(rts_argv[arg]+15, (char **) NULL, 10);
+                          );
+                  }
+                  else if (!strncmp("worker-idle-timeout=",
+                                    &rts_argv[arg][2], 20)) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          Time t = fsecondsToTime(atof(rts_argv[arg]+22));
+                          if (t < 0) {
+                              errorBelch("%s: timeout must not be negative",
+                                         rts_argv[arg]);
+                              error = rtsTrue;
+                              break;
+                          }
+                          RtsFlags.ParFlags.workerIdleTimeout = t;
+                          );
+                  }
+                  else if (!strncmp("elastic-capabilities",
+                                    &rts_argv[arg][2], 20)) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          if (rts_argv[arg][22] == '=') {
+                              Time t = fsecondsToTime(atof(rts_argv[arg]+23));
+                              if (t <= 0) {
+                                  errorBelch("%s: interval must be positive",
+                                             rts_argv[arg]);
+                                  error = rtsTrue;
+                                  break;
+                              }
+                              RtsFlags.ParFlags.elasticInterval = t;
+                          } else if (rts_argv[arg][22] != '\0') {
+                              errorBelch("unknown RTS option: %s",rts_argv[arg]);
+                              error = rtsTrue;
+                              break;
+                          }
+                          RtsFlags.ParFlags.elastic = rtsTrue;
+                          );
+                  }
+                  else if (!strncmp("cap-pool=", &rts_argv[arg][2], 9)) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          if (!parseCapPool(rts_argv[arg])) {
+                              error = rtsTrue;
+                              break;
+                          }
+                          );
+                  }
+                  else if (!strncmp("auto-nursery", &rts_argv[arg][2], 12)) {
+                      OPTION_UNSAFE;
+                      if (rts_argv[arg][14] == '=') {
+                          Time t = fsecondsToTime(atof(rts_argv[arg]+15));
+                          if (t <= 0) {
+                              errorBelch("%s: pause must be positive",
+                                         rts_argv[arg]);
+                              error = rtsTrue;
+                              break;
+                          }
+                          RtsFlags.GcFlags.autoNurseryPause = t;
+                      } else if (rts_argv[arg][14] != '\0') {
+                          errorBelch("unknown RTS option: %s",rts_argv[arg]);
+                          error = rtsTrue;
+                          break;
+                      }
+                      RtsFlags.GcFlags.autoNursery = rtsTrue;
+                  }
+                  else if (!strncmp("gc-overhead=", &rts_argv[arg][2], 12)) {
+                      OPTION_UNSAFE;
+                      double pc = atof(rts_argv[arg]+14);
+                      if (pc <= 0 || pc >= 100) {
+                          errorBelch("%s: percentage must be between 0 and 100",
+                                     rts_argv[arg]);
+                          error = rtsTrue;
+                          break;
+                      }
+                      RtsFlags.GcFlags.gcOverhead = pc / 100;
+                  }
+                  else if (!strncmp("decommit-age=", &rts_argv[arg][2], 13)) {
+                      OPTION_UNSAFE;
+                      Time t = fsecondsToTime(atof(rts_argv[arg]+15));
+                      if (t <= 0) {
+                          errorBelch("%s: age must be positive",
+                                     rts_argv[arg]);
+                          error = rtsTrue;
+                          break;
+                      }
+                      RtsFlags.GcFlags.decommitAge = t;
+                  }
+                  else if (!strncmp("tenure-age=", &rts_argv[arg][2], 11)) {
+                      OPTION_UNSAFE;
+                      int n = atoi(rts_argv[arg]+13);
+                      if (n < 2 || n > MAX_TENURE_AGE) {
+                          errorBelch("%s: the age must be between 2 and %d",
+                                     rts_argv[arg], MAX_TENURE_AGE);
+                          error = rtsTrue;
+                          break;
+                      }
+                      RtsFlags.GcFlags.tenureAge = n;
+                  }
+                  else if (strequal("adaptive-tenure",
+                                    &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.adaptiveTenure = rtsTrue;
+                  }
+                  else if (!strncmp("soft-heap-limit=",
+                                    &rts_argv[arg][2], 16)) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.softHeapLimit =
+                          decodeSize(rts_argv[arg], 18, BLOCK_SIZE,
+                                     HS_WORD_MAX) / BLOCK_SIZE;
+                  }
+                  else if (strequal("c-finalizers-in-gc",
+                                    &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.GcFlags.cFinalizersInGC = rtsTrue;
+                          );
+                  }
+                  else if (!strncmp("decommit-rate=", &rts_argv[arg][2], 14)) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.decommitRate =
+                          (StgWord)decodeSize(rts_argv[arg], 16, MBLOCK_SIZE,
+                                              HS_WORD_MAX);
+                  }
+                  else if (!strncmp("stm-contention=",
+                                    &rts_argv[arg][2], 15)) {
+                      OPTION_SAFE;
+                      if (strequal("none", &rts_argv[arg][17])) {
+                          RtsFlags.ConcFlags.stmContention =
+                              STM_CONTENTION_NONE;
+                      } else if (strequal("backoff", &rts_argv[arg][17])) {
+                          RtsFlags.ConcFlags.stmContention =
+                              STM_CONTENTION_BACKOFF;
+                      } else {
+                          errorBelch("%s: unknown contention manager",
+                                     rts_argv[arg]);
+                          error = rtsTrue;
+                      }
+                  }
+                  else if (!strncmp("eventlog-sink=", &rts_argv[arg][2], 14)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          if (rts_argv[arg][16] == '\0') {
+                              errorBelch("%s: missing sink", rts_argv[arg]);
+                              error = rtsTrue;
+                          } else {
+                              RtsFlags.TraceFlags.sink = rts_argv[arg]+16;
+                          }
+                          );
+                  }
+                  else if (!strncmp("eventlog-ring=", &rts_argv[arg][2], 14)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.ring_size =
+                              decodeSize(rts_argv[arg], 16, 64*1024,
+                                         HS_WORD_MAX);
+                          );
+                  }
+                  else if (!strncmp("eventlog-sample=", &rts_argv[arg][2], 16)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          if (!read_trace_sampling(rts_argv[arg])) {
+                              error = rtsTrue;
+                          }
+                          );
+                  }
+#if !defined(mingw32_HOST_OS)
+                  else if (!strncmp("eventlog-toggle=", &rts_argv[arg][2], 16)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          char *comma;
+                          RtsFlags.TraceFlags.toggle_classes =
+                              copyArg(rts_argv[arg] + 18);
+                          comma = strchr(RtsFlags.TraceFlags.toggle_classes, ',');
+                          if (comma != NULL) {
+                              *comma = '\0';
+                              RtsFlags.TraceFlags.toggle_time =
+                                  fsecondsToTime(atof(comma + 1));
+                          }
+                          );
+                  }
+#endif
+                  else if (!strncmp("alloc-sample=", &rts_argv[arg][2], 13)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.alloc_sample_bytes =
+                              decodeSize(rts_argv[arg], 15, 1, HS_WORD_MAX);
+                          );
+                  }
+                  else if (!strncmp("sample-stacks", &rts_argv[arg][2], 13)) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          if (rts_argv[arg][15] == '=') {
+                              RtsFlags.TraceFlags.stack_sample_ticks =
+                                  (nat)strtol(rts_argv[arg]+16,
+                                              (char **)NULL, 10);
+                          } else if (rts_argv[arg][15] == '\0') {
+                              RtsFlags.TraceFlags.stack_sample_ticks = 1;
+                          } else {
+                              errorBelch("unknown RTS option: %s",
+                                         rts_argv[arg]);
+                              error = rtsTrue;
+                          }
+                          );
+                  }
+                  else if (strequal("eventlog-compact",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.compact = rtsTrue;
+                          );
+                  }
+                  else if (strequal("eventlog-async",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          THREADED_BUILD_ONLY(
+                              RtsFlags.TraceFlags.async_writer = rtsTrue;
+                              );
+                          );
+                  }
                   else {
                       OPTION_SAFE;
                       errorBelch("unknown RTS option: %s",rts_argv[arg]);
@@ -900,6 +1536,14 @@ error = rtsTrue;
                   RtsFlags.GcFlags.initialStkSize =
                       decodeSize(rts_argv[arg], 3, sizeof(W_), HS_WORD_MAX) / sizeof(W_);
                   break;
+                case 's':
+                  RtsFlags.GcFlags.stkPauseSplitSize =
+                      decodeSize(rts_argv[arg], 3, 0, HS_WORD_MAX) / sizeof(W_);
+                  break;
+                case 'g':
+                  RtsFlags.GcFlags.stkGcSplitSize =
+                      decodeSize(rts_argv[arg], 3, 0, HS_WORD_MAX) / sizeof(W_);
+                  break;
                 default:
                   RtsFlags.GcFlags.initialStkSize =
                       decodeSize(rts_argv[arg], 2, sizeof(W_), HS_WORD_MAX) / sizeof(W_);
@@ -943,6 +1587,15 @@ error = rtsTrue;
                 OPTION_UNSAFE;
                 if (rts_argv[arg][2] == '\0') {
                   /* use default */
+                } else if (!strncmp("budget=", &rts_argv[arg][2], 7)) {
+                    Time t = fsecondsToTime(atof(rts_argv[arg]+9) / 1000);
+                    if (t <= 0) {
+                        errorBelch("%s: budget must be positive",
+                                   rts_argv[arg]);
+                        error = rtsTrue;
+                        break;
+                    }
+                    RtsFlags.GcFlags.idleGCBudget = t;
                 } else {
                     Time t = fsecondsToTime(atof(rts_argv[arg]+2));
                     if (t == 0) {
@@ -1256,16 +1909,48 @@ error = rtsTrue;
                                 = strtol(rts_argv[arg]+3, (char **) NULL, 10);
                         }
                         break;
+                    case 'n':
+                        if (rts_argv[arg][3] == '\0') {
+                            RtsFlags.ParFlags.parGcAuto = rtsTrue;
+                        } else {
+                            int threads;
+                            threads = strtol(rts_argv[arg]+3, (char **) NULL, 10);
+                            if (threads <= 0) {
+                                errorBelch("-qn must be at least 1");
+                                error = rtsTrue;
+                            } else {
+                                RtsFlags.ParFlags.parGcThreads = threads;
+                            }
+                        }
+                        break;
                     case 'i':
                         RtsFlags.ParFlags.parGcNoSyncWithIdle
                             = strtol(rts_argv[arg]+3, (char **) NULL, 10);
                         break;
                     case 'a':
                         RtsFlags.ParFlags.setAffinity = rtsTrue;
+                        if (rts_argv[arg][3] == '\0') {
+                            RtsFlags.ParFlags.affinityPolicy = AFFINITY_MODULO;
+                        } else if (strequal(rts_argv[arg]+3, "=compact")) {
+                            RtsFlags.ParFlags.affinityPolicy = AFFINITY_COMPACT;
+                        } else if (strequal(rts_argv[arg]+3, "=scatter")) {
+                            RtsFlags.ParFlags.affinityPolicy = AFFINITY_SCATTER;
+                        } else if (strequal(rts_argv[arg]+3, "=physical")) {
+                            RtsFlags.ParFlags.affinityPolicy = AFFINITY_PHYSICAL;
+                        } else {
+                            errorBelch("unknown RTS option: %s",rts_argv[arg]);
+                            error = rtsTrue;
+                        }
                         break;
                     case 'm':
                         RtsFlags.ParFlags.migrate = rtsFalse;
                         break;
+                    case 's':
+                        RtsFlags.ParFlags.stealThreads = rtsTrue;
+                        break;
+                    case 't':
+                        RtsFlags.ParFlags.sparkThrottle = rtsTrue;
+                        break;
                     case 'w':
                         // -qw was removed; accepted for backwards compat
                         break;
@@ -1349,6 +2034,33 @@ error = rtsTrue;
                     }
                     break;
 
+                case 'H': /* huge pages */
+                    OPTION_UNSAFE;
+                    RtsFlags.GcFlags.hugePages = rtsTrue;
+                    if (rts_argv[arg][3] != '\0') {
+                        StgWord64 sz = decodeSize(rts_argv[arg], 3,
+                                                  MBLOCK_SIZE, HS_WORD_MAX);
+                        if (sz & (sz - 1)) {
+                            errorBelch("-xH: size must be a power of 2");
+                            error = rtsTrue;
+                        }
+                        RtsFlags.GcFlags.hugePageSize = (StgWord)sz;
+                    }
+                    break;
+
+                case 'r': /* address space reserved for the heap */
+                    OPTION_UNSAFE;
+#if defined(USE_LARGE_ADDRESS_SPACE)
+                    RtsFlags.GcFlags.addressSpaceSize
+                        = (StgWord)decodeSize(rts_argv[arg], 3, MBLOCK_SIZE,
+                                              HS_WORD_MAX);
+#else
+                    errorBelch("-xr: this RTS does not reserve the heap's "
+                               "address space");
+                    error = rtsTrue;
+#endif
+                    break;
+
 #if defined(x86_64_HOST_ARCH)
                 case 'm': /* linkerMemBase */
                     OPTION_UNSAFE;
@@ -1436,6 +2148,10 @@ error = rtsTrue;
 
 static void normaliseRtsOpts (void)
 {
+#if defined(THREADED_RTS)
+    nat i;
+#endif
+
     if (RtsFlags.MiscFlags.tickInterval < 0) {
         RtsFlags.MiscFlags.tickInterval = DEFAULT_TICK_INTERVAL;
     }
@@ -1456,6 +2172,18 @@ static void normaliseRtsOpts (void)
                     RtsFlags.MiscFlags.tickInterval);
     }
 
+#if defined(THREADED_RTS)
+    for (i = 0; i < RtsFlags.ParFlags.nCapPools; i++) {
+        if (RtsFlags.MiscFlags.tickInterval == 0) {
+            RtsFlags.ParFlags.capPools[i].ctxtSwitchTime = 0;
+        } else if (RtsFlags.ParFlags.capPools[i].ctxtSwitchTime > 0) {
+            RtsFlags.MiscFlags.tickInterval =
+                stg_min(RtsFlags.ParFlags.capPools[i].ctxtSwitchTime,
+                        RtsFlags.MiscFlags.tickInterval);
+        }
+    }
+#endif
+
     if (RtsFlags.GcFlags.idleGCDelayTime > 0) {
         RtsFlags.MiscFlags.tickInterval =
             stg_min(RtsFlags.GcFlags.idleGCDelayTime,
@@ -1476,6 +2204,20 @@ static void normaliseRtsOpts (void)
         RtsFlags.ConcFlags.ctxtSwitchTicks = 0;
     }
 
+#if defined(THREADED_RTS)
+    for (i = 0; i < RtsFlags.ParFlags.nCapPools; i++) {
+        CAP_POOL_FLAGS *pool = &RtsFlags.ParFlags.capPools[i];
+        if (pool->ctxtSwitchTime < 0) {
+            pool->ctxtSwitchTicks = RtsFlags.ConcFlags.ctxtSwitchTicks;
+        } else if (pool->ctxtSwitchTime > 0) {
+            pool->ctxtSwitchTicks =
+                pool->ctxtSwitchTime / RtsFlags.MiscFlags.tickInterval;
+        } else {
+            pool->ctxtSwitchTicks = 0;
+        }
+    }
+#endif
+
     if (RtsFlags.ProfFlags.heapProfileInterval > 0) {
         RtsFlags.ProfFlags.heapProfileIntervalTicks =
             RtsFlags.ProfFlags.heapProfileInterval /
@@ -1484,11 +2226,37 @@ static void normaliseRtsOpts (void)
         RtsFlags.ProfFlags.heapProfileIntervalTicks = 0;
     }
 
+#ifdef TRACING
+    if (RtsFlags.TraceFlags.toggle_classes != NULL &&
+        RtsFlags.TraceFlags.ring_size != 0) {
+        errorBelch("--eventlog-toggle and --eventlog-ring both need SIGUSR2");
+        errorUsage();
+    }
+#endif
+
     if (RtsFlags.GcFlags.stkChunkBufferSize >
         RtsFlags.GcFlags.stkChunkSize / 2) {
         errorBelch("stack chunk buffer size (-kb) must be less than 50%% of the stack chunk size (-kc)");
         errorUsage();
     }
+
+    // Objects past the second GC they survive age in generations of
+    // their own, after generation 0 (see Note [Aging] in rts/sm/GC.c).
+    if (RtsFlags.GcFlags.tenureAge == 0) {
+        RtsFlags.GcFlags.tenureAge = RtsFlags.GcFlags.adaptiveTenure ? 4 : 2;
+    }
+    if (RtsFlags.GcFlags.generations > 1) {
+        RtsFlags.GcFlags.generations += RtsFlags.GcFlags.tenureAge - 2;
+    } else {
+        RtsFlags.GcFlags.tenureAge = 2;
+        RtsFlags.GcFlags.adaptiveTenure = rtsFalse;
+    }
+
+    // a soft limit at or above the hard one would never come into play
+    if (RtsFlags.GcFlags.maxHeapSize != 0 &&
+        RtsFlags.GcFlags.softHeapLimit >= RtsFlags.GcFlags.maxHeapSize) {
+        RtsFlags.GcFlags.softHeapLimit = 0;
+    }
 }
 
 static void errorUsage (void)
@@ -1612,7 +2380,102 @@ decodeSize(const char *flag, nat offset, StgWord64 min, StgWord64 max)
     return val;
 }
 
+#if defined(THREADED_RTS)
+/* --cap-pool=<name>:<n>[,cpu=<cpu>][,C=<secs>], see Note [Capability
+ * pools] in Capability.c */
+static rtsBool
+parseCapPool (const char *arg)
+{
+    const char *c, *colon;
+    char *end;
+    CAP_POOL_FLAGS *pool;
+    long n;
+
+    if (RtsFlags.ParFlags.nCapPools == MAX_CAP_POOLS) {
+        errorBelch("%s: at most %d pools", arg, MAX_CAP_POOLS);
+        return rtsFalse;
+    }
+    pool = &RtsFlags.ParFlags.capPools[RtsFlags.ParFlags.nCapPools];
+
+    c = arg + 11;
+    colon = strchr(c, ':');
+    if (colon == NULL || colon == c) {
+        errorBelch("%s: expected <name>:<n>", arg);
+        return rtsFalse;
+    }
+    n = strtol(colon + 1, &end, 10);
+    if (n <= 0) {
+        errorBelch("%s: a pool needs at least one capability", arg);
+        return rtsFalse;
+    }
+
+    pool->name = stgMallocBytes(colon - c + 1, "parseCapPool");
+    memcpy(pool->name, c, colon - c);
+    pool->name[colon - c] = '\0';
+    pool->nCaps = (nat)n;
+    pool->cpu = -1;
+    pool->ctxtSwitchTime = -1;
+
+    for (c = end; *c == ','; c = end) {
+        if (!strncmp(c, ",cpu=", 5)) {
+            pool->cpu = strtol(c + 5, &end, 10);
+            if (end == c + 5 || pool->cpu < 0) {
+                errorBelch("%s: bad CPU number", arg);
+                return rtsFalse;
+            }
+        } else if (!strncmp(c, ",C=", 3)) {
+            double d = strtod(c + 3, &end);
+            if (end == c + 3 || d < 0) {
+                errorBelch("%s: bad context switch interval", arg);
+                return rtsFalse;
+            }
+            pool->ctxtSwitchTime = fsecondsToTime(d);
+        } else {
+            break;
+        }
+    }
+    if (*c != '\0') {
+        errorBelch("%s: unknown pool setting %s", arg, c);
+        return rtsFalse;
+    }
+
+    RtsFlags.ParFlags.nCapPools++;
+    return rtsTrue;
+}
+#endif
+
 #if defined(TRACING)
+/* --eventlog-sample=<class><n>[,<class><n>...] */
+static rtsBool read_trace_sampling(const char *arg)
+{
+    const char *c = arg + 18;
+    char *end;
+    long n;
+
+    for (;;) {
+        if (*c != 's' && *c != 'f') {
+            errorBelch("%s: only the classes 's' and 'f' can be sampled", arg);
+            return rtsFalse;
+        }
+        n = strtol(c + 1, &end, 10);
+        if (end == c + 1 || n < 1) {
+            errorBelch("%s: bad sampling rate", arg);
+            return rtsFalse;
+        }
+        if (*c == 's') {
+            RtsFlags.TraceFlags.sched_sample = (nat)n;
+        } else {
+            RtsFlags.TraceFlags.spark_sample = (nat)n;
+        }
+        if (*end == '\0') return rtsTrue;
+        if (*end != ',') {
+            errorBelch("%s: bad sampling rate", arg);
+            return rtsFalse;
+        }
+        c = end + 1;
+    }
+}
+
 static void read_trace_flags(char *arg)
 {
     char *c;
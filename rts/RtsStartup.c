@@ -36,9 +36,17 @@
 #include "Hash.h"
 #include "Profiling.h"
 #include "Timer.h"
+#include "GetTime.h"
+#include "Elastic.h"
+#include "SpinLock.h"
+#include "sm/Decommit.h"
+#include "sm/HeapImage.h"
 #include "Globals.h"
 #include "FileLock.h"
+#include "ShmChannel.h"
 #include "LinkerInternals.h"
+#include "PerfCounters.h"
+#include "Metrics.h"
 
 #if defined(PROFILING)
 # include "ProfHeap.h"
@@ -47,6 +55,8 @@
 
 #if defined(mingw32_HOST_OS) && !defined(THREADED_RTS)
 #include "win32/AsyncIO.h"
+#elif defined(linux_HOST_OS) && !defined(THREADED_RTS)
+#include "posix/AsyncIO.h"
 #endif
 
 #if !defined(mingw32_HOST_OS)
@@ -68,6 +78,7 @@
 static int hs_init_count = 0;
 
 static void flushStdHandles(void);
+static void exitWithoutTeardown(int n) GNUC3_ATTRIBUTE(__noreturn__);
 
 const RtsConfig defaultRtsConfig  = {
     .rts_opts_enabled = RtsOptsSafeOnly,
@@ -171,10 +182,15 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
 
     /* Initialise the stats department, phase 1 */
     initStats1();
+    stat_initPhase("flags");
+
+    /* choose the clock for timestamps (--clock), before anything is traced */
+    initTimestampClock();
 
 #ifdef USE_PAPI
     papi_init();
 #endif
+    initPerfCounters();
 
     /* initTracing must be after setupRtsFlags() */
 #ifdef TRACING
@@ -183,19 +199,31 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
     /* Trace the startup event
      */
     traceEventStartup();
+    stat_initPhase("tracing");
+
+#if defined(THREADED_RTS)
+    /* calibrate spin locks, before anything needs one */
+    initSpinLocks();
+#endif
 
     /* initialise scheduler data structures (needs to be done before
      * initStorage()).
      */
     initScheduler();
+    stat_initPhase("scheduler");
 
     /* Trace some basic information about the process */
     traceWallClockTime();
+    traceClockSource();
     traceOSProcessInfo();
 
     /* initialize the storage manager */
     initStorage();
 
+    /* create the --metrics-shm segment (needs the generations) */
+    initMetrics();
+    stat_initPhase("storage");
+
     /* initialise the stable pointer table */
     initStableTables();
 
@@ -216,6 +244,7 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
     getStablePtr((StgPtr)nonTermination_closure);
     getStablePtr((StgPtr)blockedIndefinitelyOnSTM_closure);
     getStablePtr((StgPtr)allocationLimitExceeded_closure);
+    getStablePtr((StgPtr)residencyQuotaExceeded_closure);
     getStablePtr((StgPtr)nestedAtomically_closure);
 
     getStablePtr((StgPtr)runSparks_closure);
@@ -223,26 +252,41 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
     getStablePtr((StgPtr)ioManagerCapabilitiesChanged_closure);
 #ifndef mingw32_HOST_OS
     getStablePtr((StgPtr)blockedOnBadFD_closure);
-    getStablePtr((StgPtr)runHandlersPtr_closure);
+    getStablePtr((StgPtr)runHandlersBatchPtr_closure);
 #endif
 
     /* initialise the shared Typeable store */
     initGlobalStore();
 
+    /* put back the CAFs saved by an earlier run (+RTS --heap-image),
+     * before any of them can be entered */
+    restoreHeapImage();
+
     /* initialise file locking, if necessary */
     initFileLocking();
 
+    /* initialise the shared-memory channels */
+    initShmChannels();
+
 #if defined(DEBUG)
     /* initialise thread label table (tso->char*) */
     initThreadLabelTable();
 #endif
 
     initProfiling1();
+    stat_initPhase("tables");
 
     /* start the virtual timer 'subsystem'. */
     initTimer();
     startTimer();
 
+#if defined(THREADED_RTS)
+    startElasticCapabilities();
+#endif
+    startDecommitter();
+    startCFinalizerThread();
+    stat_initPhase("threads");
+
 #if defined(RTS_USER_SIGNALS)
     if (RtsFlags.MiscFlags.install_signal_handlers) {
         /* Initialise the user signal handler set */
@@ -252,25 +296,32 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
     }
 #endif
 
-#if defined(mingw32_HOST_OS) && !defined(THREADED_RTS)
+#if (defined(mingw32_HOST_OS) || defined(linux_HOST_OS)) \
+    && !defined(THREADED_RTS)
     startupAsyncIO();
 #endif
 
 #if X86_INIT_FPU
     x86_init_fpu();
 #endif
+    stat_initPhase("signals");
 
     startupHpc();
 
     // This must be done after module initialisation.
     // ToDo: make this work in the presence of multiple hs_add_root()s.
     initProfiling2();
+    stat_initPhase("hpc/prof");
 
     // ditto.
 #if defined(THREADED_RTS)
     ioManagerStart();
+    stat_initPhase("io manager");
 #endif
 
+    /* the module constructors have inserted their static pointers */
+    freezeStaticPtrTable();
+
     /* Record initialization times */
     stat_endInit();
 }
@@ -338,12 +389,17 @@ hs_exit_(rtsBool wait_foreign)
 #endif
 
 #if defined(THREADED_RTS)
+    // before the IO manager goes: setNumCapabilities() talks to it
+    stopElasticCapabilities();
     ioManagerDie();
 #endif
 
     /* stop all running tasks */
     exitScheduler(wait_foreign);
 
+    /* run the C finalizers queued by the GC first, to keep their order */
+    stopCFinalizerThread();
+
     /* run C finalizers for all active weak pointers */
     for (i = 0; i < n_capabilities; i++) {
         runAllCFinalizers(capabilities[i]->weak_ptr_list_hd);
@@ -362,6 +418,8 @@ hs_exit_(rtsBool wait_foreign)
     stopTimer();
     exitTimer(wait_foreign);
 
+    stopDecommitter();
+
     // set the terminal settings back to what they were
 #if !defined(mingw32_HOST_OS)
     resetTerminalSettings();
@@ -396,6 +454,10 @@ hs_exit_(rtsBool wait_foreign)
     /* free file locking tables, if necessary */
     freeFileLocking();
 
+    /* give the buffers of the messages we still have back to their
+     * shared-memory channels */
+    exitShmChannels();
+
     /* free the Static Pointer Table */
     exitStaticPtrTable();
 
@@ -432,8 +494,13 @@ hs_exit_(rtsBool wait_foreign)
 
 #if defined(mingw32_HOST_OS) && !defined(THREADED_RTS)
     shutdownAsyncIO(wait_foreign);
+#elif defined(linux_HOST_OS) && !defined(THREADED_RTS)
+    shutdownAsyncIO();
 #endif
 
+    exitPerfCounters();
+    exitMetrics();
+
     /* free hash table storage */
     exitHashTable();
 
@@ -447,6 +514,67 @@ hs_exit_(rtsBool wait_foreign)
     freeRtsArgs();
 }
 
+/* ----------------------------------------------------------------------------
+ * +RTS --fast-exit
+ *
+ * Exiting the program with hs_exit_() does a final major GC to get rid
+ * of the threads, runs the C finalizers and frees the heap and all the
+ * tables, which can take seconds for a large heap.  None of that is
+ * needed when the process is about to go away, so here we only flush
+ * the Haskell handles, stop the Capabilities where they are (so that
+ * nothing else writes to the statistics or the eventlog), and write
+ * out the statistics, profiles and eventlog before _exit().
+ *
+ * This is only for exiting the program (shutdownHaskellAndExit()): a
+ * plain hs_exit() may be followed by more C code.
+ * ------------------------------------------------------------------------- */
+
+static void
+exitWithoutTeardown (int n)
+{
+    stat_startExit();
+
+    OnExitHook();
+
+    flushStdHandles();
+
+    haltScheduler();
+
+    stopTimer();
+
+#if !defined(mingw32_HOST_OS)
+    resetTerminalSettings();
+#endif
+
+    stat_endExit();
+
+    exitHpc();
+
+    // outputs the stats (+RTS -s)
+    exitStorage();
+
+#if defined(PROFILING)
+    reportCCSProfiling();
+#endif
+    endProfiling();
+#ifdef PROFILING
+    if (prof_file != NULL) fclose(prof_file);
+#endif
+
+#ifdef TRACING
+    endTracing();
+#endif
+
+    exitMetrics();
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if (exitFn)
+        (*exitFn)(n);
+    _exit(n);
+}
+
 // Flush stdout and stderr.  We do this during shutdown so that it
 // happens even when the RTS is being used as a library, without a
 // main (#5594)
@@ -481,6 +609,10 @@ shutdownHaskellAndExit(int n, int fastExit)
         // and exit immediately (see #5402)
         hs_init_count = 1;
 
+        if (RtsFlags.MiscFlags.fastExit) {
+            exitWithoutTeardown(n);
+        }
+
         // we're about to exit(), no need to wait for foreign calls to return.
         hs_exit_(rtsFalse);
     }
@@ -550,6 +682,14 @@ void (*exitFn)(int) = 0;
 void
 stg_exit(int n)
 {
+#ifdef TRACING
+  // Don't lose the events kept by --eventlog-ring, or the messages kept
+  // by --debug-trace-buffer; endTracing() does nothing if hs_exit() has
+  // already been done
+  if (RtsFlags.TraceFlags.ring_size != 0 ||
+      RtsFlags.DebugFlags.trace_buffer != 0)
+    endTracing();
+#endif
   if (exitFn)
     (*exitFn)(n);
   exit(n);
@@ -107,6 +107,30 @@ stgFree(void* p)
   free(p);
 }
 
+/* malloc() only promises the alignment of the largest basic type, so
+ * structures that are laid out in cache lines (Capability, gc_thread)
+ * are allocated with stgMallocAlignedBytes(), which keeps the pointer
+ * that malloc() returned in the word before the aligned block.
+ */
+void *
+stgMallocAlignedBytes (int n, int align, char *msg)
+{
+    char *space;
+    StgWord aligned;
+
+    space = stgMallocBytes(n + align + sizeof(void *), msg);
+    aligned = ((StgWord)space + sizeof(void *) + align - 1)
+        & ~((StgWord)align - 1);
+    ((void **)aligned)[-1] = space;
+    return (void *)aligned;
+}
+
+void
+stgFreeAligned (void *p)
+{
+    free(((void **)p)[-1]);
+}
+
 /* -----------------------------------------------------------------------------
    Stack overflow
 
@@ -28,6 +28,13 @@ void *stgCallocBytes(int n, int m, char *msg)
 
 void stgFree(void* p);
 
+// Memory aligned to 'align' bytes (a power of 2), freed with
+// stgFreeAligned().
+void *stgMallocAlignedBytes(int n, int align, char *msg)
+    GNUC3_ATTRIBUTE(__malloc__);
+
+void stgFreeAligned(void *p);
+
 /* -----------------------------------------------------------------------------
  * Misc other utilities
  * -------------------------------------------------------------------------- */
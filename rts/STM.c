@@ -80,6 +80,31 @@
  * particular, when a thread is putting itself to sleep, it mustn't release the
  * TVar's lock until it has added itself to the wait queue and marked its TSO as
  * BlockedOnSTM -- this makes sure that other threads will know to wake it.
+ * The queue is doubly linked, newest first, and the prev_queue_entry of the
+ * first entry points to the last one, so that both ends can be reached
+ * straight away.
+ *
+ * A commit that updates a TVar normally wakes every thread waiting on it.
+ * With setTVarWakeupLimit# it wakes only the longest-waiting n that have not
+ * been woken already: for a TVar that is a queue of work, where any waiter can
+ * take any item, waking them all just has most of them block again.  The
+ * thread that takes an item updates the TVar in turn, waking the next ones.
+ *
+ * Version clock
+ * -------------
+ *
+ * As in TL2 (Dice, Shalev and Shavit, "Transactional Locking II", DISC
+ * 2006), there is a global version clock, stm_clock, which every commit
+ * that updates TVars advances before any of its updates become visible.
+ * Each TVar is stamped with the clock value of the last commit that
+ * updated it, and each TRec records the clock when its (outermost)
+ * transaction started.  If the clock has not moved when a transaction
+ * that has not updated anything commits, nothing it read can have
+ * changed in the meantime, so it commits without looking at its read
+ * set at all; stmValidateNestOfTransactions() is short-circuited in the
+ * same way.  Otherwise validation proceeds as described above, with the
+ * version stamps standing in for the old per-TVar update counts in
+ * check_read_only.
  *
  * ---------------------------------------------------------------------------*/
 
@@ -91,6 +116,7 @@
 #include "STM.h"
 #include "Trace.h"
 #include "Threads.h"
+#include "Hash.h"
 #include "sm/Storage.h"
 
 #include <stdio.h>
@@ -169,6 +195,23 @@ static int shake(void) {
 
 #define REUSE_MEMORY
 
+/* Note [Keeping the free TRecs]
+
+   A transaction whose commit fails frees its TRec header and chunks to
+   the Capability's free lists, and its next attempt takes them straight
+   back.  The lists used to be emptied at every GC, so a contended
+   transaction with a large read set allocated all its chunks again
+   after each GC, and they were copied and promoted along with the rest.
+
+   Now markCapability() keeps the free headers and chunks alive instead:
+   they are freed with next_entry_idx = 0, and the header's invariant
+   list emptied, so they keep nothing else alive.  Only up to
+   MAX_FREE_TREC_CHUNKS chunks are kept per Capability, so that one
+   transaction with a huge read set doesn't pin its chunks for good.
+*/
+
+#define MAX_FREE_TREC_CHUNKS 256
+
 /*......................................................................*/
 
 #define IF_STM_UNIPROC(__X)  do { } while (0)
@@ -373,7 +416,10 @@ static void park_tso(StgTSO *tso) {
   TRACE("park_tso on tso=%p", tso);
 }
 
-static void unpark_tso(Capability *cap, StgTSO *tso) {
+// Returns TRUE if this is the wakeup that unblocks tso
+static StgBool unpark_tso(Capability *cap, StgTSO *tso) {
+    StgBool woken = FALSE;
+
     // We will continue unparking threads while they remain on one of the wait
     // queues: it's up to the thread itself to remove it from the wait queues
     // if it decides to do so when it is scheduled.
@@ -392,29 +438,35 @@ static void unpark_tso(Capability *cap, StgTSO *tso) {
       TRACE("unpark_tso on tso=%p", tso);
       tso->block_info.closure = &stg_STM_AWOKEN_closure;
       tryWakeupThread(cap,tso);
+      woken = TRUE;
     } else {
       TRACE("spurious unpark_tso on tso=%p", tso);
     }
     unlockTSO(tso);
+    return woken;
 }
 
 static void unpark_waiters_on(Capability *cap, StgTVar *s) {
+  StgTVarWatchQueue *fq;
   StgTVarWatchQueue *q;
-  StgTVarWatchQueue *trail;
+  StgWord limit, woken;
   TRACE("unpark_waiters_on tvar=%p", s);
-  // unblock TSOs in reverse order, to be a bit fairer (#2319)
-  for (q = s -> first_watch_queue_entry, trail = q;
-       q != END_STM_WATCH_QUEUE;
-       q = q -> next_queue_entry) {
-    trail = q;
+  fq = s -> first_watch_queue_entry;
+  if (fq == END_STM_WATCH_QUEUE) {
+    return;
   }
-  q = trail;
-  for (;
-       q != END_STM_WATCH_QUEUE;
-       q = q -> prev_queue_entry) {
-    if (watcher_is_tso(q)) {
-      unpark_tso(cap, (StgTSO *)(q -> closure));
+  limit = s -> wakeup_limit;
+  woken = 0;
+  // unblock TSOs in reverse order, to be a bit fairer (#2319), starting
+  // from the last entry
+  q = fq -> prev_queue_entry;
+  for (;;) {
+    if (watcher_is_tso(q) && unpark_tso(cap, (StgTSO *)(q -> closure))) {
+      woken++;
+      if (woken == limit) break;
     }
+    if (q == fq) break;
+    q = q -> prev_queue_entry;
   }
 }
 
@@ -459,6 +511,7 @@ static StgTRecHeader *new_stg_trec_header(Capability *cap,
   result -> enclosing_trec = enclosing_trec;
   result -> current_chunk = new_stg_trec_chunk(cap);
   result -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
+  result -> index = NULL;
 
   if (enclosing_trec == NO_TREC) {
     result -> state = TREC_ACTIVE;
@@ -473,6 +526,110 @@ static StgTRecHeader *new_stg_trec_header(Capability *cap,
 
 /*......................................................................*/
 
+// Indexing large TRecs
+//
+// Looking up a TVar in a TRec is a linear scan over its chunks, which
+// makes a transaction that touches n TVars cost O(n^2).  Once a scan has
+// gone over TREC_INDEX_THRESHOLD entries of a TRec without finding what
+// it was looking for, we build a hash table from TVar to entry for that
+// TRec, and keep it up to date lazily: entries are only ever added at
+// the end of the current chunk, so each lookup first indexes whatever
+// has been added since the last one.  Lookups from transactions nested
+// inside the TRec (orElse) use its index too.
+//
+// The table is keyed on addresses and holds pointers into the chunks,
+// and both move in a GC, so an index records the number of GCs when it
+// was built and is thrown away after a GC.  The table is malloc'd, and
+// it is freed along with the TRec in free_stg_trec_header().
+
+#define TREC_INDEX_THRESHOLD 64
+
+typedef struct TRecIndex_ {
+  HashTable    *table;
+  StgWord       epoch;   // generations[0].collections when built
+  StgTRecChunk *chunk;   // entries of chunk up to idx, and of all
+  StgWord       idx;     //   the chunks before it, are in the table
+} TRecIndex;
+
+static void free_trec_index(StgTRecHeader *trec) {
+  TRecIndex *ix = trec -> index;
+  if (ix != NULL) {
+    freeHashTable(ix -> table, NULL);
+    stgFree(ix);
+    trec -> index = NULL;
+  }
+}
+
+// Add the entries that have been added to trec since we last looked
+static void update_trec_index(StgTRecHeader *trec) {
+  TRecIndex *ix = trec -> index;
+  StgTRecChunk *c;
+  StgWord i, limit;
+
+  c = trec -> current_chunk;
+  if (c == ix -> chunk && c -> next_entry_idx == ix -> idx) {
+    return;
+  }
+
+  for (; c != END_STM_CHUNK_LIST; c = c -> prev_chunk) {
+    limit = (c == trec -> current_chunk) ? c -> next_entry_idx
+                                         : TREC_CHUNK_NUM_ENTRIES;
+    i = (c == ix -> chunk) ? ix -> idx : 0;
+    for (; i < limit; i ++) {
+      insertHashTable(ix -> table, (StgWord)c -> entries[i].tvar,
+                      &(c -> entries[i]));
+    }
+    if (c == ix -> chunk) break;
+  }
+
+  ix -> chunk = trec -> current_chunk;
+  ix -> idx = trec -> current_chunk -> next_entry_idx;
+}
+
+static void build_trec_index(StgTRecHeader *trec) {
+  TRecIndex *ix;
+
+  TRACE("%p : indexing trec", trec);
+  ix = stgMallocBytes(sizeof(TRecIndex), "build_trec_index");
+  ix -> table = allocHashTable();
+  ix -> epoch = generations[0].collections;
+  ix -> chunk = NULL;
+  ix -> idx = 0;
+  trec -> index = ix;
+  update_trec_index(trec);
+}
+
+// The entry for tvar in trec itself (not in its enclosing TRecs), or NULL
+static TRecEntry *find_entry(StgTRecHeader *trec, StgTVar *tvar) {
+  TRecEntry *result = NULL;
+  StgWord n = 0;
+
+  if (trec -> index != NULL &&
+      trec -> index -> epoch != generations[0].collections) {
+    free_trec_index(trec);
+  }
+
+  if (trec -> index != NULL) {
+    update_trec_index(trec);
+    return lookupHashTable(trec -> index -> table, (StgWord)tvar);
+  }
+
+  FOR_EACH_ENTRY(trec, e, {
+    if (e -> tvar == tvar) {
+      result = e;
+      BREAK_FOR_EACH;
+    }
+    n ++;
+  });
+
+  if (result == NULL && n >= TREC_INDEX_THRESHOLD) {
+    build_trec_index(trec);
+  }
+  return result;
+}
+
+/*......................................................................*/
+
 // Allocation / deallocation functions that retain per-capability lists
 // of closures that can be re-used
 
@@ -518,8 +675,8 @@ static StgTRecChunk *alloc_stg_trec_chunk(Capability *cap) {
   } else {
     result = cap -> free_trec_chunks;
     cap -> free_trec_chunks = result -> prev_chunk;
+    cap -> n_free_trec_chunks --;
     result -> prev_chunk = END_STM_CHUNK_LIST;
-    result -> next_entry_idx = 0;
   }
   return result;
 }
@@ -527,8 +684,13 @@ static StgTRecChunk *alloc_stg_trec_chunk(Capability *cap) {
 static void free_stg_trec_chunk(Capability *cap,
                                 StgTRecChunk *c) {
 #if defined(REUSE_MEMORY)
+  if (cap -> n_free_trec_chunks >= MAX_FREE_TREC_CHUNKS) {
+    return;
+  }
+  c -> next_entry_idx = 0;
   c -> prev_chunk = cap -> free_trec_chunks;
   cap -> free_trec_chunks = c;
+  cap -> n_free_trec_chunks ++;
 #endif
 }
 
@@ -541,8 +703,6 @@ static StgTRecHeader *alloc_stg_trec_header(Capability *cap,
     result = cap -> free_trec_headers;
     cap -> free_trec_headers = result -> enclosing_trec;
     result -> enclosing_trec = enclosing_trec;
-    result -> current_chunk -> next_entry_idx = 0;
-    result -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
     if (enclosing_trec == NO_TREC) {
       result -> state = TREC_ACTIVE;
     } else {
@@ -558,14 +718,19 @@ static void free_stg_trec_header(Capability *cap,
                                  StgTRecHeader *trec) {
 #if defined(REUSE_MEMORY)
   StgTRecChunk *chunk = trec -> current_chunk -> prev_chunk;
+  free_trec_index(trec);
   while (chunk != END_STM_CHUNK_LIST) {
     StgTRecChunk *prev_chunk = chunk -> prev_chunk;
     free_stg_trec_chunk(cap, chunk);
     chunk = prev_chunk;
   }
   trec -> current_chunk -> prev_chunk = END_STM_CHUNK_LIST;
+  trec -> current_chunk -> next_entry_idx = 0;
+  trec -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
   trec -> enclosing_trec = cap -> free_trec_headers;
   cap -> free_trec_headers = trec;
+#else
+  free_trec_index(trec);
 #endif
 }
 
@@ -573,6 +738,47 @@ static void free_stg_trec_header(Capability *cap,
 
 // Helper functions for managing waiting lists
 
+static void push_watch_queue_entry(Capability *cap,
+                                   StgTVar *s,
+                                   StgTVarWatchQueue *q) {
+  StgTVarWatchQueue *fq;
+  fq = s -> first_watch_queue_entry;
+  q -> next_queue_entry = fq;
+  if (fq == END_STM_WATCH_QUEUE) {
+    q -> prev_queue_entry = q;
+  } else {
+    q -> prev_queue_entry = fq -> prev_queue_entry;
+    fq -> prev_queue_entry = q;
+  }
+  s -> first_watch_queue_entry = q;
+  dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+}
+
+static void unlink_watch_queue_entry(Capability *cap,
+                                     StgTVar *s,
+                                     StgTVarWatchQueue *q) {
+  StgTVarWatchQueue *fq;
+  StgTVarWatchQueue *pq;
+  StgTVarWatchQueue *nq;
+  fq = s -> first_watch_queue_entry;
+  nq = q -> next_queue_entry;
+  pq = q -> prev_queue_entry;
+  if (q == fq) {
+    if (nq != END_STM_WATCH_QUEUE) {
+      nq -> prev_queue_entry = pq; // the last entry
+    }
+    s -> first_watch_queue_entry = nq;
+    dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+  } else {
+    pq -> next_queue_entry = nq;
+    if (nq != END_STM_WATCH_QUEUE) {
+      nq -> prev_queue_entry = pq;
+    } else {
+      fq -> prev_queue_entry = pq; // q was the last entry
+    }
+  }
+}
+
 static void build_watch_queue_entries_for_trec(Capability *cap,
                                                StgTSO *tso,
                                                StgTRecHeader *trec) {
@@ -585,21 +791,13 @@ static void build_watch_queue_entries_for_trec(Capability *cap,
   FOR_EACH_ENTRY(trec, e, {
     StgTVar *s;
     StgTVarWatchQueue *q;
-    StgTVarWatchQueue *fq;
     s = e -> tvar;
     TRACE("%p : adding tso=%p to watch queue for tvar=%p", trec, tso, s);
     ACQ_ASSERT(s -> current_value == (StgClosure *)trec);
     NACQ_ASSERT(s -> current_value == e -> expected_value);
-    fq = s -> first_watch_queue_entry;
     q = alloc_stg_tvar_watch_queue(cap, (StgClosure*) tso);
-    q -> next_queue_entry = fq;
-    q -> prev_queue_entry = END_STM_WATCH_QUEUE;
-    if (fq != END_STM_WATCH_QUEUE) {
-      fq -> prev_queue_entry = q;
-    }
-    s -> first_watch_queue_entry = q;
+    push_watch_queue_entry(cap, s, q);
     e -> new_value = (StgClosure *) q;
-    dirty_TVAR(cap,s); // we modified first_watch_queue_entry
   });
 }
 
@@ -614,8 +812,6 @@ static void remove_watch_queue_entries_for_trec(Capability *cap,
 
   FOR_EACH_ENTRY(trec, e, {
     StgTVar *s;
-    StgTVarWatchQueue *pq;
-    StgTVarWatchQueue *nq;
     StgTVarWatchQueue *q;
     StgClosure *saw;
     s = e -> tvar;
@@ -626,18 +822,7 @@ static void remove_watch_queue_entries_for_trec(Capability *cap,
           q -> closure,
           s);
     ACQ_ASSERT(s -> current_value == (StgClosure *)trec);
-    nq = q -> next_queue_entry;
-    pq = q -> prev_queue_entry;
-    if (nq != END_STM_WATCH_QUEUE) {
-      nq -> prev_queue_entry = pq;
-    }
-    if (pq != END_STM_WATCH_QUEUE) {
-      pq -> next_queue_entry = nq;
-    } else {
-      ASSERT (s -> first_watch_queue_entry == q);
-      s -> first_watch_queue_entry = nq;
-      dirty_TVAR(cap,s); // we modified first_watch_queue_entry
-    }
+    unlink_watch_queue_entry(cap, s, q);
     free_stg_tvar_watch_queue(cap, q);
     unlock_tvar(cap, trec, s, saw, FALSE);
   });
@@ -679,27 +864,19 @@ static void merge_update_into(Capability *cap,
                               StgTVar *tvar,
                               StgClosure *expected_value,
                               StgClosure *new_value) {
-  int found;
+  TRecEntry *e;
 
   // Look for an entry in this trec
-  found = FALSE;
-  FOR_EACH_ENTRY(t, e, {
-    StgTVar *s;
-    s = e -> tvar;
-    if (s == tvar) {
-      found = TRUE;
-      if (e -> expected_value != expected_value) {
-        // Must abort if the two entries start from different values
-        TRACE("%p : update entries inconsistent at %p (%p vs %p)",
-              t, tvar, e -> expected_value, expected_value);
-        t -> state = TREC_CONDEMNED;
-      }
-      e -> new_value = new_value;
-      BREAK_FOR_EACH;
+  e = find_entry(t, tvar);
+  if (e != NULL) {
+    if (e -> expected_value != expected_value) {
+      // Must abort if the two entries start from different values
+      TRACE("%p : update entries inconsistent at %p (%p vs %p)",
+            t, tvar, e -> expected_value, expected_value);
+      t -> state = TREC_CONDEMNED;
     }
-  });
-
-  if (!found) {
+    e -> new_value = new_value;
+  } else {
     // No entry so far in this trec
     TRecEntry *ne;
     ne = get_new_entry(cap, t);
@@ -707,6 +884,10 @@ static void merge_update_into(Capability *cap,
     ne -> expected_value = expected_value;
     ne -> new_value = new_value;
   }
+
+  if (new_value != expected_value) {
+    t -> has_updates = TRUE;
+  }
 }
 
 /*......................................................................*/
@@ -744,18 +925,16 @@ static void merge_read_into(Capability *cap,
   //
   for (t = trec; !found && t != NO_TREC; t = t -> enclosing_trec)
   {
-    FOR_EACH_ENTRY(t, e, {
-      if (e -> tvar == tvar) {
-        found = TRUE;
-        if (e -> expected_value != expected_value) {
-            // Must abort if the two entries start from different values
-            TRACE("%p : read entries inconsistent at %p (%p vs %p)",
-                  t, tvar, e -> expected_value, expected_value);
-            t -> state = TREC_CONDEMNED;
-        }
-        BREAK_FOR_EACH;
+    TRecEntry *e = find_entry(t, tvar);
+    if (e != NULL) {
+      found = TRUE;
+      if (e -> expected_value != expected_value) {
+          // Must abort if the two entries start from different values
+          TRACE("%p : read entries inconsistent at %p (%p vs %p)",
+                t, tvar, e -> expected_value, expected_value);
+          t -> state = TREC_CONDEMNED;
       }
-    });
+    }
   }
 
   if (!found) {
@@ -828,11 +1007,15 @@ static void revert_ownership(Capability *cap STG_UNUSED,
 //     stashed in the TRec entries and are then checked in check_read_only
 //     to ensure that an atomic snapshot of all of these locations has been
 //     seen.
+//
+// If validation fails because of a TVar, and conflict is not NULL, the
+// TVar is stored in *conflict.
 
 static StgBool validate_and_acquire_ownership (Capability *cap,
                                                StgTRecHeader *trec,
                                                int acquire_all,
-                                               int retain_ownership) {
+                                               int retain_ownership,
+                                               StgTVar **conflict) {
   StgBool result;
 
   if (shake()) {
@@ -852,6 +1035,7 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
         TRACE("%p : trying to acquire %p", trec, s);
         if (!cond_lock_tvar(trec, s, e -> expected_value)) {
           TRACE("%p : failed to acquire %p", trec, s);
+          if (conflict != NULL) *conflict = s;
           result = FALSE;
           BREAK_FOR_EACH;
         }
@@ -861,16 +1045,18 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
           TRACE("%p : will need to check %p", trec, s);
           if (s -> current_value != e -> expected_value) {
             TRACE("%p : doesn't match", trec);
+            if (conflict != NULL) *conflict = s;
             result = FALSE;
             BREAK_FOR_EACH;
           }
-          e -> num_updates = s -> num_updates;
+          e -> version = s -> version;
           if (s -> current_value != e -> expected_value) {
             TRACE("%p : doesn't match (race)", trec);
+            if (conflict != NULL) *conflict = s;
             result = FALSE;
             BREAK_FOR_EACH;
           } else {
-            TRACE("%p : need to check version %ld", trec, e -> num_updates);
+            TRACE("%p : need to check version %ld", trec, (long)e -> version);
           }
         });
       }
@@ -895,7 +1081,8 @@ static StgBool validate_and_acquire_ownership (Capability *cap,
 // Keir Fraser's PhD dissertation "Practical lock-free programming" discuss
 // this kind of algorithm.
 
-static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED) {
+static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED,
+                               StgTVar **conflict STG_UNUSED) {
   StgBool result = TRUE;
 
   ASSERT (config_use_read_phase);
@@ -904,14 +1091,15 @@ static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED) {
       StgTVar *s;
       s = e -> tvar;
       if (entry_is_read_only(e)) {
-        TRACE("%p : check_read_only for TVar %p, saw %ld", trec, s, e -> num_updates);
+        TRACE("%p : check_read_only for TVar %p, saw %ld", trec, s, (long)e -> version);
 
         // Note we need both checks and in this order as the TVar could be
         // locked by another transaction that is committing but has not yet
-        // incremented `num_updates` (See #7815).
+        // stamped `version` (See #7815).
         if (s -> current_value != e -> expected_value ||
-            s -> num_updates != e -> num_updates) {
+            s -> version != e -> version) {
           TRACE("%p : mismatch", trec);
+          if (conflict != NULL) *conflict = s;
           result = FALSE;
           BREAK_FOR_EACH;
         }
@@ -929,16 +1117,15 @@ void stmPreGCHook (Capability *cap) {
   lock_stm(NO_TREC);
   TRACE("stmPreGCHook");
   cap->free_tvar_watch_queues = END_STM_WATCH_QUEUE;
-  cap->free_trec_chunks = END_STM_CHUNK_LIST;
-  cap->free_trec_headers = NO_TREC;
+  // the TRecs and chunks are kept: see Note [Keeping the free TRecs]
   unlock_stm(NO_TREC);
 }
 
 /************************************************************************/
 
-// check_read_only relies on version numbers held in TVars' "num_updates"
+// check_read_only relies on version numbers held in TVars' "version"
 // fields not wrapping around while a transaction is committed.  The version
-// number is incremented each time an update is committed to the TVar
+// number changes each time an update is committed to the TVar
 // This is unlikely to wrap around when 32-bit integers are used for the counts,
 // but to ensure correctness we maintain a shared count on the maximum
 // number of commit operations that may occur and check that this has
@@ -973,6 +1160,106 @@ static void getToken(Capability *cap STG_UNUSED) {
 
 /*......................................................................*/
 
+// Contention management
+//
+// When a commit fails, stmCommitTransaction() counts it, emits an
+// EVENT_STM_ABORT naming the TVar that was found to conflict (if we know
+// it; it is an address, so only stable between GCs), and lets the
+// contention manager chosen with +RTS --stm-contention decide what the
+// thread does before it re-runs the transaction:
+//
+//   none:    nothing; the transaction is re-run at once.
+//
+//   backoff: spin for a random time that doubles with each failure in
+//            a row, up to 2^STM_BACKOFF_MAX_SHIFT iterations, so that
+//            the transactions conflicting on a hot TVar spread out and
+//            one of them gets to commit.  After STM_BACKOFF_YIELD
+//            failures in a row, the thread also gives up its
+//            Capability at the next heap check, so that a conflicting
+//            transaction that has been preempted on the same Capability
+//            can finish (this is all the non-threaded RTS does).
+//
+// A contention manager is a function on this table, so adding one is a
+// matter of adding an entry here and a name in RtsFlags.c.
+
+#define STM_BACKOFF_MAX_SHIFT 14
+#define STM_BACKOFF_YIELD     8
+
+typedef void ContentionManager (Capability *cap, StgTSO *tso);
+
+static void contention_none (Capability *cap STG_UNUSED,
+                             StgTSO *tso STG_UNUSED) {
+}
+
+static void contention_backoff (Capability *cap, StgTSO *tso) {
+#if defined(THREADED_RTS)
+  StgWord spins, r;
+
+  if (n_capabilities > 1) {
+    spins = (StgWord)1 << stg_min(tso -> stm_aborts, STM_BACKOFF_MAX_SHIFT);
+    // a cheap hash of the thread and the failure count, for the jitter
+    r = ((StgWord)tso -> id * 2654435761U + tso -> stm_aborts) >> 7;
+    for (spins = spins / 2 + r % (spins / 2 + 1); spins > 0; spins--) {
+      busy_wait_nop();
+    }
+  }
+#endif
+  if (tso -> stm_aborts >= STM_BACKOFF_YIELD) {
+    contextSwitchCapability(cap);
+  }
+}
+
+static ContentionManager *contention_managers[] = {
+  [STM_CONTENTION_NONE]    = contention_none,
+  [STM_CONTENTION_BACKOFF] = contention_backoff,
+};
+
+static void committed(Capability *cap) {
+  cap -> stm_commits ++;
+  cap -> r.rCurrentTSO -> stm_aborts = 0;
+  dtraceStmCommit((EventCapNo)cap->no,
+                  (EventThreadID)cap->r.rCurrentTSO->id);
+}
+
+static void commit_failed(Capability *cap, StgTVar *conflict) {
+  StgTSO *tso = cap -> r.rCurrentTSO;
+
+  cap -> stm_aborts ++;
+  if (tso -> stm_aborts != (StgWord32)-1) {
+    tso -> stm_aborts ++;
+  }
+  traceEventStmAbort(cap, tso, conflict, tso -> stm_aborts);
+  contention_managers[RtsFlags.ConcFlags.stmContention](cap, tso);
+}
+
+/*......................................................................*/
+
+// The version clock (see "Version clock" at the top of the file).  It is
+// only written by commits that update TVars, after they have validated
+// and before they write anything back, so a transaction that sees the
+// same value at its start and at its end has seen no update at all.
+
+static volatile StgWord stm_clock = 0;
+
+static StgWord read_clock(void) {
+  StgWord now;
+  // order the read of the clock after our reads of TVars
+  load_load_barrier();
+  now = stm_clock;
+  load_load_barrier();
+  return now;
+}
+
+static StgWord advance_clock(void) {
+#if defined(THREADED_RTS)
+  return atomic_inc(&stm_clock, 1);
+#else
+  return ++stm_clock;
+#endif
+}
+
+/*......................................................................*/
+
 StgTRecHeader *stmStartTransaction(Capability *cap,
                                    StgTRecHeader *outer) {
   StgTRecHeader *t;
@@ -983,6 +1270,8 @@ StgTRecHeader *stmStartTransaction(Capability *cap,
   getToken(cap);
 
   t = alloc_stg_trec_header(cap, outer);
+  t -> read_version = (outer == NO_TREC) ? read_clock() : outer -> read_version;
+  t -> has_updates = FALSE;
   TRACE("%p : stmStartTransaction()=%p", outer, t);
   return t;
 }
@@ -1076,12 +1365,24 @@ StgBool stmValidateNestOfTransactions(Capability *cap, StgTRecHeader *trec) {
          (trec -> state == TREC_WAITING) ||
          (trec -> state == TREC_CONDEMNED));
 
+  // Nothing has been updated since the nest started: it is still valid
+  // unless one of its TRecs has been condemned.
+  if (trec -> state != TREC_WAITING && read_clock() == trec -> read_version) {
+    for (t = trec; t != NO_TREC; t = t -> enclosing_trec) {
+      if (t -> state == TREC_CONDEMNED) break;
+    }
+    if (t == NO_TREC) {
+      TRACE("%p : stmValidateNestOfTransactions()=1 (clock)", trec);
+      return TRUE;
+    }
+  }
+
   lock_stm(trec);
 
   t = trec;
   result = TRUE;
   while (t != NO_TREC) {
-    result &= validate_and_acquire_ownership(cap, t, TRUE, FALSE);
+    result &= validate_and_acquire_ownership(cap, t, TRUE, FALSE, NULL);
     t = t -> enclosing_trec;
   }
 
@@ -1104,15 +1405,10 @@ static TRecEntry *get_entry_for(StgTRecHeader *trec, StgTVar *tvar, StgTRecHeade
   ASSERT(trec != NO_TREC);
 
   do {
-    FOR_EACH_ENTRY(trec, e, {
-      if (e -> tvar == tvar) {
-        result = e;
-        if (in != NULL) {
-          *in = trec;
-        }
-        BREAK_FOR_EACH;
-      }
-    });
+    result = find_entry(trec, tvar);
+    if (result != NULL && in != NULL) {
+      *in = trec;
+    }
     trec = trec -> enclosing_trec;
   } while (result == NULL && trec != NO_TREC);
 
@@ -1141,20 +1437,7 @@ static void disconnect_invariant(Capability *cap,
          q != END_STM_WATCH_QUEUE;
          q = q -> next_queue_entry) {
       if (q -> closure == (StgClosure*)inv) {
-        StgTVarWatchQueue *pq;
-        StgTVarWatchQueue *nq;
-        nq = q -> next_queue_entry;
-        pq = q -> prev_queue_entry;
-        if (nq != END_STM_WATCH_QUEUE) {
-          nq -> prev_queue_entry = pq;
-        }
-        if (pq != END_STM_WATCH_QUEUE) {
-          pq -> next_queue_entry = nq;
-        } else {
-          ASSERT (s -> first_watch_queue_entry == q);
-          s -> first_watch_queue_entry = nq;
-          dirty_TVAR(cap,s); // we modified first_watch_queue_entry
-        }
+        unlink_watch_queue_entry(cap, s, q);
         TRACE("  found it in watch queue entry %p", q);
         free_stg_tvar_watch_queue(cap, q);
         DEBUG_ONLY( found = TRUE );
@@ -1176,7 +1459,6 @@ static void connect_invariant_to_trec(Capability *cap,
   FOR_EACH_ENTRY(my_execution, e, {
     StgTVar *s = e -> tvar;
     StgTVarWatchQueue *q = alloc_stg_tvar_watch_queue(cap, (StgClosure*)inv);
-    StgTVarWatchQueue *fq = s -> first_watch_queue_entry;
 
     // We leave "last_execution" holding the values that will be
     // in the heap after the transaction we're in the process
@@ -1188,13 +1470,7 @@ static void connect_invariant_to_trec(Capability *cap,
     }
 
     TRACE("  linking trec on tvar=%p value=%p q=%p", s, e -> expected_value, q);
-    q -> next_queue_entry = fq;
-    q -> prev_queue_entry = END_STM_WATCH_QUEUE;
-    if (fq != END_STM_WATCH_QUEUE) {
-      fq -> prev_queue_entry = q;
-    }
-    s -> first_watch_queue_entry = q;
-    dirty_TVAR(cap,s); // we modified first_watch_queue_entry
+    push_watch_queue_entry(cap, s, q);
   });
 
   inv -> last_execution = my_execution;
@@ -1318,16 +1594,31 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
   StgInt64 max_commits_at_start = max_commits;
   StgBool touched_invariants;
   StgBool use_read_phase;
+  StgWord version = 0;
+  StgTVar *conflict = NULL;
 
   TRACE("%p : stmCommitTransaction()", trec);
   ASSERT (trec != NO_TREC);
-
-  lock_stm(trec);
-
   ASSERT (trec -> enclosing_trec == NO_TREC);
   ASSERT ((trec -> state == TREC_ACTIVE) ||
           (trec -> state == TREC_CONDEMNED));
 
+  // A read-only transaction that has seen no update since it started
+  // commits without validating its read set: the start of the
+  // transaction is its linearization point.
+  if (trec -> state == TREC_ACTIVE &&
+      !trec -> has_updates &&
+      trec -> invariants_to_check == END_INVARIANT_CHECK_QUEUE &&
+      read_clock() == trec -> read_version &&
+      !shake()) {
+    TRACE("%p : stmCommitTransaction()=1 (read-only, clock unchanged)", trec);
+    free_stg_trec_header(cap, trec);
+    committed(cap);
+    return TRUE;
+  }
+
+  lock_stm(trec);
+
   // touched_invariants is true if we've written to a TVar with invariants
   // attached to it, or if we're trying to add a new invariant to the system.
 
@@ -1385,7 +1676,8 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
   use_read_phase = ((config_use_read_phase) && (!touched_invariants));
 
-  result = validate_and_acquire_ownership(cap, trec, (!use_read_phase), TRUE);
+  result = validate_and_acquire_ownership(cap, trec, (!use_read_phase), TRUE,
+                                          &conflict);
   if (result) {
     // We now know that all the updated locations hold their expected values.
     ASSERT (trec -> state == TREC_ACTIVE);
@@ -1394,7 +1686,7 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
       StgInt64 max_commits_at_end;
       StgInt64 max_concurrent_commits;
       TRACE("%p : doing read check", trec);
-      result = check_read_only(trec);
+      result = check_read_only(trec, &conflict);
       TRACE("%p : read-check %s", trec, result ? "succeeded" : "failed");
 
       max_commits_at_end = max_commits;
@@ -1431,7 +1723,12 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
         }
       }
 
-      // 2. Make the updates required by the transaction
+      // 2. Advance the clock, before any of our updates become visible
+      if (trec -> has_updates) {
+        version = advance_clock();
+      }
+
+      // 3. Make the updates required by the transaction
       FOR_EACH_ENTRY(trec, e, {
         StgTVar *s;
         s = e -> tvar;
@@ -1442,9 +1739,9 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
           ACQ_ASSERT(tvar_is_locked(s, trec));
           TRACE("%p : writing %p to %p, waking waiters", trec, e -> new_value, s);
           unpark_waiters_on(cap,s);
-          IF_STM_FG_LOCKS({
-            s -> num_updates ++;
-          });
+          if (entry_is_update(e)) {
+            s -> version = version;
+          }
           unlock_tvar(cap, trec, s, e -> new_value, TRUE);
         }
         ACQ_ASSERT(!tvar_is_locked(s, trec));
@@ -1460,6 +1757,12 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
   TRACE("%p : stmCommitTransaction()=%d", trec, result);
 
+  if (result) {
+    committed(cap);
+  } else {
+    commit_failed(cap, conflict);
+  }
+
   return result;
 }
 
@@ -1475,13 +1778,13 @@ StgBool stmCommitNestedTransaction(Capability *cap, StgTRecHeader *trec) {
   lock_stm(trec);
 
   et = trec -> enclosing_trec;
-  result = validate_and_acquire_ownership(cap, trec, (!config_use_read_phase), TRUE);
+  result = validate_and_acquire_ownership(cap, trec, (!config_use_read_phase), TRUE, NULL);
   if (result) {
     // We now know that all the updated locations hold their expected values.
 
     if (config_use_read_phase) {
       TRACE("%p : doing read check", trec);
-      result = check_read_only(trec);
+      result = check_read_only(trec, NULL);
     }
     if (result) {
       // We now know that all of the read-only locations held their exepcted values
@@ -1526,7 +1829,7 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
           (trec -> state == TREC_CONDEMNED));
 
   lock_stm(trec);
-  result = validate_and_acquire_ownership(cap, trec, TRUE, TRUE);
+  result = validate_and_acquire_ownership(cap, trec, TRUE, TRUE, NULL);
   if (result) {
     // The transaction is valid so far so we can actually start waiting.
     // (Otherwise the transaction was not valid and the thread will have to
@@ -1576,7 +1879,7 @@ StgBool stmReWait(Capability *cap, StgTSO *tso) {
           (trec -> state == TREC_CONDEMNED));
 
   lock_stm(trec);
-  result = validate_and_acquire_ownership(cap, trec, TRUE, TRUE);
+  result = validate_and_acquire_ownership(cap, trec, TRUE, TRUE, NULL);
   TRACE("%p : validation %s", trec, result ? "succeeded" : "failed");
   if (result) {
     // The transaction remains valid -- do nothing because it is already on
@@ -1640,6 +1943,9 @@ StgClosure *stmReadTVar(Capability *cap,
       new_entry -> tvar = tvar;
       new_entry -> expected_value = entry -> expected_value;
       new_entry -> new_value = entry -> new_value;
+      if (entry_is_update(new_entry)) {
+        trec -> has_updates = TRUE;
+      }
       result = new_entry -> new_value;
     }
   } else {
@@ -1670,6 +1976,8 @@ void stmWriteTVar(Capability *cap,
   ASSERT (trec -> state == TREC_ACTIVE ||
           trec -> state == TREC_CONDEMNED);
 
+  trec -> has_updates = TRUE;
+
   entry = get_entry_for(trec, tvar, &entry_in);
 
   if (entry != NULL) {
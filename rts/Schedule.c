@@ -25,15 +25,19 @@
 #include "Updates.h"
 #include "Proftimer.h"
 #include "ProfHeap.h"
+#include "HeapSnapshot.h"
 #include "Weak.h"
 #include "sm/GC.h" // waitForGcThreads, releaseGCThreads, N
 #include "sm/GCThread.h"
+#include "sm/BlockAlloc.h" // freeDeferredChains_lock
 #include "Sparks.h"
 #include "Capability.h"
 #include "Task.h"
 #include "AwaitEvent.h"
 #if defined(mingw32_HOST_OS)
 #include "win32/IOManager.h"
+#elif defined(linux_HOST_OS) && !defined(THREADED_RTS)
+#include "posix/AsyncIO.h"
 #endif
 #include "Trace.h"
 #include "RaiseAsync.h"
@@ -42,6 +46,8 @@
 #include "ThreadPaused.h"
 #include "Messages.h"
 #include "Stable.h"
+#include "Metrics.h"
+#include "Elastic.h"
 
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
@@ -69,7 +75,6 @@
 // Blocked/sleeping thrads
 StgTSO *blocked_queue_hd = NULL;
 StgTSO *blocked_queue_tl = NULL;
-StgTSO *sleeping_queue = NULL;    // perhaps replace with a hash table?
 #endif
 
 /* Set to true when the latest garbage collection failed to reclaim
@@ -112,6 +117,13 @@ Mutex sched_mutex;
 // Local stats
 #ifdef THREADED_RTS
 static nat n_failed_trygrab_idles = 0, n_idle_caps = 0;
+
+// The CPUs we can run on, allowing for a cgroup CPU quota; see
+// scheduleDoGC()
+static nat usable_cpus = 0;
+
+// The generation that the idle GC is collecting; see scheduleIdleGC()
+static nat idle_gc_gen = 0;
 #endif
 
 /* -----------------------------------------------------------------------------
@@ -132,14 +144,19 @@ static void scheduleYield (Capability **pcap, Task *task);
 #endif
 #if defined(THREADED_RTS)
 static nat requestSync (Capability **pcap, Task *task, nat sync_type);
-static void acquireAllCapabilities(Capability *cap, Task *task);
+static void acquireAllCapabilities(Capability *cap, Task *task,
+                                   nat *last_cap, StgWord64 *last_thread);
 static void releaseAllCapabilities(nat n, Capability *cap, Task *task);
 static void startWorkerTasks (nat from USED_IF_THREADS, nat to USED_IF_THREADS);
 #endif
 static void scheduleStartSignalHandlers (Capability *cap);
 static void scheduleCheckBlockedThreads (Capability *cap);
 static void scheduleProcessInbox(Capability **cap);
+static void scheduleStartAsyncCalls(Capability *cap);
 static void scheduleDetectDeadlock (Capability **pcap, Task *task);
+#if defined(THREADED_RTS)
+static rtsBool scheduleIdleGC (Capability **pcap, Task *task);
+#endif
 static void schedulePushWork(Capability *cap, Task *task);
 #if defined(THREADED_RTS)
 static void scheduleActivateSpark(Capability *cap);
@@ -152,6 +169,8 @@ static void scheduleHandleThreadBlocked( StgTSO *t );
 static rtsBool scheduleHandleThreadFinished( Capability *cap, Task *task,
                                              StgTSO *t );
 static rtsBool scheduleNeedHeapProfile(rtsBool ready_to_gc);
+static void scheduleAccountThread(Capability *cap, StgTSO *t,
+                                  Time cpu_start, StgInt64 alloc_start);
 static void scheduleDoGC(Capability **pcap, Task *task, rtsBool force_major);
 
 static void deleteThread (Capability *cap, StgTSO *tso);
@@ -183,6 +202,8 @@ schedule (Capability *initialCapability, Task *task)
   StgThreadReturnCode ret;
   nat prev_what_next;
   rtsBool ready_to_gc;
+  Time cpu_start = 0;
+  StgInt64 alloc_start;
 #if defined(THREADED_RTS)
   rtsBool first = rtsTrue;
 #endif
@@ -304,6 +325,12 @@ schedule (Capability *initialCapability, Task *task)
     scheduleYield(&cap,task);
 
     if (emptyRunQueue(cap)) continue; // look for work again
+
+    if (cap->hungry) {
+        // we got some work; see requestWork()
+        cap->hungry = rtsFalse;
+        atomic_dec(&n_hungry_capabilities);
+    }
 #endif
 
 #if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
@@ -386,7 +413,7 @@ schedule (Capability *initialCapability, Task *task)
      * the user specified "context switch as often as possible", with
      * +RTS -C0
      */
-    if (RtsFlags.ConcFlags.ctxtSwitchTicks == 0
+    if (capCtxtSwitchTicks(cap) == 0
         && !emptyThreadQueues(cap)) {
         cap->context_switch = 1;
     }
@@ -397,6 +424,7 @@ run_thread:
     // loop back to run_thread, so make sure to set CurrentTSO after
     // that.
     cap->r.rCurrentTSO = t;
+    cap->pretenure_gen = t->pretenure_gen;
 
     startHeapProfTimer();
 
@@ -416,11 +444,14 @@ run_thread:
 
     // reset the interrupt flag before running Haskell code
     cap->interrupt = 0;
+    cap->sample_stack = 0;
 
     cap->in_haskell = rtsTrue;
     cap->idle = 0;
 
     dirty_TSO(cap,t);
+    // see "Splitting the stack" in Threads.c
+    threadStackSplitClean(cap,t);
     dirty_STACK(cap,t->stackobj);
 
     switch (recent_activity)
@@ -448,6 +479,12 @@ run_thread:
     }
 
     traceEventRunThread(cap, t);
+    metricsCapState(cap, RTS_METRICS_CAP_RUNNING);
+
+    alloc_start = PK_Int64((W_*)&(t->alloc_limit));
+    if (RtsFlags.MiscFlags.threadCPUTime) {
+        cpu_start = getThreadCPUTime();
+    }
 
     switch (prev_what_next) {
 
@@ -484,6 +521,7 @@ run_thread:
     // cap->r.rCurrentTSO is charged for calls to allocate(), so we
     // don't want it set when not running a Haskell thread.
     cap->r.rCurrentTSO = NULL;
+    cap->pretenure_gen = 0;
 
     // And save the current errno in this thread.
     // XXX: possibly bogus for SMP because this thread might already
@@ -494,18 +532,34 @@ run_thread:
     t->saved_winerror = GetLastError();
 #endif
 
+    scheduleAccountThread(cap, t, cpu_start, alloc_start);
+    metricsCapState(cap, RTS_METRICS_CAP_SCHEDULER);
+
     if (ret == ThreadBlocked) {
         if (t->why_blocked == BlockedOnBlackHole) {
             StgTSO *owner = blackHoleOwner(t->block_info.bh->bh);
+            traceBlackHoleBlock(t);
             traceEventStopThread(cap, t, t->why_blocked + 6,
                                  owner != NULL ? owner->id : 0);
+            dtraceBlackHoleBlock((EventCapNo)cap->no, (EventThreadID)t->id,
+                                 owner != NULL ? owner->id : 0);
         } else {
+            if (t->why_blocked == BlockedOnMVar ||
+                t->why_blocked == BlockedOnMVarRead) {
+                dtraceMVarBlock((EventCapNo)cap->no, (EventThreadID)t->id,
+                                (StgWord)t->block_info.closure);
+            }
             traceEventStopThread(cap, t, t->why_blocked + 6, 0);
         }
     } else {
         traceEventStopThread(cap, t, ret, 0);
     }
 
+    if (cap->sample_stack) {
+        cap->sample_stack = 0;
+        traceStackSample(cap, t);
+    }
+
     ASSERT_FULL_CAPABILITY_INVARIANTS(cap,task);
     ASSERT(t->cap == cap);
 
@@ -553,16 +607,118 @@ run_thread:
       barf("schedule: invalid thread return code %d", (int)ret);
     }
 
-    if (ready_to_gc || scheduleNeedHeapProfile(ready_to_gc)) {
+    if (ready_to_gc || scheduleNeedHeapProfile(ready_to_gc)
+        || performHeapSnapshot
+#ifdef TRACING
+        || performEventLogDump
+#endif
+        ) {
       scheduleDoGC(&cap,task,rtsFalse);
     }
   } /* end of while() */
 }
 
+/* -----------------------------------------------------------------------------
+ * Add what the thread has just used to its totals (see rts_getThreadCPUTime)
+ *
+ * The compiled code subtracts what the thread allocates from its
+ * alloc_limit whenever it returns to the RTS, so the difference over the
+ * run is what it allocated (unless it called setAllocationCounter).  The
+ * CPU time is that of this OS thread, so it includes any safe foreign
+ * calls the thread made.
+ * -------------------------------------------------------------------------- */
+
+static void
+scheduleAccountThread (Capability *cap, StgTSO *t,
+                       Time cpu_start, StgInt64 alloc_start)
+{
+    StgInt64 alloc;
+    StgWord64 cpu = 0;
+
+    alloc = alloc_start - PK_Int64((W_*)&(t->alloc_limit));
+    if (alloc < 0) {
+        alloc = 0;      // the thread raised its allocation counter
+    }
+    if (RtsFlags.MiscFlags.threadCPUTime) {
+        cpu = TimeToNS(getThreadCPUTime() - cpu_start);
+    }
+
+    ASSIGN_Word64((W_*)&(t->cpu_time), PK_Word64((W_*)&(t->cpu_time)) + cpu);
+    ASSIGN_Word64((W_*)&(t->allocated),
+                  PK_Word64((W_*)&(t->allocated)) + alloc);
+
+    traceEventThreadUsage(cap, t, cpu, alloc);
+}
+
 /* -----------------------------------------------------------------------------
  * Run queue operations
  * -------------------------------------------------------------------------- */
 
+/* Note [Thread priorities]
+
+   Each thread has a priority, from 0 (the default) to
+   MAX_THREAD_PRIORITY, so that a program can have the threads that
+   answer requests run ahead of those doing batch work on the same
+   Capability.  The run queue is kept in order of priority, highest
+   first, and is FIFO within each priority: appendToRunQueue() puts a
+   thread after the last of its priority, and pushOnRunQueue() before
+   the first.  The scheduler always takes the thread at the front, so
+   a thread only runs when no thread of a higher priority is runnable
+   on its Capability.
+
+   A thread that is woken up waits for the running thread to stop, as
+   before; when that is a thread of a lower priority, that happens at
+   the next context switch, because the running thread then goes back on the queue behind it.
+   So a runnable high priority thread waits for at most one
+   timeslice.  Threads of a low priority may starve, so priorities are
+   for threads that mostly wait.
+
+   When all the threads have the same priority, appendToRunQueue() and
+   pushOnRunQueue() only compare the thread with the one at the end they
+   put it, and do as they always did.  Otherwise insertInRunQueue()
+   walks the queue from the front, past the threads of a higher
+   priority (and of the same, when appending), which are expected to be
+   few.
+
+   Everything else that rearranges the run queue keeps the order:
+   removeFromRunQueue() and schedulePushWork() take threads out without
+   reordering the rest, and threads moved to another Capability are
+   appended there.  A thread that is given a new priority while it is
+   on the run queue is taken out and appended again, by
+   setThreadPriority() in Threads.c, on its own Capability.
+*/
+
+void
+insertInRunQueue (Capability *cap, StgTSO *tso, rtsBool first)
+{
+    StgTSO *prev, *t;
+
+    ASSERT(tso->_link == END_TSO_QUEUE);
+
+    // tso goes between prev and t
+    prev = END_TSO_QUEUE;
+    for (t = cap->run_queue_hd; t != END_TSO_QUEUE; prev = t, t = t->_link) {
+        if (t->priority < tso->priority ||
+            (first && t->priority == tso->priority)) {
+            break;
+        }
+    }
+
+    setTSOLink(cap, tso, t);
+    setTSOPrev(cap, tso, prev);
+    if (prev == END_TSO_QUEUE) {
+        cap->run_queue_hd = tso;
+    } else {
+        setTSOLink(cap, prev, tso);
+    }
+    if (t == END_TSO_QUEUE) {
+        cap->run_queue_tl = tso;
+    } else {
+        setTSOPrev(cap, t, tso);
+    }
+    cap->n_run_queue++;
+}
+
 void
 removeFromRunQueue (Capability *cap, StgTSO *tso)
 {
@@ -579,6 +735,7 @@ removeFromRunQueue (Capability *cap, StgTSO *tso)
         setTSOPrev(cap, tso->_link, tso->block_info.prev);
     }
     tso->_link = tso->block_info.prev = END_TSO_QUEUE;
+    cap->n_run_queue--;
 
     IF_DEBUG(sanity, checkRunQueue(cap));
 }
@@ -617,6 +774,8 @@ scheduleFindWork (Capability **pcap)
 
     scheduleProcessInbox(pcap);
 
+    scheduleStartAsyncCalls(*pcap);
+
     scheduleCheckBlockedThreads(*pcap);
 
 #if defined(THREADED_RTS)
@@ -671,6 +830,7 @@ scheduleYield (Capability **pcap, Task *task)
     if (!shouldYieldCapability(cap,task,rtsFalse) &&
         (!emptyRunQueue(cap) ||
          !emptyInbox(cap) ||
+         cap->async_calls != NULL ||
          sched_state >= SCHED_INTERRUPTING)) {
         return;
     }
@@ -721,6 +881,8 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
     // First grab as many free Capabilities as we can.
     for (i=0, n_free_caps=0; i < n_capabilities; i++) {
         cap0 = capabilities[i];
+        // only within our pool, see Note [Capability pools]
+        if (cap0->pool != cap->pool) continue;
         if (cap != cap0 && !cap0->disabled && tryGrabCapability(cap0,task)) {
             if (!emptyRunQueue(cap0)
                 || cap0->returning_tasks_hd != NULL
@@ -786,6 +948,7 @@ schedulePushWork(Capability *cap USED_IF_THREADS,
                     prev = t;
                 } else {
                     appendToRunQueue(free_caps[i],t);
+                    cap->n_run_queue--;
 
                     traceEventMigrateThread (cap, t, free_caps[i]->no);
 
@@ -863,21 +1026,92 @@ scheduleStartSignalHandlers(Capability *cap STG_UNUSED)
  * ------------------------------------------------------------------------- */
 
 static void
-scheduleCheckBlockedThreads(Capability *cap USED_IF_NOT_THREADS)
+scheduleCheckBlockedThreads(Capability *cap STG_UNUSED)
 {
-#if !defined(THREADED_RTS)
+#if defined(THREADED_RTS)
+#if !defined(mingw32_HOST_OS)
+    // raise the exceptions of threads whose deadlines have passed
+    if (!NO_THREAD_DEADLINES()) {
+        checkThreadDeadlines(cap);
+    }
+#endif
+#else
     //
     // Check whether any waiting threads need to be woken up.  If the
     // run queue is empty, and there are no other tasks running, we
     // can wait indefinitely for something to happen.
     //
-    if ( !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue) )
+    if ( !emptyQueue(blocked_queue_hd) || !EMPTY_SLEEPING_QUEUE()
+         || !NO_THREAD_DEADLINES() )
     {
         awaitEvent (emptyRunQueue(cap));
     }
 #endif
 }
 
+/* ----------------------------------------------------------------------------
+ * Budgeted idle GC (+RTS -Ibudget=<ms>)
+ *
+ * The idle GC is a major GC, so with a large heap the first request to
+ * arrive after an idle spell can wait seconds for it.  With a budget,
+ * the idle GC collects the generations one at a time instead, from the
+ * youngest up, each as a GC of its own, so that the other Capabilities
+ * can take up work between them.  Before each one we look at the run
+ * queues: if any Capability has work we stop, and the idle GC starts
+ * afresh the next time the system is idle.  We also stop before a
+ * generation whose last collection took longer than the budget: then
+ * the older generations, and the deadlock detection that the major GC
+ * does, wait until the GC next needs to collect them, as with -I0.
+ *
+ * Returns rtsTrue when the major GC is within the budget, for the
+ * caller to do it as the idle GC always did.
+ * ------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+static rtsBool
+scheduleIdleGC (Capability **pcap, Task *task)
+{
+    nat g, i;
+
+    g = calcNeeded(rtsFalse, NULL);
+    for (;;) {
+        if (stat_lastGCPause(g) > RtsFlags.GcFlags.idleGCBudget) {
+            debugTrace(DEBUG_sched,
+                       "idle GC: generation %d is over budget", g);
+            recent_activity = ACTIVITY_DONE_GC;
+#ifndef PROFILING
+            stopTimer();
+#endif
+            return rtsFalse;
+        }
+
+        if (g == oldest_gen->no) {
+            return rtsTrue;
+        }
+
+        // This peeks at the other Capabilities' run queues without any
+        // locking, but it's only a hint.
+        for (i = 0; i < n_capabilities; i++) {
+            if (!emptyRunQueue(capabilities[i])) {
+                debugTrace(DEBUG_sched, "idle GC: stopping for work");
+                recent_activity = ACTIVITY_YES;
+                return rtsFalse;
+            }
+        }
+
+        idle_gc_gen = g;
+        scheduleDoGC(pcap, task, rtsFalse);
+        idle_gc_gen = 0;
+
+        // scheduleDoGC() has reset recent_activity, but we are still
+        // idle until we have finished
+        recent_activity = ACTIVITY_INACTIVE;
+
+        g = stg_max(g + 1, calcNeeded(rtsFalse, NULL));
+    }
+}
+#endif
+
 /* ----------------------------------------------------------------------------
  * Detect deadlock conditions and attempt to resolve them.
  * ------------------------------------------------------------------------- */
@@ -902,6 +1136,17 @@ scheduleDetectDeadlock (Capability **pcap, Task *task)
          * any threads to run currently.
          */
         if (recent_activity != ACTIVITY_INACTIVE) return;
+
+        // Nor while a thread has a deadline: it will have something to
+        // do when the deadline passes, and the idle GC would stop the
+        // timer that tells us (see "Thread deadlines" in Select.c)
+        if (!NO_THREAD_DEADLINES()) return;
+
+        if (RtsFlags.GcFlags.idleGCBudget != 0 &&
+            !scheduleIdleGC(pcap, task)) {
+            return;
+        }
+        cap = *pcap;
 #endif
 
         debugTrace(DEBUG_sched, "deadlocked, forcing major GC...");
@@ -996,8 +1241,7 @@ static void
 scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
 {
 #if defined(THREADED_RTS)
-    Message *m, *next;
-    int r;
+    Message *m, *next, *prev;
     Capability *cap = *pcap;
 
     while (!emptyInbox(cap)) {
@@ -1007,23 +1251,22 @@ scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
             cap = *pcap;
         }
 
-        // don't use a blocking acquire; if the lock is held by
-        // another thread then just carry on.  This seems to avoid
-        // getting stuck in a message ping-pong situation with other
-        // processors.  We'll check the inbox again later anyway.
-        //
-        // We should really use a more efficient queue data structure
-        // here.  The trickiness is that we must ensure a Capability
-        // never goes idle if the inbox is non-empty, which is why we
-        // use cap->lock (cap->lock is released as the last thing
-        // before going idle; see Capability.c:releaseCapability()).
-        r = TRY_ACQUIRE_LOCK(&cap->lock);
-        if (r != 0) return;
-
-        m = cap->inbox;
-        cap->inbox = (Message*)END_TSO_QUEUE;
+        // Take the whole inbox at once; senders push onto it without
+        // a lock (see sendMessage() in Messages.c), so we never wait
+        // for them here.
+        m = (Message*)xchg((StgPtr)&cap->inbox, (StgWord)END_TSO_QUEUE);
 
-        RELEASE_LOCK(&cap->lock);
+        // The inbox is a stack; turn it around, so that the messages
+        // from each sender run in the order they were sent (two
+        // MSG_SET_PRIORITY for the same thread must not swap).
+        prev = (Message*)END_TSO_QUEUE;
+        while (m != (Message*)END_TSO_QUEUE) {
+            next = m->link;
+            m->link = prev;
+            prev = m;
+            m = next;
+        }
+        m = prev;
 
         while (m != (Message*)END_TSO_QUEUE) {
             next = m->link;
@@ -1034,6 +1277,42 @@ scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
 #endif
 }
 
+/* ----------------------------------------------------------------------------
+ * Start threads for the calls queued by rts_evalAsync()
+ * ------------------------------------------------------------------------- */
+
+static void
+scheduleStartAsyncCalls (Capability *cap)
+{
+    AsyncCall *a, *next, *calls;
+    StgClosure *p;
+    StgTSO *tso;
+
+    if (cap->async_calls == NULL) return;
+
+    a = (AsyncCall*)xchg((StgPtr)&cap->async_calls, (StgWord)NULL);
+
+    // The list is most recent first; start the calls in the order in
+    // which they were made.
+    calls = NULL;
+    for (; a != NULL; a = next) {
+        next = a->link;
+        a->link = calls;
+        calls = a;
+    }
+
+    for (a = calls; a != NULL; a = next) {
+        next = a->link;
+        p = (StgClosure *)deRefStablePtr(a->fn);
+        if (a->has_arg) {
+            p = rts_apply(cap, p, rts_mkPtr(cap, a->arg));
+        }
+        tso = createIOThread(cap, RtsFlags.GcFlags.initialStkSize, p);
+        scheduleThread(cap, tso);
+        stgFree(a);
+    }
+}
+
 /* ----------------------------------------------------------------------------
  * Activate spark threads (PARALLEL_HASKELL and THREADED_RTS)
  * ------------------------------------------------------------------------- */
@@ -1042,7 +1321,7 @@ scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
 static void
 scheduleActivateSpark(Capability *cap)
 {
-    if (anySparks() && !cap->disabled)
+    if (anySparks(cap) && !cap->disabled)
     {
         createSparkThread(cap);
         debugTrace(DEBUG_sched, "creating a spark thread");
@@ -1147,6 +1426,7 @@ scheduleHandleHeapOverflow( Capability *cap, StgTSO *t )
                 bdescr *x;
                 for (x = bd; x < bd + blocks; x++) {
                     initBdescr(x,g0,g0);
+                    x->dest_no = cap->pretenure_gen;
                     x->free = x->start;
                     x->flags = 0;
                 }
@@ -1266,7 +1546,7 @@ scheduleHandleThreadBlocked( StgTSO *t
  * -------------------------------------------------------------------------- */
 
 static rtsBool
-scheduleHandleThreadFinished (Capability *cap STG_UNUSED, Task *task, StgTSO *t)
+scheduleHandleThreadFinished (Capability *cap, Task *task, StgTSO *t)
 {
     /* Need to check whether this was a main thread, and if so,
      * return with the return value.
@@ -1347,6 +1627,9 @@ scheduleHandleThreadFinished (Capability *cap STG_UNUSED, Task *task, StgTSO *t)
           return rtsTrue; // tells schedule() to return
       }
 
+      // nothing will look at the stack of an unbound thread again
+      releaseThreadStack(cap, t);
+
       return rtsFalse;
 }
 
@@ -1409,15 +1692,30 @@ static nat requestSync (Capability **pcap, Task *task, nat sync_type)
 // Only call this after requestSync(), otherwise a deadlock might
 // ensue if another thread is trying to synchronise.
 //
-static void acquireAllCapabilities(Capability *cap, Task *task)
+// If last_cap isn't NULL, set it to the Capability that we waited for
+// longest, and *last_thread to the thread it was running when we
+// started waiting (0 if none), for the sync statistics.
+//
+static void acquireAllCapabilities(Capability *cap, Task *task,
+                                   nat *last_cap, StgWord64 *last_thread)
 {
     Capability *tmpcap;
     nat i;
+    StgTSO *tso;
+    Time start, wait, longest = 0;
+
+    if (last_cap != NULL) {
+        *last_cap = cap->no;
+        *last_thread = 0;
+    }
 
     for (i=0; i < n_capabilities; i++) {
         debugTrace(DEBUG_sched, "grabbing all the capabilies (%d/%d)", i, n_capabilities);
         tmpcap = capabilities[i];
         if (tmpcap != cap) {
+            // not our Capability yet, so the thread is only a hint
+            tso = tmpcap->r.rCurrentTSO;
+            start = last_cap != NULL ? getProcessElapsedTime() : 0;
             // we better hope this task doesn't get migrated to
             // another Capability while we're waiting for this one.
             // It won't, because load balancing happens while we have
@@ -1428,6 +1726,14 @@ static void acquireAllCapabilities(Capability *cap, Task *task)
             if (tmpcap->no != i) {
                 barf("acquireAllCapabilities: got the wrong capability");
             }
+            if (last_cap != NULL) {
+                wait = getProcessElapsedTime() - start;
+                if (wait > longest) {
+                    longest = wait;
+                    *last_cap = i;
+                    *last_thread = tso != NULL ? tso->id : 0;
+                }
+            }
         }
     }
     task->cap = cap;
@@ -1460,8 +1766,11 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
     nat collect_gen;
 #ifdef THREADED_RTS
     nat gc_type;
-    nat i, sync;
+    nat i, sync, n_wanted;
     StgTSO *tso;
+    Time sync_start;
+    nat sync_last_cap;
+    StgWord64 sync_last_thread;
 #endif
 
     if (sched_state == SCHED_SHUTTING_DOWN) {
@@ -1475,19 +1784,44 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
 
     // Figure out which generation we are collecting, so that we can
     // decide whether this is a parallel GC or not.
-    collect_gen = calcNeeded(force_major || heap_census, NULL);
+    collect_gen = calcNeeded(force_major || heap_census
+                             || performHeapSnapshot, NULL);
+#ifdef THREADED_RTS
+    // a slice of the idle GC, see scheduleIdleGC()
+    collect_gen = stg_max(collect_gen, idle_gc_gen);
+#endif
 
 #ifdef THREADED_RTS
     if (sched_state < SCHED_INTERRUPTING
         && RtsFlags.ParFlags.parGcEnabled
         && collect_gen >= RtsFlags.ParFlags.parGcGen
-        && ! oldest_gen->mark)
+        // With more Capabilities than CPUs, some GC threads will have
+        // been descheduled by the OS, and each step of a parallel GC
+        // waits for all of them.  That costs more than it saves in a
+        // minor GC, so those are done by this Capability alone.
+        && (collect_gen > 0 || enabled_capabilities <= usable_cpus)
+        && (! oldest_gen->mark
+            // a major mark/sweep or mark/compact GC can share out the
+            // sweep or the compaction (see par_sweep() in GC.c)
+            || collect_gen == oldest_gen->no))
     {
         gc_type = SYNC_GC_PAR;
     } else {
         gc_type = SYNC_GC_SEQ;
     }
 
+    // How many GC threads is this collection worth?  (+RTS -qn)
+    if (RtsFlags.ParFlags.parGcAuto) {
+        n_wanted = gcThreadsWanted(collect_gen);
+    } else if (RtsFlags.ParFlags.parGcThreads != 0) {
+        n_wanted = RtsFlags.ParFlags.parGcThreads;
+    } else {
+        n_wanted = n_capabilities;
+    }
+    if (gc_type == SYNC_GC_PAR && n_wanted <= 1) {
+        gc_type = SYNC_GC_SEQ;
+    }
+
     // In order to GC, there must be no threads running Haskell code.
     // Therefore, the GC thread needs to hold *all* the capabilities,
     // and release them after the GC has completed.
@@ -1520,6 +1854,9 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
         }
     } while (sync);
 
+    // the time to safepoint: see stat_endSync()
+    sync_start = getProcessElapsedTime();
+
     // don't declare this until after we have sync'd, because
     // n_capabilities may change.
     rtsBool idle_cap[n_capabilities];
@@ -1545,7 +1882,7 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
     if (gc_type == SYNC_GC_SEQ)
     {
         // single-threaded GC: grab all the capabilities
-        acquireAllCapabilities(cap,task);
+        acquireAllCapabilities(cap,task,&sync_last_cap,&sync_last_thread);
     }
     else
     {
@@ -1557,7 +1894,30 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
         // up an idle Capability takes much longer than just doing any
         // GC work on its behalf.
 
-        if (RtsFlags.ParFlags.parGcNoSyncWithIdle == 0
+        // With -qn we want only n_wanted GC threads: ourselves, the
+        // Capabilities that we cannot grab (they have to stop
+        // mutating anyway), and as many of the others as it takes.
+
+        if (n_wanted < n_capabilities) {
+            nat n_gc = 1;
+            for (i=0; i < n_capabilities; i++) {
+                if (capabilities[i]->disabled) {
+                    idle_cap[i] = tryGrabCapability(capabilities[i], task);
+                } else if (i == cap->no) {
+                    idle_cap[i] = rtsFalse;
+                } else if (n_gc < n_wanted) {
+                    idle_cap[i] = rtsFalse;
+                    n_gc++;
+                } else {
+                    idle_cap[i] = tryGrabCapability(capabilities[i], task);
+                    if (!idle_cap[i]) {
+                        n_gc++;
+                    } else {
+                        n_idle_caps++;
+                    }
+                }
+            }
+        } else if (RtsFlags.ParFlags.parGcNoSyncWithIdle == 0
             || (RtsFlags.ParFlags.parGcLoadBalancingEnabled &&
                 collect_gen >= RtsFlags.ParFlags.parGcLoadBalancingGen)) {
             for (i=0; i < n_capabilities; i++) {
@@ -1601,7 +1961,7 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
 
         // For all capabilities participating in this GC, wait until
         // they have stopped mutating and are standing by for GC.
-        waitForGcThreads(cap);
+        waitForGcThreads(cap,&sync_last_cap,&sync_last_thread);
 
 #if defined(THREADED_RTS)
         // Stable point where we can do a global check on our spark counters
@@ -1609,6 +1969,8 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
 #endif
     }
 
+    stat_endSync(cap, getProcessElapsedTime() - sync_start,
+                 sync_last_cap, sync_last_thread);
 #endif
 
     IF_DEBUG(scheduler, printAllThreads());
@@ -1677,7 +2039,8 @@ delete_threads_and_gc:
 
     switch (recent_activity) {
     case ACTIVITY_INACTIVE:
-        if (force_major) {
+        // (the timer must keep going for the thread deadlines, though)
+        if (force_major && NO_THREAD_DEADLINES()) {
             // We are doing a GC because the system has been idle for a
             // timeslice and we need to check for deadlock.  Record the
             // fact that we've done a GC and turn off the timer signal;
@@ -1713,6 +2076,17 @@ delete_threads_and_gc:
         performHeapProfile = rtsFalse;
     }
 
+#ifdef TRACING
+    // All the capabilities are stopped, so none of them is posting
+    // events: write out the --eventlog-ring buffers if asked to
+    if (performEventLogDump) {
+        performEventLogDump = rtsFalse;
+        dumpEventLog();
+    } else if (eventLogSubscribed()) {
+        flushEventLogBuffers();
+    }
+#endif
+
 #if defined(THREADED_RTS)
 
     // If n_capabilities has changed during GC, we're in trouble.
@@ -1766,6 +2140,10 @@ delete_threads_and_gc:
         // release our stash of capabilities.
         releaseAllCapabilities(n_capabilities, cap, task);
     }
+
+    // Now that the other Capabilities are running again, free what the
+    // GC left behind (see Note [Deferred freeing] in BlockAlloc.c).
+    freeDeferredChains_lock();
 #endif
 
     return;
@@ -1805,7 +2183,7 @@ forkProcess(HsStablePtr *entry
         sync = requestSync(&cap, task, SYNC_OTHER);
     } while (sync);
 
-    acquireAllCapabilities(cap,task);
+    acquireAllCapabilities(cap,task,NULL,NULL);
 
     pending_sync = 0;
 #endif
@@ -1864,6 +2242,7 @@ forkProcess(HsStablePtr *entry
         initMutex(&sched_mutex);
         initMutex(&sm_mutex);
         initMutex(&stable_mutex);
+        initThreadDeadlines();
         initMutex(&task->lock);
 
         for (i=0; i < n_capabilities; i++) {
@@ -1877,12 +2256,23 @@ forkProcess(HsStablePtr *entry
         resetTracing();
 #endif
 
+#if !defined(THREADED_RTS)
+        resetAwaitEvent();
+#endif
+#if defined(linux_HOST_OS) && !defined(THREADED_RTS)
+        resetAsyncIO();
+#endif
+        // our counters count the thread in the parent
+        perfCountersStartTask(task);
+        resetMetrics();
+
         // Now, all OS threads except the thread that forked are
         // stopped.  We need to stop all Haskell threads, including
         // those involved in foreign calls.  Also we need to delete
         // all Tasks, because they correspond to OS threads that are
         // now gone.
 
+        collectFreshThreads();
         for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
           for (t = generations[g].threads; t != END_TSO_QUEUE; t = next) {
                 next = t->global_link;
@@ -1946,6 +2336,9 @@ forkProcess(HsStablePtr *entry
         initTimer();
         startTimer();
 
+        // after discardTasksExcept(): the new thread makes a Task
+        resetCFinalizerThread();
+
         // TODO: need to trace various other things in the child
         // like startup event, capabilities, process info etc
         traceTaskCreate(task, cap);
@@ -2012,7 +2405,7 @@ setNumCapabilities (nat new_n_capabilities USED_IF_THREADS)
         sync = requestSync(&cap, task, SYNC_OTHER);
     } while (sync);
 
-    acquireAllCapabilities(cap,task);
+    acquireAllCapabilities(cap,task,NULL,NULL);
 
     pending_sync = 0;
 
@@ -2068,6 +2461,7 @@ setNumCapabilities (nat new_n_capabilities USED_IF_THREADS)
             // them to existing capsets.
             tracingAddCapapilities(n_capabilities, new_n_capabilities);
 #endif
+            perfCountersAddCapabilities(new_n_capabilities);
 
             // Resize the capabilities array
             // NB. after this, capabilities points somewhere new.  Any pointers
@@ -2119,6 +2513,7 @@ deleteAllThreads ( Capability *cap )
     nat g;
 
     debugTrace(DEBUG_sched,"deleting all threads");
+    collectFreshThreads();
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         for (t = generations[g].threads; t != END_TSO_QUEUE; t = next) {
                 next = t->global_link;
@@ -2134,7 +2529,7 @@ deleteAllThreads ( Capability *cap )
 
 #if !defined(THREADED_RTS)
     ASSERT(blocked_queue_hd == END_TSO_QUEUE);
-    ASSERT(sleeping_queue == END_TSO_QUEUE);
+    ASSERT(EMPTY_SLEEPING_QUEUE());
 #endif
 }
 
@@ -2176,6 +2571,28 @@ recoverSuspendedTask (Capability *cap, Task *task)
     incall->next = incall->prev = NULL;
 }
 
+/* Note [fast resume]
+
+   A safe foreign call gives up its Capability in suspendThread(), and
+   most of the time, if the call is short, nobody else wants it before
+   the call returns.  So resumeThread() first tries to claim the
+   Capability it left with a single cas on cap->running_task, without
+   taking cap->lock, and only goes through waitForReturnCapability()
+   if that fails.  We don't try if other Tasks are queued to return,
+   so as not to jump the queue, or if a sync is pending.
+
+   For this to be safe every claim of a free Capability has to be a
+   cas (claimCapability()), even the ones made with cap->lock held,
+   and releaseCapability_() must not make the Capability look free
+   while it is still deciding whether to hand it to a new worker.  A
+   Task that has been woken up to take a Capability may now find that
+   resumeThread() got there first; it just goes back to sleep, as it
+   would if any other Task had won, and it will be woken again when the
+   Capability is released.
+
+   +RTS -s reports how many returns took the fast path.
+   -------------------------------------------------------------------------- */
+
 /* ---------------------------------------------------------------------------
  * Suspending & resuming Haskell threads.
  *
@@ -2219,6 +2636,9 @@ suspendThread (StgRegTable *reg, rtsBool interruptible)
   tso = cap->r.rCurrentTSO;
 
   traceEventStopThread(cap, tso, THREAD_SUSPENDED_FOREIGN_CALL, 0);
+  dtraceFfiSuspend((EventCapNo)cap->no, (EventThreadID)tso->id,
+                   (StgWord)interruptible);
+  metricsCapState(cap, RTS_METRICS_CAP_SCHEDULER);
 
   // XXX this might not be necessary --SDM
   tso->what_next = ThreadRunGHC;
@@ -2274,11 +2694,26 @@ resumeThread (void *task_)
     cap = incall->suspended_cap;
     task->cap = cap;
 
-    // Wait for permission to re-enter the RTS with the result.
-    waitForReturnCapability(&cap,task);
-    // we might be on a different capability now... but if so, our
-    // entry on the suspended_ccalls list will also have been
-    // migrated.
+#if defined(THREADED_RTS)
+    // See Note [fast resume]
+    if (cap->returning_tasks_hd == NULL && pending_sync == 0
+        && claimCapability(cap, task)) {
+#ifdef PROFILING
+        cap->r.rCCCS = CCS_SYSTEM;
+#endif
+        cap->fast_resumes++;
+    } else
+#endif
+    {
+        // Wait for permission to re-enter the RTS with the result.
+        waitForReturnCapability(&cap,task);
+        // we might be on a different capability now... but if so, our
+        // entry on the suspended_ccalls list will also have been
+        // migrated.
+    }
+#if defined(THREADED_RTS)
+    cap->resumes++;
+#endif
 
     // Remove the thread from the suspended list
     recoverSuspendedTask(cap,task);
@@ -2289,6 +2724,8 @@ resumeThread (void *task_)
     tso->_link = END_TSO_QUEUE; // no write barrier reqd
 
     traceEventRunThread(cap, tso);
+    dtraceFfiResume((EventCapNo)cap->no, (EventThreadID)tso->id);
+    metricsCapState(cap, RTS_METRICS_CAP_RUNNING);
 
     /* Reset blocking status */
     tso->why_blocked  = NotBlocked;
@@ -2301,6 +2738,7 @@ resumeThread (void *task_)
     }
 
     cap->r.rCurrentTSO = tso;
+    cap->pretenure_gen = tso->pretenure_gen;
     cap->in_haskell = rtsTrue;
     errno = saved_errno;
 #if mingw32_HOST_OS
@@ -2332,6 +2770,15 @@ scheduleThread(Capability *cap, StgTSO *tso)
     // The thread goes at the *end* of the run-queue, to avoid possible
     // starvation of any threads already on the queue.
     appendToRunQueue(cap,tso);
+
+#if defined(THREADED_RTS)
+    // Some Capability is idle and waiting for work: return to the
+    // scheduler soon so that schedulePushWork() can give it a thread.
+    // See requestWork() in Capability.c.
+    if (n_hungry_capabilities > 0) {
+        contextSwitchCapability(cap);
+    }
+#endif
 }
 
 void
@@ -2450,7 +2897,6 @@ initScheduler(void)
 #if !defined(THREADED_RTS)
   blocked_queue_hd  = END_TSO_QUEUE;
   blocked_queue_tl  = END_TSO_QUEUE;
-  sleeping_queue    = END_TSO_QUEUE;
 #endif
 
   sched_state    = SCHED_RUNNING;
@@ -2460,6 +2906,17 @@ initScheduler(void)
   /* Initialise the mutex and condition variables used by
    * the scheduler. */
   initMutex(&sched_mutex);
+#if !defined(mingw32_HOST_OS)
+  initThreadDeadlines();
+#endif
+
+  usable_cpus = getNumberOfProcessors();
+  {
+      nat limit = cgroupCpuLimit();
+      if (limit != 0 && limit < usable_cpus) {
+          usable_cpus = limit;
+      }
+  }
 #endif
 
   ACQUIRE_LOCK(&sched_mutex);
@@ -2511,6 +2968,38 @@ exitScheduler (rtsBool wait_foreign USED_IF_THREADS)
     boundTaskExiting(task);
 }
 
+/* -----------------------------------------------------------------------------
+   haltScheduler()
+
+   Stop all the Capabilities where they are, without a GC, for +RTS
+   --fast-exit.  The calling OS thread keeps every Capability, so no
+   Haskell code runs again, and it must be about to exit the process.
+   -------------------------------------------------------------------------- */
+
+void
+haltScheduler (void)
+{
+#if defined(THREADED_RTS)
+    Task *task;
+    Capability *cap;
+    nat sync;
+
+    task = newBoundTask();
+
+    cap = NULL;
+    waitForReturnCapability(&cap, task);
+
+    do {
+        sync = requestSync(&cap, task, SYNC_OTHER);
+    } while (sync);
+
+    acquireAllCapabilities(cap,task,NULL,NULL);
+
+    pending_sync = 0;
+#endif
+    sched_state = SCHED_SHUTTING_DOWN;
+}
+
 void
 freeScheduler( void )
 {
@@ -2530,16 +3019,23 @@ freeScheduler( void )
     RELEASE_LOCK(&sched_mutex);
 #if defined(THREADED_RTS)
     closeMutex(&sched_mutex);
+#if !defined(mingw32_HOST_OS)
+    freeThreadDeadlines();
+#endif
 #endif
 }
 
-void markScheduler (evac_fn evac USED_IF_NOT_THREADS,
-                    void *user USED_IF_NOT_THREADS)
+void markScheduler (evac_fn evac STG_UNUSED, void *user STG_UNUSED)
 {
 #if !defined(THREADED_RTS)
     evac(user, (StgClosure **)(void *)&blocked_queue_hd);
     evac(user, (StgClosure **)(void *)&blocked_queue_tl);
-    evac(user, (StgClosure **)(void *)&sleeping_queue);
+#if !defined(mingw32_HOST_OS)
+    markSleepingThreads(evac, user);
+#endif
+#endif
+#if !defined(mingw32_HOST_OS)
+    markThreadDeadlines(evac, user);
 #endif
 }
 
@@ -2673,6 +3169,8 @@ raiseExceptionHelper (StgRegTable *reg, StgTSO *tso, StgClosure *exception)
     StgThunk *raise_closure = NULL;
     StgPtr p, next;
     StgRetInfoTable *info;
+    StgWord frame_type;
+    nat frames = 0, updates = 0;
     //
     // This closure represents the expression 'raise# E' where E
     // is the exception raise.  It is used to overwrite all the
@@ -2697,10 +3195,16 @@ raiseExceptionHelper (StgRegTable *reg, StgTSO *tso, StgClosure *exception)
     // we update any closures pointed to from update frames with the
     // raise closure that we just built.
     //
+    // We can't go straight to the catch frame: every update frame on
+    // the way is for a thunk under evaluation, which other threads may
+    // be blocked on, so each must be updated.  But with scheduler
+    // tracing on, EVENT_EXCEPTION_RAISE says how far we went.
+    //
     p = tso->stackobj->sp;
     while(1) {
         info = get_ret_itbl((StgClosure *)p);
         next = p + stack_frame_sizeW((StgClosure *)p);
+        frames++;
         switch (info->i.type) {
 
         case UPDATE_FRAME:
@@ -2713,32 +3217,34 @@ raiseExceptionHelper (StgRegTable *reg, StgTSO *tso, StgClosure *exception)
             }
             updateThunk(cap, tso, ((StgUpdateFrame *)p)->updatee,
                         (StgClosure *)raise_closure);
+            updates++;
             p = next;
             continue;
 
         case ATOMICALLY_FRAME:
             debugTrace(DEBUG_stm, "found ATOMICALLY_FRAME at %p", p);
-            tso->stackobj->sp = p;
-            return ATOMICALLY_FRAME;
+            frame_type = ATOMICALLY_FRAME;
+            goto found;
 
         case CATCH_FRAME:
-            tso->stackobj->sp = p;
-            return CATCH_FRAME;
+            frame_type = CATCH_FRAME;
+            goto found;
 
         case CATCH_STM_FRAME:
             debugTrace(DEBUG_stm, "found CATCH_STM_FRAME at %p", p);
-            tso->stackobj->sp = p;
-            return CATCH_STM_FRAME;
+            frame_type = CATCH_STM_FRAME;
+            goto found;
 
         case UNDERFLOW_FRAME:
             tso->stackobj->sp = p;
             threadStackUnderflow(cap,tso);
             p = tso->stackobj->sp;
+            frames--;           // not a frame of the computation
             continue;
 
         case STOP_FRAME:
-            tso->stackobj->sp = p;
-            return STOP_FRAME;
+            frame_type = STOP_FRAME;
+            goto found;
 
         case CATCH_RETRY_FRAME: {
             StgTRecHeader *trec = tso -> trec;
@@ -2758,6 +3264,11 @@ raiseExceptionHelper (StgRegTable *reg, StgTSO *tso, StgClosure *exception)
             continue;
         }
     }
+
+found:
+    tso->stackobj->sp = p;
+    traceEventExceptionRaise(cap, tso, frames, updates);
+    return frame_type;
 }
 
 
@@ -22,6 +22,7 @@
  */
 void initScheduler (void);
 void exitScheduler (rtsBool wait_foreign);
+void haltScheduler (void);
 void freeScheduler (void);
 void markScheduler (evac_fn evac, void *user);
 
@@ -100,7 +101,30 @@ extern volatile StgWord recent_activity;
 extern  StgTSO *blackhole_queue;
 #if !defined(THREADED_RTS)
 extern  StgTSO *blocked_queue_hd, *blocked_queue_tl;
-extern  StgTSO *sleeping_queue;
+#endif
+
+/* Threads blocked in threadDelay, in the non-threaded RTS on POSIX
+ * systems only (see rts/posix/Select.c).
+ */
+#if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+extern  nat n_sleeping_threads;
+void insertSleepingThread (StgTSO *tso, StgWord target);
+void removeSleepingThread (StgTSO *tso);
+void markSleepingThreads  (evac_fn evac, void *user);
+#endif
+
+/* Thread deadlines (System.Timeout), on POSIX systems only (see
+ * rts/posix/Select.c).
+ */
+#if !defined(mingw32_HOST_OS)
+extern  nat n_thread_deadlines;
+void markThreadDeadlines  (evac_fn evac, void *user);
+#if defined(THREADED_RTS)
+void    initThreadDeadlines  (void);
+void    freeThreadDeadlines  (void);
+rtsBool threadDeadlineDue    (void);
+void    checkThreadDeadlines (Capability *cap);
+#endif
 #endif
 
 extern rtsBool heap_overflow;
@@ -122,7 +146,14 @@ void resurrectThreads (StgTSO *);
 
 /* END_TSO_QUEUE and friends now defined in includes/stg/MiscClosures.h */
 
-/* Add a thread to the end of the run queue.
+/* Put a thread in its place among threads of other priorities, see
+ * Note [Thread priorities] in Schedule.c.  Slow path of the functions
+ * below.
+ */
+void insertInRunQueue (Capability *cap, StgTSO *tso, rtsBool first);
+
+/* Add a thread to the end of the run queue, or rather to the end of
+ * the threads of its priority.
  * NOTE: tso->link should be END_TSO_QUEUE before calling this macro.
  * ASSUMES: cap->running_task is the current task.
  */
@@ -136,14 +167,19 @@ appendToRunQueue (Capability *cap, StgTSO *tso)
     if (cap->run_queue_hd == END_TSO_QUEUE) {
         cap->run_queue_hd = tso;
         tso->block_info.prev = END_TSO_QUEUE;
+    } else if (tso->priority > cap->run_queue_tl->priority) {
+        insertInRunQueue(cap, tso, rtsFalse);
+        return;
     } else {
         setTSOLink(cap, cap->run_queue_tl, tso);
         setTSOPrev(cap, tso, cap->run_queue_tl);
     }
     cap->run_queue_tl = tso;
+    cap->n_run_queue++;
 }
 
-/* Push a thread on the beginning of the run queue.
+/* Push a thread on the beginning of the run queue, or rather of the
+ * threads of its priority.
  * ASSUMES: cap->running_task is the current task.
  */
 EXTERN_INLINE void
@@ -152,6 +188,11 @@ pushOnRunQueue (Capability *cap, StgTSO *tso);
 EXTERN_INLINE void
 pushOnRunQueue (Capability *cap, StgTSO *tso)
 {
+    if (cap->run_queue_hd != END_TSO_QUEUE &&
+        tso->priority < cap->run_queue_hd->priority) {
+        insertInRunQueue(cap, tso, rtsTrue);
+        return;
+    }
     setTSOLink(cap, tso, cap->run_queue_hd);
     tso->block_info.prev = END_TSO_QUEUE;
     if (cap->run_queue_hd != END_TSO_QUEUE) {
@@ -161,6 +202,7 @@ pushOnRunQueue (Capability *cap, StgTSO *tso)
     if (cap->run_queue_tl == END_TSO_QUEUE) {
         cap->run_queue_tl = tso;
     }
+    cap->n_run_queue++;
 }
 
 /* Pop the first thread off the runnable queue.
@@ -178,6 +220,7 @@ popRunQueue (Capability *cap)
     if (cap->run_queue_hd == END_TSO_QUEUE) {
         cap->run_queue_tl = END_TSO_QUEUE;
     }
+    cap->n_run_queue--;
     return t;
 }
 
@@ -234,11 +277,24 @@ truncateRunQueue(Capability *cap)
 {
     cap->run_queue_hd = END_TSO_QUEUE;
     cap->run_queue_tl = END_TSO_QUEUE;
+    cap->n_run_queue = 0;
 }
 
 #if !defined(THREADED_RTS)
 #define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd))
-#define EMPTY_SLEEPING_QUEUE() (emptyQueue(sleeping_queue))
+#if defined(mingw32_HOST_OS)
+#define EMPTY_SLEEPING_QUEUE() rtsTrue
+#else
+#define EMPTY_SLEEPING_QUEUE() (n_sleeping_threads == 0)
+#endif
+#endif
+
+// in the threaded RTS, only a hint: n_thread_deadlines is read without
+// taking its lock
+#if defined(mingw32_HOST_OS)
+#define NO_THREAD_DEADLINES()  rtsTrue
+#else
+#define NO_THREAD_DEADLINES()  (n_thread_deadlines == 0)
 #endif
 
 INLINE_HEADER rtsBool
@@ -247,6 +303,7 @@ emptyThreadQueues(Capability *cap)
     return emptyRunQueue(cap)
 #if !defined(THREADED_RTS)
         && EMPTY_BLOCKED_QUEUE() && EMPTY_SLEEPING_QUEUE()
+        && NO_THREAD_DEADLINES()
 #endif
     ;
 }
@@ -0,0 +1,502 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Shared-memory message channels between processes
+ *
+ * ---------------------------------------------------------------------------*/
+
+/* Note [Shared memory channels]
+
+   Processes on the same machine that send each other big messages
+   through sockets pay for copying each message into the kernel and
+   out again.  A shared-memory channel is a file, normally on a memory
+   file system such as /dev/shm, that the processes map MAP_SHARED.
+   It holds a ShmHeader and n_slots message buffers of slot_size
+   bytes:
+
+     - rts_sendShmChannel() takes a free buffer, copies the message
+       into it and appends it to the channel's queue.
+
+     - receiveShmChannel# takes the buffer at the head of the queue and
+       maps it into the heap as a ByteArray#, the same way as
+       mapFileByteArray# maps a file (see Note [Mapped byte arrays] in
+       rts/sm/Storage.c), but MAP_SHARED.  So the receiver reads the
+       sender's bytes where the sender wrote them, without copying.
+
+     - When the GC frees the array, freeGroup() calls
+       shmGroupUnmapped(), which puts the buffer back on the channel's
+       free list.  shm_mappings maps the array's block group to its
+       channel and buffer.
+
+   The free list and the queue are linked through the ShmSlots in the
+   header, and are protected by hdr->lock, a spin lock in the shared
+   memory; the processes only hold it to move a buffer from one list to
+   another.  Since several processes use them, the lock and the
+   barriers use the compiler's atomic builtins rather than those of
+   SMP.h, which are plain accesses in the non-threaded RTS.
+
+   A receiver that finds the queue empty sets hdr->waiting and waits
+   for the channel's "bell", a FIFO next to the channel's file, to be
+   readable, with threadWaitRead, so that it waits in the I/O manager
+   like any other thread blocked on a file descriptor.  A sender that
+   finds hdr->waiting set clears it and writes a byte to the bell;
+   receiveShmMessage() empties the bell before it looks at the queue,
+   so a byte written after that always wakes it.
+
+   A buffer is the receiver's until its array is garbage collected, so
+   a receiver that keeps its messages can run the sender out of
+   buffers (rts_sendShmChannel() fails with EAGAIN).  The buffers of a
+   process that dies without exiting normally are lost until the
+   channel is created again.
+   -------------------------------------------------------------------------- */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "ShmChannel.h"
+#include "sm/Storage.h"
+#include "sm/OSMem.h"
+#include "RtsUtils.h"
+#include "Hash.h"
+
+#include <errno.h>
+#include <string.h>
+
+#if !defined(mingw32_HOST_OS)
+
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define SHM_MAGIC 0x4748435348434831ULL   // "GHCSHCH1"
+#define NO_SLOT   0xFFFFFFFF
+
+typedef struct {
+    StgWord32 next;             // next buffer on the free list or queue
+    StgWord32 pad;
+    StgWord64 len;              // length of the message, if queued
+} ShmSlot;
+
+typedef struct {
+    StgWord64 magic;            // SHM_MAGIC once the channel is set up
+    StgWord64 slot_size;
+    StgWord64 data_offset;      // where the buffers start in the file
+    StgWord32 n_slots;
+    volatile StgWord32 lock;
+    StgWord32 waiting;          // a receiver is waiting on the bell
+    StgWord32 free_hd;
+    StgWord32 queue_hd;
+    StgWord32 queue_tl;
+    ShmSlot   slots[];
+} ShmHeader;
+
+typedef struct {
+    int        fd;
+    int        bell;
+    ShmHeader *hdr;             // the whole file, mapped read/write
+    W_         size;
+    nat        refs;            // 1 while open, and 1 per mapped message
+} ShmChannel;
+
+typedef struct {
+    ShmChannel *chan;
+    StgWord32   slot;
+} ShmMapping;
+
+// bdescr of a received message -> ShmMapping
+static HashTable *shm_mappings = NULL;
+
+#if defined(THREADED_RTS)
+static Mutex shm_mutex;         // protects shm_mappings and chan->refs
+#endif
+
+static void
+lockChannel (ShmHeader *hdr)
+{
+    nat spins = 0;
+
+    while (!__sync_bool_compare_and_swap(&hdr->lock, 0, 1)) {
+        if (++spins % 1000 == 0) {
+            sched_yield();
+        }
+#if defined(THREADED_RTS)
+        else {
+            busy_wait_nop();
+        }
+#endif
+    }
+}
+
+static void
+unlockChannel (ShmHeader *hdr)
+{
+    __sync_lock_release(&hdr->lock);
+}
+
+static char *
+bellPath (const char *path)
+{
+    char *bell = stgMallocBytes(strlen(path) + 6, "bellPath");
+    strcpy(bell, path);
+    strcat(bell, ".bell");
+    return bell;
+}
+
+void *
+rts_openShmChannel (const char *path, HsWord slots, HsWord slot_size)
+{
+    ShmChannel *chan;
+    ShmHeader *hdr, h;
+    W_ hdr_size, size;
+    StgWord32 i;
+    char *bell;
+    int fd, err;
+
+    if (BLOCK_SIZE % getPageSize() != 0) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    if (slots > 0) {
+        if (slot_size == 0 || slots >= NO_SLOT) {
+            errno = EINVAL;
+            return NULL;
+        }
+        // the buffers are mapped into block groups
+        slot_size = BLOCK_ROUND_UP(slot_size);
+        hdr_size = BLOCK_ROUND_UP(sizeof(ShmHeader) + slots * sizeof(ShmSlot));
+        if (slot_size > (HS_WORD_MAX - hdr_size) / slots) {
+            errno = EFBIG;
+            return NULL;
+        }
+        size = hdr_size + slots * slot_size;
+
+        h.magic = 0;
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) return NULL;
+        if (ftruncate(fd, (off_t)size) != 0) goto fail_fd;
+    } else {
+        fd = open(path, O_RDWR);
+        if (fd < 0) return NULL;
+        if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)
+            || h.magic != SHM_MAGIC) {
+            errno = EINVAL;
+            goto fail_fd;
+        }
+        slots = h.n_slots;
+        slot_size = h.slot_size;
+        hdr_size = h.data_offset;
+        size = hdr_size + slots * slot_size;
+    }
+
+    hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) goto fail_fd;
+
+    bell = bellPath(path);
+    if (h.magic != SHM_MAGIC) {
+        // we're creating it
+        unlink(bell);
+        if (mkfifo(bell, 0600) != 0 && errno != EEXIST) goto fail_map;
+
+        hdr->slot_size = slot_size;
+        hdr->data_offset = hdr_size;
+        hdr->n_slots = slots;
+        hdr->lock = 0;
+        hdr->waiting = 0;
+        for (i = 0; i < slots; i++) {
+            hdr->slots[i].next = i + 1 < slots ? i + 1 : NO_SLOT;
+            hdr->slots[i].len = 0;
+        }
+        hdr->free_hd = 0;
+        hdr->queue_hd = NO_SLOT;
+        hdr->queue_tl = NO_SLOT;
+        __sync_synchronize();
+        hdr->magic = SHM_MAGIC;
+    }
+
+    // O_RDWR so that opening the FIFO doesn't wait for the other end
+    chan = stgMallocBytes(sizeof(ShmChannel), "rts_openShmChannel");
+    chan->bell = open(bell, O_RDWR | O_NONBLOCK);
+    if (chan->bell < 0) {
+        stgFree(chan);
+        goto fail_map;
+    }
+    stgFree(bell);
+
+    chan->fd = fd;
+    chan->hdr = hdr;
+    chan->size = size;
+    chan->refs = 1;
+    return chan;
+
+fail_map:
+    err = errno;
+    stgFree(bell);
+    munmap(hdr, size);
+    errno = err;
+fail_fd:
+    err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+}
+
+static void
+freeChannel (ShmChannel *chan)
+{
+    munmap(chan->hdr, chan->size);
+    close(chan->fd);
+    close(chan->bell);
+    stgFree(chan);
+}
+
+void
+rts_closeShmChannel (void *p)
+{
+    ShmChannel *chan = p;
+
+    ACQUIRE_LOCK(&shm_mutex);
+    if (--chan->refs == 0) freeChannel(chan);
+    RELEASE_LOCK(&shm_mutex);
+}
+
+int
+rts_shmChannelFd (void *p)
+{
+    return ((ShmChannel *)p)->bell;
+}
+
+HsWord
+rts_shmChannelSlotSize (void *p)
+{
+    return ((ShmChannel *)p)->hdr->slot_size;
+}
+
+static StgWord8 *
+slotData (ShmHeader *hdr, StgWord32 slot)
+{
+    return (StgWord8 *)hdr + hdr->data_offset + (W_)slot * hdr->slot_size;
+}
+
+static void
+freeSlot (ShmHeader *hdr, StgWord32 slot)
+{
+    lockChannel(hdr);
+    hdr->slots[slot].next = hdr->free_hd;
+    hdr->free_hd = slot;
+    unlockChannel(hdr);
+}
+
+int
+rts_sendShmChannel (void *p, const void *buf, HsWord len)
+{
+    ShmChannel *chan = p;
+    ShmHeader *hdr = chan->hdr;
+    StgWord32 slot;
+    rtsBool wake;
+
+    if (len > hdr->slot_size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    lockChannel(hdr);
+    slot = hdr->free_hd;
+    if (slot != NO_SLOT) {
+        hdr->free_hd = hdr->slots[slot].next;
+    }
+    unlockChannel(hdr);
+    if (slot == NO_SLOT) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memcpy(slotData(hdr, slot), buf, len);
+    hdr->slots[slot].len = len;
+
+    lockChannel(hdr);
+    hdr->slots[slot].next = NO_SLOT;
+    if (hdr->queue_tl == NO_SLOT) {
+        hdr->queue_hd = slot;
+    } else {
+        hdr->slots[hdr->queue_tl].next = slot;
+    }
+    hdr->queue_tl = slot;
+    wake = hdr->waiting;
+    hdr->waiting = 0;
+    unlockChannel(hdr);
+
+    if (wake) {
+        // if the FIFO is full, the receiver has a wakeup already
+        while (write(chan->bell, "", 1) < 0 && errno == EINTR) {}
+    }
+    return 0;
+}
+
+StgPtr
+receiveShmMessage (Capability *cap, void *p)
+{
+    ShmChannel *chan = p;
+    ShmHeader *hdr = chan->hdr;
+    ShmMapping *m;
+    StgArrWords *arr;
+    StgWord32 slot;
+    StgWord64 len;
+    char drain[64];
+    int err;
+
+    while (read(chan->bell, drain, sizeof(drain)) > 0) {}
+
+    lockChannel(hdr);
+    slot = hdr->queue_hd;
+    if (slot == NO_SLOT) {
+        hdr->waiting = 1;
+        unlockChannel(hdr);
+        errno = EAGAIN;
+        return NULL;
+    }
+    hdr->queue_hd = hdr->slots[slot].next;
+    if (hdr->queue_hd == NO_SLOT) {
+        hdr->queue_tl = NO_SLOT;
+    }
+    unlockChannel(hdr);
+
+    len = hdr->slots[slot].len;
+    if (len == 0) {
+        // there is nothing to map
+        freeSlot(hdr, slot);
+        arr = (StgArrWords *)allocate(cap, sizeofW(StgArrWords));
+        SET_HDR(arr, &stg_ARR_WORDS_info, cap->r.rCCCS);
+        arr->bytes = 0;
+        return (StgPtr)arr;
+    }
+
+    arr = (StgArrWords *)allocateMappedBytes(cap, chan->fd,
+                                             hdr->data_offset +
+                                             (StgWord64)slot * hdr->slot_size,
+                                             (W_)len, rtsTrue);
+    if (arr == NULL) {
+        // put the message back at the head of the queue
+        err = errno;
+        lockChannel(hdr);
+        hdr->slots[slot].next = hdr->queue_hd;
+        hdr->queue_hd = slot;
+        if (hdr->queue_tl == NO_SLOT) {
+            hdr->queue_tl = slot;
+        }
+        unlockChannel(hdr);
+        errno = err;
+        return NULL;
+    }
+
+    m = stgMallocBytes(sizeof(ShmMapping), "receiveShmMessage");
+    m->chan = chan;
+    m->slot = slot;
+
+    ACQUIRE_LOCK(&shm_mutex);
+    if (shm_mappings == NULL) {
+        shm_mappings = allocHashTable();
+    }
+    insertHashTable(shm_mappings, (StgWord)Bdescr((StgPtr)arr), m);
+    chan->refs++;
+    RELEASE_LOCK(&shm_mutex);
+
+    return (StgPtr)arr;
+}
+
+// with shm_mutex held
+static void
+releaseMapping (void *p)
+{
+    ShmMapping *m = p;
+
+    freeSlot(m->chan->hdr, m->slot);
+    if (--m->chan->refs == 0) freeChannel(m->chan);
+    stgFree(m);
+}
+
+void
+shmGroupUnmapped (bdescr *bd)
+{
+    ShmMapping *m;
+
+    // set before the first message is mapped, and never reset until exit
+    if (shm_mappings == NULL) return;
+
+    ACQUIRE_LOCK(&shm_mutex);
+    m = removeHashTable(shm_mappings, (StgWord)bd, NULL);
+    if (m != NULL) {
+        releaseMapping(m);
+    }
+    RELEASE_LOCK(&shm_mutex);
+}
+
+void
+initShmChannels (void)
+{
+#if defined(THREADED_RTS)
+    initMutex(&shm_mutex);
+#endif
+}
+
+void
+exitShmChannels (void)
+{
+    // The heap goes without freeGroup(), so give the buffers of the
+    // messages we still have back to their channels here.
+    ACQUIRE_LOCK(&shm_mutex);
+    if (shm_mappings != NULL) {
+        freeHashTable(shm_mappings, releaseMapping);
+        shm_mappings = NULL;
+    }
+    RELEASE_LOCK(&shm_mutex);
+#if defined(THREADED_RTS)
+    closeMutex(&shm_mutex);
+#endif
+}
+
+#else /* mingw32_HOST_OS */
+
+// Not supported on Windows, where a file can't be mapped over part of
+// the heap (see Note [Mapped byte arrays] in rts/sm/Storage.c).
+
+void *
+rts_openShmChannel (const char *path STG_UNUSED, HsWord slots STG_UNUSED,
+                    HsWord slot_size STG_UNUSED)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+void rts_closeShmChannel (void *p STG_UNUSED) {}
+
+int rts_shmChannelFd (void *p STG_UNUSED) { return -1; }
+
+HsWord rts_shmChannelSlotSize (void *p STG_UNUSED) { return 0; }
+
+int
+rts_sendShmChannel (void *p STG_UNUSED, const void *buf STG_UNUSED,
+                    HsWord len STG_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+StgPtr
+receiveShmMessage (Capability *cap STG_UNUSED, void *p STG_UNUSED)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+void shmGroupUnmapped (bdescr *bd STG_UNUSED) {}
+
+void initShmChannels (void) {}
+
+void exitShmChannels (void) {}
+
+#endif /* mingw32_HOST_OS */
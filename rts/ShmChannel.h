@@ -0,0 +1,28 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Shared-memory message channels between processes
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SHMCHANNEL_H
+#define SHMCHANNEL_H
+
+#include "BeginPrivate.h"
+
+void initShmChannels (void);
+void exitShmChannels (void);
+
+// The next message on the channel, as a ByteArray# whose payload is the
+// message's buffer, or NULL with errno set.  Called by
+// receiveShmChannel#.
+StgPtr receiveShmMessage (Capability *cap, void *chan);
+
+// Called by freeGroup() on a group with BF_MAPPED set, which may be a
+// received message whose buffer should go back to the channel.
+void shmGroupUnmapped (bdescr *bd);
+
+#include "EndPrivate.h"
+
+#endif /* SHMCHANNEL_H */
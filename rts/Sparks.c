@@ -14,6 +14,7 @@
 #include "Trace.h"
 #include "Prelude.h"
 #include "Sparks.h"
+#include "sm/Storage.h"
 
 #if defined(THREADED_RTS)
 
@@ -48,6 +49,68 @@ createSparkThread (Capability *cap)
     appendToRunQueue(cap,tso);
 }
 
+/* --------------------------------------------------------------------------
+ * Spark throttling (+RTS -qt)
+ *
+ * A program that sparks very small computations mostly evaluates them
+ * itself before anyone else gets to, so most of its sparks fizzle, and
+ * each one costs more than the work it would save.  After each GC we
+ * look at what became of the sparks since the last adjustment, over
+ * all the Capabilities (a spark is counted as converted by the
+ * Capability that ran it): while more than about 90% of them fizzled or
+ * were GC'd, we halve spark_limit, and newSpark() drops a spark
+ * straight away if its pool already holds that many.  Once most sparks
+ * are converted again the limit doubles, up to the size of the pool.
+ * -------------------------------------------------------------------------- */
+
+// sparks that have to be accounted for before we change the limit
+#define SPARK_THROTTLE_SAMPLE 256
+
+#define SPARK_LIMIT_MIN       64
+
+static long spark_limit = 0;            // 0: not initialised yet
+static SparkCounters spark_totals;      // at the last adjustment
+
+void
+adjustSparkLimit (void)
+{
+    SparkCounters now = { 0, 0, 0, 0, 0, 0, 0 };
+    StgWord converted, wasted;
+    long max;
+    nat i;
+
+    if (!RtsFlags.ParFlags.sparkThrottle) return;
+
+    max = RtsFlags.ParFlags.maxLocalSparks;
+    if (spark_limit == 0) {
+        spark_limit = max;
+    }
+
+    for (i = 0; i < n_capabilities; i++) {
+        now.converted += capabilities[i]->spark_stats.converted;
+        now.gcd       += capabilities[i]->spark_stats.gcd;
+        now.fizzled   += capabilities[i]->spark_stats.fizzled;
+    }
+
+    converted = now.converted - spark_totals.converted;
+    wasted    = (now.gcd - spark_totals.gcd)
+              + (now.fizzled - spark_totals.fizzled);
+    if (converted + wasted < SPARK_THROTTLE_SAMPLE) return;
+    spark_totals = now;
+
+    if (wasted > 9 * converted) {
+        spark_limit = stg_max(spark_limit / 2, SPARK_LIMIT_MIN);
+    } else if (wasted < converted) {
+        spark_limit = stg_min(spark_limit * 2, max);
+    } else {
+        return;
+    }
+
+    debugTrace(DEBUG_sparks,
+               "spark throttling: %ld converted, %ld wasted, limit now %ld",
+               (long)converted, (long)wasted, spark_limit);
+}
+
 /* --------------------------------------------------------------------------
  * newSpark: create a new spark, as a result of calling "par"
  * Called directly from STG.
@@ -60,7 +123,11 @@ newSpark (StgRegTable *reg, StgClosure *p)
     SparkPool *pool = cap->sparks;
 
     if (!fizzledSpark(p)) {
-        if (pushWSDeque(pool,p)) {
+        if (RtsFlags.ParFlags.sparkThrottle && spark_limit != 0 &&
+            sparkPoolSize(pool) >= spark_limit) {
+            // not worth sparking: see "Spark throttling" above
+            cap->spark_stats.throttled++;
+        } else if (pushWSDeque(pool,p)) {
             cap->spark_stats.created++;
             traceEventSparkCreate(cap);
         } else {
@@ -210,7 +277,9 @@ pruneSparkQueue (Capability *cap)
               }
           } else {
               if (INFO_PTR_TO_STRUCT(info)->type == THUNK_STATIC) {
-                  if (*THUNK_STATIC_LINK(spark) != NULL) {
+                  // reached by this GC?  See Note [STATIC_LINK fields]
+                  if (((StgWord)*THUNK_STATIC_LINK(spark) & STATIC_BITS)
+                      == static_flag) {
                       elements[botInd] = spark; // keep entry (new address)
                       botInd++;
                       n++;
@@ -23,6 +23,7 @@ typedef struct {
     StgWord converted;
     StgWord gcd;
     StgWord fizzled;
+    StgWord throttled;  // dropped by newSpark() under +RTS -qt
 } SparkCounters;
 
 #if defined(THREADED_RTS)
@@ -33,7 +34,8 @@ typedef WSDeque SparkPool;
 SparkPool *allocSparkPool (void);
 
 // Take a spark from the "write" end of the pool.  Can be called
-// by the pool owner only.
+// by the pool owner only.  NB. not safe while other Capabilities may
+// be calling tryStealSparks() on the pool, so it is currently unused.
 INLINE_HEADER StgClosure* reclaimSpark(SparkPool *pool);
 
 // Returns True if the spark pool is empty (can give a false positive
@@ -41,12 +43,15 @@ INLINE_HEADER StgClosure* reclaimSpark(SparkPool *pool);
 INLINE_HEADER rtsBool looksEmpty(SparkPool* deque);
 
 INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool);
+INLINE_HEADER nat          tryStealSparks (SparkPool *pool,
+                                           StgClosure **sparks, nat max);
 INLINE_HEADER rtsBool      fizzledSpark  (StgClosure *);
 
 void         freeSparkPool     (SparkPool *pool);
 void         createSparkThread (Capability *cap);
 void         traverseSparkQueue(evac_fn evac, void *user, Capability *cap);
 void         pruneSparkQueue   (Capability *cap);
+void         adjustSparkLimit  (void);
 
 INLINE_HEADER void discardSparks  (SparkPool *pool);
 INLINE_HEADER long sparkPoolSize  (SparkPool *pool);
@@ -96,6 +101,24 @@ INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool)
     // other pools before trying again.
 }
 
+/* ----------------------------------------------------------------------------
+ *
+ * tryStealSparks: steal up to half of the sparks in a pool, but no more
+ * than max, with a single atomic operation.  They are stored in
+ * sparks[], oldest first, and may include fizzled ones.
+ *
+ * Returns the number of sparks stolen, which is 0 if the pool was empty
+ * or, occasionally, if there was a race with another thread stealing
+ * from the same pool.
+ *
+ -------------------------------------------------------------------------- */
+
+INLINE_HEADER nat tryStealSparks (SparkPool *pool, StgClosure **sparks,
+                                  nat max)
+{
+    return (nat)stealManyWSDeque_(pool, (void **)sparks, max);
+}
+
 INLINE_HEADER rtsBool fizzledSpark (StgClosure *spark)
 {
     return (GET_CLOSURE_TAG(spark) != 0 || !closure_SHOULD_SPARK(spark));
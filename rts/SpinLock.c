@@ -0,0 +1,105 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * The contended path of spin locks (see includes/rts/SpinLock.h)
+ *
+ * A waiter spins for spin_lock_spins iterations of busy_wait_nop(),
+ * which initSpinLocks() calibrates to about SPIN_LOCK_SPIN_NS, and then
+ * marks the lock SPIN_LOCK_PARKED and sleeps on it.  Spinning only pays
+ * off if the holder is running, so when there are more Capabilities
+ * than CPUs we can use (including a cgroup CPU quota) we spin only
+ * briefly before sleeping.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "SpinLock.h"
+#include "Elastic.h"
+
+#if defined(THREADED_RTS)
+
+// How long to spin before sleeping: about the cost of going to sleep
+// and being woken up again
+#define SPIN_LOCK_SPIN_NS   10000
+
+// The fewest iterations we spin for
+#define SPIN_LOCK_MIN_SPINS 100
+
+static nat spin_lock_spins = SPIN_COUNT;
+
+void
+initSpinLocks (void)
+{
+    StgWord64 start, elapsed;
+    nat i, cpus, limit;
+
+    start = getMonotonicNSec();
+    for (i = 0; i < SPIN_COUNT; i++) {
+        busy_wait_nop();
+    }
+    elapsed = getMonotonicNSec() - start;
+    if (elapsed == 0) elapsed = 1;
+
+    spin_lock_spins = (nat)stg_min((StgWord64)SPIN_COUNT * SPIN_LOCK_SPIN_NS
+                                   / elapsed,
+                                   (StgWord64)SPIN_COUNT * 100);
+
+    cpus = getNumberOfProcessors();
+    limit = cgroupCpuLimit();
+    if (limit != 0 && limit < cpus) {
+        cpus = limit;
+    }
+    if (RtsFlags.ParFlags.nNodes > cpus) {
+        spin_lock_spins = SPIN_LOCK_MIN_SPINS;
+    }
+    spin_lock_spins = stg_max(spin_lock_spins, SPIN_LOCK_MIN_SPINS);
+}
+
+void
+acquireSpinLockSlow (SpinLock *p)
+{
+    StgVolatilePtr w = (StgVolatilePtr)SPIN_LOCK_WORD(p);
+    StgWord64 spins = 0, parks = 0;
+    nat i;
+
+    for (i = 0; i < spin_lock_spins; i++) {
+        busy_wait_nop();
+        spins++;
+        if (*w == SPIN_LOCK_FREE &&
+            cas(w, SPIN_LOCK_FREE, SPIN_LOCK_HELD) == SPIN_LOCK_FREE) {
+            goto acquired;
+        }
+    }
+
+    // We can't tell whether anyone else is asleep, so once we have
+    // slept we have to take the lock as SPIN_LOCK_PARKED; at worst the
+    // next release makes a spurious wakeup call.
+    while (xchg((StgPtr)w, SPIN_LOCK_PARKED) != SPIN_LOCK_FREE) {
+        if (!waitOnWord(w, SPIN_LOCK_PARKED)) {
+            yieldThread();
+        }
+        parks++;
+    }
+
+acquired:
+#if defined(PROF_SPIN)
+    // we hold the lock now, so these don't race
+    p->spin += spins;
+    p->contended++;
+    p->parked += parks;
+#else
+    (void)spins;
+    (void)parks;
+#endif
+}
+
+void
+wakeSpinLockWaiter (SpinLock *p)
+{
+    wakeOnWord((StgVolatilePtr)SPIN_LOCK_WORD(p));
+}
+
+#endif /* THREADED_RTS */
@@ -0,0 +1,21 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Spin lock tuning.  The locks themselves are in includes/rts/SpinLock.h.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "BeginPrivate.h"
+
+#if defined(THREADED_RTS)
+// Calibrate how long contended locks spin.  Needs the RTS flags.
+void initSpinLocks (void);
+#endif
+
+#include "EndPrivate.h"
+
+#endif /* SPINLOCK_H */
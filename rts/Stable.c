@@ -16,6 +16,10 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "Stable.h"
+#include "Capability.h"
+#include "Task.h"
+
+#include <string.h>
 
 /* Comment from ADR's implementation in old RTS:
 
@@ -79,25 +83,93 @@
   Stable Pointers are exported to the outside world as indices and not
   pointers, because the stable pointer table is allowed to be
   reallocated for growth. The table is never shrunk for its space to
-  be reclaimed.
+  be reclaimed.  When it grows, the old copy is kept until the next GC,
+  so that a concurrent deRefStablePtr() still reads valid memory.
 
   Future plans for stable ptrs include distinguishing them by the
   generation of the pointed object. See
   http://ghc.haskell.org/trac/ghc/ticket/7670 for details.
 */
 
+/* Note [Generational stable names]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+  A program may have millions of stable names, and a minor GC cannot
+  move or free the objects in the generations it doesn't collect, so
+  the GC only looks at the stable names that refer to objects in the
+  collected generations.
+
+  - Every live stable name table entry is on the list of exactly one
+    generation (sn_gen_lists): the youngest generation of its object
+    and its StableName object.  An entry without a StableName object
+    is on the g0 list, because stg_makeStableNamezh is about to
+    allocate one in the nursery.
+
+  - gcStableTables() takes the entries off the lists of the collected
+    generations (sn_collected) and updates just those, and
+    updateStableTables() rehashes them and puts each one back on the
+    list of the generation its objects are in now.
+
+  - addrToStableHash is only changed during GC, when no Haskell thread
+    is running, so lookupStableName() can look for an existing stable
+    name there without taking stable_mutex.  The stable names made
+    since the last GC are in freshStableHash instead, under the lock,
+    and the next GC moves them to addrToStableHash.
+*/
+
 snEntry *stable_name_table = NULL;
 static snEntry *stable_name_free = NULL;
 static unsigned int SNT_size = 0;
 #define INIT_SNT_SIZE 64
 
 spEntry *stable_ptr_table = NULL;
-static spEntry *stable_ptr_free = NULL;
+static StgWord stable_ptr_free = SPT_END;   // protected by stable_mutex
 static unsigned int SPT_size = 0;
 #define INIT_SPT_SIZE 64
 
+// Tables replaced by enlargeStablePtrTable(), freed at the next GC
+#define MAX_OLD_SPTS 64
+static spEntry *old_SPTs[MAX_OLD_SPTS];
+static nat n_old_SPTs = 0;
+
 #ifdef THREADED_RTS
 Mutex stable_mutex;
+
+/* -----------------------------------------------------------------------------
+ * Per-Capability free lists
+ *
+ * A Capability keeps its own list of free stable pointer entries
+ * (cap->spt_free), so getStablePtr() and freeStablePtr() called by the
+ * Task that owns the Capability don't take stable_mutex.  A Capability
+ * that runs out first takes everything from spt_returned, a lock-free
+ * stack of entries freed by threads that have no Capability (or that
+ * have freed more than SPT_CACHE_MAX entries), and only then takes a
+ * batch of SPT_BATCH entries from the global free list under the lock.
+ * cap->n_spt_free is the length of cap->spt_free.
+ *
+ * Everything that needs the stable pointer table to stand still
+ * (enlarging it, the GC) does so under stableLock(), which makes
+ * spt_epoch odd.  An entry written without the lock goes through
+ * setSpEntry(), which writes to the current table and then checks
+ * that spt_epoch hasn't changed; if it has, the table may have been
+ * copied or GC'd under our feet, so we wait for the lock to be released
+ * and write again.  The store_load_barrier()s on both sides mean that
+ * either the writer sees the new epoch, or the thread holding the lock
+ * sees the write.
+ *
+ * The retry only protects against the table being moved, not freed:
+ * the GC frees the old tables (freeOldSPTs()) under the lock, and a
+ * writer may still be about to store into the table it read before
+ * the lock was taken.  So only a thread that owns a Capability, which
+ * can't be running while the GC is, may use setSpEntry(); a thread
+ * without one frees its entries under the lock.
+ * -------------------------------------------------------------------------- */
+
+#define SPT_BATCH     64
+#define SPT_CACHE_MAX 256
+
+static volatile StgWord spt_epoch = 0;
+static volatile StgWord spt_returned = SPT_END;
 #endif
 
 static void enlargeStableNameTable(void);
@@ -111,6 +183,25 @@ static void enlargeStablePtrTable(void);
 
 static HashTable *addrToStableHash = NULL;
 
+// The stable names made since the last GC (see Note [Generational
+// stable names]), protected by stable_mutex
+static HashTable *freshStableHash = NULL;
+
+typedef struct {
+    StgWord *entries;           // indices into stable_name_table
+    nat n;
+    nat size;
+} snList;
+
+// The stable names of each generation
+static snList *sn_gen_lists = NULL;
+
+// The stable names of the generations being collected, during GC
+static snList sn_collected = { NULL, 0, 0 };
+
+// sn_gen_lists[0].entries[sn_fresh_start..] were made since the last GC
+static nat sn_fresh_start = 0;
+
 /* -----------------------------------------------------------------------------
  * We must lock the StablePtr table during GC, to prevent simultaneous
  * calls to freeStablePtr().
@@ -121,11 +212,19 @@ stableLock(void)
 {
     initStableTables();
     ACQUIRE_LOCK(&stable_mutex);
+#ifdef THREADED_RTS
+    spt_epoch++;
+    store_load_barrier();
+#endif
 }
 
 void
 stableUnlock(void)
 {
+#ifdef THREADED_RTS
+    write_barrier();
+    spt_epoch++;
+#endif
     RELEASE_LOCK(&stable_mutex);
 }
 
@@ -147,14 +246,15 @@ initSnEntryFreeList(snEntry *table, nat n, snEntry *free)
 }
 
 STATIC_INLINE void
-initSpEntryFreeList(spEntry *table, nat n, spEntry *free)
+initSpEntryFreeList(spEntry *table, nat from, nat n, StgWord free)
 {
-  spEntry *p;
-  for (p = table + n - 1; p >= table; p--) {
-      p->addr = (P_)free;
-      free = p;
+  nat i;
+  for (i = from + n; i > from; i--) {
+      table[i-1].addr = NULL;
+      table[i-1].link = free;
+      free = i-1;
   }
-  stable_ptr_free = table;
+  stable_ptr_free = from;
 }
 
 void
@@ -170,12 +270,16 @@ initStableTables(void)
      */
     initSnEntryFreeList(stable_name_table + 1,INIT_SNT_SIZE-1,NULL);
     addrToStableHash = allocHashTable();
+    freshStableHash = allocHashTable();
+    sn_gen_lists = stgCallocBytes(RtsFlags.GcFlags.generations,
+                                  sizeof *sn_gen_lists, "initStableTables");
+    sn_fresh_start = 0;
 
     if (SPT_size > 0) return;
     SPT_size = INIT_SPT_SIZE;
     stable_ptr_table = stgMallocBytes(SPT_size * sizeof *stable_ptr_table,
                                       "initStablePtrTable");
-    initSpEntryFreeList(stable_ptr_table,INIT_SPT_SIZE,NULL);
+    initSpEntryFreeList(stable_ptr_table,0,INIT_SPT_SIZE,SPT_END);
 
 #ifdef THREADED_RTS
     initMutex(&stable_mutex);
@@ -201,21 +305,131 @@ enlargeStableNameTable(void)
     initSnEntryFreeList(stable_name_table + old_SNT_size, old_SNT_size, NULL);
 }
 
+// Must be called with stableLock() held.
 static void
 enlargeStablePtrTable(void)
 {
     nat old_SPT_size = SPT_size;
+    spEntry *new;
 
     // 2nd and subsequent times
     SPT_size *= 2;
-    stable_ptr_table =
-        stgReallocBytes(stable_ptr_table,
-                        SPT_size * sizeof *stable_ptr_table,
-                        "enlargeStablePtrTable");
+    new = stgMallocBytes(SPT_size * sizeof *stable_ptr_table,
+                         "enlargeStablePtrTable");
+    memcpy(new, stable_ptr_table, old_SPT_size * sizeof *stable_ptr_table);
+    initSpEntryFreeList(new, old_SPT_size, old_SPT_size, stable_ptr_free);
+
+    // Don't free the old table yet: deRefStablePtr() doesn't take the
+    // lock, so somebody may be reading it.
+    if (n_old_SPTs >= MAX_OLD_SPTS) {
+        barf("enlargeStablePtrTable: too many old tables");
+    }
+    old_SPTs[n_old_SPTs++] = stable_ptr_table;
+
+    write_barrier();
+    stable_ptr_table = new;
+}
+
+// Free the tables replaced by enlargeStablePtrTable().  Only safe when
+// the mutators are stopped, i.e. during GC.
+static void
+freeOldSPTs(void)
+{
+    nat i;
+    for (i = 0; i < n_old_SPTs; i++) {
+        stgFree(old_SPTs[i]);
+    }
+    n_old_SPTs = 0;
+}
+
+#ifdef THREADED_RTS
+// Write an entry of the stable pointer table without holding the lock.
+// See "Per-Capability free lists" above.
+static void
+setSpEntry(StgWord sp, StgPtr addr, StgWord link)
+{
+    StgWord epoch;
+    spEntry *table;
+
+    for (;;) {
+        epoch = spt_epoch;
+        if (epoch & 1) {
+            // the table is locked; wait until it is released
+            ACQUIRE_LOCK(&stable_mutex);
+            RELEASE_LOCK(&stable_mutex);
+            continue;
+        }
+        load_load_barrier();
+        table = stable_ptr_table;
+        table[sp].addr = addr;
+        table[sp].link = link;
+        store_load_barrier();
+        if (spt_epoch == epoch) return;
+    }
+}
 
-    initSpEntryFreeList(stable_ptr_table + old_SPT_size, old_SPT_size, NULL);
+// The Capability owned by the calling thread, or NULL
+static Capability *
+myOwnCapability(void)
+{
+    Task *task = myTask();
+    if (task != NULL && task->cap != NULL && task->cap->running_task == task) {
+        return task->cap;
+    }
+    return NULL;
 }
 
+// Push an entry on spt_returned.  With locked = rtsTrue, the caller
+// holds stableLock() and the entry can be written directly.
+static void
+returnSpEntry(StgWord sp, rtsBool locked)
+{
+    StgWord old;
+
+    do {
+        old = spt_returned;
+        if (locked) {
+            stable_ptr_table[sp].addr = NULL;
+            stable_ptr_table[sp].link = old;
+        } else {
+            setSpEntry(sp, NULL, old);
+        }
+    } while (cas(&spt_returned, old, sp) != old);
+}
+
+// Give cap some free entries; cap->spt_free must be empty.
+static void
+refillSpEntryCache(Capability *cap)
+{
+    StgWord sp;
+    nat n;
+
+    cap->spt_free = xchg((StgPtr)&spt_returned, SPT_END);
+    if (cap->spt_free != SPT_END) {
+        // these entries are ours now, so nobody else writes their links
+        n = 0;
+        for (sp = cap->spt_free; sp != SPT_END;
+             sp = stable_ptr_table[sp].link) {
+            n++;
+        }
+        cap->n_spt_free = n;
+        return;
+    }
+
+    stableLock();
+    if (stable_ptr_free == SPT_END) enlargeStablePtrTable();
+    sp = stable_ptr_free;
+    for (n = 1; n < SPT_BATCH && stable_ptr_table[sp].link != SPT_END; n++) {
+        sp = stable_ptr_table[sp].link;
+    }
+    cap->spt_free = stable_ptr_free;
+    cap->n_spt_free = n;
+    stable_ptr_free = stable_ptr_table[sp].link;
+    stable_ptr_table[sp].link = SPT_END;
+    stableUnlock();
+}
+#endif
+
 /* -----------------------------------------------------------------------------
  * Freeing entries and tables
  * -------------------------------------------------------------------------- */
@@ -223,10 +437,28 @@ enlargeStablePtrTable(void)
 void
 exitStableTables(void)
 {
+    nat g;
+
     if (addrToStableHash)
         freeHashTable(addrToStableHash, NULL);
     addrToStableHash = NULL;
 
+    if (freshStableHash)
+        freeHashTable(freshStableHash, NULL);
+    freshStableHash = NULL;
+
+    if (sn_gen_lists) {
+        for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+            stgFree(sn_gen_lists[g].entries);
+        }
+        stgFree(sn_gen_lists);
+    }
+    sn_gen_lists = NULL;
+    stgFree(sn_collected.entries);
+    sn_collected.entries = NULL;
+    sn_collected.n = 0;
+    sn_collected.size = 0;
+
     if (stable_name_table)
         stgFree(stable_name_table);
     stable_name_table = NULL;
@@ -236,12 +468,24 @@ exitStableTables(void)
         stgFree(stable_ptr_table);
     stable_ptr_table = NULL;
     SPT_size = 0;
+    freeOldSPTs();
 
 #ifdef THREADED_RTS
     closeMutex(&stable_mutex);
 #endif
 }
 
+static void
+pushSnList(snList *l, StgWord sn)
+{
+    if (l->n == l->size) {
+        l->size = l->size == 0 ? 64 : l->size * 2;
+        l->entries = stgReallocBytes(l->entries, l->size * sizeof(StgWord),
+                                     "pushSnList");
+    }
+    l->entries[l->n++] = sn;
+}
+
 STATIC_INLINE void
 freeSnEntry(snEntry *sn)
 {
@@ -252,9 +496,10 @@ freeSnEntry(snEntry *sn)
 }
 
 STATIC_INLINE void
-freeSpEntry(spEntry *sp)
+freeSpEntry(StgWord sp)
 {
-    sp->addr = (P_)stable_ptr_free;
+    stable_ptr_table[sp].addr = NULL;
+    stable_ptr_table[sp].link = stable_ptr_free;
     stable_ptr_free = sp;
 }
 
@@ -262,15 +507,34 @@ void
 freeStablePtrUnsafe(StgStablePtr sp)
 {
     ASSERT((StgWord)sp < SPT_size);
-    freeSpEntry(&stable_ptr_table[(StgWord)sp]);
+    freeSpEntry((StgWord)sp);
 }
 
 void
 freeStablePtr(StgStablePtr sp)
 {
+#ifdef THREADED_RTS
+    Capability *cap;
+
+    ASSERT((StgWord)sp < SPT_size);
+    cap = myOwnCapability();
+    if (cap == NULL) {
+        // we may be racing with a GC, see "Per-Capability free lists"
+        stableLock();
+        returnSpEntry((StgWord)sp, rtsTrue);
+        stableUnlock();
+    } else if (cap->n_spt_free < SPT_CACHE_MAX) {
+        setSpEntry((StgWord)sp, NULL, cap->spt_free);
+        cap->spt_free = (StgWord)sp;
+        cap->n_spt_free++;
+    } else {
+        returnSpEntry((StgWord)sp, rtsFalse);
+    }
+#else
     stableLock();
     freeStablePtrUnsafe(sp);
     stableUnlock();
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -317,11 +581,7 @@ lookupStableName (StgPtr p)
   StgWord sn;
   void* sn_tmp;
 
-  stableLock();
-
-  if (stable_name_free == NULL) {
-    enlargeStableNameTable();
-  }
+  initStableTables();
 
   /* removing indirections increases the likelihood
    * of finding a match in the stable name hash table.
@@ -331,9 +591,22 @@ lookupStableName (StgPtr p)
   // register the untagged pointer.  This just makes things simpler.
   p = (StgPtr)UNTAG_CLOSURE((StgClosure*)p);
 
+  // Only the GC changes addrToStableHash, so we don't need the lock to
+  // find a stable name made before the last GC (see Note [Generational
+  // stable names]).
   sn_tmp = lookupHashTable(addrToStableHash,(W_)p);
   sn = (StgWord)sn_tmp;
 
+  if (sn != 0) {
+    debugTrace(DEBUG_stable, "cached stable name %ld at %p",sn,p);
+    return sn;
+  }
+
+  stableLock();
+
+  sn_tmp = lookupHashTable(freshStableHash,(W_)p);
+  sn = (StgWord)sn_tmp;
+
   if (sn != 0) {
     ASSERT(stable_name_table[sn].addr == p);
     debugTrace(DEBUG_stable, "cached stable name %ld at %p",sn,p);
@@ -341,6 +614,10 @@ lookupStableName (StgPtr p)
     return sn;
   }
 
+  if (stable_name_free == NULL) {
+    enlargeStableNameTable();
+  }
+
   sn = stable_name_free - stable_name_table;
   stable_name_free  = (snEntry*)(stable_name_free->addr);
   stable_name_table[sn].addr = p;
@@ -348,7 +625,8 @@ lookupStableName (StgPtr p)
   /* debugTrace(DEBUG_stable, "new stable name %d at %p\n",sn,p); */
 
   /* add the new stable name to the hash table */
-  insertHashTable(addrToStableHash, (W_)p, (void *)sn);
+  insertHashTable(freshStableHash, (W_)p, (void *)sn);
+  pushSnList(&sn_gen_lists[0], sn);
 
   stableUnlock();
 
@@ -360,10 +638,23 @@ getStablePtr(StgPtr p)
 {
   StgWord sp;
 
+#ifdef THREADED_RTS
+  Capability *cap = myOwnCapability();
+  if (cap != NULL) {
+      if (cap->spt_free == SPT_END) refillSpEntryCache(cap);
+      sp = cap->spt_free;
+      cap->spt_free = stable_ptr_table[sp].link;
+      ASSERT(cap->n_spt_free > 0);
+      cap->n_spt_free--;
+      setSpEntry(sp, p, SPT_END);
+      return (StgStablePtr)(sp);
+  }
+#endif
+
   stableLock();
-  if (!stable_ptr_free) enlargeStablePtrTable();
-  sp = stable_ptr_free - stable_ptr_table;
-  stable_ptr_free  = (spEntry*)(stable_ptr_free->addr);
+  if (stable_ptr_free == SPT_END) enlargeStablePtrTable();
+  sp = stable_ptr_free;
+  stable_ptr_free = stable_ptr_table[sp].link;
   stable_ptr_table[sp].addr = p;
   stableUnlock();
   return (StgStablePtr)(sp);
@@ -378,10 +669,8 @@ getStablePtr(StgPtr p)
         spEntry *p;                                                     \
         spEntry *__end_ptr = &stable_ptr_table[SPT_size];               \
         for (p = stable_ptr_table; p < __end_ptr; p++) {                \
-            /* Internal pointers are free slots. NULL is last in free */ \
-            /* list. */                                                 \
-            if (p->addr &&                                              \
-                (p->addr < (P_)stable_ptr_table || p->addr >= (P_)__end_ptr)) \
+            /* Free slots have a NULL addr. */                          \
+            if (p->addr != NULL)                                        \
             {                                                           \
                 do { CODE } while(0);                                   \
             }                                                           \
@@ -415,18 +704,10 @@ markStablePtrTable(evac_fn evac, void *user)
     FOR_EACH_STABLE_PTR(p, evac(user, (StgClosure **)&p->addr););
 }
 
-STATIC_INLINE void
-rememberOldStableNameAddresses(void)
-{
-    /* TODO: Only if !full GC */
-    FOR_EACH_STABLE_NAME(p, p->old = p->addr;);
-}
-
 void
 markStableTables(evac_fn evac, void *user)
 {
     markStablePtrTable(evac, user);
-    rememberOldStableNameAddresses();
 }
 
 /* -----------------------------------------------------------------------------
@@ -477,38 +758,99 @@ threadStableTables( evac_fn evac, void *user )
  * refer to the entry.
  * -------------------------------------------------------------------------- */
 
+// The generation of a stable name table entry: the youngest generation
+// of its object and its StableName object (see Note [Generational
+// stable names]).
+static nat
+snEntryGen (snEntry *p)
+{
+    nat g;
+
+    if (p->sn_obj == NULL) {
+        return 0;
+    }
+    g = Bdescr((StgPtr)p->sn_obj)->gen_no;
+    if (p->addr != NULL && HEAP_ALLOCED(p->addr)) {
+        g = stg_min(g, Bdescr(p->addr)->gen_no);
+    }
+    return g;
+}
+
+// Take the entries of the collected generations off their lists, and
+// remember their old addresses.
+static void
+collectStableNames (void)
+{
+    nat g, i;
+    StgWord sn;
+    snList *l;
+
+    // the stable names made since the last GC join addrToStableHash
+    l = &sn_gen_lists[0];
+    for (i = sn_fresh_start; i < l->n; i++) {
+        sn = l->entries[i];
+        insertHashTable(addrToStableHash, (W_)stable_name_table[sn].addr,
+                        (void *)sn);
+    }
+    if (keyCountHashTable(freshStableHash) != 0) {
+        freeHashTable(freshStableHash, NULL);
+        freshStableHash = allocHashTable();
+    }
+
+    sn_collected.n = 0;
+    for (g = 0; g <= N; g++) {
+        l = &sn_gen_lists[g];
+        for (i = 0; i < l->n; i++) {
+            sn = l->entries[i];
+            stable_name_table[sn].old = stable_name_table[sn].addr;
+            pushSnList(&sn_collected, sn);
+        }
+        l->n = 0;
+    }
+    sn_fresh_start = 0;
+}
+
 void
 gcStableTables( void )
 {
-    FOR_EACH_STABLE_NAME(
-        p, {
-            // Update the pointer to the StableName object, if there is one
-            if (p->sn_obj != NULL) {
-                p->sn_obj = isAlive(p->sn_obj);
-                if(p->sn_obj == NULL) {
-                    // StableName object died
-                    debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
-                               (long)(p - stable_name_table), p->addr);
-                    freeSnEntry(p);
-                    /* Can't "continue", so use goto */
-                    goto next_stable_name;
-                }
+    nat i, n;
+    snEntry *p;
+
+    // nobody can be looking at the old copies of the table now
+    freeOldSPTs();
+
+    collectStableNames();
+
+    n = 0;
+    for (i = 0; i < sn_collected.n; i++) {
+        p = &stable_name_table[sn_collected.entries[i]];
+
+        // Update the pointer to the StableName object, if there is one
+        if (p->sn_obj != NULL) {
+            p->sn_obj = isAlive(p->sn_obj);
+            if(p->sn_obj == NULL) {
+                // StableName object died
+                debugTrace(DEBUG_stable, "GC'd StableName %ld (addr=%p)",
+                           (long)(p - stable_name_table), p->addr);
+                freeSnEntry(p);
+                continue;
             }
-            /* If sn_obj became NULL, the object died, and addr is now
-             * invalid. But if sn_obj was null, then the StableName
-             * object may not have been created yet, while the pointee
-             * already exists and must be updated to new location. */
-            if (p->addr != NULL) {
-                p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
-                if(p->addr == NULL) {
-                    // StableName pointee died
-                    debugTrace(DEBUG_stable, "GC'd pointee %ld",
-                               (long)(p - stable_name_table));
-                }
+        }
+        /* If sn_obj became NULL, the object died, and addr is now
+         * invalid. But if sn_obj was null, then the StableName
+         * object may not have been created yet, while the pointee
+         * already exists and must be updated to new location. */
+        if (p->addr != NULL) {
+            p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
+            if(p->addr == NULL) {
+                // StableName pointee died
+                debugTrace(DEBUG_stable, "GC'd pointee %ld",
+                           (long)(p - stable_name_table));
             }
-    next_stable_name:
-            if (0) {}
-        });
+        }
+        sn_collected.entries[n++] = sn_collected.entries[i];
+    }
+    sn_collected.n = n;
 }
 
 /* -----------------------------------------------------------------------------
@@ -523,29 +865,34 @@ gcStableTables( void )
 void
 updateStableTables(rtsBool full)
 {
+    nat i;
+    StgWord sn;
+    snEntry *p;
+
     if (full && addrToStableHash != NULL && 0 != keyCountHashTable(addrToStableHash)) {
         freeHashTable(addrToStableHash,NULL);
         addrToStableHash = allocHashTable();
     }
 
-    if(full) {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != NULL) {
-                    // Target still alive, Re-hash this stable name
-                    insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                }
-            });
-    } else {
-        FOR_EACH_STABLE_NAME(
-            p, {
-                if (p->addr != p->old) {
-                    removeHashTable(addrToStableHash, (W_)p->old, NULL);
-                    /* Movement happened: */
-                    if (p->addr != NULL) {
-                        insertHashTable(addrToStableHash, (W_)p->addr, (void *)(p - stable_name_table));
-                    }
-                }
-            });
+    // In a major GC every entry was collected, so sn_collected has
+    // them all.
+    for (i = 0; i < sn_collected.n; i++) {
+        sn = sn_collected.entries[i];
+        p = &stable_name_table[sn];
+        if (full) {
+            if (p->addr != NULL) {
+                // Target still alive, Re-hash this stable name
+                insertHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
+            }
+        } else if (p->addr != p->old) {
+            removeHashTable(addrToStableHash, (W_)p->old, NULL);
+            /* Movement happened: */
+            if (p->addr != NULL) {
+                insertHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
+            }
+        }
+        pushSnList(&sn_gen_lists[snEntryGen(p)], sn);
     }
+    sn_collected.n = 0;
+    sn_fresh_start = sn_gen_lists[0].n;
 }
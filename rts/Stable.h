@@ -19,6 +19,9 @@
 
 #include "BeginPrivate.h"
 
+/* End of a list of free stable pointer table entries */
+#define SPT_END ((StgWord)-1)
+
 void    freeStablePtr         ( StgStablePtr sp );
 
 /* Use the "Unsafe" one after manually locking with stableLock/stableUnlock */
@@ -31,10 +34,6 @@ StgWord lookupStableName      ( StgPtr p );
 /* Call given function on every stable ptr. markStableTables depends
  * on the function updating its pointers in case the object is
  * moved. */
-/* TODO: This also remembers old stable name addresses, which isn't
- * necessary in some contexts markStableTables is called from.
- * Consider splitting it.
- */
 void    markStableTables      ( evac_fn evac, void *user );
 
 void    threadStableTables    ( evac_fn evac, void *user );
@@ -20,6 +20,60 @@ static HashTable * spt = NULL;
 static Mutex spt_lock;
 #endif
 
+/* The frozen table.
+ *
+ * Static pointers are resolved often, from many threads at once (once
+ * per remote message in a distributed-closure library, say), and a
+ * lookup under spt_lock makes them all wait for each other.  But almost
+ * all the entries are inserted by the module constructors, before
+ * hs_init_ghc() has finished.  So at the end of hs_init_ghc(),
+ * freezeStaticPtrTable() copies the entries into an open-addressed
+ * table that never changes again, and hs_spt_lookup() looks there first
+ * without a lock.  Only entries inserted later (GHCi loading code, or a
+ * shared library opened with dlopen()) need the locked lookup in spt,
+ * and we don't even try that if there are none.
+ *
+ * spt still holds every entry, and remains the only place where they
+ * (and their StablePtrs) are owned.  Removing a frozen entry marks its
+ * slot SPT_SLOT_REMOVED rather than emptying it, so that the probe
+ * sequences of other keys aren't broken.
+ */
+#define SPT_SLOT_EMPTY   0
+#define SPT_SLOT_FULL    1
+#define SPT_SLOT_REMOVED 2
+
+typedef struct {
+  StgWord64 key[2];
+  StgStablePtr sp;
+  volatile StgWord state;
+} SptSlot;
+
+typedef struct {
+  StgWord mask;                         // size - 1; the size is a power of 2
+  SptSlot slots[FLEXIBLE_ARRAY];
+} FrozenSpt;
+
+static FrozenSpt * frozen_spt = NULL;
+
+// number of entries in spt that are not in frozen_spt
+static volatile StgWord spt_n_unfrozen = 0;
+
+static SptSlot * findFrozenSlot(StgWord64 key[2]) {
+  const FrozenSpt * t = frozen_spt;
+  StgWord i;
+
+  if (t == NULL) return NULL;
+  // The fingerprints are hashes already, so any bits will do.
+  for (i = (StgWord)key[0] & t->mask;
+       t->slots[i].state != SPT_SLOT_EMPTY;
+       i = (i + 1) & t->mask) {
+    if (t->slots[i].key[0] == key[0] && t->slots[i].key[1] == key[1]) {
+      return (SptSlot *)&t->slots[i];
+    }
+  }
+  return NULL;
+}
+
 /// Hash function for the SPT.
 static int hashFingerprint(HashTable *table, StgWord64 key[2]) {
   // Take half of the key to compute the hash.
@@ -49,6 +103,7 @@ void hs_spt_insert(StgWord64 key[2],void *spe_closure) {
   *entry = getStablePtr(spe_closure);
   ACQUIRE_LOCK(&spt_lock);
   insertHashTable(spt, (StgWord)key, entry);
+  spt_n_unfrozen++;
   RELEASE_LOCK(&spt_lock);
 }
 
@@ -61,6 +116,14 @@ void hs_spt_remove(StgWord64 key[2]) {
    if (spt) {
      ACQUIRE_LOCK(&spt_lock);
      StgStablePtr* entry = removeHashTable(spt, (StgWord)key, NULL);
+     if (entry) {
+       SptSlot * slot = findFrozenSlot(key);
+       if (slot && slot->state == SPT_SLOT_FULL) {
+         slot->state = SPT_SLOT_REMOVED;
+       } else {
+         spt_n_unfrozen--;
+       }
+     }
      RELEASE_LOCK(&spt_lock);
 
      if (entry)
@@ -69,7 +132,11 @@ void hs_spt_remove(StgWord64 key[2]) {
 }
 
 StgPtr hs_spt_lookup(StgWord64 key[2]) {
-  if (spt) {
+  SptSlot * slot = findFrozenSlot(key);
+  if (slot && slot->state == SPT_SLOT_FULL) {
+    return deRefStablePtr(slot->sp);
+  }
+  if (spt && spt_n_unfrozen > 0) {
     ACQUIRE_LOCK(&spt_lock);
     const StgStablePtr * entry = lookupHashTable(spt, (StgWord)key);
     RELEASE_LOCK(&spt_lock);
@@ -93,7 +160,59 @@ int hs_spt_key_count() {
   return spt ? keyCountHashTable(spt) : 0;
 }
 
+void freezeStaticPtrTable(void) {
+  StgWord size, n, i, j;
+  StgWord64 ** keys;
+  FrozenSpt * t;
+
+  // Only the first hs_init_ghc() freezes the table (exitStaticPtrTable()
+  // thaws it), so a reader can never be left with a table in its hands
+  // that we free.
+  if (spt == NULL || frozen_spt != NULL) return;
+
+  ACQUIRE_LOCK(&spt_lock);
+
+  n = keyCountHashTable(spt);
+  if (n == 0) {
+    RELEASE_LOCK(&spt_lock);
+    return;
+  }
+  // at most half full, so that the probe sequences stay short
+  for (size = 16; size < 2 * n; size *= 2) {}
+
+  keys = stgMallocBytes(n * sizeof(StgWord64 *), "freezeStaticPtrTable");
+  n = keysHashTable(spt, (StgWord *)keys, n);
+
+  t = stgCallocBytes(1, sizeof(FrozenSpt) + size * sizeof(SptSlot),
+                     "freezeStaticPtrTable");
+  t->mask = size - 1;
+  for (i = 0; i < n; i++) {
+    const StgStablePtr * entry = lookupHashTable(spt, (StgWord)keys[i]);
+    for (j = (StgWord)keys[i][0] & t->mask;
+         t->slots[j].state != SPT_SLOT_EMPTY;
+         j = (j + 1) & t->mask) {}
+    t->slots[j].key[0] = keys[i][0];
+    t->slots[j].key[1] = keys[i][1];
+    t->slots[j].sp = *entry;
+    t->slots[j].state = SPT_SLOT_FULL;
+  }
+  stgFree(keys);
+
+  // Readers look at frozen_spt without the lock: they must see the
+  // contents of the table by the time they see the pointer to it.
+  write_barrier();
+  frozen_spt = t;
+  spt_n_unfrozen = 0;
+
+  RELEASE_LOCK(&spt_lock);
+}
+
 void exitStaticPtrTable() {
+  if (frozen_spt) {
+    stgFree(frozen_spt);
+    frozen_spt = NULL;
+  }
+  spt_n_unfrozen = 0;
   if (spt) {
     freeHashTable(spt, freeSptEntry);
     spt = NULL;
@@ -11,6 +11,10 @@
 
 #include "BeginPrivate.h"
 
+/** Makes the entries inserted so far readable without a lock.  Called
+ * at the end of hs_init_ghc(), when the module constructors have run. */
+void freezeStaticPtrTable ( void );
+
 /** Frees the Static Pointer Table. */
 void exitStaticPtrTable ( void );
 
@@ -18,10 +18,16 @@
 #include "sm/GC.h" // gc_alloc_block_sync, whitehole_spin
 #include "sm/GCThread.h"
 #include "sm/BlockAlloc.h"
+#include "sm/OSMem.h"
+#include "sm/Freeze.h"
 
 #if USE_PAPI
 #include "Papi.h"
 #endif
+#include "PerfCounters.h"
+#include "Metrics.h"
+
+#include <string.h>
 
 /* huh? */
 #define BIG_STRING_LEN              512
@@ -34,6 +40,14 @@ static Time
     start_exit_cpu, start_exit_elapsed,
     end_exit_cpu,   end_exit_elapsed;
 
+// the steps of hs_init_ghc(), see stat_initPhase()
+#define MAX_INIT_PHASES 16
+
+static const char *init_phase_names[MAX_INIT_PHASES];
+static Time init_phase_elapsed[MAX_INIT_PHASES];
+static nat  n_init_phases = 0;
+static Time init_phase_start = 0;
+
 static Time GC_tot_cpu  = 0;
 
 static StgWord64 GC_tot_alloc      = 0;
@@ -42,6 +56,30 @@ static StgWord64 GC_tot_copied     = 0;
 static StgWord64 GC_par_max_copied = 0;
 static StgWord64 GC_par_tot_copied = 0;
 
+// stopping the other capabilities for a GC, see stat_endSync()
+static StgWord64 SYNC_count = 0;
+static Time SYNC_tot_elapsed = 0, SYNC_max_elapsed = 0;
+static nat SYNC_max_cap = 0;
+static StgWord64 SYNC_max_thread = 0;
+
+// weak pointer processing, see Note [Parallel weak pointers]
+static Time WP_start_elapsed = 0;
+static Time WP_tot_elapsed = 0, WP_max_elapsed = 0;
+static StgWord64 WP_rounds = 0;
+
+// the phases of GarbageCollect(), see stat_startGCPhase()
+#define GC_PHASE_BUCKETS 6      // <10us, <100us, <1ms, <10ms, <100ms, more
+
+static const char *gc_phase_names[N_GC_PHASES] = {
+    "Roots", "Scavenge", "Weak ptrs", "Sweep", "Nursery", "Return mem"
+};
+
+static Time GC_phase_start = 0;
+static Time GC_phase_cur[N_GC_PHASES];          // this GC
+static Time GC_phase_tot[N_GC_PHASES];
+static Time GC_phase_max[N_GC_PHASES];
+static StgWord64 GC_phase_hist[N_GC_PHASES][GC_PHASE_BUCKETS];
+
 #ifdef PROFILING
 static Time RP_start_time  = 0, RP_tot_time  = 0;  // retainer prof user time
 static Time RPe_start_time = 0, RPe_tot_time = 0;  // retainer prof elap time
@@ -64,11 +102,57 @@ static W_ residency_samples = 0; // for stats only
 static W_ current_slop      = 0;
 static W_ max_slop          = 0;
 
+// Remembered set (mutable list) entries scanned per GC; see
+// scavenge_mutable_list()
+static W_         max_mut_list_entries = 0;
+static StgWord64  GC_tot_mut_list_entries = 0;
+static StgWord64  GC_tot_mut_list_dups = 0;
+
 static W_ GC_end_faults = 0;
 
 static Time *GC_coll_cpu = NULL;
 static Time *GC_coll_elapsed = NULL;
 static Time *GC_coll_max_pause = NULL;
+static Time *GC_coll_last_pause = NULL;
+
+/* -----------------------------------------------------------------------------
+   Pause time distributions and mutator utilisation
+
+   Each GC's pause (elapsed time) is counted in a log-linear histogram
+   for its generation, in the style of HdrHistogram: pauses below 64us
+   are counted exactly, and each power of two above that is split into
+   32 buckets, so a percentile read back from it is within about 3%.
+
+   The minimum mutator utilisation (MMU) for a window size W is the
+   smallest fraction of any W-long stretch of the run that was not
+   spent in GC.  A worst window can always be slid so that it ends
+   where a pause ends, so those are the only ones we look at: for each
+   window size we keep the total length of the pauses in the window
+   ending now, over a ring of the most recent pauses.  (If more than
+   PAUSE_RING pauses fit in a window, the oldest are forgotten and the
+   MMU of that window comes out too high.)
+   -------------------------------------------------------------------------- */
+
+#define PAUSE_SUB_BITS  5
+#define PAUSE_SUB       (1 << PAUSE_SUB_BITS)
+#define PAUSE_MAX_BITS  40      // in us, about 12 days
+#define PAUSE_BUCKETS   (2 * PAUSE_SUB + \
+                         (PAUSE_MAX_BITS - PAUSE_SUB_BITS - 1) * PAUSE_SUB)
+
+static StgWord64 *GC_pause_hist = NULL;  // PAUSE_BUCKETS for each generation
+
+#define PAUSE_RING 4096
+
+static const StgWord64 mmu_window_ms[GC_MMU_WINDOWS] = { 1, 10, 100, 1000 };
+
+static Time      pause_ring_start[PAUSE_RING];
+static Time      pause_ring_end[PAUSE_RING];
+static StgWord64 pause_seq = 0;                 // pauses so far
+static StgWord64 mmu_tail[GC_MMU_WINDOWS];      // oldest pause in the window
+static Time      mmu_sum[GC_MMU_WINDOWS];       // pauses from mmu_tail on
+static double    mmu_min[GC_MMU_WINDOWS];       // < 0: no window yet
+
+static void recordPause (nat gen, Time start, Time end);
 
 static void statsFlush( void );
 static void statsClose( void );
@@ -82,6 +166,12 @@ Time stat_getElapsedTime(void)
     return getProcessElapsedTime() - start_init_elapsed;
 }
 
+// The same, from the clock chosen by --clock
+Time stat_getElapsedTimestamp(void)
+{
+    return NSToTime(getTimestampNSec()) - start_init_elapsed;
+}
+
 /* ---------------------------------------------------------------------------
    Measure the current MUT time, for profiling
    ------------------------------------------------------------------------ */
@@ -127,10 +217,13 @@ mut_user_time_during_heap_census( void )
 void
 initStats0(void)
 {
+    nat i;
+
     start_init_cpu    = 0;
     start_init_elapsed = 0;
     end_init_cpu     = 0;
     end_init_elapsed  = 0;
+    n_init_phases    = 0;
 
     start_exit_cpu    = 0;
     start_exit_elapsed = 0;
@@ -143,6 +236,30 @@ initStats0(void)
     GC_par_tot_copied = 0;
     GC_tot_cpu  = 0;
 
+    SYNC_count = 0;
+    SYNC_tot_elapsed = 0;
+    SYNC_max_elapsed = 0;
+    SYNC_max_cap = 0;
+    SYNC_max_thread = 0;
+
+    WP_start_elapsed = 0;
+    WP_tot_elapsed = 0;
+    WP_max_elapsed = 0;
+    WP_rounds = 0;
+
+    pause_seq = 0;
+    for (i = 0; i < GC_MMU_WINDOWS; i++) {
+        mmu_tail[i] = 0;
+        mmu_sum[i] = 0;
+        mmu_min[i] = -1;
+    }
+
+    GC_phase_start = 0;
+    memset(GC_phase_cur, 0, sizeof(GC_phase_cur));
+    memset(GC_phase_tot, 0, sizeof(GC_phase_tot));
+    memset(GC_phase_max, 0, sizeof(GC_phase_max));
+    memset(GC_phase_hist, 0, sizeof(GC_phase_hist));
+
 #ifdef PROFILING
     RP_start_time  = 0;
     RP_tot_time  = 0;
@@ -159,6 +276,9 @@ initStats0(void)
     cumulative_residency = 0;
     residency_samples = 0;
     max_slop = 0;
+    max_mut_list_entries = 0;
+    GC_tot_mut_list_entries = 0;
+    GC_tot_mut_list_dups = 0;
 
     GC_end_faults = 0;
 }
@@ -188,11 +308,20 @@ initStats1 (void)
         (Time *)stgMallocBytes(
             sizeof(Time)*RtsFlags.GcFlags.generations,
             "initStats");
+    GC_coll_last_pause =
+        (Time *)stgMallocBytes(
+            sizeof(Time)*RtsFlags.GcFlags.generations,
+            "initStats");
     for (i = 0; i < RtsFlags.GcFlags.generations; i++) {
         GC_coll_cpu[i] = 0;
         GC_coll_elapsed[i] = 0;
         GC_coll_max_pause[i] = 0;
+        GC_coll_last_pause[i] = 0;
     }
+    GC_pause_hist =
+        (StgWord64 *)stgCallocBytes(
+            RtsFlags.GcFlags.generations * PAUSE_BUCKETS, sizeof(StgWord64),
+            "initStats");
 }
 
 /* -----------------------------------------------------------------------------
@@ -203,6 +332,24 @@ void
 stat_startInit(void)
 {
     getProcessTimes(&start_init_cpu, &start_init_elapsed);
+    init_phase_start = start_init_elapsed;
+}
+
+// The part of hs_init_ghc() since the previous call (or since
+// stat_startInit()) was the named step; +RTS -s shows how long each
+// step took.  The flags may not have been parsed yet, so we always
+// record them: it's only a clock read.
+void
+stat_initPhase(const char *name)
+{
+    Time now = getProcessElapsedTime();
+
+    if (n_init_phases < MAX_INIT_PHASES) {
+        init_phase_names[n_init_phases] = name;
+        init_phase_elapsed[n_init_phases] = now - init_phase_start;
+        n_init_phases++;
+    }
+    init_phase_start = now;
 }
 
 void
@@ -276,6 +423,8 @@ stat_startGC (Capability *cap, gc_thread *gct)
       papi_start_gc_count();
     }
 #endif
+    perfCountersCharge(rtsFalse, -1);
+    metricsStartGC();
 
     getProcessTimes(&gct->gc_start_cpu, &gct->gc_start_elapsed);
 
@@ -292,9 +441,52 @@ stat_startGC (Capability *cap, gc_thread *gct)
         gct->gc_start_faults = getPageFaults();
     }
 
+    memset(GC_phase_cur, 0, sizeof(GC_phase_cur));
+
     updateNurseriesStats();
 }
 
+/* -----------------------------------------------------------------------------
+   Called around each phase of GarbageCollect(), by the thread leading
+   the GC.  A phase may be entered more than once in a GC; the times
+   are added up.  At the end of the GC, stat_endGC() adds them to the
+   totals and the histograms for +RTS -s, and posts EVENT_GC_PHASES.
+   -------------------------------------------------------------------------- */
+
+void
+stat_startGCPhase(void)
+{
+    GC_phase_start = getProcessElapsedTime();
+    perfCountersCharge(rtsTrue, -1);
+}
+
+void
+stat_endGCPhase(GcPhase phase)
+{
+    GC_phase_cur[phase] += getProcessElapsedTime() - GC_phase_start;
+    perfCountersCharge(rtsTrue, phase);
+}
+
+static void
+addGCPhaseTimes(void)
+{
+    nat p, b;
+    Time t, limit;
+
+    for (p = 0; p < N_GC_PHASES; p++) {
+        t = GC_phase_cur[p];
+        GC_phase_tot[p] += t;
+        if (GC_phase_max[p] < t) {
+            GC_phase_max[p] = t;
+        }
+        limit = USToTime(10);
+        for (b = 0; b < GC_PHASE_BUCKETS - 1 && t >= limit; b++) {
+            limit *= 10;
+        }
+        GC_phase_hist[p][b]++;
+    }
+}
+
 /* -----------------------------------------------------------------------------
    Called at the end of each GC
    -------------------------------------------------------------------------- */
@@ -307,9 +499,15 @@ stat_endGC (Capability *cap, gc_thread *gct,
     W_ tot_alloc;
     W_ alloc;
 
+    perfCountersCharge(rtsTrue, -1);
+
     if (RtsFlags.GcFlags.giveStats != NO_GC_STATS ||
-        RtsFlags.ProfFlags.doHeapProfile)
+        RtsFlags.ProfFlags.doHeapProfile ||
         // heap profiling needs GC_tot_time
+        RtsFlags.GcFlags.idleGCBudget != 0 ||
+        // and the idle GC stat_lastGCPause()
+        RtsFlags.GcFlags.gcOverhead != 0)
+        // and --gc-overhead stat_totalGCCpu()
     {
         Time cpu, elapsed, gc_cpu, gc_elapsed;
 
@@ -319,6 +517,10 @@ stat_endGC (Capability *cap, gc_thread *gct,
         // of GC eventlog events.
         traceEventGcGlobalSync(cap);
 
+        addGCPhaseTimes();
+        traceEventGcPhases(cap, GC_phase_cur);
+        perfCountersTrace(cap);
+
         // Emitted before GC_END on all caps, which simplifies tools code.
         traceEventGcStats(cap,
                           CAPSET_HEAP_DEFAULT,
@@ -379,6 +581,8 @@ stat_endGC (Capability *cap, gc_thread *gct,
         if (GC_coll_max_pause[gen] < gc_elapsed) {
             GC_coll_max_pause[gen] = gc_elapsed;
         }
+        GC_coll_last_pause[gen] = gc_elapsed;
+        recordPause(gen, gct->gc_start_elapsed, elapsed);
 
         GC_tot_copied += (StgWord64) copied;
         GC_par_max_copied += (StgWord64) par_max_copied;
@@ -402,6 +606,15 @@ stat_endGC (Capability *cap, gc_thread *gct,
         }
 
         if (slop > max_slop) max_slop = slop;
+
+        if (mut_list_entries > max_mut_list_entries) {
+            max_mut_list_entries = mut_list_entries;
+        }
+        GC_tot_mut_list_entries += mut_list_entries;
+        GC_tot_mut_list_dups += mut_list_dups;
+
+        metricsEndGC(gen, elapsed - start_init_elapsed, gc_cpu, gc_elapsed,
+                     copied, current_residency, max_residency, tot_alloc);
     }
 
     if (rub_bell) {
@@ -422,6 +635,47 @@ stat_endGC (Capability *cap, gc_thread *gct,
 #endif
 }
 
+/* -----------------------------------------------------------------------------
+   How long the last collection of generation gen took (elapsed time),
+   or 0 if it hasn't been collected.  Only kept with +RTS -s or
+   -Ibudget.
+   -------------------------------------------------------------------------- */
+
+Time
+stat_lastGCPause (nat gen)
+{
+    return GC_coll_last_pause[gen];
+}
+
+/* -----------------------------------------------------------------------------
+   Called by scheduleDoGC() once it has stopped the other capabilities:
+   sync is the time from its request to the arrival of the last of
+   them, last_cap, which was running thread last_thread (or 0) when the
+   GC started waiting for it.  A capability that takes long to stop is
+   usually running a loop that doesn't allocate.
+   -------------------------------------------------------------------------- */
+
+void
+stat_endSync (Capability *cap, Time sync, nat last_cap, StgWord64 last_thread)
+{
+    SYNC_count++;
+    SYNC_tot_elapsed += sync;
+    if (SYNC_max_elapsed < sync) {
+        SYNC_max_elapsed = sync;
+        SYNC_max_cap = last_cap;
+        SYNC_max_thread = last_thread;
+    }
+    traceEventGcSync(cap, sync, last_cap, last_thread);
+    metricsSync(sync, last_cap, last_thread);
+}
+
+// CPU time of the GCs that have finished
+Time
+stat_totalGCCpu (void)
+{
+    return GC_tot_cpu;
+}
+
 /* -----------------------------------------------------------------------------
    Called at the beginning of each Retainer Profiliing
    -------------------------------------------------------------------------- */
@@ -467,6 +721,166 @@ stat_endRP(
 }
 #endif /* PROFILING */
 
+/* -----------------------------------------------------------------------------
+   Called around the weak pointer processing of each GC, which is done
+   in rounds (see Note [Parallel weak pointers] in sm/MarkWeak.c).  We
+   only time it in elapsed time: the CPU time of the GC threads is
+   already counted as GC time.
+   -------------------------------------------------------------------------- */
+
+void
+stat_startWeak(void)
+{
+    WP_start_elapsed = getProcessElapsedTime();
+}
+
+void
+stat_endWeak(nat rounds)
+{
+    Time t = getProcessElapsedTime() - WP_start_elapsed;
+
+    WP_tot_elapsed += t;
+    if (WP_max_elapsed < t) {
+        WP_max_elapsed = t;
+    }
+    WP_rounds += rounds;
+}
+
+/* -----------------------------------------------------------------------------
+   Pause statistics, see "Pause time distributions" above
+   -------------------------------------------------------------------------- */
+
+static nat
+pauseBucket (StgWord64 us)
+{
+    nat m, k;
+
+    if (us < 2 * PAUSE_SUB) {
+        return (nat)us;
+    }
+    if (us >> PAUSE_MAX_BITS) {
+        us = ((StgWord64)1 << PAUSE_MAX_BITS) - 1;
+    }
+    for (m = 0; (us >> (m + 1)) != 0; m++) {
+        // m is the index of the top bit
+    }
+    k = m - PAUSE_SUB_BITS;
+    return 2 * PAUSE_SUB + (k - 1) * PAUSE_SUB
+        + (nat)((us >> k) - PAUSE_SUB);
+}
+
+// The least pause (in us) that is beyond bucket b
+static StgWord64
+pauseBucketTop (nat b)
+{
+    nat k;
+    StgWord64 j;
+
+    if (b < 2 * PAUSE_SUB) {
+        return b + 1;
+    }
+    k = (b - 2 * PAUSE_SUB) / PAUSE_SUB + 1;
+    j = (b - 2 * PAUSE_SUB) % PAUSE_SUB + PAUSE_SUB;
+    return (j + 1) << k;
+}
+
+static void
+recordPause (nat gen, Time start, Time end)
+{
+    nat w;
+    StgWord64 slot;
+    Time window, lo, gc;
+    double u;
+
+    GC_pause_hist[gen * PAUSE_BUCKETS + pauseBucket(TimeToUS(end - start))]++;
+
+    slot = pause_seq % PAUSE_RING;
+    for (w = 0; w < GC_MMU_WINDOWS; w++) {
+        // forget the pause we're about to overwrite
+        if (pause_seq >= PAUSE_RING && mmu_tail[w] == pause_seq - PAUSE_RING) {
+            mmu_sum[w] -= pause_ring_end[slot] - pause_ring_start[slot];
+            mmu_tail[w]++;
+        }
+    }
+    pause_ring_start[slot] = start;
+    pause_ring_end[slot] = end;
+
+    for (w = 0; w < GC_MMU_WINDOWS; w++) {
+        window = USToTime(mmu_window_ms[w] * 1000);
+        lo = end - window;
+        mmu_sum[w] += end - start;
+        while (pause_ring_end[mmu_tail[w] % PAUSE_RING] <= lo) {
+            slot = mmu_tail[w] % PAUSE_RING;
+            mmu_sum[w] -= pause_ring_end[slot] - pause_ring_start[slot];
+            mmu_tail[w]++;
+        }
+        // the run so far must be at least as long as the window
+        if (lo < end_init_elapsed) continue;
+
+        gc = mmu_sum[w];
+        slot = mmu_tail[w] % PAUSE_RING;
+        if (pause_ring_start[slot] < lo) {
+            gc -= lo - pause_ring_start[slot];
+        }
+        u = 1.0 - (double)gc / (double)window;
+        if (mmu_min[w] < 0 || u < mmu_min[w]) {
+            mmu_min[w] = u;
+        }
+    }
+    pause_seq++;
+}
+
+// Pause statistics for the collections of generation gen, or of all of
+// them if gen < 0
+static void
+pauseStats (int gen, GCPauseStats *s)
+{
+    static const double qs[4] = { 0.5, 0.9, 0.99, 0.999 };
+    StgWord64 n, target, seen;
+    nat g, g0, g1, b, q;
+    Time max = 0, t;
+
+    if (gen < 0) {
+        g0 = 0; g1 = RtsFlags.GcFlags.generations;
+    } else {
+        g0 = gen; g1 = gen + 1;
+    }
+
+    n = 0;
+    for (g = g0; g < g1; g++) {
+        for (b = 0; b < PAUSE_BUCKETS; b++) {
+            n += GC_pause_hist[g * PAUSE_BUCKETS + b];
+        }
+        if (max < GC_coll_max_pause[g]) max = GC_coll_max_pause[g];
+    }
+
+    s->pauses = n;
+    s->max_seconds = TimeToSecondsDbl(max);
+
+    for (q = 0; q < 4; q++) {
+        target = (StgWord64)(qs[q] * n);
+        if ((double)target < qs[q] * n) target++;     // rounding up
+        seen = 0;
+        t = 0;
+        for (b = 0; n > 0 && b < PAUSE_BUCKETS; b++) {
+            for (g = g0; g < g1; g++) {
+                seen += GC_pause_hist[g * PAUSE_BUCKETS + b];
+            }
+            if (seen >= target) {
+                t = USToTime(pauseBucketTop(b));
+                break;
+            }
+        }
+        if (t > max) t = max;
+        switch (q) {
+        case 0: s->p50_seconds  = TimeToSecondsDbl(t); break;
+        case 1: s->p90_seconds  = TimeToSecondsDbl(t); break;
+        case 2: s->p99_seconds  = TimeToSecondsDbl(t); break;
+        default: s->p999_seconds = TimeToSecondsDbl(t); break;
+        }
+    }
+}
+
 /* -----------------------------------------------------------------------------
    Called at the beginning of each heap census
    -------------------------------------------------------------------------- */
@@ -540,6 +954,24 @@ StgInt TOTAL_CALLS=1;
   statsPrintf("  (SLOW_CALLS_" #arity ") %% of (TOTAL_CALLS) : %.1f%%\n", \
               SLOW_CALLS_##arity * 100.0/TOTAL_CALLS)
 
+#if defined(THREADED_RTS) && defined(PROF_SPIN)
+static void
+addSpinLockStats (SpinLock *total, SpinLock *p)
+{
+    total->spin      += p->spin;
+    total->contended += p->contended;
+    total->parked    += p->parked;
+}
+
+static void
+statsSpinLock (char *name, SpinLock *p)
+{
+    statsPrintf("%s: %"FMT_Word64" (%"FMT_Word64" contended, %"
+                FMT_Word64" parked)\n",
+                name, p->spin, p->contended, p->parked);
+}
+#endif
+
 static inline Time get_init_cpu(void) { return end_init_cpu - start_init_cpu; }
 static inline Time get_init_elapsed(void) { return end_init_elapsed - start_init_elapsed; }
 
@@ -630,10 +1062,55 @@ stat_exit (void)
             showStgWord64(max_slop*sizeof(W_), temp, rtsTrue/*commas*/);
             statsPrintf("%16s bytes maximum slop\n", temp);
 
-            statsPrintf("%16" FMT_SizeT " MB total memory in use (%" FMT_SizeT " MB lost due to fragmentation)\n\n",
+            if (total_collections > 0) {
+                showStgWord64(max_mut_list_entries, temp, rtsTrue/*commas*/);
+                statsPrintf("%16s maximum remembered set entries (%" FMT_Word64 " per GC on average, %" FMT_Word64 " duplicates)\n",
+                            temp,
+                            GC_tot_mut_list_entries / total_collections,
+                            GC_tot_mut_list_dups);
+            }
+
+            statsPrintf("%16" FMT_SizeT " MB total memory in use (%" FMT_SizeT " MB lost due to fragmentation)\n",
                         (size_t)(peak_mblocks_allocated * MBLOCK_SIZE_W) / (1024 * 1024 / sizeof(W_)),
                         (size_t)(peak_mblocks_allocated * BLOCKS_PER_MBLOCK * BLOCK_SIZE_W - hw_alloc_blocks * BLOCK_SIZE_W) / (1024 * 1024 / sizeof(W_)));
 
+            if (RtsFlags.GcFlags.hugePages) {
+                StgWord hugetlb, thp;
+                osHugePageMBlocks(&hugetlb, &thp);
+                statsPrintf("%16" FMT_Word " MB in huge pages (%" FMT_Word " MB advised for transparent huge pages)\n",
+                            hugetlb * (MBLOCK_SIZE / (1024 * 1024)),
+                            thp * (MBLOCK_SIZE / (1024 * 1024)));
+            }
+            if (RtsFlags.GcFlags.decommitAge != 0) {
+                statsPrintf("%16" FMT_Word " MB given back to the OS in the background\n",
+                            decommitted_mblocks * (MBLOCK_SIZE / (1024 * 1024)));
+            }
+            if (n_frozen_blocks != 0) {
+                statsPrintf("%16" FMT_Word " MB in the frozen heap\n",
+                            n_frozen_blocks * BLOCK_SIZE / (1024 * 1024));
+            }
+
+            {
+                W_ free_blocks, free_mblocks;
+                W_ histogram[MBLOCK_FREE_HISTOGRAM_SIZE];
+                nat i;
+
+                ACQUIRE_SM_LOCK;
+                fragmentationStats(&free_blocks, &free_mblocks, histogram);
+                RELEASE_SM_LOCK;
+
+                statsPrintf("%16" FMT_Word " MB free in megablocks in use (%" FMT_Word " MB in free megablocks)\n",
+                            free_blocks * BLOCK_SIZE / (1024 * 1024),
+                            free_mblocks * (MBLOCK_SIZE / (1024 * 1024)));
+                statsPrintf("%16s megablocks in use by free blocks:", "");
+                for (i = 0; i < MBLOCK_FREE_HISTOGRAM_SIZE; i++) {
+                    statsPrintf(" %d-%d:%" FMT_Word,
+                                1 << i, (1 << (i+1)) - 1, histogram[i]);
+                }
+                statsPrintf("\n");
+            }
+            statsPrintf("\n");
+
             /* Print garbage collections in each gen */
             statsPrintf("                                     Tot time (elapsed)  Avg pause  Max pause\n");
             for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
@@ -647,6 +1124,53 @@ stat_exit (void)
                             gen->collections == 0 ? 0 : TimeToSecondsDbl(GC_coll_elapsed[g] / gen->collections),
                             TimeToSecondsDbl(GC_coll_max_pause[g]));
             }
+            statsPrintf("  Weak ptrs  %5" FMT_Word64 " rounds                      %6.3fs                %3.4fs\n",
+                        WP_rounds,
+                        TimeToSecondsDbl(WP_tot_elapsed),
+                        TimeToSecondsDbl(WP_max_elapsed));
+
+            if (total_collections > 0) {
+                statsPrintf("\n  GC phases      (elapsed)  Max pause"
+                            "   <10us  <100us    <1ms   <10ms  <100ms    more\n");
+                for (i = 0; i < N_GC_PHASES; i++) {
+                    nat b;
+                    statsPrintf("  %-10s    %6.3fs    %3.4fs",
+                                gc_phase_names[i],
+                                TimeToSecondsDbl(GC_phase_tot[i]),
+                                TimeToSecondsDbl(GC_phase_max[i]));
+                    for (b = 0; b < GC_PHASE_BUCKETS; b++) {
+                        statsPrintf(" %7" FMT_Word64, GC_phase_hist[i][b]);
+                    }
+                    statsPrintf("\n");
+                }
+
+                statsPrintf("\n  GC pauses     Count       p50       p90       p99     p99.9       Max\n");
+                for (g = 0; g <= RtsFlags.GcFlags.generations; g++) {
+                    GCPauseStats ps;
+                    char name[16];
+                    if (g < RtsFlags.GcFlags.generations) {
+                        pauseStats(g, &ps);
+                        sprintf(name, "Gen %2d", g);
+                    } else {
+                        pauseStats(-1, &ps);
+                        strcpy(name, "All");
+                    }
+                    statsPrintf("  %-10s %8" FMT_Word64 "   %3.4fs   %3.4fs   %3.4fs   %3.4fs   %3.4fs\n",
+                                name, ps.pauses, ps.p50_seconds, ps.p90_seconds,
+                                ps.p99_seconds, ps.p999_seconds, ps.max_seconds);
+                }
+
+                statsPrintf("\n  Min mutator utilisation:");
+                for (i = 0; i < GC_MMU_WINDOWS; i++) {
+                    if (mmu_min[i] < 0) {
+                        statsPrintf(" %" FMT_Word64 "ms -", mmu_window_ms[i]);
+                    } else {
+                        statsPrintf(" %" FMT_Word64 "ms %.1f%%",
+                                    mmu_window_ms[i], mmu_min[i] * 100);
+                    }
+                    statsPrintf(i + 1 < GC_MMU_WINDOWS ? "," : "\n");
+                }
+            }
 
 #if defined(THREADED_RTS)
             if (RtsFlags.ParFlags.parGcEnabled && n_capabilities > 1) {
@@ -668,7 +1192,7 @@ stat_exit (void)
 
             {
                 nat i;
-                SparkCounters sparks = { 0, 0, 0, 0, 0, 0};
+                SparkCounters sparks = { 0, 0, 0, 0, 0, 0, 0 };
                 for (i = 0; i < n_capabilities; i++) {
                     sparks.created   += capabilities[i]->spark_stats.created;
                     sparks.dud       += capabilities[i]->spark_stats.dud;
@@ -676,17 +1200,166 @@ stat_exit (void)
                     sparks.converted += capabilities[i]->spark_stats.converted;
                     sparks.gcd       += capabilities[i]->spark_stats.gcd;
                     sparks.fizzled   += capabilities[i]->spark_stats.fizzled;
+                    sparks.throttled += capabilities[i]->spark_stats.throttled;
                 }
 
-                statsPrintf("  SPARKS: %" FMT_Word " (%" FMT_Word " converted, %" FMT_Word " overflowed, %" FMT_Word " dud, %" FMT_Word " GC'd, %" FMT_Word " fizzled)\n\n",
-                            sparks.created + sparks.dud + sparks.overflowed,
+                statsPrintf("  SPARKS: %" FMT_Word " (%" FMT_Word " converted, %" FMT_Word " overflowed, %" FMT_Word " dud, %" FMT_Word " GC'd, %" FMT_Word " fizzled",
+                            sparks.created + sparks.dud + sparks.overflowed
+                                + sparks.throttled,
                             sparks.converted, sparks.overflowed, sparks.dud,
                             sparks.gcd, sparks.fizzled);
+                if (RtsFlags.ParFlags.sparkThrottle) {
+                    statsPrintf(", %" FMT_Word " throttled", sparks.throttled);
+                }
+                statsPrintf(")\n\n");
+            }
+
+            {
+                nat i;
+                StgWord resumes = 0, fast_resumes = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    resumes      += capabilities[i]->resumes;
+                    fast_resumes += capabilities[i]->fast_resumes;
+                }
+                if (resumes > 0) {
+                    statsPrintf("  SAFE FFI RETURNS: %" FMT_Word " (%" FMT_Word " fast path)\n\n",
+                                resumes, fast_resumes);
+                }
+            }
+
+            {
+                nat i;
+                StgWord handoffs = 0, spun = 0;
+                Time latency = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    handoffs += capabilities[i]->bound_handoffs;
+                    spun     += capabilities[i]->spun_handoffs;
+                    latency  += capabilities[i]->handoff_latency;
+                }
+                if (handoffs > 0) {
+                    statsPrintf("  BOUND THREAD HANDOFFS: %" FMT_Word " (%" FMT_Word " without sleeping, %.1fus avg)\n\n",
+                                handoffs, spun,
+                                (double)TimeToNS(latency) / 1000 / handoffs);
+                }
+            }
+
+            if (SYNC_count > 0 && n_capabilities > 1) {
+                statsPrintf("  GC SYNC: %.4fs avg, %.4fs max (waiting for cap %d",
+                            TimeToSecondsDbl(SYNC_tot_elapsed) / SYNC_count,
+                            TimeToSecondsDbl(SYNC_max_elapsed), SYNC_max_cap);
+                if (SYNC_max_thread != 0) {
+                    statsPrintf(", thread %" FMT_Word, (W_)SYNC_max_thread);
+                }
+                statsPrintf(")\n\n");
             }
 #endif
 
+            {
+                nat i;
+                StgWord chunks = 0, hits = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    chunks += capabilities[i]->stack_chunks;
+                    hits   += capabilities[i]->stack_chunk_hits;
+                }
+                if (chunks > 0) {
+                    statsPrintf("  STACK CHUNKS: %" FMT_Word " (%" FMT_Word " reused, %.1f%%, saving %" FMT_Word " bytes)\n\n",
+                                chunks, hits, 100.0 * hits / chunks,
+                                hits * RtsFlags.GcFlags.stkChunkSize * sizeof(W_));
+                }
+            }
+
+            {
+                nat i;
+                StgWord pauses = 0, frames = 0, squeezed = 0, splits = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    pauses   += capabilities[i]->pauses;
+                    frames   += capabilities[i]->pause_frames;
+                    squeezed += capabilities[i]->pause_words_squeezed;
+                    splits   += capabilities[i]->pause_splits;
+                }
+                if (pauses > 0) {
+                    statsPrintf("  THREAD PAUSES: %" FMT_Word " (%.1f frames scanned on average, %" FMT_Word " bytes squeezed, %" FMT_Word " stack splits)\n\n",
+                                pauses, (double)frames / pauses,
+                                squeezed * sizeof(W_), splits);
+                }
+            }
+
+            {
+                nat i;
+                StgWord splits = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    splits += capabilities[i]->stack_gc_splits;
+                }
+                if (total_collections > 0 && stack_words_scanned > 0) {
+                    statsPrintf("  STACK SCANNED BY GC: %" FMT_Word " bytes per GC (%" FMT_Word " clean stacks split)\n\n",
+                                stack_words_scanned * sizeof(W_) / total_collections,
+                                splits);
+                }
+            }
+
+            {
+                nat i;
+                StgWord created = 0, hits = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    created += capabilities[i]->threads_created;
+                    hits    += capabilities[i]->thread_stack_hits;
+                }
+                if (created > 0) {
+                    statsPrintf("  THREADS: %" FMT_Word " created (%" FMT_Word " with a recycled stack, %.1f%%)\n\n",
+                                created, hits, 100.0 * hits / created);
+                }
+            }
+
+            {
+                nat i;
+                StgWord commits = 0, aborts = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    commits += capabilities[i]->stm_commits;
+                    aborts  += capabilities[i]->stm_aborts;
+                }
+                if (commits + aborts > 0) {
+                    statsPrintf("  STM: %" FMT_Word " commits, %" FMT_Word " failed (%.1f%%)\n",
+                                commits, aborts,
+                                100.0 * aborts / (commits + aborts));
+                    for (i = 0; n_capabilities > 1 && i < n_capabilities; i++) {
+                        statsPrintf("    cap %u: %" FMT_Word " commits, %" FMT_Word " failed\n",
+                                    i, capabilities[i]->stm_commits,
+                                    capabilities[i]->stm_aborts);
+                    }
+                    statsPrintf("\n");
+                }
+            }
+
+            {
+                nat i;
+                StgWord blocked = 0, forwarded = 0, remote = 0, batches = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    blocked   += capabilities[i]->bh_blocked;
+                    forwarded += capabilities[i]->bh_forwarded;
+                    remote    += capabilities[i]->bh_remote_wakeups;
+                    batches   += capabilities[i]->bh_wakeup_batches;
+                }
+                if (blocked > 0) {
+                    statsPrintf("  BLACK HOLES: %" FMT_Word " blocked (%" FMT_Word " forwarded to the owner)",
+                                blocked, forwarded);
+                    if (remote > 0) {
+                        statsPrintf(", %" FMT_Word " woken on other caps in %" FMT_Word " batches",
+                                    remote, batches);
+                    }
+                    statsPrintf("\n\n");
+                }
+            }
+
             statsPrintf("  INIT    time  %7.3fs  (%7.3fs elapsed)\n",
                         TimeToSecondsDbl(init_cpu), TimeToSecondsDbl(init_elapsed));
+            {
+                nat i;
+                for (i = 0; i < n_init_phases; i++) {
+                    statsPrintf("    %-12s %8.3fms elapsed\n",
+                                init_phase_names[i],
+                                TimeToSecondsDbl(init_phase_elapsed[i]) * 1000);
+                }
+            }
 
             statsPrintf("  MUT     time  %7.3fs  (%7.3fs elapsed)\n",
                         TimeToSecondsDbl(mut_cpu), TimeToSecondsDbl(mut_elapsed));
@@ -738,15 +1411,29 @@ stat_exit (void)
 #if USE_PAPI
             papi_stats_report();
 #endif
+            perfCountersReport(gc_phase_names);
 #if defined(THREADED_RTS) && defined(PROF_SPIN)
             {
-                nat g;
+                nat g, i;
+                SpinLock gc_spin, mut_spin;
 
-                statsPrintf("gc_alloc_block_sync: %"FMT_Word64"\n", gc_alloc_block_sync.spin);
+                statsSpinLock("gc_alloc_block_sync", &gc_alloc_block_sync);
                 statsPrintf("whitehole_spin: %"FMT_Word64"\n", whitehole_spin);
                 for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
-                    statsPrintf("gen[%d].sync: %"FMT_Word64"\n", g, generations[g].sync.spin);
+                    char name[32];
+                    sprintf(name, "gen[%d].sync", g);
+                    statsSpinLock(name, &generations[g].sync);
+                }
+
+                // totals over the GC threads
+                initSpinLock(&gc_spin);
+                initSpinLock(&mut_spin);
+                for (i = 0; gc_threads != NULL && i < n_capabilities; i++) {
+                    addSpinLockStats(&gc_spin, &gc_threads[i]->gc_spin);
+                    addSpinLockStats(&mut_spin, &gc_threads[i]->mut_spin);
                 }
+                statsSpinLock("gc_spin", &gc_spin);
+                statsSpinLock("mut_spin", &mut_spin);
             }
 #endif
         }
@@ -765,8 +1452,7 @@ stat_exit (void)
                  " ,(\"mutator_cpu_seconds\", \"%.3f\")\n"
                  " ,(\"mutator_wall_seconds\", \"%.3f\")\n"
                  " ,(\"GC_cpu_seconds\", \"%.3f\")\n"
-                 " ,(\"GC_wall_seconds\", \"%.3f\")\n"
-                 " ]\n";
+                 " ,(\"GC_wall_seconds\", \"%.3f\")\n";
       }
       else {
           fmt1 = "<<ghc: %llu bytes, ";
@@ -784,6 +1470,29 @@ stat_exit (void)
                     TimeToSecondsDbl(init_cpu), TimeToSecondsDbl(init_elapsed),
                     TimeToSecondsDbl(mut_cpu), TimeToSecondsDbl(mut_elapsed),
                     TimeToSecondsDbl(gc_cpu), TimeToSecondsDbl(gc_elapsed));
+          if (RtsFlags.MiscFlags.machineReadable) {
+              GCPauseStats ps;
+              pauseStats(-1, &ps);
+              statsPrintf(" ,(\"GC_pauses\", \"%" FMT_Word64 "\")\n"
+                          " ,(\"GC_pause_p50_us\", \"%" FMT_Word64 "\")\n"
+                          " ,(\"GC_pause_p99_us\", \"%" FMT_Word64 "\")\n"
+                          " ,(\"GC_pause_max_us\", \"%" FMT_Word64 "\")\n"
+                          " ,(\"max_bytes_slop\", \"%" FMT_Word64 "\")\n"
+                          " ,(\"max_mem_in_use_bytes\", \"%" FMT_Word64 "\")\n"
+                          " ,(\"max_mut_list_entries\", \"%" FMT_Word64 "\")\n"
+                          " ,(\"mut_list_entries\", \"%" FMT_Word64 "\")\n"
+                          " ,(\"mut_list_dups\", \"%" FMT_Word64 "\")\n"
+                          " ]\n",
+                          ps.pauses,
+                          (StgWord64)(ps.p50_seconds * 1e6 + 0.5),
+                          (StgWord64)(ps.p99_seconds * 1e6 + 0.5),
+                          (StgWord64)(ps.max_seconds * 1e6 + 0.5),
+                          max_slop * (StgWord64)sizeof(W_),
+                          (StgWord64)peak_mblocks_allocated * MBLOCK_SIZE,
+                          (StgWord64)max_mut_list_entries,
+                          GC_tot_mut_list_entries,
+                          GC_tot_mut_list_dups);
+          }
         }
 
         statsFlush();
@@ -802,6 +1511,14 @@ stat_exit (void)
       stgFree(GC_coll_max_pause);
       GC_coll_max_pause = NULL;
     }
+    if (GC_coll_last_pause) {
+      stgFree(GC_coll_last_pause);
+      GC_coll_last_pause = NULL;
+    }
+    if (GC_pause_hist) {
+      stgFree(GC_pause_hist);
+      GC_pause_hist = NULL;
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -812,7 +1529,7 @@ stat_exit (void)
 void
 statDescribeGens(void)
 {
-  nat g, mut, lge, i;
+  nat g, mut, lge, i, c;
   W_ gen_slop;
   W_ tot_live, tot_slop;
   W_ gen_live, gen_blocks;
@@ -842,11 +1559,13 @@ statDescribeGens(void)
       for (i = 0; i < n_capabilities; i++) {
           mut += countOccupied(capabilities[i]->mut_lists[g]);
 
-          // Add the pinned object block.
-          bd = capabilities[i]->pinned_object_block;
-          if (bd != NULL) {
-              gen_live   += bd->free - bd->start;
-              gen_blocks += bd->blocks;
+          // Add the pinned object blocks.
+          for (c = 0; c < N_PINNED_CLASSES; c++) {
+              bd = capabilities[i]->pinned_object_block[c];
+              if (bd != NULL) {
+                  gen_live   += bd->free - bd->start;
+                  gen_blocks += bd->blocks;
+              }
           }
 
           gen_live   += gcThreadLiveWords(i,g);
@@ -888,6 +1607,9 @@ extern void getGCStats( GCStats *s )
 {
     nat total_collections = 0;
     nat g;
+    W_ pinned_blocks = 0, pinned_live = 0;
+    W_ free_blocks, free_mblocks;
+    W_ histogram[MBLOCK_FREE_HISTOGRAM_SIZE];
     Time gc_cpu = 0;
     Time gc_elapsed = 0;
     Time current_elapsed = 0;
@@ -902,6 +1624,8 @@ extern void getGCStats( GCStats *s )
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         gc_cpu     += GC_coll_cpu[g];
         gc_elapsed += GC_coll_elapsed[g];
+        pinned_blocks += generations[g].n_pinned_blocks;
+        pinned_live   += generations[g].n_pinned_live_words;
     }
 
     s->bytes_allocated = GC_tot_alloc*(StgWord64)sizeof(W_);
@@ -927,7 +1651,45 @@ extern void getGCStats( GCStats *s )
     s->wall_seconds = TimeToSecondsDbl(current_elapsed - end_init_elapsed);
     s->par_tot_bytes_copied = GC_par_tot_copied*(StgWord64)sizeof(W_);
     s->par_max_bytes_copied = GC_par_max_copied*(StgWord64)sizeof(W_);
+    s->pinned_bytes = pinned_blocks*(StgWord64)BLOCK_SIZE;
+    s->pinned_live_bytes = pinned_live*(StgWord64)sizeof(W_);
+    s->gc_roots_wall_seconds      = TimeToSecondsDbl(GC_phase_tot[GC_PHASE_ROOTS]);
+    s->gc_scav_wall_seconds       = TimeToSecondsDbl(GC_phase_tot[GC_PHASE_SCAV]);
+    s->gc_weak_wall_seconds       = TimeToSecondsDbl(GC_phase_tot[GC_PHASE_WEAK]);
+    s->gc_sweep_wall_seconds      = TimeToSecondsDbl(GC_phase_tot[GC_PHASE_SWEEP]);
+    s->gc_nursery_wall_seconds    = TimeToSecondsDbl(GC_phase_tot[GC_PHASE_NURSERY]);
+    s->gc_return_mem_wall_seconds = TimeToSecondsDbl(GC_phase_tot[GC_PHASE_RETURN_MEM]);
+
+    ACQUIRE_SM_LOCK;
+    fragmentationStats(&free_blocks, &free_mblocks, histogram);
+    RELEASE_SM_LOCK;
+    s->free_block_bytes = free_blocks*(StgWord64)BLOCK_SIZE;
+    s->free_mblock_bytes = free_mblocks*(StgWord64)MBLOCK_SIZE;
+    for (g = 0; g < MBLOCK_FREE_HISTOGRAM_SIZE; g++) {
+        s->mblock_free_histogram[g] = histogram[g];
+    }
 }
+extern void getGCStatsExt( GCStatsExt *s )
+{
+    nat i;
+
+    pauseStats(-1, &s->all);
+    pauseStats(RtsFlags.GcFlags.generations - 1, &s->major);
+    for (i = 0; i < GC_MMU_WINDOWS; i++) {
+        s->mmu_window_seconds[i] = (StgDouble)mmu_window_ms[i] / 1000;
+        s->mmu[i] = mmu_min[i];
+    }
+}
+
+extern void getGCPauseStats( nat gen, GCPauseStats *s )
+{
+    if (gen >= RtsFlags.GcFlags.generations) {
+        memset(s, 0, sizeof(GCPauseStats));
+        return;
+    }
+    pauseStats(gen, s);
+}
+
 // extern void getTaskStats( TaskStats **s ) {}
 #if 0
 extern void getSparkStats( SparkCounters *s ) {
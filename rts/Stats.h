@@ -25,6 +25,7 @@
 struct gc_thread_;
 
 void      stat_startInit(void);
+void      stat_initPhase(const char *name);
 void      stat_endInit(void);
 
 void      stat_startGC(Capability *cap, struct gc_thread_ *_gct);
@@ -32,6 +33,30 @@ void      stat_endGC  (Capability *cap, struct gc_thread_ *_gct,
                        W_ live, W_ copied, W_ slop, nat gen,
                        nat n_gc_threads, W_ par_max_copied, W_ par_tot_copied);
 
+Time      stat_lastGCPause(nat gen);
+void      stat_endSync(Capability *cap, Time sync, nat last_cap,
+                       StgWord64 last_thread);
+Time      stat_totalGCCpu(void);
+
+void      stat_startWeak(void);
+void      stat_endWeak(nat rounds);
+
+/* The parts of GarbageCollect() that we time separately (elapsed time,
+   on the thread leading the GC); keep gc_phase_names in Stats.c and
+   the EVENT_GC_PHASES payload in the same order. */
+typedef enum {
+    GC_PHASE_ROOTS,         // marking the roots
+    GC_PHASE_SCAV,          // scavenging
+    GC_PHASE_WEAK,          // weak pointer processing (and its scavenging)
+    GC_PHASE_SWEEP,         // sweeping or compacting the oldest generation
+    GC_PHASE_NURSERY,       // resizing and resetting the nurseries
+    GC_PHASE_RETURN_MEM,    // giving memory back to the OS
+    N_GC_PHASES
+} GcPhase;
+
+void      stat_startGCPhase(void);
+void      stat_endGCPhase(GcPhase phase);
+
 #ifdef PROFILING
 void      stat_startRP(void);
 void      stat_endRP(nat, 
@@ -67,6 +92,7 @@ void      statDescribeGens( void );
 
 Time stat_getElapsedGCTime(void);
 Time stat_getElapsedTime(void);
+Time stat_getElapsedTimestamp(void);
 
 /* Only exported for Papi.c */
 void statsPrintf( char *s, ... ) 
@@ -130,6 +130,7 @@ allocTask (void)
         task->id = osThreadId();
 #endif
         setMyTask(task);
+        perfCountersStartTask(task);
         return task;
     }
 }
@@ -195,6 +196,10 @@ freeTask (Task *task)
         stgFree(incall);
     }
 
+    perfCountersFreeTask(task);
+#if defined(DEBUG)
+    releaseTraceBuf(task);
+#endif
     stgFree(task);
 }
 
@@ -202,6 +207,7 @@ static Task*
 newTask (rtsBool worker)
 {
     Task *task;
+    nat i;
 
 #define ROUND_TO_CACHE_LINE(x) ((((x)+63) / 64) * 64)
     task = stgMallocBytes(ROUND_TO_CACHE_LINE(sizeof(Task)), "newTask");
@@ -214,10 +220,19 @@ newTask (rtsBool worker)
     task->spare_incalls = NULL;
     task->incall        = NULL;
 
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+        task->perf_fds[i] = -1;
+        task->perf_last[i] = 0;
+    }
+#if defined(DEBUG)
+    task->trace_buf = NULL;
+#endif
+
 #if defined(THREADED_RTS)
     initCondition(&task->cond);
     initMutex(&task->lock);
     task->wakeup = rtsFalse;
+    task->handoff_time = 0;
 #endif
 
     task->next = NULL;
@@ -311,6 +326,20 @@ newBoundTask (void)
     return task;
 }
 
+Task *
+getMyTask (void)
+{
+    Task *task;
+
+    task = myTask();
+    if (task == NULL) {
+        task = allocTask();
+        // not in a call, so freeMyTask() may free it
+        task->stopped = rtsTrue;
+    }
+    return task;
+}
+
 void
 boundTaskExiting (Task *task)
 {
@@ -416,18 +445,26 @@ static void OSThreadProcAttr
 workerStart(Task *task)
 {
     Capability *cap;
+    int cpu;
 
     // See startWorkerTask().
     ACQUIRE_LOCK(&task->lock);
     cap = task->cap;
     RELEASE_LOCK(&task->lock);
 
-    if (RtsFlags.ParFlags.setAffinity) {
+    cpu = capPoolCpu(cap);
+    if (cpu >= 0) {
+        setThreadAffinity(cpu, getNumberOfProcessors());
+    } else if (RtsFlags.ParFlags.setAffinity) {
         setThreadAffinity(cap->no, n_capabilities);
     }
+    if (RtsFlags.GcFlags.numa) {
+        setThreadNode(numa_map[cap->node]);
+    }
 
     // set the thread-local pointer to the Task:
     setMyTask(task);
+    perfCountersStartTask(task);
 
     newInCall(task);
 
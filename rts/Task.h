@@ -13,6 +13,7 @@
 #define TASK_H
 
 #include "GetTime.h"
+#include "PerfCounters.h"
 
 #include "BeginPrivate.h"
 
@@ -123,6 +124,11 @@ typedef struct Task_ {
     // that signalling a condition variable doesn't do anything if the
     // thread is already running, but we want it to be sticky.
     rtsBool wakeup;
+
+    // When the Capability was last handed to this (bound) Task, for the
+    // handoff figures in +RTS -s.  See Note [bound thread handoff] in
+    // Capability.c.
+    Time handoff_time;
 #endif
 
     // This points to the Capability that the Task "belongs" to.  If
@@ -159,6 +165,17 @@ typedef struct Task_ {
     struct Task_ *all_next;
     struct Task_ *all_prev;
 
+    // The hardware counters of this Task's OS thread, and what they
+    // read when last charged (see PerfCounters.c); -1 if not open
+    int       perf_fds[PERF_N_COUNTERS];
+    StgWord64 perf_last[PERF_N_COUNTERS];
+
+#if defined(DEBUG)
+    // Where this Task's OS thread buffers its -D/-v output, with
+    // --debug-trace-buffer (see Note [Buffered debug tracing] in Trace.c)
+    struct TraceBuf_ *trace_buf;
+#endif
+
 } Task;
 
 INLINE_HEADER rtsBool
@@ -189,6 +206,13 @@ nat  freeTaskManager (void);
 //
 Task *newBoundTask (void);
 
+// The Task of the calling OS thread, which gets one if it has none.
+// Unlike newBoundTask(), this doesn't start a call into Haskell: the
+// Task is only good for claiming a Capability for a moment (see
+// wakeupCapability()).
+//
+Task *getMyTask (void);
+
 // The current task is a bound task that is exiting.
 //
 void boundTaskExiting (Task *task);
@@ -243,13 +267,18 @@ extern nat peakWorkerCount;
 // INLINE functions... private from here on down:
 
 // A thread-local-storage key that we can use to get access to the
-// current thread's Task structure.
+// current thread's Task structure.  We use __thread wherever the C
+// compiler supports it (see CC_SUPPORTS_TLS in configure.ac), since
+// pthread_getspecific() is a call into libpthread every time.
 #if defined(THREADED_RTS)
-#if ((defined(linux_HOST_OS) && \
-     (defined(i386_HOST_ARCH) || defined(x86_64_HOST_ARCH))) || \
-    (defined(mingw32_HOST_OS) && __GNUC__ >= 4 && __GNUC_MINOR__ >= 4)) && \
-    (!defined(llvm_CC_FLAVOR))
+#if ((CC_SUPPORTS_TLS == 1) && !defined(mingw32_HOST_OS)) || \
+    (defined(mingw32_HOST_OS) && __GNUC__ >= 4 && __GNUC_MINOR__ >= 4 && \
+     !defined(llvm_CC_FLAVOR))
 #define MYTASK_USE_TLV
+// my_task keeps the default TLS model.  In the shared RTS that is
+// global-dynamic, a call to __tls_get_addr(), but libHSrts.so can be
+// dlopen()ed along with a Haskell library, and then an initial-exec
+// variable may not fit in the static TLS block.
 extern __thread Task *my_task;
 #else
 extern ThreadLocalKey currentTaskKey;
@@ -264,6 +293,11 @@ extern Task *my_task;
 // Tasks, because it has re-entered the RTS, then the task->prev_stack
 // field is used to store the previous Task.
 //
+// Without MYTASK_USE_TLV this is a pthread_getspecific() call, so code
+// that owns a Capability should use cap->running_task instead, and the
+// Task making a safe foreign call is handed from suspendThread() to
+// resumeThread() rather than looked up again.
+//
 INLINE_HEADER Task *
 myTask (void)
 {
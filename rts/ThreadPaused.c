@@ -196,7 +196,8 @@ threadPaused(Capability *cap, StgTSO *tso)
     const StgInfoTable *bh_info;
     const StgInfoTable *cur_bh_info USED_IF_THREADS;
     StgClosure *bh;
-    StgPtr stack_end;
+    StgPtr stack_end, squeeze_bottom = NULL;
+    nat frames           = 0;
     nat words_to_squeeze = 0;
     nat weight           = 0;
     nat weight_pending   = 0;
@@ -215,12 +216,15 @@ threadPaused(Capability *cap, StgTSO *tso)
     // blackholing, or eager blackholing consistently.  See Note
     // [upd-black-hole] in sm/Scav.c.
 
+    cap->pauses++;
+
     stack_end = tso->stackobj->stack + tso->stackobj->stack_size;
 
     frame = (StgClosure *)tso->stackobj->sp;
 
     while ((P_)frame < stack_end) {
         info = get_ret_itbl(frame);
+        frames++;
 
         switch (info->i.type) {
 
@@ -232,6 +236,7 @@ threadPaused(Capability *cap, StgTSO *tso)
                     words_to_squeeze += sizeofW(StgUpdateFrame);
                     weight += weight_pending;
                     weight_pending = 0;
+                    squeeze_bottom = (StgPtr)frame;
                 }
                 goto end;
             }
@@ -300,6 +305,12 @@ threadPaused(Capability *cap, StgTSO *tso)
                 // yet more computation to suspend.
                 frame = (StgClosure *)(tso->stackobj->sp + 2);
                 prev_was_update_frame = rtsFalse;
+
+                // what we had found to squeeze has gone with it
+                words_to_squeeze = 0;
+                weight = 0;
+                weight_pending = 0;
+                squeeze_bottom = NULL;
                 continue;
             }
 
@@ -340,6 +351,7 @@ threadPaused(Capability *cap, StgTSO *tso)
                 words_to_squeeze += sizeofW(StgUpdateFrame);
                 weight += weight_pending;
                 weight_pending = 0;
+                squeeze_bottom = (StgPtr)frame - sizeofW(StgUpdateFrame);
             }
             prev_was_update_frame = rtsTrue;
             break;
@@ -372,13 +384,31 @@ end:
         words_to_squeeze, weight,
         heuristic_says_squeeze ? "YES" : "NO");
 
+    cap->pause_frames += frames;
+
     if (RtsFlags.GcFlags.squeezeUpdFrames == rtsTrue &&
         heuristic_says_squeeze) {
-        stackSqueeze(cap, tso, (StgPtr)frame);
+        StgPtr sp = tso->stackobj->sp;
+        // Only the stack down to the last pair of adjacent update
+        // frames needs to be walked again, not all that we scanned.
+        stackSqueeze(cap, tso, squeeze_bottom);
+        cap->pause_words_squeezed += tso->stackobj->sp - sp;
         tso->flags |= TSO_SQUEEZED;
         // This flag tells threadStackOverflow() that the stack was
         // squeezed, because it may not need to be expanded.
     } else {
         tso->flags &= ~TSO_SQUEEZED;
     }
+
+    // If the scan was long, split the stack where the next one should
+    // stop (see "Splitting the stack" in Threads.c).  The frames left
+    // in the old chunk have all been scanned: their update frames are
+    // marked.  Squeezing didn't move the frame the scan ended at.
+    if (RtsFlags.GcFlags.stkPauseSplitSize > 0 &&
+        (W_)((StgPtr)frame - tso->stackobj->sp) >
+            stg_max(RtsFlags.GcFlags.stkPauseSplitSize,
+                    RtsFlags.GcFlags.stkChunkBufferSize) &&
+        threadStackSplit(cap, tso)) {
+        cap->pause_splits++;
+    }
 }
@@ -23,13 +23,14 @@
 #include "Printer.h"
 #include "sm/Sanity.h"
 #include "sm/Storage.h"
+#include "sm/Accounting.h"
 
 #include <string.h>
 
-/* Next thread ID to allocate.
- * LOCK: sched_mutex
+/* Next thread ID to allocate (a StgWord, so that we can take one with
+ * atomic_inc()).
  */
-static StgThreadID next_thread_id = 1;
+static volatile StgWord next_thread_id = 1;
 
 /* The smallest stack size that makes any sense is:
  *    RESERVED_STACK_WORDS    (so we can get back from the stack overflow)
@@ -80,12 +81,26 @@ createThread(Capability *cap, W_ size)
      * of a benchmark hack, but it doesn't do any harm.
      */
     stack_size = round_to_mblocks(size - sizeofW(StgTSO));
-    stack = (StgStack *)allocate(cap, stack_size);
-    TICK_ALLOC_STACK(stack_size);
-    SET_HDR(stack, &stg_STACK_info, cap->r.rCCCS);
-    stack->stack_size   = stack_size - sizeofW(StgStack);
-    stack->sp           = stack->stack + stack->stack_size;
-    stack->dirty        = 1;
+    cap->threads_created++;
+    if (cap->n_free_thread_stacks > 0 &&
+        cap->free_thread_stacks[cap->n_free_thread_stacks-1]->stack_size
+            == stack_size - sizeofW(StgStack)) {
+        // a recycled stack, see "Recycling thread stacks" below
+        stack = cap->free_thread_stacks[--cap->n_free_thread_stacks];
+        cap->thread_stack_hits++;
+        SET_HDR(stack, &stg_STACK_info, cap->r.rCCCS);
+        ASSERT(stack->sp == stack->stack + stack->stack_size);
+        // it may be in an old generation
+        stack->dirty = 0;
+        dirty_STACK(cap, stack);
+    } else {
+        stack = (StgStack *)allocate(cap, stack_size);
+        TICK_ALLOC_STACK(stack_size);
+        SET_HDR(stack, &stg_STACK_info, cap->r.rCCCS);
+        stack->stack_size   = stack_size - sizeofW(StgStack);
+        stack->sp           = stack->stack + stack->stack_size;
+        stack->dirty        = 1;
+    }
 
     tso = (StgTSO *)allocate(cap, sizeofW(StgTSO));
     TICK_ALLOC_TSO();
@@ -107,8 +122,15 @@ createThread(Capability *cap, W_ size)
 
     tso->stackobj       = stack;
     tso->tot_stack_size = stack->stack_size;
+    tso->stm_aborts     = 0;
+    tso->pretenure_gen  = 0;
+    tso->priority       = 0;
+    tso->acct_group     = 0;
 
     ASSIGN_Int64((W_*)&(tso->alloc_limit), 0);
+    ASSIGN_Word64((W_*)&(tso->cpu_time), 0);
+    ASSIGN_Word64((W_*)&(tso->allocated), 0);
+    ASSIGN_Word64((W_*)&(tso->blackhole_since), 0);
 
     tso->trec = NO_TREC;
 
@@ -121,13 +143,15 @@ createThread(Capability *cap, W_ size)
     SET_HDR((StgClosure*)stack->sp,
             (StgInfoTable *)&stg_stop_thread_info,CCS_SYSTEM);
 
-    /* Link the new thread on the global thread list.
+    /* Link the new thread on this Capability's list of new threads;
+     * the next GC moves it to g0->threads (see collectFreshThreads()).
      */
-    ACQUIRE_LOCK(&sched_mutex);
-    tso->id = next_thread_id++;  // while we have the mutex
-    tso->global_link = g0->threads;
-    g0->threads = tso;
-    RELEASE_LOCK(&sched_mutex);
+    tso->id = (StgThreadID)(atomic_inc(&next_thread_id, 1) - 1);
+    tso->global_link = cap->new_threads_hd;
+    cap->new_threads_hd = tso;
+    if (cap->new_threads_tl == END_TSO_QUEUE) {
+        cap->new_threads_tl = tso;
+    }
 
     // ToDo: report the stack size in the event?
     traceEventCreateThread(cap, tso);
@@ -135,6 +159,89 @@ createThread(Capability *cap, W_ size)
     return tso;
 }
 
+/* ---------------------------------------------------------------------------
+   Move the threads created since the last GC to g0->threads.  Called at
+   the start of GC, and by anything else that walks the thread lists.
+
+   Locks: assumes we hold *all* the capabilities.
+   ------------------------------------------------------------------------ */
+
+void
+collectFreshThreads (void)
+{
+    nat i;
+    Capability *cap;
+
+    for (i = 0; i < n_capabilities; i++) {
+        cap = capabilities[i];
+        if (cap->new_threads_tl != END_TSO_QUEUE) {
+            cap->new_threads_tl->global_link = g0->threads;
+            g0->threads = cap->new_threads_hd;
+            cap->new_threads_hd = END_TSO_QUEUE;
+            cap->new_threads_tl = END_TSO_QUEUE;
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------
+   Recycling thread stacks
+
+   Every thread starts with a stack of the same size (+RTS -ki), and a
+   program that forks a thread per request drops one for the GC at the
+   same rate.  When an unbound thread finishes with only its first
+   stack chunk, releaseThreadStack() gives the chunk to the Capability,
+   which keeps up to N_FREE_THREAD_STACKS of them for createThread().
+
+   The TSO itself is not recycled: its ThreadId may still be held, and
+   the TSO is the thread's identity.  It must still point to a valid
+   stack (the GC, the sanity checker and the heap profilers look at
+   it), so it gets the Capability's finished_stack instead, an empty
+   stack that all the finished threads on the Capability share and
+   nothing writes to.
+
+   Like the free stack chunks (see "Free stack chunks" below),
+   everything here is dropped at GC (markCapability()).
+   ------------------------------------------------------------------------ */
+
+void
+releaseThreadStack (Capability *cap, StgTSO *tso)
+{
+    StgStack *stack, *finished;
+
+    stack = tso->stackobj;
+
+    // only the first chunk of the usual size is any use to createThread()
+    if (tso->bound != NULL
+        || tso->tot_stack_size != stack->stack_size
+        || stack->stack_size + sizeofW(StgStack) !=
+               round_to_mblocks(RtsFlags.GcFlags.initialStkSize
+                                - sizeofW(StgTSO))
+        || cap->n_free_thread_stacks == N_FREE_THREAD_STACKS) {
+        return;
+    }
+
+    finished = cap->finished_stack;
+    if (finished == NULL) {
+        finished = (StgStack *)allocate(cap, sizeofW(StgStack) +
+                                             sizeofW(StgStopFrame));
+        SET_HDR(finished, &stg_STACK_info, CCS_SYSTEM);
+        finished->stack_size = sizeofW(StgStopFrame);
+        finished->sp = finished->stack;
+        finished->dirty = 0;
+        SET_HDR((StgClosure*)finished->sp,
+                (StgInfoTable *)&stg_stop_thread_info,CCS_SYSTEM);
+        cap->finished_stack = finished;
+    }
+
+    tso->stackobj = finished;
+    tso->tot_stack_size = finished->stack_size;
+
+    // empty it, as threadStackUnderflow() does: the GC may still see it
+    // on a mutable list
+    stack->sp = stack->stack + stack->stack_size;
+    cap->free_thread_stacks[cap->n_free_thread_stacks++] = stack;
+}
+
 /* ---------------------------------------------------------------------------
  * Comparing Thread ids.
  *
@@ -179,6 +286,135 @@ void rts_setThreadAllocationCounter(StgPtr tso, HsInt64 i)
     ASSIGN_Int64((W_*)&(((StgTSO *)tso)->alloc_limit), i);
 }
 
+/* ---------------------------------------------------------------------------
+ * CPU time and allocation of a thread, see schedule()
+ * ------------------------------------------------------------------------ */
+HsWord64 rts_getThreadCPUTime(StgPtr tso)
+{
+    return PK_Word64((W_*)&(((StgTSO *)tso)->cpu_time));
+}
+
+HsWord64 rts_getThreadAllocated(StgPtr tso)
+{
+    return PK_Word64((W_*)&(((StgTSO *)tso)->allocated));
+}
+
+/* ---------------------------------------------------------------------------
+ * Pretenuring the objects a thread allocates (see Note [Pretenuring]
+ * in sm/Storage.c)
+ * ------------------------------------------------------------------------ */
+HsInt rts_getThreadPretenuring(StgPtr tso)
+{
+    return ((StgTSO *)tso)->pretenure_gen;
+}
+
+void rts_setThreadPretenuring(StgPtr tso, HsInt gen)
+{
+    StgTSO *t = (StgTSO *)tso;
+    Capability *cap;
+
+    if (gen < 0) {
+        gen = 0;
+    } else if (gen >= (HsInt)RtsFlags.GcFlags.generations) {
+        gen = RtsFlags.GcFlags.generations - 1;
+    }
+    t->pretenure_gen = gen;
+
+    // if the thread is running, start with the blocks it is
+    // allocating into now
+    cap = t->cap;
+    if (cap->r.rCurrentTSO == t) {
+        cap->pretenure_gen = gen;
+        cap->r.rCurrentNursery->dest_no = gen;
+        if (cap->r.rCurrentAlloc != NULL) {
+            cap->r.rCurrentAlloc->dest_no = gen;
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------
+ * Thread priorities (see Note [Thread priorities] in Schedule.c)
+ * ------------------------------------------------------------------------ */
+HsInt rts_getThreadPriority(StgPtr tso)
+{
+    return ((StgTSO *)tso)->priority;
+}
+
+void rts_setThreadPriority(StgPtr tso, HsInt priority)
+{
+    if (priority < 0) {
+        priority = 0;
+    } else if (priority > MAX_THREAD_PRIORITY) {
+        priority = MAX_THREAD_PRIORITY;
+    }
+    setThreadPriority(rts_unsafeGetMyCapability(), (StgTSO *)tso, priority);
+}
+
+/* ----------------------------------------------------------------------------
+   setThreadPriority()
+
+   Give a thread a new priority.  A thread that is on the run queue
+   moves to the end of the threads of its new priority, to keep the
+   queue in order; the run queue, and so the priority, of a thread on
+   another Capability can only be changed by that Capability, so it is
+   sent a MSG_SET_PRIORITY.
+   ------------------------------------------------------------------------- */
+
+void
+setThreadPriority (Capability *cap, StgTSO *tso, StgWord priority)
+{
+    StgTSO *t;
+
+#ifdef THREADED_RTS
+    if (tso->cap != cap)
+    {
+        MessageSetPriority *msg;
+        msg = (MessageSetPriority *)allocate(cap,sizeofW(MessageSetPriority));
+        SET_HDR(msg, &stg_MSG_SET_PRIORITY_info, CCS_SYSTEM);
+        msg->tso = tso;
+        msg->priority = priority;
+        sendMessage(cap, tso->cap, (Message*)msg);
+        debugTraceCap(DEBUG_sched, cap, "message: set priority of thread %ld on cap %d",
+                      (W_)tso->id, tso->cap->no);
+        return;
+    }
+#endif
+
+    if (tso->priority == priority) {
+        return;
+    }
+
+    if (tso->why_blocked == NotBlocked) {
+        for (t = cap->run_queue_hd; t != END_TSO_QUEUE; t = t->_link) {
+            if (t == tso) {
+                removeFromRunQueue(cap, tso);
+                tso->priority = priority;
+                appendToRunQueue(cap, tso);
+                return;
+            }
+        }
+    }
+
+    tso->priority = priority;
+}
+
+/* ---------------------------------------------------------------------------
+ * Accounting groups (see Note [Accounting groups] in sm/Accounting.c)
+ * ------------------------------------------------------------------------ */
+HsInt rts_getThreadAccountingGroup(StgPtr tso)
+{
+    return ((StgTSO *)tso)->acct_group;
+}
+
+void rts_setThreadAccountingGroup(StgPtr tso, HsInt group)
+{
+    if (group < 0 || group >= MAX_ACCOUNTING_GROUPS) {
+        barf("rts_setThreadAccountingGroup: no group %" FMT_Int, group);
+    }
+    ((StgTSO *)tso)->acct_group = group;
+    if (group != 0) acct_groups_used = rtsTrue;
+}
+
 void rts_enableThreadAllocationLimit(StgPtr tso)
 {
     ((StgTSO *)tso)->flags |= TSO_ALLOC_LIMIT;
@@ -283,6 +519,8 @@ tryWakeupThread (Capability *cap, StgTSO *tso)
     case BlockedOnMVarRead:
     {
         if (tso->_link == END_TSO_QUEUE) {
+            dtraceMVarWakeup((EventCapNo)cap->no, (EventThreadID)tso->id,
+                             (StgWord)tso->block_info.closure);
             tso->block_info.closure = (StgClosure*)END_TSO_QUEUE;
             goto unblock;
         } else {
@@ -309,6 +547,9 @@ tryWakeupThread (Capability *cap, StgTSO *tso)
     }
 
     case BlockedOnBlackHole:
+        traceEventBlackHoleWait(cap, tso);
+        goto unblock;
+
     case BlockedOnSTM:
     case ThreadMigrating:
         goto unblock;
@@ -357,26 +598,84 @@ migrateThread (Capability *from, StgTSO *tso, Capability *to)
    awakenBlockedQueue
 
    wakes up all the threads on the specified queue.
+
+   The threads on other Capabilities are not sent a MSG_TRY_WAKEUP
+   each: the MSG_BLACKHOLE they blocked with is sent back to their
+   Capability instead, where messageBlackHole() finds the black hole
+   updated and wakes the thread up.  That needs no allocation, and the
+   messages for each Capability go in one batch, with one cas() on its
+   inbox and at most one wakeup, however many threads were waiting.
    ------------------------------------------------------------------------- */
 
+#ifdef THREADED_RTS
+static void
+wakeRemoteBlackHoleWaiters (Capability *cap, MessageBlackHole *remote)
+{
+    MessageBlackHole *msg, *next, *rest, *first, *last;
+    Capability *to;
+
+    while (remote != (MessageBlackHole*)END_TSO_QUEUE) {
+        // take out the messages for the Capability of the first one
+        to = remote->tso->cap;
+        first = last = remote;
+        rest = (MessageBlackHole*)END_TSO_QUEUE;
+        for (msg = remote->link; msg != (MessageBlackHole*)END_TSO_QUEUE;
+             msg = next) {
+            next = msg->link;
+            if (msg->tso->cap == to) {
+                last->link = msg;
+                last = msg;
+            } else {
+                msg->link = rest;
+                rest = msg;
+            }
+        }
+        sendMessages(cap, to, (Message*)first, (Message*)last);
+        cap->bh_wakeup_batches++;
+        debugTraceCap(DEBUG_sched, cap, "message: woke up black hole "
+                      "waiters on cap %d", to->no);
+        remote = rest;
+    }
+}
+#endif
+
 void
 wakeBlockingQueue(Capability *cap, StgBlockingQueue *bq)
 {
-    MessageBlackHole *msg;
+    MessageBlackHole *msg, *next;
+    MessageBlackHole *remote USED_IF_THREADS;
     const StgInfoTable *i;
 
     ASSERT(bq->header.info == &stg_BLOCKING_QUEUE_DIRTY_info  ||
            bq->header.info == &stg_BLOCKING_QUEUE_CLEAN_info  );
 
+    remote = (MessageBlackHole*)END_TSO_QUEUE;
+
     for (msg = bq->queue; msg != (MessageBlackHole*)END_TSO_QUEUE;
-         msg = msg->link) {
+         msg = next) {
+        next = msg->link;
         i = msg->header.info;
         if (i != &stg_IND_info) {
             ASSERT(i == &stg_MSG_BLACKHOLE_info);
+#ifdef THREADED_RTS
+            if (msg->tso->cap != cap) {
+                // the black hole has been updated, so this message
+                // can only wake the thread up now
+                traceEventThreadWakeup(cap, msg->tso, msg->tso->cap->no);
+                msg->link = remote;
+                remote = msg;
+                cap->bh_remote_wakeups++;
+                continue;
+            }
+#endif
             tryWakeupThread(cap,msg->tso);
         }
     }
 
+#ifdef THREADED_RTS
+    wakeRemoteBlackHoleWaiters(cap, remote);
+#endif
+
     // overwrite the BQ with an indirection so it will be
     // collected at the next GC.
 #if defined(DEBUG) && !defined(THREADED_RTS)
@@ -506,6 +805,110 @@ isThreadBound(StgTSO* tso USED_IF_THREADS)
   return rtsFalse;
 }
 
+/* -----------------------------------------------------------------------------
+   pushStackChunk
+
+   Give the thread a new stack chunk of chunk_size words (including the
+   StgStack header), and move the top of the old chunk into it: as many
+   frames as fit into the chunk buffer (+RTS -kb), followed by an
+   underflow frame pointing back to the old chunk.
+   -------------------------------------------------------------------------- */
+
+static void
+pushStackChunk (Capability *cap, StgTSO *tso, W_ chunk_size)
+{
+    StgStack *new_stack, *old_stack;
+    StgUnderflowFrame *frame;
+
+    old_stack = tso->stackobj;
+
+    debugTraceCap(DEBUG_sched, cap,
+                  "allocating new stack chunk of size %d bytes",
+                  chunk_size * sizeof(W_));
+
+    if (chunk_size == RtsFlags.GcFlags.stkChunkSize && cap->n_free_stacks > 0) {
+        new_stack = cap->free_stacks[--cap->n_free_stacks];
+        cap->stack_chunk_hits++;
+    } else {
+        new_stack = (StgStack*) allocate(cap, chunk_size);
+        TICK_ALLOC_STACK(chunk_size);
+    }
+    cap->stack_chunks++;
+    SET_HDR(new_stack, &stg_STACK_info, old_stack->header.prof.ccs);
+
+    new_stack->dirty = 0; // begin clean, we'll mark it dirty below
+    new_stack->stack_size = chunk_size - sizeofW(StgStack);
+    new_stack->sp = new_stack->stack + new_stack->stack_size;
+
+    tso->tot_stack_size += new_stack->stack_size;
+
+    {
+        StgWord *sp;
+        W_ chunk_words, size;
+
+        // find the boundary of the chunk of old stack we're going to
+        // copy to the new stack.  We skip over stack frames until we
+        // reach the smaller of
+        //
+        //   * the chunk buffer size (+RTS -kb)
+        //   * the end of the old stack
+        //
+        for (sp = old_stack->sp;
+             sp < stg_min(old_stack->sp + RtsFlags.GcFlags.stkChunkBufferSize,
+                          old_stack->stack + old_stack->stack_size); )
+        {
+            size = stack_frame_sizeW((StgClosure*)sp);
+
+            // if including this frame would exceed the size of the
+            // new stack (taking into account the underflow frame),
+            // then stop at the previous frame.
+            if (sp + size > old_stack->stack + (new_stack->stack_size -
+                                                sizeofW(StgUnderflowFrame))) {
+                break;
+            }
+            sp += size;
+        }
+
+        if (sp == old_stack->stack + old_stack->stack_size) {
+            //
+            // the old stack chunk is now empty, so we do *not* insert
+            // an underflow frame pointing back to it.  There are two
+            // cases: either the old stack chunk was the last one, in
+            // which case it ends with a STOP_FRAME, or it is not the
+            // last one, and it already ends with an UNDERFLOW_FRAME
+            // pointing to the previous chunk.  In the latter case, we
+            // will copy the UNDERFLOW_FRAME into the new stack chunk.
+            // In both cases, the old chunk will be subsequently GC'd.
+            //
+            // With the default settings, -ki1k -kb1k, this means the
+            // first stack chunk will be discarded after the first
+            // overflow, being replaced by a non-moving 32k chunk.
+            //
+        } else {
+            new_stack->sp -= sizeofW(StgUnderflowFrame);
+            frame = (StgUnderflowFrame*)new_stack->sp;
+            frame->info = &stg_stack_underflow_frame_info;
+            frame->next_chunk  = old_stack;
+        }
+
+        // copy the stack chunk between tso->sp and sp to
+        //   new_tso->sp + (tso->sp - sp)
+        chunk_words = sp - old_stack->sp;
+
+        memcpy(/* dest   */ new_stack->sp - chunk_words,
+               /* source */ old_stack->sp,
+               /* size   */ chunk_words * sizeof(W_));
+
+        old_stack->sp += chunk_words;
+        new_stack->sp -= chunk_words;
+    }
+
+    tso->stackobj = new_stack;
+
+    // we're about to run it, better mark it dirty
+    dirty_STACK(cap, new_stack);
+}
+
 /* -----------------------------------------------------------------------------
    Stack overflow
 
@@ -518,8 +921,7 @@ isThreadBound(StgTSO* tso USED_IF_THREADS)
 void
 threadStackOverflow (Capability *cap, StgTSO *tso)
 {
-    StgStack *new_stack, *old_stack;
-    StgUnderflowFrame *frame;
+    StgStack *old_stack;
     W_ chunk_size;
 
     IF_DEBUG(sanity,checkTSO(tso));
@@ -597,92 +999,87 @@ threadStackOverflow (Capability *cap, StgTSO *tso)
         chunk_size = RtsFlags.GcFlags.stkChunkSize;
     }
 
-    debugTraceCap(DEBUG_sched, cap,
-                  "allocating new stack chunk of size %d bytes",
-                  chunk_size * sizeof(W_));
-
-    new_stack = (StgStack*) allocate(cap, chunk_size);
-    SET_HDR(new_stack, &stg_STACK_info, old_stack->header.prof.ccs);
-    TICK_ALLOC_STACK(chunk_size);
-
-    new_stack->dirty = 0; // begin clean, we'll mark it dirty below
-    new_stack->stack_size = chunk_size - sizeofW(StgStack);
-    new_stack->sp = new_stack->stack + new_stack->stack_size;
-
-    tso->tot_stack_size += new_stack->stack_size;
-
-    {
-        StgWord *sp;
-        W_ chunk_words, size;
-
-        // find the boundary of the chunk of old stack we're going to
-        // copy to the new stack.  We skip over stack frames until we
-        // reach the smaller of
-        //
-        //   * the chunk buffer size (+RTS -kb)
-        //   * the end of the old stack
-        //
-        for (sp = old_stack->sp;
-             sp < stg_min(old_stack->sp + RtsFlags.GcFlags.stkChunkBufferSize,
-                          old_stack->stack + old_stack->stack_size); )
-        {
-            size = stack_frame_sizeW((StgClosure*)sp);
-
-            // if including this frame would exceed the size of the
-            // new stack (taking into account the underflow frame),
-            // then stop at the previous frame.
-            if (sp + size > old_stack->stack + (new_stack->stack_size -
-                                                sizeofW(StgUnderflowFrame))) {
-                break;
-            }
-            sp += size;
-        }
-
-        if (sp == old_stack->stack + old_stack->stack_size) {
-            //
-            // the old stack chunk is now empty, so we do *not* insert
-            // an underflow frame pointing back to it.  There are two
-            // cases: either the old stack chunk was the last one, in
-            // which case it ends with a STOP_FRAME, or it is not the
-            // last one, and it already ends with an UNDERFLOW_FRAME
-            // pointing to the previous chunk.  In the latter case, we
-            // will copy the UNDERFLOW_FRAME into the new stack chunk.
-            // In both cases, the old chunk will be subsequently GC'd.
-            //
-            // With the default settings, -ki1k -kb1k, this means the
-            // first stack chunk will be discarded after the first
-            // overflow, being replaced by a non-moving 32k chunk.
-            //
-        } else {
-            new_stack->sp -= sizeofW(StgUnderflowFrame);
-            frame = (StgUnderflowFrame*)new_stack->sp;
-            frame->info = &stg_stack_underflow_frame_info;
-            frame->next_chunk  = old_stack;
-        }
+    pushStackChunk(cap, tso, chunk_size);
 
-        // copy the stack chunk between tso->sp and sp to
-        //   new_tso->sp + (tso->sp - sp)
-        chunk_words = sp - old_stack->sp;
+    IF_DEBUG(sanity,checkTSO(tso));
+    // IF_DEBUG(scheduler,printTSO(new_tso));
+}
 
-        memcpy(/* dest   */ new_stack->sp - chunk_words,
-               /* source */ old_stack->sp,
-               /* size   */ chunk_words * sizeof(W_));
+/* -----------------------------------------------------------------------------
+   Splitting the stack
+
+   threadPaused() has to scan the stack down to the first update frame
+   that it has already marked, and a thread deep in a recursion that
+   pushes no update frames has none: every time the thread stops, the
+   whole chunk is scanned again.  When the scan was long, threadPaused()
+   calls threadStackSplit() to move the top of the stack into a chunk
+   of its own, so that the next scan ends at its underflow frame.
+
+   The GC has the same problem: a STACK is on the mutable list as soon
+   as the thread writes to it, and then the GC scavenges the whole
+   chunk, however little of it the thread has touched.  So when the
+   scheduler is about to run a thread whose stack chunk the last GC
+   found clean, and more than +RTS -kg of it is in use,
+   threadStackSplitClean() splits it first.  The frames left in the
+   old chunk don't change until the thread returns to them through the
+   underflow frame, which acts as a stack barrier: the old chunk stays
+   clean, and the next GC scavenges only the new one.  +RTS -s shows
+   how much stack the GC scanned.
+   -------------------------------------------------------------------------- */
 
-        old_stack->sp += chunk_words;
-        new_stack->sp -= chunk_words;
+rtsBool
+threadStackSplit (Capability *cap, StgTSO *tso)
+{
+    // don't bring the thread closer to its -K limit for this
+    if (RtsFlags.GcFlags.maxStkSize > 0
+        && tso->tot_stack_size + RtsFlags.GcFlags.stkChunkSize
+           >= RtsFlags.GcFlags.maxStkSize) {
+        return rtsFalse;
     }
 
-    tso->stackobj = new_stack;
-
-    // we're about to run it, better mark it dirty
-    dirty_STACK(cap, new_stack);
+    pushStackChunk(cap, tso, RtsFlags.GcFlags.stkChunkSize);
 
     IF_DEBUG(sanity,checkTSO(tso));
-    // IF_DEBUG(scheduler,printTSO(new_tso));
+    return rtsTrue;
+}
+
+void
+threadStackSplitClean (Capability *cap, StgTSO *tso)
+{
+    StgStack *stack = tso->stackobj;
+
+    // pushStackChunk() moves up to -kb of the stack, so a smaller one
+    // would be left with nothing in the old chunk
+    if (stack->dirty == 0 &&
+        RtsFlags.GcFlags.stkGcSplitSize > 0 &&
+        (W_)(stack->stack + stack->stack_size - stack->sp) >
+            stg_max(RtsFlags.GcFlags.stkGcSplitSize,
+                    RtsFlags.GcFlags.stkChunkBufferSize) &&
+        threadStackSplit(cap, tso)) {
+        cap->stack_gc_splits++;
+    }
 }
 
 
 
+/* ---------------------------------------------------------------------------
+   Free stack chunks
+
+   A thread that keeps crossing a chunk boundary (a deep recursion that
+   goes up and down) would allocate a new chunk at every overflow and
+   drop it for the GC at every underflow.  Instead, threadStackUnderflow()
+   gives each chunk of the default size (+RTS -kc) that it leaves
+   to the Capability, which keeps up to N_FREE_STACKS of them, and
+   threadStackOverflow() takes one from there when it can, whichever
+   thread on the Capability it is for.
+
+   A free chunk is empty (sp is at the end), so it does no harm that the
+   GC may still see it on a mutable list, and when it is reused
+   dirty_STACK() puts it back on one if it has to.  The cache is emptied
+   at each GC (markCapability()), so the GC never keeps chunks alive for
+   it.  +RTS -s shows how many chunks came from the cache.
+   ------------------------------------------------------------------------ */
+
 /* ---------------------------------------------------------------------------
    Stack underflow - called from the stg_stack_underflow_info frame
    ------------------------------------------------------------------------ */
@@ -728,6 +1125,13 @@ threadStackUnderflow (Capability *cap, StgTSO *tso)
     // restore the stack parameters, and update tot_stack_size
     tso->tot_stack_size -= old_stack->stack_size;
 
+    // keep the old chunk for the next overflow on this Capability
+    if (old_stack->stack_size + sizeofW(StgStack)
+            == RtsFlags.GcFlags.stkChunkSize
+        && cap->n_free_stacks < N_FREE_STACKS) {
+        cap->free_stacks[cap->n_free_stacks++] = old_stack;
+    }
+
     // we're about to run it, better mark it dirty
     dirty_STACK(cap, new_stack);
 
@@ -750,13 +1154,21 @@ printThreadBlockage(StgTSO *tso)
 #endif
 #if !defined(THREADED_RTS)
   case BlockedOnRead:
-    debugBelch("is blocked on read from fd %d", (int)(tso->block_info.fd));
+    if (tso->flags & TSO_ASYNC_IO) {
+        debugBelch("is blocked on asyncRead#");
+    } else {
+        debugBelch("is blocked on read from fd %d", (int)(tso->block_info.fd));
+    }
     break;
   case BlockedOnWrite:
-    debugBelch("is blocked on write to fd %d", (int)(tso->block_info.fd));
+    if (tso->flags & TSO_ASYNC_IO) {
+        debugBelch("is blocked on asyncWrite#");
+    } else {
+        debugBelch("is blocked on write to fd %d", (int)(tso->block_info.fd));
+    }
     break;
   case BlockedOnDelay:
-    debugBelch("is blocked until %ld", (long)(tso->block_info.target));
+    debugBelch("is blocked in threadDelay");
     break;
 #endif
   case BlockedOnMVar:
@@ -836,6 +1248,14 @@ printAllThreads(void)
   }
 
   debugBelch("other threads:\n");
+  for (i = 0; i < n_capabilities; i++) {
+    for (t = capabilities[i]->new_threads_hd; t != END_TSO_QUEUE; t = next) {
+      if (t->why_blocked != NotBlocked) {
+          printThreadStatus(t);
+      }
+      next = t->global_link;
+    }
+  }
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
     for (t = generations[g].threads; t != END_TSO_QUEUE; t = next) {
       if (t->why_blocked != NotBlocked) {
@@ -20,6 +20,7 @@ void checkBlockingQueues (Capability *cap, StgTSO *tso);
 void wakeBlockingQueue   (Capability *cap, StgBlockingQueue *bq);
 void tryWakeupThread     (Capability *cap, StgTSO *tso);
 void migrateThread       (Capability *from, StgTSO *tso, Capability *to);
+void setThreadPriority   (Capability *cap, StgTSO *tso, StgWord priority);
 
 // Wakes up a thread on a Capability (probably a different Capability
 // from the one held by the current Task).
@@ -38,8 +39,14 @@ rtsBool removeThreadFromDeQueue   (Capability *cap, StgTSO **head, StgTSO **tail
 
 StgBool isThreadBound (StgTSO* tso);
 
+// Thread lists and stacks (see "Recycling thread stacks" in Threads.c)
+void collectFreshThreads (void);
+void releaseThreadStack  (Capability *cap, StgTSO *tso);
+
 // Overfow/underflow
 void threadStackOverflow  (Capability *cap, StgTSO *tso);
+rtsBool threadStackSplit (Capability *cap, StgTSO *tso);
+void    threadStackSplitClean (Capability *cap, StgTSO *tso);
 W_   threadStackUnderflow (Capability *cap, StgTSO *tso);
 
 #ifdef DEBUG
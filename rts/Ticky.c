@@ -475,6 +475,8 @@ PrintTickyInfo(void)
   PR_CTR(SLOW_CALL_fast_pppp_ctr);
   PR_CTR(SLOW_CALL_fast_ppppp_ctr);
   PR_CTR(SLOW_CALL_fast_pppppp_ctr);
+  PR_CTR(SLOW_CALL_fast_ppppppp_ctr);
+  PR_CTR(SLOW_CALL_fast_pppppppp_ctr);
   PR_CTR(VERY_SLOW_CALL_ctr);
 
   PR_CTR(UNKNOWN_CALL_ctr);
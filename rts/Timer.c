@@ -24,6 +24,7 @@
 #include "Ticker.h"
 #include "Capability.h"
 #include "RtsSignals.h"
+#include "Trace.h"
 
 /* ticks left before next pre-emptive context switch */
 static int ticks_to_ctxt_switch = 0;
@@ -31,6 +32,11 @@ static int ticks_to_ctxt_switch = 0;
 /* idle ticks left before we perform a GC */
 static int ticks_to_gc = 0;
 
+#ifdef TRACING
+/* ticks left before we next sample the stacks (--sample-stacks) */
+static int ticks_to_stack_sample = 0;
+#endif
+
 /*
  * Function: handle_tick()
  *
@@ -42,6 +48,11 @@ void
 handle_tick(int unused STG_UNUSED)
 {
   handleProfTick();
+#if defined(THREADED_RTS)
+  if (RtsFlags.ParFlags.nCapPools > 0) {
+      contextSwitchCapPools(); /* each pool at its own interval */
+  } else
+#endif
   if (RtsFlags.ConcFlags.ctxtSwitchTicks > 0) {
       ticks_to_ctxt_switch--;
       if (ticks_to_ctxt_switch <= 0) {
@@ -50,6 +61,18 @@ handle_tick(int unused STG_UNUSED)
       }
   }
 
+#ifdef TRACING
+  traceToggleTick();
+
+  if (RtsFlags.TraceFlags.stack_sample_ticks > 0) {
+      ticks_to_stack_sample--;
+      if (ticks_to_stack_sample <= 0) {
+          ticks_to_stack_sample = RtsFlags.TraceFlags.stack_sample_ticks;
+          sampleAllCapabilities();
+      }
+  }
+#endif
+
   /*
    * If we've been inactive for idleGCDelayTime (set by +RTS
    * -I), tell the scheduler to wake up and do a GC, to check
@@ -70,7 +93,7 @@ handle_tick(int unused STG_UNUSED)
               // The scheduler will call stopTimer() when it has done
               // the GC.
 #endif
-          } else {
+          } else if (NO_THREAD_DEADLINES()) {
               recent_activity = ACTIVITY_DONE_GC;
               // disable timer signals (see #1623, #5991)
               // but only if we're not profiling
@@ -78,6 +101,8 @@ handle_tick(int unused STG_UNUSED)
               stopTimer();
 #endif
           }
+          // (while a thread has a deadline, the timer keeps going: see
+          // below)
       } else {
           ticks_to_gc--;
       }
@@ -85,6 +110,15 @@ handle_tick(int unused STG_UNUSED)
   default:
       break;
   }
+
+#if defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+  // A thread's deadline has passed (System.Timeout): make sure that a
+  // Capability runs the scheduler to raise it, even if the RTS is idle
+  // (see "Thread deadlines" in rts/posix/Select.c)
+  if (threadDeadlineDue()) {
+      wakeUpRts();
+  }
+#endif
 }
 
 // This global counter is used to allow multiple threads to stop the
@@ -20,10 +20,12 @@
 #include "eventlog/EventLog.h"
 #include "Threads.h"
 #include "Printer.h"
+#include "RtsUtils.h"
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#include <string.h>
 
 #ifdef DEBUG
 // debugging flags, set with +RTS -D<something>
@@ -58,6 +60,151 @@ static Mutex trace_utx;
 
 static rtsBool eventlog_enabled;
 
+#ifdef DEBUG
+typedef struct TraceBuf_ TraceBuf;
+static rtsBool trace_buffered = rtsFalse;
+static TraceBuf *trace_bufs = NULL;    // under trace_utx
+static void initTraceBufs (void);
+static void endTraceBufs (void);
+static void freeTraceBufs (void);
+static void resetTraceBufs (void);
+#endif
+
+/* ---------------------------------------------------------------------------
+   The classes of events, which can be changed as the program runs (see
+   rts_setEventLogClasses())
+ --------------------------------------------------------------------------- */
+
+static void updateTraceClasses (void)
+{
+    // -Ds turns on scheduler tracing too
+    TRACE_sched =
+        RtsFlags.TraceFlags.scheduler ||
+        RtsFlags.DebugFlags.scheduler;
+
+    // -Dg turns on gc tracing too
+    TRACE_gc =
+        RtsFlags.TraceFlags.gc ||
+        RtsFlags.DebugFlags.gc ||
+        RtsFlags.DebugFlags.scheduler;
+
+    TRACE_spark_sampled =
+        RtsFlags.TraceFlags.sparks_sampled;
+
+    // -Dr turns on full spark tracing
+    TRACE_spark_full =
+        RtsFlags.TraceFlags.sparks_full ||
+        RtsFlags.DebugFlags.sparks;
+
+    TRACE_user =
+        RtsFlags.TraceFlags.user;
+}
+
+// Apply classes, in the syntax of -l, to the current ones.  Doesn't
+// lock or allocate, as the SIGUSR2 handler calls it.
+static rtsBool applyTraceClasses (const char *classes)
+{
+    const char *c;
+    rtsBool enabled = rtsTrue;
+
+    for (c = classes; *c != '\0'; c++) {
+        switch (*c) {
+        case '-': case 'a': case 's': case 'g': case 'p': case 'f': case 'u':
+            break;
+        default:
+            return rtsFalse;
+        }
+    }
+
+    for (c = classes; *c != '\0'; c++) {
+        switch (*c) {
+        case '-':
+            enabled = rtsFalse;
+            continue;
+        case 'a':
+            RtsFlags.TraceFlags.scheduler      = enabled;
+            RtsFlags.TraceFlags.gc             = enabled;
+            RtsFlags.TraceFlags.sparks_sampled = enabled;
+            RtsFlags.TraceFlags.sparks_full    = enabled;
+            RtsFlags.TraceFlags.user           = enabled;
+            break;
+        case 's': RtsFlags.TraceFlags.scheduler      = enabled; break;
+        case 'g': RtsFlags.TraceFlags.gc             = enabled; break;
+        case 'p': RtsFlags.TraceFlags.sparks_sampled = enabled; break;
+        case 'f': RtsFlags.TraceFlags.sparks_full    = enabled; break;
+        case 'u': RtsFlags.TraceFlags.user           = enabled; break;
+        }
+        enabled = rtsTrue;
+    }
+
+    updateTraceClasses();
+    return rtsTrue;
+}
+
+rtsBool rts_setEventLogClasses (const char *classes)
+{
+    if (!eventlog_enabled) return rtsFalse;
+    return applyTraceClasses(classes);
+}
+
+rtsBool rts_setEventLogSampling (char cls, HsInt n)
+{
+    if (!eventlog_enabled || n < 1 || n > (HsInt)UINT32_MAX) return rtsFalse;
+    switch (cls) {
+    case 's': RtsFlags.TraceFlags.sched_sample = (nat)n; return rtsTrue;
+    case 'f': RtsFlags.TraceFlags.spark_sample = (nat)n; return rtsTrue;
+    default:  return rtsFalse;
+    }
+}
+
+/*
+ * --eventlog-toggle: SIGUSR2 turns the classes on, and either another
+ * SIGUSR2 or the timer, after toggle_time, puts back the ones that
+ * were on before.
+ */
+static rtsBool toggled_on = rtsFalse;
+static int toggle_ticks_left = 0;
+static TRACE_FLAGS toggle_saved;
+
+static void untoggleTraceClasses (void)
+{
+    RtsFlags.TraceFlags.scheduler      = toggle_saved.scheduler;
+    RtsFlags.TraceFlags.gc             = toggle_saved.gc;
+    RtsFlags.TraceFlags.sparks_sampled = toggle_saved.sparks_sampled;
+    RtsFlags.TraceFlags.sparks_full    = toggle_saved.sparks_full;
+    RtsFlags.TraceFlags.user           = toggle_saved.user;
+    updateTraceClasses();
+    toggled_on = rtsFalse;
+}
+
+void toggleTraceClasses (void)
+{
+    if (!eventlog_enabled || RtsFlags.TraceFlags.toggle_classes == NULL) {
+        return;
+    }
+    if (toggled_on) {
+        toggle_ticks_left = 0;
+        untoggleTraceClasses();
+        return;
+    }
+    toggle_saved = RtsFlags.TraceFlags;
+    if (applyTraceClasses(RtsFlags.TraceFlags.toggle_classes)) {
+        toggled_on = rtsTrue;
+        if (RtsFlags.TraceFlags.toggle_time > 0 &&
+            RtsFlags.MiscFlags.tickInterval > 0) {
+            toggle_ticks_left = stg_max(1, RtsFlags.TraceFlags.toggle_time /
+                                           RtsFlags.MiscFlags.tickInterval);
+        }
+    }
+}
+
+void traceToggleTick (void)
+{
+    if (toggle_ticks_left > 0 && --toggle_ticks_left == 0 && toggled_on) {
+        untoggleTraceClasses();
+    }
+}
+
 /* ---------------------------------------------------------------------------
    Starting up / shuttting down the tracing facilities
  --------------------------------------------------------------------------- */
@@ -89,32 +236,35 @@ void initTracing (void)
     DEBUG_FLAG(sparks,       DEBUG_sparks);
 #endif
 
-    // -Ds turns on scheduler tracing too
-    TRACE_sched =
-        RtsFlags.TraceFlags.scheduler ||
-        RtsFlags.DebugFlags.scheduler;
+    updateTraceClasses();
 
-    // -Dg turns on gc tracing too
-    TRACE_gc =
-        RtsFlags.TraceFlags.gc ||
-        RtsFlags.DebugFlags.gc ||
-        RtsFlags.DebugFlags.scheduler;
-    if (TRACE_gc && RtsFlags.GcFlags.giveStats == NO_GC_STATS) {
+    // The GC statistics are needed for the GC events, and with the
+    // eventlog, the GC class can be turned on later.
+    if ((TRACE_gc || RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG) &&
+        RtsFlags.GcFlags.giveStats == NO_GC_STATS) {
         RtsFlags.GcFlags.giveStats = COLLECT_GC_STATS;
     }
 
-    TRACE_spark_sampled =
-        RtsFlags.TraceFlags.sparks_sampled;
-
-    // -Dr turns on full spark tracing
-    TRACE_spark_full =
-        RtsFlags.TraceFlags.sparks_full ||
-        RtsFlags.DebugFlags.sparks;
+    eventlog_enabled = RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG;
 
-    TRACE_user =
-        RtsFlags.TraceFlags.user;
+    if (RtsFlags.TraceFlags.toggle_classes != NULL) {
+        // check them now, rather than in the signal handler
+        toggle_saved = RtsFlags.TraceFlags;
+        if (!applyTraceClasses(RtsFlags.TraceFlags.toggle_classes)) {
+            errorBelch("--eventlog-toggle: unknown trace class in %s",
+                       RtsFlags.TraceFlags.toggle_classes);
+            stg_exit(EXIT_FAILURE);
+        }
+        untoggleTraceClasses();
+    }
 
-    eventlog_enabled = RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG;
+    // stack and allocation samples only go to the eventlog
+    if (!eventlog_enabled) {
+        RtsFlags.TraceFlags.stack_sample_ticks = 0;
+        RtsFlags.TraceFlags.alloc_sample_bytes = 0;
+        // the heap profile goes to the .hp file after all
+        RtsFlags.ProfFlags.eventlogHeapProfile = rtsFalse;
+    }
 
     /* Note: we can have any of the TRACE_* flags turned on even when
        eventlog_enabled is off. In the DEBUG way we may be tracing to stderr.
@@ -123,6 +273,9 @@ void initTracing (void)
     if (eventlog_enabled) {
         initEventLogging();
     }
+#ifdef DEBUG
+    initTraceBufs();
+#endif
 }
 
 void endTracing (void)
@@ -130,6 +283,9 @@ void endTracing (void)
     if (eventlog_enabled) {
         endEventLogging();
     }
+#ifdef DEBUG
+    endTraceBufs();
+#endif
 }
 
 void freeTracing (void)
@@ -137,10 +293,16 @@ void freeTracing (void)
     if (eventlog_enabled) {
         freeEventLogging();
     }
+#ifdef DEBUG
+    freeTraceBufs();
+#endif
 }
 
 void resetTracing (void)
 {
+#ifdef DEBUG
+    resetTraceBufs();
+#endif
     if (eventlog_enabled) {
         abortEventLogging(); // abort eventlog inherited from parent
         initEventLogging(); // child starts its own eventlog
@@ -159,13 +321,276 @@ void tracingAddCapapilities (nat from, nat to)
  --------------------------------------------------------------------------- */
 
 #ifdef DEBUG
-static void tracePreface (void)
+/* Note [Buffered debug tracing]
+
+   Each message of the stderr tracing (-D, -v) is normally written with
+   trace_utx held, so the capabilities take turns at the lock and at
+   the write(), and the races being debugged come out differently.
+
+   With --debug-trace-buffer, a Task's OS thread instead formats the
+   message into task->trace_buf, a ring of records (the time and the
+   text of one message each) that only it writes to.  It publishes a
+   record by advancing buf->head after a write barrier, so writing a
+   message takes no lock.  Anyone holding trace_utx can write out what
+   has been published, in flushTraceBufs(): it merges the buffers in
+   time order, and advances each buf->tail, which tells the owner that
+   the space is free again.  That is done
+
+     - by a Task whose buffer is full,
+     - by a thread that has no Task and traces (the timer, ...): it has
+       no buffer, and writes its message at once, after the others,
+     - when a Task is freed (releaseTraceBuf()), and at exit.
+
+   The buffers are never freed until the RTS shuts down: a freed
+   Task's buffer is kept, empty, for the next Task that traces.
+*/
+
+#define TRACE_LINE_MAX 1024
+
+typedef struct {
+    Time time;
+    StgWord32 len;              // of the text, or TRACE_REC_SKIP
+    StgWord32 pad_;
+} TraceRec;
+
+// the rest of the ring is unused, the next record is at the start
+#define TRACE_REC_SKIP 0xffffffff
+
+#define TRACE_REC_SIZE(len) \
+    ((sizeof(TraceRec) + (len) + sizeof(TraceRec) - 1) / \
+     sizeof(TraceRec) * sizeof(TraceRec))
+
+struct TraceBuf_ {
+    Task *owner;                // NULL if free
+    struct TraceBuf_ *link;     // on trace_bufs
+    StgWord8 *ring;
+    volatile StgWord head;      // written by the owner
+    volatile StgWord tail;      // written under trace_utx
+    StgWord flush_head;         // in flushTraceBufs()
+    Time time;                  // of the message in line
+    nat line_len;
+    char line[TRACE_LINE_MAX];
+};
+
+static StgWord trace_buf_size;  // bytes in each ring
+
+static TraceRec *traceRecAt (TraceBuf *buf, StgWord pos)
+{
+    return (TraceRec *)(buf->ring + pos % trace_buf_size);
+}
+
+// Requires: trace_utx
+static void flushTraceBufs (void)
+{
+    TraceBuf *buf, *next;
+    TraceRec *rec;
+
+    for (buf = trace_bufs; buf != NULL; buf = buf->link) {
+        buf->flush_head = buf->head;
+    }
+    load_load_barrier();
+
+    for (;;) {
+        next = NULL;
+        for (buf = trace_bufs; buf != NULL; buf = buf->link) {
+            if (buf->tail == buf->flush_head) continue;
+            rec = traceRecAt(buf, buf->tail);
+            if (rec->len == TRACE_REC_SKIP) {
+                buf->tail += trace_buf_size - buf->tail % trace_buf_size;
+                if (buf->tail == buf->flush_head) continue;
+                rec = traceRecAt(buf, buf->tail);
+            }
+            if (next == NULL || rec->time < traceRecAt(next, next->tail)->time) {
+                next = buf;
+            }
+        }
+        if (next == NULL) break;
+
+        rec = traceRecAt(next, next->tail);
+        debugBelch("%.*s", (int)rec->len, (char *)(rec + 1));
+        // done with the record before the owner may reuse its space
+        store_load_barrier();
+        next->tail += TRACE_REC_SIZE(rec->len);
+    }
+}
+
+static TraceBuf *newTraceBuf (Task *task)
 {
+    TraceBuf *buf;
+
+    ACQUIRE_LOCK(&trace_utx);
+    for (buf = trace_bufs; buf != NULL; buf = buf->link) {
+        if (buf->owner == NULL) break;
+    }
+    if (buf == NULL) {
+        buf = stgMallocBytes(sizeof(TraceBuf), "newTraceBuf");
+        buf->ring = stgMallocBytes(trace_buf_size, "newTraceBuf");
+        buf->head = 0;
+        buf->tail = 0;
+        buf->link = trace_bufs;
+        trace_bufs = buf;
+    }
+    buf->owner = task;
+    RELEASE_LOCK(&trace_utx);
+
+    task->trace_buf = buf;
+    return buf;
+}
+
+void releaseTraceBuf (Task *task)
+{
+    TraceBuf *buf = task->trace_buf;
+
+    if (buf == NULL) return;
+    ACQUIRE_LOCK(&trace_utx);
+    flushTraceBufs();
+    buf->owner = NULL;
+    RELEASE_LOCK(&trace_utx);
+    task->trace_buf = NULL;
+}
+
+// The owner publishes the message in buf->line
+static void commitTraceLine (TraceBuf *buf)
+{
+    StgWord size = TRACE_REC_SIZE(buf->line_len);
+    StgWord room = trace_buf_size - buf->head % trace_buf_size;
+    StgWord need = size + (room < size ? room : 0);
+    TraceRec *rec;
+
+    if (trace_buf_size - (buf->head - buf->tail) < need) {
+        ACQUIRE_LOCK(&trace_utx);
+        flushTraceBufs();   // empties this one
+        RELEASE_LOCK(&trace_utx);
+    }
+
+    rec = traceRecAt(buf, buf->head);
+    if (room < size) {
+        rec->len = TRACE_REC_SKIP;
+        rec = traceRecAt(buf, buf->head + room);
+    }
+    rec->time = buf->time;
+    rec->len = buf->line_len;
+    memcpy(rec + 1, buf->line, buf->line_len);
+    write_barrier();
+    buf->head += need;
+}
+
+static void initTraceBufs (void)
+{
+    if (RtsFlags.DebugFlags.trace_buffer == 0 ||
+        RtsFlags.TraceFlags.tracing != TRACE_STDERR) {
+        return;
+    }
+    trace_buf_size = (StgWord)RtsFlags.DebugFlags.trace_buffer
+                     / sizeof(TraceRec) * sizeof(TraceRec);
+    trace_buffered = rtsTrue;
+}
+
+static void endTraceBufs (void)
+{
+    if (!trace_buffered) return;
+    ACQUIRE_LOCK(&trace_utx);
+    flushTraceBufs();
+    trace_buffered = rtsFalse;
+    RELEASE_LOCK(&trace_utx);
+}
+
+static void freeTraceBufs (void)
+{
+    TraceBuf *buf, *next;
+
+    for (buf = trace_bufs; buf != NULL; buf = next) {
+        next = buf->link;
+        if (buf->owner != NULL) buf->owner->trace_buf = NULL;
+        stgFree(buf->ring);
+        stgFree(buf);
+    }
+    trace_bufs = NULL;
+}
+
+// in the child of forkProcess()
+static void resetTraceBufs (void)
+{
+    TraceBuf *buf;
+
+    if (!trace_buffered) return;
+    // what is buffered is the parent's to write, and trace_utx may
+    // have been held by one of its other threads
 #ifdef THREADED_RTS
-    debugBelch("%12lx: ", (unsigned long)osThreadId());
+    initMutex(&trace_utx);
+#endif
+    for (buf = trace_bufs; buf != NULL; buf = buf->link) {
+        buf->tail = buf->head;
+    }
+}
+
+static void vtraceBelch (TraceBuf *buf, const char *s, va_list ap)
+{
+    int n;
+
+    if (buf == NULL) {
+        vdebugBelch(s, ap);
+        return;
+    }
+    n = vsnprintf(buf->line + buf->line_len,
+                  TRACE_LINE_MAX - buf->line_len, s, ap);
+    if (n > 0) {
+        // a message that is too long is cut short
+        buf->line_len = stg_min(buf->line_len + n, TRACE_LINE_MAX - 1);
+    }
+}
+
+static void traceBelch (TraceBuf *buf, const char *s, ...)
+    GNUC3_ATTRIBUTE(format (PRINTF, 2, 3));
+
+static void traceBelch (TraceBuf *buf, const char *s, ...)
+{
+    va_list ap;
+    va_start(ap,s);
+    vtraceBelch(buf, s, ap);
+    va_end(ap);
+}
+
+static void tracePreface (TraceBuf *buf)
+{
+#ifdef THREADED_RTS
+    traceBelch(buf, "%12lx: ", (unsigned long)osThreadId());
 #endif
     if (RtsFlags.TraceFlags.timestamp) {
-        debugBelch("%9" FMT_Word64 ": ", stat_getElapsedTime());
+        traceBelch(buf, "%9" FMT_Word64 ": ",
+                   buf != NULL ? buf->time : stat_getElapsedTimestamp());
+    }
+}
+
+/*
+ * A trace message is written between traceMsgBegin() and traceMsgEnd(),
+ * with traceBelch().  traceMsgBegin() returns the Task's buffer, or NULL
+ * if it has none, and then trace_utx is held until traceMsgEnd().
+ */
+static TraceBuf *traceMsgBegin (void)
+{
+    TraceBuf *buf = NULL;
+    Task *task;
+
+    if (trace_buffered && (task = myTask()) != NULL) {
+        buf = task->trace_buf;
+        if (buf == NULL) buf = newTraceBuf(task);
+        buf->line_len = 0;
+        buf->time = stat_getElapsedTimestamp();
+    } else {
+        ACQUIRE_LOCK(&trace_utx);
+        if (trace_buffered) flushTraceBufs();
+    }
+    tracePreface(buf);
+    return buf;
+}
+
+static void traceMsgEnd (TraceBuf *buf)
+{
+    if (buf == NULL) {
+        RELEASE_LOCK(&trace_utx);
+    } else {
+        commitTraceLine(buf);
     }
 }
 #endif
@@ -199,53 +624,95 @@ static void traceSchedEvent_stderr (Capability *cap, EventTypeNum tag,
                                     StgWord info1 STG_UNUSED,
                                     StgWord info2 STG_UNUSED)
 {
-    ACQUIRE_LOCK(&trace_utx);
+    TraceBuf *buf = traceMsgBegin();
 
-    tracePreface();
     switch (tag) {
     case EVENT_CREATE_THREAD:   // (cap, thread)
-        debugBelch("cap %d: created thread %" FMT_Word "\n",
+        traceBelch(buf, "cap %d: created thread %" FMT_Word "\n",
                    cap->no, (W_)tso->id);
         break;
     case EVENT_RUN_THREAD:      //  (cap, thread)
-        debugBelch("cap %d: running thread %" FMT_Word " (%s)\n",
+        traceBelch(buf, "cap %d: running thread %" FMT_Word " (%s)\n",
                    cap->no, (W_)tso->id, what_next_strs[tso->what_next]);
         break;
     case EVENT_THREAD_RUNNABLE: // (cap, thread)
-        debugBelch("cap %d: thread %" FMT_Word " appended to run queue\n",
+        traceBelch(buf, "cap %d: thread %" FMT_Word " appended to run queue\n",
                    cap->no, (W_)tso->id);
         break;
     case EVENT_MIGRATE_THREAD:  // (cap, thread, new_cap)
-        debugBelch("cap %d: thread %" FMT_Word " migrating to cap %d\n",
+        traceBelch(buf, "cap %d: thread %" FMT_Word " migrating to cap %d\n",
                    cap->no, (W_)tso->id, (int)info1);
         break;
     case EVENT_THREAD_WAKEUP:   // (cap, thread, info1_cap)
-        debugBelch("cap %d: waking up thread %" FMT_Word " on cap %d\n",
+        traceBelch(buf, "cap %d: waking up thread %" FMT_Word " on cap %d\n",
                    cap->no, (W_)tso->id, (int)info1);
         break;
 
     case EVENT_STOP_THREAD:     // (cap, thread, status)
         if (info1 == 6 + BlockedOnBlackHole) {
-            debugBelch("cap %d: thread %" FMT_Word " stopped (blocked on black hole owned by thread %lu)\n",
+            traceBelch(buf, "cap %d: thread %" FMT_Word " stopped (blocked on black hole owned by thread %lu)\n",
                        cap->no, (W_)tso->id, (long)info2);
         } else {
-            debugBelch("cap %d: thread %" FMT_Word " stopped (%s)\n",
+            traceBelch(buf, "cap %d: thread %" FMT_Word " stopped (%s)\n",
                        cap->no, (W_)tso->id, thread_stop_reasons[info1]);
         }
         break;
+    case EVENT_STM_ABORT:       // (cap, thread, tvar, aborts)
+        traceBelch(buf, "cap %d: thread %" FMT_Word " failed to commit "
+                   "(TVar %p, %lu in a row)\n",
+                   cap->no, (W_)tso->id, (void *)info1, (unsigned long)info2);
+        break;
+    case EVENT_BLACKHOLE_WAIT:  // (cap, thread, wait)
+        traceBelch(buf, "cap %d: thread %" FMT_Word " woken after %.3fms "
+                   "on a black hole\n",
+                   cap->no, (W_)tso->id, (double)info1 / 1000000);
+        break;
+    case EVENT_EXCEPTION_RAISE: // (cap, thread, frames, updates)
+        traceBelch(buf, "cap %d: thread %" FMT_Word " raised an exception "
+                   "through %" FMT_Word " frames (%" FMT_Word " updates)\n",
+                   cap->no, (W_)tso->id, (W_)info1, (W_)info2);
+        break;
     default:
-        debugBelch("cap %d: thread %" FMT_Word ": event %d\n\n",
+        traceBelch(buf, "cap %d: thread %" FMT_Word ": event %d\n\n",
                    cap->no, (W_)tso->id, tag);
         break;
     }
 
-    RELEASE_LOCK(&trace_utx);
+    traceMsgEnd(buf);
 }
 #endif
 
+/*
+ * --eventlog-sample: log the first of every n events of each kind on
+ * each capability.  Each kind has its own count, so that the rarer
+ * events aren't all dropped in favour of the frequent ones, and
+ * a capability's share of the log follows its share of the events.
+ */
+STATIC_INLINE rtsBool sampleEvent (Capability *cap, EventTypeNum tag, nat n)
+{
+    if (cap->trace_sample_count[tag] == 0) {
+        cap->trace_sample_count[tag] = n - 1;
+        return rtsTrue;
+    }
+    cap->trace_sample_count[tag]--;
+    return rtsFalse;
+}
+
 void traceSchedEvent_ (Capability *cap, EventTypeNum tag,
                        StgTSO *tso, StgWord info1, StgWord info2)
 {
+    if (RtsFlags.TraceFlags.sched_sample > 1 && cap != NULL) {
+        // a thread's stop goes with its run
+        if (tag == EVENT_STOP_THREAD) {
+            if (!cap->trace_run_sampled) return;
+        } else {
+            rtsBool sampled =
+                sampleEvent(cap, tag, RtsFlags.TraceFlags.sched_sample);
+            if (tag == EVENT_RUN_THREAD) cap->trace_run_sampled = sampled;
+            if (!sampled) return;
+        }
+    }
+
 #ifdef DEBUG
     if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
         traceSchedEvent_stderr(cap, tag, tso, info1, info2);
@@ -259,40 +726,39 @@ void traceSchedEvent_ (Capability *cap, EventTypeNum tag,
 #ifdef DEBUG
 static void traceGcEvent_stderr (Capability *cap, EventTypeNum tag)
 {
-    ACQUIRE_LOCK(&trace_utx);
+    TraceBuf *buf = traceMsgBegin();
 
-    tracePreface();
     switch (tag) {
       case EVENT_REQUEST_SEQ_GC:  // (cap)
-          debugBelch("cap %d: requesting sequential GC\n", cap->no);
+          traceBelch(buf, "cap %d: requesting sequential GC\n", cap->no);
           break;
       case EVENT_REQUEST_PAR_GC:  // (cap)
-          debugBelch("cap %d: requesting parallel GC\n", cap->no);
+          traceBelch(buf, "cap %d: requesting parallel GC\n", cap->no);
           break;
       case EVENT_GC_START:        // (cap)
-          debugBelch("cap %d: starting GC\n", cap->no);
+          traceBelch(buf, "cap %d: starting GC\n", cap->no);
           break;
       case EVENT_GC_END:          // (cap)
-          debugBelch("cap %d: finished GC\n", cap->no);
+          traceBelch(buf, "cap %d: finished GC\n", cap->no);
           break;
       case EVENT_GC_IDLE:         // (cap)
-          debugBelch("cap %d: GC idle\n", cap->no);
+          traceBelch(buf, "cap %d: GC idle\n", cap->no);
           break;
       case EVENT_GC_WORK:         // (cap)
-          debugBelch("cap %d: GC working\n", cap->no);
+          traceBelch(buf, "cap %d: GC working\n", cap->no);
           break;
       case EVENT_GC_DONE:         // (cap)
-          debugBelch("cap %d: GC done\n", cap->no);
+          traceBelch(buf, "cap %d: GC done\n", cap->no);
           break;
       case EVENT_GC_GLOBAL_SYNC:  // (cap)
-          debugBelch("cap %d: all caps stopped for GC\n", cap->no);
+          traceBelch(buf, "cap %d: all caps stopped for GC\n", cap->no);
           break;
       default:
           barf("traceGcEvent: unknown event tag %d", tag);
           break;
     }
 
-    RELEASE_LOCK(&trace_utx);
+    traceMsgEnd(buf);
 }
 #endif
 
@@ -378,29 +844,227 @@ void traceEventGcStats_  (Capability *cap,
     }
 }
 
+void traceEventGcPhases_ (Capability *cap, Time *phases)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for this one */
+    } else
+#endif
+    {
+        postEventGcPhases(cap, phases);
+    }
+}
+
+void traceEventGcSync_ (Capability *cap, Time sync, nat last_cap,
+                        StgWord64 last_thread)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        debugBelch("cap %d: GC sync took %.3fms, waiting last for cap %d "
+                   "(thread %" FMT_Word ")\n", cap->no,
+                   (double)TimeToNS(sync) / 1000000, last_cap, (W_)last_thread);
+    } else
+#endif
+    {
+        postEventGcSync(cap, sync, last_cap, last_thread);
+    }
+}
+
+/* ---------------------------------------------------------------------------
+   Stack samples (--sample-stacks)
+
+   On every nth tick handle_tick() asks each Capability for a sample, and
+   the scheduler takes one when the thread it is running next returns to
+   it (so a thread that doesn't allocate is sampled late).  The sample is
+   the info pointers of the frames on top of the thread's stack, from the
+   return address it will resume at downwards; with tables-next-to-code
+   these are the addresses of the return code, which the symbol table of
+   the binary turns into names offline.
+   ------------------------------------------------------------------------ */
+
+#define STACK_SAMPLE_DEPTH 64
+
+void traceStackSample (Capability *cap, StgTSO *tso)
+{
+    StgWord frames[STACK_SAMPLE_DEPTH];
+    StgStack *stack;
+    StgPtr sp, end;
+    const StgInfoTable *info;
+    nat n;
+
+    if (tso->what_next == ThreadComplete || tso->what_next == ThreadKilled) {
+        return;
+    }
+
+    stack = tso->stackobj;
+    sp = stack->sp;
+    end = stack->stack + stack->stack_size;
+    n = 0;
+    while (n < STACK_SAMPLE_DEPTH && sp < end) {
+        info = ((StgClosure *)sp)->header.info;
+        frames[n++] = (StgWord)info;
+        if (info == &stg_stop_thread_info) {
+            break;
+        }
+        if (info == &stg_stack_underflow_frame_info) {
+            stack = ((StgUnderflowFrame *)sp)->next_chunk;
+            sp = stack->sp;
+            end = stack->stack + stack->stack_size;
+        } else {
+            sp += stack_frame_sizeW((StgClosure *)sp);
+        }
+    }
+
+    postStackSample(cap, tso, frames, n);
+}
+
+/* ---------------------------------------------------------------------------
+   Allocation samples (--alloc-sample)
+
+   When a heap check fails at the end of a nursery block and the
+   Capability has allocated another alloc_sample_bytes since its last
+   sample, stg_gc_noregs calls here before carrying on with the next
+   block.  The bytes that allocate() hands out (large objects, and the
+   blocks of primops such as newByteArray#) count too, but as they
+   don't stop at a heap check they are put down to the next one.
+
+   On top of the stack is the frame that the heap-check failure code
+   pushed: for a thunk or function this holds the closure, whose info
+   pointer says which one is allocating, and for a case alternative it
+   holds the value being returned.  Below it is the frame the code will
+   return to, the other half of the sample.  As for stack samples, both
+   are code addresses with tables-next-to-code.
+   ------------------------------------------------------------------------ */
+
+void traceAllocSample (Capability *cap, StgPtr sp)
+{
+    const StgInfoTable *info;
+    StgClosure *closure;
+    StgWord closure_info, frame_info, sample_words;
+
+    sample_words = RtsFlags.TraceFlags.alloc_sample_bytes / sizeof(W_);
+
+    info = ((StgClosure *)sp)->header.info;
+    closure_info = 0;
+    if (info == &stg_enter_info) {
+        closure = UNTAG_CLOSURE((StgClosure *)sp[1]);
+        closure_info = (StgWord)closure->header.info;
+        sp += 2;
+    } else if (info == &stg_gc_fun_info) {
+        closure = UNTAG_CLOSURE((StgClosure *)sp[2]);
+        closure_info = (StgWord)closure->header.info;
+        sp += 3 + sp[1];
+    } else if (info == &stg_ret_p_info || info == &stg_ret_n_info ||
+               info == &stg_ret_f_info || info == &stg_ret_d_info ||
+               info == &stg_ret_l_info) {
+        sp += stack_frame_sizeW((StgClosure *)sp);
+    }
+    frame_info = (StgWord)((StgClosure *)sp)->header.info;
+
+    postAllocSample(cap, cap->r.rCurrentTSO,
+                    (StgWord64)(cap->total_allocated -
+                                (cap->alloc_sample_next - sample_words))
+                        * sizeof(W_),
+                    closure_info, frame_info);
+
+    cap->alloc_sample_next = cap->total_allocated + sample_words;
+}
+
+/* ---------------------------------------------------------------------------
+   Heap census samples (--eventlog-heap-profile)
+
+   The census is taken by the GC, so the events go in the buffer of the
+   Capability leading it, between its GC events.  Bands are numbered in
+   the order they first appear; EVENT_HEAP_PROF_BAND gives the name of a
+   band just before its first sample.
+   ------------------------------------------------------------------------ */
+
+void traceHeapProfBegin (Capability *cap, StgWord32 breakdown,
+                         StgWord64 interval_ns)
+{
+    if (eventlog_enabled) {
+        postHeapProfBegin(cap, breakdown, interval_ns);
+    }
+}
+
+void traceHeapProfBand (Capability *cap, StgWord32 band, const char *name)
+{
+    if (eventlog_enabled) {
+        postHeapProfBand(cap, band, name);
+    }
+}
+
+void traceHeapProfSampleBegin (Capability *cap, StgWord32 sample,
+                               StgWord64 mut_time_ns)
+{
+    if (eventlog_enabled) {
+        postHeapProfSampleBegin(cap, sample, mut_time_ns);
+    }
+}
+
+void traceHeapProfSample (Capability *cap, StgWord32 band, StgWord64 bytes)
+{
+    if (eventlog_enabled) {
+        postHeapProfSample(cap, band, bytes);
+    }
+}
+
+void traceHeapProfSampleEnd (Capability *cap, StgWord32 sample)
+{
+    if (eventlog_enabled) {
+        postHeapProfSampleEnd(cap, sample);
+    }
+}
+
+void traceEventThreadUsage_ (Capability *cap, StgTSO *tso,
+                             StgWord64 cpu_time, StgWord64 allocated)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for this one */
+    } else
+#endif
+    {
+        postThreadUsage(cap, tso, cpu_time, allocated);
+    }
+}
+
+void traceEventHwCounters_ (Capability *cap, EventCapNo capno,
+                            StgWord16 kind, StgWord64 *counts)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* no stderr equivalent for this one */
+    } else
+#endif
+    {
+        postEventHwCounters(cap, capno, kind, counts);
+    }
+}
+
 void traceCapEvent (Capability   *cap,
                     EventTypeNum  tag)
 {
 #ifdef DEBUG
     if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
-        ACQUIRE_LOCK(&trace_utx);
+        TraceBuf *buf = traceMsgBegin();
 
-        tracePreface();
         switch (tag) {
         case EVENT_CAP_CREATE:   // (cap)
-            debugBelch("cap %d: initialised\n", cap->no);
+            traceBelch(buf, "cap %d: initialised\n", cap->no);
             break;
         case EVENT_CAP_DELETE:   // (cap)
-            debugBelch("cap %d: shutting down\n", cap->no);
+            traceBelch(buf, "cap %d: shutting down\n", cap->no);
             break;
         case EVENT_CAP_ENABLE:   // (cap)
-            debugBelch("cap %d: enabling capability\n", cap->no);
+            traceBelch(buf, "cap %d: enabling capability\n", cap->no);
             break;
         case EVENT_CAP_DISABLE:  // (cap)
-            debugBelch("cap %d: disabling capability\n", cap->no);
+            traceBelch(buf, "cap %d: disabling capability\n", cap->no);
             break;
         }
-        RELEASE_LOCK(&trace_utx);
+        traceMsgEnd(buf);
     } else
 #endif
     {
@@ -419,26 +1083,25 @@ void traceCapsetEvent (EventTypeNum tag,
         // When events go to stderr, it is annoying to see the capset
         // events every time, so we only emit them with -Ds.
     {
-        ACQUIRE_LOCK(&trace_utx);
+        TraceBuf *buf = traceMsgBegin();
 
-        tracePreface();
         switch (tag) {
         case EVENT_CAPSET_CREATE:   // (capset, capset_type)
-            debugBelch("created capset %" FMT_Word " of type %d\n", (W_)capset, (int)info);
+            traceBelch(buf, "created capset %" FMT_Word " of type %d\n", (W_)capset, (int)info);
             break;
         case EVENT_CAPSET_DELETE:   // (capset)
-            debugBelch("deleted capset %" FMT_Word "\n", (W_)capset);
+            traceBelch(buf, "deleted capset %" FMT_Word "\n", (W_)capset);
             break;
         case EVENT_CAPSET_ASSIGN_CAP:  // (capset, capno)
-            debugBelch("assigned cap %" FMT_Word " to capset %" FMT_Word "\n",
+            traceBelch(buf, "assigned cap %" FMT_Word " to capset %" FMT_Word "\n",
                        (W_)info, (W_)capset);
             break;
         case EVENT_CAPSET_REMOVE_CAP:  // (capset, capno)
-            debugBelch("removed cap %" FMT_Word " from capset %" FMT_Word "\n",
+            traceBelch(buf, "removed cap %" FMT_Word " from capset %" FMT_Word "\n",
                        (W_)info, (W_)capset);
             break;
         }
-        RELEASE_LOCK(&trace_utx);
+        traceMsgEnd(buf);
     } else
 #endif
     {
@@ -454,6 +1117,12 @@ void traceWallClockTime_(void) {
     }
 }
 
+void traceClockSource_(void) {
+    if (eventlog_enabled) {
+        postClockSource();
+    }
+}
+
 void traceOSProcessInfo_(void) {
     if (eventlog_enabled) {
         postCapsetEvent(EVENT_OSPROCESS_PID,
@@ -502,41 +1171,40 @@ void traceOSProcessInfo_(void) {
 static void traceSparkEvent_stderr (Capability *cap, EventTypeNum tag,
                                     StgWord info1)
 {
-    ACQUIRE_LOCK(&trace_utx);
+    TraceBuf *buf = traceMsgBegin();
 
-    tracePreface();
     switch (tag) {
 
     case EVENT_CREATE_SPARK_THREAD: // (cap, spark_thread)
-        debugBelch("cap %d: creating spark thread %lu\n",
+        traceBelch(buf, "cap %d: creating spark thread %lu\n",
                    cap->no, (long)info1);
         break;
     case EVENT_SPARK_CREATE:        // (cap)
-        debugBelch("cap %d: added spark to pool\n",
+        traceBelch(buf, "cap %d: added spark to pool\n",
                    cap->no);
         break;
     case EVENT_SPARK_DUD:           //  (cap)
-        debugBelch("cap %d: discarded dud spark\n",
+        traceBelch(buf, "cap %d: discarded dud spark\n",
                    cap->no);
         break;
     case EVENT_SPARK_OVERFLOW:      // (cap)
-        debugBelch("cap %d: discarded overflowed spark\n",
+        traceBelch(buf, "cap %d: discarded overflowed spark\n",
                    cap->no);
         break;
     case EVENT_SPARK_RUN:           // (cap)
-        debugBelch("cap %d: running a spark\n",
+        traceBelch(buf, "cap %d: running a spark\n",
                    cap->no);
         break;
     case EVENT_SPARK_STEAL:         // (cap, victim_cap)
-        debugBelch("cap %d: stealing a spark from cap %d\n",
+        traceBelch(buf, "cap %d: stealing a spark from cap %d\n",
                    cap->no, (int)info1);
         break;
     case EVENT_SPARK_FIZZLE:        // (cap)
-        debugBelch("cap %d: fizzled spark removed from pool\n",
+        traceBelch(buf, "cap %d: fizzled spark removed from pool\n",
                    cap->no);
         break;
     case EVENT_SPARK_GC:            // (cap)
-        debugBelch("cap %d: GCd spark removed from pool\n",
+        traceBelch(buf, "cap %d: GCd spark removed from pool\n",
                    cap->no);
         break;
     default:
@@ -544,12 +1212,17 @@ static void traceSparkEvent_stderr (Capability *cap, EventTypeNum tag,
         break;
     }
 
-    RELEASE_LOCK(&trace_utx);
+    traceMsgEnd(buf);
 }
 #endif
 
 void traceSparkEvent_ (Capability *cap, EventTypeNum tag, StgWord info1)
 {
+    if (RtsFlags.TraceFlags.spark_sample > 1 && cap != NULL &&
+        !sampleEvent(cap, tag, RtsFlags.TraceFlags.spark_sample)) {
+        return;
+    }
+
 #ifdef DEBUG
     if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
         traceSparkEvent_stderr(cap, tag, info1);
@@ -624,14 +1297,13 @@ void traceTaskDelete_ (Task *task)
 #ifdef DEBUG
 static void vtraceCap_stderr(Capability *cap, char *msg, va_list ap)
 {
-    ACQUIRE_LOCK(&trace_utx);
+    TraceBuf *buf = traceMsgBegin();
 
-    tracePreface();
-    debugBelch("cap %d: ", cap->no);
-    vdebugBelch(msg,ap);
-    debugBelch("\n");
+    traceBelch(buf, "cap %d: ", cap->no);
+    vtraceBelch(buf, msg, ap);
+    traceBelch(buf, "\n");
 
-    RELEASE_LOCK(&trace_utx);
+    traceMsgEnd(buf);
 }
 
 static void traceCap_stderr(Capability *cap, char *msg, ...)
@@ -663,13 +1335,12 @@ void traceCap_(Capability *cap, char *msg, ...)
 #ifdef DEBUG
 static void vtrace_stderr(char *msg, va_list ap)
 {
-    ACQUIRE_LOCK(&trace_utx);
+    TraceBuf *buf = traceMsgBegin();
 
-    tracePreface();
-    vdebugBelch(msg,ap);
-    debugBelch("\n");
+    vtraceBelch(buf, msg, ap);
+    traceBelch(buf, "\n");
 
-    RELEASE_LOCK(&trace_utx);
+    traceMsgEnd(buf);
 }
 #endif
 
@@ -729,17 +1400,38 @@ void traceUserMarker(Capability *cap, char *markername)
 }
 
 
+void traceUserBinaryMsg(Capability *cap, StgWord id,
+                        StgWord8 *buf, StgWord len)
+{
+    /* Like traceUserMsg, called from Cmm, so we check TRACE_user here */
+
+    // the eventlog has 32 bits for the id; see traceBinaryEvent#
+    if (id != (StgWord32)id) return;
+
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR && TRACE_user) {
+        traceCap_stderr(cap, "User binary event %" FMT_Word
+                        " (%" FMT_Word " bytes)", id, len);
+    } else
+#endif
+    {
+        if (eventlog_enabled && TRACE_user) {
+            postUserBinaryEvent(cap, (StgWord32)id, buf, len);
+        }
+    }
+}
+
 void traceThreadLabel_(Capability *cap,
                        StgTSO     *tso,
                        char       *label)
 {
 #ifdef DEBUG
     if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
-        ACQUIRE_LOCK(&trace_utx);
-        tracePreface();
-        debugBelch("cap %d: thread %" FMT_Word " has label %s\n",
+        TraceBuf *buf = traceMsgBegin();
+
+        traceBelch(buf, "cap %d: thread %" FMT_Word " has label %s\n",
                    cap->no, (W_)tso->id, label);
-        RELEASE_LOCK(&trace_utx);
+        traceMsgEnd(buf);
     } else
 #endif
     {
@@ -774,7 +1466,9 @@ void traceBegin (const char *str, ...)
 
     ACQUIRE_LOCK(&trace_utx);
 
-    tracePreface();
+    // the message is written at once, so that the caller can add to it
+    if (trace_buffered) flushTraceBufs();
+    tracePreface(NULL);
     vdebugBelch(str,ap);
     va_end(ap);
 }
@@ -786,8 +1480,37 @@ void traceEnd (void)
 }
 #endif /* DEBUG */
 
+#else /* !TRACING */
+
+rtsBool rts_setEventLogClasses (const char *classes STG_UNUSED)
+{
+    return rtsFalse;
+}
+
+rtsBool rts_setEventLogSampling (char cls STG_UNUSED, HsInt n STG_UNUSED)
+{
+    return rtsFalse;
+}
+
 #endif /* TRACING */
 
+/*
+ * Name a kind of binary user event (see includes/rts/UserEvents.h);
+ * present in every way, since base calls it.
+ */
+#ifdef TRACING
+void traceUserEventType(StgWord32 id, char *name)
+{
+    if (eventlog_enabled && TRACE_user) {
+        postUserBinaryEventType(id, name);
+    }
+}
+#else
+void traceUserEventType(StgWord32 id STG_UNUSED, char *name STG_UNUSED)
+{
+}
+#endif
+
 // If DTRACE is enabled, but neither DEBUG nor TRACING, we need a C land
 // wrapper for the user-msg probe (as we can't expand that in PrimOps.cmm)
 //
@@ -11,6 +11,7 @@
 
 #include "rts/EventLogFormat.h"
 #include "Capability.h"
+#include "GetTime.h"
 
 #if defined(DTRACE)
 #include "RtsProbes.h"
@@ -30,6 +31,12 @@ void freeTracing (void);
 void resetTracing (void);
 void tracingAddCapapilities (nat from, nat to);
 
+#if defined(DEBUG)
+// --debug-trace-buffer: write out what the Task has buffered, and give
+// its buffer back for another Task to use
+void releaseTraceBuf (Task *task);
+#endif
+
 #endif /* TRACING */
 
 typedef StgWord32 CapsetID;
@@ -152,6 +159,39 @@ void traceEventGcStats_  (Capability *cap,
                           W_        par_max_copied,
                           W_        par_tot_copied);
 
+void traceEventGcPhases_ (Capability *cap, Time *phases);
+
+void traceEventGcSync_ (Capability *cap, Time sync, nat last_cap,
+                        StgWord64 last_thread);
+
+void traceEventHwCounters_ (Capability *cap, EventCapNo capno,
+                            StgWord16 kind, StgWord64 *counts);
+
+void traceEventThreadUsage_ (Capability *cap, StgTSO *tso,
+                             StgWord64 cpu_time, StgWord64 allocated);
+
+/*
+ * Log the return frames on top of tso's stack (--sample-stacks)
+ */
+void traceStackSample (Capability *cap, StgTSO *tso);
+
+/*
+ * Log the code that is allocating (--alloc-sample); called by
+ * stg_gc_noregs, with the thread's stack pointer
+ */
+void traceAllocSample (Capability *cap, StgPtr sp);
+
+/*
+ * Heap census samples (--eventlog-heap-profile), see ProfHeap.c
+ */
+void traceHeapProfBegin (Capability *cap, StgWord32 breakdown,
+                         StgWord64 interval_ns);
+void traceHeapProfBand (Capability *cap, StgWord32 band, const char *name);
+void traceHeapProfSampleBegin (Capability *cap, StgWord32 sample,
+                               StgWord64 mut_time_ns);
+void traceHeapProfSample (Capability *cap, StgWord32 band, StgWord64 bytes);
+void traceHeapProfSampleEnd (Capability *cap, StgWord32 sample);
+
 /* 
  * Record a spark event
  */
@@ -167,6 +207,13 @@ void traceEventGcStats_  (Capability *cap,
 
 void traceSparkEvent_ (Capability *cap, EventTypeNum tag, StgWord info1);
 
+/*
+ * --eventlog-toggle: turn the classes on or back off (called by the
+ * SIGUSR2 handler), and count down the time they stay on (by the timer)
+ */
+void toggleTraceClasses (void);
+void traceToggleTick (void);
+
 // variadic macros are C99, and supported by gcc.  However, the
 // ##__VA_ARGS syntax is a gcc extension, which allows the variable
 // argument list to be empty (see gcc docs for details).
@@ -203,6 +250,14 @@ void traceUserMsg(Capability *cap, char *msg);
  */
 void traceUserMarker(Capability *cap, char *msg);
 
+/*
+ * A binary event emitted by the program, with a number saying what it
+ * is; bytes are copied into the eventlog as they are.
+ * Used by the traceBinaryEvent# primop
+ */
+void traceUserBinaryMsg(Capability *cap, StgWord id,
+                        StgWord8 *buf, StgWord len);
+
 /*
  * An event to record a Haskell thread's label/name
  * Used by GHC.Conc.labelThread
@@ -262,6 +317,8 @@ void traceCapsetEvent (EventTypeNum tag,
 
 void traceWallClockTime_(void);
 
+void traceClockSource_(void);
+
 void traceOSProcessInfo_ (void);
 
 void traceSparkCounters_ (Capability *cap,
@@ -286,6 +343,17 @@ void traceTaskDelete_ (Task       *task);
 #define traceEventGcStats_(cap, heap_capset, gen, \
                            copied, slop, fragmentation, \
                            par_n_threads, par_max_copied, par_tot_copied) /* nothing */
+#define traceEventGcPhases_(cap, phases) /* nothing */
+#define traceEventGcSync_(cap, sync, last_cap, last_thread) /* nothing */
+#define traceEventHwCounters_(cap, capno, kind, counts) /* nothing */
+#define traceEventThreadUsage_(cap, tso, cpu_time, allocated) /* nothing */
+#define traceStackSample(cap, tso) /* nothing */
+#define traceAllocSample(cap, sp) /* nothing */
+#define traceHeapProfBegin(cap, breakdown, interval_ns) /* nothing */
+#define traceHeapProfBand(cap, band, name) /* nothing */
+#define traceHeapProfSampleBegin(cap, sample, mut_time_ns) /* nothing */
+#define traceHeapProfSample(cap, band, bytes) /* nothing */
+#define traceHeapProfSampleEnd(cap, sample) /* nothing */
 #define traceHeapEvent(cap, tag, heap_capset, info1) /* nothing */
 #define traceEventHeapInfo_(heap_capset, gens, \
                             maxHeapSize, allocAreaSize, \
@@ -302,6 +370,7 @@ INLINE_HEADER void traceEventStartup_ (int n_caps STG_UNUSED) {};
 #define traceCapEvent(cap, tag) /* nothing */
 #define traceCapsetEvent(tag, capset, info) /* nothing */
 #define traceWallClockTime_() /* nothing */
+#define traceClockSource_() /* nothing */
 #define traceOSProcessInfo_() /* nothing */
 #define traceSparkCounters_(cap, counters, remaining) /* nothing */
 #define traceTaskCreate_(taskID, cap) /* nothing */
@@ -338,6 +407,8 @@ void dtraceUserMarkerWrapper(Capability *cap, char *msg);
     HASKELLEVENT_MIGRATE_THREAD(cap, tid, new_cap)
 #define dtraceThreadWakeup(cap, tid, other_cap)         \
     HASKELLEVENT_THREAD_WAKEUP(cap, tid, other_cap)
+#define dtraceStmAbort(cap, tid, tvar, aborts)          \
+    HASKELLEVENT_STM_ABORT(cap, tid, tvar, aborts)
 #define dtraceGcStart(cap)                              \
     HASKELLEVENT_GC_START(cap)
 #define dtraceGcEnd(cap)                                \
@@ -428,6 +499,36 @@ INLINE_HEADER void dtraceStartup (int num_caps) {
 #define dtraceTaskDelete(taskID)                        \
     HASKELLEVENT_TASK_DELETE(taskID)
 
+// These probes have no eventlog counterpart, so they are called
+// directly rather than from a trace*() function.  Some of them are
+// on hot paths (allocGroup()), so each checks that its probe is
+// enabled before evaluating the arguments.
+#define DTRACE_IF_ENABLED(probe, args)                  \
+    do {                                                \
+        if (RTS_UNLIKELY(HASKELLEVENT_##probe##_ENABLED())) { \
+            HASKELLEVENT_##probe args;                  \
+        }                                               \
+    } while (0)
+
+#define dtraceStmCommit(cap, tid)                       \
+    DTRACE_IF_ENABLED(STM_COMMIT, (cap, tid))
+#define dtraceMVarBlock(cap, tid, mvar)                 \
+    DTRACE_IF_ENABLED(MVAR_BLOCK, (cap, tid, mvar))
+#define dtraceMVarWakeup(cap, tid, mvar)                \
+    DTRACE_IF_ENABLED(MVAR_WAKEUP, (cap, tid, mvar))
+#define dtraceBlackHoleBlock(cap, tid, owner)           \
+    DTRACE_IF_ENABLED(BLACKHOLE_BLOCK, (cap, tid, owner))
+#define dtraceFfiSuspend(cap, tid, interruptible)       \
+    DTRACE_IF_ENABLED(FFI_SUSPEND, (cap, tid, interruptible))
+#define dtraceFfiResume(cap, tid)                       \
+    DTRACE_IF_ENABLED(FFI_RESUME, (cap, tid))
+#define dtraceBlockAlloc(node, n)                       \
+    DTRACE_IF_ENABLED(BLOCK_ALLOC, (node, n))
+#define dtraceMBlockAlloc(node, n, addr)                \
+    DTRACE_IF_ENABLED(MBLOCK_ALLOC, (node, n, addr))
+#define dtraceMBlockFree(n, addr)                       \
+    DTRACE_IF_ENABLED(MBLOCK_FREE, (n, addr))
+
 #else /* !defined(DTRACE) */
 
 #define dtraceCreateThread(cap, tid)                    /* nothing */
@@ -436,6 +537,7 @@ INLINE_HEADER void dtraceStartup (int num_caps) {
 #define dtraceThreadRunnable(cap, tid)                  /* nothing */
 #define dtraceMigrateThread(cap, tid, new_cap)          /* nothing */
 #define dtraceThreadWakeup(cap, tid, other_cap)         /* nothing */
+#define dtraceStmAbort(cap, tid, tvar, aborts)          /* nothing */
 #define dtraceGcStart(cap)                              /* nothing */
 #define dtraceGcEnd(cap)                                /* nothing */
 #define dtraceRequestSeqGc(cap)                         /* nothing */
@@ -480,6 +582,15 @@ INLINE_HEADER void dtraceStartup (int num_caps STG_UNUSED) {};
 #define dtraceTaskCreate(taskID, cap, tid)              /* nothing */
 #define dtraceTaskMigrate(taskID, cap, new_cap)         /* nothing */
 #define dtraceTaskDelete(taskID)                        /* nothing */
+#define dtraceStmCommit(cap, tid)                       /* nothing */
+#define dtraceMVarBlock(cap, tid, mvar)                 /* nothing */
+#define dtraceMVarWakeup(cap, tid, mvar)                /* nothing */
+#define dtraceBlackHoleBlock(cap, tid, owner)           /* nothing */
+#define dtraceFfiSuspend(cap, tid, interruptible)       /* nothing */
+#define dtraceFfiResume(cap, tid)                       /* nothing */
+#define dtraceBlockAlloc(node, n)                       /* nothing */
+#define dtraceMBlockAlloc(node, n, addr)                /* nothing */
+#define dtraceMBlockFree(n, addr)                       /* nothing */
 
 #endif
 
@@ -524,6 +635,16 @@ INLINE_HEADER void traceEventStopThread(Capability          *cap    STG_UNUSED,
                      (EventThreadStatus)status, (EventThreadID)info);
 }
 
+INLINE_HEADER void traceEventThreadUsage(Capability *cap       STG_UNUSED,
+                                         StgTSO     *tso       STG_UNUSED,
+                                         StgWord64   cpu_time  STG_UNUSED,
+                                         StgWord64   allocated STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        traceEventThreadUsage_(cap, tso, cpu_time, allocated);
+    }
+}
+
 // needs to be EXTERN_INLINE as it is used in another EXTERN_INLINE function
 EXTERN_INLINE void traceEventThreadRunnable(Capability *cap STG_UNUSED, 
                                             StgTSO     *tso STG_UNUSED);
@@ -577,6 +698,54 @@ INLINE_HEADER void traceEventThreadWakeup(Capability *cap       STG_UNUSED,
                        (EventCapNo)other_cap);
 }
 
+INLINE_HEADER void traceEventStmAbort(Capability *cap    STG_UNUSED,
+                                      StgTSO     *tso    STG_UNUSED,
+                                      StgTVar    *tvar   STG_UNUSED,
+                                      nat         aborts STG_UNUSED)
+{
+    traceSchedEvent2(cap, EVENT_STM_ABORT, tso, (W_)tvar, aborts);
+    dtraceStmAbort((EventCapNo)cap->no, (EventThreadID)tso->id,
+                   (W_)tvar, aborts);
+}
+
+/*
+ * How many stack frames raiseExceptionHelper() looked at to find the
+ * handler (the handler's included), and how many were update frames.
+ */
+INLINE_HEADER void traceEventExceptionRaise(Capability *cap     STG_UNUSED,
+                                            StgTSO     *tso     STG_UNUSED,
+                                            nat         frames  STG_UNUSED,
+                                            nat         updates STG_UNUSED)
+{
+    traceSchedEvent2(cap, EVENT_EXCEPTION_RAISE, tso, frames, updates);
+}
+
+/*
+ * How long threads wait on black holes: traceBlackHoleBlock() notes
+ * when a thread blocked, if scheduler events are being traced, and
+ * traceEventBlackHoleWait() posts EVENT_BLACKHOLE_WAIT when it's woken.
+ */
+INLINE_HEADER void traceBlackHoleBlock(StgTSO *tso STG_UNUSED)
+{
+#ifdef TRACING
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        tso->blackhole_since = getTimestampNSec();
+    }
+#endif
+}
+
+INLINE_HEADER void traceEventBlackHoleWait(Capability *cap STG_UNUSED,
+                                           StgTSO     *tso STG_UNUSED)
+{
+#ifdef TRACING
+    if (RTS_UNLIKELY(tso->blackhole_since != 0)) {
+        traceSchedEvent2(cap, EVENT_BLACKHOLE_WAIT, tso,
+                         getTimestampNSec() - tso->blackhole_since, 0);
+        tso->blackhole_since = 0;
+    }
+#endif
+}
+
 INLINE_HEADER void traceThreadLabel(Capability *cap   STG_UNUSED,
                                     StgTSO     *tso   STG_UNUSED,
                                     char       *label STG_UNUSED)
@@ -669,6 +838,34 @@ INLINE_HEADER void traceEventGcStats(Capability *cap            STG_UNUSED,
                        par_n_threads, par_max_copied, par_tot_copied);
 }
 
+INLINE_HEADER void traceEventGcPhases(Capability *cap    STG_UNUSED,
+                                      Time       *phases STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventGcPhases_(cap, phases);
+    }
+}
+
+INLINE_HEADER void traceEventGcSync(Capability *cap         STG_UNUSED,
+                                    Time        sync        STG_UNUSED,
+                                    nat         last_cap    STG_UNUSED,
+                                    StgWord64   last_thread STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventGcSync_(cap, sync, last_cap, last_thread);
+    }
+}
+
+INLINE_HEADER void traceEventHwCounters(Capability *cap    STG_UNUSED,
+                                        EventCapNo  capno  STG_UNUSED,
+                                        StgWord16   kind   STG_UNUSED,
+                                        StgWord64  *counts STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceEventHwCounters_(cap, capno, kind, counts);
+    }
+}
+
 INLINE_HEADER void traceEventHeapInfo(CapsetID    heap_capset   STG_UNUSED,
                                       nat         gens          STG_UNUSED,
                                       W_        maxHeapSize   STG_UNUSED,
@@ -760,6 +957,11 @@ INLINE_HEADER void traceWallClockTime(void)
     /* Note: no DTrace equivalent because it is available to DTrace directly */
 }
 
+INLINE_HEADER void traceClockSource(void)
+{
+    traceClockSource_();
+}
+
 INLINE_HEADER void traceOSProcessInfo(void)
 {
     traceOSProcessInfo_();
@@ -32,6 +32,11 @@
  *
  * Both popWSDeque and stealWSDeque also return NULL when the queue is empty.
  *
+ * A reader can also claim several elements at once with
+ * stealManyWSDeque_(), by moving top past all of them with a single
+ * cas.  This is only safe if the owner never uses popWSDeque(); see
+ * the comment on stealManyWSDeque_().
+ *
  * Testing: see testsuite/tests/rts/testwsdeque.c.  If
  * there's anything wrong with the deque implementation, this test
  * will probably catch it.
@@ -225,6 +230,59 @@ stealWSDeque (WSDeque *q)
     return stolen;
 }
 
+/* -----------------------------------------------------------------------------
+ * stealManyWSDeque_
+ *
+ * Steal up to half of the elements in the deque, and at most max, in
+ * one go.  The elements are copied out before the cas on top, which
+ * then claims all of them at once: if another thief got in first the
+ * cas fails and we return 0, just as stealWSDeque_() returns NULL.
+ * Pushes by the owner cannot overwrite the slots we read, because
+ * pushWSDeque() never writes to a slot between top and bottom.
+ *
+ * popWSDeque() is another matter.  It takes the bottom element without
+ * a cas whenever it sees more than one element, relying on thieves
+ * only ever taking the element at top.  A thief claiming n elements
+ * could then take one that the owner has already popped, so this must
+ * only be used on deques whose owner takes its own elements with
+ * stealWSDeque_() as well.  Spark pools are such deques (see
+ * findSpark()); the GC's todo_q deques are not.
+ * -------------------------------------------------------------------------- */
+
+StgWord
+stealManyWSDeque_ (WSDeque *q, void **elems, StgWord max)
+{
+    StgWord b, t, n, i;
+    long size;
+
+    // NB. these loads must be ordered, as in stealWSDeque_()
+    t = q->top;
+    load_load_barrier();
+    b = q->bottom;
+
+    size = (long)b - (long)t;
+    if (size <= 0 || max == 0) {
+        return 0; /* already looks empty, abort */
+    }
+
+    // round up, so that we can still steal the last element
+    n = ((StgWord)size + 1) / 2;
+    if (n > max) {
+        n = max;
+    }
+
+    for (i = 0; i < n; i++) {
+        elems[i] = q->elements[(t + i) & q->moduloSize];
+    }
+
+    if ( !(CASTOP(&(q->top),t,t+n)) ) {
+        /* lost the race, someone else has changed top in the meantime */
+        return 0;
+    }
+
+    return n;
+}
+
 /* -----------------------------------------------------------------------------
  * pushWSQueue
  * -------------------------------------------------------------------------- */
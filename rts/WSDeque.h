@@ -62,7 +62,8 @@ typedef struct WSDeque_ {
  *
  * A WSDeque has an *owner* thread.  The owner can perform any operation;
  * other threads are only allowed to call stealWSDeque_(),
- * stealWSDeque(), looksEmptyWSDeque(), and dequeElements().
+ * stealWSDeque(), stealManyWSDeque_(), looksEmptyWSDeque(), and
+ * dequeElements().
  *
  * -------------------------------------------------------------------------- */
 
@@ -90,6 +91,13 @@ void * stealWSDeque_ (WSDeque *q);
 // NULL if the pool is empty.
 void * stealWSDeque (WSDeque *q);
 
+// Removes up to half of the elements of the deque (and at most max)
+// from the "read" end, storing them in elems[] oldest first.  Returns
+// the number removed, which is 0 if the pool is empty or if there was
+// a collision with another thief.  Only for deques whose owner never
+// calls popWSDeque(); see WSDeque.c.
+StgWord stealManyWSDeque_ (WSDeque *q, void **elems, StgWord max);
+
 // "guesses" whether a deque is empty. Can return false negatives in
 //  presence of concurrent steal() calls, and false positives in
 //  presence of a concurrent pushBottom().
@@ -97,6 +105,10 @@ EXTERN_INLINE rtsBool looksEmptyWSDeque (WSDeque* q);
 
 EXTERN_INLINE long dequeElements   (WSDeque *q);
 
+// A lower bound on the number of elements that can be pushed before
+// the deque is full.  Can be called by the owner only.
+EXTERN_INLINE long dequeSpace      (WSDeque *q);
+
 /* -----------------------------------------------------------------------------
  * PRIVATE below here
  * -------------------------------------------------------------------------- */
@@ -110,6 +122,14 @@ dequeElements (WSDeque *q)
     return ((long)b - (long)t);
 }
 
+EXTERN_INLINE long
+dequeSpace (WSDeque *q)
+{
+    // pushWSDeque() keeps one slot free.  dequeElements() can only
+    // overestimate, since thieves only ever remove elements.
+    return (long)q->moduloSize - dequeElements(q);
+}
+
 EXTERN_INLINE rtsBool
 looksEmptyWSDeque (WSDeque *q)
 {
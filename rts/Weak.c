@@ -16,6 +16,19 @@
 #include "Prelude.h"
 #include "Trace.h"
 
+#if defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+#include <unistd.h>
+#endif
+
+STATIC_INLINE void
+runCFinalizer (void (*fptr)(void), void *ptr, void *eptr, StgWord flag)
+{
+    if (flag & CFINALIZER_HAS_ENV)
+        ((void (*)(void *, void *))fptr)(eptr, ptr);
+    else
+        ((void (*)(void *))fptr)(ptr);
+}
+
 void
 runCFinalizers(StgCFinalizerList *list)
 {
@@ -24,13 +37,226 @@ runCFinalizers(StgCFinalizerList *list)
         (StgClosure *)head != &stg_NO_FINALIZER_closure;
         head = (StgCFinalizerList *)head->link)
     {
-        if (head->flag)
-            ((void (*)(void *, void *))head->fptr)(head->eptr, head->ptr);
-        else
-            ((void (*)(void *))head->fptr)(head->ptr);
+        runCFinalizer(head->fptr, head->ptr, head->eptr, head->flag);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   The C finalizer thread
+
+   The C finalizers of the weak pointers that a GC finds dead used to be
+   run by scheduleFinalizers(), at the end of the GC, with every other
+   Capability still waiting for it: a GC that frees many ForeignPtrs
+   made the pause longer by the time of all the free()s and close()s.
+
+   In the threaded RTS they are now copied out of the heap into a batch,
+   which is queued for a thread of their own to run while the program
+   carries on.  The finalizers of a weak run in the same order as
+   before, and batches are run in the order the GCs made them.  A
+   finalizer added with CFINALIZER_IN_GC in its flag is still run
+   during the GC (before any of the finalizers of the same GC that are
+   queued), and +RTS --c-finalizers-in-gc runs them all there.
+
+   The thread has a Task with running_finalizers set, so that a C
+   finalizer that calls back into Haskell fails in the same way as it
+   does in a GC (see rts_lock()).  At exit, stopCFinalizerThread() waits
+   for the queue to be empty, before the finalizers of the weaks that
+   are still alive are run.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+typedef struct {
+    void (*fptr)(void);
+    void *ptr;
+    void *eptr;
+    StgWord flag;
+} CFinalizer;
+
+typedef struct CFinalizerBatch_ {
+    struct CFinalizerBatch_ *next;
+    nat n;
+    CFinalizer fins[FLEXIBLE_ARRAY];
+} CFinalizerBatch;
+
+static Mutex            cfin_mutex;
+static Condition        cfin_wakeup;
+static Condition        cfin_done;
+static CFinalizerBatch *cfin_queue = NULL;
+static CFinalizerBatch *cfin_queue_tail = NULL;
+static rtsBool          cfin_running = rtsFalse;
+static rtsBool          cfin_stop = rtsFalse;
+#if !defined(mingw32_HOST_OS)
+static pid_t            cfin_pid;
+#endif
+
+static void OSThreadProcAttr
+cfinalizerThread (void *arg STG_UNUSED)
+{
+    CFinalizerBatch *batch;
+    CFinalizer *f;
+    Task *task;
+    nat i;
+
+    task = newBoundTask();
+    boundTaskExiting(task);
+    task->running_finalizers = rtsTrue;
+
+    ACQUIRE_LOCK(&cfin_mutex);
+    for (;;) {
+        while (cfin_queue == NULL && !cfin_stop) {
+            waitCondition(&cfin_wakeup, &cfin_mutex);
+        }
+        batch = cfin_queue;
+        if (batch == NULL) break;       // stopping, and nothing is left
+        cfin_queue = batch->next;
+        if (cfin_queue == NULL) cfin_queue_tail = NULL;
+        RELEASE_LOCK(&cfin_mutex);
+
+        for (i = 0; i < batch->n; i++) {
+            f = &batch->fins[i];
+            runCFinalizer(f->fptr, f->ptr, f->eptr, f->flag);
+        }
+        stgFree(batch);
+
+        ACQUIRE_LOCK(&cfin_mutex);
+    }
+    RELEASE_LOCK(&cfin_mutex);
+
+    freeMyTask();
+
+    ACQUIRE_LOCK(&cfin_mutex);
+    cfin_running = rtsFalse;
+    broadcastCondition(&cfin_done);
+    RELEASE_LOCK(&cfin_mutex);
+}
+
+void
+startCFinalizerThread (void)
+{
+    OSThreadId tid;
+
+    if (RtsFlags.GcFlags.cFinalizersInGC) return;
+
+    initMutex(&cfin_mutex);
+    initCondition(&cfin_wakeup);
+    initCondition(&cfin_done);
+    cfin_stop = rtsFalse;
+    cfin_running = rtsTrue;
+#if !defined(mingw32_HOST_OS)
+    cfin_pid = getpid();
+#endif
+
+    if (createOSThread(&tid, "ghc_cfinalizers", cfinalizerThread, NULL) != 0) {
+        sysErrorBelch("startCFinalizerThread: failed to create thread");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+void
+stopCFinalizerThread (void)
+{
+    if (!cfin_running) return;
+#if !defined(mingw32_HOST_OS)
+    // The thread doesn't survive forkProcess()
+    if (getpid() != cfin_pid) return;
+#endif
+
+    ACQUIRE_LOCK(&cfin_mutex);
+    cfin_stop = rtsTrue;
+    signalCondition(&cfin_wakeup);
+    while (cfin_running) {
+        waitCondition(&cfin_done, &cfin_mutex);
+    }
+    RELEASE_LOCK(&cfin_mutex);
+
+    closeCondition(&cfin_done);
+    closeCondition(&cfin_wakeup);
+    closeMutex(&cfin_mutex);
+}
+
+// In the child of forkProcess(): the thread is gone, so start another,
+// which runs the batches that were still queued.  A batch that the old
+// thread was in the middle of is lost.
+void
+resetCFinalizerThread (void)
+{
+    OSThreadId tid;
+
+    if (!cfin_running) return;
+
+    initMutex(&cfin_mutex);
+    initCondition(&cfin_wakeup);
+    initCondition(&cfin_done);
+#if !defined(mingw32_HOST_OS)
+    cfin_pid = getpid();
+#endif
+
+    if (createOSThread(&tid, "ghc_cfinalizers", cfinalizerThread, NULL) != 0) {
+        sysErrorBelch("resetCFinalizerThread: failed to create thread");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+// Run the finalizers on list that must be run in the GC, and add the
+// others to batch
+static void
+queueCFinalizers (StgCFinalizerList *list, CFinalizerBatch *batch)
+{
+    StgCFinalizerList *head;
+    CFinalizer *f;
+
+    for (head = list;
+        (StgClosure *)head != &stg_NO_FINALIZER_closure;
+        head = (StgCFinalizerList *)head->link)
+    {
+        if (head->flag & CFINALIZER_IN_GC) {
+            runCFinalizer(head->fptr, head->ptr, head->eptr, head->flag);
+        } else {
+            f = &batch->fins[batch->n++];
+            f->fptr = head->fptr;
+            f->ptr  = head->ptr;
+            f->eptr = head->eptr;
+            f->flag = head->flag;
+        }
+    }
+}
+
+// The number of finalizers on list that queueCFinalizers() would queue
+static nat
+countQueuedCFinalizers (StgCFinalizerList *list)
+{
+    StgCFinalizerList *head;
+    nat n = 0;
+
+    for (head = list;
+        (StgClosure *)head != &stg_NO_FINALIZER_closure;
+        head = (StgCFinalizerList *)head->link)
+    {
+        if (!(head->flag & CFINALIZER_IN_GC)) n++;
     }
+    return n;
+}
+
+#else /* !THREADED_RTS */
+
+void
+startCFinalizerThread (void)
+{
 }
 
+void
+stopCFinalizerThread (void)
+{
+}
+
+void
+resetCFinalizerThread (void)
+{
+}
+
+#endif /* THREADED_RTS */
+
 void
 runAllCFinalizers(StgWeak *list)
 {
@@ -51,10 +277,35 @@ runAllCFinalizers(StgWeak *list)
     }
 }
 
+/* For rts_getFinalizerCounts() */
+static StgWord64 finalizers_queued = 0;     // only written by the GC
+static volatile StgWord finalizers_completed = 0;
+
+void
+rts_getFinalizerCounts (HsWord64 *queued, HsWord64 *completed)
+{
+    *queued = finalizers_queued;
+    *completed = finalizers_completed;
+}
+
+void
+rts_finalizerDone (void)
+{
+    atomic_inc(&finalizers_completed, 1);
+}
+
+/* The fewest finalizers worth a thread of their own */
+#define MIN_FINALIZER_BATCH 32
+
 /*
  * scheduleFinalizers() is called on the list of weak pointers found
  * to be dead after a garbage collection.  It overwrites each object
- * with DEAD_WEAK, and creates a new thread to run the pending finalizers.
+ * with DEAD_WEAK, and creates new threads to run the pending finalizers:
+ * they are split into up to one batch per Capability (of at least
+ * MIN_FINALIZER_BATCH each), and as the threads are all put on this
+ * Capability's run queue, schedulePushWork() hands them out to the idle
+ * ones.  Finalizers have no order, so nothing is lost by running them
+ * at once.
  *
  * This function is called just after GC.  The weak pointers on the
  * argument list are those whose keys were found to be not reachable,
@@ -73,14 +324,34 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
     StgTSO *t;
     StgMutArrPtrs *arr;
     StgWord size;
-    nat n, i;
+    nat n, i, m, b, batches;
     Task *task;
+#if defined(THREADED_RTS)
+    CFinalizerBatch *batch = NULL;
+#endif
 
     task = myTask();
     if (task != NULL) {
         task->running_finalizers = rtsTrue;
     }
 
+#if defined(THREADED_RTS)
+    // See "The C finalizer thread" above
+    if (cfin_running) {
+        n = 0;
+        for (w = list; w; w = w->link) {
+            n += countQueuedCFinalizers((StgCFinalizerList *)w->cfinalizers);
+        }
+        if (n > 0) {
+            batch = stgMallocBytes(sizeof(CFinalizerBatch)
+                                   + n * sizeof(CFinalizer),
+                                   "scheduleFinalizers");
+            batch->next = NULL;
+            batch->n = 0;
+        }
+    }
+#endif
+
     // count number of finalizers, and kill all the weak pointers first...
     n = 0;
     for (w = list; w; w = w->link) {
@@ -92,6 +363,11 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
             n++;
         }
 
+#if defined(THREADED_RTS)
+        if (batch != NULL) {
+            queueCFinalizers((StgCFinalizerList *)w->cfinalizers, batch);
+        } else
+#endif
         runCFinalizers((StgCFinalizerList *)w->cfinalizers);
 
 #ifdef PROFILING
@@ -110,37 +386,61 @@ scheduleFinalizers(Capability *cap, StgWeak *list)
         task->running_finalizers = rtsFalse;
     }
 
+#if defined(THREADED_RTS)
+    if (batch != NULL) {
+        debugTrace(DEBUG_weak, "weak: queueing %d C finalizers", batch->n);
+        ACQUIRE_LOCK(&cfin_mutex);
+        if (cfin_queue_tail == NULL) {
+            cfin_queue = batch;
+        } else {
+            cfin_queue_tail->next = batch;
+        }
+        cfin_queue_tail = batch;
+        signalCondition(&cfin_wakeup);
+        RELEASE_LOCK(&cfin_mutex);
+    }
+#endif
+
     // No finalizers to run?
     if (n == 0) return;
 
-    debugTrace(DEBUG_weak, "weak: batching %d finalizers", n);
+    batches = stg_min(enabled_capabilities,
+                      (n + MIN_FINALIZER_BATCH - 1) / MIN_FINALIZER_BATCH);
+    finalizers_queued += n;
 
-    size = n + mutArrPtrsCardTableSize(n);
-    arr = (StgMutArrPtrs *)allocate(cap, sizeofW(StgMutArrPtrs) + size);
-    TICK_ALLOC_PRIM(sizeofW(StgMutArrPtrs), n, 0);
-    SET_HDR(arr, &stg_MUT_ARR_PTRS_FROZEN_info, CCS_SYSTEM);
-    arr->ptrs = n;
-    arr->size = size;
+    debugTrace(DEBUG_weak, "weak: batching %d finalizers in %d thread(s)",
+               n, batches);
 
-    n = 0;
-    for (w = list; w; w = w->link) {
-        if (w->finalizer != &stg_NO_FINALIZER_closure) {
-            arr->payload[n] = w->finalizer;
-            n++;
+    w = list;
+    for (b = 0; b < batches; b++) {
+        m = n / batches + (b < n % batches ? 1 : 0);
+
+        size = m + mutArrPtrsCardTableSize(m);
+        arr = (StgMutArrPtrs *)allocate(cap, sizeofW(StgMutArrPtrs) + size);
+        TICK_ALLOC_PRIM(sizeofW(StgMutArrPtrs), m, 0);
+        SET_HDR(arr, &stg_MUT_ARR_PTRS_FROZEN_info, CCS_SYSTEM);
+        arr->ptrs = m;
+        arr->size = size;
+
+        for (i = 0; i < m; w = w->link) {
+            if (w->finalizer != &stg_NO_FINALIZER_closure) {
+                arr->payload[i] = w->finalizer;
+                i++;
+            }
+        }
+        // set all the cards to 1
+        for (i = m; i < size; i++) {
+            arr->payload[i] = (StgClosure *)(W_)(-1);
         }
-    }
-    // set all the cards to 1
-    for (i = n; i < size; i++) {
-        arr->payload[i] = (StgClosure *)(W_)(-1);
-    }
 
-    t = createIOThread(cap,
-                       RtsFlags.GcFlags.initialStkSize,
-                       rts_apply(cap,
+        t = createIOThread(cap,
+                           RtsFlags.GcFlags.initialStkSize,
                            rts_apply(cap,
-                               (StgClosure *)runFinalizerBatch_closure,
-                               rts_mkInt(cap,n)),
-                           (StgClosure *)arr)
-        );
-    scheduleThread(cap,t);
+                               rts_apply(cap,
+                                   (StgClosure *)runFinalizerBatch_closure,
+                                   rts_mkInt(cap,m)),
+                               (StgClosure *)arr)
+            );
+        scheduleThread(cap,t);
+    }
 }
@@ -19,6 +19,10 @@ extern StgWeak * dead_weak_ptr_list;
 void runCFinalizers(StgCFinalizerList *list);
 void runAllCFinalizers(StgWeak *w);
 void scheduleFinalizers(Capability *cap, StgWeak *w);
+
+void startCFinalizerThread(void);
+void stopCFinalizerThread(void);
+void resetCFinalizerThread(void);
 void markWeakList(void);
 
 #include "EndPrivate.h"
@@ -15,7 +15,9 @@
 #include "Capability.h"
 #include "RtsUtils.h"
 #include "Stats.h"
+#include "GetTime.h"
 #include "EventLog.h"
+#include "PerfCounters.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -25,6 +27,10 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#if !defined(mingw32_HOST_OS)
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 // PID of the process that writes to event_log_filename (#4512)
 static pid_t event_log_pid = -1;
@@ -38,6 +44,9 @@ FILE *event_log_file = NULL;
 
 static int flushCount;
 
+// --eventlog-compact, see EventLogFormat.h
+static rtsBool compact_events = rtsFalse;
+
 // Struct for record keeping of buffer to store event types and events.
 typedef struct _EventsBuf {
   StgInt8 *begin;
@@ -45,6 +54,9 @@ typedef struct _EventsBuf {
   StgInt8 *marker;
   StgWord64 size;
   EventCapNo capno; // which capability this buffer belongs to, or -1
+  StgWord64 last_ts;         // --eventlog-compact: time of the last event
+  EventThreadID cur_thread;  // --eventlog-compact: thread of the last
+                             // EVENT_RUN_THREAD in this block, or 0
 } EventsBuf;
 
 EventsBuf *capEventBuf; // one EventsBuf for each Capability
@@ -107,6 +119,24 @@ char *EventDesc[] = {
   [EVENT_TASK_MIGRATE]        = "Task migrate",
   [EVENT_TASK_DELETE]         = "Task delete",
   [EVENT_HACK_BUG_T9003]      = "Empty event for bug #9003",
+  [EVENT_STM_ABORT]           = "STM commit failed",
+  [EVENT_USER_BINARY_MSG]     = "User binary message",
+  [EVENT_USER_BINARY_TYPE]    = "User binary message type",
+  [EVENT_GC_PHASES]           = "GC phase times",
+  [EVENT_HW_COUNTERS]         = "Hardware counters",
+  [EVENT_STACK_SAMPLE]        = "Stack sample",
+  [EVENT_THREAD_USAGE]        = "Thread CPU time and allocation",
+  [EVENT_ALLOC_SAMPLE]        = "Allocation sample",
+  [EVENT_BLACKHOLE_WAIT]      = "Blocked on black hole",
+  [EVENT_CLOCK_SOURCE]        = "Timestamp clock",
+  [EVENT_HEAP_PROF_BEGIN]     = "Start of heap profile",
+  [EVENT_HEAP_PROF_BAND]      = "Heap profile band",
+  [EVENT_HEAP_PROF_SAMPLE_BEGIN] = "Start of heap profile sample",
+  [EVENT_HEAP_PROF_SAMPLE]    = "Heap profile sample",
+  [EVENT_HEAP_PROF_SAMPLE_END] = "End of heap profile sample",
+  [EVENT_STOP_CUR_THREAD]     = "Stop current thread",
+  [EVENT_EXCEPTION_RAISE]     = "Exception raised",
+  [EVENT_GC_SYNC]             = "GC sync",
 };
 
 // Event type.
@@ -119,6 +149,108 @@ typedef struct _EventType {
 
 EventType eventTypes[NUM_GHC_EVENT_TAGS];
 
+#ifdef THREADED_RTS
+/* -----------------------------------------------------------------------------
+   The background writer (+RTS --eventlog-async)
+
+   Normally printAndClearEventBuf() writes a full buffer to the log
+   straight away, which stalls whichever thread happened to fill it.
+   With the background writer, the contents of the buffer are instead
+   swapped with an empty chunk and the full chunk is pushed onto
+   pending_chunks, a lock-free stack, for the writer thread to pick up.
+
+   The writer takes the whole stack with xchg(), reverses it so that
+   each capability's blocks are written in the order they were filled,
+   writes them out, and puts the chunks back on free_chunks.
+
+   To bound the memory used, a thread that finds EVENTLOG_MAX_PENDING
+   chunks waiting blocks until the writer has caught up.
+   -------------------------------------------------------------------------- */
+
+#define EVENTLOG_MAX_PENDING 32
+
+typedef struct _EventLogChunk {
+    struct _EventLogChunk *link;
+    StgInt8   *buf;
+    StgWord64  alloc;       // size of buf
+    StgWord64  len;         // bytes of events in buf
+} EventLogChunk;
+
+static EventLogChunk * volatile pending_chunks = NULL;
+static volatile StgWord n_pending_chunks = 0;
+
+static EventLogChunk *free_chunks = NULL;   // protected by free_chunks_lock
+static SpinLock free_chunks_lock;
+
+static rtsBool writer_running = rtsFalse;   // these are protected by
+static rtsBool writer_busy    = rtsFalse;   // writer_mutex
+static rtsBool writer_stop    = rtsFalse;
+static Mutex     writer_mutex;
+static Condition writer_wakeup;             // there is work
+static Condition writer_idle;               // a batch has been written
+
+static void startEventLogWriter (void);
+static void stopEventLogWriter (void);
+static void handOffEventBuf (EventsBuf *ebuf);
+#endif
+
+/* -----------------------------------------------------------------------------
+   The flight recorder (+RTS --eventlog-ring=<size>)
+
+   Instead of writing out each full buffer, we keep the last few in
+   memory, in a ring per capability (and one for eventBuf), overwriting
+   the oldest.  dumpEventLog() writes the header, the rings and what is
+   in the buffers out as a complete eventlog, replacing the previous
+   dump.  That happens at exit (including barf() and stg_exit()), on
+   SIGUSR2, and when hs_dump_eventlog() is called; the last two set
+   performEventLogDump, and the scheduler does the dump next time it
+   has stopped all the capabilities (see scheduleDoGC()).
+   -------------------------------------------------------------------------- */
+
+typedef struct _EventRing {
+    StgInt8  **blocks;          // ring_n_blocks buffers, NULL until used
+    StgWord64 *lens;            // bytes of events in each one
+    nat        next;            // the one to overwrite next
+} EventRing;
+
+#define RING_BLOCKS 4
+
+static EventRing *capEventRing = NULL;      // one for each Capability
+static EventRing  globalEventRing;          // for eventBuf
+static nat        ring_n_blocks;
+static StgWord64  ring_block_size;
+static char      *ring_dump_filename = NULL;
+static rtsBool    ring_closed = rtsFalse;   // endEventLogging() has run
+
+volatile rtsBool performEventLogDump = rtsFalse;
+
+static void initEventRing (EventRing *r);
+static void freeEventRing (EventRing *r);
+static void pushEventRing (EventsBuf *ebuf);
+
+/* -----------------------------------------------------------------------------
+   Subscribers (rts_subscribeEventLog())
+
+   We keep a copy of the header, so that a subscriber can be sent it
+   first whenever it subscribes.  After that it gets each buffer as it
+   is written out, by printAndClearEventBuf() or pushEventRing().  To
+   keep the stream flowing when buffers fill slowly, the scheduler
+   also calls flushEventLogBuffers() after each GC while there is a
+   subscriber (but not with --eventlog-ring, where it would waste the
+   ring on small blocks).
+   -------------------------------------------------------------------------- */
+
+static StgInt8   *event_log_header = NULL;
+static StgWord64  event_log_header_len;
+
+static EventLogSubscriber subscriber_fn = NULL;  // protected by
+static void *subscriber_data = NULL;             // subscriber_mutex
+#ifdef THREADED_RTS
+static Mutex subscriber_mutex;
+#endif
+
+static void sendToSubscriber (StgInt8 *buf, StgWord64 len);
+
 static void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno);
 static void resetEventsBuf(EventsBuf* eb);
 static void printAndClearEventBuf (EventsBuf *eventsBuf);
@@ -133,6 +265,8 @@ static void closeBlockMarker(EventsBuf *ebuf);
 static StgBool hasRoomForEvent(EventsBuf *eb, EventTypeNum eNum);
 static StgBool hasRoomForVariableEvent(EventsBuf *eb, nat payload_bytes);
 
+static FILE *openEventLogSink(rtsBool forked);
+
 static inline void postWord8(EventsBuf *eb, StgWord8 i)
 {
     *(eb->pos++) = i;
@@ -163,7 +297,7 @@ static inline void postBuf(EventsBuf *eb, StgWord8 *buf, nat size)
 }
 
 static inline StgWord64 time_ns(void)
-{ return TimeToNS(stat_getElapsedTime()); }
+{ return TimeToNS(stat_getElapsedTimestamp()); }
 
 static inline void postEventTypeNum(EventsBuf *eb, EventTypeNum etNum)
 { postWord16(eb, etNum); }
@@ -195,10 +329,52 @@ static inline void postTaskId(EventsBuf *eb, EventTaskId tUniq)
 static inline void postPayloadSize(EventsBuf *eb, EventPayloadSize size)
 { postWord16(eb,size); }
 
+static inline void postVarint(EventsBuf *eb, StgWord64 n)
+{
+    while (n >= 0x80) {
+        postWord8(eb, (StgWord8)(n | 0x80));
+        n >>= 7;
+    }
+    postWord8(eb, (StgWord8)n);
+}
+
+static inline void postSVarint(EventsBuf *eb, StgInt64 n)
+{ postVarint(eb, n >= 0 ? (StgWord64)n << 1 : ~((StgWord64)n << 1)); }
+
+// The most that the header of an event in the compact format can take
+#define MAX_COMPACT_HEADER_SIZE (sizeof(StgWord8) + 10)
+
+static inline nat eventHeaderRoom(void)
+{
+    return compact_events ? MAX_COMPACT_HEADER_SIZE
+                          : sizeof(EventTypeNum) + sizeof(EventTimestamp);
+}
+
+static inline nat blockMarkerHeaderSize(void)
+{
+    return (compact_events ? sizeof(StgWord8) : sizeof(EventTypeNum))
+        + sizeof(EventTimestamp);
+}
+
+// Event types are below 0xff, so in the compact format they take a
+// byte; 0xff is left for EVENT_DATA_END, which is posted with
+// postEventTypeNum().
+static inline void postEventHeaderAt(EventsBuf *eb, EventTypeNum type,
+                                     EventTimestamp ts)
+{
+    if (compact_events) {
+        postWord8(eb, (StgWord8)type);
+        postSVarint(eb, (StgInt64)(ts - eb->last_ts));
+        eb->last_ts = ts;
+    } else {
+        postEventTypeNum(eb, type);
+        postWord64(eb, ts);
+    }
+}
+
 static inline void postEventHeader(EventsBuf *eb, EventTypeNum type)
 {
-    postEventTypeNum(eb, type);
-    postTimestamp(eb);
+    postEventHeaderAt(eb, type, time_ns());
 }
 
 static inline void postInt8(EventsBuf *eb, StgInt8 i)
@@ -214,6 +390,7 @@ initEventLogging(void)
     StgWord8 t, c;
     nat n_caps;
     char *prog;
+    rtsBool forked = (event_log_pid != -1);
 
     prog = stgMallocBytes(strlen(prog_name) + 1, "initEventLogging");
     strcpy(prog, prog_name);
@@ -228,6 +405,8 @@ initEventLogging(void)
     }
 #endif
 
+    compact_events = RtsFlags.TraceFlags.compact;
+
     event_log_filename = stgMallocBytes(strlen(prog)
                                         + 10 /* .%d */
                                         + 10 /* .eventlog */,
@@ -253,10 +432,31 @@ initEventLogging(void)
     }
     stgFree(prog);
 
-    /* Open event log file for writing. */
-    if ((event_log_file = fopen(event_log_filename, "wb")) == NULL) {
-        sysErrorBelch("initEventLogging: can't open %s", event_log_filename);
-        stg_exit(EXIT_FAILURE);
+    if (RtsFlags.TraceFlags.ring_size != 0) {
+        char *sink = forked ? NULL : RtsFlags.TraceFlags.sink;
+
+        // a dump replaces the previous one, so it has to be a file
+        if (sink != NULL && !strncmp(sink, "file:", 5)) {
+            sink += 5;
+        } else if (sink != NULL && (!strncmp(sink, "fd:", 3) ||
+                                    !strncmp(sink, "unix:", 5) ||
+                                    !strcmp(sink, "none"))) {
+            errorBelch("warning: --eventlog-ring writes to a file; "
+                       "ignoring --eventlog-sink=%s", sink);
+            sink = NULL;
+        }
+        ring_dump_filename = sink != NULL ? sink : event_log_filename;
+
+        ring_block_size = RtsFlags.TraceFlags.ring_size / RING_BLOCKS;
+        if (ring_block_size > EVENT_LOG_SIZE) {
+            ring_block_size = EVENT_LOG_SIZE;
+        }
+        ring_n_blocks = RtsFlags.TraceFlags.ring_size / ring_block_size;
+        ring_closed = rtsFalse;
+        initEventRing(&globalEventRing);
+    } else {
+        /* Open event log file for writing. */
+        event_log_file = openEventLogSink(forked);
     }
 
     /*
@@ -303,6 +503,20 @@ initEventLogging(void)
                 sizeof(EventThreadID) + sizeof(EventCapNo);
             break;
 
+        case EVENT_STM_ABORT:       // (cap, thread, tvar, aborts)
+            eventTypes[t].size =
+                sizeof(EventThreadID) + sizeof(StgWord64) + sizeof(StgWord32);
+            break;
+
+        case EVENT_BLACKHOLE_WAIT:  // (cap, thread, wait)
+            eventTypes[t].size = sizeof(EventThreadID) + sizeof(StgWord64);
+            break;
+
+        case EVENT_EXCEPTION_RAISE: // (cap, thread, frames, updates)
+            eventTypes[t].size =
+                sizeof(EventThreadID) + 2 * sizeof(StgWord32);
+            break;
+
         case EVENT_STOP_THREAD:     // (cap, thread, status)
             eventTypes[t].size = sizeof(EventThreadID)
                                + sizeof(StgWord16)
@@ -343,6 +557,24 @@ initEventLogging(void)
                 sizeof(EventCapsetID) + sizeof(StgWord64) + sizeof(StgWord32);
             break;
 
+        case EVENT_CLOCK_SOURCE:    // (clock, counter_hz, resolution_ns)
+            eventTypes[t].size = sizeof(StgWord16) + 2 * sizeof(StgWord64);
+            break;
+
+        case EVENT_HEAP_PROF_BEGIN:        // (breakdown, interval_ns)
+        case EVENT_HEAP_PROF_SAMPLE_BEGIN: // (sample, mut_time_ns)
+        case EVENT_HEAP_PROF_SAMPLE:       // (band, bytes)
+            eventTypes[t].size = sizeof(StgWord32) + sizeof(StgWord64);
+            break;
+
+        case EVENT_HEAP_PROF_SAMPLE_END:   // (sample)
+            eventTypes[t].size = sizeof(StgWord32);
+            break;
+
+        case EVENT_STOP_CUR_THREAD: // (cap, status, blocked_on)
+            eventTypes[t].size = sizeof(StgWord16) + sizeof(EventThreadID);
+            break;
+
         case EVENT_SPARK_STEAL:     // (cap, victim_cap)
             eventTypes[t].size =
                 sizeof(EventCapNo);
@@ -372,6 +604,10 @@ initEventLogging(void)
         case EVENT_PROGRAM_ARGS:     // (capset, strvec)
         case EVENT_PROGRAM_ENV:      // (capset, strvec)
         case EVENT_THREAD_LABEL:     // (thread, str)
+        case EVENT_USER_BINARY_MSG:  // (id, bytes)
+        case EVENT_USER_BINARY_TYPE: // (id, str)
+        case EVENT_STACK_SAMPLE:     // (thread, frames)
+        case EVENT_HEAP_PROF_BAND:   // (band, name)
             eventTypes[t].size = 0xffff;
             break;
 
@@ -379,6 +615,25 @@ initEventLogging(void)
             eventTypes[t].size = 7 * sizeof(StgWord64);
             break;
 
+        case EVENT_GC_PHASES:        // (cap, N_GC_PHASES*time)
+            eventTypes[t].size = N_GC_PHASES * sizeof(StgWord64);
+            break;
+
+        case EVENT_GC_SYNC:          // (cap, sync, last_cap, last_thread)
+            eventTypes[t].size = sizeof(StgWord64) + sizeof(EventCapNo)
+                               + sizeof(EventThreadID);
+            break;
+
+        case EVENT_THREAD_USAGE:     // (cap, thread, cpu_time, allocated)
+            eventTypes[t].size =
+                sizeof(EventThreadID) + 2 * sizeof(StgWord64);
+            break;
+
+        case EVENT_HW_COUNTERS:      // (cap, cap, kind, 4*count)
+            eventTypes[t].size = sizeof(EventCapNo) + sizeof(StgWord16)
+                + PERF_N_COUNTERS * sizeof(StgWord64);
+            break;
+
         case EVENT_HEAP_ALLOCATED:    // (heap_capset, alloc_bytes)
         case EVENT_HEAP_SIZE:         // (heap_capset, size_bytes)
         case EVENT_HEAP_LIVE:         // (heap_capset, live_bytes)
@@ -443,14 +698,28 @@ initEventLogging(void)
     postInt32(&eventBuf, EVENT_HEADER_END);
 
     // Prepare event buffer for events (data).
-    postInt32(&eventBuf, EVENT_DATA_BEGIN);
+    postInt32(&eventBuf, compact_events ? EVENT_DATA_BEGIN_COMPACT
+                                        : EVENT_DATA_BEGIN);
 
     // Flush capEventBuf with header.
     /*
      * Flush header and data begin marker to the file, thus preparing the
      * file to have events written to it.
      */
-    printAndClearEventBuf(&eventBuf);
+    // keep the header for subscribers and --eventlog-ring dumps
+    event_log_header_len = eventBuf.pos - eventBuf.begin;
+    event_log_header = stgMallocBytes(event_log_header_len,
+                                      "initEventLogging");
+    memcpy(event_log_header, eventBuf.begin, event_log_header_len);
+
+    if (RtsFlags.TraceFlags.ring_size != 0) {
+        // make eventBuf the same size as the blocks of its ring
+        stgFree(eventBuf.begin);
+        initEventsBuf(&eventBuf, ring_block_size, (EventCapNo)(-1));
+        postBlockMarker(&eventBuf);
+    } else {
+        printAndClearEventBuf(&eventBuf);
+    }
 
     for (c = 0; c < n_caps; ++c) {
         postBlockMarker(&capEventBuf[c]);
@@ -458,14 +727,121 @@ initEventLogging(void)
 
 #ifdef THREADED_RTS
     initMutex(&eventBufMutex);
+    initMutex(&subscriber_mutex);
+
+    // nothing to write in the background with --eventlog-ring or
+    // --eventlog-sink=none
+    if (RtsFlags.TraceFlags.async_writer && event_log_file != NULL) {
+        startEventLogWriter();
+    }
 #endif
 }
 
+/*
+ * Open the destination for the eventlog, as given by
+ * +RTS --eventlog-sink.  A forked child always writes to its own
+ * <program>.<pid>.eventlog file, since it can't share the parent's
+ * descriptor or socket (#4512).
+ */
+static FILE *
+openEventLogSink(rtsBool forked)
+{
+    char *sink = forked ? NULL : RtsFlags.TraceFlags.sink;
+    FILE *f;
+
+    if (sink != NULL && !strcmp(sink, "none")) {
+        f = NULL;       // only for subscribers
+    }
+    else if (sink == NULL) {
+        f = fopen(event_log_filename, "wb");
+        if (f == NULL) {
+            sysErrorBelch("initEventLogging: can't open %s",
+                          event_log_filename);
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+    else if (!strncmp(sink, "fd:", 3)) {
+        char *end;
+        long fd = strtol(sink+3, &end, 10);
+        if (end == sink+3 || *end != '\0' || fd < 0) {
+            errorBelch("initEventLogging: bad eventlog sink %s", sink);
+            stg_exit(EXIT_FAILURE);
+        }
+        f = fdopen((int)fd, "wb");
+        if (f == NULL) {
+            sysErrorBelch("initEventLogging: can't write to fd %ld", fd);
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+    else if (!strncmp(sink, "unix:", 5)) {
+#if defined(mingw32_HOST_OS)
+        errorBelch("initEventLogging: unix sockets are not supported "
+                   "on this platform");
+        stg_exit(EXIT_FAILURE);
+#else
+        struct sockaddr_un addr;
+        int fd;
+
+        if (strlen(sink+5) >= sizeof(addr.sun_path)) {
+            errorBelch("initEventLogging: socket path too long: %s", sink+5);
+            stg_exit(EXIT_FAILURE);
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, sink+5);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 ||
+            connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            sysErrorBelch("initEventLogging: can't connect to %s", sink+5);
+            stg_exit(EXIT_FAILURE);
+        }
+        f = fdopen(fd, "wb");
+        if (f == NULL) {
+            sysErrorBelch("initEventLogging: fdopen");
+            stg_exit(EXIT_FAILURE);
+        }
+#endif
+    }
+    else {
+        if (!strncmp(sink, "file:", 5)) {
+            sink += 5;
+        }
+        f = fopen(sink, "wb");
+        if (f == NULL) {
+            sysErrorBelch("initEventLogging: can't open %s", sink);
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+
+    return f;
+}
+
 void
 endEventLogging(void)
 {
     nat c;
 
+    if (RtsFlags.TraceFlags.ring_size != 0) {
+        if (!ring_closed) {
+            StgWord8 end[2];
+
+            dumpEventLog();
+            ring_closed = rtsTrue;
+
+            end[0] = (StgWord8)(EVENT_DATA_END >> 8);
+            end[1] = (StgWord8)EVENT_DATA_END;
+            sendToSubscriber((StgInt8*)end, sizeof(end));
+            rts_unsubscribeEventLog();
+        }
+        return;
+    }
+
+#ifdef THREADED_RTS
+    // Let the background writer finish; the rest is written directly.
+    stopEventLogWriter();
+#endif
+
     // Flush all events remaining in the buffers.
     for (c = 0; c < n_capabilities; ++c) {
         printAndClearEventBuf(&capEventBuf[c]);
@@ -479,6 +855,9 @@ endEventLogging(void)
     // Flush the end of data marker.
     printAndClearEventBuf(&eventBuf);
 
+    // that was the last thing a subscriber gets
+    rts_unsubscribeEventLog();
+
     if (event_log_file != NULL) {
         fclose(event_log_file);
     }
@@ -497,8 +876,23 @@ moreCapEventBufs (nat from, nat to)
                                      "moreCapEventBufs");
     }
 
-    for (c = from; c < to; ++c) {
-        initEventsBuf(&capEventBuf[c], EVENT_LOG_SIZE, c);
+    if (RtsFlags.TraceFlags.ring_size != 0) {
+        if (from > 0) {
+            capEventRing = stgReallocBytes(capEventRing,
+                                           to * sizeof(EventRing),
+                                           "moreCapEventBufs");
+        } else {
+            capEventRing = stgMallocBytes(to * sizeof(EventRing),
+                                          "moreCapEventBufs");
+        }
+        for (c = from; c < to; ++c) {
+            initEventRing(&capEventRing[c]);
+            initEventsBuf(&capEventBuf[c], ring_block_size, c);
+        }
+    } else {
+        for (c = from; c < to; ++c) {
+            initEventsBuf(&capEventBuf[c], EVENT_LOG_SIZE, c);
+        }
     }
 
     // The from == 0 already covered in initEventLogging, so we are interested
@@ -525,22 +919,175 @@ freeEventLogging(void)
     if (capEventBuf != NULL)  {
         stgFree(capEventBuf);
     }
+    if (capEventRing != NULL) {
+        for (c = 0; c < n_capabilities; ++c) {
+            freeEventRing(&capEventRing[c]);
+        }
+        stgFree(capEventRing);
+        capEventRing = NULL;
+        freeEventRing(&globalEventRing);
+    }
+    if (event_log_header != NULL) {
+        stgFree(event_log_header);
+        event_log_header = NULL;
+    }
     if (event_log_filename != NULL) {
         stgFree(event_log_filename);
     }
 }
 
+/*
+ * --eventlog-ring: write out the header, the rings and the current
+ * buffers as an eventlog, replacing the previous dump.  Must be called
+ * when no capability is posting events (or at exit).  Anything else:
+ * just flush the eventlog.
+ */
+void
+dumpEventLog(void)
+{
+    FILE *f;
+    nat c, i, j;
+    EventRing *r;
+    StgWord8 end[2];
+
+    if (RtsFlags.TraceFlags.ring_size == 0) {
+        flushEventLog();
+        return;
+    }
+    if (ring_closed || capEventRing == NULL) return;
+
+    // Move what is in the buffers into the rings
+    for (c = 0; c < n_capabilities; ++c) {
+        pushEventRing(&capEventBuf[c]);
+    }
+    ACQUIRE_LOCK(&eventBufMutex);
+    pushEventRing(&eventBuf);
+
+    f = fopen(ring_dump_filename, "wb");
+    if (f == NULL) {
+        sysErrorBelch("dumpEventLog: can't open %s", ring_dump_filename);
+        RELEASE_LOCK(&eventBufMutex);
+        return;
+    }
+
+    fwrite(event_log_header, 1, event_log_header_len, f);
+    for (c = 0; c <= n_capabilities; ++c) {
+        r = c < n_capabilities ? &capEventRing[c] : &globalEventRing;
+        // oldest first
+        for (i = 0; i < ring_n_blocks; ++i) {
+            j = (r->next + i) % ring_n_blocks;
+            if (r->blocks[j] != NULL && r->lens[j] != 0) {
+                fwrite(r->blocks[j], 1, r->lens[j], f);
+            }
+        }
+    }
+    end[0] = (StgWord8)(EVENT_DATA_END >> 8);
+    end[1] = (StgWord8)EVENT_DATA_END;
+    fwrite(end, 1, sizeof(end), f);
+
+    if (fclose(f) != 0) {
+        sysErrorBelch("dumpEventLog: can't write %s", ring_dump_filename);
+    }
+    RELEASE_LOCK(&eventBufMutex);
+}
+
 void
 flushEventLog(void)
 {
+#ifdef THREADED_RTS
+    if (writer_running) {
+        ACQUIRE_LOCK(&writer_mutex);
+        while (pending_chunks != NULL || writer_busy) {
+            waitCondition(&writer_idle, &writer_mutex);
+        }
+        RELEASE_LOCK(&writer_mutex);
+    }
+#endif
     if (event_log_file != NULL) {
         fflush(event_log_file);
     }
 }
 
+/*
+ * Write out what is in the buffers now, for subscribers.  Must be
+ * called when no capability is posting events.
+ */
+void
+flushEventLogBuffers(void)
+{
+    nat c;
+
+    for (c = 0; c < n_capabilities; ++c) {
+        printAndClearEventBuf(&capEventBuf[c]);
+    }
+    ACQUIRE_LOCK(&eventBufMutex);
+    printAndClearEventBuf(&eventBuf);
+    RELEASE_LOCK(&eventBufMutex);
+}
+
+rtsBool
+eventLogSubscribed(void)
+{
+    return subscriber_fn != NULL && RtsFlags.TraceFlags.ring_size == 0;
+}
+
+static void
+sendToSubscriber (StgInt8 *buf, StgWord64 len)
+{
+    if (subscriber_fn == NULL) return;
+
+    ACQUIRE_LOCK(&subscriber_mutex);
+    if (subscriber_fn != NULL) {
+        subscriber_fn(subscriber_data, (const StgWord8*)buf, (StgWord)len);
+    }
+    RELEASE_LOCK(&subscriber_mutex);
+}
+
+rtsBool
+rts_subscribeEventLog (EventLogSubscriber fn, void *user)
+{
+    if (event_log_header == NULL) {
+        return rtsFalse; // not logging events (yet, or any more)
+    }
+
+    ACQUIRE_LOCK(&subscriber_mutex);
+    if (subscriber_fn != NULL) {
+        RELEASE_LOCK(&subscriber_mutex);
+        return rtsFalse;
+    }
+    fn(user, (const StgWord8*)event_log_header,
+       (StgWord)event_log_header_len);
+    subscriber_data = user;
+    subscriber_fn = fn;
+    RELEASE_LOCK(&subscriber_mutex);
+    return rtsTrue;
+}
+
+void
+rts_unsubscribeEventLog (void)
+{
+    if (event_log_header == NULL) return;
+
+    ACQUIRE_LOCK(&subscriber_mutex);
+    subscriber_fn = NULL;
+    subscriber_data = NULL;
+    RELEASE_LOCK(&subscriber_mutex);
+}
+
 void
 abortEventLogging(void)
 {
+#ifdef THREADED_RTS
+    // In a forked child there is no writer thread, even if the parent
+    // had one; just forget about it.  flushEventLog() was called before
+    // the fork, so nothing is pending.
+    writer_running = rtsFalse;
+    pending_chunks = NULL;
+    n_pending_chunks = 0;
+#endif
+    // nor is the subscriber's machinery, probably
+    subscriber_fn = NULL;
+    subscriber_data = NULL;
     freeEventLogging();
     if (event_log_file != NULL) {
         fclose(event_log_file);
@@ -566,11 +1113,24 @@ postSchedEvent (Capability *cap,
         printAndClearEventBuf(eb);
     }
 
+    // In the compact format, a thread usually stops in the same block
+    // as it started running, and then we can leave out its id
+    if (compact_events && tag == EVENT_STOP_THREAD &&
+        thread == eb->cur_thread) {
+        postEventHeader(eb, EVENT_STOP_CUR_THREAD);
+        postWord16(eb,info1 /* status */);
+        postThreadID(eb,info2 /* blocked on thread */);
+        eb->cur_thread = 0;
+        return;
+    }
+
     postEventHeader(eb, tag);
 
     switch (tag) {
-    case EVENT_CREATE_THREAD:   // (cap, thread)
     case EVENT_RUN_THREAD:      // (cap, thread)
+        eb->cur_thread = thread;
+        /* fall through */
+    case EVENT_CREATE_THREAD:   // (cap, thread)
     case EVENT_THREAD_RUNNABLE: // (cap, thread)
     {
         postThreadID(eb,thread);
@@ -599,6 +1159,29 @@ postSchedEvent (Capability *cap,
         break;
     }
 
+    case EVENT_STM_ABORT:       // (cap, thread, tvar, aborts)
+    {
+        postThreadID(eb,thread);
+        postWord64(eb,info1 /* tvar */);
+        postWord32(eb,info2 /* aborts */);
+        break;
+    }
+
+    case EVENT_BLACKHOLE_WAIT:  // (cap, thread, wait)
+    {
+        postThreadID(eb,thread);
+        postWord64(eb,info1 /* wait, in ns */);
+        break;
+    }
+
+    case EVENT_EXCEPTION_RAISE: // (cap, thread, frames, updates)
+    {
+        postThreadID(eb,thread);
+        postWord32(eb,info1 /* frames */);
+        postWord32(eb,info2 /* update frames */);
+        break;
+    }
+
     default:
         barf("postSchedEvent: unknown event tag %d", tag);
     }
@@ -673,6 +1256,105 @@ postSparkCountersEvent (Capability *cap,
     postWord64(eb,remaining);
 }
 
+void
+postEventGcPhases (Capability *cap, Time *phases)
+{
+    EventsBuf *eb;
+    nat p;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_GC_PHASES)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_GC_PHASES);
+    for (p = 0; p < N_GC_PHASES; p++) {
+        postWord64(eb, TimeToNS(phases[p]));
+    }
+}
+
+void
+postEventGcSync (Capability *cap, Time sync, EventCapNo last_cap,
+                 EventThreadID last_thread)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_GC_SYNC)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_GC_SYNC);
+    postWord64(eb, TimeToNS(sync));
+    postCapNo(eb, last_cap);
+    postThreadID(eb, last_thread);
+}
+
+void
+postThreadUsage (Capability *cap, StgTSO *tso, StgWord64 cpu_time,
+                 StgWord64 allocated)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_THREAD_USAGE)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_THREAD_USAGE);
+    postThreadID(eb, tso->id);
+    postWord64(eb, cpu_time);
+    postWord64(eb, allocated);
+}
+
+void
+postAllocSample (Capability *cap, StgTSO *tso, StgWord64 bytes,
+                 StgWord closure_info, StgWord frame_info)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_ALLOC_SAMPLE)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_ALLOC_SAMPLE);
+    postThreadID(eb, tso->id);
+    postWord64(eb, bytes);
+    postWord64(eb, (StgWord64)closure_info);
+    postWord64(eb, (StgWord64)frame_info);
+}
+
+void
+postEventHwCounters (Capability *cap, EventCapNo capno, StgWord16 kind,
+                     StgWord64 *counts)
+{
+    EventsBuf *eb;
+    nat i;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_HW_COUNTERS)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_HW_COUNTERS);
+    postCapNo(eb, capno);
+    postWord16(eb, kind);
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+        postWord64(eb, counts[i]);
+    }
+}
+
 void
 postCapEvent (EventTypeNum  tag,
               EventCapNo    capno)
@@ -847,8 +1529,7 @@ void postWallClockTime (EventCapsetID capset)
     /* Normally we'd call postEventHeader(), but that generates its own
        timestamp, so we go one level lower so we can write out the
        timestamp we already generated above. */
-    postEventTypeNum(&eventBuf, EVENT_WALL_CLOCK_TIME);
-    postWord64(&eventBuf, ts);
+    postEventHeaderAt(&eventBuf, EVENT_WALL_CLOCK_TIME, ts);
 
     /* EVENT_WALL_CLOCK_TIME (capset, unix_epoch_seconds, nanoseconds) */
     postCapsetID(&eventBuf, capset);
@@ -858,6 +1539,34 @@ void postWallClockTime (EventCapsetID capset)
     RELEASE_LOCK(&eventBufMutex);
 }
 
+/* EVENT_CLOCK_SOURCE says which clock the timestamps come from (a
+   CLOCK_SOURCE_* from --clock), so that a tool knows how far to trust
+   them: the frequency of the counter it reads, if it reads one (the
+   TSC, say), and its resolution.  The timestamps themselves are always
+   in nanoseconds.
+ */
+void postClockSource (void)
+{
+    nat source;
+    StgWord64 hz, resolution;
+
+    getTimestampClock(&source, &hz, &resolution);
+
+    ACQUIRE_LOCK(&eventBufMutex);
+
+    if (!hasRoomForEvent(&eventBuf, EVENT_CLOCK_SOURCE)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(&eventBuf);
+    }
+
+    postEventHeader(&eventBuf, EVENT_CLOCK_SOURCE);
+    postWord16(&eventBuf, (StgWord16)source);
+    postWord64(&eventBuf, hz);
+    postWord64(&eventBuf, resolution);
+
+    RELEASE_LOCK(&eventBufMutex);
+}
+
 /*
  * Various GC and heap events
  */
@@ -1039,8 +1748,7 @@ postEventAtTimestamp (Capability *cap, EventTimestamp ts, EventTypeNum tag)
     /* Normally we'd call postEventHeader(), but that generates its own
        timestamp, so we go one level lower so we can write out
        the timestamp we received as an argument. */
-    postEventTypeNum(eb, tag);
-    postWord64(eb, ts);
+    postEventHeaderAt(eb, tag, ts);
 }
 
 #define BUF 512
@@ -1115,6 +1823,87 @@ void postUserEvent(Capability *cap, EventTypeNum type, char *msg)
     postBuf(eb, (StgWord8*) msg, size);
 }
 
+/*
+ * Copy the bytes straight in: unlike postUserEvent() there is no string
+ * to measure, and there is nothing to format.  A payload too big for
+ * an event is cut short.
+ */
+void postUserBinaryEvent(Capability *cap, StgWord32 id,
+                         StgWord8 *buf, StgWord len)
+{
+    EventsBuf *eb;
+    nat size;
+
+    if (len > 0xffff - sizeof(StgWord32)) {
+        len = 0xffff - sizeof(StgWord32);
+    }
+    size = sizeof(StgWord32) + len;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForVariableEvent(eb, size)){
+        printAndClearEventBuf(eb);
+
+        if (!hasRoomForVariableEvent(eb, size)){
+            // Event size exceeds buffer size, bail out:
+            return;
+        }
+    }
+
+    postEventHeader(eb, EVENT_USER_BINARY_MSG);
+    postPayloadSize(eb, size);
+    postWord32(eb, id);
+    postBuf(eb, buf, len);
+}
+
+void postStackSample(Capability *cap, StgTSO *tso, StgWord *frames, nat n)
+{
+    EventsBuf *eb;
+    nat size, i;
+
+    size = sizeof(EventThreadID) + n * sizeof(StgWord64);
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForVariableEvent(eb, size)){
+        printAndClearEventBuf(eb);
+
+        if (!hasRoomForVariableEvent(eb, size)){
+            // Event size exceeds buffer size, bail out:
+            return;
+        }
+    }
+
+    postEventHeader(eb, EVENT_STACK_SAMPLE);
+    postPayloadSize(eb, size);
+    postThreadID(eb, tso->id);
+    for (i = 0; i < n; i++) {
+        postWord64(eb, (StgWord64)frames[i]);
+    }
+}
+
+void postUserBinaryEventType(StgWord32 id, char *name)
+{
+    int strsize = strlen(name);
+    int size;
+
+    if (strsize > 0xff) strsize = 0xff;
+    size = sizeof(StgWord32) + strsize;
+
+    ACQUIRE_LOCK(&eventBufMutex);
+
+    if (!hasRoomForVariableEvent(&eventBuf, size)){
+        printAndClearEventBuf(&eventBuf);
+    }
+
+    postEventHeader(&eventBuf, EVENT_USER_BINARY_TYPE);
+    postPayloadSize(&eventBuf, size);
+    postWord32(&eventBuf, id);
+    postBuf(&eventBuf, (StgWord8*) name, strsize);
+
+    RELEASE_LOCK(&eventBufMutex);
+}
+
 void postThreadLabel(Capability    *cap,
                      EventThreadID  id,
                      char          *label)
@@ -1140,17 +1929,113 @@ void postThreadLabel(Capability    *cap,
     postBuf(eb, (StgWord8*) label, strsize);
 }
 
+/*
+ * Heap profile events (--eventlog-heap-profile), see ProfHeap.c
+ */
+void postHeapProfBegin (Capability *cap, StgWord32 breakdown,
+                        StgWord64 interval_ns)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_HEAP_PROF_BEGIN)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_HEAP_PROF_BEGIN);
+    postWord32(eb, breakdown);
+    postWord64(eb, interval_ns);
+}
+
+void postHeapProfBand (Capability *cap, StgWord32 band, const char *name)
+{
+    EventsBuf *eb;
+    int strsize = strlen(name);
+    int size;
+
+    if (strsize > 0xffff - (int)sizeof(StgWord32)) {
+        strsize = 0xffff - sizeof(StgWord32);
+    }
+    size = sizeof(StgWord32) + strsize;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForVariableEvent(eb, size)){
+        printAndClearEventBuf(eb);
+
+        if (!hasRoomForVariableEvent(eb, size)){
+            // Event size exceeds buffer size, bail out:
+            return;
+        }
+    }
+
+    postEventHeader(eb, EVENT_HEAP_PROF_BAND);
+    postPayloadSize(eb, size);
+    postWord32(eb, band);
+    postBuf(eb, (StgWord8*) name, strsize);
+}
+
+void postHeapProfSampleBegin (Capability *cap, StgWord32 sample,
+                              StgWord64 mut_time_ns)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_HEAP_PROF_SAMPLE_BEGIN)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_HEAP_PROF_SAMPLE_BEGIN);
+    postWord32(eb, sample);
+    postWord64(eb, mut_time_ns);
+}
+
+void postHeapProfSample (Capability *cap, StgWord32 band, StgWord64 bytes)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_HEAP_PROF_SAMPLE)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_HEAP_PROF_SAMPLE);
+    postWord32(eb, band);
+    postWord64(eb, bytes);
+}
+
+void postHeapProfSampleEnd (Capability *cap, StgWord32 sample)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_HEAP_PROF_SAMPLE_END)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_HEAP_PROF_SAMPLE_END);
+    postWord32(eb, sample);
+}
+
 void closeBlockMarker (EventsBuf *ebuf)
 {
     StgInt8* save_pos;
 
     if (ebuf->marker)
     {
-        // (type:16, time:64, size:32, end_time:64)
+        // (type:16, time:64, size:32, end_time:64), with an 8-bit type
+        // in the compact format
 
         save_pos = ebuf->pos;
-        ebuf->pos = ebuf->marker + sizeof(EventTypeNum) +
-                    sizeof(EventTimestamp);
+        ebuf->pos = ebuf->marker + blockMarkerHeaderSize();
         postWord32(ebuf, save_pos - ebuf->marker);
         postTimestamp(ebuf);
         ebuf->pos = save_pos;
@@ -1168,7 +2053,15 @@ void postBlockMarker (EventsBuf *eb)
     closeBlockMarker(eb);
 
     eb->marker = eb->pos;
-    postEventHeader(eb, EVENT_BLOCK_MARKER);
+    if (compact_events) {
+        // the time in full, as the base for the rest of the block
+        eb->last_ts = time_ns();
+        eb->cur_thread = 0;
+        postWord8(eb, (StgWord8)EVENT_BLOCK_MARKER);
+        postWord64(eb, eb->last_ts);
+    } else {
+        postEventHeader(eb, EVENT_BLOCK_MARKER);
+    }
     postWord32(eb,0); // these get filled in later by closeBlockMarker();
     postWord64(eb,0);
     postCapNo(eb, eb->capno);
@@ -1184,6 +2077,30 @@ void printAndClearEventBuf (EventsBuf *ebuf)
     {
         numBytes = ebuf->pos - ebuf->begin;
 
+        if (capEventRing != NULL) {
+            pushEventRing(ebuf);
+            flushCount++;
+            return;
+        }
+
+        sendToSubscriber(ebuf->begin, numBytes);
+
+        if (event_log_file == NULL) {   // --eventlog-sink=none
+            resetEventsBuf(ebuf);
+            flushCount++;
+            postBlockMarker(ebuf);
+            return;
+        }
+
+#ifdef THREADED_RTS
+        if (writer_running) {
+            handOffEventBuf(ebuf);
+            flushCount++;
+            postBlockMarker(ebuf);
+            return;
+        }
+#endif
+
         written = fwrite(ebuf->begin, 1, numBytes, event_log_file);
         if (written != numBytes) {
             debugBelch(
@@ -1205,19 +2122,83 @@ void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno)
     eb->size = size;
     eb->marker = NULL;
     eb->capno = capno;
+    eb->last_ts = 0;
+    eb->cur_thread = 0;
 }
 
 void resetEventsBuf(EventsBuf* eb)
 {
     eb->pos = eb->begin;
     eb->marker = NULL;
+    eb->last_ts = 0;
+    eb->cur_thread = 0;
+}
+
+static void
+initEventRing (EventRing *r)
+{
+    r->blocks = stgCallocBytes(ring_n_blocks, sizeof(StgInt8 *),
+                               "initEventRing");
+    r->lens   = stgCallocBytes(ring_n_blocks, sizeof(StgWord64),
+                               "initEventRing");
+    r->next   = 0;
+}
+
+static void
+freeEventRing (EventRing *r)
+{
+    nat i;
+
+    for (i = 0; i < ring_n_blocks; ++i) {
+        if (r->blocks[i] != NULL) stgFree(r->blocks[i]);
+    }
+    stgFree(r->blocks);
+    stgFree(r->lens);
+}
+
+// Swap the contents of ebuf, if there are any events, with the oldest
+// block of its ring.  ebuf is left with a fresh block marker.
+static void
+pushEventRing (EventsBuf *ebuf)
+{
+    EventRing *r;
+    StgInt8 *tmp;
+    nat marker_size;
+
+    marker_size = blockMarkerHeaderSize()
+                + eventTypes[EVENT_BLOCK_MARKER].size;
+    if (ebuf->pos == ebuf->begin ||
+        (ebuf->marker == ebuf->begin &&
+         ebuf->pos == ebuf->begin + marker_size)) {
+        return;    // nothing but a block marker
+    }
+
+    if (ebuf->marker != NULL) {
+        closeBlockMarker(ebuf);
+    }
+
+    sendToSubscriber(ebuf->begin, ebuf->pos - ebuf->begin);
+
+    r = ebuf->capno == (EventCapNo)(-1) ? &globalEventRing
+                                        : &capEventRing[ebuf->capno];
+    tmp = r->blocks[r->next];
+    if (tmp == NULL) {
+        tmp = stgMallocBytes(ebuf->size, "pushEventRing");
+    }
+    r->blocks[r->next] = ebuf->begin;
+    r->lens[r->next] = ebuf->pos - ebuf->begin;
+    r->next = (r->next + 1) % ring_n_blocks;
+
+    ebuf->begin = tmp;
+    resetEventsBuf(ebuf);
+    postBlockMarker(ebuf);
 }
 
 StgBool hasRoomForEvent(EventsBuf *eb, EventTypeNum eNum)
 {
   nat size;
 
-  size = sizeof(EventTypeNum) + sizeof(EventTimestamp) + eventTypes[eNum].size;
+  size = eventHeaderRoom() + eventTypes[eNum].size;
 
   if (eb->pos + size > eb->begin + eb->size) {
       return 0; // Not enough space.
@@ -1230,8 +2211,7 @@ StgBool hasRoomForVariableEvent(EventsBuf *eb, nat payload_bytes)
 {
   nat size;
 
-  size = sizeof(EventTypeNum) + sizeof(EventTimestamp) +
-      sizeof(EventPayloadSize) + payload_bytes;
+  size = eventHeaderRoom() + sizeof(EventPayloadSize) + payload_bytes;
 
   if (eb->pos + size > eb->begin + eb->size) {
       return 0; // Not enough space.
@@ -1257,4 +2237,187 @@ void postEventType(EventsBuf *eb, EventType *et)
     postInt32(eb, EVENT_ET_END);
 }
 
+#ifdef THREADED_RTS
+static EventLogChunk *
+getEventLogChunk (StgWord64 size)
+{
+    EventLogChunk *c;
+
+    ACQUIRE_SPIN_LOCK(&free_chunks_lock);
+    c = free_chunks;
+    if (c != NULL) {
+        free_chunks = c->link;
+    }
+    RELEASE_SPIN_LOCK(&free_chunks_lock);
+
+    if (c == NULL) {
+        c = stgMallocBytes(sizeof(EventLogChunk), "getEventLogChunk");
+        c->buf = NULL;
+        c->alloc = 0;
+    }
+    if (c->alloc != size) {
+        if (c->buf != NULL) stgFree(c->buf);
+        c->buf = stgMallocBytes(size, "getEventLogChunk");
+        c->alloc = size;
+    }
+    return c;
+}
+
+static void
+putEventLogChunk (EventLogChunk *c)
+{
+    ACQUIRE_SPIN_LOCK(&free_chunks_lock);
+    c->link = free_chunks;
+    free_chunks = c;
+    RELEASE_SPIN_LOCK(&free_chunks_lock);
+}
+
+// Swap the contents of ebuf with an empty chunk and hand it to the
+// writer thread.  ebuf is left empty.
+static void
+handOffEventBuf (EventsBuf *ebuf)
+{
+    EventLogChunk *c, *old;
+    StgInt8 *tmp;
+
+    if (n_pending_chunks >= EVENTLOG_MAX_PENDING) {
+        ACQUIRE_LOCK(&writer_mutex);
+        while (n_pending_chunks >= EVENTLOG_MAX_PENDING) {
+            waitCondition(&writer_idle, &writer_mutex);
+        }
+        RELEASE_LOCK(&writer_mutex);
+    }
+
+    c = getEventLogChunk(ebuf->size);
+    c->len = ebuf->pos - ebuf->begin;
+    tmp = c->buf;
+    c->buf = ebuf->begin;
+    ebuf->begin = tmp;
+    resetEventsBuf(ebuf);
+
+    atomic_inc(&n_pending_chunks, 1);
+    do {
+        old = pending_chunks;
+        c->link = old;
+    } while (cas((StgVolatilePtr)&pending_chunks,
+                 (StgWord)old, (StgWord)c) != (StgWord)old);
+
+    if (old == NULL) {
+        // the writer may be asleep
+        ACQUIRE_LOCK(&writer_mutex);
+        signalCondition(&writer_wakeup);
+        RELEASE_LOCK(&writer_mutex);
+    }
+}
+
+static void OSThreadProcAttr
+eventLogWriter (void *arg STG_UNUSED)
+{
+    EventLogChunk *c, *next, *batch;
+    StgWord64 written;
+
+    for (;;) {
+        ACQUIRE_LOCK(&writer_mutex);
+        while (pending_chunks == NULL && !writer_stop) {
+            waitCondition(&writer_wakeup, &writer_mutex);
+        }
+        if (pending_chunks == NULL) {
+            // asked to stop, and there is nothing left to write
+            writer_running = rtsFalse;
+            broadcastCondition(&writer_idle);
+            RELEASE_LOCK(&writer_mutex);
+            return;
+        }
+        writer_busy = rtsTrue;
+        RELEASE_LOCK(&writer_mutex);
+
+        c = (EventLogChunk *)xchg((StgPtr)&pending_chunks, (StgWord)NULL);
+
+        // the stack is newest-first; write oldest-first
+        batch = NULL;
+        for (; c != NULL; c = next) {
+            next = c->link;
+            c->link = batch;
+            batch = c;
+        }
+
+        for (c = batch; c != NULL; c = next) {
+            next = c->link;
+            written = fwrite(c->buf, 1, c->len, event_log_file);
+            if (written != c->len) {
+                debugBelch(
+                    "eventLogWriter: fwrite() failed, written=%" FMT_Word64
+                    " doesn't match numBytes=%" FMT_Word64, written, c->len);
+            }
+            putEventLogChunk(c);
+            atomic_dec(&n_pending_chunks);
+        }
+
+        ACQUIRE_LOCK(&writer_mutex);
+        writer_busy = rtsFalse;
+        broadcastCondition(&writer_idle);
+        RELEASE_LOCK(&writer_mutex);
+    }
+}
+
+static void
+startEventLogWriter (void)
+{
+    OSThreadId tid;
+
+    initSpinLock(&free_chunks_lock);
+    initMutex(&writer_mutex);
+    initCondition(&writer_wakeup);
+    initCondition(&writer_idle);
+    pending_chunks = NULL;
+    n_pending_chunks = 0;
+    writer_stop = rtsFalse;
+    writer_busy = rtsFalse;
+    writer_running = rtsTrue;
+
+    if (createOSThread(&tid, "ghc_eventlog", eventLogWriter, NULL) != 0) {
+        errorBelch("warning: can't start the eventlog writer thread; "
+                   "writing the eventlog synchronously");
+        writer_running = rtsFalse;
+    }
+}
+
+static void
+stopEventLogWriter (void)
+{
+    EventLogChunk *c, *next;
+
+    if (!writer_running) return;
+
+    ACQUIRE_LOCK(&writer_mutex);
+    writer_stop = rtsTrue;
+    signalCondition(&writer_wakeup);
+    while (writer_running) {
+        waitCondition(&writer_idle, &writer_mutex);
+    }
+    RELEASE_LOCK(&writer_mutex);
+
+    for (c = free_chunks; c != NULL; c = next) {
+        next = c->link;
+        stgFree(c->buf);
+        stgFree(c);
+    }
+    free_chunks = NULL;
+}
+#endif /* THREADED_RTS */
+
+#else /* !TRACING */
+
+rtsBool
+rts_subscribeEventLog (EventLogSubscriber fn STG_UNUSED,
+                       void *user STG_UNUSED)
+{
+    return rtsFalse;
+}
+
+void
+rts_unsubscribeEventLog (void)
+{
+}
+
 #endif /* TRACING */
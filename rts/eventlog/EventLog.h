@@ -28,6 +28,22 @@ void abortEventLogging(void); // #4512 - after fork child needs to abort
 void flushEventLog(void);     // event log inherited from parent
 void moreCapEventBufs (nat from, nat to);
 
+/*
+ * --eventlog-ring: write out the events kept in memory.  Set
+ * performEventLogDump to have the scheduler do it when it next stops
+ * all the capabilities.
+ */
+void dumpEventLog(void);
+extern volatile rtsBool performEventLogDump;
+
+/*
+ * rts_subscribeEventLog(): is there a subscriber that wants the
+ * buffers written out regularly, with flushEventLogBuffers() (when no
+ * capability is posting events).
+ */
+rtsBool eventLogSubscribed(void);
+void flushEventLogBuffers(void);
+
 /*
  * Post a scheduler event to the capability's event buffer (an event
  * that has an associated thread).
@@ -47,6 +63,18 @@ void postMsg(char *msg, va_list ap);
 
 void postUserEvent(Capability *cap, EventTypeNum type, char *msg);
 
+/*
+ * A binary user event, and the name for its id
+ */
+void postUserBinaryEvent(Capability *cap, StgWord32 id,
+                         StgWord8 *buf, StgWord len);
+void postUserBinaryEventType(StgWord32 id, char *name);
+
+/*
+ * The info pointers of the top n frames on the stack of tso
+ */
+void postStackSample(Capability *cap, StgTSO *tso, StgWord *frames, nat n);
+
 void postCapMsg(Capability *cap, char *msg, va_list ap);
 
 void postEventStartup(EventCapNo n_caps);
@@ -81,6 +109,8 @@ void postCapsetVecEvent (EventTypeNum tag,
 
 void postWallClockTime (EventCapsetID capset);
 
+void postClockSource (void);
+
 /*
  * Post a `par` spark event
  */
@@ -125,6 +155,48 @@ void postEventGcStats  (Capability    *cap,
                         W_           par_max_copied,
                         W_           par_tot_copied);
 
+/*
+ * The time spent in each phase of a GC (N_GC_PHASES of them)
+ */
+void postEventGcPhases (Capability *cap, Time *phases);
+
+/*
+ * How long a GC waited for the other capabilities to stop, and which
+ * one (and the thread on it) it waited for last
+ */
+void postEventGcSync (Capability *cap, Time sync, EventCapNo last_cap,
+                      EventThreadID last_thread);
+
+/*
+ * The CPU time (ns) and allocation (bytes) of a thread's last run
+ */
+void postThreadUsage (Capability *cap, StgTSO *tso, StgWord64 cpu_time,
+                      StgWord64 allocated);
+
+/*
+ * An allocation sample (--alloc-sample), see traceAllocSample()
+ */
+void postAllocSample (Capability *cap, StgTSO *tso, StgWord64 bytes,
+                      StgWord closure_info, StgWord frame_info);
+
+/*
+ * Heap profile events (--eventlog-heap-profile): a band is named once,
+ * before its first sample, and then known by its number
+ */
+void postHeapProfBegin (Capability *cap, StgWord32 breakdown,
+                        StgWord64 interval_ns);
+void postHeapProfBand (Capability *cap, StgWord32 band, const char *name);
+void postHeapProfSampleBegin (Capability *cap, StgWord32 sample,
+                              StgWord64 mut_time_ns);
+void postHeapProfSample (Capability *cap, StgWord32 band, StgWord64 bytes);
+void postHeapProfSampleEnd (Capability *cap, StgWord32 sample);
+
+/*
+ * Running totals of the hardware counters, see PerfCounters.c
+ */
+void postEventHwCounters (Capability *cap, EventCapNo capno, StgWord16 kind,
+                          StgWord64 *counts);
+
 void postTaskCreateEvent (EventTaskId taskId,
                           EventCapNo cap,
                           EventKernelThreadId tid);
@@ -0,0 +1,461 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Asynchronous read/write requests for the non-threaded RTS on Linux.
+ *
+ * asyncRead# and asyncWrite# used to exist only on Windows, where
+ * win32/AsyncIO.c hands them to a pool of worker threads.  On Linux we
+ * submit them to an io_uring instead: the thread making the request
+ * goes on the blocked queue, with TSO_ASYNC_IO set in its flags and
+ * block_info.async_result pointing at the request, and awaitEvent()
+ * (Select.c) calls awaitRequests() to wake up the threads whose
+ * requests have completed.  The kernel does the I/O, so a read from a
+ * slow disk doesn't hold up the other Haskell threads, and no extra OS
+ * threads are needed.
+ *
+ * The buffer is passed straight to the kernel, so it must stay put:
+ * it has to be pinned (or malloc'd), and the caller must keep it alive
+ * until the request returns.  If the thread is killed while the
+ * request is in flight we ask the kernel to cancel it, but the kernel
+ * may still be using the buffer after the exception has been raised.
+ *
+ * The non-threaded RTS has a single Capability, so there is a single
+ * ring.  If the kernel has no io_uring (before 5.6; or it is forbidden
+ * by a seccomp policy), requests are performed synchronously, and
+ * rtsSupportsAsyncIO() returns false so that the I/O library doesn't
+ * use them.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#if defined(__linux__)
+/* for syscall() */
+#define _GNU_SOURCE
+#endif
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "AsyncIO.h"
+#include "Schedule.h"
+#include "RtsUtils.h"
+
+#if defined(linux_HOST_OS) && !defined(THREADED_RTS)
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#if defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(IORING_FEAT_RW_CUR_POS) \
+    && defined(__NR_io_uring_setup)
+#define USE_IO_URING 1
+#endif
+
+/*
+ * The state of a request, kept in the reqID field of its
+ * StgAsyncIOResult (there are no request IDs on Linux).
+ */
+#define ASYNC_IO_PENDING   0  // in flight
+#define ASYNC_IO_DONE      1  // len and errCode are valid
+#define ASYNC_IO_ABANDONED 2  // thread gone, free it when the kernel is done
+
+typedef struct {
+    StgAsyncIOResult res;       // must be first: freed by stg_block_async
+    struct iovec     iov;
+} AsyncIORequest;
+
+// Requests that are DONE but whose threads haven't been woken yet
+static nat n_done = 0;
+
+static void
+completeRequest (StgAsyncIOResult *ares, int result)
+{
+    if (ares->reqID == ASYNC_IO_ABANDONED) {
+        stgFree(ares);
+        return;
+    }
+    if (result < 0) {
+        ares->len     = -1;
+        ares->errCode = -result;
+    } else {
+        ares->len     = result;
+        ares->errCode = 0;
+    }
+    ares->reqID = ASYNC_IO_DONE;
+    n_done++;
+}
+
+static void
+syncRequest (AsyncIORequest *req, int fd, int forWriting)
+{
+    ssize_t r;
+
+    do {
+        r = forWriting ? writev(fd, &req->iov, 1) : readv(fd, &req->iov, 1);
+    } while (r < 0 && errno == EINTR);
+
+    completeRequest(&req->res, r < 0 ? -errno : (int)r);
+}
+
+/* -----------------------------------------------------------------------------
+ * The ring
+ * -------------------------------------------------------------------------- */
+
+#if defined(USE_IO_URING)
+
+#define RING_ENTRIES 256
+
+static int ring_fd = -1;
+
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static struct io_uring_sqe *sqes;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe *cqes;
+
+static void  *sq_ring_ptr, *cq_ring_ptr;
+static size_t sq_ring_size, cq_ring_size, sqes_size;
+
+// Requests submitted whose completion we haven't seen yet, and the
+// most there can be without overflowing the completion queue
+static nat n_in_flight = 0;
+static nat max_in_flight;
+
+static void
+closeRing (void)
+{
+    if (sqes != NULL) munmap(sqes, sqes_size);
+    if (cq_ring_ptr != NULL && cq_ring_ptr != sq_ring_ptr) {
+        munmap(cq_ring_ptr, cq_ring_size);
+    }
+    if (sq_ring_ptr != NULL) munmap(sq_ring_ptr, sq_ring_size);
+    sqes = NULL;
+    sq_ring_ptr = cq_ring_ptr = NULL;
+    if (ring_fd >= 0) close(ring_fd);
+    ring_fd = -1;
+}
+
+static rtsBool
+openRing (void)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    ring_fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (ring_fd < 0) {
+        IF_DEBUG(scheduler,
+                 debugBelch("asyncIO: no io_uring (errno %d), "
+                            "requests will be synchronous\n", errno));
+        return rtsFalse;
+    }
+    // we need reads and writes at the current file position
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        closeRing();
+        return rtsFalse;
+    }
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_ring_size > sq_ring_size) sq_ring_size = cq_ring_size;
+        cq_ring_size = sq_ring_size;
+    }
+
+    sq_ring_ptr = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring_ptr == MAP_FAILED) {
+        sq_ring_ptr = NULL;
+        closeRing();
+        return rtsFalse;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring_ptr = sq_ring_ptr;
+    } else {
+        cq_ring_ptr = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring_fd,
+                           IORING_OFF_CQ_RING);
+        if (cq_ring_ptr == MAP_FAILED) {
+            cq_ring_ptr = NULL;
+            closeRing();
+            return rtsFalse;
+        }
+    }
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        sqes = NULL;
+        closeRing();
+        return rtsFalse;
+    }
+
+    sq_head  = (unsigned *)((char *)sq_ring_ptr + p.sq_off.head);
+    sq_tail  = (unsigned *)((char *)sq_ring_ptr + p.sq_off.tail);
+    sq_mask  = (unsigned *)((char *)sq_ring_ptr + p.sq_off.ring_mask);
+    sq_array = (unsigned *)((char *)sq_ring_ptr + p.sq_off.array);
+    cq_head  = (unsigned *)((char *)cq_ring_ptr + p.cq_off.head);
+    cq_tail  = (unsigned *)((char *)cq_ring_ptr + p.cq_off.tail);
+    cq_mask  = (unsigned *)((char *)cq_ring_ptr + p.cq_off.ring_mask);
+    cqes     = (struct io_uring_cqe *)((char *)cq_ring_ptr + p.cq_off.cqes);
+
+    // Leave room for the cancellations too
+    max_in_flight = p.cq_entries / 2;
+    n_in_flight = 0;
+    return rtsTrue;
+}
+
+// Move the completions from the completion queue into their requests
+static void
+reapCompletions (void)
+{
+    unsigned head, tail;
+    struct io_uring_cqe *cqe;
+
+    head = *cq_head;
+    tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        cqe = &cqes[head & *cq_mask];
+        // user_data is 0 for cancellations
+        if (cqe->user_data != 0) {
+            n_in_flight--;
+            completeRequest((StgAsyncIOResult *)(StgWord)cqe->user_data,
+                            cqe->res);
+        }
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Wait until the kernel has completed at least one request
+static void
+waitForCompletion (void)
+{
+    while (syscall(__NR_io_uring_enter, ring_fd, 0, 1,
+                   IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            sysErrorBelch("io_uring_enter");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+    reapCompletions();
+}
+
+// Queue one submission and hand it to the kernel; returns rtsFalse if
+// the kernel wouldn't take it
+static rtsBool
+submit (StgWord8 opcode, int fd, void *addr, unsigned len, StgWord64 data)
+{
+    unsigned tail, index;
+    struct io_uring_sqe *sqe;
+    long r;
+
+    tail  = *sq_tail;
+    index = tail & *sq_mask;
+    sqe   = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    if (opcode != IORING_OP_ASYNC_CANCEL) {
+        sqe->off   = (StgWord64)-1;   // the current file position
+    }
+    sqe->addr      = (StgWord64)(StgWord)addr;
+    sqe->len       = len;
+    sqe->user_data = data;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    do {
+        r = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0);
+    } while (r < 0 && errno == EINTR);
+
+    if (r != 1) {
+        // the kernel didn't consume it: take it back
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        return rtsFalse;
+    }
+    return rtsTrue;
+}
+
+#endif /* USE_IO_URING */
+
+/* -----------------------------------------------------------------------------
+ * The API
+ * -------------------------------------------------------------------------- */
+
+void
+startupAsyncIO (void)
+{
+#if defined(USE_IO_URING)
+    openRing();
+#endif
+    n_done = 0;
+}
+
+void
+shutdownAsyncIO (void)
+{
+#if defined(USE_IO_URING)
+    // Any requests still in flight belong to threads that have been
+    // deleted; closing the ring cancels them.
+    closeRing();
+#endif
+}
+
+// In the child of forkProcess(): the requests in flight belong to the
+// parent, whose ring we share.  Give the child a ring of its own; the
+// threads waiting for the parent's requests are about to be deleted.
+void
+resetAsyncIO (void)
+{
+#if defined(USE_IO_URING)
+    StgTSO *tso;
+
+    for (tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = tso->_link) {
+        if ((tso->flags & TSO_ASYNC_IO)
+            && tso->block_info.async_result->reqID == ASYNC_IO_PENDING) {
+            completeRequest(tso->block_info.async_result, -ECANCELED);
+        }
+    }
+    if (ring_fd >= 0) {
+        closeRing();
+        openRing();
+    }
+#endif
+}
+
+HsBool
+rtsSupportsAsyncIO (void)
+{
+#if defined(USE_IO_URING)
+    return ring_fd >= 0 ? HS_BOOL_TRUE : HS_BOOL_FALSE;
+#else
+    return HS_BOOL_FALSE;
+#endif
+}
+
+StgAsyncIOResult *
+addIORequest (int fd, int forWriting, int len, char *buf)
+{
+    AsyncIORequest *req;
+
+    req = stgMallocBytes(sizeof(AsyncIORequest), "addIORequest");
+    req->res.reqID   = ASYNC_IO_PENDING;
+    req->res.len     = 0;
+    req->res.errCode = 0;
+    req->iov.iov_base = buf;
+    req->iov.iov_len  = len;
+
+#if defined(USE_IO_URING)
+    if (ring_fd >= 0) {
+        if (n_in_flight >= max_in_flight) {
+            waitForCompletion();
+        }
+        if (submit(forWriting ? IORING_OP_WRITEV : IORING_OP_READV,
+                   fd, &req->iov, 1, (StgWord64)(StgWord)req)) {
+            n_in_flight++;
+            return &req->res;
+        }
+    }
+#endif
+
+    syncRequest(req, fd, forWriting);
+    return &req->res;
+}
+
+void
+abandonIORequest (StgAsyncIOResult *ares)
+{
+    switch (ares->reqID) {
+    case ASYNC_IO_DONE:
+        n_done--;
+        stgFree(ares);
+        break;
+    case ASYNC_IO_PENDING:
+        ares->reqID = ASYNC_IO_ABANDONED;
+#if defined(USE_IO_URING)
+        // Best effort: the completion frees it, whether it was
+        // cancelled or not
+        if (ring_fd >= 0) {
+            submit(IORING_OP_ASYNC_CANCEL, -1, ares, 0, 0);
+        }
+#endif
+        break;
+    default:
+        barf("abandonIORequest: request %p already abandoned", ares);
+    }
+}
+
+int
+asyncIOPollFd (void)
+{
+#if defined(USE_IO_URING)
+    if (n_in_flight > 0) return ring_fd;
+#endif
+    return -1;
+}
+
+rtsBool
+awaitRequests (void)
+{
+    StgTSO *tso, *prev, *next;
+    StgAsyncIOResult *ares;
+    rtsBool woke = rtsFalse;
+
+#if defined(USE_IO_URING)
+    if (n_in_flight > 0) {
+        reapCompletions();
+    }
+#endif
+    if (n_done == 0) return rtsFalse;
+
+    prev = NULL;
+    for (tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        if ((tso->flags & TSO_ASYNC_IO)
+            && tso->block_info.async_result->reqID == ASYNC_IO_DONE) {
+            ares = tso->block_info.async_result;
+            n_done--;
+
+            tso->flags &= ~TSO_ASYNC_IO;
+            tso->why_blocked = NotBlocked;
+            tso->_link = END_TSO_QUEUE;
+            // save the StgAsyncIOResult in the stg_block_async_info
+            // stack frame, because the block_info field will be
+            // overwritten by pushOnRunQueue().
+            tso->stackobj->sp[1] = (W_)ares;
+            pushOnRunQueue(&MainCapability, tso);
+            woke = rtsTrue;
+        } else {
+            if (prev == NULL)
+                blocked_queue_hd = tso;
+            else
+                setTSOLink(&MainCapability, prev, tso);
+            prev = tso;
+        }
+    }
+
+    if (prev == NULL)
+        blocked_queue_hd = blocked_queue_tl = END_TSO_QUEUE;
+    else {
+        prev->_link = END_TSO_QUEUE;
+        blocked_queue_tl = prev;
+    }
+
+    return woke;
+}
+
+#else /* !linux_HOST_OS || THREADED_RTS */
+
+HsBool
+rtsSupportsAsyncIO (void)
+{
+    return HS_BOOL_FALSE;
+}
+
+#endif
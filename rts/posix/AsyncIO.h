@@ -0,0 +1,40 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Asynchronous read/write requests for the non-threaded RTS on Linux
+ * (asyncRead#, asyncWrite#), using io_uring.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef POSIX_ASYNCIO_H
+#define POSIX_ASYNCIO_H
+
+#include "BeginPrivate.h"
+
+#if defined(linux_HOST_OS) && !defined(THREADED_RTS)
+
+void startupAsyncIO  (void);
+void shutdownAsyncIO (void);
+void resetAsyncIO    (void);
+
+StgAsyncIOResult *addIORequest (int fd, int forWriting, int len, char *buf);
+
+// The thread blocked on the request has been removed from the
+// blocked queue (throwTo): forget about the request.
+void abandonIORequest (StgAsyncIOResult *ares);
+
+// Wake up the threads whose requests have completed; returns rtsTrue
+// if it woke any.  Called by awaitEvent().
+rtsBool awaitRequests (void);
+
+// A descriptor that becomes readable when a request completes, or -1
+// if no request is in flight.  awaitEvent() waits on it along with the
+// descriptors in the blocked queue.
+int asyncIOPollFd (void);
+
+#endif
+
+#include "EndPrivate.h"
+
+#endif /* POSIX_ASYNCIO_H */
@@ -25,6 +25,9 @@
 # include <papi.h>
 #endif
 
+#include <stdio.h>
+#include <string.h>
+
 #if ! ((defined(HAVE_GETRUSAGE) && !irix_HOST_OS) || defined(HAVE_TIMES))
 #error No implementation for getProcessCPUTime() available.
 #endif
@@ -183,6 +186,256 @@ void getProcessTimes(Time *user, Time *elapsed)
 
 #endif // HAVE_TIMES
 
+/* -----------------------------------------------------------------------------
+   The clock for timestamps (--clock)
+
+   Every eventlog event carries a timestamp, so with tracing on the cost
+   of reading the clock matters.  clock_gettime() is usually answered by
+   the vDSO without entering the kernel, but --clock offers two cheaper
+   sources on the same time base as getMonotonicNSec():
+
+     tsc     reads the CPU's cycle counter (rdtsc on x86-64, cntvct_el0
+             on AArch64) and scales it to nanoseconds.  On x86-64 we
+             only do this if the TSC is invariant, and on Linux only if
+             the kernel still considers it a usable clocksource; the
+             frequency is calibrated against getMonotonicNSec() at
+             startup.
+     coarse  uses CLOCK_MONOTONIC_COARSE, which is as cheap as reading
+             a word of memory but only advances once per kernel tick.
+
+   If the clock asked for isn't available we fall back to the monotonic
+   clock.  The eventlog records which clock was used (traceClockSource).
+   -------------------------------------------------------------------------- */
+
+#if defined(__GNUC__) && (defined(x86_64_HOST_ARCH) || defined(aarch64_HOST_ARCH))
+#define HAVE_CYCLE_COUNTER 1
+#endif
+
+// How long to calibrate the TSC for
+#define TSC_CALIBRATION_NS 10000000
+
+static nat timestamp_clock = CLOCK_SOURCE_MONOTONIC;
+
+#if defined(HAVE_CYCLE_COUNTER)
+
+// ns = tsc_base_ns + (((tsc - tsc_base) * tsc_mult) >> 32)
+static StgWord64 tsc_base;
+static StgWord64 tsc_base_ns;
+static StgWord64 tsc_mult;
+static StgWord64 tsc_hz;
+
+static INLINE_ME StgWord64 readCycleCounter (void)
+{
+#if defined(x86_64_HOST_ARCH)
+    StgWord32 lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((StgWord64)hi << 32) | lo;
+#else
+    StgWord64 v;
+    __asm__ __volatile__ ("isb; mrs %0, cntvct_el0" : "=r" (v) : : "memory");
+    return v;
+#endif
+}
+
+// Read the cycle counter and the monotonic clock as close together as
+// we can: we keep the tightest of a few tries, since we may be
+// descheduled (or, in a VM, the virtual CPU may be) in between.
+static void readClockPair (StgWord64 *tsc, StgWord64 *ns)
+{
+    StgWord64 before, after, t, best = ~(StgWord64)0;
+    nat i;
+
+    for (i = 0; i < 16; i++) {
+        before = readCycleCounter();
+        t = getMonotonicNSec();
+        after = readCycleCounter();
+        if (after - before < best) {
+            best = after - before;
+            *tsc = before + (after - before) / 2;
+            *ns = t;
+        }
+    }
+}
+
+static rtsBool haveUsableCycleCounter (void)
+{
+#if defined(x86_64_HOST_ARCH)
+    StgWord32 eax, ebx, ecx, edx;
+
+    __asm__ __volatile__ ("cpuid"
+                          : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                          : "a" (0x80000000), "c" (0));
+    if (eax < 0x80000007) {
+        return rtsFalse;
+    }
+    __asm__ __volatile__ ("cpuid"
+                          : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                          : "a" (0x80000007), "c" (0));
+    if (!(edx & (1 << 8))) {
+        return rtsFalse; // not invariant: the rate changes with the clock
+    }
+#endif
+
+#if defined(linux_HOST_OS) && defined(x86_64_HOST_ARCH)
+    {
+        // The kernel drops the TSC from the available clocksources if
+        // it finds that it is not synchronised between CPUs
+        FILE *f;
+        char buf[256];
+        rtsBool found = rtsTrue;
+
+        f = fopen("/sys/devices/system/clocksource/clocksource0/"
+                  "available_clocksource", "r");
+        if (f != NULL) {
+            found = fgets(buf, sizeof(buf), f) != NULL &&
+                    strstr(buf, "tsc") != NULL;
+            fclose(f);
+        }
+        if (!found) {
+            return rtsFalse;
+        }
+    }
+#endif
+
+    return rtsTrue;
+}
+
+static rtsBool initCycleCounter (void)
+{
+#if !defined(aarch64_HOST_ARCH)
+    StgWord64 tsc = 0, ns = 0;
+#endif
+
+    if (!haveUsableCycleCounter()) {
+        return rtsFalse;
+    }
+
+#if defined(aarch64_HOST_ARCH)
+    __asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (tsc_hz));
+    readClockPair(&tsc_base, &tsc_base_ns);
+#else
+    readClockPair(&tsc_base, &tsc_base_ns);
+    do {
+        readClockPair(&tsc, &ns);
+    } while (ns - tsc_base_ns < TSC_CALIBRATION_NS);
+    if (tsc <= tsc_base) {
+        return rtsFalse;
+    }
+    tsc_hz = (StgWord64)((double)(tsc - tsc_base) * 1e9 /
+                         (double)(ns - tsc_base_ns));
+#endif
+
+    if (tsc_hz == 0) {
+        return rtsFalse;
+    }
+    tsc_mult = (StgWord64)(((unsigned __int128)1000000000 << 32) / tsc_hz);
+    return rtsTrue;
+}
+
+#endif /* HAVE_CYCLE_COUNTER */
+
+void initTimestampClock (void)
+{
+    nat want = RtsFlags.MiscFlags.clockSource;
+
+    timestamp_clock = CLOCK_SOURCE_MONOTONIC;
+
+    switch (want) {
+    case CLOCK_SOURCE_TSC:
+#if defined(HAVE_CYCLE_COUNTER)
+        if (initCycleCounter()) {
+            timestamp_clock = CLOCK_SOURCE_TSC;
+            return;
+        }
+#endif
+        errorBelch("--clock=tsc: no usable cycle counter, "
+                   "using the monotonic clock");
+        return;
+
+    case CLOCK_SOURCE_COARSE:
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_COARSE)
+        {
+            struct timespec ts;
+            if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0) {
+                timestamp_clock = CLOCK_SOURCE_COARSE;
+                return;
+            }
+        }
+#endif
+        errorBelch("--clock=coarse: not supported, "
+                   "using the monotonic clock");
+        return;
+
+    default:
+        return;
+    }
+}
+
+StgWord64 getTimestampNSec (void)
+{
+    switch (timestamp_clock) {
+#if defined(HAVE_CYCLE_COUNTER)
+    case CLOCK_SOURCE_TSC:
+        return tsc_base_ns +
+            (StgWord64)(((unsigned __int128)(readCycleCounter() - tsc_base)
+                         * tsc_mult) >> 32);
+#endif
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_COARSE)
+    case CLOCK_SOURCE_COARSE:
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (StgWord64)ts.tv_sec * 1000000000 +
+               (StgWord64)ts.tv_nsec;
+    }
+#endif
+
+    default:
+        return getMonotonicNSec();
+    }
+}
+
+void getTimestampClock (nat *source, StgWord64 *hz, StgWord64 *resolution)
+{
+    *source = timestamp_clock;
+    *hz = 0;
+    *resolution = 1;
+
+    switch (timestamp_clock) {
+#if defined(HAVE_CYCLE_COUNTER)
+    case CLOCK_SOURCE_TSC:
+        *hz = tsc_hz;
+        *resolution = stg_max(1, 1000000000 / tsc_hz);
+        break;
+#endif
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_COARSE)
+    case CLOCK_SOURCE_COARSE:
+    {
+        struct timespec ts;
+        if (clock_getres(CLOCK_MONOTONIC_COARSE, &ts) == 0) {
+            *resolution = (StgWord64)ts.tv_sec * 1000000000 +
+                          (StgWord64)ts.tv_nsec;
+        }
+        break;
+    }
+#endif
+
+    default:
+#if defined(HAVE_CLOCK_GETTIME)
+    {
+        struct timespec ts;
+        if (clock_getres(CLOCK_ID, &ts) == 0) {
+            *resolution = (StgWord64)ts.tv_sec * 1000000000 +
+                          (StgWord64)ts.tv_nsec;
+        }
+    }
+#endif
+        break;
+    }
+}
+
 Time getThreadCPUTime(void)
 {
 #if USE_PAPI
@@ -53,9 +53,27 @@
 #define USE_PTHREAD_FOR_ITIMER
 #endif
 
+/*
+ * On Linux the threaded RTS ticks in a thread of its own that reads a
+ * timerfd, so that the tick doesn't interrupt system calls in the
+ * program with EINTR.  While the ticker is stopped (see
+ * ACTIVITY_DONE_GC in Schedule.c) the timerfd is disarmed, and the
+ * thread doesn't wake up at all until the RTS has work again.
+ */
+#if defined(linux_HOST_OS) && defined(THREADED_RTS) && \
+    defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_TIMERFD_CREATE)
+#define USE_PTHREAD_FOR_ITIMER
+#define USE_TIMERFD_FOR_ITIMER
+#endif
+
 #if defined(USE_PTHREAD_FOR_ITIMER)
 #include <pthread.h>
 #include <unistd.h>
+#include <errno.h>
+#endif
+
+#if defined(USE_TIMERFD_FOR_ITIMER)
+#include <sys/timerfd.h>
 #endif
 
 /*
@@ -105,7 +123,10 @@ ghc-stage2: timer_create: Not owner
 #undef USE_TIMER_CREATE
 #endif /* solaris2_HOST_OS */
 
-#if defined(USE_TIMER_CREATE)
+#if defined(USE_PTHREAD_FOR_ITIMER)
+   // No signal, but rtsTimerSignal() has to return something
+#  define ITIMER_SIGNAL SIGVTALRM
+#elif defined(USE_TIMER_CREATE)
 #  define ITIMER_SIGNAL SIGVTALRM
 #elif defined(HAVE_SETITIMER)
 #  define ITIMER_SIGNAL  SIGALRM
@@ -115,7 +136,7 @@ ghc-stage2: timer_create: Not owner
 #  error No way to set an interval timer.
 #endif
 
-#if defined(USE_TIMER_CREATE)
+#if defined(USE_TIMER_CREATE) && !defined(USE_PTHREAD_FOR_ITIMER)
 static timer_t timer;
 #endif
 
@@ -150,16 +171,86 @@ static void install_vtalrm_handler(TickProc handle_tick)
 #endif
 
 #if defined(USE_PTHREAD_FOR_ITIMER)
-static volatile int itimer_enabled;
+/*
+ * The ticker thread.  ticker_mutex is held while handle_tick() runs, so
+ * that once stopTicker() has returned there are no more ticks (#4074).
+ * handle_tick() may itself stop the ticker (via stopTimer()), in which
+ * case we already hold the mutex.
+ */
+static pthread_t       ticker_thread;
+static pthread_mutex_t ticker_mutex;
+static pthread_cond_t  ticker_start;
+static rtsBool         ticker_stopped = rtsTrue;
+static rtsBool         ticker_exiting = rtsFalse;
+static rtsBool         ticker_in_tick = rtsFalse;
+
+#if defined(USE_TIMERFD_FOR_ITIMER)
+static int ticker_fd = -1;
+
+static void
+setTickerFd (Time value, Time interval)
+{
+    struct itimerspec it;
+
+    it.it_value.tv_sec     = TimeToSeconds(value);
+    it.it_value.tv_nsec    = TimeToNS(value) % 1000000000;
+    it.it_interval.tv_sec  = TimeToSeconds(interval);
+    it.it_interval.tv_nsec = TimeToNS(interval) % 1000000000;
+
+    if (timerfd_settime(ticker_fd, 0, &it, NULL) != 0) {
+        sysErrorBelch("timerfd_settime");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+#endif
+
+// Block until the next tick is due
+static void
+waitForTick (void)
+{
+#if defined(USE_TIMERFD_FOR_ITIMER)
+    StgWord64 expirations;
+
+    if (read(ticker_fd, &expirations, sizeof(expirations)) < 0
+        && errno != EINTR && errno != EAGAIN) {
+        sysErrorBelch("Ticker: read(timerfd)");
+        stg_exit(EXIT_FAILURE);
+    }
+#else
+    usleep(TimeToUS(itimer_interval));
+#endif
+}
+
 static void *itimer_thread_func(void *_handle_tick)
 {
     TickProc handle_tick = _handle_tick;
+    sigset_t set;
+
+    // the ticker must not take any of the program's signals
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
     while (1) {
-        usleep(TimeToUS(itimer_interval));
-        switch (itimer_enabled) {
-            case 1: handle_tick(0); break;
-            case 2: itimer_enabled = 0;
+        pthread_mutex_lock(&ticker_mutex);
+        // stopped: sleep until startTicker() or exitTicker()
+        while (ticker_stopped && !ticker_exiting) {
+            pthread_cond_wait(&ticker_start, &ticker_mutex);
         }
+        if (ticker_exiting) {
+            pthread_mutex_unlock(&ticker_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&ticker_mutex);
+
+        waitForTick();
+
+        pthread_mutex_lock(&ticker_mutex);
+        if (!ticker_stopped && !ticker_exiting) {
+            ticker_in_tick = rtsTrue;
+            handle_tick(0);
+            ticker_in_tick = rtsFalse;
+        }
+        pthread_mutex_unlock(&ticker_mutex);
     }
     return NULL;
 }
@@ -171,8 +262,28 @@ initTicker (Time interval, TickProc handle_tick)
     itimer_interval = interval;
 
 #if defined(USE_PTHREAD_FOR_ITIMER)
-    pthread_t tid;
-    pthread_create(&tid, NULL, itimer_thread_func, (void*)handle_tick);
+    // After forkProcess() this runs again in the child, where the old
+    // thread doesn't exist; start from scratch.
+    pthread_mutex_init(&ticker_mutex, NULL);
+    pthread_cond_init(&ticker_start, NULL);
+    ticker_stopped = rtsTrue;
+    ticker_exiting = rtsFalse;
+    ticker_in_tick = rtsFalse;
+#if defined(USE_TIMERFD_FOR_ITIMER)
+    if (ticker_fd >= 0) {
+        close(ticker_fd);
+    }
+    ticker_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (ticker_fd < 0) {
+        sysErrorBelch("timerfd_create");
+        stg_exit(EXIT_FAILURE);
+    }
+#endif
+    if (pthread_create(&ticker_thread, NULL, itimer_thread_func,
+                       (void*)handle_tick) != 0) {
+        sysErrorBelch("Ticker: pthread_create");
+        stg_exit(EXIT_FAILURE);
+    }
 #elif defined(USE_TIMER_CREATE)
     {
         struct sigevent ev;
@@ -198,7 +309,13 @@ void
 startTicker(void)
 {
 #if defined(USE_PTHREAD_FOR_ITIMER)
-    itimer_enabled = 1;
+    pthread_mutex_lock(&ticker_mutex);
+    ticker_stopped = rtsFalse;
+#if defined(USE_TIMERFD_FOR_ITIMER)
+    setTickerFd(itimer_interval, itimer_interval);
+#endif
+    pthread_cond_signal(&ticker_start);
+    pthread_mutex_unlock(&ticker_mutex);
 #elif defined(USE_TIMER_CREATE)
     {
         struct itimerspec it;
@@ -232,12 +349,18 @@ void
 stopTicker(void)
 {
 #if defined(USE_PTHREAD_FOR_ITIMER)
-    if (itimer_enabled == 1) {
-        itimer_enabled = 2;
-        /* Wait for the thread to confirm it won't generate another tick. */
-        while (itimer_enabled != 0)
-            sched_yield();
-    }
+    rtsBool from_tick;
+
+    // handle_tick() calling stopTimer() on the ticker thread
+    from_tick = ticker_in_tick && pthread_equal(pthread_self(), ticker_thread);
+
+    if (!from_tick) pthread_mutex_lock(&ticker_mutex);
+    ticker_stopped = rtsTrue;
+#if defined(USE_TIMERFD_FOR_ITIMER)
+    // disarm it, so that the thread sleeps until startTicker()
+    setTickerFd(0, 0);
+#endif
+    if (!from_tick) pthread_mutex_unlock(&ticker_mutex);
 #elif defined(USE_TIMER_CREATE)
     struct itimerspec it;
 
@@ -266,7 +389,30 @@ stopTicker(void)
 void
 exitTicker (rtsBool wait STG_UNUSED)
 {
-#if defined(USE_TIMER_CREATE)
+#if defined(USE_PTHREAD_FOR_ITIMER)
+    pthread_mutex_lock(&ticker_mutex);
+    ticker_exiting = rtsTrue;
+#if defined(USE_TIMERFD_FOR_ITIMER)
+    // wake up the thread if it is waiting for a tick
+    setTickerFd(1, 0);
+#endif
+    pthread_cond_signal(&ticker_start);
+    pthread_mutex_unlock(&ticker_mutex);
+
+    if (wait) {
+        if (pthread_join(ticker_thread, NULL) != 0) {
+            sysErrorBelch("Ticker: pthread_join");
+        }
+#if defined(USE_TIMERFD_FOR_ITIMER)
+        close(ticker_fd);
+        ticker_fd = -1;
+#endif
+        pthread_mutex_destroy(&ticker_mutex);
+        pthread_cond_destroy(&ticker_start);
+    } else {
+        pthread_detach(ticker_thread);
+    }
+#elif defined(USE_TIMER_CREATE)
     // Before deleting the timer set the signal to ignore to avoid the
     // possibility of the signal being delivered after the timer is deleted.
     signal(ITIMER_SIGNAL, SIG_IGN);
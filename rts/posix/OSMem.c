@@ -13,6 +13,7 @@
 
 #include "RtsUtils.h"
 #include "sm/OSMem.h"
+#include "Trace.h"
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -32,17 +33,45 @@
 
 #include <errno.h>
 
+#if defined(HAVE_NUMA_H)
+#include <numa.h>
+#endif
+#if defined(HAVE_NUMAIF_H)
+#include <numaif.h>
+#endif
+
 #if darwin_HOST_OS || ios_HOST_OS
 #include <mach/mach.h>
 #include <mach/vm_map.h>
 #include <sys/sysctl.h>
 #endif
 
+// With USE_LARGE_ADDRESS_SPACE the heap lives inside one reservation
+// (see MBlock.c), so we don't make hugetlbfs mappings of our own and
+// -xH only asks for transparent huge pages (see osCommitMemory()).
+#if defined(linux_HOST_OS) && defined(MAP_HUGETLB) \
+    && !defined(USE_LARGE_ADDRESS_SPACE)
+#define USE_HUGETLB 1
+#endif
+
 static caddr_t next_request = 0;
 
+#if defined(USE_HUGETLB)
+static void initHugePages (void);
+#endif
+
 void osMemInit(void)
 {
     next_request = (caddr_t)RtsFlags.GcFlags.heapBase;
+
+    if (RtsFlags.GcFlags.hugePages) {
+#if defined(USE_HUGETLB)
+        initHugePages();
+#elif !defined(MADV_HUGEPAGE)
+        errorBelch("warning: -xH: huge pages are not supported on this "
+                   "platform");
+#endif
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -197,12 +226,228 @@ gen_map_mblocks (W_ size)
     return ret;
 }
 
+/* -----------------------------------------------------------------------------
+   Huge pages (+RTS -xH)
+
+   With -xH we first try to map the heap with MAP_HUGETLB, which takes
+   memory from the pool of huge pages reserved by the administrator
+   (vm.nr_hugepages, or the per-size pools in /sys/kernel/mm/hugepages).
+   A huge page (2MB or 1GB) holds several mblocks, and such a mapping can
+   only be unmapped in whole huge pages, so:
+
+     - requests are rounded up to whole huge pages, and the mblocks we
+       didn't need go on hugetlb_free, from which later requests are
+       served first;
+
+     - osFreeMBlocks() puts huge-page-backed mblocks back on hugetlb_free
+       rather than unmapping them, so this memory is only given back to
+       the OS by osFreeAllMBlocks();
+
+     - every mapping is remembered in hugetlb_regions, so that we can
+       tell which mblocks are huge-page backed.
+
+   If there is no pool (or no pool of the requested size), we fall back
+   to ordinary mappings and ask for transparent huge pages instead with
+   madvise(MADV_HUGEPAGE), which the kernel honours when it can.
+   -------------------------------------------------------------------------- */
+
+// Number of mblocks we have asked to be backed by transparent huge pages
+static W_ thp_mblocks = 0;
+
+#if defined(USE_HUGETLB)
+
+typedef struct HugeFree_ {
+    struct HugeFree_ *next;
+    W_ n;                       // mblocks in this run, including this one
+} HugeFree;
+
+typedef struct {
+    StgWord8 *start;
+    W_ size;                    // bytes
+} HugeRegion;
+
+static rtsBool     hugetlb_ok = rtsFalse;
+static int         hugetlb_flags = 0;
+static W_          huge_page_size = 0;
+static HugeFree   *hugetlb_free = NULL;
+static HugeRegion *hugetlb_regions = NULL;
+static nat         n_hugetlb_regions = 0;
+static nat         max_hugetlb_regions = 0;
+static W_          hugetlb_mblocks = 0;
+
+// The default huge page size, from /proc/meminfo, or 0
+static W_
+defaultHugePageSize (void)
+{
+    FILE *f;
+    char line[128];
+    unsigned long kb = 0;
+
+    f = fopen("/proc/meminfo", "r");
+    if (f == NULL) return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) break;
+    }
+    fclose(f);
+    return (W_)kb * 1024;
+}
+
+static void
+initHugePages (void)
+{
+    W_ dflt, size;
+    nat shift;
+
+    dflt = defaultHugePageSize();
+    size = RtsFlags.GcFlags.hugePageSize;
+    if (size == 0) size = dflt;
+
+    if (size == 0 || size < MBLOCK_SIZE) {
+        // no hugetlbfs, or pages too small to be worth it
+        return;
+    }
+
+    if (size != dflt) {
+#if defined(MAP_HUGE_SHIFT)
+        for (shift = 0; ((W_)1 << shift) < size; shift++) {}
+        hugetlb_flags = shift << MAP_HUGE_SHIFT;
+#else
+        // we can't ask for a size other than the default
+        (void)shift;
+        return;
+#endif
+    }
+
+    huge_page_size = size;
+    hugetlb_ok = rtsTrue;
+}
+
+static rtsBool
+isHugeMBlock (void *mblock)
+{
+    nat i;
+
+    for (i = 0; i < n_hugetlb_regions; i++) {
+        if ((StgWord8*)mblock >= hugetlb_regions[i].start &&
+            (StgWord8*)mblock < hugetlb_regions[i].start
+                                + hugetlb_regions[i].size) {
+            return rtsTrue;
+        }
+    }
+    return rtsFalse;
+}
+
+static void
+freeHugeMBlocks (void *addr, W_ n)
+{
+    HugeFree *f = (HugeFree *)addr;
+
+    f->n = n;
+    f->next = hugetlb_free;
+    hugetlb_free = f;
+}
+
+static void *
+getHugeMBlocks (nat n)
+{
+    HugeFree **p, *f, *rest;
+    W_ size;
+    void *ret;
+
+    // first fit from the mblocks we already have
+    for (p = &hugetlb_free; *p != NULL; p = &(*p)->next) {
+        f = *p;
+        if (f->n >= n) {
+            if (f->n == n) {
+                *p = f->next;
+            } else {
+                rest = (HugeFree *)((StgWord8*)f + (W_)n * MBLOCK_SIZE);
+                rest->next = f->next;
+                rest->n = f->n - n;
+                *p = rest;
+            }
+            return f;
+        }
+    }
+
+    if (!hugetlb_ok) return NULL;
+
+    size = ((W_)n * MBLOCK_SIZE + huge_page_size - 1) & ~(huge_page_size - 1);
+    ret = mmap(0, size, PROT_READ | PROT_WRITE,
+               MAP_ANON | MAP_PRIVATE | MAP_HUGETLB | hugetlb_flags, -1, 0);
+    if (ret == (void *)-1) {
+        // ENOMEM if the pool is empty, EINVAL if there is no pool of
+        // this size.  Either way, don't try again.
+        errorBelch("warning: -xH: no huge pages of %" FMT_Word " kB "
+                   "available (%s), using transparent huge pages instead",
+                   huge_page_size / 1024, strerror(errno));
+        hugetlb_ok = rtsFalse;
+        return NULL;
+    }
+    // hugetlb mappings are aligned to the huge page size
+    ASSERT(((W_)ret & MBLOCK_MASK) == 0);
+
+    if (n_hugetlb_regions == max_hugetlb_regions) {
+        max_hugetlb_regions = stg_max(16, 2 * max_hugetlb_regions);
+        hugetlb_regions = stgReallocBytes(hugetlb_regions,
+                                  max_hugetlb_regions * sizeof(HugeRegion),
+                                  "getHugeMBlocks");
+    }
+    hugetlb_regions[n_hugetlb_regions].start = ret;
+    hugetlb_regions[n_hugetlb_regions].size = size;
+    n_hugetlb_regions++;
+    hugetlb_mblocks += size / MBLOCK_SIZE;
+
+    if (size > (W_)n * MBLOCK_SIZE) {
+        freeHugeMBlocks((StgWord8*)ret + (W_)n * MBLOCK_SIZE,
+                        size / MBLOCK_SIZE - n);
+    }
+
+    debugTrace(DEBUG_gc, "mapped %" FMT_Word " bytes of huge pages at %p",
+               size, ret);
+    return ret;
+}
+
+#endif /* USE_HUGETLB */
+
+#if defined(MADV_HUGEPAGE)
+static void
+adviseHugePages (void *addr, W_ size)
+{
+    // Failure just means we keep ordinary pages (e.g. a kernel without
+    // THP), which is the fallback anyway.
+    if (madvise(addr, size, MADV_HUGEPAGE) == 0) {
+        thp_mblocks += size / MBLOCK_SIZE;
+    }
+}
+#endif
+
+void
+osHugePageMBlocks (StgWord *hugetlb, StgWord *thp)
+{
+#if defined(USE_HUGETLB)
+    *hugetlb = hugetlb_mblocks;
+#else
+    *hugetlb = 0;
+#endif
+    *thp = thp_mblocks;
+}
+
 void *
 osGetMBlocks(nat n)
 {
   caddr_t ret;
   W_ size = MBLOCK_SIZE * (W_)n;
 
+#if defined(USE_HUGETLB)
+  if (RtsFlags.GcFlags.hugePages) {
+      ret = getHugeMBlocks(n);
+      if (ret != NULL) {
+          return ret;
+      }
+  }
+#endif
+
   if (next_request == 0) {
       // use gen_map_mblocks the first time.
       ret = gen_map_mblocks(size);
@@ -229,11 +474,37 @@ osGetMBlocks(nat n)
   // ToDo: check that we haven't already grabbed the memory at next_request
   next_request = ret + size;
 
+#if defined(MADV_HUGEPAGE)
+  if (RtsFlags.GcFlags.hugePages) {
+      adviseHugePages(ret, size);
+  }
+#endif
+
   return ret;
 }
 
 void osFreeMBlocks(char *addr, nat n)
 {
+#if defined(USE_HUGETLB)
+    W_ i, j;
+
+    if (n_hugetlb_regions > 0) {
+        // The range may span huge and ordinary mappings, if they
+        // happened to be adjacent; deal with each run separately.
+        for (i = 0; i < n; i = j) {
+            rtsBool huge = isHugeMBlock(addr + i * MBLOCK_SIZE);
+            for (j = i + 1;
+                 j < n && isHugeMBlock(addr + j * MBLOCK_SIZE) == huge;
+                 j++) {}
+            if (huge) {
+                freeHugeMBlocks(addr + i * MBLOCK_SIZE, j - i);
+            } else {
+                munmap(addr + i * MBLOCK_SIZE, (j - i) * MBLOCK_SIZE);
+            }
+        }
+        return;
+    }
+#endif
     munmap(addr, n * MBLOCK_SIZE);
 }
 
@@ -241,6 +512,64 @@ void osReleaseFreeMemory(void) {
     /* Nothing to do on POSIX */
 }
 
+// Let the OS take back the memory in [at, at+size), which must be
+// page-aligned, without unmapping it: it reads as zeros afterwards (or
+// as its old contents, with MADV_FREE, if the OS didn't need it).
+rtsBool osDiscardMemory(void *at, W_ size)
+{
+#if defined(MADV_FREE)
+    // Cheaper than MADV_DONTNEED: the pages are only reclaimed under
+    // memory pressure.  Older Linux kernels reject it with EINVAL.
+    if (madvise(at, size, MADV_FREE) == 0) {
+        return rtsTrue;
+    }
+#endif
+#if defined(MADV_DONTNEED)
+    if (madvise(at, size, MADV_DONTNEED) == 0) {
+        return rtsTrue;
+    }
+#endif
+    return rtsFalse;
+}
+
+rtsBool osMapFile (void *at, W_ size, int fd, StgWord64 offset,
+                   rtsBool shared)
+{
+    void *ret;
+    int err;
+
+#if defined(USE_HUGETLB)
+    // can't map part of a huge page
+    if (n_hugetlb_regions > 0 && isHugeMBlock(MBLOCK_ROUND_DOWN(at))) {
+        errno = ENOTSUP;
+        return rtsFalse;
+    }
+#endif
+
+    ret = mmap(at, size, PROT_READ,
+               (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED,
+               fd, (off_t)offset);
+    if (ret == (void *)-1) {
+        // a failed MAP_FIXED may already have dropped the old mapping
+        err = errno;
+        osUnmapFile(at, size);
+        errno = err;
+        return rtsFalse;
+    }
+    return rtsTrue;
+}
+
+void osUnmapFile (void *at, W_ size)
+{
+    void *ret;
+
+    ret = mmap(at, size, PROT_READ | PROT_WRITE,
+               MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+    if (ret == (void *)-1) {
+        barf("osUnmapFile: mmap: %s", strerror(errno));
+    }
+}
+
 void osFreeAllMBlocks(void)
 {
     void *mblock;
@@ -248,10 +577,111 @@ void osFreeAllMBlocks(void)
     for (mblock = getFirstMBlock();
          mblock != NULL;
          mblock = getNextMBlock(mblock)) {
+#if defined(USE_HUGETLB)
+        if (n_hugetlb_regions > 0 && isHugeMBlock(mblock)) continue;
+#endif
         munmap(mblock, MBLOCK_SIZE);
     }
+
+#if defined(USE_HUGETLB)
+    nat i;
+    for (i = 0; i < n_hugetlb_regions; i++) {
+        munmap(hugetlb_regions[i].start, hugetlb_regions[i].size);
+    }
+    stgFree(hugetlb_regions);
+    hugetlb_regions = NULL;
+    n_hugetlb_regions = max_hugetlb_regions = 0;
+    hugetlb_free = NULL;
+#endif
+}
+
+#if defined(USE_LARGE_ADDRESS_SPACE)
+
+/* -----------------------------------------------------------------------------
+   Reserving the heap's address space up front: see Note [Large address
+   space] in MBlock.c.
+   -------------------------------------------------------------------------- */
+
+void *osReserveHeapMemory(void *hint, W_ *len)
+{
+    W_ size, slop;
+    StgWord8 *ret;
+
+    size = (*len + MBLOCK_SIZE - 1) & ~MBLOCK_MASK;
+
+    // The reservation may be refused, e.g. with a ulimit -v, in which case
+    // we try again with 1/8 less until we get something.
+    for (;;) {
+        if (size < MBLOCK_SIZE) {
+            errorBelch("out of memory (could not reserve address space "
+                       "for the heap)");
+            stg_exit(EXIT_FAILURE);
+        }
+        ret = mmap(hint, size + MBLOCK_SIZE, PROT_NONE,
+                   MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+        if (ret != (void *)-1) break;
+        if (errno != ENOMEM && errno != EINVAL) {
+            barf("osReserveHeapMemory: mmap: %s", strerror(errno));
+        }
+        size = (size - size / 8) & ~MBLOCK_MASK;
+    }
+
+    // trim to an MBLOCK_SIZE-aligned range, as in gen_map_mblocks()
+    slop = (W_)ret & MBLOCK_MASK;
+    if (munmap(ret, MBLOCK_SIZE - slop) == -1) {
+        barf("osReserveHeapMemory: munmap failed");
+    }
+    if (slop > 0 && munmap(ret + MBLOCK_SIZE - slop + size, slop) == -1) {
+        barf("osReserveHeapMemory: munmap failed");
+    }
+
+    *len = size;
+    return ret + MBLOCK_SIZE - slop;
+}
+
+void osCommitMemory(void *at, W_ size)
+{
+    void *ret;
+
+    ret = mmap(at, size, PROT_READ | PROT_WRITE,
+               MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+    if (ret == (void *)-1) {
+        if (errno == ENOMEM) {
+            errorBelch("out of memory (requested %" FMT_Word " bytes)", size);
+            stg_exit(EXIT_FAILURE);
+        }
+        barf("osCommitMemory: mmap: %s", strerror(errno));
+    }
+
+#if defined(MADV_HUGEPAGE)
+    if (RtsFlags.GcFlags.hugePages) {
+        adviseHugePages(at, size);
+    }
+#endif
+}
+
+void osDecommitMemory(void *at, W_ size)
+{
+    // Put the range back to the state osReserveHeapMemory() left it in,
+    // which gives the pages back to the OS and unaccounts them.
+    void *ret;
+
+    ret = mmap(at, size, PROT_NONE,
+               MAP_ANON | MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, -1, 0);
+    if (ret == (void *)-1) {
+        sysErrorBelch("unable to decommit memory");
+    }
+}
+
+void osReleaseHeapMemory(void *at, W_ size)
+{
+    if (munmap(at, size) == -1) {
+        sysErrorBelch("unable to release memory");
+    }
 }
 
+#endif /* USE_LARGE_ADDRESS_SPACE */
+
 W_ getPageSize (void)
 {
     static W_ pageSize = 0;
@@ -304,6 +734,37 @@ StgWord64 getPhysicalMemorySize (void)
     return physMemSize;
 }
 
+/* Returns 0 if the size of the last-level cache cannot be identified */
+StgWord64 getLastLevelCacheSize (void)
+{
+    static StgWord64 llcSize = 0;
+    if (!llcSize) {
+#if defined(darwin_HOST_OS) || defined(ios_HOST_OS)
+        size_t len = sizeof(llcSize);
+        if (sysctlbyname("hw.l3cachesize", &llcSize, &len, NULL, 0) == -1
+            || llcSize == 0) {
+            len = sizeof(llcSize);
+            if (sysctlbyname("hw.l2cachesize", &llcSize, &len,
+                             NULL, 0) == -1) {
+                llcSize = 0;
+            }
+        }
+#else
+        long ret = -1;
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+        ret = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+        if (ret <= 0) {
+            ret = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        }
+#endif
+        llcSize = ret > 0 ? (StgWord64)ret : 0;
+#endif /* darwin_HOST_OS */
+    }
+    return llcSize;
+}
+
 void setExecutable (void *p, W_ len, rtsBool exec)
 {
     StgWord pageSize = getPageSize();
@@ -318,3 +779,69 @@ void setExecutable (void *p, W_ len, rtsBool exec)
         barf("setExecutable: failed to protect 0x%p\n", p);
     }
 }
+
+#if defined(HAVE_LIBNUMA) && defined(HAVE_NUMA_H) && defined(HAVE_NUMAIF_H)
+#define USE_LIBNUMA 1
+#endif
+
+rtsBool osNumaAvailable(void)
+{
+#if defined(USE_LIBNUMA)
+    return (numa_available() != -1);
+#else
+    return rtsFalse;
+#endif
+}
+
+nat osNumaNodes(void)
+{
+#if defined(USE_LIBNUMA)
+    return numa_num_configured_nodes();
+#else
+    return 1;
+#endif
+}
+
+StgWord osNumaMask(void)
+{
+#if defined(USE_LIBNUMA)
+    struct bitmask *mask;
+    mask = numa_get_mems_allowed();
+    if (osNumaNodes() > sizeof(StgWord)*8) {
+        barf("osNumaMask: too many NUMA nodes (%d)", osNumaNodes());
+    }
+    StgWord r = mask->maskp[0];
+    numa_bitmask_free(mask);
+    return r;
+#else
+    return 1;
+#endif
+}
+
+void osBindMBlocksToNode(
+    void *addr STG_UNUSED,
+    StgWord size STG_UNUSED,
+    nat node STG_UNUSED)
+{
+#if defined(USE_LIBNUMA)
+    int ret;
+    unsigned long mask = 1UL << node;
+    if (RtsFlags.GcFlags.numa) {
+        // MPOL_PREFERRED rather than MPOL_BIND: if the node is out of
+        // memory we would rather get remote pages than fail.
+        ret = mbind(addr, (unsigned long)size,
+                    MPOL_PREFERRED, &mask, sizeof(mask)*8, 0);
+        if (ret != 0) {
+            sysErrorBelch("mbind");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+#endif
+}
+
+void *osGetMBlocksOnNode(nat n, nat node)
+{
+    void *ret = osGetMBlocks(n);
+    osBindMBlocksToNode(ret, (StgWord)n * MBLOCK_SIZE, node);
+    return ret;
+}
@@ -27,6 +27,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
 #endif
 
 #if defined(HAVE_PTHREAD_H)
@@ -39,6 +41,10 @@
 #if defined(THREADED_RTS)
 #include "RtsUtils.h"
 #include "Task.h"
+#include "Trace.h"
+
+#include <errno.h>
+#include <sys/time.h>
 
 #if HAVE_STRING_H
 #include <string.h>
@@ -72,6 +78,10 @@
 #include <mach/mach.h>
 #endif
 
+#if defined(HAVE_NUMA_H)
+#include <numa.h>
+#endif
+
 #ifdef HAVE_SIGNAL_H
 # include <signal.h>
 #endif
@@ -83,6 +93,136 @@
  *
  */
 
+#if defined(USE_FUTEX_CONDITION)
+
+/* -----------------------------------------------------------------------------
+ * Futex condition variables
+ *
+ * A Condition is a sequence number that every signal and broadcast
+ * bumps.  A waiter reads it while holding the mutex, releases the
+ * mutex and sleeps on the futex for as long as the number hasn't
+ * changed, so a signal in between isn't lost.  Like a pthread condition
+ * variable it may wake spuriously, and with 2^32 signals between the
+ * read and the sleep it could miss one, which we don't worry about.
+ *
+ * Compared with glibc's condition variables this is one atomic
+ * increment and at most one system call to signal, none at all when
+ * nobody is waiting, and the wakeup goes to exactly the thread
+ * sleeping on that Condition: each Task has its own (task->cond), so
+ * the Capability handoff wakes the Task it hands over to.
+ *
+ * waiters is only changed under the mutex, but it is read by
+ * signallers that may not hold it.  The waiter's increment and the
+ * signaller's bump of seq are both full barriers, so either the
+ * signaller sees the waiter or the waiter sees the new seq.
+ * -------------------------------------------------------------------------- */
+
+STATIC_INLINE int
+futex (volatile StgWord32 *uaddr, int op, StgWord32 val,
+       const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+void
+initCondition( Condition* pCond )
+{
+    pCond->seq = 0;
+    pCond->waiters = 0;
+}
+
+void
+closeCondition( Condition* pCond STG_UNUSED )
+{
+}
+
+rtsBool
+broadcastCondition ( Condition* pCond )
+{
+    __sync_fetch_and_add(&pCond->seq, 1);
+    if (pCond->waiters != 0) {
+        futex(&pCond->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+    }
+    return rtsTrue;
+}
+
+rtsBool
+signalCondition ( Condition* pCond )
+{
+    __sync_fetch_and_add(&pCond->seq, 1);
+    if (pCond->waiters != 0) {
+        futex(&pCond->seq, FUTEX_WAKE_PRIVATE, 1, NULL);
+    }
+    return rtsTrue;
+}
+
+void
+unlockAndSignalCondition ( Condition* pCond, Mutex* pMut )
+{
+    StgWord32 waiters;
+
+    __sync_fetch_and_add(&pCond->seq, 1);
+    waiters = pCond->waiters;   // exact: waiters only changes under pMut
+    RELEASE_LOCK(pMut);
+    // The kernel doesn't touch the memory to wake a private futex, so
+    // this is fine even if pCond has gone away
+    if (waiters != 0) {
+        futex(&pCond->seq, FUTEX_WAKE_PRIVATE, 1, NULL);
+    }
+}
+
+rtsBool
+waitCondition ( Condition* pCond, Mutex* pMut )
+{
+    StgWord32 seq;
+
+    __sync_fetch_and_add(&pCond->waiters, 1);
+    seq = pCond->seq;
+    RELEASE_LOCK(pMut);
+    futex(&pCond->seq, FUTEX_WAIT_PRIVATE, seq, NULL);
+    ACQUIRE_LOCK(pMut);
+    __sync_fetch_and_sub(&pCond->waiters, 1);
+    return rtsTrue;
+}
+
+rtsBool
+timedWaitCondition ( Condition* pCond, Mutex* pMut, Time timeout )
+{
+    StgWord32 seq;
+    StgWord64 deadline, now;
+    struct timespec ts;
+    rtsBool woken = rtsTrue;
+    int r;
+
+    deadline = getMonotonicNSec() + TimeToNS(timeout);
+
+    __sync_fetch_and_add(&pCond->waiters, 1);
+    seq = pCond->seq;
+    RELEASE_LOCK(pMut);
+    for (;;) {
+        now = getMonotonicNSec();
+        if (now >= deadline) {
+            woken = rtsFalse;
+            break;
+        }
+        // FUTEX_WAIT takes a relative timeout
+        ts.tv_sec  = (deadline - now) / 1000000000;
+        ts.tv_nsec = (deadline - now) % 1000000000;
+        r = futex(&pCond->seq, FUTEX_WAIT_PRIVATE, seq, &ts);
+        if (r == 0 || errno == EAGAIN) break;
+        if (errno == ETIMEDOUT) {
+            woken = rtsFalse;
+            break;
+        }
+        // EINTR: go round again
+    }
+    ACQUIRE_LOCK(pMut);
+    __sync_fetch_and_sub(&pCond->waiters, 1);
+    return woken;
+}
+
+#else
+
 void
 initCondition( Condition* pCond )
 {
@@ -109,12 +249,38 @@ signalCondition ( Condition* pCond )
   return (pthread_cond_signal(pCond) == 0);
 }
 
+void
+unlockAndSignalCondition ( Condition* pCond, Mutex* pMut )
+{
+  // pCond may not be touched once pMut is released
+  pthread_cond_signal(pCond);
+  RELEASE_LOCK(pMut);
+}
+
 rtsBool
 waitCondition ( Condition* pCond, Mutex* pMut )
 {
   return (pthread_cond_wait(pCond,pMut) == 0);
 }
 
+rtsBool
+timedWaitCondition ( Condition* pCond, Mutex* pMut, Time timeout )
+{
+  struct timeval tv;
+  struct timespec ts;
+  StgInt64 ns;
+
+  // pthread_cond_timedwait() wants an absolute CLOCK_REALTIME time
+  gettimeofday(&tv, NULL);
+  ts.tv_sec = tv.tv_sec;
+  ns = (StgInt64)tv.tv_usec * 1000 + TimeToNS(timeout);
+  ts.tv_sec  += ns / 1000000000;
+  ts.tv_nsec  = ns % 1000000000;
+  return (pthread_cond_timedwait(pCond,pMut,&ts) != ETIMEDOUT);
+}
+
+#endif /* USE_FUTEX_CONDITION */
+
 void
 yieldThread(void)
 {
@@ -175,6 +341,47 @@ closeMutex(Mutex* pMut)
     pthread_mutex_destroy(pMut);
 }
 
+#if defined(linux_HOST_OS) && defined(SYS_futex)
+// A futex is 32 bits: on a 64-bit big-endian machine that's the second
+// half of the word.
+STATIC_INLINE int *
+futexWord (StgVolatilePtr p)
+{
+#if defined(WORDS_BIGENDIAN) && SIZEOF_VOID_P == 8
+    return (int *)p + 1;
+#else
+    return (int *)p;
+#endif
+}
+
+rtsBool
+waitOnWord (StgVolatilePtr p, StgWord expected)
+{
+    // EAGAIN (*p has already changed) and EINTR are fine: the caller
+    // re-checks
+    syscall(SYS_futex, futexWord(p), FUTEX_WAIT_PRIVATE, (int)expected,
+            NULL, NULL, 0);
+    return rtsTrue;
+}
+
+void
+wakeOnWord (StgVolatilePtr p)
+{
+    syscall(SYS_futex, futexWord(p), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#else
+rtsBool
+waitOnWord (StgVolatilePtr p STG_UNUSED, StgWord expected STG_UNUSED)
+{
+    return rtsFalse;
+}
+
+void
+wakeOnWord (StgVolatilePtr p STG_UNUSED)
+{
+}
+#endif
+
 void
 newThreadLocalKey (ThreadLocalKey *key)
 {
@@ -256,9 +463,147 @@ getNumberOfProcessors (void)
 }
 
 #if defined(HAVE_SCHED_H) && defined(HAVE_SCHED_SETAFFINITY)
+
+/* -----------------------------------------------------------------------------
+ * CPU topology
+ *
+ * With +RTS -qa=<policy> we read the package (socket) and core of each
+ * CPU we may run on from /sys/devices/system/cpu, and put the CPUs in
+ * the order in which the policy wants Capabilities placed on them:
+ *
+ *   compact:  core by core, all SMT threads of a core before the next
+ *   scatter:  the first SMT thread of every core, taking the sockets in
+ *             turn, then the second SMT thread of every core, and so on
+ *   physical: as scatter, but only the first SMT thread of each core
+ *
+ * Capability n is then pinned to cpu_order[n % n_cpu_order].  This only
+ * depends on n, so it stays put when setNumCapabilities() changes the
+ * number of Capabilities.  If the topology can't be read, we fall back
+ * to the -qa mapping.
+ * -------------------------------------------------------------------------- */
+
+typedef struct {
+    int cpu;
+    int package;
+    int core;
+    int thread;          // index of this CPU among the SMT threads of its core
+    int core_index;      // index of the core within its package
+} CpuInfo;
+
+static CpuInfo cpu_info[CPU_SETSIZE];
+static int cpu_order[CPU_SETSIZE];
+static nat n_cpu_order = 0;
+
+static int
+readCpuTopologyFile (int cpu, const char *file)
+{
+    char path[128];
+    FILE *f;
+    int val;
+
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, file);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    if (fscanf(f, "%d", &val) != 1) {
+        val = -1;
+    }
+    fclose(f);
+    return val;
+}
+
+static int
+compareCpuLocation (const void *a, const void *b)
+{
+    const CpuInfo *x = a, *y = b;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core)       return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static int
+compareCpuScatter (const void *a, const void *b)
+{
+    const CpuInfo *x = a, *y = b;
+    if (x->thread != y->thread)         return x->thread - y->thread;
+    if (x->core_index != y->core_index) return x->core_index - y->core_index;
+    if (x->package != y->package)       return x->package - y->package;
+    return x->cpu - y->cpu;
+}
+
+void
+initCpuTopology (nat policy)
+{
+    cpu_set_t allowed;
+    nat n, i;
+    int cpu;
+
+    n_cpu_order = 0;
+    if (policy == AFFINITY_MODULO) {
+        return;
+    }
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+        sysErrorBelch("sched_getaffinity");
+        return;
+    }
+
+    n = 0;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        cpu_info[n].cpu     = cpu;
+        cpu_info[n].package = readCpuTopologyFile(cpu, "physical_package_id");
+        cpu_info[n].core    = readCpuTopologyFile(cpu, "core_id");
+        if (cpu_info[n].core < 0) {
+            // no topology information: treat each CPU as a core
+            cpu_info[n].package = 0;
+            cpu_info[n].core    = cpu;
+        }
+        n++;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    // Number the SMT threads of each core, and the cores of each package
+    qsort(cpu_info, n, sizeof(CpuInfo), compareCpuLocation);
+    for (i = 0; i < n; i++) {
+        if (i > 0 && cpu_info[i].package == cpu_info[i-1].package) {
+            if (cpu_info[i].core == cpu_info[i-1].core) {
+                cpu_info[i].thread = cpu_info[i-1].thread + 1;
+                cpu_info[i].core_index = cpu_info[i-1].core_index;
+            } else {
+                cpu_info[i].thread = 0;
+                cpu_info[i].core_index = cpu_info[i-1].core_index + 1;
+            }
+        } else {
+            cpu_info[i].thread = 0;
+            cpu_info[i].core_index = 0;
+        }
+    }
+
+    if (policy != AFFINITY_COMPACT) {
+        qsort(cpu_info, n, sizeof(CpuInfo), compareCpuScatter);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (policy == AFFINITY_PHYSICAL && cpu_info[i].thread != 0) {
+            break;
+        }
+        cpu_order[n_cpu_order++] = cpu_info[i].cpu;
+    }
+
+    debugTrace(DEBUG_sched, "CPU topology: %d CPUs, Capability 0 on CPU %d",
+               n_cpu_order, cpu_order[0]);
+}
+
 // Schedules the thread to run on CPU n of m.  m may be less than the
 // number of physical CPUs, in which case, the thread will be allowed
-// to run on CPU n, n+m, n+2m etc.
+// to run on CPU n, n+m, n+2m etc.  If initCpuTopology() has chosen an
+// order for the CPUs, the thread runs on the (n mod ncpus)'th of them
+// instead.
 void
 setThreadAffinity (nat n, nat m)
 {
@@ -266,8 +611,16 @@ setThreadAffinity (nat n, nat m)
     cpu_set_t cs;
     nat i;
 
-    nproc = getNumberOfProcessors();
     CPU_ZERO(&cs);
+    if (n_cpu_order > 0) {
+        CPU_SET(cpu_order[n % n_cpu_order], &cs);
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &cs) != 0) {
+            sysErrorBelch("sched_setaffinity");
+        }
+        return;
+    }
+
+    nproc = getNumberOfProcessors();
     for (i = n; i < nproc; i+=m) {
         CPU_SET(i, &cs);
     }
@@ -275,6 +628,13 @@ setThreadAffinity (nat n, nat m)
 }
 
 #elif defined(darwin_HOST_OS) && defined(THREAD_AFFINITY_POLICY)
+// Affinity tags are only hints, so there is no topology to apply:
+// -qa=<policy> behaves like -qa.
+void
+initCpuTopology (nat policy STG_UNUSED)
+{
+}
+
 // Schedules the current thread in the affinity set identified by tag n.
 void
 setThreadAffinity (nat n, nat m GNUC3_ATTRIBUTE(__unused__))
@@ -289,6 +649,12 @@ setThreadAffinity (nat n, nat m GNUC3_ATTRIBUTE(__unused__))
 }
 
 #elif defined(HAVE_SYS_CPUSET_H) /* FreeBSD 7.1+ */
+// Not implemented: -qa=<policy> behaves like -qa.
+void
+initCpuTopology (nat policy STG_UNUSED)
+{
+}
+
 void
 setThreadAffinity(nat n, nat m)
 {
@@ -307,6 +673,11 @@ setThreadAffinity(nat n, nat m)
 }
 
 #else
+void
+initCpuTopology (nat policy GNUC3_ATTRIBUTE(__unused__))
+{
+}
+
 void
 setThreadAffinity (nat n GNUC3_ATTRIBUTE(__unused__),
                    nat m GNUC3_ATTRIBUTE(__unused__))
@@ -314,6 +685,18 @@ setThreadAffinity (nat n GNUC3_ATTRIBUTE(__unused__),
 }
 #endif
 
+// Restrict the current thread to the CPUs of OS NUMA node 'node'.
+void
+setThreadNode (nat node GNUC3_ATTRIBUTE(__unused__))
+{
+#if defined(HAVE_LIBNUMA) && defined(HAVE_NUMA_H)
+    if (numa_run_on_node(node) == -1) {
+        sysErrorBelch("numa_run_on_node");
+        stg_exit(1);
+    }
+#endif
+}
+
 void
 interruptOSThread (OSThreadId id)
 {
@@ -23,6 +23,9 @@
 #include "AwaitEvent.h"
 #include "Stats.h"
 #include "GetTime.h"
+#include "AsyncIO.h"
+#include "Stable.h"
+#include "Threads.h"
 
 # ifdef HAVE_SYS_SELECT_H
 #  include <sys/select.h>
@@ -34,13 +37,26 @@
 
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "Clock.h"
 
-#if !defined(THREADED_RTS)
+// Persistent readiness notification, see "Persistent readiness
+// backends" below.
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#elif defined(HAVE_SYS_EVENT_H) && defined(HAVE_KQUEUE)
+#define USE_KQUEUE 1
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
 
 // The target time for a threadDelay is stored in a one-word quantity
-// in the TSO (tso->block_info.target).  On a 32-bit machine we
+// in the sleeping queue (see below).  On a 32-bit machine we
 // therefore can't afford to use nanosecond resolution because it
 // would overflow too quickly, so instead we use millisecond
 // resolution.
@@ -94,17 +110,530 @@ LowResTime getDelayTarget (HsInt us)
  * if this is true, then our time has expired.
  * (idea due to Andy Gill).
  */
+#define BEFORE(t1,t2) (((long)(t1) - (long)(t2)) < 0)
+
+#if !defined(THREADED_RTS)
+
+/* -----------------------------------------------------------------------------
+ * The sleeping queue
+ *
+ * Threads blocked in threadDelay wait in a binary heap ordered on their
+ * target times, so that putting a thread to sleep and taking it out
+ * early, when it gets an exception (System.Timeout.timeout does this
+ * all the time), are O(log n).  A sorted list needed O(n) for both.
+ * A sleeping thread's block_info.sleep_index is its position in the
+ * heap.
+ *
+ * The heap is malloc'd memory and a root for the GC (see
+ * markSleepingThreads()), so stg_delayzh needs no write barrier when
+ * it adds a thread.
+ * -------------------------------------------------------------------------- */
+
+typedef struct {
+    LowResTime target;
+    StgTSO    *tso;
+} Sleeper;
+
+static Sleeper *sleepers = NULL;
+static nat      sleepers_size = 0;
+nat             n_sleeping_threads = 0;
+
+
+static void
+setSleeper (nat i, Sleeper s)
+{
+    sleepers[i] = s;
+    s.tso->block_info.sleep_index = i;
+}
+
+// Put s at position i, or above it if it is earlier than its parent
+static void
+siftUp (nat i, Sleeper s)
+{
+    nat parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!BEFORE(s.target, sleepers[parent].target)) break;
+        setSleeper(i, sleepers[parent]);
+        i = parent;
+    }
+    setSleeper(i, s);
+}
+
+// Put s at position i, or below it if one of its children is earlier
+static void
+siftDown (nat i, Sleeper s)
+{
+    nat child;
+
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= n_sleeping_threads) break;
+        if (child + 1 < n_sleeping_threads &&
+            BEFORE(sleepers[child+1].target, sleepers[child].target)) {
+            child++;
+        }
+        if (!BEFORE(sleepers[child].target, s.target)) break;
+        setSleeper(i, sleepers[child]);
+        i = child;
+    }
+    setSleeper(i, s);
+}
+
+// Called from stg_delayzh
+void
+insertSleepingThread (StgTSO *tso, StgWord target)
+{
+    Sleeper s;
+
+    if (n_sleeping_threads == sleepers_size) {
+        sleepers_size = sleepers_size == 0 ? 64 : sleepers_size * 2;
+        sleepers = stgReallocBytes(sleepers, sleepers_size * sizeof(Sleeper),
+                                   "insertSleepingThread");
+    }
+    s.target = target;
+    s.tso = tso;
+    n_sleeping_threads++;
+    siftUp(n_sleeping_threads - 1, s);
+}
+
+static void
+removeSleeper (nat i)
+{
+    Sleeper last;
+
+    ASSERT(i < n_sleeping_threads);
+    n_sleeping_threads--;
+    if (i == n_sleeping_threads) return;
+
+    last = sleepers[n_sleeping_threads];
+    if (i > 0 && BEFORE(last.target, sleepers[(i - 1) / 2].target)) {
+        siftUp(i, last);
+    } else {
+        siftDown(i, last);
+    }
+}
+
+void
+removeSleepingThread (StgTSO *tso)
+{
+    ASSERT(tso->why_blocked == BlockedOnDelay);
+    ASSERT(sleepers[tso->block_info.sleep_index].tso == tso);
+    removeSleeper(tso->block_info.sleep_index);
+}
+
+void
+markSleepingThreads (evac_fn evac, void *user)
+{
+    nat i;
+
+    // The TSOs may move, but they keep their positions in the heap
+    for (i = 0; i < n_sleeping_threads; i++) {
+        evac(user, (StgClosure **)(void *)&sleepers[i].tso);
+    }
+}
+
+#endif /* !THREADED_RTS */
+
+/* -----------------------------------------------------------------------------
+ * Thread deadlines
+ *
+ * System.Timeout.timeout used to fork a thread that slept for the
+ * timeout and then threw the exception, and to kill that thread when
+ * the action finished first, which is the common case.  Instead it
+ * now gives the thread a deadline, rts_setThreadDeadline(), and takes
+ * it away with rts_clearThreadDeadline(): if the deadline passes
+ * first, the scheduler raises the exception in the thread itself.
+ * When it doesn't, there is no thread, no throwTo and no stack to
+ * rewrite, only an entry in another binary heap, like the sleepers'.
+ *
+ * The heap holds pointers to Deadlines, which are malloc'd so that
+ * Haskell can hold on to them.  A Deadline that has fired is out of
+ * the heap, but is only freed by rts_clearThreadDeadline().
+ *
+ * The exception can only be raised where throwTo could raise it: if
+ * the thread is masking exceptions, and isn't blocked interruptibly,
+ * we try again a tick later.
+ *
+ * In the non-threaded RTS awaitEvent() raises the exceptions, and
+ * sleeps no longer than the earliest deadline.  In the threaded RTS
+ * the heap is protected by deadlines_mutex, and a deadline is raised
+ * by the scheduler of the Capability that owns its thread, in
+ * checkThreadDeadlines(), so that nothing else can be touching the
+ * thread.  A Capability that finds a passed deadline of a thread on
+ * another Capability sends that one a MSG_TRY_WAKEUP for the thread,
+ * which is harmless to the thread and gets its scheduler to look.
+ * An idle RTS has nothing to run the scheduler, so the timer keeps
+ * going while there are deadlines, and wakes the RTS up when the
+ * earliest passes (threadDeadlineDue()).
+ *
+ * A thread in a foreign call gets the exception when the call
+ * returns, so then throwTo() leaves a message on the thread's
+ * blocked_exceptions.  We keep the message on the Deadline, which
+ * stays on pending_deadlines (a GC root) until
+ * rts_clearThreadDeadline(), which revokes the message if it still
+ * hasn't been delivered, so that it can't arrive after the deadline
+ * is gone either.
+ * -------------------------------------------------------------------------- */
+
+#define DEADLINE_FIRED ((nat)-1)
+
+typedef struct Deadline_ {
+    LowResTime  target;
+    StgTSO     *tso;
+    StgClosure *exception;
+    nat         index;      // in the heap, or DEADLINE_FIRED
+#if defined(THREADED_RTS)
+    rtsBool     poked;      // the owner's Capability has been told
+    MessageThrowTo *msg;    // waiting on the thread's blocked_exceptions
+    struct Deadline_ *prev_pending, *next_pending;
+#endif
+} Deadline;
+
+static Deadline **deadlines = NULL;
+static nat        deadlines_size = 0;
+nat               n_thread_deadlines = 0;
+
+#if defined(THREADED_RTS)
+static Mutex      deadlines_mutex;
+static Deadline  *pending_deadlines = NULL;
+
+// The target of deadlines[0], or 0 if there are no deadlines, for
+// threadDeadlineDue() to look at without taking deadlines_mutex.
+static volatile LowResTime earliest_deadline = 0;
+#endif
+
+static void
+setDeadline (nat i, Deadline *d)
+{
+    deadlines[i] = d;
+    d->index = i;
+}
+
+static void
+siftUpDeadline (nat i, Deadline *d)
+{
+    nat parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!BEFORE(d->target, deadlines[parent]->target)) break;
+        setDeadline(i, deadlines[parent]);
+        i = parent;
+    }
+    setDeadline(i, d);
+}
+
+static void
+siftDownDeadline (nat i, Deadline *d)
+{
+    nat child;
+
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= n_thread_deadlines) break;
+        if (child + 1 < n_thread_deadlines &&
+            BEFORE(deadlines[child+1]->target, deadlines[child]->target)) {
+            child++;
+        }
+        if (!BEFORE(deadlines[child]->target, d->target)) break;
+        setDeadline(i, deadlines[child]);
+        i = child;
+    }
+    setDeadline(i, d);
+}
+
+static void
+insertDeadline (Deadline *d)
+{
+    if (n_thread_deadlines == deadlines_size) {
+        deadlines_size = deadlines_size == 0 ? 64 : deadlines_size * 2;
+        deadlines = stgReallocBytes(deadlines,
+                                    deadlines_size * sizeof(Deadline *),
+                                    "insertDeadline");
+    }
+    n_thread_deadlines++;
+    siftUpDeadline(n_thread_deadlines - 1, d);
+}
+
+static void
+removeDeadline (Deadline *d)
+{
+    nat i = d->index;
+    Deadline *last;
+
+    ASSERT(i < n_thread_deadlines && deadlines[i] == d);
+    n_thread_deadlines--;
+    d->index = DEADLINE_FIRED;
+    if (i == n_thread_deadlines) return;
+
+    last = deadlines[n_thread_deadlines];
+    if (i > 0 && BEFORE(last->target, deadlines[(i - 1) / 2]->target)) {
+        siftUpDeadline(i, last);
+    } else {
+        siftDownDeadline(i, last);
+    }
+}
+
+// Can we raise the exception in tso now?  If not, we try again later.
+static rtsBool
+deadlineCanFire (StgTSO *tso)
+{
+    if ((tso->flags & TSO_BLOCKEX) &&
+        !((tso->flags & TSO_INTERRUPTIBLE) && interruptible(tso))) {
+        return rtsFalse;
+    }
+#if defined(THREADED_RTS)
+    // throwTo() would send a message to get hold of the thread
+    if (tso->why_blocked == BlockedOnMsgThrowTo) {
+        return rtsFalse;
+    }
+#endif
+    return rtsTrue;
+}
+
+static void
+retryDeadline (Deadline *d)
+{
+    d->target = getDelayTarget(TimeToUS(RtsFlags.MiscFlags.tickInterval));
+    siftDownDeadline(d->index, d);
+}
+
+#if defined(THREADED_RTS)
+static void
+noteEarliestDeadline (void)
+{
+    earliest_deadline = n_thread_deadlines > 0 ? deadlines[0]->target : 0;
+}
+#endif
+
+void *
+rts_setThreadDeadline (StgPtr tso, HsInt us, HsStablePtr exception)
+{
+    Deadline *d;
+
+    d = stgMallocBytes(sizeof(Deadline), "rts_setThreadDeadline");
+    d->target    = getDelayTarget(us);
+    d->tso       = (StgTSO *)tso;
+    d->exception = (StgClosure *)deRefStablePtr(exception);
+    freeStablePtr(exception);
+#if defined(THREADED_RTS)
+    d->poked = rtsFalse;
+    d->msg   = NULL;
+    ACQUIRE_LOCK(&deadlines_mutex);
+#endif
+    insertDeadline(d);
+#if defined(THREADED_RTS)
+    noteEarliestDeadline();
+    RELEASE_LOCK(&deadlines_mutex);
+#endif
+    return d;
+}
+
+void
+rts_clearThreadDeadline (void *deadline)
+{
+    Deadline *d = deadline;
+
+#if defined(THREADED_RTS)
+    ACQUIRE_LOCK(&deadlines_mutex);
+    if (d->msg != NULL) {
+        const StgInfoTable *i;
+
+        // revoke the exception if it is still waiting
+        i = lockClosure((StgClosure *)d->msg);
+        unlockClosure((StgClosure *)d->msg,
+                      i == &stg_MSG_THROWTO_info ? &stg_MSG_NULL_info : i);
+
+        if (d->prev_pending == NULL) {
+            pending_deadlines = d->next_pending;
+        } else {
+            d->prev_pending->next_pending = d->next_pending;
+        }
+        if (d->next_pending != NULL) {
+            d->next_pending->prev_pending = d->prev_pending;
+        }
+    }
+#endif
+    if (d->index != DEADLINE_FIRED) {
+        removeDeadline(d);
+    }
+#if defined(THREADED_RTS)
+    noteEarliestDeadline();
+    RELEASE_LOCK(&deadlines_mutex);
+#endif
+    stgFree(d);
+}
+
+void
+markThreadDeadlines (evac_fn evac, void *user)
+{
+    nat i;
+
+    for (i = 0; i < n_thread_deadlines; i++) {
+        evac(user, (StgClosure **)(void *)&deadlines[i]->tso);
+        evac(user, &deadlines[i]->exception);
+    }
+#if defined(THREADED_RTS)
+    {
+        Deadline *d;
+        for (d = pending_deadlines; d != NULL; d = d->next_pending) {
+            evac(user, (StgClosure **)(void *)&d->msg);
+        }
+    }
+#endif
+}
+
+#if !defined(THREADED_RTS)
+
+static rtsBool fireThreadDeadlines (LowResTime now)
+{
+    Deadline *d;
+    StgTSO *tso;
+    rtsBool flag = rtsFalse;
+
+    while (n_thread_deadlines > 0) {
+        d = deadlines[0];
+        if (BEFORE(now, d->target)) {
+            break;
+        }
+        tso = d->tso;
+        if (!deadlineCanFire(tso)) {
+            retryDeadline(d);
+            continue;
+        }
+        removeDeadline(d);
+        IF_DEBUG(scheduler, debugBelch("Deadline of thread %lu passed\n",
+                                       (unsigned long)tso->id));
+        // a no-op if the thread has finished
+        throwToSingleThreaded(&MainCapability, tso, d->exception);
+        flag = rtsTrue;
+    }
+    return flag;
+}
+
+#else /* THREADED_RTS */
+
+void
+initThreadDeadlines (void)
+{
+    initMutex(&deadlines_mutex);
+}
+
+void
+freeThreadDeadlines (void)
+{
+    closeMutex(&deadlines_mutex);
+}
+
+rtsBool
+threadDeadlineDue (void)
+{
+    LowResTime t = earliest_deadline;
+
+    return t != 0 && !BEFORE(getLowResTimeOfDay(), t);
+}
+
+// The number of passed deadlines that checkThreadDeadlines() looks at
+// in one go
+#define DEADLINE_BATCH 32
+
+/*
+ * Raise the exceptions of the passed deadlines of the threads on cap,
+ * and tell the other Capabilities about theirs.  Called by the
+ * scheduler, holding cap.
+ */
+void
+checkThreadDeadlines (Capability *cap)
+{
+    Deadline *due[DEADLINE_BATCH];
+    Deadline *d;
+    StgTSO *tso;
+    MessageThrowTo *msg;
+    LowResTime now;
+    nat i, n;
+
+    if (!threadDeadlineDue()) return;
+
+    now = getLowResTimeOfDay();
+
+    ACQUIRE_LOCK(&deadlines_mutex);
+
+    // Take the passed deadlines out of the heap, so that those of
+    // other Capabilities don't hide ours.
+    for (n = 0; n < DEADLINE_BATCH && n_thread_deadlines > 0; n++) {
+        d = deadlines[0];
+        if (BEFORE(now, d->target)) break;
+        removeDeadline(d);
+        due[n] = d;
+    }
+
+    for (i = 0; i < n; i++) {
+        d = due[i];
+        tso = d->tso;
+
+        // Only the owner of the thread may raise the exception: a
+        // thread's cap only changes while its owner holds it, so if it
+        // is ours it stays ours.
+        if (tso->cap != cap) {
+            if (!d->poked) {
+                d->poked = rtsTrue;
+                tryWakeupThread(cap, tso);
+            }
+            insertDeadline(d);
+            continue;
+        }
+
+        d->poked = rtsFalse;
+        if (tso->what_next == ThreadComplete ||
+            tso->what_next == ThreadKilled) {
+            // leave the Deadline for rts_clearThreadDeadline()
+            continue;
+        }
+        if (!deadlineCanFire(tso)) {
+            insertDeadline(d);
+            retryDeadline(d);
+            continue;
+        }
+
+        debugTraceCap(DEBUG_sched, cap, "deadline of thread %lu passed",
+                      (unsigned long)tso->id);
+
+        // As in throwToSelf(): the thread doesn't block, so it can be
+        // its own source.
+        msg = throwTo(cap, tso, tso, d->exception);
+        if (msg != NULL) {
+            unlockClosure((StgClosure *)msg, &stg_MSG_THROWTO_info);
+            d->msg = msg;
+            d->prev_pending = NULL;
+            d->next_pending = pending_deadlines;
+            if (pending_deadlines != NULL) {
+                pending_deadlines->prev_pending = d;
+            }
+            pending_deadlines = d;
+        }
+    }
+
+    noteEarliestDeadline();
+    RELEASE_LOCK(&deadlines_mutex);
+}
+
+#endif /* THREADED_RTS */
+
+#if !defined(THREADED_RTS)
+
 static rtsBool wakeUpSleepingThreads (LowResTime now)
 {
     StgTSO *tso;
     rtsBool flag = rtsFalse;
 
-    while (sleeping_queue != END_TSO_QUEUE) {
-        tso = sleeping_queue;
-        if (((long)now - (long)tso->block_info.target) < 0) {
+    while (n_sleeping_threads > 0) {
+        if (BEFORE(now, sleepers[0].target)) {
             break;
         }
-        sleeping_queue = tso->_link;
+        tso = sleepers[0].tso;
+        removeSleeper(0);
         tso->why_blocked = NotBlocked;
         tso->_link = END_TSO_QUEUE;
         IF_DEBUG(scheduler, debugBelch("Waking up sleeping thread %lu\n",
@@ -204,6 +733,535 @@ static enum FdState fdPollWriteState (int fd)
         return RTS_FD_IS_READY;
 }
 
+/* -----------------------------------------------------------------------------
+ * Persistent readiness backends (epoll / kqueue)
+ *
+ * The select() loop below rebuilds its fd_sets from blocked_queue_hd
+ * on every call, hands the whole set to the kernel each time, and
+ * cannot cope with descriptors >= FD_SETSIZE.  Where the platform
+ * offers epoll (Linux) or kqueue (BSD, OS X) we instead keep the
+ * kernel-side registrations alive between calls, and the kernel
+ * reports back just the descriptors that are ready.
+ *
+ * We only make an epoll_ctl()/kevent() call for a descriptor when the
+ * interest in it changes, so a round costs system calls in proportion
+ * to the changes and the ready descriptors, not to the number of
+ * blocked threads.  The kernel silently forgets a registration when
+ * its descriptor is closed, so a change can fail with EBADF (we wake
+ * its threads, as select() would) or, if the descriptor was closed and
+ * reopened with the same number, ENOENT (we register it again).  A
+ * descriptor that the kernel reports with EPOLLHUP/EPOLLERR (EV_EOF or
+ * EV_ERROR for kqueue) is checked the same way in the next round, even
+ * if its interest hasn't changed.
+ *
+ * We still walk the blocked queue to work out which threads to wake,
+ * because the blocked queue is what the GC and throwTo (see
+ * removeFromQueues() in RaiseAsync.c) know about, but that walk
+ * makes no system calls.
+ *
+ * If the backend cannot be initialised at runtime (e.g. epoll_create1
+ * fails with ENOSYS), we fall back to select().
+ * -------------------------------------------------------------------------- */
+
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+#define USE_POLL_BACKEND 1
+
+#define FD_WANT_READ  1
+#define FD_WANT_WRITE 2
+
+typedef struct {
+    StgWord8  registered; // FD_WANT_* bits currently known to the kernel
+    StgWord8  wanted;     // FD_WANT_* bits wanted by blocked threads
+    StgWord8  ready;      // FD_WANT_* bits the kernel reported as ready
+    StgWord8  invalid;    // the kernel refused the fd (EBADF)
+    StgWord8  recheck;    // hung up or failed: re-register next round
+    StgWord32 round;      // the round in which wanted/ready were last reset
+} FdInterest;
+
+// -1: not initialised yet, -2: initialisation failed, use select()
+static int poll_fd = -1;
+
+// Indexed by file descriptor, grown on demand
+static FdInterest *fd_table = NULL;
+static int fd_table_size = 0;
+
+// The descriptors registered with the kernel, and those wanted in
+// the current round.  Swapped at the end of each round.
+static int *registered_fds = NULL;
+static int n_registered_fds = 0;
+static int *round_fds = NULL;
+static int n_round_fds = 0;
+
+// Set when a negative fd is seen; such threads must be woken promptly
+static rtsBool round_has_bad_fd = rtsFalse;
+
+static StgWord32 poll_round = 0;
+
+#define MAX_POLL_EVENTS 256
+
+static rtsBool
+initPollBackend (void)
+{
+    if (poll_fd >= 0) return rtsTrue;
+    if (poll_fd == -2) return rtsFalse;
+
+#if defined(USE_EPOLL)
+    poll_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    poll_fd = kqueue();
+    if (poll_fd >= 0) {
+        fcntl(poll_fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (poll_fd < 0) {
+        IF_DEBUG(scheduler,
+                 debugBelch("awaitEvent: persistent poll backend unavailable"
+                            " (errno %d), falling back to select()\n",
+                            errno));
+        poll_fd = -2;
+        return rtsFalse;
+    }
+    return rtsTrue;
+}
+
+static void
+growFdTable (int fd)
+{
+    int new_size, i;
+
+    new_size = fd_table_size == 0 ? 64 : fd_table_size;
+    while (new_size <= fd) new_size *= 2;
+
+    fd_table = stgReallocBytes(fd_table, new_size * sizeof(FdInterest),
+                               "growFdTable");
+    for (i = fd_table_size; i < new_size; i++) {
+        fd_table[i].registered = 0;
+        fd_table[i].wanted     = 0;
+        fd_table[i].ready      = 0;
+        fd_table[i].invalid    = 0;
+        fd_table[i].recheck    = 0;
+        fd_table[i].round      = 0;
+    }
+    fd_table_size = new_size;
+
+    // registered_fds and round_fds never hold more entries than
+    // there are slots in fd_table.
+    registered_fds = stgReallocBytes(registered_fds, new_size * sizeof(int),
+                                     "growFdTable");
+    round_fds = stgReallocBytes(round_fds, new_size * sizeof(int),
+                                "growFdTable");
+}
+
+static void
+wantFd (int fd, StgWord8 what)
+{
+    if (fd < 0) {
+        // Nothing sensible to ask the kernel; treat it like EBADF.
+        round_has_bad_fd = rtsTrue;
+        return;
+    }
+    if (fd >= fd_table_size) {
+        growFdTable(fd);
+    }
+    if (fd_table[fd].round != poll_round) {
+        fd_table[fd].round   = poll_round;
+        fd_table[fd].wanted  = 0;
+        fd_table[fd].ready   = 0;
+        fd_table[fd].invalid = 0;
+        round_fds[n_round_fds++] = fd;
+    }
+    fd_table[fd].wanted |= what;
+}
+
+enum RegResult {
+    REG_OK = 0,
+    REG_BAD_FD,       // the fd is not open
+    REG_UNPOLLABLE,   // the fd cannot be polled and is always ready
+};
+
+/*
+ * Tell the kernel that we are now interested in 'wanted' on fd, where
+ * 'registered' is what we last told it.  Called when they differ, or
+ * with registered == wanted when fd has hung up, to find out whether
+ * it is still open.
+ */
+#if defined(USE_EPOLL)
+static enum RegResult
+updateRegistration (int fd, StgWord8 registered, StgWord8 wanted)
+{
+    struct epoll_event ev;
+    int op, r;
+
+    if (wanted == 0) {
+        // Failure here just means the fd has already been closed,
+        // which removes it from the epoll set anyway.
+        epoll_ctl(poll_fd, EPOLL_CTL_DEL, fd, NULL);
+        return REG_OK;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    ev.events  = ((wanted & FD_WANT_READ)  ? EPOLLIN  : 0)
+               | ((wanted & FD_WANT_WRITE) ? EPOLLOUT : 0);
+
+    op = registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    for (;;) {
+        r = epoll_ctl(poll_fd, op, fd, &ev);
+        if (r == 0) return REG_OK;
+
+        switch (errno) {
+        case ENOENT:
+            // the fd was closed and reopened behind our back, so the
+            // kernel has forgotten about it.
+            if (op == EPOLL_CTL_MOD) { op = EPOLL_CTL_ADD; continue; }
+            return REG_BAD_FD;
+        case EEXIST:
+            if (op == EPOLL_CTL_ADD) { op = EPOLL_CTL_MOD; continue; }
+            return REG_BAD_FD;
+        case EPERM:
+            // Regular files and directories cannot be polled; select()
+            // always reports them as ready, so we do the same.
+            return REG_UNPOLLABLE;
+        case EBADF:
+            return REG_BAD_FD;
+        default:
+            sysErrorBelch("epoll_ctl");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+}
+#else /* USE_KQUEUE */
+static enum RegResult
+updateRegistration (int fd, StgWord8 registered, StgWord8 wanted)
+{
+    struct kevent ch[2];
+    struct kevent res[2];
+    int n = 0, r, i;
+    enum RegResult result = REG_OK;
+
+    // EV_ADD of a filter that is already there just updates it, so we
+    // add the wanted filters even if they are registered: if fd has
+    // been closed meanwhile, that re-registers it or reports EBADF.
+    if (wanted & FD_WANT_READ) {
+        EV_SET(&ch[n++], fd, EVFILT_READ, EV_ADD | EV_RECEIPT, 0, 0, NULL);
+    } else if (registered & FD_WANT_READ) {
+        EV_SET(&ch[n++], fd, EVFILT_READ, EV_DELETE | EV_RECEIPT, 0, 0, NULL);
+    }
+    if (wanted & FD_WANT_WRITE) {
+        EV_SET(&ch[n++], fd, EVFILT_WRITE, EV_ADD | EV_RECEIPT, 0, 0, NULL);
+    } else if (registered & FD_WANT_WRITE) {
+        EV_SET(&ch[n++], fd, EVFILT_WRITE, EV_DELETE | EV_RECEIPT, 0, 0, NULL);
+    }
+    if (n == 0) return REG_OK;
+
+    // With EV_RECEIPT every change is reported back individually, so
+    // a bad fd does not stop the other changes from being applied.
+    while ((r = kevent(poll_fd, ch, n, res, n, NULL)) < 0) {
+        if (errno != EINTR) {
+            sysErrorBelch("kevent");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < r; i++) {
+        if (!(res[i].flags & EV_ERROR) || res[i].data == 0) continue;
+        if (ch[i].flags & EV_DELETE) continue; // closed already: fine
+        if (res[i].data == EBADF) {
+            result = REG_BAD_FD;
+        } else if (res[i].data != ENOENT) {
+            errno = res[i].data;
+            sysErrorBelch("kevent");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+    return result;
+}
+#endif
+
+/*
+ * Bring the kernel's registrations into line with the blocked queue.
+ * Only the descriptors whose interest has changed, or that have hung
+ * up, cost a system call (see above).
+ */
+static void
+syncRegistrations (void)
+{
+    StgTSO *tso;
+    int i, fd, *tmp;
+
+    // Start a new round.  Round 0 is reserved for "never seen".
+    poll_round++;
+    if (poll_round == 0) {
+        for (i = 0; i < fd_table_size; i++) fd_table[i].round = 0;
+        poll_round = 1;
+    }
+    n_round_fds = 0;
+    round_has_bad_fd = rtsFalse;
+
+    for (tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = tso->_link) {
+#if defined(linux_HOST_OS)
+        if (tso->flags & TSO_ASYNC_IO) continue;  // see asyncIOPollFd()
+#endif
+        switch (tso->why_blocked) {
+        case BlockedOnRead:
+            wantFd(tso->block_info.fd, FD_WANT_READ);
+            break;
+        case BlockedOnWrite:
+            wantFd(tso->block_info.fd, FD_WANT_WRITE);
+            break;
+        default:
+            barf("awaitEvent");
+        }
+    }
+#if defined(linux_HOST_OS)
+    if (asyncIOPollFd() >= 0) {
+        wantFd(asyncIOPollFd(), FD_WANT_READ);
+    }
+#endif
+
+    // Drop registrations nobody is waiting on any more
+    for (i = 0; i < n_registered_fds; i++) {
+        fd = registered_fds[i];
+        if (fd_table[fd].round != poll_round
+            && fd_table[fd].registered != 0) {
+            updateRegistration(fd, fd_table[fd].registered, 0);
+            fd_table[fd].registered = 0;
+        }
+    }
+
+    // Add or modify the ones that are wanted, and re-validate those
+    // that have hung up
+    for (i = 0; i < n_round_fds; i++) {
+        fd = round_fds[i];
+        if (fd_table[fd].wanted == fd_table[fd].registered
+            && !fd_table[fd].recheck) {
+            continue;
+        }
+        fd_table[fd].recheck = 0;
+        switch (updateRegistration(fd, fd_table[fd].registered,
+                                   fd_table[fd].wanted)) {
+        case REG_OK:
+            fd_table[fd].registered = fd_table[fd].wanted;
+            break;
+        case REG_BAD_FD:
+            fd_table[fd].registered = 0;
+            fd_table[fd].invalid = 1;
+            break;
+        case REG_UNPOLLABLE:
+            // leave it unregistered, so that we try again (and
+            // report it ready again) next round.
+            fd_table[fd].registered = 0;
+            fd_table[fd].ready |= fd_table[fd].wanted;
+            break;
+        }
+    }
+
+    // The descriptors wanted this round are the ones we now have
+    // registered, or will try to register again next round.
+    tmp = registered_fds;
+    registered_fds = round_fds;
+    n_registered_fds = n_round_fds;
+    round_fds = tmp;
+}
+
+/*
+ * Wait for events.  timeout < 0 means wait forever.  Returns the
+ * number of descriptors found ready, 0 on timeout, or -1 with errno
+ * set on failure.
+ */
+static int
+pollForEvents (Time timeout)
+{
+    rtsBool any_ready = round_has_bad_fd;
+    int i, n, fd;
+
+    // Descriptors that are ready without asking the kernel (regular
+    // files, invalid descriptors) mean we must not block.
+    for (i = 0; i < n_registered_fds && !any_ready; i++) {
+        fd = registered_fds[i];
+        if (fd_table[fd].ready || fd_table[fd].invalid) {
+            any_ready = rtsTrue;
+            break;
+        }
+    }
+    if (any_ready) timeout = 0;
+
+    {
+#if defined(USE_EPOLL)
+        struct epoll_event events[MAX_POLL_EVENTS];
+        int ms;
+
+        if (timeout < 0) {
+            ms = -1;
+        } else {
+            // round up: we never want to sleep *less* than requested
+            Time t = (TimeToNS(timeout) + 999999) / 1000000;
+            ms = t > INT_MAX ? INT_MAX : (int)t;
+        }
+
+        n = epoll_wait(poll_fd, events, MAX_POLL_EVENTS, ms);
+        if (n < 0) return n;
+
+        for (i = 0; i < n; i++) {
+            fd = events[i].data.fd;
+            if (fd < 0 || fd >= fd_table_size) continue;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                fd_table[fd].ready |= FD_WANT_READ;
+            }
+            if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                fd_table[fd].ready |= FD_WANT_WRITE;
+            }
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                fd_table[fd].recheck = 1;
+            }
+        }
+#else /* USE_KQUEUE */
+        struct kevent events[MAX_POLL_EVENTS];
+        struct timespec ts, *pts;
+
+        if (timeout < 0) {
+            pts = NULL;
+        } else {
+            // kqueue rejects absurdly large timeouts, see the comment
+            // about select() and SUSv2 in awaitEvent().
+            const time_t max_seconds = 2678400; // 31 * 24 * 60 * 60
+            ts.tv_sec = TimeToSeconds(timeout);
+            if (ts.tv_sec < max_seconds) {
+                ts.tv_nsec = TimeToNS(timeout) % 1000000000;
+            } else {
+                ts.tv_sec  = max_seconds;
+                ts.tv_nsec = 0;
+            }
+            pts = &ts;
+        }
+
+        n = kevent(poll_fd, NULL, 0, events, MAX_POLL_EVENTS, pts);
+        if (n < 0) return n;
+
+        for (i = 0; i < n; i++) {
+            fd = (int)events[i].ident;
+            if (fd < 0 || fd >= fd_table_size) continue;
+            if (events[i].filter == EVFILT_READ) {
+                fd_table[fd].ready |= FD_WANT_READ;
+            } else if (events[i].filter == EVFILT_WRITE) {
+                fd_table[fd].ready |= FD_WANT_WRITE;
+            }
+            if (events[i].flags & (EV_EOF | EV_ERROR)) {
+                fd_table[fd].recheck = 1;
+            }
+        }
+#endif
+    }
+
+    return any_ready ? n + 1 : n;
+}
+
+static enum FdState
+fdPollBackendState (int fd, StgWord8 what)
+{
+    if (fd < 0 || fd >= fd_table_size || fd_table[fd].invalid) {
+        return RTS_FD_IS_INVALID;
+    }
+    return (fd_table[fd].ready & what) ? RTS_FD_IS_READY : RTS_FD_IS_BLOCKING;
+}
+
+/*
+ * After fork() the child shares the kernel's epoll/kqueue object with
+ * the parent (epoll) or does not inherit it at all (kqueue), so start
+ * again from scratch.
+ */
+void
+resetAwaitEvent (void)
+{
+    int i;
+
+    if (poll_fd >= 0) {
+        close(poll_fd);
+    }
+    poll_fd = -1;
+    for (i = 0; i < fd_table_size; i++) {
+        fd_table[i].registered = 0;
+        fd_table[i].recheck = 0;
+    }
+    n_registered_fds = 0;
+}
+
+#else /* !USE_POLL_BACKEND */
+
+void
+resetAwaitEvent (void)
+{
+}
+
+#endif /* USE_POLL_BACKEND */
+
+/*
+ * How long may awaitEvent() block for?  Returns -1 for "forever".
+ */
+static Time
+awaitEventTimeout (rtsBool wait, LowResTime now)
+{
+    LowResTime target;
+
+    if (!wait) {
+        return 0;
+    } else if (n_sleeping_threads > 0) {
+        target = sleepers[0].target;
+        if (n_thread_deadlines > 0 &&
+            BEFORE(deadlines[0]->target, target)) {
+            target = deadlines[0]->target;
+        }
+        return LowResTimeToTime(target - now);
+    } else if (n_thread_deadlines > 0) {
+        return LowResTimeToTime(deadlines[0]->target - now);
+    } else {
+        return -1;
+    }
+}
+
+/*
+ * We were interrupted by a signal while waiting.  Returns rtsTrue if
+ * we should return to the scheduler straight away.
+ */
+static rtsBool
+awaitEventInterrupted (void)
+{
+    /* We got a signal; could be one of ours.  If so, we need
+     * to start up the signal handler straight away, otherwise
+     * we could block for a long time before the signal is
+     * serviced.
+     */
+#if defined(RTS_USER_SIGNALS)
+    if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
+        startSignalHandlers(&MainCapability);
+        return rtsTrue; /* still hold the lock */
+    }
+#endif
+
+    /* we were interrupted, return to the scheduler immediately.
+     */
+    if (sched_state >= SCHED_INTERRUPTING) {
+        return rtsTrue; /* still hold the lock */
+    }
+
+    /* check for threads that need waking up
+     */
+    {
+        LowResTime now = getLowResTimeOfDay();
+        wakeUpSleepingThreads(now);
+        fireThreadDeadlines(now);
+    }
+
+    /* If new runnable threads have arrived, stop waiting for
+     * I/O and run them.
+     */
+    if (!emptyRunQueue(&MainCapability)) {
+        return rtsTrue; /* still hold the lock */
+    }
+
+    return rtsFalse;
+}
+
 /* Argument 'wait' says whether to wait for I/O to become available,
  * or whether to just check and return immediately.  If there are
  * other threads ready to run, we normally do the non-waiting variety,
@@ -225,8 +1283,12 @@ awaitEvent(rtsBool wait)
     int numFound;
     int maxfd = -1;
     rtsBool seen_bad_fd = rtsFalse;
+#if defined(USE_POLL_BACKEND)
+    rtsBool use_select;
+#endif
     struct timeval tv, *ptv;
     LowResTime now;
+    Time timeout;
 
     IF_DEBUG(scheduler,
              debugBelch("scheduler: checking for threads blocked on I/O");
@@ -236,6 +1298,10 @@ awaitEvent(rtsBool wait)
              debugBelch("\n");
              );
 
+#if defined(USE_POLL_BACKEND)
+    use_select = !initPollBackend();
+#endif
+
     /* loop until we've woken up some threads.  This loop is needed
      * because the select timing isn't accurate, we sometimes sleep
      * for a while but not long enough to wake up a thread in
@@ -244,10 +1310,37 @@ awaitEvent(rtsBool wait)
     do {
 
       now = getLowResTimeOfDay();
-      if (wakeUpSleepingThreads(now)) {
+      if (wakeUpSleepingThreads(now) | fireThreadDeadlines(now)) {
+          return;
+      }
+#if defined(linux_HOST_OS)
+      if (awaitRequests()) {
           return;
       }
+#endif
+
+      timeout = awaitEventTimeout(wait, now);
+
+#if defined(USE_POLL_BACKEND)
+      if (!use_select) {
+          syncRegistrations();
 
+          while (pollForEvents(timeout) < 0) {
+              if (errno != EINTR) {
+#if defined(USE_EPOLL)
+                  sysErrorBelch("epoll_wait");
+#else
+                  sysErrorBelch("kevent");
+#endif
+                  stg_exit(EXIT_FAILURE);
+              }
+              if (awaitEventInterrupted()) {
+                  return;
+              }
+          }
+      } else
+#endif
+      {
       /*
        * Collect all of the fd's that we're interested in
        */
@@ -257,6 +1350,10 @@ awaitEvent(rtsBool wait)
       for(tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
         next = tso->_link;
 
+#if defined(linux_HOST_OS)
+        if (tso->flags & TSO_ASYNC_IO) continue;
+#endif
+
       /* On FreeBSD FD_SETSIZE is unsigned. Cast it to signed int
        * in order to switch off the 'comparison between signed and
        * unsigned error message
@@ -289,12 +1386,17 @@ awaitEvent(rtsBool wait)
         }
       }
 
-      if (!wait) {
-          // just poll
-          tv.tv_sec  = 0;
-          tv.tv_usec = 0;
-          ptv = &tv;
-      } else if (sleeping_queue != END_TSO_QUEUE) {
+#if defined(linux_HOST_OS)
+      if (asyncIOPollFd() >= 0) {
+          int fd = asyncIOPollFd();
+          maxfd = (fd > maxfd) ? fd : maxfd;
+          FD_SET(fd, &rfd);
+      }
+#endif
+
+      if (timeout < 0) {
+          ptv = NULL;
+      } else {
           /* SUSv2 allows implementations to have an implementation defined
            * maximum timeout for select(2). The standard requires
            * implementations to silently truncate values exceeding this maximum
@@ -313,17 +1415,14 @@ awaitEvent(rtsBool wait)
            */
           const time_t max_seconds = 2678400; // 31 * 24 * 60 * 60
 
-          Time min = LowResTimeToTime(sleeping_queue->block_info.target - now);
-          tv.tv_sec  = TimeToSeconds(min);
+          tv.tv_sec  = TimeToSeconds(timeout);
           if (tv.tv_sec < max_seconds) {
-              tv.tv_usec = TimeToUS(min) % 1000000;
+              tv.tv_usec = TimeToUS(timeout) % 1000000;
           } else {
               tv.tv_sec = max_seconds;
               tv.tv_usec = 0;
           }
           ptv = &tv;
-      } else {
-          ptv = NULL;
       }
 
       /* Check for any interesting events */
@@ -339,35 +1438,11 @@ awaitEvent(rtsBool wait)
             }
           }
 
-          /* We got a signal; could be one of ours.  If so, we need
-           * to start up the signal handler straight away, otherwise
-           * we could block for a long time before the signal is
-           * serviced.
-           */
-#if defined(RTS_USER_SIGNALS)
-          if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
-              startSignalHandlers(&MainCapability);
-              return; /* still hold the lock */
-          }
-#endif
-
-          /* we were interrupted, return to the scheduler immediately.
-           */
-          if (sched_state >= SCHED_INTERRUPTING) {
-              return; /* still hold the lock */
-          }
-
-          /* check for threads that need waking up
-           */
-          wakeUpSleepingThreads(getLowResTimeOfDay());
-
-          /* If new runnable threads have arrived, stop waiting for
-           * I/O and run them.
-           */
-          if (!emptyRunQueue(&MainCapability)) {
-              return; /* still hold the lock */
+          if (awaitEventInterrupted()) {
+              return;
           }
       }
+      }
 
       /* Step through the waiting queue, unblocking every thread that now has
        * a file descriptor in a ready state.
@@ -380,10 +1455,21 @@ awaitEvent(rtsBool wait)
               int fd;
               enum FdState fd_state = RTS_FD_IS_BLOCKING;
 
+#if defined(linux_HOST_OS)
+              // awaitRequests() wakes these up
+              if (tso->flags & TSO_ASYNC_IO) {
+                  fd = -1;
+              } else
+#endif
               switch (tso->why_blocked) {
               case BlockedOnRead:
                   fd = tso->block_info.fd;
 
+#if defined(USE_POLL_BACKEND)
+                  if (!use_select) {
+                      fd_state = fdPollBackendState(fd, FD_WANT_READ);
+                  } else
+#endif
                   if (seen_bad_fd) {
                       fd_state = fdPollReadState (fd);
                   } else if (FD_ISSET(fd, &rfd)) {
@@ -393,6 +1479,11 @@ awaitEvent(rtsBool wait)
               case BlockedOnWrite:
                   fd = tso->block_info.fd;
 
+#if defined(USE_POLL_BACKEND)
+                  if (!use_select) {
+                      fd_state = fdPollBackendState(fd, FD_WANT_WRITE);
+                  } else
+#endif
                   if (seen_bad_fd) {
                       fd_state = fdPollWriteState (fd);
                   } else if (FD_ISSET(fd, &wfd)) {
@@ -445,4 +1536,5 @@ awaitEvent(rtsBool wait)
              && emptyRunQueue(&MainCapability));
 }
 
-#endif /* THREADED_RTS */
+#endif /* !THREADED_RTS */
+
@@ -15,6 +15,12 @@
 #include "RtsUtils.h"
 #include "Prelude.h"
 #include "Stable.h"
+#include "HeapSnapshot.h"
+
+#ifdef TRACING
+#include "Trace.h"
+#include "eventlog/EventLog.h"
+#endif
 
 #ifdef alpha_HOST_ARCH
 # if defined(linux_HOST_OS)
@@ -72,6 +78,8 @@ static sigset_t savedSignals;
 static Mutex sig_mutex; // protects signal_handlers, nHandlers
 #endif
 
+static void initPendingSignals (void);
+
 /* -----------------------------------------------------------------------------
  * Initialisation / deinitialisation
  * -------------------------------------------------------------------------- */
@@ -80,6 +88,7 @@ void
 initUserSignals(void)
 {
     sigemptyset(&userSignals);
+    initPendingSignals();
 #ifdef THREADED_RTS
     initMutex(&sig_mutex);
 #endif
@@ -127,14 +136,26 @@ more_handlers(int sig)
 
 // Here's the pipe into which we will send our signals
 static volatile int io_manager_wakeup_fd = -1;
+// that of the TimerManager on capability 0, which runs the handlers
 static int timer_manager_control_wr_fd = -1;
 
 #define IO_MANAGER_WAKEUP 0xff
 #define IO_MANAGER_DIE    0xfe
 #define IO_MANAGER_SYNC   0xfd
+#define IO_MANAGER_SIGNALS 0xfc
 
-void setTimerManagerControlFd(int fd) {
-    timer_manager_control_wr_fd = fd;
+void setTimerManagerControlFd(nat cap_no USED_IF_THREADS, int fd) {
+#if defined(THREADED_RTS)
+    if (cap_no < n_capabilities) {
+        capabilities[cap_no]->timer_manager_control_wr_fd = fd;
+    } else {
+        errorBelch("warning: setTimerManagerControlFd called with illegal capability number.");
+        return;
+    }
+#endif
+    if (cap_no == 0) {
+        timer_manager_control_wr_fd = fd;
+    }
 }
 
 void
@@ -187,13 +208,16 @@ ioManagerDie (void)
     int fd;
     int r;
 
-    if (0 <= timer_manager_control_wr_fd) {
-        r = write(timer_manager_control_wr_fd, &byte, 1);
-        if (r == -1) { sysErrorBelch("ioManagerDie: write"); }
-        timer_manager_control_wr_fd = -1;
-    }
+    // the TimerManager on capability 0 is told with the others
+    timer_manager_control_wr_fd = -1;
 
     for (i=0; i < n_capabilities; i++) {
+        fd = capabilities[i]->timer_manager_control_wr_fd;
+        if (0 <= fd) {
+            r = write(fd, &byte, 1);
+            if (r == -1) { sysErrorBelch("ioManagerDie: write"); }
+            capabilities[i]->timer_manager_control_wr_fd = -1;
+        }
         fd = capabilities[i]->io_manager_control_wr_fd;
         if (0 <= fd) {
             r = write(fd, &byte, 1);
@@ -222,92 +246,207 @@ ioManagerStart (void)
 }
 #endif
 
-#if !defined(THREADED_RTS)
+/* -----------------------------------------------------------------------------
+ * The queue of pending signals
+ *
+ * A signal handler can't allocate memory or take a lock, so
+ * generic_handler() copies the siginfo_t of each signal into a slot of
+ * a fixed-size ring.  The ring is drained in batches by
+ * takePendingSignals(): from startSignalHandlers() in the non-threaded
+ * RTS, and from the TimerManager thread in the threaded RTS, which is
+ * woken by a single IO_MANAGER_SIGNALS byte however many signals have
+ * arrived since it last looked.
+ *
+ * Signals can be delivered to any OS thread, so there may be several
+ * producers at once; there is only ever one consumer.  Each slot
+ * carries a sequence number saying whether it is free for the producer
+ * that has claimed index n (seq == n) or holds a complete siginfo_t for
+ * the consumer (seq == n+1).
+ *
+ * Like the kernel, we don't queue a standard signal that is already
+ * pending: its handler runs once, with the siginfo_t of the first
+ * occurrence.  Real-time signals are queued individually.
+ * -------------------------------------------------------------------------- */
 
-#define N_PENDING_HANDLERS 16
+#define N_PENDING_SIGNALS 64    // a power of 2
 
-siginfo_t pending_handler_buf[N_PENDING_HANDLERS];
-siginfo_t *next_pending_handler = pending_handler_buf;
+typedef struct {
+    volatile StgWord seq;
+    siginfo_t info;
+} PendingSignal;
 
-#endif /* THREADED_RTS */
+static PendingSignal pending_signals[N_PENDING_SIGNALS];
 
-/* -----------------------------------------------------------------------------
- * Low-level signal handler
- *
- * Places the requested handler on a stack of pending handlers to be
- * started up at the next context switch.
- * -------------------------------------------------------------------------- */
+volatile StgWord pending_signals_head = 0;     // next slot to take
+volatile StgWord pending_signals_tail = 0;     // next slot to claim
+
+#if defined(NSIG)
+#define N_COALESCED_SIGNALS NSIG
+#else
+#define N_COALESCED_SIGNALS 65
+#endif
+
+// non-zero while a standard signal is in the ring
+static volatile StgWord signal_queued[N_COALESCED_SIGNALS];
+
+#if defined(THREADED_RTS)
+// non-zero while the TimerManager has been sent IO_MANAGER_SIGNALS but
+// has not yet started taking the signals
+static volatile StgWord signals_wakeup_sent = 0;
+#endif
 
 static void
-generic_handler(int sig USED_IF_THREADS,
-                siginfo_t *info,
-                void *p STG_UNUSED)
+initPendingSignals (void)
 {
-#if defined(THREADED_RTS)
+    nat i;
+    for (i = 0; i < N_PENDING_SIGNALS; i++) {
+        pending_signals[i].seq = i;
+    }
+    pending_signals_head = 0;
+    pending_signals_tail = 0;
+    memset((void*)signal_queued, 0, sizeof(signal_queued));
+}
 
-    StgWord8 buf[sizeof(siginfo_t) + 1];
-    int r;
+static rtsBool
+isCoalescedSignal (int sig)
+{
+#if defined(SIGRTMIN) && defined(SIGRTMAX)
+    if (sig >= SIGRTMIN && sig <= SIGRTMAX) {
+        return rtsFalse;
+    }
+#endif
+    return sig >= 0 && sig < N_COALESCED_SIGNALS;
+}
+
+// Returns rtsFalse if the ring is full.  Async-signal-safe.
+static rtsBool
+pushPendingSignal (int sig, siginfo_t *info)
+{
+    PendingSignal *slot;
+    StgWord pos;
+    StgInt diff;
+
+    for (;;) {
+        pos = pending_signals_tail;
+        slot = &pending_signals[pos % N_PENDING_SIGNALS];
+        diff = (StgInt)(slot->seq - pos);
+        if (diff == 0) {
+            if (cas(&pending_signals_tail, pos, pos + 1) == pos) break;
+        } else if (diff < 0) {
+            return rtsFalse;
+        }
+        // otherwise another producer claimed pos first; try again
+    }
 
-    buf[0] = sig;
     if (info == NULL) {
         // info may be NULL on Solaris (see #3790)
-        memset(buf+1, 0, sizeof(siginfo_t));
+        memset(&slot->info, 0, sizeof(siginfo_t));
+        slot->info.si_signo = sig;
     } else {
-        memcpy(buf+1, info, sizeof(siginfo_t));
+        memcpy(&slot->info, info, sizeof(siginfo_t));
     }
+    write_barrier();
+    slot->seq = pos + 1;
+    return rtsTrue;
+}
 
-    if (0 <= timer_manager_control_wr_fd)
-    {
-        r = write(timer_manager_control_wr_fd, buf, sizeof(siginfo_t)+1);
-        if (r == -1 && errno == EAGAIN) {
-            errorBelch("lost signal due to full pipe: %d\n", sig);
-        }
-    }
+/* -----------------------------------------------------------------------------
+ * Take up to max pending signals, oldest first, copying them into buf,
+ * which has room for max siginfo_t structures.  Returns the number taken.
+ *
+ * In the threaded RTS this is called by the TimerManager when it
+ * receives IO_MANAGER_SIGNALS; it must call us again if we fill buf.
+ * -------------------------------------------------------------------------- */
 
-    // If the IO manager hasn't told us what the FD of the write end
-    // of its pipe is, there's not much we can do here, so just ignore
-    // the signal..
+HsInt
+takePendingSignals (void *buf, HsInt max)
+{
+    siginfo_t *infos = (siginfo_t *)buf;
+    PendingSignal *slot;
+    StgWord pos;
+    HsInt n;
+    int sig;
 
-#else /* not THREADED_RTS */
+#if defined(THREADED_RTS)
+    // Any signal pushed after this gets a wakeup of its own; any pushed
+    // before it is in the ring for us to find below.
+    xchg((StgPtr)&signals_wakeup_sent, 0);
+#endif
 
-    /* Can't call allocate from here.  Probably can't call malloc
-       either.  However, we have to schedule a new thread somehow.
+    for (n = 0; n < max; n++) {
+        pos = pending_signals_head;
+        slot = &pending_signals[pos % N_PENDING_SIGNALS];
+        if (slot->seq != pos + 1) break; // empty, or not yet complete
+        load_load_barrier();
 
-       It's probably ok to request a context switch and allow the
-       scheduler to  start the handler thread, but how do we
-       communicate this to the scheduler?
+        memcpy(&infos[n], &slot->info, sizeof(siginfo_t));
+        sig = infos[n].si_signo;
+        if (isCoalescedSignal(sig)) {
+            signal_queued[sig] = 0;
+        }
 
-       We need some kind of locking, but with low overhead (i.e. no
-       blocking signals every time around the scheduler).
+        write_barrier();
+        slot->seq = pos + N_PENDING_SIGNALS;
+        pending_signals_head = pos + 1;
+    }
 
-       Signal Handlers are atomic (i.e. they can't be interrupted), and
-       we can make use of this.  We just need to make sure the
-       critical section of the scheduler can't be interrupted - the
-       only way to do this is to block signals.  However, we can lower
-       the overhead by only blocking signals when there are any
-       handlers to run, i.e. the set of pending handlers is
-       non-empty.
-    */
+    return n;
+}
 
-    /* We use a stack to store the pending signals.  We can't
-       dynamically grow this since we can't allocate any memory from
-       within a signal handler.
+/* -----------------------------------------------------------------------------
+ * Low-level signal handler
+ *
+ * Queues the signal to have its Haskell handler started up by the
+ * TimerManager, or at the next context switch in the non-threaded RTS.
+ * -------------------------------------------------------------------------- */
+
+static void
+generic_handler(int sig,
+                siginfo_t *info,
+                void *p STG_UNUSED)
+{
+    rtsBool coalesced;
 
-       Hence unfortunately we have to bomb out if the buffer
-       overflows.  It might be acceptable to carry on in certain
-       circumstances, depending on the signal.
+    /* The non-threaded RTS doesn't need to block signals every time
+       around the scheduler to protect its view of the queue: the ring
+       is lock-free, and startSignalHandlers() (which does block them)
+       is only called once signals_pending().
     */
 
-    memcpy(next_pending_handler, info, sizeof(siginfo_t));
+    coalesced = isCoalescedSignal(sig);
+    if (coalesced && cas(&signal_queued[sig], 0, 1) != 0) {
+        return; // already pending
+    }
+
+    if (!pushPendingSignal(sig, info)) {
+        if (coalesced) signal_queued[sig] = 0;
+        errorBelch("lost signal due to full queue: %d", sig);
+        return;
+    }
 
-    next_pending_handler++;
+#if defined(THREADED_RTS)
 
-    // stack full?
-    if (next_pending_handler == &pending_handler_buf[N_PENDING_HANDLERS]) {
-        errorBelch("too many pending signals");
-        stg_exit(EXIT_FAILURE);
+    if (cas(&signals_wakeup_sent, 0, 1) == 0)
+    {
+        StgWord8 byte = (StgWord8)IO_MANAGER_SIGNALS;
+        int r = -1;
+
+        // If the IO manager hasn't told us what the FD of the write end
+        // of its pipe is, the signal stays queued until it starts.
+        if (0 <= timer_manager_control_wr_fd) {
+            r = write(timer_manager_control_wr_fd, &byte, 1);
+            if (r == -1 && errno == EAGAIN) {
+                errorBelch("lost signal wakeup due to full pipe: %d", sig);
+            }
+        }
+        if (r != 1) {
+            // let the next signal try again
+            signals_wakeup_sent = 0;
+        }
     }
 
+#else /* not THREADED_RTS */
+
     interruptCapability(&MainCapability);
 
 #endif /* THREADED_RTS */
@@ -451,32 +590,36 @@ stg_sig_install(int sig, int spi, void *mask)
 void
 startSignalHandlers(Capability *cap)
 {
-  siginfo_t *info;
-  int sig;
+  siginfo_t batch[N_PENDING_SIGNALS];
+  siginfo_t *infos;
+  HsInt i, n, m;
 
   blockUserSignals();
 
-  while (next_pending_handler != pending_handler_buf) {
-
-    next_pending_handler--;
-
-    sig = next_pending_handler->si_signo;
-    if (signal_handlers[sig] == STG_SIG_DFL) {
-        continue; // handler has been changed.
-    }
+  n = takePendingSignals(batch, N_PENDING_SIGNALS);
 
-    info = stgMallocBytes(sizeof(siginfo_t), "startSignalHandlers");
-           // freed by runHandler
-    memcpy(info, next_pending_handler, sizeof(siginfo_t));
+  // drop signals whose handler has since been changed
+  m = 0;
+  for (i = 0; i < n; i++) {
+      if (signal_handlers[batch[i].si_signo] != STG_SIG_DFL) {
+          batch[m++] = batch[i];
+      }
+  }
 
-    scheduleThread(cap,
-        createIOThread(cap,
-          RtsFlags.GcFlags.initialStkSize,
-              rts_apply(cap,
-                  rts_apply(cap,
-                      &base_GHCziConcziSignal_runHandlersPtr_closure,
-                      rts_mkPtr(cap, info)),
-                  rts_mkInt(cap, info->si_signo))));
+  if (m != 0) {
+      infos = stgMallocBytes(m * sizeof(siginfo_t), "startSignalHandlers");
+             // freed by runHandlersBatchPtr
+      memcpy(infos, batch, m * sizeof(siginfo_t));
+
+      // one thread runs the handlers for the whole batch
+      scheduleThread(cap,
+          createIOThread(cap,
+            RtsFlags.GcFlags.initialStkSize,
+                rts_apply(cap,
+                    rts_apply(cap,
+                        &base_GHCziConcziSignal_runHandlersBatchPtr_closure,
+                        rts_mkPtr(cap, infos)),
+                    rts_mkInt(cap, m))));
   }
 
   unblockUserSignals();
@@ -503,6 +646,12 @@ stg_sig_install(StgInt sig STG_UNUSED,
   return STG_SIG_DFL;
 }
 
+HsInt
+takePendingSignals (void *buf STG_UNUSED, HsInt max STG_UNUSED)
+{
+    return 0;
+}
+
 #endif
 
 #if defined(RTS_USER_SIGNALS)
@@ -534,6 +683,52 @@ empty_handler (int sig STG_UNUSED)
     // nothing
 }
 
+#ifdef TRACING
+/* -----------------------------------------------------------------------------
+ * SIGUSR2 with +RTS --eventlog-ring: write out the events kept in
+ * memory.  The scheduler does it at its next GC (see scheduleDoGC()).
+ * -------------------------------------------------------------------------- */
+static void
+eventlog_dump_handler (int sig STG_UNUSED)
+{
+    performEventLogDump = rtsTrue;
+}
+
+static rtsBool
+eventlogRingEnabled (void)
+{
+    return RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG &&
+           RtsFlags.TraceFlags.ring_size != 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * SIGUSR2 with +RTS --eventlog-toggle: turn the classes on, or back off
+ * (see toggleTraceClasses() in Trace.c, which only sets flags).
+ * -------------------------------------------------------------------------- */
+static void
+eventlog_toggle_handler (int sig STG_UNUSED)
+{
+    toggleTraceClasses();
+}
+
+static rtsBool
+eventlogToggleEnabled (void)
+{
+    return RtsFlags.TraceFlags.tracing == TRACE_EVENTLOG &&
+           RtsFlags.TraceFlags.toggle_classes != NULL;
+}
+#endif
+
+/* -----------------------------------------------------------------------------
+ * SIGUSR1 with +RTS --heap-snapshot-signal: write a heap snapshot at the
+ * next GC (see HeapSnapshot.c).
+ * -------------------------------------------------------------------------- */
+static void
+heap_snapshot_handler (int sig STG_UNUSED)
+{
+    performHeapSnapshot = rtsTrue;
+}
+
 /* -----------------------------------------------------------------------------
    SIGTSTP handling
 
@@ -670,6 +865,27 @@ initDefaultHandlers(void)
         sysErrorBelch("warning: failed to install SIGPIPE handler");
     }
 
+#ifdef TRACING
+    if (eventlogRingEnabled() || eventlogToggleEnabled()) {
+        action.sa_handler = eventlogRingEnabled() ? eventlog_dump_handler
+                                                  : eventlog_toggle_handler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = 0;
+        if (sigaction(SIGUSR2, &action, &oact) != 0) {
+            sysErrorBelch("warning: failed to install SIGUSR2 handler");
+        }
+    }
+#endif
+
+    if (RtsFlags.MiscFlags.heapSnapshotSignal) {
+        action.sa_handler = heap_snapshot_handler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = 0;
+        if (sigaction(SIGUSR1, &action, &oact) != 0) {
+            sysErrorBelch("warning: failed to install SIGUSR1 handler");
+        }
+    }
+
     set_sigtstp_action(rtsTrue);
 }
 
@@ -690,6 +906,18 @@ resetDefaultHandlers(void)
     if (sigaction(SIGPIPE, &action, NULL) != 0) {
         sysErrorBelch("warning: failed to uninstall SIGPIPE handler");
     }
+#ifdef TRACING
+    // restore SIGUSR2
+    if ((eventlogRingEnabled() || eventlogToggleEnabled()) &&
+        sigaction(SIGUSR2, &action, NULL) != 0) {
+        sysErrorBelch("warning: failed to uninstall SIGUSR2 handler");
+    }
+#endif
+    // restore SIGUSR1
+    if (RtsFlags.MiscFlags.heapSnapshotSignal &&
+        sigaction(SIGUSR1, &action, NULL) != 0) {
+        sysErrorBelch("warning: failed to uninstall SIGUSR1 handler");
+    }
 
     set_sigtstp_action(rtsFalse);
 }
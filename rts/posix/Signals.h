@@ -18,9 +18,9 @@
 rtsBool anyUserHandlers(void);
 
 #if !defined(THREADED_RTS)
-extern siginfo_t pending_handler_buf[];
-extern siginfo_t *next_pending_handler;
-#define signals_pending() (next_pending_handler != pending_handler_buf)
+extern volatile StgWord pending_signals_head;
+extern volatile StgWord pending_signals_tail;
+#define signals_pending() (pending_signals_head != pending_signals_tail)
 void startSignalHandlers(Capability *cap);
 #endif
 
@@ -0,0 +1,196 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Residency of accounting groups of threads
+ *
+ * ---------------------------------------------------------------------------*/
+
+/* Note [Accounting groups]
+
+   A service that runs the requests of several tenants in one process
+   would like to know how much of the heap each of them is keeping
+   alive, and to stop one that keeps too much.  So a thread can be put
+   in an accounting group, 1 to MAX_ACCOUNTING_GROUPS-1 (0 is no
+   group), and the threads it forks start in the same group.
+
+   The objects in the heap don't record who allocated them, and giving
+   them an owner would cost a word in every object or per-group
+   allocation and to-space blocks.  Instead a major GC attributes what
+   it copies to the group whose threads it reached it from:
+
+     - Before it marks the other roots, for each group that has
+       threads, the GC evacuates the stacks of the group's threads and
+       scavenges everything reachable from them (account_groups() in
+       GC.c).  What it copies (or, for large objects, relinks) while
+       doing so is the group's residency.
+
+     - Those stacks would have been live anyway, since a blocked
+       thread that is unreachable is resurrected rather than dropped,
+       so this changes the order of the GC's work, not what survives.
+
+     - An object reachable from the threads of several groups goes to
+       the first of them (in the order of their numbers); what is
+       reachable only from other roots (CAFs, stable pointers, threads
+       in no group, ...) goes to no group.  So the residencies add up
+       to at most the live data.
+
+   This part of a major GC is done by one GC thread, before the others
+   start, and a minor GC doesn't account at all: a group's residency is
+   the figure from the last major GC.  Objects in a generation that is
+   compacted (+RTS -c) are marked rather than copied, and small pinned
+   objects don't go through the GC's copying, so they aren't counted.
+
+   A group can have a quota.  When a major GC finds a group over it,
+   checkGroupQuotas() raises ResidencyQuotaExceeded in each of the
+   group's threads, except those that are masking exceptions or are in
+   a foreign call.  It does so once: not again until the group has
+   gone back under its quota.
+   -------------------------------------------------------------------------- */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Accounting.h"
+#include "Storage.h"
+#include "GC.h"
+#include "GCThread.h"
+#include "GCTDecl.h"
+#include "Evac.h"
+#include "Capability.h"
+#include "RaiseAsync.h"
+#include "Prelude.h"
+#include "Trace.h"
+
+typedef struct {
+    W_      residency;          // words, at the last major GC
+    W_      quota;              // words, 0 for none
+    rtsBool over;               // raised ResidencyQuotaExceeded already
+} AcctGroup;
+
+static AcctGroup acct_groups[MAX_ACCOUNTING_GROUPS];
+
+rtsBool acct_groups_used = rtsFalse;
+
+StgWord64
+usedAccountingGroups (void)
+{
+    StgWord64 used = 0;
+    StgTSO *t;
+    nat g;
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        for (t = generations[g].old_threads; t != END_TSO_QUEUE;
+             t = t->global_link) {
+            if (t->acct_group != 0) used |= (StgWord64)1 << t->acct_group;
+        }
+    }
+    return used;
+}
+
+void
+markGroupStacks (nat group)
+{
+    StgTSO *t, *tso;
+    nat g;
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        for (t = generations[g].old_threads; t != END_TSO_QUEUE;
+             t = t->global_link) {
+            if (t->acct_group != group ||
+                t->what_next == ThreadComplete ||
+                t->what_next == ThreadKilled) {
+                continue;
+            }
+            // an earlier group may have reached the TSO already
+            tso = t;
+            if (IS_FORWARDING_PTR(tso->header.info)) {
+                tso = (StgTSO *)UN_FORWARDING_PTR(tso->header.info);
+            }
+            evacuate((StgClosure **)&tso->stackobj);
+        }
+    }
+}
+
+void
+setGroupResidency (nat group, W_ words)
+{
+    acct_groups[group].residency = words;
+    debugTrace(DEBUG_gc, "accounting group %d: %" FMT_Word " bytes",
+               group, words * sizeof(W_));
+}
+
+void
+checkGroupQuotas (void)
+{
+    StgWord64 over = 0;
+    StgTSO *t;
+    nat g;
+
+    for (g = 1; g < MAX_ACCOUNTING_GROUPS; g++) {
+        if (acct_groups[g].quota == 0 ||
+            acct_groups[g].residency <= acct_groups[g].quota) {
+            acct_groups[g].over = rtsFalse;
+        } else if (!acct_groups[g].over) {
+            acct_groups[g].over = rtsTrue;
+            over |= (StgWord64)1 << g;
+        }
+    }
+    if (over == 0) return;
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        for (t = generations[g].threads; t != END_TSO_QUEUE;
+             t = t->global_link) {
+            if (!(over & ((StgWord64)1 << t->acct_group)) ||
+                t->what_next == ThreadComplete ||
+                t->what_next == ThreadKilled ||
+                (t->flags & TSO_BLOCKEX) ||
+                t->why_blocked == BlockedOnCCall ||
+                t->why_blocked == BlockedOnCCall_Interruptible) {
+                continue;
+            }
+            debugTrace(DEBUG_sched,
+                       "thread %lu: residency quota of group %d exceeded",
+                       (unsigned long)t->id, t->acct_group);
+            throwToSingleThreaded(t->cap, t,
+                                  (StgClosure *)residencyQuotaExceeded_closure);
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   The API
+   -------------------------------------------------------------------------- */
+
+static nat
+checkGroup (HsInt group, const char *fn)
+{
+    if (group <= 0 || group >= MAX_ACCOUNTING_GROUPS) {
+        barf("%s: no group %" FMT_Int, fn, group);
+    }
+    return (nat)group;
+}
+
+HsWord64
+rts_getAccountingGroupResidency (HsInt group)
+{
+    nat g = checkGroup(group, "rts_getAccountingGroupResidency");
+    return (HsWord64)acct_groups[g].residency * sizeof(W_);
+}
+
+HsWord64
+rts_getAccountingGroupQuota (HsInt group)
+{
+    nat g = checkGroup(group, "rts_getAccountingGroupQuota");
+    return (HsWord64)acct_groups[g].quota * sizeof(W_);
+}
+
+void
+rts_setAccountingGroupQuota (HsInt group, HsWord64 bytes)
+{
+    nat g = checkGroup(group, "rts_setAccountingGroupQuota");
+    StgWord64 words = (bytes + sizeof(W_) - 1) / sizeof(W_);
+
+    acct_groups[g].quota = words > (StgWord64)HS_WORD_MAX ? HS_WORD_MAX
+                                                          : (W_)words;
+}
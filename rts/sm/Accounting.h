@@ -0,0 +1,35 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Residency of accounting groups of threads: see Accounting.c
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_ACCOUNTING_H
+#define SM_ACCOUNTING_H
+
+#include "BeginPrivate.h"
+
+// Set once a thread has been put in a group; until then a major GC
+// doesn't account
+extern rtsBool acct_groups_used;
+
+// Called by a major GC: evacuates the stacks of the threads in 'group',
+// which the GC then scavenges and counts as the group's residency
+void markGroupStacks (nat group);
+
+// The groups that have threads, as a mask of bits (for the GC)
+StgWord64 usedAccountingGroups (void);
+
+// Called by a major GC with the words it counted for each group
+void setGroupResidency (nat group, W_ words);
+
+// Called at the end of a major GC, with all the Capabilities stopped:
+// raises ResidencyQuotaExceeded in the threads of the groups that have
+// gone over their quota
+void checkGroupQuotas (void);
+
+#include "EndPrivate.h"
+
+#endif /* SM_ACCOUNTING_H */
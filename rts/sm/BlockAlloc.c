@@ -22,10 +22,15 @@
 #include "RtsUtils.h"
 #include "BlockAlloc.h"
 #include "OSMem.h"
+#include "Capability.h"
+#include "GetTime.h"
+#include "Trace.h"
+#include "ShmChannel.h"
 
 #include <string.h>
 
-static void  initMBlock(void *mblock);
+static void  initMBlock(void *mblock, nat node);
+static W_    free_deferred(W_ max);
 
 /* -----------------------------------------------------------------------------
 
@@ -87,11 +92,22 @@ static void  initMBlock(void *mblock);
   blocks in each bucket is doubly-linked, so that if a block is
   coalesced we can easily remove it from its current free list.
 
-  To allocate a new block of size S, grab a block from bucket
-  log2ceiling(S) (i.e. log2() rounded up), in which all blocks are at
-  least as big as S, and split it if necessary.  If there are no
-  blocks in that bucket, look at bigger buckets until a block is found
-  Allocation is therefore O(logN) time.
+  To allocate a new block of size S, we look for the best fit: first
+  in bucket log2(S), which may contain blocks big enough for S, and
+  then in bucket log2ceiling(S) (i.e. log2() rounded up), in which all
+  blocks are at least as big as S.  If there are no blocks in that
+  bucket, look at bigger buckets until a block is found.  Within a
+  bucket we take the smallest block that fits, and of those the one
+  with the lowest address, looking at no more than BEST_FIT_SCAN
+  blocks.  We split the block if necessary.  Allocation is therefore
+  O(logN) time.
+
+  Choosing the best fit, rather than the first fit, leaves the big
+  free groups intact, and preferring low addresses packs allocation
+  into the same megablocks, so that the higher ones are more likely to
+  become wholly free and be returned to the OS (returnMemoryToOS()).
+  We only take a fresh megablock once no megablock that is already in
+  use has room.  fragmentationStats() measures how well this works.
 
   To free a block:
     - coalesce it with neighbours.
@@ -149,11 +165,14 @@ static void  initMBlock(void *mblock);
 
 // In THREADED_RTS mode, the free list is protected by sm_mutex.
 
-static bdescr *free_list[MAX_FREE_LIST];
-static bdescr *free_mblock_list;
+static bdescr *free_list[MAX_NUMA_NODES][MAX_FREE_LIST];
+static bdescr *free_mblock_list[MAX_NUMA_NODES];
 
-// free_list[i] contains blocks that are at least size 2^i, and at
-// most size 2^(i+1) - 1.
+// free_list[node][i] contains blocks that are at least size 2^i, and
+// at most size 2^(i+1) - 1, whose memory lives on NUMA node 'node'.
+// Each bdescr records its node in bd->node, so a freed group always
+// goes back on the free list that it came from.  Without +RTS --numa
+// there is only one node and only free_list[0] is used.
 //
 // To find the free list in which to place a block, use log_2(size).
 // To find a free block of the right size, use log_2_ceil(size).
@@ -161,19 +180,52 @@ static bdescr *free_mblock_list;
 W_ n_alloc_blocks;   // currently allocated blocks
 W_ hw_alloc_blocks;  // high-water allocated blocks
 
+W_ n_alloc_blocks_by_node[MAX_NUMA_NODES];
+
+W_ decommitted_mblocks = 0;
+
+// chains that the GC has left for us to free: see Note [Deferred freeing]
+static bdescr *deferred_free = NULL;
+W_ n_deferred_blocks = 0;
+
 /* -----------------------------------------------------------------------------
    Initialisation
    -------------------------------------------------------------------------- */
 
 void initBlockAllocator(void)
 {
-    nat i;
-    for (i=0; i < MAX_FREE_LIST; i++) {
-        free_list[i] = NULL;
+    nat i, node;
+    for (node = 0; node < MAX_NUMA_NODES; node++) {
+        for (i=0; i < MAX_FREE_LIST; i++) {
+            free_list[node][i] = NULL;
+        }
+        free_mblock_list[node] = NULL;
+        n_alloc_blocks_by_node[node] = 0;
     }
-    free_mblock_list = NULL;
     n_alloc_blocks = 0;
     hw_alloc_blocks = 0;
+    deferred_free = NULL;
+    n_deferred_blocks = 0;
+}
+
+/* -----------------------------------------------------------------------------
+   Accounting
+   -------------------------------------------------------------------------- */
+
+STATIC_INLINE
+void recordAllocatedBlocks(nat node, W_ n)
+{
+    n_alloc_blocks += n;
+    n_alloc_blocks_by_node[node] += n;
+    if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
+}
+
+STATIC_INLINE
+void recordFreedBlocks(nat node, W_ n)
+{
+    ASSERT(n_alloc_blocks >= n);
+    n_alloc_blocks -= n;
+    n_alloc_blocks_by_node[node] -= n;
 }
 
 /* -----------------------------------------------------------------------------
@@ -238,7 +290,7 @@ free_list_insert (bdescr *bd)
     ASSERT(bd->blocks < BLOCKS_PER_MBLOCK);
     ln = log_2(bd->blocks);
 
-    dbl_link_onto(bd, &free_list[ln]);
+    dbl_link_onto(bd, &free_list[bd->node][ln]);
 }
 
 
@@ -264,21 +316,44 @@ setup_tail (bdescr *bd)
 }
 
 
+// The most free groups that best_fit() looks at in a bucket, so that
+// allocation stays cheap when a bucket is long
+#define BEST_FIT_SCAN 16
+
+// Find the smallest group of at least n blocks among the first few in
+// a free list, preferring the lowest address among groups of the
+// same size.  Returns NULL if none of them is big enough.
+STATIC_INLINE bdescr *
+best_fit (bdescr *bd, W_ n)
+{
+    bdescr *best = NULL;
+    nat i;
+
+    for (i = 0; bd != NULL && i < BEST_FIT_SCAN; bd = bd->link, i++) {
+        if (bd->blocks >= n &&
+            (best == NULL || bd->blocks < best->blocks ||
+             (bd->blocks == best->blocks && bd < best))) {
+            best = bd;
+        }
+    }
+    return best;
+}
+
 // Take a free block group bd, and split off a group of size n from
 // it.  Adjust the free list as necessary, and return the new group.
 static bdescr *
-split_free_block (bdescr *bd, W_ n, nat ln)
+split_free_block (bdescr *bd, nat node, W_ n, nat ln)
 {
     bdescr *fg; // free group
 
     ASSERT(bd->blocks > n);
-    dbl_link_remove(bd, &free_list[ln]);
+    dbl_link_remove(bd, &free_list[node][ln]);
     fg = bd + bd->blocks - n; // take n blocks off the end
     fg->blocks = n;
     bd->blocks -= n;
     setup_tail(bd);
     ln = log_2(bd->blocks);
-    dbl_link_onto(bd, &free_list[ln]);
+    dbl_link_onto(bd, &free_list[node][ln]);
     return fg;
 }
 
@@ -287,7 +362,7 @@ split_free_block (bdescr *bd, W_ n, nat ln)
  * initGroup afterwards.
  */
 static bdescr *
-alloc_mega_group (StgWord mblocks)
+alloc_mega_group (nat node, StgWord mblocks)
 {
     bdescr *best, *bd, *prev;
     StgWord n;
@@ -296,15 +371,16 @@ alloc_mega_group (StgWord mblocks)
 
     best = NULL;
     prev = NULL;
-    for (bd = free_mblock_list; bd != NULL; prev = bd, bd = bd->link)
+    for (bd = free_mblock_list[node]; bd != NULL; prev = bd, bd = bd->link)
     {
         if (bd->blocks == n)
         {
             if (prev) {
                 prev->link = bd->link;
             } else {
-                free_mblock_list = bd->link;
+                free_mblock_list[node] = bd->link;
             }
+            bd->flags &= ~BF_DECOMMITTED;
             return bd;
         }
         else if (bd->blocks > n)
@@ -324,12 +400,12 @@ alloc_mega_group (StgWord mblocks)
                           (best_mblocks-mblocks)*MBLOCK_SIZE);
 
         best->blocks = MBLOCK_GROUP_BLOCKS(best_mblocks - mblocks);
-        initMBlock(MBLOCK_ROUND_DOWN(bd));
+        initMBlock(MBLOCK_ROUND_DOWN(bd), node);
     }
     else
     {
-        void *mblock = getMBlocks(mblocks);
-        initMBlock(mblock);             // only need to init the 1st one
+        void *mblock = getMBlocksOnNode(node, mblocks);
+        initMBlock(mblock, node);       // only need to init the 1st one
         bd = FIRST_BDESCR(mblock);
     }
     bd->blocks = MBLOCK_GROUP_BLOCKS(mblocks);
@@ -337,40 +413,62 @@ alloc_mega_group (StgWord mblocks)
 }
 
 bdescr *
-allocGroup (W_ n)
+allocGroupOnNode (nat node, W_ n)
 {
     bdescr *bd, *rem;
     StgWord ln;
 
     if (n == 0) barf("allocGroup: requested zero blocks");
 
+    ASSERT(node < n_numa_nodes);
+
+    dtraceBlockAlloc((StgWord)node, (StgWord)n);
+
     if (n >= BLOCKS_PER_MBLOCK)
     {
         StgWord mblocks;
 
+        // before we take new mblocks (Note [Deferred freeing])
+        if (deferred_free != NULL) {
+            free_deferred((W_)-1);
+        }
+
         mblocks = BLOCKS_TO_MBLOCKS(n);
 
         // n_alloc_blocks doesn't count the extra blocks we get in a
         // megablock group.
-        n_alloc_blocks += mblocks * BLOCKS_PER_MBLOCK;
-        if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
+        recordAllocatedBlocks(node, mblocks * BLOCKS_PER_MBLOCK);
 
-        bd = alloc_mega_group(mblocks);
+        bd = alloc_mega_group(node, mblocks);
         // only the bdescrs of the first MB are required to be initialised
         initGroup(bd);
         goto finish;
     }
 
-    n_alloc_blocks += n;
-    if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
+    recordAllocatedBlocks(node, n);
+
+search:
+    // Some of the groups in bucket log_2(n) may be big enough; if n is
+    // a power of 2 they all are.
+    bd = best_fit(free_list[node][log_2(n)], n);
+
+    if (bd != NULL) {
+        goto found;
+    }
 
     ln = log_2_ceil(n);
 
-    while (ln < MAX_FREE_LIST && free_list[ln] == NULL) {
+    while (ln < MAX_FREE_LIST && free_list[node][ln] == NULL) {
         ln++;
     }
 
     if (ln == MAX_FREE_LIST) {
+        // the deferred groups may have room (Note [Deferred freeing])
+        if (deferred_free != NULL) {
+            free_deferred((W_)-1);
+            goto search;
+        }
+
 #if 0  /* useful for debugging fragmentation */
         if ((W_)mblocks_allocated * BLOCKS_PER_MBLOCK * BLOCK_SIZE_W
              - (W_)((n_alloc_blocks - n) * BLOCK_SIZE_W) > (2*1024*1024)/sizeof(W_)) {
@@ -380,27 +478,30 @@ allocGroup (W_ n)
         }
 #endif
 
-        bd = alloc_mega_group(1);
+        bd = alloc_mega_group(node, 1);
         bd->blocks = n;
         initGroup(bd);                   // we know the group will fit
         rem = bd + n;
         rem->blocks = BLOCKS_PER_MBLOCK-n;
         initGroup(rem); // init the slop
-        n_alloc_blocks += rem->blocks;
+        recordAllocatedBlocks(node, rem->blocks);
         freeGroup(rem);                  // add the slop on to the free list
         goto finish;
     }
 
-    bd = free_list[ln];
+    bd = best_fit(free_list[node][ln], n);
+
+found:
+    ln = log_2(bd->blocks);
 
     if (bd->blocks == n)                // exactly the right size!
     {
-        dbl_link_remove(bd, &free_list[ln]);
+        dbl_link_remove(bd, &free_list[node][ln]);
         initGroup(bd);
     }
     else if (bd->blocks >  n)            // block too big...
     {
-        bd = split_free_block(bd, n, ln);
+        bd = split_free_block(bd, node, n, ln);
         ASSERT(bd->blocks == n);
         initGroup(bd);
     }
@@ -432,46 +533,83 @@ finish:
 // preferably if there are any.
 //
 bdescr *
-allocLargeChunk (W_ min, W_ max)
+allocLargeChunkOnNode (nat node, W_ min, W_ max)
 {
     bdescr *bd;
     StgWord ln, lnmax;
 
     if (min >= BLOCKS_PER_MBLOCK) {
-        return allocGroup(max);
+        return allocGroupOnNode(node,max);
     }
 
     ln = log_2_ceil(min);
     lnmax = log_2_ceil(max); // tops out at MAX_FREE_LIST
 
-    while (ln < lnmax && free_list[ln] == NULL) {
+    while (ln < lnmax && free_list[node][ln] == NULL) {
         ln++;
     }
     if (ln == lnmax) {
-        return allocGroup(max);
+        return allocGroupOnNode(node,max);
+    }
+
+    // Every group in this bucket is at least min blocks, so take the
+    // one with the lowest address, as best_fit() would.
+    {
+        bdescr *p;
+        nat i;
+        bd = free_list[node][ln];
+        for (p = bd->link, i = 1; p != NULL && i < BEST_FIT_SCAN;
+             p = p->link, i++) {
+            if (p < bd) bd = p;
+        }
     }
-    bd = free_list[ln];
 
     if (bd->blocks <= max)              // exactly the right size!
     {
-        dbl_link_remove(bd, &free_list[ln]);
+        dbl_link_remove(bd, &free_list[node][ln]);
         initGroup(bd);
     }
     else   // block too big...
     {
-        bd = split_free_block(bd, max, ln);
+        bd = split_free_block(bd, node, max, ln);
         ASSERT(bd->blocks == max);
         initGroup(bd);
     }
 
-    n_alloc_blocks += bd->blocks;
-    if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
+    recordAllocatedBlocks(node, bd->blocks);
 
     IF_DEBUG(sanity, memset(bd->start, 0xaa, bd->blocks * BLOCK_SIZE));
     IF_DEBUG(sanity, checkFreeListSanity());
     return bd;
 }
 
+// Callers that don't care which node their memory comes from get
+// the node with the fewest allocated blocks, so that node-agnostic
+// allocation doesn't pile up on node 0.
+STATIC_INLINE nat
+least_allocated_node (void)
+{
+    nat node, best = 0;
+    for (node = 1; node < n_numa_nodes; node++) {
+        if (n_alloc_blocks_by_node[node] < n_alloc_blocks_by_node[best]) {
+            best = node;
+        }
+    }
+    return best;
+}
+
+bdescr *
+allocGroup (W_ n)
+{
+    return allocGroupOnNode(least_allocated_node(), n);
+}
+
+bdescr *
+allocLargeChunk (W_ min, W_ max)
+{
+    return allocLargeChunkOnNode(least_allocated_node(), min, max);
+}
+
 bdescr *
 allocGroup_lock(W_ n)
 {
@@ -498,6 +636,169 @@ allocBlock_lock(void)
     return bd;
 }
 
+bdescr *
+allocBlockOnNode(nat node)
+{
+    return allocGroupOnNode(node,1);
+}
+
+bdescr *
+allocGroupOnNode_lock(nat node, W_ n)
+{
+    bdescr *bd;
+    ACQUIRE_SM_LOCK;
+    bd = allocGroupOnNode(node,n);
+    RELEASE_SM_LOCK;
+    return bd;
+}
+
+bdescr *
+allocBlockOnNode_lock(nat node)
+{
+    bdescr *bd;
+    ACQUIRE_SM_LOCK;
+    bd = allocBlockOnNode(node);
+    RELEASE_SM_LOCK;
+    return bd;
+}
+
+/* -----------------------------------------------------------------------------
+   Per-Capability block cache
+
+   allocBlock_lock() takes sm_mutex on every call, which becomes a
+   point of contention when many Capabilities are allocating at once.
+   So each Capability keeps a small cache of free single blocks
+   (cap->block_cache), refilled BLOCK_CACHE_BATCH blocks at a time; the
+   common case of allocBlockCap_lock() then takes no lock at all.
+
+   A cache is only touched by the Task that owns the Capability, or by
+   the Capability's own GC thread while the mutators are stopped, so it
+   needs no synchronisation itself.  Refilling and flushing go to the
+   global free lists, so the caller of refillBlockCache() and
+   flushBlockCache() must hold sm_mutex (or gc_alloc_block_sync
+   during GC).
+
+   Blocks in a cache have already been taken off the free list and are
+   counted in n_alloc_blocks; memInventory() accounts for them
+   separately.  The caches are flushed back to the free list at each
+   major GC, before we decide how much memory to return to the OS.
+   -------------------------------------------------------------------------- */
+
+#define BLOCK_CACHE_BATCH 32
+
+bdescr *
+allocBlockCached (Capability *cap)
+{
+    bdescr *bd;
+
+    bd = cap->block_cache;
+    if (bd != NULL) {
+        cap->block_cache = bd->link;
+        cap->n_cached_blocks--;
+        bd->link = NULL;
+    }
+    return bd;
+}
+
+void
+refillBlockCache (Capability *cap)
+{
+    bdescr *bd;
+    W_ i, n;
+
+    // Take a contiguous chunk if there is one, but accept whatever
+    // small group is available to avoid fragmentation (#7257).
+    bd = allocLargeChunkOnNode(cap->node, 1, BLOCK_CACHE_BATCH);
+    n = bd->blocks;
+
+    // split the group into single-block groups
+    for (i = 0; i < n; i++) {
+        bd[i].blocks = 1;
+        bd[i].free = bd[i].start;
+        bd[i].link = (i+1 < n) ? &bd[i+1] : cap->block_cache;
+    }
+    cap->block_cache = bd;
+    cap->n_cached_blocks += n;
+}
+
+void
+flushBlockCache (Capability *cap)
+{
+    bdescr *bd, *next;
+
+    for (bd = cap->block_cache; bd != NULL; bd = next) {
+        next = bd->link;
+        freeGroup(bd);
+    }
+    cap->block_cache = NULL;
+    cap->n_cached_blocks = 0;
+}
+
+bdescr *
+allocBlockCap_lock (Capability *cap)
+{
+    bdescr *bd;
+
+    bd = allocBlockCached(cap);
+    if (bd == NULL) {
+        ACQUIRE_SM_LOCK;
+        refillBlockCache(cap);
+        RELEASE_SM_LOCK;
+        bd = allocBlockCached(cap);
+    }
+    return bd;
+}
+
+// Grow the allocated group bd to n blocks in place, by taking the
+// blocks that follow it from the free group next to it in the same
+// megablock.  Returns rtsFalse, leaving bd alone, if there is no such
+// free group or it is too small.  Requires the SM lock.
+rtsBool
+extendGroup (bdescr *bd, W_ n)
+{
+    bdescr *next, *rest, *b;
+    W_ extra;
+    nat node;
+
+    ASSERT(bd->free != (P_)-1);
+
+    if (n <= bd->blocks) return rtsTrue;
+
+    // groups of megablocks have no bdescrs after the first megablock
+    if (n >= BLOCKS_PER_MBLOCK) return rtsFalse;
+
+    next = bd + bd->blocks;
+    if (next > LAST_BDESCR(MBLOCK_ROUND_DOWN(bd)) || next->free != (P_)-1) {
+        return rtsFalse;
+    }
+
+    extra = n - bd->blocks;
+    if (next->blocks < extra) return rtsFalse;
+
+    node = bd->node;
+    dbl_link_remove(next, &free_list[node][log_2(next->blocks)]);
+    if (next->blocks > extra) {
+        rest = next + extra;
+        rest->blocks = next->blocks - extra;
+        rest->free = (P_)-1;
+        rest->gen = NULL;
+        rest->gen_no = 0;
+        setup_tail(rest);
+        free_list_insert(rest);
+    }
+    recordAllocatedBlocks(node, extra);
+
+    for (b = next; b < next + extra; b++) {
+        b->free = 0;
+        b->blocks = 0;
+        b->link = bd;
+    }
+    bd->blocks = n;
+
+    IF_DEBUG(sanity, checkFreeListSanity());
+    return rtsTrue;
+}
+
 /* -----------------------------------------------------------------------------
    De-Allocation
    -------------------------------------------------------------------------- */
@@ -525,11 +826,13 @@ static void
 free_mega_group (bdescr *mg)
 {
     bdescr *bd, *prev;
+    nat node;
 
     // Find the right place in the free list.  free_mblock_list is
     // sorted by *address*, not by size as the free_list is.
     prev = NULL;
-    bd = free_mblock_list;
+    node = mg->node;
+    bd = free_mblock_list[node];
     while (bd && bd->start < mg->start) {
         prev = bd;
         bd = bd->link;
@@ -544,9 +847,17 @@ free_mega_group (bdescr *mg)
     }
     else
     {
-        mg->link = free_mblock_list;
-        free_mblock_list = mg;
+        mg->link = free_mblock_list[node];
+        free_mblock_list[node] = mg;
+    }
+
+    // The group is now as young as the memory we just freed, and at
+    // least part of it is committed.  See decommitFreeMBlocks().
+    if (RtsFlags.GcFlags.decommitAge != 0) {
+        mg->u.freed = (StgWord)(TimeToUS(getProcessElapsedTime()) / 1000);
+        mg->flags &= ~BF_DECOMMITTED;
     }
+
     // coalesce forwards
     coalesce_mblocks(mg);
 
@@ -558,12 +869,22 @@ void
 freeGroup(bdescr *p)
 {
   StgWord ln;
+  nat node;
 
   // Todo: not true in multithreaded GC
   // ASSERT_SM_LOCK();
 
   ASSERT(p->free != (P_)-1);
 
+  // drop the file mapping (see Note [Mapped byte arrays] in Storage.c)
+  if (p->flags & BF_MAPPED) {
+      p->start = (P_)BLOCK_ROUND_DOWN(p->start);
+      osUnmapFile(p->start + BLOCK_SIZE_W, (W_)(p->blocks - 1) * BLOCK_SIZE);
+      p->flags &= ~BF_MAPPED;
+      // a message from a shared-memory channel gives back its buffer
+      shmGroupUnmapped(p);
+  }
+
   p->free = (void *)-1;  /* indicates that this block is free */
   p->gen = NULL;
   p->gen_no = 0;
@@ -572,6 +893,10 @@ freeGroup(bdescr *p)
 
   if (p->blocks == 0) barf("freeGroup: block size is zero");
 
+  // the group goes back on the free list of the node it came from
+  node = p->node;
+  ASSERT(node < n_numa_nodes);
+
   if (p->blocks >= BLOCKS_PER_MBLOCK)
   {
       StgWord mblocks;
@@ -580,14 +905,13 @@ freeGroup(bdescr *p)
       // If this is an mgroup, make sure it has the right number of blocks
       ASSERT(p->blocks == MBLOCK_GROUP_BLOCKS(mblocks));
 
-      n_alloc_blocks -= mblocks * BLOCKS_PER_MBLOCK;
+      recordFreedBlocks(node, mblocks * BLOCKS_PER_MBLOCK);
 
       free_mega_group(p);
       return;
   }
 
-  ASSERT(n_alloc_blocks >= p->blocks);
-  n_alloc_blocks -= p->blocks;
+  recordFreedBlocks(node, p->blocks);
 
   // coalesce forwards
   {
@@ -597,7 +921,7 @@ freeGroup(bdescr *p)
       {
           p->blocks += next->blocks;
           ln = log_2(next->blocks);
-          dbl_link_remove(next, &free_list[ln]);
+          dbl_link_remove(next, &free_list[node][ln]);
           if (p->blocks == BLOCKS_PER_MBLOCK)
           {
               free_mega_group(p);
@@ -617,7 +941,7 @@ freeGroup(bdescr *p)
       if (prev->free == (P_)-1)
       {
           ln = log_2(prev->blocks);
-          dbl_link_remove(prev, &free_list[ln]);
+          dbl_link_remove(prev, &free_list[node][ln]);
           prev->blocks += p->blocks;
           if (prev->blocks >= BLOCKS_PER_MBLOCK)
           {
@@ -661,8 +985,112 @@ freeChain_lock(bdescr *bd)
     RELEASE_SM_LOCK;
 }
 
+/* -----------------------------------------------------------------------------
+   Note [Deferred freeing]
+
+   At the end of a GC the from-space of each collected generation and
+   its dead large objects all go back to the free list, and the
+   freeGroup() of each group coalesces it with its neighbours and moves
+   free list entries around: with a big old generation, or many dead
+   arrays, that is a large part of the pause, done by the GC leader
+   alone while every other Capability waits.
+
+   So the GC doesn't free those chains itself: deferFreeChain() puts
+   them on deferred_free, which only costs a walk of each chain to find
+   its end, and the groups are freed later by
+
+     - the GC leader, in freeDeferredChains_lock(), once scheduleDoGC()
+       has let the other Capabilities go.  It frees DEFERRED_FREE_BATCH
+       groups at a time, releasing sm_mutex in between, so that
+       mutators that need blocks meanwhile don't wait for all of it;
+
+     - allocGroupOnNode(), if it would otherwise take new memory from
+       the mblock allocator (in the non-threaded RTS this is the only
+       thing that frees them between GCs);
+
+     - GarbageCollect(), before it starts, and exitStorage(), so that a
+       GC and everything after exit see an empty deferred_free.
+
+   Until then the blocks still count in n_alloc_blocks, and
+   n_deferred_blocks says how many of them are on deferred_free
+   (counted like countAllocdBlocks()), for memInventory() and for the
+   GC's estimate of the memory it needs.
+
+   In THREADED_RTS mode deferred_free is protected by sm_mutex, like the
+   free lists.
+   -------------------------------------------------------------------------- */
+
+#define DEFERRED_FREE_BATCH 256
+
+void
+deferFreeChain (bdescr *bd)
+{
+    bdescr *last;
+
+    if (bd == NULL) return;
+
+    for (last = bd; ; last = last->link) {
+        if (last->blocks >= BLOCKS_PER_MBLOCK) {
+            n_deferred_blocks +=
+                BLOCKS_TO_MBLOCKS(last->blocks) * BLOCKS_PER_MBLOCK;
+        } else {
+            n_deferred_blocks += last->blocks;
+        }
+        if (last->link == NULL) break;
+    }
+
+    last->link = deferred_free;
+    deferred_free = bd;
+}
+
+// Free at most max groups of deferred_free.  Returns the number freed.
+static W_
+free_deferred (W_ max)
+{
+    bdescr *bd;
+    W_ n;
+
+    for (n = 0; n < max && deferred_free != NULL; n++) {
+        bd = deferred_free;
+        deferred_free = bd->link;
+        if (bd->blocks >= BLOCKS_PER_MBLOCK) {
+            n_deferred_blocks -=
+                BLOCKS_TO_MBLOCKS(bd->blocks) * BLOCKS_PER_MBLOCK;
+        } else {
+            n_deferred_blocks -= bd->blocks;
+        }
+        freeGroup(bd);
+    }
+    ASSERT(deferred_free != NULL || n_deferred_blocks == 0);
+    return n;
+}
+
+void
+freeDeferredChains (void)
+{
+    free_deferred((W_)-1);
+}
+
+void
+freeDeferredChains_lock (void)
+{
+    W_ n = 0;
+    rtsBool more;
+
+    do {
+        ACQUIRE_SM_LOCK;
+        n += free_deferred(DEFERRED_FREE_BATCH);
+        more = deferred_free != NULL;
+        RELEASE_SM_LOCK;
+    } while (more);
+
+    if (n > 0) {
+        debugTrace(DEBUG_gc, "freed %" FMT_Word " deferred block group(s)", n);
+    }
+}
+
 static void
-initMBlock(void *mblock)
+initMBlock(void *mblock, nat node)
 {
     bdescr *bd;
     StgWord8 *block;
@@ -678,6 +1106,7 @@ initMBlock(void *mblock)
     for (; block <= (StgWord8*)LAST_BLOCK(mblock); bd += 1,
              block += BLOCK_SIZE) {
         bd->start = (void*)block;
+        bd->node = node;
     }
 }
 
@@ -715,30 +1144,89 @@ countAllocdBlocks(bdescr *bd)
     return n;
 }
 
-void returnMemoryToOS(nat n /* megablocks */)
+// How fragmented is the free memory?  Counts the free blocks in
+// groups smaller than a megablock, and the wholly free megablocks, and
+// makes a histogram of the megablocks that are partly in use: entry i
+// counts the megablocks with between 2^i and 2^(i+1)-1 free blocks.
+// Free blocks in megablocks that are mostly in use can't be returned
+// to the OS.  The caller must hold sm_mutex.
+void
+fragmentationStats (W_ *free_blocks, W_ *free_mblocks,
+                    W_ histogram[MBLOCK_FREE_HISTOGRAM_SIZE])
 {
-    static bdescr *bd;
-    StgWord size;
+    bdescr *bd, *p, *first;
+    W_ n;
+    StgWord ln;
+    nat node, i;
+
+    *free_blocks = 0;
+    *free_mblocks = 0;
+    for (i = 0; i < MBLOCK_FREE_HISTOGRAM_SIZE; i++) {
+        histogram[i] = 0;
+    }
 
-    bd = free_mblock_list;
-    while ((n > 0) && (bd != NULL)) {
-        size = BLOCKS_TO_MBLOCKS(bd->blocks);
-        if (size > n) {
-            StgWord newSize = size - n;
-            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
-            freeAddr += newSize * MBLOCK_SIZE;
-            bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
-            freeMBlocks(freeAddr, n);
-            n = 0;
+    for (node = 0; node < n_numa_nodes; node++) {
+        for (ln = 0; ln < MAX_FREE_LIST; ln++) {
+            for (bd = free_list[node][ln]; bd != NULL; bd = bd->link) {
+                *free_blocks += bd->blocks;
+
+                // Count each megablock once, for its first free group.
+                // The groups in a megablock that isn't wholly free all
+                // have valid heads, so we can walk them in order.
+                first = NULL;
+                n = 0;
+                for (p = FIRST_BDESCR(MBLOCK_ROUND_DOWN(bd));
+                     p <= LAST_BDESCR(MBLOCK_ROUND_DOWN(bd));
+                     p += p->blocks) {
+                    ASSERT(p->blocks > 0 && p->blocks < BLOCKS_PER_MBLOCK);
+                    if (p->free == (P_)-1) {
+                        if (first == NULL) {
+                            first = p;
+                            if (first != bd) break;
+                        }
+                        n += p->blocks;
+                    }
+                }
+                if (first == bd) {
+                    histogram[stg_min(log_2(n),
+                                      MBLOCK_FREE_HISTOGRAM_SIZE-1)]++;
+                }
+            }
         }
-        else {
-            char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
-            n -= size;
-            bd = bd->link;
-            freeMBlocks(freeAddr, size);
+        for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
+            *free_mblocks += BLOCKS_TO_MBLOCKS(bd->blocks);
         }
     }
-    free_mblock_list = bd;
+}
+
+void returnMemoryToOS(nat n /* megablocks */)
+{
+    bdescr *bd;
+    nat node;
+    StgWord size;
+
+    // ToDo: not fair, we free all the memory starting with node 0.
+    for (node = 0; n > 0 && node < n_numa_nodes; node++) {
+      bd = free_mblock_list[node];
+      while ((n > 0) && (bd != NULL)) {
+          size = BLOCKS_TO_MBLOCKS(bd->blocks);
+          if (size > n) {
+              StgWord newSize = size - n;
+              char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+              freeAddr += newSize * MBLOCK_SIZE;
+              bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
+              freeMBlocks(freeAddr, n);
+              n = 0;
+          }
+          else {
+              char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+              n -= size;
+              bd = bd->link;
+              freeMBlocks(freeAddr, size);
+          }
+      }
+      free_mblock_list[node] = bd;
+    }
 
     osReleaseFreeMemory();
 
@@ -750,6 +1238,65 @@ void returnMemoryToOS(nat n /* megablocks */)
     );
 }
 
+/* -----------------------------------------------------------------------------
+   decommitFreeMBlocks
+
+   With +RTS --decommit-age, the GC doesn't call returnMemoryToOS().
+   Instead, free mgroups stay on free_mblock_list (and keep their address
+   space), and once a group has been free for the given age we tell the
+   OS that it may take the memory back (osDiscardMemory(), i.e.
+   madvise(MADV_FREE)), which is cheaper than unmapping it and leaves it
+   ready for reuse if the heap grows again.  Each group records in
+   u.freed when it was last freed (or coalesced with freshly freed
+   memory), and BF_DECOMMITTED says that we have already given back its
+   memory.
+
+   We must keep the block descriptors of the first mblock of each group,
+   because alloc_mega_group() relies on them when it hands out the group
+   as a whole, so we only give back the memory from the first block of
+   the group onwards.  Memory given back reads as zeros, or as its old
+   contents if the OS didn't need it; either is fine for a free block.
+
+   Called with the sm_mutex held, by the thread in Decommit.c (or from
+   the GC in the non-threaded RTS).  Decommits at most 'max' mblocks
+   (but at least one group if there is an old enough one), and returns
+   the number of mblocks decommitted.
+   -------------------------------------------------------------------------- */
+
+W_ decommitFreeMBlocks (Time age, W_ max)
+{
+    bdescr *bd;
+    nat node;
+    W_ done = 0, mblocks, page_size, now, age_ms;
+    StgWord8 *start, *end;
+
+    now = (W_)(TimeToUS(getProcessElapsedTime()) / 1000);
+    age_ms = (W_)(TimeToUS(age) / 1000);
+    page_size = getPageSize();
+
+    for (node = 0; done < max && node < n_numa_nodes; node++) {
+        for (bd = free_mblock_list[node];
+             done < max && bd != NULL;
+             bd = bd->link) {
+            if ((bd->flags & BF_DECOMMITTED) || now - bd->u.freed < age_ms) {
+                continue;
+            }
+            mblocks = BLOCKS_TO_MBLOCKS(bd->blocks);
+            start = (StgWord8*)(((W_)FIRST_BLOCK(MBLOCK_ROUND_DOWN(bd))
+                                 + page_size - 1) & ~(page_size - 1));
+            end = (StgWord8*)MBLOCK_ROUND_DOWN(bd) + mblocks * MBLOCK_SIZE;
+            if (osDiscardMemory(start, end - start)) {
+                done += mblocks;
+            }
+            // don't try again even if it failed
+            bd->flags |= BF_DECOMMITTED;
+        }
+    }
+
+    decommitted_mblocks += done;
+    return done;
+}
+
 /* -----------------------------------------------------------------------------
    Debugging
    -------------------------------------------------------------------------- */
@@ -773,68 +1320,72 @@ checkFreeListSanity(void)
 {
     bdescr *bd, *prev;
     StgWord ln, min;
+    nat node;
 
-
-    min = 1;
-    for (ln = 0; ln < MAX_FREE_LIST; ln++) {
-        IF_DEBUG(block_alloc,
-                 debugBelch("free block list [%" FMT_Word "]:\n", ln));
-
-        prev = NULL;
-        for (bd = free_list[ln]; bd != NULL; prev = bd, bd = bd->link)
-        {
+    for (node = 0; node < n_numa_nodes; node++) {
+        min = 1;
+        for (ln = 0; ln < MAX_FREE_LIST; ln++) {
             IF_DEBUG(block_alloc,
-                     debugBelch("group at %p, length %ld blocks\n",
-                                bd->start, (long)bd->blocks));
-            ASSERT(bd->free == (P_)-1);
-            ASSERT(bd->blocks > 0 && bd->blocks < BLOCKS_PER_MBLOCK);
-            ASSERT(bd->blocks >= min && bd->blocks <= (min*2 - 1));
-            ASSERT(bd->link != bd); // catch easy loops
-
-            check_tail(bd);
-
-            if (prev)
-                ASSERT(bd->u.back == prev);
-            else
-                ASSERT(bd->u.back == NULL);
+                     debugBelch("free block list [%" FMT_Word "]:\n", ln));
 
+            prev = NULL;
+            for (bd = free_list[node][ln]; bd != NULL; prev = bd, bd = bd->link)
             {
-                bdescr *next;
-                next = bd + bd->blocks;
-                if (next <= LAST_BDESCR(MBLOCK_ROUND_DOWN(bd)))
+                IF_DEBUG(block_alloc,
+                         debugBelch("group at %p, length %ld blocks\n",
+                                    bd->start, (long)bd->blocks));
+                ASSERT(bd->free == (P_)-1);
+                ASSERT(bd->node == node);
+                ASSERT(bd->blocks > 0 && bd->blocks < BLOCKS_PER_MBLOCK);
+                ASSERT(bd->blocks >= min && bd->blocks <= (min*2 - 1));
+                ASSERT(bd->link != bd); // catch easy loops
+
+                check_tail(bd);
+
+                if (prev)
+                    ASSERT(bd->u.back == prev);
+                else
+                    ASSERT(bd->u.back == NULL);
+
                 {
-                    ASSERT(next->free != (P_)-1);
+                    bdescr *next;
+                    next = bd + bd->blocks;
+                    if (next <= LAST_BDESCR(MBLOCK_ROUND_DOWN(bd)))
+                    {
+                        ASSERT(next->free != (P_)-1);
+                    }
                 }
             }
+            min = min << 1;
         }
-        min = min << 1;
-    }
 
-    prev = NULL;
-    for (bd = free_mblock_list; bd != NULL; prev = bd, bd = bd->link)
-    {
-        IF_DEBUG(block_alloc,
-                 debugBelch("mega group at %p, length %ld blocks\n",
-                            bd->start, (long)bd->blocks));
+        prev = NULL;
+        for (bd = free_mblock_list[node]; bd != NULL; prev = bd, bd = bd->link)
+        {
+            IF_DEBUG(block_alloc,
+                     debugBelch("mega group at %p, length %ld blocks\n",
+                                bd->start, (long)bd->blocks));
 
-        ASSERT(bd->link != bd); // catch easy loops
+            ASSERT(bd->link != bd); // catch easy loops
+            ASSERT(bd->node == node);
 
-        if (bd->link != NULL)
-        {
-            // make sure the list is sorted
-            ASSERT(bd->start < bd->link->start);
-        }
+            if (bd->link != NULL)
+            {
+                // make sure the list is sorted
+                ASSERT(bd->start < bd->link->start);
+            }
 
-        ASSERT(bd->blocks >= BLOCKS_PER_MBLOCK);
-        ASSERT(MBLOCK_GROUP_BLOCKS(BLOCKS_TO_MBLOCKS(bd->blocks))
-               == bd->blocks);
+            ASSERT(bd->blocks >= BLOCKS_PER_MBLOCK);
+            ASSERT(MBLOCK_GROUP_BLOCKS(BLOCKS_TO_MBLOCKS(bd->blocks))
+                   == bd->blocks);
 
-        // make sure we're fully coalesced
-        if (bd->link != NULL)
-        {
-            ASSERT (MBLOCK_ROUND_DOWN(bd->link) !=
-                    (StgWord8*)MBLOCK_ROUND_DOWN(bd) +
-                    BLOCKS_TO_MBLOCKS(bd->blocks) * MBLOCK_SIZE);
+            // make sure we're fully coalesced
+            if (bd->link != NULL)
+            {
+                ASSERT (MBLOCK_ROUND_DOWN(bd->link) !=
+                        (StgWord8*)MBLOCK_ROUND_DOWN(bd) +
+                        BLOCKS_TO_MBLOCKS(bd->blocks) * MBLOCK_SIZE);
+            }
         }
     }
 }
@@ -845,18 +1396,21 @@ countFreeList(void)
   bdescr *bd;
   W_ total_blocks = 0;
   StgWord ln;
+  nat node;
 
-  for (ln=0; ln < MAX_FREE_LIST; ln++) {
-      for (bd = free_list[ln]; bd != NULL; bd = bd->link) {
-          total_blocks += bd->blocks;
+  for (node = 0; node < n_numa_nodes; node++) {
+      for (ln=0; ln < MAX_FREE_LIST; ln++) {
+          for (bd = free_list[node][ln]; bd != NULL; bd = bd->link) {
+              total_blocks += bd->blocks;
+          }
+      }
+      for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
+          total_blocks += BLOCKS_PER_MBLOCK * BLOCKS_TO_MBLOCKS(bd->blocks);
+          // The caller of this function, memInventory(), expects to match
+          // the total number of blocks in the system against mblocks *
+          // BLOCKS_PER_MBLOCK, so we must subtract the space for the
+          // block descriptors from *every* mblock.
       }
-  }
-  for (bd = free_mblock_list; bd != NULL; bd = bd->link) {
-      total_blocks += BLOCKS_PER_MBLOCK * BLOCKS_TO_MBLOCKS(bd->blocks);
-      // The caller of this function, memInventory(), expects to match
-      // the total number of blocks in the system against mblocks *
-      // BLOCKS_PER_MBLOCK, so we must subtract the space for the
-      // block descriptors from *every* mblock.
   }
   return total_blocks;
 }
@@ -869,6 +1423,12 @@ markBlocks (bdescr *bd)
     }
 }
 
+void
+markDeferredBlocks (void)
+{
+    markBlocks(deferred_free);
+}
+
 void
 reportUnmarkedBlocks (void)
 {
@@ -12,22 +12,44 @@
 #include "BeginPrivate.h"
 
 bdescr *allocLargeChunk (W_ min, W_ max);
+bdescr *allocLargeChunkOnNode (nat node, W_ min, W_ max);
+rtsBool extendGroup (bdescr *bd, W_ n);
+
+/* Per-Capability block cache ---------------------------------------------- */
+
+bdescr *allocBlockCap_lock (Capability *cap);
+bdescr *allocBlockCached   (Capability *cap);
+void    refillBlockCache   (Capability *cap);
+void    flushBlockCache    (Capability *cap);
+
+/* Deferred freeing (see Note [Deferred freeing] in BlockAlloc.c) -------- */
+
+void deferFreeChain          (bdescr *bd);
+void freeDeferredChains      (void);
+void freeDeferredChains_lock (void);
 
 /* Debugging  -------------------------------------------------------------- */
 
 extern W_ countBlocks       (bdescr *bd);
 extern W_ countAllocdBlocks (bdescr *bd);
 extern void returnMemoryToOS(nat n);
+extern void fragmentationStats(W_ *free_blocks, W_ *free_mblocks,
+                               W_ histogram[MBLOCK_FREE_HISTOGRAM_SIZE]);
+extern W_ decommitFreeMBlocks(Time age, W_ max);
 
 #ifdef DEBUG
 void checkFreeListSanity(void);
 W_   countFreeList(void);
 void markBlocks (bdescr *bd);
+void markDeferredBlocks (void);
 void reportUnmarkedBlocks (void);
 #endif
 
 extern W_ n_alloc_blocks;   // currently allocated blocks
 extern W_ hw_alloc_blocks;  // high-water allocated blocks
+extern W_ n_alloc_blocks_by_node[MAX_NUMA_NODES];
+extern W_ n_deferred_blocks; // allocated blocks on the deferred free list
+extern W_ decommitted_mblocks; // total given back by decommitFreeMBlocks()
 
 #include "EndPrivate.h"
 
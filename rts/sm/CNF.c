@@ -0,0 +1,839 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Compact regions
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "BlockAlloc.h"
+#include "Capability.h"
+#include "CNF.h"
+#include "Hash.h"
+#include "RtsUtils.h"
+#include "Storage.h"
+
+#include <string.h>
+
+/*
+  Note [Compact regions]
+  ~~~~~~~~~~~~~~~~~~~~~~
+
+  A compact region is a chain of block groups holding fully-evaluated,
+  immutable data, which the GC treats as a single object: a pointer
+  into any part of a region keeps the whole region alive, and nothing
+  in a region is ever copied, marked, or scanned.  So a large
+  structure that lives for a long time (a lookup table, say) costs the
+  GC nothing once it is in a region, in the same way as a large
+  object.
+
+  Layout.  Each block group of a region starts with an
+  StgCompactNFDataBlock, which points to the region (owner) and to the
+  next group.  The first group is followed by the StgCompactNFData,
+  which is the object the program holds on to (a Compact#); objects
+  are allocated after it, and bd->free is the allocation pointer of
+  each group.  Every block descriptor of a group has BF_COMPACT, and
+  every group fits in one megablock, except for a group holding a
+  single large object at its start, so that objectGetCompact() can
+  find the region from any object in it.
+
+  GC.  The first group of every region is on gen->compact_objects.
+  evacuate() sends pointers into a region to evacuate_compact(), which
+  moves the region to gen->live_compact_objects of the destination
+  generation, like evacuate_large().  Regions left on compact_objects
+  of a collected generation at the end of GC are dead, and are freed.
+  A region can only point to itself and to static closures that are
+  never collected, so there is nothing to scavenge.
+
+  Adding data.  compactAdd() copies an object and everything reachable
+  from it into a region, keeping sharing (and cycles).  It follows
+  indirections and evaluated blackholes, but fails on anything that is
+  not a constructor, a byte array, a frozen array of pointers or a BCO:
+  thunks, functions and mutable objects can't go in a region.  It holds
+  the SM lock for the duration, which also serialises adds to a region.
+  Data copied before a failure stays in the region.
+
+  BCOs.  A region can hold the BCOs of interpreted code, so that GHCi
+  can keep them, or write them out and read them back in, in one go
+  instead of building them one at a time with newBCO#.  A BCO points to
+  static functions and CAFs as well as to constructors, which is only
+  safe if those are never collected: so they are allowed in a region
+  only when keepCAFs is set, as it is in GHCi.  The break array of a BCO
+  compiled with breakpoints is copied like any other byte array, so the
+  copy won't see breakpoints set on the original.  Since the GC never
+  looks inside a region, checkUnload() searches the static pointers of
+  regions itself (compactSearchPointers()), to keep the object code
+  they point to loaded.
+
+  Serialisation.  A region can be written out block by block
+  (compactGetFirstBlock(), compactGetNextBlock(), compactBlockSize()),
+  and read back in by allocating each block (compactAllocateBlock()),
+  copying the image into it, and then calling compactFixupPointers(),
+  which moves the pointers to the new blocks using the address that
+  each block header had when it was written (self).  Static closures
+  and info pointers are left alone, so this only works for the same
+  executable.
+
+  These functions are available to Haskell as out-of-line primops
+  (stg_compact*zh in PrimOps.cmm), to be bound with foreign import prim.
+*/
+
+/* ----------------------------------------------------------------------------
+   Block groups
+   ------------------------------------------------------------------------- */
+
+// Allocate a group of n blocks for a region.  The caller holds the SM
+// lock, and accounts for the blocks.
+static bdescr *
+allocCompactGroup (generation *gen, W_ n)
+{
+    bdescr *bd, *tl;
+    StgCompactNFDataBlock *block;
+    W_ i, m;
+
+    bd = allocGroup(n);
+    initBdescr(bd, gen, gen->to);
+    bd->flags = BF_COMPACT;
+    bd->link = NULL;
+    bd->u.back = NULL;
+
+    m = bd->blocks > BLOCKS_PER_MBLOCK ? 1 : bd->blocks;
+    for (i = 1, tl = bd + 1; i < m; i++, tl++) {
+        tl->flags = BF_COMPACT;
+    }
+
+    block = (StgCompactNFDataBlock *)bd->start;
+    block->self = block;
+    block->owner = NULL;
+    block->next = NULL;
+    bd->free = (P_)(block + 1);
+
+    return bd;
+}
+
+static void
+freeCompactGroup (bdescr *bd)
+{
+    bdescr *tl;
+    W_ i, m;
+
+    m = bd->blocks > BLOCKS_PER_MBLOCK ? 1 : bd->blocks;
+    for (i = 1, tl = bd + 1; i < m; i++, tl++) {
+        tl->flags = 0;
+    }
+    freeGroup(bd);
+}
+
+// Add a group of n blocks to the end of a region (SM lock held)
+static bdescr *
+appendCompactGroup (StgCompactNFData *str, W_ n)
+{
+    generation *gen;
+    StgCompactNFDataBlock *block;
+    bdescr *bd;
+
+    gen = Bdescr((P_)str)->gen;
+    bd = allocCompactGroup(gen, n);
+    gen->n_compact_blocks += bd->blocks;
+
+    block = (StgCompactNFDataBlock *)bd->start;
+    block->owner = str;
+    str->last->next = block;
+    str->last = block;
+    str->totalW += bd->blocks * BLOCK_SIZE_W;
+
+    return bd;
+}
+
+// Allocate words in a region (SM lock held)
+static StgPtr
+compactAllocate (StgCompactNFData *str, W_ words)
+{
+    bdescr *bd;
+    StgPtr p;
+    W_ hdr = sizeofW(StgCompactNFDataBlock);
+
+    bd = Bdescr((P_)str->nursery);
+    if (bd->free + words > bd->start + bd->blocks * BLOCK_SIZE_W) {
+        if (hdr + words > str->autoBlockW) {
+            // A large object gets a group to itself, and we never
+            // allocate anything else there.
+            bd = appendCompactGroup(str,
+                     BLOCK_ROUND_UP((hdr + words) * sizeof(W_)) / BLOCK_SIZE);
+        } else {
+            bd = appendCompactGroup(str, str->autoBlockW / BLOCK_SIZE_W);
+            str->nursery = (StgCompactNFDataBlock *)bd->start;
+        }
+    }
+
+    p = bd->free;
+    bd->free += words;
+    return p;
+}
+
+static void
+compactFree (StgCompactNFData *str)
+{
+    StgCompactNFDataBlock *block, *next;
+
+    for (block = compactGetFirstBlock(str); block != NULL; block = next) {
+        next = block->next;
+        freeCompactGroup(Bdescr((P_)block));
+    }
+}
+
+// Free the regions on a list of first blocks (SM lock held)
+void
+freeCompactList (bdescr *bd)
+{
+    bdescr *next;
+
+    for (; bd != NULL; bd = next) {
+        next = bd->link;
+        compactFree(((StgCompactNFDataBlock *)bd->start)->owner);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+   Creating regions
+   ------------------------------------------------------------------------- */
+
+StgCompactNFData *
+compactNew (Capability *cap STG_UNUSED, StgWord size)
+{
+    StgCompactNFData *str;
+    StgCompactNFDataBlock *block;
+    bdescr *bd;
+    W_ n;
+
+    ASSERT(sizeofW(StgCompactNFData) == sizeofW(StgHeader) + 4);
+
+    // size is the size of each block group, in bytes
+    n = BLOCK_ROUND_UP(size) / BLOCK_SIZE;
+    n = stg_max(n, 1);
+    n = stg_min(n, BLOCKS_PER_MBLOCK);
+
+    ACQUIRE_SM_LOCK;
+    bd = allocCompactGroup(g0, n);
+    g0->n_compact_blocks += bd->blocks;
+    dbl_link_onto(bd, &g0->compact_objects);
+    RELEASE_SM_LOCK;
+
+    block = (StgCompactNFDataBlock *)bd->start;
+    str = (StgCompactNFData *)(block + 1);
+    block->owner = str;
+
+    SET_HDR((StgClosure *)str, &stg_COMPACT_NFDATA_info, CCS_SYSTEM);
+    str->totalW = bd->blocks * BLOCK_SIZE_W;
+    str->autoBlockW = n * BLOCK_SIZE_W;
+    str->nursery = block;
+    str->last = block;
+    bd->free = (P_)(str + 1);
+
+    return str;
+}
+
+/* ----------------------------------------------------------------------------
+   Copying data into a region
+   ------------------------------------------------------------------------- */
+
+typedef struct {
+    StgCompactNFData *str;
+    HashTable *copied;          // object -> its copy in the region
+    StgClosure **todo;          // copies that may point out of the region
+    W_ n_todo;
+    W_ size_todo;
+    rtsBool failed;
+} CompactCopy;
+
+STATIC_INLINE rtsBool
+inCompact (StgCompactNFData *str, StgClosure *q)
+{
+    return (Bdescr((P_)q)->flags & BF_COMPACT) && objectGetCompact(q) == str;
+}
+
+static void
+pushTodo (CompactCopy *cc, StgClosure *c)
+{
+    if (cc->n_todo == cc->size_todo) {
+        cc->size_todo *= 2;
+        cc->todo = stgReallocBytes(cc->todo,
+                                   cc->size_todo * sizeof(StgClosure *),
+                                   "compactAdd");
+    }
+    cc->todo[cc->n_todo++] = c;
+}
+
+// Return a (tagged) pointer to the copy of p in the region, copying it
+// if necessary.  The fields of a new copy still point to the originals;
+// it is pushed on cc->todo to be fixed by compactScavenge().
+static StgClosure *
+compactCopy (CompactCopy *cc, StgClosure *p)
+{
+    StgClosure *q, *r, *copy;
+    const StgInfoTable *info, *i;
+    StgWord tag;
+    W_ size;
+
+    for (;;) {
+        tag = GET_CLOSURE_TAG(p);
+        q = UNTAG_CLOSURE(p);
+        info = get_itbl(q);
+
+        if (!HEAP_ALLOCED(q)) {
+            // A static constructor without CAFs lives as long as the
+            // program does.  One that may refer to CAFs is only kept
+            // alive by the GC if it is reachable, so it gets copied.
+            switch (info->type) {
+            case CONSTR_NOCAF_STATIC:
+                return p;
+            case FUN_STATIC:
+            case THUNK_STATIC:
+                // only for BCOs: see "BCOs" in Note [Compact regions]
+                if (keepCAFs) return p;
+                goto fail;
+            case IND_STATIC:
+                p = ((StgInd *)q)->indirectee;
+                continue;
+            case CONSTR_STATIC:
+                break;
+            default:
+                goto fail;
+            }
+        } else if (inCompact(cc->str, q)) {
+            return p;
+        }
+
+        copy = lookupHashTable(cc->copied, (StgWord)q);
+        if (copy != NULL) {
+            return TAG_CLOSURE(tag, copy);
+        }
+
+        switch (info->type) {
+
+        case IND:
+        case IND_PERM:
+            p = ((StgInd *)q)->indirectee;
+            continue;
+
+        case BLACKHOLE:
+            r = ((StgInd *)q)->indirectee;
+            if (GET_CLOSURE_TAG(r) == 0) {
+                i = r->header.info;
+                if (i == &stg_TSO_info
+                    || i == &stg_WHITEHOLE_info
+                    || i == &stg_BLOCKING_QUEUE_CLEAN_info
+                    || i == &stg_BLOCKING_QUEUE_DIRTY_info) {
+                    goto fail;      // still being evaluated
+                }
+            }
+            p = r;
+            continue;
+
+        case CONSTR:
+        case CONSTR_1_0:
+        case CONSTR_0_1:
+        case CONSTR_2_0:
+        case CONSTR_1_1:
+        case CONSTR_0_2:
+        case CONSTR_STATIC:     // the copy has no static link field
+        case ARR_WORDS:
+        case MUT_ARR_PTRS_FROZEN:
+        case MUT_ARR_PTRS_FROZEN0:
+        case SMALL_MUT_ARR_PTRS_FROZEN:
+        case SMALL_MUT_ARR_PTRS_FROZEN0:
+            size = closure_sizeW(q);
+            copy = (StgClosure *)compactAllocate(cc->str, size);
+            memcpy(copy, q, size * sizeof(W_));
+            insertHashTable(cc->copied, (StgWord)q, copy);
+            if (info->type != ARR_WORDS) {
+                pushTodo(cc, copy);
+            }
+            return TAG_CLOSURE(tag, copy);
+
+        case BCO:
+            size = bco_sizeW((StgBCO *)q);
+            copy = (StgClosure *)compactAllocate(cc->str, size);
+            memcpy(copy, q, size * sizeof(W_));
+            insertHashTable(cc->copied, (StgWord)q, copy);
+            pushTodo(cc, copy);
+            return TAG_CLOSURE(tag, copy);
+
+        default:
+            goto fail;
+        }
+    }
+
+fail:
+    cc->failed = rtsTrue;
+    return p;
+}
+
+// Copy the objects that a new copy points to
+static void
+compactScavenge (CompactCopy *cc, StgClosure *c)
+{
+    const StgInfoTable *info;
+    StgClosure **p, **end;
+
+    info = get_itbl(c);
+    switch (info->type) {
+    case BCO:
+    {
+        StgBCO *bco = (StgBCO *)c;
+        bco->instrs   = (StgArrWords *)compactCopy(cc, (StgClosure *)bco->instrs);
+        bco->literals = (StgArrWords *)compactCopy(cc, (StgClosure *)bco->literals);
+        bco->ptrs     = (StgMutArrPtrs *)compactCopy(cc, (StgClosure *)bco->ptrs);
+        return;
+    }
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0:
+    {
+        StgMutArrPtrs *a = (StgMutArrPtrs *)c;
+        // nothing in a region is ever on a mutable list
+        SET_INFO(c, &stg_MUT_ARR_PTRS_FROZEN_info);
+        memset(mutArrPtrsCard(a, 0), 0, mutArrPtrsCards(a->ptrs));
+        p = a->payload;
+        end = p + a->ptrs;
+        break;
+    }
+    case SMALL_MUT_ARR_PTRS_FROZEN:
+    case SMALL_MUT_ARR_PTRS_FROZEN0:
+        SET_INFO(c, &stg_SMALL_MUT_ARR_PTRS_FROZEN_info);
+        p = ((StgSmallMutArrPtrs *)c)->payload;
+        end = p + ((StgSmallMutArrPtrs *)c)->ptrs;
+        break;
+    default:
+        p = c->payload;
+        end = p + info->layout.payload.ptrs;
+        break;
+    }
+
+    for (; p < end && !cc->failed; p++) {
+        *p = compactCopy(cc, *p);
+    }
+}
+
+StgClosure *
+compactAdd (Capability *cap STG_UNUSED, StgCompactNFData *str,
+            StgClosure *what)
+{
+    CompactCopy cc;
+    StgClosure *root;
+
+    cc.str = str;
+    cc.copied = allocHashTable();
+    cc.size_todo = 64;
+    cc.todo = stgMallocBytes(cc.size_todo * sizeof(StgClosure *),
+                             "compactAdd");
+    cc.n_todo = 0;
+    cc.failed = rtsFalse;
+
+    ACQUIRE_SM_LOCK;
+    root = compactCopy(&cc, what);
+    while (!cc.failed && cc.n_todo > 0) {
+        compactScavenge(&cc, cc.todo[--cc.n_todo]);
+    }
+    RELEASE_SM_LOCK;
+
+    freeHashTable(cc.copied, NULL);
+    stgFree(cc.todo);
+
+    return cc.failed ? NULL : root;
+}
+
+StgWord
+compactContains (StgCompactNFData *str, StgClosure *what)
+{
+    StgClosure *q = UNTAG_CLOSURE(what);
+
+    return HEAP_ALLOCED(q) && inCompact(str, q);
+}
+
+StgWord
+compactSize (StgCompactNFData *str)
+{
+    return str->totalW * sizeof(W_);
+}
+
+/* ----------------------------------------------------------------------------
+   Serialisation
+   ------------------------------------------------------------------------- */
+
+StgCompactNFDataBlock *
+compactGetFirstBlock (StgCompactNFData *str)
+{
+    return ((StgCompactNFDataBlock *)str) - 1;
+}
+
+StgCompactNFDataBlock *
+compactGetNextBlock (StgCompactNFData *str STG_UNUSED,
+                     StgCompactNFDataBlock *block)
+{
+    return block->next;
+}
+
+// The number of bytes of a block to save; this is also the size to
+// give compactAllocateBlock() when reading it back.
+StgWord
+compactBlockSize (StgCompactNFDataBlock *block)
+{
+    bdescr *bd;
+
+    if (block == NULL) return 0;
+    bd = Bdescr((P_)block);
+    return (bd->free - (P_)block) * sizeof(W_);
+}
+
+StgCompactNFData *
+compactBlockOwner (StgCompactNFDataBlock *block)
+{
+    return block->owner;
+}
+
+// Regions being read in: a block may be allocated and the image copied
+// into it while the program continues (and GCs), so until
+// compactFixupPointers() the groups are kept here, chained from each
+// first group by bd->link, where the GC doesn't look at them.
+typedef struct CompactImport_ {
+    bdescr *first;
+    bdescr *last;
+    struct CompactImport_ *next;
+} CompactImport;
+
+static CompactImport *compact_imports = NULL;   // protected by the SM lock
+
+StgCompactNFDataBlock *
+compactAllocateBlock (Capability *cap STG_UNUSED, StgWord size,
+                      StgCompactNFDataBlock *previous)
+{
+    CompactImport *imp;
+    bdescr *bd;
+    W_ n;
+
+    if (size < sizeof(StgCompactNFDataBlock)
+        || size % sizeof(W_) != 0) {
+        return NULL;
+    }
+
+    n = BLOCK_ROUND_UP(size) / BLOCK_SIZE;
+
+    ACQUIRE_SM_LOCK;
+    for (imp = compact_imports; imp != NULL; imp = imp->next) {
+        if (previous != NULL && (P_)previous == imp->last->start) break;
+    }
+    if (previous != NULL && imp == NULL) {
+        RELEASE_SM_LOCK;
+        return NULL;
+    }
+
+    bd = allocCompactGroup(g0, n);
+    bd->free = bd->start + size / sizeof(W_);
+
+    if (imp == NULL) {
+        imp = stgMallocBytes(sizeof(CompactImport), "compactAllocateBlock");
+        imp->first = bd;
+        imp->next = compact_imports;
+        compact_imports = imp;
+    } else {
+        imp->last->link = bd;
+    }
+    imp->last = bd;
+    RELEASE_SM_LOCK;
+
+    return (StgCompactNFDataBlock *)bd->start;
+}
+
+typedef struct {
+    StgWord old;                // where the block was
+    StgWord new;                // where it is now
+    StgWord size;               // bytes in use
+} CompactRange;
+
+static int
+cmpCompactRange (const void *a, const void *b)
+{
+    StgWord x = ((const CompactRange *)a)->old;
+    StgWord y = ((const CompactRange *)b)->old;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// Move a (possibly tagged) pointer into the old image to the new one.
+// Returns rtsFalse if the pointer is neither into the image nor to a
+// static closure.
+static rtsBool
+fixupPointer (CompactRange *ranges, W_ n, StgClosure **p)
+{
+    StgWord tag = GET_CLOSURE_TAG(*p);
+    StgWord q = (StgWord)UNTAG_CLOSURE(*p);
+    W_ lo, hi, mid;
+
+    lo = 0; hi = n;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (q < ranges[mid].old) {
+            hi = mid;
+        } else if (q >= ranges[mid].old + ranges[mid].size) {
+            lo = mid + 1;
+        } else {
+            *p = TAG_CLOSURE(tag, (StgClosure *)
+                             (q - ranges[mid].old + ranges[mid].new));
+            return rtsTrue;
+        }
+    }
+
+    return !HEAP_ALLOCED((void *)q);
+}
+
+static rtsBool
+fixupObjects (CompactRange *ranges, W_ n, StgPtr p, StgPtr end)
+{
+    StgClosure *c, **q, **qend;
+    const StgInfoTable *info;
+
+    while (p < end) {
+        c = (StgClosure *)p;
+        info = get_itbl(c);
+        switch (info->type) {
+        case CONSTR:
+        case CONSTR_1_0:
+        case CONSTR_0_1:
+        case CONSTR_2_0:
+        case CONSTR_1_1:
+        case CONSTR_0_2:
+        case CONSTR_STATIC:
+            q = c->payload;
+            qend = q + info->layout.payload.ptrs;
+            break;
+        case ARR_WORDS:
+            q = qend = NULL;
+            break;
+        case MUT_ARR_PTRS_FROZEN:
+            q = ((StgMutArrPtrs *)c)->payload;
+            qend = q + ((StgMutArrPtrs *)c)->ptrs;
+            break;
+        case SMALL_MUT_ARR_PTRS_FROZEN:
+            q = ((StgSmallMutArrPtrs *)c)->payload;
+            qend = q + ((StgSmallMutArrPtrs *)c)->ptrs;
+            break;
+        case BCO:
+        {
+            StgBCO *bco = (StgBCO *)c;
+            if (!fixupPointer(ranges, n, (StgClosure **)&bco->instrs)
+                || !fixupPointer(ranges, n, (StgClosure **)&bco->literals)
+                || !fixupPointer(ranges, n, (StgClosure **)&bco->ptrs)) {
+                return rtsFalse;
+            }
+            q = qend = NULL;
+            break;
+        }
+        default:
+            return rtsFalse;
+        }
+        for (; q < qend; q++) {
+            if (!fixupPointer(ranges, n, q)) return rtsFalse;
+        }
+        p += closure_sizeW(c);
+    }
+
+    return p == end;
+}
+
+StgClosure *
+compactFixupPointers (Capability *cap STG_UNUSED,
+                      StgCompactNFDataBlock *first, StgClosure *root)
+{
+    CompactImport *imp, **pimp;
+    CompactRange *ranges;
+    StgCompactNFDataBlock *block;
+    StgCompactNFData *str;
+    bdescr *bd, *next;
+    W_ i, n, blocks;
+    rtsBool ok;
+
+    ACQUIRE_SM_LOCK;
+    for (pimp = &compact_imports; *pimp != NULL; pimp = &(*pimp)->next) {
+        if ((*pimp)->first->start == (P_)first) break;
+    }
+    imp = *pimp;
+    if (imp == NULL) {
+        RELEASE_SM_LOCK;
+        return NULL;
+    }
+    *pimp = imp->next;
+    RELEASE_SM_LOCK;
+
+    n = 0;
+    for (bd = imp->first; bd != NULL; bd = bd->link) n++;
+    ranges = stgMallocBytes(n * sizeof(CompactRange), "compactFixupPointers");
+    for (i = 0, bd = imp->first; bd != NULL; bd = bd->link, i++) {
+        ranges[i].old  = (StgWord)((StgCompactNFDataBlock *)bd->start)->self;
+        ranges[i].new  = (StgWord)bd->start;
+        ranges[i].size = (bd->free - bd->start) * sizeof(W_);
+    }
+    qsort(ranges, n, sizeof(CompactRange), cmpCompactRange);
+
+    str = (StgCompactNFData *)(first + 1);
+    ok = imp->first->free >= (P_)(str + 1)
+        && str->header.info == &stg_COMPACT_NFDATA_info;
+    for (i = 1; ok && i < n; i++) {
+        ok = ranges[i-1].old + ranges[i-1].size <= ranges[i].old;
+    }
+
+    blocks = 0;
+    for (bd = imp->first; ok && bd != NULL; bd = bd->link) {
+        block = (StgCompactNFDataBlock *)bd->start;
+        ok = fixupObjects(ranges, n,
+                          block == first ? (P_)(str + 1) : (P_)(block + 1),
+                          bd->free)
+            && fixupPointer(ranges, n, (StgClosure **)&block->next)
+            && (block->next == NULL || HEAP_ALLOCED(block->next));
+        block->self = block;
+        block->owner = str;
+        blocks += bd->blocks;
+    }
+    ok = ok
+        && fixupPointer(ranges, n, (StgClosure **)&str->nursery)
+        && fixupPointer(ranges, n, (StgClosure **)&str->last)
+        && HEAP_ALLOCED(str->nursery) && HEAP_ALLOCED(str->last)
+        && fixupPointer(ranges, n, &root);
+    stgFree(ranges);
+
+    ACQUIRE_SM_LOCK;
+    if (ok) {
+        for (bd = imp->first->link; bd != NULL; bd = next) {
+            next = bd->link;
+            bd->link = NULL;
+        }
+        bd = imp->first;
+        str->totalW = blocks * BLOCK_SIZE_W;
+        str->autoBlockW = stg_min(str->autoBlockW,
+                                  BLOCKS_PER_MBLOCK * BLOCK_SIZE_W);
+        g0->n_compact_blocks += blocks;
+        dbl_link_onto(bd, &g0->compact_objects);
+    } else {
+        for (bd = imp->first; bd != NULL; bd = next) {
+            next = bd->link;
+            freeCompactGroup(bd);
+        }
+    }
+    RELEASE_SM_LOCK;
+
+    stgFree(imp);
+    return ok ? root : NULL;
+}
+
+/* ----------------------------------------------------------------------------
+   Searching a region for pointers out of it
+   ------------------------------------------------------------------------- */
+
+// Call f on every pointer to a static closure in the region whose first
+// block group is bd.  Used by checkUnload(), after a major GC.
+void
+compactSearchPointers (bdescr *bd, void (*f)(void *))
+{
+    StgCompactNFDataBlock *block;
+    StgClosure *c, **q, **qend;
+    const StgInfoTable *info;
+    StgPtr p, end;
+
+    block = (StgCompactNFDataBlock *)bd->start;
+    p = (P_)((StgCompactNFData *)(block + 1) + 1);
+    for (;;) {
+        end = Bdescr((P_)block)->free;
+        while (p < end) {
+            c = (StgClosure *)p;
+            info = get_itbl(c);
+            switch (info->type) {
+            case MUT_ARR_PTRS_FROZEN:
+                q = ((StgMutArrPtrs *)c)->payload;
+                qend = q + ((StgMutArrPtrs *)c)->ptrs;
+                break;
+            case SMALL_MUT_ARR_PTRS_FROZEN:
+                q = ((StgSmallMutArrPtrs *)c)->payload;
+                qend = q + ((StgSmallMutArrPtrs *)c)->ptrs;
+                break;
+            case ARR_WORDS:
+            case BCO:           // its fields point into the region
+                q = qend = NULL;
+                break;
+            default:
+                q = c->payload;
+                qend = q + info->layout.payload.ptrs;
+                break;
+            }
+            for (; q < qend; q++) {
+                if (!HEAP_ALLOCED(UNTAG_CLOSURE(*q))) {
+                    f(UNTAG_CLOSURE(*q));
+                }
+            }
+            p += closure_sizeW(c);
+        }
+        block = block->next;
+        if (block == NULL) break;
+        p = (P_)(block + 1);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+   Sanity checking
+   ------------------------------------------------------------------------- */
+
+#ifdef DEBUG
+
+W_
+countCompactBlocks (bdescr *bd)
+{
+    StgCompactNFDataBlock *block;
+    W_ n = 0;
+
+    for (; bd != NULL; bd = bd->link) {
+        ASSERT(bd->flags & BF_COMPACT);
+        block = (StgCompactNFDataBlock *)bd->start;
+        for (; block != NULL; block = block->next) {
+            n += Bdescr((P_)block)->blocks;
+        }
+    }
+    return n;
+}
+
+void
+markCompactBlocks (bdescr *bd)
+{
+    StgCompactNFDataBlock *block;
+
+    for (; bd != NULL; bd = bd->link) {
+        block = (StgCompactNFDataBlock *)bd->start;
+        for (; block != NULL; block = block->next) {
+            Bdescr((P_)block)->flags |= BF_KNOWN;
+        }
+    }
+}
+
+// The regions being read in
+W_
+countCompactImportBlocks (void)
+{
+    CompactImport *imp;
+    W_ n = 0;
+
+    for (imp = compact_imports; imp != NULL; imp = imp->next) {
+        n += countBlocks(imp->first);
+    }
+    return n;
+}
+
+void
+markCompactImportBlocks (void)
+{
+    CompactImport *imp;
+
+    for (imp = compact_imports; imp != NULL; imp = imp->next) {
+        markBlocks(imp->first);
+    }
+}
+
+#endif /* DEBUG */
@@ -0,0 +1,62 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Compact regions: see CNF.c
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_CNF_H
+#define SM_CNF_H
+
+#include "BeginPrivate.h"
+
+StgCompactNFData *compactNew      (Capability *cap, StgWord size);
+StgClosure       *compactAdd      (Capability *cap, StgCompactNFData *str,
+                                   StgClosure *what);
+StgWord           compactContains (StgCompactNFData *str, StgClosure *what);
+StgWord           compactSize     (StgCompactNFData *str);
+
+// Serialisation
+StgCompactNFDataBlock *compactGetFirstBlock (StgCompactNFData *str);
+StgCompactNFDataBlock *compactGetNextBlock  (StgCompactNFData *str,
+                                             StgCompactNFDataBlock *block);
+StgWord                compactBlockSize     (StgCompactNFDataBlock *block);
+StgCompactNFDataBlock *compactAllocateBlock (Capability *cap, StgWord size,
+                                             StgCompactNFDataBlock *previous);
+StgClosure            *compactFixupPointers (Capability *cap,
+                                             StgCompactNFDataBlock *first,
+                                             StgClosure *root);
+StgCompactNFData      *compactBlockOwner    (StgCompactNFDataBlock *block);
+
+// Free the dead regions on a list (during GC)
+void freeCompactList (bdescr *bd);
+
+// For checkUnload()
+void compactSearchPointers (bdescr *bd, void (*f)(void *));
+
+#ifdef DEBUG
+W_   countCompactBlocks       (bdescr *bd);
+void markCompactBlocks        (bdescr *bd);
+W_   countCompactImportBlocks (void);
+void markCompactImportBlocks  (void);
+#endif
+
+// The region that an object in a compact region belongs to.  Every
+// block group of a region fits in one megablock, except for one that
+// holds a single large object at its start, so Bdescr() works for any
+// object in a region.
+INLINE_HEADER StgCompactNFData *
+objectGetCompact (StgClosure *p)
+{
+    bdescr *bd = Bdescr((P_)p);
+
+    if (bd->blocks == 0) {
+        bd = bd->link;          // not the first block of the group
+    }
+    return ((StgCompactNFDataBlock *)bd->start)->owner;
+}
+
+#include "EndPrivate.h"
+
+#endif /* SM_CNF_H */
@@ -67,8 +67,18 @@
    closure is normally the same (if they are not the same, then
    presumably the tag is not essential and it therefore doesn't matter
    if we throw away some of the tags).
+
+   When compacting in parallel (see compact_par() below), several
+   threads may add fields to the same chain at once, so the update of
+   the object's info field is done with cas().  Only pushes onto the
+   front of a chain ever happen concurrently; a chain is only walked or
+   unthreaded by the thread that owns the object.
    ------------------------------------------------------------------------- */
 
+#if defined(THREADED_RTS)
+static rtsBool compact_parallel = rtsFalse;
+#endif
+
 STATIC_INLINE void
 thread (StgClosure **p)
 {
@@ -84,11 +94,27 @@ thread (StgClosure **p)
     // ptr is possibly threaded:
     // ASSERT(LOOKS_LIKE_CLOSURE_PTR(q));
 
-    if (HEAP_ALLOCED(q)) {
+    if (HEAP_ALLOCED_GC(q)) {
         bd = Bdescr(q);
 
         if (bd->flags & BF_MARKED)
         {
+#if defined(THREADED_RTS)
+            if (compact_parallel) {
+                StgWord new;
+                do {
+                    iptr = *(volatile StgWord *)q;
+                    if (GET_CLOSURE_TAG((StgClosure *)iptr) == 0) {
+                        *p = (StgClosure *)(iptr + GET_CLOSURE_TAG(q0));
+                        new = (StgWord)p + 1;
+                    } else {
+                        *p = (StgClosure *)iptr;
+                        new = (StgWord)p + 2;
+                    }
+                } while (cas((StgVolatilePtr)q, iptr, new) != iptr);
+                return;
+            }
+#endif
             iptr = *q;
             switch (GET_CLOSURE_TAG((StgClosure *)iptr))
             {
@@ -197,8 +223,9 @@ thread_static( StgClosure* p )
 
   // keep going until we've threaded all the objects on the linked
   // list...
-  while (p != END_OF_STATIC_LIST) {
+  while (p != END_OF_STATIC_OBJECT_LIST) {
 
+    p = UNTAG_STATIC_LIST_PTR(p);
     info = get_itbl(p);
     switch (info->type) {
 
@@ -451,13 +478,16 @@ thread_TSO (StgTSO *tso)
 }
 
 
+#define ALL_BLOCKS ((W_)-1)
+
+// Update at most n blocks from bd onwards.
 static void
-update_fwd_large( bdescr *bd )
+update_fwd_large( bdescr *bd, W_ n )
 {
   StgPtr p;
   const StgInfoTable* info;
 
-  for (; bd != NULL; bd = bd->link) {
+  for (; bd != NULL && n > 0; bd = bd->link, n--) {
 
     // nothing to do in a pinned block; it might not even have an object
     // at the beginning.
@@ -734,8 +764,9 @@ thread_obj (StgInfoTable *info, StgPtr p)
     }
 }
 
+// Update at most n blocks from blocks onwards.
 static void
-update_fwd( bdescr *blocks )
+update_fwd( bdescr *blocks, W_ n )
 {
     StgPtr p;
     bdescr *bd;
@@ -744,7 +775,7 @@ update_fwd( bdescr *blocks )
     bd = blocks;
 
     // cycle through all the blocks in the step
-    for (; bd != NULL; bd = bd->link) {
+    for (; bd != NULL && n > 0; bd = bd->link, n--) {
         p = bd->start;
 
         // linearly scan the objects in this block
@@ -760,9 +791,6 @@ static void
 update_fwd_compact( bdescr *blocks )
 {
     StgPtr p, q, free;
-#if 0
-    StgWord m;
-#endif
     bdescr *bd, *free_bd;
     StgInfoTable *info;
     StgWord size;
@@ -778,31 +806,11 @@ update_fwd_compact( bdescr *blocks )
 
         while (p < bd->free ) {
 
-            while ( p < bd->free && !is_marked(p,bd) ) {
-                p++;
-            }
+            p = find_marked(p, bd);
             if (p >= bd->free) {
                 break;
             }
 
-#if 0
-    next:
-        m = * ((StgPtr)bd->u.bitmap + ((p - bd->start) / (BITS_IN(StgWord))));
-        m >>= ((p - bd->start) & (BITS_IN(StgWord) - 1));
-
-        while ( p < bd->free ) {
-
-            if ((m & 1) == 0) {
-                m >>= 1;
-                p++;
-                if (((StgWord)p & (sizeof(W_) * BITS_IN(StgWord))) == 0) {
-                    goto next;
-                } else {
-                    continue;
-                }
-            }
-#endif
-
             // Problem: we need to know the destination for this cell
             // in order to unthread its info pointer.  But we can't
             // know the destination without the size, because we may
@@ -834,9 +842,6 @@ update_fwd_compact( bdescr *blocks )
 
             unthread(q,(StgWord)free + GET_CLOSURE_TAG((StgClosure *)iptr));
             free += size;
-#if 0
-            goto next;
-#endif
         }
     }
 }
@@ -845,9 +850,6 @@ static W_
 update_bkwd_compact( generation *gen )
 {
     StgPtr p, free;
-#if 0
-    StgWord m;
-#endif
     bdescr *bd, *free_bd;
     StgInfoTable *info;
     StgWord size;
@@ -864,31 +866,11 @@ update_bkwd_compact( generation *gen )
 
         while (p < bd->free ) {
 
-            while ( p < bd->free && !is_marked(p,bd) ) {
-                p++;
-            }
+            p = find_marked(p, bd);
             if (p >= bd->free) {
                 break;
             }
 
-#if 0
-    next:
-        m = * ((StgPtr)bd->u.bitmap + ((p - bd->start) / (BITS_IN(StgWord))));
-        m >>= ((p - bd->start) & (BITS_IN(StgWord) - 1));
-
-        while ( p < bd->free ) {
-
-            if ((m & 1) == 0) {
-                m >>= 1;
-                p++;
-                if (((StgWord)p & (sizeof(W_) * BITS_IN(StgWord))) == 0) {
-                    goto next;
-                } else {
-                    continue;
-                }
-            }
-#endif
-
             if (is_marked(p+1,bd)) {
                 // don't forget to update the free ptr in the block desc.
                 free_bd->free = free;
@@ -914,9 +896,6 @@ update_bkwd_compact( generation *gen )
 
             free += size;
             p += size;
-#if 0
-            goto next;
-#endif
         }
     }
 
@@ -930,6 +909,437 @@ update_bkwd_compact( generation *gen )
     return free_blocks;
 }
 
+/* -----------------------------------------------------------------------------
+   Parallel compaction
+
+   In a parallel major GC of a compacted oldest generation, the
+   pointer-updating and moving phases of compaction are shared out
+   between the GC threads.  The forward/backward scheme
+   above threads forward pointers and updates them in the same pass,
+   which is inherently sequential, so the parallel version uses three
+   separate passes with a barrier in between:
+
+     1. thread every pointer field of every live object: the objects in
+        the non-compacted blocks and large objects, and the marked
+        objects in the compacted blocks.  Fields are added to chains
+        with cas(), see thread().
+
+     2. for each marked object in the compacted blocks, compute its
+        destination and unthread its chain.  After this pass every
+        pointer to a compacted object holds its new address.
+
+     3. slide each object down to its destination.
+
+   To let passes 2 and 3 run in parallel, the compacted blocks are cut
+   into regions of COMPACT_REGION_BLOCKS blocks, and objects only slide
+   within their own region.  This leaves at most one partially filled
+   block at the end of each region, which is a small price for the
+   parallelism.  The regions are joined back together at the end.
+
+   Marking is still sequential: the mark stack isn't thread-safe, so
+   as for a mark/sweep GC the other GC threads stand by while the main
+   GC thread marks, and are only woken up here (see par_compact() in
+   GC.c).  Each of them runs compactHelper(), which takes part in the
+   passes below until it is told to stop.  If the heap is too small to
+   be worth splitting up, the helpers are stopped straight away.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+#define COMPACT_REGION_BLOCKS 128
+#define COMPACT_CHUNK_BLOCKS  32
+
+// don't bother going parallel for fewer blocks than this
+#define COMPACT_PAR_MIN_BLOCKS (2 * COMPACT_REGION_BLOCKS)
+
+typedef struct {
+    bdescr *start;          // first block; the region is NULL-terminated
+    bdescr *free_bd;        // last block containing live data (pass 3)
+    StgPtr  free;           // free pointer in free_bd (pass 3)
+    W_      used_blocks;    // blocks containing live data (pass 3)
+} CompactRegion;
+
+typedef struct {
+    bdescr *start;
+    W_      n_blocks;
+    rtsBool large;          // a chunk of a large object list
+} CompactChunk;
+
+enum { COMPACT_IDLE, COMPACT_THREAD, COMPACT_FWD, COMPACT_MOVE, COMPACT_EXIT };
+
+static CompactRegion *compact_regions;
+static nat            n_compact_regions;
+static CompactChunk  *compact_chunks;
+static nat            n_compact_chunks;
+
+static Mutex     compact_mutex;
+static Condition compact_wakeup;    // a new pass has started
+static Condition compact_done;      // a helper has finished a pass
+static nat       compact_pass;      // protected by compact_mutex
+static nat       compact_busy;      // helpers still in this pass
+static nat       n_compact_helpers;
+
+static volatile StgWord compact_next; // next work item to claim
+
+static void
+thread_region (CompactRegion *r)
+{
+    bdescr *bd;
+    StgPtr p;
+    StgWord iptr;
+    StgInfoTable *info;
+
+    for (bd = r->start; bd != NULL; bd = bd->link) {
+        p = bd->start;
+        while (p < bd->free) {
+            p = find_marked(p, bd);
+            if (p >= bd->free) {
+                break;
+            }
+            iptr = get_threaded_info(p);
+            info = INFO_PTR_TO_STRUCT((StgInfoTable *)UNTAG_CLOSURE((StgClosure *)iptr));
+            p = thread_obj(info, p);
+        }
+    }
+}
+
+static void
+forward_region (CompactRegion *r)
+{
+    bdescr *bd, *free_bd;
+    StgPtr p, free;
+    StgWord iptr, size;
+    StgInfoTable *info;
+
+    free_bd = r->start;
+    free = free_bd->start;
+
+    for (bd = r->start; bd != NULL; bd = bd->link) {
+        p = bd->start;
+        while (p < bd->free) {
+            p = find_marked(p, bd);
+            if (p >= bd->free) {
+                break;
+            }
+            // all the fields were threaded in the previous pass, so we
+            // only need the size here.
+            iptr = get_threaded_info(p);
+            info = INFO_PTR_TO_STRUCT((StgInfoTable *)UNTAG_CLOSURE((StgClosure *)iptr));
+            size = closure_sizeW_((StgClosure *)p, info);
+
+            if (free + size > free_bd->start + BLOCK_SIZE_W) {
+                // see update_fwd_compact()
+                mark(p+1,bd);
+                free_bd = free_bd->link;
+                free = free_bd->start;
+            } else {
+                ASSERT(!is_marked(p+1,bd));
+            }
+
+            unthread(p, (StgWord)free + GET_CLOSURE_TAG((StgClosure *)iptr));
+            free += size;
+            p += size;
+        }
+    }
+}
+
+static void
+move_region (CompactRegion *r)
+{
+    bdescr *bd, *free_bd;
+    StgPtr p, free;
+    StgWord size;
+    StgInfoTable *info;
+    W_ used;
+
+    free_bd = r->start;
+    free = free_bd->start;
+    used = 1;
+
+    for (bd = r->start; bd != NULL; bd = bd->link) {
+        p = bd->start;
+        while (p < bd->free) {
+            p = find_marked(p, bd);
+            if (p >= bd->free) {
+                break;
+            }
+            if (is_marked(p+1,bd)) {
+                free_bd->free = free;
+                free_bd = free_bd->link;
+                free = free_bd->start;
+                used++;
+            }
+
+            ASSERT(LOOKS_LIKE_INFO_PTR((StgWord)((StgClosure *)p)->header.info));
+            info = get_itbl((StgClosure *)p);
+            size = closure_sizeW_((StgClosure *)p,info);
+
+            if (free != p) {
+                move(free,p,size);
+            }
+            if (info->type == STACK) {
+                move_STACK((StgStack *)p, (StgStack *)free);
+            }
+
+            free += size;
+            p += size;
+        }
+    }
+
+    r->free_bd = free_bd;
+    r->free = free;
+    r->used_blocks = (used == 1 && free == free_bd->start) ? 0 : used;
+}
+
+static void
+compact_do_pass (nat pass)
+{
+    StgWord i, n_items;
+
+    n_items = n_compact_regions;
+    if (pass == COMPACT_THREAD) {
+        n_items += n_compact_chunks;
+    }
+
+    for (;;) {
+        i = atomic_inc(&compact_next, 1) - 1;
+        if (i >= n_items) break;
+
+        switch (pass) {
+        case COMPACT_THREAD:
+            if (i < n_compact_chunks) {
+                CompactChunk *c = &compact_chunks[i];
+                if (c->large) {
+                    update_fwd_large(c->start, c->n_blocks);
+                } else {
+                    update_fwd(c->start, c->n_blocks);
+                }
+            } else {
+                thread_region(&compact_regions[i - n_compact_chunks]);
+            }
+            break;
+        case COMPACT_FWD:
+            forward_region(&compact_regions[i]);
+            break;
+        case COMPACT_MOVE:
+            move_region(&compact_regions[i]);
+            break;
+        default:
+            barf("compact_do_pass: %d", pass);
+        }
+    }
+}
+
+// Run by the other GC threads in a parallel compacting GC, see
+// gcWorkerThread().
+void
+compactHelper (void)
+{
+    nat seen = COMPACT_IDLE;
+    nat pass;
+
+    for (;;) {
+        ACQUIRE_LOCK(&compact_mutex);
+        while (compact_pass == seen) {
+            waitCondition(&compact_wakeup, &compact_mutex);
+        }
+        pass = seen = compact_pass;
+        RELEASE_LOCK(&compact_mutex);
+
+        if (pass != COMPACT_EXIT) {
+            compact_do_pass(pass);
+        }
+
+        ACQUIRE_LOCK(&compact_mutex);
+        if (--compact_busy == 0) {
+            signalCondition(&compact_done);
+        }
+        RELEASE_LOCK(&compact_mutex);
+
+        if (pass == COMPACT_EXIT) {
+            return;
+        }
+    }
+}
+
+// Start a pass on all the helpers, join in, and wait for them to finish.
+static void
+compact_run_pass (nat pass)
+{
+    ACQUIRE_LOCK(&compact_mutex);
+    compact_next = 0;
+    compact_busy = n_compact_helpers;
+    compact_pass = pass;
+    broadcastCondition(&compact_wakeup);
+    RELEASE_LOCK(&compact_mutex);
+
+    if (pass != COMPACT_EXIT) {
+        compact_do_pass(pass);
+    }
+
+    ACQUIRE_LOCK(&compact_mutex);
+    while (compact_busy > 0) {
+        waitCondition(&compact_done, &compact_mutex);
+    }
+    RELEASE_LOCK(&compact_mutex);
+}
+
+static nat
+count_chunks (bdescr *bd)
+{
+    nat n = 0;
+    W_ i;
+    while (bd != NULL) {
+        for (i = 0; bd != NULL && i < COMPACT_CHUNK_BLOCKS; i++) {
+            bd = bd->link;
+        }
+        n++;
+    }
+    return n;
+}
+
+static void
+add_chunks (bdescr *bd, rtsBool large)
+{
+    CompactChunk *c;
+    W_ i;
+    while (bd != NULL) {
+        c = &compact_chunks[n_compact_chunks++];
+        c->start = bd;
+        c->large = large;
+        for (i = 0; bd != NULL && i < COMPACT_CHUNK_BLOCKS; i++) {
+            bd = bd->link;
+        }
+        c->n_blocks = i;
+    }
+}
+
+static rtsBool
+compact_par_wanted (generation *gen)
+{
+    return n_compact_helpers > 0
+        && gen->old_blocks != NULL
+        && gen->n_old_blocks >= COMPACT_PAR_MIN_BLOCKS;
+}
+
+// Get ready for the helpers, which are woken up after this
+void
+startParCompact (nat n_helpers)
+{
+    n_compact_helpers = n_helpers;
+    if (n_helpers == 0) {
+        return;
+    }
+    initMutex(&compact_mutex);
+    initCondition(&compact_wakeup);
+    initCondition(&compact_done);
+    compact_pass = COMPACT_IDLE;
+}
+
+// Stop the helpers, if compact() didn't already
+static void
+endParCompact (void)
+{
+    if (n_compact_helpers > 0) {
+        compact_run_pass(COMPACT_EXIT);
+        n_compact_helpers = 0;
+        closeCondition(&compact_done);
+        closeCondition(&compact_wakeup);
+        closeMutex(&compact_mutex);
+    }
+}
+
+// Steps 2 and 3 of compact(), in parallel.
+static void
+compact_par (generation *gen)
+{
+    bdescr *bd, *next, *head, **tail;
+    nat g, n, i, max_chunks;
+    W_ blocks;
+
+    // Cut the compacted blocks into regions.
+    n_compact_regions = (gen->n_old_blocks + COMPACT_REGION_BLOCKS - 1)
+                            / COMPACT_REGION_BLOCKS;
+    compact_regions = stgMallocBytes(n_compact_regions * sizeof(CompactRegion),
+                                     "compact_par");
+    n = 0;
+    for (bd = gen->old_blocks; bd != NULL; bd = next) {
+        ASSERT(n < n_compact_regions);
+        compact_regions[n].start = bd;
+        for (i = 1; i < COMPACT_REGION_BLOCKS && bd->link != NULL; i++) {
+            bd = bd->link;
+        }
+        next = bd->link;
+        bd->link = NULL;
+        n++;
+    }
+    n_compact_regions = n;
+
+    // Collect the rest of the heap into chunks.
+    max_chunks = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        max_chunks += count_chunks(generations[g].blocks);
+        max_chunks += count_chunks(generations[g].scavenged_large_objects);
+        for (n = 0; n < n_capabilities; n++) {
+            max_chunks += count_chunks(gc_threads[n]->gens[g].todo_bd);
+            max_chunks += count_chunks(gc_threads[n]->gens[g].part_list);
+        }
+    }
+    compact_chunks = stgMallocBytes((max_chunks + 1) * sizeof(CompactChunk),
+                                    "compact_par");
+    n_compact_chunks = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        add_chunks(generations[g].blocks, rtsFalse);
+        add_chunks(generations[g].scavenged_large_objects, rtsTrue);
+        for (n = 0; n < n_capabilities; n++) {
+            add_chunks(gc_threads[n]->gens[g].todo_bd, rtsFalse);
+            add_chunks(gc_threads[n]->gens[g].part_list, rtsFalse);
+        }
+    }
+
+    debugTrace(DEBUG_gc, "compact_par: %d regions, %d chunks, %d helpers",
+               n_compact_regions, n_compact_chunks, n_compact_helpers);
+
+    compact_parallel = rtsTrue;
+    compact_run_pass(COMPACT_THREAD);
+    compact_parallel = rtsFalse;
+    compact_run_pass(COMPACT_FWD);
+    compact_run_pass(COMPACT_MOVE);
+    endParCompact();
+
+    // Join the regions back together, dropping the empty ones.
+    head = NULL;
+    tail = &head;
+    blocks = 0;
+    for (n = 0; n < n_compact_regions; n++) {
+        CompactRegion *r = &compact_regions[n];
+        if (r->used_blocks == 0 && (head != NULL || n + 1 < n_compact_regions)) {
+            freeChain(r->start);
+            continue;
+        }
+        r->free_bd->free = r->free;
+        if (r->free_bd->link != NULL) {
+            freeChain(r->free_bd->link);
+            r->free_bd->link = NULL;
+        }
+        *tail = r->start;
+        tail = &r->free_bd->link;
+        blocks += stg_max(r->used_blocks, 1);
+    }
+
+    debugTrace(DEBUG_gc,
+               "update_bkwd: %d (compact, old: %d blocks, now %d blocks)",
+               gen->no, gen->n_old_blocks, blocks);
+
+    gen->old_blocks = head;
+    gen->n_old_blocks = blocks;
+
+    stgFree(compact_chunks);
+    stgFree(compact_regions);
+}
+
+#endif /* THREADED_RTS */
+
 void
 compact(StgClosure *static_objects)
 {
@@ -997,17 +1407,25 @@ compact(StgClosure *static_objects)
     // the CAF list (used by GHCi)
     markCAFs((evac_fn)thread_root, NULL);
 
+#if defined(THREADED_RTS)
+    if (compact_par_wanted(oldest_gen)) {
+        compact_par(oldest_gen);
+        return;
+    }
+    endParCompact();
+#endif
+
     // 2. update forward ptrs
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         gen = &generations[g];
         debugTrace(DEBUG_gc, "update_fwd:  %d", g);
 
-        update_fwd(gen->blocks);
+        update_fwd(gen->blocks, ALL_BLOCKS);
         for (n = 0; n < n_capabilities; n++) {
-            update_fwd(gc_threads[n]->gens[g].todo_bd);
-            update_fwd(gc_threads[n]->gens[g].part_list);
+            update_fwd(gc_threads[n]->gens[g].todo_bd, ALL_BLOCKS);
+            update_fwd(gc_threads[n]->gens[g].part_list, ALL_BLOCKS);
         }
-        update_fwd_large(gen->scavenged_large_objects);
+        update_fwd_large(gen->scavenged_large_objects, ALL_BLOCKS);
         if (g == RtsFlags.GcFlags.generations-1 && gen->old_blocks != NULL) {
             debugTrace(DEBUG_gc, "update_fwd:  %d (compact)", g);
             update_fwd_compact(gen->old_blocks);
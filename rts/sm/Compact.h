@@ -46,8 +46,56 @@ is_marked(StgPtr p, bdescr *bd)
     return (*bitmap_word & bit_mask);
 }
 
+// The number of the lowest set bit in w, which must not be 0
+INLINE_HEADER nat
+lowest_set_bit (StgWord w)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll((unsigned long long)w);
+#else
+    nat n = 0;
+    while ((w & 1) == 0) {
+        w >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// The first marked word of bd at or after p, or bd->free if there is
+// none.  This looks at the bitmap a word at a time, so that it skips
+// BITS_IN(W_) dead words in one step.
+INLINE_HEADER StgPtr
+find_marked (StgPtr p, bdescr *bd)
+{
+    W_ offset = p - bd->start;
+    W_ end = bd->free - bd->start;
+    W_ i;
+    StgWord m;
+
+    if (offset >= end) {
+        return bd->free;
+    }
+    i = offset / BITS_IN(W_);
+    m = bd->u.bitmap[i] & ((StgWord)-1 << (offset & (BITS_IN(W_) - 1)));
+    while (m == 0) {
+        i++;
+        if (i * BITS_IN(W_) >= end) {
+            return bd->free;
+        }
+        m = bd->u.bitmap[i];
+    }
+    offset = i * BITS_IN(W_) + lowest_set_bit(m);
+    return offset < end ? bd->start + offset : bd->free;
+}
+
 void compact (StgClosure *static_objects);
 
+#if defined(THREADED_RTS)
+void startParCompact (nat n_helpers);
+void compactHelper   (void);
+#endif
+
 #include "EndPrivate.h"
 
 #endif /* SM_COMPACT_H */
@@ -0,0 +1,167 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Giving free memory back to the OS in the background
+ * (+RTS --decommit-age)
+ *
+ * Without --decommit-age, the GC unmaps free mblocks at the end of each
+ * major GC if there are more than it expects to need (see
+ * returnMemoryToOS()), so a program whose heap goes up and down pays for
+ * an munmap() and then for faulting the memory back in every time.
+ * With it, nothing is unmapped: decommitFreeMBlocks() (BlockAlloc.c)
+ * gives back the memory of the free mgroups that have stayed free for
+ * the given age, and this file decides when to call it.
+ *
+ * Each call gives back at most --decommit-rate bytes per second since
+ * the previous one, so that a big drop in the heap is returned
+ * gradually and a burst that comes back soon finds most of its memory
+ * still there.
+ *
+ * In the threaded RTS a background thread does this DECOMMIT_TICKS times
+ * per age (but at least once a second).  The non-threaded RTS has no
+ * such thread, so the GC calls decommitStep() after each GC instead.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Decommit.h"
+#include "BlockAlloc.h"
+#include "Storage.h"
+#include "GetTime.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+
+#if defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+#include <unistd.h>
+#endif
+
+#define DECOMMIT_TICKS 4
+
+static Time last_step;
+
+static void
+decommitStep_ (void)
+{
+    Time now, elapsed;
+    W_ max, n;
+
+    now = getProcessElapsedTime();
+    elapsed = stg_min(now - last_step, SecondsToTime(1));
+    last_step = now;
+
+    max = (W_)((double)RtsFlags.GcFlags.decommitRate
+               * TimeToUS(elapsed) / 1000000 / MBLOCK_SIZE);
+    if (max == 0) max = 1;
+
+    ACQUIRE_SM_LOCK;
+    n = decommitFreeMBlocks(RtsFlags.GcFlags.decommitAge, max);
+    RELEASE_SM_LOCK;
+
+    if (n > 0) {
+        debugTrace(DEBUG_gc, "decommitted %" FMT_Word " megablock(s)", n);
+    }
+}
+
+#if defined(THREADED_RTS)
+
+static Mutex     decommit_mutex;
+static Condition decommit_wakeup;
+static Condition decommit_done;
+static rtsBool   decommit_running = rtsFalse;
+static rtsBool   decommit_stop = rtsFalse;
+#if !defined(mingw32_HOST_OS)
+static pid_t     decommit_pid;
+#endif
+
+static void OSThreadProcAttr
+decommitThread (void *arg STG_UNUSED)
+{
+    Time interval;
+
+    interval = stg_min(RtsFlags.GcFlags.decommitAge / DECOMMIT_TICKS,
+                       SecondsToTime(1));
+
+    ACQUIRE_LOCK(&decommit_mutex);
+    while (!decommit_stop) {
+        timedWaitCondition(&decommit_wakeup, &decommit_mutex, interval);
+        if (decommit_stop) break;
+        RELEASE_LOCK(&decommit_mutex);
+        decommitStep_();
+        ACQUIRE_LOCK(&decommit_mutex);
+    }
+    decommit_running = rtsFalse;
+    broadcastCondition(&decommit_done);
+    RELEASE_LOCK(&decommit_mutex);
+}
+
+void
+startDecommitter (void)
+{
+    OSThreadId tid;
+
+    if (RtsFlags.GcFlags.decommitAge == 0) return;
+
+    last_step = getProcessElapsedTime();
+
+    initMutex(&decommit_mutex);
+    initCondition(&decommit_wakeup);
+    initCondition(&decommit_done);
+    decommit_stop = rtsFalse;
+    decommit_running = rtsTrue;
+#if !defined(mingw32_HOST_OS)
+    decommit_pid = getpid();
+#endif
+
+    if (createOSThread(&tid, "ghc_decommit", decommitThread, NULL) != 0) {
+        sysErrorBelch("startDecommitter: failed to create thread");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+
+void
+stopDecommitter (void)
+{
+    if (RtsFlags.GcFlags.decommitAge == 0) return;
+#if !defined(mingw32_HOST_OS)
+    // The thread doesn't survive forkProcess()
+    if (getpid() != decommit_pid) return;
+#endif
+
+    ACQUIRE_LOCK(&decommit_mutex);
+    decommit_stop = rtsTrue;
+    signalCondition(&decommit_wakeup);
+    while (decommit_running) {
+        waitCondition(&decommit_done, &decommit_mutex);
+    }
+    RELEASE_LOCK(&decommit_mutex);
+
+    closeCondition(&decommit_done);
+    closeCondition(&decommit_wakeup);
+    closeMutex(&decommit_mutex);
+}
+
+#else /* !THREADED_RTS */
+
+void
+startDecommitter (void)
+{
+    last_step = getProcessElapsedTime();
+}
+
+void
+stopDecommitter (void)
+{
+}
+
+void
+decommitStep (void)
+{
+    if (RtsFlags.GcFlags.decommitAge != 0) {
+        decommitStep_();
+    }
+}
+
+#endif /* THREADED_RTS */
@@ -0,0 +1,24 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Giving free memory back to the OS in the background
+ * (+RTS --decommit-age)
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_DECOMMIT_H
+#define SM_DECOMMIT_H
+
+#include "BeginPrivate.h"
+
+void startDecommitter (void);
+void stopDecommitter  (void);
+
+#if !defined(THREADED_RTS)
+void decommitStep (void);
+#endif
+
+#include "EndPrivate.h"
+
+#endif /* SM_DECOMMIT_H */
@@ -21,6 +21,7 @@
 #include "GCTDecl.h"
 #include "GCUtils.h"
 #include "Compact.h"
+#include "CNF.h"
 #include "MarkStack.h"
 #include "Prelude.h"
 #include "Trace.h"
@@ -104,9 +105,10 @@ copy_tag(StgClosure **p, const StgInfoTable *info,
         to[i] = from[i];
     }
 
-//  if (to+size+2 < bd->start + BLOCK_SIZE_W) {
-//      __builtin_prefetch(to + size + 2, 1);
-//  }
+#if defined(GC_PREFETCH)
+    // the next object copied into this generation (probably) goes here
+    prefetch_to_space(to + size + 2);
+#endif
 
 #if defined(PARALLEL_GC)
     {
@@ -165,9 +167,10 @@ copy_tag_nolock(StgClosure **p, const StgInfoTable *info,
     *p = TAG_CLOSURE(tag,(StgClosure*)to);
     src->header.info = (const StgInfoTable *)MK_FORWARDING_PTR(to);
 
-//  if (to+size+2 < bd->start + BLOCK_SIZE_W) {
-//      __builtin_prefetch(to + size + 2, 1);
-//  }
+#if defined(GC_PREFETCH)
+    // the next object copied into this generation (probably) goes here
+    prefetch_to_space(to + size + 2);
+#endif
 
 #ifdef PROFILING
     // We store the size of the just evacuated object in the LDV word so that
@@ -243,9 +246,14 @@ copy(StgClosure **p, const StgInfoTable *info,
 /* -----------------------------------------------------------------------------
    Evacuate a large object
 
-   This just consists of removing the object from the (doubly-linked)
-   gen->large_objects list, and linking it on to the (singly-linked)
-   gen->new_large_objects list, from where it will be scavenged later.
+   This just consists of claiming the object, by setting BF_EVACUATED
+   in its block descriptor, and linking it on to this GC thread's
+   ws->todo_large_objects list, from where it will be scavenged later.
+   The object stays on gen->large_objects, which nobody changes during
+   GC, so the GC threads don't need to take gen->sync: the lists of
+   the GC threads are linked through bd->u.back, and
+   collect_large_objects() (in GC.c) sorts the live objects from the
+   dead ones at the end.
 
    Convention: bd->flags has BF_EVACUATED set for a large object
    that has been evacuated, or unset otherwise.
@@ -255,37 +263,34 @@ STATIC_INLINE void
 evacuate_large(StgPtr p)
 {
   bdescr *bd;
-  generation *gen, *new_gen;
-  nat gen_no, new_gen_no;
+  generation *new_gen;
+  nat new_gen_no;
   gen_workspace *ws;
 
   bd = Bdescr(p);
-  gen = bd->gen;
-  gen_no = bd->gen_no;
-  ACQUIRE_SPIN_LOCK(&gen->sync);
 
-  // already evacuated?
+  // already evacuated?  The claim has to be atomic, because other GC
+  // threads may be evacuating the same object.
+#if defined(PARALLEL_GC)
+  if (__sync_fetch_and_or(&bd->flags, BF_EVACUATED) & BF_EVACUATED) {
+#else
   if (bd->flags & BF_EVACUATED) {
+#endif
     /* Don't forget to set the gct->failed_to_evac flag if we didn't get
-     * the desired destination (see comments in evacuate()).
+     * the desired destination (see comments in evacuate()).  The
+     * thread that claimed the object may not have set bd->gen_no yet,
+     * but then we see the old generation, and just keep the pointer
+     * on the mutable list for one more GC.
      */
-    if (gen_no < gct->evac_gen_no) {
+    if (bd->gen_no < gct->evac_gen_no) {
         gct->failed_to_evac = rtsTrue;
         TICK_GC_FAILED_PROMOTION();
     }
-    RELEASE_SPIN_LOCK(&gen->sync);
     return;
   }
-
-  // remove from large_object list
-  if (bd->u.back) {
-    bd->u.back->link = bd->link;
-  } else { // first object in the list
-    gen->large_objects = bd->link;
-  }
-  if (bd->link) {
-    bd->link->u.back = bd->u.back;
-  }
+#if !defined(PARALLEL_GC)
+  bd->flags |= BF_EVACUATED;
+#endif
 
   /* link it on to the evacuated large object list of the destination gen
    */
@@ -302,27 +307,150 @@ evacuate_large(StgPtr p)
   ws = &gct->gens[new_gen_no];
   new_gen = &generations[new_gen_no];
 
-  bd->flags |= BF_EVACUATED;
   initBdescr(bd, new_gen, new_gen->to);
 
   // If this is a block of pinned objects, we don't have to scan
   // these objects, because they aren't allowed to contain any
   // pointers.  For these blocks, we skip the scavenge stage and put
-  // them straight on the scavenged_large_objects list.
+  // them straight on the scavenged large objects list.
   if (bd->flags & BF_PINNED) {
       ASSERT(get_itbl((StgClosure *)p)->type == ARR_WORDS);
-      if (new_gen != gen) { ACQUIRE_SPIN_LOCK(&new_gen->sync); }
-      dbl_link_onto(bd, &new_gen->scavenged_large_objects);
-      new_gen->n_scavenged_large_blocks += bd->blocks;
-      if (new_gen != gen) { RELEASE_SPIN_LOCK(&new_gen->sync); }
+      bd->u.back = ws->scavd_large_objects;
+      ws->scavd_large_objects = bd;
+      ws->n_scavd_large_blocks += bd->blocks;
+      gct->pinned_evacd += bd->free - bd->start;
   } else {
-      bd->link = ws->todo_large_objects;
+      bd->u.back = ws->todo_large_objects;
       ws->todo_large_objects = bd;
   }
+}
+
+/* -----------------------------------------------------------------------------
+   Mark an object in a block of small pinned objects
+
+   Sets the object's bit in the block's bitmap and, the first time,
+   adds its size to the live words of the block (see allocatePinned()).
+   This is only for the stats: the block is evacuated as a whole by
+   evacuate_large().
+   -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+mark_pinned(StgClosure *q, bdescr *bd)
+{
+  W_ off = (P_)q - bd->start;
+  StgPtr w = bd->start + off / BITS_IN(W_);
+  W_ bit = (W_)1 << (off & (BITS_IN(W_) - 1));
+  W_ size;
+
+  ASSERT(get_itbl(q)->type == ARR_WORDS);
+  size = arr_words_sizeW((StgArrWords *)q);
+
+#if defined(PARALLEL_GC)
+  {
+      W_ old;
+      do {
+          old = *w;
+          if (old & bit) return;
+      } while (cas((StgVolatilePtr)w, old, old | bit) != old);
+      atomic_inc((StgVolatilePtr)&PINNED_LIVE_WORDS(bd), size);
+  }
+#else
+  if (*w & bit) return;
+  *w |= bit;
+  PINNED_LIVE_WORDS(bd) += size;
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+   Evacuate a compact region
+
+   A pointer into a compact region keeps the whole region alive, so we
+   move the region (i.e. its first block) from gen->compact_objects to
+   live_compact_objects of the destination generation.  There is
+   nothing to scavenge: see Note [Compact regions] in CNF.c.
+
+   Convention: as for large objects, the first block of a region has
+   BF_EVACUATED set once the region has been evacuated.
+   -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+evacuate_compact(StgPtr p)
+{
+  StgCompactNFData *str;
+  bdescr *bd;
+  generation *gen, *new_gen;
+  nat gen_no, new_gen_no;
+
+  str = objectGetCompact((StgClosure *)p);
+  bd = Bdescr((StgPtr)str);
+  gen = bd->gen;
+  gen_no = bd->gen_no;
+  ACQUIRE_SPIN_LOCK(&gen->sync);
+
+  // already evacuated?
+  if (bd->flags & BF_EVACUATED) {
+    if (gen_no < gct->evac_gen_no) {
+        gct->failed_to_evac = rtsTrue;
+        TICK_GC_FAILED_PROMOTION();
+    }
+    RELEASE_SPIN_LOCK(&gen->sync);
+    return;
+  }
+
+  dbl_link_remove(bd, &gen->compact_objects);
+
+  new_gen_no = bd->dest_no;
+
+  if (new_gen_no < gct->evac_gen_no) {
+      if (gct->eager_promotion) {
+          new_gen_no = gct->evac_gen_no;
+      } else {
+          gct->failed_to_evac = rtsTrue;
+      }
+  }
+
+  new_gen = &generations[new_gen_no];
+
+  bd->flags |= BF_EVACUATED;
+  initBdescr(bd, new_gen, new_gen->to);
+
+  if (new_gen != gen) { ACQUIRE_SPIN_LOCK(&new_gen->sync); }
+  dbl_link_onto(bd, &new_gen->live_compact_objects);
+  new_gen->n_live_compact_blocks += str->totalW / BLOCK_SIZE_W;
+  if (new_gen != gen) { RELEASE_SPIN_LOCK(&new_gen->sync); }
 
   RELEASE_SPIN_LOCK(&gen->sync);
 }
 
+/* -----------------------------------------------------------------------------
+   Evacuate a static object
+
+   Puts the object on gct->static_objects, for scavenge_static(), unless
+   this GC has reached it already or it is to be ignored.  See Note
+   [STATIC_LINK fields] in Storage.h.
+   -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+evacuate_static_object (StgClosure **link_field, StgClosure *q)
+{
+    StgWord link = (StgWord)*link_field;
+
+    if (((link & STATIC_BITS) | prev_static_flag) != 3) {
+        StgWord new_list_head = (StgWord)q | static_flag;
+#ifndef THREADED_RTS
+        *link_field = gct->static_objects;
+        gct->static_objects = (StgClosure *)new_list_head;
+#else
+        StgWord prev;
+        prev = cas((StgVolatilePtr)link_field, link,
+                   (StgWord)gct->static_objects);
+        if (prev == link) {
+            gct->static_objects = (StgClosure *)new_list_head;
+        }
+#endif
+    }
+}
+
 /* ----------------------------------------------------------------------------
    Evacuate
 
@@ -363,8 +491,38 @@ evacuate_large(StgPtr p)
    it doesn't help.  One reason is that the (StgClosure **) pointer
    gets spilled to the stack inside evacuate(), resulting in far more
    extra reads/writes than we save.
+
+   Most of the objects in a typical heap are small constructors, thunks
+   and functions of the fixed layouts (CONSTR_2_0, THUNK_1_0, ...),
+   whose size depends only on the closure type.  Rather than go
+   through the indirect jump of the switch, which mispredicts whenever
+   the types of consecutive objects differ, evacuate() looks the type
+   up in evac_fixed_sizeW[] first, so those objects all take the same
+   well-predicted branch to a copy of a known size.  CONSTR_0_1 isn't
+   in the table, since it may be a Char or an Int that we share.
    ------------------------------------------------------------------------- */
 
+// an object that must be copied with copy() rather than
+// copy_tag_nolock(), because it may be updated (see copy_tag())
+#define EVAC_LOCK 0x80
+
+static const StgWord8 evac_fixed_sizeW[N_CLOSURE_TYPES] = {
+    [CONSTR_1_0] = sizeofW(StgHeader) + 1,
+    [CONSTR_2_0] = sizeofW(StgHeader) + 2,
+    [CONSTR_1_1] = sizeofW(StgHeader) + 2,
+    [CONSTR_0_2] = sizeofW(StgHeader) + 2,
+    [FUN_1_0]    = sizeofW(StgHeader) + 1,
+    [FUN_0_1]    = sizeofW(StgHeader) + 1,
+    [FUN_2_0]    = sizeofW(StgHeader) + 2,
+    [FUN_1_1]    = sizeofW(StgHeader) + 2,
+    [FUN_0_2]    = sizeofW(StgHeader) + 2,
+    [THUNK_1_0]  = (sizeofW(StgThunk) + 1) | EVAC_LOCK,
+    [THUNK_0_1]  = (sizeofW(StgThunk) + 1) | EVAC_LOCK,
+    [THUNK_2_0]  = (sizeofW(StgThunk) + 2) | EVAC_LOCK,
+    [THUNK_1_1]  = (sizeofW(StgThunk) + 2) | EVAC_LOCK,
+    [THUNK_0_2]  = (sizeofW(StgThunk) + 2) | EVAC_LOCK,
+};
+
 REGPARM1 GNUC_ATTR_HOT void
 evacuate(StgClosure **p)
 {
@@ -373,6 +531,7 @@ evacuate(StgClosure **p)
   StgClosure *q;
   const StgInfoTable *info;
   StgWord tag;
+  nat size;
 
   q = *p;
 
@@ -392,38 +551,13 @@ loop:
 
       case THUNK_STATIC:
           if (info->srt_bitmap != 0) {
-              if (*THUNK_STATIC_LINK((StgClosure *)q) == NULL) {
-#ifndef THREADED_RTS
-                  *THUNK_STATIC_LINK((StgClosure *)q) = gct->static_objects;
-                  gct->static_objects = (StgClosure *)q;
-#else
-                  StgPtr link;
-                  link = (StgPtr)cas((StgPtr)THUNK_STATIC_LINK((StgClosure *)q),
-                                     (StgWord)NULL,
-                                     (StgWord)gct->static_objects);
-                  if (link == NULL) {
-                      gct->static_objects = (StgClosure *)q;
-                  }
-#endif
-              }
+              evacuate_static_object(THUNK_STATIC_LINK((StgClosure *)q), q);
           }
           return;
 
       case FUN_STATIC:
-          if (info->srt_bitmap != 0 &&
-              *FUN_STATIC_LINK((StgClosure *)q) == NULL) {
-#ifndef THREADED_RTS
-              *FUN_STATIC_LINK((StgClosure *)q) = gct->static_objects;
-              gct->static_objects = (StgClosure *)q;
-#else
-              StgPtr link;
-              link = (StgPtr)cas((StgPtr)FUN_STATIC_LINK((StgClosure *)q),
-                                 (StgWord)NULL,
-                                 (StgWord)gct->static_objects);
-              if (link == NULL) {
-                  gct->static_objects = (StgClosure *)q;
-              }
-#endif
+          if (info->srt_bitmap != 0) {
+              evacuate_static_object(FUN_STATIC_LINK((StgClosure *)q), q);
           }
           return;
 
@@ -432,37 +566,11 @@ loop:
            * on the CAF list, so don't do anything with it here (we'll
            * scavenge it later).
            */
-          if (*IND_STATIC_LINK((StgClosure *)q) == NULL) {
-#ifndef THREADED_RTS
-                  *IND_STATIC_LINK((StgClosure *)q) = gct->static_objects;
-                  gct->static_objects = (StgClosure *)q;
-#else
-                  StgPtr link;
-                  link = (StgPtr)cas((StgPtr)IND_STATIC_LINK((StgClosure *)q),
-                                     (StgWord)NULL,
-                                     (StgWord)gct->static_objects);
-                  if (link == NULL) {
-                      gct->static_objects = (StgClosure *)q;
-                  }
-#endif
-          }
+          evacuate_static_object(IND_STATIC_LINK((StgClosure *)q), q);
           return;
 
       case CONSTR_STATIC:
-          if (*STATIC_LINK(info,(StgClosure *)q) == NULL) {
-#ifndef THREADED_RTS
-              *STATIC_LINK(info,(StgClosure *)q) = gct->static_objects;
-              gct->static_objects = (StgClosure *)q;
-#else
-              StgPtr link;
-              link = (StgPtr)cas((StgPtr)STATIC_LINK(info,(StgClosure *)q),
-                                 (StgWord)NULL,
-                                 (StgWord)gct->static_objects);
-              if (link == NULL) {
-                  gct->static_objects = (StgClosure *)q;
-              }
-#endif
-          }
+          evacuate_static_object(STATIC_LINK(info,(StgClosure *)q), q);
           /* I am assuming that static_objects pointers are not
            * written to other objects, and thus, no need to retag. */
           return;
@@ -480,7 +588,21 @@ loop:
 
   bd = Bdescr((P_)q);
 
-  if ((bd->flags & (BF_LARGE | BF_MARKED | BF_EVACUATED)) != 0) {
+  if ((bd->flags & (BF_LARGE | BF_MARKED | BF_EVACUATED | BF_COMPACT)) != 0) {
+
+      // a pointer into a compact region keeps the whole region alive
+      if (bd->flags & BF_COMPACT) {
+          evacuate_compact((P_)q);
+          return;
+      }
+
+      // record which objects in a block of small pinned objects are
+      // alive, before looking at BF_EVACUATED: the block is only
+      // evacuated once, for the first object we find in it.
+      if ((bd->flags & (BF_PINNED_SMALL | BF_FROZEN)) == BF_PINNED_SMALL
+          && bd->gen_no <= N) {
+          mark_pinned(q, bd);
+      }
 
       // pointer into to-space: just return it.  It might be a pointer
       // into a generation that we aren't collecting (> N), or it
@@ -548,6 +670,16 @@ loop:
       return;
   }
 
+  size = evac_fixed_sizeW[INFO_PTR_TO_STRUCT(info)->type];
+  if (size != 0) {
+      if (size & EVAC_LOCK) {
+          copy(p,info,q,size & ~EVAC_LOCK,gen_no);
+      } else {
+          copy_tag_nolock(p,info,q,size,gen_no,tag);
+      }
+      return;
+  }
+
   switch (INFO_PTR_TO_STRUCT(info)->type) {
 
   case WHITEHOLE:
@@ -585,37 +717,7 @@ loop:
       return;
   }
 
-  case FUN_0_1:
-  case FUN_1_0:
-  case CONSTR_1_0:
-      copy_tag_nolock(p,info,q,sizeofW(StgHeader)+1,gen_no,tag);
-      return;
-
-  case THUNK_1_0:
-  case THUNK_0_1:
-      copy(p,info,q,sizeofW(StgThunk)+1,gen_no);
-      return;
-
-  case THUNK_1_1:
-  case THUNK_2_0:
-  case THUNK_0_2:
-#ifdef NO_PROMOTE_THUNKS
-#error bitrotted
-#endif
-    copy(p,info,q,sizeofW(StgThunk)+2,gen_no);
-    return;
-
-  case FUN_1_1:
-  case FUN_2_0:
-  case FUN_0_2:
-  case CONSTR_1_1:
-  case CONSTR_2_0:
-      copy_tag_nolock(p,info,q,sizeofW(StgHeader)+2,gen_no,tag);
-      return;
-
-  case CONSTR_0_2:
-      copy_tag_nolock(p,info,q,sizeofW(StgHeader)+2,gen_no,tag);
-      return;
+  // the other fixed layouts are in evac_fixed_sizeW[]
 
   case THUNK:
       copy(p,info,q,thunk_sizeW_fromITBL(INFO_PTR_TO_STRUCT(info)),gen_no);
@@ -0,0 +1,264 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Freezing the heap for sharing with forked processes
+ *
+ * A server that builds a big heap and then forks worker processes
+ * would like the workers to share that heap with it, copy-on-write,
+ * for as long as they run.  But the first major GC in a worker copies
+ * (or marks) every live object, and that writes to every page of the
+ * heap, so each worker soon has a private copy of all of it.
+ *
+ * freezeHeap() does a major GC and then takes everything that is left
+ * in the heap out of the generations: the blocks go on frozen_blocks
+ * and frozen_large_objects, with BF_FROZEN and BF_EVACUATED set.  To
+ * the GC, a frozen object looks like one in a generation older than
+ * the one it is collecting: evacuate() stops at BF_EVACUATED, so it is
+ * never copied or marked, and its blocks are never swept or freed.
+ * The frozen heap is never collected, so anything in it that dies is
+ * never reclaimed; it is meant for data that the program keeps.  It
+ * is usually called just before the first forkProcess, and the parent
+ * and the children all keep the heap frozen.
+ *
+ * The frozen blocks get the oldest generation's number, so that the
+ * write barrier records a frozen object on the mutable list of the
+ * oldest generation when the mutator writes to it (by updating a
+ * frozen thunk, for example).  Such an object may then point to
+ * objects anywhere in the heap, and since nothing traces the frozen
+ * heap, it must stay on the mutable list for good, even through major
+ * GCs:
+ *
+ *   - prepare_collected_gen() keeps the mutable lists of the oldest
+ *     generation when there is a frozen heap, and
+ *     scavenge_capability_mut_lists() scavenges the frozen entries on
+ *     them in a major GC too, dropping the others.
+ *
+ *   - scavenge_mutable_list() keeps a frozen object dirty, so that it
+ *     stays on the list and the mutator doesn't record it again.
+ *
+ * The only writes to the frozen heap are then the mutator's own and
+ * the GC's updates of the objects that the mutator has written to,
+ * and of the links of the frozen threads and weak pointers.
+ *
+ * The frozen objects may refer to static objects, which the GC only
+ * finds by tracing from the heap.  freezeLiveHeap() keeps the static
+ * objects that were live when it froze the heap, and
+ * markFrozenStatics() makes them roots.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "GC.h"
+#include "Freeze.h"
+#include "GCThread.h"
+#include "GCTDecl.h"
+#include "GCUtils.h"
+#include "Capability.h"
+#include "RtsUtils.h"
+#include "Trace.h"
+
+bdescr *frozen_blocks = NULL;
+bdescr *frozen_large_objects = NULL;
+W_      n_frozen_blocks = 0;
+
+volatile rtsBool freeze_requested = rtsFalse;
+
+static StgClosure **frozen_statics = NULL;
+static W_           n_frozen_statics = 0;
+
+void
+freezeHeap (void)
+{
+    if (RtsFlags.GcFlags.generations == 1) {
+        // without an old generation there is no write barrier, so we
+        // couldn't find the pointers out of the frozen heap
+        errorBelch("freezeHeap: the heap can't be frozen with -G1");
+        return;
+    }
+    freeze_requested = rtsTrue;
+    performMajorGC();
+}
+
+static void
+freeze_block (bdescr *bd)
+{
+    bd->flags |= BF_EVACUATED | BF_FROZEN;
+    bd->gen = oldest_gen;
+    bd->gen_no = oldest_gen->no;
+    bd->dest_no = oldest_gen->no;
+    n_frozen_blocks += bd->blocks;
+}
+
+static void
+freeze_chain (bdescr *bd)
+{
+    bdescr *next;
+
+    for (; bd != NULL; bd = next) {
+        next = bd->link;
+        freeze_block(bd);
+        bd->link = frozen_blocks;
+        frozen_blocks = bd;
+    }
+}
+
+static void
+freeze_statics (StgClosure *first_static)
+{
+    StgClosure *p;
+
+    for (p = first_static; p != END_OF_STATIC_OBJECT_LIST;
+         p = *STATIC_LINK(get_itbl(p), p)) {
+        p = UNTAG_STATIC_LIST_PTR(p);
+        frozen_statics[n_frozen_statics++] = p;
+    }
+}
+
+static W_
+count_statics (StgClosure *first_static)
+{
+    StgClosure *p;
+    W_ n = 0;
+
+    for (p = first_static; p != END_OF_STATIC_OBJECT_LIST;
+         p = *STATIC_LINK(get_itbl(p), p)) {
+        p = UNTAG_STATIC_LIST_PTR(p);
+        n++;
+    }
+    return n;
+}
+
+void
+freezeLiveHeap (void)
+{
+    nat g, i;
+    W_ n;
+    generation *gen;
+    gen_workspace *ws;
+    bdescr *bd, *next;
+    StgTSO *t;
+    StgWeak *w;
+
+    ASSERT(major_gc);
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        gen = &generations[g];
+
+        freeze_chain(gen->blocks);
+        gen->blocks = NULL;
+        gen->n_blocks = 0;
+        gen->n_words = 0;
+        gen->live_estimate = 0;
+
+        // the GC threads keep their partly full blocks for next time
+        for (i = 0; i < n_capabilities; i++) {
+            ws = &gc_threads[i]->gens[g];
+
+            freeze_chain(ws->part_list);
+            ws->part_list = NULL;
+            ws->n_part_blocks = 0;
+
+            ASSERT(ws->scavd_list == NULL);
+
+            if (ws->todo_free != ws->todo_bd->start) {
+                bd = ws->todo_bd;
+                bd->free = ws->todo_free;
+                bd->link = NULL;
+                freeze_chain(bd);
+                alloc_todo_block(ws, 0);
+            }
+        }
+
+        for (bd = gen->large_objects; bd != NULL; bd = next) {
+            next = bd->link;
+            freeze_block(bd);
+            bd->link = frozen_large_objects;
+            frozen_large_objects = bd;
+        }
+        gen->large_objects = NULL;
+        gen->n_large_blocks = 0;
+        gen->n_large_words = 0;
+        gen->n_pinned_blocks = 0;
+        gen->n_pinned_live_words = 0;
+
+        if (gen == oldest_gen) continue;
+
+        // Everything frozen is in the oldest generation now, so its
+        // threads, weak pointers and mutable list entries go there too.
+        if (gen->threads != END_TSO_QUEUE) {
+            for (t = gen->threads; t->global_link != END_TSO_QUEUE;
+                 t = t->global_link) {
+            }
+            t->global_link = oldest_gen->threads;
+            oldest_gen->threads = gen->threads;
+            gen->threads = END_TSO_QUEUE;
+        }
+
+        if (gen->weak_ptr_list != NULL) {
+            for (w = gen->weak_ptr_list; w->link != NULL; w = w->link) {
+            }
+            w->link = oldest_gen->weak_ptr_list;
+            oldest_gen->weak_ptr_list = gen->weak_ptr_list;
+            gen->weak_ptr_list = NULL;
+        }
+
+        if (g != 0) {
+            for (i = 0; i < n_capabilities; i++) {
+                bd = capabilities[i]->mut_lists[g];
+                while (bd->link != NULL) bd = bd->link;
+                bd->link = capabilities[i]->mut_lists[oldest_gen->no];
+                capabilities[i]->mut_lists[oldest_gen->no] =
+                    capabilities[i]->mut_lists[g];
+                capabilities[i]->mut_lists[g] =
+                    allocBlockOnNode(capNoToNumaNode(i));
+            }
+        }
+    }
+
+    // The static objects traced by this GC include all those that the
+    // frozen heap refers to, and those frozen before, which were roots.
+    n = 0;
+    if (n_gc_threads == 1) {
+        n = count_statics(gct->scavenged_static_objects);
+    } else {
+        for (i = 0; i < n_gc_threads; i++) {
+            if (!gc_threads[i]->idle) {
+                n += count_statics(gc_threads[i]->scavenged_static_objects);
+            }
+        }
+    }
+
+    if (frozen_statics != NULL) stgFree(frozen_statics);
+    frozen_statics = stgMallocBytes(stg_max(n, 1) * sizeof(StgClosure *),
+                                    "freezeLiveHeap");
+    n_frozen_statics = 0;
+    if (n_gc_threads == 1) {
+        freeze_statics(gct->scavenged_static_objects);
+    } else {
+        for (i = 0; i < n_gc_threads; i++) {
+            if (!gc_threads[i]->idle) {
+                freeze_statics(gc_threads[i]->scavenged_static_objects);
+            }
+        }
+    }
+    ASSERT(n_frozen_statics == n);
+
+    debugTrace(DEBUG_gc, "froze %" FMT_Word " blocks, %" FMT_Word
+               " static objects", n_frozen_blocks, n_frozen_statics);
+
+    freeze_requested = rtsFalse;
+}
+
+void
+markFrozenStatics (evac_fn evac, void *user)
+{
+    W_ i;
+
+    for (i = 0; i < n_frozen_statics; i++) {
+        evac(user, &frozen_statics[i]);
+    }
+}
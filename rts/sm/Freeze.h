@@ -0,0 +1,40 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Freezing the heap for sharing with forked processes: see Freeze.c
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_FREEZE_H
+#define SM_FREEZE_H
+
+#include "BeginPrivate.h"
+
+// The frozen heap.  Its blocks have BF_FROZEN and BF_EVACUATED set, and
+// belong to the oldest generation, but are on none of its lists.
+extern bdescr *frozen_blocks;
+extern bdescr *frozen_large_objects;
+extern W_      n_frozen_blocks;   // in both lists
+
+// Set by freezeHeap(); the next major GC freezes the heap it leaves
+extern volatile rtsBool freeze_requested;
+
+// Called by a major GC once all the live data is in the generations'
+// block lists, before the static objects are unlinked
+void freezeLiveHeap (void);
+
+// The static objects that were live when the heap was frozen: the
+// frozen objects may refer to them, so they are roots from then on
+void markFrozenStatics (evac_fn evac, void *user);
+
+INLINE_HEADER rtsBool
+isFrozen (StgPtr p)
+{
+    return n_frozen_blocks != 0 && HEAP_ALLOCED_GC(p) &&
+           (Bdescr(p)->flags & BF_FROZEN) != 0;
+}
+
+#include "EndPrivate.h"
+
+#endif /* SM_FREEZE_H */
@@ -27,6 +27,7 @@
 #include "MarkWeak.h"
 #include "Sparks.h"
 #include "Sweep.h"
+#include "CNF.h"
 
 #include "Storage.h"
 #include "RtsUtils.h"
@@ -36,7 +37,12 @@
 #include "Schedule.h"
 #include "Sanity.h"
 #include "BlockAlloc.h"
+#include "Decommit.h"
+#include "Freeze.h"
+#include "HeapImage.h"
+#include "Accounting.h"
 #include "ProfHeap.h"
+#include "HeapSnapshot.h"
 #include "Weak.h"
 #include "Prelude.h"
 #include "RtsSignals.h"
@@ -47,7 +53,10 @@
 #include "RaiseAsync.h"
 #include "Papi.h"
 #include "Stable.h"
+#include "Threads.h"
 #include "CheckUnload.h"
+#include "GetTime.h"
+#include "OSMem.h"
 
 #include <string.h> // for memset()
 #include <unistd.h>
@@ -99,10 +108,52 @@
 nat N;
 rtsBool major_gc;
 
+/* The tags of the static links of the static objects reached by the
+ * last major GC and by the one before it (see Note [STATIC_LINK fields]
+ * in Storage.h).
+ */
+nat static_flag = STATIC_FLAG_B;
+nat prev_static_flag = STATIC_FLAG_A;
+
 /* Data used for allocation area sizing.
  */
 static W_ g0_pcnt_kept = 30; // percentage of g0 live at last minor GC
 
+/* Note [Aging]
+   ~~~~~~~~~~~~
+   An object that survives its first GC is copied from the nursery into
+   the blocks of generation 0, and if it survives the next one it is
+   promoted to generation 1: the tenure age is 2.  With +RTS
+   --tenure-age=<n>, n-2 generations are added after generation 0, and
+   survivors age in them for n-2 more GCs before they are promoted
+   ("tenured") into the generation after them, which is what -G calls
+   generation 1.  The aging generations (1..last_aging_gen) are
+   collected by every GC (see calcNeeded()), so data that lives for a
+   few GCs and then dies never gets into an old generation, where it
+   would stay until the next major GC.
+
+   With --adaptive-tenure, the tenure age varies between 2 and n with
+   the amount tenured by each minor GC, taken as a fraction of the
+   nursery (this is "demographic feedback", as in Ungar and Jackson,
+   "An adaptive tenuring policy for generation scavengers", TOPLAS
+   1992).  When a lot is tenured, some of it is probably going to die
+   soon, so objects age for longer; when very little is, the copying
+   done by aging isn't paying off, and they are tenured sooner.  The
+   tenure age is changed by pointing gen->to of an aging generation at
+   the first old generation (set_tenure_age()), and
+   prepare_collected_gen() updates the dest_no of the blocks to match;
+   an aging generation that isn't in use stays empty, and isn't
+   collected.
+   -------------------------------------------------------------------------- */
+
+static nat tenure_age = 0;   // current tenure age, 0 <=> not set yet
+
+// --adaptive-tenure moves the tenure age up when a minor GC tenures
+// more than TENURE_HIGH_PCT% of the words in the nursery, and down when
+// it tenures less than TENURE_LOW_PCT%
+#define TENURE_HIGH_PCT 5
+#define TENURE_LOW_PCT  1
+
 /* Mut-list stats */
 #ifdef DEBUG
 nat mutlist_MUTVARS,
@@ -129,8 +180,29 @@ StgWord8 the_gc_thread[sizeof(gc_thread) + 64 * sizeof(gen_workspace)];
 // step->todos[] lists we have to look in to find work.
 nat n_gc_threads;
 
+// A parallel major GC of a marked oldest generation: the other GC
+// threads only help with the sweep or the compaction (see par_sweep()
+// and par_compact()).
+static volatile rtsBool mark_only;
+
+#if defined(THREADED_RTS)
+// The other GC threads are in gcWorkerThread() for this GC, and what
+// runOnGcThreads() wants them to do
+static rtsBool par_gc_workers;
+static void (* volatile gc_job)(nat me);
+
+// What recent collections cost, for gcThreadsWanted()
+static W_     minor_copied = 0;   // words copied by recent minor GCs
+static double gc_thread_rate = 0; // words copied per second per GC thread
+#endif
+
 // For stats:
 long copied;        // *words* copied & scavenged during this GC
+W_ mut_list_entries;
+W_ mut_list_dups;
+
+// Words of stack scavenged, over all GCs, for +RTS -s
+W_ stack_words_scanned = 0;
 
 rtsBool work_stealing;
 
@@ -141,20 +213,35 @@ DECLARE_GCT
    -------------------------------------------------------------------------- */
 
 static void mark_root               (void *user, StgClosure **root);
-static void zero_static_object_list (StgClosure* first_static);
 static void prepare_collected_gen   (generation *gen);
 static void prepare_uncollected_gen (generation *gen);
+static void stash_mut_list          (Capability *cap, nat gen_no);
 static void init_gc_thread          (gc_thread *t);
 static void resize_generations      (void);
 static void resize_nursery          (void);
+static void resize_nursery_auto     (void);
 static void start_gc_threads        (void);
 static void scavenge_until_all_done (void);
 static StgWord inc_running          (void);
 static StgWord dec_running          (void);
 static void wakeup_gc_threads       (nat me);
 static void shutdown_gc_threads     (nat me);
+static void end_weak_rounds         (void);
+static void account_groups          (void);
+#if defined(THREADED_RTS)
+static void pruneSparkQueues        (nat me);
+static volatile StgWord prune_next; // see pruneSparkQueues()
+static void record_gc_throughput    (Time elapsed);
+#endif
+static void par_sweep               (nat me);
+static void par_compact             (nat me);
 static void collect_gct_blocks      (void);
+static void collect_large_objects   (void);
 static void collect_pinned_object_blocks (void);
+STATIC_INLINE void count_pinned_block (generation *gen, bdescr *bd);
+static void set_tenure_age          (nat age);
+static void adapt_tenure_age        (W_ tenured);
+static W_   tenured_words           (void);
 
 #if defined(DEBUG)
 static void gcCAFs                  (void);
@@ -168,6 +255,55 @@ bdescr *mark_stack_top_bd; // topmost block in the mark stack
 bdescr *mark_stack_bd;     // current block in the mark stack
 StgPtr mark_sp;            // pointer to the next unallocated mark stack entry
 
+/* -----------------------------------------------------------------------------
+   Memory pressure handlers
+
+   Under a soft heap limit (+RTS --soft-heap-limit), resize_generations()
+   sizes the generations to fit in the limit, so that major GCs come
+   sooner, and compacts the oldest generation past compactThreshold of
+   it.  If a major GC still leaves more than the limit in use (the live
+   data and the nursery), we run each handler registered with
+   addMemoryPressureHandler() in a new thread, so that the program can
+   drop caches before it runs into -M or the limits of the machine.
+
+   The handlers are on a list that only ever grows at the front, under
+   sm_mutex, so GarbageCollect() takes the head while it holds sm_mutex
+   and can walk the list later without it.
+   -------------------------------------------------------------------------- */
+
+typedef struct PressureHandler_ {
+    StgStablePtr action;
+    struct PressureHandler_ *link;
+} PressureHandler;
+
+static PressureHandler *pressure_handlers = NULL;
+
+void
+addMemoryPressureHandler (StgStablePtr action)
+{
+    PressureHandler *h;
+
+    h = stgMallocBytes(sizeof(PressureHandler), "addMemoryPressureHandler");
+    h->action = action;
+
+    ACQUIRE_SM_LOCK;
+    h->link = pressure_handlers;
+    pressure_handlers = h;
+    RELEASE_SM_LOCK;
+}
+
+static void
+run_pressure_handlers (Capability *cap, PressureHandler *h)
+{
+    StgTSO *t;
+
+    for (; h != NULL; h = h->link) {
+        t = createIOThread(cap, RtsFlags.GcFlags.initialStkSize,
+                           (StgClosure *)deRefStablePtr(h->action));
+        scheduleThread(cap, t);
+    }
+}
+
 /* -----------------------------------------------------------------------------
    GarbageCollect: the main entry point to the garbage collector.
 
@@ -189,6 +325,9 @@ GarbageCollect (nat collect_gen,
   gc_thread *saved_gct;
 #endif
   nat g, n;
+  rtsBool adapt_tenure;
+  W_ tenured_before = 0;
+  PressureHandler *pressure = NULL;
 
   // necessary if we stole a callee-saves register for gct:
 #if defined(THREADED_RTS)
@@ -201,6 +340,10 @@ GarbageCollect (nat collect_gen,
 
   ACQUIRE_SM_LOCK;
 
+  // anything the last GC left to free (Note [Deferred freeing] in
+  // BlockAlloc.c) goes now, so that we start with the usual accounting
+  freeDeferredChains();
+
 #if defined(RTS_USER_SIGNALS)
   if (RtsFlags.MiscFlags.install_signal_handlers) {
     // block signals
@@ -246,6 +389,21 @@ GarbageCollect (nat collect_gen,
   N = collect_gen;
   major_gc = (N == RtsFlags.GcFlags.generations-1);
 
+  // Flip the meaning of the static link tags, rather than clearing
+  // the links after the GC; see Note [STATIC_LINK fields] in Storage.h
+  if (major_gc) {
+      prev_static_flag = static_flag;
+      static_flag =
+          static_flag == STATIC_FLAG_A ? STATIC_FLAG_B : STATIC_FLAG_A;
+  }
+
+#if defined(THREADED_RTS)
+  par_gc_workers = gc_type == SYNC_GC_PAR;
+  mark_only = gc_type == SYNC_GC_PAR && major_gc && oldest_gen->mark;
+#else
+  mark_only = rtsFalse;
+#endif
+
 #if defined(THREADED_RTS)
   work_stealing = RtsFlags.ParFlags.parGcLoadBalancingEnabled &&
                   N >= RtsFlags.ParFlags.parGcLoadBalancingGen;
@@ -258,6 +416,8 @@ GarbageCollect (nat collect_gen,
       // work stealing or not, e.g. it might be a good idea to do it
       // if the heap is big.  For now, we just turn it on or off with
       // a flag.
+
+  reset_arr_work();
 #endif
 
   /* Start threads, so they can be spinning up while we finish initialisation.
@@ -267,9 +427,12 @@ GarbageCollect (nat collect_gen,
 #if defined(THREADED_RTS)
   /* How many threads will be participating in this GC?
    * We don't try to parallelise minor GCs (unless the user asks for
-   * it with +RTS -gn0), or mark/compact/sweep GC.
+   * it with +RTS -gn0), or the marking phase of a mark/sweep or
+   * mark/compact GC.  Those mark on one thread, because the mark stack
+   * isn't thread-safe, and then share out the sweep (see par_sweep())
+   * or the compaction (see par_compact()).
    */
-  if (gc_type == SYNC_GC_PAR) {
+  if (gc_type == SYNC_GC_PAR && !mark_only) {
       n_gc_threads = n_capabilities;
   } else {
       n_gc_threads = 1;
@@ -288,6 +451,7 @@ GarbageCollect (nat collect_gen,
 
   // do this *before* we start scavenging
   collectFreshWeakPtrs();
+  collectFreshThreads();
 
   // check sanity *before* GC
   IF_DEBUG(sanity, checkSanity(rtsFalse /* before GC */, major_gc));
@@ -296,11 +460,21 @@ GarbageCollect (nat collect_gen,
   // and put them on the g0->large_object list.
   collect_pinned_object_blocks();
 
+  // see Note [Aging]
+  if (tenure_age == 0) {
+      set_tenure_age(RtsFlags.GcFlags.tenureAge);
+  }
+  adapt_tenure = RtsFlags.GcFlags.adaptiveTenure && N <= last_aging_gen;
+  if (adapt_tenure) {
+      tenured_before = tenured_words();
+  }
+
   // Initialise all the generations/steps that we're collecting.
   for (g = 0; g <= N; g++) {
       prepare_collected_gen(&generations[g]);
   }
   // Initialise all the generations/steps that we're *not* collecting.
+  mut_list_entries = 0;
   for (g = N+1; g < RtsFlags.GcFlags.generations; g++) {
       prepare_uncollected_gen(&generations[g]);
   }
@@ -326,15 +500,27 @@ GarbageCollect (nat collect_gen,
    * follow all the roots that we know about:
    */
 
+  // attribute what the threads of each accounting group keep alive to
+  // the group, before the other GC threads start and anything else is
+  // marked (see Note [Accounting groups] in Accounting.c)
+  if (major_gc && acct_groups_used) {
+      account_groups();
+  }
+
   // the main thread is running: this prevents any other threads from
   // exiting prematurely, so we can start them now.
   // NB. do this after the mutable lists have been saved above, otherwise
   // the other GC threads will be writing into the old mutable lists.
   inc_running();
+#if defined(THREADED_RTS)
+  prune_next = 0;
+#endif
   wakeup_gc_threads(gct->thread_index);
 
   traceEventGcWork(gct->cap);
 
+  stat_startGCPhase();
+
   // scavenge the capability-private mutable lists.  This isn't part
   // of markSomeCapabilities() because markSomeCapabilities() can only
   // call back into the GC via mark_root() (due to the gct register
@@ -362,6 +548,9 @@ GarbageCollect (nat collect_gen,
   gct->evac_gen_no = 0;
   markCAFs(mark_root, gct);
 
+  // and from the static objects that the frozen heap may refer to
+  markFrozenStatics(mark_root, gct);
+
   // follow all the roots that the application knows about.
   gct->evac_gen_no = 0;
   if (n_gc_threads == 1) {
@@ -387,44 +576,47 @@ GarbageCollect (nat collect_gen,
   // Mark the stable pointer table.
   markStableTables(mark_root, gct);
 
+  stat_endGCPhase(GC_PHASE_ROOTS);
+
   /* -------------------------------------------------------------------------
    * Repeatedly scavenge all the areas we know about until there's no
    * more scavenging to be done.
    */
-  for (;;)
-  {
+  stat_startGCPhase();
+  scavenge_until_all_done();
+  stat_endGCPhase(GC_PHASE_SCAV);
+
+  // must be last...  invariant is that everything is fully
+  // scavenged at this point.  Each time traverseWeakPtrList() returns
+  // rtsTrue it has started a round of weak pointer processing, which
+  // all the GC threads scavenge (see Note [Parallel weak pointers]).
+  stat_startGCPhase();
+  stat_startWeak();
+  n = 0;
+  while (traverseWeakPtrList()) {
       scavenge_until_all_done();
-      // The other threads are now stopped.  We might recurse back to
-      // here, but from now on this is the only thread.
-
-      // must be last...  invariant is that everything is fully
-      // scavenged at this point.
-      if (traverseWeakPtrList()) { // returns rtsTrue if evaced something
-          inc_running();
-          continue;
-      }
-
-      // If we get to here, there's really nothing left to do.
-      break;
+      n++;
   }
+  end_weak_rounds();
+  stat_endWeak(n);
+  stat_endGCPhase(GC_PHASE_WEAK);
+
+#ifdef THREADED_RTS
+  // alongside the other GC threads, see pruneSparkQueues()
+  pruneSparkQueues(gct->thread_index);
+#endif
 
   shutdown_gc_threads(gct->thread_index);
 
   // Now see which stable names are still alive.
   gcStableTables();
 
+  // and which large objects
+  collect_large_objects();
+
 #ifdef THREADED_RTS
-  if (n_gc_threads == 1) {
-      for (n = 0; n < n_capabilities; n++) {
-          pruneSparkQueue(capabilities[n]);
-      }
-  } else {
-      for (n = 0; n < n_capabilities; n++) {
-          if (n == cap->no || gc_threads[n]->idle) {
-              pruneSparkQueue(capabilities[n]);
-         }
-      }
-  }
+  // every pool has been pruned, so the spark counters add up
+  adjustSparkLimit();
 #endif
 
 #ifdef PROFILING
@@ -442,18 +634,27 @@ GarbageCollect (nat collect_gen,
 
   // Finally: compact or sweep the oldest generation.
   if (major_gc && oldest_gen->mark) {
-      if (oldest_gen->compact)
+      stat_startGCPhase();
+      if (oldest_gen->compact && mark_only)
+          par_compact(gct->thread_index);
+      else if (oldest_gen->compact)
           compact(gct->scavenged_static_objects);
+      else if (mark_only)
+          par_sweep(gct->thread_index);
       else
           sweep(oldest_gen);
+      stat_endGCPhase(GC_PHASE_SWEEP);
   }
 
   copied = 0;
   par_max_copied = 0;
   par_tot_copied = 0;
+  mut_list_dups = 0;
   {
       nat i;
       for (i=0; i < n_gc_threads; i++) {
+          mut_list_dups += gc_threads[i]->mut_list_dups;
+          stack_words_scanned += gc_threads[i]->stack_scanned;
           if (n_gc_threads > 1) {
               debugTrace(DEBUG_gc,"thread %d:", i);
               debugTrace(DEBUG_gc,"   copied           %ld", gc_threads[i]->copied * sizeof(W_));
@@ -509,7 +710,7 @@ GarbageCollect (nat collect_gen,
                    mutlist_OTHERS);
     }
 
-    bdescr *next, *prev;
+    bdescr *next, *prev, *dead;
     gen = &generations[g];
 
     // for generations we collected...
@@ -517,7 +718,9 @@ GarbageCollect (nat collect_gen,
 
         /* free old memory and shift to-space into from-space for all
          * the collected steps (except the allocation area).  These
-         * freed blocks will probaby be quickly recycled.
+         * freed blocks will probaby be quickly recycled.  The freeing
+         * itself is done after the GC: see Note [Deferred freeing] in
+         * BlockAlloc.c.
          */
         if (gen->mark)
         {
@@ -525,6 +728,7 @@ GarbageCollect (nat collect_gen,
             if (gen->old_blocks != NULL) {
 
                 prev = NULL;
+                dead = NULL;
                 for (bd = gen->old_blocks; bd != NULL; bd = next) {
 
                     next = bd->link;
@@ -536,7 +740,8 @@ GarbageCollect (nat collect_gen,
                         } else {
                             prev->link = next;
                         }
-                        freeGroup(bd);
+                        bd->link = dead;
+                        dead = bd;
                         gen->n_old_blocks--;
                     }
                     else
@@ -561,6 +766,7 @@ GarbageCollect (nat collect_gen,
                     prev->link = gen->blocks;
                     gen->blocks = gen->old_blocks;
                 }
+                deferFreeChain(dead);
             }
             // add the new blocks to the block tally
             gen->n_blocks += gen->n_old_blocks;
@@ -569,7 +775,7 @@ GarbageCollect (nat collect_gen,
         }
         else // not copacted
         {
-            freeChain(gen->old_blocks);
+            deferFreeChain(gen->old_blocks);
         }
 
         gen->old_blocks = NULL;
@@ -578,13 +784,27 @@ GarbageCollect (nat collect_gen,
         /* LARGE OBJECTS.  The current live large objects are chained on
          * scavenged_large, having been moved during garbage
          * collection from large_objects.  Any objects left on the
-         * large_objects list are therefore dead, so we free them here.
+         * large_objects list are therefore dead, so we free them (after
+         * the GC, like the old blocks).
          */
-        freeChain(gen->large_objects);
+        deferFreeChain(gen->large_objects);
         gen->large_objects  = gen->scavenged_large_objects;
         gen->n_large_blocks = gen->n_scavenged_large_blocks;
         gen->n_large_words  = countOccupied(gen->large_objects);
         gen->n_new_large_words = 0;
+
+        gen->n_pinned_blocks = 0;
+        gen->n_pinned_live_words = 0;
+        for (bd = gen->large_objects; bd; bd = bd->link) {
+            count_pinned_block(gen, bd);
+        }
+
+        /* COMPACT REGIONS.  Likewise, the live regions have been moved
+         * to live_compact_objects, and the rest are dead.
+         */
+        freeCompactList(gen->compact_objects);
+        gen->compact_objects  = gen->live_compact_objects;
+        gen->n_compact_blocks = gen->n_live_compact_blocks;
     }
     else // for generations > N
     {
@@ -596,10 +816,18 @@ GarbageCollect (nat collect_gen,
             next = bd->link;
             dbl_link_onto(bd, &gen->large_objects);
             gen->n_large_words += bd->free - bd->start;
+            count_pinned_block(gen, bd);
         }
 
         // add the new blocks we promoted during this GC
         gen->n_large_blocks += gen->n_scavenged_large_blocks;
+
+        // and the compact regions
+        for (bd = gen->live_compact_objects; bd; bd = next) {
+            next = bd->link;
+            dbl_link_onto(bd, &gen->compact_objects);
+        }
+        gen->n_compact_blocks += gen->n_live_compact_blocks;
     }
 
     ASSERT(countBlocks(gen->large_objects) == gen->n_large_blocks);
@@ -607,6 +835,8 @@ GarbageCollect (nat collect_gen,
 
     gen->scavenged_large_objects = NULL;
     gen->n_scavenged_large_blocks = 0;
+    gen->live_compact_objects = NULL;
+    gen->n_live_compact_blocks = 0;
 
     // Count "live" data
     live_words  += genLiveWords(gen);
@@ -623,9 +853,34 @@ GarbageCollect (nat collect_gen,
     }
   } // for all generations
 
+  // freeze what is left, for freezeHeap()
+  if (major_gc && freeze_requested) {
+      freezeLiveHeap();
+  }
+
+  // write the evaluated CAFs, for saveHeapImage()
+  if (major_gc && heap_image_requested) {
+      writeHeapImage();
+  }
+
+  if (adapt_tenure) {
+      W_ tenured_after = tenured_words();
+      adapt_tenure_age(tenured_after > tenured_before ?
+                       tenured_after - tenured_before : 0);
+  }
+
   // update the max size of older generations after a major GC
   resize_generations();
 
+  // over the soft limit?  (see run_pressure_handlers())
+  if (major_gc && RtsFlags.GcFlags.softHeapLimit != 0 &&
+      live_blocks + countNurseryBlocks() > RtsFlags.GcFlags.softHeapLimit) {
+      debugTrace(DEBUG_gc, "memory pressure: %ld blocks in use, soft limit %ld",
+                 (long)(live_blocks + countNurseryBlocks()),
+                 (long)RtsFlags.GcFlags.softHeapLimit);
+      pressure = pressure_handlers;
+  }
+
   // Free the mark stack.
   if (mark_stack_top_bd != NULL) {
       debugTrace(DEBUG_gc, "mark stack: %d blocks",
@@ -642,9 +897,10 @@ GarbageCollect (nat collect_gen,
       }
   }
 
+  stat_startGCPhase();
   resize_nursery();
-
   resetNurseries();
+  stat_endGCPhase(GC_PHASE_NURSERY);
 
  // mark the garbage collected CAFs as dead
 #if defined(DEBUG)
@@ -665,31 +921,15 @@ GarbageCollect (nat collect_gen,
   }
 
 #ifdef PROFILING
-  // resetStaticObjectForRetainerProfiling() must be called before
-  // zeroing below.
-
   // ToDo: fix the gct->scavenged_static_objects below
   resetStaticObjectForRetainerProfiling(gct->scavenged_static_objects);
 #endif
 
-  // zero the scavenged static object list
-  if (major_gc) {
-      nat i;
-      if (n_gc_threads == 1) {
-          zero_static_object_list(gct->scavenged_static_objects);
-      } else {
-          for (i = 0; i < n_gc_threads; i++) {
-              if (!gc_threads[i]->idle) {
-                  zero_static_object_list(gc_threads[i]->scavenged_static_objects);
-              }
-          }
-      }
-  }
-
   // Start any pending finalizers.  Must be after
   // updateStableTables() and stableUnlock() (see #4221).
   RELEASE_SM_LOCK;
   scheduleFinalizers(cap, dead_weak_ptr_list);
+  run_pressure_handlers(cap, pressure);
   ACQUIRE_SM_LOCK;
 
   // check sanity after GC
@@ -709,24 +949,48 @@ GarbageCollect (nat collect_gen,
       ACQUIRE_SM_LOCK;
   }
 
+  // A heap snapshot needs the heap in the same state as a census
+  if (performHeapSnapshot && major_gc) {
+      performHeapSnapshot = rtsFalse;
+      RELEASE_SM_LOCK;
+      heapSnapshot();
+      ACQUIRE_SM_LOCK;
+  }
+
   // send exceptions to any threads which were about to die
   RELEASE_SM_LOCK;
   resurrectThreads(resurrected_threads);
+  // and to the threads of groups over their residency quota
+  if (major_gc && acct_groups_used) {
+      checkGroupQuotas();
+  }
   ACQUIRE_SM_LOCK;
 
+  stat_startGCPhase();
   if (major_gc) {
       W_ need, got;
-      need = BLOCKS_TO_MBLOCKS(n_alloc_blocks);
+      for (n = 0; n < n_capabilities; n++) {
+          flushBlockCache(capabilities[n]);
+      }
+      // not counting the blocks that are about to be freed
+      need = BLOCKS_TO_MBLOCKS(n_alloc_blocks - n_deferred_blocks);
       got = mblocks_allocated;
       /* If the amount of data remains constant, next major GC we'll
          require (F+1)*need. We leave (F+2)*need in order to reduce
          repeated deallocation and reallocation. */
       need = (RtsFlags.GcFlags.oldGenFactor + 2) * need;
-      if (got > need) {
+      // with --decommit-age, this is done gradually instead (Decommit.c)
+      if (got > need && RtsFlags.GcFlags.decommitAge == 0) {
           returnMemoryToOS(got - need);
       }
   }
 
+#if !defined(THREADED_RTS)
+  // there's no background thread to do it
+  decommitStep();
+#endif
+  stat_endGCPhase(GC_PHASE_RETURN_MEM);
+
   // extra GC trace info
   IF_DEBUG(gc, statDescribeGens());
 
@@ -752,6 +1016,10 @@ GarbageCollect (nat collect_gen,
              live_blocks * BLOCK_SIZE_W - live_words /* slop */,
              N, n_gc_threads, par_max_copied, par_tot_copied);
 
+#if defined(THREADED_RTS)
+  record_gc_throughput(getProcessElapsedTime() - gct->gc_start_elapsed);
+#endif
+
 #if defined(RTS_USER_SIGNALS)
   if (RtsFlags.MiscFlags.install_signal_handlers) {
     // unblock signals again
@@ -814,7 +1082,8 @@ new_gc_thread (nat n, gc_thread *t)
         // but can't, because it uses gct which isn't set up at this point.
         // Hence, allocate a block for todo_bd manually:
         {
-            bdescr *bd = allocBlock(); // no lock, locks aren't initialised yet
+            // no lock, locks aren't initialised yet
+            bdescr *bd = allocBlockOnNode(capNoToNumaNode(n));
             initBdescr(bd, ws->gen, ws->gen->to);
             bd->flags = BF_EVACUATED;
             bd->u.scan = bd->free = bd->start;
@@ -828,6 +1097,8 @@ new_gc_thread (nat n, gc_thread *t)
         ws->todo_overflow = NULL;
         ws->n_todo_overflow = 0;
         ws->todo_large_objects = NULL;
+        ws->scavd_large_objects = NULL;
+        ws->n_scavd_large_blocks = 0;
 
         ws->part_list = NULL;
         ws->n_part_blocks = 0;
@@ -854,9 +1125,9 @@ initGcThreads (nat from USED_IF_THREADS, nat to USED_IF_THREADS)
 
     for (i = from; i < to; i++) {
         gc_threads[i] =
-            stgMallocBytes(sizeof(gc_thread) +
+            stgMallocAlignedBytes(sizeof(gc_thread) +
                            RtsFlags.GcFlags.generations * sizeof(gen_workspace),
-                           "alloc_gc_threads");
+                           64, "alloc_gc_threads");
 
         new_gc_thread(i, gc_threads[i]);
     }
@@ -880,7 +1151,7 @@ freeGcThreads (void)
             {
                 freeWSDeque(gc_threads[i]->gens[g].todo_q);
             }
-            stgFree (gc_threads[i]);
+            stgFreeAligned (gc_threads[i]);
         }
         stgFree (gc_threads);
 #else
@@ -898,7 +1169,12 @@ freeGcThreads (void)
    Start GC threads
    ------------------------------------------------------------------------- */
 
-static volatile StgWord gc_running_threads;
+volatile StgWord gc_running_threads;
+volatile StgWord gc_work_pushed;
+
+// An idle GC thread waits for up to 2^GC_IDLE_MAX_BACKOFF spins before
+// looking for work again, unless it is told that work has been pushed
+#define GC_IDLE_MAX_BACKOFF 10
 
 static StgWord
 inc_running (void)
@@ -943,22 +1219,21 @@ any_work (void)
 
 #if defined(THREADED_RTS)
     if (work_stealing) {
-        nat n;
-        // look for work to steal
-        for (n = 0; n < n_gc_threads; n++) {
-            if (n == gct->thread_index) continue;
+        nat i, n;
+        // look for work to steal, starting with our neighbour so that
+        // the idle threads don't all look at the same deques first
+        for (i = 1; i < n_gc_threads; i++) {
+            n = (gct->thread_index + i) % n_gc_threads;
             for (g = RtsFlags.GcFlags.generations-1; g >= 0; g--) {
                 ws = &gc_threads[n]->gens[g];
                 if (!looksEmptyWSDeque(ws->todo_q)) return rtsTrue;
             }
         }
+        if (!looksEmptyArrWork()) return rtsTrue;
     }
 #endif
 
     gct->no_work++;
-#if defined(THREADED_RTS)
-    yieldThread();
-#endif
 
     return rtsFalse;
 }
@@ -994,28 +1269,258 @@ loop:
 
     debugTrace(DEBUG_gc, "%d GC threads still running", r);
 
-    while (gc_running_threads != 0) {
-        // usleep(1);
-        if (any_work()) {
-            inc_running();
-            traceEventGcWork(gct->cap);
-            goto loop;
+    // Termination: a thread that runs out of work decrements
+    // gc_running_threads, and increments it again before it takes any
+    // more (so the count can't reach zero while there is work in a
+    // deque that some running thread could still add to).  We are done
+    // when it reaches zero.
+    //
+    // Rather than scanning every other thread's deques continuously,
+    // an idle thread backs off exponentially between scans.  It cuts the
+    // wait short when the GC is over, or when gc_work_pushed changes:
+    // todo_block_full() bumps it when it publishes a block while some
+    // thread is idle.
+    {
+        StgWord seen USED_IF_THREADS;
+        nat backoff USED_IF_THREADS = 0, spin USED_IF_THREADS;
+
+        while (gc_running_threads != 0) {
+            seen = gc_work_pushed;
+            if (any_work()) {
+                inc_running();
+                traceEventGcWork(gct->cap);
+                goto loop;
+            }
+            // any_work() does not remove the work from the queue, it
+            // just checks for the presence of work.  If we find any,
+            // then we increment gc_running_threads and go back to
+            // scavenge_loop() to perform any pending work.
+
+#if defined(THREADED_RTS)
+            for (spin = 0; spin < (1u << backoff); spin++) {
+                if (gc_running_threads == 0 || gc_work_pushed != seen) break;
+                busy_wait_nop();
+            }
+            if (backoff < GC_IDLE_MAX_BACKOFF) {
+                backoff++;
+            } else {
+                yieldThread();
+            }
+#endif
         }
-        // any_work() does not remove the work from the queue, it
-        // just checks for the presence of work.  If we find any,
-        // then we increment gc_running_threads and go back to
-        // scavenge_loop() to perform any pending work.
     }
 
     traceEventGcDone(gct->cap);
 }
 
+/* -----------------------------------------------------------------------------
+   Accounting groups
+
+   Scavenges from the stacks of each group's threads in turn, on this GC
+   thread alone, and counts what that copies as the group's residency.
+   -------------------------------------------------------------------------- */
+
+static void
+account_groups (void)
+{
+    StgWord64 used;
+    W_ before;
+    nat g;
+
+    used = usedAccountingGroups();
+    for (g = 1; g < MAX_ACCOUNTING_GROUPS; g++) {
+        if (!(used & ((StgWord64)1 << g))) {
+            setGroupResidency(g, 0);
+            continue;
+        }
+        before = gct->scanned + gct->pinned_evacd;
+        inc_running();
+        markGroupStacks(g);
+        scavenge_until_all_done();
+        setGroupResidency(g, gct->scanned + gct->pinned_evacd - before);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Weak pointer rounds
+
+   When the heap has been scavenged, the other GC threads wait in
+   wait_weak_round() for the main GC thread to start a round of weak
+   pointer processing with startWeakRound(), join in, and scavenge
+   again; see Note [Parallel weak pointers] in MarkWeak.c.  The main
+   thread counts them in before it starts the round, so the round is not
+   over until they have all done their part.  end_weak_rounds() sends
+   them home at the end.
+   -------------------------------------------------------------------------- */
+
 #if defined(THREADED_RTS)
+static volatile StgWord weak_round = 0;    // bumped for each round
+static volatile nat weak_round_work;       // WEAK_ROUND_*
+#endif
+
+void
+startWeakRound (nat work)
+{
+#if defined(THREADED_RTS)
+    nat i;
+#endif
+
+    inc_running();
+#if defined(THREADED_RTS)
+    if (n_gc_threads > 1) {
+        for (i = 0; i < n_gc_threads; i++) {
+            if (i == gct->thread_index || gc_threads[i]->idle) continue;
+            inc_running();
+        }
+        weak_round_work = work;
+        write_barrier();
+        weak_round++;
+    }
+#endif
+    doWeakRound(work);
+}
+
+static void
+end_weak_rounds (void)
+{
+#if defined(THREADED_RTS)
+    if (n_gc_threads > 1) {
+        weak_round_work = WEAK_ROUND_END;
+        write_barrier();
+        weak_round++;
+    }
+#endif
+}
+
+#if defined(THREADED_RTS)
+
+/* -----------------------------------------------------------------------------
+   Pruning the spark pools
+
+   Once the heap is marked, every GC thread prunes the spark pool of its
+   own Capability, and then the GC threads share out the pools of the
+   Capabilities that are not taking part in the GC (all of them, in a
+   single-threaded GC), claiming one at a time from prune_next.  Each
+   pool is pruned by exactly one thread, so its spark_stats need no
+   locking, and adjustSparkLimit() adds them up after GC.
+   -------------------------------------------------------------------------- */
+
+static void
+pruneSparkQueues (nat me)
+{
+    StgWord n;
+
+    pruneSparkQueue(capabilities[me]);
+
+    while ((n = atomic_inc(&prune_next, 1) - 1) < n_capabilities) {
+        if (n == me || (n_gc_threads > 1 && !gc_threads[n]->idle)) {
+            continue;
+        }
+        pruneSparkQueue(capabilities[n]);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Choosing how many GC threads to use (+RTS -qn)
+
+   Waking up a GC thread costs tens of microseconds, so there is no point
+   in sharing out a GC that would only take a few times that on one
+   thread.  We guess how many words this GC will copy: what recent minor
+   GCs copied, plus the live data of the older generations being
+   collected.  Dividing by the copying rate per GC thread that we
+   measured in recent GCs gives the time a single thread would take,
+   and we ask for one GC thread per PAR_GC_THREAD_WORK of that.
+   -------------------------------------------------------------------------- */
+
+// The least GC work worth waking up another GC thread for
+#define PAR_GC_THREAD_WORK   USToTime(500)
+
+// Our guess at the copying rate before we have measured it: 256Mb/s
+#define PAR_GC_INITIAL_RATE  ((double)(256 * 1024 * 1024) / sizeof(W_))
+
+nat
+gcThreadsWanted (nat gen)
+{
+    W_ words;
+    double secs;
+    nat g, n;
+
+    if (gc_thread_rate == 0) {
+        gc_thread_rate = PAR_GC_INITIAL_RATE;
+    }
+
+    words = minor_copied;
+    for (g = 1; g <= gen && g < RtsFlags.GcFlags.generations; g++) {
+        words += genLiveWords(&generations[g]);
+    }
+
+    secs = (double)words / gc_thread_rate;
+    n = (nat)(secs * TIME_RESOLUTION / PAR_GC_THREAD_WORK);
+    if (RtsFlags.ParFlags.parGcThreads != 0) {
+        n = stg_min(n, RtsFlags.ParFlags.parGcThreads);
+    }
+    return stg_max(stg_min(n, n_capabilities), 1);
+}
+
+// Called at the end of each GC
+static void
+record_gc_throughput (Time elapsed)
+{
+    nat i, threads;
+    double rate;
+
+    if (N == 0) {
+        minor_copied = (minor_copied + copied) / 2;
+    }
+
+    if (n_gc_threads == 1) {
+        threads = 1;
+    } else {
+        threads = 0;
+        for (i = 0; i < n_gc_threads; i++) {
+            if (!gc_threads[i]->idle) threads++;
+        }
+    }
+
+    // a GC that copied very little tells us more about the fixed costs
+    // than about the copying rate
+    if (elapsed <= 0 || (W_)copied < BLOCK_SIZE_W * (W_)threads) {
+        return;
+    }
+
+    rate = (double)copied * TIME_RESOLUTION / ((double)elapsed * threads);
+    if (gc_thread_rate == 0) {
+        gc_thread_rate = rate;
+    } else {
+        gc_thread_rate = (3 * gc_thread_rate + rate) / 4;
+    }
+}
+
+// Wait for the next round; returns rtsFalse if there are no more
+static rtsBool
+wait_weak_round (StgWord *round, nat *work)
+{
+    nat spin = 0;
+
+    while (weak_round == *round) {
+        busy_wait_nop();
+        if (++spin == 1000) {
+            spin = 0;
+            yieldThread();
+        }
+    }
+    load_load_barrier();
+    (*round)++;
+    *work = weak_round_work;
+    return *work != WEAK_ROUND_END;
+}
 
 void
 gcWorkerThread (Capability *cap)
 {
     gc_thread *saved_gct;
+    StgWord round;
+    nat work;
 
     // necessary if we stole a callee-saves register for gct:
     saved_gct = gct;
@@ -1041,32 +1546,50 @@ gcWorkerThread (Capability *cap)
     }
     papi_thread_start_gc1_count(gct->papi_events);
 #endif
+    perfCountersCharge(rtsFalse, -1);
+
+    if (mark_only) {
+        // We've only been woken up to help with the sweep or compaction
+        if (oldest_gen->compact) {
+            compactHelper();
+        } else {
+            sweepChunks();
+        }
+    } else {
+        init_gc_thread(gct);
 
-    init_gc_thread(gct);
+        traceEventGcWork(gct->cap);
 
-    traceEventGcWork(gct->cap);
+        // the main GC thread can't start a weak pointer round before
+        // we have finished scavenging, so this is the one to wait past
+        round = weak_round;
 
-    // Every thread evacuates some roots.
-    gct->evac_gen_no = 0;
-    markCapability(mark_root, gct, cap, rtsTrue/*prune sparks*/);
-    scavenge_capability_mut_lists(cap);
+        // Every thread evacuates some roots.
+        gct->evac_gen_no = 0;
+        markCapability(mark_root, gct, cap, rtsTrue/*prune sparks*/);
+        scavenge_capability_mut_lists(cap);
 
-    scavenge_until_all_done();
+        scavenge_until_all_done();
 
-#ifdef THREADED_RTS
-    // Now that the whole heap is marked, we discard any sparks that
-    // were found to be unreachable.  The main GC thread is currently
-    // marking heap reachable via weak pointers, so it is
-    // non-deterministic whether a spark will be retained if it is
-    // only reachable via weak pointers.  To fix this problem would
-    // require another GC barrier, which is too high a price.
-    pruneSparkQueue(cap);
-#endif
+        // Help with the weak pointers until the main GC thread has
+        // finished with them.
+        while (wait_weak_round(&round, &work)) {
+            doWeakRound(work);
+            scavenge_until_all_done();
+        }
+
+        // Now that the whole heap is marked, we discard any sparks that
+        // were found to be unreachable.  Sparks that are only
+        // reachable via weak pointers are retained, because the weak
+        // pointer rounds are over by now.
+        pruneSparkQueues(gct->thread_index);
+    }
 
 #ifdef USE_PAPI
     // count events in this thread towards the GC totals
     papi_thread_stop_gc1_count(gct->papi_events);
 #endif
+    perfCountersCharge(rtsTrue, -1);
 
     // Wait until we're told to continue
     RELEASE_SPIN_LOCK(&gct->gc_spin);
@@ -1074,6 +1597,19 @@ gcWorkerThread (Capability *cap)
     debugTrace(DEBUG_gc, "GC thread %d waiting to continue...",
                gct->thread_index);
     ACQUIRE_SPIN_LOCK(&gct->mut_spin);
+
+    // runOnGcThreads() sends us back to stand by for each job it has
+    while (gct->wakeup == GC_THREAD_RUNNING) {
+        RELEASE_SPIN_LOCK(&gct->mut_spin);
+        gct->wakeup = GC_THREAD_STANDING_BY;
+        ACQUIRE_SPIN_LOCK(&gct->gc_spin);
+
+        gc_job(gct->thread_index);
+
+        RELEASE_SPIN_LOCK(&gct->gc_spin);
+        gct->wakeup = GC_THREAD_WAITING_TO_CONTINUE;
+        ACQUIRE_SPIN_LOCK(&gct->mut_spin);
+    }
     debugTrace(DEBUG_gc, "GC thread %d on my way...", gct->thread_index);
 
     SET_GCT(saved_gct);
@@ -1083,13 +1619,21 @@ gcWorkerThread (Capability *cap)
 
 #if defined(THREADED_RTS)
 
+// Sets *last_cap to the last Capability that we found still running,
+// and *last_thread to the thread it was running then (0 if none), for
+// the sync statistics (stat_endSync()).
 void
-waitForGcThreads (Capability *cap USED_IF_THREADS)
+waitForGcThreads (Capability *cap USED_IF_THREADS, nat *last_cap,
+                  StgWord64 *last_thread)
 {
     const nat n_threads = n_capabilities;
     const nat me = cap->no;
     nat i, j;
     rtsBool retry = rtsTrue;
+    StgTSO *tso;
+
+    *last_cap = me;
+    *last_thread = 0;
 
     while(retry) {
         for (i=0; i < n_threads; i++) {
@@ -1106,6 +1650,10 @@ waitForGcThreads (Capability *cap USED_IF_THREADS)
                 interruptCapability(capabilities[i]);
                 if (gc_threads[i]->wakeup != GC_THREAD_STANDING_BY) {
                     retry = rtsTrue;
+                    // not our Capability, so the thread is only a hint
+                    tso = capabilities[i]->r.rCurrentTSO;
+                    *last_cap = i;
+                    *last_thread = tso != NULL ? tso->id : 0;
                 }
             }
             if (!retry) break;
@@ -1166,6 +1714,154 @@ shutdown_gc_threads (nat me USED_IF_THREADS)
 #endif
 }
 
+/* -----------------------------------------------------------------------------
+   Sweep or compact the oldest generation with all the GC threads.
+
+   The other GC threads have been standing by while we marked, so we
+   wake them all up now; they call sweepChunks() or compactHelper() and
+   then wait to continue, as they would at the end of a copying GC.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+static nat
+count_mark_helpers (nat me)
+{
+    nat i, n = 0;
+
+    for (i=0; i < n_capabilities; i++) {
+        if (i == me || gc_threads[i]->idle) continue;
+        n++;
+    }
+    return n;
+}
+
+static void
+wakeup_mark_helpers (nat me)
+{
+    nat i;
+
+    for (i=0; i < n_capabilities; i++) {
+        if (i == me || gc_threads[i]->idle) continue;
+        debugTrace(DEBUG_gc, "waking up gc thread %d to help", i);
+        if (gc_threads[i]->wakeup != GC_THREAD_STANDING_BY)
+            barf("wakeup_mark_helpers");
+
+        gc_threads[i]->wakeup = GC_THREAD_RUNNING;
+        ACQUIRE_SPIN_LOCK(&gc_threads[i]->mut_spin);
+        RELEASE_SPIN_LOCK(&gc_threads[i]->gc_spin);
+    }
+}
+
+static void
+wait_mark_helpers (nat me)
+{
+    nat i;
+
+    for (i=0; i < n_capabilities; i++) {
+        if (i == me || gc_threads[i]->idle) continue;
+        while (gc_threads[i]->wakeup != GC_THREAD_WAITING_TO_CONTINUE) {
+            busy_wait_nop();
+            write_barrier();
+        }
+    }
+}
+#endif
+
+static void
+par_sweep (nat me USED_IF_THREADS)
+{
+#if defined(THREADED_RTS)
+    startParSweep(oldest_gen);
+    wakeup_mark_helpers(me);
+    sweepChunks();
+    wait_mark_helpers(me);
+    endParSweep(oldest_gen);
+#else
+    sweep(oldest_gen);
+#endif
+}
+
+static void
+par_compact (nat me USED_IF_THREADS)
+{
+#if defined(THREADED_RTS)
+    startParCompact(count_mark_helpers(me));
+    wakeup_mark_helpers(me);
+    compact(gct->scavenged_static_objects);
+    wait_mark_helpers(me);
+#else
+    compact(gct->scavenged_static_objects);
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+   Run a job on all the GC threads, after the GC proper
+
+   At the end of a parallel GC the other GC threads are waiting to
+   continue (see gcWorkerThread()).  To give them more work we send them
+   back to standing by and wake them up again, as at the start of the
+   GC, and then they call job() instead of collecting.  Used for the
+   heap census (see heapCensus()), which has to wait until the heap has
+   been swept but before the mutator runs.
+
+   job is passed the index of the GC thread; the calling thread runs it
+   too.  When the other GC threads are not taking part in this GC, the
+   calling thread runs it alone.
+   -------------------------------------------------------------------------- */
+
+void
+runOnGcThreads (void (*job)(nat me))
+{
+#if defined(THREADED_RTS)
+    const nat n_threads = n_capabilities;
+    const nat me = gct->thread_index;
+    nat i;
+
+    if (!par_gc_workers) {
+        job(me);
+        return;
+    }
+
+    gc_job = job;
+
+    for (i=0; i < n_threads; i++) {
+        if (i == me || gc_threads[i]->idle) continue;
+        if (gc_threads[i]->wakeup != GC_THREAD_WAITING_TO_CONTINUE)
+            barf("runOnGcThreads");
+
+        ACQUIRE_SPIN_LOCK(&gc_threads[i]->gc_spin);
+        gc_threads[i]->wakeup = GC_THREAD_RUNNING;
+        RELEASE_SPIN_LOCK(&gc_threads[i]->mut_spin);
+    }
+
+    for (i=0; i < n_threads; i++) {
+        if (i == me || gc_threads[i]->idle) continue;
+        while (gc_threads[i]->wakeup != GC_THREAD_STANDING_BY) {
+            busy_wait_nop();
+            write_barrier();
+        }
+        debugTrace(DEBUG_gc, "waking up gc thread %d for a job", i);
+        gc_threads[i]->wakeup = GC_THREAD_RUNNING;
+        ACQUIRE_SPIN_LOCK(&gc_threads[i]->mut_spin);
+        RELEASE_SPIN_LOCK(&gc_threads[i]->gc_spin);
+    }
+
+    job(me);
+
+    for (i=0; i < n_threads; i++) {
+        if (i == me || gc_threads[i]->idle) continue;
+        while (gc_threads[i]->wakeup != GC_THREAD_WAITING_TO_CONTINUE) {
+            busy_wait_nop();
+            write_barrier();
+        }
+    }
+
+    gc_job = NULL;
+#else
+    job(0);
+#endif
+}
+
 #if defined(THREADED_RTS)
 void
 releaseGCThreads (Capability *cap USED_IF_THREADS)
@@ -1202,8 +1898,15 @@ prepare_collected_gen (generation *gen)
     g = gen->no;
     if (g != 0) {
         for (i = 0; i < n_capabilities; i++) {
+            if (gen == oldest_gen && n_frozen_blocks != 0) {
+                // except for the entries for the frozen heap, which
+                // are still roots: see Freeze.c
+                stash_mut_list(capabilities[i], g);
+                continue;
+            }
             freeChain(capabilities[i]->mut_lists[g]);
-            capabilities[i]->mut_lists[g] = allocBlock();
+            capabilities[i]->mut_lists[g] =
+                allocBlockOnNode(capNoToNumaNode(i));
         }
     }
 
@@ -1253,14 +1956,28 @@ prepare_collected_gen (generation *gen)
         }
     }
 
-    // mark the small objects as from-space
+    // mark the small objects as from-space.  gen->to may have changed
+    // since the blocks were allocated (see Note [Aging]), but blocks
+    // that stay in this generation, such as new large objects, keep
+    // their destination.
     for (bd = gen->old_blocks; bd; bd = bd->link) {
         bd->flags &= ~BF_EVACUATED;
+        if (bd->dest_no != g) bd->dest_no = gen->to->no;
     }
 
     // mark the large objects as from-space
     for (bd = gen->large_objects; bd; bd = bd->link) {
         bd->flags &= ~BF_EVACUATED;
+        if (bd->dest_no != g) bd->dest_no = gen->to->no;
+        if (bd->flags & BF_PINNED_SMALL) {
+            clearPinnedMarks(bd);
+        }
+    }
+
+    // and the compact regions
+    for (bd = gen->compact_objects; bd; bd = bd->link) {
+        bd->flags &= ~BF_EVACUATED;
+        if (bd->dest_no != g) bd->dest_no = gen->to->no;
     }
 
     // for a compacted generation, we need to allocate the bitmap
@@ -1315,7 +2032,7 @@ static void
 stash_mut_list (Capability *cap, nat gen_no)
 {
     cap->saved_mut_lists[gen_no] = cap->mut_lists[gen_no];
-    cap->mut_lists[gen_no] = allocBlock_sync();
+    cap->mut_lists[gen_no] = allocBlockOnNode_sync(cap->node);
 }
 
 /* ----------------------------------------------------------------------------
@@ -1335,6 +2052,7 @@ prepare_uncollected_gen (generation *gen)
     // mutable lists as roots early on in the GC.
     for (i = 0; i < n_capabilities; i++) {
         stash_mut_list(capabilities[i], gen->no);
+        mut_list_entries += countOccupied(capabilities[i]->saved_mut_lists[gen->no]);
     }
 
     ASSERT(gen->scavenged_large_objects == NULL);
@@ -1384,6 +2102,52 @@ collect_gct_blocks (void)
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Sort the large objects of the collected generations.  Those that
+   were evacuated are on the scavd_large_objects lists of the GC
+   threads, and go on the scavenged_large_objects list of their new
+   generation; the rest are left on their gen->large_objects list,
+   which now holds just the dead ones (see evacuate_large()).
+   -------------------------------------------------------------------------- */
+
+static void
+collect_large_objects (void)
+{
+    nat g, i;
+    generation *gen;
+    gc_thread *t;
+    gen_workspace *ws;
+    bdescr *bd, *next, *dead;
+
+    for (g = 0; g <= N; g++) {
+        gen = &generations[g];
+        dead = NULL;
+        for (bd = gen->large_objects; bd != NULL; bd = next) {
+            next = bd->link;
+            if (!(bd->flags & BF_EVACUATED)) {
+                bd->link = dead;
+                dead = bd;
+            }
+        }
+        gen->large_objects = dead;
+    }
+
+    for (i = 0; i < n_gc_threads; i++) {
+        // with one GC thread, it is the one for our Capability
+        t = n_gc_threads == 1 ? gct : gc_threads[i];
+        for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+            ws = &t->gens[g];
+            for (bd = ws->scavd_large_objects; bd != NULL; bd = next) {
+                next = bd->u.back;
+                dbl_link_onto(bd, &ws->gen->scavenged_large_objects);
+            }
+            ws->gen->n_scavenged_large_blocks += ws->n_scavd_large_blocks;
+            ws->scavd_large_objects = NULL;
+            ws->n_scavd_large_blocks = 0;
+        }
+    }
+}
+
 /* -----------------------------------------------------------------------------
    During mutation, any blocks that are filled by allocatePinned() are
    stashed on the local pinned_object_blocks list, to avoid needing to
@@ -1398,10 +2162,19 @@ collect_gct_blocks (void)
 static void
 collect_pinned_object_blocks (void)
 {
-    nat n;
+    nat n, c;
     bdescr *bd, *prev;
 
     for (n = 0; n < n_capabilities; n++) {
+        // the blocks we are still allocating into aren't on any list,
+        // but the objects in them are marked too
+        for (c = 0; c < N_PINNED_CLASSES; c++) {
+            bd = capabilities[n]->pinned_object_block[c];
+            if (bd != NULL) {
+                clearPinnedMarks(bd);
+            }
+        }
+
         prev = NULL;
         for (bd = capabilities[n]->pinned_object_blocks; bd != NULL; bd = bd->link) {
             prev = bd;
@@ -1417,6 +2190,74 @@ collect_pinned_object_blocks (void)
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Tenuring: see Note [Aging]
+   -------------------------------------------------------------------------- */
+
+static void
+set_tenure_age (nat age)
+{
+    nat g;
+    generation *old = &generations[last_aging_gen + 1];
+
+    if (RtsFlags.GcFlags.generations == 1) {
+        tenure_age = 2;
+        return;
+    }
+
+    // objects in generation g have survived g+1 GCs
+    for (g = 0; g <= last_aging_gen; g++) {
+        generations[g].to = g + 2 < age ? &generations[g+1] : old;
+    }
+    tenure_age = age;
+}
+
+// The words in the first old generation, including the partly full
+// blocks of the GC threads
+static W_
+tenured_words (void)
+{
+    nat i, g;
+    W_ words;
+
+    g = last_aging_gen + 1;
+    words = genLiveWords(&generations[g]);
+    for (i = 0; i < n_capabilities; i++) {
+        words += gcThreadLiveWords(i, g);
+    }
+    return words;
+}
+
+static void
+adapt_tenure_age (W_ tenured)
+{
+    W_ nursery = countNurseryBlocks() * BLOCK_SIZE_W;
+    nat age = tenure_age;
+
+    if (tenured * 100 > nursery * TENURE_HIGH_PCT) {
+        if (age < RtsFlags.GcFlags.tenureAge) age++;
+    } else if (tenured * 100 < nursery * TENURE_LOW_PCT) {
+        if (age > 2) age--;
+    }
+
+    if (age != tenure_age) {
+        debugTrace(DEBUG_gc, "tenured %ld words: tenure age %d -> %d",
+                   (long)tenured, tenure_age, age);
+        set_tenure_age(age);
+    }
+}
+
+// Add a block of small pinned objects to the stats of its generation
+// (see allocatePinned())
+STATIC_INLINE void
+count_pinned_block (generation *gen, bdescr *bd)
+{
+    if (bd->flags & BF_PINNED_SMALL) {
+        gen->n_pinned_blocks++;
+        gen->n_pinned_live_words += PINNED_LIVE_WORDS(bd);
+    }
+}
+
 /* -----------------------------------------------------------------------------
    Initialise a gc_thread before GC
    -------------------------------------------------------------------------- */
@@ -1424,8 +2265,8 @@ collect_pinned_object_blocks (void)
 static void
 init_gc_thread (gc_thread *t)
 {
-    t->static_objects = END_OF_STATIC_LIST;
-    t->scavenged_static_objects = END_OF_STATIC_LIST;
+    t->static_objects = END_OF_STATIC_OBJECT_LIST;
+    t->scavenged_static_objects = END_OF_STATIC_OBJECT_LIST;
     t->scan_bd = NULL;
     t->mut_lists = t->cap->mut_lists;
     t->evac_gen_no = 0;
@@ -1434,9 +2275,12 @@ init_gc_thread (gc_thread *t)
     t->thunk_selector_depth = 0;
     t->copied = 0;
     t->scanned = 0;
+    t->pinned_evacd = 0;
+    t->stack_scanned = 0;
     t->any_work = 0;
     t->no_work = 0;
     t->scav_find_work = 0;
+    t->mut_list_dups = 0;
 }
 
 /* -----------------------------------------------------------------------------
@@ -1462,22 +2306,53 @@ mark_root(void *user USED_IF_THREADS, StgClosure **root)
     SET_GCT(saved_gct);
 }
 
-/* -----------------------------------------------------------------------------
-   Initialising the static object & mutable lists
-   -------------------------------------------------------------------------- */
+/* ----------------------------------------------------------------------------
+   GC overhead target (+RTS --gc-overhead)
+
+   The time a major GC takes depends on the live data, and the time
+   between two of them on how far the oldest generation may grow, -F
+   times the live data.  So the share of the CPU time that goes to
+   major GCs is roughly inversely proportional to -F, and at each major
+   GC we scale -F by the ratio of the share of the CPU time spent in GC
+   since the last one (minor GCs included) to the target.  The share of
+   minor GCs doesn't depend on -F, so we limit each step to a factor of
+   2, and -F to between GC_OVERHEAD_MIN_F and GC_OVERHEAD_MAX_F.  The
+   heap limits (-M, --soft-heap-limit) still apply: resize_generations()
+   lowers the size of the generations as the heap nears them, whatever
+   -F is.
+   ------------------------------------------------------------------------- */
+
+#define GC_OVERHEAD_MIN_F 1.0
+#define GC_OVERHEAD_MAX_F 64.0
+
+static Time overhead_last_cpu    = 0;  // process CPU time at the last major GC
+static Time overhead_last_gc_cpu = 0;  // of which in GC
 
 static void
-zero_static_object_list(StgClosure* first_static)
+tune_old_gen_factor (void)
 {
-  StgClosure* p;
-  StgClosure* link;
-  const StgInfoTable *info;
-
-  for (p = first_static; p != END_OF_STATIC_LIST; p = link) {
-    info = get_itbl(p);
-    link = *STATIC_LINK(info, p);
-    *STATIC_LINK(info,p) = NULL;
-  }
+    Time cpu, gc_cpu;
+    double share, ratio, f;
+
+    cpu = getProcessCPUTime();
+    // the GCs before this one, and this one so far
+    gc_cpu = stat_totalGCCpu() + (cpu - gct->gc_start_cpu);
+
+    if (overhead_last_cpu != 0 && cpu > overhead_last_cpu) {
+        share = (double)(gc_cpu - overhead_last_gc_cpu)
+              / (double)(cpu - overhead_last_cpu);
+        ratio = share / RtsFlags.GcFlags.gcOverhead;
+        ratio = stg_min(stg_max(ratio, 0.5), 2.0);
+        f = RtsFlags.GcFlags.oldGenFactor * ratio;
+        RtsFlags.GcFlags.oldGenFactor =
+            stg_min(stg_max(f, GC_OVERHEAD_MIN_F), GC_OVERHEAD_MAX_F);
+
+        debugTrace(DEBUG_gc, "gc overhead: %.1f%%, -F%.2f",
+                   share * 100, RtsFlags.GcFlags.oldGenFactor);
+    }
+
+    overhead_last_cpu = cpu;
+    overhead_last_gc_cpu = gc_cpu;
 }
 
 /* ----------------------------------------------------------------------------
@@ -1497,7 +2372,15 @@ resize_generations (void)
     if (major_gc && RtsFlags.GcFlags.generations > 1) {
         W_ live, size, min_alloc, words;
         const W_ max  = RtsFlags.GcFlags.maxHeapSize;
-        const W_ gens = RtsFlags.GcFlags.generations;
+        // a soft limit is lower than max (see normaliseRtsOpts())
+        const W_ soft = RtsFlags.GcFlags.softHeapLimit;
+        const W_ limit = soft != 0 ? soft : max;
+        // the aging generations don't grow with the old ones
+        const W_ gens = RtsFlags.GcFlags.generations - last_aging_gen;
+
+        if (RtsFlags.GcFlags.gcOverhead != 0) {
+            tune_old_gen_factor();
+        }
 
         // live in the oldest generations
         if (oldest_gen->live_estimate != 0) {
@@ -1506,7 +2389,7 @@ resize_generations (void)
             words = oldest_gen->n_words;
         }
         live = (words + BLOCK_SIZE_W - 1) / BLOCK_SIZE_W +
-            oldest_gen->n_large_blocks;
+            oldest_gen->n_large_blocks + oldest_gen->n_compact_blocks;
 
         // default max size for all generations except zero
         size = stg_max(live * RtsFlags.GcFlags.oldGenFactor,
@@ -1525,11 +2408,12 @@ resize_generations (void)
                             RtsFlags.GcFlags.minAllocAreaSize);
 
         // Auto-enable compaction when the residency reaches a
-        // certain percentage of the maximum heap size (default: 30%).
+        // certain percentage of the maximum heap size (default: 30%),
+        // or of the soft limit if there is one.
         if (RtsFlags.GcFlags.compact ||
-            (max > 0 &&
+            (limit > 0 &&
              oldest_gen->n_blocks >
-             (RtsFlags.GcFlags.compactThreshold * max) / 100)) {
+             (RtsFlags.GcFlags.compactThreshold * limit) / 100)) {
             oldest_gen->mark = 1;
             oldest_gen->compact = 1;
 //        debugBelch("compaction: on\n", live);
@@ -1539,10 +2423,37 @@ resize_generations (void)
 //        debugBelch("compaction: off\n", live);
         }
 
+        // The compactor would have to update the pointers out of the
+        // frozen heap (see Freeze.c), which it doesn't know how to find
+        // exactly once each, so we copy or sweep instead.
+        if (n_frozen_blocks != 0) {
+            oldest_gen->mark = 0;
+            oldest_gen->compact = 0;
+        }
+
         if (RtsFlags.GcFlags.sweep) {
             oldest_gen->mark = 1;
         }
 
+        // Under a soft limit, size the generations as we would for -M
+        // with the soft limit, so that major GCs come sooner the closer
+        // the heap gets to it.  But unlike -M we never give up: leave
+        // at least minOldGenSize to promote into above the live data,
+        // so that we don't do a major GC every time.
+        if (soft != 0) {
+            W_ soft_size = 0;
+            if (soft > min_alloc) {
+                if (oldest_gen->compact) {
+                    soft_size = (soft - min_alloc) / ((gens - 1) * 2 - 1);
+                } else {
+                    soft_size = (soft - min_alloc) / ((gens - 1) * 2);
+                }
+            }
+            soft_size = stg_max(soft_size,
+                                live + RtsFlags.GcFlags.minOldGenSize);
+            size = stg_min(size, soft_size);
+        }
+
         // if we're going to go over the maximum heap size, reduce the
         // size of the generations accordingly.  The calculation is
         // different if compaction is turned on, because we don't need
@@ -1643,11 +2554,15 @@ resize_nursery (void)
     }
     else  // Generational collector
     {
+        if (RtsFlags.GcFlags.autoNursery)
+        {
+            resize_nursery_auto();
+        }
         /*
          * If the user has given us a suggested heap size, adjust our
          * allocation area to make best use of the memory available.
          */
-        if (RtsFlags.GcFlags.heapSizeSuggestion)
+        else if (RtsFlags.GcFlags.heapSizeSuggestion)
         {
             long blocks;
             StgWord needed;
@@ -1700,6 +2615,75 @@ resize_nursery (void)
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Automatic nursery sizing (+RTS --auto-nursery)
+
+   A larger nursery means fewer minor GCs.  The work done by each minor
+   GC depends mostly on how much survives, not on the nursery size, so
+   a larger nursery means less time in GC overall, up to the point where
+   the nursery no longer fits in the cache.  It also means that more
+   data is live at each GC, so pauses grow.
+
+   We start each Capability off with its share of the last-level cache,
+   and after every minor GC we double the nursery if the pause was less
+   than half of the target (so that doubling would probably still be
+   within the target), or halve it if the pause went over the target.
+   The size is kept between -A and AUTO_NURSERY_MAX_LLC times the cache
+   share (and a quarter of -M, if given).
+   -------------------------------------------------------------------------- */
+
+#define AUTO_NURSERY_DEFAULT_LLC (4 * 1024 * 1024)  // if we can't find out
+#define AUTO_NURSERY_MAX_LLC     64
+
+static W_ auto_nursery_blocks = 0;  // per Capability, 0 until the first GC
+
+static void
+resize_nursery_auto (void)
+{
+    W_ llc_blocks, min_blocks, max_blocks;
+    StgWord64 llc;
+    Time pause, target;
+
+    llc = getLastLevelCacheSize();
+    if (llc == 0) {
+        llc = AUTO_NURSERY_DEFAULT_LLC;
+    }
+    llc_blocks = stg_max((W_)(llc / BLOCK_SIZE / n_capabilities), 1);
+
+    min_blocks = RtsFlags.GcFlags.minAllocAreaSize;
+    max_blocks = stg_max(min_blocks, llc_blocks * AUTO_NURSERY_MAX_LLC);
+    if (RtsFlags.GcFlags.maxHeapSize != 0) {
+        max_blocks = stg_min(max_blocks,
+                             stg_max(min_blocks,
+                                     RtsFlags.GcFlags.maxHeapSize / 4
+                                     / n_capabilities));
+    }
+
+    if (auto_nursery_blocks == 0) {
+        auto_nursery_blocks = llc_blocks;
+    }
+    else if (N == 0)
+    {
+        // pauses of major GCs say little about the nursery, so we only
+        // look at minor GCs.
+        target = RtsFlags.GcFlags.autoNurseryPause;
+        pause = getProcessElapsedTime() - gct->gc_start_elapsed;
+        if (pause > target) {
+            auto_nursery_blocks /= 2;
+        } else if (pause < target / 2) {
+            auto_nursery_blocks *= 2;
+        }
+    }
+
+    auto_nursery_blocks = stg_min(stg_max(auto_nursery_blocks, min_blocks),
+                                  max_blocks);
+
+    debugTrace(DEBUG_gc, "auto nursery: %ld blocks per capability",
+               (long)auto_nursery_blocks);
+
+    resizeNurseries(auto_nursery_blocks * n_capabilities);
+}
+
 /* -----------------------------------------------------------------------------
    Sanity code for CAF garbage collection.
 
@@ -1725,13 +2709,14 @@ static void gcCAFs(void)
     p = debug_caf_list;
     prev = NULL;
 
-    for (p = debug_caf_list; p != (StgIndStatic*)END_OF_STATIC_LIST;
+    for (p = debug_caf_list; p != (StgIndStatic*)END_OF_CAF_LIST;
          p = (StgIndStatic*)p->saved_info) {
 
         info = get_itbl((StgClosure*)p);
         ASSERT(info->type == IND_STATIC);
 
-        if (p->static_link == NULL) {
+        // not reached by this GC?  See Note [STATIC_LINK fields]
+        if (((StgWord)p->static_link & STATIC_BITS) != static_flag) {
             debugTrace(DEBUG_gccafs, "CAF gc'd at 0x%p", p);
             SET_INFO((StgClosure*)p,&stg_GCD_CAF_info); // stub it
             if (prev == NULL) {
@@ -34,8 +34,22 @@ extern StgPtr mark_sp;
 
 extern long copied;
 
+// entries of the mutable lists (remembered sets) scanned in this GC,
+// and the duplicates among them that were dropped
+extern W_ mut_list_entries;
+extern W_ mut_list_dups;
+
+extern W_ stack_words_scanned;
+
 extern rtsBool work_stealing;
 
+// GC threads with work to do, or that have not yet finished looking
+// for it; the GC is over when this drops to zero.
+extern volatile StgWord gc_running_threads;
+// bumped when a block is pushed for other threads to steal while
+// some GC thread is idle (see scavenge_until_all_done())
+extern volatile StgWord gc_work_pushed;
+
 #ifdef DEBUG
 extern nat mutlist_MUTVARS, mutlist_MUTARRS, mutlist_MVARS, mutlist_OTHERS,
     mutlist_TVAR,
@@ -50,13 +64,21 @@ extern nat mutlist_MUTVARS, mutlist_MUTARRS, mutlist_MVARS, mutlist_OTHERS,
 extern StgWord64 whitehole_spin;
 #endif
 
+// weak pointer rounds, see Note [Parallel weak pointers] in MarkWeak.c
+void startWeakRound (nat work);
+
 void gcWorkerThread (Capability *cap);
+void runOnGcThreads (void (*job)(nat me));
 void initGcThreads (nat from, nat to);
 void freeGcThreads (void);
 
 #if defined(THREADED_RTS)
-void waitForGcThreads (Capability *cap);
+void waitForGcThreads (Capability *cap, nat *last_cap,
+                       StgWord64 *last_thread);
 void releaseGCThreads (Capability *cap);
+
+// how many GC threads would be worth using to collect gen (+RTS -qn)
+nat gcThreadsWanted (nat gen);
 #endif
 
 #define WORK_UNIT_WORDS 128
@@ -13,6 +13,7 @@
 #include "GC.h"
 #include "Storage.h"
 #include "Compact.h"
+#include "CNF.h"
 #include "Task.h"
 #include "Capability.h"
 #include "Trace.h"
@@ -65,6 +66,13 @@ isAlive(StgClosure *p)
         return p;
     }
 
+    // a compact region is alive or dead as a whole, and its first
+    // block has the evacuated flag
+    if (bd->flags & BF_COMPACT) {
+        bd = Bdescr((P_)objectGetCompact(q));
+        return (bd->flags & BF_EVACUATED) ? p : NULL;
+    }
+
     // large objects use the evacuated flag
     if (bd->flags & BF_LARGE) {
         return NULL;
@@ -118,14 +126,15 @@ revertCAFs( void )
     StgIndStatic *c;
 
     for (c = revertible_caf_list;
-         c != (StgIndStatic *)END_OF_STATIC_LIST;
+         c != (StgIndStatic *)END_OF_CAF_LIST;
          c = (StgIndStatic *)c->static_link)
     {
+        c = (StgIndStatic *)UNTAG_STATIC_LIST_PTR(c);
         SET_INFO((StgClosure *)c, c->saved_info);
         c->saved_info = NULL;
         // could, but not necessary: c->static_link = NULL;
     }
-    revertible_caf_list = (StgIndStatic*)END_OF_STATIC_LIST;
+    revertible_caf_list = (StgIndStatic*)END_OF_CAF_LIST;
 }
 
 void
@@ -134,15 +143,17 @@ markCAFs (evac_fn evac, void *user)
     StgIndStatic *c;
 
     for (c = dyn_caf_list;
-         c != (StgIndStatic*)END_OF_STATIC_LIST;
+         c != (StgIndStatic*)END_OF_CAF_LIST;
          c = (StgIndStatic *)c->static_link)
     {
+        c = (StgIndStatic *)UNTAG_STATIC_LIST_PTR(c);
         evac(user, &c->indirectee);
     }
     for (c = revertible_caf_list;
-         c != (StgIndStatic*)END_OF_STATIC_LIST;
+         c != (StgIndStatic*)END_OF_CAF_LIST;
          c = (StgIndStatic *)c->static_link)
     {
+        c = (StgIndStatic *)UNTAG_STATIC_LIST_PTR(c);
         evac(user, &c->indirectee);
     }
 }
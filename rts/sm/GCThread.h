@@ -92,6 +92,11 @@ typedef struct gen_workspace_ {
     // where large objects to be scavenged go
     bdescr *     todo_large_objects;
 
+    // Large objects that have already been scavenged, linked through
+    // bd->u.back (see evacuate_large())
+    bdescr *     scavd_large_objects;
+    StgWord      n_scavd_large_blocks;
+
     // Objects that have already been scavenged.
     bdescr *     scavd_list;
     nat          n_scavd_blocks;     // count of blocks in this list
@@ -100,7 +105,7 @@ typedef struct gen_workspace_ {
     bdescr *     part_list;
     unsigned int n_part_blocks;      // count of above
 
-    StgWord pad[3];
+    StgWord pad[1];
 
 } gen_workspace ATTRIBUTE_ALIGNED(64);
 // align so that computing gct->gens[n] is a shift, not a multiply
@@ -116,16 +121,27 @@ typedef struct gen_workspace_ {
    ------------------------------------------------------------------------- */
 
 typedef struct gc_thread_ {
-    Capability *cap;
-
 #ifdef THREADED_RTS
-    OSThreadId id;                 // The OS thread that this struct belongs to
+    // Written by the GC leader as well as by this thread, to start and
+    // stop it (see wakeup_gc_threads() and friends in GC.c).  The
+    // fields from cap on, which only this thread writes during the
+    // GC, start on the next cache line, so that they don't bounce
+    // between CPUs while the leader waits for the others.  What the
+    // other threads read while looking for work (in any_work() and
+    // when stealing) is in the gen_workspaces, which have cache lines
+    // of their own.
     SpinLock   gc_spin;
     SpinLock   mut_spin;
     volatile StgWord wakeup;       // NB not StgWord8; only StgWord is guaranteed atomic
+    rtsBool idle;                  // sitting out of this GC cycle
+
+    Capability *cap ATTRIBUTE_ALIGNED(64);
+    OSThreadId id;                 // The OS thread that this struct belongs to
+#else
+    Capability *cap;
+    rtsBool idle;                  // sitting out of this GC cycle
 #endif
     nat thread_index;              // a zero based index identifying the thread
-    rtsBool idle;                  // sitting out of this GC cycle
 
     bdescr * free_blocks;          // a buffer of free blocks for this thread
                                    //  during GC without accessing the block
@@ -134,6 +150,10 @@ typedef struct gc_thread_ {
     StgClosure* static_objects;      // live static objects
     StgClosure* scavenged_static_objects;   // static objects scavenged so far
 
+    StgWeak *   old_weak_ptrs;       // our share of the weak pointers whose
+                                     // keys are not known to be alive yet
+                                     // (see MarkWeak.c)
+
     W_ gc_count;                 // number of GCs this thread has done
 
     // block that is currently being scanned
@@ -178,9 +198,13 @@ typedef struct gc_thread_ {
 
     W_ copied;
     W_ scanned;
+    W_ pinned_evacd;            // words of pinned large objects, which
+                                // are evacuated without being scanned
+    W_ stack_scanned;           // words of stack chunks scavenged
     W_ any_work;
     W_ no_work;
     W_ scav_find_work;
+    W_ mut_list_dups;
 
     Time gc_start_cpu;   // process CPU time
     Time gc_start_elapsed;  // process elapsed time
@@ -30,22 +30,44 @@
 SpinLock gc_alloc_block_sync;
 #endif
 
+// Blocks allocated during GC come from the NUMA node of the
+// Capability that the current GC thread belongs to, so that each GC
+// thread copies into memory local to the CPU it is running on.
+
 bdescr *
-allocBlock_sync(void)
+allocBlockOnNode_sync(nat node)
 {
     bdescr *bd;
     ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
-    bd = allocBlock();
+    bd = allocBlockOnNode(node);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
     return bd;
 }
 
+// The GC thread for a Capability has exclusive use of its block
+// cache while the GC is running.
+bdescr *
+allocBlock_sync(void)
+{
+    bdescr *bd;
+    Capability *cap = gct->cap;
+
+    bd = allocBlockCached(cap);
+    if (bd == NULL) {
+        ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
+        refillBlockCache(cap);
+        RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
+        bd = allocBlockCached(cap);
+    }
+    return bd;
+}
+
 static bdescr *
 allocGroup_sync(nat n)
 {
     bdescr *bd;
     ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
-    bd = allocGroup(n);
+    bd = allocGroupOnNode(gct->cap->node, n);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
     return bd;
 }
@@ -115,12 +137,12 @@ grab_local_todo_block (gen_workspace *ws)
 bdescr *
 steal_todo_block (nat g)
 {
-    nat n;
+    nat i, n;
     bdescr *bd;
 
-    // look for work to steal
-    for (n = 0; n < n_gc_threads; n++) {
-        if (n == gct->thread_index) continue;
+    // look for work to steal, starting with our neighbour (c.f. any_work())
+    for (i = 1; i < n_gc_threads; i++) {
+        n = (gct->thread_index + i) % n_gc_threads;
         bd = stealWSDeque(gc_threads[n]->gens[g].todo_q);
         if (bd) {
             return bd;
@@ -130,6 +152,77 @@ steal_todo_block (nat g)
 }
 #endif
 
+/* -----------------------------------------------------------------------------
+   The pool of large arrays that the GC threads scavenge together.
+
+   Items are only added during a GC, and the pool is emptied before the
+   next one starts, so an item never moves or goes away while a GC
+   thread may be looking at it.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+static arr_work arr_works[MAX_ARR_WORK];
+static volatile StgWord n_arr_works = 0;
+
+void
+reset_arr_work (void)
+{
+    nat i;
+
+    for (i = 0; i < stg_min(n_arr_works, MAX_ARR_WORK); i++) {
+        arr_works[i].arr = NULL;
+    }
+    n_arr_works = 0;
+}
+
+// Returns an item for the caller to fill in and publish by setting
+// its arr field, or NULL if the pool is full.
+arr_work *
+new_arr_work (void)
+{
+    StgWord i;
+
+    i = atomic_inc(&n_arr_works, 1) - 1;
+    if (i >= MAX_ARR_WORK) {
+        return NULL;
+    }
+    return &arr_works[i];
+}
+
+arr_work *
+grab_arr_work (StgWord *chunk)
+{
+    StgWord i, n, c;
+    arr_work *w;
+
+    n = stg_min(n_arr_works, MAX_ARR_WORK);
+    for (i = 0; i < n; i++) {
+        w = &arr_works[i];
+        if (w->arr == NULL || w->next_chunk >= w->n_chunks) continue;
+        c = atomic_inc(&w->next_chunk, 1) - 1;
+        if (c < w->n_chunks) {
+            *chunk = c;
+            return w;
+        }
+    }
+    return NULL;
+}
+
+rtsBool
+looksEmptyArrWork (void)
+{
+    StgWord i, n;
+    arr_work *w;
+
+    n = stg_min(n_arr_works, MAX_ARR_WORK);
+    for (i = 0; i < n; i++) {
+        w = &arr_works[i];
+        if (w->arr != NULL && w->next_chunk < w->n_chunks) return rtsFalse;
+    }
+    return rtsTrue;
+}
+#endif
+
 void
 push_scanned_block (bdescr *bd, gen_workspace *ws)
 {
@@ -258,6 +351,11 @@ todo_block_full (nat size, gen_workspace *ws)
                 bd->link = ws->todo_overflow;
                 ws->todo_overflow = bd;
                 ws->n_todo_overflow++;
+            } else if (gc_running_threads < n_gc_threads) {
+                // some thread is idle; let it know there is work to
+                // steal (a lost update doesn't matter, it only has to
+                // change)
+                gc_work_pushed++;
             }
         }
     }
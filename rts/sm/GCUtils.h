@@ -19,6 +19,7 @@
 #include "GCTDecl.h"
 
 bdescr *allocBlock_sync(void);
+bdescr *allocBlockOnNode_sync(nat node);
 void    freeChain_sync(bdescr *bd);
 
 void    push_scanned_block   (bdescr *bd, gen_workspace *ws);
@@ -30,6 +31,28 @@ bdescr *grab_local_todo_block  (gen_workspace *ws);
 bdescr *steal_todo_block       (nat s);
 #endif
 
+#if defined(THREADED_RTS)
+// A large array being scavenged in pieces by all the GC threads: see
+// "Splitting large arrays" in Scav.c.
+typedef struct {
+    StgMutArrPtrs *arr;              // NULL until the item is ready
+    nat            gen_no;           // evac_gen_no to scavenge it with
+    rtsBool        mutable;          // MUT_ARR_PTRS_{CLEAN,DIRTY}
+    StgWord        n_chunks;
+    volatile StgWord next_chunk;     // the next chunk to claim
+    volatile StgWord done_chunks;    // chunks scavenged
+    volatile StgWord failed;         // a chunk had failed_to_evac
+} arr_work;
+
+#define ARR_WORK_CHUNK_CARDS 64
+#define MAX_ARR_WORK         64
+
+void      reset_arr_work    (void);
+arr_work *new_arr_work      (void);
+arr_work *grab_arr_work     (StgWord *chunk);
+rtsBool   looksEmptyArrWork (void);
+#endif
+
 // Returns true if a block is partially full.  This predicate is used to try
 // to re-use partial blocks wherever possible, and to reduce wastage.
 // We might need to tweak the actual value.
@@ -63,6 +86,25 @@ recordMutableGen_GC (StgClosure *p, nat gen_no)
     *bd->free++ = (StgWord)p;
 }
 
+// Software prefetching, for RTSs built with GcPrefetch=YES: see
+// evacuate_ptrs() in Scav.c.  GC_PREFETCH_DIST is how many fields ahead
+// of the one being evacuated we prefetch.  evacuate() looks at the
+// block descriptor of the object before the object itself, so we
+// prefetch both; for a static object the descriptor address is
+// meaningless, but a prefetch doesn't fault.
+#if defined(GC_PREFETCH)
+#ifndef GC_PREFETCH_DIST
+#define GC_PREFETCH_DIST 4
+#endif
+#define prefetch_closure(c) \
+    do { \
+        StgPtr p_ = (StgPtr)UNTAG_CLOSURE((StgClosure *)(c)); \
+        __builtin_prefetch(Bdescr(p_), 0, 3); \
+        __builtin_prefetch(p_, 0, 3); \
+    } while (0)
+#define prefetch_to_space(p) __builtin_prefetch((p), 1, 3)
+#endif
+
 #include "EndPrivate.h"
 
 #endif /* SM_GCUTILS_H */
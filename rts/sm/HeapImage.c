@@ -0,0 +1,834 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Heap images: saving the values of the evaluated CAFs to a file, so
+ * that the next run of the same program can start with them instead
+ * of evaluating them again.
+ *
+ * A program that spends its first seconds building big tables in CAFs
+ * calls saveHeapImage() (System.Mem.saveHeapImage) once they are
+ * built, with +RTS --heap-image=<file>.  That does a major GC, and at
+ * the end of it, when the static objects that the GC found are still
+ * linked together, writeHeapImage() copies the value of each live
+ * evaluated CAF (an IND_STATIC) into the image, with everything it
+ * refers to in the heap.  A later run with the same flag reads the
+ * image before any Haskell code runs (restoreHeapImage()), puts the
+ * copies into fresh blocks of the oldest generation and makes each
+ * CAF an IND_STATIC pointing at its value, as if the program had just
+ * evaluated it.
+ *
+ * The copies are laid out in blocks, as they will be in the heap: the
+ * small closures of the image are packed into chunks of one block,
+ * and each large one has a chunk to itself, which becomes a large
+ * object.  So that the image can be read into blocks at any address,
+ * it records the position of each pointer it holds:
+ *
+ *   - a pointer to a closure in the image is written as the closure's
+ *     byte offset in the image, plus the tag, and listed in the heap
+ *     relocations;
+ *
+ *   - info pointers and pointers to static closures are written as
+ *     they are, and listed in the text relocations: in the next run
+ *     they are only out by the distance the program was loaded at
+ *     from where it was loaded when the image was written.
+ *
+ * That only works for a program that is a single executable, as a
+ * statically linked one is: a value is only saved if all the code and
+ * static closures it refers to are in the executable, between
+ * __executable_start and _end, and an image is only read back by the
+ * same executable file, as /proc/self/exe tells us.  Hence heap images
+ * are only supported on Linux, and not when profiling, which would
+ * also need the cost centres in the image.
+ *
+ * Only immutable values are saved: constructors, functions, thunks,
+ * selector thunks, frozen arrays and unpinned byte arrays.  A CAF
+ * whose value refers to anything else (a mutable object, a PAP, a
+ * thunk under evaluation, a pinned byte array that an Addr# may point
+ * into) is left out of the image and is evaluated again in the next
+ * run, as usual.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "GC.h"
+#include "HeapImage.h"
+#include "GCThread.h"
+#include "GCTDecl.h"
+#include "RtsUtils.h"
+#include "Hash.h"
+#include "Trace.h"
+
+#include <string.h>
+
+#if defined(linux_HOST_OS) && !defined(PROFILING)
+#define HEAP_IMAGES
+#endif
+
+#if defined(HEAP_IMAGES)
+#include <errno.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+volatile rtsBool heap_image_requested = rtsFalse;
+
+void
+saveHeapImage (void)
+{
+#if defined(HEAP_IMAGES)
+    if (RtsFlags.MiscFlags.heapImage == NULL) {
+        errorBelch("saveHeapImage: no image file "
+                   "(use +RTS --heap-image=<file>)");
+        return;
+    }
+    heap_image_requested = rtsTrue;
+    performMajorGC();
+#else
+    errorBelch("saveHeapImage: heap images are not supported by this RTS");
+#endif
+}
+
+#if defined(HEAP_IMAGES)
+
+// the bounds of the executable, defined by the linker
+extern char __executable_start[];
+extern char _end[];
+
+#define HEAP_IMAGE_MAGIC   ((StgWord64)0x48494d4147453031ULL) // "HIMAGE01"
+
+typedef struct {
+    StgWord64 magic;
+    StgWord64 word_size;
+    StgWord64 block_size;
+    StgWord64 exe_size;         // the executable file, for telling
+    StgWord64 exe_mtime;        //   whether the image is ours
+    StgWord64 exe_ino;
+    StgWord64 exe_length;       // _end - __executable_start
+    StgWord64 exe_start;        // __executable_start when written
+    StgWord64 n_blocks;
+    StgWord64 n_chunks;
+    StgWord64 n_text_relocs;
+    StgWord64 n_heap_relocs;
+    StgWord64 n_cafs;
+} HeapImageHeader;
+
+typedef struct {
+    StgWord first_block;        // in the image
+    StgWord blocks;
+    StgWord words;              // used
+    StgWord large;
+} ImageChunk;
+
+typedef struct {
+    StgWord caf;                // address when written
+    StgWord value;              // as in the image's pointer fields
+    StgWord in_heap;            // value is an offset into the image
+} ImageCAF;
+
+typedef struct {
+    StgClosure *p;              // in the heap
+    W_          at;             // word offset of its copy
+} ImageTodo;
+
+#define NO_CHUNK ((W_)-1)
+
+typedef struct {
+    StgWord    *data;           // n_blocks blocks
+    W_          n_blocks, max_blocks;
+    ImageChunk *chunks;
+    W_          n_chunks, max_chunks;
+    W_          small;          // chunk the small closures go in
+    StgWord    *text_relocs;    // word offsets
+    W_          n_text_relocs, max_text_relocs;
+    StgWord    *heap_relocs;    // word offsets
+    W_          n_heap_relocs, max_heap_relocs;
+    ImageCAF   *cafs;
+    W_          n_cafs, max_cafs;
+    HashTable  *copied;         // closure -> 1 + byte offset of its copy
+    StgClosure **added;         // closures copied for the current CAF
+    W_          n_added, max_added;
+    ImageTodo  *todo;           // copied but not yet scanned
+    W_          n_todo, max_todo;
+} HeapImage;
+
+// Make room for one more element of an array of size bytes each
+static void *
+grow (void *p, W_ n, W_ *max, W_ size)
+{
+    if (n < *max) return p;
+    *max = *max == 0 ? 64 : *max * 2;
+    return stgReallocBytes(p, *max * size, "heap image");
+}
+
+#define PUSH(arr, n, max, x)                                            \
+    do {                                                                \
+        (arr) = grow((arr), (n), &(max), sizeof(*(arr)));               \
+        (arr)[(n)++] = (x);                                             \
+    } while (0)
+
+STATIC_INLINE rtsBool
+in_program (void *p)
+{
+    return (char *)p >= __executable_start && (char *)p < _end;
+}
+
+/* -----------------------------------------------------------------------------
+ * Writing the image
+ * -------------------------------------------------------------------------- */
+
+static ImageChunk *
+new_chunk (HeapImage *img, W_ blocks)
+{
+    ImageChunk *c;
+
+    if (img->n_blocks + blocks > img->max_blocks) {
+        img->max_blocks = stg_max(img->max_blocks * 2,
+                                  img->n_blocks + blocks);
+        img->data = stgReallocBytes(img->data,
+                                    img->max_blocks * BLOCK_SIZE,
+                                    "heap image");
+    }
+    // zero the slop at the end of the chunk
+    memset(&img->data[img->n_blocks * BLOCK_SIZE_W], 0, blocks * BLOCK_SIZE);
+
+    img->chunks = grow(img->chunks, img->n_chunks, &img->max_chunks,
+                       sizeof(ImageChunk));
+    c = &img->chunks[img->n_chunks++];
+    c->first_block = img->n_blocks;
+    c->blocks = blocks;
+    c->words = 0;
+    c->large = 0;
+    img->n_blocks += blocks;
+    return c;
+}
+
+// Room for a closure of n words in the image; returns its word offset
+static W_
+image_alloc (HeapImage *img, W_ n)
+{
+    ImageChunk *c;
+    W_ at;
+
+    if (n >= LARGE_OBJECT_THRESHOLD/sizeof(W_)) {
+        c = new_chunk(img, BLOCK_ROUND_UP(n * sizeof(W_)) / BLOCK_SIZE);
+        c->large = 1;
+        c->words = n;
+        return c->first_block * BLOCK_SIZE_W;
+    }
+
+    if (img->small == NO_CHUNK ||
+        img->chunks[img->small].words + n > BLOCK_SIZE_W) {
+        new_chunk(img, 1);
+        img->small = img->n_chunks - 1;
+    }
+    c = &img->chunks[img->small];
+    at = c->first_block * BLOCK_SIZE_W + c->words;
+    c->words += n;
+    return at;
+}
+
+static rtsBool
+can_copy (StgClosure *p, const StgInfoTable *info)
+{
+    switch (info->type) {
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_0_1:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case CONSTR_0_2:
+    case FUN:
+    case FUN_1_0:
+    case FUN_0_1:
+    case FUN_2_0:
+    case FUN_1_1:
+    case FUN_0_2:
+    case THUNK:
+    case THUNK_1_0:
+    case THUNK_0_1:
+    case THUNK_2_0:
+    case THUNK_1_1:
+    case THUNK_0_2:
+    case THUNK_SELECTOR:
+    case MUT_ARR_PTRS_FROZEN0:
+    case MUT_ARR_PTRS_FROZEN:
+    case SMALL_MUT_ARR_PTRS_FROZEN0:
+    case SMALL_MUT_ARR_PTRS_FROZEN:
+        return rtsTrue;
+
+    case ARR_WORDS:
+        // an Addr# may point into a pinned array, and we wouldn't know
+        // to relocate it
+        return (Bdescr((StgPtr)p)->flags & BF_PINNED) == 0;
+
+    default:
+        return rtsFalse;
+    }
+}
+
+// Find what q stands for in the image, copying it if need be: the
+// encoded pointer goes in *value, and *in_heap says whether it points
+// into the image.  Fails if q refers to something we can't save.
+static rtsBool
+image_encode (HeapImage *img, StgClosure *q, StgWord *value,
+              rtsBool *in_heap)
+{
+    StgClosure *p, *r;
+    const StgInfoTable *info, *i;
+    void *copied;
+    W_ size, at;
+
+    for (;;) {
+        p = UNTAG_CLOSURE(q);
+
+        if (!HEAP_ALLOCED_GC(p)) {
+            if (!in_program(p)) return rtsFalse;
+            *value = (StgWord)q;
+            *in_heap = rtsFalse;
+            return rtsTrue;
+        }
+
+        info = get_itbl(p);
+        if (info->type == IND || info->type == IND_PERM) {
+            q = ((StgInd *)p)->indirectee;
+            continue;
+        }
+        if (info->type == BLACKHOLE) {
+            r = ((StgInd *)p)->indirectee;
+            if (GET_CLOSURE_TAG(r) == 0) {
+                i = r->header.info;
+                if (i == &stg_TSO_info
+                    || i == &stg_WHITEHOLE_info
+                    || i == &stg_BLOCKING_QUEUE_CLEAN_info
+                    || i == &stg_BLOCKING_QUEUE_DIRTY_info) {
+                    // still being evaluated
+                    return rtsFalse;
+                }
+            }
+            q = r;
+            continue;
+        }
+        break;
+    }
+
+    copied = lookupHashTable(img->copied, (StgWord)p);
+    if (copied != NULL) {
+        *value = ((StgWord)copied - 1) + GET_CLOSURE_TAG(q);
+        *in_heap = rtsTrue;
+        return rtsTrue;
+    }
+
+    if (!can_copy(p, info)) return rtsFalse;
+
+    size = closure_sizeW_(p, (StgInfoTable *)info);
+    at = image_alloc(img, size);
+    memcpy(&img->data[at], p, size * sizeof(W_));
+
+    // a MUT_ARR_PTRS_FROZEN0 is on a mutable list, which the copy
+    // won't be
+    switch (info->type) {
+    case MUT_ARR_PTRS_FROZEN0:
+        SET_INFO((StgClosure *)&img->data[at], &stg_MUT_ARR_PTRS_FROZEN_info);
+        break;
+    case SMALL_MUT_ARR_PTRS_FROZEN0:
+        SET_INFO((StgClosure *)&img->data[at],
+                 &stg_SMALL_MUT_ARR_PTRS_FROZEN_info);
+        break;
+    default:
+        break;
+    }
+
+    insertHashTable(img->copied, (StgWord)p, (void *)(at * sizeof(W_) + 1));
+    PUSH(img->added, img->n_added, img->max_added, p);
+    img->todo = grow(img->todo, img->n_todo, &img->max_todo,
+                     sizeof(ImageTodo));
+    img->todo[img->n_todo].p = p;
+    img->todo[img->n_todo].at = at;
+    img->n_todo++;
+
+    *value = at * sizeof(W_) + GET_CLOSURE_TAG(q);
+    *in_heap = rtsTrue;
+    return rtsTrue;
+}
+
+// Fill in the pointer field at word offset at of the image, which
+// holds q in the heap
+static rtsBool
+image_field (HeapImage *img, StgClosure *q, W_ at)
+{
+    StgWord value;
+    rtsBool in_heap;
+
+    if (!image_encode(img, q, &value, &in_heap)) return rtsFalse;
+    img->data[at] = value;
+    if (in_heap) {
+        PUSH(img->heap_relocs, img->n_heap_relocs, img->max_heap_relocs, at);
+    } else {
+        PUSH(img->text_relocs, img->n_text_relocs, img->max_text_relocs, at);
+    }
+    return rtsTrue;
+}
+
+// Fill in the info pointer and the pointer fields of the copy of p at
+// word offset at
+static rtsBool
+image_scan (HeapImage *img, StgClosure *p, W_ at)
+{
+    const StgInfoTable *info;
+    StgClosure **q, **end;
+
+    PUSH(img->text_relocs, img->n_text_relocs, img->max_text_relocs, at);
+
+    info = get_itbl(p);
+    switch (info->type) {
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_0_1:
+    case CONSTR_2_0:
+    case CONSTR_1_1:
+    case CONSTR_0_2:
+    case FUN:
+    case FUN_1_0:
+    case FUN_0_1:
+    case FUN_2_0:
+    case FUN_1_1:
+    case FUN_0_2:
+        q = p->payload;
+        end = q + info->layout.payload.ptrs;
+        break;
+
+    case THUNK:
+    case THUNK_1_0:
+    case THUNK_0_1:
+    case THUNK_2_0:
+    case THUNK_1_1:
+    case THUNK_0_2:
+        q = ((StgThunk *)p)->payload;
+        end = q + info->layout.payload.ptrs;
+        break;
+
+    case THUNK_SELECTOR:
+        q = &((StgSelector *)p)->selectee;
+        end = q + 1;
+        break;
+
+    case MUT_ARR_PTRS_FROZEN0:
+    case MUT_ARR_PTRS_FROZEN:
+        q = ((StgMutArrPtrs *)p)->payload;
+        end = q + ((StgMutArrPtrs *)p)->ptrs;
+        break;
+
+    case SMALL_MUT_ARR_PTRS_FROZEN0:
+    case SMALL_MUT_ARR_PTRS_FROZEN:
+        q = ((StgSmallMutArrPtrs *)p)->payload;
+        end = q + ((StgSmallMutArrPtrs *)p)->ptrs;
+        break;
+
+    case ARR_WORDS:
+        return rtsTrue;
+
+    default:
+        barf("image_scan: unexpected closure type %d", (int)info->type);
+    }
+
+    for (; q < end; q++) {
+        if (!image_field(img, *q, at + ((StgPtr)q - (StgPtr)p))) {
+            return rtsFalse;
+        }
+    }
+    return rtsTrue;
+}
+
+// Add the value of caf to the image, with everything it refers to, or
+// nothing if we can't save all of it
+static void
+image_caf (HeapImage *img, StgIndStatic *caf)
+{
+    W_ n_blocks, n_chunks, small, small_words, n_text, n_heap, i;
+    StgWord value;
+    rtsBool in_heap, ok;
+    ImageTodo t;
+
+    if (!in_program(caf)) return;
+
+    n_blocks = img->n_blocks;
+    n_chunks = img->n_chunks;
+    small = img->small;
+    small_words = small == NO_CHUNK ? 0 : img->chunks[small].words;
+    n_text = img->n_text_relocs;
+    n_heap = img->n_heap_relocs;
+
+    ok = image_encode(img, caf->indirectee, &value, &in_heap);
+    while (ok && img->n_todo > 0) {
+        t = img->todo[--img->n_todo];
+        ok = image_scan(img, t.p, t.at);
+    }
+
+    if (ok) {
+        img->cafs = grow(img->cafs, img->n_cafs, &img->max_cafs,
+                         sizeof(ImageCAF));
+        img->cafs[img->n_cafs].caf = (StgWord)caf;
+        img->cafs[img->n_cafs].value = value;
+        img->cafs[img->n_cafs].in_heap = in_heap;
+        img->n_cafs++;
+    } else {
+        for (i = 0; i < img->n_added; i++) {
+            removeHashTable(img->copied, (StgWord)img->added[i], NULL);
+        }
+        img->n_todo = 0;
+        img->n_blocks = n_blocks;
+        img->n_chunks = n_chunks;
+        img->small = small;
+        if (small != NO_CHUNK) img->chunks[small].words = small_words;
+        img->n_text_relocs = n_text;
+        img->n_heap_relocs = n_heap;
+    }
+    img->n_added = 0;
+}
+
+static nat
+image_statics (HeapImage *img, StgClosure *first_static)
+{
+    StgClosure *p;
+    nat n = 0;
+
+    for (p = first_static; p != END_OF_STATIC_OBJECT_LIST;
+         p = *STATIC_LINK(get_itbl(p), p)) {
+        p = UNTAG_STATIC_LIST_PTR(p);
+        if (get_itbl(p)->type == IND_STATIC) {
+            image_caf(img, (StgIndStatic *)p);
+            n++;
+        }
+    }
+    return n;
+}
+
+static rtsBool
+program_identity (HeapImageHeader *hdr)
+{
+    struct stat st;
+
+    if (stat("/proc/self/exe", &st) != 0) return rtsFalse;
+    hdr->exe_size = (StgWord64)st.st_size;
+    hdr->exe_mtime = (StgWord64)st.st_mtime;
+    hdr->exe_ino = (StgWord64)st.st_ino;
+    hdr->exe_length = (StgWord64)(_end - __executable_start);
+    return rtsTrue;
+}
+
+static void
+write_image (HeapImage *img)
+{
+    char *path = RtsFlags.MiscFlags.heapImage;
+    char *tmp;
+    FILE *f;
+    HeapImageHeader hdr;
+    rtsBool ok;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (!program_identity(&hdr)) {
+        sysErrorBelch("saveHeapImage: /proc/self/exe");
+        return;
+    }
+    hdr.magic = HEAP_IMAGE_MAGIC;
+    hdr.word_size = sizeof(W_);
+    hdr.block_size = BLOCK_SIZE;
+    hdr.exe_start = (StgWord64)(StgWord)__executable_start;
+    hdr.n_blocks = img->n_blocks;
+    hdr.n_chunks = img->n_chunks;
+    hdr.n_text_relocs = img->n_text_relocs;
+    hdr.n_heap_relocs = img->n_heap_relocs;
+    hdr.n_cafs = img->n_cafs;
+
+    // write a new file and rename it, so that a program starting up
+    // meanwhile reads either the old image or the new one
+    tmp = stgMallocBytes(strlen(path) + 5, "saveHeapImage");
+    strcpy(tmp, path);
+    strcat(tmp, ".tmp");
+
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        sysErrorBelch("saveHeapImage: %s", tmp);
+        stgFree(tmp);
+        return;
+    }
+
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+      && fwrite(img->chunks, sizeof(ImageChunk), img->n_chunks, f)
+             == img->n_chunks
+      && fwrite(img->data, BLOCK_SIZE, img->n_blocks, f) == img->n_blocks
+      && fwrite(img->text_relocs, sizeof(StgWord), img->n_text_relocs, f)
+             == img->n_text_relocs
+      && fwrite(img->heap_relocs, sizeof(StgWord), img->n_heap_relocs, f)
+             == img->n_heap_relocs
+      && fwrite(img->cafs, sizeof(ImageCAF), img->n_cafs, f) == img->n_cafs;
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok) {
+        sysErrorBelch("saveHeapImage: %s", tmp);
+        remove(tmp);
+    } else if (rename(tmp, path) != 0) {
+        sysErrorBelch("saveHeapImage: %s", path);
+        remove(tmp);
+    }
+    stgFree(tmp);
+}
+
+void
+writeHeapImage (void)
+{
+    HeapImage img;
+    nat i, n_cafs;
+
+    ASSERT(major_gc);
+
+    memset(&img, 0, sizeof(img));
+    img.small = NO_CHUNK;
+    img.copied = allocHashTable();
+
+    n_cafs = 0;
+    if (n_gc_threads == 1) {
+        n_cafs = image_statics(&img, gct->scavenged_static_objects);
+    } else {
+        for (i = 0; i < n_gc_threads; i++) {
+            if (!gc_threads[i]->idle) {
+                n_cafs += image_statics(
+                    &img, gc_threads[i]->scavenged_static_objects);
+            }
+        }
+    }
+
+    debugTrace(DEBUG_gc, "heap image: %" FMT_Word " of %u CAFs, %"
+               FMT_Word " blocks", img.n_cafs, n_cafs, img.n_blocks);
+
+    write_image(&img);
+
+    freeHashTable(img.copied, NULL);
+    stgFree(img.data);
+    stgFree(img.chunks);
+    stgFree(img.text_relocs);
+    stgFree(img.heap_relocs);
+    stgFree(img.cafs);
+    stgFree(img.added);
+    stgFree(img.todo);
+
+    heap_image_requested = rtsFalse;
+}
+
+/* -----------------------------------------------------------------------------
+ * Reading the image
+ * -------------------------------------------------------------------------- */
+
+// Read n elements of size bytes into a new array
+static void *
+read_array (FILE *f, W_ n, W_ size)
+{
+    void *p = stgMallocBytes(stg_max(n, 1) * size, "restoreHeapImage");
+    if (fread(p, size, n, f) != n) {
+        stgFree(p);
+        return NULL;
+    }
+    return p;
+}
+
+// The address in the heap of an image pointer field's value
+STATIC_INLINE StgWord
+restore_ptr (StgPtr *block_addr, StgWord value)
+{
+    StgWord tag = value & TAG_MASK;
+    StgWord off = value - tag;
+    return (StgWord)(block_addr[off / BLOCK_SIZE] +
+                     (off % BLOCK_SIZE) / sizeof(W_)) + tag;
+}
+
+void
+restoreHeapImage (void)
+{
+    char *path = RtsFlags.MiscFlags.heapImage;
+    FILE *f;
+    HeapImageHeader hdr, ours;
+    ImageChunk *chunks = NULL;
+    ImageCAF *cafs = NULL;
+    StgWord *text_relocs = NULL, *heap_relocs = NULL;
+    bdescr **groups = NULL;
+    StgPtr *block_addr = NULL;
+    StgWord slide, w, image_words;
+    StgIndStatic *caf;
+    bdescr *bd;
+    W_ i, j, n_restored;
+    rtsBool ok;
+
+    if (path == NULL) return;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        // the first run, before any image has been saved
+        if (errno != ENOENT) {
+            sysErrorBelch("restoreHeapImage: %s", path);
+        }
+        return;
+    }
+
+    memset(&ours, 0, sizeof(ours));
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        hdr.magic != HEAP_IMAGE_MAGIC) {
+        errorBelch("restoreHeapImage: %s is not a heap image", path);
+        goto out;
+    }
+    if (!program_identity(&ours) ||
+        hdr.word_size != sizeof(W_) ||
+        hdr.block_size != BLOCK_SIZE ||
+        hdr.exe_size != ours.exe_size ||
+        hdr.exe_mtime != ours.exe_mtime ||
+        hdr.exe_ino != ours.exe_ino ||
+        hdr.exe_length != ours.exe_length) {
+        errorBelch("restoreHeapImage: %s was saved by a different build "
+                   "of the program; ignoring it", path);
+        goto out;
+    }
+
+    chunks = read_array(f, hdr.n_chunks, sizeof(ImageChunk));
+    ok = chunks != NULL;
+
+    // read the blocks straight into the heap
+    if (ok) {
+        groups = stgMallocBytes(stg_max(hdr.n_chunks, 1) * sizeof(bdescr *),
+                                "restoreHeapImage");
+        block_addr = stgMallocBytes(stg_max(hdr.n_blocks, 1) *
+                                    sizeof(StgPtr), "restoreHeapImage");
+        for (i = 0; i < hdr.n_chunks; i++) groups[i] = NULL;
+    }
+    for (i = 0; ok && i < hdr.n_chunks; i++) {
+        if (chunks[i].blocks == 0 ||
+            chunks[i].first_block + chunks[i].blocks > hdr.n_blocks ||
+            chunks[i].words > chunks[i].blocks * BLOCK_SIZE_W) {
+            ok = rtsFalse;
+            break;
+        }
+        ACQUIRE_SM_LOCK;
+        groups[i] = allocGroup(chunks[i].blocks);
+        RELEASE_SM_LOCK;
+        ok = fread(groups[i]->start, BLOCK_SIZE, chunks[i].blocks, f)
+            == chunks[i].blocks;
+        for (j = 0; j < chunks[i].blocks; j++) {
+            block_addr[chunks[i].first_block + j] =
+                groups[i]->start + j * BLOCK_SIZE_W;
+        }
+    }
+
+    if (ok) {
+        text_relocs = read_array(f, hdr.n_text_relocs, sizeof(StgWord));
+        heap_relocs = read_array(f, hdr.n_heap_relocs, sizeof(StgWord));
+        cafs = read_array(f, hdr.n_cafs, sizeof(ImageCAF));
+        ok = text_relocs != NULL && heap_relocs != NULL && cafs != NULL;
+    }
+
+    // check the relocations before we apply any of them
+    image_words = hdr.n_blocks * BLOCK_SIZE_W;
+    for (i = 0; ok && i < hdr.n_text_relocs; i++) {
+        ok = text_relocs[i] < image_words;
+    }
+    for (i = 0; ok && i < hdr.n_heap_relocs; i++) {
+        w = heap_relocs[i];
+        ok = w < image_words &&
+            (block_addr[w / BLOCK_SIZE_W][w % BLOCK_SIZE_W] & ~TAG_MASK)
+                < image_words * sizeof(W_);
+    }
+    for (i = 0; ok && i < hdr.n_cafs; i++) {
+        ok = !cafs[i].in_heap || cafs[i].value < image_words * sizeof(W_);
+    }
+
+    if (!ok) {
+        errorBelch("restoreHeapImage: %s is damaged; ignoring it", path);
+        ACQUIRE_SM_LOCK;
+        for (i = 0; i < hdr.n_chunks; i++) {
+            if (groups[i] != NULL) freeGroup(groups[i]);
+        }
+        RELEASE_SM_LOCK;
+        goto out;
+    }
+
+    slide = (StgWord)__executable_start - (StgWord)hdr.exe_start;
+
+    for (i = 0; i < hdr.n_text_relocs; i++) {
+        w = text_relocs[i];
+        block_addr[w / BLOCK_SIZE_W][w % BLOCK_SIZE_W] += slide;
+    }
+    for (i = 0; i < hdr.n_heap_relocs; i++) {
+        w = heap_relocs[i];
+        block_addr[w / BLOCK_SIZE_W][w % BLOCK_SIZE_W] =
+            restore_ptr(block_addr,
+                        block_addr[w / BLOCK_SIZE_W][w % BLOCK_SIZE_W]);
+    }
+
+    // the image's closures are in the oldest generation, as if the
+    // program had built them and they had lived through a few GCs
+    ACQUIRE_SM_LOCK;
+    for (i = 0; i < hdr.n_chunks; i++) {
+        bd = groups[i];
+        initBdescr(bd, oldest_gen, oldest_gen);
+        bd->free = bd->start + chunks[i].words;
+        if (chunks[i].large) {
+            bd->flags = BF_LARGE;
+            dbl_link_onto(bd, &oldest_gen->large_objects);
+            oldest_gen->n_large_blocks += bd->blocks;
+            oldest_gen->n_large_words += chunks[i].words;
+        } else {
+            bd->flags = 0;
+            bd->link = oldest_gen->blocks;
+            oldest_gen->blocks = bd;
+            oldest_gen->n_blocks += bd->blocks;
+            oldest_gen->n_words += chunks[i].words;
+        }
+    }
+    RELEASE_SM_LOCK;
+
+    n_restored = 0;
+    for (i = 0; i < hdr.n_cafs; i++) {
+        caf = (StgIndStatic *)(cafs[i].caf + slide);
+        if (!in_program(caf) ||
+            get_itbl((StgClosure *)caf)->type != THUNK_STATIC) {
+            continue;
+        }
+        caf->saved_info = caf->header.info;
+        caf->indirectee = (StgClosure *)
+            (cafs[i].in_heap ? restore_ptr(block_addr, cafs[i].value)
+                             : cafs[i].value + slide);
+        write_barrier();
+        SET_INFO((StgClosure *)caf, &stg_IND_STATIC_info);
+        n_restored++;
+    }
+
+    debugTrace(DEBUG_gc, "heap image: restored %" FMT_Word " of %" FMT_Word
+               " CAFs, %" FMT_Word " blocks", n_restored,
+               (W_)hdr.n_cafs, (W_)hdr.n_blocks);
+
+out:
+    fclose(f);
+    if (chunks != NULL) stgFree(chunks);
+    if (groups != NULL) stgFree(groups);
+    if (block_addr != NULL) stgFree(block_addr);
+    if (text_relocs != NULL) stgFree(text_relocs);
+    if (heap_relocs != NULL) stgFree(heap_relocs);
+    if (cafs != NULL) stgFree(cafs);
+}
+
+#else /* !HEAP_IMAGES */
+
+void
+writeHeapImage (void)
+{
+    heap_image_requested = rtsFalse;
+}
+
+void
+restoreHeapImage (void)
+{
+}
+
+#endif /* HEAP_IMAGES */
@@ -0,0 +1,29 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2016
+ *
+ * Heap images: saving the evaluated CAFs for the next run of the
+ * program, see HeapImage.c
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_HEAPIMAGE_H
+#define SM_HEAPIMAGE_H
+
+#include "BeginPrivate.h"
+
+// Set by saveHeapImage(); the next major GC writes the image
+extern volatile rtsBool heap_image_requested;
+
+// Called by a major GC once all the live data is in the generations'
+// block lists, before the static objects are unlinked
+void writeHeapImage (void);
+
+// Called by hs_init_ghc() before any Haskell code runs: if +RTS
+// --heap-image names an image of this program, put its values back
+// into the CAFs
+void restoreHeapImage (void);
+
+#include "EndPrivate.h"
+
+#endif /* SM_HEAPIMAGE_H */
@@ -15,6 +15,7 @@
 #include "BlockAlloc.h"
 #include "Trace.h"
 #include "OSMem.h"
+#include "Capability.h"
 
 #include <string.h>
 
@@ -22,6 +23,207 @@ W_ peak_mblocks_allocated = 0;
 W_ mblocks_allocated = 0;
 W_ mpc_misses = 0;
 
+#if defined(USE_LARGE_ADDRESS_SPACE)
+
+/* -----------------------------------------------------------------------------
+   Note [Large address space]
+
+   When we can, we reserve a single large range of address space for the
+   heap at startup (+RTS -xr, 1TB by default).  The reservation is
+   PROT_NONE and MAP_NORESERVE, so it costs nothing but page tables; we
+   commit mblocks inside it as the heap grows and decommit them when it
+   shrinks.  Then HEAP_ALLOCED(p) is just a range check against
+   mblock_address_space (see MBlock.h), instead of a lookup in the
+   mblock_cache backed by the mblock_maps, and getMBlocks() doesn't have
+   to maintain the maps at all.
+
+   Committed mblocks are allocated from the bottom of the range up to
+   mblock_high_watermark.  Decommitted mblocks below the watermark are
+   kept on free_list, a doubly-linked list of (address, size) ranges in
+   ascending address order, in which adjacent ranges are always merged;
+   a range that reaches the watermark lowers it instead.  New requests
+   take the first range on free_list that is big enough, and only raise
+   the watermark when there is none.
+
+   Note that HEAP_ALLOCED is also true of decommitted mblocks inside the
+   range, but nobody has a pointer into those.
+
+   All of this is protected by the sm_mutex, like the mblock maps are.
+   -------------------------------------------------------------------------- */
+
+typedef struct free_list {
+    struct free_list *prev;
+    struct free_list *next;
+    W_ address;
+    W_ size;
+} free_list;
+
+static free_list *free_list_head = NULL;
+static W_ mblock_high_watermark = 0;
+
+struct mblock_address_range mblock_address_space = { 0, 0, {0} };
+
+// The first committed mblock at or after p, or NULL
+static void *
+getCommittedMBlockFrom (W_ p)
+{
+    free_list *f;
+
+    for (f = free_list_head; f != NULL && p >= f->address; f = f->next) {
+        if (p < f->address + f->size) p = f->address + f->size;
+    }
+
+    if (p >= mblock_high_watermark) return NULL;
+    return (void*)p;
+}
+
+void * getFirstMBlock(void)
+{
+    return getCommittedMBlockFrom(mblock_address_space.begin);
+}
+
+void * getNextMBlock(void *mblock)
+{
+    return getCommittedMBlockFrom((W_)mblock + MBLOCK_SIZE);
+}
+
+static void *
+getReusableMBlocks (nat n)
+{
+    free_list *f;
+    W_ size = MBLOCK_SIZE * (W_)n;
+    void *addr;
+
+    for (f = free_list_head; f != NULL; f = f->next) {
+        if (f->size < size) continue;
+
+        addr = (void*)f->address;
+        f->address += size;
+        f->size -= size;
+        if (f->size == 0) {
+            if (f->prev) {
+                f->prev->next = f->next;
+            } else {
+                free_list_head = f->next;
+            }
+            if (f->next) {
+                f->next->prev = f->prev;
+            }
+            stgFree(f);
+        }
+        osCommitMemory(addr, size);
+        return addr;
+    }
+    return NULL;
+}
+
+static void *
+getFreshMBlocks (nat n)
+{
+    W_ size = MBLOCK_SIZE * (W_)n;
+    void *addr = (void*)mblock_high_watermark;
+
+    if (size > mblock_address_space.end - mblock_high_watermark) {
+        errorBelch("out of memory (the heap has used all of the %" FMT_Word
+                   " MB of address space reserved for it; see +RTS -xr)",
+                   (mblock_address_space.end - mblock_address_space.begin)
+                   / (1024 * 1024));
+        stg_exit(EXIT_HEAPOVERFLOW);
+    }
+
+    osCommitMemory(addr, size);
+    mblock_high_watermark += size;
+    return addr;
+}
+
+static void *
+getCommittedMBlocks (nat n)
+{
+    void *p;
+
+    p = getReusableMBlocks(n);
+    if (p == NULL) {
+        p = getFreshMBlocks(n);
+    }
+    ASSERT(p != NULL);
+    return p;
+}
+
+static free_list *
+newFreeRange (W_ address, W_ size, free_list *prev, free_list *next)
+{
+    free_list *f;
+
+    f = stgMallocBytes(sizeof(free_list), "decommitMBlocks");
+    f->address = address;
+    f->size = size;
+    f->prev = prev;
+    f->next = next;
+    if (prev) {
+        prev->next = f;
+    } else {
+        free_list_head = f;
+    }
+    if (next) {
+        next->prev = f;
+    }
+    return f;
+}
+
+static void
+decommitMBlocks (char *addr, nat n)
+{
+    free_list *f, *prev, *next;
+    W_ size = MBLOCK_SIZE * (W_)n;
+    W_ address = (W_)addr;
+
+    osDecommitMemory(addr, size);
+
+    // find the first range after the one we are freeing
+    prev = NULL;
+    for (next = free_list_head;
+         next != NULL && next->address < address;
+         next = next->next) {
+        prev = next;
+    }
+
+    if (prev && prev->address + prev->size == address) {
+        // extend the previous range, and merge with the next one
+        f = prev;
+        f->size += size;
+        if (next && f->address + f->size == next->address) {
+            f->size += next->size;
+            f->next = next->next;
+            if (f->next) f->next->prev = f;
+            stgFree(next);
+        }
+    } else if (next && address + size == next->address) {
+        next->address = address;
+        next->size += size;
+        f = next;
+    } else if (address + size == mblock_high_watermark) {
+        mblock_high_watermark = address;
+        return;
+    } else {
+        newFreeRange(address, size, prev, next);
+        return;
+    }
+
+    // if the merged range reaches the watermark, lower it instead
+    if (f->address + f->size == mblock_high_watermark) {
+        ASSERT(f->next == NULL);
+        mblock_high_watermark = f->address;
+        if (f->prev) {
+            f->prev->next = NULL;
+        } else {
+            free_list_head = NULL;
+        }
+        stgFree(f);
+    }
+}
+
+#else /* !USE_LARGE_ADDRESS_SPACE */
+
 /* -----------------------------------------------------------------------------
    The MBlock Map: provides our implementation of HEAP_ALLOCED()
    -------------------------------------------------------------------------- */
@@ -212,6 +414,8 @@ void * getFirstMBlock(void)
 
 #endif // SIZEOF_VOID_P
 
+#endif /* !USE_LARGE_ADDRESS_SPACE */
+
 /* -----------------------------------------------------------------------------
    Allocate new mblock(s)
    -------------------------------------------------------------------------- */
@@ -228,17 +432,48 @@ getMBlock(void)
 void *
 getMBlocks(nat n)
 {
-    nat i;
+    return getMBlocksOnNode(0, n);
+}
+
+void *
+getMBlockOnNode(nat node)
+{
+    return getMBlocksOnNode(node, 1);
+}
+
+// Allocate 'n' mblocks whose memory is preferably backed by NUMA
+// node 'node'.  'node' is an RTS node number (an index into numa_map),
+// not an OS node number.
+
+void *
+getMBlocksOnNode(nat node, nat n)
+{
     void *ret;
 
-    ret = osGetMBlocks(n);
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    ret = getCommittedMBlocks(n);
+    if (RtsFlags.GcFlags.numa) {
+        osBindMBlocksToNode(ret, (StgWord)n * MBLOCK_SIZE, numa_map[node]);
+    }
+#else
+    if (RtsFlags.GcFlags.numa) {
+        ret = osGetMBlocksOnNode(n, numa_map[node]);
+    } else {
+        ret = osGetMBlocks(n);
+    }
+#endif
 
-    debugTrace(DEBUG_gc, "allocated %d megablock(s) at %p",n,ret);
+    debugTrace(DEBUG_gc, "allocated %d megablock(s) at %p on node %d",
+               n, ret, node);
+    dtraceMBlockAlloc((StgWord)node, (StgWord)n, (StgWord)ret);
 
+#if !defined(USE_LARGE_ADDRESS_SPACE)
     // fill in the table
+    nat i;
     for (i = 0; i < n; i++) {
         markHeapAlloced( (StgWord8*)ret + i * MBLOCK_SIZE );
     }
+#endif
 
     mblocks_allocated += n;
     peak_mblocks_allocated = stg_max(peak_mblocks_allocated, mblocks_allocated);
@@ -249,17 +484,21 @@ getMBlocks(nat n)
 void
 freeMBlocks(void *addr, nat n)
 {
-    nat i;
-
     debugTrace(DEBUG_gc, "freeing %d megablock(s) at %p",n,addr);
+    dtraceMBlockFree((StgWord)n, (StgWord)addr);
 
     mblocks_allocated -= n;
 
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    decommitMBlocks(addr, n);
+#else
+    nat i;
     for (i = 0; i < n; i++) {
         markHeapUnalloced( (StgWord8*)addr + i * MBLOCK_SIZE );
     }
 
     osFreeMBlocks(addr, n);
+#endif
 }
 
 void
@@ -267,6 +506,18 @@ freeAllMBlocks(void)
 {
     debugTrace(DEBUG_gc, "freeing all megablocks");
 
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    free_list *f, *next;
+    for (f = free_list_head; f != NULL; f = next) {
+        next = f->next;
+        stgFree(f);
+    }
+    free_list_head = NULL;
+    osReleaseHeapMemory((void*)mblock_address_space.begin,
+                        mblock_address_space.end - mblock_address_space.begin);
+    mblock_address_space.begin = mblock_address_space.end = 0;
+    mblock_high_watermark = 0;
+#else
     osFreeAllMBlocks();
 
 #if SIZEOF_VOID_P == 8
@@ -276,13 +527,26 @@ freeAllMBlocks(void)
     }
     stgFree(mblock_maps);
 #endif
+#endif /* !USE_LARGE_ADDRESS_SPACE */
 }
 
 void
 initMBlocks(void)
 {
     osMemInit();
-#if SIZEOF_VOID_P == 8
+#if defined(USE_LARGE_ADDRESS_SPACE)
+    {
+        W_ size = RtsFlags.GcFlags.addressSpaceSize;
+        void *addr;
+
+        addr = osReserveHeapMemory((void*)RtsFlags.GcFlags.heapBase, &size);
+        mblock_address_space.begin = (W_)addr;
+        mblock_address_space.end = (W_)addr + size;
+        mblock_high_watermark = (W_)addr;
+        debugTrace(DEBUG_gc, "reserved %" FMT_Word " MB of address space "
+                   "for the heap at %p", size / (1024 * 1024), addr);
+    }
+#elif SIZEOF_VOID_P == 8
     memset(mblock_cache,0xff,sizeof(mblock_cache));
 #endif
 }
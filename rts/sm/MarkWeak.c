@@ -67,6 +67,70 @@
 
      No more evacuation is done.
 
+   Note [Parallel weak pointers]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   A program may have hundreds of thousands of weak pointers, and each
+   pass over them used to be made by the main GC thread alone, as was
+   all the scavenging of what they kept alive, while the other GC
+   threads waited for the GC to end.  Instead, the processing is done
+   in rounds that all the GC threads take part in:
+
+   - initWeakForGC() deals out the weak pointers of the collected
+     generations among the GC threads (gct->old_weak_ptrs).
+
+   - traverseWeakPtrList() runs on the main GC thread when the heap
+     has been scavenged.  It does the work on the thread lists itself,
+     and then starts a round with startWeakRound() (in GC.c), which
+     gets every GC thread to call doWeakRound() on its own weak
+     pointers and then scavenge together, until the heap is scavenged
+     again.  The work of a round is one of
+
+       WEAK_ROUND_TIDY: move the weak pointers whose keys are alive to
+         the weak_ptr_list of their generation, and evacuate their
+         values and finalizers (tidyWeakList()).  A thread that finds
+         a live key sets weak_alive.
+       WEAK_ROUND_DEAD: evacuate the finalizers of the weak pointers
+         that are left, and put them on dead_weak_ptr_list
+         (collectDeadWeakPtrs()).
+       WEAK_ROUND_NONE: nothing; the main thread has evacuated
+         something (resurrected threads) for everyone to scavenge.
+
+   Finding the live keys and scavenging what they keep alive happen in
+   the same round, so traverseWeakPtrList() only learns whether a
+   round found anything after the heap has been scavenged: if it did,
+   there may be more live keys, so it starts another round; once a
+   round finds none, the remaining keys are dead.  The keys are tested
+   while other threads copy objects, so a key may look dead because it
+   is just being evacuated; but then that round found a live key, so
+   there is another round, which sees it.
+
+   Note [Generational thread lists]
+   ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+   Every thread is on the threads list of the generation its TSO lives
+   in, and only the lists of the generations being collected are
+   walked, so a minor GC looks at the young threads and never at the
+   long-lived ones in the old generations, however many of them there
+   are.  An old thread that runs is dirty, and is on the mutable list
+   like any other mutated object, so it is scavenged without being on
+   a thread list we walk.
+
+   - createThread() puts a new thread on its Capability's
+     new_threads list, which needs no lock; the next GC moves these to
+     g0->threads (collectFreshThreads()).
+
+   - prepare_collected_gen() moves the threads of a collected
+     generation to old_threads.  tidyThreadList() then moves each
+     thread found alive to the threads list of the generation it was
+     copied to, so a thread that survives to an old generation drops
+     out of the minor GCs.
+
+   - The threads still on old_threads when no more live keys turn up
+     are unreachable: resurrectUnreachableThreads() keeps them alive,
+     and resurrectThreads() puts them back on a threads list and
+     sends them an exception.
+
    -------------------------------------------------------------------------- */
 
 /* Which stage of processing various kinds of weak pointer are we at?
@@ -75,29 +139,60 @@
 typedef enum { WeakPtrs, WeakThreads, WeakDone } WeakStage;
 static WeakStage weak_stage;
 
+// Whether the last round was a WEAK_ROUND_TIDY round, and whether it
+// found any live keys (see Note [Parallel weak pointers])
+static rtsBool weak_tidied;
+static volatile rtsBool weak_alive;
+
 // List of weak pointers whose key is dead
 StgWeak *dead_weak_ptr_list;
 
 // List of threads found to be unreachable
 StgTSO *resurrected_threads;
 
-static void    collectDeadWeakPtrs (generation *gen);
-static rtsBool tidyWeakList (generation *gen);
+static void    collectDeadWeakPtrs (void);
+static rtsBool tidyWeakList (void);
 static rtsBool resurrectUnreachableThreads (generation *gen);
 static void    tidyThreadList (generation *gen);
+static rtsBool startRound (nat work);
 
 void
 initWeakForGC(void)
 {
-    nat g;
+    nat g, i, n;
+    gc_thread *threads[n_gc_threads];
+    StgWeak *w, *next_w;
+
+    // the GC threads taking part in this GC
+    if (n_gc_threads == 1) {
+        threads[0] = gct;
+        n = 1;
+    } else {
+        for (i = 0, n = 0; i < n_gc_threads; i++) {
+            if (!gc_threads[i]->idle) {
+                threads[n++] = gc_threads[i];
+            }
+        }
+    }
+    for (i = 0; i < n; i++) {
+        threads[i]->old_weak_ptrs = NULL;
+    }
 
+    // deal out the weak pointers
+    i = 0;
     for (g = 0; g <= N; g++) {
         generation *gen = &generations[g];
-        gen->old_weak_ptr_list = gen->weak_ptr_list;
+        for (w = gen->weak_ptr_list; w != NULL; w = next_w) {
+            next_w = w->link;
+            w->link = threads[i]->old_weak_ptrs;
+            threads[i]->old_weak_ptrs = w;
+            if (++i == n) i = 0;
+        }
         gen->weak_ptr_list = NULL;
     }
 
     weak_stage = WeakThreads;
+    weak_tidied = rtsFalse;
     dead_weak_ptr_list = NULL;
     resurrected_threads = END_TSO_QUEUE;
 }
@@ -120,21 +215,17 @@ traverseWeakPtrList(void)
   {
       nat g;
 
-      for (g = 0; g <= N; g++) {
-          tidyThreadList(&generations[g]);
-      }
-
-      // Use weak pointer relationships (value is reachable if
-      // key is reachable):
-      for (g = 0; g <= N; g++) {
-          if (tidyWeakList(&generations[g])) {
-              flag = rtsTrue;
+      // if we evacuated anything new, it has been scavenged now, but
+      // there may be more live threads and weak pointers.
+      if (!weak_tidied || weak_alive) {
+          for (g = 0; g <= N; g++) {
+              tidyThreadList(&generations[g]);
           }
-      }
 
-      // if we evacuated anything new, we must scavenge thoroughly
-      // before we can determine which threads are unreachable.
-      if (flag) return rtsTrue;
+          // Use weak pointer relationships (value is reachable if
+          // key is reachable):
+          return startRound(WEAK_ROUND_TIDY);
+      }
 
       // Resurrect any threads which were unreachable
       for (g = 0; g <= N; g++) {
@@ -149,36 +240,27 @@ traverseWeakPtrList(void)
 
       // if we evacuated anything new, we must scavenge thoroughly
       // before entering the WeakPtrs stage.
-      if (flag) return rtsTrue;
+      if (flag) return startRound(WEAK_ROUND_NONE);
 
-      // otherwise, fall through...
+      // otherwise, fall through: the last round found no live keys,
+      // and nothing has changed since.
   }
 
   case WeakPtrs:
   {
-      nat g;
-
       // resurrecting threads might have made more weak pointers
       // alive, so traverse those lists again:
-      for (g = 0; g <= N; g++) {
-          if (tidyWeakList(&generations[g])) {
-              flag = rtsTrue;
-          }
+      if (!weak_tidied || weak_alive) {
+          return startRound(WEAK_ROUND_TIDY);
       }
 
       /* If we didn't make any changes, then we can go round and kill all
        * the dead weak pointers.  The dead_weak_ptr list is used as a list
        * of pending finalizers later on.
        */
-      if (flag == rtsFalse) {
-          for (g = 0; g <= N; g++) {
-              collectDeadWeakPtrs(&generations[g]);
-          }
-
-          weak_stage = WeakDone;  // *now* we're done,
-      }
+      weak_stage = WeakDone;  // *now* we're done,
 
-      return rtsTrue;         // but one more round of scavenging, please
+      return startRound(WEAK_ROUND_DEAD); // but one more round of scavenging, please
   }
 
   default:
@@ -187,15 +269,70 @@ traverseWeakPtrList(void)
   }
 }
 
-static void collectDeadWeakPtrs (generation *gen)
+static rtsBool
+startRound (nat work)
 {
-    StgWeak *w, *next_w;
-    for (w = gen->old_weak_ptr_list; w != NULL; w = next_w) {
+    weak_tidied = (work == WEAK_ROUND_TIDY);
+    weak_alive = rtsFalse;
+    startWeakRound(work);
+    return rtsTrue;
+}
+
+// Called by each GC thread in a round of weak pointer processing; see
+// Note [Parallel weak pointers].
+void
+doWeakRound (nat work)
+{
+    switch (work) {
+    case WEAK_ROUND_NONE:
+        break;
+    case WEAK_ROUND_TIDY:
+        if (tidyWeakList()) {
+            weak_alive = rtsTrue;
+        }
+        break;
+    case WEAK_ROUND_DEAD:
+        collectDeadWeakPtrs();
+        break;
+    default:
+        barf("doWeakRound: %d", work);
+    }
+}
+
+// Put the chain hd..tl on the front of *list, which other GC threads
+// may be adding to at the same time.
+static void
+pushWeaks (StgWeak **list, StgWeak *hd, StgWeak *tl)
+{
+#if defined(THREADED_RTS)
+    StgWeak *old;
+
+    do {
+        old = *list;
+        tl->link = old;
+    } while (cas((StgVolatilePtr)list, (StgWord)old, (StgWord)hd)
+             != (StgWord)old);
+#else
+    tl->link = *list;
+    *list = hd;
+#endif
+}
+
+static void collectDeadWeakPtrs (void)
+{
+    StgWeak *w, *hd, *tl;
+
+    hd = gct->old_weak_ptrs;
+    if (hd == NULL) return;
+
+    gct->evac_gen_no = 0;
+    tl = hd;
+    for (w = hd; w != NULL; w = w->link) {
         evacuate(&w->finalizer);
-        next_w = w->link;
-        w->link = dead_weak_ptr_list;
-        dead_weak_ptr_list = w;
+        tl = w;
     }
+    pushWeaks(&dead_weak_ptr_list, hd, tl);
+    gct->old_weak_ptrs = NULL;
 }
 
 static rtsBool resurrectUnreachableThreads (generation *gen)
@@ -225,14 +362,25 @@ static rtsBool resurrectUnreachableThreads (generation *gen)
     return flag;
 }
 
-static rtsBool tidyWeakList(generation *gen)
+// Look for live keys among this thread's share of the weak pointers.
+static rtsBool tidyWeakList(void)
 {
     StgWeak *w, **last_w, *next_w;
     const StgInfoTable *info;
     StgClosure *new;
     rtsBool flag = rtsFalse;
-    last_w = &gen->old_weak_ptr_list;
-    for (w = gen->old_weak_ptr_list; w != NULL; w = next_w) {
+    nat g;
+    // the live weak pointers of each generation, collected here so
+    // that we only touch the shared lists once per generation
+    StgWeak *hd[RtsFlags.GcFlags.generations];
+    StgWeak *tl[RtsFlags.GcFlags.generations];
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        hd[g] = NULL;
+    }
+
+    last_w = &gct->old_weak_ptrs;
+    for (w = gct->old_weak_ptrs; w != NULL; w = next_w) {
 
         /* There might be a DEAD_WEAK on the list if finalizeWeak# was
          * called on a live weak pointer object.  Just remove it.
@@ -269,20 +417,16 @@ static rtsBool tidyWeakList(generation *gen)
                 next_w  = w->link;
 
                 // and put it on the correct weak ptr list.
-                w->link = new_gen->weak_ptr_list;
-                new_gen->weak_ptr_list = w;
-                flag = rtsTrue;
-
-                if (gen->no != new_gen->no) {
-                    debugTrace(DEBUG_weak,
-                      "moving weak pointer %p from %d to %d",
-                      w, gen->no, new_gen->no);
+                if (hd[new_gen->no] == NULL) {
+                    tl[new_gen->no] = w;
                 }
-
+                w->link = hd[new_gen->no];
+                hd[new_gen->no] = w;
+                flag = rtsTrue;
 
                 debugTrace(DEBUG_weak,
-                           "weak pointer still alive at %p -> %p",
-                           w, w->key);
+                           "weak pointer still alive at %p -> %p (gen %d)",
+                           w, w->key, new_gen->no);
                 continue;
             }
             else {
@@ -296,12 +440,30 @@ static rtsBool tidyWeakList(generation *gen)
         }
     }
 
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        if (hd[g] != NULL) {
+            pushWeaks(&generations[g].weak_ptr_list, hd[g], tl[g]);
+        }
+    }
+
     return flag;
 }
 
+// Move the threads of gen that are now known to be alive onto the
+// threads list of the generation they live in.  Only the generations
+// being collected are walked (see Note [Generational thread lists]).
 static void tidyThreadList (generation *gen)
 {
     StgTSO *t, *tmp, *next, **prev;
+    nat g;
+    // the live threads of each generation, collected here so that we
+    // only touch the shared lists once per generation
+    StgTSO *hd[RtsFlags.GcFlags.generations];
+    StgTSO *tl[RtsFlags.GcFlags.generations];
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        hd[g] = END_TSO_QUEUE;
+    }
 
     prev = &gen->old_threads;
 
@@ -334,11 +496,20 @@ static void tidyThreadList (generation *gen)
             // alive
             *prev = next;
 
-            // move this thread onto the correct threads list.
-            generation *new_gen;
-            new_gen = Bdescr((P_)t)->gen;
-            t->global_link = new_gen->threads;
-            new_gen->threads  = t;
+            // and put it on the list of its new generation.
+            g = Bdescr((P_)t)->gen_no;
+            if (hd[g] == END_TSO_QUEUE) {
+                tl[g] = t;
+            }
+            t->global_link = hd[g];
+            hd[g] = t;
+        }
+    }
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        if (hd[g] != END_TSO_QUEUE) {
+            tl[g]->global_link = generations[g].threads;
+            generations[g].threads = hd[g];
         }
     }
 }
@@ -25,6 +25,15 @@ void    initWeakForGC          ( void );
 rtsBool traverseWeakPtrList    ( void );
 void    markWeakPtrList        ( void );
 
+// The work of a round of weak pointer processing (see
+// Note [Parallel weak pointers] in MarkWeak.c)
+#define WEAK_ROUND_NONE 0       // just scavenge
+#define WEAK_ROUND_TIDY 1       // look for live keys
+#define WEAK_ROUND_DEAD 2       // evacuate the finalizers of dead weak ptrs
+#define WEAK_ROUND_END  3       // no more rounds: the GC threads go home
+
+void    doWeakRound            ( nat work );
+
 #include "EndPrivate.h"
 
 #endif /* SM_MARKWEAK_H */
@@ -15,11 +15,38 @@ void osMemInit(void);
 void *osGetMBlocks(nat n);
 void osFreeMBlocks(char *addr, nat n);
 void osReleaseFreeMemory(void);
+rtsBool osDiscardMemory(void *at, W_ size);
 void osFreeAllMBlocks(void);
+void osHugePageMBlocks(StgWord *hugetlb, StgWord *thp);
 W_ getPageSize (void);
 StgWord64 getPhysicalMemorySize (void);
+StgWord64 getLastLevelCacheSize (void);
 void setExecutable (void *p, W_ len, rtsBool exec);
 
+// Map the file fd, from offset, read-only over the heap memory at 'at';
+// both must be page-aligned.  The mapping is MAP_SHARED if shared is
+// set, MAP_PRIVATE otherwise.  osUnmapFile() puts fresh memory back.
+// osMapFile() fails with errno set, and leaves fresh memory there.
+rtsBool osMapFile (void *at, W_ size, int fd, StgWord64 offset,
+                   rtsBool shared);
+void osUnmapFile (void *at, W_ size);
+
+rtsBool osNumaAvailable(void);
+nat osNumaNodes(void);
+StgWord osNumaMask(void);
+void osBindMBlocksToNode(void *addr, StgWord size, nat node);
+// osGetMBlocks(), preferring memory on OS NUMA node 'node'
+void *osGetMBlocksOnNode(nat n, nat node);
+
+#if defined(USE_LARGE_ADDRESS_SPACE)
+// Reserve (without committing) up to *len bytes of address space,
+// MBLOCK_SIZE-aligned; *len is set to what we actually got.
+void *osReserveHeapMemory(void *hint, W_ *len);
+void osCommitMemory(void *at, W_ size);
+void osDecommitMemory(void *at, W_ size);
+void osReleaseHeapMemory(void *at, W_ size);
+#endif
+
 #include "EndPrivate.h"
 
 #endif /* SM_OSMEM_H */
@@ -21,7 +21,10 @@
 #include "RtsUtils.h"
 #include "sm/Storage.h"
 #include "sm/BlockAlloc.h"
+#include "sm/CNF.h"
 #include "GCThread.h"
+#include "GC.h"
+#include "Freeze.h"
 #include "Sanity.h"
 #include "Schedule.h"
 #include "Apply.h"
@@ -637,7 +640,8 @@ checkStaticObjects ( StgClosure* static_objects )
   StgClosure *p = static_objects;
   StgInfoTable *info;
 
-  while (p != END_OF_STATIC_LIST) {
+  while (p != END_OF_STATIC_OBJECT_LIST) {
+    p = UNTAG_STATIC_LIST_PTR(p);
     checkClosure(p);
     info = get_itbl(p);
     switch (info->type) {
@@ -688,50 +692,164 @@ checkNurserySanity (nursery *nursery)
     ASSERT(blocks == nursery->n_blocks);
 }
 
-static void checkGeneration (generation *gen,
-                             rtsBool after_major_gc USED_IF_THREADS)
-{
-    nat n;
-    gen_workspace *ws;
+/* -----------------------------------------------------------------------------
+   Checking the heap in parallel
+
+   The heap blocks of every generation are put into sanity_chains, and
+   the GC threads (see runOnGcThreads()) claim SANITY_CHUNK blocks at a
+   time to check.  With +RTS --sanity-sample=<n> only about one block in
+   n is checked; which ones is decided by hashing the block address
+   with a seed that changes at every check, so that over several GCs
+   the whole heap gets looked at.
+   -------------------------------------------------------------------------- */
 
-    ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
-    ASSERT(countBlocks(gen->large_objects) == gen->n_large_blocks);
+#define SANITY_CHUNK 64
 
+static bdescr **sanity_chains = NULL;
+static nat n_sanity_chains, sanity_chain;
+static bdescr *sanity_next;
+static StgWord sanity_seed = 0;
 #if defined(THREADED_RTS)
-    // heap sanity checking doesn't work with SMP, because we can't
-    // zero the slop (see Updates.h).  However, we can sanity-check
-    // the heap after a major gc, because there is no slop.
-    if (!after_major_gc) return;
+static SpinLock sanity_lock;
 #endif
 
-    checkHeapChain(gen->blocks);
+static rtsBool sampleBlock (bdescr *bd)
+{
+    nat n = RtsFlags.DebugFlags.sanity_sample;
+    StgWord h;
+
+    if (n <= 1) return rtsTrue;
+    h = ((StgWord)bd >> BLOCK_SHIFT) ^ sanity_seed;
+    h *= (StgWord)0x9E3779B97F4A7C15ULL;
+    h ^= h >> (sizeof(StgWord) * 4);
+    return h % n == 0;
+}
+
+static void checkHeapBlock (bdescr *bd)
+{
+    StgPtr p;
 
-    for (n = 0; n < n_capabilities; n++) {
-        ws = &gc_threads[n]->gens[gen->no];
-        checkHeapChain(ws->todo_bd);
-        checkHeapChain(ws->part_list);
-        checkHeapChain(ws->scavd_list);
+    if (bd->flags & BF_LARGE) {
+        if (!(bd->flags & BF_PINNED)) {
+            checkClosure((StgClosure *)bd->start);
+        }
+        return;
+    }
+    if (bd->flags & BF_SWEPT) return;
+
+    p = bd->start;
+    while (p < bd->free) {
+        nat size = checkClosure((StgClosure *)p);
+        /* This is the smallest size of closure that can live in the heap */
+        ASSERT( size >= MIN_PAYLOAD_SIZE + sizeofW(StgHeader) );
+        p += size;
+
+        /* skip over slop */
+        while (p < bd->free &&
+               (*p < 0x1000 || !LOOKS_LIKE_INFO_PTR(*p))) { p++; }
+    }
+}
+
+// Returns the first of up to SANITY_CHUNK blocks, and in *end the
+// block after the last, or NULL when every block has been claimed
+static bdescr *claimSanityChunk (bdescr **end)
+{
+    bdescr *bd, *first;
+    nat n;
+
+    ACQUIRE_SPIN_LOCK(&sanity_lock);
+    while (sanity_next == NULL && sanity_chain < n_sanity_chains) {
+        sanity_next = sanity_chains[sanity_chain++];
     }
+    first = sanity_next;
+    for (bd = first, n = 0; bd != NULL && n < SANITY_CHUNK; n++) {
+        bd = bd->link;
+    }
+    sanity_next = bd;
+    RELEASE_SPIN_LOCK(&sanity_lock);
 
-    checkLargeObjects(gen->large_objects);
+    *end = bd;
+    return first;
 }
 
-/* Full heap sanity check. */
-static void checkFullHeap (rtsBool after_major_gc)
+static void checkHeapWorker (nat me STG_UNUSED)
 {
-    nat g, n;
+    bdescr *bd, *end;
+
+    while ((bd = claimSanityChunk(&end)) != NULL) {
+        for (; bd != end; bd = bd->link) {
+            if (sampleBlock(bd)) checkHeapBlock(bd);
+        }
+    }
+}
+
+static void checkGeneration (generation *gen)
+{
+    ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
+    ASSERT(countBlocks(gen->large_objects) == gen->n_large_blocks);
+    ASSERT(countCompactBlocks(gen->compact_objects) == gen->n_compact_blocks);
+}
+
+/* Full heap sanity check.  The heap itself can only be checked by all
+ * the GC threads after GC, when they are waiting for more work; before
+ * GC the calling thread checks it alone.
+ */
+static void checkFullHeap (rtsBool after_gc, rtsBool after_major_gc)
+{
+    nat g, n, i;
+    gen_workspace *ws;
 
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
-        checkGeneration(&generations[g], after_major_gc);
+        checkGeneration(&generations[g]);
     }
     for (n = 0; n < n_capabilities; n++) {
         checkNurserySanity(&nurseries[n]);
     }
+
+#if defined(THREADED_RTS)
+    // heap sanity checking doesn't work with SMP, because we can't
+    // zero the slop (see Updates.h).  However, we can sanity-check
+    // the heap after a major gc, because there is no slop.
+    if (!after_major_gc) return;
+#else
+    (void)after_major_gc;
+#endif
+
+    sanity_chains = stgReallocBytes(sanity_chains,
+                                    RtsFlags.GcFlags.generations *
+                                    (2 + 3 * n_capabilities) *
+                                    sizeof(bdescr *),
+                                    "checkFullHeap");
+    i = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        sanity_chains[i++] = generations[g].blocks;
+        sanity_chains[i++] = generations[g].large_objects;
+
+        for (n = 0; n < n_capabilities; n++) {
+            ws = &gc_threads[n]->gens[g];
+            sanity_chains[i++] = ws->todo_bd;
+            sanity_chains[i++] = ws->part_list;
+            sanity_chains[i++] = ws->scavd_list;
+        }
+    }
+    n_sanity_chains = i;
+    sanity_chain = 0;
+    sanity_next = NULL;
+    sanity_seed++;
+#if defined(THREADED_RTS)
+    initSpinLock(&sanity_lock);
+#endif
+
+    if (after_gc) {
+        runOnGcThreads(checkHeapWorker);
+    } else {
+        checkHeapWorker(0);
+    }
 }
 
 void checkSanity (rtsBool after_gc, rtsBool major_gc)
 {
-    checkFullHeap(after_gc && major_gc);
+    checkFullHeap(after_gc, after_gc && major_gc);
 
     checkFreeListSanity();
 
@@ -753,7 +871,7 @@ void checkSanity (rtsBool after_gc, rtsBool major_gc)
 static void
 findMemoryLeak (void)
 {
-    nat g, i;
+    nat g, i, c;
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         for (i = 0; i < n_capabilities; i++) {
             markBlocks(capabilities[i]->mut_lists[g]);
@@ -763,14 +881,22 @@ findMemoryLeak (void)
         }
         markBlocks(generations[g].blocks);
         markBlocks(generations[g].large_objects);
+        markCompactBlocks(generations[g].compact_objects);
     }
+    markCompactImportBlocks();
+    markBlocks(frozen_blocks);
+    markBlocks(frozen_large_objects);
+    markDeferredBlocks();
 
     for (i = 0; i < n_nurseries; i++) {
         markBlocks(nurseries[i].blocks);
     }
 
     for (i = 0; i < n_capabilities; i++) {
-        markBlocks(capabilities[i]->pinned_object_block);
+        for (c = 0; c < N_PINNED_CLASSES; c++) {
+            markBlocks(capabilities[i]->pinned_object_block[c]);
+        }
+        markBlocks(capabilities[i]->block_cache);
     }
 
 #ifdef PROFILING
@@ -794,13 +920,17 @@ void
 checkRunQueue(Capability *cap)
 {
     StgTSO *prev, *tso;
+    nat n;
     prev = END_TSO_QUEUE;
+    n = 0;
     for (tso = cap->run_queue_hd; tso != END_TSO_QUEUE;
-         prev = tso, tso = tso->_link) {
+         prev = tso, tso = tso->_link, n++) {
         ASSERT(prev == END_TSO_QUEUE || prev->_link == tso);
         ASSERT(tso->block_info.prev == prev);
+        ASSERT(prev == END_TSO_QUEUE || prev->priority >= tso->priority);
     }
     ASSERT(cap->run_queue_tl == prev);
+    ASSERT(cap->n_run_queue == n);
 }
 
 /* -----------------------------------------------------------------------------
@@ -831,17 +961,19 @@ genBlocks (generation *gen)
 {
     ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
     ASSERT(countBlocks(gen->large_objects) == gen->n_large_blocks);
+    ASSERT(countCompactBlocks(gen->compact_objects) == gen->n_compact_blocks);
     return gen->n_blocks + gen->n_old_blocks +
-            countAllocdBlocks(gen->large_objects);
+            countAllocdBlocks(gen->large_objects) +
+            gen->n_compact_blocks;
 }
 
 void
 memInventory (rtsBool show)
 {
-  nat g, i;
+  nat g, i, c;
   W_ gen_blocks[RtsFlags.GcFlags.generations];
   W_ nursery_blocks, retainer_blocks,
-       arena_blocks, exec_blocks;
+       arena_blocks, exec_blocks, cached_blocks, frozen, deferred;
   W_ live_blocks = 0, free_blocks = 0;
   rtsBool leak;
 
@@ -864,8 +996,11 @@ memInventory (rtsBool show)
       nursery_blocks += nurseries[i].n_blocks;
   }
   for (i = 0; i < n_capabilities; i++) {
-      if (capabilities[i]->pinned_object_block != NULL) {
-          nursery_blocks += capabilities[i]->pinned_object_block->blocks;
+      for (c = 0; c < N_PINNED_CLASSES; c++) {
+          if (capabilities[i]->pinned_object_block[c] != NULL) {
+              nursery_blocks +=
+                  capabilities[i]->pinned_object_block[c]->blocks;
+          }
       }
       nursery_blocks += countBlocks(capabilities[i]->pinned_object_blocks);
   }
@@ -883,6 +1018,22 @@ memInventory (rtsBool show)
   // count the blocks containing executable memory
   exec_blocks = countAllocdBlocks(exec_block);
 
+  // count the blocks held in the per-Capability block caches
+  cached_blocks = 0;
+  for (i = 0; i < n_capabilities; i++) {
+      ASSERT(countBlocks(capabilities[i]->block_cache)
+             == capabilities[i]->n_cached_blocks);
+      cached_blocks += capabilities[i]->n_cached_blocks;
+  }
+
+  // count the blocks of the frozen heap
+  frozen = countBlocks(frozen_blocks) + countAllocdBlocks(frozen_large_objects);
+  ASSERT(countBlocks(frozen_blocks) + countBlocks(frozen_large_objects)
+         == n_frozen_blocks);
+
+  // count the blocks that are waiting to be freed
+  deferred = n_deferred_blocks;
+
   /* count the blocks on the free list */
   free_blocks = countFreeList();
 
@@ -891,7 +1042,9 @@ memInventory (rtsBool show)
       live_blocks += gen_blocks[g];
   }
   live_blocks += nursery_blocks +
-               + retainer_blocks + arena_blocks + exec_blocks;
+               + retainer_blocks + arena_blocks + exec_blocks + cached_blocks
+               + frozen + deferred
+               + countCompactImportBlocks();
 
 #define MB(n) (((double)(n) * BLOCK_SIZE_W) / ((1024*1024)/sizeof(W_)))
 
@@ -916,6 +1069,12 @@ memInventory (rtsBool show)
                  arena_blocks, MB(arena_blocks));
       debugBelch("  exec         : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  exec_blocks, MB(exec_blocks));
+      debugBelch("  block caches : %5" FMT_Word " blocks (%6.1lf MB)\n",
+                 cached_blocks, MB(cached_blocks));
+      debugBelch("  frozen       : %5" FMT_Word " blocks (%6.1lf MB)\n",
+                 frozen, MB(frozen));
+      debugBelch("  deferred     : %5" FMT_Word " blocks (%6.1lf MB)\n",
+                 deferred, MB(deferred));
       debugBelch("  free         : %5" FMT_Word " blocks (%6.1lf MB)\n",
                  free_blocks, MB(free_blocks));
       debugBelch("  total        : %5" FMT_Word " blocks (%6.1lf MB)\n",
@@ -27,6 +27,7 @@
 #include "Sanity.h"
 #include "Capability.h"
 #include "LdvProfile.h"
+#include "Freeze.h"
 
 static void scavenge_stack (StgPtr p, StgPtr stack_end);
 
@@ -98,6 +99,43 @@ scavengeTSO (StgTSO *tso)
     gct->eager_promotion = saved_eager;
 }
 
+/* -----------------------------------------------------------------------------
+   Evacuate the pointer fields p..end-1 of an object
+
+   With GC_PREFETCH (GcPrefetch=YES in build.mk) the fields form a
+   prefetch queue: we prefetch the object that the field
+   GC_PREFETCH_DIST ahead points to, and its block descriptor, so that
+   by the time we evacuate it, both are (hopefully) in the cache, and
+   the misses overlap with the work on the fields in front of it.  The
+   queue doesn't carry over from one object to the next, because
+   gct->failed_to_evac has to be settled for each object (or card)
+   before we move on, and some objects also change gct->eager_promotion
+   around their fields.
+   -------------------------------------------------------------------------- */
+
+STATIC_INLINE void
+evacuate_ptrs (StgPtr p, StgPtr end)
+{
+#if defined(GC_PREFETCH)
+    StgPtr q;
+
+    for (q = p; q < end && q < p + GC_PREFETCH_DIST; q++) {
+        prefetch_closure(*q);
+    }
+    for (; p < end; p++) {
+        if (q < end) {
+            prefetch_closure(*q);
+            q++;
+        }
+        evacuate((StgClosure **)p);
+    }
+#else
+    for (; p < end; p++) {
+        evacuate((StgClosure **)p);
+    }
+#endif
+}
+
 /* -----------------------------------------------------------------------------
    Mutable arrays of pointers
    -------------------------------------------------------------------------- */
@@ -113,9 +151,8 @@ static StgPtr scavenge_mut_arr_ptrs (StgMutArrPtrs *a)
     for (m = 0; (int)m < (int)mutArrPtrsCards(a->ptrs) - 1; m++)
     {
         q = p + (1 << MUT_ARR_PTRS_CARD_BITS);
-        for (; p < q; p++) {
-            evacuate((StgClosure**)p);
-        }
+        evacuate_ptrs(p, q);
+        p = q;
         if (gct->failed_to_evac) {
             any_failed = rtsTrue;
             *mutArrPtrsCard(a,m) = 1;
@@ -127,9 +164,8 @@ static StgPtr scavenge_mut_arr_ptrs (StgMutArrPtrs *a)
 
     q = (StgPtr)&a->payload[a->ptrs];
     if (p < q) {
-        for (; p < q; p++) {
-            evacuate((StgClosure**)p);
-        }
+        evacuate_ptrs(p, q);
+        p = q;
         if (gct->failed_to_evac) {
             any_failed = rtsTrue;
             *mutArrPtrsCard(a,m) = 1;
@@ -146,20 +182,28 @@ static StgPtr scavenge_mut_arr_ptrs (StgMutArrPtrs *a)
 // scavenge only the marked areas of a MUT_ARR_PTRS
 static StgPtr scavenge_mut_arr_ptrs_marked (StgMutArrPtrs *a)
 {
-    W_ m;
+    W_ m, cards;
     StgPtr p, q;
     rtsBool any_failed;
 
     any_failed = rtsFalse;
-    for (m = 0; m < mutArrPtrsCards(a->ptrs); m++)
+    cards = mutArrPtrsCards(a->ptrs);
+    for (m = 0; m < cards; m++)
     {
+        // The card table is word-aligned, so skip clean cards a word
+        // at a time: most of a large old array is usually clean.
+        while (m % sizeof(W_) == 0 && m + sizeof(W_) <= cards
+               && *(StgWord *)mutArrPtrsCard(a,m) == 0) {
+            m += sizeof(W_);
+        }
+        if (m >= cards) break;
+
         if (*mutArrPtrsCard(a,m) != 0) {
             p = (StgPtr)&a->payload[m << MUT_ARR_PTRS_CARD_BITS];
             q = stg_min(p + (1 << MUT_ARR_PTRS_CARD_BITS),
                         (StgPtr)&a->payload[a->ptrs]);
-            for (; p < q; p++) {
-                evacuate((StgClosure**)p);
-            }
+            evacuate_ptrs(p, q);
+            p = q;
             if (gct->failed_to_evac) {
                 any_failed = rtsTrue;
                 gct->failed_to_evac = rtsFalse;
@@ -173,6 +217,124 @@ static StgPtr scavenge_mut_arr_ptrs_marked (StgMutArrPtrs *a)
     return (StgPtr)a + mut_arr_ptrs_sizeW(a);
 }
 
+/* -----------------------------------------------------------------------------
+   Splitting large arrays
+
+   A large object is scavenged by the GC thread that evacuated it, so a
+   parallel GC that finds one huge array of pointers would have one
+   thread scan all of it while the others wait.  Instead, when work
+   stealing is on, scavenge_large() puts an array of more than a few
+   chunks of ARR_WORK_CHUNK_CARDS cards into a pool (see GCUtils.c),
+   and every GC thread looking for work claims chunks from it in turn
+   (scavenge_find_work()).  Each chunk sets its own cards, and the
+   thread that finishes the last chunk sets the array's info pointer
+   and puts it on the mutable list, as scavenge_one() would have done.
+   -------------------------------------------------------------------------- */
+
+#if defined(PARALLEL_GC)
+static rtsBool
+split_large_array (StgPtr p, nat gen_no)
+{
+    StgMutArrPtrs *a = (StgMutArrPtrs *)p;
+    const StgInfoTable *info;
+    arr_work *w;
+    W_ cards;
+
+    if (n_gc_threads == 1 || !work_stealing) return rtsFalse;
+
+    info = get_itbl((StgClosure *)p);
+    switch (info->type) {
+    case MUT_ARR_PTRS_CLEAN:
+    case MUT_ARR_PTRS_DIRTY:
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0:
+        break;
+    default:
+        return rtsFalse;
+    }
+
+    cards = mutArrPtrsCards(a->ptrs);
+    if (cards <= 4 * ARR_WORK_CHUNK_CARDS) return rtsFalse;
+
+    w = new_arr_work();
+    if (w == NULL) return rtsFalse;
+
+    w->gen_no = gen_no;
+    w->mutable = info->type == MUT_ARR_PTRS_CLEAN ||
+                 info->type == MUT_ARR_PTRS_DIRTY;
+    w->n_chunks = (cards + ARR_WORK_CHUNK_CARDS - 1) / ARR_WORK_CHUNK_CARDS;
+    w->next_chunk = 0;
+    w->done_chunks = 0;
+    w->failed = 0;
+    write_barrier();
+    w->arr = a;
+
+    debugTrace(DEBUG_gc, "splitting array %p into %" FMT_Word " chunks",
+               a, w->n_chunks);
+    return rtsTrue;
+}
+
+static void
+scavenge_arr_chunk (arr_work *w, StgWord chunk)
+{
+    StgMutArrPtrs *a = w->arr;
+    rtsBool saved_eager_promotion = gct->eager_promotion;
+    nat saved_evac_gen_no = gct->evac_gen_no;
+    rtsBool any_failed = rtsFalse;
+    W_ m, end;
+    StgPtr p, q;
+
+    gct->evac_gen_no = w->gen_no;
+    if (w->mutable) {
+        // see the MUT_ARR_PTRS case of scavenge_one()
+        gct->eager_promotion = rtsFalse;
+    }
+
+    end = stg_min((chunk + 1) * ARR_WORK_CHUNK_CARDS,
+                  mutArrPtrsCards(a->ptrs));
+    for (m = chunk * ARR_WORK_CHUNK_CARDS; m < end; m++) {
+        p = (StgPtr)&a->payload[m << MUT_ARR_PTRS_CARD_BITS];
+        q = stg_min(p + (1 << MUT_ARR_PTRS_CARD_BITS),
+                    (StgPtr)&a->payload[a->ptrs]);
+        evacuate_ptrs(p, q);
+        gct->scanned += q - p;
+        if (gct->failed_to_evac) {
+            any_failed = rtsTrue;
+            *mutArrPtrsCard(a,m) = 1;
+            gct->failed_to_evac = rtsFalse;
+        } else {
+            *mutArrPtrsCard(a,m) = 0;
+        }
+    }
+
+    if (any_failed) {
+        w->failed = 1;
+    }
+
+    gct->eager_promotion = saved_eager_promotion;
+    gct->evac_gen_no = saved_evac_gen_no;
+
+    // atomic_inc() is a barrier, so the last thread sees every failure
+    if (atomic_inc(&w->done_chunks, 1) == w->n_chunks) {
+        if (w->mutable) {
+            SET_INFO((StgClosure *)a, w->failed ?
+                     &stg_MUT_ARR_PTRS_DIRTY_info :
+                     &stg_MUT_ARR_PTRS_CLEAN_info);
+            if (w->gen_no > 0) {
+                recordMutableGen_GC((StgClosure *)a, w->gen_no);
+            }
+        } else {
+            SET_INFO((StgClosure *)a, w->failed ?
+                     &stg_MUT_ARR_PTRS_FROZEN0_info :
+                     &stg_MUT_ARR_PTRS_FROZEN_info);
+            if (w->failed && w->gen_no > 0) {
+                recordMutableGen_GC((StgClosure *)a, w->gen_no);
+            }
+        }
+    }
+}
+#endif
+
 STATIC_INLINE StgPtr
 scavenge_small_bitmap (StgPtr p, StgWord size, StgWord bitmap)
 {
@@ -377,6 +539,25 @@ scavenge_fun_srt(const StgInfoTable *info)
     scavenge_srt((StgClosure **)GET_FUN_SRT(fun_info), fun_info->i.srt_bitmap);
 }
 
+/* -----------------------------------------------------------------------------
+   Small constructors
+
+   Like evacuate() (see evac_fixed_sizeW[] in Evac.c), scavenge_block()
+   dispatches the commonest objects, constructors of the fixed layouts,
+   through a table rather than the switch: the entry for a closure type
+   is its size in words shifted left by 2, plus its number of pointers,
+   or 0 if it isn't one of them.  Functions and thunks of the same
+   layouts have an SRT, so they still go through the switch.
+   -------------------------------------------------------------------------- */
+
+static const StgWord8 scav_constr_layout[N_CLOSURE_TYPES] = {
+    [CONSTR_1_0] = ((sizeofW(StgHeader) + 1) << 2) | 1,
+    [CONSTR_0_1] = ((sizeofW(StgHeader) + 1) << 2) | 0,
+    [CONSTR_2_0] = ((sizeofW(StgHeader) + 2) << 2) | 2,
+    [CONSTR_1_1] = ((sizeofW(StgHeader) + 2) << 2) | 1,
+    [CONSTR_0_2] = ((sizeofW(StgHeader) + 2) << 2) | 0,
+};
+
 /* -----------------------------------------------------------------------------
    Scavenge a block from the given scan pointer up to bd->free.
 
@@ -396,6 +577,7 @@ scavenge_block (bdescr *bd)
   StgInfoTable *info;
   rtsBool saved_eager_promotion;
   gen_workspace *ws;
+  StgWord layout;
 
   debugTrace(DEBUG_gc, "scavenging block %p (gen %d) @ %p",
              bd->start, bd->gen_no, bd->u.scan);
@@ -421,6 +603,20 @@ scavenge_block (bdescr *bd)
     ASSERT(gct->thunk_selector_depth == 0);
 
     q = p;
+
+    layout = scav_constr_layout[info->type];
+    if (layout != 0) {
+        switch (layout & 3) {
+        case 2:
+            evacuate(&((StgClosure *)p)->payload[1]);
+            // fall through
+        case 1:
+            evacuate(&((StgClosure *)p)->payload[0]);
+        }
+        p += layout >> 2;
+        goto done;
+    }
+
     switch (info->type) {
 
     case MVAR_CLEAN:
@@ -537,10 +733,8 @@ scavenge_block (bdescr *bd)
 
         scavenge_thunk_srt(info);
         end = (P_)((StgThunk *)p)->payload + info->layout.payload.ptrs;
-        for (p = (P_)((StgThunk *)p)->payload; p < end; p++) {
-            evacuate((StgClosure **)p);
-        }
-        p += info->layout.payload.nptrs;
+        evacuate_ptrs((P_)((StgThunk *)p)->payload, end);
+        p = end + info->layout.payload.nptrs;
         break;
     }
 
@@ -552,10 +746,8 @@ scavenge_block (bdescr *bd)
         StgPtr end;
 
         end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
-        for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-            evacuate((StgClosure **)p);
-        }
-        p += info->layout.payload.nptrs;
+        evacuate_ptrs((P_)((StgClosure *)p)->payload, end);
+        p = end + info->layout.payload.nptrs;
         break;
     }
 
@@ -690,9 +882,8 @@ scavenge_block (bdescr *bd)
         // avoid traversing it during minor GCs.
         gct->eager_promotion = rtsFalse;
         next = p + small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs*)p);
-        for (p = (P_)((StgSmallMutArrPtrs *)p)->payload; p < next; p++) {
-            evacuate((StgClosure **)p);
-        }
+        evacuate_ptrs((P_)((StgSmallMutArrPtrs *)p)->payload, next);
+        p = next;
         gct->eager_promotion = saved_eager_promotion;
 
         if (gct->failed_to_evac) {
@@ -712,9 +903,8 @@ scavenge_block (bdescr *bd)
         StgPtr next;
 
         next = p + small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs*)p);
-        for (p = (P_)((StgSmallMutArrPtrs *)p)->payload; p < next; p++) {
-            evacuate((StgClosure **)p);
-        }
+        evacuate_ptrs((P_)((StgSmallMutArrPtrs *)p)->payload, next);
+        p = next;
 
         // If we're going to put this object on the mutable list, then
         // set its info ptr to SMALL_MUT_ARR_PTRS_FROZEN0 to indicate that.
@@ -754,10 +944,8 @@ scavenge_block (bdescr *bd)
         gct->eager_promotion = rtsFalse;
 
         end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
-        for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-            evacuate((StgClosure **)p);
-        }
-        p += info->layout.payload.nptrs;
+        evacuate_ptrs((P_)((StgClosure *)p)->payload, end);
+        p = end + info->layout.payload.nptrs;
 
         gct->eager_promotion = saved_eager_promotion;
         gct->failed_to_evac = rtsTrue; // mutable
@@ -794,6 +982,7 @@ scavenge_block (bdescr *bd)
      * Case (b) arises if we didn't manage to promote everything that
      * the current object points to into the current generation.
      */
+  done:
     if (gct->failed_to_evac) {
         gct->failed_to_evac = rtsFalse;
         if (bd->gen_no > 0) {
@@ -940,9 +1129,8 @@ scavenge_mark_stack(void)
 
             scavenge_thunk_srt(info);
             end = (P_)((StgThunk *)p)->payload + info->layout.payload.ptrs;
-            for (p = (P_)((StgThunk *)p)->payload; p < end; p++) {
-                evacuate((StgClosure **)p);
-            }
+            evacuate_ptrs((P_)((StgThunk *)p)->payload, end);
+            p = end;
             break;
         }
 
@@ -954,9 +1142,8 @@ scavenge_mark_stack(void)
             StgPtr end;
 
             end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
-            for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-                evacuate((StgClosure **)p);
-            }
+            evacuate_ptrs((P_)((StgClosure *)p)->payload, end);
+            p = end;
             break;
         }
 
@@ -1095,9 +1282,8 @@ scavenge_mark_stack(void)
             saved_eager = gct->eager_promotion;
             gct->eager_promotion = rtsFalse;
             next = p + small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs*)p);
-            for (p = (P_)((StgSmallMutArrPtrs *)p)->payload; p < next; p++) {
-                evacuate((StgClosure **)p);
-            }
+            evacuate_ptrs((P_)((StgSmallMutArrPtrs *)p)->payload, next);
+            p = next;
             gct->eager_promotion = saved_eager;
 
             if (gct->failed_to_evac) {
@@ -1117,9 +1303,8 @@ scavenge_mark_stack(void)
             StgPtr next, q = p;
 
             next = p + small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs*)p);
-            for (p = (P_)((StgSmallMutArrPtrs *)p)->payload; p < next; p++) {
-                evacuate((StgClosure **)p);
-            }
+            evacuate_ptrs((P_)((StgSmallMutArrPtrs *)p)->payload, next);
+            p = next;
 
             // If we're going to put this object on the mutable list, then
             // set its info ptr to SMALL_MUT_ARR_PTRS_FROZEN0 to indicate that.
@@ -1157,9 +1342,8 @@ scavenge_mark_stack(void)
             gct->eager_promotion = rtsFalse;
 
             end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
-            for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-                evacuate((StgClosure **)p);
-            }
+            evacuate_ptrs((P_)((StgClosure *)p)->payload, end);
+            p = end;
 
             gct->eager_promotion = saved_eager_promotion;
             gct->failed_to_evac = rtsTrue; // mutable
@@ -1410,9 +1594,8 @@ scavenge_one(StgPtr p)
         gct->eager_promotion = rtsFalse;
         q = p;
         next = p + small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs*)p);
-        for (p = (P_)((StgSmallMutArrPtrs *)p)->payload; p < next; p++) {
-            evacuate((StgClosure **)p);
-        }
+        evacuate_ptrs((P_)((StgSmallMutArrPtrs *)p)->payload, next);
+        p = next;
         gct->eager_promotion = saved_eager;
 
         if (gct->failed_to_evac) {
@@ -1432,9 +1615,8 @@ scavenge_one(StgPtr p)
         StgPtr next, q=p;
 
         next = p + small_mut_arr_ptrs_sizeW((StgSmallMutArrPtrs*)p);
-        for (p = (P_)((StgSmallMutArrPtrs *)p)->payload; p < next; p++) {
-            evacuate((StgClosure **)p);
-        }
+        evacuate_ptrs((P_)((StgSmallMutArrPtrs *)p)->payload, next);
+        p = next;
 
         // If we're going to put this object on the mutable list, then
         // set its info ptr to SMALL_MUT_ARR_PTRS_FROZEN0 to indicate that.
@@ -1472,9 +1654,8 @@ scavenge_one(StgPtr p)
         gct->eager_promotion = rtsFalse;
 
         end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
-        for (p = (P_)((StgClosure *)p)->payload; p < end; p++) {
-            evacuate((StgClosure **)p);
-        }
+        evacuate_ptrs((P_)((StgClosure *)p)->payload, end);
+        p = end;
 
         gct->eager_promotion = saved_eager_promotion;
         gct->failed_to_evac = rtsTrue; // mutable
@@ -1554,16 +1735,38 @@ scavenge_one(StgPtr p)
 void
 scavenge_mutable_list(bdescr *bd, generation *gen)
 {
-    StgPtr p, q;
+    StgPtr p, q, prev;
     nat gen_no;
+    rtsBool frozen;
 
     gen_no = gen->no;
     gct->evac_gen_no = gen_no;
+    prev = NULL;
     for (; bd != NULL; bd = bd->link) {
         for (q = bd->start; q < bd->free; q++) {
             p = (StgPtr)*q;
             ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
 
+            // An object that is mutated repeatedly can be recorded
+            // several times in a row (e.g. concurrent writeMutVars, or
+            // an object that failed to evacuate last time and was
+            // recorded twice).  Scavenging it once is enough, and
+            // dropping the duplicate here stops it being carried over
+            // to the next GC.
+            if (p == prev) {
+                gct->mut_list_dups++;
+                continue;
+            }
+            prev = p;
+
+            // In a major GC we only get here for the entries for the
+            // frozen heap (see Freeze.c); the rest of the list belongs
+            // to a collected generation.
+            frozen = isFrozen(p);
+            if (!frozen && gen_no <= N) {
+                continue;
+            }
+
 #ifdef DEBUG
             switch (get_itbl((StgClosure *)p)->type) {
             case MUT_VAR_CLEAN:
@@ -1634,6 +1837,13 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
                 ;
             }
 
+            // Nothing traces the frozen heap, so a frozen object stays
+            // on the list, and dirty so that the mutator doesn't
+            // record it again.
+            if (frozen) {
+                gct->failed_to_evac = rtsTrue;
+            }
+
             if (scavenge_one(p)) {
                 // didn't manage to promote everything, so put the
                 // object back on the list.
@@ -1659,6 +1869,16 @@ scavenge_capability_mut_lists (Capability *cap)
         freeChain_sync(cap->saved_mut_lists[g]);
         cap->saved_mut_lists[g] = NULL;
     }
+
+    /* In a major GC, the frozen heap's entries on the mutable list of
+     * the oldest generation are roots too (see Freeze.c).
+     */
+    g = RtsFlags.GcFlags.generations-1;
+    if (N == g && cap->saved_mut_lists[g] != NULL) {
+        scavenge_mutable_list(cap->saved_mut_lists[g], &generations[g]);
+        freeChain_sync(cap->saved_mut_lists[g]);
+        cap->saved_mut_lists[g] = NULL;
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -1691,10 +1911,13 @@ scavenge_static(void)
      * (static_objects is a global)
      */
     p = gct->static_objects;
-    if (p == END_OF_STATIC_LIST) {
+    if (p == END_OF_STATIC_OBJECT_LIST) {
           break;
     }
 
+    // the links are tagged; see Note [STATIC_LINK fields] in Storage.h
+    p = UNTAG_STATIC_LIST_PTR(p);
+
     ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
     info = get_itbl(p);
     /*
@@ -1708,7 +1931,7 @@ scavenge_static(void)
      */
     gct->static_objects = *STATIC_LINK(info,p);
     *STATIC_LINK(info,p) = gct->scavenged_static_objects;
-    gct->scavenged_static_objects = p;
+    gct->scavenged_static_objects = (StgClosure *)((StgWord)p | static_flag);
 
     switch (info -> type) {
 
@@ -1796,6 +2019,8 @@ scavenge_stack(StgPtr p, StgPtr stack_end)
   StgWord bitmap;
   StgWord size;
 
+  gct->stack_scanned += stack_end - p;
+
   /*
    * Each time around this loop, we are looking at a chunk of stack
    * that starts with an activation record.
@@ -1944,15 +2169,19 @@ scavenge_large (gen_workspace *ws)
         // take this object *off* the large objects list and put it on
         // the scavenged large objects list.  This is so that we can
         // treat new_large_objects as a stack and push new objects on
-        // the front when evacuating.
-        ws->todo_large_objects = bd->link;
+        // the front when evacuating.  Both lists are our own, and are
+        // linked through bd->u.back (see evacuate_large()).
+        ws->todo_large_objects = bd->u.back;
 
-        ACQUIRE_SPIN_LOCK(&ws->gen->sync);
-        dbl_link_onto(bd, &ws->gen->scavenged_large_objects);
-        ws->gen->n_scavenged_large_blocks += bd->blocks;
-        RELEASE_SPIN_LOCK(&ws->gen->sync);
+        bd->u.back = ws->scavd_large_objects;
+        ws->scavd_large_objects = bd;
+        ws->n_scavd_large_blocks += bd->blocks;
 
         p = bd->start;
+#if defined(PARALLEL_GC)
+        // the chunks are counted in gct->scanned as they are done
+        if (split_large_array(p, ws->gen->no)) continue;
+#endif
         if (scavenge_one(p)) {
             if (ws->gen->no > 0) {
                 recordMutableGen_GC((StgClosure *)p, ws->gen->no);
@@ -2032,6 +2261,18 @@ loop:
 
 #if defined(THREADED_RTS)
     if (work_stealing) {
+#if defined(PARALLEL_GC)
+        // help with a large array (see "Splitting large arrays")
+        {
+            arr_work *w;
+            StgWord chunk;
+            if ((w = grab_arr_work(&chunk)) != NULL) {
+                scavenge_arr_chunk(w, chunk);
+                did_anything = rtsTrue;
+                goto loop;
+            }
+        }
+#endif
         // look for work to steal
         for (g = RtsFlags.GcFlags.generations-1; g >= 0; g--) {
             if ((bd = steal_todo_block(g)) != NULL) {
@@ -2066,7 +2307,7 @@ loop:
     work_to_do = rtsFalse;
 
     // scavenge static objects
-    if (major_gc && gct->static_objects != END_OF_STATIC_LIST) {
+    if (major_gc && gct->static_objects != END_OF_STATIC_OBJECT_LIST) {
         IF_DEBUG(sanity, checkStaticObjects(gct->static_objects));
         scavenge_static();
     }
@@ -34,6 +34,11 @@
 #endif
 
 #include <string.h>
+#include <errno.h>
+#if !defined(mingw32_HOST_OS)
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
 
 #include "ffi.h"
 
@@ -53,10 +58,18 @@ bdescr *exec_block;
 generation *generations = NULL; /* all the generations */
 generation *g0          = NULL; /* generation 0, for convenience */
 generation *oldest_gen  = NULL; /* oldest generation, for convenience */
+nat last_aging_gen      = 0;    /* see Note [Aging] in GC.c */
 
 nursery *nurseries = NULL;     /* array of nurseries, size == n_capabilities */
 nat n_nurseries;
-volatile StgWord next_nursery = 0;
+
+/*
+ * When we are using nursery chunks, we need a separate next_nursery
+ * pointer for each NUMA node.  Nursery i lives on NUMA node
+ * (i % n_numa_nodes), so next_nursery[node] starts at 'node' and is
+ * stepped by n_numa_nodes.
+ */
+volatile StgWord next_nursery[MAX_NUMA_NODES];
 
 #ifdef THREADED_RTS
 /*
@@ -89,6 +102,12 @@ initGeneration (generation *gen, int g)
     gen->n_new_large_words = 0;
     gen->scavenged_large_objects = NULL;
     gen->n_scavenged_large_blocks = 0;
+    gen->compact_objects = NULL;
+    gen->n_compact_blocks = 0;
+    gen->n_pinned_blocks = 0;
+    gen->n_pinned_live_words = 0;
+    gen->live_compact_objects = NULL;
+    gen->n_live_compact_blocks = 0;
     gen->mark = 0;
     gen->compact = 0;
     gen->bitmap = NULL;
@@ -98,13 +117,12 @@ initGeneration (generation *gen, int g)
     gen->threads = END_TSO_QUEUE;
     gen->old_threads = END_TSO_QUEUE;
     gen->weak_ptr_list = NULL;
-    gen->old_weak_ptr_list = NULL;
 }
 
 void
 initStorage (void)
 {
-  nat g;
+  nat g, n;
 
   if (generations != NULL) {
       // multi-init protection
@@ -161,6 +179,10 @@ initStorage (void)
       generations[g].to = &generations[g+1];
   }
   oldest_gen->to = oldest_gen;
+
+  /* Generations 1..last_aging_gen hold the objects that are still
+   * aging (see Note [Aging] in GC.c) */
+  last_aging_gen = RtsFlags.GcFlags.tenureAge - 2;
   
   /* The oldest generation has one step. */
   if (RtsFlags.GcFlags.compact || RtsFlags.GcFlags.sweep) {
@@ -175,9 +197,9 @@ initStorage (void)
 
   generations[0].max_blocks = 0;
 
-  dyn_caf_list = (StgIndStatic*)END_OF_STATIC_LIST;
-  debug_caf_list = (StgIndStatic*)END_OF_STATIC_LIST;
-  revertible_caf_list = (StgIndStatic*)END_OF_STATIC_LIST;
+  dyn_caf_list = (StgIndStatic*)END_OF_CAF_LIST;
+  debug_caf_list = (StgIndStatic*)END_OF_CAF_LIST;
+  revertible_caf_list = (StgIndStatic*)END_OF_CAF_LIST;
    
   /* initialise the allocate() interface */
   large_alloc_lim = RtsFlags.GcFlags.minAllocAreaSize * BLOCK_SIZE_W;
@@ -193,7 +215,9 @@ initStorage (void)
 
   N = 0;
 
-  next_nursery = 0;
+  for (n = 0; n < n_numa_nodes; n++) {
+      next_nursery[n] = n;
+  }
   storageAddCapabilities(0, n_capabilities);
 
   IF_DEBUG(gc, statDescribeGens());
@@ -254,7 +278,8 @@ void storageAddCapabilities (nat from, nat to)
     // allocate a block for each mut list
     for (n = from; n < to; n++) {
         for (g = 1; g < RtsFlags.GcFlags.generations; g++) {
-            capabilities[n]->mut_lists[g] = allocBlock();
+            capabilities[n]->mut_lists[g] =
+                allocBlockOnNode(capNoToNumaNode(n));
         }
     }
 
@@ -269,6 +294,7 @@ void storageAddCapabilities (nat from, nat to)
 void
 exitStorage (void)
 {
+    freeDeferredChains_lock();
     updateNurseriesStats();
     stat_exit();
 }
@@ -426,7 +452,8 @@ newCAF(StgRegTable *reg, StgIndStatic *caf)
         // out whether it is from a dynamic library.
 
         ACQUIRE_SM_LOCK; // dyn_caf_list is global, locked by sm_mutex
-        caf->static_link = (StgClosure*)dyn_caf_list;
+        caf->static_link = (StgClosure*)((StgWord)dyn_caf_list |
+                                         STATIC_FLAG_LIST);
         dyn_caf_list = caf;
         RELEASE_SM_LOCK;
     }
@@ -483,7 +510,8 @@ newDynCAF (StgRegTable *reg, StgIndStatic *caf)
 
     ACQUIRE_SM_LOCK;
 
-    caf->static_link = (StgClosure*)revertible_caf_list;
+    caf->static_link = (StgClosure*)((StgWord)revertible_caf_list |
+                                     STATIC_FLAG_LIST);
     revertible_caf_list = caf;
 
     RELEASE_SM_LOCK;
@@ -495,8 +523,28 @@ newDynCAF (StgRegTable *reg, StgIndStatic *caf)
    Nursery management.
    -------------------------------------------------------------------------- */
 
+/* Note [Pretenuring]
+   ~~~~~~~~~~~~~~~~~~
+   Data that a program builds to keep, such as a cache, is allocated in
+   the nursery like everything else, and is copied by the GC into g0
+   and then into each older generation in turn.  A thread can instead
+   ask for the objects it allocates to be pretenured into generation g
+   (rts_setThreadPretenuring(), GHC.Conc.setPretenureGeneration): each
+   nursery block gets a destination generation (bd->dest_no) when the
+   Capability starts allocating into it, taken from cap->pretenure_gen,
+   which is the pretenure_gen of the thread it is running.  When an
+   object in the block survives a GC, evacuate() copies it straight
+   into generation g, so it is copied once, and the objects it points
+   to are promoted along with it.
+
+   The block is the unit, so this is accurate only to a block: a block
+   that one thread starts and another finishes goes where the first
+   one's objects go.  Large and pinned objects are never copied, so
+   they are not affected.
+*/
+
 static bdescr *
-allocNursery (bdescr *tail, W_ blocks)
+allocNursery (nat node, bdescr *tail, W_ blocks)
 {
     bdescr *bd = NULL;
     W_ i, n;
@@ -512,7 +560,7 @@ allocNursery (bdescr *tail, W_ blocks)
         // allocLargeChunk will prefer large chunks, but will pick up
         // small chunks if there are any available.  We must allow
         // single blocks here to avoid fragmentation (#7257)
-        bd = allocLargeChunk(1, n);
+        bd = allocLargeChunkOnNode(node, 1, n);
         n = bd->blocks;
         blocks -= n;
 
@@ -551,7 +599,7 @@ assignNurseryToCapability (Capability *cap, nat n)
 {
     cap->r.rNursery = &nurseries[n];
     cap->r.rCurrentNursery = nurseries[n].blocks;
-    newNurseryBlock(nurseries[n].blocks);
+    newNurseryBlock(cap, nurseries[n].blocks);
     cap->r.rCurrentAlloc   = NULL;
 }
 
@@ -562,18 +610,29 @@ assignNurseryToCapability (Capability *cap, nat n)
 static void
 assignNurseriesToCapabilities (nat from, nat to)
 {
-    nat i;
+    nat i, node;
 
     for (i = from; i < to; i++) {
-        assignNurseryToCapability(capabilities[i], next_nursery++);
+        node = capabilities[i]->node;
+        assignNurseryToCapability(capabilities[i], next_nursery[node]);
+        next_nursery[node] += n_numa_nodes;
     }
 }
 
+// The nursery that a Capability other than 0 starts with, when there
+// are no nursery chunks.  Many programs run with -N but only ever use
+// one Capability, or only a little of the others before the first GC,
+// so there's no point in allocating (and initialising the block
+// descriptors of) -A for each of them at startup.  A Capability that
+// does run out of its small nursery triggers a GC, and every GC resizes
+// all the nurseries to their proper size (see resize_nursery()).
+#define INITIAL_EXTRA_NURSERY_BLOCKS 16
+
 static void
 allocNurseries (nat from, nat to)
 { 
     nat i;
-    memcount n_blocks;
+    memcount n_blocks, n;
 
     if (RtsFlags.GcFlags.nurseryChunkSize) {
         n_blocks = RtsFlags.GcFlags.nurseryChunkSize;
@@ -582,20 +641,27 @@ allocNurseries (nat from, nat to)
     }
 
     for (i = from; i < to; i++) {
-        nurseries[i].blocks = allocNursery(NULL, n_blocks);
-        nurseries[i].n_blocks = n_blocks;
+        n = n_blocks;
+        if (i > 0 && RtsFlags.GcFlags.nurseryChunkSize == 0) {
+            n = stg_min(n_blocks, INITIAL_EXTRA_NURSERY_BLOCKS);
+        }
+        nurseries[i].blocks = allocNursery(capNoToNumaNode(i), NULL, n);
+        nurseries[i].n_blocks = n;
     }
 }
       
 void
 resetNurseries (void)
 {
-    next_nursery = 0;
+    nat n;
+
+    for (n = 0; n < n_numa_nodes; n++) {
+        next_nursery[n] = n;
+    }
     assignNurseriesToCapabilities(0, n_capabilities);
 
 #ifdef DEBUG
     bdescr *bd;
-    nat n;
     for (n = 0; n < n_nurseries; n++) {
         for (bd = nurseries[n].blocks; bd; bd = bd->link) {
             ASSERT(bd->gen_no == 0);
@@ -623,6 +689,9 @@ resizeNursery (nursery *nursery, W_ blocks)
 {
   bdescr *bd;
   W_ nursery_blocks;
+  nat node;
+
+  node = capNoToNumaNode(nursery - nurseries);
 
   nursery_blocks = nursery->n_blocks;
   if (nursery_blocks == blocks) return;
@@ -630,7 +699,7 @@ resizeNursery (nursery *nursery, W_ blocks)
   if (nursery_blocks < blocks) {
       debugTrace(DEBUG_gc, "increasing size of nursery to %d blocks", 
                  blocks);
-    nursery->blocks = allocNursery(nursery->blocks, blocks-nursery_blocks);
+    nursery->blocks = allocNursery(node, nursery->blocks, blocks-nursery_blocks);
   } 
   else {
     bdescr *next_bd;
@@ -650,7 +719,8 @@ resizeNursery (nursery *nursery, W_ blocks)
     // might have gone just under, by freeing a large block, so make
     // up the difference.
     if (nursery_blocks < blocks) {
-        nursery->blocks = allocNursery(nursery->blocks, blocks-nursery_blocks);
+        nursery->blocks = allocNursery(node, nursery->blocks,
+                                       blocks-nursery_blocks);
     }
   }
   
@@ -699,12 +769,39 @@ resizeNurseries (W_ blocks)
 rtsBool
 getNewNursery (Capability *cap)
 {
-    StgWord i = atomic_inc(&next_nursery, 1) - 1;
-    if (i >= n_nurseries) {
-        return rtsFalse;
+    StgWord i;
+    nat node = cap->node;
+    nat n;
+
+    for(;;) {
+        i = next_nursery[node];
+        if (i < n_nurseries) {
+            if (cas(&next_nursery[node], i, i+n_numa_nodes) == i) {
+                assignNurseryToCapability(cap, i);
+                return rtsTrue;
+            }
+        } else if (n_numa_nodes > 1) {
+            // Try to find an unused nursery chunk on other nodes.  We'll get
+            // remote memory, but the rationale is that avoiding GC is better
+            // than avoiding remote memory access.
+            rtsBool lost = rtsFalse;
+            for (n = 0; n < n_numa_nodes; n++) {
+                if (n == node) continue;
+                i = next_nursery[n];
+                if (i < n_nurseries) {
+                    if (cas(&next_nursery[n], i, i+n_numa_nodes) == i) {
+                        assignNurseryToCapability(cap, i);
+                        return rtsTrue;
+                    } else {
+                        lost = rtsTrue; /* lost a race */
+                    }
+                }
+            }
+            if (!lost) return rtsFalse;
+        } else {
+            return rtsFalse;
+        }
     }
-    assignNurseryToCapability(cap, i);
-    return rtsTrue;
 }
 
 /* -----------------------------------------------------------------------------
@@ -781,7 +878,7 @@ StgPtr allocate (Capability *cap, W_ n)
         }
 
         ACQUIRE_SM_LOCK
-        bd = allocGroup(req_blocks);
+        bd = allocGroupOnNode(cap->node,req_blocks);
         dbl_link_onto(bd, &g0->large_objects);
         g0->n_large_blocks += bd->blocks; // might be larger than req_blocks
         g0->n_new_large_words += n;
@@ -808,17 +905,16 @@ StgPtr allocate (Capability *cap, W_ n)
         if (bd == NULL) {
             // The nursery is empty: allocate a fresh block (we can't
             // fail here).
-            ACQUIRE_SM_LOCK;
-            bd = allocBlock();
+            bd = allocBlockCap_lock(cap);
             cap->r.rNursery->n_blocks++;
-            RELEASE_SM_LOCK;
             initBdescr(bd, g0, g0);
+            bd->dest_no = cap->pretenure_gen;
             bd->flags = 0;
             // If we had to allocate a new block, then we'll GC
             // pretty quickly now, because MAYBE_GC() will
             // notice that CurrentNursery->link is NULL.
         } else {
-            newNurseryBlock(bd);
+            newNurseryBlock(cap, bd);
             // we have a block in the nursery: take it and put
             // it at the *front* of the nursery list, and use it
             // to allocate() from.
@@ -867,6 +963,18 @@ StgPtr allocate (Capability *cap, W_ n)
    new block when the current one overflows.  The block is chained
    onto the large_object_list of generation 0.
 
+   There is a current block for each of a few size classes, so that
+   objects of similar size end up together: a block stays alive as
+   long as any object in it does, and mixing (say) the small, short
+   lived buffers of a network server with its long lived bigger ones
+   leaves many blocks alive for a handful of objects.  Each block also
+   records which of its objects the GC found alive and how big they
+   are (see PINNED_HDR_W in Storage.h), so that we can report how
+   fragmented the pinned blocks are (GCStats.pinned_bytes and
+   pinned_live_bytes).  We can't do anything about the fragmentation
+   beyond that, because pinned objects can't be moved: their address
+   may be held outside the heap.
+
    NOTE: The GC can't in general handle pinned objects.  This
    interface is only safe to use for ByteArrays, which have no
    pointers and don't require scavenging.  It works because the
@@ -883,11 +991,20 @@ StgPtr allocate (Capability *cap, W_ n)
    fills the allocated memory with a MutableByteArray#.
    ------------------------------------------------------------------------- */
 
+STATIC_INLINE nat
+pinnedClass (W_ n)
+{
+    if (n <= 8)  return 0;
+    if (n <= 64) return 1;
+    return 2;
+}
+
 StgPtr
 allocatePinned (Capability *cap, W_ n)
 {
     StgPtr p;
     bdescr *bd;
+    nat c;
 
     // If the request is for a large object, then allocate()
     // will give us a pinned object anyway.
@@ -906,8 +1023,9 @@ allocatePinned (Capability *cap, W_ n)
                       - n*sizeof(W_)));
     }
 
-    bd = cap->pinned_object_block;
-    
+    c = pinnedClass(n);
+    bd = cap->pinned_object_block[c];
+
     // If we don't have a block of pinned objects yet, or the current
     // one isn't large enough to hold the new object, get a new one.
     if (bd == NULL || (bd->free + n) > (bd->start + BLOCK_SIZE_W)) {
@@ -943,12 +1061,10 @@ allocatePinned (Capability *cap, W_ n)
             // counted towards allocation, and we're already counting
             // our pinned obects as allocation in
             // collect_pinned_object_blocks in the GC.
-            ACQUIRE_SM_LOCK;
-            bd = allocBlock();
-            RELEASE_SM_LOCK;
+            bd = allocBlockCap_lock(cap);
             initBdescr(bd, g0, g0);
         } else {
-            newNurseryBlock(bd);
+            newNurseryBlock(cap, bd);
             // we have a block in the nursery: steal it
             cap->r.rCurrentNursery->link = bd->link;
             if (bd->link != NULL) {
@@ -957,8 +1073,10 @@ allocatePinned (Capability *cap, W_ n)
             cap->r.rNursery->n_blocks -= bd->blocks;
         }
 
-        cap->pinned_object_block = bd;
-        bd->flags  = BF_PINNED | BF_LARGE | BF_EVACUATED;
+        cap->pinned_object_block[c] = bd;
+        bd->flags  = BF_PINNED | BF_PINNED_SMALL | BF_LARGE | BF_EVACUATED;
+        clearPinnedMarks(bd);
+        bd->free  += PINNED_HDR_W;
 
         // The pinned_object_block remains attached to the capability
         // until it is full, even if a GC occurs.  We want this
@@ -980,10 +1098,228 @@ allocatePinned (Capability *cap, W_ n)
     return p;
 }
 
+/* Note [Mapped byte arrays]
+
+   mapFileByteArray# makes a ByteArray# whose payload is a file,
+   mmap()ed read-only, so that a big file can be read without copying
+   it into the heap.  The array is an ordinary pinned large object with
+   the BF_MAPPED flag set, and the GC treats it like any other: it is
+   never copied, it is promoted by relinking its block group, and when
+   it dies its group is freed, at which point freeGroup() drops the
+   mapping.
+
+   The mapping goes inside the block group, so that the payload is in
+   the heap and Bdescr() works on it.  The group has one block more than
+   the payload needs; the StgArrWords header goes at the end of that
+   first block and the file is mapped (MAP_FIXED) from the start of the
+   second, which is page-aligned as long as BLOCK_SIZE is a multiple of
+   the page size.  bd->start points at the header, as the GC expects of
+   a large object, and freeGroup() puts it back.  osMapFile() fails on
+   memory that is backed by huge pages; we don't support mapped arrays
+   on Windows, where a file can't be mapped over part of a region.
+
+   The mapping is MAP_PRIVATE and PROT_READ: the array is immutable and
+   the file must not shrink while it is alive (reading past its end
+   raises SIGBUS).  The blocks count towards the heap size, and so
+   towards -M, but only the header is counted as allocation, since the
+   payload costs no copying.
+
+   The messages received from a shared-memory channel are mapped the
+   same way by allocateMappedBytes(), but MAP_SHARED (see Note [Shared
+   memory channels] in rts/ShmChannel.c).
+   -------------------------------------------------------------------------- */
+
+StgPtr
+allocateMappedFile (Capability *cap, StgInt fd)
+{
+#if !defined(mingw32_HOST_OS)
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) return NULL;
+
+    if (!S_ISREG(st.st_mode) || st.st_size <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((StgWord64)st.st_size > (HS_WORD_MAX & ~(BLOCK_SIZE-1)) - BLOCK_SIZE) {
+        errno = EFBIG;
+        return NULL;
+    }
+    return allocateMappedBytes(cap, fd, 0, (W_)st.st_size, rtsFalse);
+#else
+    (void)cap; (void)fd;
+    errno = ENOSYS;
+    return NULL;
+#endif
+}
+
+/* The part of allocateMappedFile() that makes the array, mapping bytes
+   bytes of fd from offset, which must be a multiple of the page size.
+   With shared, the mapping is MAP_SHARED, for the message buffers of
+   rts/ShmChannel.c. */
+StgPtr
+allocateMappedBytes (Capability *cap, int fd, StgWord64 offset, W_ bytes,
+                     rtsBool shared)
+{
+#if !defined(mingw32_HOST_OS)
+    StgArrWords *arr;
+    bdescr *bd;
+    W_ n, req_blocks;
+    int err;
+
+    if (BLOCK_SIZE % getPageSize() != 0) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    n = sizeofW(StgArrWords) + ROUNDUP_BYTES_TO_WDS(bytes);
+    req_blocks = 1 + (W_)BLOCK_ROUND_UP(bytes) / BLOCK_SIZE;
+
+    // like allocate(), but the program can recover from this one
+    if ((RtsFlags.GcFlags.maxHeapSize > 0 &&
+         req_blocks >= RtsFlags.GcFlags.maxHeapSize) ||
+        req_blocks >= HS_INT32_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ACQUIRE_SM_LOCK;
+    bd = allocGroupOnNode(cap->node, req_blocks);
+    RELEASE_SM_LOCK;
+
+    if (!osMapFile(bd->start + BLOCK_SIZE_W, bytes, fd, offset, shared)) {
+        err = errno;
+        freeGroup_lock(bd);
+        errno = err;
+        return NULL;
+    }
+
+    ACQUIRE_SM_LOCK;
+    dbl_link_onto(bd, &g0->large_objects);
+    g0->n_large_blocks += bd->blocks;
+    g0->n_new_large_words += sizeofW(StgArrWords);
+    RELEASE_SM_LOCK;
+
+    initBdescr(bd, g0, g0);
+    bd->flags = BF_LARGE | BF_PINNED | BF_MAPPED;
+    bd->start += BLOCK_SIZE_W - sizeofW(StgArrWords);
+    bd->free = bd->start + n;
+
+    TICK_ALLOC_HEAP_NOCTR(WDS(sizeofW(StgArrWords)));
+    CCS_ALLOC(cap->r.rCCCS, sizeofW(StgArrWords));
+    cap->total_allocated += sizeofW(StgArrWords);
+
+    arr = (StgArrWords *)bd->start;
+    SET_HDR(arr, &stg_ARR_WORDS_info, cap->r.rCCCS);
+    arr->bytes = bytes;
+    return (StgPtr)arr;
+#else
+    (void)cap; (void)fd; (void)offset; (void)bytes; (void)shared;
+    errno = ENOSYS;
+    return NULL;
+#endif
+}
+
+/* -----------------------------------------------------------------------------
+   Growing a large MutableByteArray# in place
+
+   resizeMutableByteArray# calls this before falling back to allocating a
+   new array and copying.  A large byte array has a block group of its
+   own, so we can grow it into the slop at the end of the group, or
+   extend the group with the free blocks that follow it (extendGroup()).
+   Returns rtsFalse if neither works.  (StgBool, because it is called
+   from Cmm.)
+   -------------------------------------------------------------------------- */
+
+StgBool
+growLargeByteArray (Capability *cap, StgArrWords *arr, W_ bytes)
+{
+    bdescr *bd;
+    W_ n, old_n, blocks, old_blocks;
+
+    bd = Bdescr((StgPtr)arr);
+    if (!(bd->flags & BF_LARGE) || (bd->flags & (BF_PINNED_SMALL|BF_MAPPED)) ||
+        bd->start != (StgPtr)arr) {
+        return rtsFalse;
+    }
+
+    old_n = arr_words_sizeW(arr);
+    n = sizeofW(StgArrWords) + ROUNDUP_BYTES_TO_WDS(bytes);
+    ASSERT(n > old_n);
+
+    blocks = (W_)BLOCK_ROUND_UP(n * sizeof(W_)) / BLOCK_SIZE;
+
+    ACQUIRE_SM_LOCK;
+    old_blocks = bd->blocks;
+    if (blocks > old_blocks && !extendGroup(bd, blocks)) {
+        RELEASE_SM_LOCK;
+        return rtsFalse;
+    }
+    bd->gen->n_large_blocks += bd->blocks - old_blocks;
+    if (bd->gen == g0) {
+        // counted as allocation, like allocate() does
+        g0->n_new_large_words += n - old_n;
+    } else {
+        bd->gen->n_large_words += n - old_n;
+    }
+    RELEASE_SM_LOCK;
+
+    bd->free = bd->start + n;
+    arr->bytes = bytes;
+
+    TICK_ALLOC_HEAP_NOCTR(WDS(n - old_n));
+    CCS_ALLOC(cap->r.rCCCS, n - old_n);
+    cap->total_allocated += n - old_n;
+    return rtsTrue;
+}
+
 /* -----------------------------------------------------------------------------
    Write Barriers
    -------------------------------------------------------------------------- */
 
+/* Note [Write barriers and concurrent marking]
+
+   The write barriers below exist only to maintain the generational
+   invariant: an old-generation object that may point into a younger
+   generation is on its Capability's mutable list.  They are not
+   enough to support marking the oldest generation concurrently with
+   the mutator, which is what a bounded-pause major GC would need.
+
+   A snapshot-at-the-beginning (SATB) marker must see every pointer
+   that was reachable when marking started, so every store that
+   overwrites a pointer in a heap object must first push the *old*
+   value onto a per-Capability remembered set while marking is in
+   progress.  In this RTS that is not the case:
+
+     - writeMutVar#, casMutVar#, atomicSwapMutVar# and
+       atomicModifyMutVar# call dirty_MUT_VAR() only for a MUT_VAR_CLEAN object, and only
+       *after* the new value has been stored, so the old value is
+       already gone (see StgCmmPrim and PrimOps.cmm);
+
+     - writeArray#, copyArray# and friends mark cards in generated
+       code and never call into the RTS;
+
+     - thunk updates (updateWithIndirection), stack frames and most
+       TSO fields are written without any barrier at all, relying on
+       the stack/TSO being scavenged in full while it is dirty.
+
+   A concurrent collector for the oldest generation also cannot use
+   the existing mark bitmaps in Compact.c/Sweep.c as-is, because the
+   copying collection of the younger generations keeps promoting
+   objects into the oldest generation's blocks while it is being
+   marked; promoted objects would need to be allocated black into a
+   separate, non-moving space.
+
+   So concurrent marking needs, at minimum: an old-value argument to
+   dirty_MUT_VAR and a barrier on every pointer store in the code
+   generator while marking is active; barriers on thunk update and on
+   stack/TSO mutation (or a re-scan of dirty stacks in the final
+   pause); and a non-moving allocator for objects promoted into the
+   oldest generation.  Until those exist, the oldest generation is
+   collected with the mutator stopped, by copying, by compaction
+   (+RTS -c) or by mark-sweep (+RTS -w).
+*/
+
 /*
    This is the write barrier for MUT_VARs, a.k.a. IORefs.  A
    MUT_VAR_CLEAN object is not on the mutable list; a MUT_VAR_DIRTY
@@ -1140,12 +1476,13 @@ W_ countOccupied (bdescr *bd)
 
 W_ genLiveWords (generation *gen)
 {
-    return gen->n_words + gen->n_large_words;
+    return gen->n_words + gen->n_large_words
+        + gen->n_compact_blocks * BLOCK_SIZE_W;
 }
 
 W_ genLiveBlocks (generation *gen)
 {
-    return gen->n_blocks + gen->n_large_blocks;
+    return gen->n_blocks + gen->n_large_blocks + gen->n_compact_blocks;
 }
 
 W_ gcThreadLiveWords (nat i, nat g)
@@ -1223,13 +1560,15 @@ calcNeeded (rtsBool force_major, memcount *blocks_needed)
         gen = &generations[g];
 
         blocks = gen->n_blocks // or: gen->n_words / BLOCK_SIZE_W (?)
-               + gen->n_large_blocks;
+               + gen->n_large_blocks
+               + gen->n_compact_blocks;
 
         // we need at least this much space
         needed += blocks;
         
         // are we collecting this gen?
         if (g == 0 || // always collect gen 0
+            (g <= last_aging_gen && blocks > 0) || // and the aging gens
             blocks > gen->max_blocks)
         {
             N = stg_max(N,g);
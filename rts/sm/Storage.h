@@ -29,6 +29,9 @@ void storageAddCapabilities (nat from, nat to);
    Storage manager state
    -------------------------------------------------------------------------- */
 
+// generations 1..last_aging_gen are aging (see Note [Aging] in GC.c)
+extern nat last_aging_gen;
+
 INLINE_HEADER rtsBool
 doYouWantToGC( Capability *cap )
 {
@@ -103,8 +106,30 @@ INLINE_HEADER void finishedNurseryBlock (Capability *cap, bdescr *bd) {
     cap->total_allocated += bd->free - bd->start;
 }
 
-INLINE_HEADER void newNurseryBlock (bdescr *bd) {
+//
+// Called when we start allocating into a nursery block.  Its objects
+// go to cap->pretenure_gen at the next GC (see Note [Pretenuring] in
+// Storage.c).
+//
+INLINE_HEADER void newNurseryBlock (Capability *cap, bdescr *bd) {
     bd->free = bd->start;
+    bd->dest_no = cap->pretenure_gen;
+}
+
+// A block of small pinned objects (BF_PINNED_SMALL) starts with a
+// bitmap with one bit per word of the block, in which the GC marks the
+// objects it finds alive, and the number of words they occupy.  The
+// header is an even number of words so that the objects stay
+// double-word aligned.
+#define PINNED_BITMAP_W       (BLOCK_SIZE_W / BITS_IN(W_))
+#define PINNED_HDR_W          (PINNED_BITMAP_W + 2)
+#define PINNED_LIVE_WORDS(bd) ((bd)->start[PINNED_BITMAP_W])
+
+INLINE_HEADER void clearPinnedMarks (bdescr *bd) {
+    nat i;
+    for (i = 0; i <= PINNED_BITMAP_W; i++) {
+        bd->start[i] = 0;
+    }
 }
 
 void    updateNurseriesStats (void);
@@ -133,14 +158,61 @@ W_    calcLiveWords  (void);
 
 extern bdescr *exec_block;
 
-#define END_OF_STATIC_LIST ((StgClosure*)1)
+/* -----------------------------------------------------------------------------
+   Note [STATIC_LINK fields]
+
+   A major GC chains the static objects that it reaches through their
+   static link fields (STATIC_LINK() in ClosureMacros.h), and the low 2
+   bits of the field say whether it has reached the object already:
+
+     00     we haven't seen this object before
+     01/10  if it equals static_flag, then we saw it in this GC,
+            otherwise in the previous major GC
+     11     ignore it: a static constructor with no CAF references (the
+            code generator gives it this value), or a CAF on one of the
+            CAF lists below, which are chained through static_link too
+
+   static_flag flips between STATIC_FLAG_A and STATIC_FLAG_B at each
+   major GC, so the links don't have to be cleared after the GC for
+   the next one to see that it hasn't reached the objects yet, and an
+   object that the GC reaches is written to once rather than twice.
+   The test for whether to put an object on the list is then just
+
+       ((link & STATIC_BITS) | prev_static_flag) != 3
+
+   An object that a GC doesn't reach is garbage, and will never be
+   reached again, so we needn't worry about one that was last seen two
+   major GCs ago looking as if it had been seen in this one.
+
+   The list itself is made of links tagged with static_flag, and ends
+   with static_flag, which the next major GC sees as just another
+   object from the previous GC.
+   -------------------------------------------------------------------------- */
+
+#define STATIC_BITS      3
+#define STATIC_FLAG_A    1
+#define STATIC_FLAG_B    2
+#define STATIC_FLAG_LIST 3
+
+extern nat prev_static_flag, static_flag;
+
+#define END_OF_STATIC_OBJECT_LIST ((StgClosure*)(StgWord)static_flag)
+#define END_OF_CAF_LIST           ((StgClosure*)STATIC_FLAG_LIST)
+
+#define UNTAG_STATIC_LIST_PTR(p) ((StgClosure*)((StgWord)(p) & ~STATIC_BITS))
 
 void move_STACK  (StgStack *src, StgStack *dest);
 
+StgBool growLargeByteArray (Capability *cap, StgArrWords *arr, W_ bytes);
+
+StgPtr allocateMappedBytes (Capability *cap, int fd, StgWord64 offset,
+                            W_ bytes, rtsBool shared);
+
 /* -----------------------------------------------------------------------------
    CAF lists
 
-   dyn_caf_list  (CAFs chained through static_link)
+   dyn_caf_list  (CAFs chained through static_link, tagged with
+                  STATIC_FLAG_LIST; see Note [STATIC_LINK fields])
       This is a chain of all CAFs in the program, used for
       dynamically-linked GHCi.
       See Note [dyn_caf_list].
@@ -150,7 +222,8 @@ void move_STACK  (StgStack *src, StgStack *dest);
       the CAFs alive.  Used for detecting when we enter a GC'd CAF,
       and to give diagnostics with +RTS -DG.
 
-   revertible_caf_list  (CAFs chained through static_link)
+   revertible_caf_list  (CAFs chained through static_link, tagged with
+                         STATIC_FLAG_LIST)
       A chain of CAFs in object code loaded with the RTS linker.
       These CAFs can be reverted to their unevaluated state using
       revertCAFs.
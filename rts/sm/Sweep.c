@@ -15,15 +15,62 @@
 #include "Rts.h"
 
 #include "BlockAlloc.h"
+#include "RtsUtils.h"
 #include "Sweep.h"
 #include "Trace.h"
 
+// Look at the mark bitmap of a marked block: flag it BF_SWEPT if
+// anything in it is alive (and BF_FRAGMENTED as well if not much is),
+// and return the number of words that may be alive.  A marked block
+// that isn't BF_SWEPT afterwards is empty.
+STATIC_INLINE W_
+sweepBlock (bdescr *bd, W_ *fragd)
+{
+    nat i;
+    W_ resid = 0;
+    StgWord *bitmap = bd->u.bitmap;
+
+    // without a branch, so that the compiler can vectorise it
+    for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
+    {
+        resid += bitmap[i] != 0;
+    }
+
+    if (resid != 0)
+    {
+        if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
+            (*fragd)++;
+            bd->flags |= BF_FRAGMENTED;
+        }
+
+        bd->flags |= BF_SWEPT;
+    }
+
+    return resid * BITS_IN(W_);
+}
+
+static void
+sweepDone (generation *gen, W_ blocks USED_IF_DEBUG, W_ freed USED_IF_DEBUG,
+           W_ fragd USED_IF_DEBUG, W_ live)
+{
+    gen->live_estimate = live;
+
+    debugTrace(DEBUG_gc, "sweeping: %d blocks, %d were copied, %d freed (%d%%), %d are fragmented, live estimate: %ld%%",
+          gen->n_old_blocks + freed,
+          gen->n_old_blocks - blocks + freed,
+          freed,
+          blocks == 0 ? 0 : (freed * 100) / blocks,
+          fragd, 
+          (unsigned long)((blocks - freed) == 0 ? 0 : ((live / BLOCK_SIZE_W) * 100) / (blocks - freed)));
+
+    ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
+}
+
 void
 sweep(generation *gen)
 {
     bdescr *bd, *prev, *next;
-    nat i;
-    W_ freed, resid, fragd, blocks, live;
+    W_ freed, fragd, blocks, live;
     
     ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
 
@@ -42,14 +89,9 @@ sweep(generation *gen)
         }
 
         blocks++;
-        resid = 0;
-        for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
-        {
-            if (bd->u.bitmap[i] != 0) resid++;
-        }
-        live += resid * BITS_IN(W_);
+        live += sweepBlock(bd, &fragd);
 
-        if (resid == 0)
+        if (!(bd->flags & BF_SWEPT))
         {
             freed++;
             gen->n_old_blocks--;
@@ -63,24 +105,132 @@ sweep(generation *gen)
         else
         {
             prev = bd;
-            if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
-                fragd++;
-                bd->flags |= BF_FRAGMENTED;
-            }
-
-            bd->flags |= BF_SWEPT;
         }
     }
 
-    gen->live_estimate = live;
+    sweepDone(gen, blocks, freed, fragd, live);
+}
 
-    debugTrace(DEBUG_gc, "sweeping: %d blocks, %d were copied, %d freed (%d%%), %d are fragmented, live estimate: %ld%%",
-          gen->n_old_blocks + freed,
-          gen->n_old_blocks - blocks + freed,
-          freed,
-          blocks == 0 ? 0 : (freed * 100) / blocks,
-          fragd, 
-          (unsigned long)((blocks - freed) == 0 ? 0 : ((live / BLOCK_SIZE_W) * 100) / (blocks - freed)));
+#if defined(THREADED_RTS)
+
+/* -----------------------------------------------------------------------------
+   Parallel sweeping
+
+   Marking is done by a single thread (the mark stack can't be shared),
+   but looking at the mark bitmap of every block, which is most of the
+   work of sweep(), can be done for each block independently.  So when
+   the parallel GC is enabled, the GC threads are started just for the
+   sweep (see GarbageCollect()):
+
+     - startParSweep() cuts old_blocks into chunks of SWEEP_CHUNK blocks;
+
+     - every GC thread calls sweepChunks(), which claims chunks until
+       none are left, and runs sweepBlock() on their marked blocks;
+
+     - when they have all finished, endParSweep() frees the marked
+       blocks that aren't BF_SWEPT, which has to be done with the
+       sm_mutex, i.e. on one thread.
+   -------------------------------------------------------------------------- */
+
+#define SWEEP_CHUNK 64
+
+typedef struct {
+    bdescr *first;
+    W_ blocks;          // marked blocks in the chunk
+    W_ fragd;
+    W_ live;
+    StgWord _padding[4];  // one chunk per cache line
+} SweepChunk;
+
+static SweepChunk *sweep_chunks = NULL;
+static StgWord n_sweep_chunks = 0;
+static volatile StgWord sweep_next = 0;
+
+void
+startParSweep (generation *gen)
+{
+    bdescr *bd;
+    W_ i, n;
 
     ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
+
+    n = (gen->n_old_blocks + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+    sweep_chunks = stgMallocBytes(stg_max(n, 1) * sizeof(SweepChunk),
+                                  "startParSweep");
+
+    for (i = 0, bd = gen->old_blocks; bd != NULL; bd = bd->link, i++) {
+        if (i % SWEEP_CHUNK == 0) {
+            sweep_chunks[i / SWEEP_CHUNK].first = bd;
+        }
+    }
+    ASSERT(i == gen->n_old_blocks);
+
+    n_sweep_chunks = n;
+    sweep_next = 0;
+    write_barrier();
+}
+
+void
+sweepChunks (void)
+{
+    SweepChunk *c;
+    bdescr *bd;
+    StgWord i;
+    nat j;
+
+    while ((i = atomic_inc(&sweep_next, 1) - 1) < n_sweep_chunks) {
+        c = &sweep_chunks[i];
+        c->blocks = 0;
+        c->fragd = 0;
+        c->live = 0;
+        for (bd = c->first, j = 0;
+             bd != NULL && j < SWEEP_CHUNK;
+             bd = bd->link, j++) {
+            if (bd->flags & BF_MARKED) {
+                c->blocks++;
+                c->live += sweepBlock(bd, &c->fragd);
+            }
+        }
+    }
+}
+
+void
+endParSweep (generation *gen)
+{
+    bdescr *bd, *prev, *next;
+    W_ i, freed, fragd, blocks, live;
+
+    blocks = fragd = live = 0;
+    for (i = 0; i < n_sweep_chunks; i++) {
+        blocks += sweep_chunks[i].blocks;
+        fragd  += sweep_chunks[i].fragd;
+        live   += sweep_chunks[i].live;
+    }
+    stgFree(sweep_chunks);
+    sweep_chunks = NULL;
+    n_sweep_chunks = 0;
+
+    freed = 0;
+    prev = NULL;
+    for (bd = gen->old_blocks; bd != NULL; bd = next)
+    {
+        next = bd->link;
+
+        if ((bd->flags & (BF_MARKED | BF_SWEPT)) == BF_MARKED) {
+            freed++;
+            gen->n_old_blocks--;
+            if (prev == NULL) {
+                gen->old_blocks = next;
+            } else {
+                prev->link = next;
+            }
+            freeGroup(bd);
+        } else {
+            prev = bd;
+        }
+    }
+
+    sweepDone(gen, blocks, freed, fragd, live);
 }
+
+#endif /* THREADED_RTS */
@@ -16,4 +16,10 @@
 
 RTS_PRIVATE void sweep(generation *gen);
 
+#if defined(THREADED_RTS)
+RTS_PRIVATE void startParSweep (generation *gen);
+RTS_PRIVATE void sweepChunks   (void);
+RTS_PRIVATE void endParSweep   (generation *gen);
+#endif
+
 #endif /* SM_SWEEP_H */
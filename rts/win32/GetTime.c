@@ -100,6 +100,37 @@ getProcessElapsedTime(void)
     return NSToTime(getMonotonicNSec());
 }
 
+// QueryPerformanceCounter() is already the cheapest clock we have (it
+// reads the TSC itself where that is reliable), so --clock=tsc and
+// --clock=coarse just use it.
+void
+initTimestampClock(void)
+{
+    if (RtsFlags.MiscFlags.clockSource != CLOCK_SOURCE_MONOTONIC) {
+        errorBelch("--clock: not supported on Windows, "
+                   "using the monotonic clock");
+    }
+}
+
+StgWord64
+getTimestampNSec(void)
+{
+    return getMonotonicNSec();
+}
+
+void
+getTimestampClock(nat *source, StgWord64 *hz, StgWord64 *resolution)
+{
+    *source = CLOCK_SOURCE_MONOTONIC;
+    if (qpc_frequency.QuadPart) {
+        *hz = qpc_frequency.QuadPart;
+        *resolution = stg_max(1, 1000000000 / *hz);
+    } else {
+        *hz = 0;
+        *resolution = 1000000; // GetTickCount()
+    }
+}
+
 Time
 getThreadCPUTime(void)
 {
@@ -3,6 +3,29 @@
  * Non-blocking / asynchronous I/O for Win32.
  *
  * (c) sof, 2002-2003.
+ *
+ * Requests are serviced in one of two ways:
+ *
+ *  - reads and writes on sockets are issued as overlapped ReadFile()/
+ *    WriteFile() calls on a handle associated with an I/O completion
+ *    port.  A single thread, IOCompletionProc(), harvests the finished
+ *    requests from the port and hands them to the scheduler via their
+ *    completion routines, so any number of outstanding socket requests
+ *    costs one OS thread in total.
+ *
+ *  - delays (threadDelay, and the timeouts of System.Timeout) are kept
+ *    in a heap ordered by deadline, which a single thread,
+ *    IODelayProc(), sleeps on until the earliest one expires.  So a
+ *    pending delay costs a WorkItem, not a thread.
+ *
+ *  - everything else (file and console I/O on CRT descriptors, which
+ *    aren't opened for overlapped I/O; procedure calls) goes on the
+ *    WorkQueue and is performed, blocking, by a pool of IOWorkerProc()
+ *    threads.
+ *
+ * If a socket can't be associated with the port, or an overlapped
+ * request can't be started, the request falls back to the worker pool,
+ * as do delays if the delay thread couldn't be started.
  */
 
 #if !defined(THREADED_RTS)
@@ -33,8 +56,35 @@ typedef struct IOManagerState {
     CritSection      active_work_lock;
     WorkItem*        active_work_items;
     UINT             sleepResolution;
+    /* completion port for overlapped socket requests, or NULL */
+    HANDLE           hCompletionPort;
+    /* pending delays, a binary heap on delayData.deadline; see
+     * IODelayProc().  hDelayEvent is NULL if there is no delay thread. */
+    CritSection      delayLock;
+    HANDLE           hDelayEvent;
+    WorkItem**       delays;
+    int              numDelays;
+    int              maxDelays;
+    volatile LONG    abandonedDelays;  /* a hint, see delayPurge() */
 } IOManagerState;
 
+/*
+ * An overlapped request in flight.  'ov' must come first:
+ * GetQueuedCompletionStatus() gives us back a pointer to it.
+ */
+typedef struct OverlappedReq {
+    OVERLAPPED       ov;
+    WorkItem*        work;
+} OverlappedReq;
+
+/* completion keys */
+#define IOCP_KEY_REQUEST 0
+#define IOCP_KEY_EXIT    1
+
+/* CancelIoEx() is only available from Vista onwards */
+typedef BOOL (WINAPI *CancelIoExProc)(HANDLE, LPOVERLAPPED);
+static CancelIoExProc pCancelIoEx;
+
 /* ToDo: wrap up this state via a IOManager handle instead? */
 static IOManagerState* ioMan;
 
@@ -296,6 +346,344 @@ NewIOWorkerThread(IOManagerState* iom)
                                  &threadId) );
 }
 
+/*
+ * Translate the Win32 error of a failed overlapped socket request
+ * into the WSA error code recv()/send() would have reported.
+ */
+static
+int
+socketErrCode(DWORD err)
+{
+    switch (err) {
+    case ERROR_NETNAME_DELETED:       return WSAECONNRESET;
+    case ERROR_CONNECTION_ABORTED:    return WSAECONNABORTED;
+    case ERROR_CONNECTION_REFUSED:    return WSAECONNREFUSED;
+    case ERROR_NETWORK_UNREACHABLE:   return WSAENETUNREACH;
+    case ERROR_HOST_UNREACHABLE:      return WSAEHOSTUNREACH;
+    case ERROR_SEM_TIMEOUT:           return WSAETIMEDOUT;
+    case ERROR_OPERATION_ABORTED:     return WSAEINTR;
+    case ERROR_BROKEN_PIPE:
+    case ERROR_NO_DATA:               return WSAESHUTDOWN;
+    default:                          return (int)err;
+    }
+}
+
+/*
+ * The routine executed by the completion thread: wait for overlapped
+ * requests to finish and run their completion routines.
+ */
+static
+unsigned
+WINAPI
+IOCompletionProc(PVOID param)
+{
+    IOManagerState* iom = (IOManagerState*)param;
+    DWORD           bytes;
+    ULONG_PTR       key;
+    OVERLAPPED*     pov;
+    OverlappedReq*  req;
+    WorkItem*       work;
+    BOOL            ok;
+    int             len, errCode;
+
+    while (1) {
+        pov = NULL;
+        ok = GetQueuedCompletionStatus(iom->hCompletionPort,
+                                       &bytes, &key, &pov, INFINITE);
+        if (pov == NULL) {
+            if (ok && key == IOCP_KEY_EXIT) {
+                break;
+            }
+            fprintf(stderr, "waiting for completions failed (%lu); fatal.\n",
+                    GetLastError());
+            fflush(stderr);
+            break;
+        }
+
+        req  = (OverlappedReq*)pov;
+        work = req->work;
+        if (ok) {
+            len     = (int)bytes;
+            errCode = 0;
+        } else {
+            len     = -1;
+            errCode = socketErrCode(GetLastError());
+        }
+
+        if (!work->abandonOp) {
+            work->onCompletion(work->requestID,
+                               work->workData.ioData.fd,
+                               len,
+                               work->workData.ioData.buf,
+                               errCode);
+        }
+        DeregisterWorkItem(iom,work);
+        free(work);
+        free(req);
+    }
+
+    EnterCriticalSection(&iom->manLock);
+    iom->numWorkers--;
+    LeaveCriticalSection(&iom->manLock);
+    return 0;
+}
+
+/*
+ * Create the completion port and the thread serving it.  Failure
+ * isn't fatal: socket requests then go to the worker pool.
+ */
+static
+void
+StartCompletionPort(IOManagerState* iom)
+{
+    unsigned threadId;
+
+    iom->hCompletionPort =
+        CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (iom->hCompletionPort == NULL) {
+        return;
+    }
+
+    iom->numWorkers++;
+    if (0 == _beginthreadex(NULL, 0, IOCompletionProc, (LPVOID)iom,
+                            0, &threadId)) {
+        iom->numWorkers--;
+        CloseHandle(iom->hCompletionPort);
+        iom->hCompletionPort = NULL;
+        return;
+    }
+
+    pCancelIoEx = (CancelIoExProc)
+        GetProcAddress(GetModuleHandle(TEXT("kernel32.dll")), "CancelIoEx");
+}
+
+/*
+ * The heap of pending delays.  Deadlines are compared by their
+ * difference, so that they survive timeGetTime() wrapping around
+ * every 49 days.  All of these need iom->delayLock.
+ */
+#define DEADLINE_BEFORE(a,b) ((LONG)((a) - (b)) < 0)
+
+static
+void
+delaySiftUp(IOManagerState* iom, int i)
+{
+    WorkItem* wi = iom->delays[i];
+    int parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!DEADLINE_BEFORE(wi->workData.delayData.deadline,
+                             iom->delays[parent]->workData.delayData.deadline)) {
+            break;
+        }
+        iom->delays[i] = iom->delays[parent];
+        i = parent;
+    }
+    iom->delays[i] = wi;
+}
+
+static
+void
+delaySiftDown(IOManagerState* iom, int i)
+{
+    WorkItem* wi = iom->delays[i];
+    int child;
+
+    while ((child = 2 * i + 1) < iom->numDelays) {
+        if (child + 1 < iom->numDelays &&
+            DEADLINE_BEFORE(iom->delays[child+1]->workData.delayData.deadline,
+                            iom->delays[child]->workData.delayData.deadline)) {
+            child++;
+        }
+        if (!DEADLINE_BEFORE(iom->delays[child]->workData.delayData.deadline,
+                             wi->workData.delayData.deadline)) {
+            break;
+        }
+        iom->delays[i] = iom->delays[child];
+        i = child;
+    }
+    iom->delays[i] = wi;
+}
+
+static
+WorkItem*
+delayPop(IOManagerState* iom)
+{
+    WorkItem* wi = iom->delays[0];
+
+    iom->numDelays--;
+    if (iom->numDelays > 0) {
+        iom->delays[0] = iom->delays[iom->numDelays];
+        delaySiftDown(iom, 0);
+    }
+    return wi;
+}
+
+/*
+ * Abandoned delays (the timeouts of System.Timeout, mostly) would
+ * otherwise stay in the heap until they expire; once they are the
+ * majority, drop them all and rebuild the heap.  abandonWorkRequest()
+ * counts them without delayLock, so the count is only a hint, which
+ * this corrects.
+ */
+static
+void
+delayPurge(IOManagerState* iom)
+{
+    int i, n = 0;
+    WorkItem* wi;
+
+    for (i = 0; i < iom->numDelays; i++) {
+        wi = iom->delays[i];
+        if (wi->abandonOp) {
+            DeregisterWorkItem(iom, wi);
+            free(wi);
+        } else {
+            iom->delays[n++] = wi;
+        }
+    }
+    iom->numDelays = n;
+    iom->abandonedDelays = 0;
+    for (i = n / 2 - 1; i >= 0; i--) {
+        delaySiftDown(iom, i);
+    }
+}
+
+/*
+ * The routine executed by the delay thread: sleep until the earliest
+ * deadline, or until a new delay or the exit event wakes us up, and
+ * complete the delays that have expired.
+ */
+static
+unsigned
+WINAPI
+IODelayProc(PVOID param)
+{
+    IOManagerState* iom = (IOManagerState*)param;
+    HANDLE    hWaits[2];
+    DWORD     rc, now, timeout;
+    WorkItem* wi;
+
+    hWaits[0] = iom->hExitEvent;
+    hWaits[1] = iom->hDelayEvent;
+
+    while (1) {
+        EnterCriticalSection(&iom->delayLock);
+        now = timeGetTime();
+        while (iom->numDelays > 0 &&
+               !DEADLINE_BEFORE(now,
+                                iom->delays[0]->workData.delayData.deadline)) {
+            wi = delayPop(iom);
+            if (wi->abandonOp) {
+                InterlockedDecrement(&iom->abandonedDelays);
+            } else {
+                // the completion routine only takes the scheduler's
+                // completed-requests lock, so it's fine to call it here
+                wi->onCompletion(wi->requestID, 0,
+                                 wi->workData.delayData.usecs, NULL, 0);
+            }
+            DeregisterWorkItem(iom, wi);
+            free(wi);
+        }
+        if (iom->abandonedDelays > iom->numDelays / 2) {
+            delayPurge(iom);
+        }
+        if (iom->numDelays > 0) {
+            timeout = iom->delays[0]->workData.delayData.deadline - now;
+        } else {
+            timeout = INFINITE;
+        }
+        LeaveCriticalSection(&iom->delayLock);
+
+        rc = WaitForMultipleObjects(2, hWaits, FALSE, timeout);
+        if (rc == WAIT_OBJECT_0) {
+            break;
+        }
+        if (rc == WAIT_FAILED) {
+            fprintf(stderr, "waiting for delays failed (%lu); fatal.\n",
+                    GetLastError());
+            fflush(stderr);
+            break;
+        }
+    }
+
+    EnterCriticalSection(&iom->manLock);
+    iom->numWorkers--;
+    LeaveCriticalSection(&iom->manLock);
+    return 0;
+}
+
+/*
+ * Start the delay thread.  Failure isn't fatal: delays then go to the
+ * worker pool, one sleeping thread each.
+ */
+static
+void
+StartDelayThread(IOManagerState* iom)
+{
+    unsigned threadId;
+
+    InitializeCriticalSection(&iom->delayLock);
+    iom->delays          = NULL;
+    iom->numDelays       = 0;
+    iom->maxDelays       = 0;
+    iom->abandonedDelays = 0;
+
+    /* An auto-reset event */
+    iom->hDelayEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (iom->hDelayEvent == NULL) {
+        return;
+    }
+
+    iom->numWorkers++;
+    if (0 == _beginthreadex(NULL, 0, IODelayProc, (LPVOID)iom,
+                            0, &threadId)) {
+        iom->numWorkers--;
+        CloseHandle(iom->hDelayEvent);
+        iom->hDelayEvent = NULL;
+    }
+}
+
+/*
+ * Add a delay to the heap, waking up the delay thread if it is now
+ * the earliest.  Returns FALSE, leaving the WorkItem untouched, if
+ * there is no delay thread or no memory.
+ */
+static
+BOOL
+startDelay(WorkItem* wItem)
+{
+    WorkItem** delays;
+    int        n;
+
+    if (ioMan->hDelayEvent == NULL) return FALSE;
+
+    wItem->workData.delayData.deadline = timeGetTime()
+        + (wItem->workData.delayData.usecs + 999) / 1000
+        + ioMan->sleepResolution;
+
+    EnterCriticalSection(&ioMan->delayLock);
+    if (ioMan->numDelays == ioMan->maxDelays) {
+        n = ioMan->maxDelays == 0 ? 64 : ioMan->maxDelays * 2;
+        delays = (WorkItem**)realloc(ioMan->delays, n * sizeof(WorkItem*));
+        if (!delays) {
+            LeaveCriticalSection(&ioMan->delayLock);
+            return FALSE;
+        }
+        ioMan->delays = delays;
+        ioMan->maxDelays = n;
+    }
+    RegisterWorkItem(ioMan, wItem);
+    ioMan->delays[ioMan->numDelays++] = wItem;
+    delaySiftUp(ioMan, ioMan->numDelays - 1);
+    if (ioMan->delays[0] == wItem) {
+        SetEvent(ioMan->hDelayEvent);
+    }
+    LeaveCriticalSection(&ioMan->delayLock);
+    return TRUE;
+}
+
 BOOL
 StartIOManager(void)
 {
@@ -343,6 +731,10 @@ StartIOManager(void)
     InitializeCriticalSection(&ioMan->active_work_lock);
     ioMan->active_work_items = NULL;
     ioMan->sleepResolution = sleepResolution;
+    ioMan->hCompletionPort = NULL;
+
+    StartCompletionPort(ioMan);
+    StartDelayThread(ioMan);
 
     return TRUE;
 }
@@ -420,6 +812,62 @@ depositWorkItem( unsigned int reqID,
     }
 }
 
+/*
+ * Function: startOverlappedRequest()
+ *
+ * Issue a socket read/write as an overlapped request on the completion
+ * port.  Returns FALSE, leaving the WorkItem untouched, if that isn't
+ * possible; the caller then hands it to the worker pool instead.
+ */
+static
+BOOL
+startOverlappedRequest( WorkItem* wItem )
+{
+    OverlappedReq* req;
+    HANDLE h = (HANDLE)(intptr_t)wItem->workData.ioData.fd;
+    BOOL   ok;
+
+    if (ioMan->hCompletionPort == NULL) return FALSE;
+
+    /* Associating a handle a second time fails with
+     * ERROR_INVALID_PARAMETER, which just means we've seen it before. */
+    if (CreateIoCompletionPort(h, ioMan->hCompletionPort,
+                               IOCP_KEY_REQUEST, 0) == NULL &&
+        GetLastError() != ERROR_INVALID_PARAMETER) {
+        return FALSE;
+    }
+
+    req = (OverlappedReq*)calloc(1, sizeof(OverlappedReq));
+    if (!req) return FALSE;
+    req->work = wItem;
+    wItem->workKind |= WORKER_OVERLAPPED;
+    wItem->overlapped = &req->ov;
+
+    /* The completion may be harvested before ReadFile()/WriteFile()
+     * even returns, so the request has to be registered first. */
+    RegisterWorkItem(ioMan, wItem);
+
+    if ( wItem->workKind & WORKER_READ ) {
+        ok = ReadFile(h, wItem->workData.ioData.buf,
+                      wItem->workData.ioData.len, NULL, &req->ov);
+    } else {
+        ok = WriteFile(h, wItem->workData.ioData.buf,
+                       wItem->workData.ioData.len, NULL, &req->ov);
+    }
+
+    /* Both immediate success and ERROR_IO_PENDING queue a completion
+     * packet; any other failure doesn't. */
+    if (ok || GetLastError() == ERROR_IO_PENDING) {
+        return TRUE;
+    }
+
+    DeregisterWorkItem(ioMan, wItem);
+    wItem->workKind &= ~WORKER_OVERLAPPED;
+    wItem->overlapped = NULL;
+    free(req);
+    return FALSE;
+}
+
 /*
  * Function: AddIORequest()
  *
@@ -450,6 +898,12 @@ AddIORequest ( int   fd,
 
     wItem->onCompletion        = onCompletion;
     wItem->requestID           = reqID;
+    wItem->abandonOp           = 0;
+    wItem->overlapped          = NULL;
+
+    if (isSocket && startOverlappedRequest(wItem)) {
+        return reqID;
+    }
 
     return depositWorkItem(reqID, wItem);
 }
@@ -474,8 +928,14 @@ AddDelayRequest ( unsigned int   usecs,
     wItem->workData.delayData.usecs = usecs;
     wItem->onCompletion = onCompletion;
     wItem->requestID    = reqID;
+    wItem->abandonOp    = 0;
+    wItem->overlapped   = NULL;
     wItem->link         = NULL;
 
+    if (startDelay(wItem)) {
+        return reqID;
+    }
+
     return depositWorkItem(reqID, wItem);
 }
 
@@ -512,6 +972,10 @@ void ShutdownIOManager ( rtsBool wait_threads )
     MMRESULT mmresult;
 
     SetEvent(ioMan->hExitEvent);
+    if (ioMan->hCompletionPort != NULL) {
+        PostQueuedCompletionStatus(ioMan->hCompletionPort, 0,
+                                   IOCP_KEY_EXIT, NULL);
+    }
 
     if (wait_threads) {
         /* Wait for all worker threads to die. */
@@ -525,6 +989,17 @@ void ShutdownIOManager ( rtsBool wait_threads )
         }
         FreeWorkQueue(ioMan->workQueue);
         CloseHandle(ioMan->hExitEvent);
+        if (ioMan->hCompletionPort != NULL) {
+            CloseHandle(ioMan->hCompletionPort);
+        }
+        if (ioMan->hDelayEvent != NULL) {
+            CloseHandle(ioMan->hDelayEvent);
+        }
+        for (num = 0; num < ioMan->numDelays; num++) {
+            free(ioMan->delays[num]);
+        }
+        free(ioMan->delays);
+        DeleteCriticalSection(&ioMan->delayLock);
         DeleteCriticalSection(&ioMan->active_work_lock);
         DeleteCriticalSection(&ioMan->manLock);
 
@@ -582,9 +1057,9 @@ DeregisterWorkItem(IOManagerState* ioMan,
  * if a blocked Haskell thread has an exception thrown to it.
  *
  * Note: we're not aborting the system call that a worker might be blocked on
- * here, just disabling the propagation of its result once its finished. We
- * may have to go the whole hog here and switch to overlapped I/O so that we
- * can abort blocked system calls.
+ * here, just disabling the propagation of its result once its finished.
+ * Overlapped socket requests are cancelled outright where CancelIoEx() is
+ * available; the completion thread then frees them as usual.
  */
 void
 abandonWorkRequest ( int reqID )
@@ -594,6 +1069,16 @@ abandonWorkRequest ( int reqID )
     for(ptr=ioMan->active_work_items;ptr;ptr=ptr->link) {
         if (ptr->requestID == (unsigned int)reqID ) {
             ptr->abandonOp = 1;
+            if ((ptr->workKind & WORKER_DELAY) && ioMan->hDelayEvent != NULL) {
+                /* counted so that the delay thread knows when to purge
+                 * its heap (see delayPurge()) */
+                InterlockedIncrement(&ioMan->abandonedDelays);
+            }
+            if ((ptr->workKind & WORKER_OVERLAPPED) && pCancelIoEx) {
+                /* cancels just this request, not others on the socket */
+                pCancelIoEx((HANDLE)(intptr_t)ptr->workData.ioData.fd,
+                            ptr->overlapped);
+            }
             LeaveCriticalSection(&ioMan->active_work_lock);
             return;
         }
@@ -49,6 +49,7 @@ typedef union workData {
     } ioData;
     struct {
         int   usecs;
+        DWORD deadline;  /* timeGetTime() when it expires */
     } delayData;
     struct {
         DoProcProc proc;
@@ -62,6 +63,7 @@ typedef struct WorkItem {
   unsigned int     requestID;
   CompletionProc   onCompletion;
   unsigned int     abandonOp;
+  LPOVERLAPPED     overlapped;   /* only for WORKER_OVERLAPPED requests */
   struct WorkItem  *link;
 } WorkItem;
 
@@ -76,6 +78,7 @@ extern CompletionProc onComplete;
 #define WORKER_DELAY       4
 #define WORKER_FOR_SOCKET  8
 #define WORKER_DO_PROC    16
+#define WORKER_OVERLAPPED 32   /* in flight on the completion port */
 
 /*
  * Starting up and shutting down.
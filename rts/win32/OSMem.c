@@ -10,48 +10,370 @@
 #include "sm/OSMem.h"
 #include "RtsUtils.h"
 
+#include <errno.h>
+
 #if HAVE_WINDOWS_H
 #include <windows.h>
 #endif
 
+/* Slot of free_blocks[] (and alloc_rec.slot) for memory with no
+   NUMA preference; slots below it are OS NUMA node numbers. */
+#define ANY_NODE MAX_NUMA_NODES
+
 typedef struct alloc_rec_ {
     char* base;    // non-aligned base address, directly from VirtualAlloc
     W_ size;       // Size in bytes
-    struct alloc_rec_* next;
+    nat slot;      // the free_blocks[] tree its free memory belongs to
+    rtsBool large; // backed by large pages, which are committed up front
 } alloc_rec;
 
+/* Free memory regions are kept in a treap (a binary search tree that
+   is balanced on average by random priorities) ordered by address, in
+   which every node also records the size of the largest region in its
+   subtree.  That makes the neighbour lookups when merging a freed
+   region and the first-fit search when allocating O(log n), rather than
+   walks along a sorted list. */
 typedef struct block_rec_ {
     char* base;        // base address, non-MBLOCK-aligned
     W_ size;           // size in bytes
-    struct block_rec_* next;
+    W_ max_size;       // largest size in this subtree
+    StgWord32 prio;    // no child has a higher priority than its parent
+    struct block_rec_ *left, *right;
 } block_rec;
 
 /* allocs are kept in ascending order, and are the memory regions as
    returned by the OS as we need to have matching VirtualAlloc and
    VirtualFree calls. */
 static alloc_rec* allocs = NULL;
+static nat n_allocs = 0;
+static nat max_allocs = 0;
+
+/* free_blocks[slot] holds the free regions of the allocs in that slot;
+   adjacent regions are merged */
+static block_rec* free_blocks[MAX_NUMA_NODES+1];
+
+static StgWord32 prio_seed = 2463534242U;
 
-/* free_blocks are kept in ascending order, and adjacent blocks are merged */
-static block_rec* free_blocks = NULL;
+/* Large pages (-xH): 0 if we aren't using them */
+static W_ large_page_size = 0;
+static W_ large_mblocks = 0;     // mblocks in large-page allocs
+
+/* Looked up at runtime: these aren't available before Vista / 2003 */
+typedef SIZE_T (WINAPI *GetLargePageMinimumProc)(void);
+typedef BOOL   (WINAPI *GetNumaHighestNodeNumberProc)(PULONG);
+typedef LPVOID (WINAPI *VirtualAllocExNumaProc)(HANDLE, LPVOID, SIZE_T,
+                                                DWORD, DWORD, DWORD);
+static GetNumaHighestNodeNumberProc pGetNumaHighestNodeNumber;
+static VirtualAllocExNumaProc pVirtualAllocExNuma;
+
+static void initLargePages(void);
 
 void
 osMemInit(void)
 {
+    HMODULE kernel32 = GetModuleHandle(TEXT("kernel32.dll"));
+    nat i;
+
     allocs = NULL;
-    free_blocks = NULL;
+    n_allocs = 0;
+    max_allocs = 0;
+    for (i = 0; i <= MAX_NUMA_NODES; i++) {
+        free_blocks[i] = NULL;
+    }
+    large_mblocks = 0;
+
+    pGetNumaHighestNodeNumber = (GetNumaHighestNodeNumberProc)
+        GetProcAddress(kernel32, "GetNumaHighestNodeNumber");
+    pVirtualAllocExNuma = (VirtualAllocExNumaProc)
+        GetProcAddress(kernel32, "VirtualAllocExNuma");
+
+    if (RtsFlags.GcFlags.hugePages) {
+        initLargePages();
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Large pages
+
+   MEM_LARGE_PAGES memory has to be reserved and committed in one go, in
+   multiples of GetLargePageMinimum(), and can't be decommitted; it
+   needs the SeLockMemoryPrivilege ("Lock pages in memory"), which we
+   enable in our token if the account has been granted it.
+   -------------------------------------------------------------------------- */
+
+static rtsBool
+enableLockMemoryPrivilege(void)
+{
+    HANDLE token;
+    TOKEN_PRIVILEGES tp;
+    rtsBool ok;
+
+    if (!OpenProcessToken(GetCurrentProcess(),
+                          TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return rtsFalse;
+    }
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    // AdjustTokenPrivileges() succeeds even if we don't hold the
+    // privilege, but then sets ERROR_NOT_ALL_ASSIGNED
+    ok = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME,
+                              &tp.Privileges[0].Luid)
+        && AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL)
+        && GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return ok;
+}
+
+static void
+initLargePages(void)
+{
+    GetLargePageMinimumProc pGetLargePageMinimum;
+    W_ size;
+
+    pGetLargePageMinimum = (GetLargePageMinimumProc)
+        GetProcAddress(GetModuleHandle(TEXT("kernel32.dll")),
+                       "GetLargePageMinimum");
+    size = pGetLargePageMinimum ? pGetLargePageMinimum() : 0;
+
+    if (size == 0 || size % MBLOCK_SIZE != 0) {
+        errorBelch("warning: -xH: large pages are not supported on this "
+                   "system");
+        return;
+    }
+    if (!enableLockMemoryPrivilege()) {
+        errorBelch("warning: -xH: large pages need the \"Lock pages in "
+                   "memory\" privilege (SeLockMemoryPrivilege)");
+        return;
+    }
+    if (RtsFlags.GcFlags.hugePageSize != 0 &&
+        RtsFlags.GcFlags.hugePageSize != size) {
+        errorBelch("warning: -xH: using the system's large page size "
+                   "(%" FMT_Word " bytes)", size);
+    }
+    large_page_size = size;
+}
+
+/* -----------------------------------------------------------------------------
+   The free region treaps
+   -------------------------------------------------------------------------- */
+
+static StgWord32
+nextPrio(void)
+{
+    // xorshift32
+    prio_seed ^= prio_seed << 13;
+    prio_seed ^= prio_seed >> 17;
+    prio_seed ^= prio_seed << 5;
+    return prio_seed;
+}
+
+STATIC_INLINE W_
+maxSize(block_rec *t)
+{
+    return t ? t->max_size : 0;
+}
+
+static void
+fixMaxSize(block_rec *t)
+{
+    W_ m = t->size;
+    if (maxSize(t->left)  > m) m = maxSize(t->left);
+    if (maxSize(t->right) > m) m = maxSize(t->right);
+    t->max_size = m;
+}
+
+// Split 't' into the regions below 'base' (*l) and the rest (*r)
+static void
+splitFree(block_rec *t, char *base, block_rec **l, block_rec **r)
+{
+    if (t == NULL) {
+        *l = *r = NULL;
+    } else if (t->base < base) {
+        splitFree(t->right, base, &t->right, r);
+        fixMaxSize(t);
+        *l = t;
+    } else {
+        splitFree(t->left, base, l, &t->left);
+        fixMaxSize(t);
+        *r = t;
+    }
+}
+
+// Join two treaps; all of 'l' lies below all of 'r'
+static block_rec *
+joinFree(block_rec *l, block_rec *r)
+{
+    if (l == NULL) return r;
+    if (r == NULL) return l;
+    if (l->prio > r->prio) {
+        l->right = joinFree(l->right, r);
+        fixMaxSize(l);
+        return l;
+    } else {
+        r->left = joinFree(l, r->left);
+        fixMaxSize(r);
+        return r;
+    }
+}
+
+static void
+addFreeRegion(nat slot, char *base, W_ size)
+{
+    block_rec *rec, *l, *r;
+    rec = (block_rec*)stgMallocBytes(sizeof(block_rec),
+                                     "getMBlocks: addFreeRegion");
+    rec->base = base;
+    rec->size = size;
+    rec->max_size = size;
+    rec->prio = nextPrio();
+    rec->left = rec->right = NULL;
+    splitFree(free_blocks[slot], base, &l, &r);
+    free_blocks[slot] = joinFree(joinFree(l, rec), r);
+}
+
+// Remove the region starting at 'base' and return its size
+static W_
+takeFreeRegion(nat slot, char *base)
+{
+    block_rec *l, *m, *r;
+    W_ size;
+    splitFree(free_blocks[slot], base, &l, &r);
+    splitFree(r, base+1, &m, &r);
+    free_blocks[slot] = joinFree(l, r);
+    if (m == NULL || m->left != NULL || m->right != NULL) {
+        barf("getMBlocks: takeFreeRegion: no free region at %p", base);
+    }
+    size = m->size;
+    stgFree(m);
+    return size;
+}
+
+// The region with the highest base below 'addr', or NULL
+static block_rec *
+freeRegionBelow(block_rec *t, char *addr)
+{
+    block_rec *best = NULL;
+    while (t != NULL) {
+        if (t->base < addr) {
+            best = t;
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return best;
+}
+
+// The region with the lowest base at or above 'addr', or NULL
+static block_rec *
+freeRegionFrom(block_rec *t, char *addr)
+{
+    block_rec *best = NULL;
+    while (t != NULL) {
+        if (t->base >= addr) {
+            best = t;
+            t = t->left;
+        } else {
+            t = t->right;
+        }
+    }
+    return best;
+}
+
+// The lowest-addressed region of at least 'size' bytes, or NULL
+static block_rec *
+firstFit(block_rec *t, W_ size)
+{
+    while (t != NULL && t->max_size >= size) {
+        if (maxSize(t->left) >= size) {
+            t = t->left;
+        } else if (t->size >= size) {
+            return t;
+        } else {
+            t = t->right;
+        }
+    }
+    return NULL;
+}
+
+static void
+freeTree(block_rec *t)
+{
+    if (t != NULL) {
+        freeTree(t->left);
+        freeTree(t->right);
+        stgFree(t);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   The allocs array
+   -------------------------------------------------------------------------- */
+
+// Index of the first alloc that ends after 'addr' (n_allocs if none)
+static nat
+findAlloc(char *addr)
+{
+    nat lo = 0, hi = n_allocs;
+    while (lo < hi) {
+        nat mid = lo + (hi - lo) / 2;
+        if (allocs[mid].base + allocs[mid].size <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// The alloc containing 'addr', or NULL
+static alloc_rec *
+allocContaining(char *addr)
+{
+    nat i = findAlloc(addr);
+    if (i < n_allocs && allocs[i].base <= addr) {
+        return &allocs[i];
+    }
+    return NULL;
+}
+
+static char *
+reserveMemory(W_ size, DWORD flags, nat slot)
+{
+    if (slot != ANY_NODE && pVirtualAllocExNuma != NULL) {
+        return pVirtualAllocExNuma(GetCurrentProcess(), NULL, size,
+                                   flags, PAGE_READWRITE, slot);
+    }
+    return VirtualAlloc(NULL, size, flags, PAGE_READWRITE);
 }
 
 static
 alloc_rec*
-allocNew(nat n) {
-    alloc_rec* rec;
-    rec = (alloc_rec*)stgMallocBytes(sizeof(alloc_rec),"getMBlocks: allocNew");
-    rec->size = ((W_)n+1)*MBLOCK_SIZE;
-    rec->base =
-        VirtualAlloc(NULL, rec->size, MEM_RESERVE, PAGE_READWRITE);
-    if(rec->base==0) {
-        stgFree((void*)rec);
-        rec=0;
+allocNew(nat n, nat slot) {
+    alloc_rec rec;
+    nat i;
+
+    rec.slot = slot;
+    rec.large = rtsFalse;
+    rec.base = NULL;
+
+    if (large_page_size != 0) {
+        // large page allocations are aligned to the large page size,
+        // which is a multiple of MBLOCK_SIZE
+        rec.size = ((W_)n * MBLOCK_SIZE + large_page_size - 1)
+                   & ~(large_page_size - 1);
+        rec.base = reserveMemory(rec.size,
+                                 MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                 slot);
+        // Failure is likely once physical memory is fragmented; fall
+        // back to ordinary pages.
+        rec.large = rec.base != NULL;
+    }
+    if (rec.base == NULL) {
+        rec.size = ((W_)n+1)*MBLOCK_SIZE;
+        rec.base = reserveMemory(rec.size, MEM_RESERVE, slot);
+    }
+    if (rec.base == NULL) {
         if (GetLastError() == ERROR_NOT_ENOUGH_MEMORY) {
 
             errorBelch("out of memory");
@@ -59,101 +381,87 @@ allocNew(nat n) {
             sysErrorBelch(
                 "getMBlocks: VirtualAlloc MEM_RESERVE %d blocks failed", n);
         }
-    } else {
-        alloc_rec temp;
-        temp.base=0; temp.size=0; temp.next=allocs;
+        return NULL;
+    }
 
-        alloc_rec* it;
-        it=&temp;
-        for(; it->next!=0 && it->next->base<rec->base; it=it->next) ;
-        rec->next=it->next;
-        it->next=rec;
+    if (rec.large) {
+        large_mblocks += rec.size / MBLOCK_SIZE;
+    }
 
-        allocs=temp.next;
+    if (n_allocs == max_allocs) {
+        max_allocs = max_allocs ? max_allocs * 2 : 16;
+        allocs = stgReallocBytes(allocs, max_allocs * sizeof(alloc_rec),
+                                 "getMBlocks: allocNew");
     }
-    return rec;
+    i = findAlloc(rec.base);
+    memmove(&allocs[i+1], &allocs[i], (n_allocs - i) * sizeof(alloc_rec));
+    allocs[i] = rec;
+    n_allocs++;
+    return &allocs[i];
 }
 
 static
 void
-insertFree(char* alloc_base, W_ alloc_size) {
-    block_rec temp;
-    block_rec* it;
-    block_rec* prev;
-
-    temp.base=0; temp.size=0; temp.next=free_blocks;
-    it = free_blocks;
-    prev = &temp;
-    for( ; it!=0 && it->base<alloc_base; prev=it, it=it->next) {}
-
-    if(it!=0 && alloc_base+alloc_size == it->base) {
-        if(prev->base + prev->size == alloc_base) { /* Merge it, alloc, prev */
-            prev->size += alloc_size + it->size;
-            prev->next = it->next;
-            stgFree(it);
-        } else {                                    /* Merge it, alloc */
-            it->base = alloc_base;
-            it->size += alloc_size;
-        }
-    } else if(prev->base + prev->size == alloc_base) { /* Merge alloc, prev */
-        prev->size += alloc_size;
-    } else {                                           /* Merge none */
-        block_rec* rec;
-        rec = (block_rec*)stgMallocBytes(sizeof(block_rec),
-                                         "getMBlocks: insertFree");
-        rec->base=alloc_base;
-        rec->size=alloc_size;
-        rec->next = it;
-        prev->next=rec;
+insertFree(nat slot, char* alloc_base, W_ alloc_size) {
+    block_rec *prev, *next;
+
+    prev = freeRegionBelow(free_blocks[slot], alloc_base);
+    next = freeRegionFrom(free_blocks[slot], alloc_base);
+
+    if (prev != NULL && prev->base + prev->size == alloc_base) {
+        alloc_base = prev->base;
+        alloc_size += takeFreeRegion(slot, prev->base);
     }
-    free_blocks=temp.next;
+    if (next != NULL && alloc_base + alloc_size == next->base) {
+        alloc_size += takeFreeRegion(slot, next->base);
+    }
+    addFreeRegion(slot, alloc_base, alloc_size);
+}
+
+STATIC_INLINE rtsBool
+fitsAligned(block_rec *it, W_ size)
+{
+    return (W_)MBLOCK_ROUND_UP(it->base) - (W_)it->base + size <= it->size;
 }
 
 static
 void*
-findFreeBlocks(nat n) {
-    void* ret=0;
+findFreeBlocks(nat slot, nat n) {
     block_rec* it;
-    block_rec temp;
-    block_rec* prev;
-
-    W_ required_size;
-    it=free_blocks;
-    required_size = n*MBLOCK_SIZE;
-    temp.next=free_blocks; temp.base=0; temp.size=0;
-    prev=&temp;
-    /* TODO: Don't just take first block, find smallest sufficient block */
-    for( ; it!=0 && it->size<required_size; prev=it, it=it->next ) {}
-    if(it!=0) {
-        if( (((W_)it->base) & MBLOCK_MASK) == 0) { /* MBlock aligned */
-            ret = (void*)it->base;
-            if(it->size==required_size) {
-                prev->next=it->next;
-                stgFree(it);
-            } else {
-                it->base += required_size;
-                it->size -=required_size;
-            }
+    char *base, *need_base;
+    W_ size, required_size;
+
+    required_size = (W_)n*MBLOCK_SIZE;
+    it = firstFit(free_blocks[slot], required_size);
+    if (it != NULL && !fitsAligned(it, required_size)) {
+        // too small once aligned; an extra MBLOCK_SIZE always suffices
+        block_rec *big = firstFit(free_blocks[slot],
+                                  required_size + MBLOCK_SIZE);
+        if (big == NULL) {
+            // but a smaller, aligned region may still do: walk the
+            // remaining regions in address order
+            do {
+                it = freeRegionFrom(free_blocks[slot], it->base + it->size);
+            } while (it != NULL && !fitsAligned(it, required_size));
         } else {
-            char* need_base;
-            block_rec* next;
-            int new_size;
-            need_base =
-                (char*)(((W_)it->base) & ((W_)~MBLOCK_MASK)) + MBLOCK_SIZE;
-            next = (block_rec*)stgMallocBytes(
-                    sizeof(block_rec)
-                    , "getMBlocks: findFreeBlocks: splitting");
-            new_size = need_base - it->base;
-            next->base = need_base +required_size;
-            next->size = it->size - (new_size+required_size);
-            it->size = new_size;
-            next->next = it->next;
-            it->next = next;
-            ret=(void*)need_base;
+            it = big;
         }
     }
-    free_blocks=temp.next;
-    return ret;
+    if (it == NULL) {
+        return NULL;
+    }
+
+    base = it->base;
+    size = takeFreeRegion(slot, base);
+    need_base = (char*)MBLOCK_ROUND_UP(base);
+    if (need_base != base) {
+        addFreeRegion(slot, base, need_base - base);
+    }
+    if (need_base + required_size != base + size) {
+        addFreeRegion(slot, need_base + required_size,
+                      (base + size) - (need_base + required_size));
+    }
+    return need_base;
 }
 
 /* VirtualAlloc MEM_COMMIT can't cross boundaries of VirtualAlloc MEM_RESERVE,
@@ -161,37 +469,38 @@ findFreeBlocks(nat n) {
    (ordered) allocated blocks. */
 static void
 commitBlocks(char* base, W_ size) {
-    alloc_rec* it;
-    it=allocs;
-    for( ; it!=0 && (it->base+it->size)<=base; it=it->next ) {}
-    for( ; it!=0 && size>0; it=it->next ) {
+    nat i;
+    for (i = findAlloc(base); i < n_allocs && size > 0; i++) {
+        alloc_rec *it = &allocs[i];
         W_ size_delta;
         void* temp;
         size_delta = it->size - (base-it->base);
         if(size_delta>size) size_delta=size;
-        temp = VirtualAlloc(base, size_delta, MEM_COMMIT, PAGE_READWRITE);
-        if(temp==0) {
-            sysErrorBelch("getMBlocks: VirtualAlloc MEM_COMMIT failed");
-            stg_exit(EXIT_FAILURE);
+        if (!it->large) {  // large pages are committed already
+            temp = VirtualAlloc(base, size_delta, MEM_COMMIT, PAGE_READWRITE);
+            if(temp==0) {
+                sysErrorBelch("getMBlocks: VirtualAlloc MEM_COMMIT failed");
+                stg_exit(EXIT_FAILURE);
+            }
         }
         size-=size_delta;
         base+=size_delta;
     }
 }
 
-void *
-osGetMBlocks(nat n) {
+static void *
+getMBlocksInSlot(nat n, nat slot) {
     void* ret;
-    ret = findFreeBlocks(n);
+    ret = findFreeBlocks(slot, n);
     if(ret==0) {
         alloc_rec* alloc;
-        alloc = allocNew(n);
+        alloc = allocNew(n, slot);
         /* We already belch in allocNew if it fails */
         if (alloc == 0) {
             stg_exit(EXIT_FAILURE);
         } else {
-            insertFree(alloc->base, alloc->size);
-            ret = findFreeBlocks(n);
+            insertFree(slot, alloc->base, alloc->size);
+            ret = findFreeBlocks(slot, n);
         }
     }
 
@@ -207,167 +516,147 @@ osGetMBlocks(nat n) {
     return ret;
 }
 
+void *
+osGetMBlocks(nat n) {
+    return getMBlocksInSlot(n, ANY_NODE);
+}
+
+/* The node preference has to be given when the memory is reserved, so
+   each node has its own allocs and free regions. */
+void *
+osGetMBlocksOnNode(nat n, nat node) {
+    if (pVirtualAllocExNuma == NULL || node >= MAX_NUMA_NODES) {
+        return getMBlocksInSlot(n, ANY_NODE);
+    }
+    return getMBlocksInSlot(n, node);
+}
+
 void osFreeMBlocks(char *addr, nat n)
 {
     alloc_rec *p;
+    nat i;
     W_ nBytes = (W_)n * MBLOCK_SIZE;
 
-    insertFree(addr, nBytes);
-
-    p = allocs;
-    while ((p != NULL) && (addr >= (p->base + p->size))) {
-        p = p->next;
+    i = findAlloc(addr);
+    if (i >= n_allocs || allocs[i].base > addr) {
+        errorBelch("Memory to be freed isn't allocated\n");
+        stg_exit(EXIT_FAILURE);
     }
+    insertFree(allocs[i].slot, addr, nBytes);
+
+    // The range may span several adjacent allocs of the same slot
     while (nBytes > 0) {
-        if ((p == NULL) || (p->base > addr)) {
+        if ((i >= n_allocs) || (allocs[i].base > addr)) {
             errorBelch("Memory to be freed isn't allocated\n");
             stg_exit(EXIT_FAILURE);
         }
-        if (p->base + p->size >= addr + nBytes) {
-            if (!VirtualFree(addr, nBytes, MEM_DECOMMIT)) {
-                sysErrorBelch("osFreeMBlocks: VirtualFree MEM_DECOMMIT failed");
-                stg_exit(EXIT_FAILURE);
-            }
-            nBytes = 0;
-        }
-        else {
-            W_ bytesToFree = p->base + p->size - addr;
-            if (!VirtualFree(addr, bytesToFree, MEM_DECOMMIT)) {
-                sysErrorBelch("osFreeMBlocks: VirtualFree MEM_DECOMMIT failed");
-                stg_exit(EXIT_FAILURE);
-            }
-            addr += bytesToFree;
-            nBytes -= bytesToFree;
-            p = p->next;
+        p = &allocs[i];
+        W_ bytesToFree = p->base + p->size - addr;
+        if (bytesToFree > nBytes) bytesToFree = nBytes;
+        // large pages can't be decommitted; they stay with the alloc
+        if (!p->large && !VirtualFree(addr, bytesToFree, MEM_DECOMMIT)) {
+            sysErrorBelch("osFreeMBlocks: VirtualFree MEM_DECOMMIT failed");
+            stg_exit(EXIT_FAILURE);
         }
+        addr += bytesToFree;
+        nBytes -= bytesToFree;
+        i++;
+    }
+}
+
+rtsBool osDiscardMemory(void *at, W_ size)
+{
+    alloc_rec *p = allocContaining(at);
+    if (p != NULL && p->large) {
+        // MEM_RESET doesn't apply to large pages, which are never paged
+        return rtsFalse;
     }
+    // MEM_RESET: the pages stay committed, but their contents no longer
+    // need to be preserved, so they won't be written to the page file.
+    return VirtualAlloc(at, size, MEM_RESET, PAGE_READWRITE) != NULL;
+}
+
+// We can't map a file over part of a VirtualAlloc()ed region, so
+// allocateMappedFile() never gets here.
+rtsBool osMapFile(void *at STG_UNUSED, W_ size STG_UNUSED, int fd STG_UNUSED,
+                  StgWord64 offset STG_UNUSED, rtsBool shared STG_UNUSED)
+{
+    errno = ENOSYS;
+    return rtsFalse;
+}
+
+void osUnmapFile(void *at STG_UNUSED, W_ size STG_UNUSED)
+{
+    barf("osUnmapFile: not supported");
 }
 
 void osReleaseFreeMemory(void)
 {
-    alloc_rec *prev_a, *a;
-    alloc_rec head_a;
-    block_rec *prev_fb, *fb;
-    block_rec head_fb;
-    char *a_end, *fb_end;
-
-    /* go through allocs and free_blocks in lockstep, looking for allocs
-       that are completely free, and uncommit them */
-
-    head_a.base = 0;
-    head_a.size = 0;
-    head_a.next = allocs;
-    head_fb.base = 0;
-    head_fb.size = 0;
-    head_fb.next = free_blocks;
-    prev_a = &head_a;
-    a = allocs;
-    prev_fb = &head_fb;
-    fb = free_blocks;
-
-    while (a != NULL) {
+    nat i;
+    block_rec *fb;
+    char *a_base, *a_end, *fb_base, *fb_end;
+
+    /* Look for allocs that are completely free, and release them.  Going
+       backwards lets us remove entries from allocs as we go. */
+    for (i = n_allocs; i-- > 0; ) {
+        alloc_rec *a = &allocs[i];
+        a_base = a->base;
         a_end = a->base + a->size;
-        /* If a is freeable then there is a single freeblock in fb that
-           covers it. The end of this free block must be >= the end of
-           a, so skip anything in fb that ends before a. */
-        while (fb != NULL && fb->base + fb->size < a_end) {
-            prev_fb = fb;
-            fb = fb->next;
+
+        /* If a is freeable then there is a single free region that
+           covers it, which is the last one starting at or below a. */
+        fb = freeRegionBelow(free_blocks[a->slot], a_base + 1);
+        if (fb == NULL || fb->base + fb->size < a_end) {
+            continue;
         }
 
-        if (fb == NULL) {
-            /* If we have nothing left in fb, then neither a nor
-               anything later in the list is freeable, so we are done. */
-            break;
+        fb_base = fb->base;
+        fb_end = fb->base + fb->size;
+        takeFreeRegion(a->slot, fb_base);
+        if (fb_base != a_base) {
+            addFreeRegion(a->slot, fb_base, a_base - fb_base);
         }
-        else {
-            fb_end = fb->base + fb->size;
-            /* We have a candidate fb. But does it really cover a? */
-            if (fb->base <= a->base) {
-                /* Yes, the alloc is within the free block. Now we need
-                   to know if it sticks out at either end. */
-                if (fb_end == a_end) {
-                    if (fb->base == a->base) {
-                        /* fb and a are identical, so just free fb */
-                        prev_fb->next = fb->next;
-                        stgFree(fb);
-                        fb = prev_fb->next;
-                    }
-                    else {
-                        /* fb begins earlier, so truncate it to not include a */
-                        fb->size = a->base - fb->base;
-                    }
-                }
-                else {
-                    /* fb ends later, so we'll make fb just be the part
-                       after a. First though, if it also starts earlier,
-                       we make a new free block record for the before bit. */
-                    if (fb->base != a->base) {
-                        block_rec *new_fb;
-
-                        new_fb =
-                            (block_rec *)stgMallocBytes(sizeof(block_rec),
-                                                        "osReleaseFreeMemory");
-                        new_fb->base = fb->base;
-                        new_fb->size = a->base - fb->base;
-                        new_fb->next = fb;
-                        prev_fb->next = new_fb;
-                    }
-                    fb->size = fb_end - a_end;
-                    fb->base = a_end;
-                }
-                /* Now we can free the alloc */
-                prev_a->next = a->next;
-                if(!VirtualFree((void *)a->base, 0, MEM_RELEASE)) {
-                    sysErrorBelch("freeAllMBlocks: VirtualFree MEM_RELEASE "
-                                  "failed");
-                    stg_exit(EXIT_FAILURE);
-                }
-                stgFree(a);
-                a = prev_a->next;
-            }
-            else {
-                /* Otherwise this alloc is not freeable, so go on to the
-                   next one */
-                prev_a = a;
-                a = a->next;
-            }
+        if (fb_end != a_end) {
+            addFreeRegion(a->slot, a_end, fb_end - a_end);
         }
-    }
 
-    allocs = head_a.next;
-    free_blocks = head_fb.next;
+        /* Now we can free the alloc */
+        if(!VirtualFree((void *)a->base, 0, MEM_RELEASE)) {
+            sysErrorBelch("freeAllMBlocks: VirtualFree MEM_RELEASE "
+                          "failed");
+            stg_exit(EXIT_FAILURE);
+        }
+        if (a->large) {
+            large_mblocks -= a->size / MBLOCK_SIZE;
+        }
+        memmove(&allocs[i], &allocs[i+1],
+                (n_allocs - i - 1) * sizeof(alloc_rec));
+        n_allocs--;
+    }
 }
 
 void
 osFreeAllMBlocks(void)
 {
-    {
-        block_rec* next;
-        block_rec* it;
-        next=0;
-        it = free_blocks;
-        for(; it!=0; ) {
-            next = it->next;
-            stgFree(it);
-            it=next;
-        }
+    nat i;
+
+    for (i = 0; i <= MAX_NUMA_NODES; i++) {
+        freeTree(free_blocks[i]);
+        free_blocks[i] = NULL;
     }
-    {
-        alloc_rec* next;
-        alloc_rec* it;
-        next=0;
-        it=allocs;
-        for(; it!=0; ) {
-            if(!VirtualFree((void*)it->base, 0, MEM_RELEASE)) {
-                sysErrorBelch("freeAllMBlocks: VirtualFree MEM_RELEASE failed");
-                stg_exit(EXIT_FAILURE);
-            }
-            next = it->next;
-            stgFree(it);
-            it=next;
+    for (i = 0; i < n_allocs; i++) {
+        if(!VirtualFree((void*)allocs[i].base, 0, MEM_RELEASE)) {
+            sysErrorBelch("freeAllMBlocks: VirtualFree MEM_RELEASE failed");
+            stg_exit(EXIT_FAILURE);
         }
     }
+    if (allocs != NULL) {
+        stgFree(allocs);
+    }
+    allocs = NULL;
+    n_allocs = 0;
+    max_allocs = 0;
+    large_mblocks = 0;
 }
 
 W_ getPageSize (void)
@@ -402,6 +691,34 @@ StgWord64 getPhysicalMemorySize (void)
     return physMemSize;
 }
 
+/* Returns 0 if the size of the last-level cache cannot be identified */
+StgWord64 getLastLevelCacheSize (void)
+{
+    static StgWord64 llcSize = 0;
+    if (!llcSize) {
+        SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info, *p;
+        DWORD len = 0;
+        BYTE level = 0;
+
+        GetLogicalProcessorInformation(NULL, &len);
+        if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            return 0;
+        }
+        info = stgMallocBytes(len, "getLastLevelCacheSize");
+        if (GetLogicalProcessorInformation(info, &len)) {
+            for (p = info; (char *)(p + 1) <= (char *)info + len; p++) {
+                if (p->Relationship == RelationCache
+                    && p->Cache.Level >= level) {
+                    level = p->Cache.Level;
+                    llcSize = p->Cache.Size;
+                }
+            }
+        }
+        stgFree(info);
+    }
+    return llcSize;
+}
+
 void setExecutable (void *p, W_ len, rtsBool exec)
 {
     DWORD dwOldProtect = 0;
@@ -414,3 +731,49 @@ void setExecutable (void *p, W_ len, rtsBool exec)
         stg_exit(EXIT_FAILURE);
     }
 }
+
+rtsBool osNumaAvailable(void)
+{
+    return osNumaNodes() > 1 && pVirtualAllocExNuma != NULL;
+}
+
+nat osNumaNodes(void)
+{
+    static nat nodes = 0;
+    if (!nodes) {
+        ULONG highest;
+        if (pGetNumaHighestNodeNumber != NULL &&
+            pGetNumaHighestNodeNumber(&highest)) {
+            nodes = (nat)highest + 1;
+        } else {
+            nodes = 1;
+        }
+    }
+    return nodes;
+}
+
+StgWord osNumaMask(void)
+{
+    nat nodes = osNumaNodes();
+    if (nodes > sizeof(StgWord)*8) {
+        barf("osNumaMask: too many NUMA nodes (%d)", nodes);
+    }
+    return nodes == sizeof(StgWord)*8 ? ~(StgWord)0
+                                      : ((StgWord)1 << nodes) - 1;
+}
+
+void osHugePageMBlocks(StgWord *hugetlb, StgWord *thp)
+{
+    // Windows has no transparent huge pages
+    *hugetlb = large_mblocks;
+    *thp = 0;
+}
+
+void osBindMBlocksToNode(
+    void *addr STG_UNUSED,
+    StgWord size STG_UNUSED,
+    nat node STG_UNUSED)
+{
+    // VirtualAllocExNuma() can only set the preferred node when memory
+    // is reserved, so the work is done by osGetMBlocksOnNode() instead.
+}
@@ -11,6 +11,8 @@
 #include <windows.h>
 #if defined(THREADED_RTS)
 #include "RtsUtils.h"
+#include "Trace.h"
+#include <stdlib.h>
 
 /* For reasons not yet clear, the entire contents of process.h is protected
  * by __STRICT_ANSI__ not being defined.
@@ -71,6 +73,14 @@ signalCondition ( Condition* pCond )
     return rtsTrue;
 }
 
+void
+unlockAndSignalCondition ( Condition* pCond, Mutex* pMut )
+{
+    // pCond may not be touched once pMut is released
+    signalCondition(pCond);
+    RELEASE_LOCK(pMut);
+}
+
 rtsBool
 waitCondition ( Condition* pCond, Mutex* pMut )
 {
@@ -81,6 +91,20 @@ waitCondition ( Condition* pCond, Mutex* pMut )
   return rtsTrue;
 }
 
+rtsBool
+timedWaitCondition ( Condition* pCond, Mutex* pMut, Time timeout )
+{
+  DWORD r;
+
+  RELEASE_LOCK(pMut);
+  // in ms, short of INFINITE: the cast alone would wrap long timeouts
+  r = WaitForSingleObject(*pCond,
+                          (DWORD)stg_min(TimeToUS(timeout) / 1000,
+                                         (Time)(INFINITE - 1)));
+  ACQUIRE_LOCK(pMut);
+  return (r != WAIT_TIMEOUT);
+}
+
 void
 yieldThread()
 {
@@ -170,6 +194,50 @@ closeMutex (Mutex* pMut)
 }
 #endif
 
+// WaitOnAddress() and WakeByAddressSingle() are Windows 8 and later
+typedef BOOL (WINAPI *WaitOnAddressProc)(volatile VOID *, PVOID, SIZE_T,
+                                         DWORD);
+typedef VOID (WINAPI *WakeByAddressSingleProc)(PVOID);
+
+static WaitOnAddressProc       pWaitOnAddress       = NULL;
+static WakeByAddressSingleProc pWakeByAddressSingle = NULL;
+static rtsBool                 wait_on_address_init = rtsFalse;
+
+static void
+initWaitOnAddress (void)
+{
+    // racing threads all find the same functions
+    HMODULE kernelbase = GetModuleHandle(TEXT("KernelBase.dll"));
+    if (kernelbase != NULL) {
+        pWakeByAddressSingle = (WakeByAddressSingleProc)
+            GetProcAddress(kernelbase, "WakeByAddressSingle");
+        pWaitOnAddress = (WaitOnAddressProc)
+            GetProcAddress(kernelbase, "WaitOnAddress");
+    }
+    write_barrier();
+    wait_on_address_init = rtsTrue;
+}
+
+rtsBool
+waitOnWord (StgVolatilePtr p, StgWord expected)
+{
+    if (!wait_on_address_init) initWaitOnAddress();
+    if (pWaitOnAddress == NULL || pWakeByAddressSingle == NULL) {
+        return rtsFalse;
+    }
+    pWaitOnAddress(p, &expected, sizeof(StgWord), INFINITE);
+    return rtsTrue;
+}
+
+void
+wakeOnWord (StgVolatilePtr p)
+{
+    if (!wait_on_address_init) initWaitOnAddress();
+    if (pWaitOnAddress != NULL && pWakeByAddressSingle != NULL) {
+        pWakeByAddressSingle((PVOID)p);
+    }
+}
+
 void
 newThreadLocalKey (ThreadLocalKey *key)
 {
@@ -256,6 +324,150 @@ getNumberOfProcessors (void)
     return nproc;
 }
 
+/* ----------------------------------------------------------------------------
+ * CPU topology, for +RTS -qa=<policy>
+ *
+ * As on Linux (see rts/posix/OSThreads.c), but the package and core of
+ * each CPU come from GetLogicalProcessorInformation(): every
+ * RelationProcessorPackage and RelationProcessorCore entry carries the
+ * mask of the CPUs it covers, and we number packages and cores in the
+ * order the entries appear.  Only the CPUs of the current processor
+ * group (at most one per bit of a DWORD_PTR) are considered, because
+ * that is all SetThreadAffinityMask() can reach.
+ * -------------------------------------------------------------------------- */
+
+#define MAX_CPUS (sizeof(DWORD_PTR) * 8)
+
+typedef struct {
+    int cpu;
+    int package;
+    int core;
+    int thread;          // index of this CPU among the SMT threads of its core
+    int core_index;      // index of the core within its package
+} CpuInfo;
+
+static CpuInfo cpu_info[MAX_CPUS];
+static int cpu_order[MAX_CPUS];
+static nat n_cpu_order = 0;
+
+static int
+compareCpuLocation (const void *a, const void *b)
+{
+    const CpuInfo *x = a, *y = b;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core)       return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static int
+compareCpuScatter (const void *a, const void *b)
+{
+    const CpuInfo *x = a, *y = b;
+    if (x->thread != y->thread)         return x->thread - y->thread;
+    if (x->core_index != y->core_index) return x->core_index - y->core_index;
+    if (x->package != y->package)       return x->package - y->package;
+    return x->cpu - y->cpu;
+}
+
+void
+initCpuTopology (nat policy)
+{
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info, *p;
+    DWORD len = 0;
+    DWORD_PTR allowed, system;
+    int package[MAX_CPUS], core[MAX_CPUS];
+    int n_packages = 0, n_cores = 0;
+    nat n, i, cpu;
+
+    n_cpu_order = 0;
+    if (policy == AFFINITY_MODULO) {
+        return;
+    }
+
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &allowed, &system)) {
+        sysErrorBelch("GetProcessAffinityMask");
+        return;
+    }
+
+    for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+        package[cpu] = -1;
+        core[cpu] = -1;
+    }
+
+    GetLogicalProcessorInformation(NULL, &len);
+    if (GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
+        info = stgMallocBytes(len, "initCpuTopology");
+        if (GetLogicalProcessorInformation(info, &len)) {
+            for (p = info; (char *)(p + 1) <= (char *)info + len; p++) {
+                if (p->Relationship == RelationProcessorPackage) {
+                    for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+                        if (p->ProcessorMask & ((DWORD_PTR)1 << cpu)) {
+                            package[cpu] = n_packages;
+                        }
+                    }
+                    n_packages++;
+                } else if (p->Relationship == RelationProcessorCore) {
+                    for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+                        if (p->ProcessorMask & ((DWORD_PTR)1 << cpu)) {
+                            core[cpu] = n_cores;
+                        }
+                    }
+                    n_cores++;
+                }
+            }
+        }
+        stgFree(info);
+    }
+
+    n = 0;
+    for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!(allowed & ((DWORD_PTR)1 << cpu))) continue;
+        cpu_info[n].cpu     = cpu;
+        cpu_info[n].package = package[cpu] < 0 ? 0 : package[cpu];
+        cpu_info[n].core    = core[cpu];
+        if (cpu_info[n].core < 0) {
+            // no topology information: treat each CPU as a core
+            cpu_info[n].package = 0;
+            cpu_info[n].core    = n_cores + cpu;
+        }
+        n++;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    // Number the SMT threads of each core, and the cores of each package
+    qsort(cpu_info, n, sizeof(CpuInfo), compareCpuLocation);
+    for (i = 0; i < n; i++) {
+        if (i > 0 && cpu_info[i].package == cpu_info[i-1].package) {
+            if (cpu_info[i].core == cpu_info[i-1].core) {
+                cpu_info[i].thread = cpu_info[i-1].thread + 1;
+                cpu_info[i].core_index = cpu_info[i-1].core_index;
+            } else {
+                cpu_info[i].thread = 0;
+                cpu_info[i].core_index = cpu_info[i-1].core_index + 1;
+            }
+        } else {
+            cpu_info[i].thread = 0;
+            cpu_info[i].core_index = 0;
+        }
+    }
+
+    if (policy != AFFINITY_COMPACT) {
+        qsort(cpu_info, n, sizeof(CpuInfo), compareCpuScatter);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (policy == AFFINITY_PHYSICAL && cpu_info[i].thread != 0) {
+            break;
+        }
+        cpu_order[n_cpu_order++] = cpu_info[i].cpu;
+    }
+
+    debugTrace(DEBUG_sched, "CPU topology: %d CPUs, Capability 0 on CPU %d",
+               n_cpu_order, cpu_order[0]);
+}
+
 void
 setThreadAffinity (nat n, nat m) // cap N of M
 {
@@ -265,11 +477,14 @@ setThreadAffinity (nat n, nat m) // cap N of M
 
     hThread = GetCurrentThread();
 
-    nproc = getNumberOfProcessors();
-
     mask = 0;
-    for (i = n; i < nproc; i+=m) {
-        mask |= 1 << i;
+    if (n_cpu_order > 0) {
+        mask = (DWORD_PTR)1 << cpu_order[n % n_cpu_order];
+    } else {
+        nproc = getNumberOfProcessors();
+        for (i = n; i < nproc; i+=m) {
+            mask |= 1 << i;
+        }
     }
 
     r = SetThreadAffinityMask(hThread, mask);
@@ -279,6 +494,11 @@ setThreadAffinity (nat n, nat m) // cap N of M
     }
 }
 
+void
+setThreadNode (nat node STG_UNUSED)
+{
+}
+
 typedef BOOL (WINAPI *PCSIO)(HANDLE);
 
 void
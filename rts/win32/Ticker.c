@@ -9,36 +9,176 @@
 #include <stdio.h>
 #include <process.h>
 
+// The ticker is a thread waiting on a one-shot waitable timer, which
+// it re-arms after every tick.  We used to use a timer-queue timer
+// (CreateTimerQueueTimer()), but that runs off the system timer and
+// so can't tick more often than every 15.6ms.
+//
+// Since Windows 10 1803, CreateWaitableTimerExW() accepts
+// CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, which gives a timer with
+// sub-millisecond resolution that doesn't depend on the global timer
+// resolution.  Where that isn't available we fall back to an ordinary
+// waitable timer, and raise the system timer resolution with
+// timeBeginPeriod() while the ticker is running.
+//
+// While the ticker is stopped (see stopTimer()) the thread waits on
+// wake_event only, so an idle program causes no wakeups at all.
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+typedef HANDLE (WINAPI *CreateWaitableTimerExWProc)(LPSECURITY_ATTRIBUTES,
+                                                    LPCWSTR, DWORD, DWORD);
+
 static TickProc tick_proc = NULL;
-static HANDLE timer_queue = NULL;
-static HANDLE timer       = NULL;
 static Time tick_interval = 0;
 
-static VOID CALLBACK tick_callback(
-  PVOID lpParameter STG_UNUSED,
-  BOOLEAN TimerOrWaitFired STG_UNUSED
-  )
+static HANDLE ticker_thread    = NULL;
+static DWORD  ticker_thread_id = 0;
+static HANDLE timer            = NULL;
+static HANDLE wake_event       = NULL;  // startTicker/stopTicker/exitTicker
+static CRITICAL_SECTION ticker_lock;
+
+// protected by ticker_lock
+static rtsBool ticker_stopped;
+static rtsBool ticker_exiting;
+static rtsBool ticker_in_tick;
+
+// only used by the ticker thread
+static StgWord64 next_tick;             // getMonotonicNSec() of the next tick
+
+// the timeBeginPeriod() in force, or 0
+static UINT timer_period = 0;
+
+static void
+armTimer (void)
 {
-    tick_proc(0);
+    LARGE_INTEGER due;
+    StgWord64 now, interval;
+
+    now = getMonotonicNSec();
+    interval = TimeToNS(tick_interval);
+
+    next_tick += interval;
+    if (next_tick <= now) {
+        // we fell behind, e.g. the machine was suspended: don't try
+        // to catch up with a burst of ticks
+        next_tick = now + interval;
+    }
+
+    // negative means relative, in units of 100ns
+    due.QuadPart = -(LONGLONG)((next_tick - now + 99) / 100);
+    if (!SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE)) {
+        sysErrorBelch("SetWaitableTimer");
+        stg_exit(EXIT_FAILURE);
+    }
 }
 
-// We use the CreateTimerQueue() API which has been around since
-// Windows 2000.  Apparently it gives bad results before Windows 7,
-// though: http://www.virtualdub.org/blog/pivot/entry.php?id=272
-//
-// Even with the improvements in Windows 7, this timer isn't going to
-// be very useful for profiling with a max usable resolution of
-// 15ms. Unfortunately we don't have anything better.
+static unsigned __stdcall
+ticker_thread_func (void *param STG_UNUSED)
+{
+    HANDLE handles[2];
+    rtsBool armed = rtsFalse;
+    DWORD r;
+
+    handles[0] = wake_event;
+    handles[1] = timer;
+
+    while (1) {
+        EnterCriticalSection(&ticker_lock);
+        if (ticker_exiting) {
+            LeaveCriticalSection(&ticker_lock);
+            break;
+        }
+        if (ticker_stopped) {
+            if (armed) {
+                CancelWaitableTimer(timer);
+                armed = rtsFalse;
+            }
+        } else if (!armed) {
+            next_tick = getMonotonicNSec();
+            armTimer();
+            armed = rtsTrue;
+        }
+        LeaveCriticalSection(&ticker_lock);
+
+        r = WaitForMultipleObjects(armed ? 2 : 1, handles, FALSE, INFINITE);
+
+        if (r == WAIT_OBJECT_0 + 1) {
+            EnterCriticalSection(&ticker_lock);
+            if (!ticker_stopped && !ticker_exiting) {
+                ticker_in_tick = rtsTrue;
+                tick_proc(0);
+                ticker_in_tick = rtsFalse;
+            }
+            // handle_tick() may have stopped the ticker
+            if (!ticker_stopped && !ticker_exiting) {
+                armTimer();
+            } else {
+                armed = rtsFalse;
+            }
+            LeaveCriticalSection(&ticker_lock);
+        } else if (r == WAIT_FAILED) {
+            sysErrorBelch("Ticker: WaitForMultipleObjects");
+            stg_exit(EXIT_FAILURE);
+        }
+    }
+    return 0;
+}
 
 void
 initTicker (Time interval, TickProc handle_tick)
 {
+    CreateWaitableTimerExWProc pCreateWaitableTimerExW;
+
     tick_interval = interval;
     tick_proc = handle_tick;
 
-    timer_queue = CreateTimerQueue();
-    if (timer_queue == NULL) {
-        sysErrorBelch("CreateTimerQueue");
+    ticker_stopped = rtsTrue;
+    ticker_exiting = rtsFalse;
+    ticker_in_tick = rtsFalse;
+    InitializeCriticalSection(&ticker_lock);
+
+    pCreateWaitableTimerExW = (CreateWaitableTimerExWProc)
+        GetProcAddress(GetModuleHandle(TEXT("kernel32.dll")),
+                       "CreateWaitableTimerExW");
+    timer = NULL;
+    if (pCreateWaitableTimerExW != NULL) {
+        // fails with ERROR_INVALID_PARAMETER before Windows 10 1803
+        timer = pCreateWaitableTimerExW(NULL, NULL,
+                                        CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                        TIMER_ALL_ACCESS);
+    }
+    if (timer == NULL) {
+        TIMECAPS timecaps;
+
+        timer = CreateWaitableTimer(NULL, FALSE, NULL);
+        if (timer == NULL) {
+            sysErrorBelch("CreateWaitableTimer");
+            stg_exit(EXIT_FAILURE);
+        }
+        if (timeGetDevCaps(&timecaps, sizeof(timecaps)) == MMSYSERR_NOERROR) {
+            timer_period = timecaps.wPeriodMin;
+            if (timer_period < 1) timer_period = 1;
+        } else {
+            timer_period = 1;
+        }
+    } else {
+        timer_period = 0;
+    }
+
+    wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (wake_event == NULL) {
+        sysErrorBelch("CreateEvent");
+        stg_exit(EXIT_FAILURE);
+    }
+
+    ticker_thread = (HANDLE)_beginthreadex(NULL, 0, ticker_thread_func,
+                                           NULL, 0,
+                                           (unsigned*)&ticker_thread_id);
+    if (ticker_thread == NULL) {
+        sysErrorBelch("Ticker: _beginthreadex");
         stg_exit(EXIT_FAILURE);
     }
 }
@@ -46,35 +186,65 @@ initTicker (Time interval, TickProc handle_tick)
 void
 startTicker(void)
 {
-    BOOL r;
-
-    r = CreateTimerQueueTimer(&timer,
-                              timer_queue,
-                              tick_callback,
-                              0,
-                              0,
-                              TimeToUS(tick_interval) / 1000, // ms
-                              WT_EXECUTEINTIMERTHREAD);
-    if (r == 0) {
-        sysErrorBelch("CreateTimerQueueTimer");
-        stg_exit(EXIT_FAILURE);
+    EnterCriticalSection(&ticker_lock);
+    if (ticker_stopped) {
+        ticker_stopped = rtsFalse;
+        if (timer_period != 0) {
+            timeBeginPeriod(timer_period);
+        }
     }
+    LeaveCriticalSection(&ticker_lock);
+    SetEvent(wake_event);
 }
 
 void
 stopTicker(void)
 {
-    if (timer_queue != NULL && timer != NULL) {
-        DeleteTimerQueueTimer(timer_queue, timer, NULL);
-        timer = NULL;
+    rtsBool from_tick;
+
+    // handle_tick() calling stopTimer() on the ticker thread
+    from_tick = ticker_in_tick && GetCurrentThreadId() == ticker_thread_id;
+
+    if (!from_tick) EnterCriticalSection(&ticker_lock);
+    if (!ticker_stopped) {
+        ticker_stopped = rtsTrue;
+        if (timer_period != 0) {
+            timeEndPeriod(timer_period);
+        }
     }
+    if (!from_tick) LeaveCriticalSection(&ticker_lock);
+    // wake the thread, so that it disarms the timer
+    SetEvent(wake_event);
 }
 
 void
 exitTicker (rtsBool wait)
 {
-    if (timer_queue != NULL) {
-        DeleteTimerQueueEx(timer_queue, wait ? INVALID_HANDLE_VALUE : NULL);
-        timer_queue = NULL;
+    if (ticker_thread == NULL) {
+        return;
+    }
+
+    EnterCriticalSection(&ticker_lock);
+    ticker_exiting = rtsTrue;
+    if (!ticker_stopped) {
+        ticker_stopped = rtsTrue;
+        if (timer_period != 0) {
+            timeEndPeriod(timer_period);
+        }
+    }
+    LeaveCriticalSection(&ticker_lock);
+    SetEvent(wake_event);
+
+    if (wait) {
+        if (WaitForSingleObject(ticker_thread, INFINITE) == WAIT_FAILED) {
+            sysErrorBelch("Ticker: WaitForSingleObject");
+        }
+        CloseHandle(timer);
+        CloseHandle(wake_event);
+        DeleteCriticalSection(&ticker_lock);
+        timer = NULL;
+        wake_event = NULL;
     }
+    CloseHandle(ticker_thread);
+    ticker_thread = NULL;
 }
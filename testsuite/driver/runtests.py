@@ -53,6 +53,7 @@ long_options = [
   "check-files-written", # check files aren't written by multiple tests
   "verbose=",          # verbose (0,1,2 so far)
   "skip-perf-tests",       # skip performance tests
+  "scaling",               # run the -N sweeps of scaling tests
   ]
 
 opts, args = getopt.getopt(sys.argv[1:], "e:", long_options)
@@ -104,6 +105,9 @@ for opt,arg in opts:
     if opt == '--skip-perf-tests':
         config.skip_perf_tests = True
 
+    if opt == '--scaling':
+        config.run_scaling = True
+
     if opt == '--verbose':
         if arg not in ["0","1","2","3","4"]:
             sys.stderr.write("ERROR: requested verbosity %s not supported, use 0,1,2,3 or 4" % arg)
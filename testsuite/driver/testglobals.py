@@ -115,6 +115,11 @@ class TestConfig:
         # Should we skip performance tests
         self.skip_perf_tests = False
 
+        # Should we run the -N sweeps of scaling tests (see scaling()),
+        # and on how many cores at most (None: all of them)?
+        self.run_scaling = False
+        self.scaling_max_cores = None
+
 global config
 config = TestConfig()
 
@@ -221,6 +226,14 @@ class TestOptions:
        self.compiler_stats_range_fields = {}
        self.stats_range_fields = {}
 
+       # which -t numeric fields must stay below a bound?  Elements are
+       # things like ('GC_pause_max_us', 50000).  See stats_max_field().
+       self.stats_max_fields = {}
+
+       # For a scaling test, the speedups we expect, the extra RTS flags
+       # to sweep with, and the stat to time (see scaling())
+       self.scaling = None
+
        # should we run this test alone, i.e. not run it in parallel with
        # any other threads
        self.alone = False
@@ -17,6 +17,7 @@ import copy
 import glob
 from math import ceil, trunc
 import collections
+import multiprocessing
 
 have_subprocess = False
 try:
@@ -63,7 +64,7 @@ def setLocalTestOpts(opts):
 
 def isStatsTest():
     opts = getTestOpts()
-    return len(opts.compiler_stats_range_fields) > 0 or len(opts.stats_range_fields) > 0
+    return len(opts.compiler_stats_range_fields) > 0 or len(opts.stats_range_fields) > 0 or len(opts.stats_max_fields) > 0 or opts.scaling != None
 
 
 # This can be called at the top of a file of tests, to set default test options
@@ -297,6 +298,35 @@ def _stats_num_field( name, opts, field, expecteds ):
         (expected, dev) = expecteds
         opts.stats_range_fields[field] = (expected, dev)
 
+# A field of the -t stats that must not exceed a bound, for stats such
+# as GC pause times that vary too much from run to run for
+# stats_num_field, but shouldn't regress beyond some limit.  bounds is
+# either a number or a list of (condition, bound), like the expected
+# values of stats_num_field.  As well as the fields printed by the RTS,
+# field can be one of these, which are computed from them:
+#
+#   GC_elapsed_percent  GC_wall_seconds as a percentage of
+#                       mutator_wall_seconds + GC_wall_seconds
+#   mem_in_use_ratio    max_mem_in_use_bytes / max_bytes_used, i.e. the
+#                       memory the heap took per byte of live data
+
+def stats_max_field( field, bounds ):
+    return lambda name, opts, f=field, b=bounds: _stats_max_field(name, opts, f, b);
+
+def _stats_max_field( name, opts, field, bounds ):
+    if field in opts.stats_max_fields:
+        framework_fail(name, 'duplicate-maxfield', 'Duplicate ' + field + ' max_field check')
+
+    if type(bounds) is list:
+        for (b, bound) in bounds:
+            if b:
+                opts.stats_max_fields[field] = bound
+                return
+        framework_fail(name, 'maxfield-no-bound', 'No bound found for ' + field + ' in max_field check')
+
+    else:
+        opts.stats_max_fields[field] = bounds
+
 def compiler_stats_num_field( field, expecteds ):
     return lambda name, opts, f=field, e=expecteds: _compiler_stats_num_field(name, opts, f, e);
 
@@ -318,6 +348,32 @@ def _compiler_stats_num_field( name, opts, field, expecteds ):
 
 # -----
 
+# A scaling test is run again with +RTS -N<n> for every n in expecteds,
+# once for each set of extra RTS flags in variants, and fails if its
+# speedup over -N1 is more than dev% below the expected one.  For each
+# run the time is taken from field of the -t --machine-readable stats,
+# where 'wall' means mutator_wall_seconds + GC_wall_seconds.  The
+# results are written to <name>.scaling, one line per run, for plotting.
+#
+# The sweep is slow, and only meaningful on a quiet machine, so it is
+# only done with make SCALING=YES (runtests --scaling); otherwise the
+# test runs once, like any other.
+#
+# For example,
+#     scaling([(2, 1.8, 10), (4, 3.2, 15)], variants=['', '-qg'])
+
+def scaling( expecteds, variants=[''], field='wall' ):
+    return lambda name, opts, e=expecteds, v=variants, f=field: _scaling(name, opts, e, v, f)
+
+def _scaling( name, opts, expecteds, variants, field ):
+    if opts.scaling != None:
+        framework_fail(name, 'duplicate-scaling', 'Duplicate scaling check')
+    opts.scaling = (expecteds, variants, field)
+    if config.run_scaling:
+        opts.alone = True
+
+# -----
+
 def when(b, f):
     # When list_brokens is on, we want to see all expect_broken calls,
     # so we always do f
@@ -1171,6 +1227,62 @@ def checkStats(name, way, stats_file, range_fields):
                 
     return result
 
+# Check the fields of the -t stats that have an upper bound (see
+# stats_max_field())
+
+def checkStatsMax(name, way, stats_file, max_fields):
+    full_name = name + '(' + way + ')'
+
+    result = passed()
+    if len(max_fields) > 0:
+        f = open(in_testdir(stats_file))
+        contents = f.read()
+        f.close()
+
+        for (field, bound) in max_fields.items():
+            val = statsMaxFieldValue(contents, field)
+            if val == None:
+                print('Failed to find field: ', field)
+                result = failBecause('no such stats field')
+                continue
+
+            if val > bound:
+                print(field, 'value is too high:')
+                result = failBecause('stat not good enough', tag='stat')
+
+            if val > bound or config.verbose >= 4:
+                print('    Bound       ' + full_name + ' ' + field + ':', bound)
+                print('    Actual      ' + full_name + ' ' + field + ':', val)
+
+    return result
+
+def statsMaxFieldValue(contents, field):
+    def get(fld):
+        m = re.search('\("' + fld + '", "([0-9.]+)"\)', contents)
+        if m == None:
+            return None
+        return float(m.group(1))
+
+    if field == 'GC_elapsed_percent':
+        mut = get('mutator_wall_seconds')
+        gc  = get('GC_wall_seconds')
+        if mut == None or gc == None:
+            return None
+        if mut + gc == 0:
+            return 0.0
+        return round(gc * 100 / (mut + gc), 1)
+
+    if field == 'mem_in_use_ratio':
+        mem  = get('max_mem_in_use_bytes')
+        live = get('max_bytes_used')
+        if mem == None or live == None:
+            return None
+        if live == 0:
+            return 0.0
+        return round(mem / live, 2)
+
+    return get(field)
+
 # -----------------------------------------------------------------------------
 # Build a single-module program
 
@@ -1297,7 +1409,7 @@ def simple_run( name, way, prog, args ):
     my_rts_flags = rts_flags(way)
 
     stats_file = name + '.stats'
-    if len(opts.stats_range_fields) > 0:
+    if len(opts.stats_range_fields) > 0 or len(opts.stats_max_fields) > 0:
         args += ' +RTS -V0 -t' + stats_file + ' --machine-readable -RTS'
 
     if opts.no_stdin:
@@ -1351,7 +1463,97 @@ def simple_run( name, way, prog, args ):
         if check_prof and not check_prof_ok(name):
             return failBecause('bad profile')
 
-    return checkStats(name, way, stats_file, opts.stats_range_fields)
+    result = checkStats(name, way, stats_file, opts.stats_range_fields)
+    if badResult(result):
+        return result
+
+    result = checkStatsMax(name, way, stats_file, opts.stats_max_fields)
+    if badResult(result) or opts.scaling == None or not config.run_scaling:
+        return result
+
+    return checkScaling(name, way, prog + ' ' + args + ' ' + my_rts_flags,
+                        stdin_comes_from)
+
+# -----------------------------------------------------------------------------
+# Run a scaling test over a sweep of -N (see scaling())
+
+def checkScaling(name, way, cmd, stdin_comes_from):
+    opts = getTestOpts()
+    (expecteds, variants, field) = opts.scaling
+    full_name = name + '(' + way + ')'
+
+    max_cores = config.scaling_max_cores
+    if max_cores == None:
+        try:
+            max_cores = multiprocessing.cpu_count()
+        except NotImplementedError:
+            max_cores = 1
+    cores = [1] + [n for (n, _, _) in expecteds if 1 < n <= max_cores]
+
+    stats_file = name + '.scaling.stats'
+    report = []
+    result = passed()
+
+    for variant in variants:
+        times = {}
+        for n in cores:
+            run_cmd = 'cd ' + opts.testdir + ' && ' + cmd \
+                + ' +RTS -N' + str(n) + ' ' + variant \
+                + ' -V0 -t' + stats_file + ' --machine-readable -RTS' \
+                + stdin_comes_from + ' >/dev/null 2>&1'
+            r = runCmdFor(name, run_cmd, timeout_multiplier=opts.timeout_multiplier)
+            if r >> 8 != opts.exit_code:
+                print('Wrong exit code in scaling run with -N' + str(n), variant)
+                return failBecause('bad exit code')
+
+            val = scalingStat(stats_file, field)
+            if val == None:
+                print('Failed to find field: ', field)
+                return failBecause('no such stats field')
+            times[n] = val
+            speedup = times[1] / val if val > 0 else float('inf')
+            report.append(' '.join([variant or '-', str(n), str(val),
+                                    str(round(speedup, 2))]))
+
+        for (n, expected, dev) in expecteds:
+            if n not in times:
+                continue
+            speedup = times[1] / times[n] if times[n] > 0 else float('inf')
+            lowerBound = expected * ((100 - float(dev)) / 100)
+            bad = speedup < lowerBound
+            if bad:
+                print(field, 'speedup with -N' + str(n), variant, 'is too low:')
+                result = failBecause('scaling not good enough', tag='stat')
+            if bad or config.verbose >= 4:
+                print('    Expected    ' + full_name + ' -N' + str(n) + ' ' + variant + ':',
+                      expected, '-' + str(dev) + '%')
+                print('    Actual      ' + full_name + ' -N' + str(n) + ' ' + variant + ':',
+                      round(speedup, 2))
+
+    f = open(in_testdir(name + '.scaling'), 'w')
+    f.write('# variant cores ' + field + ' speedup\n')
+    f.write('\n'.join(report) + '\n')
+    f.close()
+
+    return result
+
+def scalingStat(stats_file, field):
+    f = open(in_testdir(stats_file))
+    contents = f.read()
+    f.close()
+
+    if field == 'wall':
+        fields = ['mutator_wall_seconds', 'GC_wall_seconds']
+    else:
+        fields = [field]
+
+    total = 0
+    for fld in fields:
+        m = re.search('\("' + fld + '", "([0-9.]+)"\)', contents)
+        if m == None:
+            return None
+        total += float(m.group(1))
+    return total
 
 def rts_flags(way):
     if (way == ''):
@@ -182,6 +182,14 @@ ifeq "$(SKIP_PERF_TESTS)" "YES"
 RUNTEST_OPTS += --skip-perf-tests
 endif
 
+ifeq "$(SCALING)" "YES"
+RUNTEST_OPTS += --scaling
+endif
+
+ifneq "$(SCALING_MAX_CORES)" ""
+RUNTEST_OPTS += -e config.scaling_max_cores=$(SCALING_MAX_CORES)
+endif
+
 ifneq "$(CLEAN_ONLY)" ""
 RUNTEST_OPTS += -e clean_only=True
 else
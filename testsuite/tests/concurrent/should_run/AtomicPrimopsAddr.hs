@@ -0,0 +1,151 @@
+{-# LANGUAGE MagicHash #-}
+{-# LANGUAGE UnboxedTuples #-}
+
+module Main ( main ) where
+
+import Control.Concurrent
+import Control.Monad (when)
+import Foreign.Marshal.Alloc
+import Foreign.Storable
+import GHC.Exts
+import GHC.IO
+import GHC.Ptr
+
+-- The Addr# versions of the tests in AtomicPrimops, on memory outside
+-- the heap.
+
+-- | Iterations per worker.
+iters :: Int
+iters = 1000000
+
+main :: IO ()
+main = do
+    fetchAddSubTest
+    fetchXorTest
+    casTest
+    readWriteTest
+
+fetchAddSubTest :: IO ()
+fetchAddSubTest = do
+    tot <- race 0
+        (\ p -> work fetchAddIntAddr p iters 2)
+        (\ p -> work fetchSubIntAddr p iters 1)
+    assertEq 1000000 tot "fetchAddSubTest"
+  where
+    work :: (Ptr Int -> Int -> IO ()) -> Ptr Int -> Int -> Int -> IO ()
+    work op p 0 val = return ()
+    work op p n val = op p val >> work op p (n-1) val
+
+fetchXorTest :: IO ()
+fetchXorTest = do
+    res <- race n0
+        (\ p -> work p iters t1pat)
+        (\ p -> work p iters t2pat)
+    assertEq expected res "fetchXorTest"
+  where
+    work :: Ptr Int -> Int -> Int -> IO ()
+    work p 0 val = return ()
+    work p n val = fetchXorIntAddr p val >> work p (n-1) val
+
+    (n0, t1pat, t2pat)
+        | sizeOf (undefined :: Int) == 8 =
+            (0x00000000ffffffff, 0x5555555555555555, 0x9999999999999999)
+        | otherwise = (0x0000ffff, 0x55555555, 0x99999999)
+    expected
+        | sizeOf (undefined :: Int) == 8 = 4294967295
+        | otherwise = 65535
+
+casTest :: IO ()
+casTest = do
+    tot <- race 0
+        (\ p -> work p iters 1)
+        (\ p -> work p iters 2)
+    assertEq 3000000 tot "casTest"
+  where
+    work :: Ptr Int -> Int -> Int -> IO ()
+    work p 0 val = return ()
+    work p n val = add p val >> work p (n-1) val
+
+    add :: Ptr Int -> Int -> IO ()
+    add p n = do
+        old <- peek p
+        old' <- casIntAddr p old (old + n)
+        when (old /= old') $ add p n
+
+readWriteTest :: IO ()
+readWriteTest = do
+    p <- malloc
+    poke p 0
+    latch <- newEmptyMVar
+    done <- newEmptyMVar
+    forkIO $ do
+        takeMVar latch
+        n <- atomicReadIntAddr p
+        assertEq 1 n "readWriteTest"
+        putMVar done ()
+    atomicWriteIntAddr p 1
+    putMVar latch ()
+    takeMVar done
+    free p
+
+-- | Create two threads that mutate the word passed to them
+-- concurrently.
+race :: Int                 -- ^ Initial value
+     -> (Ptr Int -> IO ())  -- ^ Thread 1 action
+     -> (Ptr Int -> IO ())  -- ^ Thread 2 action
+     -> IO Int              -- ^ Final value
+race n0 thread1 thread2 = do
+    done1 <- newEmptyMVar
+    done2 <- newEmptyMVar
+    p <- malloc
+    poke p n0
+    forkIO $ thread1 p >> putMVar done1 ()
+    forkIO $ thread2 p >> putMVar done2 ()
+    mapM_ takeMVar [done1, done2]
+    n <- peek p
+    free p
+    return n
+
+------------------------------------------------------------------------
+-- Test helper
+
+assertEq :: (Eq a, Show a) => a -> a -> String -> IO ()
+assertEq expected actual name
+    | expected == actual = putStrLn $ name ++ ": OK"
+    | otherwise = do
+        putStrLn $ name ++ ": FAIL"
+        putStrLn $ "Expected: " ++ show expected
+        putStrLn $ "  Actual: " ++ show actual
+
+------------------------------------------------------------------------
+-- Wrappers around Addr#
+
+fetchAddIntAddr :: Ptr Int -> Int -> IO ()
+fetchAddIntAddr (Ptr a#) (I# n#) = IO $ \ s# ->
+    case fetchAddIntOffAddr# a# 0# n# s# of
+        (# s2#, _ #) -> (# s2#, () #)
+
+fetchSubIntAddr :: Ptr Int -> Int -> IO ()
+fetchSubIntAddr (Ptr a#) (I# n#) = IO $ \ s# ->
+    case fetchSubIntOffAddr# a# 0# n# s# of
+        (# s2#, _ #) -> (# s2#, () #)
+
+fetchXorIntAddr :: Ptr Int -> Int -> IO ()
+fetchXorIntAddr (Ptr a#) (I# n#) = IO $ \ s# ->
+    case fetchXorIntOffAddr# a# 0# n# s# of
+        (# s2#, _ #) -> (# s2#, () #)
+
+atomicWriteIntAddr :: Ptr Int -> Int -> IO ()
+atomicWriteIntAddr (Ptr a#) (I# n#) = IO $ \ s# ->
+    case atomicWriteIntOffAddr# a# 0# n# s# of
+        s2# -> (# s2#, () #)
+
+atomicReadIntAddr :: Ptr Int -> IO Int
+atomicReadIntAddr (Ptr a#) = IO $ \ s# ->
+    case atomicReadIntOffAddr# a# 0# s# of
+        (# s2#, n# #) -> (# s2#, I# n# #)
+
+casIntAddr :: Ptr Int -> Int -> Int -> IO Int
+casIntAddr (Ptr a#) (I# old#) (I# new#) = IO $ \ s# ->
+    case casIntOffAddr# a# 0# old# new# s# of
+        (# s2#, old2# #) -> (# s2#, I# old2# #)
@@ -0,0 +1,30 @@
+module Main (main) where
+
+import GHC.Conc
+import Control.Concurrent
+import Control.Exception
+import System.Environment
+import System.Exit
+import System.Mem
+
+main = do
+  n <- fmap ((+ 200000) . length) getArgs
+  setAccountingGroupQuota 1 (1024*1024)
+  ready <- newEmptyMVar
+  m <- newEmptyMVar
+  let action = do me <- myThreadId
+                  setAccountingGroup me 1
+                  let xs = [1..n]
+                  _ <- evaluate (length xs)
+                  putMVar ready ()
+                  threadDelay 10000000
+                  print (sum xs)
+  forkFinally action (putMVar m)
+  takeMVar ready
+  performMajorGC
+  residency <- accountingGroupResidency 1
+  print (residency > 1024*1024)
+  r <- takeMVar m
+  case r of
+    Left e | Just ResidencyQuotaExceeded <- fromException e -> return ()
+    _ -> print r >> exitFailure
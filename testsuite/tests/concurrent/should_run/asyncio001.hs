@@ -0,0 +1,15 @@
+-- File I/O on blocking descriptors goes through asyncRead#/asyncWrite#
+-- on Linux in the non-threaded RTS; check that it reads back what it
+-- wrote while another thread keeps running.
+import Control.Concurrent
+import Control.Monad
+
+main :: IO ()
+main = do
+  let file = "asyncio001.tmp"
+      contents = concat (replicate 20000 ['a' .. 'z'])
+  ticks <- newMVar (0 :: Int)
+  _ <- forkIO $ forever $ modifyMVar_ ticks (return . (+1)) >> yield
+  writeFile file contents
+  back <- readFile file
+  print (length back, back == contents)
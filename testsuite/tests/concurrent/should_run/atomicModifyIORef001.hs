@@ -0,0 +1,30 @@
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+
+-- Threads counting on one IORef with atomicModifyIORef', and swapping
+-- values with atomicSwapIORef: nothing may be lost.
+
+main :: IO ()
+main = do
+  ref <- newIORef (0 :: Int)
+  done <- newEmptyMVar
+  forM_ [1 .. 4 :: Int] $ \_ -> forkIO $ do
+    replicateM_ 100000 $ atomicModifyIORef' ref (\n -> (n + 1, ()))
+    putMVar done ()
+  replicateM_ 4 (takeMVar done)
+  readIORef ref >>= print
+
+  -- Each thread swaps in its own values; the values that come out, plus
+  -- the last one left in, are exactly the ones that went in.
+  swap <- newIORef (0 :: Int)
+  sums <- newIORef (0 :: Int)
+  forM_ [1 .. 4 :: Int] $ \t -> forkIO $ do
+    forM_ [1 .. 10000] $ \i -> do
+      old <- atomicSwapIORef swap (t * 100000 + i)
+      atomicModifyIORef' sums (\s -> (s + old, ()))
+    putMVar done ()
+  replicateM_ 4 (takeMVar done)
+  s <- readIORef sums
+  l <- readIORef swap
+  print (s + l == sum [ t * 100000 + i | t <- [1 .. 4], i <- [1 .. 10000] ])
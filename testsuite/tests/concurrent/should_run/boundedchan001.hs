@@ -0,0 +1,33 @@
+import Control.Concurrent
+import Control.Concurrent.BoundedChan
+import Control.Monad
+
+-- Producers and a consumer on a small BoundedChan: every element arrives,
+-- in order for each producer; then a blocked writer is killed and must
+-- not lose the wakeup meant for the next one.
+
+main :: IO ()
+main = do
+  c <- newBoundedChan 16
+  forM_ [0 .. 3] $ \p -> forkIO $
+    forM_ [1 .. 10000] $ \i -> writeBoundedChan c (p, i :: Int)
+  let loop :: [Int] -> Int -> Int -> IO (Bool, Int)
+      loop lasts 0 total = return (all (== 10000) lasts, total)
+      loop lasts n total = do
+        xs <- readBoundedChanMany c 8
+        let lasts' = foldl next lasts xs
+            next ls (p, i) = [ if q == p && l == i - 1 then i
+                               else if q == p then -1 else l
+                             | (q, l) <- zip [0 ..] ls ]
+        loop lasts' (n - length xs) (total + sum (map snd xs))
+  loop [0, 0, 0, 0] 40000 0 >>= print
+
+  c2 <- newBoundedChan 1
+  writeBoundedChan c2 'a'
+  t <- forkIO (writeBoundedChan c2 'b')
+  threadDelay 100000
+  killThread t
+  _ <- forkIO (writeBoundedChan c2 'c')
+  threadDelay 100000
+  readBoundedChan c2 >>= print
+  readBoundedChan c2 >>= print
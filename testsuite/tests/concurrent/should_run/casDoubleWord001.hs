@@ -0,0 +1,46 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+
+import Control.Concurrent
+import Control.Monad
+import GHC.Exts
+import GHC.IO
+
+-- Threads bumping a (value, tag) pair with casDoubleWordArray#, as a
+-- lock-free structure would bump a pointer and its ABA tag: both words
+-- must always move together, and no update may be lost.
+
+data MBA = MBA (MutableByteArray# RealWorld)
+
+main :: IO ()
+main = do
+  arr <- IO $ \s -> case newAlignedPinnedByteArray# 64# 16# s of
+                      (# s1, a #) -> (# s1, MBA a #)
+  write arr 0 0
+  write arr 1 0
+  done <- newEmptyMVar
+  forM_ [1 .. 4 :: Int] $ \_ -> forkIO $ do
+    replicateM_ 100000 (bump arr)
+    putMVar done ()
+  replicateM_ 4 (takeMVar done)
+  (_, v, t) <- cas arr 0 0 0 0
+  print (v, t)
+
+  -- a failed swap leaves the words alone and returns them
+  (ok, v', t') <- cas arr 0 (v + 1) t 5 5
+  print (ok, v' == v, t' == t)
+
+bump :: MBA -> IO ()
+bump arr = loop 0 0
+  where
+    loop v t = do
+      (ok, v', t') <- cas arr 0 v t (v + 1) (t + 2)
+      unless ok (loop v' t')
+
+cas :: MBA -> Int -> Word -> Word -> Word -> Word -> IO (Bool, Word, Word)
+cas (MBA a) (I# i) (W# o1) (W# o2) (W# n1) (W# n2) = IO $ \s ->
+  case casDoubleWordArray# a i o1 o2 n1 n2 s of
+    (# s1, ok, r1, r2 #) -> (# s1, (isTrue# ok, W# r1, W# r2) #)
+
+write :: MBA -> Int -> Word -> IO ()
+write (MBA a) (I# i) (W# w) = IO $ \s ->
+  case writeWordArray# a i w s of s1 -> (# s1, () #)
@@ -0,0 +1,19 @@
+import Control.Concurrent
+import Control.Monad
+import System.Timeout
+
+-- Lots of sleeping threads, half of which are killed before they wake
+-- up, plus timeouts that are cancelled: exactly the others wake up.
+
+main :: IO ()
+main = do
+  out <- newChan
+  ts <- forM [1 .. 2000 :: Int] $ \i -> forkIO $ do
+    threadDelay ((i `mod` 100) * 1000 + 10000)
+    writeChan out i
+  forM_ (zip [1 :: Int ..] ts) $ \(j, t) -> when (even j) $ killThread t
+  rs <- replicateM 1000 (readChan out)
+  print (length rs, all odd rs)
+
+  n <- fmap length $ forM [1 .. 10000 :: Int] $ \_ -> timeout 10000000 (return ())
+  print n
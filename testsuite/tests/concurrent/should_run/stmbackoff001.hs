@@ -0,0 +1,15 @@
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+
+-- Many threads incrementing one TVar, under --stm-contention=backoff
+
+main :: IO ()
+main = do
+  tv <- atomically (newTVar (0 :: Int))
+  done <- newEmptyMVar
+  forM_ [1 .. 8 :: Int] $ \_ -> forkIO $ do
+    replicateM_ 10000 $ atomically $ readTVar tv >>= writeTVar tv . (+ 1)
+    putMVar done ()
+  replicateM_ 8 (takeMVar done)
+  atomically (readTVar tv) >>= print
@@ -0,0 +1,30 @@
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+
+-- Read-only transactions over many TVars, while other threads move
+-- values between them: every read-only transaction must see a
+-- consistent total, whether it commits through the version clock or
+-- through full validation.
+
+main :: IO ()
+main = do
+  tvs <- mapM (atomically . newTVar) (replicate 100 (10 :: Int))
+  done <- newEmptyMVar
+  forM_ [0 .. 3] $ \w -> forkIO $ do
+    forM_ [1 .. 20000 :: Int] $ \i -> atomically $ do
+      let a = tvs !! ((i * 7 + w) `mod` 100)
+          b = tvs !! ((i * 13 + w * 3) `mod` 100)
+      x <- readTVar a
+      writeTVar a (x - 1)
+      y <- readTVar b
+      writeTVar b (y + 1)
+    putMVar done ()
+  bad <- newMVar (0 :: Int)
+  forM_ [1 .. 2000 :: Int] $ \_ -> do
+    s <- atomically $ fmap sum (mapM readTVar tvs)
+    when (s /= 1000) $ modifyMVar_ bad (return . (+1))
+  replicateM_ 4 (takeMVar done)
+  total <- atomically $ fmap sum (mapM readTVar tvs)
+  print total
+  readMVar bad >>= print
@@ -0,0 +1,23 @@
+import Control.Monad
+import GHC.Conc
+
+-- Transactions reading and writing thousands of TVars, so that their
+-- TRecs are indexed, across orElse and across GCs.
+
+main :: IO ()
+main = do
+  tvs <- atomically $ mapM newTVar [1 .. 5000 :: Int]
+  atomically $ do
+    forM_ tvs $ \tv -> readTVar tv >>= writeTVar tv . (* 2)
+    (do forM_ tvs $ \tv -> readTVar tv >>= writeTVar tv . (+ 1)
+        s <- fmap sum (mapM readTVar tvs)
+        when (s > 0) retry)
+      `orElse` return ()
+    forM_ (reverse tvs) $ \tv -> readTVar tv >>= writeTVar tv . (+ 1)
+  atomically (fmap sum (mapM readTVar tvs)) >>= print
+  n <- atomically $ (readTVar (last tvs) >>= \x -> check (x < 0) >> return 0)
+                    `orElse` fmap length (mapM readTVar tvs)
+  print n
+
+check :: Bool -> STM ()
+check b = if b then return () else retry
@@ -0,0 +1,43 @@
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+
+-- Many consumers blocked on a work queue whose TVar wakes only one
+-- waiter per update: every item must still be taken, and every
+-- consumer must see its stop item.
+
+consumers :: Int
+consumers = 50
+
+main :: IO ()
+main = do
+  queue <- newTVarIO []
+  setTVarWakeupLimit queue 1
+  results <- newTVarIO (0 :: Int, 0 :: Int)
+  done <- newEmptyMVar
+  forM_ [1 .. consumers] $ \_ -> forkIO $ do
+    let loop = do
+          item <- atomically $ do
+            xs <- readTVar queue
+            case xs of
+              []     -> retry
+              (x:rest) -> do writeTVar queue rest; return x
+          if item < 0
+            then putMVar done ()
+            else do
+              atomically $ do
+                (n, s) <- readTVar results
+                writeTVar results (n + 1, s + item)
+              loop
+    loop
+  forM_ [1 .. 2000 :: Int] $ \i -> do
+    atomically $ do
+      xs <- readTVar queue
+      writeTVar queue (xs ++ [i])
+    when (i `mod` 100 == 0) yield
+  forM_ [1 .. consumers] $ \_ ->
+    atomically $ do
+      xs <- readTVar queue
+      writeTVar queue (xs ++ [-1])
+  replicateM_ consumers (takeMVar done)
+  readTVarIO results >>= print
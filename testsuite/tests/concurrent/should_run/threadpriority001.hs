@@ -0,0 +1,28 @@
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+
+-- Thread priorities: values out of range are clamped, and a thread
+-- that is already runnable moves ahead of the threads of a lower
+-- priority when it is given a higher one.
+
+main :: IO ()
+main = do
+  me <- myThreadId
+  threadPriority me >>= print
+  setThreadPriority me 7
+  threadPriority me >>= print
+  setThreadPriority me (-1)
+  threadPriority me >>= print
+
+  -- keep the main thread ahead of the others until it blocks
+  setThreadPriority me 3
+  order <- newMVar []
+  done <- newEmptyMVar
+  ts <- forM [1 .. 3 :: Int] $ \i -> forkIO $ do
+    modifyMVar_ order (return . (i :))
+    putMVar done ()
+  setThreadPriority (ts !! 2) 1
+  threadPriority (ts !! 2) >>= print
+  replicateM_ 3 (takeMVar done)
+  readMVar order >>= print . reverse
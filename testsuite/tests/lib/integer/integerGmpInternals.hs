@@ -81,10 +81,14 @@ main = do
     print $ powModInteger b e m
     print $ powModInteger b e (m-1)
     print $ powModSecInteger b e (m-1)
+    print $ I.powModIntegerCtx b e (I.powModContextInteger m)
+    print $ I.powModIntegerCtx b e (I.powModContextInteger (m-1))
+    print $ I.powModIntegerCtx (-b) e (I.powModContextInteger (m-1))
     print $ gcdExtInteger b e
     print $ gcdExtInteger e b
     print $ gcdExtInteger x y
     print $ gcdExtInteger y x
+    print $ gcdExtInteger 3 (2^(200::Int)+1)
     print $ powInteger 12345 0
     print $ powInteger 12345 1
     print $ powInteger 12345 30
@@ -0,0 +1,18 @@
+-- The cost of calling a trivial C function, with an unsafe call and
+-- with a safe one (which releases and reacquires the Capability).
+import Foreign.C.Types
+import RtsBench
+
+foreign import ccall unsafe "stdlib.h abs" unsafeAbs :: CInt -> IO CInt
+foreign import ccall safe   "stdlib.h abs" safeAbs   :: CInt -> IO CInt
+
+loop :: (CInt -> IO CInt) -> Int -> IO ()
+loop f = go
+  where go 0 = return ()
+        go i = f (fromIntegral i) >> go (i - 1)
+
+main :: IO ()
+main = do
+    n <- getIterations 1000000
+    benchmark "ffi-unsafe" n $ loop unsafeAbs n
+    benchmark "ffi-safe" n $ loop safeAbs n
@@ -0,0 +1,13 @@
+-- The cost of forkIO: creating a thread (createThread()), scheduling it
+-- and letting it finish.
+import Control.Concurrent
+import Control.Monad
+import RtsBench
+
+main :: IO ()
+main = do
+    n <- getIterations 100000
+    done <- newEmptyMVar
+    benchmark "forkIO" n $ do
+        replicateM_ n $ forkIO $ putMVar done ()
+        replicateM_ n $ takeMVar done
@@ -0,0 +1,22 @@
+-- How long a major GC takes as the amount of live data grows: keep a
+-- list of about the given number of megabytes alive and time repeated
+-- performMajorGC calls.
+import Control.Exception
+import Control.Monad
+import System.Mem
+import RtsBench
+
+-- a cons cell and a boxed Int take 5 words
+liveList :: Int -> [Int]
+liveList mb = [1 .. mb * 1024 * 1024 `div` (5 * 8)]
+
+main :: IO ()
+main = do
+    n <- getIterations 10
+    forM_ [1, 8, 32] $ \mb -> do
+        let xs = liveList mb
+        _ <- evaluate (length xs)
+        benchmark ("gc-major-" ++ show mb ++ "mb") n $
+            replicateM_ n performMajorGC
+        _ <- evaluate (sum xs)
+        return ()
@@ -0,0 +1,25 @@
+-- Two threads passing a token back and forth through a pair of MVars,
+-- first on the same Capability and then on different ones, which
+-- measures the cost of waking a thread on another Capability.
+import Control.Concurrent
+import Control.Monad
+import RtsBench
+
+pingPong :: String -> Int -> Int -> IO ()
+pingPong name other n = do
+    ping <- newEmptyMVar
+    pong <- newEmptyMVar
+    done <- newEmptyMVar
+    benchmark name n $ do
+        _ <- forkOn other $ replicateM_ n $ takeMVar ping >>= putMVar pong
+        _ <- forkOn 0 $ do
+            replicateM_ n $ putMVar ping () >> takeMVar pong
+            putMVar done ()
+        takeMVar done
+
+main :: IO ()
+main = do
+    n <- getIterations 100000
+    pingPong "mvar-pingpong-local" 0 n
+    caps <- getNumCapabilities
+    when (caps > 1) $ pingPong "mvar-pingpong-remote" 1 n
@@ -0,0 +1,22 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+-- Throughput of allocatePinned(), for several sizes of pinned byte
+-- array.  The largest is big enough to be a large object.
+import Control.Monad
+import GHC.Exts
+import GHC.IO
+import RtsBench
+
+allocPinned :: Int -> IO ()
+allocPinned (I# sz) = IO $ \s ->
+    case newPinnedByteArray# sz s of (# s', _ #) -> (# s', () #)
+
+loop :: Int -> Int -> IO ()
+loop size = go
+  where go 0 = return ()
+        go i = allocPinned size >> go (i - 1)
+
+main :: IO ()
+main = do
+    n <- getIterations 1000000
+    forM_ [16, 128, 1024, 8192] $ \size ->
+        benchmark ("allocatePinned-" ++ show size) n $ loop size n
@@ -0,0 +1,39 @@
+-- Support for the RTS microbenchmarks in this directory.  Each
+-- measurement is timed with the RTS's monotonic clock and printed on
+-- one line, in the same format as +RTS -t --machine-readable, so that
+-- the results can be read back with @read :: String -> [(String,String)]@.
+module RtsBench (getIterations, benchmark) where
+
+import Control.Concurrent
+import Data.Word
+import System.Environment
+import System.IO
+
+foreign import ccall unsafe "getMonotonicNSec"
+    getMonotonicNSec :: IO Word64
+
+-- | The number of iterations to run: the first command-line argument,
+-- or the given default.
+getIterations :: Int -> IO Int
+getIterations def = do
+    args <- getArgs
+    case args of
+      (n:_) -> return (read n)
+      []    -> return def
+
+-- | @benchmark name ops act@ runs @act@, which performs @ops@ of the
+-- operations being measured, and prints how long it took.
+benchmark :: String -> Int -> IO () -> IO ()
+benchmark name ops act = do
+    caps <- getNumCapabilities
+    start <- getMonotonicNSec
+    act
+    end <- getMonotonicNSec
+    let total = end - start
+        per_op = fromIntegral total / fromIntegral (max 1 ops) :: Double
+    print [("benchmark",    name),
+           ("capabilities", show caps),
+           ("operations",   show ops),
+           ("total_ns",     show total),
+           ("ns_per_op",    show per_op)]
+    hFlush stdout
@@ -0,0 +1,29 @@
+-- STM transactions that increment a TVar, run on every Capability at
+-- once: first with a TVar each, then all on the same TVar, so that the
+-- second measures commit under contention (and the retries it causes).
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+import RtsBench
+
+increment :: TVar Int -> IO ()
+increment tv = atomically $ readTVar tv >>= \x -> writeTVar tv $! x + 1
+
+run :: String -> Bool -> Int -> IO ()
+run name shared n = do
+    caps <- getNumCapabilities
+    tvs <- if shared
+              then fmap (replicate caps) (newTVarIO 0)
+              else replicateM caps (newTVarIO 0)
+    done <- newEmptyMVar
+    let per_cap = n `div` caps
+    benchmark name (per_cap * caps) $ do
+        forM_ (zip [0..] tvs) $ \(i,tv) ->
+            forkOn i $ replicateM_ per_cap (increment tv) >> putMVar done ()
+        replicateM_ caps $ takeMVar done
+
+main :: IO ()
+main = do
+    n <- getIterations 1000000
+    run "stm-private" False n
+    run "stm-shared" True n
@@ -0,0 +1,21 @@
+-- Sparking many small computations, which idle Capabilities steal from
+-- the spark pool; with -N1 they all fizzle, which measures the cost of
+-- creating them.
+import Control.Exception
+import GHC.Conc
+import RtsBench
+
+fib :: Int -> Int
+fib n = if n < 2 then n else fib (n - 1) + fib (n - 2)
+
+sparkAll :: [Int] -> ()
+sparkAll []     = ()
+sparkAll (x:xs) = x `par` sparkAll xs
+
+main :: IO ()
+main = do
+    n <- getIterations 100000
+    let xs = [ fib (12 + i `mod` 4) | i <- [1..n] ]
+    benchmark "spark" n $ do
+        _ <- evaluate (sparkAll xs `pseq` sum xs)
+        return ()
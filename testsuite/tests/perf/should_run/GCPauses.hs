@@ -0,0 +1,31 @@
+{-# LANGUAGE BangPatterns #-}
+-- A program with a steady amount of live data, like a server keeping a
+-- window of recent messages, so that its GC pause times and the memory
+-- its heap takes are predictable.
+
+data Queue = Queue [[Int]] [[Int]]
+
+push :: [Int] -> Queue -> Queue
+push x (Queue f b) = Queue f (x:b)
+
+pop :: Queue -> ([Int], Queue)
+pop (Queue (x:f) b) = (x, Queue f b)
+pop (Queue [] b)    = pop (Queue (reverse b) [])
+
+window, messages :: Int
+window   = 1000
+messages = 100000
+
+message :: Int -> [Int]
+message n = [n .. n + 99]
+
+loop :: Int -> Queue -> Int -> Int
+loop !i q !acc
+  | i == messages = acc
+  | otherwise =
+      let m = message i
+          (old, q') = pop q
+      in sum m `seq` loop (i + 1) (push m q') (acc + head old)
+
+main :: IO ()
+main = print (loop 0 (Queue (map message [-window .. -1]) []) 0)
@@ -0,0 +1,50 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+module Main where
+
+-- Grow a large MutableByteArray# by doubling, as a growable buffer
+-- does, and check that the contents survive whether the RTS grows it
+-- in place or copies it.
+
+import GHC.Exts
+import GHC.IO
+import System.Mem (performGC)
+import Control.Monad
+import Foreign.Storable (sizeOf)
+
+data MBA = MBA (MutableByteArray# RealWorld)
+
+newMBA :: Int -> IO MBA
+newMBA (I# n) = IO $ \s -> case newByteArray# n s of
+  (# s', mba #) -> (# s', MBA mba #)
+
+resizeMBA :: MBA -> Int -> IO MBA
+resizeMBA (MBA mba) (I# n) = IO $ \s -> case resizeMutableByteArray# mba n s of
+  (# s', mba' #) -> (# s', MBA mba' #)
+
+writeWord :: MBA -> Int -> Int -> IO ()
+writeWord (MBA mba) (I# i) (I# x) = IO $ \s ->
+  case writeIntArray# mba i x s of s' -> (# s', () #)
+
+readWord :: MBA -> Int -> IO Int
+readWord (MBA mba) (I# i) = IO $ \s -> case readIntArray# mba i s of
+  (# s', x #) -> (# s', I# x #)
+
+wordSize :: Int
+wordSize = sizeOf (0 :: Int)
+
+main :: IO ()
+main = do
+  let go :: MBA -> Int -> Int -> IO MBA
+      go mba filled size
+        | size > 16 * 1024 * 1024 = return mba
+        | otherwise = do
+            forM_ [filled .. size `div` wordSize - 1] $ \i -> writeWord mba i i
+            when (size == 1024 * 1024) performGC
+            mba' <- resizeMBA mba (size * 2)
+            go mba' (size `div` wordSize) (size * 2)
+  mba <- newMBA 16384
+  final <- go mba 0 16384
+  bad <- foldM (\n i -> do x <- readWord final i
+                           return (if x == i then n else n + 1))
+               (0 :: Int) [0 .. 16 * 1024 * 1024 `div` wordSize - 1]
+  print bad
@@ -0,0 +1,98 @@
+{-# LANGUAGE MagicHash, UnboxedTuples, GHCForeignImportPrim, UnliftedFFITypes,
+             BangPatterns #-}
+-- Compact regions: copy a structure into a region, check that it
+-- survives GC, and read a copy of the region back in from its blocks.
+module Main where
+
+import Control.Monad
+import Foreign.Marshal.Utils (copyBytes)
+import GHC.Exts
+import GHC.IO
+import GHC.Ptr
+import System.Mem
+
+foreign import prim "stg_compactNewzh"
+  compactNew# :: Word# -> State# RealWorld -> (# State# RealWorld, Any #)
+foreign import prim "stg_compactAddzh"
+  compactAdd# :: Any -> Any -> State# RealWorld
+              -> (# State# RealWorld, Int#, Any #)
+foreign import prim "stg_compactContainszh"
+  compactContains# :: Any -> Any -> State# RealWorld
+                   -> (# State# RealWorld, Int# #)
+foreign import prim "stg_compactGetFirstBlockzh"
+  compactGetFirstBlock# :: Any -> State# RealWorld
+                        -> (# State# RealWorld, Addr#, Word# #)
+foreign import prim "stg_compactGetNextBlockzh"
+  compactGetNextBlock# :: Any -> Addr# -> State# RealWorld
+                       -> (# State# RealWorld, Addr#, Word# #)
+foreign import prim "stg_compactAllocateBlockzh"
+  compactAllocateBlock# :: Word# -> Addr# -> State# RealWorld
+                        -> (# State# RealWorld, Addr# #)
+foreign import prim "stg_compactFixupPointerszh"
+  compactFixupPointers# :: Addr# -> Any -> State# RealWorld
+                        -> (# State# RealWorld, Int#, Any, Any #)
+
+compactNew :: Word -> IO Any
+compactNew (W# n) = IO $ \s -> case compactNew# n s of
+  (# s', c #) -> (# s', c #)
+
+compactAdd :: Any -> a -> IO (Maybe a)
+compactAdd c x = IO $ \s -> case compactAdd# c (unsafeCoerce# x) s of
+  (# s', 0#, _ #) -> (# s', Nothing #)
+  (# s', _, y #)  -> (# s', Just (unsafeCoerce# y) #)
+
+contains :: Any -> a -> IO Bool
+contains c x = IO $ \s -> case compactContains# c (unsafeCoerce# x) s of
+  (# s', r #) -> (# s', isTrue# r #)
+
+blocks :: Any -> IO [(Ptr (), Int)]
+blocks c = IO (\s -> case compactGetFirstBlock# c s of
+                       (# s', a, n #) -> (# s', (Ptr a, W# n) #)) >>= go
+  where
+    go (Ptr a, n)
+      | n == 0 = return []
+      | otherwise = do
+          next <- IO $ \s -> case compactGetNextBlock# c a s of
+                               (# s', b, m #) -> (# s', (Ptr b, W# m) #)
+          rest <- go next
+          return ((Ptr a, fromIntegral n) : rest)
+
+-- Copy the blocks of a region into new ones, as if reading it from a file
+readBack :: Any -> a -> IO (Maybe a)
+readBack c root = do
+  bs <- blocks c
+  new <- foldM copyBlock [] bs
+  let Ptr first = last new
+  IO $ \s -> case compactFixupPointers# first (unsafeCoerce# root) s of
+    (# s', 0#, _, _ #) -> (# s', Nothing #)
+    (# s', _, _, r #)  -> (# s', Just (unsafeCoerce# r) #)
+ where
+  copyBlock prev (p, n) = do
+    let !(Ptr a) = case prev of { [] -> nullPtr; (q:_) -> q }
+        !(W# n') = fromIntegral n
+    q <- IO $ \s -> case compactAllocateBlock# n' a s of
+                      (# s', b #) -> (# s', Ptr b #)
+    copyBytes q p n
+    return (q : prev)
+
+main :: IO ()
+main = do
+  let xs = [1 .. 100000] :: [Int]
+  print (sum xs)
+
+  c <- compactNew 4096
+  Just ys <- compactAdd c xs
+  performMajorGC
+  print (length ys, sum ys)
+  contains c ys >>= print
+  contains c xs >>= print
+
+  -- thunks can't go in a region
+  r <- compactAdd c (map (+1) xs)
+  putStrLn (maybe "thunk rejected" (const "thunk copied") r)
+
+  -- the copy is in a new region
+  Just zs <- readBack c ys
+  performMajorGC
+  print (length zs, sum zs)
+  contains c zs >>= print
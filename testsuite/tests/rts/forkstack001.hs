@@ -0,0 +1,22 @@
+import Control.Concurrent
+import Control.Monad
+import GHC.Conc
+
+-- Lots of short-lived threads, so that the stacks of finished threads
+-- are recycled for new ones.  A finished thread can still be looked
+-- at and killed.
+
+main :: IO ()
+main = do
+  done <- newEmptyMVar
+  tids <- forM [1..100000 :: Int] $ \i ->
+    forkIO $ putMVar done $! length (show i)
+  total <- fmap sum $ replicateM 100000 (takeMVar done)
+  print total
+  let t = last tids
+      wait = do
+        s <- threadStatus t
+        if s == ThreadFinished then print s else yield >> wait
+  wait
+  killThread t
+  threadStatus t >>= print
@@ -0,0 +1,19 @@
+import Control.Exception
+import Control.Monad
+import Debug.Trace
+import System.Environment
+import System.Mem
+
+-- With "save", writes table to the heap image once it is evaluated.
+-- A run that restores the image prints it without building it again.
+
+{-# NOINLINE table #-}
+table :: Int
+table = trace "building table" (sum [1 .. 1000000])
+
+main :: IO ()
+main = do
+  args <- getArgs
+  _ <- evaluate table
+  when (args == ["save"]) saveHeapImage
+  print table
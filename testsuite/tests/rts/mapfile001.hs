@@ -0,0 +1,41 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+
+-- mapFileByteArray#: the array holds the file, survives GC, and an
+-- empty file is refused
+
+import GHC.Exts
+import GHC.IO (IO(..))
+import GHC.IO.FD (FD(..), openFile)
+import qualified GHC.IO.Device as Device
+import System.IO (IOMode(..))
+import System.Mem (performGC)
+
+data BA = BA ByteArray#
+
+mapFile :: FilePath -> IO (Int, BA)
+mapFile path = do
+  (fd, _) <- openFile path ReadMode False
+  r <- IO $ \s ->
+         case fromIntegral (fdFD fd) of
+           I# fd# -> case mapFileByteArray# fd# s of
+                       (# s', r#, ba #) -> (# s', (I# r#, BA ba) #)
+  Device.close fd
+  return r
+
+contents :: BA -> String
+contents (BA ba) =
+  [ C# (indexCharArray# ba i) | I# i <- [0 .. I# (sizeofByteArray# ba) - 1] ]
+
+main :: IO ()
+main = do
+  let str = concat (replicate 20000 "mapped byte arrays\n")
+  writeFile "mapfile001.dat" str
+  (r, ba) <- mapFile "mapfile001.dat"
+  print r
+  performGC
+  print (contents ba == str)
+  performGC
+
+  writeFile "mapfile001.empty" ""
+  (r', ba') <- mapFile "mapfile001.empty"
+  print (r', length (contents ba'))
@@ -0,0 +1,35 @@
+-- Weak pointer processing with several GC threads: a chain of weak
+-- pointers, each keyed on the value of the one before, stays alive if
+-- the first key does (which takes one round per link to find out), and
+-- the finalizers of many dead weak pointers all run.
+
+import Control.Concurrent
+import Control.Monad
+import Data.IORef
+import Data.Maybe
+import Foreign.StablePtr
+import System.Mem
+import System.Mem.Weak
+
+chain :: Int -> IO (IORef Int, [Weak (IORef Int)])
+chain n = do
+  keys <- mapM newIORef [1..n]
+  ws <- zipWithM (\k v -> mkWeak k v Nothing) keys (tail keys)
+  return (head keys, ws)
+
+main :: IO ()
+main = do
+  count <- newIORef (0 :: Int)
+  (first, ws) <- chain 1000
+  root <- newStablePtr first
+  forM_ [1..100000 :: Int] $ \i -> do
+    r <- newIORef i
+    mkWeakIORef r (atomicModifyIORef' count (\n -> (n+1, ())))
+  performMajorGC
+  alive <- mapM deRefWeak ws
+  print (length (filter isJust alive))
+  freeStablePtr root
+  let wait = do
+        n <- readIORef count
+        if n < 100000 then threadDelay 1000 >> wait else print n
+  wait
@@ -0,0 +1,17 @@
+-- The fragmentation of small pinned objects is reported by getGCStats
+import Control.Monad
+import Foreign
+import GHC.Stats
+import System.Mem
+
+main :: IO ()
+main = do
+  ptrs <- forM [1 .. 20000 :: Int] $ \_ -> mallocForeignPtrBytes 100
+  -- keep one object in ten alive
+  let kept = [ p | (i, p) <- zip [0 :: Int ..] ptrs, i `mod` 10 == 0 ]
+  length kept `seq` performGC
+  s <- getGCStats
+  print (pinnedBytes s > 0)
+  print (pinnedLiveBytes s > 0)
+  print (pinnedLiveBytes s < pinnedBytes s `div` 4)
+  mapM_ (\p -> withForeignPtr p $ \q -> poke (q :: Ptr Word8) 0) kept
@@ -0,0 +1,15 @@
+import Control.Concurrent
+import Control.Monad
+import System.Mem
+
+-- The handler registered with addMemoryPressureHandler must run after a
+-- major GC that leaves more live data than --soft-heap-limit.
+main :: IO ()
+main = do
+  m <- newEmptyMVar
+  addMemoryPressureHandler (void (tryPutMVar m ()))
+  let xs = [1 .. 200000] :: [Int]
+  print (sum xs)
+  performMajorGC
+  takeMVar m
+  print (length xs)
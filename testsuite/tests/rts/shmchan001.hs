@@ -0,0 +1,60 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+
+-- shared-memory channels: messages arrive in order and intact, a full
+-- channel refuses more, the buffers come back when the GC frees the
+-- messages, and the channel's fd wakes a receiver that found it empty
+
+import Control.Concurrent (threadWaitRead)
+import Foreign
+import Foreign.C
+import GHC.Exts
+import GHC.IO (IO(..))
+import System.Mem (performGC)
+import System.Posix.Types (Fd(..))
+
+foreign import ccall unsafe "rts_openShmChannel"
+  openShmChannel :: CString -> Word -> Word -> IO (Ptr ())
+foreign import ccall unsafe "rts_closeShmChannel"
+  closeShmChannel :: Ptr () -> IO ()
+foreign import ccall unsafe "rts_shmChannelFd"
+  shmChannelFd :: Ptr () -> IO CInt
+foreign import ccall unsafe "rts_sendShmChannel"
+  sendShmChannel :: Ptr () -> Ptr Word8 -> Word -> IO CInt
+
+send :: Ptr () -> String -> IO CInt
+send chan str =
+  withCStringLen str $ \(p, n) -> sendShmChannel chan (castPtr p) (fromIntegral n)
+
+-- returns the contents, so the array itself is dead afterwards
+receive :: Ptr () -> IO (Int, String)
+receive (Ptr chan) = do
+  (r, s) <- IO $ \st ->
+              case receiveShmChannel# chan st of
+                (# st', r#, ba #) ->
+                  (# st', (I# r#, [ C# (indexCharArray# ba i)
+                                  | I# i <- [0 .. I# (sizeofByteArray# ba) - 1] ]) #)
+  length s `seq` return (r, s)
+
+main :: IO ()
+main = do
+  tx <- withCString "shmchan001.chan" $ \p -> openShmChannel p 2 100000
+  rx <- withCString "shmchan001.chan" $ \p -> openShmChannel p 0 0
+
+  let big = concat (replicate 5000 "shared memory\n")
+  rs <- mapM (send tx) [big, "hello", "full"]
+  print rs
+
+  (r1, m1) <- receive rx
+  (r2, m2) <- receive rx
+  print (r1, m1 == big, r2, m2)
+  (r3, m3) <- receive rx
+  print (r3, m3)
+
+  performGC
+  send tx "again" >>= print
+  fd <- shmChannelFd rx
+  threadWaitRead (Fd fd)
+  receive rx >>= print
+
+  closeShmChannel rx
+  closeShmChannel tx
@@ -0,0 +1,22 @@
+import Control.Concurrent
+import Control.Monad
+
+-- Many threads each recursing up and down across stack chunk
+-- boundaries, so that stack chunks are reused, by the same thread and
+-- by others.
+
+depth :: Int -> Int
+depth 0 = 0
+depth n = 1 + depth (n - 1)
+
+main :: IO ()
+main = do
+  results <- forM [1..20] $ \i -> do
+    m <- newEmptyMVar
+    _ <- forkIO $ do
+      let loop :: Int -> Int -> Int
+          loop 0 acc = acc
+          loop k acc = loop (k - 1) $! acc + depth (1000 + k + i)
+      putMVar m $! loop 200 0
+    return m
+  mapM takeMVar results >>= print . sum
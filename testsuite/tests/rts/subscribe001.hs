@@ -0,0 +1,24 @@
+{-# LANGUAGE ForeignFunctionInterface #-}
+
+-- rts_subscribeEventLog(): the subscriber gets the header first, then
+-- blocks of events as the program runs
+
+module Main where
+
+import Control.Monad
+import System.Mem
+
+foreign import ccall "subscribe" subscribe :: IO Int
+foreign import ccall "header_ok" headerOk :: IO Int
+foreign import ccall "blocks_seen" blocksSeen :: IO Int
+
+main :: IO ()
+main = do
+  subscribe >>= print
+  subscribe >>= print   -- there is a subscriber already
+  forM_ [1..20::Int] $ \i -> do
+    print (sum [1..i * 1000])
+    performGC
+  headerOk >>= print
+  n <- blocksSeen
+  print (n > 0)
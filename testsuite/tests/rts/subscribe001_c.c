@@ -0,0 +1,33 @@
+#include "Rts.h"
+#include <string.h>
+
+static int n_calls = 0;
+static int got_header = 0;
+static int n_blocks = 0;
+
+static void
+receive (void *user, const StgWord8 *buf, StgWord size)
+{
+    // the header starts with EVENT_HEADER_BEGIN, "hdrb"
+    if (n_calls++ == 0) {
+        got_header = user == &n_calls && size > 4 &&
+                     memcmp(buf, "hdrb", 4) == 0;
+    } else if (size > 0) {
+        n_blocks++;
+    }
+}
+
+int subscribe (void)
+{
+    return rts_subscribeEventLog(receive, &n_calls);
+}
+
+int header_ok (void)
+{
+    return got_header;
+}
+
+int blocks_seen (void)
+{
+    return n_blocks;
+}
@@ -0,0 +1,9 @@
+-- Data that lives for a few GCs, with extra aging generations
+import qualified Data.Map as Map
+import Data.List (foldl')
+
+main :: IO ()
+main = do
+  let step m i = Map.insert (i `mod` 5000) i (Map.delete ((i + 7) `mod` 5000) m)
+      m = foldl' step Map.empty [1 .. 300000 :: Int]
+  print (Map.size m, Map.foldl' (+) 0 m)
@@ -0,0 +1,82 @@
+#define THREADED_RTS
+
+#include "Rts.h"
+#include "WSDeque.h"
+#include <stdio.h>
+
+// Like testwsdeque, but the thieves use stealManyWSDeque_(), so the
+// owner takes its own elements with stealWSDeque_() rather than
+// popWSDeque() (as findSpark() does with spark pools).
+
+#define SCRATCH_SIZE (1024*1024)
+#define THREADS 3
+#define TAKE 2
+#define BATCH 16
+
+WSDeque *q;
+
+StgWord scratch[SCRATCH_SIZE];
+StgWord done;
+
+OSThreadId ids[THREADS];
+
+void work(void *p, nat n)
+{
+    StgWord val;
+
+    val = *(StgWord *)p;
+    if (val != 0) {
+        fflush(stdout);
+        fflush(stderr);
+        barf("FAIL: %ld %d %d", p, n, val);
+    }
+    *(StgWord*)p = n+10;
+}
+
+void OSThreadProcAttr thief(void *info)
+{
+    void *elems[BATCH];
+    StgWord n, got, i;
+    nat count = 0;
+
+    n = (StgWord)info;
+
+    while (!done) {
+        got = stealManyWSDeque_(q, elems, BATCH);
+        for (i = 0; i < got; i++) {
+            work(elems[i],n+1); count++;
+        }
+    }
+    debugBelch("thread %ld finished, stole %d", n, count);
+}
+
+int main(int argc, char*argv[])
+{
+    int n;
+    nat count = 0;
+    void *p;
+
+    q = newWSDeque(1024);
+    done = 0;
+
+    for (n=0; n < SCRATCH_SIZE; n++) {
+        scratch[n] = 0;
+    }
+
+    for (n=0; n < THREADS; n++) {
+        createOSThread(&ids[n], "thief", thief, (void*)(StgWord)n);
+    }
+
+    for (n=0; n < SCRATCH_SIZE; n++) {
+        if (n % TAKE) {
+            p = stealWSDeque_(q);
+            if (p != NULL) { work(p,0); count++; }
+        }
+        pushWSDeque(q,&scratch[n]);
+    }
+
+#ifdef DEBUG
+    debugBelch("main thread finished, took %d", count);
+#endif
+    exit(0);
+}
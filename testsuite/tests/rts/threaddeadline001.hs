@@ -0,0 +1,37 @@
+{-# LANGUAGE MagicHash #-}
+
+-- rts_setThreadDeadline raises the exception in a thread whose deadline
+-- passes, whether it is blocked or running, in all the ways, and
+-- rts_clearThreadDeadline stops it
+
+import Control.Concurrent
+import Control.Exception
+import Control.Monad (forever)
+import Foreign
+import GHC.Conc (ThreadId(..))
+import GHC.Exts
+
+foreign import ccall unsafe "rts_setThreadDeadline"
+  setThreadDeadline :: ThreadId# -> Int -> StablePtr SomeException
+                    -> IO (Ptr ())
+foreign import ccall unsafe "rts_clearThreadDeadline"
+  clearThreadDeadline :: Ptr () -> IO ()
+
+withDeadline :: Int -> IO a -> IO a
+withDeadline us act = do
+  ThreadId t <- myThreadId
+  mask $ \restore -> do
+    ex <- newStablePtr (toException (ErrorCall "deadline"))
+    d <- setThreadDeadline t us ex
+    restore act `finally` clearThreadDeadline d
+
+main :: IO ()
+main = do
+  m <- newEmptyMVar :: IO (MVar ())
+  r1 <- try (withDeadline 100000 (takeMVar m))
+  print (r1 :: Either ErrorCall ())
+  r2 <- try (withDeadline 100000 (forever (threadDelay 1000)))
+  print (r2 :: Either ErrorCall ())
+  r3 <- try (withDeadline 100000 (return ()))
+  threadDelay 300000
+  print (r3 :: Either ErrorCall ())
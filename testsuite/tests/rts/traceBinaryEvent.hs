@@ -0,0 +1,25 @@
+{-# LANGUAGE MagicHash, UnboxedTuples #-}
+
+import Debug.Trace
+import GHC.Exts
+import GHC.IO
+
+main :: IO ()
+main = do
+  registerBinaryEventType 1 "span"
+  IO $ \s -> case newByteArray# 64# s of
+    (# s1, mba #) -> case fill mba 0# s1 of
+      s2 -> case unsafeFreezeByteArray# mba s2 of
+        (# s3, ba #) -> (# loop ba 0# s3, () #)
+  where
+    -- byte i of the array is i
+    fill mba i s
+      | isTrue# (i ==# 64#) = s
+      | otherwise = case writeWord8Array# mba i (int2Word# i) s of
+                      s' -> fill mba (i +# 1#) s'
+
+    -- the array is not pinned, and events go in whichever buffer
+    loop ba i s
+      | isTrue# (i ==# 10000#) = s
+      | otherwise = case traceBinaryEvent# 1## ba 8# 48# s of
+                      s' -> loop ba (i +# 1#) s'
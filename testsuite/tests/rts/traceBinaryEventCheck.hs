@@ -0,0 +1,60 @@
+-- Reads the eventlog written by traceBinaryEvent, in the format described
+-- in includes/rts/EventLogFormat.h, and checks its binary user events.
+
+import Data.Bits
+import qualified Data.ByteString as B
+import System.Environment
+
+eventUserBinaryMsg, eventUserBinaryType :: Int
+eventUserBinaryMsg  = 161
+eventUserBinaryType = 162
+
+w16 :: B.ByteString -> Int -> Int
+w16 s i = fromIntegral (B.index s i) `shiftL` 8 .|. fromIntegral (B.index s (i+1))
+
+w32 :: B.ByteString -> Int -> Int
+w32 s i = w16 s i `shiftL` 16 .|. w16 s (i+2)
+
+slice :: B.ByteString -> Int -> Int -> B.ByteString
+slice s i n = B.take n (B.drop i s)
+
+-- The sizes of the event types, and where the events start
+header :: B.ByteString -> ([(Int,Int)], Int)
+header s = eventTypes 8 []  -- after "hdrb" "hetb"
+  where
+    eventTypes i acc
+      | w32 s i == 0x65746200 =  -- "etb\0"
+          let ty   = w16 s (i+4)
+              size = w16 s (i+6)
+              desc = w32 s (i+8)
+              info = w32 s (i+12+desc)
+          in eventTypes (i + 20 + desc + info) ((ty, size) : acc)
+      | w32 s (i+8) /= 0x64617462 = error "not an uncompacted eventlog"
+      | otherwise = (acc, i + 12)  -- after "hete" "hdre" "datb"
+
+-- Each event's type and payload
+events :: [(Int,Int)] -> B.ByteString -> Int -> [(Int, B.ByteString)]
+events sizes s i
+  | ty == 0xffff = []
+  | size == 0xffff = let n = w16 s (i+10)
+                     in (ty, slice s (i+12) n) : events sizes s (i+12+n)
+  | otherwise = (ty, slice s (i+10) size) : events sizes s (i+10+size)
+  where
+    ty = w16 s i
+    size = maybe (error ("unknown event type " ++ show ty)) id
+                 (lookup ty sizes)
+
+main :: IO ()
+main = do
+  [file] <- getArgs
+  s <- B.readFile file
+  let (sizes, start) = header s
+      evs = events sizes s start
+      msgs = [ p | (ty, p) <- evs, ty == eventUserBinaryMsg ]
+  sequence_ [ putStrLn ("binary event type " ++ show (w32 p 0) ++ ": "
+                        ++ map (toEnum . fromIntegral) (B.unpack (B.drop 4 p)))
+            | (ty, p) <- evs, ty == eventUserBinaryType ]
+  putStrLn (show (length [ () | p <- msgs, w32 p 0 == 1 ])
+            ++ " binary events of type 1")
+  putStrLn (if all (\p -> B.drop 4 p == B.pack [8..55]) msgs
+               then "payloads ok" else "bad payload")
@@ -365,6 +365,8 @@ wanteds = concat
           ,structField C    "Capability" "interrupt"
           ,structField C    "Capability" "sparks"
           ,structField C    "Capability" "total_allocated"
+          ,structField C    "Capability" "alloc_sample_next"
+          ,structField C    "Capability" "pretenure_gen"
           ,structField C    "Capability" "weak_ptr_list_hd"
           ,structField C    "Capability" "weak_ptr_list_tl"
 
@@ -372,6 +374,7 @@ wanteds = concat
           ,structField Both "bdescr" "free"
           ,structField Both "bdescr" "blocks"
           ,structField C    "bdescr" "gen_no"
+          ,structField C    "bdescr" "dest_no"
           ,structField C    "bdescr" "link"
 
           ,structSize C  "generation"
@@ -427,6 +430,7 @@ wanteds = concat
           ,closureField  C    "StgTSO"      "saved_errno"
           ,closureField  C    "StgTSO"      "trec"
           ,closureField  C    "StgTSO"      "flags"
+          ,closureField  C    "StgTSO"      "acct_group"
           ,closureField  C    "StgTSO"      "dirty"
           ,closureField  C    "StgTSO"      "bq"
           ,closureField  Both "StgTSO"      "alloc_limit"
@@ -497,7 +501,8 @@ wanteds = concat
           ,closureSize  C "StgTVar"
           ,closureField C "StgTVar" "current_value"
           ,closureField C "StgTVar" "first_watch_queue_entry"
-          ,closureField C "StgTVar" "num_updates"
+          ,closureField C "StgTVar" "version"
+          ,closureField C "StgTVar" "wakeup_limit"
 
           ,closureSize  C "StgWeak"
           ,closureField C "StgWeak" "link"
@@ -582,7 +587,7 @@ wanteds = concat
            -- Note that this conditional part only affects the C headers.
            -- That's important, as it means we get the same PlatformConstants
            -- type on all platforms.
-          ,if os == "mingw32"
+          ,if os == "mingw32" || os == "linux"
            then concat [structSize  C "StgAsyncIOResult"
                        ,structField C "StgAsyncIOResult" "reqID"
                        ,structField C "StgAsyncIOResult" "len"
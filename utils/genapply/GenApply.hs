@@ -939,6 +939,12 @@ main = do
   putStr (render the_code)
 
 -- These have been shown to cover about 99% of cases in practice...
+-- The 7- and 8-pointer cases are for combinator-heavy code, where an
+-- unknown function of that arity would otherwise be applied in two
+-- steps, building a PAP in between.
+--
+--  NOTE: other places to change if you change applyTypes: see the
+--  comment above slowCallPattern in compiler/codeGen/StgCmmArgRep.hs
 applyTypes = [
         [V],
         [F],
@@ -956,7 +962,9 @@ applyTypes = [
         [P,P,P,V],
         [P,P,P,P],
         [P,P,P,P,P],
-        [P,P,P,P,P,P]
+        [P,P,P,P,P,P],
+        [P,P,P,P,P,P,P],
+        [P,P,P,P,P,P,P,P]
    ]
 
 -- No need for V args in the stack apply cases.
@@ -40,7 +40,7 @@ void
 Usage(const char *str)
 {
    if (str) printf("error: %s\n", str);
-   printf("usage: %s -b -d -ef -g -i -p -mn -p -s -tf -y [file[.hp]]\n", programname);
+   printf("usage: %s -b -d -ef -g -i -p -mn -nn -p -r -s -tf -y [file[.hp]]\n", programname);
    printf("where -b  use large title box\n");
    printf("      -d  sort by standard deviation\n"); 
    printf("      -ef[in|mm|pt] produce Encapsulated PostScript f units wide (f > 2 inches)\n");
@@ -49,7 +49,9 @@ Usage(const char *str)
    printf("      -M  multi-page output (key separate from graph)\n");
    printf("      -mn print maximum of n bands (default & max 20)\n");
    printf("          -m0 removes the band limit altogether\n");
+   printf("      -nn keep at most n samples, averaging neighbouring ones\n");
    printf("      -p  use previous scaling, shading and ordering\n");
+   printf("      -r  read file twice, keeping only the samples of the bands shown\n");
    printf("      -s  use small title box\n");
    printf("      -tf ignore trace bands which sum below f%% (default 1%%, max 5%%)\n");
    printf("      -y  traditional\n");
@@ -7,6 +7,7 @@
 #include "Error.h"
 #include "HpFile.h"
 #include "Utilities.h"
+#include "rts/prof/HeapProfileFormat.h"
 
 #ifndef atof
 double atof PROTO((const char *));
@@ -34,11 +35,22 @@ static boolish insample = 0;			/* true when in sample  */
 
 static floatish lastsample;			/* the last sample time */
 
+static intish nmarkmax = 0, nsamplemax = 0;
+
+static void ReadHpFile PROTO((FILE *));		/* forward */
 static void GetHpLine PROTO((FILE *));		/* forward */
 static void GetHpTok  PROTO((FILE *));		/* forward */
+static void GetHpBinFile PROTO((FILE *));	/* forward */
 
 static struct entry *GetEntry PROTO((char *));	/* forward */
 
+static void AddMark      PROTO((floatish));	/* forward */
+static void BeginSample  PROTO((floatish));	/* forward */
+static void SampleValue  PROTO((struct entry *, floatish)); /* forward */
+static void EndSample    PROTO((void));		/* forward */
+static void FinishSamples PROTO((void));	/* forward */
+static void ChooseBands  PROTO((void));		/* forward */
+
 static void MakeIdentTable PROTO((void));	/* forward */
 
 char *jobstring;
@@ -63,26 +75,40 @@ floatish *markmap;		/* sample marks		*/
  *	identifier i	   -- there are i identifiers in this sample 
  *	END_SAMPLE i   	   -- end of ith sample 
  *
+ *	or, written by +RTS --binary-heap-profile, in the binary format of
+ *	rts/prof/HeapProfileFormat.h, which starts with a byte that can't
+ *	start a line of the above.
+ *
+ *	With -r the input is read twice.  The first pass only adds up the
+ *	values of each identifier, and ChooseBands() uses the totals to
+ *	pick the bands that TraceElement() and TopTwenty() would keep.
+ *	The second pass then stores the samples of those bands only, and
+ *	adds the others into the "OTHER" band as it goes, so together
+ *	with -n the memory needed no longer grows with the length of the
+ *	profile or with the number of identifiers in it.
  */
 
+static boolish firstpass = 0;			/* true in -r's 1st pass */
+
 void
 GetHpFile(FILE *infp)
 {
-    nsamples = 0;
-    nmarks   = 0;
     nidents  = 0;
 
-    ch = ' ';
-    endfile = 0;
-    linenum = 1;
-    lastsample = 0.0;
+    if (rflag) {
+	firstpass = 1;
+	ReadHpFile(infp);
+	firstpass = 0;
 
-    GetHpTok(infp);
+	ChooseBands();
 
-    while (endfile == 0) {
-	GetHpLine(infp);
+	if (fseek(infp, 0L, SEEK_SET) != 0) {
+	    Error("%s: -r needs a file that can be read twice", hpfile);
+	}
     }
 
+    ReadHpFile(infp);
+
     if (!gotjob) {
 	Error("%s: JOB missing", hpfile);
     }
@@ -110,6 +136,33 @@ GetHpFile(FILE *infp)
 }
 
 
+static void
+ReadHpFile(FILE *infp)
+{
+    nsamples = 0;
+    nmarks   = 0;
+
+    endfile = 0;
+    linenum = 1;
+    lastsample = 0.0;
+    insample = 0;
+
+    ch = getc(infp);
+
+    if (ch == (unsigned char) HP_BIN_MAGIC[0]) {
+	GetHpBinFile(infp);
+    } else {
+	GetHpTok(infp);
+
+	while (endfile == 0) {
+	    GetHpLine(infp);
+	}
+    }
+
+    FinishSamples();
+}
+
+
 /*
  *      Read the next line from the input, check the syntax, and perform
  *	the appropriate action.
@@ -118,8 +171,6 @@ GetHpFile(FILE *infp)
 static void
 GetHpLine(FILE *infp)
 {
-    static intish nmarkmax = 0, nsamplemax = 0;
-
     switch (thetok) {
     case JOB_TOK:
 	GetHpTok(infp);
@@ -172,16 +223,7 @@ GetHpLine(FILE *infp)
 	if (insample) {
 	    Error("%s, line %d, MARK occurs within sample", hpfile, linenum);
 	}
-	if (nmarks >= nmarkmax) {
-	    if (!markmap) {
-		nmarkmax = N_MARKS;
-		markmap = (floatish*) xmalloc(nmarkmax * sizeof(floatish));
-	    } else {
-		nmarkmax *= 2;
-		markmap = (floatish*) xrealloc(markmap, nmarkmax * sizeof(floatish));
-	    }
-	}
-	markmap[ nmarks++ ] = thefloatish; 
+	AddMark(thefloatish);
         GetHpTok(infp);
         break;
 
@@ -196,17 +238,7 @@ GetHpLine(FILE *infp)
 	} else {
 	    lastsample = thefloatish;
         }
-	if (nsamples >= nsamplemax) {
-	    if (!samplemap) {
-		nsamplemax = N_SAMPLES;
-		samplemap = (floatish*) xmalloc(nsamplemax * sizeof(floatish));
-	    } else {
-		nsamplemax *= 2;
-		samplemap = (floatish*) xrealloc(samplemap, 
-	                                      nsamplemax * sizeof(floatish));
-	    }
-	}
-	samplemap[ nsamples ] = thefloatish;
+	BeginSample(thefloatish);
 	GetHpTok(infp);
 	break;
 
@@ -217,7 +249,7 @@ GetHpLine(FILE *infp)
 	    Error("%s, line %d: floating point number must follow END_SAMPLE", 
                   hpfile, linenum);
 	}
-        nsamples++;
+	EndSample();
 	GetHpTok(infp);
 	break;
 
@@ -227,7 +259,7 @@ GetHpLine(FILE *infp)
 	    Error("%s, line %d: integer must follow identifier", hpfile, 
                   linenum);
 	}
-        StoreSample(GetEntry(theident), nsamples, thefloatish);
+	SampleValue(GetEntry(theident), thefloatish);
 	GetHpTok(infp); 
         break;
 
@@ -500,7 +532,10 @@ MakeEntry(char *name)
 
     e = (struct entry *) xmalloc(sizeof(struct entry));
     e->chk = MakeChunk();
+    e->last = e->chk;
     e->name = copystring(name); 
+    e->total = 0.0;
+    e->band = e;
     return e;
 }
 
@@ -530,6 +565,10 @@ GetEntry(char *name)
         e = MakeEntry(name);
         e->next = hashtable[ h ];
         hashtable[ h ] = e;
+	if (rflag && !firstpass) {
+	    /* the file grew after the first pass */
+	    e->band = otherentry;
+	}
         return (e);
     }
 }
@@ -544,8 +583,7 @@ StoreSample(struct entry *en, intish bucket, floatish value)
 {
     struct chunk* chk; 
 
-    for (chk = en->chk; chk->next != 0; chk = chk->next)
-	; 
+    chk = en->last;
 
     if (chk->nd < N_CHUNK) {
 	chk->d[ chk->nd ].bucket = bucket;
@@ -557,7 +595,414 @@ StoreSample(struct entry *en, intish bucket, floatish value)
 	t->d[ 0 ].bucket = bucket;
 	t->d[ 0 ].value  = value;
 	t->nd += 1;
+	en->last = t;
+    }
+}
+
+
+static void
+AddMark(floatish mark)
+{
+    if (firstpass) {
+	return;
+    }
+
+    if (nmarks >= nmarkmax) {
+	if (!markmap) {
+	    nmarkmax = N_MARKS;
+	    markmap = (floatish*) xmalloc(nmarkmax * sizeof(floatish));
+	} else {
+	    nmarkmax *= 2;
+	    markmap = (floatish*) xrealloc(markmap, nmarkmax * sizeof(floatish));
+	}
+    }
+    markmap[ nmarks++ ] = mark;
+}
+
+
+/*
+ *	Samples are collected into buckets of "stride" samples each, whose
+ *	value is the average of theirs.  The stride is 1 unless -n was
+ *	given, in which case it doubles, and each pair of buckets is
+ *	merged into one, when the next sample would make more than
+ *	maxsamples buckets.  That keeps the memory needed for a long
+ *	profile in proportion to maxsamples rather than to its length.
+ *
+ *	The current bucket is number nsamples, and has "inbucket" samples
+ *	in it so far.
+ */
+
+static intish stride = 1;
+static intish inbucket = 0;
+
+/*
+ *	Merge each pair of buckets of an entry, in place.
+ */
+
+static void
+HalveEntry(struct entry *en)
+{
+    struct chunk *rd, *wr, *next;
+    intish bucket;
+    int i, w;
+
+    wr = en->chk;
+    w = 0;
+
+    for (rd = en->chk; rd; rd = rd->next) {
+	for (i = 0; i < rd->nd; i++) {
+	    bucket = rd->d[ i ].bucket / 2;
+	    if (w > 0 && wr->d[ w - 1 ].bucket == bucket) {
+		wr->d[ w - 1 ].value += rd->d[ i ].value / 2;
+	    } else {
+		if (w == N_CHUNK) {
+		    wr->nd = w;
+		    wr = wr->next;
+		    w = 0;
+		}
+		wr->d[ w ].bucket = bucket;
+		wr->d[ w ].value  = rd->d[ i ].value / 2;
+		w++;
+	    }
+	}
+    }
+    wr->nd = w;
+
+    for (rd = wr->next; rd; rd = next) {
+	next = rd->next;
+	free(rd->d);
+	free(rd);
+    }
+    wr->next = 0;
+    en->last = wr;
+}
+
+static void
+BeginSample(floatish time)
+{
+    intish i;
+    struct entry *e;
+
+    if (firstpass || inbucket > 0) {
+	return;		/* not the first sample of its bucket */
     }
+
+    if (maxsamples > 0 && nsamples == maxsamples) {
+	for (i = 0; i < N_HASH; i++) {
+	    for (e = hashtable[ i ]; e; e = e->next) {
+		HalveEntry(e);
+	    }
+	}
+	nsamples /= 2;
+	for (i = 0; i < nsamples; i++) {
+	    samplemap[ i ] = samplemap[ 2 * i ];
+	}
+	stride *= 2;
+    }
+
+    if (nsamples >= nsamplemax) {
+	if (!samplemap) {
+	    nsamplemax = N_SAMPLES;
+	    samplemap = (floatish*) xmalloc(nsamplemax * sizeof(floatish));
+	} else {
+	    nsamplemax *= 2;
+	    samplemap = (floatish*) xrealloc(samplemap, 
+	                                  nsamplemax * sizeof(floatish));
+	}
+    }
+    samplemap[ nsamples ] = time;
+}
+
+static void
+SampleValue(struct entry *en, floatish value)
+{
+    struct chunk *chk;
+
+    if (firstpass) {
+	en->total += value;
+	return;
+    }
+
+    en = en->band;
+    if (!en) {
+	return;		/* a trace element (-r) */
+    }
+
+    value /= stride;
+
+    chk = en->last;
+    if (chk->nd > 0 && chk->d[ chk->nd - 1 ].bucket == nsamples) {
+	chk->d[ chk->nd - 1 ].value += value;
+    } else {
+	StoreSample(en, nsamples, value);
+    }
+}
+
+static void
+EndSample(void)
+{
+    if (firstpass) {
+	return;
+    }
+
+    if (++inbucket == stride) {
+	nsamples++;
+	inbucket = 0;
+    }
+}
+
+/*
+ *	At the end of the input, turn the sum of the samples in the last
+ *	bucket, if it is not full, into their average.
+ */
+
+static void
+FinishSamples(void)
+{
+    intish i;
+    struct entry *e;
+    struct chunk *chk;
+    floatish scale;
+
+    if (inbucket == 0) {
+	return;
+    }
+
+    scale = (floatish) stride / (floatish) inbucket;
+    for (i = 0; i < N_HASH; i++) {
+	for (e = hashtable[ i ]; e; e = e->next) {
+	    chk = e->last;
+	    if (chk->nd > 0 && chk->d[ chk->nd - 1 ].bucket == nsamples) {
+		chk->d[ chk->nd - 1 ].value *= scale;
+	    }
+	}
+    }
+    nsamples++;
+    inbucket = 0;
+}
+
+
+/*
+ *	Choose the bands to keep from the totals of the first pass of -r,
+ *	in the same way as TraceElement() and TopTwenty() would: drop the
+ *	smallest identifiers that together make less than the threshold,
+ *	and if more than TWENTY are left, gather all but the biggest
+ *	TWENTY - 1 into "OTHER".
+ */
+
+struct entry* otherentry = 0;
+
+static int
+CompareTotals(const void *a, const void *b)
+{
+    floatish ta, tb;
+
+    ta = (*(struct entry * const *) a)->total;
+    tb = (*(struct entry * const *) b)->total;
+    return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+static void
+ChooseBands(void)
+{
+    struct entry **es;
+    struct entry *e, **ep;
+    intish n, i, compact;
+    floatish grandtotal, t;
+
+    n = 0;
+    es = (struct entry**) xmalloc((nidents + 1) * sizeof(struct entry*));
+    for (i = 0; i < N_HASH; i++) {
+	for (e = hashtable[ i ]; e; e = e->next) {
+	    es[ n++ ] = e;
+	}
+    }
+    qsort(es, n, sizeof(struct entry*), CompareTotals);
+
+    grandtotal = 0.0;
+    for (i = 0; i < n; i++) {
+	grandtotal += es[ i ]->total;
+    }
+
+    t = 0.0;	/* cumulative percentage */
+    for (i = 0; i < n; i++) {
+	t += (100.0 * es[ i ]->total) / grandtotal;
+	if (t >= THRESHOLD_PERCENT) {
+	    break;
+	}
+	es[ i ]->band = 0;
+    }
+
+    if (TWENTY != 0 && n - i > TWENTY) {
+	otherentry = MakeEntry("OTHER");
+	otherentry->next = 0;
+	compact = (n - i - TWENTY) + 1;
+	for (; compact > 0; compact--, i++) {
+	    es[ i ]->band = otherentry;
+	}
+
+	/* at the end of its chain, so that GetEntry() finds an
+	   identifier of the same name first */
+	for (ep = &hashtable[ Hash("OTHER") ]; *ep; ep = &(*ep)->next) {
+	}
+	*ep = otherentry;
+    }
+
+    free(es);
+}
+
+
+/*
+ *	Read a binary heap profile, whose first byte is in "ch". Each
+ *	sample only has the values that changed since the previous one,
+ *	so the current value of every identifier is kept in "values".
+ */
+
+static unsigned long long
+GetVarint(FILE *infp)
+{
+    unsigned long long n;
+    int shift, c;
+
+    n = 0;
+    shift = 0;
+    do {
+	c = getc(infp);
+	if (c == EOF || shift > 63) {
+	    Error("%s: truncated binary heap profile", hpfile);
+	}
+	n |= (unsigned long long) (c & 0x7f) << shift;
+	shift += 7;
+    } while (c & 0x80);
+
+    return n;
+}
+
+static long long
+GetSVarint(FILE *infp)
+{
+    unsigned long long n;
+
+    n = GetVarint(infp);
+    return (n & 1) ? ~(long long) (n >> 1) : (long long) (n >> 1);
+}
+
+static char *
+GetBinString(FILE *infp)
+{
+    unsigned long long len;
+    char *s;
+
+    len = GetVarint(infp);
+    s = xmalloc(len + 1);
+    if (fread(s, 1, len, infp) != len) {
+	Error("%s: truncated binary heap profile", hpfile);
+    }
+    s[ len ] = '\0';
+    return s;
+}
+
+static void
+GetHpBinFile(FILE *infp)
+{
+    char magic[ HP_BIN_MAGIC_LEN ];
+    struct entry **ids;
+    floatish *values;
+    intish nids, maxids, i;
+    unsigned long long id, n, j;
+    long long time;
+    char *name;
+    int tag;
+
+    magic[ 0 ] = ch;
+    if (fread(magic + 1, 1, HP_BIN_MAGIC_LEN - 1, infp) 
+            != HP_BIN_MAGIC_LEN - 1
+        || memcmp(magic, HP_BIN_MAGIC, HP_BIN_MAGIC_LEN) != 0) {
+	Error("%s: not a heap profile", hpfile);
+    }
+
+    ids = 0;
+    values = 0;
+    nids = 0;
+    maxids = 0;
+    time = 0;
+
+    while ((tag = getc(infp)) != EOF) {
+	switch (tag) {
+	case HP_BIN_JOB:
+	    jobstring = GetBinString(infp);
+	    gotjob = 1;
+	    break;
+
+	case HP_BIN_DATE:
+	    datestring = GetBinString(infp);
+	    gotdate = 1;
+	    break;
+
+	case HP_BIN_SAMPLE_UNIT:
+	    sampleunitstring = GetBinString(infp);
+	    gotsampleunit = 1;
+	    break;
+
+	case HP_BIN_VALUE_UNIT:
+	    valueunitstring = GetBinString(infp);
+	    gotvalueunit = 1;
+	    break;
+
+	case HP_BIN_IDENT:
+	    id = GetVarint(infp);
+	    if (id != (unsigned long long) nids) {
+		Error("%s: identifiers out of sequence", hpfile);
+	    }
+	    if (nids >= maxids) {
+		maxids = maxids ? maxids * 2 : N_SAMPLES;
+		ids = (struct entry**) xrealloc(ids,
+		                          maxids * sizeof(struct entry*));
+		values = (floatish*) xrealloc(values,
+		                          maxids * sizeof(floatish));
+	    }
+	    name = GetBinString(infp);
+	    ids[ nids ] = GetEntry(name);
+	    values[ nids ] = 0.0;
+	    nids++;
+	    free(name);
+	    break;
+
+	case HP_BIN_MARK:
+	    AddMark((floatish) GetVarint(infp) / 1e6);
+	    break;
+
+	case HP_BIN_SAMPLE:
+	    time += GetSVarint(infp);
+	    if (time < 0 || (floatish) time / 1e6 < lastsample) {
+		Error("%s: samples out of sequence", hpfile);
+	    }
+	    lastsample = (floatish) time / 1e6;
+	    BeginSample(lastsample);
+
+	    n = GetVarint(infp);
+	    for (j = 0; j < n; j++) {
+		id = GetVarint(infp);
+		if (id >= (unsigned long long) nids) {
+		    Error("%s: undefined identifier in sample", hpfile);
+		}
+		values[ id ] += (floatish) GetSVarint(infp);
+	    }
+	    for (i = 0; i < nids; i++) {
+		if (values[ i ] != 0.0) {
+		    SampleValue(ids[ i ], values[ i ]);
+		}
+	    }
+	    EndSample();
+	    break;
+
+	default:
+	    Error("%s: unknown record %d in binary heap profile", hpfile, tag);
+	}
+    }
+
+    free(ids);
+    free(values);
 }
 
 
@@ -579,16 +1024,17 @@ MakeIdentTable(void)
     nidents = 0;
     for (i = 0; i < N_HASH; i++) {
         for (e = hashtable[ i ]; e; e = e->next) {
-	    nidents++;
+	    if (e->band == e) nidents++;
         }
     }
 
     identtable = (struct entry**) xmalloc(nidents * sizeof(struct entry*));
     j = 0;
 
+    /* only the bands chosen by -r, which is all of them without it */
     for (i = 0; i < N_HASH; i++) {
-        for (e = hashtable[ i ]; e; e = e->next, j++) {
-	    identtable[ j ] = e; 
+        for (e = hashtable[ i ]; e; e = e->next) {
+	    if (e->band == e) identtable[ j++ ] = e; 
         }
     }
 }
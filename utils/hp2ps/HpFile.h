@@ -40,7 +40,10 @@ struct chunk {
 struct entry {
     struct entry *next;
     struct chunk *chk;
+    struct chunk *last;                 /* the last chunk of chk */
     char   *name;
+    floatish total;                     /* sum of the values (-r) */
+    struct entry *band;                 /* where the values go (-r) */
 };
 
 extern char *theident;
@@ -55,6 +58,7 @@ extern int endfile;
 char *TokenToString PROTO((token));
 
 extern struct entry** identtable;
+extern struct entry* otherentry;
 
 extern floatish *samplemap;
 extern floatish *markmap;
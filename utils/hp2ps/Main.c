@@ -25,6 +25,8 @@ boolish yflag = 0; 	/* ignore marks				*/
 boolish bflag = 0; 	/* use a big title box			*/
 boolish sflag = 0;	/* use a small title box		*/
 int     mflag = 0;	/* max no. of bands displayed (default 20) */
+int     nflag = 0;	/* max no. of samples kept (default all) */
+boolish rflag = 0;	/* read the input twice, keeping only bands */
 boolish tflag = 0;	/* ignored threshold specified          */
 boolish cflag = 0;      /* colour output                        */
 
@@ -59,6 +61,7 @@ floatish areabelow;
 intish nsamples;
 intish nmarks;
 intish nidents;
+intish maxsamples = 0;
 
 floatish THRESHOLD_PERCENT = DEFAULT_THRESHOLD;
 int TWENTY = DEFAULT_TWENTY;
@@ -113,6 +116,17 @@ int main(int argc, char *argv[])
 	    case 'M':
 	        multipageflag++;
                 goto nextarg;
+	    case 'n':
+		nflag++;
+		maxsamples = atoi(*argv + 1);
+		if (maxsamples < 2)
+		    Usage(*argv-1);
+		// samples are merged in pairs
+		maxsamples += maxsamples & 1;
+		goto nextarg;
+	    case 'r':
+		rflag++;
+		goto nextarg;
 	    case 't':
 		tflag++;
 		THRESHOLD_PERCENT = (floatish) atof(*argv + 1);
@@ -44,6 +44,7 @@ typedef long int intish;
 extern intish nsamples;
 extern intish nmarks;
 extern intish nidents;
+extern intish maxsamples;
 
 extern floatish maxcombinedheight;
 extern floatish areabelow;
@@ -61,6 +62,8 @@ extern boolish yflag;
 extern boolish bflag;
 extern boolish sflag;
 extern int     mflag;
+extern int     nflag;
+extern boolish rflag;
 extern boolish tflag;
 extern boolish cflag;
 
@@ -30,6 +30,17 @@ TopTwenty(void)
     struct chunk* ch;
     floatish *other; 
 
+    if (otherentry) {
+	/* -r made "OTHER" while reading: it goes at the bottom */
+	for (i = 0; identtable[i] != otherentry; i++) {
+	}
+	for (; i > 0; i--) {
+	    identtable[i] = identtable[i-1];
+	}
+	identtable[0] = otherentry;
+	return;
+    }
+
     i = nidents;
     if (i <= TWENTY) return;	/* nothing to do! */
 
@@ -67,6 +67,12 @@ void TraceElement(void)
     }
 
 
+    /* with -r the trace elements were left out while reading */
+    if (rflag) {
+	free(totals);
+	return;
+    }
+
     /* find the grand total (NB: can get *BIG*!) */
 
     grandtotal = 0.0;